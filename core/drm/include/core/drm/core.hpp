@@ -4,6 +4,7 @@
 #include <map>
 #include <unordered_map>
 #include <optional>
+#include <span>
 #include <variant>
 
 #include <arch/mem_space.hpp>
@@ -32,6 +33,7 @@ namespace drm_core {
 struct Event {
 	uint64_t cookie;
 	uint32_t crtcId;
+	uint32_t sequence;
 	uint64_t timestamp;
 };
 
@@ -100,8 +102,18 @@ struct File {
 private:
 	void _retirePageFlip(uint64_t cookie, uint32_t crtc_id);
 
+	// Applies a DRM_MODE_ATOMIC_NONBLOCK commit once all earlier commits on its CRTCs
+	// have completed. The file might be closed in the meantime.
+	static async::detached _commitNonblocking(std::shared_ptr<Device> device,
+			std::weak_ptr<File *> file, std::vector<Assignment> assignments,
+			std::vector<std::shared_ptr<Crtc>> crtcs, std::vector<uint32_t> event_crtc_ids,
+			uint64_t cookie);
+
 	std::shared_ptr<Device> _device;
 
+	// Expires when the file is destroyed; see _commitNonblocking().
+	std::shared_ptr<File *> _self;
+
 	helix::UniqueDescriptor _memory;
 
 	std::vector<std::shared_ptr<FrameBuffer>> _frameBuffers;
@@ -193,8 +205,18 @@ drm_mode_modeinfo makeModeInfo(const char *name, uint32_t type,
 void addDmtModes(std::vector<drm_mode_modeinfo> &supported_modes,
 		unsigned int max_width, unsigned max_height);
 
+// Clips damage rectangles (e.g., from DIRTYFB or FB_DAMAGE_CLIPS) to the given area
+// and drops empty ones. An empty list of clips means that the whole area is damaged.
+std::vector<drm_mode_rect> clipDamage(std::span<const drm_mode_rect> clips,
+		const drm_mode_rect &area);
+
 // Copies 16-byte aligned buffers. Expected to be faster than plain memcpy().
 extern "C" void fastCopy16(void *, const void *, size_t);
 
+// Convert a row of XRGB8888 pixels to RGB565 and RGB888 respectively.
+// There are no alignment requirements.
+void convertXrgb8888ToRgb565(void *dest, const void *src, size_t pixels);
+void convertXrgb8888ToRgb888(void *dest, const void *src, size_t pixels);
+
 } //namespace drm_core
 
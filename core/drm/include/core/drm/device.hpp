@@ -32,6 +32,9 @@ public:
 			uint32_t height, uint32_t bpp) = 0;
 	virtual std::shared_ptr<FrameBuffer> createFrameBuffer(std::shared_ptr<BufferObject> buff,
 			uint32_t width, uint32_t height, uint32_t format, uint32_t pitch) = 0;
+	// Wraps memory imported through a foreign PRIME fd into a BufferObject that can be used
+	// for FrameBuffers. Returns nullptr if the device cannot scan out of arbitrary memory.
+	virtual std::shared_ptr<BufferObject> importMemory(helix::UniqueDescriptor memory, size_t size);
 	//returns major, minor, patchlvl
 	virtual std::tuple<int, int, int> driverVersion() = 0;
 	//returns name, desc, date
@@ -102,6 +105,7 @@ private:
 	std::shared_ptr<Property> _crtcWProperty;
 	std::shared_ptr<Property> _crtcHProperty;
 	std::shared_ptr<Property> _inFormatsProperty;
+	std::shared_ptr<Property> _fbDamageClipsProperty;
 
 	std::map<std::array<char, 16>, std::shared_ptr<drm_core::BufferObject>> _exportedBufferObjects;
 
@@ -146,6 +150,7 @@ public:
 	Property *crtcWProperty();
 	Property *crtcHProperty();
 	Property *inFormatsProperty();
+	Property *fbDamageClipsProperty();
 };
 
 } //namespace drm_core
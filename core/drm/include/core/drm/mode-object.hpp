@@ -1,5 +1,6 @@
 #pragma once
 
+#include <async/mutex.hpp>
 #include <core/id-allocator.hpp>
 #include <libdrm/drm_fourcc.h>
 
@@ -127,10 +128,21 @@ public:
 
 	std::vector<drm_core::Assignment> getAssignments(std::shared_ptr<Device> dev);
 
+	// Returns the sequence number for the next completed flip on this CRTC.
+	uint32_t nextFlipSequence();
+
+	// Commits that affect this CRTC hold this mutex until they complete,
+	// such that they are applied in the order in which they were submitted.
+	async::mutex &commitMutex() {
+		return _commitMutex;
+	}
+
 	int index;
 
 private:
 	std::shared_ptr<CrtcState> _drmState;
+	uint32_t _flipSequence = 0;
+	async::mutex _commitMutex;
 };
 
 /**
@@ -230,7 +242,8 @@ public:
 	uint32_t format();
 	void setFormat(uint32_t format);
 
-	virtual void notifyDirty() = 0;
+	// Called for DRM_IOCTL_MODE_DIRTYFB with the (clipped, non-empty) damaged regions.
+	virtual void notifyDirty(std::vector<drm_mode_rect> damage) = 0;
 	virtual uint32_t getWidth() = 0;
 	virtual uint32_t getHeight() = 0;
 };
@@ -289,6 +302,18 @@ struct PlaneState {
 	uint32_t src_h = 0;
 
 	std::shared_ptr<Blob> in_formats;
+
+	// Damage clips (an array of drm_mode_rect) and whether FB_ID was changed. Both only
+	// apply to a single commit, i.e., they are reset when the state is copied.
+	std::shared_ptr<Blob> fb_damage_clips;
+	bool fb_changed = false;
+
+	/**
+	 * Returns the regions of the framebuffer that need to be updated by this commit,
+	 * clipped to the source rectangle. This is the whole source rectangle unless the
+	 * commit carries damage clips for the framebuffer that is already shown.
+	 */
+	std::vector<drm_mode_rect> damage();
 };
 
 } //namespace drm_core
@@ -52,6 +52,7 @@ enum PropertyId {
 	crtcW,
 	crtcH,
 	inFormats,
+	fbDamageClips,
 };
 
 struct Property {
@@ -0,0 +1,65 @@
+#include <bit>
+#include <cstring>
+
+#include <core/drm/core.hpp>
+
+// The kernels below use the GCC vector extensions. These lower to SSE2 on x86_64 and
+// to NEON on aarch64; both are part of the baseline ISA, so no runtime dispatch is needed.
+
+namespace drm_core {
+
+namespace {
+
+using u8x16 = uint8_t __attribute__((vector_size(16)));
+using u16x8 = uint16_t __attribute__((vector_size(16)));
+using u32x4 = uint32_t __attribute__((vector_size(16)));
+
+template<typename T>
+T packRgb565(T p) {
+	return ((p >> 8) & 0xF800) | ((p >> 5) & 0x07E0) | ((p >> 3) & 0x001F);
+}
+
+} // anonymous namespace
+
+void convertXrgb8888ToRgb565(void *dest, const void *src, size_t pixels) {
+	auto d = static_cast<char *>(dest);
+	auto s = static_cast<const char *>(src);
+
+	size_t i = 0;
+	for(; i + 8 <= pixels; i += 8) {
+		u32x4 lo, hi;
+		memcpy(&lo, s + i * 4, 16);
+		memcpy(&hi, s + i * 4 + 16, 16);
+		auto out = __builtin_shufflevector(std::bit_cast<u16x8>(packRgb565(lo)),
+				std::bit_cast<u16x8>(packRgb565(hi)), 0, 2, 4, 6, 8, 10, 12, 14);
+		memcpy(d + i * 2, &out, 16);
+	}
+
+	for(; i < pixels; i++) {
+		uint32_t p;
+		memcpy(&p, s + i * 4, 4);
+		uint16_t out = packRgb565(p);
+		memcpy(d + i * 2, &out, 2);
+	}
+}
+
+void convertXrgb8888ToRgb888(void *dest, const void *src, size_t pixels) {
+	auto d = static_cast<char *>(dest);
+	auto s = static_cast<const char *>(src);
+
+	// Drop the X byte of each pixel. Each store writes 4 bytes past the 4 converted
+	// pixels, so the vector loop has to stop two pixels before the end of the row.
+	size_t i = 0;
+	for(; i + 6 <= pixels; i += 4) {
+		u8x16 p;
+		memcpy(&p, s + i * 4, 16);
+		auto out = __builtin_shufflevector(p, p,
+				0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 15, 15, 15, 15);
+		memcpy(d + i * 3, &out, 16);
+	}
+
+	for(; i < pixels; i++)
+		memcpy(d + i * 3, s + i * 4, 3);
+}
+
+} // namespace drm_core
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <assert.h>
 #include <stdio.h>
 #include <deque>
@@ -30,6 +31,7 @@ drm_core::File::File(std::shared_ptr<Device> device)
 	HelHandle handle;
 	HEL_CHECK(helCreateIndirectMemory(1024, &handle));
 	_memory = helix::UniqueDescriptor{handle};
+	_self = std::make_shared<File *>(this);
 
 	_statusPage.update(_eventSequence, 0);
 };
@@ -144,12 +146,12 @@ drm_core::File::read(void *object, const char *,
 
 	auto ev = &self->_pendingEvents.front();
 
-	// TODO: Support sequence number and CRTC id.
 	drm_event_vblank out;
 	memset(&out, 0, sizeof(drm_event_vblank));
 	out.base.type = DRM_EVENT_FLIP_COMPLETE;
 	out.base.length = sizeof(drm_event_vblank);
 	out.user_data = ev->cookie;
+	out.sequence = ev->sequence;
 	out.crtc_id = ev->crtcId;
 	out.tv_sec = ev->timestamp / 1000000000;
 	out.tv_usec = (ev->timestamp % 1000000000) / 1000;
@@ -203,6 +205,9 @@ void drm_core::File::_retirePageFlip(uint64_t cookie, uint32_t crtc_id) {
 	Event event;
 	event.cookie = cookie;
 	event.crtcId = crtc_id;
+	event.sequence = 0;
+	if(auto obj = _device->findObject(crtc_id); obj && obj->asCrtc())
+		event.sequence = obj->asCrtc()->nextFlipSequence();
 	postEvent(event);
 }
 
@@ -749,3 +754,21 @@ void drm_core::addDmtModes(std::vector<drm_mode_modeinfo> &supported_modes,
 	}
 }
 
+std::vector<drm_mode_rect> drm_core::clipDamage(std::span<const drm_mode_rect> clips,
+		const drm_mode_rect &area) {
+	if(clips.empty())
+		return {area};
+
+	std::vector<drm_mode_rect> damage;
+	for(auto &clip : clips) {
+		drm_mode_rect rect{
+			.x1 = std::max(clip.x1, area.x1),
+			.y1 = std::max(clip.y1, area.y1),
+			.x2 = std::min(clip.x2, area.x2),
+			.y2 = std::min(clip.y2, area.y2),
+		};
+		if(rect.x1 < rect.x2 && rect.y1 < rect.y2)
+			damage.push_back(rect);
+	}
+	return damage;
+}
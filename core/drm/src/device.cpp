@@ -73,6 +73,11 @@ std::unique_ptr<drm_core::AtomicState> drm_core::Device::atomicState() {
 	return std::make_unique<drm_core::AtomicState>(state);
 }
 
+std::shared_ptr<drm_core::BufferObject>
+drm_core::Device::importMemory(helix::UniqueDescriptor, size_t) {
+	return nullptr;
+}
+
 /**
  * Adds a (credentials, BufferObject) pair to the list of exported BOs for this device
  */
@@ -185,6 +190,10 @@ drm_core::Property *drm_core::Device::inFormatsProperty() {
 	return _inFormatsProperty.get();
 }
 
+drm_core::Property *drm_core::Device::fbDamageClipsProperty() {
+	return _fbDamageClipsProperty.get();
+}
+
 void drm_core::Device::registerProperty(std::shared_ptr<drm_core::Property> p) {
 	_properties.insert({p->id(), p});
 }
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <libdrm/drm_fourcc.h>
 
 #include <bragi/helpers-std.hpp>
@@ -18,6 +20,62 @@ static constexpr auto primeFileOperations = protocols::fs::FileOperations{
 	.accessMemory = &drm_core::PrimeFile::accessMemory,
 };
 
+namespace {
+
+// Returns the CRTCs whose state is changed by a commit, ordered by their ids.
+std::vector<std::shared_ptr<Crtc>> affectedCrtcs(AtomicState &state) {
+	std::vector<std::shared_ptr<Crtc>> crtcs;
+	for(auto &[_, cs] : state.crtc_states())
+		crtcs.push_back(cs->crtc().lock());
+	for(auto &[_, ps] : state.plane_states()) {
+		// Planes can also move away from a CRTC.
+		if(ps->crtc)
+			crtcs.push_back(ps->crtc);
+		if(auto old = ps->plane->drmState(); old && old->crtc)
+			crtcs.push_back(old->crtc);
+	}
+
+	std::sort(crtcs.begin(), crtcs.end(), [] (auto &a, auto &b) {
+		return a->id() < b->id();
+	});
+	crtcs.erase(std::unique(crtcs.begin(), crtcs.end()), crtcs.end());
+	return crtcs;
+}
+
+// Waits for earlier commits on the given CRTCs, then captures the assignments against
+// the up-to-date state and commits them. The mutexes are taken in id order.
+async::result<void> applyCommit(std::shared_ptr<Device> device,
+		const std::vector<Assignment> &assignments,
+		const std::vector<std::shared_ptr<Crtc>> &crtcs) {
+	for(auto &crtc : crtcs)
+		co_await crtc->commitMutex().async_lock();
+
+	auto config = device->createConfiguration();
+	auto state = device->atomicState();
+	auto valid = config->capture(assignments, state);
+	assert(valid);
+	config->commit(std::move(state));
+	co_await config->waitForCompletion();
+
+	for(auto &crtc : crtcs)
+		crtc->commitMutex().unlock();
+}
+
+} // anonymous namespace
+
+}
+
+async::detached drm_core::File::_commitNonblocking(std::shared_ptr<Device> device,
+		std::weak_ptr<File *> file, std::vector<Assignment> assignments,
+		std::vector<std::shared_ptr<Crtc>> crtcs, std::vector<uint32_t> event_crtc_ids,
+		uint64_t cookie) {
+	co_await applyCommit(device, assignments, crtcs);
+
+	auto self = file.lock();
+	if(!self)
+		co_return;
+	for(auto id : event_crtc_ids)
+		(*self)->_retirePageFlip(cookie, id);
 }
 
 async::result<void>
@@ -518,26 +576,25 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 				std::cout << "core/drm: PAGE_FLIP()" << std::endl;
 
 			auto obj = self->_device->findObject(req->drm_crtc_id());
-			assert(obj);
-			auto crtc = obj->asCrtc();
-			assert(crtc);
-
-			std::vector<drm_core::Assignment> assignments;
-
+			auto crtc = obj ? obj->asCrtc() : nullptr;
 			auto fb = self->_device->findObject(req->drm_fb_id());
-			assert(fb);
-			assignments.push_back(Assignment::withModeObj(crtc->primaryPlane()->sharedModeObject(), self->_device->fbIdProperty(), fb));
 
-			auto config = self->_device->createConfiguration();
-			auto state = self->_device->atomicState();
-			auto valid = config->capture(assignments, state);
-			assert(valid);
-			config->commit(std::move(state));
+			// Flips always complete synchronously, so DRM_MODE_PAGE_FLIP_ASYNC
+			// and the target flags are not supported.
+			if(!crtc || !fb || !fb->asFrameBuffer()
+					|| (req->drm_flags() & ~uint32_t{DRM_MODE_PAGE_FLIP_EVENT})) {
+				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			}else{
+				std::vector<drm_core::Assignment> assignments;
+				assignments.push_back(Assignment::withModeObj(crtc->primaryPlane()->sharedModeObject(), self->_device->fbIdProperty(), fb));
 
-			co_await config->waitForCompletion();
-			self->_retirePageFlip(req->drm_cookie(), crtc->id());
+				co_await applyCommit(self->_device, assignments,
+						{std::static_pointer_cast<Crtc>(crtc->sharedModeObject())});
+				if(req->drm_flags() & DRM_MODE_PAGE_FLIP_EVENT)
+					self->_retirePageFlip(req->drm_cookie(), crtc->id());
 
-			resp.set_error(managarm::fs::Errors::SUCCESS);
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+			}
 
 			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
@@ -554,12 +611,21 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 
 			auto obj = self->_device->findObject(req->drm_fb_id());
-			if(!obj) {
+			if(!obj || req->drm_clips().size() > DRM_MODE_FB_DIRTY_MAX_CLIPS) {
 				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
 			} else {
 				auto fb = obj->asFrameBuffer();
 				assert(fb);
-				fb->notifyDirty();
+
+				std::vector<drm_mode_rect> clips;
+				for(auto &clip : req->drm_clips())
+					clips.push_back({clip.x1(), clip.y1(), clip.x2(), clip.y2()});
+
+				drm_mode_rect area{0, 0, static_cast<int32_t>(fb->getWidth()),
+						static_cast<int32_t>(fb->getHeight())};
+				auto damage = clipDamage(clips, area);
+				if(!damage.empty())
+					fb->notifyDirty(std::move(damage));
 			}
 
 			auto ser = resp.SerializeAsString();
@@ -1016,15 +1082,21 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 			if(!(req->drm_flags() & DRM_MODE_ATOMIC_TEST_ONLY)) {
 				if(logDrmRequests)
 					std::cout << "\tCommitting configuration ..." << std::endl;
-				config->commit(std::move(state));
-				co_await config->waitForCompletion();
-			}
 
-			if(req->drm_flags() & DRM_MODE_PAGE_FLIP_EVENT) {
-				co_await config->waitForCompletion();
+				// The state above only validates the commit; it is captured again
+				// once earlier commits on the same CRTCs have been applied.
+				auto crtcs = affectedCrtcs(*state);
+				if(!(req->drm_flags() & DRM_MODE_PAGE_FLIP_EVENT))
+					crtc_ids.clear();
+
+				if(req->drm_flags() & DRM_MODE_ATOMIC_NONBLOCK) {
+					_commitNonblocking(self->_device, self->_self, std::move(assignments),
+							std::move(crtcs), std::move(crtc_ids), req->drm_cookie());
+				}else{
+					co_await applyCommit(self->_device, assignments, crtcs);
 
-				for(auto id : crtc_ids) {
-					self->_retirePageFlip(req->drm_cookie(), id);
+					for(auto id : crtc_ids)
+						self->_retirePageFlip(req->drm_cookie(), id);
 				}
 			}
 
@@ -1118,6 +1190,49 @@ drm_core::File::ioctl(void *object, uint32_t id, helix_ng::RecvInlineResult msg,
 			std::copy_n(creds.credentials(), 16, std::begin(credentials));
 			auto [bo, handle] = self->importBufferObject(credentials);
 
+			if(!bo) {
+				// The fd was not exported by this device (e.g., it belongs to another DRM
+				// device or to a memfd). Ask POSIX for its memory and let the driver wrap it,
+				// such that it can be scanned out without copying.
+				managarm::posix::CntRequest mem_req;
+				mem_req.set_request_type(managarm::posix::CntReqType::FD_ACCESS_MEMORY);
+				for(size_t i = 0; i < 16; i++)
+					mem_req.add_passthrough_credentials(credentials[i]);
+
+				auto mem_ser = mem_req.SerializeAsString();
+				auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(
+					self->_device->_posixLane,
+					helix_ng::offer(
+						helix_ng::sendBuffer(mem_ser.data(), mem_ser.size()),
+						helix_ng::recvInline())
+				);
+				HEL_CHECK(offer.error());
+				HEL_CHECK(send_req.error());
+				HEL_CHECK(recv_resp.error());
+
+				managarm::posix::SvrResponse posix_resp;
+				posix_resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+				recv_resp.reset();
+
+				if(posix_resp.error() == managarm::posix::Errors::SUCCESS) {
+					auto [pull_memory] = co_await helix_ng::exchangeMsgs(
+						offer.descriptor(),
+						helix_ng::pullDescriptor()
+					);
+					HEL_CHECK(pull_memory.error());
+
+					size_t size;
+					HEL_CHECK(helMemoryInfo(pull_memory.descriptor().getHandle(), &size));
+
+					auto imported = self->_device->importMemory(pull_memory.descriptor(), size);
+					if(imported) {
+						// Remember the BO such that importing the same fd again yields the same handle.
+						self->_device->registerBufferObject(imported, credentials);
+						std::tie(bo, handle) = self->importBufferObject(credentials);
+					}
+				}
+			}
+
 			if(bo) {
 				resp.set_error(managarm::fs::Errors::SUCCESS);
 				resp.set_drm_prime_handle(handle);
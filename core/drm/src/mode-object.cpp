@@ -147,6 +147,10 @@ void drm_core::Crtc::setDrmState(std::shared_ptr<drm_core::CrtcState> new_state)
 	_drmState = new_state;
 }
 
+uint32_t drm_core::Crtc::nextFlipSequence() {
+	return ++_flipSequence;
+}
+
 std::vector<drm_core::Assignment> drm_core::Crtc::getAssignments(std::shared_ptr<drm_core::Device> dev) {
 	std::vector<drm_core::Assignment> assignments = std::vector<drm_core::Assignment>();
 
@@ -249,6 +253,7 @@ std::vector<drm_core::Assignment> drm_core::Plane::getAssignments(std::shared_pt
 	assignments.push_back(drm_core::Assignment::withInt(this->sharedModeObject(), dev->crtcYProperty(), drmState()->crtc_y));
 	assignments.push_back(drm_core::Assignment::withModeObj(this->sharedModeObject(), dev->fbIdProperty(), drmState()->fb));
 	assignments.push_back(drm_core::Assignment::withBlob(this->sharedModeObject(), dev->inFormatsProperty(), drmState()->in_formats));
+	assignments.push_back(drm_core::Assignment::withBlob(this->sharedModeObject(), dev->fbDamageClipsProperty(), drmState()->fb_damage_clips));
 
 	return assignments;
 }
@@ -257,6 +262,24 @@ drm_core::Plane::PlaneType drm_core::PlaneState::type(void) {
 	return plane->type();
 }
 
+std::vector<drm_mode_rect> drm_core::PlaneState::damage() {
+	drm_mode_rect area{
+		.x1 = static_cast<int32_t>(src_x),
+		.y1 = static_cast<int32_t>(src_y),
+		.x2 = static_cast<int32_t>(src_x + src_w),
+		.y2 = static_cast<int32_t>(src_y + src_h),
+	};
+
+	if(fb_changed || !fb_damage_clips)
+		return {area};
+
+	std::span<const drm_mode_rect> clips{
+		reinterpret_cast<const drm_mode_rect *>(fb_damage_clips->data()),
+		fb_damage_clips->size() / sizeof(drm_mode_rect)
+	};
+	return clipDamage(clips, area);
+}
+
 // ----------------------------------------------------------------
 // Connector
 // ----------------------------------------------------------------
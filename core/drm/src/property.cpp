@@ -118,6 +118,8 @@ std::shared_ptr<drm_core::PlaneState> drm_core::AtomicState::plane(uint32_t id)
 		auto plane = _device->findObject(id)->asPlane();
 		assert(plane->drmState());
 		auto plane_state = PlaneState(*plane->drmState());
+		plane_state.fb_damage_clips = nullptr;
+		plane_state.fb_changed = false;
 		auto plane_state_shared = std::make_shared<drm_core::PlaneState>(plane_state);
 		_planeStates.insert({id, plane_state_shared});
 		return plane_state_shared;
@@ -206,7 +208,9 @@ drm_core::Device::Device() {
 
 		void writeToState(const Assignment assignment, std::unique_ptr<AtomicState> &state) override {
 			assert(!assignment.objectValue || assignment.objectValue->type() == ObjectType::frameBuffer);
-			state->plane(assignment.object->id())->fb = static_pointer_cast<FrameBuffer>(assignment.objectValue);
+			auto plane_state = state->plane(assignment.object->id());
+			plane_state->fb_changed = assignment.objectValue != plane_state->plane->drmState()->fb;
+			plane_state->fb = static_pointer_cast<FrameBuffer>(assignment.objectValue);
 			state->plane(assignment.object->id())->plane->setCurrentFrameBuffer(static_pointer_cast<FrameBuffer>(assignment.objectValue).get());
 		}
 
@@ -429,4 +433,21 @@ drm_core::Device::Device() {
 		}
 	};
 	registerProperty(_inFormatsProperty = std::make_shared<InFormatsProperty>());
+
+	struct FbDamageClipsProperty : drm_core::Property {
+		FbDamageClipsProperty()
+		: drm_core::Property(fbDamageClips, BlobProperty{}, "FB_DAMAGE_CLIPS", DRM_MODE_PROP_ATOMIC) { }
+
+		bool validate(const Assignment& assignment) override {
+			if(!assignment.blobValue)
+				return true;
+
+			return !(assignment.blobValue->size() % sizeof(drm_mode_rect));
+		}
+
+		void writeToState(const Assignment assignment, std::unique_ptr<AtomicState> &state) override {
+			state->plane(assignment.object->id())->fb_damage_clips = assignment.blobValue;
+		}
+	};
+	registerProperty(_fbDamageClipsProperty = std::make_shared<FbDamageClipsProperty>());
 }
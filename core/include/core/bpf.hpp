@@ -6,6 +6,7 @@
 #include <cstdio>
 #include <linux/filter.h>
 #include <span>
+#include <vector>
 
 constexpr bool logBpfOps = false;
 
@@ -30,19 +31,30 @@ struct Bpf {
 	Bpf(std::span<char> fprog)
 		: prog_{
 			reinterpret_cast<struct sock_filter *>(fprog.data()),
-			fprog.size() / sizeof(struct sock_filter)
+			reinterpret_cast<struct sock_filter *>(fprog.data()) + fprog.size() / sizeof(struct sock_filter)
 		} {
 
 	}
 
+	// Checks the program and translates it into the threaded code that run() executes.
+	// Must succeed before run() is called.
 	bool validate();
 
-	uint32_t run(arch::dma_buffer_view buffer);
+	uint32_t run(arch::dma_buffer_view buffer) const;
 private:
-	std::span<struct sock_filter> prog_;
+	// Pre-decoded instruction. handler points into the dispatch table of execute_()
+	// and jump targets are absolute instruction indices.
+	struct Insn {
+		const void *handler;
+		uint32_t k;
+		uint32_t jt;
+		uint32_t jf;
+	};
+
+	// Returns the dispatch table if code is null.
+	static uint32_t execute_(const Insn *code, size_t size, arch::dma_buffer_view buffer,
+			const void *const **table);
 
-	// accumulator register
-	uint32_t A = 0;
-	// index register
-	uint32_t X = 0;
+	std::vector<struct sock_filter> prog_;
+	std::vector<Insn> code_;
 };
@@ -0,0 +1,79 @@
+#pragma once
+
+// ----------------------------------------------------------------
+// Slab allocator for DMA buffers
+// ----------------------------------------------------------------
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <arch/dma_pool.hpp>
+
+namespace core {
+
+// DMA pool that serves allocations from per-size-class free lists.
+// Buffers are carved from physically contiguous chunks that stay resident for the lifetime
+// of the pool. The physical address of each chunk is looked up once, such that neither
+// allocation nor dmaPhysical() needs a syscall once the pool is warmed up.
+// Like FramePool, the pool does not synchronize; it must only be used by a single thread.
+struct SlabDmaPool final : arch::dma_pool {
+	// Size classes are powers of two between these bounds.
+	static constexpr size_t minShift = 6;
+	static constexpr size_t maxShift = 14;
+	// Size of the chunks that small buffers are carved from.
+	static constexpr size_t chunkSize = size_t{64} << 10;
+
+	struct Statistics {
+		// Number of buffers that were allocated (including recycled ones).
+		uint64_t allocations = 0;
+		// Number of allocations that were served from a free list.
+		uint64_t recycled = 0;
+		// Number of chunks that were allocated from the kernel.
+		uint64_t chunks = 0;
+	};
+
+	SlabDmaPool(int addressBits = 64);
+
+	SlabDmaPool(const SlabDmaPool &) = delete;
+
+	SlabDmaPool &operator= (const SlabDmaPool &) = delete;
+
+	~SlabDmaPool() override;
+
+	void *allocate(size_t size, size_t count, size_t align) override;
+	void deallocate(void *pointer, size_t size, size_t count, size_t align) override;
+
+	const Statistics &statistics() const {
+		return stats_;
+	}
+
+private:
+	static constexpr size_t numClasses = maxShift - minShift + 1;
+
+	struct FreeBuffer {
+		FreeBuffer *next;
+	};
+
+	struct Chunk {
+		void *window;
+		size_t size;
+	};
+
+	static size_t classOf_(size_t size, size_t align);
+
+	// Allocates a new physically contiguous, mapped chunk.
+	void *allocateChunk_(size_t size);
+	void freeChunk_(void *window, size_t size);
+
+	int addressBits_;
+	FreeBuffer *freeLists_[numClasses] = {};
+	std::vector<Chunk> chunks_;
+	Statistics stats_;
+};
+
+// Returns the physical address of a DMA buffer.
+// For buffers from a SlabDmaPool, this does not involve a syscall.
+uintptr_t dmaPhysical(const void *pointer);
+
+} // namespace core
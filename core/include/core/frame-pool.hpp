@@ -0,0 +1,143 @@
+#pragma once
+
+// ----------------------------------------------------------------
+// Recycling allocator for coroutine frames
+// ----------------------------------------------------------------
+
+#include <coroutine>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <async/result.hpp>
+
+namespace core {
+
+// Caches freed coroutine frames in per-thread free lists that are keyed by the frame size
+// (rounded up to the granularity). Servers run one helix::Dispatcher per thread, so the
+// cache is effectively per dispatcher and does not need any synchronization.
+// Frames that are freed on a different thread than the one that allocated them
+// simply migrate to the cache of the freeing thread.
+struct FramePool {
+	static constexpr size_t granularity = 64;
+	// Larger frames are rare; they bypass the cache.
+	static constexpr size_t maxPooledSize = 4096;
+	// Upper bound on the number of cached frames per size class.
+	static constexpr size_t maxCachedFrames = 256;
+
+	struct Statistics {
+		// Number of frames that were allocated (including recycled ones).
+		uint64_t allocations = 0;
+		// Number of allocations that were served from the cache.
+		uint64_t recycled = 0;
+		// Number of frames that were freed.
+		uint64_t frees = 0;
+		// Number of frames that are currently in the cache.
+		uint64_t cached = 0;
+	};
+
+	static FramePool &get() {
+		thread_local FramePool pool;
+		return pool;
+	}
+
+	FramePool() = default;
+
+	FramePool(const FramePool &) = delete;
+
+	FramePool &operator= (const FramePool &) = delete;
+
+	~FramePool() {
+		for(size_t k = 0; k < numClasses; ++k) {
+			while(freeLists_[k]) {
+				auto frame = freeLists_[k];
+				freeLists_[k] = frame->next;
+				::operator delete(frame, (k + 1) * granularity);
+			}
+		}
+	}
+
+	void *allocate(size_t size) {
+		stats_.allocations++;
+		if(size > maxPooledSize)
+			return ::operator new(size);
+
+		auto k = classOf_(size);
+		if(auto frame = freeLists_[k]) {
+			freeLists_[k] = frame->next;
+			numCached_[k]--;
+			stats_.recycled++;
+			stats_.cached--;
+			return frame;
+		}
+		return ::operator new((k + 1) * granularity);
+	}
+
+	void deallocate(void *p, size_t size) {
+		stats_.frees++;
+		if(size > maxPooledSize) {
+			::operator delete(p, size);
+			return;
+		}
+
+		auto k = classOf_(size);
+		if(numCached_[k] == maxCachedFrames) {
+			::operator delete(p, (k + 1) * granularity);
+			return;
+		}
+		auto frame = new (p) FreeFrame{freeLists_[k]};
+		freeLists_[k] = frame;
+		numCached_[k]++;
+		stats_.cached++;
+	}
+
+	const Statistics &statistics() const {
+		return stats_;
+	}
+
+private:
+	static constexpr size_t numClasses = maxPooledSize / granularity;
+
+	struct FreeFrame {
+		FreeFrame *next;
+	};
+
+	static size_t classOf_(size_t size) {
+		return (size + granularity - 1) / granularity - 1;
+	}
+
+	FreeFrame *freeLists_[numClasses] = {};
+	size_t numCached_[numClasses] = {};
+	Statistics stats_;
+};
+
+// Wraps the promise type of a coroutine type to allocate frames from the FramePool.
+template<typename Promise>
+struct PooledPromise : Promise {
+	using Promise::Promise;
+
+	static void *operator new(size_t size) {
+		return FramePool::get().allocate(size);
+	}
+
+	static void operator delete(void *p, size_t size) {
+		FramePool::get().deallocate(p, size);
+	}
+};
+
+} // namespace core
+
+// Including this header makes all async::result and async::detached coroutines that are
+// defined afterwards use the FramePool. To avoid mixing pooled and non-pooled definitions of
+// the same coroutine, users should include this header in all translation units of a target
+// (e.g., by passing -include core/frame-pool.hpp).
+
+template<typename T, typename... Args>
+struct std::coroutine_traits<async::result<T>, Args...> {
+	using promise_type = core::PooledPromise<typename async::result<T>::promise_type>;
+};
+
+template<typename... Args>
+struct std::coroutine_traits<async::detached, Args...> {
+	using promise_type = core::PooledPromise<async::detached::promise_type>;
+};
@@ -31,6 +31,13 @@ struct Packet {
 
 struct NetlinkFile {
 	virtual void deliver(core::netlink::Packet packet) = 0;
+
+	// Delivers multiple packets at once. Sockets can override this to avoid
+	// waking up readers once per packet.
+	virtual void deliverBatch(const std::vector<core::netlink::Packet> &packets) {
+		for(auto &packet : packets)
+			deliver(packet);
+	}
 };
 
 struct Group {
@@ -42,6 +49,12 @@ struct Group {
 			socket->deliver(packet);
 	}
 
+	// Like carbonCopy() but for multiple messages (which are delivered in order).
+	void carbonCopyBatch(const std::vector<core::netlink::Packet> &packets) {
+		for(auto socket : subscriptions)
+			socket->deliverBatch(packets);
+	}
+
 	std::vector<NetlinkFile *> subscriptions;
 };
 
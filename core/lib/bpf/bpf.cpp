@@ -1,137 +1,215 @@
 #include <arch/bit.hpp>
 #include <core/bpf.hpp>
+#include <cstring>
+
+namespace {
+
+// Order of the dispatch table in Bpf::execute_().
+enum Handler {
+	aluAddX,
+	aluAndK,
+	aluMulK,
+	jmpJeqK,
+	jmpJsetK,
+	ldxWImm,
+	ldBInd,
+	ldHAbs,
+	ldHInd,
+	ldWAbs,
+	ldWInd,
+	miscTax,
+	retA,
+	retK,
+	numHandlers
+};
+
+// Classic BPF programs are limited to BPF_MAXINSNS instructions on Linux.
+constexpr size_t maxInstructions = 4096;
+
+// Loads a big endian value from the packet. Fails if the load is out of bounds.
+template<typename T>
+bool load(arch::dma_buffer_view buffer, size_t offset, uint32_t &value) {
+	if(offset > buffer.size() || buffer.size() - offset < sizeof(T)) {
+		if(logBpfOps)
+			printf("core/bpf: read of size 0x%zx at offset 0x%zx is out of bounds (buffer size 0x%zx)\n",
+				sizeof(T), offset, buffer.size());
+		return false;
+	}
+	T raw;
+	memcpy(&raw, buffer.byte_data() + offset, sizeof(T));
+	value = arch::convert_endian<arch::endian::big>(raw);
+	return true;
+}
+
+} // anonymous namespace
 
 bool Bpf::validate() {
+	if(prog_.empty() || prog_.size() > maxInstructions)
+		return false;
+
+	Op last = Op(prog_.back().code);
+	if(last != Op::RET_K && last != Op::RET_A)
+		return false;
+
+	const void *const *table;
+	execute_(nullptr, 0, {}, &table);
+
+	code_.clear();
+	code_.reserve(prog_.size());
 	for(size_t pc = 0; pc < prog_.size(); pc++) {
 		auto inst = prog_[pc];
+		Insn insn{nullptr, inst.k, 0, 0};
 
+		Handler handler;
 		switch(Op(inst.code)) {
-			case Op::JMP_JEQ_K:
-			// case Op::JMP_JEQ_X:
-			// case Op::JMP_JGE_K:
-			// case Op::JMP_JGE_X:
-			// case Op::JMP_JGT_K:
-			// case Op::JMP_JGT_X:
-			case Op::JMP_JSET_K:
-			// case Op::JMP_JSET_X:
-				if(pc + inst.jt + 1 >= prog_.size() || pc + inst.jf + 1 >= prog_.size())
-					return false;
-				break;
+			case Op::ALU_ADD_X: handler = aluAddX; break;
+			case Op::ALU_AND_K: handler = aluAndK; break;
+			case Op::ALU_MUL_K: handler = aluMulK; break;
+			case Op::JMP_JEQ_K: handler = jmpJeqK; break;
+			case Op::JMP_JSET_K: handler = jmpJsetK; break;
+			case Op::LDX_W_IMM: handler = ldxWImm; break;
+			case Op::LD_B_IND: handler = ldBInd; break;
+			case Op::LD_H_ABS: handler = ldHAbs; break;
+			case Op::LD_H_IND: handler = ldHInd; break;
+			case Op::LD_W_ABS: handler = ldWAbs; break;
+			case Op::LD_W_IND: handler = ldWInd; break;
+			case Op::MISC_TAX: handler = miscTax; break;
+			case Op::RET_A: handler = retA; break;
+			case Op::RET_K: handler = retK; break;
 			default:
-				break;
+				// TODO: for now, an unknown BPF instruction is a hard failure as our coverage of
+				// the instruction set is quite incomplete. In the future, once that doesn't hold
+				// any more, we should do proper error handling here instead (e.g. return EINVAL).
+				printf("core: unhandled BPF instruction 0x%02x\n", inst.code);
+				printf("\t{ 0x%02x, %.2u, %.2u, 0x%08x }\n", inst.code, inst.jt, inst.jf, inst.k);
+				assert(!"unhandled BPF instruction");
+				return false;
 		}
-	}
 
-	Op last = Op(prog_.back().code);
-	if(last != Op::RET_K && last != Op::RET_A)
-		return false;
+		if(handler == jmpJeqK || handler == jmpJsetK) {
+			if(pc + inst.jt + 1 >= prog_.size() || pc + inst.jf + 1 >= prog_.size())
+				return false;
+			insn.jt = pc + inst.jt + 1;
+			insn.jf = pc + inst.jf + 1;
+		}
+
+		insn.handler = table[handler];
+		code_.push_back(insn);
+	}
 
 	return true;
 }
 
-uint32_t Bpf::run(arch::dma_buffer_view buffer) {
-	size_t pc = 0;
+uint32_t Bpf::run(arch::dma_buffer_view buffer) const {
+	assert(!code_.empty() && "Bpf::run() called without validate()");
+	return execute_(code_.data(), code_.size(), buffer, nullptr);
+}
+
+// Executes direct-threaded code: each handler jumps straight to the handler of the
+// next instruction, so there is no central dispatch and no decoding per packet.
+// validate() guarantees that all jumps stay in bounds and that the program ends
+// with a return.
+uint32_t Bpf::execute_(const Insn *code, size_t size, arch::dma_buffer_view buffer,
+		const void *const **table) {
+	// Indexed by Handler.
+	static const void *const handlers[numHandlers] = {
+		&&alu_add_x,
+		&&alu_and_k,
+		&&alu_mul_k,
+		&&jmp_jeq_k,
+		&&jmp_jset_k,
+		&&ldx_w_imm,
+		&&ld_b_ind,
+		&&ld_h_abs,
+		&&ld_h_ind,
+		&&ld_w_abs,
+		&&ld_w_ind,
+		&&misc_tax,
+		&&ret_a,
+		&&ret_k,
+	};
+
+	if(!code) {
+		*table = handlers;
+		return 0;
+	}
+
+	// accumulator register
+	uint32_t A = 0;
+	// index register
+	uint32_t X = 0;
+
+	const Insn *ip = code;
 
-	auto bpf_log_op = [&pc, this](const char *format, auto ...args) {
+	auto bpf_log_op = [&ip, code, size](const char *format, auto ...args) {
 		if(logBpfOps) {
-			printf("\t[%.2zu/%.2zu] ", pc, prog_.size() - 1);
+			printf("\t[%.2zu/%.2zu] ", size_t(ip - code), size - 1);
 			printf(format, args...);
 			puts("");
 		}
 	};
 
-	for(pc = 0; pc < prog_.size(); pc++) {
-		auto inst = prog_[pc];
+#define DISPATCH_NEXT() goto *(++ip)->handler
+#define DISPATCH_JUMP(target) do { ip = code + (target); goto *ip->handler; } while(0)
+// Packets that are too short for a load are rejected (as on Linux).
+#define LOAD_OR_REJECT(T, offset) do { if(!load<T>(buffer, (offset), A)) return 0; } while(0)
 
-		auto load = [&buffer]<typename T>(size_t offset) -> T {
-			if(!(offset + sizeof(T) <= buffer.size())) {
-				printf("core/bpf: read of size 0x%zx at offset 0x%zx would be out of bounds (buffer size 0x%zx)",
-					sizeof(T), offset, buffer.size());
-				assert(offset + sizeof(T) <= buffer.size());
-			}
-			return arch::convert_endian<arch::endian::big>(*reinterpret_cast<T *>(buffer.subview(offset, sizeof(T)).data()));
-		};
+	goto *ip->handler;
 
-		switch(Op(inst.code)) {
-			case Op::ALU_ADD_X: {
-				bpf_log_op("A (0x%x) += X (0x%x) = 0x%x", A, X, A * X);
-				A += X;
-				break;
-			}
-			case Op::ALU_AND_K: {
-				bpf_log_op("A (0x%x) &= k (0x%x) = 0x%x", A, inst.k, A & inst.k);
-				A &= inst.k;
-				break;
-			}
-			case Op::ALU_MUL_K: {
-				bpf_log_op("A (0x%x) *= k (0x%x) = 0x%x", A, inst.k, A * inst.k);
-				A *= inst.k;
-				break;
-			}
-			case Op::JMP_JEQ_K: {
-				bpf_log_op("PC += 0x%02x if A == K (0x%x == 0x%x) else 0x%02x (0x%02x)", inst.jt, A, inst.k, inst.jf, (A == inst.k) ? inst.jt : inst.jf);
-				pc += (A == inst.k) ? inst.jt : inst.jf;
-				break;
-			}
-			case Op::JMP_JSET_K: {
-				bpf_log_op("PC += 0x%02x if A & k (0x%x & 0x%x) else 0x%02x (0x%02x)", inst.jt, A, inst.k, inst.jf, (A & inst.k) ? inst.jt : inst.jf);
-				pc += (A & inst.k) ? inst.jt : inst.jf;
-				break;
-			}
-			case Op::LDX_W_IMM: {
-				bpf_log_op("X <- k (0x%02x)", inst.k);
-				X = inst.k;
-				break;
-			}
-			case Op::LD_B_IND: {
-				auto val = load.template operator()<uint8_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:1 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
-				break;
-			}
-			case Op::LD_H_ABS: {
-				auto val = load.template operator()<uint16_t>(inst.k);
-				bpf_log_op("A <- P[k:2 (0x%02x)] = 0x%hx", inst.k, val);
-				A = val;
-				break;
-			}
-			case Op::LD_H_IND: {
-				auto val = load.template operator()<uint16_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:2 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
-				break;
-			}
-			case Op::LD_W_ABS: {
-				auto val = load.template operator()<uint32_t>(inst.k);
-				bpf_log_op("A <- P[k:4 (0x%04x)] = 0x%x", inst.k, val);
-				A = val;
-				break;
-			}
-			case Op::LD_W_IND: {
-				auto val = load.template operator()<uint32_t>(X + inst.k);
-				bpf_log_op("A <- P[X+k:4 (0x%02x + 0x%02x)] (0x%hx)", X, inst.k, val);
-				A = val;
-				break;
-			}
-			case Op::MISC_TAX: {
-				bpf_log_op("X <- A (0x%02x)", A);
-				X = A;
-				break;
-			}
-			case Op::RET_K: {
-				bpf_log_op("RET k (0x%02x)", inst.k);
-				return inst.k;
-			}
-			default:
-				// TODO: for now, an unknown BPF instruction is a hard failure as our coverage of
-				// the instruction set is quite incomplete. In the future, once that doesn't hold
-				// any more, we should do proper error handling here instead (e.g. return EINVAL).
-				printf("core: unhandled BPF instruction 0x%02x\n", inst.code);
-				bpf_log_op("{ 0x%02x, %.2u, %.2u, 0x%08x }\n", inst.code, inst.jt, inst.jf, inst.k);
-				assert(!"unhandled BPF instruction");
-		}
-
-	}
+alu_add_x:
+	bpf_log_op("A (0x%x) += X (0x%x) = 0x%x", A, X, A + X);
+	A += X;
+	DISPATCH_NEXT();
+alu_and_k:
+	bpf_log_op("A (0x%x) &= k (0x%x) = 0x%x", A, ip->k, A & ip->k);
+	A &= ip->k;
+	DISPATCH_NEXT();
+alu_mul_k:
+	bpf_log_op("A (0x%x) *= k (0x%x) = 0x%x", A, ip->k, A * ip->k);
+	A *= ip->k;
+	DISPATCH_NEXT();
+jmp_jeq_k:
+	bpf_log_op("PC = 0x%02x if A == K (0x%x == 0x%x) else 0x%02x", ip->jt, A, ip->k, ip->jf);
+	DISPATCH_JUMP((A == ip->k) ? ip->jt : ip->jf);
+jmp_jset_k:
+	bpf_log_op("PC = 0x%02x if A & k (0x%x & 0x%x) else 0x%02x", ip->jt, A, ip->k, ip->jf);
+	DISPATCH_JUMP((A & ip->k) ? ip->jt : ip->jf);
+ldx_w_imm:
+	bpf_log_op("X <- k (0x%02x)", ip->k);
+	X = ip->k;
+	DISPATCH_NEXT();
+ld_b_ind:
+	LOAD_OR_REJECT(uint8_t, size_t{X} + ip->k);
+	bpf_log_op("A <- P[X+k:1 (0x%02x + 0x%02x)] (0x%hx)", X, ip->k, A);
+	DISPATCH_NEXT();
+ld_h_abs:
+	LOAD_OR_REJECT(uint16_t, ip->k);
+	bpf_log_op("A <- P[k:2 (0x%02x)] = 0x%hx", ip->k, A);
+	DISPATCH_NEXT();
+ld_h_ind:
+	LOAD_OR_REJECT(uint16_t, size_t{X} + ip->k);
+	bpf_log_op("A <- P[X+k:2 (0x%02x + 0x%02x)] (0x%hx)", X, ip->k, A);
+	DISPATCH_NEXT();
+ld_w_abs:
+	LOAD_OR_REJECT(uint32_t, ip->k);
+	bpf_log_op("A <- P[k:4 (0x%04x)] = 0x%x", ip->k, A);
+	DISPATCH_NEXT();
+ld_w_ind:
+	LOAD_OR_REJECT(uint32_t, size_t{X} + ip->k);
+	bpf_log_op("A <- P[X+k:4 (0x%02x + 0x%02x)] (0x%x)", X, ip->k, A);
+	DISPATCH_NEXT();
+misc_tax:
+	bpf_log_op("X <- A (0x%02x)", A);
+	X = A;
+	DISPATCH_NEXT();
+ret_a:
+	bpf_log_op("RET A (0x%02x)", A);
+	return A;
+ret_k:
+	bpf_log_op("RET k (0x%02x)", ip->k);
+	return ip->k;
 
-	assert(!"invalid BPF filter with no return!");
+#undef LOAD_OR_REJECT
+#undef DISPATCH_JUMP
+#undef DISPATCH_NEXT
 }
@@ -0,0 +1,128 @@
+#include <assert.h>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <new>
+
+#include <core/dma-pool.hpp>
+#include <hel.h>
+#include <hel-syscalls.h>
+
+namespace core {
+
+namespace {
+
+constexpr size_t pageSize = 0x1000;
+
+struct ChunkInfo {
+	size_t size;
+	uintptr_t physical;
+};
+
+// Chunks of all pools, indexed by their virtual address.
+// This is shared by all threads since buffers are passed between them.
+std::mutex chunkMutex;
+std::map<uintptr_t, ChunkInfo> allChunks;
+
+} // anonymous namespace
+
+SlabDmaPool::SlabDmaPool(int addressBits)
+: addressBits_{addressBits} { }
+
+SlabDmaPool::~SlabDmaPool() {
+	for(auto &chunk : chunks_)
+		freeChunk_(chunk.window, chunk.size);
+}
+
+size_t SlabDmaPool::classOf_(size_t size, size_t align) {
+	size_t shift = minShift;
+	while(shift <= maxShift && ((size_t{1} << shift) < size || (size_t{1} << shift) < align))
+		shift++;
+	return shift - minShift;
+}
+
+void *SlabDmaPool::allocate(size_t size, size_t count, size_t align) {
+	// Buffers are aligned to their size class; chunks are only page-aligned.
+	assert(align <= pageSize);
+	stats_.allocations++;
+
+	auto k = classOf_(size * count, align);
+	if(k >= numClasses)
+		return allocateChunk_((size * count + pageSize - 1) & ~(pageSize - 1));
+
+	if(auto buffer = freeLists_[k]) {
+		freeLists_[k] = buffer->next;
+		stats_.recycled++;
+		return buffer;
+	}
+
+	// Split a new chunk into buffers of this size class. Since the chunk is physically
+	// contiguous, buffers never cross a discontinuity in physical memory.
+	auto bufferSize = size_t{1} << (k + minShift);
+	auto window = static_cast<std::byte *>(allocateChunk_(chunkSize));
+	chunks_.push_back({window, chunkSize});
+	for(size_t offset = chunkSize - bufferSize; offset > 0; offset -= bufferSize) {
+		auto buffer = new (window + offset) FreeBuffer{freeLists_[k]};
+		freeLists_[k] = buffer;
+	}
+	return window;
+}
+
+void SlabDmaPool::deallocate(void *pointer, size_t size, size_t count, size_t align) {
+	auto k = classOf_(size * count, align);
+	if(k >= numClasses) {
+		freeChunk_(pointer, (size * count + pageSize - 1) & ~(pageSize - 1));
+		return;
+	}
+
+	auto buffer = new (pointer) FreeBuffer{freeLists_[k]};
+	freeLists_[k] = buffer;
+}
+
+void *SlabDmaPool::allocateChunk_(size_t size) {
+	HelAllocRestrictions restrictions{};
+	restrictions.addressBits = addressBits_;
+
+	HelHandle memory;
+	void *window;
+	HEL_CHECK(helAllocateMemory(size, kHelAllocContinuous, &restrictions, &memory));
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+			0, size, kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+
+	// Continuous memory is never evicted; hence, the physical address stays valid.
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(window, &physical));
+
+	std::lock_guard lock{chunkMutex};
+	allChunks.emplace(reinterpret_cast<uintptr_t>(window), ChunkInfo{size, physical});
+	stats_.chunks++;
+	return window;
+}
+
+void SlabDmaPool::freeChunk_(void *window, size_t size) {
+	{
+		std::lock_guard lock{chunkMutex};
+		allChunks.erase(reinterpret_cast<uintptr_t>(window));
+	}
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+}
+
+uintptr_t dmaPhysical(const void *pointer) {
+	auto address = reinterpret_cast<uintptr_t>(pointer);
+	{
+		std::lock_guard lock{chunkMutex};
+		auto it = allChunks.upper_bound(address);
+		if(it != allChunks.begin()) {
+			--it;
+			if(address - it->first < it->second.size)
+				return it->second.physical + (address - it->first);
+		}
+	}
+
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(pointer, &physical));
+	return physical;
+}
+
+} // namespace core
@@ -59,6 +59,14 @@ enum {
 	PCI_L_DEVICE_SPECIFIC = 20
 };
 
+// Device-independent feature bits.
+enum {
+	VIRTIO_RING_F_INDIRECT_DESC = 28,
+	VIRTIO_RING_F_EVENT_IDX = 29,
+	VIRTIO_F_VERSION_1 = 32,
+	VIRTIO_F_RING_PACKED = 34
+};
+
 // bits of the device status register
 enum {
 	ACKNOWLEDGE = 1,
@@ -72,9 +80,19 @@ enum {
 	// Bits of the spec::Descriptor::flags field.
 	VIRTQ_DESC_F_NEXT = 1, // descriptor is part of a chain
 	VIRTQ_DESC_F_WRITE = 2, // buffer is written by device
+	VIRTQ_DESC_F_INDIRECT = 4, // buffer contains a table of descriptors
+
+	// Additional bits of the spec::PackedDescriptor::flags field.
+	VIRTQ_DESC_F_AVAIL = 1 << 7,
+	VIRTQ_DESC_F_USED = 1 << 15,
 
 	// Bits of the spec::UsedRing::flags field.
-	VIRTQ_USED_F_NO_NOTIFY = 1 // no need to notify the device
+	VIRTQ_USED_F_NO_NOTIFY = 1, // no need to notify the device
+
+	// Values of the spec::EventSuppression::flags field.
+	RING_EVENT_FLAGS_ENABLE = 0,
+	RING_EVENT_FLAGS_DISABLE = 1,
+	RING_EVENT_FLAGS_DESC = 2 // only notify when reaching offsetWrap
 };
 
 namespace spec {
@@ -122,6 +140,21 @@ namespace spec {
 
 		arch::scalar_variable<uint16_t> eventIndex;
 	};
+
+	// Descriptors of packed virtqs (VIRTIO_F_RING_PACKED).
+	struct PackedDescriptor {
+		arch::scalar_variable<uint64_t> address;
+		arch::scalar_variable<uint32_t> length;
+		arch::scalar_variable<uint16_t> id;
+		arch::scalar_variable<uint16_t> flags;
+	};
+	static_assert(sizeof(PackedDescriptor) == 16);
+
+	struct EventSuppression {
+		arch::scalar_variable<uint16_t> offsetWrap;
+		arch::scalar_variable<uint16_t> flags;
+	};
+	static_assert(sizeof(EventSuppression) == 4);
 };
 
 struct DeviceSpace;
@@ -183,7 +216,7 @@ struct DeviceSpace {
 		} else {
 			static_assert(sizeof(typename RT::rep_type) == 4,
 					"Unsupported size for DeviceSpace::load()");
-			auto v = _transport->loadConfig16(r.offset());
+			auto v = _transport->loadConfig32(r.offset());
 			return static_cast<typename RT::rep_type>(v);
 		}
 	}
@@ -238,6 +271,12 @@ struct Handle {
 
 	void setupLink(Handle other);
 
+	// Makes this descriptor refer to a table of descriptors (see VIRTIO_RING_F_INDIRECT_DESC).
+	// The table must be contiguous in physical memory and must not be changed until
+	// the device returns the descriptor. Entries use the split virtq format and must be
+	// chained in table order; they are converted in place if the queue is packed.
+	void setupIndirect(arch::dma_buffer_view table);
+
 private:
 	Queue *_queue;
 	size_t _tableIndex;
@@ -291,11 +330,19 @@ struct Request {
 };
 
 // Represents a single virtq.
+// Handles always refer to descriptors in the split virtq format. For packed virtqs,
+// these descriptors are only kept in driver memory and are copied to the ring on posting.
 struct Queue {
 	friend struct Handle;
 
+	// Constructs a split virtq.
 	Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *table,
-			spec::AvailableRing *available, spec::UsedRing *used);
+			spec::AvailableRing *available, spec::UsedRing *used, bool event_index);
+
+	// Constructs a packed virtq.
+	Queue(unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+			spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+			bool event_index);
 protected:
 	~Queue() = default;
 
@@ -309,6 +356,11 @@ public:
 		return _queueSize;
 	}
 
+	// Returns the number of descriptors that can be obtained without waiting.
+	size_t numFreeDescriptors() {
+		return _descriptorStack.size();
+	}
+
 	// Allocates a single descriptor.
 	// The descriptor is automatically freed when the device returns it.
 	async::result<Handle> obtainDescriptor();
@@ -344,18 +396,51 @@ protected:
 	virtual void notifyTransport() = 0;
 
 private:
+	void _postSplit(Handle handle);
+	void _postPacked(Handle handle);
+	bool _needsNotify();
+	bool _retrieveSplit();
+	bool _retrievePacked();
+	void _completeChain(size_t table_index, uint32_t written);
+
 	// Index of this queue as part of its owning device.
 	unsigned int _queueIndex;
 
 	// Number of descriptors in this queue.
 	size_t _queueSize;
 
+	// Whether this virtq uses the packed layout.
+	bool _packed;
+
+	// Whether VIRTIO_RING_F_EVENT_IDX was negotiated.
+	bool _eventIndex;
+
 	// Pointers to different data structures of this virtq.
+	// For packed virtqs, _table points to _shadowTable.
 	spec::Descriptor *_table;
-	spec::AvailableRing *_availableRing;
-	spec::UsedRing *_usedRing;
-	spec::AvailableExtra *_availableExtra;
-	spec::UsedExtra *_usedExtra;
+	spec::AvailableRing *_availableRing = nullptr;
+	spec::UsedRing *_usedRing = nullptr;
+	spec::AvailableExtra *_availableExtra = nullptr;
+	spec::UsedExtra *_usedExtra = nullptr;
+
+	spec::PackedDescriptor *_packedRing = nullptr;
+	spec::EventSuppression *_driverEvent = nullptr;
+	spec::EventSuppression *_deviceEvent = nullptr;
+	std::unique_ptr<spec::Descriptor[]> _shadowTable;
+
+	// For packed virtqs: indirect tables (indexed by descriptor) and lengths of posted chains
+	// (indexed by head descriptor).
+	std::vector<spec::Descriptor *> _indirectTables;
+	std::vector<uint16_t> _chainLengths;
+
+	// For packed virtqs: next ring entries to post and to retrieve, and their wrap counters.
+	uint16_t _availIndex = 0;
+	bool _availWrap = true;
+	uint16_t _usedIndex = 0;
+	bool _usedWrap = true;
+
+	// Number of ring entries (packed) or chains (split) posted since the last notification.
+	uint16_t _numAdded = 0;
 
 	// Keeps track of unused descriptor indices.
 	std::vector<uint16_t> _descriptorStack;
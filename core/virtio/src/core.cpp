@@ -1,12 +1,13 @@
 
 #include <assert.h>
+#include <string.h>
 #include <iostream>
 #include <unordered_map>
 #include <optional>
 
+#include <core/dma-pool.hpp>
 #include <core/virtio/core.hpp>
-#include <fafnir/dsl.hpp>
-#include <protocols/kernlet/compiler.hpp>
+#include <protocols/kernlet/programs.hpp>
 
 namespace virtio_core {
 
@@ -106,6 +107,7 @@ private:
 	protocols::hw::Device _hwDevice;
 	arch::io_space _legacySpace;
 	helix::UniqueDescriptor _irq;
+	bool _eventIndex = false;
 
 	std::vector<std::unique_ptr<LegacyPciQueue>> _queues;
 };
@@ -113,7 +115,8 @@ private:
 struct LegacyPciQueue final : Queue {
 	LegacyPciQueue(LegacyPciTransport *transport,
 			unsigned int queue_index, size_t queue_size,
-			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used);
+			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
+			bool event_index);
 
 protected:
 	void notifyTransport() override;
@@ -155,7 +158,11 @@ void LegacyPciTransport::acknowledgeDriverFeature(unsigned int feature) {
 }
 
 void LegacyPciTransport::finalizeFeatures() {
-	// Does nothing for now.
+	// Ring features are handled transparently by Queue.
+	if(checkDeviceFeature(VIRTIO_RING_F_EVENT_IDX)) {
+		acknowledgeDriverFeature(VIRTIO_RING_F_EVENT_IDX);
+		_eventIndex = true;
+	}
 }
 
 void LegacyPciTransport::claimQueues(unsigned int max_index) {
@@ -200,7 +207,7 @@ Queue *LegacyPciTransport::setupQueue(unsigned int queue_index) {
 	auto available = reinterpret_cast<spec::AvailableRing *>((char *)window + available_offset);
 	auto used = reinterpret_cast<spec::UsedRing *>((char *)window + used_offset);
 	_queues[queue_index] = std::make_unique<LegacyPciQueue>(this, queue_index, queue_size,
-			table, available, used);
+			table, available, used, _eventIndex);
 
 	// Hand the queue to the device.
 	uintptr_t table_physical;
@@ -251,8 +258,10 @@ async::detached LegacyPciTransport::_processIrqs() {
 
 LegacyPciQueue::LegacyPciQueue(LegacyPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
-		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used)
-: Queue{queue_index, queue_size, table, available, used}, _transport{transport} { }
+		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
+		bool event_index)
+: Queue{queue_index, queue_size, table, available, used, event_index},
+		_transport{transport} { }
 
 void LegacyPciQueue::notifyTransport() {
 	_transport->_legacySpace.store(PCI_L_QUEUE_NOTIFY, queueIndex());
@@ -303,6 +312,10 @@ private:
 	arch::mem_space _isrSpace() { return arch::mem_space{_isrMapping.get()}; }
 	arch::mem_space _deviceSpace() { return arch::mem_space{_deviceMapping.get()}; }
 
+	Queue *_setupPackedQueue(unsigned int queue_index, size_t queue_size,
+			unsigned int notify_index);
+	void _enableQueue(void *table, void *available, void *used);
+
 	async::detached _processIrqs();
 	async::detached _processQueueMsi();
 
@@ -315,7 +328,8 @@ private:
 	unsigned int _notifyMultiplier;
 	helix::UniqueDescriptor _irq;
 	helix::UniqueDescriptor _queueMsi;
-
+	bool _eventIndex = false;
+	bool _packed = false;
 
 	std::vector<std::unique_ptr<StandardPciQueue>> _queues;
 };
@@ -324,7 +338,13 @@ struct StandardPciQueue final : Queue {
 	StandardPciQueue(StandardPciTransport *transport,
 			unsigned int queue_index, size_t queue_size,
 			spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
-			arch::scalar_register<uint16_t> notify_register);
+			bool event_index, arch::scalar_register<uint16_t> notify_register);
+
+	StandardPciQueue(StandardPciTransport *transport,
+			unsigned int queue_index, size_t queue_size,
+			spec::PackedDescriptor *ring, spec::EventSuppression *driver_event,
+			spec::EventSuppression *device_event,
+			bool event_index, arch::scalar_register<uint16_t> notify_register);
 
 protected:
 	void notifyTransport() override;
@@ -372,8 +392,18 @@ void StandardPciTransport::acknowledgeDriverFeature(unsigned int feature) {
 }
 
 void StandardPciTransport::finalizeFeatures() {
-	assert(checkDeviceFeature(32));
-	acknowledgeDriverFeature(32);
+	assert(checkDeviceFeature(VIRTIO_F_VERSION_1));
+	acknowledgeDriverFeature(VIRTIO_F_VERSION_1);
+
+	// Ring features are handled transparently by Queue.
+	if(checkDeviceFeature(VIRTIO_RING_F_EVENT_IDX)) {
+		acknowledgeDriverFeature(VIRTIO_RING_F_EVENT_IDX);
+		_eventIndex = true;
+	}
+	if(checkDeviceFeature(VIRTIO_F_RING_PACKED)) {
+		acknowledgeDriverFeature(VIRTIO_F_RING_PACKED);
+		_packed = true;
+	}
 
 	_commonSpace().store(PCI_DEVICE_STATUS, _commonSpace().load(PCI_DEVICE_STATUS) | FEATURES_OK);
 	auto confirm = _commonSpace().load(PCI_DEVICE_STATUS);
@@ -395,6 +425,9 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 
 	// TODO: Ensure that the queue size is indeed a power of 2.
 
+	if(_packed)
+		return _setupPackedQueue(queue_index, queue_size, notify_index);
+
 	// Determine the queue size in bytes.
 	constexpr size_t available_align = 2;
 	constexpr size_t used_align = 4;
@@ -423,9 +456,45 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	auto available = reinterpret_cast<spec::AvailableRing *>((char *)window + available_offset);
 	auto used = reinterpret_cast<spec::UsedRing *>((char *)window + used_offset);
 	_queues[queue_index] = std::make_unique<StandardPciQueue>(this, queue_index, queue_size,
-			table, available, used,
+			table, available, used, _eventIndex,
 			arch::scalar_register<uint16_t>{_notifyMultiplier * notify_index});
 
+	_enableQueue(table, available, used);
+	return _queues[queue_index].get();
+}
+
+Queue *StandardPciTransport::_setupPackedQueue(unsigned int queue_index, size_t queue_size,
+		unsigned int notify_index) {
+	// Determine the queue size in bytes.
+	auto driver_event_offset = queue_size * sizeof(spec::PackedDescriptor);
+	auto device_event_offset = driver_event_offset + sizeof(spec::EventSuppression);
+	auto region_size = device_event_offset + sizeof(spec::EventSuppression);
+
+	// Allocate physical memory for the virtq structs.
+	assert(region_size < 0x4000); // FIXME: do not hardcode 0x4000
+	HelHandle memory;
+	void *window;
+	HEL_CHECK(helAllocateMemory(0x4000, kHelAllocContinuous, nullptr, &memory));
+	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+			0, 0x4000, kHelMapProtRead | kHelMapProtWrite, &window));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, memory));
+
+	// Setup the memory region.
+	auto ring = reinterpret_cast<spec::PackedDescriptor *>((char *)window);
+	auto driver_event = reinterpret_cast<spec::EventSuppression *>(
+			(char *)window + driver_event_offset);
+	auto device_event = reinterpret_cast<spec::EventSuppression *>(
+			(char *)window + device_event_offset);
+	_queues[queue_index] = std::make_unique<StandardPciQueue>(this, queue_index, queue_size,
+			ring, driver_event, device_event, _eventIndex,
+			arch::scalar_register<uint16_t>{_notifyMultiplier * notify_index});
+
+	// For packed virtqs, the available and used areas hold the event suppression structs.
+	_enableQueue(ring, driver_event, device_event);
+	return _queues[queue_index].get();
+}
+
+void StandardPciTransport::_enableQueue(void *table, void *available, void *used) {
 	// Hand the queue to the device.
 	uintptr_t table_physical, available_physical, used_physical;
 	HEL_CHECK(helPointerPhysical(table, &table_physical));
@@ -446,8 +515,6 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	}
 
 	_commonSpace().store(PCI_QUEUE_ENABLE, 1);
-
-	return _queues[queue_index].get();
 }
 
 void StandardPciTransport::runDevice() {
@@ -461,48 +528,14 @@ void StandardPciTransport::runDevice() {
 
 async::detached StandardPciTransport::_processIrqs() {
 #ifdef __x86_64__ // TODO: implement kernlet compilation for aarch64
-	co_await connectKernletCompiler();
-
-	std::vector<uint8_t> kernlet_program;
-	fnr::emit_to(std::back_inserter(kernlet_program),
-		// Load the PCI_ISR register.
-		fnr::scope_push{} (
-			fnr::intrin{"__mmio_read8", 2, 1} (
-				fnr::binding{0}, // IRQ space MMIO region (bound to slot 0).
-				fnr::binding{1} // IRQ space MMIO offset (bound to slot 1).
-					 + fnr::literal{PCI_ISR.offset()} // Offset of USBSTS.
-			) & fnr::literal{3} // Progress and configuration change bits.
-		),
-		// Ack the IRQ iff one of the bits was set.
-		fnr::check_if{},
-			fnr::scope_get{0},
-		fnr::then{},
-			// Trigger the bitset event (bound to slot 2).
-			fnr::intrin{"__trigger_bitset", 2, 0} (
-				fnr::binding{2},
-				fnr::scope_get{0}
-			),
-			fnr::scope_push{} ( fnr::literal{1} ),
-		fnr::else_then{},
-			fnr::scope_push{} ( fnr::literal{2} ),
-		fnr::end{}
-	);
-
-	auto kernlet_object = co_await compile(kernlet_program.data(),
-			kernlet_program.size(), {BindType::memoryView, BindType::offset,
-			BindType::bitsetEvent});
-
-	HelHandle event_handle;
-	HEL_CHECK(helCreateBitsetEvent(&event_handle));
-	helix::UniqueDescriptor event{event_handle};
-
-	HelKernletData data[3];
-	data[0].handle = _isrMapping.memory().getHandle();
-	data[1].handle = _isrMapping.offset();
-	data[2].handle = event.getHandle();
-	HelHandle bound_handle;
-	HEL_CHECK(helBindKernlet(kernlet_object.getHandle(), data, 3, &bound_handle));
-	HEL_CHECK(helAutomateIrq(_irq.getHandle(), 0, bound_handle));
+	// Progress and configuration change bits. Reading PCI_ISR clears it.
+	auto event = co_await automateStatusIrq(_irq, _isrMapping.memory(),
+			_isrMapping.offset(),
+			StatusIrqKernlet{
+				.offset = static_cast<uint32_t>(PCI_ISR.offset()),
+				.mask = 3,
+				.width = 8
+			});
 
 	co_await _hwDevice.enableBusIrq();
 
@@ -580,8 +613,16 @@ async::detached StandardPciTransport::_processQueueMsi() {
 StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
 		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
-		arch::scalar_register<uint16_t> notify_register)
-: Queue{queue_index, queue_size, table, available, used},
+		bool event_index, arch::scalar_register<uint16_t> notify_register)
+: Queue{queue_index, queue_size, table, available, used, event_index},
+		_transport{transport}, _notifyRegister{notify_register} { }
+
+StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
+		unsigned int queue_index, size_t queue_size,
+		spec::PackedDescriptor *ring, spec::EventSuppression *driver_event,
+		spec::EventSuppression *device_event,
+		bool event_index, arch::scalar_register<uint16_t> notify_register)
+: Queue{queue_index, queue_size, ring, driver_event, device_event, event_index},
 		_transport{transport}, _notifyRegister{notify_register} { }
 
 void StandardPciQueue::notifyTransport() {
@@ -624,17 +665,31 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 		std::optional<Mapping> device_mapping;
 		unsigned int notify_multiplier = 0;
 
+		// Capabilities live in the standard config space; read it in a single request.
+		auto space = co_await hw_device.loadPciSpaceRange(0, 256);
+		assert(space.size() == 256);
+		auto loadByte = [&] (size_t i, size_t offset) -> uint32_t {
+			assert(info.caps[i].offset + offset < space.size());
+			return space[info.caps[i].offset + offset];
+		};
+		auto loadWord = [&] (size_t i, size_t offset) -> uint32_t {
+			assert(info.caps[i].offset + offset + 4 <= space.size());
+			uint32_t word;
+			memcpy(&word, space.data() + info.caps[i].offset + offset, 4);
+			return word;
+		};
+
 		for(size_t i = 0; i < info.caps.size(); i++) {
 			if(info.caps[i].type != 0x09)
 				continue;
 
-			auto subtype = co_await hw_device.loadPciCapability(i, 3, 1);
+			auto subtype = loadByte(i, 3);
 			if(subtype != 1 && subtype != 2 && subtype != 3 && subtype != 4)
 				continue;
 
-			auto bir = co_await hw_device.loadPciCapability(i, 4, 1);
-			auto offset = co_await hw_device.loadPciCapability(i, 8, 4);
-			auto length = co_await hw_device.loadPciCapability(i, 12, 4);
+			auto bir = loadByte(i, 4);
+			auto offset = loadWord(i, 8);
+			auto length = loadWord(i, 12);
 			std::cout << "virtio: Subtype: " << capName(subtype).value_or("<invalid>")
 					<< " (" << subtype << "), BAR index: " << bir << ", offset: " << offset
 					<< ", length: " << length << std::endl;
@@ -647,7 +702,7 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 				common_mapping = std::move(mapping);
 			}else if(subtype == 2) {
 				notify_mapping = std::move(mapping);
-				notify_multiplier = co_await hw_device.loadPciCapability(i, 16, 4);
+				notify_multiplier = loadWord(i, 16);
 			}else if(subtype == 3) {
 				isr_mapping = std::move(mapping);
 			}else if(subtype == 4) {
@@ -725,8 +780,7 @@ Handle::Handle(Queue *queue, size_t table_index)
 void Handle::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
 	assert(view.size());
 
-	uintptr_t physical;
-	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	auto physical = core::dmaPhysical(view.data());
 
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->address.store(physical);
@@ -736,8 +790,7 @@ void Handle::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
 void Handle::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
 	assert(view.size());
 
-	uintptr_t physical;
-	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	auto physical = core::dmaPhysical(view.data());
 
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->address.store(physical);
@@ -745,6 +798,20 @@ void Handle::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_WRITE);
 }
 
+void Handle::setupIndirect(arch::dma_buffer_view table) {
+	assert(table.size() && !(table.size() % sizeof(spec::Descriptor)));
+
+	auto physical = core::dmaPhysical(table.data());
+
+	auto descriptor = _queue->_table + _tableIndex;
+	descriptor->address.store(physical);
+	descriptor->length.store(table.size());
+	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_INDIRECT);
+
+	if(_queue->_packed)
+		_queue->_indirectTables[_tableIndex] = reinterpret_cast<spec::Descriptor *>(table.data());
+}
+
 void Handle::setupLink(Handle other) {
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->next.store(other._tableIndex);
@@ -781,9 +848,21 @@ async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 // Queue
 // --------------------------------------------------------
 
+namespace {
+
+// Determines whether the other side asked for a notification when the index
+// moves from old_index to new_index (see VIRTIO_RING_F_EVENT_IDX).
+bool needsEvent(uint16_t event, uint16_t new_index, uint16_t old_index) {
+	return static_cast<uint16_t>(new_index - event - 1)
+			< static_cast<uint16_t>(new_index - old_index);
+}
+
+} // anonymous namespace
+
 Queue::Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *table,
-		spec::AvailableRing *available, spec::UsedRing *used)
-: _queueIndex{queue_index}, _queueSize{queue_size}, _progressHead{0} {
+		spec::AvailableRing *available, spec::UsedRing *used, bool event_index)
+: _queueIndex{queue_index}, _queueSize{queue_size}, _packed{false}, _eventIndex{event_index},
+		_progressHead{0} {
 	// Construct the hardware state.
 	_table = new (table) spec::Descriptor[_queueSize];
 	_availableRing = new (available) spec::AvailableRing;
@@ -812,6 +891,40 @@ Queue::Queue(unsigned int queue_index, size_t queue_size, spec::Descriptor *tabl
 	_activeRequests.resize(_queueSize);
 }
 
+Queue::Queue(unsigned int queue_index, size_t queue_size, spec::PackedDescriptor *ring,
+		spec::EventSuppression *driver_event, spec::EventSuppression *device_event,
+		bool event_index)
+: _queueIndex{queue_index}, _queueSize{queue_size}, _packed{true}, _eventIndex{event_index},
+		_progressHead{0} {
+	// Construct the hardware state.
+	_packedRing = new (ring) spec::PackedDescriptor[_queueSize];
+	_driverEvent = new (driver_event) spec::EventSuppression;
+	_deviceEvent = new (device_event) spec::EventSuppression;
+
+	for(size_t i = 0; i < _queueSize; i++) {
+		_packedRing[i].address.store(0);
+		_packedRing[i].length.store(0);
+		_packedRing[i].id.store(0);
+		_packedRing[i].flags.store(0);
+	}
+
+	// With EVENT_IDX, we ask for an interrupt once the first entry is used.
+	_driverEvent->offsetWrap.store(1 << 15);
+	_driverEvent->flags.store(_eventIndex ? RING_EVENT_FLAGS_DESC : RING_EVENT_FLAGS_ENABLE);
+	_deviceEvent->offsetWrap.store(0);
+	_deviceEvent->flags.store(RING_EVENT_FLAGS_ENABLE);
+
+	// Construct the software state.
+	_shadowTable = std::make_unique<spec::Descriptor[]>(_queueSize);
+	_table = _shadowTable.get();
+	_indirectTables.resize(_queueSize);
+	_chainLengths.resize(_queueSize);
+
+	for(size_t i = 0; i < _queueSize; i++)
+		_descriptorStack.push_back(i);
+	_activeRequests.resize(_queueSize);
+}
+
 async::result<Handle> Queue::obtainDescriptor() {
 	while(true) {
 		if(_descriptorStack.empty()) {
@@ -839,54 +952,194 @@ void Queue::postDescriptor(Handle handle, Request *request,
 	assert(!_activeRequests[handle.tableIndex()]);
 	_activeRequests[handle.tableIndex()] = request;
 
+	if(_packed) {
+		_postPacked(handle);
+	}else{
+		_postSplit(handle);
+	}
+}
+
+void Queue::_postSplit(Handle handle) {
 	auto enqueue_head = _availableRing->headIndex.load();
 	auto ring_index = enqueue_head & (_queueSize - 1);
 	_availableRing->elements[ring_index].tableIndex.store(handle.tableIndex());
 
 	asm volatile ( "" : : : "memory" );
 	_availableRing->headIndex.store(enqueue_head + 1);
+	_numAdded++;
 }
 
-void Queue::notify() {
+void Queue::_postPacked(Handle handle) {
+	auto head = handle.tableIndex();
+	auto head_ring_index = _availIndex;
+	uint16_t head_flags = 0;
+
+	// Copy the chain to consecutive ring entries. All entries carry the head's index as ID.
+	uint16_t length = 0;
+	auto table_index = head;
+	while(true) {
+		auto descriptor = _table + table_index;
+		auto flags = descriptor->flags.load();
+
+		if(flags & VIRTQ_DESC_F_INDIRECT) {
+			// Packed indirect tables are implicitly chained in table order. Their id and
+			// flags fields overlap with the split flags and next fields, respectively.
+			auto table = _indirectTables[table_index];
+			assert(table);
+			for(size_t i = 0; i < descriptor->length.load() / sizeof(spec::Descriptor); i++) {
+				auto entry_flags = table[i].flags.load() & VIRTQ_DESC_F_WRITE;
+				table[i].flags.store(0);
+				table[i].next.store(entry_flags);
+			}
+		}
+
+		uint16_t ring_flags = (flags & (VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE
+					| VIRTQ_DESC_F_INDIRECT))
+				| (_availWrap ? VIRTQ_DESC_F_AVAIL : VIRTQ_DESC_F_USED);
+
+		auto entry = _packedRing + _availIndex;
+		entry->address.store(descriptor->address.load());
+		entry->length.store(descriptor->length.load());
+		entry->id.store(head);
+		if(!length) {
+			head_flags = ring_flags;
+		}else{
+			entry->flags.store(ring_flags);
+		}
+		length++;
+
+		if(++_availIndex == _queueSize) {
+			_availIndex = 0;
+			_availWrap = !_availWrap;
+		}
+
+		if(!(flags & VIRTQ_DESC_F_NEXT))
+			break;
+		table_index = descriptor->next.load();
+	}
+	_chainLengths[head] = length;
+	_numAdded += length;
+
+	// The device must not see the head before the rest of the chain.
 	asm volatile ( "" : : : "memory" );
-	if(!(_usedRing->flags.load() & VIRTQ_USED_F_NO_NOTIFY))
+	_packedRing[head_ring_index].flags.store(head_flags);
+}
+
+void Queue::notify() {
+	if(_needsNotify())
 		notifyTransport();
+	_numAdded = 0;
+}
+
+bool Queue::_needsNotify() {
+	// Posted descriptors must be visible before we read the device's suppression state.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if(_packed) {
+		auto flags = _deviceEvent->flags.load();
+		if(flags == RING_EVENT_FLAGS_DISABLE)
+			return false;
+		if(flags != RING_EVENT_FLAGS_DESC)
+			return true;
+
+		auto offset_wrap = _deviceEvent->offsetWrap.load();
+		uint16_t event = offset_wrap & 0x7FFF;
+		if(static_cast<bool>(offset_wrap >> 15) != _availWrap)
+			event -= _queueSize;
+		return needsEvent(event, _availIndex, _availIndex - _numAdded);
+	}
+
+	if(_eventIndex) {
+		auto head = _availableRing->headIndex.load();
+		return needsEvent(_usedExtra->eventIndex.load(), head, head - _numAdded);
+	}
+	return !(_usedRing->flags.load() & VIRTQ_USED_F_NO_NOTIFY);
 }
 
 void Queue::processInterrupt() {
 	while(true) {
-		auto used_head = _usedRing->headIndex.load();
+		while(_packed ? _retrievePacked() : _retrieveSplit())
+			;
+
+		if(!_eventIndex)
+			break;
+
+		// Ask the device to interrupt us once it uses the next entry.
+		if(_packed) {
+			_driverEvent->offsetWrap.store(_usedIndex | (_usedWrap ? (1 << 15) : 0));
+		}else{
+			_availableExtra->eventIndex.store(_progressHead);
+		}
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-		if((_progressHead & 0xFFFF) == used_head)
+		// Entries that were used before the device saw the update do not raise an interrupt.
+		if(!(_packed ? _retrievePacked() : _retrieveSplit()))
 			break;
+	}
+}
 
-		asm volatile ( "" : : : "memory" );
+bool Queue::_retrieveSplit() {
+	auto used_head = _usedRing->headIndex.load();
 
-		auto ring_index = _progressHead & (_queueSize - 1);
-		auto table_index = _usedRing->elements[ring_index].tableIndex.load();
-		assert(table_index < _queueSize);
+	if((_progressHead & 0xFFFF) == used_head)
+		return false;
 
-		// Dequeue the Request object.
-		auto request = _activeRequests[table_index];
-		assert(request);
-		request->len = _usedRing->elements[ring_index].written.load();
-		_activeRequests[table_index] = nullptr;
+	asm volatile ( "" : : : "memory" );
 
-		// Free all descriptors in the descriptor chain.
-		auto chain_index = table_index;
-		while(_table[chain_index].flags.load() & VIRTQ_DESC_F_NEXT) {
-			auto successor = _table[chain_index].next.load();
-			_descriptorStack.push_back(chain_index);
-			chain_index = successor;
-		}
-		_descriptorStack.push_back(chain_index);
-		_descriptorDoorbell.raise();
+	auto ring_index = _progressHead & (_queueSize - 1);
+	auto table_index = _usedRing->elements[ring_index].tableIndex.load();
+	auto written = _usedRing->elements[ring_index].written.load();
+	assert(table_index < _queueSize);
+	_progressHead++;
 
-		// Call the completion handler.
-		request->complete(request);
+	_completeChain(table_index, written);
+	return true;
+}
+
+bool Queue::_retrievePacked() {
+	auto entry = _packedRing + _usedIndex;
+	auto flags = entry->flags.load();
+	bool avail = flags & VIRTQ_DESC_F_AVAIL;
+	bool used = flags & VIRTQ_DESC_F_USED;
+	if(avail != used || used != _usedWrap)
+		return false;
+
+	asm volatile ( "" : : : "memory" );
+
+	auto table_index = entry->id.load();
+	auto written = entry->length.load();
+	assert(table_index < _queueSize);
+
+	// The device returns a single entry per chain; skip the remaining ones.
+	_usedIndex += _chainLengths[table_index];
+	if(_usedIndex >= _queueSize) {
+		_usedIndex -= _queueSize;
+		_usedWrap = !_usedWrap;
+	}
+
+	_completeChain(table_index, written);
+	return true;
+}
 
-		_progressHead++;
+void Queue::_completeChain(size_t table_index, uint32_t written) {
+	// Dequeue the Request object.
+	auto request = _activeRequests[table_index];
+	assert(request);
+	request->len = written;
+	_activeRequests[table_index] = nullptr;
+
+	// Free all descriptors in the descriptor chain.
+	auto chain_index = table_index;
+	while(_table[chain_index].flags.load() & VIRTQ_DESC_F_NEXT) {
+		auto successor = _table[chain_index].next.load();
+		_descriptorStack.push_back(chain_index);
+		chain_index = successor;
 	}
+	_descriptorStack.push_back(chain_index);
+	_descriptorDoorbell.raise();
+
+	// Call the completion handler.
+	request->complete(request);
 }
 
 } // namespace virtio_core
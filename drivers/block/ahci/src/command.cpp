@@ -11,8 +11,8 @@ Command::Command(uint64_t sector, size_t numSectors, size_t numBytes, void *buff
 		CommandType type) : sector_{sector}, numSectors_{numSectors}, numBytes_{numBytes},
 	buffer_{buffer}, type_{type}, event_{} {
 
-	// TODO: Requests larger than 64k need to be split
-	assert(numBytes < 65536);
+	// Port splits larger requests; this is the limit of our PRDT.
+	assert(numBytes <= 65536);
 
 	if (logCommands) {
 		printf("block/ahci: queueing %zu byte %s to %p at sector %" PRIu64 "\n",
@@ -29,7 +29,7 @@ void Command::notifyCompletion() {
 	event_.raise();
 }
 
-void Command::prepare(commandTable& table, commandHeader& header) {
+void Command::prepare(commandTable& table, commandHeader& header, int ncqTag) {
 	auto tablePhys = helix::ptrToPhysical(&table);
 	assert((tablePhys & 0x7F) == 0 && tablePhys < std::numeric_limits<uint32_t>::max());
 	assert(numSectors_ < std::numeric_limits<uint16_t>::max());
@@ -57,17 +57,43 @@ void Command::prepare(commandTable& table, commandHeader& header) {
 	header.ctBase = static_cast<uint32_t>(helix::ptrToPhysical(&table));
 	header.ctBaseUpper = 0;
 
+	assert(ncqTag < 0 || isQueueable());
+	if (ncqTag >= 0) {
+		// For FPDMA QUEUED, the count goes into the features field,
+		// and the sector count field holds the tag.
+		assert(ncqTag < 32);
+		table.commandFis.features = numSectors_ & 0xFF;
+		table.commandFis.featuresUpper = (numSectors_ >> 8) & 0xFF;
+		table.commandFis.sectorCount = static_cast<uint16_t>(ncqTag << 3);
+	}
+
 	switch (type_) {
 		case CommandType::read:
-			table.commandFis.command = 0x25; // READ DMA EXT
+			if (ncqTag >= 0) {
+				table.commandFis.command = 0x60; // READ FPDMA QUEUED
+			} else {
+				table.commandFis.command = 0x25; // READ DMA EXT
+			}
 			break;
 		case CommandType::write:
-			table.commandFis.command = 0x35; // WRITE DMA EXT
+			if (ncqTag >= 0) {
+				table.commandFis.command = 0x61; // WRITE FPDMA QUEUED
+			} else {
+				table.commandFis.command = 0x35; // WRITE DMA EXT
+			}
 			header.configBytes[0] |= 1 << 6; // Indicates we are writing
 			break;
 		case CommandType::identify:
 			table.commandFis.command = 0xEC; // IDENTIFY DEVICE
 			break;
+		case CommandType::trim:
+			// The LBA fields are unused; the sector count is the number of range blocks.
+			table.commandFis.command = 0x06; // DATA SET MANAGEMENT
+			table.commandFis.features = 1; // TRIM
+			table.commandFis.lba0 = table.commandFis.lba1 = table.commandFis.lba2 = 0;
+			table.commandFis.lba3 = table.commandFis.lba4 = table.commandFis.lba5 = 0;
+			header.configBytes[0] |= 1 << 6; // Indicates we are writing
+			break;
 		default:
 			assert(!"unknown command type");
 	}
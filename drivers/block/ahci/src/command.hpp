@@ -7,7 +7,9 @@
 enum class CommandType {
 	read,
 	write,
-	identify
+	identify,
+	// DATA SET MANAGEMENT with the TRIM bit. The buffer contains LBA range entries.
+	trim
 };
 
 struct Command {
@@ -22,9 +24,15 @@ public:
 		assert(type == CommandType::identify);
 	}
 
-	void prepare(commandTable& table, commandHeader& header);
+	// If ncqTag is non-negative, reads and writes are issued as FPDMA QUEUED commands.
+	void prepare(commandTable& table, commandHeader& header, int ncqTag = -1);
 	void notifyCompletion(); 
 
+	// Whether the command can be issued as an FPDMA QUEUED command.
+	bool isQueueable() const {
+		return type_ == CommandType::read || type_ == CommandType::write;
+	}
+
 	auto getFuture() {
 		return event_.wait();
 	}
@@ -49,6 +57,8 @@ constexpr const char *cmdTypeToString(CommandType type) {
 			return "write";
 		case CommandType::identify:
 			return "identify";
+		case CommandType::trim:
+			return "trim";
 		default:
 			assert(!"unknown command type");
 	}
@@ -1,4 +1,5 @@
 #include <inttypes.h>
+#include <string.h>
 
 #include <helix/memory.hpp>
 #include <helix/timer.hpp>
@@ -36,6 +37,7 @@ namespace flags {
 		constexpr int hostDataError   = 1 << 28;
 		constexpr int ifFatalError    = 1 << 27;
 		constexpr int ifNonFatalError = 1 << 26;
+		constexpr int sdbFis          = 1 << 3;
 		constexpr int d2hFis          = 1;
 	}
 
@@ -47,13 +49,21 @@ namespace flags {
 
 namespace {
 	constexpr size_t sectorSize = 512;
+
+	// Limited by the number of PRDT entries per command table.
+	constexpr size_t maxSectorsPerCommand = 65536 / sectorSize;
+
+	// Each LBA range entry of a TRIM command covers up to 65535 sectors.
+	constexpr size_t trimEntriesPerBlock = sectorSize / 8;
+	constexpr uint64_t maxSectorsPerTrimEntry = 0xFFFF;
 }
 
 // TODO: We can use a more appropriate block size, but this breaks other parts of the OS.
-Port::Port(int64_t parentId, int portIndex, size_t numCommandSlots, bool staggeredSpinUp, arch::mem_space regs)
+Port::Port(int64_t parentId, int portIndex, size_t numCommandSlots, bool staggeredSpinUp,
+		bool hbaSupportsNcq, arch::mem_space regs)
 	: BlockDevice{::sectorSize, parentId},  regs_{regs}, deviceSize_{0},
 	numCommandSlots_{numCommandSlots}, commandsInFlight_{0}, portIndex_{portIndex}, 
-	staggeredSpinUp_{staggeredSpinUp}
+	staggeredSpinUp_{staggeredSpinUp}, hbaSupportsNcq_{hbaSupportsNcq}
 {
 }
 
@@ -122,7 +132,7 @@ void Port::dumpState() {
 	printf("  PxSACT: %#x\n", regs_.load(regs::sataActive));
 	printf("  PxIS: %#x\n", regs_.load(regs::interruptStatus));
 	printf("  PxIE: %#x\n", regs_.load(regs::interruptEnable));
-	printf("  commandsInFlight: %zu\n", commandsInFlight_);
+	printf("  commandsInFlight: %zu (NCQ %s)\n", commandsInFlight_, ncq_ ? "yes" : "no");
 	printf("  submittedCmds slots used: %zu\n", std::count_if(submittedCmds_.begin(), submittedCmds_.end(), [](auto &p){ return p != nullptr; }));
 }
 
@@ -199,6 +209,21 @@ async::result<bool> Port::run() {
 			portIndex_, model.c_str(), static_cast<float>(deviceSize_ / (1 << 30)),
 			logicalSize, physicalSize, sectorCount);
 	assert(logicalSize == 512 && "block/ahci: logical sector size > 512 is not supported");
+	bool rotational = identify->isRotational();
+
+	// The identify command above was not queued; from now on, all commands are.
+	// The device may support fewer tags than the HBA has slots.
+	if (hbaSupportsNcq_ && identify->supportsNcq()) {
+		ncq_ = true;
+		numCommandSlots_ = std::min(numCommandSlots_, identify->getNcqDepth());
+		printf("block/ahci: Port %d uses NCQ with %zu slots\n", portIndex_, numCommandSlots_);
+	}
+
+	if (identify->supportsTrim()) {
+		trimSupported_ = true;
+		maxTrimBlocks_ = std::min(identify->getMaxTrimBlocks(), maxSectorsPerCommand);
+		printf("block/ahci: Port %d supports TRIM\n", portIndex_);
+	}
 
 	// Clear and enable interrupts on this port
 	auto is = regs_.load(regs::interruptStatus);
@@ -206,6 +231,7 @@ async::result<bool> Port::run() {
 	auto ie = regs_.load(regs::interruptEnable);
 	regs_.store(regs::interruptEnable, ie
 			| flags::is::d2hFis
+			| flags::is::sdbFis
 			| flags::is::taskFileError
 			| flags::is::hostDataError
 			| flags::is::hostFatalError
@@ -214,7 +240,10 @@ async::result<bool> Port::run() {
 
 	submitPendingLoop_();
 
-	blockfs::runDevice(this);
+	blockfs::SchedulerOptions scheduler;
+	scheduler.rotational = rotational;
+	scheduler.maxInFlight = numCommandSlots_;
+	blockfs::runDevice(this, scheduler);
 
 	co_return true;
 }
@@ -273,8 +302,11 @@ void Port::handleIrq() {
 
 	std::vector<Command *> completed;
 
-	// Notify all completed commands
+	// Notify all completed commands. NCQ commands are pending until the device
+	// clears their bit in PxSACT (after the HBA already cleared PxCI).
 	auto cmdActiveMask = regs_.load(regs::commandIssue);
+	if (ncq_)
+		cmdActiveMask |= regs_.load(regs::sataActive);
 	for (size_t i = 0; i < numCommandSlots_; i++) {
 		if (submittedCmds_[i] && !(cmdActiveMask & (1 << i))) {
 			completed.push_back(std::exchange(submittedCmds_[i], nullptr));
@@ -284,6 +316,9 @@ void Port::handleIrq() {
 	commandsInFlight_ -= completed.size();
 	regs_.store(regs::interruptStatus, is);
 
+	if (!commandsInFlight_ && completed.size() > 0)
+		idleDoorbell_.raise();
+
 	for (auto &cmd : completed) {
 		cmd->notifyCompletion();
 	}
@@ -305,37 +340,96 @@ async::detached Port::submitPendingLoop_() {
 }
 
 async::result<void> Port::submitCommand_(Command *cmd) {
+	// Non-queued commands cannot be mixed with NCQ commands; wait until the queue is empty.
+	bool queued = ncq_ && cmd->isQueueable();
+	if (ncq_ && !queued) {
+		while (commandsInFlight_)
+			co_await idleDoorbell_.async_wait();
+	}
+
 	auto slot = co_await findFreeSlot_();
 	assert(!(regs_.load(regs::commandIssue) & (1 << slot)));
 	assert(!submittedCmds_[slot]);
 
 	// Setup command table and FIS
-	cmd->prepare(commandTables_[slot], commandList_->slots[slot]);
+	cmd->prepare(commandTables_[slot], commandList_->slots[slot], queued ? static_cast<int>(slot) : -1);
 
 	// Issue command
 	submittedCmds_[slot] = cmd;
 	commandsInFlight_++;
 
-	// Wait until not busy
-	while (regs_.load(regs::tfd) & (flags::tfd::bsy | flags::tfd::drq))
-		;
+	if (queued) {
+		// Queued commands do not need to wait for the device; PxSACT must be set before PxCI.
+		regs_.store(regs::sataActive, 1 << slot);
+	} else {
+		// Wait until not busy
+		while (regs_.load(regs::tfd) & (flags::tfd::bsy | flags::tfd::drq))
+			;
+	}
 
 	regs_.store(regs::commandIssue, 1 << slot);
-	co_return;
+
+	// Do not issue NCQ commands before the non-queued command completes.
+	if (ncq_ && !queued)
+		co_await cmd->getFuture();
+}
+
+async::result<void> Port::transfer_(CommandType type, uint64_t sector, void *buffer, size_t numSectors) {
+	// Queue all parts of the transfer before waiting such that
+	// the device can process them concurrently.
+	std::deque<Command> cmds;
+	for (size_t progress = 0; progress < numSectors; progress += maxSectorsPerCommand) {
+		auto chunk = std::min(numSectors - progress, maxSectorsPerCommand);
+		auto &cmd = cmds.emplace_back(sector + progress, chunk, chunk * sectorSize,
+				reinterpret_cast<char *>(buffer) + progress * sectorSize, type);
+		pendingCmdQueue_.put(&cmd);
+	}
+
+	for (auto &cmd : cmds)
+		co_await cmd.getFuture();
+}
+
+async::result<void> Port::trim_(uint64_t sector, size_t numSectors) {
+	if (!trimSupported_)
+		co_return;
+
+	auto sectorsPerCommand = maxTrimBlocks_ * trimEntriesPerBlock * maxSectorsPerTrimEntry;
+
+	auto end = sector + numSectors;
+	while (sector < end) {
+		auto chunk = std::min(end - sector, sectorsPerCommand);
+		auto numEntries = (chunk + maxSectorsPerTrimEntry - 1) / maxSectorsPerTrimEntry;
+		auto numBlocks = (numEntries + trimEntriesPerBlock - 1) / trimEntriesPerBlock;
+
+		// Unused entries (with a zero count) are ignored by the device.
+		arch::dma_array<uint64_t> entries{&dmaPool_, numBlocks * trimEntriesPerBlock};
+		memset(entries.data(), 0, numBlocks * sectorSize);
+		for (size_t i = 0; i < numEntries; i++) {
+			auto count = std::min(end - sector, maxSectorsPerTrimEntry);
+			entries[i] = sector | (count << 48);
+			sector += count;
+		}
+
+		Command cmd{0, numBlocks, numBlocks * sectorSize, entries.data(), CommandType::trim};
+		pendingCmdQueue_.put(&cmd);
+		co_await cmd.getFuture();
+	}
+}
+
+async::result<void> Port::submit(blockfs::BlockRequest &request) {
+	if (request.op == blockfs::BlockOp::discard) {
+		co_await trim_(request.sector, request.numSectors());
+		co_return;
+	}
+	co_await BlockDevice::submit(request);
 }
 
 async::result<void> Port::readSectors(uint64_t sector, void *buffer, size_t numSectors) {
-	Command cmd{sector, numSectors, numSectors * sectorSize,
-			buffer, CommandType::read};
-	pendingCmdQueue_.put(&cmd);
-	co_await cmd.getFuture();
+	return transfer_(CommandType::read, sector, buffer, numSectors);
 }
 
 async::result<void> Port::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
-	Command cmd{sector, numSectors, numSectors * sectorSize,
-			const_cast<void *>(buffer), CommandType::write};
-	pendingCmdQueue_.put(&cmd);
-	co_await cmd.getFuture();
+	return transfer_(CommandType::write, sector, const_cast<void *>(buffer), numSectors);
 }
 
 async::result<size_t> Port::getSize() {
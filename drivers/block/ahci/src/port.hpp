@@ -1,5 +1,6 @@
 #pragma once
 
+#include <deque>
 #include <queue>
 
 #include <arch/mem_space.hpp>
@@ -17,7 +18,7 @@
 class Port : public blockfs::BlockDevice {
 public:
 	Port(int64_t parentId, int index, size_t numCommandSlots, bool staggeredSpinUp,
-			arch::mem_space regs);
+			bool hbaSupportsNcq, arch::mem_space regs);
 
 public:
 	async::result<bool> init();
@@ -29,6 +30,7 @@ public:
 	async::result<void> readSectors(uint64_t sector, void *buf, size_t numSectors) override;
 	async::result<void> writeSectors(uint64_t sector, const void *buf, size_t numSectors) override;
 	async::result<size_t> getSize() override;
+	async::result<void> submit(blockfs::BlockRequest &request) override;
 
 	int getIndex() const { return portIndex_; }
 
@@ -36,6 +38,8 @@ private:
 	async::result<size_t> findFreeSlot_();
 	async::detached submitPendingLoop_();
 	async::result<void> submitCommand_(Command *cmd);
+	async::result<void> transfer_(CommandType type, uint64_t sector, void *buffer, size_t numSectors);
+	async::result<void> trim_(uint64_t sector, size_t numSectors);
 	void start_();
 	void stop_();
 
@@ -62,10 +66,19 @@ private:
 
 	std::array<Command *, limits::maxCmdSlots> submittedCmds_{};
 	async::recurring_event freeSlotDoorbell_;
+	// Raised when the last command in flight completes.
+	async::recurring_event idleDoorbell_;
 
 	uint64_t deviceSize_;
 	size_t numCommandSlots_;
 	size_t commandsInFlight_;
 	int portIndex_;
 	bool staggeredSpinUp_;
+	bool hbaSupportsNcq_;
+	// Whether reads and writes use native command queuing (determined during run()).
+	bool ncq_ = false;
+	// Whether the device supports TRIM and the number of 512 byte blocks of
+	// LBA range entries per command (determined during run()).
+	bool trimSupported_ = false;
+	size_t maxTrimBlocks_ = 0;
 };
@@ -90,15 +90,23 @@ static_assert(alignof(commandTable) >= 128);
 struct identifyDevice {
 	uint16_t _junkA[27];
 	uint16_t model[20];
-	uint16_t _junkB[36];
+	uint16_t _junkB[28];
+	uint16_t queueDepth;
+	uint16_t sataCapabilities;
+	uint16_t _junkB2[6];
 	uint16_t capabilities;
 	uint16_t _junkC[16];
 	uint64_t maxLBA48;
-	uint16_t _junkD[2];
+	uint16_t _junkD;
+	uint16_t maxDsmBlocks;
 	uint16_t sectorSizeInfo;
 	uint16_t _junkE[9];
 	uint16_t logicalSectorSize;
-	uint16_t _junkF[139];
+	uint16_t _junkF[52];
+	uint16_t dataSetManagement;
+	uint16_t _junkF2[47];
+	uint16_t rotationRate;
+	uint16_t _junkG[38];
 
 	std::string getModel() const {
 		char modelNative[41];
@@ -121,6 +129,11 @@ struct identifyDevice {
 		return out;
 	}
 
+	// Devices that report a rotation rate of 1 are non-rotating media (e.g., SSDs).
+	bool isRotational() const {
+		return rotationRate != 1;
+	}
+
 	// Returns logical and physical sector sizes
 	std::pair<size_t, size_t> getSectorSize() const {
 		if (sectorSizeInfo & (1 << 14) && !(sectorSizeInfo & (1 << 15))) {
@@ -143,5 +156,25 @@ struct identifyDevice {
 	bool supportsLba48() const {
 		return capabilities & (1 << 10);
 	}
+
+	bool supportsNcq() const {
+		// Word 76 is invalid if it is 0 or 0xFFFF.
+		return sataCapabilities != 0xFFFF && (sataCapabilities & (1 << 8));
+	}
+
+	bool supportsTrim() const {
+		return dataSetManagement & 1;
+	}
+
+	// Maximum number of 512 byte blocks of LBA ranges per DATA SET MANAGEMENT command.
+	size_t getMaxTrimBlocks() const {
+		// Zero means that the limit is not reported.
+		return (maxDsmBlocks && maxDsmBlocks != 0xFFFF) ? maxDsmBlocks : 1;
+	}
+
+	// Maximum number of outstanding NCQ commands.
+	size_t getNcqDepth() const {
+		return (queueDepth & 0x1F) + 1;
+	}
 };
 static_assert(sizeof(identifyDevice) == 512);
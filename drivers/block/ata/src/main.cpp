@@ -138,7 +138,11 @@ async::detached Controller::run() {
 
 	_doRequestLoop();
 
-	blockfs::runDevice(this);
+	// The controller processes one request at a time; let the scheduler sort and merge them.
+	blockfs::SchedulerOptions scheduler;
+	scheduler.rotational = true;
+	scheduler.maxInFlight = 1;
+	blockfs::runDevice(this, scheduler);
 }
 
 async::detached Controller::_doRequestLoop() {
@@ -22,7 +22,14 @@ struct Command {
 		return promise_.get_future();
 	}
 
+	// Sets a flag on completion. Used when polling for completion.
+	void setCompletionFlag(bool *flag) {
+		completionFlag_ = flag;
+	}
+
 	void complete(uint16_t status, spec::CompletionEntry::Result result) {
+		if (completionFlag_)
+			*completionFlag_ = true;
 		promise_.set_value(Result{status, result});
 	}
 
@@ -30,4 +37,5 @@ private:
 	spec::Command command_;
 	async::promise<Result, frg::stl_allocator> promise_;
 	std::vector<arch::dma_array<uint64_t>> prpLists;
+	bool *completionFlag_ = nullptr;
 };
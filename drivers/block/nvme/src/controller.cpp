@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <iostream>
+
 #include <arch/bit.hpp>
 #include <helix/timer.hpp>
+#include <protocols/clock/vdso.hpp>
 
 #include "controller.hpp"
 
@@ -19,6 +23,7 @@ namespace flags {
 	namespace cap {
 		constexpr arch::field<uint64_t, uint16_t> mqes{0, 16};
 		constexpr arch::field<uint64_t, uint8_t> dstrd{32, 4};
+		constexpr arch::field<uint64_t, uint8_t> mpsmin{48, 4};
 	} // namespace cap
 
 	namespace vs {
@@ -39,15 +44,24 @@ namespace flags {
 } // namespace flags
 
 Controller::Controller(int64_t parentId, protocols::hw::Device hwDevice, helix::Mapping hbaRegs,
-					   helix::UniqueDescriptor, helix::UniqueDescriptor irq)
+					   helix::UniqueDescriptor, helix::UniqueDescriptor irq, unsigned int numMsis)
 	: hwDevice_{std::move(hwDevice)}, regsMapping_{std::move(hbaRegs)},
-	  regs_{regsMapping_.get()}, irq_{std::move(irq)}, parentId_{parentId} {
+	  regs_{regsMapping_.get()}, numMsis_{numMsis}, parentId_{parentId} {
+	// handleIrqs() accesses irqs_ while we install more vectors.
+	irqs_.reserve(MAX_IO_QUEUES);
+	irqs_.push_back(std::move(irq));
+
+	HelHandle clockHandle;
+	HEL_CHECK(helAccessClockPage(&clockHandle));
+	clockMemory_ = helix::UniqueDescriptor{clockHandle};
+	clockPage_ = helix::Mapping{clockMemory_, 0, sizeof(HelClockPage), kHelMapProtRead};
 }
 
 async::detached Controller::run() {
-	co_await hwDevice_.enableBusIrq();
+	if (!numMsis_)
+		co_await hwDevice_.enableBusIrq();
 
-	handleIrqs();
+	handleIrqs(0);
 
 	co_await reset();
 	co_await scanNamespaces();
@@ -56,28 +70,32 @@ async::detached Controller::run() {
 		ns->run();
 }
 
-async::detached Controller::handleIrqs() {
-	irqSequence_ = 0;
+async::detached Controller::handleIrqs(unsigned int vector) {
+	uint64_t sequence = 0;
 
 	while (true) {
-		auto awaitResult = co_await helix_ng::awaitEvent(irq_, irqSequence_);
+		auto awaitResult = co_await helix_ng::awaitEvent(irqs_[vector], sequence);
 
-		regs_.store(regs::intms, 1);
+		// INTMS/INTMC must not be used with MSI-X.
+		if (!numMsis_)
+			regs_.store(regs::intms, 1);
 
 		HEL_CHECK(awaitResult.error());
-		irqSequence_ = awaitResult.sequence();
+		sequence = awaitResult.sequence();
 
 		int found = 0;
 		for (auto &q : activeQueues_) {
-			found |= q->handleIrq();
+			if (q->getIrqVector() == vector)
+				found |= q->handleIrq();
 		}
 
-		regs_.store(regs::intmc, 1);
+		if (!numMsis_)
+			regs_.store(regs::intmc, 1);
 
 		if (found) {
-			HEL_CHECK(helAcknowledgeIrq(irq_.getHandle(), kHelAckAcknowledge, irqSequence_));
+			HEL_CHECK(helAcknowledgeIrq(irqs_[vector].getHandle(), kHelAckAcknowledge, sequence));
 		} else {
-			HEL_CHECK(helAcknowledgeIrq(irq_.getHandle(), kHelAckNack, irqSequence_));
+			HEL_CHECK(helAcknowledgeIrq(irqs_[vector].getHandle(), kHelAckNack, sequence));
 		}
 	}
 }
@@ -111,6 +129,7 @@ async::result<void> Controller::reset() {
 
 	queueDepth_ = std::min((cap & flags::cap::mqes) + 1, IO_QUEUE_DEPTH);
 	dbStride_ = 1 << (cap & flags::cap::dstrd);
+	minPageShift_ = 12 + (cap & flags::cap::mpsmin);
 
 	version_ = regs_.load(regs::vs);
 
@@ -129,15 +148,60 @@ async::result<void> Controller::reset() {
 
 	co_await enable();
 
-	auto ioQ = std::make_unique<Queue>(1, queueDepth_, regs_.subspace(doorbellsOffset + 1 * 8 * dbStride_));
-	ioQ->init();
+	// Try to use one I/O queue per CPU. Each queue gets its own MSI-X vector
+	// (except for the first one which shares vector 0 with the admin queue).
+	auto clockPage = reinterpret_cast<const HelClockPage *>(clockPage_.get());
+	unsigned int numIoQueues = 1;
+	if (numMsis_ > 1) {
+		numIoQueues = std::min({std::max(clockPage->numCpus, uint32_t{1}), numMsis_, MAX_IO_QUEUES});
+
+		auto res = co_await setNumQueues(numIoQueues);
+		if (res.first == 0) {
+			// The controller reports the number of allocated SQs and CQs (0-based).
+			auto allocated = std::min(res.second.u32 & 0xFFFF, res.second.u32 >> 16) + 1;
+			numIoQueues = std::min(numIoQueues, allocated);
+		} else {
+			numIoQueues = 1;
+		}
+	}
+
+	// Spread the vectors across the CPUs, one per I/O queue.
+	auto numCpus = std::max(clockPage->numCpus, uint32_t{1});
+	for (unsigned int i = 1; i <= numIoQueues; i++) {
+		auto vector = i - 1;
+		if (vector == irqs_.size()) {
+			irqs_.push_back(co_await hwDevice_.installMsi(vector, vector % numCpus));
+			handleIrqs(vector);
+		}
+
+		auto ioQ = std::make_unique<Queue>(i, queueDepth_,
+				regs_.subspace(doorbellsOffset + i * 8 * dbStride_), vector);
+		ioQ->init();
 
-	if (co_await setupIoQueue(ioQ.get())) {
+		if (!(co_await setupIoQueue(ioQ.get())))
+			break;
 		ioQ->run();
 		activeQueues_.push_back(std::move(ioQ));
 	}
 
 	assert(activeQueues_.size() >= 2 && "At least need one IO queue");
+	std::cout << "block/nvme: Using " << activeQueues_.size() - 1 << " I/O queue(s)" << std::endl;
+}
+
+async::result<Command::Result> Controller::setNumQueues(unsigned int n) {
+	using arch::convert_endian;
+	using arch::endian;
+
+	auto &adminQ = activeQueues_.front();
+	auto cmd = std::make_unique<Command>();
+	auto &cmdBuf = cmd->getCommandBuffer().common;
+
+	// Both the number of SQs and CQs are 0-based.
+	cmdBuf.opcode = spec::kSetFeatures;
+	cmdBuf.cdw10 = convert_endian<endian::little, endian::native>((uint32_t)spec::kNumberOfQueues);
+	cmdBuf.cdw11 = convert_endian<endian::little, endian::native>(((n - 1) << 16) | (n - 1));
+
+	return adminQ->submitCommand(std::move(cmd));
 }
 
 async::result<bool> Controller::setupIoQueue(Queue *q) {
@@ -167,7 +231,7 @@ async::result<Command::Result> Controller::createCQ(Queue *q) {
 	cmdBuf.cqid = convert_endian<endian::little, endian::native>((uint16_t)q->getQueueId());
 	cmdBuf.qSize = convert_endian<endian::little, endian::native>((uint16_t)q->getQueueDepth() - 1);
 	cmdBuf.cqFlags = convert_endian<endian::little, endian::native>((uint16_t)flags);
-	cmdBuf.irqVector = 0; // TODO: set to MSI vector
+	cmdBuf.irqVector = convert_endian<endian::little, endian::native>((uint16_t)q->getIrqVector());
 
 	return adminQ->submitCommand(std::move(cmd));
 }
@@ -248,6 +312,12 @@ async::result<void> Controller::scanNamespaces() {
 
 	nn = convert_endian<endian::little>(idCtrl.nn);
 
+	// MDTS is a power of two in units of the minimum page size; zero means no limit.
+	if (idCtrl.mdts)
+		maxTransferSize_ = size_t{1} << (idCtrl.mdts + minPageShift_);
+
+	supportsDsm_ = convert_endian<endian::little>(idCtrl.oncs) & spec::kOncsDatasetManagement;
+
 	if (version_ >= flags::vs::version(1, 1, 0)) {
 		auto nsList = arch::dma_array<uint32_t>{nullptr, 1024};
 		int numLists = (nn + 1023) >> 10;
@@ -295,8 +365,11 @@ async::result<void> Controller::createNamespace(unsigned int nsid) {
 	activeNamespaces_.push_back(std::move(ns));
 }
 
-async::result<Command::Result> Controller::submitIoCommand(std::unique_ptr<Command> cmd) {
-	auto &ioQ = activeQueues_.back();
+async::result<Command::Result> Controller::submitIoCommand(std::unique_ptr<Command> cmd,
+		uint64_t pollNanos) {
+	// Route the command to the queue of the current CPU.
+	auto cpu = protocols::clock::getCpu(reinterpret_cast<const HelClockPage *>(clockPage_.get()));
+	auto &ioQ = activeQueues_[1 + cpu % (activeQueues_.size() - 1)];
 
-	return ioQ->submitCommand(std::move(cmd));
+	return ioQ->submitCommand(std::move(cmd), pollNanos);
 }
@@ -10,23 +10,45 @@
 
 struct Controller {
 	Controller(int64_t parentId, protocols::hw::Device hwDevice, helix::Mapping hbaRegs,
-			   helix::UniqueDescriptor ahciBar, helix::UniqueDescriptor irq);
+			   helix::UniqueDescriptor ahciBar, helix::UniqueDescriptor irq, unsigned int numMsis);
 
 	async::detached run();
 
-	async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd);
+	async::result<Command::Result> submitIoCommand(std::unique_ptr<Command> cmd,
+			uint64_t pollNanos = 0);
 
 	inline int64_t getParentId() const {
 		return parentId_;
 	}
+
+	// Maximum size of a single I/O command in bytes (zero if unlimited).
+	inline size_t getMaxTransferSize() const {
+		return maxTransferSize_;
+	}
+
+	// Whether the controller supports Dataset Management (i.e., deallocation of LBAs).
+	inline bool supportsDatasetManagement() const {
+		return supportsDsm_;
+	}
 private:
 	static constexpr int IO_QUEUE_DEPTH = 1024;
+	// Each I/O queue (except for the first one) consumes an MSI-X vector.
+	// Since the kernel only has a few IRQ slots, we limit the number of queues.
+	static constexpr unsigned int MAX_IO_QUEUES = 8;
 
 	protocols::hw::Device hwDevice_;
 	helix::Mapping regsMapping_;
 	arch::mem_space regs_;
-	helix::UniqueDescriptor irq_;
+	// IRQs indexed by interrupt vector. Vector 0 is shared by the admin queue and the
+	// first I/O queue; without MSI(-X), it is the only vector.
+	std::vector<helix::UniqueDescriptor> irqs_;
+	unsigned int numMsis_;
+
+	// Used to determine the number of CPUs and the current CPU.
+	helix::UniqueDescriptor clockMemory_;
+	helix::Mapping clockPage_;
 
+	// activeQueues_[0] is the admin queue, all others are I/O queues.
 	std::vector<std::unique_ptr<Queue>> activeQueues_;
 	std::vector<std::unique_ptr<Namespace>> activeNamespaces_;
 
@@ -34,8 +56,9 @@ private:
 	unsigned int queueDepth_;
 	uint32_t dbStride_;
 	uint32_t version_;
-
-	uint64_t irqSequence_;
+	unsigned int minPageShift_;
+	size_t maxTransferSize_ = 0;
+	bool supportsDsm_ = false;
 
 	async::result<void> reset();
 	async::result<void> scanNamespaces();
@@ -45,6 +68,7 @@ private:
 	async::result<void> disable();
 
 	async::result<bool> setupIoQueue(Queue *q);
+	async::result<Command::Result> setNumQueues(unsigned int n);
 	async::result<Command::Result> createCQ(Queue *q);
 	async::result<Command::Result> createSQ(Queue *q);
 
@@ -54,5 +78,5 @@ private:
 
 	async::result<void> createNamespace(unsigned int nsid);
 
-	async::detached handleIrqs();
+	async::detached handleIrqs(unsigned int vector);
 };
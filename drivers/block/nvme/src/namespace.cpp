@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <arch/bit.hpp>
 
 #include "namespace.hpp"
@@ -15,35 +17,105 @@ async::detached Namespace::run() {
 }
 
 async::result<void> Namespace::readSectors(uint64_t sector, void *buffer, size_t numSectors) {
+	return readWrite_(spec::kRead, sector, buffer, numSectors, 0, polled_);
+}
+
+async::result<void> Namespace::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
+	return readWrite_(spec::kWrite, sector, const_cast<void *>(buffer), numSectors, 0, polled_);
+}
+
+async::result<void> Namespace::submit(blockfs::BlockRequest &request) {
 	using arch::convert_endian;
 	using arch::endian;
 
-	auto cmd = std::make_unique<Command>();
-	auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+	if(request.op == blockfs::BlockOp::flush) {
+		auto cmd = std::make_unique<Command>();
+		auto &cmdBuf = cmd->getCommandBuffer().common;
+
+		cmdBuf.opcode = spec::kFlush;
+		cmdBuf.namespaceId = convert_endian<endian::little, endian::native>(nsid_);
 
-	cmdBuf.opcode = spec::kRead;
-	cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
-	cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
-	cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)numSectors - 1);
-	cmd->setupBuffer(arch::dma_buffer_view{nullptr, buffer, numSectors << lbaShift_});
+		co_await controller_->submitIoCommand(std::move(cmd));
+		co_return;
+	}else if(request.op == blockfs::BlockOp::discard) {
+		if(!controller_->supportsDatasetManagement())
+			co_return;
 
-	co_await controller_->submitIoCommand(std::move(cmd));
+		// Each range covers at most 2^32 - 1 LBAs.
+		constexpr uint64_t maxRangeLength = UINT32_MAX;
+		auto sector = request.sector;
+		auto end = request.sector + request.numSectors();
+		while(sector < end) {
+			auto ranges = arch::dma_array<spec::DsmRange>{nullptr, spec::maxDsmRanges};
+			size_t n = 0;
+			while(sector < end && n < spec::maxDsmRanges) {
+				auto length = std::min(end - sector, maxRangeLength);
+				ranges[n].attributes = 0;
+				ranges[n].length = convert_endian<endian::little, endian::native>(
+						static_cast<uint32_t>(length));
+				ranges[n].startLba = convert_endian<endian::little, endian::native>(sector);
+				sector += length;
+				n++;
+			}
+
+			auto cmd = std::make_unique<Command>();
+			auto &cmdBuf = cmd->getCommandBuffer().common;
+
+			cmdBuf.opcode = spec::kDatasetManagement;
+			cmdBuf.namespaceId = convert_endian<endian::little, endian::native>(nsid_);
+			cmdBuf.cdw10 = convert_endian<endian::little, endian::native>(
+					static_cast<uint32_t>(n - 1));
+			cmdBuf.cdw11 = convert_endian<endian::little, endian::native>(
+					static_cast<uint32_t>(spec::kDeallocate));
+			cmd->setupBuffer(arch::dma_buffer_view{nullptr, ranges.data(),
+					n * sizeof(spec::DsmRange)});
+
+			co_await controller_->submitIoCommand(std::move(cmd));
+		}
+		co_return;
+	}
+
+	// Segments are submitted one after another; callers that want to keep the
+	// queue busy need to use submitMany().
+	uint16_t control = 0;
+	if(request.flags & blockfs::blockFua)
+		control |= spec::kForceUnitAccess;
+	auto opcode = (request.op == blockfs::BlockOp::write) ? spec::kWrite : spec::kRead;
+	auto poll = polled_ || (request.flags & blockfs::blockHighPriority);
+	auto sector = request.sector;
+	for(auto &segment : request.segments) {
+		co_await readWrite_(opcode, sector, segment.buffer, segment.numSectors, control, poll);
+		sector += segment.numSectors;
+	}
 }
 
-async::result<void> Namespace::writeSectors(uint64_t sector, const void *buffer, size_t numSectors) {
+async::result<void> Namespace::readWrite_(uint8_t opcode, uint64_t sector, void *buffer,
+		size_t numSectors, uint16_t control, bool poll) {
 	using arch::convert_endian;
 	using arch::endian;
 
-	auto cmd = std::make_unique<Command>();
-	auto &cmdBuf = cmd->getCommandBuffer().readWrite;
+	// Command::setupBuffer() builds PRP lists for arbitrarily large buffers; we only need
+	// to split requests that exceed the controller's MDTS or the 16-bit block count.
+	size_t maxSectors = size_t{1} << 16;
+	if (auto maxTransfer = controller_->getMaxTransferSize(); maxTransfer)
+		maxSectors = std::min(maxSectors, std::max(maxTransfer >> lbaShift_, size_t{1}));
+
+	for (size_t progress = 0; progress < numSectors; progress += maxSectors) {
+		auto chunk = std::min(numSectors - progress, maxSectors);
+
+		auto cmd = std::make_unique<Command>();
+		auto &cmdBuf = cmd->getCommandBuffer().readWrite;
 
-	cmdBuf.opcode = spec::kWrite;
-	cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
-	cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector);
-	cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)numSectors - 1);
-	cmd->setupBuffer(arch::dma_buffer_view{nullptr, (char *)buffer, numSectors << lbaShift_});
+		cmdBuf.opcode = opcode;
+		cmdBuf.nsid = convert_endian<endian::little, endian::native>(nsid_);
+		cmdBuf.startLba = convert_endian<endian::little, endian::native>(sector + progress);
+		cmdBuf.length = convert_endian<endian::little, endian::native>((uint16_t)(chunk - 1));
+		cmdBuf.control = convert_endian<endian::little, endian::native>(control);
+		cmd->setupBuffer(arch::dma_buffer_view{nullptr,
+				(char *)buffer + (progress << lbaShift_), chunk << lbaShift_});
 
-	co_await controller_->submitIoCommand(std::move(cmd));
+		co_await controller_->submitIoCommand(std::move(cmd), poll ? POLL_NANOS : 0);
+	}
 }
 
 async::result<size_t> Namespace::getSize() {
@@ -13,9 +13,22 @@ struct Namespace : blockfs::BlockDevice {
 	async::result<void> readSectors(uint64_t sector, void *buf, size_t numSectors) override;
 	async::result<void> writeSectors(uint64_t sector, const void *buf, size_t numSectors) override;
 	async::result<size_t> getSize() override;
+	async::result<void> submit(blockfs::BlockRequest &request) override;
+
+	// If enabled, all reads and writes poll for their completion (for up to POLL_NANOS)
+	// instead of waiting for an IRQ. High-priority requests always poll.
+	void setPolledCompletions(bool enabled) {
+		polled_ = enabled;
+	}
 
 private:
+	static constexpr uint64_t POLL_NANOS = 50'000;
+
+	async::result<void> readWrite_(uint8_t opcode, uint64_t sector, void *buffer,
+			size_t numSectors, uint16_t control, bool poll);
+
 	Controller *controller_;
 	unsigned int nsid_;
 	int lbaShift_;
+	bool polled_ = false;
 };
@@ -5,8 +5,9 @@
 #include "queue.hpp"
 #include "spec.hpp"
 
-Queue::Queue(unsigned int qid, unsigned int depth, arch::mem_space doorbells)
-	: qid_(qid), depth_(depth), doorbells_(doorbells), sqTail_(0), cqHead_(0), cqPhase_(1) {
+Queue::Queue(unsigned int qid, unsigned int depth, arch::mem_space doorbells, unsigned int irqVector)
+	: qid_(qid), depth_(depth), irqVector_(irqVector), doorbells_(doorbells), sqTail_(0), cqHead_(0),
+	  cqPhase_(1) {
 	queuedCmds_.resize(depth);
 }
 
@@ -80,7 +81,8 @@ int Queue::handleIrq() {
 }
 
 async::result<size_t> Queue::findFreeSlot() {
-	if (commandsInFlight_ >= depth_)
+	// Polled submissions can take the slot before we are woken up.
+	while (commandsInFlight_ >= depth_)
 		co_await freeSlotDoorbell_.async_wait();
 
 	for (size_t i = 0; i < queuedCmds_.size(); i++) {
@@ -116,9 +118,32 @@ async::result<void> Queue::submitCommandToDevice(std::unique_ptr<Command> cmd) {
 	commandsInFlight_++;
 }
 
-async::result<Command::Result> Queue::submitCommand(std::unique_ptr<Command> cmd) {
+async::result<Command::Result> Queue::submitCommand(std::unique_ptr<Command> cmd,
+		uint64_t pollNanos) {
 	auto future = cmd->getFuture();
 
-	pendingCmdQueue_.put(std::move(cmd));
+	// Polling is only useful if we do not have to wait for a slot.
+	if (!pollNanos || commandsInFlight_ >= depth_) {
+		pendingCmdQueue_.put(std::move(cmd));
+		co_return *(co_await future.get());
+	}
+
+	bool completed = false;
+	cmd->setCompletionFlag(&completed);
+	co_await submitCommandToDevice(std::move(cmd));
+
+	uint64_t start;
+	HEL_CHECK(helGetClock(&start));
+	while (true) {
+		handleIrq();
+		if (completed)
+			break;
+
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		if (now - start >= pollNanos)
+			break;
+	}
+
 	co_return *(co_await future.get());
 }
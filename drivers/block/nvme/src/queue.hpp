@@ -11,7 +11,8 @@
 #include "spec.hpp"
 
 struct Queue {
-	Queue(unsigned int index, unsigned int depth, arch::mem_space doorbells);
+	Queue(unsigned int index, unsigned int depth, arch::mem_space doorbells,
+			unsigned int irqVector = 0);
 
 	void init();
 	async::detached run();
@@ -22,6 +23,9 @@ struct Queue {
 	unsigned int getQueueDepth() const {
 		return depth_;
 	}
+	unsigned int getIrqVector() const {
+		return irqVector_;
+	}
 
 	uintptr_t getCqPhysAddr() const {
 		return cqPhys_;
@@ -30,13 +34,17 @@ struct Queue {
 		return sqPhys_;
 	}
 
-	async::result<Command::Result> submitCommand(std::unique_ptr<Command> cmd);
+	// If pollNanos is non-zero, the command is submitted immediately and we spin on the CQ
+	// for up to pollNanos before we fall back to waiting for an IRQ.
+	async::result<Command::Result> submitCommand(std::unique_ptr<Command> cmd,
+			uint64_t pollNanos = 0);
 
 	int handleIrq();
 
 private:
 	unsigned int qid_;
 	unsigned int depth_;
+	unsigned int irqVector_;
 	arch::mem_space doorbells_;
 	spec::CompletionEntry *cqes_;
 	void *sqCmds_;
@@ -5,8 +5,24 @@
 namespace spec {
 
 enum CommandOpcode {
+	kFlush = 0x00,
 	kWrite = 0x01,
 	kRead = 0x02,
+	kDatasetManagement = 0x09,
+};
+
+enum ReadWriteControl {
+	kForceUnitAccess = 1 << 14,
+};
+
+// Bits of cdw11 of Dataset Management commands.
+enum DatasetManagementAttributes {
+	kDeallocate = 1 << 2,
+};
+
+// Bits of IdentifyController::oncs.
+enum OptionalNvmCommands {
+	kOncsDatasetManagement = 1 << 2,
 };
 
 enum AdminOpcode {
@@ -15,6 +31,11 @@ enum AdminOpcode {
 	kDeleteCQ = 0x4,
 	kCreateCQ = 0x5,
 	kIdentify = 0x6,
+	kSetFeatures = 0x9,
+};
+
+enum FeatureId {
+	kNumberOfQueues = 0x07,
 };
 
 enum CommandFlags {
@@ -260,6 +281,17 @@ struct IdentifyCommand {
 	uint32_t __reserved11[5];
 };
 
+// Dataset Management commands transfer an array of these ranges.
+struct DsmRange {
+	uint32_t attributes;
+	uint32_t length;
+	uint64_t startLba;
+};
+static_assert(sizeof(DsmRange) == 16);
+
+// Maximal number of ranges per Dataset Management command.
+inline constexpr size_t maxDsmRanges = 256;
+
 union Command {
 	CommonCommand common;
 	ReadWriteCommand readWrite;
@@ -1,7 +1,11 @@
 
 #include <stdlib.h>
+#include <algorithm>
+#include <deque>
 #include <iostream>
 
+#include <protocols/clock/vdso.hpp>
+
 #include "block.hpp"
 
 namespace block {
@@ -13,8 +17,8 @@ static bool logInitiateRetire = false;
 // UserRequest
 // --------------------------------------------------------
 
-UserRequest::UserRequest(bool write_, uint64_t sector_, void *buffer_, size_t num_sectors_)
-: write{write_}, sector{sector_}, buffer{buffer_}, numSectors{num_sectors_} { }
+UserRequest::UserRequest(uint32_t type_, uint64_t sector_, void *buffer_, size_t size_)
+: type{type_}, sector{sector_}, buffer{buffer_}, size{size_} { }
 
 // --------------------------------------------------------
 // Device
@@ -22,137 +26,312 @@ UserRequest::UserRequest(bool write_, uint64_t sector_, void *buffer_, size_t nu
 
 Device::Device(std::unique_ptr<virtio_core::Transport> transport, int64_t parent_id)
 : blockfs::BlockDevice{512, parent_id}, _transport{std::move(transport)},
-		_requestQueue{nullptr}, _size{0} { }
+		_useIndirect{false}, _maxSegments{0}, _size{0} {
+	HelHandle clockHandle;
+	HEL_CHECK(helAccessClockPage(&clockHandle));
+	_clockMemory = helix::UniqueDescriptor{clockHandle};
+	_clockPage = helix::Mapping{_clockMemory, 0, sizeof(HelClockPage), kHelMapProtRead};
+}
 
 void Device::runDevice() {
+	bool multiQueue = false;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_MQ)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_MQ);
+		multiQueue = true;
+	}
+	if(_transport->checkDeviceFeature(virtio_core::VIRTIO_RING_F_INDIRECT_DESC)) {
+		_transport->acknowledgeDriverFeature(virtio_core::VIRTIO_RING_F_INDIRECT_DESC);
+		_useIndirect = true;
+	}
+	bool segMax = false;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_SEG_MAX)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_SEG_MAX);
+		segMax = true;
+	}
+	bool discard = false;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_DISCARD)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_DISCARD);
+		discard = true;
+	}
 	_transport->finalizeFeatures();
-	_transport->claimQueues(1);
-	_requestQueue = _transport->setupQueue(0);
+
+	unsigned int numQueues = 1;
+	if(multiQueue) {
+		auto page = reinterpret_cast<HelClockPage *>(_clockPage.get());
+		numQueues = std::max(1u, std::min({
+				static_cast<unsigned int>(_transport->space().load(spec::regs::numQueues)),
+				static_cast<unsigned int>(page->numCpus), maxQueues}));
+	}
+
+	_transport->claimQueues(numQueues);
+	for(unsigned int i = 0; i < numQueues; i++) {
+		auto rq = std::make_unique<RequestQueue>();
+		rq->queue = _transport->setupQueue(i);
+		_queues.push_back(std::move(rq));
+	}
 
 	auto size = static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[0]))
 			| (static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[1])) << 32);
 	std::cout << "virtio: Disk size: " << size << " sectors" << std::endl;
 	_size = size;
 
+	// Each request needs one descriptor for the header and one for the status byte.
+	auto numDescriptors = _queues.front()->queue->numDescriptors();
+	if(_useIndirect) {
+		_maxSegments = indirectTableSize - 2;
+	}else{
+		// Limit to ensure that we don't monopolize the device.
+		_maxSegments = numDescriptors / 4;
+	}
+	if(segMax) {
+		auto deviceSegments = _transport->space().load(spec::regs::segMax);
+		if(deviceSegments)
+			_maxSegments = std::min(_maxSegments, static_cast<size_t>(deviceSegments));
+	}
+	assert(_maxSegments >= 1);
+	if(discard) {
+		_maxDiscardSectors = _transport->space().load(spec::regs::maxDiscardSectors);
+		_maxDiscardSegments = _transport->space().load(spec::regs::maxDiscardSeg);
+		// We keep the payload of each discard request within a single page.
+		_maxDiscardSegments = std::min(_maxDiscardSegments,
+				0x1000 / sizeof(VirtDiscardSegment));
+		if(!_maxDiscardSectors || !_maxDiscardSegments) {
+			_maxDiscardSectors = 0;
+			_maxDiscardSegments = 0;
+		}
+	}
+	std::cout << "virtio: Using " << numQueues << " queues"
+			<< (_useIndirect ? " with indirect descriptors" : "")
+			<< (_maxDiscardSectors ? ", discard is supported" : "") << std::endl;
+
 	_transport->runDevice();
 
 	// perform device specific setup
-	virtRequestBuffer = new VirtRequest[_requestQueue->numDescriptors()];
-	statusBuffer = new uint8_t[_requestQueue->numDescriptors()];
-
-	// natural alignment makes sure that request headers do not cross page boundaries
-	assert((uintptr_t)virtRequestBuffer % sizeof(VirtRequest) == 0);
+	for(auto &rq : _queues) {
+		auto n = rq->queue->numDescriptors();
+		rq->virtRequestBuffer = new VirtRequest[n];
+		rq->statusBuffer = new uint8_t[n];
+
+		// natural alignment makes sure that request headers do not cross page boundaries
+		assert((uintptr_t)rq->virtRequestBuffer % sizeof(VirtRequest) == 0);
+
+		if(_useIndirect) {
+			// Tables must be physically contiguous; page alignment and the table size
+			// (which divides the page size) ensure that they do not cross pages.
+			static_assert(!(0x1000 % (indirectTableSize * sizeof(virtio_core::spec::Descriptor))));
+			auto tables = aligned_alloc(0x1000,
+					n * indirectTableSize * sizeof(virtio_core::spec::Descriptor));
+			assert(tables);
+			rq->indirectTables = new (tables) virtio_core::spec::Descriptor[n * indirectTableSize];
+		}
 
-	// setup an interrupt for the device
-	_processRequests();
+		_processRequests(rq.get());
+	}
 
 	blockfs::runDevice(this);
 }
 
 async::result<void> Device::readSectors(uint64_t sector,
 		void *buffer, size_t num_sectors) {
-	// Natural alignment makes sure a sector does not cross a page boundary.
-	assert(!((uintptr_t)buffer % 512));
-//	printf("readSectors(%lu, %lu)\n", sector, num_sectors);
+	co_await _transfer(false, sector, buffer, num_sectors);
+}
 
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
+async::result<void> Device::writeSectors(uint64_t sector,
+		const void *buffer, size_t num_sectors) {
+	co_await _transfer(true, sector, const_cast<void *>(buffer), num_sectors);
+}
 
-	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(false, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.raise();
-		co_await request->event.wait();
-		delete request;
+async::result<size_t> Device::getSize() {
+	co_return _size * 512;
+}
+
+async::result<void> Device::submit(blockfs::BlockRequest &request) {
+	if(request.op == blockfs::BlockOp::discard) {
+		co_await _discard(request.sector, request.numSectors());
+		co_return;
 	}
+	co_await BlockDevice::submit(request);
 }
 
-async::result<void> Device::writeSectors(uint64_t sector,
-		const void *buffer, size_t num_sectors) {
+async::result<void> Device::_transfer(bool write, uint64_t sector,
+		void *buffer, size_t num_sectors) {
 	// Natural alignment makes sure a sector does not cross a page boundary.
 	assert(!((uintptr_t)buffer % 512));
-//	printf("writeSectors(%lu, %lu)\n", sector, num_sectors);
 
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
+	auto cpu = protocols::clock::getCpu(reinterpret_cast<HelClockPage *>(_clockPage.get()));
+	auto rq = _queues[cpu % _queues.size()].get();
+
+	// A buffer that is not page aligned touches at most one more page than its size suggests.
+	size_t max_sectors = (_maxSegments > 1) ? (_maxSegments - 1) * 8 : 1;
 
+	// Submit all requests before waiting such that the device can process them in parallel.
+	std::deque<UserRequest> requests;
 	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(true, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.raise();
-		co_await request->event.wait();
-		delete request;
+		auto &request = requests.emplace_back(write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN,
+				sector + progress, (char *)buffer + 512 * progress,
+				512 * std::min(num_sectors - progress, max_sectors));
+		rq->pendingQueue.push(&request);
 	}
+	rq->pendingDoorbell.raise();
+
+	for(auto &request : requests)
+		co_await request.event.wait();
 }
 
-async::result<size_t> Device::getSize() {
-	co_return _size * 512;
+async::result<void> Device::_discard(uint64_t sector, size_t num_sectors) {
+	if(!_maxDiscardSectors || !num_sectors)
+		co_return;
+
+	auto cpu = protocols::clock::getCpu(reinterpret_cast<HelClockPage *>(_clockPage.get()));
+	auto rq = _queues[cpu % _queues.size()].get();
+
+	// Each request carries up to _maxDiscardSegments segments in its own page
+	// (such that the payload is physically contiguous).
+	constexpr size_t segmentsPerPage = 0x1000 / sizeof(VirtDiscardSegment);
+	auto sectors_per_request = _maxDiscardSectors * _maxDiscardSegments;
+	auto num_requests = (num_sectors + sectors_per_request - 1) / sectors_per_request;
+	auto pages = aligned_alloc(0x1000, 0x1000 * num_requests);
+	assert(pages);
+	auto segments = new (pages) VirtDiscardSegment[num_requests * segmentsPerPage];
+
+	std::deque<UserRequest> requests;
+	size_t progress = 0;
+	for(size_t i = 0; i < num_requests; i++) {
+		auto first = segments + i * segmentsPerPage;
+		size_t n = 0;
+		while(progress < num_sectors && n < _maxDiscardSegments) {
+			auto chunk = std::min(num_sectors - progress, _maxDiscardSectors);
+			first[n].sector = sector + progress;
+			first[n].numSectors = chunk;
+			first[n].flags = 0;
+			progress += chunk;
+			n++;
+		}
+
+		auto &request = requests.emplace_back(VIRTIO_BLK_T_DISCARD, 0,
+				first, n * sizeof(VirtDiscardSegment));
+		rq->pendingQueue.push(&request);
+	}
+	rq->pendingDoorbell.raise();
+
+	for(auto &request : requests)
+		co_await request.event.wait();
+	free(pages);
+}
+
+size_t Device::_descriptorsPerRequest(UserRequest *request) {
+	if(_useIndirect)
+		return 1;
+	auto address = reinterpret_cast<uintptr_t>(request->buffer);
+	auto numPages = ((address & 0xFFF) + request->size + 0xFFF) >> 12;
+	return numPages + 2;
 }
 
-async::detached Device::_processRequests() {
+async::detached Device::_processRequests(RequestQueue *rq) {
+	auto queue = rq->queue;
+
 	while(true) {
-		if(_pendingQueue.empty()) {
-			co_await _pendingDoorbell.async_wait();
+		if(rq->pendingQueue.empty()) {
+			co_await rq->pendingDoorbell.async_wait();
 			continue;
 		}
 
-		auto request = _pendingQueue.front();
-		_pendingQueue.pop();
-		assert(request->numSectors);
-
-		// Setup the descriptor for the request header.
-		virtio_core::Chain chain;
-		chain.append(co_await _requestQueue->obtainDescriptor());
+		// Submit all pending requests and notify the device only once.
+		bool needsNotify = false;
+		while(!rq->pendingQueue.empty()) {
+			auto request = rq->pendingQueue.front();
+			rq->pendingQueue.pop();
+			assert(request->size);
+
+			// The device does not see requests (and does not free descriptors)
+			// until we notify it. Do that before we block on obtainDescriptor().
+			if(needsNotify && queue->numFreeDescriptors() < _descriptorsPerRequest(request)) {
+				queue->notify();
+				needsNotify = false;
+			}
 
-		VirtRequest *header = &virtRequestBuffer[chain.front().tableIndex()];
-		if(request->write) {
-			header->type = VIRTIO_BLK_T_OUT;
-		}else{
-			header->type = VIRTIO_BLK_T_IN;
-		}
-		header->reserved = 0;
-		header->sector = request->sector;
-
-		chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-				header, sizeof(VirtRequest)});
-
-		// Setup descriptors for the transfered data.
-		for(size_t i = 0; i < request->numSectors; i++) {
-			chain.append(co_await _requestQueue->obtainDescriptor());
-			if(request->write) {
-				chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+			auto dataView = arch::dma_buffer_view{nullptr, request->buffer, request->size};
+			// The device writes to the buffer only for reads.
+			bool deviceWrites = request->type == VIRTIO_BLK_T_IN;
+
+			virtio_core::Chain chain;
+			chain.append(co_await queue->obtainDescriptor());
+			auto index = chain.front().tableIndex();
+
+			VirtRequest *header = &rq->virtRequestBuffer[index];
+			header->type = request->type;
+			header->reserved = 0;
+			header->sector = request->sector;
+			auto headerView = arch::dma_buffer_view{nullptr, header, sizeof(VirtRequest)};
+			auto statusView = arch::dma_buffer_view{nullptr, &rq->statusBuffer[index], 1};
+
+			if(_useIndirect) {
+				// Place header, data and status into the indirect table; the request
+				// then consumes only a single descriptor of the ring.
+				auto table = rq->indirectTables + index * indirectTableSize;
+				size_t n = 0;
+				auto appendEntry = [&] (arch::dma_buffer_view view, bool deviceWrites) {
+					assert(n < indirectTableSize);
+					uintptr_t physical;
+					HEL_CHECK(helPointerPhysical(view.data(), &physical));
+					table[n].address.store(physical);
+					table[n].length.store(view.size());
+					table[n].flags.store(deviceWrites ? virtio_core::VIRTQ_DESC_F_WRITE : 0);
+					if(n)
+						table[n - 1].flags.store(table[n - 1].flags.load()
+								| virtio_core::VIRTQ_DESC_F_NEXT);
+					table[n].next.store(n + 1);
+					n++;
+				};
+
+				appendEntry(headerView, false);
+				size_t offset = 0;
+				while(offset < dataView.size()) {
+					auto address = reinterpret_cast<uintptr_t>(dataView.data()) + offset;
+					auto chunk = std::min(dataView.size() - offset,
+							0x1000 - (address & 0xFFF));
+					appendEntry(dataView.subview(offset, chunk), deviceWrites);
+					offset += chunk;
+				}
+				appendEntry(statusView, true);
+
+				chain.front().setupIndirect(arch::dma_buffer_view{nullptr,
+						table, n * sizeof(virtio_core::spec::Descriptor)});
 			}else{
-				chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
+				chain.setupBuffer(virtio_core::hostToDevice, headerView);
+
+				// Setup descriptors for the transfered data.
+				if(deviceWrites) {
+					co_await virtio_core::scatterGather(virtio_core::deviceToHost,
+							chain, queue, dataView);
+				}else{
+					co_await virtio_core::scatterGather(virtio_core::hostToDevice,
+							chain, queue, dataView);
+				}
+
+				// Setup a descriptor for the status byte.
+				chain.append(co_await queue->obtainDescriptor());
+				chain.setupBuffer(virtio_core::deviceToHost, statusView);
 			}
-		}
-
-		if(logInitiateRetire)
-			std::cout << "Submitting " << request->numSectors
-					<< " data descriptors" << std::endl;
 
-		// Setup a descriptor for the status byte.
-		chain.append(co_await _requestQueue->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-				&statusBuffer[chain.front().tableIndex()], 1});
-
-		// Submit the request to the device
-		_requestQueue->postDescriptor(chain.front(), request,
-				[] (virtio_core::Request *base_request) {
-			auto request = static_cast<UserRequest *>(base_request);
 			if(logInitiateRetire)
-				std::cout << "Retiring " << request->numSectors
-						<< " data descriptors" << std::endl;
-			request->event.raise();
-		});
-		_requestQueue->notify();
+				std::cout << "Submitting " << request->size
+						<< " bytes" << std::endl;
+
+			// Submit the request to the device
+			queue->postDescriptor(chain.front(), request,
+					[] (virtio_core::Request *base_request) {
+				auto request = static_cast<UserRequest *>(base_request);
+				if(logInitiateRetire)
+					std::cout << "Retiring " << request->size
+							<< " bytes" << std::endl;
+				request->event.raise();
+			});
+			needsNotify = true;
+		}
+
+		if(needsNotify)
+			queue->notify();
 	}
 }
 
@@ -1,10 +1,12 @@
 
 #include <memory>
 #include <queue>
+#include <vector>
 
 #include <blockfs.hpp>
 #include <core/virtio/core.hpp>
 #include <async/oneshot-event.hpp>
+#include <helix/memory.hpp>
 
 namespace block {
 namespace virtio {
@@ -20,15 +22,35 @@ struct VirtRequest {
 };
 static_assert(sizeof(VirtRequest) == 16, "Bad sizeof(VirtRequest)");
 
+// Payload of VIRTIO_BLK_T_DISCARD requests.
+struct VirtDiscardSegment {
+	uint64_t sector;
+	uint32_t numSectors;
+	uint32_t flags;
+};
+static_assert(sizeof(VirtDiscardSegment) == 16, "Bad sizeof(VirtDiscardSegment)");
+
 enum {
 	VIRTIO_BLK_T_IN = 0,
-	VIRTIO_BLK_T_OUT = 1
+	VIRTIO_BLK_T_OUT = 1,
+	VIRTIO_BLK_T_DISCARD = 11
+};
+
+// Feature bits.
+enum {
+	VIRTIO_BLK_F_SEG_MAX = 2,
+	VIRTIO_BLK_F_MQ = 12,
+	VIRTIO_BLK_F_DISCARD = 13
 };
 
 namespace spec::regs {
 	inline constexpr arch::scalar_register<uint32_t> capacity[] = {
 			arch::scalar_register<uint32_t>{0},
 			arch::scalar_register<uint32_t>{4}};
+	inline constexpr arch::scalar_register<uint32_t> segMax{12};
+	inline constexpr arch::scalar_register<uint16_t> numQueues{34};
+	inline constexpr arch::scalar_register<uint32_t> maxDiscardSectors{36};
+	inline constexpr arch::scalar_register<uint32_t> maxDiscardSeg{40};
 }
 
 struct Device;
@@ -38,16 +60,37 @@ struct Device;
 // --------------------------------------------------------
 
 struct UserRequest : virtio_core::Request {
-	UserRequest(bool write, uint64_t sector, void *buffer, size_t num_sectors);
+	UserRequest(uint32_t type, uint64_t sector, void *buffer, size_t size);
 
-	bool write;
+	// One of VIRTIO_BLK_T_IN, VIRTIO_BLK_T_OUT or VIRTIO_BLK_T_DISCARD.
+	uint32_t type;
 	uint64_t sector;
 	void *buffer;
-	size_t numSectors;
+	// Size of the buffer in bytes.
+	size_t size;
 
 	async::oneshot_event event;
 };
 
+// --------------------------------------------------------
+// RequestQueue
+// --------------------------------------------------------
+
+// State of a single virtq. We use one virtq per CPU (if the device supports it).
+struct RequestQueue {
+	virtio_core::Queue *queue = nullptr;
+
+	// Stores UserRequest objects that have not been submitted yet.
+	std::queue<UserRequest *> pendingQueue;
+	async::recurring_event pendingDoorbell;
+
+	// These buffers store virtio-block request headers, status bytes and indirect
+	// descriptor tables. They are indexed by the index of the request's first descriptor.
+	VirtRequest *virtRequestBuffer = nullptr;
+	uint8_t *statusBuffer = nullptr;
+	virtio_core::spec::Descriptor *indirectTables = nullptr;
+};
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
@@ -65,23 +108,44 @@ struct Device : blockfs::BlockDevice {
 
 	async::result<size_t> getSize() override;
 
+	async::result<void> submit(blockfs::BlockRequest &request) override;
+
 private:
-	// Submits requests from _pendingQueue to the device.
-	async::detached _processRequests();
+	// Number of descriptors in each indirect descriptor table.
+	static constexpr size_t indirectTableSize = 32;
+
+	// Upper bound on the number of virtqs that we use.
+	static constexpr unsigned int maxQueues = 8;
+
+	// Splits a transfer into requests and submits them to the queue of the current CPU.
+	async::result<void> _transfer(bool write, uint64_t sector, void *buffer, size_t num_sectors);
+
+	// Discards the sectors (if VIRTIO_BLK_F_DISCARD was negotiated).
+	async::result<void> _discard(uint64_t sector, size_t num_sectors);
+
+	// Submits requests from the pending queue to the device.
+	async::detached _processRequests(RequestQueue *rq);
+
+	// Returns the number of descriptors (in the ring) that a request consumes.
+	size_t _descriptorsPerRequest(UserRequest *request);
 
 	std::unique_ptr<virtio_core::Transport> _transport;
 
-	// The single virtq of this device.
-	virtio_core::Queue *_requestQueue;
+	std::vector<std::unique_ptr<RequestQueue>> _queues;
 
-	// Stores UserRequest objects that have not been submitted yet.
-	std::queue<UserRequest *> _pendingQueue;
-	async::recurring_event _pendingDoorbell;
+	// Whether VIRTIO_RING_F_INDIRECT_DESC was negotiated.
+	bool _useIndirect;
+
+	// Maximal number of data segments per request.
+	size_t _maxSegments;
+
+	// Limits of discard requests (zero if discard is not supported).
+	size_t _maxDiscardSectors = 0;
+	size_t _maxDiscardSegments = 0;
 
-	// these two buffer store virtio-block request header and status bytes
-	// they are indexed by the index of the request's first descriptor
-	VirtRequest *virtRequestBuffer;
-	uint8_t *statusBuffer;
+	// Used to determine the current CPU.
+	helix::UniqueDescriptor _clockMemory;
+	helix::Mapping _clockPage;
 
 	// The size of the disk
 	size_t _size;
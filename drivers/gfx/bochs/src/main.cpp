@@ -366,8 +366,8 @@ uint32_t GfxDevice::FrameBuffer::getHeight() {
 	return _bo->getHeight();
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect>) {
+	// Buffers live in VRAM and are scanned out directly, so there is nothing to copy.
 }
 
 // ----------------------------------------------------------------
@@ -1,3 +1,16 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+
+#include <arch/mem_space.hpp>
+#include <async/result.hpp>
+#include <core/drm/core.hpp>
+#include <protocols/hw/client.hpp>
+
+#include "spec.hpp"
 
 struct PllLimits {
 	struct {
@@ -88,3 +101,204 @@ struct Framebuffer {
 	uintptr_t address;
 };
 
+
+struct Controller {
+	Controller(arch::mem_space ctrl, volatile uint32_t *gtt, size_t gtt_entries)
+	: _ctrl{ctrl}, _gtt{gtt}, _gttEntries{gtt_entries} { }
+
+	// Reads the EDID of the monitor attached to the analog port.
+	void readEdid(void *buffer);
+
+	// Performs a full mode set and scans out of fb.
+	void modeset(Mode mode, PllParams params, int multiplier, Framebuffer *fb);
+
+	// Turns off the plane, pipe, DPLL and DAC.
+	void shutdown();
+
+	// ------------------------------------------------------------------------
+	// GMBUS functions.
+	// ------------------------------------------------------------------------
+	void i2cWrite(unsigned int address, const void *buffer, size_t size);
+	void i2cRead(unsigned int address, void *buffer, size_t size);
+
+private:
+	void _waitForGmbusProgress();
+	void _waitForGmbusCompletion();
+
+public:
+	// ------------------------------------------------------------------------
+	// DPLL programming functions.
+	// ------------------------------------------------------------------------
+
+	void disableDpll();
+	void programDpll(PllParams params, int multiplier);
+	void dumpDpll();
+
+	// ------------------------------------------------------------------------
+	// Pipe programming functions.
+	// ------------------------------------------------------------------------
+
+	void disablePipe();
+	void programPipe(Mode mode);
+	void dumpPipe();
+
+	// ------------------------------------------------------------------------
+	// Plane handling functions.
+	// ------------------------------------------------------------------------
+
+	void disablePlane();
+	void enablePlane(Framebuffer *fb);
+
+	// ------------------------------------------------------------------------
+	// Cursor handling functions.
+	// ------------------------------------------------------------------------
+
+	void disableCursor();
+	void enableCursor(uintptr_t address);
+	void moveCursor(int x, int y);
+
+	// ------------------------------------------------------------------------
+	// Port handling functions.
+	// ------------------------------------------------------------------------
+
+	void disableDac();
+	void enableDac();
+
+	// ------------------------------------------------------------------------
+	// GTT functions.
+	// ------------------------------------------------------------------------
+
+	size_t gttEntries() {
+		return _gttEntries;
+	}
+
+	// Number of leading GTT entries that firmware already populated (i.e., stolen memory).
+	size_t countPopulatedEntries();
+
+	void bindPages(size_t first, std::span<const uintptr_t> physicals);
+	void unbindPages(size_t first, size_t count);
+
+	// ------------------------------------------------------------------------
+	// Miscellaneous functions.
+	// ------------------------------------------------------------------------
+
+	void relinquishVga();
+
+private:
+	arch::mem_space _ctrl;
+	volatile uint32_t *_gtt;
+	size_t _gttEntries;
+};
+
+struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevice> {
+	struct FrameBuffer;
+
+	struct Configuration : drm_core::Configuration {
+		Configuration(GfxDevice *device)
+		: _device(device) { };
+
+		bool capture(std::vector<drm_core::Assignment> assignment, std::unique_ptr<drm_core::AtomicState> &state) override;
+		void dispose() override;
+		void commit(std::unique_ptr<drm_core::AtomicState> state) override;
+
+	private:
+		async::detached _doCommit(std::unique_ptr<drm_core::AtomicState> state);
+
+		GfxDevice *_device;
+	};
+
+	struct Plane : drm_core::Plane {
+		Plane(GfxDevice *device, PlaneType type);
+	};
+
+	// Buffers live in system memory and are bound into the GTT. The CPU accesses them
+	// through the aperture, which keeps its view coherent with scanout.
+	struct BufferObject final : drm_core::BufferObject, std::enable_shared_from_this<BufferObject> {
+		BufferObject(GfxDevice *device, size_t size, uintptr_t gtt_offset,
+				helix::UniqueDescriptor memory, uint32_t width, uint32_t height);
+		~BufferObject();
+
+		std::shared_ptr<drm_core::BufferObject> sharedBufferObject() override;
+		size_t getSize() override;
+		std::pair<helix::BorrowedDescriptor, uint64_t> getMemory() override;
+
+		// Offset of the buffer in the graphics address space.
+		uintptr_t getGttOffset();
+
+	private:
+		GfxDevice *_device;
+		size_t _size;
+		uintptr_t _gttOffset;
+		helix::UniqueDescriptor _memory;
+		helix::Mapping _mapping;
+		helix::UniqueDescriptor _apertureView;
+	};
+
+	struct Connector : drm_core::Connector {
+		Connector(GfxDevice *device);
+
+	private:
+		std::vector<drm_core::Encoder *> _encoders;
+	};
+
+	struct Encoder : drm_core::Encoder {
+		Encoder(GfxDevice *device);
+	};
+
+	struct Crtc final : drm_core::Crtc {
+		Crtc(GfxDevice *device);
+
+		drm_core::Plane *primaryPlane() override;
+		drm_core::Plane *cursorPlane() override;
+
+	private:
+		GfxDevice *_device;
+	};
+
+	struct FrameBuffer final : drm_core::FrameBuffer {
+		FrameBuffer(GfxDevice *device, std::shared_ptr<GfxDevice::BufferObject> bo,
+				uint32_t pitch);
+
+		GfxDevice::BufferObject *getBufferObject();
+		uint32_t getPitch();
+		void notifyDirty(std::vector<drm_mode_rect> damage) override;
+		uint32_t getWidth() override;
+		uint32_t getHeight() override;
+
+	private:
+		std::shared_ptr<GfxDevice::BufferObject> _bo;
+		uint32_t _pitch;
+	};
+
+	GfxDevice(protocols::hw::Device hw_device, Controller controller,
+			helix::UniqueDescriptor aperture);
+
+	async::result<std::unique_ptr<drm_core::Configuration>> initialize();
+	std::unique_ptr<drm_core::Configuration> createConfiguration() override;
+	std::pair<std::shared_ptr<drm_core::BufferObject>, uint32_t> createDumb(uint32_t width,
+			uint32_t height, uint32_t bpp) override;
+	std::shared_ptr<drm_core::FrameBuffer>
+			createFrameBuffer(std::shared_ptr<drm_core::BufferObject> bo,
+			uint32_t width, uint32_t height, uint32_t format, uint32_t pitch) override;
+
+	//returns major, minor, patchlvl
+	std::tuple<int, int, int> driverVersion() override;
+	//returns name, desc, date
+	std::tuple<std::string, std::string, std::string> driverInfo() override;
+
+private:
+	std::shared_ptr<Crtc> _theCrtc;
+	std::shared_ptr<Encoder> _theEncoder;
+	std::shared_ptr<Connector> _theConnector;
+	std::shared_ptr<Plane> _primaryPlane;
+	std::shared_ptr<Plane> _cursorPlane;
+
+	protocols::hw::Device _hwDevice;
+	Controller _controller;
+	helix::UniqueDescriptor _aperture;
+	range_allocator _gttAllocator;
+	size_t _reservedGttSize;
+	bool _claimedDevice;
+	// Mode that the pipe is currently programmed to (if any).
+	std::optional<drm_mode_modeinfo> _currentMode;
+};
@@ -1,16 +1,31 @@
 
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
+#include <bit>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include <arch/mem_space.hpp>
 #include <async/result.hpp>
+#include <helix/ipc.hpp>
+#include <protocols/fs/server.hpp>
 #include <protocols/hw/client.hpp>
 #include <protocols/mbus/client.hpp>
+#include <core/drm/core.hpp>
+
+#include <libdrm/drm.h>
+#include <libdrm/drm_mode.h>
 
 #include "spec.hpp"
 #include "intel.hpp"
+#include <fs.bragi.hpp>
+
+namespace {
+	constexpr bool logBuffers = false;
+	constexpr bool logCommits = false;
+}
 
 struct [[ gnu::packed ]] DisplayData {
 	uint8_t magic[8];
@@ -171,90 +186,30 @@ int computeSdvoMultiplier(int pixel_clock) {
 	}
 }
 
-struct Controller {
-	Controller(arch::mem_space ctrl, void *memory)
-	: _ctrl{ctrl}, _memory{memory} { }
-
-	void run();
-
-private:
-	// ------------------------------------------------------------------------
-	// GMBUS functions.
-	// ------------------------------------------------------------------------
-	void i2cWrite(unsigned int address, const void *buffer, size_t size);
-	void i2cRead(unsigned int address, void *buffer, size_t size);
-
-	void _waitForGmbusProgress();
-	void _waitForGmbusCompletion();
-
-	// ------------------------------------------------------------------------
-	// DPLL programming functions.
-	// ------------------------------------------------------------------------
-
-	void disableDpll();
-	void programDpll(PllParams params, int multiplier);
-	void dumpDpll();
-
-	// ------------------------------------------------------------------------
-	// Pipe programming functions.
-	// ------------------------------------------------------------------------
-
-	void disablePipe();
-	void programPipe(Mode mode);
-	void dumpPipe();
-	
-	// ------------------------------------------------------------------------
-	// Plane handling functions.
-	// ------------------------------------------------------------------------
-
-	void disablePlane();
-	void enablePlane(Framebuffer *fb);
-	
-	// ------------------------------------------------------------------------
-	// Port handling functions.
-	// ------------------------------------------------------------------------
-
-	void disableDac();
-	void enableDac();
-
-	// ------------------------------------------------------------------------
-	// Miscellaneous functions.
-	// ------------------------------------------------------------------------
-
-	void relinquishVga();
-
-private:
-	arch::mem_space _ctrl;
-	void *_memory;
-};
+Mode modeInfoToMode(const drm_mode_modeinfo &info) {
+	Mode mode;
+	mode.dot = info.clock;
+	mode.horizontal.active = info.hdisplay;
+	mode.horizontal.syncStart = info.hsync_start;
+	mode.horizontal.syncEnd = info.hsync_end;
+	mode.horizontal.total = info.htotal;
+	mode.vertical.active = info.vdisplay;
+	mode.vertical.syncStart = info.vsync_start;
+	mode.vertical.syncEnd = info.vsync_end;
+	mode.vertical.total = info.vtotal;
+	return mode;
+}
 
-void Controller::run() {
+void Controller::readEdid(void *buffer) {
 	uint8_t offset = 0;
-	DisplayData edid;
-
 	_ctrl.store(regs::gmbusSelect, gmbus_select::pairSelect(PinPair::analog));
 	i2cWrite(0x50, &offset, 1);
-	i2cRead(0x50, &edid, 128);
-
-	auto mode = edidToMode(edid);
+	i2cRead(0x50, buffer, 128);
+}
 
-	// Set up a nice framebuffer for our mode.
-	Framebuffer fb;
-	fb.width = mode.horizontal.active;
-	fb.height = mode.vertical.active;
-	fb.stride = fb.width * 4;
-	fb.address = 0;
-
-	auto plane = reinterpret_cast<uint32_t *>(_memory);
-	for(size_t x = 0; x < fb.width; x++)
-		for(size_t y = 0; y < fb.height; y++)
-			plane[y * fb.width + x] = (x / 5) | ((y / 4) << 8);
-
-	// Perform the mode setting.
-	auto multiplier = computeSdvoMultiplier(mode.dot);
-	auto params = findParams(mode.dot * multiplier, 96000, limitsG45);
-	
+void Controller::modeset(Mode mode, PllParams params, int multiplier, Framebuffer *fb) {
 	disableDac();
+	disablePlane();
 	disablePipe();
 	disableDpll();
 	relinquishVga();
@@ -264,10 +219,18 @@ void Controller::run() {
 
 	programPipe(mode);
 	dumpPipe();
-	enablePlane(&fb);
+	enablePlane(fb);
 	enableDac();
 }
 
+void Controller::shutdown() {
+	disableDac();
+	disableCursor();
+	disablePlane();
+	disablePipe();
+	disableDpll();
+}
+
 // ------------------------------------------------------------------------
 // GMBUS functions.
 // ------------------------------------------------------------------------
@@ -353,7 +316,8 @@ void Controller::_waitForGmbusCompletion() {
 
 void Controller::disableDpll() {
 	auto bits = _ctrl.load(regs::pllControl);
-	assert(bits & pll_control::enablePll);
+	if(!(bits & pll_control::enablePll))
+		return;
 	_ctrl.store(regs::pllControl, bits & ~pll_control::enablePll);
 }
 
@@ -427,8 +391,8 @@ void Controller::dumpDpll() {
 void Controller::disablePipe() {
 	auto bits = _ctrl.load(regs::pipeConfig);
 	std::cout << "Pipe config: " << static_cast<uint32_t>(bits) << std::endl;
-	assert(bits & pipe_config::enablePipe);
-	assert(bits & pipe_config::pipeStatus);
+	if(!(bits & pipe_config::enablePipe))
+		return;
 	_ctrl.store(regs::pipeConfig, bits & ~pipe_config::enablePipe);
 	
 	std::cout << "After disable: " << (_ctrl.load(regs::pipeConfig)
@@ -505,22 +469,50 @@ void Controller::dumpPipe() {
 
 void Controller::disablePlane() {
 	auto bits = _ctrl.load(regs::planeControl);
-	assert(bits & plane_control::enablePlane);
+	if(!(bits & plane_control::enablePlane))
+		return;
 	_ctrl.store(regs::planeControl, bits & ~plane_control::enablePlane);
+	// The control register is only latched once the surface address is written.
+	_ctrl.store(regs::planeAddress, _ctrl.load(regs::planeAddress));
 }
 
+// Also used to flip: the hardware latches all plane registers at the next vblank
+// after the surface address is written, so this never tears.
 void Controller::enablePlane(Framebuffer *fb) {
 	assert(!(fb->stride % 64));
-	_ctrl.store(regs::planeOffset, 0);
-	_ctrl.store(regs::planeStride, fb->stride);
-	_ctrl.store(regs::planeAddress, fb->address);
+	assert(!(fb->address % 0x1000));
 
 	auto bits = _ctrl.load(regs::planeControl);
-	std::cout << "Plane control: " << static_cast<uint32_t>(bits) << std::endl;
-	assert(!(bits & plane_control::enablePlane));
 	_ctrl.store(regs::planeControl, (bits & ~plane_control::pixelFormat)
-			| plane_control::pixelFormat(PrimaryFormat::RGBX8888)
+			| plane_control::pixelFormat(PrimaryFormat::BGRX8888)
 			| plane_control::enablePlane(true));
+	_ctrl.store(regs::planeOffset, 0);
+	_ctrl.store(regs::planeStride, fb->stride);
+	_ctrl.store(regs::planeAddress, fb->address);
+}
+
+// ------------------------------------------------------------------------
+// Cursor handling functions.
+// ------------------------------------------------------------------------
+
+void Controller::disableCursor() {
+	_ctrl.store(regs::cursorControl, cursor_control::mode(CursorMode::disabled));
+	_ctrl.store(regs::cursorBase, 0);
+}
+
+void Controller::enableCursor(uintptr_t address) {
+	assert(!(address % 0x1000));
+	_ctrl.store(regs::cursorControl, cursor_control::mode(CursorMode::argb64x64)
+			| cursor_control::pipeSelect(0));
+	_ctrl.store(regs::cursorBase, address);
+}
+
+// Only touches the position register, so moving the cursor does not require a new
+// base address (and does not wait for vblank).
+void Controller::moveCursor(int x, int y) {
+	_ctrl.store(regs::cursorPosition,
+			cursor_position::x(std::abs(x)) | cursor_position::xSign(x < 0)
+			| cursor_position::y(std::abs(y)) | cursor_position::ySign(y < 0));
 }
 
 // ------------------------------------------------------------------------
@@ -530,7 +522,8 @@ void Controller::enablePlane(Framebuffer *fb) {
 void Controller::disableDac() {
 	auto bits = _ctrl.load(regs::dacPort);
 	std::cout << "DAC Port: " << static_cast<uint32_t>(bits) << std::endl;
-	assert(bits & dac_port::enableDac);
+	if(!(bits & dac_port::enableDac))
+		return;
 	_ctrl.store(regs::dacPort, bits & ~dac_port::enableDac);
 }
 
@@ -546,38 +539,496 @@ void Controller::enableDac() {
 
 void Controller::relinquishVga() {
 	auto bits = _ctrl.load(regs::vgaControl);
-	assert(!(bits & vga_control::disableVga));
+	if(bits & vga_control::disableVga)
+		return;
 	_ctrl.store(regs::vgaControl, (bits & ~vga_control::centeringMode)
 			| vga_control::disableVga(true));
 }
 
+// ------------------------------------------------------------------------
+// GTT functions.
+// ------------------------------------------------------------------------
+
+size_t Controller::countPopulatedEntries() {
+	size_t n = 0;
+	while(n < _gttEntries && (_gtt[n] & gtt_entry::valid))
+		n++;
+	return n;
+}
+
+void Controller::bindPages(size_t first, std::span<const uintptr_t> physicals) {
+	assert(first + physicals.size() <= _gttEntries);
+	for(size_t i = 0; i < physicals.size(); i++)
+		_gtt[first + i] = gtt_entry::encode(physicals[i]);
+	// Posting read: make sure that the PTEs reach the GTT before the GPU uses them.
+	(void)_gtt[first + physicals.size() - 1];
+}
+
+void Controller::unbindPages(size_t first, size_t count) {
+	assert(first + count <= _gttEntries);
+	for(size_t i = 0; i < count; i++)
+		_gtt[first + i] = 0;
+	(void)_gtt[first + count - 1];
+}
+
+// ----------------------------------------------------------------
+// GfxDevice.
+// ----------------------------------------------------------------
+
+GfxDevice::GfxDevice(protocols::hw::Device hw_device, Controller controller,
+		helix::UniqueDescriptor aperture)
+: _hwDevice{std::move(hw_device)}, _controller{controller}, _aperture{std::move(aperture)},
+		_gttAllocator{static_cast<unsigned int>(std::bit_width(_controller.gttEntries()) - 1 + 12), 12},
+		_claimedDevice{false} {
+	// Keep the GTT entries that firmware set up for stolen memory; the VGA console lives there.
+	_reservedGttSize = _controller.countPopulatedEntries() * 0x1000;
+	if(_reservedGttSize) {
+		[[maybe_unused]] auto offset = _gttAllocator.allocate(_reservedGttSize);
+		assert(!offset);
+	}
+}
+
+async::result<std::unique_ptr<drm_core::Configuration>> GfxDevice::initialize() {
+	std::vector<drm_core::Assignment> assignments;
+
+	DisplayData edid;
+	_controller.readEdid(&edid);
+	auto mode = edidToMode(edid);
+
+	_theCrtc = std::make_shared<Crtc>(this);
+	_theCrtc->setupWeakPtr(_theCrtc);
+	_theCrtc->setupState(_theCrtc);
+	_theEncoder = std::make_shared<Encoder>(this);
+	_theEncoder->setupWeakPtr(_theEncoder);
+	_theConnector = std::make_shared<Connector>(this);
+	_theConnector->setupWeakPtr(_theConnector);
+	_theConnector->setupState(_theConnector);
+	_primaryPlane = std::make_shared<Plane>(this, Plane::PlaneType::PRIMARY);
+	_primaryPlane->setupWeakPtr(_primaryPlane);
+	_primaryPlane->setupState(_primaryPlane);
+	_cursorPlane = std::make_shared<Plane>(this, Plane::PlaneType::CURSOR);
+	_cursorPlane->setupWeakPtr(_cursorPlane);
+	_cursorPlane->setupState(_cursorPlane);
+
+	registerObject(_theCrtc.get());
+	registerObject(_theEncoder.get());
+	registerObject(_theConnector.get());
+	registerObject(_primaryPlane.get());
+	registerObject(_cursorPlane.get());
+
+	assignments.push_back(drm_core::Assignment::withInt(_theCrtc, activeProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withBlob(_theCrtc, modeIdProperty(), nullptr));
+
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, planeTypeProperty(), 1));
+	assignments.push_back(drm_core::Assignment::withModeObj(_primaryPlane, crtcIdProperty(), _theCrtc));
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, srcHProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, srcWProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, crtcHProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, crtcWProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, srcXProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, srcYProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, crtcXProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withInt(_primaryPlane, crtcYProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withModeObj(_primaryPlane, fbIdProperty(), nullptr));
+
+	assignments.push_back(drm_core::Assignment::withInt(_cursorPlane, planeTypeProperty(), 2));
+	assignments.push_back(drm_core::Assignment::withModeObj(_cursorPlane, crtcIdProperty(), _theCrtc));
+	assignments.push_back(drm_core::Assignment::withInt(_cursorPlane, crtcXProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withInt(_cursorPlane, crtcYProperty(), 0));
+	assignments.push_back(drm_core::Assignment::withModeObj(_cursorPlane, fbIdProperty(), nullptr));
+
+	assignments.push_back(drm_core::Assignment::withInt(_theConnector, dpmsProperty(), 3));
+	assignments.push_back(drm_core::Assignment::withModeObj(_theConnector, crtcIdProperty(), _theCrtc));
+
+	_theEncoder->setCurrentCrtc(_theCrtc.get());
+	_theConnector->setupPossibleEncoders({_theEncoder.get()});
+	_theConnector->setCurrentEncoder(_theEncoder.get());
+	_theConnector->setCurrentStatus(1);
+	_theEncoder->setupPossibleCrtcs({_theCrtc.get()});
+	_theEncoder->setupPossibleClones({_theEncoder.get()});
+	_primaryPlane->setupPossibleCrtcs({_theCrtc.get()});
+	_cursorPlane->setupPossibleCrtcs({_theCrtc.get()});
+
+	setupCrtc(_theCrtc.get());
+	setupEncoder(_theEncoder.get());
+	attachConnector(_theConnector.get());
+
+	// The DPLL can only hit exact dot clocks, hence we only offer the monitor's preferred mode.
+	char name[sizeof(drm_mode_modeinfo::name)];
+	snprintf(name, sizeof(name), "%dx%d", mode.horizontal.active, mode.vertical.active);
+	std::vector<drm_mode_modeinfo> supported_modes;
+	supported_modes.push_back(drm_core::makeModeInfo(name,
+			DRM_MODE_TYPE_DRIVER | DRM_MODE_TYPE_PREFERRED, mode.dot,
+			mode.horizontal.active, mode.horizontal.syncStart, mode.horizontal.syncEnd,
+			mode.horizontal.total, 0,
+			mode.vertical.active, mode.vertical.syncStart, mode.vertical.syncEnd,
+			mode.vertical.total, 0, 0));
+	_theConnector->setModeList(supported_modes);
+
+	setupMinDimensions(640, 480);
+	setupMaxDimensions(4096, 4096);
+
+	_theConnector->setupPhysicalDimensions(edid.screenWidth * 10, edid.screenHeight * 10);
+	_theConnector->setupSubpixel(0);
+	_theConnector->setConnectorType(DRM_MODE_CONNECTOR_VGA);
+
+	auto config = createConfiguration();
+	auto state = atomicState();
+	assert(config->capture(assignments, state));
+	config->commit(std::move(state));
+
+	co_return std::move(config);
+}
+
+std::unique_ptr<drm_core::Configuration> GfxDevice::createConfiguration() {
+	return std::make_unique<Configuration>(this);
+}
+
+std::shared_ptr<drm_core::FrameBuffer> GfxDevice::createFrameBuffer(std::shared_ptr<drm_core::BufferObject> base_bo,
+		uint32_t width, uint32_t height, uint32_t, uint32_t pitch) {
+	auto bo = std::static_pointer_cast<GfxDevice::BufferObject>(base_bo);
+
+	assert(pitch % 64 == 0);
+	assert(pitch >= width * 4);
+	assert(bo->getSize() >= pitch * height);
+
+	auto fb = std::make_shared<FrameBuffer>(this, bo, pitch);
+	fb->setupWeakPtr(fb);
+	registerObject(fb.get());
+	return fb;
+}
+
+std::tuple<int, int, int> GfxDevice::driverVersion() {
+	return {1, 0, 0};
+}
+
+std::tuple<std::string, std::string, std::string> GfxDevice::driverInfo() {
+	return {"i915", "Intel Graphics", "20231211"};
+}
+
+std::pair<std::shared_ptr<drm_core::BufferObject>, uint32_t>
+GfxDevice::createDumb(uint32_t width, uint32_t height, uint32_t bpp) {
+	assert(bpp == 32);
+	unsigned int page_size = 4096;
+
+	// The display engine requires 64 byte aligned strides.
+	auto pitch = ((width * (bpp / 8)) + 63) & ~uint32_t{63};
+	auto size = ((pitch * height) + (page_size - 1)) & ~(page_size - 1);
+
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+
+	auto gtt_offset = _gttAllocator.allocate(size);
+	if(logBuffers)
+		std::cout << "gfx/intel: Allocating " << width << "x" << height
+				<< " buffer of size " << (void *)(size_t)size
+				<< " at GTT offset " << (void *)gtt_offset << std::endl;
+
+	auto buffer = std::make_shared<BufferObject>(this, size, gtt_offset,
+			helix::UniqueDescriptor{handle}, width, height);
+
+	auto mapping = installMapping(buffer.get());
+	buffer->setupMapping(mapping);
+	return std::make_pair(buffer, pitch);
+}
+
+// ----------------------------------------------------------------
+// GfxDevice::Configuration.
+// ----------------------------------------------------------------
+
+bool GfxDevice::Configuration::capture(std::vector<drm_core::Assignment> assignment, std::unique_ptr<drm_core::AtomicState> &state) {
+	for(auto &assign: assignment) {
+		assert(assign.property->validate(assign));
+		assign.property->writeToState(assign, state);
+	}
+
+	auto plane_state = state->plane(_device->_primaryPlane->id());
+	auto cursor_state = state->plane(_device->_cursorPlane->id());
+	auto crtc_state = state->crtc(_device->_theCrtc->id());
+
+	if(crtc_state->mode != nullptr) {
+		drm_mode_modeinfo mode_info;
+		memcpy(&mode_info, crtc_state->mode->data(), sizeof(drm_mode_modeinfo));
+		plane_state->src_h = mode_info.vdisplay;
+		plane_state->src_w = mode_info.hdisplay;
+
+		if(plane_state->src_w <= 0 || plane_state->src_h <= 0) {
+			std::cout << "\e[31m" "gfx/intel: invalid state width of height" << "\e[39m" << std::endl;
+			return false;
+		}
+
+		auto mode = modeInfoToMode(mode_info);
+		try {
+			findParams(mode.dot * computeSdvoMultiplier(mode.dot), 96000, limitsG45);
+		}catch(const std::runtime_error &) {
+			std::cout << "\e[31m" "gfx/intel: mode " << mode_info.name
+					<< " cannot be generated by the DPLL" "\e[39m" << std::endl;
+			return false;
+		}
+
+		if(!plane_state->fb) {
+			std::cout << "\e[31m" "gfx/intel: no framebuffer for primary plane" "\e[39m" << std::endl;
+			return false;
+		}
+	}
+
+	if(cursor_state->fb) {
+		auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(cursor_state->fb);
+		if(fb->getWidth() != cursorSize || fb->getHeight() != cursorSize
+				|| fb->getPitch() != cursorSize * 4) {
+			std::cout << "\e[31m" "gfx/intel: cursor must be a "
+					<< cursorSize << "x" << cursorSize << " ARGB8888 buffer" "\e[39m" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void GfxDevice::Configuration::dispose() {
+
+}
+
+void GfxDevice::Configuration::commit(std::unique_ptr<drm_core::AtomicState> state) {
+	_device->_theCrtc->setDrmState(state->crtc(_device->_theCrtc->id()));
+	_device->_theConnector->setDrmState(state->connector(_device->_theConnector->id()));
+	_device->_primaryPlane->setDrmState(state->plane(_device->_primaryPlane->id()));
+	_device->_cursorPlane->setDrmState(state->plane(_device->_cursorPlane->id()));
+
+	_doCommit(std::move(state));
+}
+
+async::detached GfxDevice::Configuration::_doCommit(std::unique_ptr<drm_core::AtomicState> state) {
+	if(logCommits)
+		std::cout << "gfx/intel: Committing configuration" << std::endl;
+
+	auto primary_plane_state = state->plane(_device->_primaryPlane->id());
+	auto cursor_plane_state = state->plane(_device->_cursorPlane->id());
+	auto crtc_state = state->crtc(_device->_theCrtc->id());
+	auto &controller = _device->_controller;
+
+	if(crtc_state->mode != nullptr) {
+		if(!_device->_claimedDevice) {
+			co_await _device->_hwDevice.claimDevice();
+			_device->_claimedDevice = true;
+		}
+
+		drm_mode_modeinfo mode_info;
+		memcpy(&mode_info, crtc_state->mode->data(), sizeof(drm_mode_modeinfo));
+
+		auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(primary_plane_state->fb);
+		Framebuffer scanout;
+		scanout.width = fb->getWidth();
+		scanout.height = fb->getHeight();
+		scanout.stride = fb->getPitch();
+		scanout.address = fb->getBufferObject()->getGttOffset();
+
+		if(!_device->_currentMode
+				|| memcmp(&*_device->_currentMode, &mode_info, sizeof(drm_mode_modeinfo))) {
+			auto mode = modeInfoToMode(mode_info);
+			auto multiplier = computeSdvoMultiplier(mode.dot);
+			auto params = findParams(mode.dot * multiplier, 96000, limitsG45);
+
+			controller.disableCursor();
+			controller.modeset(mode, params, multiplier, &scanout);
+			_device->_currentMode = mode_info;
+		}else{
+			if(logCommits)
+				std::cout << "gfx/intel: Flip to GTT offset "
+						<< (void *)scanout.address << std::endl;
+			controller.enablePlane(&scanout);
+		}
+
+		if(cursor_plane_state->fb) {
+			auto cursor = static_pointer_cast<GfxDevice::FrameBuffer>(cursor_plane_state->fb);
+			controller.moveCursor(cursor_plane_state->crtc_x, cursor_plane_state->crtc_y);
+			controller.enableCursor(cursor->getBufferObject()->getGttOffset());
+		}else{
+			controller.disableCursor();
+		}
+	}else if(_device->_currentMode) {
+		controller.shutdown();
+		_device->_currentMode = std::nullopt;
+	}
+
+	complete();
+}
+
+// ----------------------------------------------------------------
+// GfxDevice::Connector.
+// ----------------------------------------------------------------
+
+GfxDevice::Connector::Connector(GfxDevice *device)
+	: drm_core::Connector { device, device->allocator.allocate() } {
+	_encoders.push_back(device->_theEncoder.get());
+}
+
+// ----------------------------------------------------------------
+// GfxDevice::Encoder.
+// ----------------------------------------------------------------
+
+GfxDevice::Encoder::Encoder(GfxDevice *device)
+	:drm_core::Encoder { device, device->allocator.allocate() } {
+}
+
+// ----------------------------------------------------------------
+// GfxDevice::Crtc.
+// ----------------------------------------------------------------
+
+GfxDevice::Crtc::Crtc(GfxDevice *device)
+	:drm_core::Crtc { device, device->allocator.allocate() } {
+	_device = device;
+}
+
+drm_core::Plane *GfxDevice::Crtc::primaryPlane() {
+	return _device->_primaryPlane.get();
+}
+
+drm_core::Plane *GfxDevice::Crtc::cursorPlane() {
+	return _device->_cursorPlane.get();
+}
+
+// ----------------------------------------------------------------
+// GfxDevice::FrameBuffer.
+// ----------------------------------------------------------------
+
+GfxDevice::FrameBuffer::FrameBuffer(GfxDevice *device,
+		std::shared_ptr<GfxDevice::BufferObject> bo, uint32_t pitch)
+: drm_core::FrameBuffer { device, device->allocator.allocate() } {
+	_bo = bo;
+	_pitch = pitch;
+}
+
+GfxDevice::BufferObject *GfxDevice::FrameBuffer::getBufferObject() {
+	return _bo.get();
+}
+
+uint32_t GfxDevice::FrameBuffer::getPitch() {
+	return _pitch;
+}
+
+uint32_t GfxDevice::FrameBuffer::getWidth() {
+	return _bo->getWidth();
+}
+
+uint32_t GfxDevice::FrameBuffer::getHeight() {
+	return _bo->getHeight();
+}
+
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect>) {
+	// Buffers are scanned out of the GTT directly, so there is nothing to copy.
+}
+
+// ----------------------------------------------------------------
+// GfxDevice: Plane.
+// ----------------------------------------------------------------
+
+GfxDevice::Plane::Plane(GfxDevice *device, PlaneType type)
+	:drm_core::Plane { device, device->allocator.allocate(), type } {
+}
+
+// ----------------------------------------------------------------
+// GfxDevice: BufferObject.
+// ----------------------------------------------------------------
+
+GfxDevice::BufferObject::BufferObject(GfxDevice *device, size_t size, uintptr_t gtt_offset,
+		helix::UniqueDescriptor memory, uint32_t width, uint32_t height)
+: drm_core::BufferObject{width, height}, _device{device}, _size{size}, _gttOffset{gtt_offset},
+		_memory{std::move(memory)}, _mapping{_memory, 0, _size} {
+	assert(!(_gttOffset % 0x1000));
+
+	std::vector<uintptr_t> physicals;
+	physicals.reserve(_size / 0x1000);
+	for(size_t page = 0; page < _size; page += 0x1000) {
+		uintptr_t physical;
+		HEL_CHECK(helPointerPhysical(reinterpret_cast<char *>(_mapping.get()) + page, &physical));
+		physicals.push_back(physical);
+	}
+	_device->_controller.bindPages(_gttOffset / 0x1000, physicals);
+
+	HelHandle handle;
+	HEL_CHECK(helCreateSliceView(_device->_aperture.getHandle(),
+			_gttOffset, _size, 0, &handle));
+	_apertureView = helix::UniqueDescriptor{handle};
+}
+
+GfxDevice::BufferObject::~BufferObject() {
+	_device->_controller.unbindPages(_gttOffset / 0x1000, _size / 0x1000);
+	_device->_gttAllocator.free(_gttOffset, _size);
+}
+
+std::shared_ptr<drm_core::BufferObject> GfxDevice::BufferObject::sharedBufferObject() {
+	return this->shared_from_this();
+}
+
+size_t GfxDevice::BufferObject::getSize() {
+	return _size;
+}
+
+std::pair<helix::BorrowedDescriptor, uint64_t> GfxDevice::BufferObject::getMemory() {
+	return std::make_pair(helix::BorrowedDescriptor{_apertureView}, 0);
+}
+
+uintptr_t GfxDevice::BufferObject::getGttOffset() {
+	return _gttOffset;
+}
+
 // ----------------------------------------------------------------
 // Freestanding PCI discovery functions.
 // ----------------------------------------------------------------
 
-async::detached bindController(mbus_ng::Entity hwEntity) {
-	protocols::hw::Device device((co_await hwEntity.getRemoteLane()).unwrap());
+async::detached bindController(mbus_ng::Entity entity) {
+	protocols::hw::Device device((co_await entity.getRemoteLane()).unwrap());
 	auto info = co_await device.getPciInfo();
 	assert(info.barInfo[0].ioType == protocols::hw::IoType::kIoTypeMemory);
 	assert(info.barInfo[2].ioType == protocols::hw::IoType::kIoTypeMemory);
 	assert(!info.barInfo[0].offset);
 	assert(!info.barInfo[2].offset);
 	auto ctrl_bar = co_await device.accessBar(0);
-	auto memory_bar = co_await device.accessBar(2);
+	auto aperture_bar = co_await device.accessBar(2);
 //	auto irq = co_await device.accessIrq();
-	
-	void *ctrl_window, *memory_window;
+
+	// The GTT covers exactly the mappable aperture.
+	size_t gtt_entries = info.barInfo[2].length / 0x1000;
+
+	void *ctrl_window;
 	HEL_CHECK(helMapMemory(ctrl_bar.getHandle(), kHelNullHandle, nullptr,
-			0, 0x8'0000, kHelMapProtRead | kHelMapProtWrite,
+			0, gttOffset + gtt_entries * sizeof(uint32_t), kHelMapProtRead | kHelMapProtWrite,
 			&ctrl_window));
-	HEL_CHECK(helMapMemory(memory_bar.getHandle(), kHelNullHandle, nullptr,
-			0, 0x1000'0000, kHelMapProtRead | kHelMapProtWrite,
-			&memory_window));
 
-	Controller controller{arch::mem_space(ctrl_window), memory_window};
-	controller.run();
-}
+	Controller controller{arch::mem_space(ctrl_window),
+			reinterpret_cast<volatile uint32_t *>(
+				reinterpret_cast<char *>(ctrl_window) + gttOffset),
+			gtt_entries};
+
+	auto gfxDevice = std::make_shared<GfxDevice>(std::move(device),
+			controller, std::move(aperture_bar));
+
+	auto config = co_await gfxDevice->initialize();
+
+	// Create an mbus object for the device.
+	mbus_ng::Properties descriptor{
+		{"drvcore.mbus-parent", mbus_ng::StringItem{std::to_string(entity.id())}},
+		{"unix.subsystem", mbus_ng::StringItem{"drm"}},
+		{"unix.devname", mbus_ng::StringItem{"dri/card"}}
+	};
 
+	co_await config->waitForCompletion();
+
+	auto gfxEntity = (co_await mbus_ng::Instance::global().createEntity(
+		"gfx_intel", descriptor)).unwrap();
+
+	[] (auto device, mbus_ng::EntityManager entity) -> async::detached {
+		while (true) {
+			auto [localLane, remoteLane] = helix::createStream();
+
+			// If this fails, too bad!
+			(void)(co_await entity.serveRemoteLane(std::move(remoteLane)));
+
+			drm_core::serveDrmDevice(device, std::move(localLane));
+		}
+	}(gfxDevice, std::move(gfxEntity));
+}
 async::detached observeControllers() {
 	auto filter = mbus_ng::Conjunction{{
 		mbus_ng::EqualsFilter{"pci-vendor", "8086"},
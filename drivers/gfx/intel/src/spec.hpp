@@ -162,6 +162,54 @@ namespace vga_control {
 	static constexpr arch::field<uint32_t, unsigned int> centeringMode(30, 2);
 }
 
+// ----------------------------------------------------------------------------
+// Cursor registers (pipe A).
+// ----------------------------------------------------------------------------
+
+namespace regs {
+	static constexpr arch::bit_register<uint32_t> cursorControl(0x70080);
+	// Writing the base address arms the update of all cursor registers.
+	static constexpr arch::scalar_register<uint32_t> cursorBase(0x70084);
+	static constexpr arch::bit_register<uint32_t> cursorPosition(0x70088);
+}
+
+enum class CursorMode : unsigned int {
+	disabled = 0,
+	argb64x64 = 0x27
+};
+
+namespace cursor_control {
+	static constexpr arch::field<uint32_t, CursorMode> mode(0, 6);
+	static constexpr arch::field<uint32_t, unsigned int> pipeSelect(28, 2);
+}
+
+// Coordinates are in sign-magnitude representation.
+namespace cursor_position {
+	static constexpr arch::field<uint32_t, unsigned int> x(0, 12);
+	static constexpr arch::field<uint32_t, bool> xSign(15, 1);
+	static constexpr arch::field<uint32_t, unsigned int> y(16, 12);
+	static constexpr arch::field<uint32_t, bool> ySign(31, 1);
+}
+
+constexpr unsigned int cursorSize = 64;
+
+// ----------------------------------------------------------------------------
+// Graphics translation table.
+// ----------------------------------------------------------------------------
+
+// On G4x, the GTT lives in the second half of the 4 MiB MMIO BAR.
+constexpr size_t gttOffset = 0x20'0000;
+
+namespace gtt_entry {
+	static constexpr uint32_t valid = 1;
+
+	// Gen4 PTEs store physical address bits 35:32 in bits 7:4.
+	inline uint32_t encode(uint64_t physical) {
+		return static_cast<uint32_t>(physical & 0xFFFF'F000)
+				| static_cast<uint32_t>((physical >> 28) & 0xF0) | valid;
+	}
+}
+
 // ----------------------------------------------------------------------------
 // VGA BIOS registers.
 // ----------------------------------------------------------------------------
@@ -27,10 +27,10 @@
 
 GfxDevice::GfxDevice(protocols::hw::Device hw_device,
 		unsigned int screen_width, unsigned int screen_height,
-		size_t screen_pitch, helix::Mapping fb_mapping)
+		size_t screen_pitch, unsigned int screen_bpp, helix::Mapping fb_mapping)
 : _hwDevice{std::move(hw_device)},
 		_screenWidth{screen_width}, _screenHeight{screen_height},
-		_screenPitch{screen_pitch},_fbMapping{std::move(fb_mapping)} {
+		_screenPitch{screen_pitch}, _screenBpp{screen_bpp}, _fbMapping{std::move(fb_mapping)} {
 	if((reinterpret_cast<uintptr_t>(_fbMapping.get()) & 15)) {
 		std::cout << "\e[31m" "gfx/plainfb: Hardware framebuffer is not aligned;"
 				" expect perfomance degradation!" "\e[39m" << std::endl;
@@ -135,7 +135,7 @@ std::shared_ptr<drm_core::FrameBuffer> GfxDevice::createFrameBuffer(std::shared_
 	assert(pitch / 4 >= width);
 	assert(bo->getSize() >= pitch * height);
 
-	auto fb = std::make_shared<FrameBuffer>(this, bo, pitch);
+	auto fb = std::make_shared<FrameBuffer>(this, bo, width, height, pitch);
 	fb->setupWeakPtr(fb);
 	registerObject(fb.get());
 	return fb;
@@ -165,6 +165,57 @@ GfxDevice::createDumb(uint32_t width, uint32_t height, uint32_t bpp) {
 	return std::make_pair(bo, pitch);
 }
 
+std::shared_ptr<drm_core::BufferObject>
+GfxDevice::importMemory(helix::UniqueDescriptor memory, size_t size) {
+	// We blit from the mapping of the BO, so any memory can be scanned out.
+	// The dimensions of imported BOs are only known once a FrameBuffer is created.
+	auto bo = std::make_shared<BufferObject>(this, size, std::move(memory), 0, 0);
+
+	auto mapping = installMapping(bo.get());
+	bo->setupMapping(mapping);
+
+	return bo;
+}
+
+void GfxDevice::_blit(FrameBuffer *fb, const drm_mode_rect &rect) {
+	auto bo = fb->getBufferObject();
+
+	auto minWidth = std::min(fb->getWidth(), _screenWidth);
+	auto minHeight = std::min(fb->getHeight(), _screenHeight);
+
+	auto x1 = std::min(static_cast<unsigned int>(rect.x1), minWidth);
+	auto y1 = std::min(static_cast<unsigned int>(rect.y1), minHeight);
+	auto x2 = std::min(static_cast<unsigned int>(rect.x2), minWidth);
+	auto y2 = std::min(static_cast<unsigned int>(rect.y2), minHeight);
+
+	// fastCopy16() needs 16-byte aligned spans, i.e., multiples of four pixels.
+	auto fast = fb->fastScanout() && _screenBpp == 32;
+	if(fast) {
+		x1 &= ~3u;
+		x2 = std::min((x2 + 3) & ~3u, minWidth);
+		fast = !(x2 & 3);
+	}
+	if(x1 >= x2 || y1 >= y2)
+		return;
+
+	auto dest = reinterpret_cast<char *>(_fbMapping.get()) + y1 * _screenPitch
+			+ x1 * (_screenBpp / 8);
+	auto src = reinterpret_cast<char *>(bo->accessMapping()) + y1 * fb->getPitch() + x1 * 4;
+
+	for(unsigned int k = y1; k < y2; k++) {
+		if(_screenBpp == 16)
+			drm_core::convertXrgb8888ToRgb565(dest, src, x2 - x1);
+		else if(_screenBpp == 24)
+			drm_core::convertXrgb8888ToRgb888(dest, src, x2 - x1);
+		else if(fast)
+			drm_core::fastCopy16(dest, src, (x2 - x1) * 4);
+		else
+			memcpy(dest, src, (x2 - x1) * 4);
+		dest += _screenPitch;
+		src += fb->getPitch();
+	}
+}
+
 // ----------------------------------------------------------------
 // GfxDevice::Configuration.
 // ----------------------------------------------------------------
@@ -199,14 +250,18 @@ void GfxDevice::Configuration::dispose() {
 }
 
 void GfxDevice::Configuration::commit(std::unique_ptr<drm_core::AtomicState> state) {
+	auto mode_changed = state->crtc(_device->_theCrtc->id())->mode
+			!= _device->_theCrtc->drmState()->mode;
+
 	_device->_theCrtc->setDrmState(state->crtc(_device->_theCrtc->id()));
 	_device->_theConnector->setDrmState(state->connector(_device->_theConnector->id()));
 	_device->_plane->setDrmState(state->plane(_device->_plane->id()));
 
-	_dispatch(std::move(state));
+	_dispatch(std::move(state), mode_changed);
 }
 
-async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::AtomicState> state) {
+async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::AtomicState> state,
+		bool modeChanged) {
 	auto crtc_state = state->crtc(_device->_theCrtc->id());
 
 	if(crtc_state->mode != nullptr) {
@@ -220,25 +275,13 @@ async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::At
 		if(plane_state->fb != nullptr) {
 			auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(plane_state->fb);
 
-			auto bo = fb->getBufferObject();
-			auto dest = reinterpret_cast<char *>(_device->_fbMapping.get());
-			auto src = reinterpret_cast<char *>(bo->accessMapping());
-
-			auto minWidth = std::min(bo->getWidth(), _device->_screenWidth);
-			auto minHeight = std::min(bo->getHeight(), _device->_screenHeight);
-
-			if(fb->fastScanout()) {
-				for(unsigned int k = 0; k < minHeight; k++) {
-					drm_core::fastCopy16(dest, src, minWidth * 4);
-					dest += _device->_screenPitch;
-					src += fb->getPitch();
-				}
+			// Only copy what changed, e.g., a blinking cursor instead of the whole screen.
+			if(modeChanged) {
+				_device->_blit(fb.get(), {0, 0, static_cast<int32_t>(fb->getWidth()),
+						static_cast<int32_t>(fb->getHeight())});
 			}else{
-				for(unsigned int k = 0; k < minHeight; k++) {
-					memcpy(dest, src, minWidth * 4);
-					dest += _device->_screenPitch;
-					src += fb->getPitch();
-				}
+				for(auto &rect : plane_state->damage())
+					_device->_blit(fb.get(), rect);
 			}
 		}
 	} else {
@@ -283,13 +326,14 @@ drm_core::Plane *GfxDevice::Crtc::primaryPlane() {
 // ----------------------------------------------------------------
 
 GfxDevice::FrameBuffer::FrameBuffer(GfxDevice *device,
-		std::shared_ptr<GfxDevice::BufferObject> bo, size_t pitch)
+		std::shared_ptr<GfxDevice::BufferObject> bo, uint32_t width, uint32_t height,
+		size_t pitch)
 : drm_core::FrameBuffer{device, device->allocator.allocate()},
-		_device{device}, _bo{std::move(bo)}, _pitch{pitch} {
+		_device{device}, _bo{std::move(bo)}, _width{width}, _height{height}, _pitch{pitch} {
 	if(!_device->_hardwareFbIsAligned) {
 		_fastScanout = false;
 	}else if((reinterpret_cast<uintptr_t>(_bo->accessMapping()) & 15)
-			|| ((_bo->getWidth() * 4) & 15)) {
+			|| (_pitch & 15)) {
 		std::cout << "\e[31m" "gfx/plainfb: Framebuffer is not aligned!" "\e[39m" << std::endl;
 		_fastScanout = false;
 	}
@@ -303,17 +347,22 @@ GfxDevice::BufferObject *GfxDevice::FrameBuffer::getBufferObject() {
 	return _bo.get();
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-	// TODO: Re-blit the FrameBuffer if it is currently displayed.
-	std::cout << "gfx/plainfb: notifyDirty() is not implemented correctly" << std::endl;
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect> damage) {
+	if(!_device->_claimedDevice || _device->_plane->getFrameBuffer() != this)
+		return;
+	if(!_device->_theCrtc->drmState()->mode)
+		return;
+
+	for(auto &rect : damage)
+		_device->_blit(this, rect);
 }
 
 uint32_t GfxDevice::FrameBuffer::getWidth() {
-	return _bo->getWidth();
+	return _width;
 }
 
 uint32_t GfxDevice::FrameBuffer::getHeight() {
-	return _bo->getHeight();
+	return _height;
 }
 
 // ----------------------------------------------------------------
@@ -363,10 +412,14 @@ async::detached bindController(mbus_ng::Entity hwEntity) {
 	std::cout << "gfx/plainfb: Resolution " << info.width
 			<< "x" << info.height << " (" << info.bpp
 			<< " bpp, pitch: " << info.pitch << ")" << std::endl;
-	assert(info.bpp == 32);
+	// 16 and 24 bpp framebuffers are assumed to be RGB565 and RGB888.
+	if(info.bpp != 16 && info.bpp != 24 && info.bpp != 32) {
+		std::cout << "\e[31m" "gfx/plainfb: Unsupported framebuffer depth" "\e[39m" << std::endl;
+		co_return;
+	}
 
 	auto gfxDevice = std::make_shared<GfxDevice>(std::move(hwDevice),
-			info.width, info.height, info.pitch,
+			info.width, info.height, info.pitch, info.bpp,
 			helix::Mapping{fbMemory, 0, info.pitch * info.height});
 	auto config = co_await gfxDevice->initialize();
 
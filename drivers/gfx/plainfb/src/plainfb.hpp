@@ -26,7 +26,8 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 		void commit(std::unique_ptr<drm_core::AtomicState> state) override;
 
 	private:
-		async::detached _dispatch(std::unique_ptr<drm_core::AtomicState> state);
+		async::detached _dispatch(std::unique_ptr<drm_core::AtomicState> state,
+				bool modeChanged);
 
 		GfxDevice *_device;
 	};
@@ -70,26 +71,28 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 	struct FrameBuffer final : drm_core::FrameBuffer {
 		FrameBuffer(GfxDevice *device, std::shared_ptr<GfxDevice::BufferObject> bo,
-				size_t pitch);
+				uint32_t width, uint32_t height, size_t pitch);
 
 		size_t getPitch();
 		bool fastScanout() { return _fastScanout; }
 
 		GfxDevice::BufferObject *getBufferObject();
-		void notifyDirty() override;
+		void notifyDirty(std::vector<drm_mode_rect> damage) override;
 		uint32_t getWidth() override;
 		uint32_t getHeight() override;
 
 	private:
 		GfxDevice *_device;
 		std::shared_ptr<GfxDevice::BufferObject> _bo;
+		uint32_t _width;
+		uint32_t _height;
 		size_t _pitch;
 		bool _fastScanout = true;
 	};
 
 	GfxDevice(protocols::hw::Device hw_device,
 			unsigned int screen_width, unsigned int screen_height,
-			size_t screen_pitch, helix::Mapping fb_mapping);
+			size_t screen_pitch, unsigned int screen_bpp, helix::Mapping fb_mapping);
 
 	async::result<std::unique_ptr<drm_core::Configuration>> initialize();
 	std::unique_ptr<drm_core::Configuration> createConfiguration() override;
@@ -98,15 +101,22 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 	std::shared_ptr<drm_core::FrameBuffer>
 			createFrameBuffer(std::shared_ptr<drm_core::BufferObject> bo,
 			uint32_t width, uint32_t height, uint32_t format, uint32_t pitch) override;
+	std::shared_ptr<drm_core::BufferObject> importMemory(helix::UniqueDescriptor memory,
+			size_t size) override;
 
 	std::tuple<int, int, int> driverVersion() override;
 	std::tuple<std::string, std::string, std::string> driverInfo() override;
 
 private:
+	// Copies a region of the framebuffer to the screen,
+	// converting from XRGB8888 if the screen uses a different format.
+	void _blit(FrameBuffer *fb, const drm_mode_rect &rect);
+
 	protocols::hw::Device _hwDevice;
 	unsigned int _screenWidth;
 	unsigned int _screenHeight;
 	size_t _screenPitch;
+	unsigned int _screenBpp;
 	helix::Mapping _fbMapping;
 
 	std::shared_ptr<Plane> _plane;
@@ -33,26 +33,99 @@ private:
 	std::coroutine_handle<> _handle;
 };
 
-async::result<void> Cmd::transferToHost2d(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device) {
-	spec::XferToHost2d xfer;
-	memset(&xfer, 0, sizeof(spec::XferToHost2d));
-	xfer.header.type = spec::cmd::xferToHost2d;
-	xfer.rect.x = 0;
-	xfer.rect.y = 0;
-	xfer.rect.width = width;
-	xfer.rect.height = height;
-	xfer.resourceId = resourceId;
-
-	spec::Header xfer_result;
-	virtio_core::Chain xfer_chain;
-	co_await virtio_core::scatterGather(virtio_core::hostToDevice,
-			xfer_chain, device->_controlQ,
-			arch::dma_buffer_view{nullptr, &xfer, sizeof(spec::XferToHost2d)});
-	co_await virtio_core::scatterGather(virtio_core::deviceToHost,
-			xfer_chain, device->_controlQ,
-			arch::dma_buffer_view{nullptr, &xfer_result, sizeof(spec::Header)});
-	co_await AwaitableRequest{device->_controlQ, xfer_chain.front()};
-	assert(xfer_result.type == spec::resp::noData);
+// Posts a number of descriptors to a queue but only notifies the device once.
+struct BatchedRequests {
+	struct Entry : virtio_core::Request {
+		BatchedRequests *batch;
+	};
+
+	BatchedRequests(virtio_core::Queue *queue, size_t count)
+	: _queue{queue}, _entries(count), _pending{count} { }
+
+	// Descriptors of posted chains are only freed once the device returns them.
+	// Notify early if we would otherwise wait for descriptors that the device never sees.
+	void reserve(size_t descriptors) {
+		if(_queue->numFreeDescriptors() < descriptors)
+			_queue->notify();
+	}
+
+	void post(size_t index, virtio_core::Handle descriptor) {
+		_entries[index].batch = this;
+		_queue->postDescriptor(descriptor, &_entries[index], [] (virtio_core::Request *base) {
+			auto batch = static_cast<Entry *>(base)->batch;
+			if(!--batch->_pending)
+				batch->_done.raise();
+		});
+	}
+
+	async::result<void> wait() {
+		if(!_pending)
+			co_return;
+		_queue->notify();
+		co_await _done.wait();
+	}
+
+private:
+	virtio_core::Queue *_queue;
+	std::vector<Entry> _entries;
+	size_t _pending;
+	async::oneshot_event _done;
+};
+
+// Returns the guest physical memory backing a buffer, merging contiguous pages.
+static std::vector<spec::MemEntry> memEntries(void *ptr, size_t size) {
+	std::vector<spec::MemEntry> entries;
+	for(size_t page = 0; page < size; page += 4096) {
+		uintptr_t physical;
+		HEL_CHECK(helPointerPhysical((reinterpret_cast<char *>(ptr) + page), &physical));
+
+		if(!entries.empty() && entries.back().address + entries.back().length == physical) {
+			entries.back().length += 4096;
+			continue;
+		}
+
+		spec::MemEntry entry;
+		memset(&entry, 0, sizeof(spec::MemEntry));
+		entry.address = physical;
+		entry.length = 4096;
+		entries.push_back(entry);
+	}
+	return entries;
+}
+
+async::result<void> Cmd::transferToHost2d(std::span<const drm_mode_rect> rects, uint32_t pitch, uint32_t resourceId, GfxDevice *device) {
+	std::vector<spec::XferToHost2d> xfers(rects.size());
+	std::vector<spec::Header> xfer_results(rects.size());
+	BatchedRequests batch{device->_controlQ, rects.size()};
+
+	for(size_t i = 0; i < rects.size(); i++) {
+		auto &rect = rects[i];
+		auto &xfer = xfers[i];
+		memset(&xfer, 0, sizeof(spec::XferToHost2d));
+		xfer.header.type = spec::cmd::xferToHost2d;
+		xfer.rect.x = rect.x1;
+		xfer.rect.y = rect.y1;
+		xfer.rect.width = rect.x2 - rect.x1;
+		xfer.rect.height = rect.y2 - rect.y1;
+		// Offset of the rectangle within the backing storage.
+		xfer.offset = uint64_t{pitch} * rect.y1 + rect.x1 * 4;
+		xfer.resourceId = resourceId;
+
+		// Each buffer might cross a page boundary.
+		batch.reserve(4);
+		virtio_core::Chain xfer_chain;
+		co_await virtio_core::scatterGather(virtio_core::hostToDevice,
+				xfer_chain, device->_controlQ,
+				arch::dma_buffer_view{nullptr, &xfer, sizeof(spec::XferToHost2d)});
+		co_await virtio_core::scatterGather(virtio_core::deviceToHost,
+				xfer_chain, device->_controlQ,
+				arch::dma_buffer_view{nullptr, &xfer_results[i], sizeof(spec::Header)});
+		batch.post(i, xfer_chain.front());
+	}
+	co_await batch.wait();
+
+	for(auto &result : xfer_results)
+		assert(result.type == spec::resp::noData);
 }
 
 async::result<void> Cmd::setScanout(uint32_t width, uint32_t height, uint32_t scanoutId, uint32_t resourceId, GfxDevice *device) {
@@ -79,25 +152,63 @@ async::result<void> Cmd::setScanout(uint32_t width, uint32_t height, uint32_t sc
 	assert(scanout_result.type == spec::resp::noData);
 }
 
-async::result<void> Cmd::resourceFlush(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device) {
-	spec::ResourceFlush flush;
-	memset(&flush, 0, sizeof(spec::ResourceFlush));
-	flush.header.type = spec::cmd::resourceFlush;
-	flush.rect.x = 0;
-	flush.rect.y = 0;
-	flush.rect.width = width;
-	flush.rect.height = height;
-	flush.resourceId = resourceId;
-
-	spec::Header flush_result;
-	virtio_core::Chain flush_chain;
-	co_await virtio_core::scatterGather(virtio_core::hostToDevice, flush_chain, device->_controlQ,
-		arch::dma_buffer_view{nullptr, &flush, sizeof(spec::ResourceFlush)});
-	co_await virtio_core::scatterGather(virtio_core::deviceToHost, flush_chain, device->_controlQ,
-		arch::dma_buffer_view{nullptr, &flush_result, sizeof(spec::Header)});
-	co_await AwaitableRequest{device->_controlQ, flush_chain.front()};
-
-	assert(flush_result.type == spec::resp::noData);
+async::result<void> Cmd::setScanoutBlob(uint32_t width, uint32_t height, uint32_t pitch, uint32_t scanoutId, uint32_t resourceId, GfxDevice *device) {
+	spec::SetScanoutBlob scanout;
+	memset(&scanout, 0, sizeof(spec::SetScanoutBlob));
+	scanout.header.type = spec::cmd::setScanoutBlob;
+	scanout.rect.x = 0;
+	scanout.rect.y = 0;
+	scanout.rect.width = width;
+	scanout.rect.height = height;
+	scanout.scanoutId = scanoutId;
+	scanout.resourceId = resourceId;
+	scanout.width = width;
+	scanout.height = height;
+	scanout.format = spec::format::bgrx;
+	scanout.strides[0] = pitch;
+
+	spec::Header scanout_result;
+	virtio_core::Chain scanout_chain;
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice,
+			scanout_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, &scanout, sizeof(spec::SetScanoutBlob)});
+	co_await virtio_core::scatterGather(virtio_core::deviceToHost,
+			scanout_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, &scanout_result, sizeof(spec::Header)});
+	co_await AwaitableRequest{device->_controlQ, scanout_chain.front()};
+
+	assert(scanout_result.type == spec::resp::noData);
+}
+
+async::result<void> Cmd::resourceFlush(std::span<const drm_mode_rect> rects, uint32_t resourceId, GfxDevice *device) {
+	std::vector<spec::ResourceFlush> flushes(rects.size());
+	std::vector<spec::Header> flush_results(rects.size());
+	BatchedRequests batch{device->_controlQ, rects.size()};
+
+	for(size_t i = 0; i < rects.size(); i++) {
+		auto &rect = rects[i];
+		auto &flush = flushes[i];
+		memset(&flush, 0, sizeof(spec::ResourceFlush));
+		flush.header.type = spec::cmd::resourceFlush;
+		flush.rect.x = rect.x1;
+		flush.rect.y = rect.y1;
+		flush.rect.width = rect.x2 - rect.x1;
+		flush.rect.height = rect.y2 - rect.y1;
+		flush.resourceId = resourceId;
+
+		// Each buffer might cross a page boundary.
+		batch.reserve(4);
+		virtio_core::Chain flush_chain;
+		co_await virtio_core::scatterGather(virtio_core::hostToDevice, flush_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, &flush, sizeof(spec::ResourceFlush)});
+		co_await virtio_core::scatterGather(virtio_core::deviceToHost, flush_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, &flush_results[i], sizeof(spec::Header)});
+		batch.post(i, flush_chain.front());
+	}
+	co_await batch.wait();
+
+	for(auto &result : flush_results)
+		assert(result.type == spec::resp::noData);
 }
 
 async::result<spec::DisplayInfo> Cmd::getDisplayInfo(GfxDevice *device) {
@@ -143,18 +254,8 @@ async::result<void> Cmd::create2d(uint32_t width, uint32_t height, uint32_t reso
 
 async::result<void> Cmd::attachBacking(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device) {
 	assert(ptr);
-	
-	std::vector<spec::MemEntry> entries;
-	for(size_t page = 0; page < size; page += 4096) {
-		spec::MemEntry entry;
-		memset(&entry, 0, sizeof(spec::MemEntry));
-		uintptr_t physical;
 
-		HEL_CHECK(helPointerPhysical((reinterpret_cast<char *>(ptr) + page), &physical));
-		entry.address = physical;
-		entry.length = 4096;
-		entries.push_back(entry);
-	}
+	auto entries = memEntries(ptr, size);
 
 	spec::AttachBacking attachment;
 	memset(&attachment, 0, sizeof(spec::AttachBacking));
@@ -174,3 +275,30 @@ async::result<void> Cmd::attachBacking(uint32_t resourceId, void *ptr, size_t si
 
 	assert(attach_result.type == spec::resp::noData);
 }
+
+async::result<void> Cmd::createBlob(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device) {
+	assert(ptr);
+
+	auto entries = memEntries(ptr, size);
+
+	spec::CreateBlob blob;
+	memset(&blob, 0, sizeof(spec::CreateBlob));
+	blob.header.type = spec::cmd::createBlob;
+	blob.resourceId = resourceId;
+	blob.blobMem = spec::blobMem::guest;
+	blob.blobFlags = spec::blobFlags::shareable;
+	blob.numEntries = entries.size();
+	blob.size = size;
+
+	spec::Header blob_result;
+	virtio_core::Chain blob_chain;
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, blob_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, &blob, sizeof(spec::CreateBlob)});
+	co_await virtio_core::scatterGather(virtio_core::hostToDevice, blob_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, entries.data(), entries.size() * sizeof(spec::MemEntry)});
+	co_await virtio_core::scatterGather(virtio_core::deviceToHost, blob_chain, device->_controlQ,
+			arch::dma_buffer_view{nullptr, &blob_result, sizeof(spec::Header)});
+	co_await AwaitableRequest{device->_controlQ, blob_chain.front()};
+
+	assert(blob_result.type == spec::resp::noData);
+}
@@ -1,14 +1,22 @@
 #pragma once
 
+#include <span>
+
 #include <async/result.hpp>
 
 #include "src/virtio.hpp"
 
 struct Cmd {
-	static async::result<void> transferToHost2d(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device);
+	// pitch is the size of a row of the resource in bytes.
+	// All rectangles are submitted to the device with a single notification.
+	static async::result<void> transferToHost2d(std::span<const drm_mode_rect> rects, uint32_t pitch, uint32_t resourceId, GfxDevice *device);
 	static async::result<void> setScanout(uint32_t width, uint32_t height, uint32_t scanoutId, uint32_t resourceId, GfxDevice *device);
-	static async::result<void> resourceFlush(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device);
+	static async::result<void> setScanoutBlob(uint32_t width, uint32_t height, uint32_t pitch, uint32_t scanoutId, uint32_t resourceId, GfxDevice *device);
+	// All rectangles are submitted to the device with a single notification.
+	static async::result<void> resourceFlush(std::span<const drm_mode_rect> rects, uint32_t resourceId, GfxDevice *device);
 	static async::result<spec::DisplayInfo> getDisplayInfo(GfxDevice *device);
 	static async::result<void> create2d(uint32_t width, uint32_t height, uint32_t resourceId, GfxDevice *device);
 	static async::result<void> attachBacking(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device);
+	// Creates a blob resource that is backed by guest memory and can be scanned out directly.
+	static async::result<void> createBlob(uint32_t resourceId, void *ptr, size_t size, GfxDevice *device);
 };
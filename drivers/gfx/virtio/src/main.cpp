@@ -74,6 +74,11 @@ async::result<std::unique_ptr<drm_core::Configuration>> GfxDevice::initialize()
 	if(_transport->checkDeviceFeature(VIRTIO_GPU_F_EDID))
 		_transport->acknowledgeDriverFeature(VIRTIO_GPU_F_EDID);
 
+	if(_transport->checkDeviceFeature(VIRTIO_GPU_F_RESOURCE_BLOB)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_GPU_F_RESOURCE_BLOB);
+		_blobResources = true;
+	}
+
 	_transport->finalizeFeatures();
 	_transport->claimQueues(2);
 
@@ -191,7 +196,7 @@ std::shared_ptr<drm_core::FrameBuffer> GfxDevice::createFrameBuffer(std::shared_
 	assert(pitch / 4 >= width);
 	assert(bo->getSize() >= pitch * height);
 
-	auto fb = std::make_shared<FrameBuffer>(this, bo);
+	auto fb = std::make_shared<FrameBuffer>(this, bo, width, height, pitch);
 	fb->setupWeakPtr(fb);
 	registerObject(fb.get());
 	return fb;
@@ -222,6 +227,23 @@ GfxDevice::createDumb(uint32_t width, uint32_t height, uint32_t bpp) {
 	return std::make_pair(bo, pitch);
 }
 
+std::shared_ptr<drm_core::BufferObject>
+GfxDevice::importMemory(helix::UniqueDescriptor memory, size_t size) {
+	// 2D resources need to know their dimensions and are always copied to the host;
+	// only blob resources can scan out of memory that we did not allocate.
+	if(!_blobResources)
+		return nullptr;
+
+	auto bo = std::make_shared<BufferObject>(this, _resourceIdAllocator.allocate(), size,
+			std::move(memory), 0, 0);
+
+	auto mapping = installMapping(bo.get());
+	bo->setupMapping(mapping);
+
+	bo->_initHw();
+	return bo;
+}
+
 // ----------------------------------------------------------------
 // GfxDevice::Configuration.
 // ----------------------------------------------------------------
@@ -301,9 +323,15 @@ async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::At
 
 			co_await fb->getBufferObject()->wait();
 
-			co_await Cmd::transferToHost2d(pps->src_w, pps->src_h, resourceId, _device);
-			co_await Cmd::setScanout(pps->src_w, pps->src_h, scanoutId, resourceId, _device);
-			co_await Cmd::resourceFlush(pps->src_w, pps->src_h, resourceId, _device);
+			drm_mode_rect rect{0, 0, static_cast<int32_t>(pps->src_w), static_cast<int32_t>(pps->src_h)};
+			if(_device->_blobResources) {
+				co_await Cmd::setScanoutBlob(pps->src_w, pps->src_h, fb->getPitch(),
+						scanoutId, resourceId, _device);
+			}else{
+				co_await Cmd::transferToHost2d({&rect, 1}, fb->getPitch(), resourceId, _device);
+				co_await Cmd::setScanout(pps->src_w, pps->src_h, scanoutId, resourceId, _device);
+			}
+			co_await Cmd::resourceFlush({&rect, 1}, resourceId, _device);
 		}
 	}
 
@@ -318,11 +346,20 @@ async::detached GfxDevice::Configuration::_dispatch(std::unique_ptr<drm_core::At
 
 			co_await fb->getBufferObject()->wait();
 
-			// TODO: if(!fb->getBufferObject()->is3D())
-				co_await Cmd::transferToHost2d(ps->src_w, ps->src_h, resourceId, _device);
+			// Only the damaged regions have to be transferred and flushed.
+			auto damage = ps->damage();
 
-			co_await Cmd::setScanout(ps->src_w, ps->src_h, static_pointer_cast<GfxDevice::Plane>(ps->plane)->scanoutId(), resourceId, _device);
-			co_await Cmd::resourceFlush(ps->src_w, ps->src_h, resourceId, _device);
+			// Blob resources share the guest memory with the host, so there is nothing to transfer.
+			// TODO: if(!fb->getBufferObject()->is3D())
+			auto scanoutId = static_pointer_cast<GfxDevice::Plane>(ps->plane)->scanoutId();
+			if(_device->_blobResources) {
+				co_await Cmd::setScanoutBlob(ps->src_w, ps->src_h, fb->getPitch(),
+						scanoutId, resourceId, _device);
+			}else{
+				co_await Cmd::transferToHost2d(damage, fb->getPitch(), resourceId, _device);
+				co_await Cmd::setScanout(ps->src_w, ps->src_h, scanoutId, resourceId, _device);
+			}
+			co_await Cmd::resourceFlush(damage, resourceId, _device);
 		}
 	}
 
@@ -370,31 +407,40 @@ int GfxDevice::Crtc::scanoutId() {
 // ----------------------------------------------------------------
 
 GfxDevice::FrameBuffer::FrameBuffer(GfxDevice *device,
-		std::shared_ptr<GfxDevice::BufferObject> bo)
+		std::shared_ptr<GfxDevice::BufferObject> bo, uint32_t width, uint32_t height,
+		uint32_t pitch)
 : drm_core::FrameBuffer { device, device->allocator.allocate() } {
 	_bo = bo;
 	_device = device;
+	_width = width;
+	_height = height;
+	_pitch = pitch;
 }
 
 GfxDevice::BufferObject *GfxDevice::FrameBuffer::getBufferObject() {
 	return _bo.get();
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
-	_xferAndFlush();
+uint32_t GfxDevice::FrameBuffer::getPitch() {
+	return _pitch;
+}
+
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect> damage) {
+	_xferAndFlush(std::move(damage));
 }
 
 uint32_t GfxDevice::FrameBuffer::getWidth() {
-	return _bo->getWidth();
+	return _width;
 }
 
 uint32_t GfxDevice::FrameBuffer::getHeight() {
-	return _bo->getHeight();
+	return _height;
 }
 
-async::detached GfxDevice::FrameBuffer::_xferAndFlush() {
-	co_await Cmd::transferToHost2d(_bo->getWidth(), _bo->getHeight(), _bo->resourceId(), _device);
-	co_await Cmd::resourceFlush(_bo->getWidth(), _bo->getHeight(), _bo->resourceId(), _device);
+async::detached GfxDevice::FrameBuffer::_xferAndFlush(std::vector<drm_mode_rect> damage) {
+	if(!_device->_blobResources)
+		co_await Cmd::transferToHost2d(damage, _pitch, _bo->resourceId(), _device);
+	co_await Cmd::resourceFlush(damage, _bo->resourceId(), _device);
 }
 
 // ----------------------------------------------------------------
@@ -439,8 +485,12 @@ std::pair<helix::BorrowedDescriptor, uint64_t> GfxDevice::BufferObject::getMemor
 }
 
 async::detached GfxDevice::BufferObject::_initHw() {
-	co_await Cmd::create2d(getWidth(), getHeight(), _resourceId, _device);
-	co_await Cmd::attachBacking(_resourceId, _mapping.get(), getSize(), _device);
+	if(_device->_blobResources) {
+		co_await Cmd::createBlob(_resourceId, _mapping.get(), getSize(), _device);
+	}else{
+		co_await Cmd::create2d(getWidth(), getHeight(), _resourceId, _device);
+		co_await Cmd::attachBacking(_resourceId, _mapping.get(), getSize(), _device);
+	}
 
 	_jump.raise();
 }
@@ -10,6 +10,15 @@ namespace format {
 	inline constexpr uint32_t xrgb = 4;
 }
 
+namespace blobMem {
+	inline constexpr uint32_t guest = 1;
+}
+
+namespace blobFlags {
+	inline constexpr uint32_t mappable = 1;
+	inline constexpr uint32_t shareable = 2;
+}
+
 namespace cmd {
 	/* 2D commands */
 	inline constexpr uint32_t getDisplayInfo = 0x100;
@@ -127,6 +136,29 @@ struct ResourceFlush {
 	uint32_t padding;
 };
 
+struct CreateBlob {
+	Header header;
+	uint32_t resourceId;
+	uint32_t blobMem;
+	uint32_t blobFlags;
+	uint32_t numEntries;
+	uint64_t blobId;
+	uint64_t size;
+};
+
+struct SetScanoutBlob {
+	Header header;
+	Rect rect;
+	uint32_t scanoutId;
+	uint32_t resourceId;
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint32_t padding;
+	uint32_t strides[4];
+	uint32_t offsets[4];
+};
+
 namespace cfg {
 	inline constexpr arch::scalar_register<uint32_t> numScanouts(8);
 } //namespace cfg
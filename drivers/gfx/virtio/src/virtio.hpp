@@ -101,17 +101,22 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 	};
 
 	struct FrameBuffer final : drm_core::FrameBuffer {
-		FrameBuffer(GfxDevice *device, std::shared_ptr<GfxDevice::BufferObject> bo);
+		FrameBuffer(GfxDevice *device, std::shared_ptr<GfxDevice::BufferObject> bo,
+				uint32_t width, uint32_t height, uint32_t pitch);
 
 		GfxDevice::BufferObject *getBufferObject();
-		void notifyDirty() override;
+		uint32_t getPitch();
+		void notifyDirty(std::vector<drm_mode_rect> damage) override;
 		uint32_t getWidth() override;
 		uint32_t getHeight() override;
-		async::detached _xferAndFlush();
+		async::detached _xferAndFlush(std::vector<drm_mode_rect> damage);
 
 	private:
 		std::shared_ptr<GfxDevice::BufferObject> _bo;
 		GfxDevice *_device;
+		uint32_t _width;
+		uint32_t _height;
+		uint32_t _pitch;
 	};
 
 	GfxDevice(std::unique_ptr<virtio_core::Transport> transport);
@@ -123,6 +128,8 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 	std::shared_ptr<drm_core::FrameBuffer>
 			createFrameBuffer(std::shared_ptr<drm_core::BufferObject> bo,
 			uint32_t width, uint32_t height, uint32_t format, uint32_t pitch) override;
+	std::shared_ptr<drm_core::BufferObject> importMemory(helix::UniqueDescriptor memory,
+			size_t size) override;
 
 	//returns major, minor, patchlvl
 	std::tuple<int, int, int> driverVersion() override;
@@ -142,4 +149,6 @@ private:
 	id_allocator<uint32_t> _resourceIdAllocator;
 
 	bool _virgl3D = false;
+	// Dumb buffers are blob resources in guest memory that the host scans out directly.
+	bool _blobResources = false;
 };
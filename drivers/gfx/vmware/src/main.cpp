@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <assert.h>
 #include <stdio.h>
 #include <deque>
@@ -244,8 +245,10 @@ async::result<void> GfxDevice::waitIrq(uint32_t irq_mask) {
 			break;
 		}
 	} else {
+		// Without interrupts we have to poll until the device has drained the FIFO.
 		writeRegister(register_index::sync, 1);
-		readRegister(register_index::busy);
+		while (readRegister(register_index::busy))
+			;
 	}
 
 }
@@ -311,30 +314,29 @@ async::result<void *> GfxDevice::DeviceFifo::reserve(size_t size) {
 				(next_cmd + bytes == max && stop > min)) in_place = true;
 
 			else if ((max - next_cmd) + (stop - min) <= bytes) {
-				co_await _device->waitIrq(2); // TODO: add a definiton for the mask
-			} else {
-				_usingBounceBuf = true;
+				// The FIFO is full; wait until the device has consumed some commands.
+				co_await _device->waitIrq(irq_flags::fifo_progress);
+				continue;
 			}
 		} else {
-			if (next_cmd + bytes < stop) in_place = true;
-			else co_await _device->waitIrq(2); // TODO: add a definiton for the mask
+			if (next_cmd + bytes < stop) {
+				in_place = true;
+			} else {
+				co_await _device->waitIrq(irq_flags::fifo_progress);
+				continue;
+			}
 		}
 
-		if (in_place) {
-			if (reserveable) {
-				writeRegister(fifo_index::reserved, bytes);
-				auto mem = static_cast<uint8_t *>(_fifoMapping.get());
-				auto ptr = mem + next_cmd;
-
-				co_return ptr;
-			}
+		// Commands are written directly to FIFO memory unless they wrap around.
+		if (in_place && reserveable) {
+			writeRegister(fifo_index::reserved, bytes);
+			auto mem = static_cast<uint8_t *>(_fifoMapping.get());
+			co_return mem + next_cmd;
 		}
 
 		_usingBounceBuf = true;
 		co_return _bounceBuf;
 	}
-
-	co_return nullptr;
 }
 
 void GfxDevice::DeviceFifo::commit(size_t bytes) {
@@ -458,21 +460,100 @@ void GfxDevice::DeviceFifo::setCursorState(bool enabled) {
 	}
 }
 
-async::result<void> GfxDevice::DeviceFifo::updateRectangle(int x, int y, int w, int h) {
+async::result<void> GfxDevice::DeviceFifo::updateRectangles(std::span<const drm_mode_rect> rects) {
 	// size in dwords
-	size_t size = sizeof(commands::update_rectangle) / 4 + 1;
+	constexpr size_t size = sizeof(commands::update_rectangle) / 4 + 1;
+	// Keep reservations small compared to the FIFO.
+	constexpr size_t maxBatch = 256;
 
-	auto ptr = static_cast<uint32_t *>(co_await reserve(size));
+	while (!rects.empty()) {
+		auto batch = rects.first(std::min(rects.size(), maxBatch));
+		rects = rects.subspan(batch.size());
+
+		auto ptr = static_cast<uint32_t *>(co_await reserve(size * batch.size()));
 
-	ptr[0] = (uint32_t)command_index::update;
-	auto cmd = reinterpret_cast<commands::update_rectangle *>(ptr + 1);
+		for (auto &rect : batch) {
+			ptr[0] = (uint32_t)command_index::update;
+			auto cmd = reinterpret_cast<commands::update_rectangle *>(ptr + 1);
 
-	cmd->x = x;
-	cmd->y = y;
-	cmd->w = w;
-	cmd->h = h;
+			cmd->x = rect.x1;
+			cmd->y = rect.y1;
+			cmd->w = rect.x2 - rect.x1;
+			cmd->h = rect.y2 - rect.y1;
+			ptr += size;
+		}
+
+		commitAll();
+	}
+}
+
+async::result<uint32_t> GfxDevice::DeviceFifo::insertFence() {
+	if (!hasCapability(caps::fifo_fence))
+		co_return 0;
+
+	auto fence = _nextFence++;
+	if (!_nextFence)
+		_nextFence = 1;
+
+	// size in dwords
+	size_t size = sizeof(commands::fence) / 4 + 1;
+
+	auto ptr = static_cast<uint32_t *>(co_await reserve(size));
+
+	ptr[0] = (uint32_t)command_index::fence;
+	auto cmd = reinterpret_cast<commands::fence *>(ptr + 1);
+	cmd->fence = fence;
 
 	commitAll();
+	co_return fence;
+}
+
+async::result<void> GfxDevice::DeviceFifo::syncToFence(uint32_t fence) {
+	if (!fence)
+		co_return;
+
+	// The device writes the last fence that it processed to the FIFO. Fences wrap around.
+	auto passed = [&] {
+		return static_cast<int32_t>(readRegister(fifo_index::fence) - fence) >= 0;
+	};
+
+	while (!passed())
+		co_await _device->waitIrq(irq_flags::any_fence);
+}
+
+async::result<void> GfxDevice::present(FrameBuffer *fb, std::vector<drm_mode_rect> damage) {
+	auto bo = fb->getBufferObject();
+	helix::Mapping user_fb{bo->getMemory().first, 0, bo->getSize()};
+	auto dest = reinterpret_cast<char *>(_fbMapping.get());
+	auto src = reinterpret_cast<char *>(user_fb.get());
+
+	// The framebuffer is laid out exactly like the screen.
+	int32_t w = readRegister(register_index::width),
+		h = readRegister(register_index::height);
+	size_t pitch = fb->getPixelPitch();
+
+	std::vector<drm_mode_rect> updates;
+	for (auto &rect : damage) {
+		auto x1 = std::min(rect.x1, w), x2 = std::min(rect.x2, w);
+		auto y1 = std::min(rect.y1, h), y2 = std::min(rect.y2, h);
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+
+		size_t length = (x2 - x1) * 4;
+		for (int32_t y = y1; y < y2; y++) {
+			size_t offset = y * pitch + x1 * 4;
+			if (offset + length > bo->getSize())
+				break;
+			memcpy(dest + offset, src + offset, length);
+		}
+
+		updates.push_back({x1, y1, x2, y2});
+	}
+
+	// Wait until the device has processed the updates so that commits
+	// (and their page flip events) complete only once the screen is up to date.
+	co_await _fifo.updateRectangles(updates);
+	co_await _fifo.syncToFence(co_await _fifo.insertFence());
 }
 
 // ----------------------------------------------------------------
@@ -612,12 +693,13 @@ async::detached GfxDevice::Configuration::commitConfiguration(std::unique_ptr<dr
 
 	if (primary_plane_state->fb != nullptr) {
 		auto fb = static_pointer_cast<GfxDevice::FrameBuffer>(primary_plane_state->fb);
-		helix::Mapping user_fb{fb->getBufferObject()->getMemory().first, 0, fb->getBufferObject()->getSize()};
-		drm_core::fastCopy16(_device->_fbMapping.get(), user_fb.get(), fb->getBufferObject()->getSize());
-		int w = _device->readRegister(register_index::width),
-			h = _device->readRegister(register_index::height);
-
-		co_await _device->_fifo.updateRectangle(0, 0, w, h);
+		if (switch_mode) {
+			drm_mode_rect rect{0, 0, static_cast<int32_t>(primary_plane_state->src_w),
+					static_cast<int32_t>(primary_plane_state->src_h)};
+			co_await _device->present(fb.get(), {rect});
+		} else {
+			co_await _device->present(fb.get(), primary_plane_state->damage());
+		}
 	}
 
 	complete();
@@ -664,6 +746,7 @@ drm_core::Plane *GfxDevice::Crtc::Crtc::cursorPlane() {
 GfxDevice::FrameBuffer::FrameBuffer(GfxDevice *dev,
 		std::shared_ptr<GfxDevice::BufferObject> bo, uint32_t pixel_pitch)
 	: drm_core::FrameBuffer { dev, dev->allocator.allocate() } {
+	_device = dev;
 	_bo = bo;
 	_pixelPitch = pixel_pitch;
 }
@@ -676,8 +759,15 @@ uint32_t GfxDevice::FrameBuffer::getPixelPitch() {
 	return _pixelPitch;
 }
 
-void GfxDevice::FrameBuffer::notifyDirty() {
+void GfxDevice::FrameBuffer::notifyDirty(std::vector<drm_mode_rect> damage) {
+	if (!_device->_isClaimed || _device->_primaryPlane->getFrameBuffer() != this)
+		return;
+
+	_present(std::move(damage));
+}
 
+async::detached GfxDevice::FrameBuffer::_present(std::vector<drm_mode_rect> damage) {
+	co_await _device->present(this, std::move(damage));
 }
 
 uint32_t GfxDevice::FrameBuffer::getWidth() {
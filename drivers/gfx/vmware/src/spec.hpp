@@ -157,12 +157,22 @@ namespace commands {
 		uint32_t w;
 		uint32_t h;
 	};
+
+	struct fence {
+		uint32_t fence;
+	};
 }
 
 enum class caps : uint32_t {
 	cursor = 0x00000020,
 	fifo_extended = 0x00008000,
 	irqmask = 0x00040000,
+	fifo_fence = (1<<0),
 	fifo_reserve = (1<<6),
 	fifo_cursor_bypass_3 = (1<<4),
 };
+
+namespace irq_flags {
+	constexpr uint32_t any_fence = 0x1;
+	constexpr uint32_t fifo_progress = 0x2;
+}
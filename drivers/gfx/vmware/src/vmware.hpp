@@ -1,5 +1,6 @@
 
 #include <queue>
+#include <span>
 #include <map>
 #include <unordered_map>
 
@@ -76,11 +77,14 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 		GfxDevice::BufferObject *getBufferObject();
 		uint32_t getPixelPitch();
-		void notifyDirty() override;
+		void notifyDirty(std::vector<drm_mode_rect> damage) override;
 		uint32_t getWidth() override;
 		uint32_t getHeight() override;
 
 	private:
+		async::detached _present(std::vector<drm_mode_rect> damage);
+
+		GfxDevice *_device;
 		std::shared_ptr<GfxDevice::BufferObject> _bo;
 		uint32_t _pixelPitch;
 	};
@@ -93,7 +97,12 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 		void moveCursor(int x, int y);
 		void setCursorState(bool enabled);
 		bool hasCapability(caps capability);
-		async::result<void> updateRectangle(int x, int y, int w, int h);
+		// Emits one UPDATE command per rectangle, using as few reservations as possible.
+		async::result<void> updateRectangles(std::span<const drm_mode_rect> rects);
+		// Returns 0 if the device does not support fences.
+		async::result<uint32_t> insertFence();
+		// Waits until the device has processed all commands before the fence.
+		async::result<void> syncToFence(uint32_t fence);
 	private:
 		async::result<void *> reserve(size_t size);
 		void commit(size_t);
@@ -106,6 +115,7 @@ struct GfxDevice final : drm_core::Device, std::enable_shared_from_this<GfxDevic
 
 		size_t _reservedSize;
 		size_t _fifoSize;
+		uint32_t _nextFence = 1;
 
 		uint8_t _bounceBuf[1024 * 1024];
 		bool _usingBounceBuf;
@@ -139,6 +149,8 @@ private:
 	bool hasCapability(caps capability);
 
 	async::result<void> waitIrq(uint32_t irq_mask);
+	// Copies the damaged regions of the framebuffer to the screen and updates them.
+	async::result<void> present(FrameBuffer *fb, std::vector<drm_mode_rect> damage);
 
 	protocols::hw::Device _hwDev;
 	DeviceFifo _fifo;
@@ -2,9 +2,52 @@
 
 #include <async/result.hpp>
 #include <stdint.h>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <vector>
 
 namespace blockfs {
 
+enum class BlockOp {
+	read,
+	write,
+	// Makes all completed writes durable. Does not use the sector or segments.
+	flush,
+	// Hints that the sectors are no longer in use. Segment buffers are ignored.
+	discard
+};
+
+// Flags of BlockRequests.
+enum : uint32_t {
+	// Complete writes only once they are durable.
+	blockFua = 1,
+	// Ask drivers to process this request before others (e.g., because a client is waiting for it).
+	blockHighPriority = 2
+};
+
+// A part of a BlockRequest that is backed by a contiguous buffer.
+struct BlockSegment {
+	void *buffer;
+	size_t numSectors;
+};
+
+// An operation on consecutive sectors, starting at sector.
+// Data is transferred to/from the segments in order.
+struct BlockRequest {
+	BlockOp op = BlockOp::read;
+	uint32_t flags = 0;
+	uint64_t sector = 0;
+	std::vector<BlockSegment> segments;
+
+	size_t numSectors() const {
+		size_t n = 0;
+		for(auto &segment : segments)
+			n += segment.numSectors;
+		return n;
+	}
+};
+
 struct BlockDevice {
 	BlockDevice(size_t sector_size, int64_t parent_id);
 
@@ -19,6 +62,16 @@ struct BlockDevice {
 
 	virtual async::result<size_t> getSize() = 0;
 
+	// Performs a single request. The default implementation splits reads and writes
+	// into readSectors() and writeSectors() calls. Since it cannot flush any caches,
+	// it completes flushes and discards immediately and it ignores all flags.
+	virtual async::result<void> submit(BlockRequest &request);
+
+	// Performs all requests; they may complete in any order. Drivers that can queue
+	// multiple requests should override submit() such that it does not serialize
+	// requests, since the default implementation calls submit() for all requests concurrently.
+	virtual async::result<void> submitMany(std::span<BlockRequest> requests);
+
 	size_t size;
 	const size_t sectorSize;
 	const int64_t parentId;
@@ -26,6 +79,24 @@ struct BlockDevice {
 protected:
 };
 
-async::detached runDevice(BlockDevice *device);
+// Parameters of the I/O scheduler that libblockfs can put in front of a BlockDevice.
+// The scheduler merges adjacent requests and prefers reads over writes.
+struct SchedulerOptions {
+	// Dispatch requests in ascending sector order (instead of arrival order).
+	bool rotational = false;
+	// Maximal time that reads and writes are delayed in favor of other requests, in nanoseconds.
+	uint64_t readDeadline = 50'000'000;
+	uint64_t writeDeadline = 500'000'000;
+	// Number of consecutive read batches that are dispatched while writes are waiting.
+	unsigned int writeStarvation = 2;
+	// Upper bound on the size of merged requests.
+	size_t maxMergeSectors = 2048;
+	// Upper bound on the number of requests that are passed to the device concurrently.
+	size_t maxInFlight = 32;
+};
+
+// If schedulerOptions is given, all requests to the device go through an I/O scheduler.
+async::detached runDevice(BlockDevice *device,
+		std::optional<SchedulerOptions> schedulerOptions = std::nullopt);
 
 } // namespace blockfs
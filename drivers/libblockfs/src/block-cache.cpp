@@ -0,0 +1,163 @@
+#include <assert.h>
+#include <string.h>
+#include <vector>
+
+#include "block-cache.hpp"
+
+namespace blockfs {
+namespace ext2fs {
+
+BlockCache::Ref::Ref(BlockCache *cache, std::shared_ptr<Entry> entry)
+: _cache{cache}, _entry{std::move(entry)} {
+	_entry->refCount++;
+}
+
+void BlockCache::Ref::reset() {
+	if(!_entry)
+		return;
+	assert(_entry->refCount);
+	_entry->refCount--;
+	_entry = nullptr;
+	_cache->_shrink();
+	_cache = nullptr;
+}
+
+BlockCache::BlockCache(BlockDevice *device, size_t block_size, size_t capacity)
+: _device{device}, _blockSize{block_size}, _sectorsPerBlock{block_size / 512},
+		_capacity{capacity} {
+	assert(_capacity);
+}
+
+async::result<BlockCache::Ref> BlockCache::get(uint64_t block) {
+	auto it = _entries.find(block);
+	if(it != _entries.end()) {
+		Ref ref{this, it->second};
+		_touch(it->second.get());
+		co_await ref._entry->loadEvent.wait();
+		co_return std::move(ref);
+	}
+
+	Ref ref{this, _insert(block)};
+	co_await _device->readSectors(block * _sectorsPerBlock,
+			ref._entry->data.get(), _sectorsPerBlock);
+	ref._entry->loaded = true;
+	ref._entry->loadEvent.raise();
+	co_return std::move(ref);
+}
+
+async::result<void> BlockCache::read(uint64_t block, void *buffer, size_t num_blocks) {
+	auto out = reinterpret_cast<std::byte *>(buffer);
+
+	size_t i = 0;
+	while(i < num_blocks) {
+		auto it = _entries.find(block + i);
+		if(it != _entries.end()) {
+			Ref ref{this, it->second};
+			_touch(it->second.get());
+			co_await ref._entry->loadEvent.wait();
+			memcpy(out + i * _blockSize, ref.data(), _blockSize);
+			i++;
+			continue;
+		}
+
+		// Read the run of missing blocks in a single request.
+		std::vector<Ref> run;
+		while(i + run.size() < num_blocks && !_entries.count(block + i + run.size()))
+			run.push_back(Ref{this, _insert(block + i + run.size())});
+
+		co_await _device->readSectors((block + i) * _sectorsPerBlock,
+				out + i * _blockSize, run.size() * _sectorsPerBlock);
+		for(size_t k = 0; k < run.size(); k++) {
+			auto entry = run[k]._entry.get();
+			// update() drops entries that are written while they are loaded.
+			if(entry->cached)
+				memcpy(entry->data.get(), out + (i + k) * _blockSize, _blockSize);
+			entry->loaded = true;
+			entry->loadEvent.raise();
+		}
+		i += run.size();
+	}
+}
+
+void BlockCache::update(uint64_t block, const void *buffer, size_t num_blocks) {
+	auto in = reinterpret_cast<const std::byte *>(buffer);
+
+	auto it = _entries.lower_bound(block);
+	while(it != _entries.end() && it->first < block + num_blocks) {
+		auto entry = (it++)->second;
+		if(!entry->loaded) {
+			// The data that is currently read from disk is outdated.
+			_remove(std::move(entry));
+			continue;
+		}
+		memcpy(entry->data.get(), in + (entry->block - block) * _blockSize, _blockSize);
+		entry->dirty = false;
+	}
+}
+
+void BlockCache::invalidate(uint64_t block, size_t num_blocks) {
+	auto it = _entries.lower_bound(block);
+	while(it != _entries.end() && it->first < block + num_blocks)
+		_remove((it++)->second);
+}
+
+async::result<void> BlockCache::writeback() {
+	std::vector<Ref> dirty;
+	for(auto &[block, entry] : _entries)
+		if(entry->dirty)
+			dirty.push_back(Ref{this, entry});
+
+	// Write runs of consecutive blocks with a single request.
+	std::vector<std::byte> buffer;
+	size_t i = 0;
+	while(i < dirty.size()) {
+		size_t n = 1;
+		while(i + n < dirty.size()
+				&& dirty[i + n]._entry->block == dirty[i]._entry->block + n)
+			n++;
+
+		buffer.resize(n * _blockSize);
+		for(size_t k = 0; k < n; k++) {
+			// Blocks that are dirtied again during the write remain dirty.
+			dirty[i + k]._entry->dirty = false;
+			memcpy(buffer.data() + k * _blockSize, dirty[i + k].data(), _blockSize);
+		}
+		co_await _device->writeSectors(dirty[i]._entry->block * _sectorsPerBlock,
+				buffer.data(), n * _sectorsPerBlock);
+		i += n;
+	}
+}
+
+auto BlockCache::_insert(uint64_t block) -> std::shared_ptr<Entry> {
+	auto entry = std::make_shared<Entry>();
+	entry->block = block;
+	entry->data = std::make_unique<std::byte[]>(_blockSize);
+	entry->lruIt = _lru.insert(_lru.end(), entry.get());
+	_entries.emplace(block, entry);
+	_shrink();
+	return entry;
+}
+
+void BlockCache::_remove(std::shared_ptr<Entry> entry) {
+	assert(entry->cached);
+	entry->cached = false;
+	_lru.erase(entry->lruIt);
+	_entries.erase(entry->block);
+}
+
+void BlockCache::_touch(Entry *entry) {
+	_lru.splice(_lru.end(), _lru, entry->lruIt);
+}
+
+void BlockCache::_shrink() {
+	auto it = _lru.begin();
+	while(_entries.size() > _capacity && it != _lru.end()) {
+		auto entry = *(it++);
+		if(entry->refCount || entry->dirty || !entry->loaded)
+			continue;
+		_lru.erase(entry->lruIt);
+		_entries.erase(entry->block);
+	}
+}
+
+} } // namespace blockfs::ext2fs
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include <async/oneshot-event.hpp>
+#include <async/result.hpp>
+
+#include <blockfs.hpp>
+
+namespace blockfs {
+namespace ext2fs {
+
+// LRU-bounded cache of metadata blocks (indirect blocks, extent tree nodes, bitmaps
+// and inode table blocks). The managed memory objects that hold these blocks are
+// initialized from this cache, so blocks that were evicted from the page cache
+// are usually not read from disk again.
+//
+// Writes of metadata blocks must go through update() and writes of other blocks
+// through invalidate() such that the cache stays coherent with the disk.
+struct BlockCache {
+private:
+	struct Entry {
+		uint64_t block;
+		std::unique_ptr<std::byte[]> data;
+		unsigned int refCount = 0;
+		bool loaded = false;
+		bool dirty = false;
+		// Cleared when the entry is removed from the cache (while it is still referenced).
+		bool cached = true;
+		async::oneshot_event loadEvent;
+		std::list<Entry *>::iterator lruIt;
+	};
+
+public:
+	// Reference to a cached block. Referenced blocks are not evicted.
+	struct Ref {
+		friend struct BlockCache;
+
+		Ref() = default;
+
+		Ref(const Ref &) = delete;
+
+		Ref(Ref &&other)
+		: _cache{std::exchange(other._cache, nullptr)}, _entry{std::move(other._entry)} { }
+
+		~Ref() {
+			reset();
+		}
+
+		Ref &operator= (Ref other) {
+			std::swap(_cache, other._cache);
+			std::swap(_entry, other._entry);
+			return *this;
+		}
+
+		explicit operator bool () const {
+			return static_cast<bool>(_entry);
+		}
+
+		std::byte *data() const {
+			return _entry->data.get();
+		}
+
+		// Marks the block as modified; it is written by BlockCache::writeback().
+		void markDirty() {
+			_entry->dirty = true;
+		}
+
+		void reset();
+
+	private:
+		Ref(BlockCache *cache, std::shared_ptr<Entry> entry);
+
+		BlockCache *_cache = nullptr;
+		std::shared_ptr<Entry> _entry;
+	};
+
+	BlockCache(BlockDevice *device, size_t block_size, size_t capacity);
+
+	// Returns a reference to the block (reading it if necessary).
+	async::result<Ref> get(uint64_t block);
+
+	// Copies consecutive blocks into buffer. Blocks that are not cached
+	// are read with as few requests as possible and inserted into the cache.
+	async::result<void> read(uint64_t block, void *buffer, size_t num_blocks);
+
+	// Replaces the cached contents of blocks that were written to disk.
+	void update(uint64_t block, const void *buffer, size_t num_blocks);
+
+	// Drops blocks that were overwritten by non-metadata.
+	void invalidate(uint64_t block, size_t num_blocks);
+
+	// Writes all dirty blocks to disk.
+	async::result<void> writeback();
+
+private:
+	// Inserts an entry for a block that is not cached.
+	std::shared_ptr<Entry> _insert(uint64_t block);
+	void _remove(std::shared_ptr<Entry> entry);
+	void _touch(Entry *entry);
+	// Evicts unreferenced clean blocks until the cache fits into its capacity.
+	void _shrink();
+
+	BlockDevice *_device;
+	size_t _blockSize;
+	size_t _sectorsPerBlock;
+	size_t _capacity;
+
+	std::map<uint64_t, std::shared_ptr<Entry>> _entries;
+	// Least recently used entries first.
+	std::list<Entry *> _lru;
+};
+
+} } // namespace blockfs::ext2fs
@@ -1,4 +1,5 @@
 
+#include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,10 +10,12 @@
 #include <async/result.hpp>
 #include <helix/ipc.hpp>
 #include <helix/memory.hpp>
+#include <helix/timer.hpp>
 
 #include <array>
 
 #include "ext2fs.hpp"
+#include "htree.hpp"
 
 namespace blockfs {
 namespace ext2fs {
@@ -22,6 +25,88 @@ namespace {
 
 	constexpr int pageShift = 12;
 	constexpr size_t pageSize = size_t{1} << pageShift;
+
+	// Delay before changes to the block group descriptor table are written back.
+	// Allocations that happen within this time are written back together.
+	constexpr uint64_t bgdtWritebackDelay = 500'000'000;
+
+	// Writeback of file data is delayed by this time (unless enough data is pending)
+	// such that adjacent dirty pages can be written (and allocated) together.
+	constexpr uint64_t writebackGatherDelay = 20'000'000;
+	constexpr size_t writebackGatherLimit = size_t{4} << 20;
+
+	// Readahead windows of sequentially read files start at the minimal size
+	// and double with each window up to the maximal size.
+	constexpr size_t minReadaheadWindow = 128 * 1024;
+	constexpr size_t maxReadaheadWindow = size_t{2} << 20;
+
+	// Freed blocks are discarded after this delay (such that adjacent ranges are
+	// discarded together). They cannot be allocated until that happens.
+	constexpr uint64_t discardDelay = 500'000'000;
+
+	// Size of the metadata block cache.
+	constexpr size_t blockCacheSize = size_t{8} << 20;
+
+	// Returns the index of the first bit in [bit, limit) that is equal to value,
+	// or limit if there is no such bit.
+	uint32_t findFirst(const uint32_t *words, uint32_t bit, uint32_t limit, bool value) {
+		while(bit < limit) {
+			auto word = value ? words[bit / 32] : ~words[bit / 32];
+			word &= ~uint32_t{0} << (bit % 32);
+			if(word)
+				return std::min((bit & ~uint32_t{31}) + __builtin_ctz(word), limit);
+			bit = (bit & ~uint32_t{31}) + 32;
+		}
+		return limit;
+	}
+
+	// Directories are considered to be hot (and their entries are cached) after
+	// this many lookups, if they are at least hotDirectorySize bytes large.
+	constexpr unsigned int hotDirectoryLookups = 16;
+	constexpr uint64_t hotDirectorySize = 64 * 1024;
+
+	DirEntry entryFromDisk(const DiskDirEntry *disk_entry) {
+		DirEntry entry;
+		entry.inode = disk_entry->inode;
+
+		switch(disk_entry->fileType) {
+		case EXT2_FT_REG_FILE:
+			entry.fileType = kTypeRegular; break;
+		case EXT2_FT_DIR:
+			entry.fileType = kTypeDirectory; break;
+		case EXT2_FT_SYMLINK:
+			entry.fileType = kTypeSymlink; break;
+		default:
+			entry.fileType = kTypeNone;
+		}
+
+		return entry;
+	}
+
+	uint8_t direntTypeFromDisk(uint8_t file_type) {
+		switch(file_type) {
+		case EXT2_FT_REG_FILE:
+			return DT_REG;
+		case EXT2_FT_DIR:
+			return DT_DIR;
+		case EXT2_FT_SYMLINK:
+			return DT_LNK;
+		default:
+			return DT_UNKNOWN;
+		}
+	}
+
+	// Extents and indices both start with the first file block that they cover.
+	uint32_t firstKeyOf(const DiskExtentHeader *header) {
+		uint32_t key;
+		memcpy(&key, header + 1, sizeof(uint32_t));
+		return key;
+	}
+
+	void setExtentStart(DiskExtent &extent, uint64_t block) {
+		extent.startLo = static_cast<uint32_t>(block);
+		extent.startHi = static_cast<uint16_t>(block >> 32);
+	}
 }
 
 // --------------------------------------------------------
@@ -36,56 +121,194 @@ void Inode::setFileSize(size_t size) {
 	diskInode()->size = size;
 }
 
-async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
-Inode::findEntry(std::string name) {
-	co_await readyJump.wait();
-
-	if(fileType != kTypeDirectory)
-		co_return protocols::fs::Error::notDirectory;
-	assert(fileMapping.size() == fileSize());
+async::result<helix::UniqueDescriptor> Inode::lockRange(uintptr_t offset, size_t size) {
+	auto begin = offset & ~(pageSize - 1);
+	auto end = (offset + size + pageSize - 1) & ~(pageSize - 1);
 
 	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
 	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
 			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
+			begin, end - begin, helix::Dispatcher::global());
 	co_await submit.async_wait();
 	HEL_CHECK(lock_memory.error());
+	co_return lock_memory.descriptor();
+}
 
-	// Read the directory structure.
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
+std::optional<Inode::EntryLocation> Inode::locateEntry(const std::string &name,
+		uintptr_t begin, uintptr_t end) {
+	std::optional<uintptr_t> previous;
+	uintptr_t offset = begin;
+	while(offset < end) {
 		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(fileMapping.get()) + offset);
+		assert(offset + sizeof(DiskDirEntry) <= end);
+		if(!(offset & (fs.blockSize - 1)))
+			previous = std::nullopt;
+		auto disk_entry = dirEntryAt(offset);
 		assert(disk_entry->recordLength);
 
 		if(disk_entry->inode
 				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			DirEntry entry;
-			entry.inode = disk_entry->inode;
-
-			switch(disk_entry->fileType) {
-			case EXT2_FT_REG_FILE:
-				entry.fileType = kTypeRegular; break;
-			case EXT2_FT_DIR:
-				entry.fileType = kTypeDirectory; break;
-			case EXT2_FT_SYMLINK:
-				entry.fileType = kTypeSymlink; break;
-			default:
-				entry.fileType = kTypeNone;
+				&& !memcmp(disk_entry->name, name.data(), name.length()))
+			return EntryLocation{offset, previous};
+
+		previous = offset;
+		offset += disk_entry->recordLength;
+	}
+	assert(offset == end);
+
+	return std::nullopt;
+}
+
+async::result<std::optional<std::vector<uint64_t>>>
+Inode::probeHtree(const std::string &name) {
+	if(!isIndexed() || !fs.dirIndex)
+		co_return std::nullopt;
+	auto num_blocks = fileSize() >> fs.blockShift;
+	if(!num_blocks)
+		co_return std::nullopt;
+
+	auto root_lock = co_await lockRange(0, fs.blockSize);
+
+	// The root info follows the 12 byte entries for "." and "..".
+	auto info = reinterpret_cast<DiskDxRootInfo *>(
+			reinterpret_cast<char *>(fileMapping.get()) + 24);
+	if(info->reservedZero || info->infoLength != sizeof(DiskDxRootInfo)
+			|| info->indirectLevels > 2)
+		co_return std::nullopt;
+
+	int version = info->hashVersion;
+	if(fs.unsignedHash && version <= EXT2_HASH_TEA)
+		version += EXT2_HASH_LEGACY_UNSIGNED;
+	auto hash = dirHash(version, fs.hashSeed, name.data(), name.size());
+	if(!hash)
+		co_return std::nullopt;
+
+	uintptr_t entries_offset = 24 + info->infoLength;
+	helix::UniqueDescriptor node_lock;
+	for(int level = 0; ; level++) {
+		auto entries = reinterpret_cast<DiskDxEntry *>(
+				reinterpret_cast<char *>(fileMapping.get()) + entries_offset);
+		auto count_limit = reinterpret_cast<DiskDxCountLimit *>(entries);
+		auto max_entries = (fs.blockSize - (entries_offset & (fs.blockSize - 1)))
+				/ sizeof(DiskDxEntry);
+		if(!count_limit->count || count_limit->count > count_limit->limit
+				|| count_limit->limit > max_entries)
+			co_return std::nullopt;
+
+		// Find the last entry with a hash <= the hash of the name.
+		uint32_t k = 0;
+		uint32_t lo = 1, hi = count_limit->count;
+		while(lo < hi) {
+			auto mid = (lo + hi) / 2;
+			if(entries[mid].hash <= *hash) {
+				k = mid;
+				lo = mid + 1;
+			}else{
+				hi = mid;
 			}
+		}
 
-			co_return entry;
+		auto block = entries[k].block;
+		if(block >= num_blocks)
+			co_return std::nullopt;
+
+		if(level == info->indirectLevels) {
+			// If the lowest bit of the hash is set, the following leaf continues
+			// a run of entries with the same hash.
+			std::vector<uint64_t> leaves{block};
+			for(auto i = k + 1; i < count_limit->count; i++) {
+				if((entries[i].hash & ~uint32_t{1}) != *hash || entries[i].block >= num_blocks)
+					break;
+				leaves.push_back(entries[i].block);
+			}
+			// TODO: Such runs can also continue in the next interior index block.
+			co_return leaves;
 		}
 
+		// Interior index blocks start with an empty directory entry.
+		node_lock = co_await lockRange(uintptr_t{block} << fs.blockShift, fs.blockSize);
+		entries_offset = (uintptr_t{block} << fs.blockShift) + 8;
+	}
+}
+
+async::result<void> Inode::dropIndex() {
+	if(!isIndexed())
+		co_return;
+	diskInode()->flags &= ~EXT2_INDEX_FL;
+
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			diskMapping.get(), fs.inodeSize);
+	HEL_CHECK(syncInode.error());
+}
+
+void Inode::buildEntryCache() {
+	entryCache.emplace();
+
+	uintptr_t offset = 0;
+	while(offset < fileSize()) {
+		auto disk_entry = dirEntryAt(offset);
+		assert(disk_entry->recordLength);
+		if(disk_entry->inode)
+			entryCache->insert_or_assign(std::string(disk_entry->name, disk_entry->nameLength),
+					entryFromDisk(disk_entry));
 		offset += disk_entry->recordLength;
 	}
 	assert(offset == fileSize());
+}
 
-	co_return std::nullopt;
+void Inode::invalidateReadahead(uint64_t offset, size_t length) {
+	auto it = readaheadBuffers.begin();
+	while(it != readaheadBuffers.end()) {
+		auto readahead = it->get();
+		if(readahead->offset < offset + length && offset < readahead->offset + readahead->length) {
+			readahead->valid = false;
+			it = readaheadBuffers.erase(it);
+		}else{
+			++it;
+		}
+	}
+}
+
+async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
+Inode::findEntry(std::string name) {
+	co_await readyJump.wait();
+
+	if(fileType != kTypeDirectory)
+		co_return protocols::fs::Error::notDirectory;
+	assert(fileMapping.size() == fileSize());
+
+	if(!entryCache && ++lookupCount >= hotDirectoryLookups
+			&& fileSize() >= hotDirectorySize) {
+		auto lock = co_await lockRange(0, fileSize());
+		buildEntryCache();
+	}
+
+	if(entryCache) {
+		auto it = entryCache->find(name);
+		if(it == entryCache->end())
+			co_return std::nullopt;
+		co_return it->second;
+	}
+
+	// For hashed directories, only the leaves that belong to the name are read.
+	auto leaves = co_await probeHtree(name);
+	if(leaves) {
+		for(auto leaf : *leaves) {
+			auto lock = co_await lockRange(leaf << fs.blockShift, fs.blockSize);
+			auto location = locateEntry(name, leaf << fs.blockShift,
+					(leaf + 1) << fs.blockShift);
+			if(location)
+				co_return entryFromDisk(dirEntryAt(location->offset));
+		}
+		co_return std::nullopt;
+	}
+
+	auto lock = co_await lockRange(0, fileSize());
+	auto location = locateEntry(name, 0, fileSize());
+	if(!location)
+		co_return std::nullopt;
+	co_return entryFromDisk(dirEntryAt(location->offset));
 }
 
 async::result<std::optional<DirEntry>>
@@ -215,99 +438,97 @@ async::result<frg::expected<protocols::fs::Error>> Inode::unlink(std::string nam
 		co_return protocols::fs::Error::notDirectory;
 	assert(fileMapping.size() == fileSize());
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
-
-	// Read the directory structure.
-	DiskDirEntry *previous_entry = nullptr;
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
-		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(fileMapping.get()) + offset);
-		assert(disk_entry->recordLength);
-
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
+	if(entryCache && !entryCache->contains(name))
+		co_return protocols::fs::Error::fileNotFound;
+
+	// Find the entry (and keep its page locked).
+	helix::UniqueDescriptor lock;
+	std::optional<EntryLocation> location;
+	if(auto leaves = co_await probeHtree(name); leaves) {
+		for(auto leaf : *leaves) {
+			lock = co_await lockRange(leaf << fs.blockShift, fs.blockSize);
+			location = locateEntry(name, leaf << fs.blockShift, (leaf + 1) << fs.blockShift);
+			if(location)
+				break;
+		}
+	}else{
+		lock = co_await lockRange(0, fileSize());
+		location = locateEntry(name, 0, fileSize());
+	}
+	if(!location)
+		co_return protocols::fs::Error::fileNotFound;
+	auto disk_entry = dirEntryAt(location->offset);
 
-			auto target = fs.accessInode(disk_entry->inode);
-			co_await target->readyJump.wait();
+	auto target = fs.accessInode(disk_entry->inode);
+	co_await target->readyJump.wait();
 
-			if(target->fileType == kTypeDirectory) {
-				if(target->diskInode()->linksCount > 2) {
-					co_return protocols::fs::Error::directoryNotEmpty;
-				}
+	if(target->fileType == kTypeDirectory) {
+		if(target->diskInode()->linksCount > 2) {
+			co_return protocols::fs::Error::directoryNotEmpty;
+		}
 
-				helix::LockMemoryView target_lock_memory;
-				auto target_map_size = (target->fileSize() + 0xFFF) & ~size_t(0xFFF);
-				auto &&target_submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(target->frontalMemory),
-						&target_lock_memory,
-						0, target_map_size, helix::Dispatcher::global());
-				co_await target_submit.async_wait();
-				HEL_CHECK(target_lock_memory.error());
-
-				// Check the directory entries for anything other than "." and "..".
-				uintptr_t target_offset = 0;
-				while(target_offset < target->fileSize()) {
-					assert(!(target_offset & 3));
-					assert(target_offset + sizeof(DiskDirEntry) <= target->fileSize());
-					auto target_disk_entry = reinterpret_cast<DiskDirEntry *>(
-						reinterpret_cast<char*>(target->fileMapping.get()) + target_offset);
-					assert(target_disk_entry);
-					assert(target_disk_entry->recordLength);
-
-					if(target_disk_entry->inode
-						&& target_disk_entry->nameLength == 2
-						&& target_disk_entry->name[0] == '.'
-						&& target_disk_entry->name[1] == '.') {
-						// ".."
-					} else if(target_disk_entry->inode
-						&& target_disk_entry->nameLength == 1
-						&& target_disk_entry->name[0] == '.') {
-						// "."
-					} else {
-						// Directory has stuff in it, do not delete it.
-						co_return protocols::fs::Error::directoryNotEmpty;
-					}
-
-					target_offset += target_disk_entry->recordLength;
-				}
+		helix::LockMemoryView target_lock_memory;
+		auto target_map_size = (target->fileSize() + 0xFFF) & ~size_t(0xFFF);
+		auto &&target_submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(target->frontalMemory),
+				&target_lock_memory,
+				0, target_map_size, helix::Dispatcher::global());
+		co_await target_submit.async_wait();
+		HEL_CHECK(target_lock_memory.error());
+
+		// Check the directory entries for anything other than "." and "..".
+		uintptr_t target_offset = 0;
+		while(target_offset < target->fileSize()) {
+			assert(!(target_offset & 3));
+			assert(target_offset + sizeof(DiskDirEntry) <= target->fileSize());
+			auto target_disk_entry = reinterpret_cast<DiskDirEntry *>(
+				reinterpret_cast<char*>(target->fileMapping.get()) + target_offset);
+			assert(target_disk_entry);
+			assert(target_disk_entry->recordLength);
+
+			if(!target_disk_entry->inode) {
+				// Unused entry (or htree index block).
+			} else if(target_disk_entry->nameLength == 2
+				&& target_disk_entry->name[0] == '.'
+				&& target_disk_entry->name[1] == '.') {
+				// ".."
+			} else if(target_disk_entry->nameLength == 1
+				&& target_disk_entry->name[0] == '.') {
+				// "."
+			} else {
+				// Directory has stuff in it, do not delete it.
+				co_return protocols::fs::Error::directoryNotEmpty;
 			}
 
-			// The directory should start with "." and "..". As those entries are never deleted,
-			// we can assume that a previous entry exists.
-			assert(previous_entry);
-			previous_entry->recordLength += disk_entry->recordLength;
-
-			// Flush the data to disk.
-			// TODO: It would be enough to flush only one or two pages here.
-			auto syncDir = co_await helix_ng::synchronizeSpace(
-					helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
-			HEL_CHECK(syncDir.error());
-
-			// Decrement the inode's link count
-			target->diskInode()->linksCount--;
-			auto syncInode = co_await helix_ng::synchronizeSpace(
-					helix::BorrowedDescriptor{kHelNullHandle},
-					target->diskMapping.get(), fs.inodeSize);
-			HEL_CHECK(syncInode.error());
-
-			co_return {};
+			target_offset += target_disk_entry->recordLength;
 		}
+	}
 
-		offset += disk_entry->recordLength;
-		previous_entry = disk_entry;
+	// Entries must not span block boundaries; hence, the first entry of a block
+	// is marked as unused instead of being merged into its predecessor.
+	// Block 0 starts with ".", which is never deleted.
+	if(location->previous) {
+		dirEntryAt(*location->previous)->recordLength += disk_entry->recordLength;
+	}else{
+		assert(location->offset);
+		disk_entry->inode = 0;
 	}
-	assert(offset == fileSize());
+	if(entryCache)
+		entryCache->erase(name);
+
+	// Flush the data to disk.
+	// TODO: It would be enough to flush only one or two pages here.
+	auto syncDir = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle}, fileMapping.get(), fileSize());
+	HEL_CHECK(syncDir.error());
+
+	// Decrement the inode's link count
+	target->diskInode()->linksCount--;
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			target->diskMapping.get(), fs.inodeSize);
+	HEL_CHECK(syncInode.error());
 
-	co_return protocols::fs::Error::fileNotFound;
+	co_return {};
 }
 
 async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
@@ -463,6 +684,30 @@ async::result<void> FileSystem::init() {
 	blocksCount = sb.blocksCount;
 	inodesCount = sb.inodesCount;
 	numBlockGroups = (sb.blocksCount + (sb.blocksPerGroup - 1)) / sb.blocksPerGroup;
+	descSize = sizeof(DiskGroupDesc);
+	if(sb.featureIncompat & EXT4_FEATURE_INCOMPAT_64BIT) {
+		// The first 32 bytes of larger descriptors match DiskGroupDesc.
+		descSize = sb.descSize;
+		assert(descSize >= sizeof(DiskGroupDesc));
+	}
+
+	constexpr uint32_t supportedIncompat = EXT2_FEATURE_INCOMPAT_FILETYPE
+			| EXT3_FEATURE_INCOMPAT_RECOVER | EXT4_FEATURE_INCOMPAT_EXTENTS | EXT4_FEATURE_INCOMPAT_64BIT
+			| EXT4_FEATURE_INCOMPAT_FLEX_BG;
+	if(sb.featureIncompat & ~supportedIncompat)
+		std::cout << "\e[33m" "ext2fs: Unsupported r/w-required features: "
+				<< (sb.featureIncompat & ~supportedIncompat) << "\e[39m" << std::endl;
+	dirIndex = sb.featureCompat & EXT2_FEATURE_COMPAT_DIR_INDEX;
+	unsignedHash = sb.flags & EXT2_FLAGS_UNSIGNED_HASH;
+	memcpy(hashSeed, sb.hashSeed, sizeof(hashSeed));
+
+	// Writes do not update the checksums, so other implementations would
+	// reject all metadata that we modify.
+	if(sb.featureRoCompat & EXT4_FEATURE_RO_COMPAT_METADATA_CSUM) {
+		std::cout << "\e[33m" "ext2fs: Metadata checksums are not supported,"
+				" mounting read-only" "\e[39m" << std::endl;
+		readOnly = true;
+	}
 
 	if(logSuperblock) {
 		std::cout << "ext2fs: Revision is: " << sb.revLevel << std::endl;
@@ -479,13 +724,44 @@ async::result<void> FileSystem::init() {
 		std::cout << "ext2fs:     Inodes per group: " << inodesPerGroup << std::endl;
 	}
 
-	blockGroupDescriptorBuffer.resize((numBlockGroups * sizeof(DiskGroupDesc) + 511) & ~size_t(511));
-	bgdt = (DiskGroupDesc *)blockGroupDescriptorBuffer.data();
+	// The table is written back in units of blocks (which is required by the journal).
+	blockGroupDescriptorBuffer.resize((numBlockGroups * descSize + blockSize - 1)
+			& ~size_t(blockSize - 1));
 
 	auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
 	co_await device->readSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
 			blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / 512);
 
+	if(sb.featureCompat & EXT3_FEATURE_COMPAT_HAS_JOURNAL) {
+		if(sb.featureIncompat & EXT3_FEATURE_INCOMPAT_JOURNAL_DEV) {
+			std::cout << "\e[33m" "ext2fs: External journals are not supported" "\e[39m"
+					<< std::endl;
+		}else{
+			co_await initJournal(sb);
+		}
+	}
+	// The metadata might be inconsistent without the journal's transactions.
+	if(sb.featureIncompat & EXT3_FEATURE_INCOMPAT_RECOVER && !journal) {
+		std::cout << "\e[31m" "ext2fs: File system needs journal recovery"
+				" but the journal cannot be used, mounting read-only" "\e[39m" << std::endl;
+		readOnly = true;
+	}
+
+	// Recovery might have changed the descriptors.
+	if(journal)
+		co_await device->readSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
+				blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / 512);
+
+	blockCache = std::make_unique<BlockCache>(device, blockSize, blockCacheSize >> blockShift);
+
+	groupSummaries.resize(numBlockGroups);
+	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+		freeBlocksTotal += groupDesc(bg_idx).freeBlocksCount;
+		freeInodesTotal += groupDesc(bg_idx).freeInodesCount;
+	}
+	flushBgdt();
+	flushDiscards();
+
 	// Create memory bundles to manage the block and inode bitmaps.
 	HelHandle block_bitmap_frontal, inode_bitmap_frontal;
 	HelHandle block_bitmap_backing, inode_bitmap_backing;
@@ -520,32 +796,13 @@ async::detached FileSystem::manageBlockBitmap(helix::UniqueDescriptor memory) {
 		co_await submit_manage.async_wait();
 		HEL_CHECK(manage.error());
 
-		auto bg_idx = manage.offset() >> blockPagesShift;
-		auto block = bgdt[bg_idx].blockBitmap;
-		assert(block);
-
-		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
-				&& "TODO: propery support multi-page blocks");
-		assert(manage.length() == (1 << blockPagesShift)
-				&& "TODO: propery support multi-page blocks");
-
-		if(manage.type() == kHelManageInitialize) {
-			helix::Mapping bitmap_map{memory,
-					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
-			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
-					manage.offset(), manage.length()));
-		}else{
-			assert(manage.type() == kHelManageWriteback);
-
-			helix::Mapping bitmap_map{memory,
-					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
-			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
-					manage.offset(), manage.length()));
-		}
+		// Each block group has a slot that holds a single bitmap block.
+		co_await manageMetadata(memory, manage, size_t{1} << blockPagesShift, blockSize,
+				[&] (size_t bg_idx) -> async::result<uint64_t> {
+			auto block = groupDesc(bg_idx).blockBitmap;
+			assert(block);
+			co_return block;
+		});
 	}
 }
 
@@ -557,32 +814,13 @@ async::detached FileSystem::manageInodeBitmap(helix::UniqueDescriptor memory) {
 		co_await submit_manage.async_wait();
 		HEL_CHECK(manage.error());
 
-		auto bg_idx = manage.offset() >> blockPagesShift;
-		auto block = bgdt[bg_idx].inodeBitmap;
-		assert(block);
-
-		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
-				&& "TODO: propery support multi-page blocks");
-		assert(manage.length() == (1 << blockPagesShift)
-				&& "TODO: propery support multi-page blocks");
-
-		if(manage.type() == kHelManageInitialize) {
-			helix::Mapping bitmap_map{memory,
-					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
-			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
-					manage.offset(), manage.length()));
-		}else{
-			assert(manage.type() == kHelManageWriteback);
-
-			helix::Mapping bitmap_map{memory,
-					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					bitmap_map.get(), sectorsPerBlock);
-			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
-					manage.offset(), manage.length()));
-		}
+		// Each block group has a slot that holds a single bitmap block.
+		co_await manageMetadata(memory, manage, size_t{1} << blockPagesShift, blockSize,
+				[&] (size_t bg_idx) -> async::result<uint64_t> {
+			auto block = groupDesc(bg_idx).inodeBitmap;
+			assert(block);
+			co_return block;
+		});
 	}
 }
 
@@ -594,33 +832,80 @@ async::detached FileSystem::manageInodeTable(helix::UniqueDescriptor memory) {
 		co_await submit_manage.async_wait();
 		HEL_CHECK(manage.error());
 
-		// TODO: Make sure that we do not read/write past the end of the table.
-		assert(!((inodesPerGroup * inodeSize) & (blockSize - 1)));
+		// The tables of all block groups are stored back to back.
+		auto table_size = inodesPerGroup * inodeSize;
+		co_await manageMetadata(memory, manage, table_size, table_size,
+				[&] (size_t bg_idx) -> async::result<uint64_t> {
+			auto block = groupDesc(bg_idx).inodeTable;
+			assert(block);
+			co_return block;
+		});
+	}
+}
 
-		// TODO: Use shifts instead of division.
-		auto bg_idx = manage.offset() / (inodesPerGroup * inodeSize);
-		auto bg_offset = manage.offset() % (inodesPerGroup * inodeSize);
-		auto block = bgdt[bg_idx].inodeTable;
-		assert(block);
+async::result<void> FileSystem::manageMetadata(helix::BorrowedDescriptor memory,
+		helix::ManageMemory &manage, size_t slot_size, size_t data_size,
+		std::function<async::result<uint64_t>(size_t)> block_of) {
+	helix::Mapping map{memory,
+			static_cast<ptrdiff_t>(manage.offset()), manage.length()};
+	auto window = reinterpret_cast<std::byte *>(map.get());
+
+	// Holds complete blocks if the request only covers parts of them
+	// (i.e., if blocks are larger than pages).
+	std::vector<std::byte> bounce;
+
+	auto progress = manage.offset();
+	auto end = manage.offset() + manage.length();
+	while(progress < end) {
+		auto slot = progress / slot_size;
+		auto slot_offset = progress % slot_size;
+		auto chunk = std::min(end - progress, slot_size - slot_offset);
+		auto data = window + (progress - manage.offset());
+		progress += chunk;
+
+		// The remainder of the slot is not backed by the disk.
+		if(slot_offset >= data_size) {
+			if(manage.type() == kHelManageInitialize)
+				memset(data, 0, chunk);
+			continue;
+		}
+		if(slot_offset + chunk > data_size) {
+			if(manage.type() == kHelManageInitialize)
+				memset(data + (data_size - slot_offset), 0, slot_offset + chunk - data_size);
+			chunk = data_size - slot_offset;
+		}
+
+		auto block = co_await block_of(slot) + (slot_offset >> blockShift);
+		auto skip = slot_offset & (blockSize - 1);
+		auto num_blocks = (skip + chunk + (blockSize - 1)) >> blockShift;
+
+		if(!skip && !(chunk & (blockSize - 1))) {
+			if(manage.type() == kHelManageInitialize) {
+				co_await blockCache->read(block, data, num_blocks);
+			}else{
+				co_await writeMetadata(block, data, num_blocks);
+			}
+			continue;
+		}
 
+		bounce.resize(num_blocks << blockShift);
+		co_await blockCache->read(block, bounce.data(), num_blocks);
 		if(manage.type() == kHelManageInitialize) {
-			helix::Mapping table_map{memory,
-					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock + bg_offset / 512,
-					table_map.get(), manage.length() / 512);
-			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
-					manage.offset(), manage.length()));
+			memcpy(data, bounce.data() + skip, chunk);
 		}else{
-			assert(manage.type() == kHelManageWriteback);
-
-			helix::Mapping table_map{memory,
-					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock + bg_offset / 512,
-					table_map.get(), manage.length() / 512);
-			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
-					manage.offset(), manage.length()));
+			memcpy(bounce.data() + skip, data, chunk);
+			co_await writeMetadata(block, bounce.data(), num_blocks);
 		}
 	}
+
+	if(manage.type() == kHelManageInitialize) {
+		HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
+				manage.offset(), manage.length()));
+	}else{
+		assert(manage.type() == kHelManageWriteback);
+		HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
+				manage.offset(), manage.length()));
+	}
 }
 
 auto FileSystem::accessRoot() -> std::shared_ptr<Inode> {
@@ -708,10 +993,10 @@ async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
 	disk_inode->ctime = time.tv_sec;
 	disk_inode->mtime = time.tv_sec;
 
-	// update usedDirsCount in the respective bgdt for this inode
+	// update usedDirsCount in the respective group descriptor for this inode
 	auto bg_idx = (ino - 1) / inodesPerGroup;
-	bgdt[bg_idx].usedDirsCount++;
-	co_await writebackBgdt();
+	groupDesc(bg_idx).usedDirsCount++;
+	markBgdtDirty();
 
 	co_return accessInode(ino);
 }
@@ -750,16 +1035,12 @@ async::result<std::shared_ptr<Inode>> FileSystem::createSymlink() {
 	co_return accessInode(ino);
 }
 
-async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
-		const void *buffer, size_t length) {
+// Resizes the file if a write to [offset, offset + length) extends it.
+async::result<void> FileSystem::prepareWrite(Inode *inode, uint64_t offset, size_t length) {
 	co_await inode->readyJump.wait();
 
-	// Make sure that data blocks are allocated.
-	auto blockOffset = (offset & ~(blockSize - 1)) >> blockShift;
-	auto blockCount = ((offset & (blockSize - 1)) + length + (blockSize - 1)) >> blockShift;
-	co_await assignDataBlocks(inode, blockOffset, blockCount);
+	// Data blocks are only allocated on writeback (see flushFileData()).
 
-	// Resize the file if necessary.
 	if(offset + length > inode->fileSize()) {
 		HEL_CHECK(helResizeMemory(inode->backingMemory,
 				(offset + length + 0xFFF) & ~size_t(0xFFF)));
@@ -769,6 +1050,11 @@ async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 				inode->diskMapping.get(), inodeSize);
 		HEL_CHECK(syncInode.error());
 	}
+}
+
+async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
+		const void *buffer, size_t length) {
+	co_await prepareWrite(inode, offset, length);
 
 	// TODO: If we *know* that the pages are already available,
 	//       we can also fall back to the following "old" mapping code.
@@ -797,6 +1083,16 @@ async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
 	HEL_CHECK(writeMemory.error());
 }
 
+async::result<HelError> FileSystem::writeFromWindow(Inode *inode, uint64_t offset,
+		helix::BorrowedDescriptor window, size_t length) {
+	co_await prepareWrite(inode, offset, length);
+
+	// The kernel copies from the client's pages to the page cache; we never touch the data.
+	auto copyWindow = co_await helix_ng::copyFromWindow(window,
+			helix::BorrowedDescriptor(inode->frontalMemory), offset, length);
+	co_return copyWindow.error();
+}
+
 async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
 	// TODO: Use a shift instead of a division.
 	auto inode_address = (inode->number - 1) * inodeSize;
@@ -855,6 +1151,7 @@ async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
 	manageIndirect(inode, 1, helix::UniqueDescriptor{backingOrder1});
 	manageIndirect(inode, 2, helix::UniqueDescriptor{backingOrder2});
 	manageFileData(inode);
+	flushFileData(inode);
 
 	inode->isReady = true;
 	inode->readyJump.raise();
@@ -873,34 +1170,189 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 			helix::Mapping file_map{helix::BorrowedDescriptor{inode->backingMemory},
 					static_cast<ptrdiff_t>(manage.offset()), manage.length(), kHelMapProtWrite};
 
-			assert(!(manage.offset() % inode->fs.blockSize));
-			size_t backed_size = std::min(manage.length(), inode->fileSize() - manage.offset());
-			size_t num_blocks = (backed_size + (inode->fs.blockSize - 1)) / inode->fs.blockSize;
-
-			assert(num_blocks * inode->fs.blockSize <= manage.length());
-			co_await inode->fs.readDataBlocks(inode, manage.offset() / inode->fs.blockSize,
-					num_blocks, file_map.get());
+			co_await initializeFileData(inode, manage.offset(), manage.length(),
+					reinterpret_cast<std::byte *>(file_map.get()));
 
 			HEL_CHECK(helUpdateMemory(inode->backingMemory, kHelManageInitialize,
 					manage.offset(), manage.length()));
 		}else{
 			assert(manage.type() == kHelManageWriteback);
 
-			helix::Mapping file_map{helix::BorrowedDescriptor{inode->backingMemory},
-					static_cast<ptrdiff_t>(manage.offset()), manage.length(), kHelMapProtRead};
+			// Writeback is performed asynchronously by flushFileData().
+			inode->pendingWriteback.emplace(manage.offset(), manage.length());
+			inode->pendingWritebackBytes += manage.length();
+			inode->writebackDoorbell.raise();
+		}
+	}
+}
+
+async::detached FileSystem::flushFileData(std::shared_ptr<Inode> inode) {
+	while(true) {
+		if(inode->pendingWriteback.empty()) {
+			co_await inode->writebackDoorbell.async_wait();
+			continue;
+		}
 
-			assert(!(manage.offset() % inode->fs.blockSize));
-			size_t backed_size = std::min(manage.length(), inode->fileSize() - manage.offset());
-			size_t num_blocks = (backed_size + (inode->fs.blockSize - 1)) / inode->fs.blockSize;
+		if(inode->pendingWritebackBytes < writebackGatherLimit)
+			co_await helix::sleepFor(writebackGatherDelay);
+
+		auto pending = std::move(inode->pendingWriteback);
+		inode->pendingWriteback.clear();
+		inode->pendingWritebackBytes = 0;
+
+		auto it = pending.begin();
+		while(it != pending.end()) {
+			// Merge adjacent ranges into a single write.
+			auto offset = it->first;
+			auto end = it->first + it->second;
+			for(++it; it != pending.end() && it->first == end; ++it)
+				end += it->second;
+
+			// Shared mappings can still dirty pages; such changes never reach the disk.
+			if(readOnly) {
+				std::cout << "\e[33m" "ext2fs: Discarding writeback of inode " << inode->number
+						<< " on read-only file system" "\e[39m" << std::endl;
+			}else if(offset < inode->fileSize()) {
+				helix::Mapping file_map{helix::BorrowedDescriptor{inode->backingMemory},
+						static_cast<ptrdiff_t>(offset), end - offset, kHelMapProtRead};
+
+				size_t backed_size = std::min(end - offset, inode->fileSize() - offset);
+				auto first_block = offset >> blockShift;
+				auto skip = offset & (blockSize - 1);
+				size_t num_blocks = (skip + backed_size + (blockSize - 1)) >> blockShift;
+
+				// If blocks are larger than pages, the range can cover parts of blocks.
+				// Merge it into the current contents of the blocks.
+				const void *source = file_map.get();
+				std::vector<std::byte> bounce;
+				if(skip || (num_blocks << blockShift) > end - offset) {
+					bounce.resize(num_blocks << blockShift);
+					co_await readDataBlocks(inode, first_block, num_blocks, bounce.data());
+					memcpy(bounce.data() + skip, file_map.get(), backed_size);
+					source = bounce.data();
+				}
 
-			assert(num_blocks * inode->fs.blockSize <= manage.length());
-			co_await inode->fs.writeDataBlocks(inode, manage.offset() / inode->fs.blockSize,
-					num_blocks, file_map.get());
+				// Allocate all blocks of the range at once (i.e., contiguously).
+				co_await assignDataBlocks(inode.get(), first_block, num_blocks);
+				co_await writeDataBlocks(inode, first_block, num_blocks, source);
+				inode->invalidateReadahead(offset, end - offset);
+			}
 
 			HEL_CHECK(helUpdateMemory(inode->backingMemory, kHelManageWriteback,
-					manage.offset(), manage.length()));
+					offset, end - offset));
+		}
+	}
+}
+
+async::result<void> FileSystem::readFileRange(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t length, std::byte *buffer) {
+	if(offset >= inode->fileSize())
+		co_return;
+	size_t backed_size = std::min(length, inode->fileSize() - offset);
+	auto first_block = offset >> blockShift;
+	auto skip = offset & (blockSize - 1);
+	size_t num_blocks = (skip + backed_size + (blockSize - 1)) >> blockShift;
+
+	if(!skip && (num_blocks << blockShift) <= length) {
+		co_await readDataBlocks(inode, first_block, num_blocks, buffer);
+		co_return;
+	}
+
+	// Blocks are larger than pages: read complete blocks and copy the requested part.
+	std::vector<std::byte> bounce(num_blocks << blockShift);
+	co_await readDataBlocks(inode, first_block, num_blocks, bounce.data());
+	memcpy(buffer, bounce.data() + skip, backed_size);
+}
+
+async::result<void> FileSystem::initializeFileData(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t length, std::byte *buffer) {
+	auto end = offset + length;
+
+	auto findBuffer = [&] (uint64_t position) -> std::shared_ptr<Inode::ReadaheadBuffer> {
+		for(auto &readahead : inode->readaheadBuffers)
+			if(readahead->offset <= position && position < readahead->offset + readahead->length)
+				return readahead;
+		return nullptr;
+	};
+
+	// Requests that continue the previous request (or that hit data that was read ahead)
+	// are part of a sequential stream. Note that the kernel fuses adjacent page faults.
+	bool sequential = offset == inode->readaheadNext || findBuffer(offset);
+	inode->readaheadNext = end;
+
+	if(inode->fileType != kTypeRegular || !sequential) {
+		// Random access: stop reading ahead.
+		inode->readaheadWindow = 0;
+		inode->readaheadBuffers.clear();
+		co_await readFileRange(inode, offset, length, buffer);
+		co_return;
+	}
+
+	auto growWindow = [&] {
+		inode->readaheadWindow = inode->readaheadWindow
+				? std::min(inode->readaheadWindow * 2, maxReadaheadWindow)
+				: minReadaheadWindow;
+		return inode->readaheadWindow;
+	};
+
+	uint64_t progress = offset;
+	while(progress < end) {
+		auto readahead = findBuffer(progress);
+		if(!readahead) {
+			// Start of the stream or the reader overtook the readahead.
+			readahead = issueReadahead(inode, progress, std::max(growWindow(), end - progress));
+			if(!readahead) {
+				co_await readFileRange(inode, progress, end - progress,
+						buffer + (progress - offset));
+				break;
+			}
+		}
+
+		co_await readahead->ready.wait();
+		auto chunk = std::min(end, readahead->offset + readahead->length) - progress;
+		if(readahead->valid) {
+			memcpy(buffer + (progress - offset),
+					readahead->data.get() + (progress - readahead->offset), chunk);
+		}else{
+			co_await readFileRange(inode, progress, chunk, buffer + (progress - offset));
 		}
+		progress += chunk;
 	}
+
+	// Drop readahead buffers that were consumed completely.
+	auto &buffers = inode->readaheadBuffers;
+	while(!buffers.empty() && buffers.front()->offset + buffers.front()->length <= end)
+		buffers.pop_front();
+
+	// Once the reader enters the last readahead buffer, start to read the next one.
+	// This keeps the disk busy while the reader consumes the current buffer.
+	if(buffers.size() <= 1) {
+		auto next = buffers.empty() ? end : buffers.back()->offset + buffers.back()->length;
+		issueReadahead(inode, next, growWindow());
+	}
+}
+
+std::shared_ptr<Inode::ReadaheadBuffer> FileSystem::issueReadahead(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t length) {
+	auto limit = (inode->fileSize() + (pageSize - 1)) & ~(pageSize - 1);
+	if(offset >= limit)
+		return nullptr;
+
+	auto readahead = std::make_shared<Inode::ReadaheadBuffer>();
+	readahead->offset = offset;
+	readahead->length = std::min(length, limit - offset);
+	// Zero-initialized: the part beyond the end of the file is not read.
+	readahead->data = std::make_unique<std::byte[]>(readahead->length);
+	inode->readaheadBuffers.push_back(readahead);
+
+	fillReadahead(inode, readahead);
+	return readahead;
+}
+
+async::detached FileSystem::fillReadahead(std::shared_ptr<Inode> inode,
+		std::shared_ptr<Inode::ReadaheadBuffer> readahead) {
+	co_await readFileRange(inode, readahead->offset, readahead->length, readahead->data.get());
+	readahead->ready.raise();
 }
 
 async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
@@ -912,21 +1364,21 @@ async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 		co_await submit_manage.async_wait();
 		HEL_CHECK(manage.error());
 
-		uint32_t element = manage.offset() >> blockPagesShift;
-
-		uint32_t block;
-		if(order == 1) {
-			auto disk_inode = inode->diskInode();
-
-			switch(element) {
-			case 0: block = disk_inode->data.blocks.singleIndirect; break;
-			case 1: block = disk_inode->data.blocks.doubleIndirect; break;
-			case 2: block = disk_inode->data.blocks.tripleIndirect; break;
-			default:
-				assert(!"unexpected offset");
-				abort();
+		// Each slot holds a single indirect block.
+		co_await manageMetadata(memory, manage, size_t{1} << blockPagesShift, blockSize,
+				[&] (size_t element) -> async::result<uint64_t> {
+			if(order == 1) {
+				auto disk_inode = inode->diskInode();
+
+				switch(element) {
+				case 0: co_return disk_inode->data.blocks.singleIndirect;
+				case 1: co_return disk_inode->data.blocks.doubleIndirect;
+				case 2: co_return disk_inode->data.blocks.tripleIndirect;
+				default:
+					assert(!"unexpected offset");
+					abort();
+				}
 			}
-		}else{
 			assert(order == 2);
 
 			auto indirect_frame = element >> (blockShift - 2);
@@ -943,37 +1395,38 @@ async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 			helix::Mapping indirect_map{inode->indirectOrder1,
 					(1 + indirect_frame) << blockPagesShift, size_t{1} << blockPagesShift,
 					kHelMapProtRead | kHelMapDontRequireBacking};
-			block = reinterpret_cast<uint32_t *>(indirect_map.get())[indirect_index];
-		}
-
-		assert(!(manage.offset() & ((1 << blockPagesShift) - 1))
-				&& "TODO: propery support multi-page blocks");
-		assert(manage.length() == (1 << blockPagesShift)
-				&& "TODO: propery support multi-page blocks");
-
-		if (manage.type() == kHelManageInitialize) {
-			helix::Mapping out_map{memory,
-					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->readSectors(block * sectorsPerBlock,
-					out_map.get(), sectorsPerBlock);
-			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageInitialize,
-					manage.offset(), manage.length()));
-		} else {
-			assert(manage.type() == kHelManageWriteback);
-
-			helix::Mapping out_map{memory,
-					static_cast<ptrdiff_t>(manage.offset()), manage.length()};
-			co_await device->writeSectors(block * sectorsPerBlock,
-					out_map.get(), sectorsPerBlock);
-			HEL_CHECK(helUpdateMemory(memory.getHandle(), kHelManageWriteback,
-					manage.offset(), manage.length()));
-
-		}
+			co_return reinterpret_cast<uint32_t *>(indirect_map.get())[indirect_index];
+		});
 	}
 }
 
-async::result<uint32_t> FileSystem::allocateBlock() {
-	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+async::result<std::pair<uint32_t, size_t>> FileSystem::allocateBlocks(uint32_t goal,
+		size_t max_blocks) {
+	assert(max_blocks);
+	if(!freeBlocksTotal)
+		co_return std::pair<uint32_t, size_t>{0, 0};
+	if(goal >= blocksCount)
+		goal = 0;
+	auto goal_bg = goal / blocksPerGroup;
+
+	// Start at the goal, then try the following groups. Finally, try the part of
+	// the goal's group that precedes the goal.
+	for(uint32_t k = 0; k <= numBlockGroups; k++) {
+		auto bg_idx = (goal_bg + k) % numBlockGroups;
+		auto &summary = groupSummaries[bg_idx];
+		uint32_t first_bit = (!k) ? goal % blocksPerGroup : 0;
+		uint32_t limit_bit = (k == numBlockGroups) ? goal % blocksPerGroup : blocksPerGroup;
+		first_bit = std::max(first_bit, summary.firstFreeBlock);
+		if(first_bit >= limit_bit)
+			continue;
+
+		// The on-disk bitmap is not initialized; we cannot allocate from it.
+		// TODO: Initialize such bitmaps.
+		if(groupDesc(bg_idx).flags & EXT4_BG_BLOCK_UNINIT)
+			continue;
+		if(!groupDesc(bg_idx).freeBlocksCount)
+			continue;
+
 		helix::LockMemoryView lock_bitmap;
 		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
 				&lock_bitmap,
@@ -987,36 +1440,57 @@ async::result<uint32_t> FileSystem::allocateBlock() {
 				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
 		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
-		for(unsigned int i = 0; i < (blocksPerGroup + 31) / 32; i++) {
-			if(words[i] == 0xFFFFFFFF)
-				continue;
-			for(int j = 0; j < 32; j++) {
-				if(i * 32 + j >= blocksPerGroup)
-					break;
-				if(words[i] & (static_cast<uint32_t>(1) << j))
-					continue;
-				// TODO: Make sure we never return reserved blocks.
-				// TODO: Make sure we never return blocks higher than the max. block in the SB.
-				auto block = bg_idx * blocksPerGroup + i * 32 + j;
-				assert(block);
-				assert(block < blocksCount);
-				words[i] |= static_cast<uint32_t>(1) << j;
 
-				bgdt[bg_idx].freeBlocksCount--;
-				co_await writebackBgdt();
+		auto bit = findFirst(words, first_bit, limit_bit, false);
+		if(first_bit == summary.firstFreeBlock)
+			summary.firstFreeBlock = bit;
+		if(bit >= limit_bit)
+			continue;
 
-				co_return block;
-			}
-			assert(!"Failed to find zero-bit");
-		}
+		// TODO: Make sure we never return reserved blocks.
+		auto block = bg_idx * blocksPerGroup + bit;
+		assert(block);
+		if(block >= blocksCount)
+			continue;
+
+		// Extend the run as far as possible.
+		auto run_limit = static_cast<uint32_t>(std::min({uint64_t{blocksPerGroup},
+				uint64_t{bit} + max_blocks, uint64_t{blocksCount} - bg_idx * blocksPerGroup}));
+		size_t n = findFirst(words, bit, run_limit, true) - bit;
+		assert(n);
+		for(size_t i = 0; i < n; i++)
+			words[(bit + i) / 32] |= static_cast<uint32_t>(1) << ((bit + i) % 32);
+
+		if(bit == summary.firstFreeBlock)
+			summary.firstFreeBlock = bit + n;
+		groupDesc(bg_idx).freeBlocksCount -= n;
+		freeBlocksTotal -= n;
+		markBgdtDirty();
+
+		co_return std::pair<uint32_t, size_t>{block, n};
 	}
 
-	co_return 0;
+	co_return std::pair<uint32_t, size_t>{0, 0};
+}
+
+async::result<uint32_t> FileSystem::allocateBlock(uint32_t goal) {
+	auto [block, n] = co_await allocateBlocks(goal, 1);
+	co_return block;
 }
 
 async::result<uint32_t> FileSystem::allocateInode() {
+	if(!freeInodesTotal)
+		co_return 0;
+
 	// TODO: Do not start at block group zero.
 	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+		// TODO: Initialize uninitialized inode bitmaps.
+		if(groupDesc(bg_idx).flags & EXT4_BG_INODE_UNINIT)
+			continue;
+		auto &summary = groupSummaries[bg_idx];
+		if(!groupDesc(bg_idx).freeInodesCount || summary.firstFreeInode >= inodesPerGroup)
+			continue;
+
 		helix::LockMemoryView lock_bitmap;
 		auto &&submit_bitmap = helix::submitLockMemoryView(inodeBitmap,
 				&lock_bitmap,
@@ -1030,35 +1504,62 @@ async::result<uint32_t> FileSystem::allocateInode() {
 				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
 		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
-		for(unsigned int i = 0; i < (inodesPerGroup + 31) / 32; i++) {
-			if(words[i] == 0xFFFFFFFF)
-				continue;
-			for(int j = 0; j < 32; j++) {
-				if(i * 32 + j >= inodesPerGroup)
-					break;
-				if(words[i] & (static_cast<uint32_t>(1) << j))
-					continue;
-				// TODO: Make sure we never return reserved inodes.
-				// TODO: Make sure we never return inodes higher than the max. inode in the SB.
-				auto ino = bg_idx * inodesPerGroup + i * 32 + j + 1;
-				assert(ino);
-				assert(ino < inodesCount);
-				words[i] |= static_cast<uint32_t>(1) << j;
+		auto bit = findFirst(words, summary.firstFreeInode, inodesPerGroup, false);
+		summary.firstFreeInode = bit;
+		if(bit >= inodesPerGroup)
+			continue;
+
+		// TODO: Make sure we never return reserved inodes.
+		// TODO: Make sure we never return inodes higher than the max. inode in the SB.
+		auto ino = bg_idx * inodesPerGroup + bit + 1;
+		assert(ino);
+		assert(ino < inodesCount);
+		words[bit / 32] |= static_cast<uint32_t>(1) << (bit % 32);
+
+		summary.firstFreeInode = bit + 1;
+		groupDesc(bg_idx).freeInodesCount--;
+		freeInodesTotal--;
+		markBgdtDirty();
+
+		co_return ino;
+	}
 
-				bgdt[bg_idx].freeInodesCount--;
-				co_await writebackBgdt();
+	co_return 0;
+}
 
-				co_return ino;
-			}
-			assert(!"Failed to find zero-bit");
-		}
+async::result<size_t> FileSystem::assignRun(DiskInode *disk_inode, uint32_t *slots,
+		size_t limit, uint32_t &goal) {
+	assert(limit);
+	if(slots[0]) {
+		// Skip all consecutive assigned blocks.
+		size_t n = 1;
+		while(n < limit && slots[n])
+			n++;
+		goal = slots[n - 1] + 1;
+		co_return n;
 	}
 
-	co_return 0;
+	// Allocate all consecutive unassigned blocks at once such that they end up contiguous.
+	size_t n = 1;
+	while(n < limit && !slots[n])
+		n++;
+
+	auto [block, count] = co_await allocateBlocks(goal, n);
+	assert(block && "Out of disk space"); // TODO: Fix this.
+	for(size_t i = 0; i < count; i++)
+		slots[i] = block + i;
+	disk_inode->blocks += count * (blockSize / 512);
+	goal = block + count;
+	co_return count;
 }
 
 async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 		uint64_t block_offset, size_t num_blocks) {
+	if(inode->usesExtents()) {
+		co_await assignExtentBlocks(inode, block_offset, num_blocks);
+		co_return;
+	}
+
 	size_t per_indirect = blockSize / 4;
 	size_t per_single = per_indirect;
 	size_t per_double = per_indirect * per_indirect;
@@ -1069,6 +1570,10 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 	size_t d_range = s_range + per_double; // Plus the first double indirect block.
 
 	auto disk_inode = inode->diskInode();
+	auto old_blocks = disk_inode->blocks;
+
+	// Place blocks after the previous block of the file (or in the inode's group).
+	uint32_t goal = inode->allocationGoal ? inode->allocationGoal : goalForInode(inode);
 
 	size_t prg = 0;
 	while(prg < num_blocks) {
@@ -1076,25 +1581,19 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 			while(prg < num_blocks
 					&& block_offset + prg < i_range) {
 				auto idx = block_offset + prg;
-				if(disk_inode->data.blocks.direct[idx]) {
-					prg++;
-					continue;
-				}
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->blocks += (blockSize / 512);
-				disk_inode->data.blocks.direct[idx] = block;
-				prg++;
+				prg += co_await assignRun(disk_inode, disk_inode->data.blocks.direct + idx,
+						std::min(num_blocks - prg, i_range - idx), goal);
 			}
 		}else if(block_offset + prg < s_range) {
 			bool needsReset = false;
 
 			// Allocate the single-indirect block itself.
 			if(!disk_inode->data.blocks.singleIndirect) {
-				auto block = co_await allocateBlock();
+				auto block = co_await allocateBlock(goal);
 				assert(block && "Out of disk space"); // TODO: Fix this.
 				disk_inode->blocks += (blockSize / 512);
 				disk_inode->data.blocks.singleIndirect = block;
+				goal = block + 1;
 				needsReset = true;
 			}
 
@@ -1116,23 +1615,17 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 			while(prg < num_blocks
 					&& block_offset + prg < s_range) {
 				auto idx = block_offset + prg - i_range;
-				if(window[idx]) {
-					prg++;
-					continue;
-				}
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->blocks += (blockSize / 512);
-				window[idx] = block;
-				prg++;
+				prg += co_await assignRun(disk_inode, window + idx,
+						std::min(num_blocks - prg, per_single - idx), goal);
 			}
 		}else if(block_offset + prg < d_range) {
 			bool doubleNeedsReset = false;
 			if(!disk_inode->data.blocks.doubleIndirect) {
-				auto block = co_await allocateBlock();
+				auto block = co_await allocateBlock(goal);
 				assert(block && "Out of disk space"); // TODO: Fix this.
 				disk_inode->blocks += (blockSize / 512);
 				disk_inode->data.blocks.doubleIndirect = block;
+				goal = block + 1;
 				doubleNeedsReset = true;
 			}
 
@@ -1159,10 +1652,11 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 				bool needsReset = false;
 				if(!double_window[indirect_frame]) {
 					// Allocate the single indirect block.
-					auto block = co_await allocateBlock();
+					auto block = co_await allocateBlock(goal);
 					assert(block && "Out of disk space"); // TODO: Fix this.
 					disk_inode->blocks += (blockSize / 512);
 					double_window[indirect_frame] = block;
+					goal = block + 1;
 					needsReset = true;
 				}
 
@@ -1181,22 +1675,327 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 				if(needsReset)
 					memset(window, 0, size_t{1} << blockPagesShift);
 
-				if(window[indirect_index]) {
-					prg++;
-					continue;
-				}
-
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->blocks += (blockSize / 512);
-				window[indirect_index] = block;
-				prg++;
+				prg += co_await assignRun(disk_inode, window + indirect_index,
+						std::min(num_blocks - prg, per_indirect - indirect_index), goal);
 			}
 		}else{
 			assert(!"TODO: Implement allocation in triple indirect blocks");
 		}
 	}
+	inode->allocationGoal = goal;
+
+	if(disk_inode->blocks == old_blocks)
+		co_return;
+	auto syncInode = co_await helix_ng::synchronizeSpace(
+			helix::BorrowedDescriptor{kHelNullHandle},
+			inode->diskMapping.get(), inodeSize);
+	HEL_CHECK(syncInode.error());
+}
+
+async::result<ExtentMapping> FileSystem::mapExtent(Inode *inode,
+		uint64_t index, size_t limit) {
+	assert(limit);
+	BlockCache::Ref node;
+
+	// File blocks at or above this boundary are not covered by the current node.
+	uint64_t boundary = UINT64_MAX;
+
+	// Walk down from the root node (which is stored in the inode) to a leaf.
+	auto header = &inode->diskInode()->data.extents.header;
+	while(true) {
+		assert(header->magic == EXT4_EXTENT_MAGIC);
+		if(!header->depth)
+			break;
+
+		// Find the last index that starts at or before the file block.
+		auto indices = reinterpret_cast<DiskExtentIndex *>(header + 1);
+		int k = -1;
+		for(int i = 0; i < header->numEntries; i++) {
+			if(indices[i].fileBlock > index)
+				break;
+			k = i;
+		}
+		if(k < 0) {
+			if(header->numEntries)
+				boundary = std::min(boundary, uint64_t{indices[0].fileBlock});
+			co_return ExtentMapping{0, static_cast<size_t>(std::min(uint64_t{limit},
+					boundary - index)), false};
+		}
+		if(k + 1 < header->numEntries)
+			boundary = std::min(boundary, uint64_t{indices[k + 1].fileBlock});
+
+		node = co_await blockCache->get(indices[k].leaf());
+		header = reinterpret_cast<DiskExtentHeader *>(node.data());
+	}
+
+	auto extents = reinterpret_cast<DiskExtent *>(header + 1);
+	for(int i = 0; i < header->numEntries; i++) {
+		auto &extent = extents[i];
+		if(index < extent.fileBlock) {
+			// The file block is in a hole before this extent.
+			boundary = std::min(boundary, uint64_t{extent.fileBlock});
+			break;
+		}
+		if(index < uint64_t{extent.fileBlock} + extent.numBlocks()) {
+			size_t n = std::min(uint64_t{limit},
+					uint64_t{extent.fileBlock} + extent.numBlocks() - index);
+			if(!extent.isInitialized())
+				co_return ExtentMapping{0, n, true};
+			co_return ExtentMapping{extent.start() + (index - extent.fileBlock), n, false};
+		}
+	}
+
+	co_return ExtentMapping{0, static_cast<size_t>(std::min(uint64_t{limit},
+			boundary - index)), false};
+}
+
+async::result<std::vector<ExtentPathLevel>> FileSystem::findExtentPath(Inode *inode,
+		uint64_t index) {
+	std::vector<ExtentPathLevel> path;
+
+	auto &root = inode->diskInode()->data.extents;
+	path.push_back(ExtentPathLevel{0, {}, &root.header,
+			std::min(int{root.header.maxEntries}, 4)});
+	while(true) {
+		auto header = path.back().header;
+		assert(header->magic == EXT4_EXTENT_MAGIC);
+		if(!header->depth)
+			break;
+		assert(header->numEntries);
+
+		// Follow the last index that starts at or before the file block (or the first index).
+		auto indices = reinterpret_cast<DiskExtentIndex *>(header + 1);
+		int k = 0;
+		while(k + 1 < header->numEntries && indices[k + 1].fileBlock <= index)
+			k++;
+		path.back().pos = k;
+
+		auto node = co_await blockCache->get(indices[k].leaf());
+		std::vector<std::byte> buffer(blockSize);
+		memcpy(buffer.data(), node.data(), blockSize);
+		auto child = reinterpret_cast<DiskExtentHeader *>(buffer.data());
+		int capacity = std::min<size_t>(child->maxEntries,
+				(blockSize - sizeof(DiskExtentHeader)) / sizeof(DiskExtent));
+		path.push_back(ExtentPathLevel{indices[k].leaf(), std::move(buffer), child, capacity});
+	}
+
+	co_return path;
+}
+
+async::result<void> FileSystem::writeExtentPath(Inode *inode,
+		std::vector<ExtentPathLevel> &path) {
+	for(auto &level : path) {
+		if(!level.dirty || !level.block)
+			continue;
+		co_await writeMetadata(level.block, level.buffer.data(), 1);
+		level.dirty = false;
+	}
+
+	if(path.front().dirty) {
+		auto syncInode = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				inode->diskMapping.get(), inodeSize);
+		HEL_CHECK(syncInode.error());
+		path.front().dirty = false;
+	}
+}
+
+async::result<void> FileSystem::insertExtent(Inode *inode, DiskExtent extent) {
+	auto disk_inode = inode->diskInode();
+	auto &root = disk_inode->data.extents;
+
+	while(true) {
+		auto path = co_await findExtentPath(inode, extent.fileBlock);
+		auto &leaf = path.back();
+		auto header = leaf.header;
+		auto extents = reinterpret_cast<DiskExtent *>(header + 1);
+
+		// Find the first extent that starts after the new extent.
+		int pos = 0;
+		while(pos < header->numEntries && extents[pos].fileBlock < extent.fileBlock)
+			pos++;
+
+		auto canMerge = [] (const DiskExtent &left, const DiskExtent &right) {
+			return left.isInitialized() && right.isInitialized()
+					&& left.fileBlock + left.length == right.fileBlock
+					&& left.start() + left.length == right.start()
+					&& left.length + right.length <= DiskExtent::maxInitializedExtent;
+		};
+
+		if(pos > 0 && canMerge(extents[pos - 1], extent)) {
+			// Append to the previous extent.
+			extents[pos - 1].length += extent.length;
+		}else if(pos < header->numEntries && canMerge(extent, extents[pos])) {
+			// Prepend to the following extent.
+			auto &next = extents[pos];
+			next.fileBlock = extent.fileBlock;
+			setExtentStart(next, extent.start());
+			next.length += extent.length;
+		}else if(header->numEntries < leaf.capacity) {
+			memmove(&extents[pos + 1], &extents[pos],
+					(header->numEntries - pos) * sizeof(DiskExtent));
+			extents[pos] = extent;
+			header->numEntries++;
+		}else{
+			// Make room on the path and retry. Find the deepest node that is not full;
+			// split its child (which makes room in the child's level). If all nodes
+			// are full, move the root into a new node such that the tree grows by one level.
+			int l = path.size() - 1;
+			while(l >= 0 && path[l].header->numEntries >= path[l].capacity)
+				l--;
+
+			auto block = co_await allocateBlock(l < 0 ? goalForInode(inode)
+					: static_cast<uint32_t>(path[l + 1].block));
+			assert(block && "Out of disk space"); // TODO: Fix this.
+			disk_inode->blocks += blockSize / 512;
+			path.front().dirty = true;
+
+			std::vector<std::byte> buffer(blockSize);
+			auto node = reinterpret_cast<DiskExtentHeader *>(buffer.data());
+			if(l < 0) {
+				*node = root.header;
+				node->maxEntries = (blockSize - sizeof(DiskExtentHeader)) / sizeof(DiskExtent);
+				memcpy(node + 1, root.entries, root.header.numEntries * sizeof(DiskExtent));
+				co_await writeMetadata(block, buffer.data(), 1);
+
+				auto key = firstKeyOf(&root.header);
+				memset(root.entries, 0, sizeof(root.entries));
+				auto index = reinterpret_cast<DiskExtentIndex *>(root.entries);
+				index->fileBlock = key;
+				index->leafLo = block;
+				root.header.numEntries = 1;
+				root.header.depth++;
+			}else{
+				// Move the upper half of the entries to the new node.
+				auto &full = path[l + 1];
+				auto &parent = path[l];
+				auto entries = reinterpret_cast<std::byte *>(full.header + 1);
+				int keep = full.header->numEntries / 2;
+				int moved = full.header->numEntries - keep;
+
+				*node = *full.header;
+				node->numEntries = moved;
+				memcpy(node + 1, entries + keep * sizeof(DiskExtent), moved * sizeof(DiskExtent));
+				memset(entries + keep * sizeof(DiskExtent), 0, moved * sizeof(DiskExtent));
+				full.header->numEntries = keep;
+				full.dirty = true;
+				co_await writeMetadata(block, buffer.data(), 1);
+
+				auto indices = reinterpret_cast<DiskExtentIndex *>(parent.header + 1);
+				memmove(&indices[parent.pos + 2], &indices[parent.pos + 1],
+						(parent.header->numEntries - parent.pos - 1) * sizeof(DiskExtentIndex));
+				indices[parent.pos + 1] = DiskExtentIndex{firstKeyOf(node), block, 0, 0};
+				parent.header->numEntries++;
+				parent.dirty = true;
+			}
+			co_await writeExtentPath(inode, path);
+			continue;
+		}
+		leaf.dirty = true;
+
+		// Lookups follow the last index that starts at or before a file block;
+		// hence, indices must not start after the first entry of their child.
+		for(size_t l = path.size() - 1; l > 0; l--) {
+			auto &parent = path[l - 1];
+			auto key = firstKeyOf(path[l].header);
+			auto indices = reinterpret_cast<DiskExtentIndex *>(parent.header + 1);
+			if(indices[parent.pos].fileBlock <= key)
+				break;
+			indices[parent.pos].fileBlock = key;
+			parent.dirty = true;
+			if(parent.pos)
+				break;
+		}
+
+		co_await writeExtentPath(inode, path);
+		co_return;
+	}
+}
+
+async::result<size_t> FileSystem::initializeExtentRange(Inode *inode,
+		uint64_t index, size_t count) {
+	auto path = co_await findExtentPath(inode, index);
+	auto &leaf = path.back();
+	auto extents = reinterpret_cast<DiskExtent *>(leaf.header + 1);
+
+	int k = 0;
+	while(k < leaf.header->numEntries
+			&& uint64_t{extents[k].fileBlock} + extents[k].numBlocks() <= index)
+		k++;
+	assert(k < leaf.header->numEntries && extents[k].fileBlock <= index);
+	assert(!extents[k].isInitialized());
+
+	// Split the extent into an uninitialized head, the initialized range
+	// and an uninitialized tail. The initialized range replaces the old extent.
+	auto old = extents[k];
+	uint64_t end = uint64_t{old.fileBlock} + old.numBlocks();
+	count = std::min(uint64_t{count}, end - index);
+	auto start = old.start() + (index - old.fileBlock);
+
+	auto &extent = extents[k];
+	extent.fileBlock = index;
+	extent.length = count;
+	setExtentStart(extent, start);
+	leaf.dirty = true;
+	co_await writeExtentPath(inode, path);
+
+	if(index > old.fileBlock) {
+		DiskExtent head{};
+		head.fileBlock = old.fileBlock;
+		head.length = (index - old.fileBlock) + DiskExtent::maxInitializedExtent;
+		setExtentStart(head, old.start());
+		co_await insertExtent(inode, head);
+	}
+	if(index + count < end) {
+		DiskExtent tail{};
+		tail.fileBlock = index + count;
+		tail.length = (end - index - count) + DiskExtent::maxInitializedExtent;
+		setExtentStart(tail, start + count);
+		co_await insertExtent(inode, tail);
+	}
+	co_return count;
+}
+
+async::result<void> FileSystem::assignExtentBlocks(Inode *inode,
+		uint64_t block_offset, size_t num_blocks) {
+	auto disk_inode = inode->diskInode();
+	auto old_blocks = disk_inode->blocks;
+
+	// Place blocks after the previous block of the file (or in the inode's group).
+	uint32_t goal = inode->allocationGoal ? inode->allocationGoal : goalForInode(inode);
+
+	size_t prg = 0;
+	while(prg < num_blocks) {
+		auto index = block_offset + prg;
+		auto mapping = co_await mapExtent(inode, index, num_blocks - prg);
+		if(mapping.block) {
+			goal = mapping.block + mapping.count;
+			prg += mapping.count;
+			continue;
+		}
+		if(mapping.uninitialized) {
+			// The blocks are already allocated; they are mapped in the next iteration.
+			co_await initializeExtentRange(inode, index, mapping.count);
+			continue;
+		}
+
+		auto [block, count] = co_await allocateBlocks(goal,
+				std::min(mapping.count, size_t{DiskExtent::maxInitializedExtent}));
+		assert(block && "Out of disk space"); // TODO: Fix this.
+		disk_inode->blocks += count * (blockSize / 512);
+		goal = block + count;
+
+		DiskExtent extent{};
+		extent.fileBlock = index;
+		extent.length = count;
+		setExtentStart(extent, block);
+		co_await insertExtent(inode, extent);
+		prg += count;
+	}
+	inode->allocationGoal = goal;
 
+	if(disk_inode->blocks == old_blocks)
+		co_return;
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			inode->diskMapping.get(), inodeSize);
@@ -1206,7 +2005,8 @@ async::result<void> FileSystem::assignDataBlocks(Inode *inode,
 async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 		uint64_t offset, size_t num_blocks, void *buffer) {
 	// We perform "block-fusion" here i.e. we try to read/write multiple
-	// consecutive blocks in a single read/writeSectors() operation.
+	// consecutive blocks in a single BlockRequest. All requests are submitted
+	// together such that the device can process them concurrently.
 	auto fuse = [] (size_t remaining, uint32_t *list, size_t limit) {
 		size_t n = 1;
 		while(n < remaining && n < limit) {
@@ -1229,13 +2029,34 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not read past the EOF.
 
+	if(inode->usesExtents()) {
+		std::vector<BlockRequest> requests;
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto mapping = co_await mapExtent(inode.get(), offset + progress,
+					num_blocks - progress);
+			if(mapping.block) {
+				requests.push_back(BlockRequest{BlockOp::read, 0, mapping.block * sectorsPerBlock,
+						{BlockSegment{(uint8_t *)buffer + progress * blockSize,
+							mapping.count * sectorsPerBlock}}});
+			}else{
+				memset((uint8_t *)buffer + progress * blockSize, 0, mapping.count * blockSize);
+			}
+			progress += mapping.count;
+		}
+
+		co_await device->submitMany(requests);
+		co_return;
+	}
+
 	constexpr size_t indirectBufferSize = 8;
 
 	std::array<uint32_t, indirectBufferSize> indirectBuffer;
 
+	std::vector<BlockRequest> requests;
 	size_t progress = 0;
 	while(progress < num_blocks) {
-		// Block number and block count of the readSectors() command that we will issue here.
+		// Block number and block count of the read request that we will issue here.
 		std::pair<size_t, size_t> issue;
 
 		auto index = offset + progress;
@@ -1312,14 +2133,16 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 //				<< " blocks, starting at " << issue.first << std::endl;
 
 		if (issue.first) {
-			co_await device->readSectors(issue.first * sectorsPerBlock,
-					(uint8_t *)buffer + progress * blockSize,
-					issue.second * sectorsPerBlock);
+			requests.push_back(BlockRequest{BlockOp::read, 0, issue.first * sectorsPerBlock,
+					{BlockSegment{(uint8_t *)buffer + progress * blockSize,
+						issue.second * sectorsPerBlock}}});
 		} else {
 			memset((uint8_t *)buffer + progress * blockSize, 0, issue.second * blockSize);
 		}
 		progress += issue.second;
 	}
+
+	co_await device->submitMany(requests);
 }
 
 // TODO: There is a lot of overlap between this method and readDataBlocks.
@@ -1327,7 +2150,8 @@ async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
 async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 		uint64_t offset, size_t num_blocks, const void *buffer) {
 	// We perform "block-fusion" here i.e. we try to read/write multiple
-	// consecutive blocks in a single read/writeSectors() operation.
+	// consecutive blocks in a single BlockRequest. All requests are submitted
+	// together such that the device can process them concurrently.
 	auto fuse = [] (size_t index, size_t remaining, uint32_t *list, size_t limit) {
 		size_t n = 1;
 		while(n < remaining && index + n < limit) {
@@ -1350,9 +2174,27 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 	co_await inode->readyJump.wait();
 	// TODO: Assert that we do not write past the EOF.
 
+	if(inode->usesExtents()) {
+		std::vector<BlockRequest> requests;
+		size_t progress = 0;
+		while(progress < num_blocks) {
+			auto mapping = co_await mapExtent(inode.get(), offset + progress,
+					num_blocks - progress);
+			assert(mapping.block);
+			requests.push_back(BlockRequest{BlockOp::write, 0, mapping.block * sectorsPerBlock,
+					{BlockSegment{const_cast<uint8_t *>((const uint8_t *)buffer
+							+ progress * blockSize), mapping.count * sectorsPerBlock}}});
+			progress += mapping.count;
+		}
+
+		co_await submitDataWrites(inode.get(), requests);
+		co_return;
+	}
+
+	std::vector<BlockRequest> requests;
 	size_t progress = 0;
 	while(progress < num_blocks) {
-		// Block number and block count of the writeSectors() command that we will issue here.
+		// Block number and block count of the write request that we will issue here.
 		std::pair<size_t, size_t> issue;
 
 		auto index = offset + progress;
@@ -1404,18 +2246,44 @@ async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
 //				<< " blocks, starting at " << issue.first << std::endl;
 
 		assert(issue.first);
-		co_await device->writeSectors(issue.first * sectorsPerBlock,
-				(const uint8_t *)buffer + progress * blockSize,
-				issue.second * sectorsPerBlock);
+		requests.push_back(BlockRequest{BlockOp::write, 0, issue.first * sectorsPerBlock,
+				{BlockSegment{const_cast<uint8_t *>((const uint8_t *)buffer + progress * blockSize),
+					issue.second * sectorsPerBlock}}});
 		progress += issue.second;
 	}
+
+	co_await submitDataWrites(inode.get(), requests);
+}
+
+async::result<void> FileSystem::submitDataWrites(Inode *inode,
+		std::span<BlockRequest> requests) {
+	for(auto &request : requests)
+		blockCache->invalidate(request.sector / sectorsPerBlock,
+				request.numSectors() / sectorsPerBlock);
+
+	// Directories are metadata; they are written through the journal.
+	if(!journal || inode->fileType != kTypeDirectory) {
+		co_await device->submitMany(requests);
+		co_return;
+	}
+
+	for(auto &request : requests) {
+		assert(request.segments.size() == 1);
+		co_await journal->logBlocks(request.sector / sectorsPerBlock, request.segments[0].buffer,
+				request.segments[0].numSectors / sectorsPerBlock);
+	}
 }
 
 
 async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
+	auto old_size = inode->fileSize();
+	inode->invalidateReadahead(0, SIZE_MAX);
 	HEL_CHECK(helResizeMemory(inode->backingMemory,
 			(size + 0xFFF) & ~size_t(0xFFF)));
 	inode->setFileSize(size);
+	if(size < old_size)
+		co_await releaseDataBlocks(inode, (size + blockSize - 1) >> blockShift,
+				(old_size + blockSize - 1) >> blockShift);
 	auto syncInode = co_await helix_ng::synchronizeSpace(
 			helix::BorrowedDescriptor{kHelNullHandle},
 			inode->diskMapping.get(), inodeSize);
@@ -1423,10 +2291,460 @@ async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
 	co_return;
 }
 
+async::result<void> FileSystem::releaseDataBlocks(Inode *inode, uint64_t begin, uint64_t end) {
+	auto disk_inode = inode->diskInode();
+
+	// Runs of consecutive blocks that are freed.
+	std::vector<std::pair<uint64_t, size_t>> runs;
+	size_t freed = 0;
+	auto addRun = [&] (uint64_t block, size_t count) {
+		if(!runs.empty() && runs.back().first + runs.back().second == block) {
+			runs.back().second += count;
+		}else{
+			runs.push_back({block, count});
+		}
+		freed += count;
+	};
+	auto releaseSlots = [&] (uint32_t *slots, size_t n) {
+		for(size_t i = 0; i < n; i++) {
+			if(!slots[i])
+				continue;
+			addRun(slots[i], 1);
+			slots[i] = 0;
+		}
+	};
+
+	if(inode->usesExtents()) {
+		auto &root = disk_inode->data.extents;
+		co_await truncateExtentNode(&root.header, begin, addRun);
+		// An empty tree is a leaf.
+		if(!root.header.numEntries)
+			root.header.depth = 0;
+	}else{
+		size_t per_indirect = blockSize / 4;
+		uint64_t i_range = 12;
+		uint64_t s_range = i_range + per_indirect;
+		uint64_t d_range = s_range + per_indirect * per_indirect;
+
+		// The indirect blocks themselves are kept, since they are cached in
+		// indirectOrder1 and indirectOrder2. Their pointers are synced before the
+		// data blocks are discarded.
+		auto syncWindow = [&] (helix::Mapping &map) -> async::result<void> {
+			auto syncIndirect = co_await helix_ng::synchronizeSpace(
+					helix::BorrowedDescriptor{kHelNullHandle}, map.get(), map.size());
+			HEL_CHECK(syncIndirect.error());
+		};
+
+		if(begin < i_range)
+			releaseSlots(disk_inode->data.blocks.direct + begin, std::min(end, i_range) - begin);
+
+		if(begin < s_range && end > i_range && disk_inode->data.blocks.singleIndirect) {
+			auto from = std::max(begin, i_range);
+			auto to = std::min(end, s_range);
+
+			helix::LockMemoryView lock_indirect;
+			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder1,
+					&lock_indirect, 0, 1 << blockPagesShift,
+					helix::Dispatcher::global());
+			co_await submit.async_wait();
+			HEL_CHECK(lock_indirect.error());
+
+			helix::Mapping indirect_map{inode->indirectOrder1,
+					0, size_t{1} << blockPagesShift,
+					kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+			releaseSlots(reinterpret_cast<uint32_t *>(indirect_map.get()) + (from - i_range),
+					to - from);
+			co_await syncWindow(indirect_map);
+		}
+
+		if(begin < d_range && end > s_range && disk_inode->data.blocks.doubleIndirect) {
+			auto from = std::max(begin, s_range);
+			auto to = std::min(end, d_range);
+
+			helix::LockMemoryView lock_double_indirect;
+			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder1,
+					&lock_double_indirect, 1 << blockPagesShift, 1 << blockPagesShift,
+					helix::Dispatcher::global());
+			co_await submit.async_wait();
+			HEL_CHECK(lock_double_indirect.error());
+
+			helix::Mapping double_indirect_map{inode->indirectOrder1,
+					1 << blockPagesShift, size_t{1} << blockPagesShift,
+					kHelMapProtRead | kHelMapDontRequireBacking};
+			auto double_window = reinterpret_cast<uint32_t *>(double_indirect_map.get());
+
+			while(from < to) {
+				int64_t indirect_frame = (from - s_range) >> (blockShift - 2);
+				int64_t indirect_index = (from - s_range) & ((1 << (blockShift - 2)) - 1);
+				auto n = std::min(to - from, per_indirect - indirect_index);
+				if(!double_window[indirect_frame]) {
+					from += n;
+					continue;
+				}
+
+				helix::LockMemoryView lock_indirect;
+				auto &&submit = helix::submitLockMemoryView(inode->indirectOrder2,
+						&lock_indirect, indirect_frame << blockPagesShift, 1 << blockPagesShift,
+						helix::Dispatcher::global());
+				co_await submit.async_wait();
+				HEL_CHECK(lock_indirect.error());
+
+				helix::Mapping indirect_map{inode->indirectOrder2,
+						indirect_frame << blockPagesShift, size_t{1} << blockPagesShift,
+						kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+				releaseSlots(reinterpret_cast<uint32_t *>(indirect_map.get()) + indirect_index, n);
+				co_await syncWindow(indirect_map);
+				from += n;
+			}
+		}
+
+		// Triple indirect blocks are not cached in the indirectOrder* memories;
+		// they are accessed through the block cache instead (and freed as well).
+		if(end > d_range && disk_inode->data.blocks.tripleIndirect) {
+			auto from = std::max(begin, d_range);
+			co_await truncateIndirectBlock(disk_inode->data.blocks.tripleIndirect, 3,
+					from - d_range, addRun);
+			if(from == d_range) {
+				addRun(disk_inode->data.blocks.tripleIndirect, 1);
+				disk_inode->data.blocks.tripleIndirect = 0;
+			}
+		}
+	}
+
+	disk_inode->blocks -= freed * (blockSize / 512);
+	for(auto [block, count] : runs)
+		freeBlocks(block, count);
+}
+
+async::result<void> FileSystem::truncateExtentNode(DiskExtentHeader *header, uint64_t begin,
+		const std::function<void(uint64_t, size_t)> &release) {
+	assert(header->magic == EXT4_EXTENT_MAGIC);
+
+	int kept = 0;
+	if(!header->depth) {
+		auto extents = reinterpret_cast<DiskExtent *>(header + 1);
+		for(int i = 0; i < header->numEntries; i++) {
+			auto extent = extents[i];
+			auto count = extent.numBlocks();
+			if(extent.fileBlock + count <= begin) {
+				extents[kept++] = extent;
+				continue;
+			}
+
+			uint32_t keep = (extent.fileBlock < begin) ? begin - extent.fileBlock : 0;
+			release(extent.start() + keep, count - keep);
+			if(keep) {
+				extent.length = extent.isInitialized() ? keep
+						: keep + DiskExtent::maxInitializedExtent;
+				extents[kept++] = extent;
+			}
+		}
+	}else{
+		auto indices = reinterpret_cast<DiskExtentIndex *>(header + 1);
+		for(int i = 0; i < header->numEntries; i++) {
+			auto index = indices[i];
+			// Children that end before begin are not affected.
+			if(i + 1 < header->numEntries && indices[i + 1].fileBlock <= begin) {
+				indices[kept++] = index;
+				continue;
+			}
+
+			std::vector<std::byte> buffer(blockSize);
+			{
+				auto node = co_await blockCache->get(index.leaf());
+				memcpy(buffer.data(), node.data(), blockSize);
+			}
+			auto child = reinterpret_cast<DiskExtentHeader *>(buffer.data());
+			co_await truncateExtentNode(child, begin, release);
+			if(!child->numEntries) {
+				release(index.leaf(), 1);
+				continue;
+			}
+			co_await writeMetadata(index.leaf(), buffer.data(), 1);
+			indices[kept++] = index;
+		}
+	}
+	header->numEntries = kept;
+}
+
+async::result<void> FileSystem::truncateIndirectBlock(uint32_t block, int level,
+		uint64_t begin, const std::function<void(uint64_t, size_t)> &release) {
+	std::vector<std::byte> buffer(blockSize);
+	{
+		auto ref = co_await blockCache->get(block);
+		memcpy(buffer.data(), ref.data(), blockSize);
+	}
+	auto slots = reinterpret_cast<uint32_t *>(buffer.data());
+
+	// Number of file blocks that are mapped through each slot.
+	uint64_t per_slot = uint64_t{1} << ((blockShift - 2) * (level - 1));
+	bool changed = false;
+	for(size_t i = begin / per_slot; i < blockSize / 4; i++) {
+		if(!slots[i])
+			continue;
+		if(level > 1) {
+			uint64_t first = i * per_slot;
+			uint64_t child_begin = begin > first ? begin - first : 0;
+			co_await truncateIndirectBlock(slots[i], level - 1, child_begin, release);
+			// The child still maps blocks before begin.
+			if(child_begin)
+				continue;
+		}
+		release(slots[i], 1);
+		slots[i] = 0;
+		changed = true;
+	}
+
+	// If begin is zero, the caller frees the block anyway.
+	if(changed && begin)
+		co_await writeMetadata(block, buffer.data(), 1);
+}
+
+void FileSystem::freeBlocks(uint64_t block, size_t count) {
+	// Merge the range with adjacent pending ranges.
+	auto it = pendingDiscards.emplace(block, count).first;
+	if(auto next = std::next(it); next != pendingDiscards.end()
+			&& it->first + it->second == next->first) {
+		it->second += next->second;
+		pendingDiscards.erase(next);
+	}
+	if(it != pendingDiscards.begin()) {
+		auto prev = std::prev(it);
+		if(prev->first + prev->second == it->first) {
+			prev->second += it->second;
+			pendingDiscards.erase(it);
+		}
+	}
+	discardDoorbell.raise();
+}
+
+async::detached FileSystem::flushDiscards() {
+	while(true) {
+		if(pendingDiscards.empty()) {
+			co_await discardDoorbell.async_wait();
+			continue;
+		}
+
+		co_await helix::sleepFor(discardDelay);
+
+		auto ranges = std::move(pendingDiscards);
+		pendingDiscards.clear();
+
+		// Freed metadata blocks might still be logged; make sure that the journal
+		// does not write them back once they are reused.
+		if(journal) {
+			for(auto [block, count] : ranges)
+				co_await journal->forgetBlocks(block, count);
+		}
+
+		// Devices that do not support discards complete these requests immediately.
+		std::vector<BlockRequest> requests;
+		for(auto [block, count] : ranges)
+			requests.push_back(BlockRequest{BlockOp::discard, 0, block * sectorsPerBlock,
+					{BlockSegment{nullptr, count * sectorsPerBlock}}});
+		co_await device->submitMany(requests);
+
+		// Only now the blocks can be reused (otherwise, new data could be discarded).
+		for(auto [block, count] : ranges)
+			co_await releaseBlocks(block, count);
+	}
+}
+
+async::result<void> FileSystem::releaseBlocks(uint64_t block, size_t count) {
+	while(count) {
+		uint32_t bg_idx = block / blocksPerGroup;
+		uint32_t bit = block % blocksPerGroup;
+		auto n = std::min(count, size_t{blocksPerGroup - bit});
+
+		helix::LockMemoryView lock_bitmap;
+		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
+				&lock_bitmap,
+				bg_idx << blockPagesShift, 1 << blockPagesShift,
+				helix::Dispatcher::global());
+		co_await submit_bitmap.async_wait();
+		HEL_CHECK(lock_bitmap.error());
+
+		helix::Mapping bitmap_map{blockBitmap,
+				bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+
+		// Blocks that are already free indicate a corrupted file system (e.g., a block that
+		// is referenced twice). We do not count them again but keep going.
+		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
+		size_t released = 0;
+		for(size_t i = 0; i < n; i++) {
+			auto &word = words[(bit + i) / 32];
+			auto mask = static_cast<uint32_t>(1) << ((bit + i) % 32);
+			if(!(word & mask))
+				continue;
+			word &= ~mask;
+			released++;
+		}
+		if(released != n)
+			std::cout << "\e[33m" "ext2fs: Releasing " << (n - released)
+					<< " blocks that are already free (block group " << bg_idx
+					<< ", first block " << block << ")" "\e[39m" << std::endl;
+
+		auto &summary = groupSummaries[bg_idx];
+		summary.firstFreeBlock = std::min(summary.firstFreeBlock, bit);
+		groupDesc(bg_idx).freeBlocksCount += released;
+		freeBlocksTotal += released;
+		markBgdtDirty();
+
+		blockCache->invalidate(block, n);
+		block += n;
+		count -= n;
+	}
+}
+
+void FileSystem::markBgdtDirty() {
+	bgdtDirty = true;
+	bgdtDoorbell.raise();
+}
+
+async::detached FileSystem::flushBgdt() {
+	while(true) {
+		if(!bgdtDirty) {
+			co_await bgdtDoorbell.async_wait();
+			continue;
+		}
+
+		co_await helix::sleepFor(bgdtWritebackDelay);
+		bgdtDirty = false;
+		co_await writebackBgdt();
+	}
+}
+
 async::result<void> FileSystem::writebackBgdt() {
 	auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
-	co_await device->writeSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
-			blockGroupDescriptorBuffer.data(), blockGroupDescriptorBuffer.size() / 512);
+	co_await writeMetadata(bgdt_offset >> blockShift, blockGroupDescriptorBuffer.data(),
+			blockGroupDescriptorBuffer.size() >> blockShift);
+}
+
+async::result<void> FileSystem::writeMetadata(uint64_t block, const void *buffer,
+		size_t num_blocks) {
+	blockCache->update(block, buffer, num_blocks);
+	if(journal) {
+		co_await journal->logBlocks(block, buffer, num_blocks);
+	}else{
+		co_await device->writeSectors(block * sectorsPerBlock, buffer,
+				num_blocks * sectorsPerBlock);
+	}
+}
+
+async::result<void> FileSystem::initJournal(const DiskSuperblock &sb) {
+	// Read the journal inode directly from disk: its page in the inode table
+	// could be changed by the recovery.
+	if(!sb.journalInum || sb.journalInum > inodesCount) {
+		std::cout << "\e[31m" "ext2fs: Invalid journal inode" "\e[39m" << std::endl;
+		co_return;
+	}
+	auto bg_idx = (sb.journalInum - 1) / inodesPerGroup;
+	uint64_t table_offset = uint64_t{(sb.journalInum - 1) % inodesPerGroup} * inodeSize;
+	std::vector<std::byte> buffer(512);
+	co_await device->readSectors(groupDesc(bg_idx).inodeTable * sectorsPerBlock
+			+ table_offset / 512, buffer.data(), 1);
+	DiskInode disk_inode;
+	memcpy(&disk_inode, buffer.data() + table_offset % 512, sizeof(DiskInode));
+
+	std::vector<uint64_t> blocks;
+	size_t num_blocks = disk_inode.size >> blockShift;
+	if(disk_inode.flags & EXT4_EXTENTS_FL) {
+		co_await collectExtentBlocks(&disk_inode.data.extents.header, blocks, num_blocks);
+	}else{
+		for(int i = 0; i < 12 && blocks.size() < num_blocks; i++)
+			blocks.push_back(disk_inode.data.blocks.direct[i]);
+		co_await collectIndirectBlocks(disk_inode.data.blocks.singleIndirect, 1,
+				blocks, num_blocks);
+		co_await collectIndirectBlocks(disk_inode.data.blocks.doubleIndirect, 2,
+				blocks, num_blocks);
+		co_await collectIndirectBlocks(disk_inode.data.blocks.tripleIndirect, 3,
+				blocks, num_blocks);
+	}
+	if(blocks.size() < num_blocks
+			|| std::find(blocks.begin(), blocks.end(), 0) != blocks.end()) {
+		std::cout << "\e[31m" "ext2fs: Journal inode has holes" "\e[39m" << std::endl;
+		co_return;
+	}
+
+	auto new_journal = std::make_unique<Journal>(device, blockSize, std::move(blocks),
+			[this] (bool needs_recovery) {
+		return setNeedsRecovery(needs_recovery);
+	});
+	if(!(co_await new_journal->init()))
+		co_return;
+
+	// The journal is empty after init() (committed transactions were replayed).
+	co_await setNeedsRecovery(false);
+
+	journal = std::move(new_journal);
+	device = journal.get();
+}
+
+async::result<void> FileSystem::setNeedsRecovery(bool needs_recovery) {
+	// The superblock is never logged, hence it is not affected by the journal.
+	std::vector<std::byte> sb_buffer(1024);
+	co_await device->readSectors(2, sb_buffer.data(), 2);
+	auto disk_sb = reinterpret_cast<DiskSuperblock *>(sb_buffer.data());
+	if(static_cast<bool>(disk_sb->featureIncompat & EXT3_FEATURE_INCOMPAT_RECOVER)
+			== needs_recovery)
+		co_return;
+	if(needs_recovery) {
+		disk_sb->featureIncompat |= EXT3_FEATURE_INCOMPAT_RECOVER;
+	}else{
+		disk_sb->featureIncompat &= ~uint32_t{EXT3_FEATURE_INCOMPAT_RECOVER};
+	}
+	co_await device->writeSectors(2, sb_buffer.data(), 2);
+}
+
+async::result<void> FileSystem::collectIndirectBlocks(uint32_t block, int level,
+		std::vector<uint64_t> &blocks, size_t limit) {
+	if(blocks.size() >= limit)
+		co_return;
+	if(!block) {
+		// Leave holes such that the caller can detect them.
+		blocks.push_back(0);
+		co_return;
+	}
+
+	std::vector<uint32_t> entries(blockSize / 4);
+	co_await device->readSectors(block * sectorsPerBlock, entries.data(), sectorsPerBlock);
+	for(auto entry : entries) {
+		if(blocks.size() >= limit)
+			break;
+		if(level == 1) {
+			blocks.push_back(entry);
+		}else{
+			co_await collectIndirectBlocks(entry, level - 1, blocks, limit);
+		}
+	}
+}
+
+async::result<void> FileSystem::collectExtentBlocks(const DiskExtentHeader *header,
+		std::vector<uint64_t> &blocks, size_t limit) {
+	if(header->magic != EXT4_EXTENT_MAGIC)
+		co_return;
+
+	if(!header->depth) {
+		auto extents = reinterpret_cast<const DiskExtent *>(header + 1);
+		for(int i = 0; i < header->numEntries && blocks.size() < limit; i++) {
+			// Fill holes with zeros such that the caller can detect them.
+			while(blocks.size() < std::min(size_t{extents[i].fileBlock}, limit))
+				blocks.push_back(0);
+			for(uint32_t k = 0; k < extents[i].numBlocks() && blocks.size() < limit; k++)
+				blocks.push_back(extents[i].isInitialized() ? extents[i].start() + k : 0);
+		}
+		co_return;
+	}
+
+	auto indices = reinterpret_cast<const DiskExtentIndex *>(header + 1);
+	std::vector<std::byte> node(blockSize);
+	for(int i = 0; i < header->numEntries && blocks.size() < limit; i++) {
+		co_await device->readSectors(indices[i].leaf() * sectorsPerBlock,
+				node.data(), sectorsPerBlock);
+		co_await collectExtentBlocks(reinterpret_cast<DiskExtentHeader *>(node.data()),
+				blocks, limit);
+	}
 }
 
 // --------------------------------------------------------
@@ -1480,5 +2798,51 @@ OpenFile::readEntries() {
 	co_return std::nullopt;
 }
 
+async::result<protocols::fs::ReadResult>
+OpenFile::readDirents(void *buffer, size_t length) {
+	co_await inode->readyJump.wait();
+
+	if(inode->fileType != kTypeDirectory)
+		co_return protocols::fs::Error::notDirectory;
+
+	if(offset >= inode->fileSize())
+		co_return size_t{0};
+
+	auto map_size = (inode->fileSize() + 0xFFF) & ~size_t(0xFFF);
+
+	helix::LockMemoryView lock_memory;
+	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(inode->frontalMemory),
+			&lock_memory, 0, map_size, helix::Dispatcher::global());
+	co_await submit.async_wait();
+	HEL_CHECK(lock_memory.error());
+
+	helix::Mapping file_map{helix::BorrowedDescriptor{inode->frontalMemory},
+			0, map_size,
+			kHelMapProtRead | kHelMapDontRequireBacking};
+
+	// Unlike readEntries(), return all entries of the directory blocks that fit into the buffer.
+	protocols::fs::DirentBuilder builder{buffer, length};
+	while(offset < inode->fileSize()) {
+		assert(!(offset & 3));
+		assert(offset + sizeof(DiskDirEntry) <= inode->fileSize());
+		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
+				reinterpret_cast<char *>(file_map.get()) + offset);
+		assert(offset + disk_entry->recordLength <= inode->fileSize());
+
+		if(disk_entry->inode) {
+			if(!builder.append(disk_entry->inode, offset + disk_entry->recordLength,
+					direntTypeFromDisk(disk_entry->fileType),
+					{disk_entry->name, disk_entry->nameLength}))
+				break;
+		}
+		offset += disk_entry->recordLength;
+	}
+
+	// Not even a single entry fits into the buffer.
+	if(!builder.size() && offset < inode->fileSize())
+		co_return protocols::fs::Error::illegalArguments;
+	co_return builder.size();
+}
+
 } } // namespace blockfs::ext2fs
 
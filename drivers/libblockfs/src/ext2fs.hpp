@@ -1,7 +1,10 @@
 
 #include <string.h>
 #include <time.h>
+#include <deque>
+#include <functional>
 #include <optional>
+#include <map>
 #include <memory>
 #include <optional>
 #include <unordered_map>
@@ -12,9 +15,12 @@
 #include <async/oneshot-event.hpp>
 #include <async/recurring-event.hpp>
 #include <hel.h>
+#include <helix/ipc.hpp>
 
 #include <blockfs.hpp>
+#include "block-cache.hpp"
 #include "common.hpp"
+#include "journal.hpp"
 #include "fs.bragi.hpp"
 
 namespace blockfs {
@@ -27,6 +33,56 @@ namespace ext2fs {
 using FlockManager = protocols::fs::FlockManager;
 using Flock = protocols::fs::Flock;
 
+// ext4 extent trees. Each node starts with a header; leaves (depth zero) contain extents
+// while inner nodes contain indices. The root node is stored in the inode.
+struct DiskExtentHeader {
+	uint16_t magic;
+	uint16_t numEntries;
+	uint16_t maxEntries;
+	uint16_t depth;
+	uint32_t generation;
+};
+static_assert(sizeof(DiskExtentHeader) == 12, "Bad DiskExtentHeader struct size");
+
+struct DiskExtent {
+	uint32_t fileBlock;
+	// Lengths above maxInitializedExtent denote uninitialized extents (that read as zeros).
+	uint16_t length;
+	uint16_t startHi;
+	uint32_t startLo;
+
+	uint64_t start() const {
+		return (static_cast<uint64_t>(startHi) << 32) | startLo;
+	}
+
+	uint32_t numBlocks() const {
+		return length > maxInitializedExtent ? length - maxInitializedExtent : length;
+	}
+
+	bool isInitialized() const {
+		return length <= maxInitializedExtent;
+	}
+
+	static constexpr uint16_t maxInitializedExtent = 32768;
+};
+static_assert(sizeof(DiskExtent) == 12, "Bad DiskExtent struct size");
+
+struct DiskExtentIndex {
+	uint32_t fileBlock;
+	uint32_t leafLo;
+	uint16_t leafHi;
+	uint16_t unused;
+
+	uint64_t leaf() const {
+		return (static_cast<uint64_t>(leafHi) << 32) | leafLo;
+	}
+};
+static_assert(sizeof(DiskExtentIndex) == 12, "Bad DiskExtentIndex struct size");
+
+enum {
+	EXT4_EXTENT_MAGIC = 0xF30A
+};
+
 union FileData {
 	struct Blocks {
 		uint32_t direct[12];
@@ -35,7 +91,13 @@ union FileData {
 		uint32_t tripleIndirect;
 	};
 
+	struct Extents {
+		DiskExtentHeader header;
+		DiskExtent entries[4];
+	};
+
 	Blocks blocks;
+	Extents extents;
 	uint8_t embedded[60];
 };
 static_assert(sizeof(FileData) == 60, "Bad FileData struct size");
@@ -89,11 +151,15 @@ struct DiskSuperblock {
 	//-- Directory Indexing Support --
 	uint32_t hashSeed[4];
 	uint8_t defHashVersion;
-	uint8_t padding[3];
+	uint8_t jnlBackupType;
+	// Size of group descriptors if EXT4_FEATURE_INCOMPAT_64BIT is set.
+	uint16_t descSize;
 	//-- Other options --
 	uint32_t defaultMountOptions;
 	uint32_t firstMetaBg;
-	uint8_t unused[760];
+	uint8_t unused0[88];
+	uint32_t flags;
+	uint8_t unused[668];
 };
 static_assert(sizeof(DiskSuperblock) == 1024, "Bad DiskSuperblock struct size");
 
@@ -104,11 +170,39 @@ struct DiskGroupDesc {
 	uint16_t freeBlocksCount;
 	uint16_t freeInodesCount;
 	uint16_t usedDirsCount;
-	uint16_t pad;
+	uint16_t flags;
 	uint8_t reserved[12];
 };
 static_assert(sizeof(DiskGroupDesc) == 32, "Bad DiskGroupDesc struct size");
 
+enum {
+	// Bits of DiskGroupDesc::flags.
+	EXT4_BG_INODE_UNINIT = 1,
+	EXT4_BG_BLOCK_UNINIT = 2
+};
+
+enum {
+	// Bits of DiskSuperblock::featureCompat.
+	EXT3_FEATURE_COMPAT_HAS_JOURNAL = 0x4,
+	EXT2_FEATURE_COMPAT_DIR_INDEX = 0x20,
+
+	// Bits of DiskSuperblock::featureIncompat.
+	EXT2_FEATURE_INCOMPAT_FILETYPE = 0x2,
+	EXT3_FEATURE_INCOMPAT_RECOVER = 0x4,
+	EXT3_FEATURE_INCOMPAT_JOURNAL_DEV = 0x8,
+	EXT4_FEATURE_INCOMPAT_EXTENTS = 0x40,
+	EXT4_FEATURE_INCOMPAT_64BIT = 0x80,
+	EXT4_FEATURE_INCOMPAT_FLEX_BG = 0x200,
+
+	// Bits of DiskSuperblock::featureRoCompat.
+	EXT4_FEATURE_RO_COMPAT_METADATA_CSUM = 0x400
+};
+
+enum {
+	// Bits of DiskSuperblock::flags.
+	EXT2_FLAGS_UNSIGNED_HASH = 0x2
+};
+
 struct DiskInode {
 	uint16_t mode;
 	uint16_t uid;
@@ -135,6 +229,12 @@ enum {
 	EXT2_ROOT_INO = 2
 };
 
+enum {
+	// Bits of DiskInode::flags.
+	EXT2_INDEX_FL = 0x1000,
+	EXT4_EXTENTS_FL = 0x80000
+};
+
 enum {
 	EXT2_S_IFMT = 0xF000,
 	EXT2_S_IFLNK = 0xA000,
@@ -150,6 +250,32 @@ struct DiskDirEntry {
 	char name[];
 };
 
+// Block 0 of a hashed (htree) directory contains the entries for "." and ".."
+// (the latter spanning the rest of the block), followed by this struct.
+struct DiskDxRootInfo {
+	uint32_t reservedZero;
+	uint8_t hashVersion;
+	uint8_t infoLength;
+	uint8_t indirectLevels;
+	uint8_t unusedFlags;
+};
+static_assert(sizeof(DiskDxRootInfo) == 8, "Bad DiskDxRootInfo struct size");
+
+// Index entries follow the root info (in block 0) or an empty directory entry
+// spanning the whole block (in interior index blocks). The first entry has an implicit
+// hash of zero; its hash field stores the count and limit of the entries instead.
+struct DiskDxEntry {
+	uint32_t hash;
+	uint32_t block;
+};
+static_assert(sizeof(DiskDxEntry) == 8, "Bad DiskDxEntry struct size");
+
+struct DiskDxCountLimit {
+	uint16_t limit;
+	uint16_t count;
+};
+static_assert(sizeof(DiskDxCountLimit) == 4, "Bad DiskDxCountLimit struct size");
+
 enum {
 	EXT2_FT_REG_FILE = 1,
 	EXT2_FT_DIR = 2,
@@ -183,6 +309,21 @@ struct Inode : std::enable_shared_from_this<Inode> {
 		return diskInode()->size;
 	}
 
+	// Returns true if the file data is mapped by an extent tree instead of block lists.
+	bool usesExtents() {
+		return diskInode()->flags & EXT4_EXTENTS_FL;
+	}
+
+	// Returns true if this is a hashed (htree) directory.
+	bool isIndexed() {
+		return diskInode()->flags & EXT2_INDEX_FL;
+	}
+
+	DiskDirEntry *dirEntryAt(uintptr_t offset) {
+		return reinterpret_cast<DiskDirEntry *>(
+				reinterpret_cast<char *>(fileMapping.get()) + offset);
+	}
+
 	void setFileSize(uint64_t size);
 
 	async::result<frg::expected<protocols::fs::Error, std::optional<DirEntry>>>
@@ -195,6 +336,34 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	async::result<protocols::fs::Error> chmod(int mode);
 	async::result<protocols::fs::Error> utimensat(uint64_t atime_sec, uint64_t atime_nsec, uint64_t mtime_sec, uint64_t mtime_nsec);
 
+	// Locks the pages of the file that contain the given range into memory.
+	async::result<helix::UniqueDescriptor> lockRange(uintptr_t offset, size_t size);
+
+	struct EntryLocation {
+		uintptr_t offset;
+		// Offset of the preceding entry in the same block (if any).
+		std::optional<uintptr_t> previous;
+	};
+
+	// Searches [begin, end) of the (locked) directory for an entry with the given name.
+	std::optional<EntryLocation> locateEntry(const std::string &name,
+			uintptr_t begin, uintptr_t end);
+
+	// Walks the htree index of the directory. Returns the leaf blocks that can contain
+	// the name, or std::nullopt if the directory is not indexed (or the index is unusable).
+	async::result<std::optional<std::vector<uint64_t>>> probeHtree(const std::string &name);
+
+	// Clears EXT2_INDEX_FL. This is done before a directory is modified in a way that
+	// does not maintain its index; the directory is then read linearly (also by other
+	// ext2 implementations).
+	async::result<void> dropIndex();
+
+	// Fills entryCache from the (locked) directory.
+	void buildEntryCache();
+
+	// Drops readahead buffers that overlap the range (as the disk contents changed).
+	void invalidateReadahead(uint64_t offset, size_t length);
+
 	FileSystem &fs;
 
 	// ext2fs on-disk inode number
@@ -233,14 +402,72 @@ struct Inode : std::enable_shared_from_this<Inode> {
 
 	int uid, gid;
 	FlockManager flockManager;
+	protocols::fs::RangeLockManager rangeLockManager;
 
 	std::unordered_set<std::string> obstructedLinks;
+
+	// Number of findEntry() calls on this directory.
+	unsigned int lookupCount = 0;
+	// Complete map from names to entries. Only built for frequently accessed directories.
+	std::optional<std::unordered_map<std::string, DirEntry>> entryCache;
+
+	// Block after the most recently allocated block of this file.
+	uint32_t allocationGoal = 0;
+
+	// Writeback requests (offset -> length) that were not processed yet.
+	std::map<uintptr_t, size_t> pendingWriteback;
+	size_t pendingWritebackBytes = 0;
+	async::recurring_event writebackDoorbell;
+
+	// File data that was read ahead of a sequential reader
+	// but that was not requested by the page cache yet.
+	struct ReadaheadBuffer {
+		uint64_t offset;
+		size_t length;
+		std::unique_ptr<std::byte[]> data;
+		async::oneshot_event ready;
+		// Cleared if the disk contents change while the buffer is being read.
+		bool valid = true;
+	};
+
+	// End of the most recent initialization request (for stream detection).
+	uint64_t readaheadNext = 0;
+	// Size of the next readahead buffer, or zero if the file is not read sequentially.
+	size_t readaheadWindow = 0;
+	// Ordered by offset.
+	std::deque<std::shared_ptr<ReadaheadBuffer>> readaheadBuffers;
 };
 
 // --------------------------------------------------------
 // FileSystem
 // --------------------------------------------------------
 
+// Result of FileSystem::mapExtent().
+struct ExtentMapping {
+	// First disk block, or zero for holes and uninitialized extents.
+	uint64_t block;
+	// Number of file blocks that are mapped contiguously from there.
+	size_t count;
+	// True for uninitialized extents (i.e., allocated blocks that read as zeros).
+	bool uninitialized;
+};
+
+// Node on the path from the root of an extent tree to a leaf
+// (see FileSystem::findExtentPath()).
+struct ExtentPathLevel {
+	// Disk block of the node, or zero for the root (which is stored in the inode).
+	uint64_t block;
+	// Copy of the node that is written back by FileSystem::writeExtentPath()
+	// (empty for the root).
+	std::vector<std::byte> buffer;
+	DiskExtentHeader *header;
+	// Maximal number of entries of the node.
+	int capacity;
+	// Index of the entry that the path follows (unused for leaves).
+	int pos = 0;
+	bool dirty = false;
+};
+
 struct FileSystem {
 	FileSystem(BlockDevice *device);
 
@@ -249,6 +476,13 @@ struct FileSystem {
 	async::detached manageBlockBitmap(helix::UniqueDescriptor memory);
 	async::detached manageInodeBitmap(helix::UniqueDescriptor memory);
 	async::detached manageInodeTable(helix::UniqueDescriptor memory);
+	// Serves a management request of memory that caches metadata blocks. The memory
+	// consists of slots of slot_size bytes; the first data_size bytes of each slot cache
+	// consecutive disk blocks, starting at block_of(slot). Requests may span multiple
+	// slots and may cover parts of blocks (if blocks are larger than pages).
+	async::result<void> manageMetadata(helix::BorrowedDescriptor memory,
+			helix::ManageMemory &manage, size_t slot_size, size_t data_size,
+			std::function<async::result<uint64_t>(size_t)> block_of);
 
 	std::shared_ptr<Inode> accessRoot();
 	std::shared_ptr<Inode> accessInode(uint32_t number);
@@ -256,27 +490,118 @@ struct FileSystem {
 	async::result<std::shared_ptr<Inode>> createDirectory();
 	async::result<std::shared_ptr<Inode>> createSymlink();
 
+	async::result<void> prepareWrite(Inode *inode, uint64_t offset, size_t length);
 	async::result<void> write(Inode *inode, uint64_t offset,
 			const void *buffer, size_t length);
+	// Like write() but copies the data from a window of a client's buffer
+	// (see helCreateSpaceWindow()) directly to the page cache.
+	// Returns an error if the window cannot be read.
+	async::result<HelError> writeFromWindow(Inode *inode, uint64_t offset,
+			helix::BorrowedDescriptor window, size_t length);
 
 	async::detached initiateInode(std::shared_ptr<Inode> inode);
 	async::detached manageFileData(std::shared_ptr<Inode> inode);
+	async::detached flushFileData(std::shared_ptr<Inode> inode);
 	async::detached manageIndirect(std::shared_ptr<Inode> inode, int order,
 			helix::UniqueDescriptor memory);
 
-	async::result<uint32_t> allocateBlock();
+	// Allocates up to max_blocks consecutive blocks, preferably at or after goal.
+	// Returns the first block and the number of blocks (or zero if the disk is full).
+	async::result<std::pair<uint32_t, size_t>> allocateBlocks(uint32_t goal, size_t max_blocks);
+	async::result<uint32_t> allocateBlock(uint32_t goal = 0);
 	async::result<uint32_t> allocateInode();
 
+	// Returns the block group descriptor of the given group.
+	DiskGroupDesc &groupDesc(uint32_t bg_idx) {
+		return *reinterpret_cast<DiskGroupDesc *>(blockGroupDescriptorBuffer.data()
+				+ bg_idx * descSize);
+	}
+
+	// Returns the first block of the group that contains the inode.
+	uint32_t goalForInode(Inode *inode) {
+		return ((inode->number - 1) / inodesPerGroup) * blocksPerGroup;
+	}
+
 	async::result<void> assignDataBlocks(Inode *inode,
 			uint64_t block_offset, size_t num_blocks);
 
+	// Helper for assignDataBlocks(). Assigns blocks to slots[0] and following unassigned
+	// slots (up to limit). Returns the number of slots that were processed.
+	async::result<size_t> assignRun(DiskInode *disk_inode, uint32_t *slots,
+			size_t limit, uint32_t &goal);
+
+	// Looks up the mapping of file block index in the extent tree of the inode.
+	async::result<ExtentMapping> mapExtent(Inode *inode, uint64_t index, size_t limit);
+	async::result<void> assignExtentBlocks(Inode *inode,
+			uint64_t block_offset, size_t num_blocks);
+
+	// Helpers for assignExtentBlocks().
+	// Returns the path to the leaf that covers (or should cover) file block index.
+	async::result<std::vector<ExtentPathLevel>> findExtentPath(Inode *inode, uint64_t index);
+	// Writes the nodes of the path that were modified.
+	async::result<void> writeExtentPath(Inode *inode, std::vector<ExtentPathLevel> &path);
+	// Inserts an extent that does not overlap existing extents. Merges it with adjacent
+	// extents if possible; splits full nodes and grows the tree as necessary.
+	async::result<void> insertExtent(Inode *inode, DiskExtent extent);
+	// Marks up to count blocks (starting at file block index) of the uninitialized extent
+	// that contains index as initialized. Returns the number of blocks that were converted.
+	async::result<size_t> initializeExtentRange(Inode *inode, uint64_t index, size_t count);
+
 	async::result<void> readDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, void *buffer);
+
+	// Reads the page-aligned range of the file into buffer. Parts beyond the end
+	// of the file are not touched.
+	async::result<void> readFileRange(std::shared_ptr<Inode> inode, uint64_t offset,
+			size_t length, std::byte *buffer);
+	// Serves an initialization request of the page cache; detects sequential
+	// streams and reads ahead of them.
+	async::result<void> initializeFileData(std::shared_ptr<Inode> inode, uint64_t offset,
+			size_t length, std::byte *buffer);
+	// Starts to read a readahead buffer at offset.
+	std::shared_ptr<Inode::ReadaheadBuffer> issueReadahead(std::shared_ptr<Inode> inode,
+			uint64_t offset, size_t length);
+	async::detached fillReadahead(std::shared_ptr<Inode> inode,
+			std::shared_ptr<Inode::ReadaheadBuffer> readahead);
 	async::result<void> writeDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, const void *buffer);
 
 	async::result<void> truncate(Inode *inode, size_t size);
 
+	// Removes file blocks [begin, end) from the inode and frees the data blocks.
+	async::result<void> releaseDataBlocks(Inode *inode, uint64_t begin, uint64_t end);
+	// Helpers for releaseDataBlocks(). Remove all mappings of file blocks >= begin
+	// (relative to the first file block of the node) and pass the blocks that become
+	// unused (including tree nodes) to release. The node itself is not freed.
+	async::result<void> truncateExtentNode(DiskExtentHeader *header, uint64_t begin,
+			const std::function<void(uint64_t, size_t)> &release);
+	async::result<void> truncateIndirectBlock(uint32_t block, int level, uint64_t begin,
+			const std::function<void(uint64_t, size_t)> &release);
+
+	// Frees blocks. They are discarded (in batches) and only become available
+	// for allocation once the discard completed.
+	void freeBlocks(uint64_t block, size_t count);
+	async::detached flushDiscards();
+	// Clears the blocks in the block bitmap.
+	async::result<void> releaseBlocks(uint64_t block, size_t count);
+
+	// Writes metadata blocks (through the journal, if there is one).
+	async::result<void> writeMetadata(uint64_t block, const void *buffer, size_t num_blocks);
+	// Writes requests that were built by writeDataBlocks().
+	async::result<void> submitDataWrites(Inode *inode, std::span<BlockRequest> requests);
+
+	async::result<void> initJournal(const DiskSuperblock &sb);
+	// Sets or clears EXT3_FEATURE_INCOMPAT_RECOVER in the on-disk superblock.
+	async::result<void> setNeedsRecovery(bool needs_recovery);
+	// Helpers for initJournal(). Append the disk blocks of the file to blocks.
+	async::result<void> collectIndirectBlocks(uint32_t block, int level,
+			std::vector<uint64_t> &blocks, size_t limit);
+	async::result<void> collectExtentBlocks(const DiskExtentHeader *header,
+			std::vector<uint64_t> &blocks, size_t limit);
+
+	// Schedules a writeback of the block group descriptor table.
+	void markBgdtDirty();
+	async::detached flushBgdt();
 	async::result<void> writebackBgdt();
 
 	BlockDevice *device;
@@ -290,8 +615,41 @@ struct FileSystem {
 	uint32_t inodesPerGroup;
 	uint32_t blocksCount;
 	uint32_t inodesCount;
+	// Size of the entries of the block group descriptor table.
+	uint32_t descSize;
+	// Set if the file system must not be modified (e.g., because it uses
+	// features that writes do not maintain).
+	bool readOnly = false;
+	// Parameters of htree directories.
+	bool dirIndex;
+	bool unsignedHash;
+	uint32_t hashSeed[4];
 	std::vector<std::byte> blockGroupDescriptorBuffer;
-	DiskGroupDesc *bgdt;
+
+	// In-memory allocation hints for each block group.
+	// All bits below the hints are known to be set in the respective bitmap;
+	// code that clears bits must lower the hints accordingly.
+	struct GroupSummary {
+		uint32_t firstFreeBlock = 0;
+		uint32_t firstFreeInode = 0;
+	};
+	std::vector<GroupSummary> groupSummaries;
+	// Sums of the free counts of all block group descriptors.
+	uint64_t freeBlocksTotal = 0;
+	uint64_t freeInodesTotal = 0;
+
+	bool bgdtDirty = false;
+	async::recurring_event bgdtDoorbell;
+
+	// Freed blocks (block -> count) that are not discarded yet.
+	std::map<uint64_t, size_t> pendingDiscards;
+	async::recurring_event discardDoorbell;
+
+	// If the file system has a journal, device points to it.
+	std::unique_ptr<Journal> journal;
+
+	// Cache of metadata blocks; sits on top of the journal.
+	std::unique_ptr<BlockCache> blockCache;
 
 	helix::UniqueDescriptor blockBitmap;
 	helix::UniqueDescriptor inodeBitmap;
@@ -309,9 +667,13 @@ struct OpenFile {
 
 	async::result<std::optional<std::string>> readEntries();
 
+	// Returns as many entries as fit into the buffer (see protocols::fs::DirentBuilder).
+	async::result<protocols::fs::ReadResult> readDirents(void *buffer, size_t length);
+
 	std::shared_ptr<Inode> inode;
 	uint64_t offset;
 	Flock flock;
+	protocols::fs::RangeLockFile rangeLocks;
 	bool append;
 };
 
@@ -84,6 +84,31 @@ async::result<void> Partition::writeSectors(uint64_t sector, const void *buffer,
 			buffer, count);
 }
 
+async::result<void> Partition::submit(BlockRequest &request) {
+	_toParent(request);
+	co_await _table.getDevice()->submit(request);
+	_fromParent(request);
+}
+
+async::result<void> Partition::submitMany(std::span<BlockRequest> requests) {
+	for(auto &request : requests)
+		_toParent(request);
+	co_await _table.getDevice()->submitMany(requests);
+	for(auto &request : requests)
+		_fromParent(request);
+}
+
+void Partition::_toParent(BlockRequest &request) {
+	assert(request.sector + request.numSectors() <= _numSectors);
+	if(request.op != BlockOp::flush)
+		request.sector += _startLba;
+}
+
+void Partition::_fromParent(BlockRequest &request) {
+	if(request.op != BlockOp::flush)
+		request.sector -= _startLba;
+}
+
 async::result<size_t> Partition::getSize() {
 	co_return _numSectors * sectorSize;
 }
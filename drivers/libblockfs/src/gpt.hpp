@@ -32,6 +32,8 @@ namespace type_guids {
 			{0x68, 0xB6, 0xB7, 0x26, 0x99, 0xC7}};
 	static constexpr Guid managarmRootPartition{0x64212B3B, 0x56A1, 0x4DFB, {0x97, 0x1E},
 			{0xBC, 0x8C, 0xD0, 0x27, 0x99, 0x6A}};
+	static constexpr Guid linuxSwap{0x0657FD6D, 0xA4AB, 0x43C4, {0x84, 0xE5},
+			{0x09, 0x33, 0xC8, 0x4B, 0x4F, 0x4F}};
 };
 
 // --------------------------------------------------------
@@ -106,11 +108,20 @@ struct Partition : public BlockDevice {
 
 	async::result<size_t> getSize() override;
 
+	async::result<void> submit(BlockRequest &request) override;
+
+	async::result<void> submitMany(std::span<BlockRequest> requests) override;
+
 	Guid id();
 
 	Guid type();
 
 private:
+	// Requests are forwarded to the parent device in place (without copying their segments);
+	// these add and remove the offset of the partition.
+	void _toParent(BlockRequest &request);
+	void _fromParent(BlockRequest &request);
+
 	Table &_table;
 	Guid _id;
 	Guid _type;
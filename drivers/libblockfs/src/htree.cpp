@@ -0,0 +1,165 @@
+#include "htree.hpp"
+
+// The hash functions in this file have to match the ones that Linux uses
+// to build htree directories bit for bit.
+
+namespace blockfs {
+namespace ext2fs {
+
+namespace {
+
+uint32_t rotateLeft(uint32_t x, int s) {
+	return (x << s) | (x >> (32 - s));
+}
+
+uint32_t legacyHash(const char *name, size_t length, bool is_unsigned) {
+	uint32_t hash0 = 0x12A3FE2D;
+	uint32_t hash1 = 0x37ABE8F9;
+	for(size_t i = 0; i < length; i++) {
+		uint32_t c = is_unsigned ? static_cast<uint32_t>(static_cast<unsigned char>(name[i]))
+				: static_cast<uint32_t>(static_cast<signed char>(name[i]));
+		uint32_t hash = hash1 + (hash0 ^ (c * 7152373));
+		if(hash & 0x80000000)
+			hash -= 0x7FFFFFFF;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+// Packs (up to num * 4 bytes of) the name into num words, padding with the length.
+void nameToWords(const char *name, size_t length, uint32_t *words, int num,
+		bool is_unsigned) {
+	uint32_t pad = static_cast<uint32_t>(length) | (static_cast<uint32_t>(length) << 8);
+	pad |= pad << 16;
+
+	uint32_t value = pad;
+	if(length > static_cast<size_t>(num) * 4)
+		length = num * 4;
+	for(size_t i = 0; i < length; i++) {
+		uint32_t c = is_unsigned ? static_cast<uint32_t>(static_cast<unsigned char>(name[i]))
+				: static_cast<uint32_t>(static_cast<signed char>(name[i]));
+		value = c + (value << 8);
+		if((i % 4) == 3) {
+			*words++ = value;
+			value = pad;
+			num--;
+		}
+	}
+	if(--num >= 0)
+		*words++ = value;
+	while(--num >= 0)
+		*words++ = pad;
+}
+
+uint32_t halfMd4Transform(uint32_t buf[4], const uint32_t in[8]) {
+	auto f = [] (uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); };
+	auto g = [] (uint32_t x, uint32_t y, uint32_t z) { return (x & y) + ((x ^ y) & z); };
+	auto h = [] (uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; };
+
+	constexpr uint32_t k1 = 0;
+	constexpr uint32_t k2 = 013240474631;
+	constexpr uint32_t k3 = 015666365641;
+
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	auto round = [] (auto fn, uint32_t &w, uint32_t x, uint32_t y, uint32_t z,
+			uint32_t value, int s) {
+		w = rotateLeft(w + fn(x, y, z) + value, s);
+	};
+
+	round(f, a, b, c, d, in[0] + k1, 3);
+	round(f, d, a, b, c, in[1] + k1, 7);
+	round(f, c, d, a, b, in[2] + k1, 11);
+	round(f, b, c, d, a, in[3] + k1, 19);
+	round(f, a, b, c, d, in[4] + k1, 3);
+	round(f, d, a, b, c, in[5] + k1, 7);
+	round(f, c, d, a, b, in[6] + k1, 11);
+	round(f, b, c, d, a, in[7] + k1, 19);
+
+	round(g, a, b, c, d, in[1] + k2, 3);
+	round(g, d, a, b, c, in[3] + k2, 5);
+	round(g, c, d, a, b, in[5] + k2, 9);
+	round(g, b, c, d, a, in[7] + k2, 13);
+	round(g, a, b, c, d, in[0] + k2, 3);
+	round(g, d, a, b, c, in[2] + k2, 5);
+	round(g, c, d, a, b, in[4] + k2, 9);
+	round(g, b, c, d, a, in[6] + k2, 13);
+
+	round(h, a, b, c, d, in[3] + k3, 3);
+	round(h, d, a, b, c, in[7] + k3, 9);
+	round(h, c, d, a, b, in[2] + k3, 11);
+	round(h, b, c, d, a, in[6] + k3, 15);
+	round(h, a, b, c, d, in[1] + k3, 3);
+	round(h, d, a, b, c, in[5] + k3, 9);
+	round(h, c, d, a, b, in[0] + k3, 11);
+	round(h, b, c, d, a, in[4] + k3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+	return buf[1];
+}
+
+void teaTransform(uint32_t buf[4], const uint32_t in[4]) {
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+	for(int n = 0; n < 16; n++) {
+		sum += 0x9E3779B9;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	}
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+} // anonymous namespace
+
+std::optional<uint32_t> dirHash(int version, const uint32_t seed[4],
+		const char *name, size_t length) {
+	uint32_t buf[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+	if(seed[0] || seed[1] || seed[2] || seed[3]) {
+		for(int i = 0; i < 4; i++)
+			buf[i] = seed[i];
+	}
+
+	uint32_t hash;
+	switch(version) {
+	case EXT2_HASH_LEGACY:
+	case EXT2_HASH_LEGACY_UNSIGNED:
+		hash = legacyHash(name, length, version == EXT2_HASH_LEGACY_UNSIGNED);
+		break;
+	case EXT2_HASH_HALF_MD4:
+	case EXT2_HASH_HALF_MD4_UNSIGNED: {
+		uint32_t in[8];
+		for(size_t i = 0; i < length; i += 32) {
+			nameToWords(name + i, length - i, in, 8, version == EXT2_HASH_HALF_MD4_UNSIGNED);
+			halfMd4Transform(buf, in);
+		}
+		hash = buf[1];
+		break;
+	}
+	case EXT2_HASH_TEA:
+	case EXT2_HASH_TEA_UNSIGNED: {
+		uint32_t in[4];
+		for(size_t i = 0; i < length; i += 16) {
+			nameToWords(name + i, length - i, in, 4, version == EXT2_HASH_TEA_UNSIGNED);
+			teaTransform(buf, in);
+		}
+		hash = buf[0];
+		break;
+	}
+	default:
+		return std::nullopt;
+	}
+
+	hash &= ~uint32_t{1};
+	// The largest hash value is reserved to mark the end of the directory.
+	if(hash == uint32_t{0x7FFFFFFF} << 1)
+		hash = uint32_t{0x7FFFFFFE} << 1;
+	return hash;
+}
+
+} } // namespace blockfs::ext2fs
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <optional>
+
+namespace blockfs {
+namespace ext2fs {
+
+enum {
+	// Values of DiskDxRootInfo::hashVersion.
+	EXT2_HASH_LEGACY = 0,
+	EXT2_HASH_HALF_MD4 = 1,
+	EXT2_HASH_TEA = 2,
+	EXT2_HASH_LEGACY_UNSIGNED = 3,
+	EXT2_HASH_HALF_MD4_UNSIGNED = 4,
+	EXT2_HASH_TEA_UNSIGNED = 5
+};
+
+// Computes the hash that htree directories use to order entries with the given name.
+// The lowest bit of the result is always clear.
+// Returns std::nullopt if the hash version is not supported.
+std::optional<uint32_t> dirHash(int version, const uint32_t seed[4],
+		const char *name, size_t length);
+
+} } // namespace blockfs::ext2fs
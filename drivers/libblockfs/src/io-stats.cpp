@@ -0,0 +1,164 @@
+#include <assert.h>
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "io-stats.hpp"
+
+namespace blockfs {
+namespace iostats {
+
+namespace {
+
+protocols::ostrace::Context *ostContext;
+protocols::ostrace::EventId ostQueueEvent;
+protocols::ostrace::EventId ostDispatchEvent;
+protocols::ostrace::EventId ostDeviceCompleteEvent;
+protocols::ostrace::EventId ostCompleteEvent;
+protocols::ostrace::ItemId ostOpItem;
+protocols::ostrace::ItemId ostSectorItem;
+protocols::ostrace::ItemId ostByteCounter;
+protocols::ostrace::ItemId ostTimeCounter;
+
+uint64_t currentNanos() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+IoStats::OpStats &statsForOp(IoStats &stats, BlockOp op) {
+	switch(op) {
+	case BlockOp::read: return stats.reads;
+	case BlockOp::write: return stats.writes;
+	case BlockOp::flush: return stats.flushes;
+	case BlockOp::discard: return stats.discards;
+	}
+	__builtin_unreachable();
+}
+
+} // anonymous namespace
+
+std::vector<uint64_t> IoStats::toVector() const {
+	auto ms = [] (uint64_t nanos) -> uint64_t {
+		return nanos / 1'000'000;
+	};
+
+	return {
+		reads.ios, reads.merges, reads.sectors, ms(reads.ticks),
+		writes.ios, writes.merges, writes.sectors, ms(writes.ticks),
+		inFlight, ms(ioTicks), ms(timeInQueue),
+		discards.ios, discards.merges, discards.sectors, ms(discards.ticks),
+		flushes.ios, ms(flushes.ticks)
+	};
+}
+
+MonitoredDevice::MonitoredDevice(BlockDevice *device, Stage stage)
+: BlockDevice{device->sectorSize, device->parentId}, _device{device}, _stage{stage} {
+	size = device->size;
+}
+
+async::result<void> MonitoredDevice::readSectors(uint64_t sector, void *buffer,
+		size_t num_sectors) {
+	BlockRequest request{
+		.op = BlockOp::read,
+		.sector = sector,
+		.segments = {{buffer, num_sectors}}
+	};
+	co_await submit(request);
+}
+
+async::result<void> MonitoredDevice::writeSectors(uint64_t sector, const void *buffer,
+		size_t num_sectors) {
+	BlockRequest request{
+		.op = BlockOp::write,
+		.sector = sector,
+		.segments = {{const_cast<void *>(buffer), num_sectors}}
+	};
+	co_await submit(request);
+}
+
+async::result<size_t> MonitoredDevice::getSize() {
+	return _device->getSize();
+}
+
+async::result<void> MonitoredDevice::submit(BlockRequest &request) {
+	auto start = co_await _start(request);
+	co_await _device->submit(request);
+	co_await _complete(request, start);
+}
+
+async::result<void> MonitoredDevice::submitMany(std::span<BlockRequest> requests) {
+	std::vector<uint64_t> starts;
+	starts.reserve(requests.size());
+	for(auto &request : requests)
+		starts.push_back(co_await _start(request));
+	co_await _device->submitMany(requests);
+	for(size_t i = 0; i < requests.size(); i++)
+		co_await _complete(requests[i], starts[i]);
+}
+
+IoStats MonitoredDevice::stats() {
+	auto now = currentNanos();
+	_updateBusyTime(now);
+	return _stats;
+}
+
+async::result<uint64_t> MonitoredDevice::_start(const BlockRequest &request) {
+	auto now = currentNanos();
+	_updateBusyTime(now);
+	_stats.inFlight++;
+
+	if(ostContext) {
+		protocols::ostrace::Event oste{ostContext,
+				_stage == Stage::queue ? ostQueueEvent : ostDispatchEvent};
+		oste.withCounter(ostOpItem, static_cast<int64_t>(request.op));
+		oste.withCounter(ostSectorItem, static_cast<int64_t>(request.sector));
+		oste.withCounter(ostByteCounter,
+				static_cast<int64_t>(request.numSectors() * sectorSize));
+		co_await oste.emit();
+	}
+	co_return now;
+}
+
+async::result<void> MonitoredDevice::_complete(const BlockRequest &request, uint64_t start) {
+	auto now = currentNanos();
+	_updateBusyTime(now);
+	assert(_stats.inFlight);
+	_stats.inFlight--;
+
+	auto &op = statsForOp(_stats, request.op);
+	op.ios++;
+	op.sectors += request.numSectors() * sectorSize / 512;
+	op.ticks += now - start;
+	_stats.timeInQueue += now - start;
+
+	if(ostContext) {
+		protocols::ostrace::Event oste{ostContext,
+				_stage == Stage::queue ? ostCompleteEvent : ostDeviceCompleteEvent};
+		oste.withCounter(ostOpItem, static_cast<int64_t>(request.op));
+		oste.withCounter(ostSectorItem, static_cast<int64_t>(request.sector));
+		oste.withCounter(ostByteCounter,
+				static_cast<int64_t>(request.numSectors() * sectorSize));
+		oste.withCounter(ostTimeCounter, static_cast<int64_t>(now - start));
+		co_await oste.emit();
+	}
+}
+
+void MonitoredDevice::_updateBusyTime(uint64_t now) {
+	if(_stats.inFlight)
+		_stats.ioTicks += now - _busySince;
+	_busySince = now;
+}
+
+async::result<void> initTracing(protocols::ostrace::Context *context) {
+	ostQueueEvent = co_await context->announceEvent("libblockfs.queue");
+	ostDispatchEvent = co_await context->announceEvent("libblockfs.dispatch");
+	ostDeviceCompleteEvent = co_await context->announceEvent("libblockfs.device-complete");
+	ostCompleteEvent = co_await context->announceEvent("libblockfs.complete");
+	ostOpItem = co_await context->announceItem("op");
+	ostSectorItem = co_await context->announceItem("sector");
+	ostByteCounter = co_await context->announceItem("numBytes");
+	ostTimeCounter = co_await context->announceItem("time");
+	ostContext = context;
+}
+
+} } // namespace blockfs::iostats
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+
+#include <async/result.hpp>
+#include <protocols/ostrace/ostrace.hpp>
+
+#include <blockfs.hpp>
+
+namespace blockfs {
+namespace iostats {
+
+// Cumulative counters of a device, modeled after Linux' /sys/block/<dev>/stat.
+// Times are in nanoseconds.
+struct IoStats {
+	struct OpStats {
+		uint64_t ios = 0;
+		uint64_t merges = 0;
+		uint64_t sectors = 0;
+		uint64_t ticks = 0;
+	};
+
+	OpStats reads;
+	OpStats writes;
+	uint64_t inFlight = 0;
+	// Time during which at least one request was in flight.
+	uint64_t ioTicks = 0;
+	// Sum of the times that all requests were in flight.
+	uint64_t timeInQueue = 0;
+	OpStats discards;
+	// Flushes only count ios and ticks.
+	OpStats flushes;
+
+	// Returns the fields of /sys/block/<dev>/stat in order (with times in milliseconds).
+	std::vector<uint64_t> toVector() const;
+};
+
+// Where a MonitoredDevice sits in the stack of BlockDevices.
+enum class Stage {
+	// In front of the I/O scheduler: requests are queued.
+	queue,
+	// Behind the I/O scheduler: requests are dispatched to the driver.
+	dispatch
+};
+
+// Forwards all requests to another BlockDevice, while emitting ostrace events for
+// each request and keeping cumulative counters.
+//
+// At Stage::queue, libblockfs.queue and libblockfs.complete are emitted when a request
+// is submitted and completed. At Stage::dispatch, libblockfs.dispatch and
+// libblockfs.device-complete are emitted. All events carry the op (see BlockOp),
+// sector and numBytes; completion events also carry the latency in nanoseconds.
+struct MonitoredDevice final : BlockDevice {
+	MonitoredDevice(BlockDevice *device, Stage stage);
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<size_t> getSize() override;
+
+	async::result<void> submit(BlockRequest &request) override;
+
+	async::result<void> submitMany(std::span<BlockRequest> requests) override;
+
+	// Returns the current counters (including the time that the current requests are in flight).
+	IoStats stats();
+
+private:
+	// Returns the time at which the request was started.
+	async::result<uint64_t> _start(const BlockRequest &request);
+	async::result<void> _complete(const BlockRequest &request, uint64_t start);
+
+	void _updateBusyTime(uint64_t now);
+
+	BlockDevice *_device;
+	Stage _stage;
+	IoStats _stats;
+	// Time at which _stats.ioTicks was last updated.
+	uint64_t _busySince = 0;
+};
+
+// Announces the events of MonitoredDevice. Must be called before requests are submitted.
+async::result<void> initTracing(protocols::ostrace::Context *context);
+
+} } // namespace blockfs::iostats
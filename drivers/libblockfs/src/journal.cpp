@@ -0,0 +1,508 @@
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+
+#include <arch/bit.hpp>
+#include <helix/timer.hpp>
+
+#include "journal.hpp"
+
+namespace blockfs {
+namespace ext2fs {
+
+namespace {
+
+constexpr bool logRecovery = true;
+
+// Time that the commit loop waits for other writers to join a transaction.
+constexpr uint64_t commitDelay = 5'000'000;
+
+template<typename T>
+T big(T x) {
+	return arch::convert_endian<arch::endian::big, arch::endian::native>(x);
+}
+
+} // anonymous namespace
+
+Journal::Journal(BlockDevice *device, uint32_t block_size, std::vector<uint64_t> blocks,
+		std::function<async::result<void>(bool)> set_needs_recovery)
+: BlockDevice{device->sectorSize, device->parentId}, _device{device},
+		_blockSize{block_size}, _sectorsPerBlock{static_cast<uint32_t>(block_size / device->sectorSize)},
+		_blocks{std::move(blocks)}, _setNeedsRecovery{std::move(set_needs_recovery)} {
+	size = device->size;
+}
+
+async::result<bool> Journal::init() {
+	if(_blocks.empty())
+		co_return false;
+
+	_superblockBuffer.resize(_blockSize);
+	co_await _device->readSectors(_blocks[0] * _sectorsPerBlock,
+			_superblockBuffer.data(), _sectorsPerBlock);
+	auto sb = reinterpret_cast<JournalSuperblock *>(_superblockBuffer.data());
+
+	if(big(sb->header.magic) != JBD2_MAGIC) {
+		std::cout << "\e[31m" "ext2fs: Journal has a bad magic number" "\e[39m" << std::endl;
+		co_return false;
+	}
+
+	auto type = big(sb->header.blockType);
+	if(type != JBD2_SUPERBLOCK_V1 && type != JBD2_SUPERBLOCK_V2) {
+		std::cout << "\e[31m" "ext2fs: Journal superblock has an unexpected type" "\e[39m"
+				<< std::endl;
+		co_return false;
+	}
+	if(big(sb->blockSize) != _blockSize || big(sb->maxLength) > _blocks.size()
+			|| !big(sb->first) || big(sb->first) >= big(sb->maxLength)) {
+		std::cout << "\e[31m" "ext2fs: Journal superblock is inconsistent" "\e[39m"
+				<< std::endl;
+		co_return false;
+	}
+
+	if(type == JBD2_SUPERBLOCK_V2) {
+		// TODO: Support checksums.
+		constexpr uint32_t supportedIncompat = JBD2_FEATURE_INCOMPAT_REVOKE
+				| JBD2_FEATURE_INCOMPAT_64BIT | JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT;
+		if((big(sb->featureIncompat) & ~supportedIncompat)
+				|| (big(sb->featureCompat) & JBD2_FEATURE_COMPAT_CHECKSUM)) {
+			std::cout << "\e[31m" "ext2fs: Journal uses unsupported features" "\e[39m"
+					<< std::endl;
+			co_return false;
+		}
+		_64bit = big(sb->featureIncompat) & JBD2_FEATURE_INCOMPAT_64BIT;
+	}
+
+	_first = big(sb->first);
+	_maxLength = big(sb->maxLength);
+	_tagSize = _64bit ? sizeof(JournalBlockTag) : sizeof(JournalBlockTag) - 4;
+
+	// Each transaction consists of descriptor blocks (the first tag is followed by
+	// a UUID), the data blocks and one commit block.
+	size_t per_descriptor = (_blockSize - sizeof(JournalHeader) - 16) / _tagSize;
+	size_t capacity = _maxLength - _first - 1;
+	_maxTransactionBlocks = capacity * per_descriptor / (per_descriptor + 1);
+	assert(_maxTransactionBlocks);
+
+	auto sequence = big(sb->sequence);
+	if(sb->start)
+		sequence = co_await _recover(big(sb->start), sequence);
+	co_await _writeSuperblock(0, sequence);
+
+	_running = std::make_shared<Transaction>();
+	_running->sequence = sequence;
+	_commitLoop();
+
+	co_return true;
+}
+
+async::result<void> Journal::readSectors(uint64_t sector, void *buffer,
+		size_t num_sectors) {
+	while(true) {
+		auto generation = _checkpointGeneration;
+		co_await _device->readSectors(sector, buffer, num_sectors);
+		// If a transaction was dropped during the read, we might have missed its blocks.
+		if(generation == _checkpointGeneration)
+			break;
+	}
+	_overlay(sector, num_sectors, buffer);
+}
+
+async::result<void> Journal::writeSectors(uint64_t sector, const void *buffer,
+		size_t num_sectors) {
+	return _device->writeSectors(sector, buffer, num_sectors);
+}
+
+async::result<size_t> Journal::getSize() {
+	return _device->getSize();
+}
+
+async::result<void> Journal::submit(BlockRequest &request) {
+	if(request.op != BlockOp::read) {
+		co_await _device->submit(request);
+		co_return;
+	}
+
+	while(true) {
+		auto generation = _checkpointGeneration;
+		co_await _device->submit(request);
+		if(generation == _checkpointGeneration)
+			break;
+	}
+	_overlay(request);
+}
+
+async::result<void> Journal::submitMany(std::span<BlockRequest> requests) {
+	while(true) {
+		auto generation = _checkpointGeneration;
+		co_await _device->submitMany(requests);
+		if(generation == _checkpointGeneration)
+			break;
+	}
+	for(auto &request : requests) {
+		if(request.op == BlockOp::read)
+			_overlay(request);
+	}
+}
+
+async::result<void> Journal::logBlocks(uint64_t block, const void *buffer, size_t num_blocks) {
+	// Blocks can end up in multiple transactions if the running one becomes full.
+	std::vector<std::shared_ptr<Transaction>> transactions;
+
+	for(size_t i = 0; i < num_blocks; i++) {
+		while(!_running->blocks.contains(block + i)
+				&& _running->blocks.size() >= _maxTransactionBlocks) {
+			_full = true;
+			_doorbell.raise();
+			co_await _spaceEvent.async_wait();
+		}
+
+		auto &copy = _running->blocks[block + i];
+		if(!copy)
+			copy = std::make_unique<std::byte[]>(_blockSize);
+		memcpy(copy.get(), reinterpret_cast<const std::byte *>(buffer) + i * _blockSize,
+				_blockSize);
+
+		if(transactions.empty() || transactions.back() != _running)
+			transactions.push_back(_running);
+	}
+	_doorbell.raise();
+
+	for(auto &transaction : transactions)
+		co_await transaction->committed.wait();
+}
+
+async::result<void> Journal::forgetBlocks(uint64_t block, size_t num_blocks) {
+	auto intersects = [&] (Transaction *transaction) {
+		auto it = transaction->blocks.lower_bound(block);
+		return it != transaction->blocks.end() && it->first < block + num_blocks;
+	};
+
+	if(intersects(_running.get())) {
+		_running->blocks.erase(_running->blocks.lower_bound(block),
+				_running->blocks.lower_bound(block + num_blocks));
+
+		// If nothing is left to commit, writers that wait for the transaction are done.
+		// The sequence number was not used on disk yet, hence it is reused.
+		if(_running->blocks.empty()) {
+			auto sequence = _running->sequence;
+			_running->committed.raise();
+			_running = std::make_shared<Transaction>();
+			_running->sequence = sequence;
+			_full = false;
+			_spaceEvent.raise();
+		}
+	}
+
+	// The checkpoint of the committing transaction would overwrite the blocks.
+	if(auto committing = _committing; committing && intersects(committing.get()))
+		co_await committing->checkpointed.wait();
+}
+
+void Journal::_buildRequests(std::vector<BlockRequest> &requests, BlockOp op,
+		uint32_t position, std::byte **buffers, size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		assert(position + i < _maxLength);
+		auto block = _blocks[position + i];
+		BlockSegment segment{buffers[i], _sectorsPerBlock};
+
+		if(i && _blocks[position + i - 1] + 1 == block) {
+			requests.back().segments.push_back(segment);
+		}else{
+			requests.push_back(BlockRequest{op, 0, block * _sectorsPerBlock, {segment}});
+		}
+	}
+}
+
+void Journal::_overlay(uint64_t sector, size_t num_sectors, void *buffer) {
+	auto first = sector / _sectorsPerBlock;
+	auto last = (sector + num_sectors + _sectorsPerBlock - 1) / _sectorsPerBlock;
+
+	// Blocks of the running transaction are newer; hence, copy them last.
+	for(auto transaction : {_committing.get(), _running.get()}) {
+		if(!transaction)
+			continue;
+		for(auto it = transaction->blocks.lower_bound(first);
+				it != transaction->blocks.end() && it->first < last; ++it) {
+			auto begin = std::max(sector, it->first * _sectorsPerBlock);
+			auto end = std::min(sector + num_sectors, (it->first + 1) * _sectorsPerBlock);
+			memcpy(reinterpret_cast<std::byte *>(buffer) + (begin - sector) * sectorSize,
+					it->second.get() + (begin - it->first * _sectorsPerBlock) * sectorSize,
+					(end - begin) * sectorSize);
+		}
+	}
+}
+
+void Journal::_overlay(const BlockRequest &request) {
+	auto sector = request.sector;
+	for(auto &segment : request.segments) {
+		_overlay(sector, segment.numSectors, segment.buffer);
+		sector += segment.numSectors;
+	}
+}
+
+async::result<void> Journal::_flush() {
+	BlockRequest request;
+	request.op = BlockOp::flush;
+	co_await _device->submit(request);
+}
+
+async::result<void> Journal::_writeSuperblock(uint32_t start, uint32_t sequence) {
+	auto sb = reinterpret_cast<JournalSuperblock *>(_superblockBuffer.data());
+	sb->start = big(start);
+	sb->sequence = big(sequence);
+	co_await _device->writeSectors(_blocks[0] * _sectorsPerBlock,
+			_superblockBuffer.data(), _sectorsPerBlock);
+}
+
+async::result<uint32_t> Journal::_recover(uint32_t start, uint32_t sequence) {
+	struct Replay {
+		uint64_t block;
+		uint32_t position;
+		bool escaped;
+	};
+
+	auto advance = [&] (uint32_t position) {
+		return (position + 1 == _maxLength) ? _first : position + 1;
+	};
+
+	auto sb = reinterpret_cast<JournalSuperblock *>(_superblockBuffer.data());
+	bool has_revoke = big(sb->header.blockType) == JBD2_SUPERBLOCK_V2
+			&& (big(sb->featureIncompat) & JBD2_FEATURE_INCOMPAT_REVOKE);
+
+	// Pass 1: Find all committed transactions and revoked blocks.
+	std::vector<std::pair<uint32_t, std::vector<Replay>>> transactions;
+	std::unordered_map<uint64_t, uint32_t> revoked;
+	std::vector<Replay> pending;
+	std::vector<uint64_t> pending_revoked;
+
+	std::vector<std::byte> buffer(_blockSize);
+	auto position = start;
+	while(position >= _first && position < _maxLength) {
+		co_await _device->readSectors(_blocks[position] * _sectorsPerBlock,
+				buffer.data(), _sectorsPerBlock);
+		auto header = reinterpret_cast<JournalHeader *>(buffer.data());
+		if(big(header->magic) != JBD2_MAGIC || big(header->sequence) != sequence)
+			break;
+
+		auto type = big(header->blockType);
+		if(type == JBD2_DESCRIPTOR_BLOCK) {
+			size_t offset = sizeof(JournalHeader);
+			while(offset + _tagSize <= _blockSize) {
+				auto tag = reinterpret_cast<JournalBlockTag *>(buffer.data() + offset);
+				auto flags = big(tag->flags);
+				uint64_t block = big(tag->blockLo);
+				if(_64bit)
+					block |= static_cast<uint64_t>(big(tag->blockHi)) << 32;
+
+				position = advance(position);
+				pending.push_back(Replay{block, position, static_cast<bool>(flags & JBD2_FLAG_ESCAPE)});
+
+				offset += _tagSize;
+				if(!(flags & JBD2_FLAG_SAME_UUID))
+					offset += 16;
+				if(flags & JBD2_FLAG_LAST_TAG)
+					break;
+			}
+		}else if(type == JBD2_COMMIT_BLOCK) {
+			for(auto block : pending_revoked)
+				revoked[block] = sequence;
+			transactions.emplace_back(sequence, std::move(pending));
+			pending.clear();
+			pending_revoked.clear();
+			sequence++;
+		}else if(type == JBD2_REVOKE_BLOCK && has_revoke) {
+			auto revoke_header = reinterpret_cast<JournalRevokeHeader *>(buffer.data());
+			size_t count = std::min(size_t{big(revoke_header->count)}, size_t{_blockSize});
+			size_t record_size = _64bit ? 8 : 4;
+			for(size_t offset = sizeof(JournalRevokeHeader); offset + record_size <= count;
+					offset += record_size) {
+				if(_64bit) {
+					uint64_t block;
+					memcpy(&block, buffer.data() + offset, 8);
+					pending_revoked.push_back(big(block));
+				}else{
+					uint32_t block;
+					memcpy(&block, buffer.data() + offset, 4);
+					pending_revoked.push_back(big(block));
+				}
+			}
+		}else{
+			break;
+		}
+
+		position = advance(position);
+	}
+
+	// Pass 2: Write the blocks of all committed transactions to their home locations.
+	// A block that is revoked by a transaction is not replayed from that
+	// transaction or any earlier transaction.
+	size_t num_replayed = 0;
+	for(auto &[transaction_sequence, replays] : transactions) {
+		for(auto &replay : replays) {
+			auto it = revoked.find(replay.block);
+			if(it != revoked.end() && static_cast<int32_t>(it->second - transaction_sequence) >= 0)
+				continue;
+
+			co_await _device->readSectors(_blocks[replay.position] * _sectorsPerBlock,
+					buffer.data(), _sectorsPerBlock);
+			if(replay.escaped) {
+				uint32_t magic = big(uint32_t{JBD2_MAGIC});
+				memcpy(buffer.data(), &magic, 4);
+			}
+			co_await _device->writeSectors(replay.block * _sectorsPerBlock,
+					buffer.data(), _sectorsPerBlock);
+			num_replayed++;
+		}
+	}
+	co_await _flush();
+
+	if(logRecovery)
+		std::cout << "ext2fs: Replayed " << transactions.size() << " transactions ("
+				<< num_replayed << " blocks) from the journal" << std::endl;
+	co_return sequence;
+}
+
+async::detached Journal::_commitLoop() {
+	while(true) {
+		if(_running->blocks.empty()) {
+			co_await _doorbell.async_wait();
+			continue;
+		}
+
+		// Give other writers the chance to join the transaction.
+		if(!_full)
+			co_await helix::sleepFor(commitDelay);
+		// forgetBlocks() might have dropped all blocks in the meantime.
+		if(_running->blocks.empty())
+			continue;
+
+		_committing = std::move(_running);
+		_running = std::make_shared<Transaction>();
+		_running->sequence = _committing->sequence + 1;
+		_full = false;
+		_spaceEvent.raise();
+
+		// _commit() flushes before it writes the commit block, so the flag is durable
+		// before the transaction can be replayed.
+		if(!_needsRecovery) {
+			co_await _setNeedsRecovery(true);
+			_needsRecovery = true;
+		}
+
+		co_await _commit(_committing.get());
+		_committing->committed.raise();
+
+		co_await _checkpoint(_committing.get());
+		_committing->checkpointed.raise();
+		_committing = nullptr;
+		_checkpointGeneration++;
+
+		// The file system is clean unless another transaction is pending.
+		if(_running->blocks.empty()) {
+			co_await _setNeedsRecovery(false);
+			_needsRecovery = false;
+		}
+	}
+}
+
+async::result<void> Journal::_commit(Transaction *transaction) {
+	auto sb = reinterpret_cast<JournalSuperblock *>(_superblockBuffer.data());
+	auto make_header = [&] (std::byte *block, uint32_t type) {
+		memset(block, 0, _blockSize);
+		auto header = reinterpret_cast<JournalHeader *>(block);
+		header->magic = big(uint32_t{JBD2_MAGIC});
+		header->blockType = big(type);
+		header->sequence = big(transaction->sequence);
+	};
+
+	// The journal is only replayed from the superblock's start block.
+	co_await _writeSuperblock(_first, transaction->sequence);
+
+	std::vector<std::unique_ptr<std::byte[]>> descriptors;
+	// Copies of blocks that start with the magic number.
+	std::vector<std::unique_ptr<std::byte[]>> escaped;
+	// Buffers of the descriptor and data blocks, in journal order.
+	std::vector<std::byte *> buffers;
+
+	size_t per_descriptor = (_blockSize - sizeof(JournalHeader) - 16) / _tagSize;
+	auto it = transaction->blocks.begin();
+	while(it != transaction->blocks.end()) {
+		auto descriptor = std::make_unique<std::byte[]>(_blockSize);
+		make_header(descriptor.get(), JBD2_DESCRIPTOR_BLOCK);
+		buffers.push_back(descriptor.get());
+
+		size_t offset = sizeof(JournalHeader);
+		for(size_t n = 0; n < per_descriptor && it != transaction->blocks.end(); n++, ++it) {
+			auto &[block, data] = *it;
+			auto tag = reinterpret_cast<JournalBlockTag *>(descriptor.get() + offset);
+			tag->blockLo = big(static_cast<uint32_t>(block));
+			if(_64bit)
+				tag->blockHi = big(static_cast<uint32_t>(block >> 32));
+
+			uint16_t flags = n ? JBD2_FLAG_SAME_UUID : 0;
+			if(n + 1 == per_descriptor || std::next(it) == transaction->blocks.end())
+				flags |= JBD2_FLAG_LAST_TAG;
+
+			uint32_t magic;
+			memcpy(&magic, data.get(), 4);
+			if(big(magic) == JBD2_MAGIC) {
+				// Recovery would mistake this block for a journal block.
+				auto copy = std::make_unique<std::byte[]>(_blockSize);
+				memcpy(copy.get(), data.get(), _blockSize);
+				memset(copy.get(), 0, 4);
+				buffers.push_back(copy.get());
+				escaped.push_back(std::move(copy));
+				flags |= JBD2_FLAG_ESCAPE;
+			}else{
+				buffers.push_back(data.get());
+			}
+			tag->flags = big(flags);
+
+			offset += _tagSize;
+			if(!n) {
+				memcpy(descriptor.get() + offset, sb->uuid, 16);
+				offset += 16;
+			}
+		}
+
+		descriptors.push_back(std::move(descriptor));
+	}
+	assert(buffers.size() + 1 <= _maxLength - _first);
+
+	std::vector<BlockRequest> requests;
+	_buildRequests(requests, BlockOp::write, _first, buffers.data(), buffers.size());
+	co_await _device->submitMany(requests);
+	co_await _flush();
+
+	// The transaction becomes valid once the commit block is durable.
+	auto commit = std::make_unique<std::byte[]>(_blockSize);
+	make_header(commit.get(), JBD2_COMMIT_BLOCK);
+	auto commit_ptr = commit.get();
+	requests.clear();
+	_buildRequests(requests, BlockOp::write, _first + buffers.size(), &commit_ptr, 1);
+	co_await _device->submitMany(requests);
+	co_await _flush();
+}
+
+async::result<void> Journal::_checkpoint(Transaction *transaction) {
+	std::vector<BlockRequest> requests;
+	uint64_t next = 0;
+	for(auto &[block, data] : transaction->blocks) {
+		BlockSegment segment{data.get(), _sectorsPerBlock};
+		if(!requests.empty() && block == next) {
+			requests.back().segments.push_back(segment);
+		}else{
+			requests.push_back(BlockRequest{BlockOp::write, 0, block * _sectorsPerBlock, {segment}});
+		}
+		next = block + 1;
+	}
+	co_await _device->submitMany(requests);
+	co_await _flush();
+
+	// All blocks are at their home locations; the journal is empty again.
+	co_await _writeSuperblock(0, transaction->sequence + 1);
+}
+
+} } // namespace blockfs::ext2fs
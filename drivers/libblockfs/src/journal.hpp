@@ -0,0 +1,212 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
+#include <async/result.hpp>
+
+#include <blockfs.hpp>
+
+namespace blockfs {
+namespace ext2fs {
+
+// --------------------------------------------------------
+// On-disk structures (JBD2)
+// --------------------------------------------------------
+
+// Note that all fields of these structures are big-endian.
+
+struct JournalHeader {
+	uint32_t magic;
+	uint32_t blockType;
+	uint32_t sequence;
+};
+static_assert(sizeof(JournalHeader) == 12, "Bad JournalHeader struct size");
+
+struct JournalSuperblock {
+	JournalHeader header;
+	uint32_t blockSize;
+	uint32_t maxLength;
+	uint32_t first;
+	uint32_t sequence;
+	uint32_t start;
+	uint32_t error;
+	//-- Version 2 only --
+	uint32_t featureCompat;
+	uint32_t featureIncompat;
+	uint32_t featureRoCompat;
+	uint8_t uuid[16];
+	uint32_t numUsers;
+	uint32_t dynSuper;
+	uint32_t maxTransaction;
+	uint32_t maxTransData;
+	uint8_t checksumType;
+	uint8_t padding0[3];
+	uint32_t padding[42];
+	uint32_t checksum;
+	uint8_t users[16 * 48];
+};
+static_assert(sizeof(JournalSuperblock) == 1024, "Bad JournalSuperblock struct size");
+
+// Descriptor blocks contain an array of these tags, one for each data block
+// that follows the descriptor. Unless JBD2_FLAG_SAME_UUID is set, a tag is followed
+// by a 16 byte UUID. Without JBD2_FEATURE_INCOMPAT_64BIT, blockHi is omitted.
+struct JournalBlockTag {
+	uint32_t blockLo;
+	uint16_t checksum;
+	uint16_t flags;
+	uint32_t blockHi;
+};
+static_assert(sizeof(JournalBlockTag) == 12, "Bad JournalBlockTag struct size");
+
+// Revoke blocks contain an array of 32-bit (or 64-bit) block numbers after this header.
+struct JournalRevokeHeader {
+	JournalHeader header;
+	// Number of bytes that are used in the block (including this header).
+	uint32_t count;
+};
+static_assert(sizeof(JournalRevokeHeader) == 16, "Bad JournalRevokeHeader struct size");
+
+enum {
+	JBD2_MAGIC = 0xC03B3998
+};
+
+enum {
+	// Values of JournalHeader::blockType.
+	JBD2_DESCRIPTOR_BLOCK = 1,
+	JBD2_COMMIT_BLOCK = 2,
+	JBD2_SUPERBLOCK_V1 = 3,
+	JBD2_SUPERBLOCK_V2 = 4,
+	JBD2_REVOKE_BLOCK = 5
+};
+
+enum {
+	// Bits of JournalSuperblock::featureCompat.
+	JBD2_FEATURE_COMPAT_CHECKSUM = 0x1,
+
+	// Bits of JournalSuperblock::featureIncompat.
+	JBD2_FEATURE_INCOMPAT_REVOKE = 0x1,
+	JBD2_FEATURE_INCOMPAT_64BIT = 0x2,
+	JBD2_FEATURE_INCOMPAT_ASYNC_COMMIT = 0x4
+};
+
+enum {
+	// Bits of JournalBlockTag::flags.
+	JBD2_FLAG_ESCAPE = 1,
+	JBD2_FLAG_SAME_UUID = 2,
+	JBD2_FLAG_DELETED = 4,
+	JBD2_FLAG_LAST_TAG = 8
+};
+
+// --------------------------------------------------------
+// Journal
+// --------------------------------------------------------
+
+// Writes metadata blocks through a JBD2 journal (like ext3/ext4 in data=writeback mode).
+//
+// Logged blocks are added to the running transaction. A background loop commits the
+// running transaction (group commit: all blocks that were logged in the meantime are
+// written in one sequential write) and then writes the blocks to their home locations
+// (checkpointing). As the journal is empty after each checkpoint, each transaction
+// starts at the first block of the journal.
+//
+// Reads through this BlockDevice return the contents of logged blocks,
+// even if they were not checkpointed yet. Writes bypass the journal.
+//
+// Other implementations only replay the journal if the file system is marked as
+// needing recovery. set_needs_recovery(true) is awaited before a transaction is
+// committed; set_needs_recovery(false) once the journal is empty and idle again.
+struct Journal final : BlockDevice {
+	// blocks contains the disk block of each block of the journal.
+	Journal(BlockDevice *device, uint32_t block_size, std::vector<uint64_t> blocks,
+			std::function<async::result<void>(bool)> set_needs_recovery);
+
+	// Reads the journal superblock and replays committed transactions.
+	// Returns false if the journal cannot be used.
+	async::result<bool> init();
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<size_t> getSize() override;
+
+	async::result<void> submit(BlockRequest &request) override;
+
+	async::result<void> submitMany(std::span<BlockRequest> requests) override;
+
+	// Logs consecutive blocks. Completes once they are committed to the journal.
+	async::result<void> logBlocks(uint64_t block, const void *buffer, size_t num_blocks);
+
+	// Must be called before freed blocks are reused (e.g., as file data, which bypasses
+	// the journal). Drops the blocks from the running transaction and waits until
+	// the committing transaction (if it contains any of the blocks) is checkpointed.
+	// Afterwards, no logged copy of the blocks is written to their home locations.
+	//
+	// Note that JBD2 revoke records are not needed: since each commit starts at the
+	// first block of the journal after the previous transaction was checkpointed,
+	// recovery never replays a transaction that precedes the one that freed the blocks.
+	async::result<void> forgetBlocks(uint64_t block, size_t num_blocks);
+
+private:
+	struct Transaction {
+		uint32_t sequence;
+		std::map<uint64_t, std::unique_ptr<std::byte[]>> blocks;
+		async::oneshot_event committed;
+		async::oneshot_event checkpointed;
+	};
+
+	// Maps a range of the journal to disk requests (splitting at discontinuities).
+	void _buildRequests(std::vector<BlockRequest> &requests, BlockOp op,
+			uint32_t position, std::byte **buffers, size_t count);
+
+	// Copies logged blocks that intersect the sectors into the buffer.
+	void _overlay(uint64_t sector, size_t num_sectors, void *buffer);
+	void _overlay(const BlockRequest &request);
+
+	async::result<void> _flush();
+	async::result<void> _writeSuperblock(uint32_t start, uint32_t sequence);
+
+	// Replays all committed transactions. Returns the next sequence number.
+	async::result<uint32_t> _recover(uint32_t start, uint32_t sequence);
+
+	async::detached _commitLoop();
+	async::result<void> _commit(Transaction *transaction);
+	async::result<void> _checkpoint(Transaction *transaction);
+
+	BlockDevice *_device;
+	uint32_t _blockSize;
+	uint32_t _sectorsPerBlock;
+	std::vector<uint64_t> _blocks;
+	std::function<async::result<void>(bool)> _setNeedsRecovery;
+	bool _needsRecovery = false;
+
+	std::vector<std::byte> _superblockBuffer;
+	uint32_t _first = 0;
+	uint32_t _maxLength = 0;
+	size_t _tagSize = 0;
+	bool _64bit = false;
+
+	// Maximal number of blocks per transaction, such that it fits into the journal.
+	size_t _maxTransactionBlocks = 0;
+
+	std::shared_ptr<Transaction> _running;
+	// Transaction that is currently committed or checkpointed.
+	std::shared_ptr<Transaction> _committing;
+	// Incremented whenever a checkpointed transaction is dropped.
+	uint64_t _checkpointGeneration = 0;
+
+	// Raised when blocks are logged.
+	async::recurring_event _doorbell;
+	// Raised when a new running transaction is started.
+	async::recurring_event _spaceEvent;
+	bool _full = false;
+};
+
+} } // namespace blockfs::ext2fs
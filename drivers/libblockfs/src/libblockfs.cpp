@@ -7,6 +7,8 @@
 #include <linux/cdrom.h>
 #include <linux/fs.h>
 
+#include <async/oneshot-event.hpp>
+#include <frg/std_compat.hpp>
 #include <helix/ipc.hpp>
 #include <protocols/fs/server.hpp>
 #include <protocols/mbus/client.hpp>
@@ -15,7 +17,10 @@
 #include <blockfs.hpp>
 #include "gpt.hpp"
 #include "ext2fs.hpp"
+#include "io-stats.hpp"
 #include "raw.hpp"
+#include "scheduler.hpp"
+#include "swap.hpp"
 #include "fs.bragi.hpp"
 #include <bragi/helpers-std.hpp>
 
@@ -61,6 +66,22 @@ async::result<protocols::fs::Error> flock(void *object, int flags) {
 	co_return result;
 }
 
+async::result<protocols::fs::Error> rangeLock(void *object,
+		protocols::fs::RangeLockRequest request) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->readyJump.wait();
+
+	co_return co_await self->inode->rangeLockManager.lock(&self->rangeLocks, request);
+}
+
+async::result<std::optional<protocols::fs::RangeLockRequest>> testRangeLock(void *object,
+		protocols::fs::RangeLockRequest request) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->readyJump.wait();
+
+	co_return self->inode->rangeLockManager.test(&self->rangeLocks, request);
+}
+
 async::result<protocols::fs::ReadResult> read(void *object, const char *,
 		void *buffer, size_t length) {
 	if (!length)
@@ -167,6 +188,8 @@ async::result<frg::expected<protocols::fs::Error, size_t>> write(void *object, c
 	}
 
 	auto self = static_cast<ext2fs::OpenFile *>(object);
+	if(self->inode->fs.readOnly)
+		co_return protocols::fs::Error::readOnlyFileSystem;
 	if(self->append) {
 		self->offset = self->inode->fileSize();
 	}
@@ -184,10 +207,51 @@ async::result<frg::expected<protocols::fs::Error, size_t>> pwrite(void *object,
 	}
 
 	auto self = static_cast<ext2fs::OpenFile *>(object);
+	if(self->inode->fs.readOnly)
+		co_return protocols::fs::Error::readOnlyFileSystem;
 	co_await self->inode->fs.write(self->inode.get(), offset, buffer, length);
 	co_return length;
 }
 
+async::result<frg::expected<protocols::fs::Error, size_t>>
+writeFromWindow(void *object, const char *, helix::BorrowedDescriptor window, size_t length) {
+	if(!length) {
+		co_return 0;
+	}
+
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	if(self->inode->fs.readOnly)
+		co_return protocols::fs::Error::readOnlyFileSystem;
+	if(self->append) {
+		self->offset = self->inode->fileSize();
+	}
+	auto error = co_await self->inode->fs.writeFromWindow(self->inode.get(), self->offset,
+			window, length);
+	if(error == kHelErrFault || error == kHelErrIllegalArgs)
+		co_return protocols::fs::Error::illegalArguments;
+	HEL_CHECK(error);
+	self->offset += length;
+	co_return length;
+}
+
+async::result<frg::expected<protocols::fs::Error, size_t>>
+pwriteFromWindow(void *object, int64_t offset, const char *,
+		helix::BorrowedDescriptor window, size_t length) {
+	if(!length) {
+		co_return 0;
+	}
+
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	if(self->inode->fs.readOnly)
+		co_return protocols::fs::Error::readOnlyFileSystem;
+	auto error = co_await self->inode->fs.writeFromWindow(self->inode.get(), offset,
+			window, length);
+	if(error == kHelErrFault || error == kHelErrIllegalArgs)
+		co_return protocols::fs::Error::illegalArguments;
+	HEL_CHECK(error);
+	co_return length;
+}
+
 async::result<helix::BorrowedDescriptor>
 accessMemory(void *object) {
 	auto self = static_cast<ext2fs::OpenFile *>(object);
@@ -205,9 +269,21 @@ readEntries(void *object) {
 	co_return co_await self->readEntries();
 }
 
+async::result<protocols::fs::ReadResult>
+readDirents(void *object, void *buffer, size_t length) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+
+	protocols::ostrace::Event oste{&ostContext, ostReaddirEvent};
+	co_await oste.emit();
+
+	co_return co_await self->readDirents(buffer, length);
+}
+
 async::result<frg::expected<protocols::fs::Error>>
 truncate(void *object, size_t size) {
 	auto self = static_cast<ext2fs::OpenFile *>(object);
+	if(self->inode->fs.readOnly)
+		co_return protocols::fs::Error::readOnlyFileSystem;
 	co_await self->inode->fs.truncate(self->inode.get(), size);
 	co_return {};
 }
@@ -230,10 +306,15 @@ constexpr protocols::fs::FileOperations fileOperations {
 	.pread        = &pread,
 	.write        = &write,
 	.pwrite       = &pwrite,
+	.writeFromWindow = &writeFromWindow,
+	.pwriteFromWindow = &pwriteFromWindow,
 	.readEntries  = &readEntries,
+	.readDirents  = &readDirents,
 	.accessMemory = &accessMemory,
 	.truncate     = &truncate,
 	.flock        = &flock,
+	.rangeLock    = &rangeLock,
+	.testRangeLock = &testRangeLock,
 	.getFileFlags = &getFileFlags,
 	.setFileFlags = &setFileFlags,
 };
@@ -271,6 +352,9 @@ getLink(std::shared_ptr<void> object,
 async::result<protocols::fs::GetLinkResult> link(std::shared_ptr<void> object,
 		std::string name, int64_t ino) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	if(self->fs.readOnly)
+		co_return protocols::fs::GetLinkResult{nullptr, -1,
+				protocols::fs::FileType::unknown};
 	auto entry = co_await self->link(std::move(name), ino, kTypeRegular);
 	if(!entry)
 		co_return protocols::fs::GetLinkResult{nullptr, -1,
@@ -297,6 +381,8 @@ async::result<protocols::fs::GetLinkResult> link(std::shared_ptr<void> object,
 
 async::result<frg::expected<protocols::fs::Error>> unlink(std::shared_ptr<void> object, std::string name) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	if(self->fs.readOnly)
+		co_return protocols::fs::Error::readOnlyFileSystem;
 	auto result = co_await self->unlink(std::move(name));
 	if(!result) {
 		assert(result.error() == protocols::fs::Error::fileNotFound
@@ -349,15 +435,17 @@ open(std::shared_ptr<void> object, bool append) {
 	helix::UniqueLane local_pt, remote_pt;
 	std::tie(local_ctrl, remote_ctrl) = helix::createStream();
 	std::tie(local_pt, remote_pt) = helix::createStream();
-	struct timespec time;
-	// Use CLOCK_REALTIME when available
-	clock_gettime(CLOCK_MONOTONIC, &time);
-	self->diskInode()->atime = time.tv_sec;
-
-	auto syncInode = co_await helix_ng::synchronizeSpace(
-			helix::BorrowedDescriptor{kHelNullHandle},
-			self->diskMapping.get(), self->fs.inodeSize);
-	HEL_CHECK(syncInode.error());
+	if(!self->fs.readOnly) {
+		struct timespec time;
+		// Use CLOCK_REALTIME when available
+		clock_gettime(CLOCK_MONOTONIC, &time);
+		self->diskInode()->atime = time.tv_sec;
+
+		auto syncInode = co_await helix_ng::synchronizeSpace(
+				helix::BorrowedDescriptor{kHelNullHandle},
+				self->diskMapping.get(), self->fs.inodeSize);
+		HEL_CHECK(syncInode.error());
+	}
 
 	serve(file, std::move(local_ctrl), std::move(local_pt));
 
@@ -384,6 +472,8 @@ async::result<std::string> readSymlink(std::shared_ptr<void> object) {
 async::result<protocols::fs::MkdirResult>
 mkdir(std::shared_ptr<void> object, std::string name) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	if(self->fs.readOnly)
+		co_return protocols::fs::MkdirResult{nullptr, -1};
 	auto entry = co_await self->mkdir(std::move(name));
 
 	if(!entry)
@@ -396,6 +486,8 @@ mkdir(std::shared_ptr<void> object, std::string name) {
 async::result<protocols::fs::SymlinkResult>
 symlink(std::shared_ptr<void> object, std::string name, std::string target) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	if(self->fs.readOnly)
+		co_return protocols::fs::SymlinkResult{nullptr, -1};
 	auto entry = co_await self->symlink(std::move(name), std::move(target));
 
 	if(!entry)
@@ -407,6 +499,8 @@ symlink(std::shared_ptr<void> object, std::string name, std::string target) {
 
 async::result<protocols::fs::Error> chmod(std::shared_ptr<void> object, int mode) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	if(self->fs.readOnly)
+		co_return protocols::fs::Error::readOnlyFileSystem;
 	auto result = co_await self->chmod(mode);
 
 	co_return result;
@@ -414,6 +508,8 @@ async::result<protocols::fs::Error> chmod(std::shared_ptr<void> object, int mode
 
 async::result<protocols::fs::Error> utimensat(std::shared_ptr<void> object, uint64_t atime_sec, uint64_t atime_nsec, uint64_t mtime_sec, uint64_t mtime_nsec) {
 	auto self = std::static_pointer_cast<ext2fs::Inode>(object);
+	if(self->fs.readOnly)
+		co_return protocols::fs::Error::readOnlyFileSystem;
 	auto result = co_await self->utimensat(atime_sec, atime_nsec, mtime_sec, mtime_nsec);
 
 	co_return result;
@@ -517,24 +613,9 @@ async::result<protocols::fs::ReadResult> rawRead(void *object, const char *,
 	HEL_CHECK(helGetClock(&start));
 
 	auto self = static_cast<raw::OpenFile *>(object);
-	auto file_size = co_await self->rawFs->device->getSize();
-
-	if(self->offset >= file_size)
-		co_return size_t{0};
-
-	auto remaining = file_size - self->offset;
-	auto chunkSize = std::min(length, remaining);
-	if(!chunkSize)
-		co_return size_t{0}; // TODO: Return an explicit end-of-file error?
-
-	auto chunk_offset = self->offset;
+	auto chunkSize = co_await self->rawFs->read(self->offset, buffer, length);
 	self->offset += chunkSize;
 
-	auto readMemory = co_await helix_ng::readMemory(
-			helix::BorrowedDescriptor(self->rawFs->frontalMemory),
-			chunk_offset, chunkSize, buffer);
-	HEL_CHECK(readMemory.error());
-
 	uint64_t end;
 	HEL_CHECK(helGetClock(&end));
 
@@ -546,6 +627,14 @@ async::result<protocols::fs::ReadResult> rawRead(void *object, const char *,
 	co_return chunkSize;
 }
 
+async::result<protocols::fs::ReadResult> rawPread(void *object, int64_t offset, const char *,
+		void *buffer, size_t length) {
+	auto self = static_cast<raw::OpenFile *>(object);
+	if(offset < 0)
+		co_return protocols::fs::Error::illegalArguments;
+	co_return co_await self->rawFs->read(offset, buffer, length);
+}
+
 async::result<protocols::fs::Error> rawFlock(void *object, int flags) {
 	auto self = static_cast<raw::OpenFile*>(object);
 
@@ -599,6 +688,7 @@ constexpr protocols::fs::FileOperations rawOperations {
 	.seekRel = rawSeekRel,
 	.seekEof = rawSeekEof,
 	.read = rawRead,
+	.pread = rawPread,
 	.ioctl = rawIoctl,
 	.flock = rawFlock,
 };
@@ -608,7 +698,49 @@ constexpr protocols::fs::FileOperations rawOperations {
 BlockDevice::BlockDevice(size_t sector_size, int64_t parent_id)
 : size(0), sectorSize(sector_size), parentId(parent_id) { }
 
-async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition, std::unique_ptr<raw::RawFs> rawFs) {
+async::result<void> BlockDevice::submit(BlockRequest &request) {
+	if(request.op != BlockOp::read && request.op != BlockOp::write)
+		co_return;
+
+	auto sector = request.sector;
+	for(auto &segment : request.segments) {
+		if(request.op == BlockOp::read) {
+			co_await readSectors(sector, segment.buffer, segment.numSectors);
+		}else{
+			co_await writeSectors(sector, segment.buffer, segment.numSectors);
+		}
+		sector += segment.numSectors;
+	}
+}
+
+namespace {
+
+struct SubmitManyState {
+	size_t pending;
+	async::oneshot_event done;
+};
+
+async::detached runSubmission(BlockDevice *device, BlockRequest *request,
+		SubmitManyState *state) {
+	co_await device->submit(*request);
+	if(!--state->pending)
+		state->done.raise();
+}
+
+} // anonymous namespace
+
+async::result<void> BlockDevice::submitMany(std::span<BlockRequest> requests) {
+	if(requests.empty())
+		co_return;
+
+	SubmitManyState state{requests.size(), {}};
+	for(auto &request : requests)
+		runSubmission(this, &request, &state);
+	co_await state.done.wait();
+}
+
+async::detached servePartition(helix::UniqueLane lane, iostats::MonitoredDevice *partition,
+		std::unique_ptr<raw::RawFs> rawFs) {
 	std::cout << "unix device: Connection" << std::endl;
 
 	// TODO(qookie): Generic file system type
@@ -662,6 +794,17 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_node.error());
 		}else if(req.req_type() == managarm::fs::CntReqType::SB_CREATE_REGULAR) {
+			if(fs->readOnly) {
+				managarm::fs::SvrResponse resp;
+				resp.set_error(managarm::fs::Errors::READ_ONLY_FILE_SYSTEM);
+
+				auto ser = resp.SerializeAsString();
+				auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
+					helix_ng::sendBuffer(ser.data(), ser.size()));
+				HEL_CHECK(send_resp.error());
+				continue;
+			}
+
 			auto inode = co_await fs->createRegular(req.uid(), req.gid());
 
 			helix::UniqueLane local_lane, remote_lane;
@@ -697,6 +840,17 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 				break;
 			}
 
+			if(fs->readOnly) {
+				managarm::fs::SvrResponse resp;
+				resp.set_error(managarm::fs::Errors::READ_ONLY_FILE_SYSTEM);
+
+				auto ser = resp.SerializeAsString();
+				auto [send_resp] = co_await helix_ng::exchangeMsgs(conversation,
+					helix_ng::sendBuffer(ser.data(), ser.size()));
+				HEL_CHECK(send_resp.error());
+				continue;
+			}
+
 			auto oldInode = fs->accessInode(req->inode_source());
 			auto newInode = fs->accessInode(req->inode_target());
 
@@ -790,6 +944,18 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 			);
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_node.error());
+		}else if(preamble.id() == managarm::fs::GetIoStatsRequest::message_id) {
+			managarm::fs::GetIoStatsReply resp;
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			for(auto value : partition->stats().toVector())
+				resp.add_values(value);
+
+			auto [send_head, send_tail] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadTail(resp, frg::stl_allocator{})
+			);
+			HEL_CHECK(send_head.error());
+			HEL_CHECK(send_tail.error());
 		} else if(preamble.id() == managarm::fs::GenericIoctlRequest::message_id) {
 			auto req = bragi::parse_head_only<managarm::fs::GenericIoctlRequest>(recv_head);
 
@@ -823,17 +989,26 @@ async::detached servePartition(helix::UniqueLane lane, gpt::Partition *partition
 	}
 }
 
-async::detached runDevice(BlockDevice *device) {
+async::detached runDevice(BlockDevice *device, std::optional<SchedulerOptions> schedulerOptions) {
 	if (!tracingInitialized) {
 		ostContext = co_await protocols::ostrace::createContext();
 		ostReadEvent = co_await ostContext.announceEvent("libblockfs.read");
 		ostReaddirEvent = co_await ostContext.announceEvent("libblockfs.readdir");
 		ostByteCounter = co_await ostContext.announceItem("numBytes");
 		ostTimeCounter = co_await ostContext.announceItem("time");
+		co_await iostats::initTracing(&ostContext);
 
 		tracingInitialized = true;
 	}
 
+	// Partitions (and hence file systems) only see the scheduler.
+	// Like the table below, the scheduler is never deleted.
+	// Requests that the scheduler dispatches are traced separately from queued requests.
+	if(schedulerOptions)
+		device = new scheduler::Scheduler{
+				new iostats::MonitoredDevice{device, iostats::Stage::dispatch},
+				*schedulerOptions};
+
 	// TODO(qookie): Don't leak the table.
 	// Currently it should be fine to leak it since neither it nor
 	// the device gets deleted anyway.
@@ -875,8 +1050,15 @@ async::detached runDevice(BlockDevice *device) {
 
 		if(type == gpt::type_guids::managarmRootPartition)
 			printf("  It's a Managarm root partition!\n");
+		else if(type == gpt::type_guids::linuxSwap)
+			printf("  It's a swap partition!\n");
+
+		// File systems and raw files access the partition through a MonitoredDevice,
+		// which collects the statistics that we report to POSIX. Never deleted (like the table).
+		auto device = new iostats::MonitoredDevice{&table->getPartition(i), iostats::Stage::queue};
 
-		auto device = &table->getPartition(i);
+		if(type == gpt::type_guids::linuxSwap)
+			co_await swap::enableSwap(device);
 
 		auto rawFs = std::make_unique<raw::RawFs>(device);
 		co_await rawFs->init();
@@ -895,7 +1077,8 @@ async::detached runDevice(BlockDevice *device) {
 		auto entity = (co_await mbus_ng::Instance::global().createEntity(
 					"partition", descriptor)).unwrap();
 
-		[] (mbus_ng::EntityManager entity, gpt::Partition *partition, std::unique_ptr<raw::RawFs> rawFs) -> async::detached {
+		[] (mbus_ng::EntityManager entity, iostats::MonitoredDevice *partition,
+				std::unique_ptr<raw::RawFs> rawFs) -> async::detached {
 			while (true) {
 				auto [localLane, remoteLane] = helix::createStream();
 
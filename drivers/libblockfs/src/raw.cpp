@@ -1,15 +1,17 @@
+#include <algorithm>
+
 #include "raw.hpp"
 
 namespace blockfs {
 namespace raw {
 
-RawFs::RawFs(BlockDevice *device)
-: device{device} { }
+RawFs::RawFs(BlockDevice *device, bool readahead)
+: device{device}, readahead{readahead} { }
 
 async::result<void> RawFs::init() {
 	auto device_size = co_await device->getSize();
 	auto cache_size = (device_size + 0xFFF) & ~size_t(0xFFF);
-	HEL_CHECK(helCreateManagedMemory(cache_size, 0,
+	HEL_CHECK(helCreateManagedMemory(cache_size, readahead ? kHelManagedReadahead : 0,
 				&backingMemory, &frontalMemory));
 
 	manageMapping();
@@ -63,6 +65,26 @@ async::detached RawFs::manageMapping() {
 	}
 }
 
+async::result<size_t> RawFs::read(uint64_t offset, void *buffer, size_t length) {
+	auto device_size = co_await device->getSize();
+	if(offset >= device_size)
+		co_return 0;
+	auto chunk_size = std::min(length, device_size - offset);
+
+	// Since raw files are read-only, the page cache never contains newer data than the device.
+	if(!(offset % device->sectorSize) && !(chunk_size % device->sectorSize)) {
+		co_await device->readSectors(offset / device->sectorSize, buffer,
+				chunk_size / device->sectorSize);
+		co_return chunk_size;
+	}
+
+	auto readMemory = co_await helix_ng::readMemory(
+			helix::BorrowedDescriptor(frontalMemory),
+			offset, chunk_size, buffer);
+	HEL_CHECK(readMemory.error());
+	co_return chunk_size;
+}
+
 OpenFile::OpenFile(RawFs *rawFs)
 : rawFs(rawFs) { }
 
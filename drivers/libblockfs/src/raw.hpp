@@ -12,13 +12,20 @@ using FlockManager = protocols::fs::FlockManager;
 using Flock = protocols::fs::Flock;
 
 struct RawFs {
-	RawFs(BlockDevice *device);
+	// If readahead is set, the page cache reads ahead adjacent pages on fault.
+	RawFs(BlockDevice *device, bool readahead = false);
 
 	async::result<void> init();
 
 	async::detached manageMapping();
 
+	// Reads up to length bytes at offset; returns the number of bytes that were read.
+	// Sector-aligned reads are performed by the device directly into the buffer;
+	// other reads use the page cache.
+	async::result<size_t> read(uint64_t offset, void *buffer, size_t length);
+
 	BlockDevice *device;
+	bool readahead;
 	HelHandle backingMemory;
 	HelHandle frontalMemory;
 	helix::Mapping fileMapping;
@@ -0,0 +1,258 @@
+#include <assert.h>
+#include <iostream>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "scheduler.hpp"
+
+namespace blockfs {
+namespace scheduler {
+
+namespace {
+
+constexpr bool logStats = false;
+
+// Interval (in dispatched requests) between two dumps of the statistics.
+constexpr uint64_t statsInterval = 1024;
+
+uint64_t currentNanos() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+void dumpQueueStats(const char *name, const QueueStats &stats) {
+	std::cout << "libblockfs: scheduler " << name << ": queued " << stats.queued
+			<< ", dispatched " << stats.dispatched
+			<< ", merged " << stats.merged
+			<< ", expired " << stats.expired
+			<< ", wait " << stats.waitNanos / 1000 << " us" << std::endl;
+}
+
+} // anonymous namespace
+
+Scheduler::Scheduler(BlockDevice *device, SchedulerOptions options)
+: BlockDevice{device->sectorSize, device->parentId}, _device{device}, _options{options} {
+	assert(_options.maxInFlight);
+	size = device->size;
+	_reads.stats = &_stats.reads;
+	_writes.stats = &_stats.writes;
+
+	_dispatchLoop();
+}
+
+async::result<void> Scheduler::readSectors(uint64_t sector, void *buffer,
+		size_t num_sectors) {
+	BlockRequest request;
+	request.op = BlockOp::read;
+	request.sector = sector;
+	request.segments.push_back({buffer, num_sectors});
+	co_await submit(request);
+}
+
+async::result<void> Scheduler::writeSectors(uint64_t sector, const void *buffer,
+		size_t num_sectors) {
+	BlockRequest request;
+	request.op = BlockOp::write;
+	request.sector = sector;
+	request.segments.push_back({const_cast<void *>(buffer), num_sectors});
+	co_await submit(request);
+}
+
+async::result<size_t> Scheduler::getSize() {
+	return _device->getSize();
+}
+
+async::result<void> Scheduler::submit(BlockRequest &request) {
+	if(!_isQueued(request)) {
+		co_await _device->submit(request);
+		co_return;
+	}
+
+	Entry entry;
+	entry.request = &request;
+	_enqueue(&entry);
+	co_await entry.done.wait();
+}
+
+async::result<void> Scheduler::submitMany(std::span<BlockRequest> requests) {
+	// Queue everything first such that requests can be merged with each other.
+	std::vector<Entry> entries(requests.size());
+	for(size_t i = 0; i < requests.size(); i++) {
+		if(!_isQueued(requests[i]))
+			continue;
+		entries[i].request = &requests[i];
+		_enqueue(&entries[i]);
+	}
+
+	for(size_t i = 0; i < requests.size(); i++) {
+		if(entries[i].request) {
+			co_await entries[i].done.wait();
+		}else{
+			co_await _device->submit(requests[i]);
+		}
+	}
+}
+
+void Scheduler::_enqueue(Entry *entry) {
+	auto &queue = _queueFor(*entry->request);
+
+	entry->enqueueTime = currentNanos();
+	entry->sortedIt = queue.sorted.emplace(entry->request->sector, entry);
+	if(entry->request->flags & blockHighPriority) {
+		// Dispatch high priority requests as soon as possible.
+		entry->deadline = entry->enqueueTime;
+		entry->fifoIt = queue.fifo.insert(queue.fifo.begin(), entry);
+	}else{
+		entry->deadline = entry->enqueueTime + (entry->request->op == BlockOp::read
+				? _options.readDeadline : _options.writeDeadline);
+		entry->fifoIt = queue.fifo.insert(queue.fifo.end(), entry);
+	}
+	queue.stats->queued++;
+
+	_doorbell.raise();
+}
+
+void Scheduler::_remove(Queue &queue, Entry *entry) {
+	queue.sorted.erase(entry->sortedIt);
+	queue.fifo.erase(entry->fifoIt);
+	queue.stats->queued--;
+}
+
+auto Scheduler::_pick(uint64_t now) -> Entry * {
+	Queue *queue = nullptr;
+	Entry *entry = nullptr;
+
+	// The fronts of the FIFOs have the earliest deadlines.
+	for(auto candidate : {&_reads, &_writes}) {
+		if(candidate->fifo.empty() || candidate->fifo.front()->deadline > now)
+			continue;
+		queue = candidate;
+		entry = candidate->fifo.front();
+		queue->stats->expired++;
+		break;
+	}
+
+	if(!queue) {
+		if(_reads.fifo.empty()) {
+			queue = &_writes;
+		}else if(_writes.fifo.empty() || _starvedWrites < _options.writeStarvation) {
+			queue = &_reads;
+		}else{
+			queue = &_writes;
+		}
+
+		if(_options.rotational) {
+			// One-way elevator: continue after the previous request, then wrap around.
+			auto it = queue->sorted.lower_bound(_headPosition);
+			if(it == queue->sorted.end())
+				it = queue->sorted.begin();
+			entry = it->second;
+		}else{
+			entry = queue->fifo.front();
+		}
+	}
+
+	if(queue == &_writes) {
+		_starvedWrites = 0;
+	}else if(!_writes.fifo.empty()) {
+		_starvedWrites++;
+	}
+
+	return entry;
+}
+
+async::detached Scheduler::_dispatchLoop() {
+	while(true) {
+		if((_reads.fifo.empty() && _writes.fifo.empty())
+				|| _stats.inFlight >= _options.maxInFlight) {
+			co_await _doorbell.async_wait();
+			continue;
+		}
+
+		auto now = currentNanos();
+		auto first = _pick(now);
+		auto &queue = _queueFor(*first->request);
+		auto flags = first->request->flags;
+		_remove(queue, first);
+
+		std::vector<Entry *> entries{first};
+		uint64_t start = first->request->sector;
+		uint64_t end = start + first->request->numSectors();
+
+		auto canMerge = [&] (Entry *other) {
+			return other->request->flags == flags
+					&& end - start + other->request->numSectors() <= _options.maxMergeSectors;
+		};
+
+		// Merge entries that start where the current range ends.
+		while(true) {
+			auto it = queue.sorted.find(end);
+			if(it == queue.sorted.end() || !canMerge(it->second))
+				break;
+			auto other = it->second;
+			_remove(queue, other);
+			entries.push_back(other);
+			end += other->request->numSectors();
+		}
+
+		// Merge entries that end where the current range starts.
+		while(true) {
+			auto it = queue.sorted.lower_bound(start);
+			if(it == queue.sorted.begin())
+				break;
+			--it;
+			auto other = it->second;
+			if(other->request->sector + other->request->numSectors() != start
+					|| !canMerge(other))
+				break;
+			_remove(queue, other);
+			entries.insert(entries.begin(), other);
+			start = other->request->sector;
+		}
+
+		// Build the merged request. Segments that are adjacent in memory are combined.
+		BlockRequest request;
+		request.op = first->request->op;
+		request.flags = flags;
+		request.sector = start;
+		for(auto entry : entries) {
+			queue.stats->waitNanos += now - entry->enqueueTime;
+			for(auto &segment : entry->request->segments) {
+				if(!request.segments.empty()) {
+					auto &last = request.segments.back();
+					if(reinterpret_cast<char *>(last.buffer) + last.numSectors * sectorSize
+							== segment.buffer) {
+						last.numSectors += segment.numSectors;
+						continue;
+					}
+				}
+				request.segments.push_back(segment);
+			}
+		}
+
+		queue.stats->dispatched++;
+		queue.stats->merged += entries.size() - 1;
+		_headPosition = end;
+
+		if(logStats && !((_stats.reads.dispatched + _stats.writes.dispatched) % statsInterval)) {
+			dumpQueueStats("reads", _stats.reads);
+			dumpQueueStats("writes", _stats.writes);
+		}
+
+		_stats.inFlight++;
+		_dispatch(std::move(request), std::move(entries));
+	}
+}
+
+async::detached Scheduler::_dispatch(BlockRequest request, std::vector<Entry *> entries) {
+	co_await _device->submit(request);
+
+	_stats.inFlight--;
+	for(auto entry : entries)
+		entry->done.raise();
+	_doorbell.raise();
+}
+
+} } // namespace blockfs::scheduler
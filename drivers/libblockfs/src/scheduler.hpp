@@ -0,0 +1,116 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
+
+#include <blockfs.hpp>
+
+namespace blockfs {
+namespace scheduler {
+
+struct QueueStats {
+	// Requests that are waiting to be dispatched.
+	size_t queued = 0;
+	// Requests that were passed to the device (after merging).
+	uint64_t dispatched = 0;
+	// Requests that were merged into other requests.
+	uint64_t merged = 0;
+	// Requests that were dispatched because their deadline expired.
+	uint64_t expired = 0;
+	// Total time that requests spent waiting for dispatch, in nanoseconds.
+	uint64_t waitNanos = 0;
+};
+
+struct Stats {
+	QueueStats reads;
+	QueueStats writes;
+	// Requests that were dispatched to the device but did not complete yet.
+	size_t inFlight = 0;
+};
+
+// --------------------------------------------------------
+// Scheduler
+// --------------------------------------------------------
+
+// Sits between the file systems and the BlockDevice of a disk.
+// Reads are considered synchronous (i.e., a client waits for them) while writes are
+// considered to be writeback; hence, reads are preferred unless writes hit their deadline.
+// Flushes and discards bypass the scheduler.
+struct Scheduler final : BlockDevice {
+	Scheduler(BlockDevice *device, SchedulerOptions options);
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override;
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override;
+
+	async::result<size_t> getSize() override;
+
+	async::result<void> submit(BlockRequest &request) override;
+
+	async::result<void> submitMany(std::span<BlockRequest> requests) override;
+
+	const Stats &stats() {
+		return _stats;
+	}
+
+private:
+	struct Entry;
+
+	struct Queue {
+		QueueStats *stats;
+		// Queued entries, ordered by sector.
+		std::multimap<uint64_t, Entry *> sorted;
+		// Queued entries, ordered by deadline.
+		std::list<Entry *> fifo;
+	};
+
+	struct Entry {
+		BlockRequest *request = nullptr;
+		uint64_t enqueueTime = 0;
+		uint64_t deadline = 0;
+		std::multimap<uint64_t, Entry *>::iterator sortedIt;
+		std::list<Entry *>::iterator fifoIt;
+		async::oneshot_event done;
+	};
+
+	static bool _isQueued(const BlockRequest &request) {
+		return (request.op == BlockOp::read || request.op == BlockOp::write)
+				&& request.numSectors();
+	}
+
+	Queue &_queueFor(const BlockRequest &request) {
+		return request.op == BlockOp::read ? _reads : _writes;
+	}
+
+	void _enqueue(Entry *entry);
+	void _remove(Queue &queue, Entry *entry);
+
+	// Determines the entry that is dispatched next.
+	Entry *_pick(uint64_t now);
+
+	async::detached _dispatchLoop();
+	async::detached _dispatch(BlockRequest request, std::vector<Entry *> entries);
+
+	BlockDevice *_device;
+	SchedulerOptions _options;
+	Stats _stats;
+	Queue _reads;
+	Queue _writes;
+
+	// Raised when entries are queued and when dispatched requests complete.
+	async::recurring_event _doorbell;
+
+	// Sector following the previously dispatched request.
+	uint64_t _headPosition = 0;
+
+	// Number of consecutive read batches that were dispatched while writes were waiting.
+	unsigned int _starvedWrites = 0;
+};
+
+} } // namespace blockfs::scheduler
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "raw.hpp"
+#include "swap.hpp"
+
+namespace blockfs {
+namespace swap {
+
+namespace {
+
+constexpr size_t pageSize = 0x1000;
+
+// The swap header occupies the first page of the partition.
+struct SwapHeader {
+	uint8_t bootBits[1024];
+	uint32_t version;
+	// Index of the last usable page.
+	uint32_t lastPage;
+	uint32_t numBadPages;
+	uint8_t uuid[16];
+	char volumeName[16];
+};
+
+// The signature is stored in the last bytes of the first page.
+constexpr const char signature[] = "SWAPSPACE2";
+constexpr size_t signatureSize = sizeof(signature) - 1;
+
+} // anonymous namespace
+
+async::result<bool> enableSwap(BlockDevice *device) {
+	auto deviceSize = co_await device->getSize();
+	if(deviceSize < 2 * pageSize || pageSize % device->sectorSize)
+		co_return false;
+
+	std::vector<uint8_t> page(pageSize);
+	co_await device->readSectors(0, page.data(), pageSize / device->sectorSize);
+	if(memcmp(page.data() + pageSize - signatureSize, signature, signatureSize)) {
+		printf("libblockfs: Swap partition does not contain a swap header\n");
+		co_return false;
+	}
+
+	SwapHeader header;
+	memcpy(&header, page.data(), sizeof(SwapHeader));
+	if(header.version != 1 || header.numBadPages) {
+		printf("libblockfs: Unsupported swap header (version %u, %u bad pages)\n",
+				header.version, header.numBadPages);
+		co_return false;
+	}
+
+	size_t numPages = std::min(size_t{header.lastPage} + 1, deviceSize / pageSize);
+	if(numPages < 2)
+		co_return false;
+
+	// Swap uses a page cache of its own that reads ahead on fault. The kernel assigns
+	// consecutive slots to pages that are swapped out together; hence, readahead
+	// usually fetches the pages that are faulted in next.
+	// Like the partition table, this is never deleted.
+	auto swapFs = new raw::RawFs{device, true};
+	co_await swapFs->init();
+
+	auto error = helEnableSwap(swapFs->frontalMemory, numPages);
+	if(error == kHelErrIllegalState) {
+		printf("libblockfs: Ignoring swap partition, swap is already enabled\n");
+		co_return false;
+	}
+	HEL_CHECK(error);
+
+	printf("libblockfs: Enabled swap partition of %zu KiB\n", (numPages - 1) * (pageSize / 1024));
+	co_return true;
+}
+
+} // namespace swap
+} // namespace blockfs
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <async/result.hpp>
+#include <blockfs.hpp>
+
+namespace blockfs {
+namespace swap {
+
+// Enables swapping of anonymous memory to a Linux-compatible swap partition
+// (i.e., one that was formatted by mkswap). Returns false if the partition does not
+// contain a usable swap header or if the kernel already uses another swap partition.
+async::result<bool> enableSwap(BlockDevice *device);
+
+} // namespace swap
+} // namespace blockfs
@@ -88,6 +88,11 @@ private:
 
 	std::deque<PendingEvent> _pending;
 	bool _overflow = false;
+
+	// Number of events of the last frame in _pending and whether
+	// subsequent motion-only frames may be merged into it.
+	size_t _lastFrameSize = 0;
+	bool _lastFrameMergeable = false;
 };
 
 struct EventDevice {
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <deque>
 #include <iostream>
+#include <optional>
 
 #include <async/result.hpp>
 #include <async/oneshot-event.hpp>
@@ -35,6 +36,28 @@ constexpr bool isMultitouchCode(int code) {
 	return code >= ABS_MT_FIRST && code <= ABS_MT_LAST;
 }
 
+// If a reader falls behind by more than this many events, we merge motion-only frames.
+constexpr size_t compressThreshold = 256;
+// If a reader falls behind by more than this many events, we drop all of them (SYN_DROPPED).
+constexpr size_t overflowThreshold = 1024;
+
+// Complete frames that only consist of relative motion and (non-multitouch) absolute axes
+// can be merged without losing any state.
+bool isMotionOnly(const std::vector<StagedEvent> &frame) {
+	if(frame.empty() || frame.back().type != EV_SYN || frame.back().code != SYN_REPORT)
+		return false;
+	for(auto &evt : frame) {
+		if(evt.type == EV_SYN && evt.code == SYN_REPORT)
+			continue;
+		if(evt.type == EV_REL)
+			continue;
+		if(evt.type == EV_ABS && !isMultitouchCode(evt.code))
+			continue;
+		return false;
+	}
+	return true;
+}
+
 async::detached issueReset() {
 	auto filter = mbus_ng::Conjunction{{
 		mbus_ng::EqualsFilter{"class", "pm-interface"}
@@ -115,6 +138,7 @@ File::read(void *object, const char *, void *buffer, size_t max_size) {
 		// Reset the overflow flag.
 		self->_pending.clear();
 		self->_overflow = false;
+		self->_lastFrameMergeable = false;
 
 		co_return sizeof(input_event);
 	}else{
@@ -125,6 +149,9 @@ File::read(void *object, const char *, void *buffer, size_t max_size) {
 			self->_pending.pop_front();
 			if(self->_pending.empty())
 				self->_statusPage.update(self->_currentSeq, 0);
+			// Do not merge into frames that were already partially read.
+			if(self->_pending.size() < self->_lastFrameSize)
+				self->_lastFrameMergeable = false;
 
 			input_event uev;
 			memset(&uev, 0, sizeof(input_event));
@@ -521,18 +548,37 @@ void EventDevice::emitEvent(int type, int code, int value) {
 }
 
 void EventDevice::notify() {
-	if(_staged.empty())
+	// Do not wake up readers for frames that only consist of SYN_REPORTs, i.e., if
+	// emitEvent() filtered out all other events (e.g., mice that report zero motion).
+	bool empty = std::ranges::all_of(_staged, [] (const StagedEvent &evt) {
+		return evt.type == EV_SYN && evt.code == SYN_REPORT;
+	});
+	if(empty) {
+		_staged.clear();
 		return;
+	}
+
+	bool motionOnly = isMotionOnly(_staged);
+
+	// Timestamps are only queried once per clock.
+	std::optional<struct timespec> realtimeNow, monotonicNow;
+	auto getNow = [&] (int clockId) -> struct timespec {
+		auto &now = (clockId == CLOCK_REALTIME) ? realtimeNow : monotonicNow;
+		if(!now) {
+			now.emplace();
+			if(clock_gettime(clockId, &now.value()))
+				throw std::runtime_error("clock_gettime() failed");
+		}
+		return *now;
+	};
 
 	for(auto &file : _files) {
 		if(file._overflow)
 			continue;
 
-		struct timespec now;
-		if(clock_gettime(file._clockId, &now))
-			throw std::runtime_error("clock_gettime() failed");
+		auto now = getNow(file._clockId);
 
-		if(file._pending.size() > 1024) {
+		if(file._pending.size() > overflowThreshold) {
 			file._overflow = true;
 			continue;
 		}
@@ -543,8 +589,42 @@ void EventDevice::notify() {
 						<< "] Event type: " << evt.type << ", code: " << evt.code
 						<< ", value: " << evt.value << std::endl;
 
+		// Under backpressure, merge motion into the last frame instead of queueing more events.
+		// Relative axes are accumulated, absolute axes are replaced. The reader is
+		// already woken up since the last frame is still pending.
+		if(motionOnly && file._lastFrameMergeable
+				&& file._pending.size() > compressThreshold) {
+			auto frameBegin = file._pending.end() - file._lastFrameSize;
+			for(StagedEvent evt : _staged) {
+				if(evt.type == EV_SYN)
+					continue;
+				auto it = std::find_if(frameBegin, file._pending.end(),
+						[&] (const PendingEvent &pending) {
+					return pending.type == evt.type && pending.code == evt.code;
+				});
+				if(it != file._pending.end()) {
+					if(evt.type == EV_REL) {
+						it->value += evt.value;
+					}else{
+						it->value = evt.value;
+					}
+				}else{
+					// Insert before the final SYN_REPORT.
+					file._pending.insert(file._pending.end() - 1,
+							PendingEvent{evt.type, evt.code, evt.value, now});
+					file._lastFrameSize++;
+					frameBegin = file._pending.end() - file._lastFrameSize;
+				}
+			}
+			for(auto it = frameBegin; it != file._pending.end(); ++it)
+				it->timestamp = now;
+			continue;
+		}
+
 		for(StagedEvent evt : _staged)
 			file._pending.push_back(PendingEvent{evt.type, evt.code, evt.value, now});
+		file._lastFrameSize = _staged.size();
+		file._lastFrameMergeable = motionOnly;
 		file._currentSeq++;
 		file._statusPage.update(file._currentSeq, EPOLLIN);
 		file._statusBell.raise();
@@ -24,12 +24,25 @@ enum Color {
 struct Attribute {
 	Color fgColor = kColorWhite;
 	Color bgColor = kColorBlack;
+
+	bool operator== (const Attribute &other) const {
+		return fgColor == other.fgColor && bgColor == other.bgColor;
+	}
 };
 
+// The display is expected to start out blank (i.e., filled with spaces).
 struct Display {
 	virtual void setChar(int x, int y, char c, Attribute attribute) = 0;
 	virtual void setCursor(int x, int y) = 0;
 
+	// Moves the contents of the display up by the given number of lines.
+	// Returns false if the display cannot do that; the Emulator then redraws
+	// all cells that changed instead.
+	virtual bool scrollUp(int lines) {
+		(void)lines;
+		return false;
+	}
+
 	int width = 50;
 	int height = 10;
 };
@@ -43,7 +56,9 @@ struct Emulator {
 		kStatusCsi
 	};
 
+	// Only forwards the character to the display if the cell actually changes.
 	void setChar(int x, int y, char c, Attribute attribute);
+	void scrollUp();
 	void handleControlSeq(char character);
 	void handleCsi(char character);
 	void printChar(char character);
@@ -12,14 +12,39 @@ Emulator::Emulator(Display *display) {
 
 	chars = new char[width * height];
 	attributes = new Attribute[width * height];
+	memset(chars, ' ', width * height);
 }
 
 void Emulator::setChar(int x, int y, char c, Attribute attribute) {
-	attributes[y * x + x] = attribute;
-	chars[y * x + x] = c;
+	if(x < 0 || x >= width || y < 0 || y >= height)
+		return;
+
+	auto i = y * width + x;
+	if(chars[i] == c && attributes[i] == attribute)
+		return;
+	attributes[i] = attribute;
+	chars[i] = c;
 	display->setChar(x, y, c, attribute);
 }
 
+void Emulator::scrollUp() {
+	Attribute blank;
+	if(display->scrollUp(1)) {
+		memmove(chars, chars + width, width * (height - 1));
+		memmove(attributes, attributes + width, sizeof(Attribute) * width * (height - 1));
+		// We do not know what the display left in the last line; force an update.
+		memset(chars + (height - 1) * width, 0, width);
+	}else{
+		// Row i is only overwritten after row i - 1 has been updated.
+		for(int i = 1; i < height; i++)
+			for(int j = 0; j < width; j++)
+				setChar(j, i - 1, chars[i * width + j], attributes[i * width + j]);
+	}
+
+	for(int j = 0; j < width; j++)
+		setChar(j, height - 1, ' ', blank);
+}
+
 void Emulator::handleControlSeq(char character) {
 	if(character == 'A') {
 		int n = 1;
@@ -266,18 +291,7 @@ void Emulator::printChar(char character) {
 			}
 		}
 		if(cursorY >= height) {
-			for(int i = 1; i < height; i++) {
-				for(int j = 0; j < width; j++) {
-					char moved_char = chars[j * width + width];
-					Attribute moved_attribute = attributes[j * width + width];
-					setChar(j, i - 1, moved_char, moved_attribute);
-				}
-			}
-			for(int j = 0; j < width; j++) {
-				Attribute attribute;
-				attribute.fgColor = kColorWhite;
-				setChar(j, height - 1, ' ', attribute);
-			}
+			scrollUp();
 			cursorY = height - 1;
 		}
 		display->setCursor(cursorX, cursorY);
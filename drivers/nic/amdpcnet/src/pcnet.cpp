@@ -15,7 +15,9 @@
 #include <protocols/hw/client.hpp>
 #include <netserver/nic.hpp>
 #include <core/queue.hpp>
+#include <algorithm>
 #include <queue>
+#include <span>
 #include <string.h>
 
 // debug options
@@ -99,15 +101,29 @@ struct PcNetQueue {
 	void init(PcNetNic& nic);
 };
 
+// A call to receiveBatch() that waits for frames.
+struct RxBatch {
+	async::oneshot_event event;
+	std::span<nic::RxFrame> frames;
+	size_t count = 0;
+};
+
 struct PcNetNic : nic::Link {
 	PcNetNic(protocols::hw::Device dev);
 	virtual async::result<size_t> receive(arch::dma_buffer_view);
 	virtual async::result<void> send(const arch::dma_buffer_view);
+	virtual async::result<size_t> receiveBatch(std::span<nic::RxFrame>);
+	virtual async::result<void> sendBatch(std::span<const arch::dma_buffer_view>);
 	virtual ~PcNetNic() = default;
 
 	async::result<void> init();
 	async::detached processIrqs();
 protected:
+	// Moves received frames from the RX ring to the pending batches.
+	void drainRx();
+	// Gives a frame to the device, without demanding transmission.
+	std::shared_ptr<Request> queueTransmit(const arch::dma_buffer_view frame);
+
 	async::result<uint32_t> pollDevice();
 	uint32_t csr_read(uint32_t n);
 	void csr_write(uint32_t n, uint32_t m);
@@ -123,6 +139,7 @@ protected:
 	arch::dma_buffer initializer_;
 	PcNetQueue<true> tx_;
 	PcNetQueue<false> rx_;
+	std::queue<RxBatch *> rxBatches_;
 };
 
 template<bool IsTransmit>
@@ -291,24 +308,81 @@ async::result<uint32_t> PcNetNic::pollDevice() {
 }
 
 async::result<size_t> PcNetNic::receive(arch::dma_buffer_view frame) {
+	nic::RxFrame rx;
+	co_await receiveBatch({&rx, 1});
+	auto size = std::min(rx.length, frame.size());
+	memcpy(frame.data(), rx.buffer.data(), size);
+	co_return size;
+}
+
+async::result<size_t> PcNetNic::receiveBatch(std::span<nic::RxFrame> frames) {
 	if(logDriverStuff)
-		std::cout << "drivers/pcnet: receive() -> " << frame.size() << std::endl;
-	
-	auto req = std::make_shared<Request>(rx_.descriptor_count);
-	req->frame = frame;
-	req->index = rx_.next_index;
-	assert(rx_.buffers[req->index].size() > frame.size());
-	memset(rx_.buffers[req->index].data(), 0, frame.size());
-	rx_.requests.push_back(req);
-	++rx_.next_index;
-	co_await req->event.wait();
-	co_return frame.size();
+		std::cout << "drivers/pcnet: receiveBatch() -> " << frames.size() << std::endl;
+
+	RxBatch batch{.frames = frames};
+	rxBatches_.push(&batch);
+	// Frames may have arrived before the batch was queued.
+	drainRx();
+	co_await batch.event.wait();
+	co_return batch.count;
+}
+
+void PcNetNic::drainRx() {
+	while(!rxBatches_.empty()) {
+		auto batch = rxBatches_.front();
+
+		while(batch->count < batch->frames.size()) {
+			auto i = rx_.next_index();
+			if((rx_.descriptors[i].status & 0x8000) != 0) //owned by card
+				break;
+			if(logDriverStuff)
+				std::cout << "drivers/pcnet: RX descriptor @ " << i << "!!!" << std::endl;
+
+			auto size = rx_.descriptors[i].msg_length;
+			auto &frame = batch->frames[batch->count++];
+			frame.buffer = arch::dma_buffer(dmaPool(), size);
+			frame.length = size;
+			frame.meta = {};
+			memcpy(frame.buffer.data(), rx_.buffers[i].data(), size); //steal - erm... "borrow" the data
+			rx_.descriptors[i].status = 0x8000; //give device back the buffer
+			++rx_.next_index;
+		}
+
+		if(!batch->count)
+			break;
+
+		rxBatches_.pop();
+		batch->event.raise();
+	}
 }
 
 async::result<void> PcNetNic::send(const arch::dma_buffer_view frame) {
+	co_await sendBatch({&frame, 1});
+}
+
+async::result<void> PcNetNic::sendBatch(std::span<const arch::dma_buffer_view> frames) {
 	if(logDriverStuff)
-		std::cout << "drivers/pcnet: send() -> " << frame.size() << std::endl;
+		std::cout << "drivers/pcnet: sendBatch() -> " << frames.size() << std::endl;
+
+	std::shared_ptr<Request> req;
+	for(auto &frame : frames) {
+		// If the ring is full, wait for the oldest frame (i.e., the next descriptor) first.
+		while(tx_.requests.size() == tx_.descriptor_count) {
+			auto oldest = tx_.requests.front();
+			csr_write(0, (1 << 3) | (1 << 6)); // TDMD -- demand transmission
+			co_await oldest->event.wait();
+		}
+		req = queueTransmit(frame);
+	}
+	if(!req)
+		co_return;
 
+	// Demand transmission once for the entire batch, instead of waiting for the device to poll.
+	csr_write(0, (1 << 3) | (1 << 6));
+	co_await req->event.wait();
+}
+
+std::shared_ptr<Request> PcNetNic::queueTransmit(const arch::dma_buffer_view frame) {
 	auto req = std::make_shared<Request>(tx_.descriptor_count);
 	req->frame = frame;
 	req->index = tx_.next_index;
@@ -321,7 +395,7 @@ async::result<void> PcNetNic::send(const arch::dma_buffer_view frame) {
 	__sync_synchronize();
 	tx_.requests.push_back(req);
 	++tx_.next_index;
-	co_await req->event.wait();
+	return req;
 }
 
 async::detached PcNetNic::processIrqs() {
@@ -349,20 +423,7 @@ async::detached PcNetNic::processIrqs() {
 			if(logDriverStuff)
 				std::cout << "drivers/pcnet: IRQ-RINT" << std::endl;
 			
-			for(uint32_t i = 0; i < rx_.requests.size(); i++) {
-				auto req = rx_.requests[i];
-				if((rx_.descriptors[req->index].status & 0x8000) != 0) //owned by card
-					continue;
-				if(logDriverStuff)
-					std::cout << "drivers/pcnet: RX request @ " << req->index << "!!!" << std::endl;
-
-				auto size = rx_.descriptors[req->index].msg_length;
-				memcpy(req->frame.data(), rx_.buffers[req->index].data(), size); //steal - erm... "borrow" the data
-				req->frame = req->frame.subview(0, size);
-				rx_.descriptors[req->index].status = 0x8000; //give device back the buffer
-				req->event.raise();
-				rx_.requests.erase(rx_.requests.begin() + i);
-			}
+			drainRx();
 			new_csr0 |= (1 << 10); //mask off RINT
 		}
 		// Handle transmits
@@ -370,10 +431,12 @@ async::detached PcNetNic::processIrqs() {
 			if(logDriverStuff)
 				std::cout << "drivers/pcnet: IRQ-TINT" << std::endl;
 			
-			for(uint32_t i = 0; i < tx_.requests.size(); i++) {
+			for(uint32_t i = 0; i < tx_.requests.size();) {
 				auto req = tx_.requests[i];
-				if((tx_.descriptors[req->index].status & 0x8000) != 0) //still owned by card
+				if((tx_.descriptors[req->index].status & 0x8000) != 0) { //still owned by card
+					i++;
 					continue;
+				}
 				if(logDriverStuff)
 					std::cout << "drivers/pcnet: TX request @ " << req->index << "!!!" << std::endl;
 				
@@ -40,6 +40,9 @@ struct E1000Nic : nic::Link {
 
 	async::result<size_t> receive(arch::dma_buffer_view) override;
 	async::result<void> send(const arch::dma_buffer_view) override;
+	async::result<size_t> receiveBatch(std::span<nic::RxFrame>) override;
+	async::result<void> sendBatch(std::span<const arch::dma_buffer_view>) override;
+	async::result<void> sendOffloaded(const arch::dma_buffer_view, const nic::TxMetadata &) override;
 
 	async::result<void> init();
 
@@ -57,8 +60,14 @@ private:
 	void em_eth_rx_ack();
 	void em_rxd_setup();
 	void reap_tx_buffers();
+	// Fills the next TX descriptor and returns it; the caller writes TDT.
+	struct e1000_tx_desc *queue_tx_buffer(const arch::dma_buffer_view buf, u32 cmd = 0);
 
 	bool eth_rx_pop();
+	// Returns true if the NIC wrote back descriptors that we did not pop yet.
+	bool rx_pending();
+	// Masks RX interrupts while frames are pending, see processIrqs().
+	void update_rx_polling();
 
 	int setPromiscuousMode(struct e1000_hw *hw, int flags);
 
@@ -80,6 +89,7 @@ private:
 	arch::dma_array<DescriptorSpace> _txdbuf;
 
 	std::queue<Request *> _requests;
+	bool _rxPolling = false;
 
 public:
 	struct e1000_hw _hw;
@@ -3,10 +3,13 @@
 #include <async/oneshot-event.hpp>
 #include <arch/dma_structs.hpp>
 #include <core/queue.hpp>
+#include <netserver/nic.hpp>
+#include <span>
 #include <stddef.h>
 
 struct Request {
 	async::oneshot_event event;
-	arch::dma_buffer_view frame;
-	size_t size;
+	std::span<nic::RxFrame> frames;
+	// Number of frames that were received.
+	size_t count = 0;
 };
@@ -24,10 +24,10 @@ async::detached E1000Nic::processIrqs() {
 		if(status & (E1000_ICR_TXQE | E1000_ICR_TXDW))
 			status &= ~(E1000_ICR_TXQE | E1000_ICR_TXDW);
 
-		if(status & E1000_ICR_RXT0) {
-			printf("e1000: handling packet RX irq\n");
+		if(status & (E1000_ICR_RXT0 | E1000_ICR_RXDMT0)) {
 			while(eth_rx_pop());
-			status &= ~E1000_ICR_RXT0;
+			update_rx_polling();
+			status &= ~(E1000_ICR_RXT0 | E1000_ICR_RXDMT0);
 		}
 
 		status &= ~E1000_ICR_INT_ASSERTED;
@@ -96,6 +96,12 @@ async::result<void> E1000Nic::init() {
 	else
 		type = NicType::Lem;
 
+	// The legacy descriptors that we use support checksum offloading since the 82543.
+	// TSO is not supported as frames are copied into 2048 byte TX buffers;
+	// netserver segments super-segments in software.
+	if(_hw.mac.type >= e1000_82543)
+		offloads_ = nic::OFFLOAD_TX_CSUM | nic::OFFLOAD_RX_CSUM;
+
 	/*
 	 * For ICH8 and family we need to
 	 * map the flash memory, and this
@@ -212,30 +218,71 @@ fail:
 }
 
 async::result<size_t> E1000Nic::receive(arch::dma_buffer_view frame) {
-	Request req{.frame = frame};
+	nic::RxFrame rx;
+	co_await receiveBatch({&rx, 1});
+	assert(rx.length <= frame.size());
+	memcpy(frame.data(), rx.buffer.data(), rx.length);
+	co_return rx.length;
+}
+
+async::result<size_t> E1000Nic::receiveBatch(std::span<nic::RxFrame> frames) {
+	Request req{.frames = frames};
 	_requests.push(&req);
 
 	eth_rx_pop();
+	update_rx_polling();
 
 	co_await req.event.wait();
 
-	co_return req.size;
+	co_return req.count;
 }
 
-async::result<void> E1000Nic::send(const arch::dma_buffer_view buf) {
+struct e1000_tx_desc *E1000Nic::queue_tx_buffer(const arch::dma_buffer_view buf, u32 cmd) {
 	reap_tx_buffers();
 
 	memcpy(&_txdbuf[_txIndex], buf.data(), buf.size());
 	struct e1000_tx_desc* desc = &_txd[_txIndex];
-	desc->lower.data = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS | buf.size();
+	desc->lower.data = E1000_TXD_CMD_EOP | E1000_TXD_CMD_IFCS | E1000_TXD_CMD_RS | cmd | buf.size();
 
 	++_txIndex;
+	return desc;
+}
+
+async::result<void> E1000Nic::send(const arch::dma_buffer_view buf) {
+	queue_tx_buffer(buf);
 	E1000_WRITE_REG(&_hw, E1000_TDT(0), _txIndex);
 
 	// TODO(no92): decide whether returning without waiting for the TX IRQ is optimal
 	co_return;
 }
 
+async::result<void> E1000Nic::sendBatch(std::span<const arch::dma_buffer_view> frames) {
+	for(auto &buf : frames)
+		queue_tx_buffer(buf);
+
+	// Only write the tail once per batch.
+	E1000_WRITE_REG(&_hw, E1000_TDT(0), _txIndex);
+	co_return;
+}
+
+async::result<void> E1000Nic::sendOffloaded(const arch::dma_buffer_view buf,
+		const nic::TxMetadata &meta) {
+	// The CSS and CSO fields of legacy descriptors are only 8 bits wide.
+	if(meta.gsoSize || !meta.needsChecksum || !(offloads_ & nic::OFFLOAD_TX_CSUM)
+			|| meta.csumStart + meta.csumOffset > 0xFF) {
+		co_await nic::Link::sendOffloaded(buf, meta);
+		co_return;
+	}
+
+	// The NIC sums from CSS to the end of the frame and inserts the checksum at CSO.
+	auto desc = queue_tx_buffer(buf, E1000_TXD_CMD_IC);
+	desc->lower.flags.cso = meta.csumStart + meta.csumOffset;
+	desc->upper.fields.css = meta.csumStart;
+
+	E1000_WRITE_REG(&_hw, E1000_TDT(0), _txIndex);
+	co_return;
+}
+
 async::result<void> E1000Nic::identifyHardware() {
 	_hw.vendor_id = co_await _device.loadPciSpace(0, 2);
 	_hw.device_id = co_await _device.loadPciSpace(2, 2);
@@ -53,49 +53,94 @@ void E1000Nic::em_rxd_setup() {
 }
 
 bool E1000Nic::eth_rx_pop() {
-	if(_requests.empty()) {
-		printf("e1000: no requests queued\n");
+	if(_requests.empty())
 		return false;
-	}
 
 	auto req = _requests.front();
 	assert(req);
 
-	if(_hw.mac.type >= em_mac_min) {
-		union e1000_rx_desc_extended* desc = (union e1000_rx_desc_extended*) &_rxd[_rxIndex];
-
-		if(!(desc->wb.upper.status_error & E1000_RXD_STAT_DD)) {
-			return false;
-		}
-
-		memcpy(req->frame.data(), &_rxdbuf[_rxIndex], desc->wb.upper.length);
-		req->size = desc->wb.upper.length;
-
-		em_eth_rx_ack();
-	} else {
-		struct e1000_rx_desc* desc = &_rxd[_rxIndex];
-
-		if(!(desc->status & E1000_RXD_STAT_DD)) {
-			return false;
+	size_t n = 0;
+	uint32_t last_index = 0;
+	while(n < req->frames.size()) {
+		auto &frame = req->frames[n];
+
+		if(_hw.mac.type >= em_mac_min) {
+			union e1000_rx_desc_extended* desc = (union e1000_rx_desc_extended*) &_rxd[_rxIndex];
+
+			if(!(desc->wb.upper.status_error & E1000_RXD_STAT_DD)) {
+				break;
+			}
+
+			frame.length = desc->wb.upper.length;
+			frame.buffer = arch::dma_buffer{dmaPool(), frame.length};
+			memcpy(frame.buffer.data(), &_rxdbuf[_rxIndex], frame.length);
+			auto status = desc->wb.upper.status_error;
+			frame.meta.checksumValid = (status & (E1000_RXD_STAT_TCPCS | E1000_RXD_STAT_UDPCS))
+				&& !(status & E1000_RXDEXT_STATERR_TCPE);
+
+			em_eth_rx_ack();
+		} else {
+			struct e1000_rx_desc* desc = &_rxd[_rxIndex];
+
+			if(!(desc->status & E1000_RXD_STAT_DD)) {
+				break;
+			}
+
+			// copy out packet
+			frame.length = desc->length;
+			frame.buffer = arch::dma_buffer{dmaPool(), frame.length};
+			memcpy(frame.buffer.data(), &_rxdbuf[_rxIndex], frame.length);
+			frame.meta.checksumValid = !(desc->status & E1000_RXD_STAT_IXSM)
+				&& (desc->status & (E1000_RXD_STAT_TCPCS | E1000_RXD_STAT_UDPCS))
+				&& !(desc->errors & E1000_RXD_ERR_TCPE);
+
+			desc->status = 0;
 		}
 
-		// copy out packet
-		memcpy(req->frame.data(), &_rxdbuf[_rxIndex], desc->length);
-		req->size = desc->length;
-
-		desc->status = 0;
+		last_index = _rxIndex();
+		++_rxIndex;
+		n++;
 	}
 
-	E1000_WRITE_REG(&_hw, E1000_RDT(0), _rxIndex());
-	++_rxIndex;
+	if(!n)
+		return false;
+
+	// Return all descriptors of this batch to the NIC at once.
+	E1000_WRITE_REG(&_hw, E1000_RDT(0), last_index);
 
 	_requests.pop();
 
+	req->count = n;
 	req->event.raise();
 
 	return true;
 }
 
+bool E1000Nic::rx_pending() {
+	if(_hw.mac.type >= em_mac_min) {
+		union e1000_rx_desc_extended* desc = (union e1000_rx_desc_extended*) &_rxd[_rxIndex];
+		return desc->wb.upper.status_error & E1000_RXD_STAT_DD;
+	}
+	return _rxd[_rxIndex].status & E1000_RXD_STAT_DD;
+}
+
+/* Receive interrupts are masked while frames are pending (i.e., while netserver did
+ * not yet consume them); the ring is then polled by receiveBatch(). Once the ring is
+ * drained, the interrupts are unmasked again. ICR latches causes while they are
+ * masked, hence frames that arrive in between still raise an interrupt. */
+void E1000Nic::update_rx_polling() {
+	bool pending = rx_pending();
+	if(pending == _rxPolling)
+		return;
+	_rxPolling = pending;
+
+	if(pending) {
+		E1000_WRITE_REG(&_hw, E1000_IMC, E1000_IMS_RXT0 | E1000_IMS_RXDMT0);
+	} else {
+		E1000_WRITE_REG(&_hw, E1000_IMS, E1000_IMS_RXT0 | E1000_IMS_RXDMT0);
+	}
+}
+
 #define EM_RADV 64
 #define EM_RDTR 0
 
@@ -164,7 +209,11 @@ async::result<void> E1000Nic::rxInit() {
 
 	E1000_WRITE_REG(&_hw, E1000_RFCTL, rfctl);
 	u32 rxcsum = E1000_READ_REG(&_hw, E1000_RXCSUM);
-	rxcsum &= ~E1000_RXCSUM_TUOFL;
+	if(offloads_ & nic::OFFLOAD_RX_CSUM) {
+		rxcsum |= E1000_RXCSUM_TUOFL;
+	} else {
+		rxcsum &= ~E1000_RXCSUM_TUOFL;
+	}
 	E1000_WRITE_REG(&_hw, E1000_RXCSUM, rxcsum);
 
 	/*
@@ -86,10 +86,13 @@ public:
 
 	async::result<size_t> receive(arch::dma_buffer_view) override;
 	async::result<void> send(const arch::dma_buffer_view) override;
+	async::result<size_t> receiveBatch(std::span<nic::RxFrame>) override;
+	async::result<void> sendBatch(std::span<const arch::dma_buffer_view>) override;
 
 	async::result<void> init();
 
 	void ringDoorbell();
+	void setRxInterrupts(bool enabled);
 
 	void printRegisters();
 
@@ -174,6 +174,14 @@ namespace receive_config {
 	constexpr uint16_t accept_ok = 0x0F;
 }
 
+namespace interrupt_mitigate {
+	// Timers count in chip-dependent units; packet counts are in units of four packets.
+	constexpr arch::field<uint16_t, uint8_t> rx_packets{0, 4};
+	constexpr arch::field<uint16_t, uint8_t> rx_timer{4, 4};
+	constexpr arch::field<uint16_t, uint8_t> tx_packets{8, 4};
+	constexpr arch::field<uint16_t, uint8_t> tx_timer{12, 4};
+}
+
 namespace interrupt_mask {
 	constexpr arch::field<uint16_t, bool> rx_ok{0, 1};
 	constexpr arch::field<uint16_t, bool> rx_err{1, 1};
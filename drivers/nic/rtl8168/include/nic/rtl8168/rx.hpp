@@ -4,6 +4,7 @@
 #include <nic/rtl8168/common.hpp>
 #include <nic/rtl8168/descriptor.hpp>
 #include <queue>
+#include <span>
 
 struct RealtekNic;
 
@@ -14,14 +15,25 @@ struct RxQueue {
 		return helix_ng::ptrToPhysical(&_descriptors[0]);
 	}
 
+	// Passes received frames to pending requests. While frames remain in the ring,
+	// RX interrupts are masked and the ring is polled by submitBatch() instead.
 	void handleRxOk();
 	bool checkOwnerOfNextDescriptor();
-	async::result<size_t> submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic);
-	async::result<void> postDescriptor(arch::dma_buffer_view frame, RealtekNic &nic, std::shared_ptr<Request> req);
+	// Completes once at least one frame was received, returns the number of frames.
+	async::result<size_t> submitBatch(std::span<nic::RxFrame> frames);
 private:
+	struct BatchRequest {
+		async::oneshot_event event;
+		std::span<nic::RxFrame> frames;
+		size_t count = 0;
+	};
+
+	RealtekNic &_nic;
+	bool _polling = false;
 	size_t _descriptor_count;
+	arch::dma_pool *_pool;
 	std::vector<arch::dma_buffer> _descriptor_buffers;
-	std::queue<std::shared_ptr<Request>> _requests;
+	std::queue<BatchRequest *> _requests;
 	arch::dma_array<Descriptor> _descriptors;
 	QueueIndex _last_rx_index;
 	QueueIndex _next_index;
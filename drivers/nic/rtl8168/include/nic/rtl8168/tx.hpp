@@ -4,6 +4,7 @@
 #include <nic/rtl8168/common.hpp>
 #include <nic/rtl8168/descriptor.hpp>
 #include <queue>
+#include <span>
 
 struct RealtekNic;
 
@@ -17,7 +18,10 @@ struct TxQueue {
 	}
 
 	async::result<void> submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic);
-	async::result<void> postDescriptor(arch::dma_buffer_view frame, RealtekNic &nic, std::shared_ptr<Request> req);
+	// Posts all frames before ringing the doorbell, completes once all frames are sent.
+	async::result<void> submitBatch(std::span<const arch::dma_buffer_view> frames, RealtekNic &nic);
+	// Does not ring the doorbell.
+	async::result<void> postDescriptor(arch::dma_buffer_view frame, std::shared_ptr<Request> req);
 
 	bool bufferEmpty() {
 		return _amount_free_descriptors == _descriptor_count;
@@ -29,6 +29,17 @@ void RealtekNic::maskIRQsAndAck() {
 	forcePCICommit();
 }
 
+void RealtekNic::setRxInterrupts(bool enabled) {
+	if(_model == PciModel::RTL8125) {
+		// RX_OK is bit 0 on the RTL8125, too.
+		auto mask = _mmio.load(regs::rtl8125::interrupt_mask_val);
+		_mmio.store(regs::rtl8125::interrupt_mask_val, enabled ? (mask | 1) : (mask & ~uint32_t{1}));
+	} else {
+		_mmio.store(regs::interrupt_mask,
+			_mmio.load(regs::interrupt_mask) / flags::interrupt_mask::rx_ok(enabled));
+	}
+}
+
 async::result<void> RealtekNic::enableRXDVGate() {
 	_mmio.store(regs::misc, _mmio.load(regs::misc) | flags::misc::rxdv_gate(true));
 
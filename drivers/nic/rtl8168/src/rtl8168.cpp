@@ -1,6 +1,8 @@
 #include <async/basic.hpp>
+#include <cassert>
 #include <cctype>
 #include <cstdint>
+#include <cstring>
 #include <initializer_list>
 #include <nic/rtl8168/common.hpp>
 #include <nic/rtl8168/rtl8168.hpp>
@@ -387,7 +389,11 @@ async::result<bool> RealtekNic::startCard() {
 
 		co_await configureHardware();
 
-		_mmio.store(regs::interrupt_mitigate, arch::bit_value<uint16_t>(0));
+		// Coalesce IRQs (this is the value of Realtek's own driver). Together with
+		// masking RX_OK while the RX ring is polled, this bounds the IRQ rate.
+		_mmio.store(regs::interrupt_mitigate,
+			flags::interrupt_mitigate::tx_timer(5) | flags::interrupt_mitigate::tx_packets(1)
+			| flags::interrupt_mitigate::rx_timer(5) | flags::interrupt_mitigate::rx_packets(1));
 	}
 
 	co_await enableExitL1();
@@ -524,13 +530,25 @@ async::result<void> RealtekNic::init() {
 // TODO: We really should not do this like this
 //       What we should do is have a constant callback we always poll to, as this way of doing things will always be prone to race conditions
 async::result<size_t> RealtekNic::receive(arch::dma_buffer_view frame) {
-	co_return co_await _rxQueue->submitDescriptor(frame, *this);
+	nic::RxFrame rx;
+	co_await _rxQueue->submitBatch({&rx, 1});
+	assert(rx.length <= frame.size());
+	memcpy(frame.data(), rx.buffer.data(), rx.length);
+	co_return rx.length;
 }
 
 async::result<void> RealtekNic::send(arch::dma_buffer_view payload) {
 	co_await _txQueue->submitDescriptor(payload, *this);
 }
 
+async::result<size_t> RealtekNic::receiveBatch(std::span<nic::RxFrame> frames) {
+	co_return co_await _rxQueue->submitBatch(frames);
+}
+
+async::result<void> RealtekNic::sendBatch(std::span<const arch::dma_buffer_view> frames) {
+	co_await _txQueue->submitBatch(frames, *this);
+}
+
 
 async::detached RealtekNic::processIrqs() {
 	co_await _device.enableBusIrq();
@@ -78,7 +78,7 @@ void RealtekNic::closeRX() {
 	_mmio.store(regs::receive_config, _mmio.load(regs::receive_config) / flags::receive_config::accept_mask_bits(0));
 }
 
-RxQueue::RxQueue(size_t descriptors, RealtekNic &nic) : _descriptor_count{descriptors}, _last_rx_index(0, descriptors), _next_index(0, descriptors) {
+RxQueue::RxQueue(size_t descriptors, RealtekNic &nic) : _nic{nic}, _descriptor_count{descriptors}, _pool{nic.dmaPool()}, _last_rx_index(0, descriptors), _next_index(0, descriptors) {
 	_descriptors = arch::dma_array<Descriptor>(nic.dmaPool(), _descriptor_count);
 	_descriptor_buffers.reserve(_descriptor_count);
 
@@ -98,25 +98,16 @@ RxQueue::RxQueue(size_t descriptors, RealtekNic &nic) : _descriptor_count{descri
 	_descriptors[_descriptor_count - 1].flags |= flags::rx::eor(true);
 }
 
-async::result<size_t> RxQueue::submitDescriptor(arch::dma_buffer_view frame, RealtekNic &nic) {
-	auto ev_req = std::make_shared<Request>(_descriptor_count);
+async::result<size_t> RxQueue::submitBatch(std::span<nic::RxFrame> frames) {
+	BatchRequest req{.frames = frames};
+	_requests.push(&req);
 
-	co_await postDescriptor(frame, nic, ev_req);
+	// Pick up frames that arrived before the request was queued.
+	handleRxOk();
 
-	co_await ev_req->event.wait();
+	co_await req.event.wait();
 
-	co_return ev_req->frame.size();
-}
-
-async::result<void> RxQueue::postDescriptor(arch::dma_buffer_view frame, RealtekNic &nic, std::shared_ptr<Request> req) {
-	req->frame = frame;
-	req->index = _next_index;
-
-	_requests.push(std::move(req));
-
-	++_next_index;
-
-	co_return;
+	co_return req.count;
 }
 
 bool RxQueue::checkOwnerOfNextDescriptor() {
@@ -127,55 +118,76 @@ bool RxQueue::checkOwnerOfNextDescriptor() {
 void RxQueue::handleRxOk() {
 	while(!_requests.empty()) {
 		auto req = _requests.front();
-		auto i = req->index;
-
-		if((_descriptors[i].flags & flags::rx::ownership) == flags::rx::owner_nic) // Descriptor was not transmitted?
-			break;
 
-		__sync_synchronize();
-
-		auto _flags = _descriptors[i].flags;
+		// Drain as many descriptors as fit into the request.
+		while(req->count < req->frames.size()) {
+			auto i = _next_index();
+
+			if((_descriptors[i].flags & flags::rx::ownership) == flags::rx::owner_nic) // Descriptor was not transmitted?
+				break;
+
+			__sync_synchronize();
+
+			auto _flags = _descriptors[i].flags;
+
+			if(logRXDescriptor) {
+				std::cout << "drivers/rtl8168: got RX descriptor, flags:" << std::endl;
+
+				if(_flags & flags::rx::eor) {
+					std::cout << "\t\t eor" << std::endl;
+				}
+				if(_flags & flags::rx::physical_address_ok) {
+					std::cout << "\t\t physical_address_ok" << std::endl;
+				}
+				if(_flags & flags::rx::first_segment) {
+					std::cout << "\t\t first_segment" << std::endl;
+				}
+				if(_flags & flags::rx::last_segment) {
+					std::cout << "\t\t last_segment" << std::endl;
+				}
+				if(_flags & flags::rx::broadcast_packet) {
+					std::cout << "\t\t broadcast_packet" << std::endl;
+				}
+				if(_flags & flags::rx::receive_watchdog_timer_expired) {
+					std::cout << "\t\t receive_watchdog_timer_expired" << std::endl;
+				}
+				if(_flags & flags::rx::receive_error) {
+					std::cout << "\t\t receive_error" << std::endl;
+				}
+			}
 
-		if(logRXDescriptor) {
-			std::cout << "drivers/rtl8168: got RX descriptor, flags:" << std::endl;
+			auto size = _flags & flags::rx::frame_length;
 
-			if(_flags & flags::rx::eor) {
-				std::cout << "\t\t eor" << std::endl;
-			}
-			if(_flags & flags::rx::physical_address_ok) {
-				std::cout << "\t\t physical_address_ok" << std::endl;
-			}
-			if(_flags & flags::rx::first_segment) {
-				std::cout << "\t\t first_segment" << std::endl;
-			}
-			if(_flags & flags::rx::last_segment) {
-				std::cout << "\t\t last_segment" << std::endl;
-			}
-			if(_flags & flags::rx::broadcast_packet) {
-				std::cout << "\t\t broadcast_packet" << std::endl;
+			if(size == 0) {
+				break;
 			}
-			if(_flags & flags::rx::receive_watchdog_timer_expired) {
-				std::cout << "\t\t receive_watchdog_timer_expired" << std::endl;
-			}
-			if(_flags & flags::rx::receive_error) {
-				std::cout << "\t\t receive_error" << std::endl;
-			}
-		}
 
-		auto size = _flags & flags::rx::frame_length;
+			auto &frame = req->frames[req->count++];
+			frame.buffer = arch::dma_buffer(_pool, size);
+			frame.offset = 0;
+			frame.length = size;
+			frame.meta = {};
+			memcpy(frame.buffer.data(), _descriptor_buffers[i].data(), size);
 
-		if(size == 0) {
-			break;
-		}
+			_descriptors[i].flags = flags::rx::eor(_descriptors[i].flags & flags::rx::eor) |
+				flags::rx::ownership(flags::rx::owner_nic) | flags::rx::frame_length(2048);
+			_descriptors[i].vlan = 0;
 
-		memcpy(req->frame.data(), _descriptor_buffers[i].data(), size);
-		req->frame = req->frame.subview(0, size);
+			++_next_index;
+		}
 
-		_descriptors[i].flags = flags::rx::eor(_descriptors[i].flags & flags::rx::eor) |
-			flags::rx::ownership(flags::rx::owner_nic) | flags::rx::frame_length(2048);
-		_descriptors[i].vlan = 0;
+		if(!req->count)
+			break;
 
-		req->event.raise();
 		_requests.pop();
+		req->event.raise();
+	}
+
+	// The status register latches RX_OK while it is masked, hence frames that arrive
+	// before we unmask it still raise an IRQ.
+	bool pending = !checkOwnerOfNextDescriptor();
+	if(pending != _polling) {
+		_polling = pending;
+		_nic.setRxInterrupts(!pending);
 	}
 }
@@ -43,13 +43,43 @@ TxQueue::TxQueue(size_t descriptors, RealtekNic &nic) : _descriptor_count{descri
 async::result<void> TxQueue::submitDescriptor(arch::dma_buffer_view payload, RealtekNic &nic) {
 	auto ev_req = std::make_shared<Request>(_descriptor_count);
 
-	co_await postDescriptor(payload, nic, ev_req);
+	co_await postDescriptor(payload, ev_req);
+
+	// TOOD: Technically, we should not be ringing the doorbell after every transmision, but only if there
+	//       are no current transmissions in progress.
+	//       Howver, always ringing the doorbell seems to work, and avoids the problem of having to detect
+	//       stalls caused by not ringing the doorbell when it should have been rung
+	nic.ringDoorbell();
+	co_await ev_req->event.wait();
+}
+
+async::result<void> TxQueue::submitBatch(std::span<const arch::dma_buffer_view> frames, RealtekNic &nic) {
+	std::shared_ptr<Request> ev_req;
+
+	for(auto &payload : frames) {
+		// If the ring is full, let the NIC catch up. Descriptors complete in order,
+		// hence the most recent request frees all descriptors.
+		if(!_amount_free_descriptors) {
+			auto pending = _requests.back();
+			nic.ringDoorbell();
+			co_await pending->event.wait();
+		}
+
+		ev_req = std::make_shared<Request>(_descriptor_count);
+		co_await postDescriptor(payload, ev_req);
+	}
+
+	if(!ev_req)
+		co_return;
+
+	// Ring the doorbell once for the entire batch.
+	nic.ringDoorbell();
 	co_await ev_req->event.wait();
 }
 
 // TODO: support large packets
 // TODO: this function should be able to fail; there may not be enough space in the ring buffer, which should be handled gracefully
-async::result<void> TxQueue::postDescriptor(arch::dma_buffer_view payload, RealtekNic &nic, std::shared_ptr<Request> req) {
+async::result<void> TxQueue::postDescriptor(arch::dma_buffer_view payload, std::shared_ptr<Request> req) {
 	assert(_amount_free_descriptors);
 
 	_requests.push(req);
@@ -76,11 +106,7 @@ async::result<void> TxQueue::postDescriptor(arch::dma_buffer_view payload, Realt
 	__sync_synchronize();
 	--_amount_free_descriptors;
 
-	// TOOD: Technically, we should not be ringing the doorbell after every transmision, but only if there
-	//       are no current transmissions in progress.
-	//       Howver, always ringing the doorbell seems to work, and avoids the problem of having to detect
-	//       stalls caused by not ringing the doorbell when it should have been rung
-	nic.ringDoorbell();
+	// The caller rings the doorbell.
 	if(logTXDescriptor) {
 		std::cout << "drivers/rtl8168: posting TX descriptor: "
 			<< "tx_index: " << tx_index
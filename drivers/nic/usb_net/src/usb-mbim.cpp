@@ -187,8 +187,8 @@ UsbMbimNic::UsbMbimNic(mbus_ng::EntityId entity, protocols::usb::Device hw_devic
 		protocols::usb::Interface ctrl_intf, protocols::usb::Endpoint ctrl_ep,
 		protocols::usb::Interface data_intf, protocols::usb::Endpoint in, protocols::usb::Endpoint out,
 		size_t config_index)
-	: UsbNic{hw_device, mac, ctrl_intf, ctrl_ep, data_intf, in, out}, entity_{entity},
-		config_index_{config_index} {
+	: UsbNtbNic{hw_device, mac, ctrl_intf, ctrl_ep, data_intf, in, out, NCM_NDP16_IPS_SIGNATURE},
+		entity_{entity}, config_index_{config_index} {
 	raw_ip_ = true;
 	configureName("wwan");
 }
@@ -217,6 +217,8 @@ async::result<void> UsbMbimNic::initialize() {
 
 	assert(wMaxControlMessage);
 
+	co_await setupNtb_(false);
+
 	auto config_val = (co_await device_.currentConfigurationValue()).value();
 	mbus_ng::Properties descriptor{
 		{"drvcore.mbus-parent", mbus_ng::StringItem{std::to_string(entity_)}},
@@ -358,48 +360,6 @@ async::detached UsbMbimNic::listenForNotifications() {
 	co_return;
 }
 
-async::result<size_t> UsbMbimNic::receive(arch::dma_buffer_view frame) {
-	arch::dma_buffer buf{&dmaPool_, mtu};
-
-	auto res = co_await data_in_.transfer(protocols::usb::BulkTransfer{protocols::usb::kXferToHost, buf});
-	assert(res);
-
-	if(res.value() != 0) {
-		auto ncmHeader = reinterpret_cast<usb_ncm::NcmTransferHeader *>(buf.data());
-		auto ndp = reinterpret_cast<usb_ncm::NcmDatagramPointer *>(buf.subview(ncmHeader->wNdpIndex).data());
-		assert(ndp->dwSignature == usb_mbim::NCM_NDP16_IPS_SIGNATURE);
-		memcpy(frame.data(), buf.subview(ndp->wDatagram[0].Index).data(), ndp->wDatagram[0].Length);
-		co_return ndp->wDatagram[0].Length;
-	}
-
-	assert(!"USB NIC receive failed!");
-}
-
-async::result<void> UsbMbimNic::send(const arch::dma_buffer_view payload) {
-	arch::dma_buffer buf{&dmaPool_, sizeof(usb_ncm::NcmTransferHeader) + sizeof(usb_ncm::NcmDatagramPointer) + payload.size()};
-	auto ncmHeader = reinterpret_cast<usb_ncm::NcmTransferHeader *>(buf.data());
-	ncmHeader->dwSignature = usb_ncm::NCM_NTH16_SIGNATURE;
-	ncmHeader->wHeaderLength = sizeof(*ncmHeader);
-	ncmHeader->wSequence = seq_++;
-	ncmHeader->wBlockLength = uint16_t(buf.size());
-	ncmHeader->wNdpIndex = sizeof(*ncmHeader);
-
-	auto ndp = reinterpret_cast<usb_ncm::NcmDatagramPointer *>(buf.subview(ncmHeader->wNdpIndex).data());
-	ndp->dwSignature = usb_mbim::NCM_NDP16_IPS_SIGNATURE;
-	ndp->wLength = sizeof(*ndp);
-	ndp->wNextNdpIndex = 0;
-	ndp->wDatagram[0].Index = ncmHeader->wHeaderLength + ndp->wLength;
-	ndp->wDatagram[0].Length = uint16_t(payload.size());
-	ndp->wDatagram[1].Index = 0;
-	ndp->wDatagram[1].Length = 0;
-
-	memcpy(buf.subview(ndp->wDatagram[0].Index).data(), payload.data(), payload.size());
-
-	auto res = co_await data_out_.transfer(protocols::usb::BulkTransfer{protocols::usb::kXferToDevice, buf});
-	assert(res);
-	co_return;
-}
-
 async::result<void> UsbMbimNic::writeCommand(const arch::dma_buffer_view request) {
 	arch::dma_object<protocols::usb::SetupPacket> ctrl_msg{&dmaPool_};
 	ctrl_msg->type = protocols::usb::setup_type::byClass |
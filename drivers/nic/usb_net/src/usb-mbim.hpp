@@ -6,6 +6,7 @@
 #include <vector>
 #include <smarter.hpp>
 
+#include "usb-ncm.hpp"
 #include "usb-net.hpp"
 
 namespace nic::usb_mbim {
@@ -18,7 +19,7 @@ struct CdcWdmDevice {
 	bool nonBlock_ = false;
 };
 
-struct UsbMbimNic : UsbNic {
+struct UsbMbimNic : usb_ncm::UsbNtbNic {
 	friend CdcWdmDevice;
 
 	UsbMbimNic(mbus_ng::EntityId entity, protocols::usb::Device hw_device, nic::MacAddress mac,
@@ -30,9 +31,6 @@ struct UsbMbimNic : UsbNic {
 	async::detached receiveEncapsulated();
 	async::detached listenForNotifications() override;
 
-	async::result<size_t> receive(arch::dma_buffer_view) override;
-	async::result<void> send(const arch::dma_buffer_view) override;
-
 	async::result<void> writeCommand(arch::dma_buffer_view request);
 private:
 	mbus_ng::EntityId entity_;
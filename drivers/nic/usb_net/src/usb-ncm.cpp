@@ -1,3 +1,8 @@
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <helix/timer.hpp>
 #include <nic/usb_net/usb_net.hpp>
 #include <net/ethernet.h>
 
@@ -9,11 +14,313 @@ namespace nic::usb_ncm {
 
 constexpr bool debugNcm = false;
 
+// Upper bound for the size of the NTBs that we exchange with the function.
+constexpr size_t maxNtbSize = 16384;
+// Number of bulk-in transfers that are kept pending.
+constexpr size_t numRxTransfers = 4;
+// Maximal number of received NTBs that receiveBatch() did not consume yet.
+constexpr size_t maxRxBacklog = 8;
+// Maximal number of NTBs that are in flight on the bulk-out endpoint.
+constexpr size_t maxTxInFlight = 4;
+// Time in ns that a partially filled NTB waits for more datagrams before it is sent.
+constexpr uint64_t txFlushDelay = 50'000;
+
+constexpr size_t ndpHeaderSize = offsetof(NcmDatagramPointer, wDatagram);
+
+namespace {
+
+size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+} // anonymous namespace
+
+UsbNtbNic::UsbNtbNic(protocols::usb::Device hw_device, nic::MacAddress mac,
+		protocols::usb::Interface ctrl_intf, protocols::usb::Endpoint ctrl_ep,
+		protocols::usb::Interface data_intf, protocols::usb::Endpoint in, protocols::usb::Endpoint out,
+		uint32_t ndpSignature)
+	: UsbNic{hw_device, mac, ctrl_intf, ctrl_ep, data_intf, in, out},
+		ndpSignature_{ndpSignature} {
+
+}
+
+async::result<void> UsbNtbNic::setupNtb_(bool setInputSize) {
+	arch::dma_object<protocols::usb::SetupPacket> ctrl_msg{&dmaPool_};
+	arch::dma_object<NtbParameter> params{&dmaPool_};
+	ctrl_msg->type = protocols::usb::setup_type::byClass |
+					protocols::usb::setup_type::toHost | protocols::usb::setup_type::targetInterface;
+	ctrl_msg->request = uint8_t(nic::usb_net::RequestCode::GET_NTB_PARAMETERS);
+	ctrl_msg->value = 0;
+	ctrl_msg->index = ctrl_intf_.num();
+	ctrl_msg->length = params.view_buffer().size();
+
+	auto res = co_await device_.transfer(protocols::usb::ControlTransfer{
+		protocols::usb::kXferToHost, ctrl_msg, params.view_buffer()
+	});
+	assert(res);
+
+	params_ = *params;
+
+	if(debugNcm)
+		std::cout << std::format("{}", params_) << std::endl;
+
+	// NTB16 cannot describe blocks larger than 64 KiB.
+	rxNtbSize_ = std::min<size_t>(params_.dwNtbInMaxSize, 0xFFFF);
+	if(setInputSize && rxNtbSize_ > maxNtbSize) {
+		arch::dma_object<uint32_t> size{&dmaPool_};
+		*size = maxNtbSize;
+
+		ctrl_msg->type = protocols::usb::setup_type::byClass |
+						protocols::usb::setup_type::toDevice | protocols::usb::setup_type::targetInterface;
+		ctrl_msg->request = uint8_t(nic::usb_net::RequestCode::SET_NTB_INPUT_SIZE);
+		ctrl_msg->value = 0;
+		ctrl_msg->index = ctrl_intf_.num();
+		ctrl_msg->length = size.view_buffer().size();
+
+		res = co_await device_.transfer(protocols::usb::ControlTransfer{
+			protocols::usb::kXferToDevice, ctrl_msg, size.view_buffer()
+		});
+		if(res)
+			rxNtbSize_ = maxNtbSize;
+	}
+
+	txNtbSize_ = std::min<size_t>(params_.dwNtbOutMaxSize, maxNtbSize);
+	if(!params_.wNdpOutDivisor)
+		params_.wNdpOutDivisor = 1;
+	params_.wNdpOutPayloadRemainder %= params_.wNdpOutDivisor;
+	// NDP16 must be aligned to 4 bytes in any case.
+	if(!std::has_single_bit(params_.wNdpOutAlignment) || params_.wNdpOutAlignment < 4)
+		params_.wNdpOutAlignment = 4;
+}
+
+async::result<size_t> UsbNtbNic::receive(arch::dma_buffer_view frame) {
+	nic::RxFrame rx;
+	co_await receiveBatch({&rx, 1});
+	assert(rx.length <= frame.size());
+	memcpy(frame.data(), rx.buffer.data(), rx.length);
+	co_return rx.length;
+}
+
+async::result<size_t> UsbNtbNic::receiveBatch(std::span<nic::RxFrame> frames) {
+	assert(!frames.empty());
+
+	if(!rxStarted_) {
+		for(size_t i = 0; i < numRxTransfers; i++)
+			receiveNtbs_();
+		rxStarted_ = true;
+	}
+
+	size_t n = 0;
+	while(!n) {
+		while(rxNtbs_.empty())
+			co_await rxEvent_.async_wait();
+
+		while(n < frames.size() && !rxNtbs_.empty()) {
+			NcmDatagramEntry entry;
+			if(!nextDatagram_(entry)) {
+				rxNtbs_.pop_front();
+				rxNdp_ = 0;
+				rxSpace_.raise();
+				continue;
+			}
+
+			// Datagrams share the NTB, hence they are copied out into their own buffers.
+			auto &frame = frames[n++];
+			frame.buffer = arch::dma_buffer{&dmaPool_, entry.Length};
+			memcpy(frame.buffer.data(), rxNtbs_.front().buffer.subview(entry.Index).data(), entry.Length);
+			frame.offset = 0;
+			frame.length = entry.Length;
+			frame.meta = {};
+		}
+	}
+
+	co_return n;
+}
+
+async::detached UsbNtbNic::receiveNtbs_() {
+	while(true) {
+		while(rxNtbs_.size() >= maxRxBacklog)
+			co_await rxSpace_.async_wait();
+
+		arch::dma_buffer buffer{&dmaPool_, rxNtbSize_};
+		protocols::usb::BulkTransfer transfer{protocols::usb::kXferToHost, buffer};
+		transfer.allowShortPackets = true;
+		auto res = co_await data_in_.transfer(transfer);
+		assert(res);
+
+		if(!res.value())
+			continue;
+
+		rxNtbs_.push_back({std::move(buffer), res.value()});
+		rxEvent_.raise();
+	}
+}
+
+bool UsbNtbNic::nextDatagram_(NcmDatagramEntry &entry) {
+	auto &ntb = rxNtbs_.front();
+	auto data = reinterpret_cast<const uint8_t *>(ntb.buffer.data());
+
+	if(!rxNdp_) {
+		NcmTransferHeader nth;
+		if(ntb.length < sizeof(nth))
+			return false;
+		memcpy(&nth, data, sizeof(nth));
+		if(nth.dwSignature != NCM_NTH16_SIGNATURE || nth.wBlockLength > ntb.length)
+			return false;
+		// A block length of zero means that the NTB is terminated by a short packet.
+		if(nth.wBlockLength)
+			ntb.length = nth.wBlockLength;
+		rxNdp_ = nth.wNdpIndex;
+		rxEntry_ = 0;
+	}
+
+	while(rxNdp_) {
+		if(rxNdp_ % 4 || rxNdp_ + ndpHeaderSize > ntb.length)
+			return false;
+
+		NcmDatagramPointer ndp;
+		memcpy(&ndp, data + rxNdp_, ndpHeaderSize);
+		if(ndp.wLength < ndpHeaderSize)
+			return false;
+		size_t numEntries = (std::min<size_t>(ndp.wLength, ntb.length - rxNdp_) - ndpHeaderSize)
+			/ sizeof(NcmDatagramEntry);
+
+		// NDPs with other signatures (e.g., other MBIM sessions) are skipped.
+		while(ndp.dwSignature == ndpSignature_ && rxEntry_ < numEntries) {
+			memcpy(&entry, data + rxNdp_ + ndpHeaderSize + rxEntry_ * sizeof(entry), sizeof(entry));
+			rxEntry_++;
+			if(!entry.Index || !entry.Length)
+				break;
+			if(size_t{entry.Index} + entry.Length > ntb.length)
+				continue;
+			return true;
+		}
+
+		// Only follow NDPs forward such that a malformed chain cannot loop.
+		if(ndp.wNextNdpIndex <= rxNdp_)
+			return false;
+		rxNdp_ = ndp.wNextNdpIndex;
+		rxEntry_ = 0;
+	}
+
+	return false;
+}
+
+async::result<void> UsbNtbNic::send(const arch::dma_buffer_view payload) {
+	co_await queueDatagram_(payload);
+}
+
+async::result<void> UsbNtbNic::sendBatch(std::span<const arch::dma_buffer_view> frames) {
+	for(auto &frame : frames)
+		co_await queueDatagram_(frame);
+	// The end of a batch is a good point to send the NTB without waiting for the timer.
+	flushTx_();
+}
+
+size_t UsbNtbNic::datagramOffset_() const {
+	size_t divisor = params_.wNdpOutDivisor;
+	return txOffset_ + (params_.wNdpOutPayloadRemainder + divisor - txOffset_ % divisor) % divisor;
+}
+
+bool UsbNtbNic::fitsTx_(size_t size) const {
+	if(params_.wNtbOutMaxDatagrams && txEntries_.size() >= params_.wNtbOutMaxDatagrams)
+		return false;
+
+	// The NDP goes behind the datagrams and needs one more entry plus the null entry.
+	// One byte is reserved for the padding in flushTx_().
+	auto ndpOffset = alignUp(datagramOffset_() + size, params_.wNdpOutAlignment);
+	return ndpOffset + ndpHeaderSize + (txEntries_.size() + 2) * sizeof(NcmDatagramEntry) + 1
+		<= txNtbSize_;
+}
+
+async::result<void> UsbNtbNic::queueDatagram_(arch::dma_buffer_view payload) {
+	while(true) {
+		if(!txEntries_.empty()) {
+			if(fitsTx_(payload.size()))
+				break;
+			flushTx_();
+		}
+		if(txInFlight_ < maxTxInFlight)
+			break;
+		co_await txDone_.async_wait();
+	}
+
+	if(txEntries_.empty()) {
+		assert(fitsTx_(payload.size()));
+		txNtb_ = arch::dma_buffer{&dmaPool_, txNtbSize_};
+		flushTimer_(txGeneration_);
+	}
+
+	auto data = reinterpret_cast<uint8_t *>(txNtb_.data());
+	auto offset = datagramOffset_();
+	memset(data + txOffset_, 0, offset - txOffset_);
+	memcpy(data + offset, payload.data(), payload.size());
+	txEntries_.push_back({uint16_t(offset), uint16_t(payload.size())});
+	txOffset_ = offset + payload.size();
+
+	if(params_.wNtbOutMaxDatagrams && txEntries_.size() == params_.wNtbOutMaxDatagrams)
+		flushTx_();
+}
+
+void UsbNtbNic::flushTx_() {
+	if(txEntries_.empty())
+		return;
+
+	auto data = reinterpret_cast<uint8_t *>(txNtb_.data());
+	size_t ndpOffset = alignUp(txOffset_, params_.wNdpOutAlignment);
+	size_t ndpLength = ndpHeaderSize + (txEntries_.size() + 1) * sizeof(NcmDatagramEntry);
+	memset(data + txOffset_, 0, ndpOffset - txOffset_);
+
+	auto ndp = reinterpret_cast<NcmDatagramPointer *>(data + ndpOffset);
+	ndp->dwSignature = ndpSignature_;
+	ndp->wLength = uint16_t(ndpLength);
+	ndp->wNextNdpIndex = 0;
+	auto entries = data + ndpOffset + ndpHeaderSize;
+	memcpy(entries, txEntries_.data(), txEntries_.size() * sizeof(NcmDatagramEntry));
+	memset(entries + txEntries_.size() * sizeof(NcmDatagramEntry), 0, sizeof(NcmDatagramEntry));
+
+	// If the transfer was a multiple of the maximum packet size (64, 512 or 1024 bytes),
+	// the function would wait for a zero length packet. Pad by one byte instead.
+	size_t length = ndpOffset + ndpLength;
+	if(!(length % 64))
+		data[length++] = 0;
+
+	auto ncmHeader = reinterpret_cast<NcmTransferHeader *>(data);
+	ncmHeader->dwSignature = NCM_NTH16_SIGNATURE;
+	ncmHeader->wHeaderLength = sizeof(*ncmHeader);
+	ncmHeader->wSequence = seq_++;
+	ncmHeader->wBlockLength = uint16_t(length);
+	ncmHeader->wNdpIndex = uint16_t(ndpOffset);
+
+	txInFlight_++;
+	transmitNtb_(std::move(txNtb_), length);
+
+	txEntries_.clear();
+	txOffset_ = sizeof(NcmTransferHeader);
+	txGeneration_++;
+}
+
+async::detached UsbNtbNic::flushTimer_(uint64_t generation) {
+	co_await helix::sleepFor(txFlushDelay);
+	if(generation == txGeneration_)
+		flushTx_();
+}
+
+async::detached UsbNtbNic::transmitNtb_(arch::dma_buffer buffer, size_t length) {
+	auto res = co_await data_out_.transfer(protocols::usb::BulkTransfer{
+		protocols::usb::kXferToDevice, buffer.subview(0, length)
+	});
+	assert(res);
+
+	txInFlight_--;
+	txDone_.raise();
+}
+
 UsbNcmNic::UsbNcmNic(mbus_ng::EntityId entity, protocols::usb::Device hw_device, nic::MacAddress mac,
 		protocols::usb::Interface ctrl_intf, protocols::usb::Endpoint ctrl_ep,
 		protocols::usb::Interface data_intf, protocols::usb::Endpoint in, protocols::usb::Endpoint out,
 		size_t config_index)
-	: UsbNic{hw_device, mac, ctrl_intf, ctrl_ep, data_intf, in, out},
+	: UsbNtbNic{hw_device, mac, ctrl_intf, ctrl_ep, data_intf, in, out, NCM_NDP16_NO_CRC_SIGNATURE},
 		entity_{entity}, config_index_{config_index} {
 
 }
@@ -103,22 +410,9 @@ async::result<void> UsbNcmNic::initialize() {
 	else
 		min_mtu = mtu;
 
-	arch::dma_object<protocols::usb::SetupPacket> ctrl_msg{&dmaPool_};
-	arch::dma_object<NtbParameter> params{&dmaPool_};
-	ctrl_msg->type = protocols::usb::setup_type::byClass |
-					protocols::usb::setup_type::toHost | protocols::usb::setup_type::targetInterface;
-	ctrl_msg->request = uint8_t(nic::usb_net::RequestCode::GET_NTB_PARAMETERS);
-	ctrl_msg->value = 0;
-	ctrl_msg->index = ctrl_intf_.num();
-	ctrl_msg->length = params.view_buffer().size();
-
-	auto res = co_await device_.transfer(protocols::usb::ControlTransfer{
-		protocols::usb::kXferToHost, ctrl_msg, params.view_buffer()
-	});
-	assert(res);
+	co_await setupNtb_(ncm_hdr->bmNetworkCapabilities & regs::bmNetworkCapabilities::ntbInputSize);
 
-	if(debugNcm)
-		std::cout << std::format("{}", *params) << std::endl;
+	arch::dma_object<protocols::usb::SetupPacket> ctrl_msg{&dmaPool_};
 
 	if(ncm_hdr->bmNetworkCapabilities & regs::bmNetworkCapabilities::crcMode) {
 		ctrl_msg->type = protocols::usb::setup_type::byClass | protocols::usb::setup_type::targetInterface;
@@ -128,7 +422,7 @@ async::result<void> UsbNcmNic::initialize() {
 		ctrl_msg->index = ctrl_intf_.num();
 		ctrl_msg->length = 0;
 
-		res = co_await device_.transfer(protocols::usb::ControlTransfer{
+		auto res = co_await device_.transfer(protocols::usb::ControlTransfer{
 			protocols::usb::kXferToDevice, ctrl_msg, {}
 		});
 		assert(res);
@@ -157,7 +451,7 @@ async::result<void> UsbNcmNic::initialize() {
 			broadcast_ = true;
 		}
 
-		res = co_await device_.transfer(protocols::usb::ControlTransfer{
+		auto res = co_await device_.transfer(protocols::usb::ControlTransfer{
 			protocols::usb::kXferToDevice, ctrl_msg, {}
 		});
 		assert(res);
@@ -200,45 +494,4 @@ async::detached UsbNcmNic::listenForNotifications() {
 	co_return;
 }
 
-async::result<size_t> UsbNcmNic::receive(arch::dma_buffer_view frame) {
-	arch::dma_buffer buf{&dmaPool_, mtu};
-
-	auto res = co_await data_in_.transfer(protocols::usb::BulkTransfer{protocols::usb::kXferToHost, buf});
-	assert(res);
-
-	if(res.value() != 0) {
-		auto ncmHeader = reinterpret_cast<NcmTransferHeader *>(buf.data());
-		auto ndp = reinterpret_cast<NcmDatagramPointer *>(buf.subview(ncmHeader->wNdpIndex).data());
-		memcpy(frame.data(), buf.subview(ndp->wDatagram[0].Index).data(), ndp->wDatagram[0].Length);
-		co_return ndp->wDatagram[0].Length;
-	}
-
-	assert(!"USB NIC receive failed!");
-}
-
-async::result<void> UsbNcmNic::send(const arch::dma_buffer_view payload) {
-	arch::dma_buffer buf{&dmaPool_, sizeof(NcmTransferHeader) + sizeof(NcmDatagramPointer) + payload.size()};
-	auto ncmHeader = reinterpret_cast<NcmTransferHeader *>(buf.data());
-	ncmHeader->dwSignature = NCM_NTH16_SIGNATURE;
-	ncmHeader->wHeaderLength = sizeof(*ncmHeader);
-	ncmHeader->wSequence = seq_++;
-	ncmHeader->wBlockLength = uint16_t(buf.size());
-	ncmHeader->wNdpIndex = sizeof(*ncmHeader);
-
-	auto ndp = reinterpret_cast<NcmDatagramPointer *>(buf.subview(ncmHeader->wNdpIndex).data());
-	ndp->dwSignature = NCM_NDP16_NO_CRC_SIGNATURE;
-	ndp->wLength = sizeof(*ndp);
-	ndp->wNextNdpIndex = 0;
-	ndp->wDatagram[0].Index = ncmHeader->wHeaderLength + ndp->wLength;
-	ndp->wDatagram[0].Length = uint16_t(payload.size());
-	ndp->wDatagram[1].Index = 0;
-	ndp->wDatagram[1].Length = 0;
-
-	memcpy(buf.subview(ndp->wDatagram[0].Index).data(), payload.data(), payload.size());
-
-	auto res = co_await data_out_.transfer(protocols::usb::BulkTransfer{protocols::usb::kXferToDevice, buf});
-	assert(res);
-	co_return;
-}
-
 } // namespace nic::usb_ncm
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <arch/bits.hpp>
+#include <async/recurring-event.hpp>
+#include <deque>
 #include <format>
 #include <protocols/mbus/client.hpp>
+#include <vector>
 
 #include "usb-net.hpp"
 
@@ -19,14 +22,18 @@ struct [[gnu::packed]] NcmTransferHeader {
 	uint16_t wNdpIndex;
 };
 
+struct [[gnu::packed]] NcmDatagramEntry {
+	uint16_t Index;
+	uint16_t Length;
+};
+
+// NDP16 with a single datagram. In general, the entries continue up to wLength
+// and are terminated by a null entry.
 struct [[gnu::packed]] NcmDatagramPointer {
 	uint32_t dwSignature;
 	uint16_t wLength;
 	uint16_t wNextNdpIndex;
-	struct [[gnu::packed]] {
-		uint16_t Index;
-		uint16_t Length;
-	} wDatagram[2];
+	NcmDatagramEntry wDatagram[2];
 };
 
 struct NtbParameter {
@@ -44,7 +51,69 @@ struct NtbParameter {
 	uint16_t wNtbOutMaxDatagrams;
 };
 
-struct UsbNcmNic : UsbNic {
+// Datapath shared by NCM and MBIM, which both carry datagrams in 16-bit NCM Transfer
+// Blocks (NTBs). On TX, datagrams are packed into an NTB until it is full or a short
+// timer expires. On RX, multiple bulk-in transfers are kept pending and every datagram
+// of a received NTB is returned.
+struct UsbNtbNic : UsbNic {
+	UsbNtbNic(protocols::usb::Device hw_device, nic::MacAddress mac,
+		protocols::usb::Interface ctrl_intf, protocols::usb::Endpoint ctrl_ep,
+		protocols::usb::Interface intf, protocols::usb::Endpoint in, protocols::usb::Endpoint out,
+		uint32_t ndpSignature);
+
+	async::result<size_t> receive(arch::dma_buffer_view) override;
+	async::result<void> send(const arch::dma_buffer_view) override;
+	async::result<size_t> receiveBatch(std::span<nic::RxFrame>) override;
+	async::result<void> sendBatch(std::span<const arch::dma_buffer_view>) override;
+
+protected:
+	// Reads the NTB parameters of the function. Must be called before the first transfer.
+	// If setInputSize is true, the function supports SET_NTB_INPUT_SIZE.
+	async::result<void> setupNtb_(bool setInputSize);
+
+private:
+	struct RxNtb {
+		arch::dma_buffer buffer;
+		size_t length;
+	};
+
+	async::detached receiveNtbs_();
+	// Returns false if the NTB at the front of rxNtbs_ has no more datagrams.
+	bool nextDatagram_(NcmDatagramEntry &entry);
+
+	async::result<void> queueDatagram_(arch::dma_buffer_view payload);
+	// Returns the offset of the next datagram in the current NTB.
+	size_t datagramOffset_() const;
+	bool fitsTx_(size_t size) const;
+	void flushTx_();
+	async::detached flushTimer_(uint64_t generation);
+	async::detached transmitNtb_(arch::dma_buffer buffer, size_t length);
+
+	uint32_t ndpSignature_;
+	NtbParameter params_{};
+
+	size_t rxNtbSize_ = 0;
+	// Bulk-in transfers are started on the first call to receiveBatch().
+	bool rxStarted_ = false;
+	std::deque<RxNtb> rxNtbs_;
+	async::recurring_event rxEvent_;
+	async::recurring_event rxSpace_;
+	// Position of the next datagram in rxNtbs_.front(). rxNdp_ is zero if we did not
+	// look at that NTB yet.
+	size_t rxNdp_ = 0;
+	size_t rxEntry_ = 0;
+
+	size_t txNtbSize_ = 0;
+	arch::dma_buffer txNtb_;
+	std::vector<NcmDatagramEntry> txEntries_;
+	size_t txOffset_ = sizeof(NcmTransferHeader);
+	// Incremented whenever an NTB is flushed; used to expire stale flush timers.
+	uint64_t txGeneration_ = 0;
+	size_t txInFlight_ = 0;
+	async::recurring_event txDone_;
+};
+
+struct UsbNcmNic : UsbNtbNic {
 	UsbNcmNic(mbus_ng::EntityId entity, protocols::usb::Device hw_device, nic::MacAddress mac,
 		protocols::usb::Interface ctrl_intf, protocols::usb::Endpoint ctrl_ep,
 		protocols::usb::Interface intf, protocols::usb::Endpoint in, protocols::usb::Endpoint out,
@@ -52,9 +121,6 @@ struct UsbNcmNic : UsbNic {
 
 	async::result<void> initialize() override;
 	async::detached listenForNotifications() override;
-
-	async::result<size_t> receive(arch::dma_buffer_view) override;
-	async::result<void> send(const arch::dma_buffer_view) override;
 private:
 	mbus_ng::EntityId entity_;
 	size_t config_index_;
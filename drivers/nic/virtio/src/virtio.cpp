@@ -1,7 +1,12 @@
 #include <nic/virtio/virtio.hpp>
 
 #include <arch/dma_pool.hpp>
+#include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
+#include <core/dma-pool.hpp>
 #include <core/virtio/core.hpp>
+#include <deque>
+#include <vector>
 
 namespace {
 	constexpr bool logFrames = false;
@@ -10,13 +15,21 @@ namespace {
 namespace {
 // Device feature bits.
 constexpr size_t legacyHeaderSize = 10;
+// Size of the header (in both directions) if VIRTIO_NET_F_MRG_RXBUF is negotiated;
+// it includes numBuffers.
+constexpr size_t mergeableHeaderSize = 12;
 enum {
-	VIRTIO_NET_F_MAC = 5
+	VIRTIO_NET_F_CSUM = 0,
+	VIRTIO_NET_F_GUEST_CSUM = 1,
+	VIRTIO_NET_F_MAC = 5,
+	VIRTIO_NET_F_HOST_TSO4 = 11,
+	VIRTIO_NET_F_MRG_RXBUF = 15
 };
 
 // Bits for VirtHeader::flags.
 enum {
-	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1
+	VIRTIO_NET_HDR_F_NEEDS_CSUM = 1,
+	VIRTIO_NET_HDR_F_DATA_VALID = 2
 };
 
 // Values for VirtHeader::gsoType.
@@ -38,18 +51,61 @@ struct VirtHeader {
 	uint16_t numBuffers;
 };
 
+// Number of receive buffers that are kept posted to the device.
+constexpr size_t numRxSlots = 64;
+// Without mergeable buffers, each buffer holds a whole frame (and the header is separate).
+constexpr size_t rxFrameSize = 1514;
+// With mergeable buffers, the header and the frame share page-sized buffers.
+// Frames that do not fit are spread over multiple buffers.
+constexpr size_t rxMergeableSize = 4096;
+
+struct VirtioNic;
+
+// A receive buffer (together with its header) that is posted to the receive virtq.
+struct RxSlot : virtio_core::Request {
+	RxSlot(VirtioNic *nic, arch::dma_pool *pool, size_t size)
+	: nic{nic}, header{pool}, buffer{pool, size} { }
+
+	VirtioNic *nic;
+	// Only used without mergeable buffers.
+	arch::dma_object<VirtHeader> header;
+	arch::dma_buffer buffer;
+};
+
 struct VirtioNic : nic::Link {
 	VirtioNic(std::unique_ptr<virtio_core::Transport> transport);
 
 	virtual async::result<size_t> receive(arch::dma_buffer_view) override;
 	virtual async::result<void> send(const arch::dma_buffer_view) override;
+	virtual async::result<size_t> receiveBatch(std::span<nic::RxFrame>) override;
+	virtual async::result<void> sendBatch(std::span<const arch::dma_buffer_view>) override;
+	virtual async::result<void> sendOffloaded(const arch::dma_buffer_view,
+			const nic::TxMetadata &) override;
 
 	virtual ~VirtioNic() override = default;
 private:
+	async::result<void> postReceive_(RxSlot *slot);
+	async::result<void> transmit_(arch::dma_object<VirtHeader> &header,
+			const arch::dma_buffer_view payload);
+
+	// Returns the next slot that the device completed.
+	async::result<RxSlot *> nextCompleted_();
+
 	std::unique_ptr<virtio_core::Transport> transport_;
-	arch::contiguous_pool dmaPool_;
+	core::SlabDmaPool dmaPool_;
 	virtio_core::Queue *receiveVq_;
 	virtio_core::Queue *transmitVq_;
+
+	// Whether VIRTIO_NET_F_MRG_RXBUF was negotiated.
+	bool mergeable_ = false;
+	size_t headerSize_ = legacyHeaderSize;
+	size_t rxBufferSize_ = rxFrameSize;
+
+	// Receive buffers are posted on the first call to receiveBatch().
+	std::vector<std::unique_ptr<RxSlot>> rxSlots_;
+	// Slots that the device returned, in order of completion.
+	std::deque<RxSlot *> rxCompleted_;
+	async::recurring_event rxEvent_;
 };
 
 VirtioNic::VirtioNic(std::unique_ptr<virtio_core::Transport> transport)
@@ -68,6 +124,27 @@ VirtioNic::VirtioNic(std::unique_ptr<virtio_core::Transport> transport)
 		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MAC);
 	}
 
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_CSUM)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_CSUM);
+		offloads_ |= nic::OFFLOAD_TX_CSUM;
+
+		// TSO requires checksum offloading.
+		if(transport_->checkDeviceFeature(VIRTIO_NET_F_HOST_TSO4)) {
+			transport_->acknowledgeDriverFeature(VIRTIO_NET_F_HOST_TSO4);
+			offloads_ |= nic::OFFLOAD_TSO4;
+		}
+	}
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_GUEST_CSUM)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_GUEST_CSUM);
+		offloads_ |= nic::OFFLOAD_RX_CSUM;
+	}
+	if(transport_->checkDeviceFeature(VIRTIO_NET_F_MRG_RXBUF)) {
+		transport_->acknowledgeDriverFeature(VIRTIO_NET_F_MRG_RXBUF);
+		mergeable_ = true;
+		headerSize_ = mergeableHeaderSize;
+		rxBufferSize_ = rxMergeableSize;
+	}
+
 	transport_->finalizeFeatures();
 	transport_->claimQueues(2);
 	receiveVq_ = transport_->setupQueue(0);
@@ -83,30 +160,208 @@ VirtioNic::VirtioNic(std::unique_ptr<virtio_core::Transport> transport)
 }
 
 async::result<size_t> VirtioNic::receive(arch::dma_buffer_view frame) {
-	arch::dma_object<VirtHeader> header { &dmaPool_ };
+	nic::RxFrame rx;
+	co_await receiveBatch({&rx, 1});
+	assert(rx.length <= frame.size());
+	memcpy(frame.data(), reinterpret_cast<char *>(rx.buffer.data()) + rx.offset, rx.length);
+	co_return rx.length;
+}
+
+async::result<size_t> VirtioNic::receiveBatch(std::span<nic::RxFrame> frames) {
+	if(rxSlots_.empty()) {
+		// Without mergeable buffers, each slot takes two descriptors.
+		auto count = std::min(numRxSlots,
+				receiveVq_->numDescriptors() / (mergeable_ ? 1 : 2));
+		for(size_t i = 0; i < count; i++) {
+			auto &slot = rxSlots_.emplace_back(
+					std::make_unique<RxSlot>(this, &dmaPool_, rxBufferSize_));
+			co_await postReceive_(slot.get());
+		}
+		receiveVq_->notify();
+	}
+
+	while(rxCompleted_.empty())
+		co_await rxEvent_.async_wait();
+
+	size_t n = 0;
+	while(n < frames.size() && !rxCompleted_.empty()) {
+		auto slot = rxCompleted_.front();
+		rxCompleted_.pop_front();
+
+		VirtHeader header;
+		if(mergeable_) {
+			assert(slot->len >= headerSize_);
+			memcpy(&header, slot->buffer.data(), headerSize_);
+		} else {
+			header = *slot->header;
+		}
+
+		auto &frame = frames[n++];
+		frame.meta = {};
+		// Frames with NEEDS_CSUM originate from a peer that offloaded the checksum;
+		// they never travelled over a wire, hence they cannot be corrupted.
+		if(offloads_ & nic::OFFLOAD_RX_CSUM)
+			frame.meta.checksumValid = header.flags
+					& (VIRTIO_NET_HDR_F_NEEDS_CSUM | VIRTIO_NET_HDR_F_DATA_VALID);
+
+		if(!mergeable_ || header.numBuffers <= 1) {
+			// Hand out the buffer and repost the slot with a fresh one.
+			frame.offset = mergeable_ ? headerSize_ : 0;
+			frame.length = slot->len - headerSize_;
+			frame.buffer = std::exchange(slot->buffer,
+					arch::dma_buffer{&dmaPool_, rxBufferSize_});
+			co_await postReceive_(slot);
+			continue;
+		}
+
+		// The frame spans multiple buffers; gather it into a single one.
+		std::vector<RxSlot *> parts{slot};
+		size_t length = slot->len - headerSize_;
+		while(parts.size() < header.numBuffers) {
+			auto part = co_await nextCompleted_();
+			length += part->len;
+			parts.push_back(part);
+		}
+
+		frame.buffer = arch::dma_buffer{&dmaPool_, length};
+		frame.offset = 0;
+		frame.length = length;
+		size_t progress = 0;
+		for(auto part : parts) {
+			size_t skip = (part == slot) ? headerSize_ : 0;
+			memcpy(reinterpret_cast<char *>(frame.buffer.data()) + progress,
+					reinterpret_cast<char *>(part->buffer.data()) + skip, part->len - skip);
+			progress += part->len - skip;
+			co_await postReceive_(part);
+		}
+	}
+
+	// Notify the device only once for all reposted buffers.
+	receiveVq_->notify();
+	co_return n;
+}
 
+async::result<RxSlot *> VirtioNic::nextCompleted_() {
+	while(rxCompleted_.empty())
+		co_await rxEvent_.async_wait();
+	auto slot = rxCompleted_.front();
+	rxCompleted_.pop_front();
+	co_return slot;
+}
+
+async::result<void> VirtioNic::postReceive_(RxSlot *slot) {
 	virtio_core::Chain chain;
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost,
-			header.view_buffer().subview(0, legacyHeaderSize));
-	chain.append(co_await receiveVq_->obtainDescriptor());
-	chain.setupBuffer(virtio_core::deviceToHost, frame);
+	if(mergeable_) {
+		chain.append(co_await receiveVq_->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, slot->buffer);
+	} else {
+		chain.append(co_await receiveVq_->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost,
+				slot->header.view_buffer().subview(0, headerSize_));
+		chain.append(co_await receiveVq_->obtainDescriptor());
+		chain.setupBuffer(virtio_core::deviceToHost, slot->buffer);
+	}
 
-	co_return (co_await receiveVq_->submitDescriptor(chain.front()) - legacyHeaderSize);
+	receiveVq_->postDescriptor(chain.front(), slot,
+			[] (virtio_core::Request *base_request) {
+		auto slot = static_cast<RxSlot *>(base_request);
+		slot->nic->rxCompleted_.push_back(slot);
+		slot->nic->rxEvent_.raise();
+	});
 }
 
 async::result<void> VirtioNic::send(const arch::dma_buffer_view payload) {
-	if (payload.size() > 1514) {
+	co_await sendBatch({&payload, 1});
+}
+
+async::result<void> VirtioNic::sendBatch(std::span<const arch::dma_buffer_view> frames) {
+	struct BatchRequest : virtio_core::Request {
+		size_t *pending;
+		async::oneshot_event *done;
+	};
+
+	for(auto &payload : frames) {
+		if (payload.size() > 1514) {
+			throw std::runtime_error("data exceeds mtu");
+		}
+	}
+	if(frames.empty())
+		co_return;
+
+	size_t pending = frames.size();
+	async::oneshot_event done;
+	std::vector<BatchRequest> requests(frames.size());
+
+	// All frames share a single allocation of zeroed headers.
+	arch::dma_buffer headers { &dmaPool_, frames.size() * sizeof(VirtHeader) };
+	memset(headers.data(), 0, headers.size());
+
+	for(size_t i = 0; i < frames.size(); i++) {
+		// Let the device consume what we posted so far if we would wait for descriptors.
+		if(transmitVq_->numFreeDescriptors() < 2)
+			transmitVq_->notify();
+
+		virtio_core::Chain chain;
+		chain.append(co_await transmitVq_->obtainDescriptor());
+		chain.setupBuffer(virtio_core::hostToDevice,
+				headers.subview(i * sizeof(VirtHeader), headerSize_));
+		chain.append(co_await transmitVq_->obtainDescriptor());
+		chain.setupBuffer(virtio_core::hostToDevice, frames[i]);
+
+		requests[i].pending = &pending;
+		requests[i].done = &done;
+		transmitVq_->postDescriptor(chain.front(), &requests[i],
+				[] (virtio_core::Request *base_request) {
+			auto request = static_cast<BatchRequest *>(base_request);
+			if(!--*request->pending)
+				request->done->raise();
+		});
+	}
+
+	if(logFrames) {
+		std::cout << "virtio-driver: sending " << frames.size() << " frames" << std::endl;
+	}
+	transmitVq_->notify();
+	co_await done.wait();
+	if(logFrames) {
+		std::cout << "virtio-driver: sent " << frames.size() << " frames" << std::endl;
+	}
+}
+
+async::result<void> VirtioNic::sendOffloaded(const arch::dma_buffer_view payload,
+		const nic::TxMetadata &meta) {
+	// Fall back to software for offloads that the device did not negotiate.
+	if((meta.needsChecksum && !(offloads_ & nic::OFFLOAD_TX_CSUM))
+			|| (meta.gsoSize && !(offloads_ & nic::OFFLOAD_TSO4))) {
+		co_await nic::Link::sendOffloaded(payload, meta);
+		co_return;
+	}
+
+	if (!meta.gsoSize && payload.size() > 1514) {
 		throw std::runtime_error("data exceeds mtu");
 	}
 
 	arch::dma_object<VirtHeader> header { &dmaPool_ };
 	memset(header.data(), 0, sizeof(VirtHeader));
+	if(meta.needsChecksum) {
+		header->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+		header->csumStart = meta.csumStart;
+		header->csumOffset = meta.csumOffset;
+	}
+	if(meta.gsoSize) {
+		header->gsoType = VIRTIO_NET_HDR_GSO_TCPV4;
+		header->hdrLen = meta.headerLength;
+		header->gsoSize = meta.gsoSize;
+	}
+	co_await transmit_(header, payload);
+}
 
+async::result<void> VirtioNic::transmit_(arch::dma_object<VirtHeader> &header,
+		const arch::dma_buffer_view payload) {
 	virtio_core::Chain chain;
 	chain.append(co_await transmitVq_->obtainDescriptor());
 	chain.setupBuffer(virtio_core::hostToDevice,
-			header.view_buffer().subview(0, legacyHeaderSize));
+			header.view_buffer().subview(0, headerSize_));
 	chain.append(co_await transmitVq_->obtainDescriptor());
 	chain.setupBuffer(virtio_core::hostToDevice, payload);
 
@@ -22,6 +22,9 @@
 static constexpr bool logIrqs = false;
 static constexpr bool logTx = false;
 
+// Same baud rate as the kernel's serial log uses.
+constexpr unsigned int baudRate = 115200;
+
 arch::io_space base;
 helix::UniqueIrq irq;
 
@@ -65,11 +68,9 @@ void completeRecvs() {
 
 		size_t chunk = std::min(req->maxLength, recvBuffer.size());
 		assert(chunk);
-		for(size_t i = 0; i < chunk; i++) {
-			auto p = reinterpret_cast<std::byte *>(req->buffer);
-			p[i] = static_cast<std::byte>(recvBuffer.front());
-			recvBuffer.pop_front();
-		}
+		auto end = recvBuffer.begin() + chunk;
+		std::copy(recvBuffer.begin(), end, reinterpret_cast<uint8_t *>(req->buffer));
+		recvBuffer.erase(recvBuffer.begin(), end);
 
 		req->progress = chunk;
 
@@ -106,8 +107,8 @@ boost::intrusive::list<
 	>
 > sendRequests;
 
-// Size of the device's TX FIFO in bytes.
-constexpr size_t txFifoSize = 16;
+// Size of the device's TX FIFO in bytes. Determined during initialization.
+size_t txFifoSize = 1;
 
 bool txInFlight = false;
 
@@ -344,10 +345,25 @@ int main() {
 
 	base = arch::global_io.subspace(COM1);
 
-	// Perform general initialization.
+	// Perform general initialization. We try to enable the 64 byte FIFOs of the 16750;
+	// this requires DLAB while writing the FIFO control register. Other UARTs ignore the bit.
+	// Data is only drained once the RX FIFO is (almost) full or on character timeouts.
+	base.store(uart_register::lineControl, line_control::dlab(true));
 	base.store(uart_register::fifoControl,
 			fifo_control::fifoEnable(FifoCtrl::enable)
+			| fifo_control::rxReset(true) | fifo_control::txReset(true)
+			| fifo_control::enable64(true)
 			| fifo_control::fifoIrqLvl(FifoCtrl::triggerLvl14));
+	base.store(uart_register::lineControl, line_control::dlab(false));
+
+	auto ident = base.load(uart_register::irqIdentification);
+	if((ident & irq_ident_register::fifoState) == 3) {
+		txFifoSize = (ident & irq_ident_register::fifo64) ? 64 : 16;
+	}else{
+		// 8250 and 16450 have no FIFO; the 16550 (without A) has a broken one.
+		txFifoSize = 1;
+	}
+	std::cout << "uart: Using a TX FIFO of " << txFifoSize << " bytes" << std::endl;
 
 	// Wait for the FIFO to become empty.
 	while(!(base.load(uart_register::lineStatus) & line_status::txReady))
@@ -360,9 +376,11 @@ int main() {
 			| irq_enable::lineStatus(IrqCtrl::enable));
 
 	// Set the baud rate.
+	constexpr unsigned int divisor = baudClock / baudRate;
+	static_assert(divisor && divisor <= 0xFFFF);
 	base.store(uart_register::lineControl, line_control::dlab(true));
-	base.store(uart_register::baudLow, BaudRate::low9600);
-	base.store(uart_register::baudHigh, BaudRate::high9600);
+	base.store(uart_register::baudLow, divisor & 0xFF);
+	base.store(uart_register::baudHigh, divisor >> 8);
 
 	base.store(uart_register::lineControl,
 			line_control::dataBits(DataBits::charLen8)
@@ -5,10 +5,8 @@ constexpr int COM2 = 0x2F8;
 constexpr int COM3 = 0x3E8;
 constexpr int COM4 = 0x2E8;
 
-enum BaudRate {
-	low9600 = 0x0C,
-	high9600 = 0
-};
+// The divisor latch divides this frequency to obtain the baud rate.
+constexpr unsigned int baudClock = 115200;
 
 enum class DataBits {
 	charLen5 = 0,
@@ -79,6 +77,10 @@ namespace irq_enable {
 
 namespace fifo_control {
 	arch::field<uint8_t, FifoCtrl> fifoEnable(0, 1);
+	arch::field<uint8_t, bool> rxReset(1, 1);
+	arch::field<uint8_t, bool> txReset(2, 1);
+	// Only available on the 16750. Requires DLAB to be set.
+	arch::field<uint8_t, bool> enable64(5, 1);
 	arch::field<uint8_t, FifoCtrl> fifoIrqLvl(6, 2);
 }
 
@@ -97,4 +99,7 @@ namespace line_status {
 namespace irq_ident_register {
 	arch::field<uint8_t, bool> ignore(0, 1);
 	arch::field<uint8_t, IrqIds> id(1, 3);
+	arch::field<uint8_t, bool> fifo64(5, 1);
+	// Both bits are set if the FIFOs are enabled and working (i.e., on 16550A and later).
+	arch::field<uint8_t, uint8_t> fifoState(6, 2);
 }
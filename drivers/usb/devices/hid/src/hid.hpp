@@ -87,6 +87,26 @@ struct Field {
 	int arraySize;
 };
 
+// Location of a (non-padding) Field within a report.
+// These are computed once after parsing the report descriptor.
+struct FieldPlan {
+	FieldType type;
+	unsigned int bitOffset;
+	unsigned int bitSize;
+	int dataMin;
+	int dataMax;
+	bool isSigned;
+	int arraySize;
+	// Index of the first value that is produced by this field.
+	size_t valueIndex;
+};
+
+struct ReportPlan {
+	std::vector<FieldPlan> fields;
+	// Total size of the report (including the report ID).
+	unsigned int bitSize;
+};
+
 // -----------------------------------------------------
 // Elements.
 // -----------------------------------------------------
@@ -131,6 +151,7 @@ struct Handler {
 struct HidDevice {
 	HidDevice() = default;
 	void parseReportDescriptor(protocols::usb::Device device, uint8_t* p, uint8_t* limit);
+	void compileReportPlans();
 	async::detached run(protocols::usb::Device device, int intf_num, int config_num);
 
 	std::pair<uint16_t, uint16_t> getDeviceId() {
@@ -145,6 +166,8 @@ struct HidDevice {
 		{0, {}}
 	};
 
+	std::unordered_map<uint8_t, ReportPlan> reportPlans;
+
 	bool usesReportIds = false;
 
 private:
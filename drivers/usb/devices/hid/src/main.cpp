@@ -1,15 +1,19 @@
 
+#include <deque>
 #include <format>
 #include <iostream>
+#include <memory>
 #include <numeric>
 #include <optional>
 
 #include <assert.h>
+#include <endian.h>
 #include <linux/input.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
+#include <async/oneshot-event.hpp>
 #include <async/result.hpp>
 #include <core/logging.hpp>
 #include <libevbackend.hpp>
@@ -30,6 +34,10 @@ namespace {
 	constexpr bool logRawPackets = false;
 	constexpr bool logFieldValues = false;
 	constexpr bool logInputCodes = false;
+
+	// Number of interrupt transfers that we keep queued on the endpoint.
+	// With a single transfer, reports are lost while we process the previous one.
+	constexpr size_t numQueuedTransfers = 4;
 } // namespace
 
 namespace proto = protocols::usb;
@@ -213,79 +221,81 @@ int32_t signExtend(uint32_t x, int bits) {
 	return (x ^ m) - m;
 }
 
-uint8_t interpret(const std::unordered_map<uint8_t, std::vector<Field>> &fields, uint8_t *report, size_t size,
-		std::vector<std::pair<bool, int32_t>> &values, bool usesReportIds) {
-	int k = 0; // Offset of the value that we're generating.
-
-	unsigned int bit_offset = 0;
-	auto fetch = [&] (unsigned int bit_size, bool is_signed) -> int32_t {
-		assert(bit_offset + bit_size <= size * 8);
-
-		unsigned int b = bit_offset / 8;
-		assert(b < size);
-		uint32_t word = uint32_t(report[b]);
-		if(b + 1 < size)
-			word |= uint32_t(report[b + 1]) << 8;
-		if(b + 2 < size)
-			word |= uint32_t(report[b + 2]) << 16;
-		if(b + 3 < size)
-			word |= uint32_t(report[b + 3]) << 24;
-
-		uint32_t mask = (uint32_t(1) << bit_size) - 1;
-		uint32_t raw = (word >> (bit_offset % 8)) & mask;
-//			std::cout << "bit_offset: " << bit_offset << ", raw: " << raw << std::endl;
-		bit_offset += bit_size;
-
-		if(is_signed) {
-			return signExtend(raw, bit_size);
-		}else{
-			auto data = static_cast<int32_t>(raw);
-			assert(data >= 0);
-			return data;
-		}
-	};
-
-	uint8_t report_id = 0;
-
-	if(usesReportIds) {
-		report_id = *report;
-		bit_offset += 8;
+// Extracts bit_size bits at bit_offset. Reports are little endian.
+uint32_t extractBits(const uint8_t *report, size_t size, unsigned int bit_offset,
+		unsigned int bit_size) {
+	unsigned int b = bit_offset / 8;
+	assert(b < size);
+	uint32_t word;
+	if(b + 4 <= size) {
+		memcpy(&word, report + b, 4);
+		word = le32toh(word);
+	}else{
+		word = 0;
+		for(size_t i = 0; b + i < size; i++)
+			word |= uint32_t(report[b + i]) << (8 * i);
 	}
 
-	for(const Field &f : fields.at(report_id)) {
-		if(f.type == FieldType::padding) {
-			for(int i = 0; i < f.arraySize; i++)
-				fetch(f.bitSize, false);
-			continue;
-		}
+	uint32_t mask = (uint32_t(1) << bit_size) - 1;
+	return (word >> (bit_offset % 8)) & mask;
+}
 
-		assert(f.bitSize <= 31);
+void interpret(const ReportPlan &plan, const uint8_t *report, size_t size,
+		std::vector<std::pair<bool, int32_t>> &values) {
+	assert(plan.bitSize == size * 8);
 
+	for(const FieldPlan &f : plan.fields) {
 		if(f.type == FieldType::array) {
-			assert(!f.isSigned);
 			for(int i = 0; i < f.dataMax - f.dataMin + 1; i++)
-				values[k + i] = {true, 0};
+				values[f.valueIndex + i] = {true, 0};
 
 			for(int i = 0; i < f.arraySize; i++) {
-				auto data = fetch(f.bitSize, false);
+				auto data = static_cast<int32_t>(extractBits(report, size,
+						f.bitOffset + i * f.bitSize, f.bitSize));
 				if(!(data >= f.dataMin && data <= f.dataMax))
 					continue;
 
-				values[k + data - f.dataMin] = {true, 1};
+				values[f.valueIndex + data - f.dataMin] = {true, 1};
 			}
-			k += f.dataMax - f.dataMin + 1;
 		}else{
-			assert(f.type == FieldType::variable);
-			auto data = fetch(f.bitSize, f.isSigned);
+			auto raw = extractBits(report, size, f.bitOffset, f.bitSize);
+			auto data = f.isSigned ? signExtend(raw, f.bitSize) : static_cast<int32_t>(raw);
 			if(data >= f.dataMin && data <= f.dataMax)
-				values[k] = {true, data};
-			k++;
+				values[f.valueIndex] = {true, data};
 		}
 	}
+}
+
+void HidDevice::compileReportPlans() {
+	for(auto &[id, field_list] : fields) {
+		ReportPlan plan;
+		unsigned int bit_offset = usesReportIds ? 8 : 0;
+		size_t k = 0; // Offset of the value that we're generating.
+
+		for(const Field &f : field_list) {
+			if(f.type == FieldType::padding) {
+				bit_offset += f.arraySize * f.bitSize;
+				continue;
+			}
 
-	assert(bit_offset == size * 8);
+			assert(f.bitSize <= 31);
+			plan.fields.push_back(FieldPlan{f.type, bit_offset, f.bitSize, f.dataMin, f.dataMax,
+					f.isSigned, f.arraySize, k});
 
-	return report_id;
+			if(f.type == FieldType::array) {
+				assert(!f.isSigned);
+				bit_offset += f.arraySize * f.bitSize;
+				k += f.dataMax - f.dataMin + 1;
+			}else{
+				assert(f.type == FieldType::variable);
+				bit_offset += f.bitSize;
+				k++;
+			}
+		}
+
+		plan.bitSize = bit_offset;
+		reportPlans[id] = std::move(plan);
+	}
 }
 
 struct LocalState {
@@ -750,12 +760,48 @@ async::detached HidDevice::run(proto::Device device, int config_num, int intf_nu
 			return m.second.size();
 		}));
 
+	compileReportPlans();
+
+	struct QueuedTransfer {
+		QueuedTransfer(arch::dma_buffer buffer)
+		: report{std::move(buffer)} { }
+
+		arch::dma_buffer report;
+		std::optional<frg::expected<proto::UsbError, size_t>> result;
+		async::oneshot_event done;
+	};
+
+	auto submit = [&] (QueuedTransfer *queued) {
+		[] (proto::Endpoint endp, QueuedTransfer *queued) -> async::detached {
+			proto::InterruptTransfer transfer{proto::XferFlags::kXferToHost, queued->report};
+			transfer.allowShortPackets = true;
+			queued->result = co_await endp.transfer(transfer);
+			queued->done.raise();
+		}(endp, queued);
+	};
+
+	// Transfers on the same endpoint complete in order; hence, we process them in order, too.
+	std::deque<std::unique_ptr<QueuedTransfer>> queue;
+	std::vector<uint8_t> reportCopy(in_endp_pktsize);
+	for(size_t i = 0; i < numQueuedTransfers; i++) {
+		queue.push_back(std::make_unique<QueuedTransfer>(
+				arch::dma_buffer{device.bufferPool(), in_endp_pktsize}));
+		submit(queue.back().get());
+	}
+
 	while(true) {
-//		std::cout << "usb-hid: Requesting new report" << std::endl;
-		arch::dma_buffer report{device.bufferPool(), in_endp_pktsize};
-		proto::InterruptTransfer transfer{proto::XferFlags::kXferToHost, report};
-		transfer.allowShortPackets = true;
-		auto length = (co_await endp.transfer(transfer)).unwrap();
+		auto queued = std::move(queue.front());
+		queue.pop_front();
+		co_await queued->done.wait();
+		auto length = queued->result->unwrap();
+
+		// Copy the report out such that we can resubmit the buffer before processing it.
+		assert(length <= reportCopy.size());
+		memcpy(reportCopy.data(), queued->report.data(), length);
+		auto report = reportCopy.data();
+
+		queue.push_back(std::make_unique<QueuedTransfer>(std::move(queued->report)));
+		submit(queue.back().get());
 
 		// Some devices (e.g. bochs) send empty packets instead of NAKs.
 		if(!length)
@@ -766,13 +812,13 @@ async::detached HidDevice::run(proto::Device device, int config_num, int intf_nu
 					<< " (packet size is " << in_endp_pktsize << ")" << std::endl;
 			std::cout << "usb-hid: Packet:";
 			for(size_t i = 0; i < length; i++)
-				std::cout << std::format(" {:02x}", reinterpret_cast<uint8_t *>(report.data())[i]);
+				std::cout << std::format(" {:02x}", report[i]);
 			std::cout << std::endl;
 		}
 
 		std::fill(values.begin(), values.end(), std::pair<bool, int32_t>{false, 0});
-		auto report_id = interpret(fields, reinterpret_cast<uint8_t *>(report.data()),
-				length, values, usesReportIds);
+		uint8_t report_id = usesReportIds ? report[0] : 0;
+		interpret(reportPlans.at(report_id), report, length, values);
 
 		if(logFieldValues) {
 			for(size_t i = 0; i < elements.at(report_id).size(); i++)
@@ -7,6 +7,7 @@
 #include <assert.h>
 #include <stdio.h>
 
+#include <async/algorithm.hpp>
 #include <async/result.hpp>
 #include <protocols/mbus/client.hpp>
 #include <protocols/usb/usb.hpp>
@@ -22,6 +23,10 @@ namespace {
 
 	// I own a USB key that does not support the READ6 command. ~AvdG
 	constexpr bool enableRead6 = false;
+
+	// Upper bound on the data transferred by a single command (1 MiB); Linux uses the
+	// same limit for SuperSpeed devices. Larger requests are split into multiple commands.
+	constexpr size_t maxSectorsPerCommand = 2048;
 }
 
 namespace proto = protocols::usb;
@@ -64,110 +69,14 @@ async::detached StorageDevice::run(int config_num, int intf_num) {
 			_queue.pop_front();
 
 			if(logRequests)
-				std::cout << "block-usb: Reading " << req->numSectors << " sectors" << std::endl;
+				std::cout << "block-usb: " << (req->isWrite ? "Writing " : "Reading ")
+						<< req->numSectors << " sectors" << std::endl;
 			assert(req->numSectors);
-			assert(req->numSectors <= 0xFFFF);
-
-			CommandBlockWrapper cbw;
-			memset(&cbw, 0, sizeof(CommandBlockWrapper));
-			cbw.signature = Signatures::kSignCbw;
-			cbw.tag = 1;
-			cbw.transferLength = req->numSectors * 512;
-			if(!req->isWrite) {
-				cbw.flags = 0x80; // Direction: Device-to-Host.
-			}else{
-				cbw.flags = 0; // Direction: Host-to-Device.
-			}
-			cbw.lun = 0;
-
-			if(!req->isWrite) {
-				if(enableRead6 && req->sector <= 0x1FFFFF && req->numSectors <= 0xFF) {
-					scsi::Read6 command;
-					memset(&command, 0, sizeof(scsi::Read6));
-					command.opCode = 0x08;
-					command.lba[0] = req->sector >> 16;
-					command.lba[1] = (req->sector >> 8) & 0xFF;
-					command.lba[2] = req->sector & 0xFF;
-					command.transferLength = req->numSectors;
-
-					cbw.cmdLength = sizeof(scsi::Read6);
-					memcpy(cbw.cmdData, &command, sizeof(scsi::Read6));
-				}else if(req->sector <= 0xFFFFFFFF) {
-					scsi::Read10 command;
-					memset(&command, 0, sizeof(scsi::Read10));
-					command.opCode = 0x28;
-					command.lba[0] = req->sector >> 24;
-					command.lba[1] = (req->sector >> 16) & 0xFF;
-					command.lba[2] = (req->sector >> 8) & 0xFF;
-					command.lba[3] = req->sector & 0xFF;
-					command.transferLength[0] = req->numSectors >> 8;
-					command.transferLength[1] = req->numSectors & 0xFF;
-
-					cbw.cmdLength = sizeof(scsi::Read10);
-					memcpy(cbw.cmdData, &command, sizeof(scsi::Read10));
-				}else{
-					throw std::logic_error("USB storage does not currently support high LBAs!");
-				}
-			}else{
-				if(req->sector <= 0xFFFFFFFF) {
-					scsi::Write10 command;
-					memset(&command, 0, sizeof(scsi::Write10));
-					command.opCode = 0x2A;
-					command.lba[0] = req->sector >> 24;
-					command.lba[1] = (req->sector >> 16) & 0xFF;
-					command.lba[2] = (req->sector >> 8) & 0xFF;
-					command.lba[3] = req->sector & 0xFF;
-					command.transferLength[0] = req->numSectors >> 8;
-					command.transferLength[1] = req->numSectors & 0xFF;
-
-					cbw.cmdLength = sizeof(scsi::Write10);
-					memcpy(cbw.cmdData, &command, sizeof(scsi::Write10));
-				}else{
-					throw std::logic_error("USB storage does not currently support high LBAs!");
-				}
-			}
 
-			// TODO: Respect USB device DMA requirements.
-
-			// TODO: Ideally, we want to post the IN-transfer first.
-			// We do this to try to avoid unnecessary IRQs
-			// and round-trips to the device and host-controller driver.
-			CommandStatusWrapper csw;
-
-			if(logSteps)
-				std::cout << "block-usb: Sending CBW" << std::endl;
-			(co_await endp_out.transfer(proto::BulkTransfer{proto::XferFlags::kXferToDevice,
-					arch::dma_buffer_view{nullptr, &cbw, sizeof(CommandBlockWrapper)}})).unwrap();
-
-			if(logSteps)
-				std::cout << "block-usb: Waiting for data" << std::endl;
-			if(!req->isWrite) {
-				proto::BulkTransfer data_info{proto::XferFlags::kXferToHost,
-						arch::dma_buffer_view{nullptr, req->buffer, req->numSectors * 512}};
-				// TODO: We want this to be lazy but that only works if can ensure that
-				// the next transaction is also posted to the queue.
-	//			data_info.lazyNotification = true;
-				(co_await endp_in.transfer(data_info)).unwrap();
-			}else{
-				(co_await endp_out.transfer(proto::BulkTransfer{proto::XferFlags::kXferToDevice,
-						arch::dma_buffer_view{nullptr, req->buffer, req->numSectors * 512}})).unwrap();
-			}
-
-			if(logSteps)
-				std::cout << "block-usb: Waiting for CSW" << std::endl;
-			(co_await endp_in.transfer(proto::BulkTransfer{proto::XferFlags::kXferToHost,
-					arch::dma_buffer_view{nullptr, &csw, sizeof(CommandStatusWrapper)}})).unwrap();
-
-			if(logSteps)
-				std::cout << "block-usb: Request complete" << std::endl;
-			assert(csw.signature == Signatures::kSignCsw);
-			assert(csw.tag == 1);
-			assert(!csw.dataResidue);
-			if(csw.status) {
-				std::cout << "block-usb: Error status 0x"
-						<< std::hex << (unsigned int)csw.status << std::dec
-						<<  " in CSW" << std::endl;
-				throw std::runtime_error("block-usb: Giving up");
+			for(size_t progress = 0; progress < req->numSectors; progress += maxSectorsPerCommand) {
+				auto n = std::min(req->numSectors - progress, maxSectorsPerCommand);
+				co_await _transfer(endp_in, endp_out, req->isWrite, req->sector + progress,
+						static_cast<char *>(req->buffer) + progress * 512, n);
 			}
 
 			req->event.raise();
@@ -177,6 +86,133 @@ async::detached StorageDevice::run(int config_num, int intf_num) {
 	}
 }
 
+async::result<void> StorageDevice::_transfer(proto::Endpoint &endp_in, proto::Endpoint &endp_out,
+		bool isWrite, uint64_t sector, void *buffer, size_t numSectors) {
+	assert(numSectors <= maxSectorsPerCommand);
+
+	CommandBlockWrapper cbw;
+	memset(&cbw, 0, sizeof(CommandBlockWrapper));
+	cbw.signature = Signatures::kSignCbw;
+	cbw.tag = ++_tag;
+	cbw.transferLength = numSectors * 512;
+	if(!isWrite) {
+		cbw.flags = 0x80; // Direction: Device-to-Host.
+	}else{
+		cbw.flags = 0; // Direction: Host-to-Device.
+	}
+	cbw.lun = 0;
+
+	if(!isWrite) {
+		if(enableRead6 && sector <= 0x1FFFFF && numSectors <= 0xFF) {
+			scsi::Read6 command;
+			memset(&command, 0, sizeof(scsi::Read6));
+			command.opCode = 0x08;
+			command.lba[0] = sector >> 16;
+			command.lba[1] = (sector >> 8) & 0xFF;
+			command.lba[2] = sector & 0xFF;
+			command.transferLength = numSectors;
+
+			cbw.cmdLength = sizeof(scsi::Read6);
+			memcpy(cbw.cmdData, &command, sizeof(scsi::Read6));
+		}else if(sector <= 0xFFFFFFFF) {
+			scsi::Read10 command;
+			memset(&command, 0, sizeof(scsi::Read10));
+			command.opCode = 0x28;
+			command.lba[0] = sector >> 24;
+			command.lba[1] = (sector >> 16) & 0xFF;
+			command.lba[2] = (sector >> 8) & 0xFF;
+			command.lba[3] = sector & 0xFF;
+			command.transferLength[0] = numSectors >> 8;
+			command.transferLength[1] = numSectors & 0xFF;
+
+			cbw.cmdLength = sizeof(scsi::Read10);
+			memcpy(cbw.cmdData, &command, sizeof(scsi::Read10));
+		}else{
+			scsi::Read16 command;
+			memset(&command, 0, sizeof(scsi::Read16));
+			command.opCode = 0x88;
+			for(int i = 0; i < 8; i++)
+				command.lba[i] = (sector >> (56 - 8 * i)) & 0xFF;
+			for(int i = 0; i < 4; i++)
+				command.transferLength[i] = (numSectors >> (24 - 8 * i)) & 0xFF;
+
+			cbw.cmdLength = sizeof(scsi::Read16);
+			memcpy(cbw.cmdData, &command, sizeof(scsi::Read16));
+		}
+	}else{
+		if(sector <= 0xFFFFFFFF) {
+			scsi::Write10 command;
+			memset(&command, 0, sizeof(scsi::Write10));
+			command.opCode = 0x2A;
+			command.lba[0] = sector >> 24;
+			command.lba[1] = (sector >> 16) & 0xFF;
+			command.lba[2] = (sector >> 8) & 0xFF;
+			command.lba[3] = sector & 0xFF;
+			command.transferLength[0] = numSectors >> 8;
+			command.transferLength[1] = numSectors & 0xFF;
+
+			cbw.cmdLength = sizeof(scsi::Write10);
+			memcpy(cbw.cmdData, &command, sizeof(scsi::Write10));
+		}else{
+			scsi::Write16 command;
+			memset(&command, 0, sizeof(scsi::Write16));
+			command.opCode = 0x8A;
+			for(int i = 0; i < 8; i++)
+				command.lba[i] = (sector >> (56 - 8 * i)) & 0xFF;
+			for(int i = 0; i < 4; i++)
+				command.transferLength[i] = (numSectors >> (24 - 8 * i)) & 0xFF;
+
+			cbw.cmdLength = sizeof(scsi::Write16);
+			memcpy(cbw.cmdData, &command, sizeof(scsi::Write16));
+		}
+	}
+
+	// TODO: Respect USB device DMA requirements.
+
+	// Post all three phases at once. The host controller then already has the data
+	// and CSW transfers queued when the device finishes the previous phase, instead
+	// of waiting for a round trip through this driver after each phase.
+	CommandStatusWrapper csw;
+	auto data_endp = isWrite ? &endp_out : &endp_in;
+	auto data_flags = isWrite ? proto::XferFlags::kXferToDevice : proto::XferFlags::kXferToHost;
+
+	frg::expected<proto::UsbError, size_t> cbw_outcome, data_outcome, csw_outcome;
+	auto record = [] (frg::expected<proto::UsbError, size_t> &outcome) {
+		return [&outcome] (frg::expected<proto::UsbError, size_t> result) {
+			outcome = std::move(result);
+		};
+	};
+
+	if(logSteps)
+		std::cout << "block-usb: Sending CBW, data and CSW transfers" << std::endl;
+	co_await async::when_all(
+		async::transform(endp_out.transfer(proto::BulkTransfer{proto::XferFlags::kXferToDevice,
+				arch::dma_buffer_view{nullptr, &cbw, sizeof(CommandBlockWrapper)}}),
+			record(cbw_outcome)),
+		async::transform(data_endp->transfer(proto::BulkTransfer{data_flags,
+				arch::dma_buffer_view{nullptr, buffer, numSectors * 512}}),
+			record(data_outcome)),
+		async::transform(endp_in.transfer(proto::BulkTransfer{proto::XferFlags::kXferToHost,
+				arch::dma_buffer_view{nullptr, &csw, sizeof(CommandStatusWrapper)}}),
+			record(csw_outcome))
+	);
+	cbw_outcome.unwrap();
+	data_outcome.unwrap();
+	csw_outcome.unwrap();
+
+	if(logSteps)
+		std::cout << "block-usb: Request complete" << std::endl;
+	assert(csw.signature == Signatures::kSignCsw);
+	assert(csw.tag == cbw.tag);
+	assert(!csw.dataResidue);
+	if(csw.status) {
+		std::cout << "block-usb: Error status 0x"
+				<< std::hex << (unsigned int)csw.status << std::dec
+				<<  " in CSW" << std::endl;
+		throw std::runtime_error("block-usb: Giving up");
+	}
+}
+
 async::result<void> StorageDevice::readSectors(uint64_t sector,
 		void *buffer, size_t numSectors) {
 	Request req{false, sector, buffer, numSectors};
@@ -257,7 +293,12 @@ async::detached bindDevice(mbus_ng::Entity entity) {
 
 	auto storage_device = new StorageDevice(device);
 	storage_device->run(config_number.value(), intf_number.value());
-	blockfs::runDevice(storage_device);
+
+	// Bulk-Only Transport processes one command at a time; let the scheduler merge requests.
+	blockfs::SchedulerOptions scheduler;
+	scheduler.maxMergeSectors = maxSectorsPerCommand;
+	scheduler.maxInFlight = 1;
+	blockfs::runDevice(storage_device, scheduler);
 }
 
 async::detached observeDevices() {
@@ -76,6 +76,17 @@ struct Read16 {
 	uint8_t grpNumber;
 	uint8_t control;
 };
+static_assert(sizeof(Read16) == 16);
+
+struct Write16 {
+	uint8_t opCode;
+	uint8_t options;
+	uint8_t lba[8];
+	uint8_t transferLength[4];
+	uint8_t grpNumber;
+	uint8_t control;
+};
+static_assert(sizeof(Write16) == 16);
 
 struct Read32 {
 	uint8_t opCode;
@@ -111,6 +122,11 @@ struct StorageDevice : blockfs::BlockDevice {
 	async::result<size_t> getSize() override;
 
 private:
+	// Performs a single Bulk-Only Transport command.
+	async::result<void> _transfer(protocols::usb::Endpoint &endp_in,
+			protocols::usb::Endpoint &endp_out, bool isWrite, uint64_t sector,
+			void *buffer, size_t numSectors);
+
 	struct Request {
 		Request(bool isWrite, uint64_t sector, void *buffer, size_t numSectors)
 		: isWrite{isWrite}, sector{sector}, buffer{buffer}, numSectors{numSectors} { }
@@ -125,6 +141,7 @@ private:
 
 	protocols::usb::Device _usbDevice;
 	async::recurring_event _doorbell;
+	uint32_t _tag = 0;
 
 	boost::intrusive::list<
 		Request,
@@ -9,10 +9,9 @@
 #include <arch/dma_pool.hpp>
 #include <async/result.hpp>
 #include <boost/intrusive/list.hpp>
-#include <fafnir/dsl.hpp>
 #include <helix/ipc.hpp>
 #include <protocols/hw/client.hpp>
-#include <protocols/kernlet/compiler.hpp>
+#include <protocols/kernlet/programs.hpp>
 #include <protocols/mbus/client.hpp>
 #include <protocols/usb/usb.hpp>
 #include <protocols/usb/api.hpp>
@@ -401,55 +400,14 @@ Controller::enumerateDevice(std::shared_ptr<proto::Hub> hub, int port, proto::De
 }
 
 async::detached Controller::handleIrqs() {
-	co_await connectKernletCompiler();
-
-	std::vector<uint8_t> kernlet_program;
-	fnr::emit_to(std::back_inserter(kernlet_program),
-		// Load the USBSTS register.
-		fnr::scope_push{} (
-			fnr::intrin{"__mmio_read32", 2, 1} (
-				fnr::binding{0}, // EHCI MMIO region (bound to slot 0).
-				fnr::binding{1} // EHCI MMIO offset (bound to slot 1).
-					 + fnr::literal{4} // Offset of USBSTS.
-			) & fnr::literal{23} // USB transaction, error, port change and host error bits.
-		),
-		// Ack the IRQ iff one of the bits was set.
-		fnr::check_if{},
-			fnr::scope_get{0},
-		fnr::then{},
-			// Write back the interrupt bits to USBSTS to deassert the IRQ.
-			fnr::intrin{"__mmio_write32", 3, 0} (
-				fnr::binding{0}, // EHCI MMIO region (bound to slot 0).
-				fnr::binding{1} // EHCI MMIO offset (bound to slot 1).
-					+ fnr::literal{4}, // Offset of USBSTS.
-				fnr::scope_get{0}
-			),
-			// Trigger the bitset event (bound to slot 2).
-			fnr::intrin{"__trigger_bitset", 2, 0} (
-				fnr::binding{2},
-				fnr::scope_get{0}
-			),
-			fnr::scope_push{} ( fnr::literal{1} ),
-		fnr::else_then{},
-			fnr::scope_push{} ( fnr::literal{2} ),
-		fnr::end{}
-	);
-
-	auto kernlet_object = co_await compile(kernlet_program.data(),
-			kernlet_program.size(), {BindType::memoryView, BindType::offset,
-			BindType::bitsetEvent});
-
-	HelHandle event_handle;
-	HEL_CHECK(helCreateBitsetEvent(&event_handle));
-	helix::UniqueDescriptor event{event_handle};
-
-	HelKernletData data[3];
-	data[0].handle = _mmio.getHandle();
-	data[1].handle = _mapping.offset() + _space.load(cap_regs::caplength);
-	data[2].handle = event.getHandle();
-	HelHandle bound_handle;
-	HEL_CHECK(helBindKernlet(kernlet_object.getHandle(), data, 3, &bound_handle));
-	HEL_CHECK(helAutomateIrq(_irq.getHandle(), 0, bound_handle));
+	// Ack the USB transaction, error, port change and host error bits in USBSTS.
+	auto event = co_await automateStatusIrq(_irq, _mmio,
+			_mapping.offset() + _space.load(cap_regs::caplength),
+			StatusIrqKernlet{
+				.offset = 4, // Offset of USBSTS.
+				.mask = 23,
+				.writeBack = StatusIrqKernlet::WriteBack::bits
+			});
 
 	co_await _hwDevice.enableBusIrq();
 
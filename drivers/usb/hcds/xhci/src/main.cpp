@@ -357,6 +357,11 @@ void Interrupter::initialize() {
 
 	_updateDequeue();
 
+	// Coalesce interrupts: the controller waits for at least the moderation interval
+	// between two interrupts. All events that arrive in between are handled by a
+	// single pass over the event ring (and a single ERDP update).
+	_space.store(interrupter::imod, imod::interval(moderationInterval) | imod::counter(0));
+
 	_space.store(interrupter::iman, _space.load(interrupter::iman) | iman::enable(1));
 }
 
@@ -61,7 +61,8 @@ inline frg::expected<protocols::usb::UsbError> completionToError(Event ev) {
 struct Controller;
 
 struct EventRing {
-	constexpr static size_t eventRingSize = 128;
+	// One page; large enough to absorb the events that accumulate during interrupt moderation.
+	constexpr static size_t eventRingSize = 256;
 
 	struct alignas(64) ErstEntry {
 		uint32_t ringSegmentBaseLow;
@@ -77,7 +77,7 @@ namespace interrupter {
 	}
 
 	inline constexpr arch::bit_register<uint32_t> iman(0x0);
-	inline constexpr arch::scalar_register<uint32_t> imod(0x4);
+	inline constexpr arch::bit_register<uint32_t> imod(0x4);
 	inline constexpr arch::scalar_register<uint32_t> erstsz(0x8);
 	inline constexpr arch::scalar_register<uint32_t> erstbaLow(0x10);
 	inline constexpr arch::scalar_register<uint32_t> erstbaHi(0x14);
@@ -90,6 +90,12 @@ namespace iman {
 	inline constexpr arch::field<uint32_t, bool> enable(1, 1);
 }
 
+namespace imod {
+	// In units of 250ns.
+	inline constexpr arch::field<uint32_t, uint16_t> interval(0, 16);
+	inline constexpr arch::field<uint32_t, uint16_t> counter(16, 16);
+}
+
 namespace port {
 	inline constexpr arch::mem_space spaceForIndex(arch::mem_space portSpace, int idx) {
 		return portSpace.subspace(idx * 16);
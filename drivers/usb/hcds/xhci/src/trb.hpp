@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cassert>
 
+#include <algorithm>
 #include <bit>
 
 #include <arch/dma_pool.hpp>
@@ -176,6 +177,13 @@ namespace Transfer {
 
 			auto chunk = std::min(view.size() - progress, 0x1000 - (ptr & 0xFFF));
 
+			// Cover as many physically contiguous pages as possible with one TRB.
+			// A TRB's buffer must not cross a 64 KiB boundary.
+			size_t limit = 0x10000 - (pptr & 0xFFFF);
+			while(progress + chunk < view.size() && chunk < limit
+					&& helix::addressToPhysical(ptr + chunk) == pptr + chunk)
+				chunk += std::min({view.size() - progress - chunk, size_t{0x1000}, limit - chunk});
+
 			bool chain = (progress + chunk) < view.size();
 
 			// TODO(qookie): For xHCI 0.96 and older, this should be (progress + chunk) >> 10.
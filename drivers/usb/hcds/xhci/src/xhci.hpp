@@ -65,6 +65,9 @@ struct Controller;
 // ----------------------------------------------------------------
 
 struct Interrupter {
+	// 40us (in units of 250ns); this is also what Linux uses.
+	static constexpr uint16_t moderationInterval = 160;
+
 	Interrupter(EventRing *ring, arch::mem_space space)
 	: _ring{ring}, _space{space} { }
 
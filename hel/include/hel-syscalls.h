@@ -151,6 +151,11 @@ extern inline __attribute__ (( always_inline )) HelError helForkMemory(HelHandle
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helForkSpace(HelHandle space,
+		struct HelForkArea *areas, size_t num_areas) {
+	return helSyscall3(kHelCallForkSpace, (HelWord)space, (HelWord)areas, (HelWord)num_areas);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateSpace(HelHandle *handle) {
 	HelWord handle_word;
 	HelError error = helSyscall0_1(kHelCallCreateSpace, &handle_word);
@@ -225,6 +230,12 @@ extern inline __attribute__ (( always_inline )) HelError helPointerPhysical(cons
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helQueryMappingUsage(HelHandle space,
+		void *pointer, size_t size, struct HelMappingUsage *usage) {
+	return helSyscall4(kHelCallQueryMappingUsage, (HelWord)space, (HelWord)pointer,
+			(HelWord)size, (HelWord)usage);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitReadMemory(HelHandle handle,
 		uintptr_t address, size_t length, void *buffer,
 		HelHandle queue, uintptr_t context) {
@@ -241,6 +252,40 @@ extern inline __attribute__ (( always_inline )) HelError helSubmitWriteMemory(He
 			(HelWord)queue, (HelWord)context);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helCreateSpaceWindow(HelHandle space,
+		void *pointer, size_t length, HelHandle *handle) {
+	HelWord hel_handle;
+	HelError error = helSyscall3_1(kHelCallCreateSpaceWindow, (HelWord)space,
+			(HelWord)pointer, (HelWord)length, &hel_handle);
+	*handle = (HelHandle)hel_handle;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helRevokeSpaceWindow(HelHandle handle) {
+	return helSyscall1(kHelCallRevokeSpaceWindow, (HelWord)handle);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helSubmitCopyFromWindow(
+		HelHandle window, HelHandle memory, uintptr_t offset, size_t length,
+		HelHandle queue, uintptr_t context) {
+	return helSyscall6(kHelCallSubmitCopyFromWindow, (HelWord)window, (HelWord)memory,
+			(HelWord)offset, (HelWord)length, (HelWord)queue, (HelWord)context);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helSubmitReadMemoryVector(
+		HelHandle handle, const struct HelMemoryVector *vectors, size_t count,
+		HelHandle queue, uintptr_t context) {
+	return helSyscall5(kHelCallSubmitReadMemoryVector, (HelWord)handle, (HelWord)vectors,
+			(HelWord)count, (HelWord)queue, (HelWord)context);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helSubmitWriteMemoryVector(
+		HelHandle handle, const struct HelMemoryVector *vectors, size_t count,
+		HelHandle queue, uintptr_t context) {
+	return helSyscall5(kHelCallSubmitWriteMemoryVector, (HelWord)handle, (HelWord)vectors,
+			(HelWord)count, (HelWord)queue, (HelWord)context);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helMemoryInfo(HelHandle handle, 
 		size_t *size) {
 	HelWord handle_word;
@@ -260,6 +305,17 @@ extern inline __attribute__ (( always_inline )) HelError helUpdateMemory(HelHand
 			(HelWord)offset, (HelWord)length);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helEnableSwap(HelHandle handle,
+		size_t numPages) {
+	return helSyscall2(kHelCallEnableSwap, (HelWord)handle, (HelWord)numPages);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helAdviseMemory(HelHandle handle,
+		uintptr_t offset, size_t length, int advice) {
+	return helSyscall4(kHelCallAdviseMemory, (HelWord)handle, (HelWord)offset,
+			(HelWord)length, (HelWord)advice);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitLockMemoryView(HelHandle handle,
 		uintptr_t offset, size_t size, HelHandle queue, uintptr_t context) {
 	return helSyscall5(kHelCallSubmitLockMemoryView, (HelWord)handle, (HelWord)offset,
@@ -286,6 +342,16 @@ extern inline __attribute__ (( always_inline )) HelError helQueryThreadStats(Hel
 	return helSyscall2(kHelCallQueryThreadStats, (HelWord)handle, (HelWord)stats);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetThreadPmc(HelHandle handle,
+		uint32_t events) {
+	return helSyscall2(kHelCallSetThreadPmc, (HelWord)handle, (HelWord)events);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helQueryThreadPmc(HelHandle handle,
+		struct HelPmcValues *values) {
+	return helSyscall2(kHelCallQueryThreadPmc, (HelWord)handle, (HelWord)values);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helYield() {
 	return helSyscall0(kHelCallYield);
 };
@@ -295,6 +361,11 @@ extern inline __attribute__ (( always_inline )) HelError helSetPriority(HelHandl
 	return helSyscall2(kHelCallSetPriority, (HelWord)handle, (HelWord)priority);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSetScheduling(HelHandle handle,
+		const struct HelSchedulingParameters *parameters) {
+	return helSyscall2(kHelCallSetScheduling, (HelWord)handle, (HelWord)parameters);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitObserve(HelHandle handle,
 		uint64_t in_seq, HelHandle queue, uintptr_t context) {
 	return helSyscall4(kHelCallSubmitObserve, (HelWord)handle, (HelWord)in_seq,
@@ -309,6 +380,19 @@ extern inline __attribute__ (( always_inline )) HelError helInterruptThread(HelH
 	return helSyscall1(kHelCallInterruptThread, (HelWord)handle);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helQueueSignal(HelHandle handle,
+		const struct HelSignalDelivery *delivery) {
+	return helSyscall2(kHelCallQueueSignal, (HelWord)handle, (HelWord)delivery);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helDequeueSignal(HelHandle handle,
+		int *dequeued) {
+	HelWord dequeued_word;
+	HelError error = helSyscall1_1(kHelCallDequeueSignal, (HelWord)handle, &dequeued_word);
+	*dequeued = (int)dequeued_word;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helResume(HelHandle handle) {
 	return helSyscall1(kHelCallResume, (HelWord)handle);
 };
@@ -353,6 +437,13 @@ extern inline __attribute__ (( always_inline )) HelError helGetClock(uint64_t *c
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helAccessClockPage(HelHandle *handle) {
+	HelWord handle_word;
+	HelError error = helSyscall0_1(kHelCallAccessClockPage, &handle_word);
+	*handle = (HelHandle)handle_word;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClock(uint64_t counter,
 		HelHandle queue, uintptr_t context, uint64_t *async_id) {
 	HelWord async_word;
@@ -362,6 +453,16 @@ extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClock(uin
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitClockWithSlack(
+		uint64_t counter, uint64_t slack, HelHandle queue, uintptr_t context,
+		uint64_t *async_id) {
+	HelWord async_word;
+	HelError error = helSyscall4_1(kHelCallSubmitAwaitClockWithSlack, (HelWord)counter,
+			(HelWord)slack, (HelWord)queue, (HelWord)context, &async_word);
+	*async_id = (uint64_t)async_word;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateStream(HelHandle *lane1,
 		HelHandle *lane2, uint32_t attach_credentials) {
 	HelWord out_lane1;
@@ -379,6 +480,15 @@ extern inline __attribute__ (( always_inline )) HelError helSubmitAsync(HelHandl
 			(HelWord)queue, (HelWord)context, (HelWord)flags);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helSubmitAsyncRing(
+		struct HelSubmissionRing *ring, unsigned int ringShift, size_t *numSubmitted) {
+	HelWord count;
+	HelError error = helSyscall2_1(kHelCallSubmitAsyncRing, (HelWord)ring,
+			(HelWord)ringShift, &count);
+	*numSubmitted = (size_t)count;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helShutdownLane(HelHandle handle) {
 	return helSyscall1(kHelCallShutdownLane, (HelWord)handle);
 };
@@ -393,6 +503,40 @@ extern inline __attribute__ (( always_inline )) HelError helFutexWake(int *point
 	return helSyscall1(kHelCallFutexWake, (HelWord)pointer);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helFutexRequeue(int *pointer,
+		int *target, int expected, size_t wakeCount, size_t requeueCount, size_t *count) {
+	HelWord countWord;
+	HelError error = helSyscall5_1(kHelCallFutexRequeue, (HelWord)pointer, (HelWord)target,
+			(HelWord)expected, (HelWord)wakeCount, (HelWord)requeueCount, &countWord);
+	*count = (size_t)countWord;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helSubmitAwaitFutex(int *pointer,
+		int expected, HelHandle queue, uintptr_t context, uint64_t *asyncId) {
+	HelWord asyncWord;
+	HelError error = helSyscall4_1(kHelCallSubmitAwaitFutex, (HelWord)pointer,
+			(HelWord)expected, (HelWord)queue, (HelWord)context, &asyncWord);
+	*asyncId = (uint64_t)asyncWord;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helGetFutexTid(uint32_t *tid) {
+	HelWord tidWord;
+	HelError error = helSyscall0_1(kHelCallGetFutexTid, &tidWord);
+	*tid = (uint32_t)tidWord;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helFutexLockPi(int *pointer,
+		int64_t deadline) {
+	return helSyscall2(kHelCallFutexLockPi, (HelWord)pointer, (HelWord)deadline);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helFutexUnlockPi(int *pointer) {
+	return helSyscall1(kHelCallFutexUnlockPi, (HelWord)pointer);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateOneshotEvent(HelHandle *handle) {
 	HelWord handle_word;
 	HelError error = helSyscall0_1(kHelCallCreateOneshotEvent, &handle_word);
@@ -454,6 +598,17 @@ extern inline __attribute__ (( always_inline )) HelError helEnableFullIo() {
 	return helSyscall0(kHelCallEnableFullIo);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helMapDma(HelHandle handle,
+		const struct HelDmaMapping *mappings, size_t count) {
+	return helSyscall3(kHelCallMapDma, (HelWord)handle, (HelWord)mappings, (HelWord)count);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helUnmapDma(HelHandle handle,
+		const uintptr_t *ioAddresses, size_t count) {
+	return helSyscall3(kHelCallUnmapDma, (HelWord)handle, (HelWord)ioAddresses,
+			(HelWord)count);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helBindKernlet(HelHandle handle,
 		const union HelKernletData *data, size_t num_data, HelHandle *bound_handle) {
 	HelWord handle_word;
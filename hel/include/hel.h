@@ -18,7 +18,7 @@
 
 enum {
 	// largest system call number plus 1
-	kHelNumCalls = 105,
+	kHelNumCalls = 129,
 
 	kHelCallLog = 1,
 	kHelCallPanic = 10,
@@ -42,6 +42,7 @@ enum {
 	kHelCallAccessPhysical = 30,
 	kHelCallCreateSliceView = 88,
 	kHelCallForkMemory = 40,
+	kHelCallForkSpace = 110,
 	kHelCallCreateSpace = 27,
 	kHelCallCreateIndirectMemory = 45,
 	kHelCallAlterMemoryIndirection = 52,
@@ -50,29 +51,44 @@ enum {
 	kHelCallSubmitSynchronizeSpace = 53,
 	kHelCallUnmapMemory = 36,
 	kHelCallPointerPhysical = 43,
+	kHelCallQueryMappingUsage = 120,
 	kHelCallSubmitReadMemory = 77,
 	kHelCallSubmitWriteMemory = 78,
+	kHelCallSubmitReadMemoryVector = 117,
+	kHelCallSubmitWriteMemoryVector = 118,
+	kHelCallCreateSpaceWindow = 126,
+	kHelCallRevokeSpaceWindow = 127,
+	kHelCallSubmitCopyFromWindow = 128,
 	kHelCallMemoryInfo = 26,
 	kHelCallSubmitManageMemory = 46,
 	kHelCallUpdateMemory = 47,
 	kHelCallSubmitLockMemoryView = 48,
 	kHelCallLoadahead = 49,
+	kHelCallEnableSwap = 124,
+	kHelCallAdviseMemory = 125,
 	kHelCallCreateVirtualizedSpace = 50,
 
 	kHelCallCreateThread = 67,
 	kHelCallQueryThreadStats = 95,
+	kHelCallSetThreadPmc = 108,
+	kHelCallQueryThreadPmc = 109,
 	kHelCallSetPriority = 85,
+	kHelCallSetScheduling = 114,
 	kHelCallYield = 34,
 	kHelCallSubmitObserve = 74,
 	kHelCallKillThread = 87,
 	kHelCallInterruptThread = 86,
+	kHelCallQueueSignal = 112,
+	kHelCallDequeueSignal = 113,
 	kHelCallResume = 61,
 	kHelCallLoadRegisters = 75,
 	kHelCallStoreRegisters = 76,
 	kHelCallQueryRegisterInfo = 102,
 	kHelCallWriteFsBase = 41,
 	kHelCallGetClock = 42,
+	kHelCallAccessClockPage = 111,
 	kHelCallSubmitAwaitClock = 80,
+	kHelCallSubmitAwaitClockWithSlack = 106,
 	kHelCallCreateVirtualizedCpu = 37,
 	kHelCallRunVirtualizedCpu = 38,
 	kHelCallGetRandomBytes = 101,
@@ -83,10 +99,16 @@ enum {
 
 	kHelCallCreateStream = 68,
 	kHelCallSubmitAsync = 79,
+	kHelCallSubmitAsyncRing = 107,
 	kHelCallShutdownLane = 91,
 
 	kHelCallFutexWait = 73,
 	kHelCallFutexWake = 71,
+	kHelCallFutexRequeue = 105,
+	kHelCallSubmitAwaitFutex = 119,
+	kHelCallGetFutexTid = 121,
+	kHelCallFutexLockPi = 122,
+	kHelCallFutexUnlockPi = 123,
 
 	kHelCallCreateOneshotEvent = 96,
 	kHelCallCreateBitsetEvent = 97,
@@ -99,6 +121,8 @@ enum {
 	kHelCallAccessIo = 11,
 	kHelCallEnableIo = 12,
 	kHelCallEnableFullIo = 35,
+	kHelCallMapDma = 115,
+	kHelCallUnmapDma = 116,
 
 	kHelCallBindKernlet = 93,
 
@@ -176,6 +200,26 @@ struct HelX86VirtualizationRegs {
 	uint64_t apic_base;
 };
 
+//! Exits that are handled by the kernel instead of being reported by ::helRunVirtualizedCpu.
+enum {
+	//! CPUID returns the host's leaves, with virtualization features hidden.
+	kHelVmexitHandleCpuid = 1,
+	//! RDMSR/WRMSR of IA32_TSC, IA32_APIC_BASE, IA32_MISC_ENABLE and the MTRR/microcode MSRs.
+	kHelVmexitHandleMsr = 2,
+	//! HLT resumes the guest if an in-kernel interrupt (i.e., the APIC timer) is pending.
+	kHelVmexitHandleHlt = 4,
+	//! x2APIC timer MSRs (LVT timer, initial/current count, divide configuration,
+	//! TSC deadline) and EOI. The timer counts at the TSC frequency.
+	kHelVmexitHandleApicTimer = 8,
+};
+
+//! Register set ::kHelRegsVirtualizationControl.
+struct HelX86VirtualizationControl {
+	//! Mask of kHelVmexitHandle* flags. Zero (the default) reports all exits.
+	uint32_t handledExits;
+	uint32_t reserved;
+};
+
 enum {
 	kHelNullHandle = 0,
 	kHelThisUniverse = -1,
@@ -225,6 +269,31 @@ struct HelAction {
 	HelHandle handle;
 };
 
+//! A single entry of a HelSubmissionRing.
+//! The fields correspond to the arguments of helSubmitAsync().
+struct HelRingSubmission {
+	HelHandle handle;
+	const struct HelAction *actions;
+	size_t count;
+	HelHandle queue;
+	uintptr_t context;
+	uint32_t flags;
+	//! Written by the kernel: result of submitting this entry.
+	HelError error;
+};
+
+//! Ring of helSubmitAsync() calls in user space memory.
+//! User space writes entries and advances @p tail;
+//! helSubmitAsyncRing() consumes entries and advances @p head.
+struct HelSubmissionRing {
+	//! Index of the next entry that the kernel consumes.
+	uint32_t head;
+	//! Index one past the last entry that user space produced.
+	uint32_t tail;
+	//! The entries. The size of this array is passed to helSubmitAsyncRing().
+	struct HelRingSubmission entries[];
+};
+
 struct HelDescriptorInfo {
 	int type;
 };
@@ -232,21 +301,77 @@ struct HelDescriptorInfo {
 enum HelAllocFlags {
 	kHelAllocContinuous = 4,
 	kHelAllocOnDemand = 1,
+	// Back the memory by 2 MiB chunks such that it can be mapped using large pages.
+	kHelAllocHugePages = 8,
+	// Prefer memory from the NUMA node given in HelAllocRestrictions::numaNode.
+	kHelAllocNumaNode = 16,
+	// Allow the kernel to compress or swap out cold pages under memory pressure.
+	// Physical addresses of such memory (see ::helPointerPhysical) are not stable;
+	// it must not be used for DMA. Ignored for continuous, huge page and
+	// address-restricted allocations.
+	kHelAllocSwappable = 32,
 };
 
 struct HelAllocRestrictions {
 	int addressBits;
+	int numaNode;
+};
+
+enum HelDmaFlags {
+	// The device may read from the memory.
+	kHelDmaRead = 1,
+	// The device may write to the memory.
+	kHelDmaWrite = 2
+};
+
+struct HelDmaMapping {
+	HelHandle memory;
+	uintptr_t offset;
+	uintptr_t ioAddress;
+	size_t length;
+	uint32_t flags;
+};
+
+// Maximal number of elements per helSubmitReadMemoryVector() or
+// helSubmitWriteMemoryVector() call.
+enum {
+	kHelMaxMemoryVectors = 1024
+};
+
+struct HelMemoryVector {
+	uintptr_t address;
+	size_t length;
+	void *buffer;
 };
 
 enum HelManagedFlags {
 	kHelManagedReadahead = 1
 };
 
+//! Layout of priority inheritance futex words (see ::helFutexLockPi).
+enum HelFutexPiFlags {
+	//! The TID (see ::helGetFutexTid) of the owner or zero if the futex is unlocked.
+	kHelFutexPiTidMask = 0x3FFFFFFF,
+	//! Set by the kernel if the previous owner terminated while holding the futex.
+	kHelFutexPiOwnerDied = 0x40000000,
+	//! Set by the kernel while threads wait for the futex.
+	kHelFutexPiWaiters = 0x80000000
+};
+
 enum HelManageRequests {
 	kHelManageInitialize = 1,
 	kHelManageWriteback = 2
 };
 
+//! Advice for ::helAdviseMemory.
+enum HelMemoryAdvice {
+	//! Identical pages of the range may be merged (i.e., shared copy-on-write).
+	kHelAdviseMergeable = 1,
+	//! Pages of the range are not merged anymore. Already merged pages stay merged
+	//! until they are written to.
+	kHelAdviseUnmergeable = 2
+};
+
 enum HelMapFlags {
 	// Additional flags that may be set.
 	kHelMapProtRead = 256,
@@ -254,13 +379,96 @@ enum HelMapFlags {
 	kHelMapProtExecute = 1024,
 	kHelMapDontRequireBacking = 128,
 	kHelMapFixed = 2048,
-	kHelMapFixedNoReplace = 4096
+	kHelMapFixedNoReplace = 4096,
+	// Hint: use large pages where the memory is physically contiguous and aligned.
+	kHelMapPreferHugePages = 8192,
+	// Fault in the entire range while mapping it.
+	kHelMapPopulate = 16384
+};
+
+enum HelForkAreaFlags {
+	// Fork the memory object (see ::helForkMemory) and map the forked object.
+	kHelForkAreaCopyOnWrite = 1
+};
+
+//! Describes one mapping of ::helForkSpace.
+struct HelForkArea {
+	//! Handle to the memory object that is mapped (or forked).
+	HelHandle memory;
+	//! Address of the mapping in the new address space.
+	uintptr_t address;
+	//! Offset in bytes, relative to @p memory.
+	uintptr_t offset;
+	//! Size of the mapping in bytes.
+	size_t size;
+	//! Mapping flags (see ::helMapMemory).
+	uint32_t mapFlags;
+	//! Combination of HelForkAreaFlags.
+	uint32_t forkFlags;
+	//! [out] Handle to the forked memory object (if ::kHelForkAreaCopyOnWrite is set).
+	HelHandle forkedMemory;
+	//! [out] Result of forking and mapping this area.
+	HelError error;
+};
+
+//! Memory accounting of a range of an address space (see ::helQueryMappingUsage).
+//! All sizes are in bytes.
+struct HelMappingUsage {
+	//! Memory that is mapped and backed by the mapped memory object.
+	//! This does not include the global zero page.
+	size_t resident;
+	//! Part of @p resident that is not backed by a file (e.g., private copies).
+	size_t anonymous;
+	//! Part of @p resident that can also be mapped elsewhere
+	//! (e.g., the page cache or shared memory objects).
+	size_t shared;
+	//! Memory that was resident before but has been evicted since.
+	size_t evicted;
+	//! Part of @p evicted that is anonymous memory (i.e., compressed or swapped out).
+	size_t swapped;
 };
 
 enum HelThreadFlags {
 	kHelThreadStopped = 1
 };
 
+//! Describes a signal frame that the kernel builds on behalf of a server (see ::helQueueSignal).
+//!
+//! The frame is placed below the stack pointer of the thread (minus @p redZone),
+//! or at the top of the alternate stack if one is given and the thread does not
+//! already run on it. It consists of @p payload, followed by the ::kHelRegsSimd
+//! image of the thread. The ::kHelRegsSignal image of the thread is stored at
+//! @p registersOffset (within the payload).
+struct HelSignalDelivery {
+	//! Address at which the thread continues execution.
+	uintptr_t ip;
+	//! Base of the alternate stack, or zero.
+	uintptr_t altStackBase;
+	//! Size of the alternate stack in bytes.
+	size_t altStackSize;
+	//! Number of bytes below the stack pointer that must not be overwritten.
+	size_t redZone;
+	//! Address of an unsigned int that is non-zero while the thread must not be
+	//! interrupted (or zero). If the value is 1 on delivery, the kernel sets it to 2
+	//! and defers the delivery.
+	uintptr_t flagAddress;
+	//! Initial contents of the frame.
+	const void *payload;
+	//! Size of @p payload in bytes, at most ::kHelSignalMaxPayload.
+	size_t payloadSize;
+	//! Offset at which the ::kHelRegsSignal image is stored.
+	size_t registersOffset;
+	//! Offset at which the address of the ::kHelRegsSimd image is stored, or (size_t)-1.
+	size_t simdPointerOffset;
+	//! First argument of the handler.
+	uintptr_t argument;
+	//! The second and third argument of the handler are the address of the frame
+	//! plus these offsets.
+	size_t argumentOffsets[2];
+};
+
+#define kHelSignalMaxPayload 4096
+
 enum HelObservation {
 	kHelObserveNull = 0,
 	kHelObserveInterrupt = 4,
@@ -280,7 +488,8 @@ enum HelRegisterSets {
 	kHelRegsDebug = 4,
 	kHelRegsVirtualization = 5,
 	kHelRegsSimd = 6,
-	kHelRegsSignal = 7
+	kHelRegsSignal = 7,
+	kHelRegsVirtualizationControl = 8
 };
 
 //! Register-related information returned by helQueryRegisterInfo
@@ -514,6 +723,93 @@ struct HelThreadStats {
 	uint64_t userTime;
 };
 
+enum HelSchedulingPolicy {
+	//! Fair-share scheduling according to the priority (the default).
+	kHelSchedFair = 0,
+	//! Fixed priority real-time scheduling without time slices.
+	kHelSchedFifo = 1,
+	//! Fixed priority real-time scheduling with time slices.
+	kHelSchedRoundRobin = 2,
+	//! Earliest deadline first scheduling with a runtime budget per period.
+	kHelSchedDeadline = 3
+};
+
+//! Minimum and maximum priorities of ::kHelSchedFifo and ::kHelSchedRoundRobin.
+#define kHelSchedMinRealtimePriority 1
+#define kHelSchedMaxRealtimePriority 99
+
+struct HelSchedulingParameters {
+	//! One of the values of ::HelSchedulingPolicy.
+	int policy;
+	//! Priority for all policies except ::kHelSchedDeadline.
+	int priority;
+	//! Budget of ::kHelSchedDeadline threads in ns.
+	//! Threads may run for @p runtime ns within @p deadline ns of each @p period.
+	uint64_t runtime;
+	uint64_t deadline;
+	uint64_t period;
+};
+
+enum {
+	kHelPmcCycles = 1,
+	kHelPmcInstructions = 2,
+	kHelPmcCacheMisses = 4
+};
+
+enum HelClockModes {
+	// The clock can only be read using ::helGetClock.
+	kHelClockModeSyscall = 0,
+	// The clock is derived from the TSC using the calibration data of the current CPU.
+	kHelClockModeTsc = 1
+};
+
+enum HelClockPageFlags {
+	// The TSC_AUX MSR (as returned by rdtscp) contains the index of the current CPU.
+	kHelClockTscAuxIsCpu = 1
+};
+
+#define kHelClockPageMaxCpus 128
+
+struct HelClockCpu {
+	//! TSC ticks per millisecond on this CPU. Zero if the CPU is not calibrated (yet).
+	uint64_t tscTicksPerMilli;
+	uint64_t reserved;
+};
+
+//! Layout of the page returned by ::helAccessClockPage.
+//!
+//! In ::kHelClockModeTsc, the value of ::helGetClock on CPU @p i is
+//! (tsc / t) * 1000000 + (tsc % t) * 1000000 / t, where t = cpus[i].tscTicksPerMilli.
+//! The seqlock is odd while the kernel updates the page.
+struct HelClockPage {
+	uint64_t seqlock;
+	uint32_t mode;
+	uint32_t flags;
+	uint32_t numCpus;
+	uint32_t reserved;
+	struct HelClockCpu cpus[kHelClockPageMaxCpus];
+};
+
+//! Layout of the first page of the kernel log ring memory (see kerncfg's GetRingMemoryRequest).
+//!
+//! The records follow at dataOffset. The record at pointer p starts at
+//! offset (p & (ringSize - 1)) and consists of a size_t length, followed by the data
+//! (which may wrap around to the start of the ring); the next record starts at the
+//! following multiple of sizeof(size_t). Records between tailPtr and headPtr are valid.
+//! Readers must re-check tailPtr after copying a record to detect that it was overwritten.
+struct HelLogRingHeader {
+	uint64_t tailPtr;
+	uint64_t headPtr;
+	uint64_t ringSize;
+	uint64_t dataOffset;
+};
+
+struct HelPmcValues {
+	uint64_t cycles;
+	uint64_t instructions;
+	uint64_t cacheMisses;
+};
+
 enum {
   kHelVmexitHlt = 0,
   kHelVmexitTranslationFault = 1,
@@ -715,6 +1011,22 @@ HEL_C_LINKAGE HelError helCreateSliceView(HelHandle bundle, uintptr_t offset, si
 //!    	Handle to the new (i.e., forked) memory object.
 HEL_C_LINKAGE HelError helForkMemory(HelHandle handle, HelHandle *forkedHandle);
 
+//! Populates an address space with a batch of mappings, forking memory objects as necessary.
+//!
+//! This is equivalent to calling ::helForkMemory (for areas that
+//! have ::kHelForkAreaCopyOnWrite set) and ::helMapMemory for each area
+//! but it only requires a single system call.
+//! Failures of individual areas are reported through HelForkArea::error;
+//! processing continues with the next area in that case.
+//! @param[in] spaceHandle
+//!     Handle to the address space that receives the mappings (see ::helCreateSpace).
+//! @param[in,out] areas
+//!     Array of areas to map.
+//! @param[in] numAreas
+//!     Number of elements of @p areas.
+HEL_C_LINKAGE HelError helForkSpace(HelHandle spaceHandle, struct HelForkArea *areas,
+		size_t numAreas);
+
 //! Creates a virtual address space that threads can run in.
 //! @param[out] handle
 //!     Handle to the new address space.
@@ -788,13 +1100,29 @@ HEL_C_LINKAGE HelError helUnmapMemory(HelHandle spaceHandle, void *pointer, size
 
 HEL_C_LINKAGE HelError helPointerPhysical(const void *pointer, uintptr_t *physical);
 
+//! Queries how much memory of the mappings in a range of an address space is resident.
+//!
+//! The result is only a snapshot; it can be outdated as soon as this call returns.
+//! @param[in] spaceHandle
+//!     Handle to the address space.
+//!     Can be ::kHelNullHandle to query the current address space.
+//! @param[in] pointer
+//!     Start of the range. Must be aligned to the system's page size.
+//! @param[in] size
+//!     Size of the range in bytes.
+//! @param[out] usage
+//!     Memory accounting of all mappings (or parts thereof) inside the range.
+HEL_C_LINKAGE HelError helQueryMappingUsage(HelHandle spaceHandle, void *pointer, size_t size,
+		struct HelMappingUsage *usage);
+
 //! Load memory (i.e., bytes) from a descriptor.
 //!
 //! This is an asynchronous operation.
 //! @param[in] handle
 //!     Handle to the descriptor. This system call supports
-//!     address spaces (see ::helCreateAddressSpace)
-//!     and virtualized spaces (see ::helCreateVirtualizedSpace).
+//!     address spaces (see ::helCreateAddressSpace),
+//!     virtualized spaces (see ::helCreateVirtualizedSpace)
+//!     and windows (see ::helCreateSpaceWindow).
 //! @param[in] address
 //!     Address that is accessed, relative to @p handle.
 //! @param[in] length
@@ -818,6 +1146,84 @@ HEL_C_LINKAGE HelError helSubmitWriteMemory(HelHandle handle, uintptr_t address,
 		size_t length, const void *buffer,
 		HelHandle queue, uintptr_t context);
 
+//! Load memory from multiple ranges of a descriptor.
+//!
+//! This is an asynchronous operation. It behaves like one call to ::helSubmitReadMemory
+//! per element but completes only once (i.e., it posts a single HelSimpleResult).
+//! The elements are processed in order; processing stops at the first error.
+//! @param[in] handle
+//!     Handle to the descriptor. The same descriptors as for
+//!     ::helSubmitReadMemory are supported.
+//! @param[in] vectors
+//!     Array of ranges. For each element, @p length bytes are copied from
+//!     @p address (relative to @p handle) to @p buffer.
+//! @param[in] count
+//!     Number of elements in @p vectors. Must not exceed ::kHelMaxMemoryVectors.
+HEL_C_LINKAGE HelError helSubmitReadMemoryVector(HelHandle handle,
+		const struct HelMemoryVector *vectors, size_t count,
+		HelHandle queue, uintptr_t context);
+
+//! Store memory to multiple ranges of a descriptor.
+//!
+//! This is an asynchronous operation. It behaves like one call to ::helSubmitWriteMemory
+//! per element but completes only once (i.e., it posts a single HelSimpleResult).
+//! The elements are processed in order; processing stops at the first error.
+//! @param[in] handle
+//!     Handle to the descriptor. The same descriptors as for
+//!     ::helSubmitWriteMemory are supported.
+//! @param[in] vectors
+//!     Array of ranges. For each element, @p length bytes are copied from
+//!     @p buffer to @p address (relative to @p handle).
+//! @param[in] count
+//!     Number of elements in @p vectors. Must not exceed ::kHelMaxMemoryVectors.
+HEL_C_LINKAGE HelError helSubmitWriteMemoryVector(HelHandle handle,
+		const struct HelMemoryVector *vectors, size_t count,
+		HelHandle queue, uintptr_t context);
+
+//! Creates a read-only window into a range of an address space.
+//!
+//! Windows allow other processes to read a buffer without granting them access to
+//! the entire address space (e.g., to pass large payloads through IPC without copying
+//! them into the kernel). Windows can be read by ::helSubmitReadMemory
+//! (with addresses relative to the start of the window) and by ::helSubmitCopyFromWindow.
+//! Accesses see the current contents of the address space;
+//! they fail with ::kHelErrFault if the range is not mapped.
+//! @param[in] spaceHandle
+//!     Handle to the address space. ::kHelNullHandle refers to the
+//!     address space of the calling thread.
+//! @param[in] pointer
+//!     Start of the range. Does not need to be aligned.
+//! @param[in] length
+//!     Length of the range in bytes.
+//! @param[out] handle
+//!     Handle to the new window.
+HEL_C_LINKAGE HelError helCreateSpaceWindow(HelHandle spaceHandle, void *pointer, size_t length,
+		HelHandle *handle);
+
+//! Revokes a window that was created by ::helCreateSpaceWindow.
+//!
+//! Subsequent accesses through any handle to the window fail with ::kHelErrFault.
+//! Accesses that are already in progress may still complete.
+//! @param[in] handle
+//!     Handle to the window.
+HEL_C_LINKAGE HelError helRevokeSpaceWindow(HelHandle handle);
+
+//! Copies a prefix of a window into a memory object.
+//!
+//! This is an asynchronous operation. The data is copied directly from the pages
+//! of the window's address space to the memory object (without an intermediate buffer).
+//! @param[in] windowHandle
+//!     Handle to the window (see ::helCreateSpaceWindow).
+//! @param[in] memoryHandle
+//!     Handle to the memory object.
+//! @param[in] offset
+//!     Offset into the memory object.
+//! @param[in] length
+//!     Number of bytes that are copied from the start of the window.
+//!     Must not exceed the length of the window.
+HEL_C_LINKAGE HelError helSubmitCopyFromWindow(HelHandle windowHandle, HelHandle memoryHandle,
+		uintptr_t offset, size_t length, HelHandle queue, uintptr_t context);
+
 HEL_C_LINKAGE HelError helMemoryInfo(HelHandle handle,
 		size_t *size);
 
@@ -826,6 +1232,35 @@ HEL_C_LINKAGE HelError helSubmitManageMemory(HelHandle handle,
 
 HEL_C_LINKAGE HelError helUpdateMemory(HelHandle handle, int type, uintptr_t offset, size_t length);
 
+//! Enables swapping of anonymous memory to a managed memory object.
+//!
+//! The kernel writes swapped out pages to the memory object and reads them back on fault;
+//! the memory object is usually backed by a swap partition.
+//! The first page of the memory object is reserved (e.g., for a swap header).
+//! Only a single swap area is supported; further calls fail with ::kHelErrIllegalState.
+//! @param[in] handle
+//!     Handle to the frontal memory object (see ::helCreateManagedMemory).
+//! @param[in] numPages
+//!     Number of pages of the memory object (including the first page) that are
+//!     used for swap. Must be at least two and must not exceed the size of the memory object.
+HEL_C_LINKAGE HelError helEnableSwap(HelHandle handle, size_t numPages);
+
+//! Gives the kernel a hint about the usage of a range of a memory object.
+//!
+//! Currently, this is only supported by copy-on-write memory (i.e., memory created by
+//! ::helForkMemory or ::helCopyOnWrite); other memory objects fail with
+//! ::kHelErrUnsupportedOperation.
+//! @param[in] handle
+//!     Handle to the memory object.
+//! @param[in] offset
+//!     Offset of the range. Must be page-aligned.
+//! @param[in] length
+//!     Length of the range. Must be page-aligned.
+//! @param[in] advice
+//!     One of the values of ::HelMemoryAdvice.
+HEL_C_LINKAGE HelError helAdviseMemory(HelHandle handle, uintptr_t offset, size_t length,
+		int advice);
+
 HEL_C_LINKAGE HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offset, size_t size,
 		HelHandle queue, uintptr_t context);
 
@@ -870,6 +1305,26 @@ HEL_C_LINKAGE HelError helCreateThread(HelHandle universe, HelHandle spaceHandle
 //!     Statistics related to the thread.
 HEL_C_LINKAGE HelError helQueryThreadStats(HelHandle handle, struct HelThreadStats *stats);
 
+//! Select the hardware performance counters that are attached to a thread.
+//!
+//! Attached counters only count events while the thread runs in user mode.
+//! Changing the set of events resets all counter values to zero.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[in] events
+//!     Mask of events to count (kHelPmc* constants). Zero detaches all counters.
+HEL_C_LINKAGE HelError helSetThreadPmc(HelHandle handle, uint32_t events);
+
+//! Read the hardware performance counters that are attached to a thread.
+//!
+//! Values of events that are not attached are zero.
+//! Counts of a running thread are only updated when it is descheduled.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[out] values
+//!     Accumulated counter values.
+HEL_C_LINKAGE HelError helQueryThreadPmc(HelHandle handle, struct HelPmcValues *values);
+
 //! Set the priority of a thread.
 //!
 //! Managarm always runs the runnable thread with highest priority.
@@ -880,6 +1335,19 @@ HEL_C_LINKAGE HelError helQueryThreadStats(HelHandle handle, struct HelThreadSta
 //!     New priority value of the thread.
 HEL_C_LINKAGE HelError helSetPriority(HelHandle handle, int priority);
 
+//! Set the scheduling policy of a thread.
+//!
+//! Deadline threads always run before real-time threads which always run
+//! before fair-share threads.
+//! If the thread is not the calling thread, the change takes effect the next time
+//! the thread is woken up or preempted.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[in] parameters
+//!     New scheduling policy and parameters of the thread.
+HEL_C_LINKAGE HelError helSetScheduling(HelHandle handle,
+		const struct HelSchedulingParameters *parameters);
+
 //! Yields the current thread.
 HEL_C_LINKAGE HelError helYield();
 
@@ -906,6 +1374,27 @@ HEL_C_LINKAGE HelError helKillThread(HelHandle handle);
 //!     Handle to the thread.
 HEL_C_LINKAGE HelError helInterruptThread(HelHandle handle);
 
+//! Queue a signal frame for delivery to a thread.
+//!
+//! The kernel builds the frame (see HelSignalDelivery) and redirects the thread
+//! the next time that it returns from a system call, i.e., at the same point at which
+//! ::helInterruptThread would take effect. Unlike ::helInterruptThread,
+//! the thread is not stopped and no observation is reported.
+//! If the frame cannot be written, the thread is stopped with ::kHelObservePageFault.
+//! At most one delivery can be queued per thread.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[in] delivery
+//!     Description of the frame; the payload is copied by this call.
+HEL_C_LINKAGE HelError helQueueSignal(HelHandle handle, const struct HelSignalDelivery *delivery);
+
+//! Remove a signal frame that was queued by ::helQueueSignal.
+//! @param[in] handle
+//!     Handle to the thread.
+//! @param[out] dequeued
+//!     Non-zero if a delivery was removed before it took place.
+HEL_C_LINKAGE HelError helDequeueSignal(HelHandle handle, int *dequeued);
+
 //! Resume a suspended thread.
 //!
 //! Threads can explicitly be suspended through the use of ::helInterruptThread.
@@ -956,6 +1445,13 @@ HEL_C_LINKAGE HelError helGetCurrentCpu(int *cpu);
 //!     Current value of the system-wide clock in nanoseconds since boot.
 HEL_C_LINKAGE HelError helGetClock(uint64_t *counter);
 
+//! Obtain the page that allows computing ::helGetClock in user space.
+//!
+//! The page should be mapped read-only; see HelClockPage for its layout.
+//! @param[out] handle
+//!     Handle to a memory object of one page.
+HEL_C_LINKAGE HelError helAccessClockPage(HelHandle *handle);
+
 //! Wait until time passes.
 //!
 //! This is an asynchronous operation.
@@ -966,6 +1462,20 @@ HEL_C_LINKAGE HelError helGetClock(uint64_t *counter);
 HEL_C_LINKAGE HelError helSubmitAwaitClock(uint64_t counter,
 		HelHandle queue, uintptr_t context, uint64_t *asyncId);
 
+//! Wait until time passes, allowing the kernel to delay the wakeup.
+//!
+//! Same as ::helSubmitAwaitClock but the operation may complete up to @p slack
+//! nanoseconds after @p counter. This allows the kernel to coalesce nearby deadlines.
+//! This is an asynchronous operation.
+//! @param[in] counter
+//!     Deadline (absolute, see ::helGetClock).
+//! @param[in] slack
+//!     Maximal delay (in nanoseconds) that is acceptable after the deadline.
+//! @param[out] asyncId
+//!     ID to identify the asynchronous operation (absolute, see ::helCancelAsync).
+HEL_C_LINKAGE HelError helSubmitAwaitClockWithSlack(uint64_t counter, uint64_t slack,
+		HelHandle queue, uintptr_t context, uint64_t *asyncId);
+
 HEL_C_LINKAGE HelError helCreateVirtualizedCpu(HelHandle handle, HelHandle *out_handle);
 
 HEL_C_LINKAGE HelError helRunVirtualizedCpu(HelHandle handle, struct HelVmexitReason *reason);
@@ -1015,6 +1525,20 @@ HEL_C_LINKAGE HelError helCreateStream(HelHandle *lane1, HelHandle *lane2, uint3
 HEL_C_LINKAGE HelError helSubmitAsync(HelHandle handle, const struct HelAction *actions,
 		size_t count, HelHandle queue, uintptr_t context, uint32_t flags);
 
+//! Performs all helSubmitAsync() calls that are queued in a submission ring.
+//!
+//! This is equivalent to calling helSubmitAsync() for each entry between
+//! @p head and @p tail of the ring but only requires a single syscall.
+//! The result of each submission is stored in the @p error field of its entry.
+//! @param[in] ring
+//!     Pointer to the submission ring.
+//! @param[in] ringShift
+//!     The ring contains (1 << @p ringShift) entries.
+//! @param[out] numSubmitted
+//!     Number of entries that were consumed.
+HEL_C_LINKAGE HelError helSubmitAsyncRing(struct HelSubmissionRing *ring,
+		unsigned int ringShift, size_t *numSubmitted);
+
 HEL_C_LINKAGE HelError helShutdownLane(HelHandle handle);
 
 //! Create a token object.
@@ -1045,6 +1569,75 @@ HEL_C_LINKAGE HelError helFutexWait(int *pointer, int expected, int64_t deadline
 //!     Pointer that identifies the futex.
 HEL_C_LINKAGE HelError helFutexWake(int *pointer);
 
+//! Wakes up some waiters of a futex and moves others to a different futex.
+//!
+//! The waiters that are moved to @p target are not woken up; they are woken
+//! by subsequent wakes of @p target instead. Condition variables can use this to
+//! avoid waking all waiters on broadcasts only for them to contend on the mutex.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+//! @param[in] target
+//!     Pointer that identifies the futex that waiters are moved to.
+//! @param[in] expected
+//!     Expected value of the futex. This function fails with
+//!     ::kHelErrIllegalState unless the futex pointed to by @p pointer matches this value.
+//! @param[in] wakeCount
+//!     Maximal number of waiters that are woken up.
+//! @param[in] requeueCount
+//!     Maximal number of waiters that are moved to @p target.
+//! @param[out] count
+//!     Number of waiters that were woken up or moved to @p target.
+HEL_C_LINKAGE HelError helFutexRequeue(int *pointer, int *target, int expected,
+		size_t wakeCount, size_t requeueCount, size_t *count);
+
+//! Waits until a futex is woken up.
+//!
+//! This is an asynchronous operation. It is the asynchronous counterpart
+//! of ::helFutexWait; it completes immediately (without an error) if the futex
+//! does not match @p expected.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+//! @param[in] expected
+//!     Expected value of the futex.
+//! @param[out] asyncId
+//!     ID to identify the asynchronous operation (absolute, see ::helCancelAsync).
+HEL_C_LINKAGE HelError helSubmitAwaitFutex(int *pointer, int expected,
+		HelHandle queue, uintptr_t context, uint64_t *asyncId);
+
+//! Returns the TID that identifies the current thread in priority inheritance futexes.
+//! @param[out] tid
+//!     TID of the current thread. The TID is non-zero and fits into ::kHelFutexPiTidMask.
+HEL_C_LINKAGE HelError helGetFutexTid(uint32_t *tid);
+
+//! Locks a priority inheritance futex.
+//!
+//! User space should first try to lock the futex by changing it from zero to its TID.
+//! If that fails, this function blocks until the futex is handed over to the caller.
+//! While the caller waits, the owner inherits the caller's scheduling parameters
+//! (if they take precedence over the owner's parameters).
+//! Fails with ::kHelErrIllegalState if the caller already owns the futex, if waiting
+//! would deadlock or if the futex word does not match the kernel's view of the owner.
+//! If the TID in the futex word does not belong to a live thread (e.g., because the
+//! owner terminated without unlocking an uncontended futex), the caller takes the
+//! futex over and ::kHelFutexPiOwnerDied is set. Robust futex lists are not supported;
+//! if the TID was reused by another thread, that thread is treated as the owner.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+//! @param[in] deadline
+//!     Timeout (in absolute monotone time, see ::helGetClock) or -1 to wait indefinitely.
+//!     Fails with ::kHelErrCancelled on timeout.
+HEL_C_LINKAGE HelError helFutexLockPi(int *pointer, int64_t deadline);
+
+//! Unlocks a priority inheritance futex.
+//!
+//! User space only needs to call this function if ::kHelFutexPiWaiters is set;
+//! otherwise, it can unlock by changing the futex from its TID to zero.
+//! The futex is handed over to its highest priority waiter.
+//! Fails with ::kHelErrIllegalState if the caller does not own the futex.
+//! @param[in] pointer
+//!     Pointer that identifies the futex.
+HEL_C_LINKAGE HelError helFutexUnlockPi(int *pointer);
+
 //! @}
 //! @name Event Handling
 //! @{
@@ -1094,6 +1687,35 @@ HEL_C_LINKAGE HelError helEnableIo(HelHandle handle);
 
 HEL_C_LINKAGE HelError helEnableFullIo();
 
+//! Maps memory into the DMA space of a device.
+//!
+//! DMA spaces are obtained from the driver of the device's bus.
+//! Mapped memory stays locked until it is unmapped again.
+//! All mappings are visible to the device once this call returns.
+//! If an error occurs, mappings that precede the failed one stay in place.
+//! @param[in] handle
+//!     Handle to the DMA space.
+//! @param[in] mappings
+//!     Array of mappings. Offsets, I/O addresses and lengths
+//!     must be aligned to the system's page size.
+//! @param[in] count
+//!     Number of elements in @p mappings.
+HEL_C_LINKAGE HelError helMapDma(HelHandle handle, const struct HelDmaMapping *mappings,
+		size_t count);
+
+//! Removes mappings from the DMA space of a device.
+//!
+//! The IOTLB is only invalidated once per call; hence, batching unmaps is cheaper.
+//! Once this call returns, the device cannot access the memory anymore.
+//! @param[in] handle
+//!     Handle to the DMA space.
+//! @param[in] ioAddresses
+//!     Start addresses of the mappings that are removed.
+//! @param[in] count
+//!     Number of elements in @p ioAddresses.
+HEL_C_LINKAGE HelError helUnmapDma(HelHandle handle, const uintptr_t *ioAddresses,
+		size_t count);
+
 //! @}
 //! @name Kernlet Management
 //! @{
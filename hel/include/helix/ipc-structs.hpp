@@ -475,6 +475,12 @@ struct SendBragiHeadOnly {
 	frg::vector<uint8_t, Allocator> head;
 };
 
+// Like SendBragiHeadOnly but stores the head inline, i.e., without allocating.
+template <size_t HeadSize>
+struct SendBragiHeadOnlyInline {
+	frg::array<uint8_t, HeadSize> head;
+};
+
 // --------------------------------------------------------------------
 // Construction functions
 // --------------------------------------------------------------------
@@ -563,6 +569,18 @@ inline auto sendBragiHeadOnly(Message &msg, Allocator allocator = Allocator()) {
 	return item;
 }
 
+// Serializes the head into the item itself, without heap allocation.
+// Since heads have a fixed size, this is preferable for head-only messages.
+template <typename Message>
+inline auto sendBragiHeadOnly(Message &msg) {
+	SendBragiHeadOnlyInline<Message::head_size> item;
+	FRG_ASSERT(!msg.size_of_tail());
+
+	bragi::write_head_only(msg, item.head);
+
+	return item;
+}
+
 // --------------------------------------------------------------------
 // Item -> HelAction transformation
 // --------------------------------------------------------------------
@@ -721,6 +739,18 @@ inline auto createActionsArrayFor(bool chain, const SendBragiHeadOnly<Allocator>
 	return frg::array<HelAction, 1>{action};
 }
 
+template <size_t HeadSize>
+inline auto createActionsArrayFor(bool chain, const SendBragiHeadOnlyInline<HeadSize> &item) {
+	HelAction action{};
+
+	action.type = kHelActionSendFromBuffer;
+	action.flags = chain ? kHelItemChain : 0;
+	action.buffer = const_cast<uint8_t *>(item.head.data());
+	action.length = item.head.size();
+
+	return frg::array<HelAction, 1>{action};
+}
+
 // --------------------------------------------------------------------
 // Item -> Result type transformation
 // --------------------------------------------------------------------
@@ -785,6 +815,11 @@ inline auto resultTypeTuple(const SendBragiHeadOnly<Allocator> &) {
 	return frg::tuple<SendBufferResult>{};
 }
 
+template <size_t HeadSize>
+inline auto resultTypeTuple(const SendBragiHeadOnlyInline<HeadSize> &) {
+	return frg::tuple<SendBufferResult>{};
+}
+
 template <typename ...T>
 inline auto createResultsTuple(T &&...args) {
 	return frg::tuple_cat(resultTypeTuple(std::forward<T>(args))...);
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <tuple>
 #include <array>
+#include <vector>
 
 #include <async/oneshot-event.hpp>
 
@@ -170,23 +171,43 @@ private:
 public:
 	static constexpr int sizeShift = 9;
 
+	// Each chunk needs a slot in the index queue.
+	static constexpr unsigned int maxChunks = 1 << sizeShift;
+
+	static constexpr unsigned int defaultNumChunks = 16;
+	static constexpr size_t defaultChunkSize = 4096;
+
 	static Dispatcher &global();
 
-	Dispatcher()
-	: _handle{kHelNullHandle}, _queue{nullptr},
-			_activeChunks{0}, _retrieveIndex{0}, _nextIndex{0}, _lastProgress{0} { }
+	// Chunks are only activated once the kernel runs out of space
+	// in the already active chunks; hence, numChunks is an upper bound.
+	Dispatcher(unsigned int numChunks = defaultNumChunks, size_t chunkSize = defaultChunkSize)
+	: _handle{kHelNullHandle}, _queue{nullptr}, _numChunks{numChunks}, _chunkSize{chunkSize},
+			_activeChunks{0}, _hadWaiters{false},
+			_retrieveIndex{0}, _nextIndex{0}, _lastProgress{0} {
+		assert(numChunks > 0 && numChunks <= maxChunks);
+	}
 
 	Dispatcher(const Dispatcher &) = delete;
 
 	Dispatcher &operator= (const Dispatcher &) = delete;
 
+	// Changes the size of the queue. Must be called before the queue is created,
+	// i.e., before the first call to acquire(). This is mostly useful to configure global().
+	void configure(unsigned int numChunks, size_t chunkSize = defaultChunkSize) {
+		assert(!_handle && "Dispatcher::configure() called after queue creation");
+		assert(numChunks > 0 && numChunks <= maxChunks);
+		_numChunks = numChunks;
+		_chunkSize = chunkSize;
+	}
+
 	HelHandle acquire() {
 		if(!_handle) {
 			HelQueueParameters params {
 				.flags = 0,
 				.ringShift = sizeShift,
-				.numChunks = 16,
-				.chunkSize = 4096,
+				.numChunks = _numChunks,
+				.chunkSize = _chunkSize,
 			};
 			HEL_CHECK(helCreateQueue(&params, &_handle));
 
@@ -201,7 +222,9 @@ public:
 
 			_queue = reinterpret_cast<HelQueue *>(mapping);
 			auto chunksPtr = reinterpret_cast<std::byte *>(mapping) + chunksOffset;
-			for(unsigned int i = 0; i < 16; ++i)
+			_chunks.resize(_numChunks);
+			_refCounts.resize(_numChunks);
+			for(unsigned int i = 0; i < _numChunks; ++i)
 				_chunks[i] = reinterpret_cast<HelChunk *>(chunksPtr + i * reservedPerChunk);
 		}
 
@@ -212,7 +235,8 @@ public:
 		while(true) {
 			// TODO: Initialize all chunks when setting up the queue.
 			if(_retrieveIndex == _nextIndex) {
-				assert(_activeChunks < 16);
+				// All chunks are referenced by live ElementHandles.
+				assert(_activeChunks < _numChunks && "helix::Dispatcher ran out of chunks");
 
 				// Reset and enqueue the new chunk.
 				_chunks[_activeChunks]->progressFutex = 0;
@@ -224,9 +248,8 @@ public:
 				_refCounts[_activeChunks] = 1;
 				_activeChunks++;
 				continue;
-			}else if (_hadWaiters && _activeChunks < (1 << sizeShift)) {
-				assert(_activeChunks < 16);
-
+			}else if (_hadWaiters && _activeChunks < _numChunks) {
+				// The kernel had to wait for a free chunk; grow the queue.
 				// Reset and enqueue the new chunk.
 				_chunks[_activeChunks]->progressFutex = 0;
 
@@ -327,9 +350,11 @@ private:
 private:
 	HelHandle _handle;
 	HelQueue *_queue;
-	HelChunk *_chunks[16];
+	unsigned int _numChunks;
+	size_t _chunkSize;
+	std::vector<HelChunk *> _chunks;
 
-	int _activeChunks;
+	unsigned int _activeChunks;
 	bool _hadWaiters;
 
 	// Index of the chunk that we are currently retrieving/inserting next.
@@ -340,7 +365,7 @@ private:
 	int _lastProgress;
 
 	// Per-chunk reference counts.
-	int _refCounts[16];
+	std::vector<int> _refCounts;
 };
 
 inline void CurrentDispatcherToken::wait() {
@@ -371,6 +396,17 @@ private:
 	}
 };
 
+struct AwaitFutex : Operation {
+	HelError error() {
+		return result()->error;
+	}
+
+private:
+	HelSimpleResult *result() {
+		return reinterpret_cast<HelSimpleResult *>(OperationBase::element());
+	}
+};
+
 struct ProtectMemory : Operation {
 	HelError error() {
 		return result()->error;
@@ -667,6 +703,24 @@ struct Submission : private Context {
 		operation->setAsyncId(async_id);
 	}
 
+	Submission(AwaitClock *operation,
+			uint64_t counter, uint64_t slack, Dispatcher &dispatcher)
+	: _result(operation) {
+		uint64_t async_id;
+		HEL_CHECK(helSubmitAwaitClockWithSlack(counter, slack, dispatcher.acquire(),
+				reinterpret_cast<uintptr_t>(context()), &async_id));
+		operation->setAsyncId(async_id);
+	}
+
+	Submission(AwaitFutex *operation,
+			int *pointer, int expected, Dispatcher &dispatcher)
+	: _result(operation) {
+		uint64_t async_id;
+		HEL_CHECK(helSubmitAwaitFutex(pointer, expected, dispatcher.acquire(),
+				reinterpret_cast<uintptr_t>(context()), &async_id));
+		operation->setAsyncId(async_id);
+	}
+
 	Submission(BorrowedDescriptor space, ProtectMemory *operation,
 			void *pointer, size_t length, uint32_t flags,
 			Dispatcher &dispatcher)
@@ -862,6 +916,16 @@ inline Submission submitAwaitClock(AwaitClock *operation, uint64_t counter,
 	return {operation, counter, dispatcher};
 }
 
+inline Submission submitAwaitClock(AwaitClock *operation, uint64_t counter, uint64_t slack,
+		Dispatcher &dispatcher) {
+	return {operation, counter, slack, dispatcher};
+}
+
+inline Submission submitAwaitFutex(AwaitFutex *operation, int *pointer, int expected,
+		Dispatcher &dispatcher) {
+	return {operation, pointer, expected, dispatcher};
+}
+
 inline Submission submitProtectMemory(BorrowedDescriptor memory, ProtectMemory *operation,
 		void *pointer, size_t length, uint32_t flags,
 		Dispatcher &dispatcher) {
@@ -969,6 +1033,90 @@ auto exchangeMsgs(BorrowedDescriptor descriptor, Args &&...args) {
 	};
 }
 
+// --------------------------------------------------------------------
+// ExchangeMsgsVectorSender
+// --------------------------------------------------------------------
+
+// Items whose number is only known at runtime. Only items that translate to
+// a single action (e.g., PushDescriptor or PullDescriptor) are supported.
+template <typename Item>
+using VectorItemResult = std::remove_cvref_t<
+		decltype(resultTypeTuple(std::declval<const Item &>()).template get<0>())>;
+
+template <typename Item, typename Receiver>
+struct ExchangeMsgsVectorOperation : private Context {
+	static_assert(sizeof(decltype(createActionsArrayFor(false, std::declval<const Item &>())))
+			== sizeof(HelAction));
+
+	ExchangeMsgsVectorOperation(BorrowedDescriptor lane, std::vector<Item> items,
+			Receiver receiver)
+	: lane_{std::move(lane)}, items_{std::move(items)}, receiver_{std::move(receiver)} { }
+
+	void start() {
+		if(items_.empty()) {
+			async::execution::set_value(receiver_, std::vector<VectorItemResult<Item>>{});
+			return;
+		}
+
+		std::vector<HelAction> helActions;
+		helActions.reserve(items_.size());
+		for(size_t i = 0; i < items_.size(); i++) {
+			auto array = createActionsArrayFor(i + 1 < items_.size(), items_[i]);
+			helActions.push_back(array[0]);
+		}
+
+		auto context = static_cast<Context *>(this);
+		HEL_CHECK(helSubmitAsync(lane_.getHandle(),
+				helActions.data(), helActions.size(), Dispatcher::global().acquire(),
+				reinterpret_cast<uintptr_t>(context), 0));
+	}
+
+private:
+	void complete(ElementHandle element) override {
+		std::vector<VectorItemResult<Item>> results(items_.size());
+		void *ptr = element.data();
+		for(auto &result : results)
+			result.parse(ptr, element);
+
+		async::execution::set_value(receiver_, std::move(results));
+	}
+
+	BorrowedDescriptor lane_;
+	std::vector<Item> items_;
+	Receiver receiver_;
+};
+
+template <typename Item>
+struct [[nodiscard]] ExchangeMsgsVectorSender {
+	using value_type = std::vector<VectorItemResult<Item>>;
+
+	ExchangeMsgsVectorSender(BorrowedDescriptor lane, std::vector<Item> items)
+	: lane_{std::move(lane)}, items_{std::move(items)} { }
+
+	template<typename Receiver>
+	ExchangeMsgsVectorOperation<Item, Receiver> connect(Receiver receiver) {
+		return {std::move(lane_), std::move(items_), std::move(receiver)};
+	}
+
+private:
+	BorrowedDescriptor lane_;
+	std::vector<Item> items_;
+};
+
+template <typename Item>
+async::sender_awaiter<ExchangeMsgsVectorSender<Item>, std::vector<VectorItemResult<Item>>>
+operator co_await (ExchangeMsgsVectorSender<Item> sender) {
+	return {std::move(sender)};
+}
+
+// Chains all items into a single submission on the given lane. This avoids one round trip
+// per item if both sides exchange a runtime-dependent number of descriptors.
+// Since all results end up in a single queue element, the number of items should be bounded.
+template <typename Item>
+auto exchangeMsgsVector(BorrowedDescriptor descriptor, std::vector<Item> items) {
+	return ExchangeMsgsVectorSender<Item>{std::move(descriptor), std::move(items)};
+}
+
 // --------------------------------------------------------------------
 // Operations other than exchangeMsgs().
 // --------------------------------------------------------------------
@@ -1225,6 +1373,197 @@ inline auto writeMemory(BorrowedDescriptor descriptor,
 	return WriteMemorySender{descriptor, address, length, buffer};
 }
 
+// The kernel copies the HelMemoryVector array on submission; only the buffers
+// need to stay valid until the operation completes.
+template <typename Receiver>
+struct ReadMemoryVectorOperation : private Context {
+	ReadMemoryVectorOperation(BorrowedDescriptor descriptor,
+			const HelMemoryVector *vectors, size_t count, Receiver r)
+	: descriptor_{std::move(descriptor)}, vectors_{vectors}, count_{count},
+		r_{std::move(r)} { }
+
+	void start() {
+		auto context = static_cast<Context *>(this);
+		HEL_CHECK(helSubmitReadMemoryVector(descriptor_.getHandle(),
+				vectors_, count_,
+				Dispatcher::global().acquire(),
+				reinterpret_cast<uintptr_t>(context)));
+	}
+
+	ReadMemoryVectorOperation(const ReadMemoryVectorOperation &) = delete;
+	ReadMemoryVectorOperation &operator= (const ReadMemoryVectorOperation &) = delete;
+
+private:
+	void complete(ElementHandle element) override {
+		SynchronizeSpaceResult result;
+		void *ptr = element.data();
+		result.parse(ptr, element);
+		async::execution::set_value_noinline(r_, std::move(result));
+	}
+
+	BorrowedDescriptor descriptor_;
+	const HelMemoryVector *vectors_;
+	size_t count_;
+	Receiver r_;
+};
+
+struct [[nodiscard]] ReadMemoryVectorSender {
+	using value_type = SynchronizeSpaceResult;
+
+	ReadMemoryVectorSender(BorrowedDescriptor descriptor,
+			const HelMemoryVector *vectors, size_t count)
+	: descriptor_{std::move(descriptor)}, vectors_{vectors}, count_{count} { }
+
+	template<typename Receiver>
+	ReadMemoryVectorOperation<Receiver> connect(Receiver receiver) {
+		return {std::move(descriptor_), vectors_, count_, std::move(receiver)};
+	}
+
+private:
+	BorrowedDescriptor descriptor_;
+	const HelMemoryVector *vectors_;
+	size_t count_;
+};
+
+inline async::sender_awaiter<ReadMemoryVectorSender, SynchronizeSpaceResult>
+operator co_await (ReadMemoryVectorSender sender) {
+	return {std::move(sender)};
+}
+
+inline auto readMemoryVector(BorrowedDescriptor descriptor,
+		const HelMemoryVector *vectors, size_t count) {
+	return ReadMemoryVectorSender{descriptor, vectors, count};
+}
+
+template <typename Receiver>
+struct WriteMemoryVectorOperation : private Context {
+	WriteMemoryVectorOperation(BorrowedDescriptor descriptor,
+			const HelMemoryVector *vectors, size_t count, Receiver r)
+	: descriptor_{std::move(descriptor)}, vectors_{vectors}, count_{count},
+		r_{std::move(r)} { }
+
+	void start() {
+		auto context = static_cast<Context *>(this);
+		HEL_CHECK(helSubmitWriteMemoryVector(descriptor_.getHandle(),
+				vectors_, count_,
+				Dispatcher::global().acquire(),
+				reinterpret_cast<uintptr_t>(context)));
+	}
+
+	WriteMemoryVectorOperation(const WriteMemoryVectorOperation &) = delete;
+	WriteMemoryVectorOperation &operator= (const WriteMemoryVectorOperation &) = delete;
+
+private:
+	void complete(ElementHandle element) override {
+		SynchronizeSpaceResult result;
+		void *ptr = element.data();
+		result.parse(ptr, element);
+		async::execution::set_value_noinline(r_, std::move(result));
+	}
+
+	BorrowedDescriptor descriptor_;
+	const HelMemoryVector *vectors_;
+	size_t count_;
+	Receiver r_;
+};
+
+struct [[nodiscard]] WriteMemoryVectorSender {
+	using value_type = SynchronizeSpaceResult;
+
+	WriteMemoryVectorSender(BorrowedDescriptor descriptor,
+			const HelMemoryVector *vectors, size_t count)
+	: descriptor_{std::move(descriptor)}, vectors_{vectors}, count_{count} { }
+
+	template<typename Receiver>
+	WriteMemoryVectorOperation<Receiver> connect(Receiver receiver) {
+		return {std::move(descriptor_), vectors_, count_, std::move(receiver)};
+	}
+
+private:
+	BorrowedDescriptor descriptor_;
+	const HelMemoryVector *vectors_;
+	size_t count_;
+};
+
+inline async::sender_awaiter<WriteMemoryVectorSender, SynchronizeSpaceResult>
+operator co_await (WriteMemoryVectorSender sender) {
+	return {std::move(sender)};
+}
+
+inline auto writeMemoryVector(BorrowedDescriptor descriptor,
+		const HelMemoryVector *vectors, size_t count) {
+	return WriteMemoryVectorSender{descriptor, vectors, count};
+}
+
+// --------------------------------------------------------------------
+// CopyFromWindow
+// --------------------------------------------------------------------
+
+template <typename Receiver>
+struct CopyFromWindowOperation : private Context {
+	CopyFromWindowOperation(BorrowedDescriptor window, BorrowedDescriptor memory,
+			uintptr_t offset, size_t length, Receiver r)
+	: window_{std::move(window)}, memory_{std::move(memory)}, offset_{offset},
+		length_{length}, r_{std::move(r)} { }
+
+	void start() {
+		auto context = static_cast<Context *>(this);
+		HEL_CHECK(helSubmitCopyFromWindow(window_.getHandle(), memory_.getHandle(),
+				offset_, length_,
+				Dispatcher::global().acquire(),
+				reinterpret_cast<uintptr_t>(context)));
+	}
+
+	CopyFromWindowOperation(const CopyFromWindowOperation &) = delete;
+	CopyFromWindowOperation &operator= (const CopyFromWindowOperation &) = delete;
+
+private:
+	void complete(ElementHandle element) override {
+		SynchronizeSpaceResult result;
+		void *ptr = element.data();
+		result.parse(ptr, element);
+		async::execution::set_value_noinline(r_, std::move(result));
+	}
+
+	BorrowedDescriptor window_;
+	BorrowedDescriptor memory_;
+	uintptr_t offset_;
+	size_t length_;
+	Receiver r_;
+};
+
+struct [[nodiscard]] CopyFromWindowSender {
+	using value_type = SynchronizeSpaceResult;
+
+	CopyFromWindowSender(BorrowedDescriptor window, BorrowedDescriptor memory,
+			uintptr_t offset, size_t length)
+	: window_{std::move(window)}, memory_{std::move(memory)},
+		offset_{offset}, length_{length} { }
+
+	template<typename Receiver>
+	CopyFromWindowOperation<Receiver> connect(Receiver receiver) {
+		return {std::move(window_), std::move(memory_), offset_, length_,
+				std::move(receiver)};
+	}
+
+private:
+	BorrowedDescriptor window_;
+	BorrowedDescriptor memory_;
+	uintptr_t offset_;
+	size_t length_;
+};
+
+inline async::sender_awaiter<CopyFromWindowSender, SynchronizeSpaceResult>
+operator co_await (CopyFromWindowSender sender) {
+	return {std::move(sender)};
+}
+
+// Copies the first length bytes of the window to the memory object at offset.
+inline auto copyFromWindow(BorrowedDescriptor window, BorrowedDescriptor memory,
+		uintptr_t offset, size_t length) {
+	return CopyFromWindowSender{window, memory, offset, length};
+}
+
 // --------------------------------------------------------------------
 // AwaitEvent
 // --------------------------------------------------------------------
@@ -9,11 +9,14 @@
 
 namespace helix {
 
+// Default slack for timeouts that do not need to be precise (e.g., poll() timeouts).
+inline constexpr uint64_t defaultTimerSlack = 50'000;
+
 template<typename F>
 struct TimeoutCallback {
-	TimeoutCallback(uint64_t duration, F function)
+	TimeoutCallback(uint64_t duration, F function, uint64_t slack = 0)
 	: _function{std::move(function)} {
-		_runTimer(duration);
+		_runTimer(duration, slack);
 	}
 
 	TimeoutCallback(const TimeoutCallback &other) = delete;
@@ -26,12 +29,12 @@ struct TimeoutCallback {
 	}
 
 private:
-	async::detached _runTimer(uint64_t duration) {
+	async::detached _runTimer(uint64_t duration, uint64_t slack) {
 		uint64_t tick;
 		HEL_CHECK(helGetClock(&tick));
 
 		helix::AwaitClock await;
-		auto &&submit = helix::submitAwaitClock(&await, tick + duration,
+		auto &&submit = helix::submitAwaitClock(&await, tick + duration, slack,
 				helix::Dispatcher::global());
 		auto async_id = await.asyncId();
 
@@ -57,8 +60,8 @@ private:
 };
 
 struct TimeoutCancellation {
-	TimeoutCancellation(uint64_t duration, async::cancellation_event &ev)
-	:_tb{duration, Functor{&ev}} {
+	TimeoutCancellation(uint64_t duration, async::cancellation_event &ev, uint64_t slack = 0)
+	:_tb{duration, Functor{&ev}, slack} {
 	}
 
 	auto retire() {
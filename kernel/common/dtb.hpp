@@ -321,8 +321,9 @@ struct DeviceTreeNode {
 	}
 
 	frg::optional<DeviceTreeProperty> findProperty(const char *name) {
+		// Compare the full names, otherwise "reg" would also match "reg-names".
 		for (auto prop : properties_)
-			if (!memcmp(name, prop.name(), strlen(name)))
+			if (!strcmp(name, prop.name()))
 				return prop;
 
 		return frg::null_opt;
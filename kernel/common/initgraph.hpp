@@ -48,8 +48,9 @@ struct Node {
 	friend void realizeNode(Node *node);
 	friend void realizeEdge(Edge *edge);
 
-	Node(NodeType type, Engine *engine, const char *displayName = nullptr)
-	: type_{type}, engine_{engine}, displayName_{displayName} {
+	Node(NodeType type, Engine *engine, const char *displayName = nullptr,
+			bool concurrent = false)
+	: type_{type}, engine_{engine}, displayName_{displayName}, concurrent_{concurrent} {
 		realizeNode(this);
 	}
 
@@ -62,6 +63,10 @@ struct Node {
 
 	const char *displayName() { return displayName_; }
 
+	// Whether the engine may activate this node at the same time as other nodes
+	// (subject to the usual edges), see Engine::dispatchActivation().
+	bool concurrent() { return concurrent_; }
+
 protected:
 	virtual void activate() { };
 
@@ -72,6 +77,7 @@ private:
 	Engine *engine_;
 
 	const char *displayName_;
+	bool concurrent_;
 
 	frg::intrusive_list<
 		Edge,
@@ -116,6 +122,16 @@ protected:
 	virtual void reportUnreached(Node *node) { (void)node; };
 	virtual void onUnreached() { __builtin_trap(); }
 
+	// Called for nodes that are ready to run. An engine can return true to take over
+	// the activation (e.g., to run it on another CPU); it then has to run
+	// activateNode() on the node and hand it back through waitForActivation().
+	// By default, all nodes are activated inline by run().
+	virtual bool dispatchActivation(Node *node) { (void)node; return false; }
+	// Blocks until one of the dispatched nodes has been activated and returns it.
+	virtual Node *waitForActivation() { __builtin_trap(); }
+
+	static void activateNode(Node *node) { node->activate(); }
+
 public:
 	void run(Node *goal = nullptr) {
 		frg::intrusive_list<
@@ -163,26 +179,31 @@ public:
 		}
 
 		// Now, run pending nodes until no such nodes remain.
-		while(!pending_.empty()) {
+		// Nodes that are dispatched elsewhere only release their successors once
+		// they are handed back; the ready queue is only ever touched from run().
+		unsigned int nDispatched = 0;
+		while(!pending_.empty() || nDispatched) {
+			if(pending_.empty()) {
+				auto current = waitForActivation();
+				assert(nDispatched);
+				--nDispatched;
+				complete_(current);
+				continue;
+			}
+
 			auto current = pending_.pop_front();
 			assert(current->wanted_);
 			assert(!current->done_);
 
 			preActivate(current);
 
-			current->activate();
-			current->done_ = true;
-
-			postActivate(current);
-
-			for(auto edge : current->outList_) {
-				auto successor = edge->target_;
-
-				assert(successor->nUnsatisfied);
-				--successor->nUnsatisfied;
-				if(successor->wanted_ && !successor->done_ && !successor->nUnsatisfied)
-					pending_.push_back(successor);
+			if(dispatchActivation(current)) {
+				++nDispatched;
+				continue;
 			}
+
+			current->activate();
+			complete_(current);
 		}
 
 		unsigned int nUnreached = 0;
@@ -200,6 +221,21 @@ public:
 	}
 
 private:
+	void complete_(Node *current) {
+		current->done_ = true;
+
+		postActivate(current);
+
+		for(auto edge : current->outList_) {
+			auto successor = edge->target_;
+
+			assert(successor->nUnsatisfied);
+			--successor->nUnsatisfied;
+			if(successor->wanted_ && !successor->done_ && !successor->nUnsatisfied)
+				pending_.push_back(successor);
+		}
+	}
+
 	frg::intrusive_list<
 		Node,
 		frg::locate_member<
@@ -289,12 +325,21 @@ auto apply(std::index_sequence<S...>, frg::array<T, N> array, I invocable) {
 	return invocable(array[S]...);
 }
 
+// Marks a Task that does not rely on running in isolation: apart from its edges,
+// it may run at the same time as any other task (and on any CPU).
+struct Concurrent { };
+
 template< typename F, size_t NR = 0, size_t NE = 0>
 struct Task final : Node {
 	Task(Engine *engine, const char *displayName, Requires<NR> r, Entails<NE> e, F invocable)
-	: Node{NodeType::task, engine, displayName}, invocable_{std::move(invocable)},
-			rEdges_{apply(std::make_index_sequence<NR>{}, r.array, IntoEdgesTo{this})},
-			eEdges_{apply(std::make_index_sequence<NE>{}, e.array, IntoEdgesFrom{this})} { }
+	: Task{engine, displayName, false, r, e, std::move(invocable)} { }
+
+	Task(Engine *engine, const char *displayName, Concurrent,
+			Requires<NR> r, Entails<NE> e, F invocable)
+	: Task{engine, displayName, true, r, e, std::move(invocable)} { }
+
+	Task(Engine *engine, const char *displayName, Concurrent, Requires<NR> r, F invocable)
+	: Task{engine, displayName, true, r, {}, std::move(invocable)} { }
 
 	Task(Engine *engine, const char *displayName, F invocable)
 	: Task{engine, displayName, {}, {}, std::move(invocable)} { }
@@ -311,6 +356,12 @@ protected:
 	}
 
 private:
+	Task(Engine *engine, const char *displayName, bool concurrent,
+			Requires<NR> r, Entails<NE> e, F invocable)
+	: Node{NodeType::task, engine, displayName, concurrent}, invocable_{std::move(invocable)},
+			rEdges_{apply(std::make_index_sequence<NR>{}, r.array, IntoEdgesTo{this})},
+			eEdges_{apply(std::make_index_sequence<NE>{}, e.array, IntoEdgesFrom{this})} { }
+
 	F invocable_;
 	frg::array<Edge, NR> rEdges_;
 	frg::array<Edge, NE> eEdges_;
@@ -5,6 +5,10 @@
 #include <frg/printf.hpp>
 #include <frg/string.hpp>
 
+#ifdef __x86_64__
+#include <x86/machine.hpp>
+#endif
+
 // We need to define the true memcpy / memset symbols
 // (string.h expands them to the __builtin variants).
 #undef memcpy
@@ -35,6 +39,27 @@ size_t strlen(const char *str) {
 // memcpy() implementation.
 // --------------------------------------------------------------------------------------
 
+#ifdef __x86_64__
+
+namespace common::x86 {
+	constinit bool haveErms = false;
+	constinit bool haveFsrm = false;
+}
+
+namespace {
+	// Without FSRM, rep movsb/stosb have a significant startup cost;
+	// the word loops are faster for small sizes.
+	constexpr size_t repStringThreshold = 256;
+
+	inline bool useRepString(size_t n) {
+		if(!common::x86::haveErms)
+			return false;
+		return common::x86::haveFsrm || n >= repStringThreshold;
+	}
+}
+
+#endif // __x86_64__
+
 namespace {
 	extern "C++" {
 
@@ -67,6 +92,14 @@ namespace {
 #ifdef __LP64__
 
 void *memcpy(void *__restrict dest, const void *__restrict src, size_t n) {
+#ifdef __x86_64__
+	if(useRepString(n)) {
+		auto d = dest;
+		asm volatile ("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+		return dest;
+	}
+#endif
+
 	auto curDest = reinterpret_cast<unsigned char *>(dest);
 	auto curSrc = reinterpret_cast<const unsigned char *>(src);
 
@@ -144,6 +177,14 @@ void *memcpy(void *dest, const void *src, size_t n) {
 #ifdef __LP64__
 
 void *memset(void *dest, int val, size_t n) {
+#ifdef __x86_64__
+	if(useRepString(n)) {
+		auto d = dest;
+		asm volatile ("rep stosb" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+		return dest;
+	}
+#endif
+
 	auto curDest = reinterpret_cast<unsigned char *>(dest);
 	unsigned char byte = val;
 
@@ -58,3 +58,70 @@ void renderChars(void *fb_ptr, unsigned int pitch,
 	asm volatile ("" : : : "memory");
 }
 
+
+// Caches the pixels of each possible font row for a few (fg, bg) pairs,
+// so that rendering a glyph row is a single copy instead of a loop over its bits.
+// Pairs are evicted round-robin; the boot log only uses a handful of colors.
+template<int FontWidth, int Slots = 4>
+struct GlyphRowCache {
+	static_assert(FontWidth <= 8, "font rows are stored as bytes");
+
+	using Row = uint32_t[FontWidth];
+
+	const Row *lookup(int fg, int bg) {
+		for(int s = 0; s < Slots; s++) {
+			if(_slots[s].fg == fg && _slots[s].bg == bg)
+				return _slots[s].rows;
+		}
+
+		auto &slot = _slots[_next];
+		_next = (_next + 1) % Slots;
+
+		auto fg_rgb = rgbColor[fg];
+		auto bg_rgb = (bg < 0) ? defaultBg : rgbColor[bg];
+		for(int bits = 0; bits < 256; bits++) {
+			for(int j = 0; j < FontWidth; j++) {
+				int bit = (1 << ((FontWidth - 1) - j));
+				slot.rows[bits][j] = (bits & bit) ? fg_rgb : bg_rgb;
+			}
+		}
+		slot.fg = fg;
+		slot.bg = bg;
+		return slot.rows;
+	}
+
+private:
+	struct Slot {
+		// -2 never matches a valid color index.
+		int fg = -2;
+		int bg = -2;
+		Row rows[256];
+	};
+
+	Slot _slots[Slots];
+	int _next = 0;
+};
+
+template<int FontWidth, int FontHeight>
+void renderChars(GlyphRowCache<FontWidth> &cache, void *fb_ptr, unsigned int pitch,
+		unsigned int x, unsigned int y,
+		const char *c, int count, int fg, int bg,
+		std::integral_constant<int, FontWidth>,
+		std::integral_constant<int, FontHeight>) {
+	auto rows = cache.lookup(fg, bg);
+
+	auto fb = reinterpret_cast<uint32_t *>(fb_ptr);
+	auto line = fb + y * FontHeight * pitch + x * FontWidth;
+	for(size_t i = 0; i < FontHeight; i++) {
+		auto dest = line;
+		for(int k = 0; k < count; k++) {
+			auto dc = (c[k] >= 32 && c[k] <= 127) ? c[k] : 127;
+			auto &row = rows[fontBitmap[(dc - 32) * FontHeight + i]];
+			for(size_t j = 0; j < FontWidth; j++)
+				*dest++ = row[j];
+		}
+		line += pitch;
+	}
+
+	asm volatile ("" : : : "memory");
+}
@@ -26,6 +26,11 @@ enum {
 	kCpuFlagLongMode = 0x20000000
 };
 
+// Used by memcpy() and memset() to select rep movsb/stosb (see libc.cpp).
+// These are set by thor once the CPU features are known.
+extern bool haveErms;
+extern bool haveFsrm;
+
 inline frg::array<uint32_t, 4> cpuid(uint32_t eax, uint32_t ecx = 0) {
 	frg::array<uint32_t, 4> out;
 	asm volatile ( "cpuid"
@@ -45,6 +50,7 @@ enum {
 	kMsrIndexFsBase = 0xC0000100,
 	kMsrIndexGsBase = 0xC0000101,
 	kMsrIndexKernelGsBase = 0xC0000102,
+	kMsrIa32TscAux = 0xC0000103,
 	kMsrIndexVmCr = 0xC0010114,
 };
 
@@ -60,6 +66,14 @@ inline void xsave(uint8_t* area, uint64_t rfbm){
 	asm volatile("xsave %0" : : "m"(*area), "a"(low), "d"(high) : "memory");
 }
 
+inline void xsaveopt(uint8_t* area, uint64_t rfbm){
+	assert(!((uintptr_t)area & 0x3F));
+
+	uintptr_t low = rfbm & 0xFFFFFFFF;
+	uintptr_t high = (rfbm >> 32) & 0xFFFFFFFF;
+	asm volatile("xsaveopt %0" : : "m"(*area), "a"(low), "d"(high) : "memory");
+}
+
 inline void xrstor(uint8_t* area, uint64_t rfbm){
 	assert(!((uintptr_t)area & 0x3F));
 
@@ -146,6 +146,12 @@ address_t getSingle4kPage(address_t address) {
 	return page_ptr;
 }
 
+uint64_t getRawTimestampCounter() {
+	uint64_t cntpct;
+	asm volatile ("mrs %0, cntpct_el0" : "=r"(cntpct));
+	return cntpct;
+}
+
 void initProcessorEarly() {
 	eir::infoLogger() << "Starting Eir" << frg::endlog;
 
@@ -187,6 +193,7 @@ void initProcessorEarly() {
 
 // Returns Core region index
 void initProcessorPaging(void *kernel_start, uint64_t &kernel_entry) {
+	enterBootStage("setup-paging");
 	setupPaging();
 	eir::infoLogger() << "eir: Allocated " << (allocatedMemory >> 10) << " KiB"
 			" after setting up paging" << frg::endlog;
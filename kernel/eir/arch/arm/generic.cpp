@@ -38,6 +38,7 @@ void eirRelocate() {
 #endif // PIE
 
 [[noreturn]] void eirGenericMain(const GenericInfo &genericInfo) {
+	enterBootStage("parse-dtb");
 	initProcessorEarly();
 
 	DeviceTree dt{reinterpret_cast<void *>(genericInfo.deviceTreePtr)};
@@ -186,6 +187,7 @@ void eirRelocate() {
 		}
 	}
 
+	decompressInitrd();
 	setupRegionStructs();
 
 	eir::infoLogger() << "Kernel memory regions:" << frg::endlog;
@@ -214,8 +216,8 @@ void eirRelocate() {
 	auto info_ptr = generateInfo(cmdline);
 
 	auto module = bootAlloc<EirModule>();
-	module->physicalBase = initrd;
-	module->length = initrd_image.size();
+	module->physicalBase = reinterpret_cast<EirPtr>(initrd_archive.data());
+	module->length = initrd_archive.size();
 
 	char *name_ptr = bootAlloc<char>(11);
 	memcpy(name_ptr, "initrd.cpio", 11);
@@ -5,4 +5,10 @@ namespace eir {
 void initProcessorEarly() {
 }
 
+uint64_t getRawTimestampCounter() {
+	uint64_t time;
+	asm volatile ("rdtime %0" : "=r"(time));
+	return time;
+}
+
 } // namespace eir
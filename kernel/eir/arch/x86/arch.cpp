@@ -142,6 +142,13 @@ address_t getSingle4kPage(address_t address) {
 	return pt_entry & 0xF'FFFF'FFFF'F000;
 }
 
+uint64_t getRawTimestampCounter() {
+	uint32_t lsw, msw;
+	asm volatile ("rdtsc" : "=a"(lsw), "=d"(msw));
+	return (static_cast<uint64_t>(msw) << 32)
+			| static_cast<uint64_t>(lsw);
+}
+
 void initArchCpu();
 
 void initProcessorEarly() {
@@ -182,6 +189,7 @@ void initProcessorEarly() {
 
 // Returns Core region index
 void initProcessorPaging(void *kernel_start, uint64_t &kernel_entry) {
+	enterBootStage("setup-paging");
 	setupPaging();
 	eir::infoLogger() << "eir: Allocated " << (allocatedMemory >> 10) << " KiB"
 			" after setting up paging" << frg::endlog;
@@ -130,12 +130,14 @@ extern "C" void eirEnterKernel(uintptr_t, uint64_t, uint64_t);
 extern "C" void eirMultiboot2Main(uint32_t info, uint32_t magic){
 	if(magic != 0x36d76289)
 		eir::panicLogger() << "eir: Invalid multiboot2 signature, halting..." << frg::endlog;
+	enterBootStage("parse-multiboot2");
 
 	InitialRegion reservedRegions[32];
 	size_t nReservedRegions = 0;
 
 	uintptr_t eirEnd = reinterpret_cast<uintptr_t>(&eirImageCeiling);
 	reservedRegions[nReservedRegions++] = {0, eirEnd};
+	reservedRegions[nReservedRegions++] = {eirSmpTrampolineBase, eirSmpTrampolineSize};
 
 	Mb2Info* mb_info = reinterpret_cast<Mb2Info*>(info);
 	size_t add_size = 0;
@@ -237,6 +239,9 @@ extern "C" void eirMultiboot2Main(uint32_t info, uint32_t magic){
 			createInitialRegions({map->base, map->length}, {reservedRegions, nReservedRegions});
 	}
 
+	parseInitrd(reinterpret_cast<void *>(initrd_module_start));
+	decompressInitrd();
+
 	setupRegionStructs();
 
 	eir::infoLogger() << "Kernel memory regions:" << frg::endlog;
@@ -252,8 +257,6 @@ extern "C" void eirMultiboot2Main(uint32_t info, uint32_t magic){
 					<< frg::endlog;
 	}
 
-	parseInitrd(reinterpret_cast<void *>(initrd_module_start));
-
 	uint64_t kernel_entry = 0;
 	initProcessorPaging(reinterpret_cast<void *>(kernel_image.data()), kernel_entry);
 
@@ -275,8 +278,8 @@ extern "C" void eirMultiboot2Main(uint32_t info, uint32_t magic){
 			case kMb2TagModule: {
 				auto *module = reinterpret_cast<Mb2TagModule *>(tag);
 
-				initrd_module->physicalBase = (EirPtr)module->start;
-				initrd_module->length = (EirPtr)module->end - (EirPtr)module->start;
+				initrd_module->physicalBase = reinterpret_cast<EirPtr>(initrd_archive.data());
+				initrd_module->length = initrd_archive.size();
 
 				size_t name_length = strlen(module->string);
 				char *name_ptr = bootAlloc<char>(name_length);
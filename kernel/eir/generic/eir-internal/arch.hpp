@@ -30,6 +30,9 @@ void mapSingle4kPage(address_t address, address_t physical, uint32_t flags,
 address_t getSingle4kPage(address_t address);
 
 void initProcessorEarly();
+
+// Returns a raw (i.e., uncalibrated) timestamp. Used to time the boot stages.
+uint64_t getRawTimestampCounter();
 void initProcessorPaging(void *kernel_start, uint64_t &kernel_entry);
 
 // These need to be hidden because they are used in eirRelocate.
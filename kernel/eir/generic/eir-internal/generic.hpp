@@ -10,7 +10,10 @@
 namespace eir {
 
 extern frg::span<uint8_t> kernel_image;
+// The initrd as passed by the bootloader; it may be compressed.
 extern frg::span<uint8_t> initrd_image;
+// The uncompressed CPIO archive. Only valid after decompressInitrd().
+extern frg::span<uint8_t> initrd_archive;
 
 enum class RegionType {
 	null,
@@ -64,9 +67,16 @@ void mapKasanShadow(uint64_t address, size_t size);
 void unpoisonKasanShadow(uint64_t address, size_t size);
 void mapRegionsAndStructs();
 
+// Determines the size of the initrd. If it is not compressed, this also locates thor.
 void parseInitrd(void *initrd);
+// Decompresses the initrd (if necessary) and locates thor.
+// Must be called after createInitialRegions() but before setupRegionStructs().
+void decompressInitrd();
 address_t loadKernelImage(void *image);
 
+// Records the start of a boot stage; the stages are passed to thor by generateInfo().
+void enterBootStage(const char *name);
+
 EirInfo *generateInfo(const char *cmdline);
 
 void setFbInfo(void *ptr, int width, int height, size_t pitch);
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <frg/span.hpp>
+
+// Decoder for the LZ4 frame format, see
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md.
+// Checksums are not verified. Dictionaries are not supported.
+struct Lz4Frame {
+	static constexpr uint32_t magic = 0x184D2204;
+
+	static bool isLz4(const void *p) {
+		return load32(static_cast<const uint8_t *>(p)) == magic;
+	}
+
+	// Parses the frame header and walks all block headers to determine the size of the frame.
+	Lz4Frame(const void *p)
+	: base_{static_cast<const uint8_t *>(p)} {
+		auto ptr = base_;
+		if(load32(ptr) != magic)
+			return;
+		ptr += 4;
+
+		auto flg = ptr[0];
+		if((flg >> 6) != 1) // Version must be 01.
+			return;
+		if(flg & 1) // Dictionary ID.
+			return;
+		blockChecksums_ = flg & (1 << 4);
+		bool hasContentSize = flg & (1 << 3);
+		bool hasContentChecksum = flg & (1 << 2);
+		ptr += 2; // FLG and BD.
+
+		if(hasContentSize) {
+			contentSize_ = load32(ptr) | (uint64_t{load32(ptr + 4)} << 32);
+			ptr += 8;
+		}
+		ptr += 1; // Header checksum.
+		blocks_ = ptr;
+
+		while(true) {
+			auto header = load32(ptr);
+			ptr += 4;
+			if(!header)
+				break;
+			ptr += (header & 0x7FFF'FFFF);
+			if(blockChecksums_)
+				ptr += 4;
+		}
+		if(hasContentChecksum)
+			ptr += 4;
+
+		size_ = ptr - base_;
+		valid_ = hasContentSize;
+	}
+
+	// Only frames that include their content size are supported.
+	bool valid() const {
+		return valid_;
+	}
+
+	// Size of the compressed frame.
+	size_t size() const {
+		return size_;
+	}
+
+	// Size of the decompressed data.
+	uint64_t contentSize() const {
+		return contentSize_;
+	}
+
+	// Decompresses the frame into out, which must be contentSize() bytes large.
+	// Returns false if the frame is corrupted.
+	bool decompress(frg::span<uint8_t> out) const {
+		if(!valid_ || out.size() != contentSize_)
+			return false;
+
+		auto ptr = blocks_;
+		size_t progress = 0;
+		while(true) {
+			auto header = load32(ptr);
+			ptr += 4;
+			if(!header)
+				break;
+
+			size_t length = header & 0x7FFF'FFFF;
+			if(header & 0x8000'0000) {
+				if(length > out.size() - progress)
+					return false;
+				memcpy(out.data() + progress, ptr, length);
+				progress += length;
+			}else{
+				if(!decompressBlock_(ptr, length, out, progress))
+					return false;
+			}
+
+			ptr += length;
+			if(blockChecksums_)
+				ptr += 4;
+		}
+
+		return progress == out.size();
+	}
+
+private:
+	static uint32_t load32(const uint8_t *p) {
+		return uint32_t{p[0]} | (uint32_t{p[1]} << 8)
+				| (uint32_t{p[2]} << 16) | (uint32_t{p[3]} << 24);
+	}
+
+	// Decodes a single block. Matches may refer to the output of previous blocks.
+	static bool decompressBlock_(const uint8_t *in, size_t length,
+			frg::span<uint8_t> out, size_t &progress) {
+		auto end = in + length;
+
+		// Decodes the extension bytes of a literal or match length.
+		auto extendLength = [&] (size_t &n) -> bool {
+			while(true) {
+				if(in == end)
+					return false;
+				auto b = *in++;
+				n += b;
+				if(b != 255)
+					return true;
+			}
+		};
+
+		while(in < end) {
+			auto token = *in++;
+
+			size_t literals = token >> 4;
+			if(literals == 15 && !extendLength(literals))
+				return false;
+			if(literals > size_t(end - in) || literals > out.size() - progress)
+				return false;
+			memcpy(out.data() + progress, in, literals);
+			in += literals;
+			progress += literals;
+
+			// The last sequence of a block only consists of literals.
+			if(in == end)
+				break;
+
+			if(end - in < 2)
+				return false;
+			size_t offset = in[0] | (in[1] << 8);
+			in += 2;
+			if(!offset || offset > progress)
+				return false;
+
+			size_t match = token & 0xF;
+			if(match == 15 && !extendLength(match))
+				return false;
+			match += 4;
+			if(match > out.size() - progress)
+				return false;
+
+			// Matches can overlap with their own output, hence we copy byte by byte.
+			auto dest = out.data() + progress;
+			auto src = dest - offset;
+			for(size_t i = 0; i < match; i++)
+				dest[i] = src[i];
+			progress += match;
+		}
+
+		return true;
+	}
+
+	const uint8_t *base_;
+	const uint8_t *blocks_ = nullptr;
+	size_t size_ = 0;
+	uint64_t contentSize_ = 0;
+	bool blockChecksums_ = false;
+	bool valid_ = false;
+};
@@ -1,11 +1,13 @@
 #include <initgraph.hpp>
 #include <eir-internal/debug.hpp>
+#include <eir-internal/generic.hpp>
 
 namespace eir {
 
 struct GlobalInitEngine final : initgraph::Engine {
 	void preActivate(initgraph::Node *node) override {
 		infoLogger() << "eir: Running " << node->displayName() << frg::endlog;
+		enterBootStage(node->displayName());
 	}
 
 	void onUnreached() override {
@@ -2,6 +2,7 @@
 #include <eir-internal/debug.hpp>
 #include <eir-internal/generic.hpp>
 #include <eir-internal/arch.hpp>
+#include <eir-internal/lz4.hpp>
 
 #include <frg/utility.hpp>
 #include <frg/manual_box.hpp>
@@ -14,6 +15,29 @@ namespace eir {
 address_t allocatedMemory;
 frg::span<uint8_t> kernel_image{nullptr, 0};
 frg::span<uint8_t> initrd_image{nullptr, 0};
+frg::span<uint8_t> initrd_archive{nullptr, 0};
+
+// ----------------------------------------------------------------------------
+// Boot stage timing.
+// ----------------------------------------------------------------------------
+
+namespace {
+	constexpr size_t maxBootStages = 32;
+
+	EirBootStage bootStages[maxBootStages];
+	size_t numBootStages = 0;
+} // anonymous namespace
+
+void enterBootStage(const char *name) {
+	if(numBootStages == maxBootStages)
+		return;
+	auto stage = &bootStages[numBootStages++];
+	stage->startTicks = getRawTimestampCounter();
+	size_t i = 0;
+	for(; name[i] && i < sizeof(stage->name) - 1; i++)
+		stage->name[i] = name[i];
+	stage->name[i] = 0;
+}
 
 // ----------------------------------------------------------------------------
 // Memory region management.
@@ -105,6 +129,9 @@ address_t cutFromRegion(size_t size) {
 
 		if(regions[i].size < size)
 			continue;
+		// Eir needs to be able to access the memory.
+		if(regions[i].address + regions[i].size - 1 > UINTPTR_MAX)
+			continue;
 
 		regions[i].size -= size;
 
@@ -120,6 +147,8 @@ address_t cutFromRegion(size_t size) {
 }
 
 void setupRegionStructs() {
+	enterBootStage("setup-regions");
+
 	for(size_t j = numRegions; j > 0; j--) {
 		size_t i = j - 1;
 
@@ -354,14 +383,10 @@ address_t mapBootstrapData(void *p) {
 
 // ----------------------------------------------------------------------------
 
-void parseInitrd(void *initrd) {
-	CpioRange cpio_range{reinterpret_cast<void *>(initrd)};
-	auto initrd_end = reinterpret_cast<uintptr_t>(cpio_range.eof());
-	eir::infoLogger() << "Initrd ends at " << (void *)initrd_end << frg::endlog;
-	initrd_image = frg::span<uint8_t>{
-		reinterpret_cast<uint8_t *>(initrd),
-		initrd_end - reinterpret_cast<uintptr_t>(initrd)};
+namespace {
 
+void findKernelImage() {
+	CpioRange cpio_range{initrd_archive.data()};
 	for(auto entry : cpio_range) {
 		if(entry.name == "thor") {
 			kernel_image = entry.data;
@@ -372,7 +397,60 @@ void parseInitrd(void *initrd) {
 		eir::panicLogger() << "eir: could not find thor in the initrd.cpio" << frg::endlog;
 }
 
+} // anonymous namespace
+
+void parseInitrd(void *initrd) {
+	enterBootStage("parse-initrd");
+
+	if(Lz4Frame::isLz4(initrd)) {
+		Lz4Frame frame{initrd};
+		if(!frame.valid())
+			eir::panicLogger() << "eir: LZ4-compressed initrd must include its content size"
+					<< frg::endlog;
+		initrd_image = frg::span<uint8_t>{reinterpret_cast<uint8_t *>(initrd), frame.size()};
+		eir::infoLogger() << "Initrd is LZ4-compressed, ends at "
+				<< (void *)(initrd_image.data() + initrd_image.size())
+				<< ", uncompressed size: 0x" << frg::hex_fmt{frame.contentSize()} << frg::endlog;
+		return;
+	}
+
+	CpioRange cpio_range{reinterpret_cast<void *>(initrd)};
+	auto initrd_end = reinterpret_cast<uintptr_t>(cpio_range.eof());
+	eir::infoLogger() << "Initrd ends at " << (void *)initrd_end << frg::endlog;
+	initrd_image = frg::span<uint8_t>{
+		reinterpret_cast<uint8_t *>(initrd),
+		initrd_end - reinterpret_cast<uintptr_t>(initrd)};
+	initrd_archive = initrd_image;
+
+	findKernelImage();
+}
+
+void decompressInitrd() {
+	if(initrd_archive.data())
+		return;
+	enterBootStage("decompress-initrd");
+
+	Lz4Frame frame{initrd_image.data()};
+	assert(frame.valid());
+
+	// The archive is passed to thor as a single module, hence it needs to be contiguous.
+	// Cut it from a region (like the buddy trees) since the buddy allocator cannot
+	// allocate chunks larger than its roots.
+	auto size = (frame.contentSize() + pageSize - 1) & ~address_t(pageSize - 1);
+	auto physical = cutFromRegion(size);
+	initrd_archive = frg::span<uint8_t>{reinterpret_cast<uint8_t *>(static_cast<uintptr_t>(physical)),
+			static_cast<size_t>(frame.contentSize())};
+
+	if(!frame.decompress(initrd_archive))
+		eir::panicLogger() << "eir: LZ4-compressed initrd is corrupted" << frg::endlog;
+	eir::infoLogger() << "Decompressed initrd to " << (void *)physical << frg::endlog;
+
+	findKernelImage();
+}
+
 address_t loadKernelImage(void *image) {
+	enterBootStage("load-kernel");
+
 	Elf64_Ehdr ehdr;
 	memcpy(&ehdr, image, sizeof(Elf64_Ehdr));
 	if(ehdr.e_ident[0] != '\x7F'
@@ -428,6 +506,9 @@ address_t loadKernelImage(void *image) {
 }
 
 EirInfo *generateInfo(const char *cmdline){
+	// This is the last stage; it lasts until thor is entered.
+	enterBootStage("generate-info");
+
 	// Setup the eir interface struct.
 	auto info_ptr = bootAlloc<EirInfo>();
 	memset(info_ptr, 0, sizeof(EirInfo));
@@ -487,6 +568,13 @@ EirInfo *generateInfo(const char *cmdline){
 	memcpy(cmd_buffer, cmdline, cmd_length + 1);
 	info_ptr->commandLine = mapBootstrapData(cmd_buffer);
 
+	// Pass the boot stages to thor.
+	static_assert(sizeof(bootStages) <= pageSize);
+	auto stageInfos = bootAlloc<EirBootStage>(numBootStages);
+	memcpy(stageInfos, bootStages, sizeof(EirBootStage) * numBootStages);
+	info_ptr->numBootStages = numBootStages;
+	info_ptr->bootStageInfo = mapBootstrapData(stageInfos);
+
 	return info_ptr;
 }
 
@@ -41,6 +41,7 @@ extern "C" efi_status eirUefiMain(const efi_handle h, const efi_system_table *sy
 	st = system_table;
 	bs = st->boot_services;
 	handle = h;
+	enterBootStage("uefi-setup");
 
 	logHandler = uefiBootServicesLogHandler;
 
@@ -185,6 +186,9 @@ extern "C" efi_status eirUefiMain(const efi_handle h, const efi_system_table *sy
 
 	reservedRegions[nReservedRegions++] = {reinterpret_cast<uintptr_t>(loadedImage->image_base), loadedImage->image_size};
 	reservedRegions[nReservedRegions++] = {initrd, initrdInfo->file_size};
+#if defined(__x86_64__)
+	reservedRegions[nReservedRegions++] = {eirSmpTrampolineBase, eirSmpTrampolineSize};
+#endif
 
 	auto entries = memMapSize / descriptorSize;
 
@@ -259,6 +263,7 @@ extern "C" efi_status eirUefiMain(const efi_handle h, const efi_system_table *sy
 	}
 
 	initProcessorEarly();
+	decompressInitrd();
 	setupRegionStructs();
 
 	uint64_t kernel_entry = 0;
@@ -267,8 +272,8 @@ extern "C" efi_status eirUefiMain(const efi_handle h, const efi_system_table *sy
 	EirInfo *info_ptr = generateInfo(cmdLine);
 
 	auto initrd_module = bootAlloc<EirModule>(1);
-	initrd_module->physicalBase = reinterpret_cast<EirPtr>(initrd);
-	initrd_module->length = initrdInfo->file_size;
+	initrd_module->physicalBase = reinterpret_cast<EirPtr>(initrd_archive.data());
+	initrd_module->length = initrd_archive.size();
 	const char *initrd_mod_name = "initrd.cpio";
 	size_t name_length = strlen(initrd_mod_name);
 	char *name_ptr = bootAlloc<char>(name_length);
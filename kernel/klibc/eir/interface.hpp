@@ -8,6 +8,11 @@ static const uint32_t eirDebugSerial = 1;
 static const uint32_t eirDebugBochs = 2;
 static const uint32_t eirDebugKernelProfile = 16;
 
+// On x86, eir never hands this range of low physical memory to thor's allocator.
+// thor places its SMP trampoline page and the AP slot pages here.
+static const uint64_t eirSmpTrampolineBase = 0x10000;
+static const uint64_t eirSmpTrampolineSize = 0x3000;
+
 typedef uint64_t EirPtr;
 typedef uint64_t EirSize;
 
@@ -36,6 +41,14 @@ struct EirFramebuffer {
 	EirSize fbType;
 };
 
+// Start of a boot stage in eir. Each stage lasts until the next one starts;
+// the last stage lasts until thor is entered.
+struct EirBootStage {
+	// Raw timestamp counter value (i.e., TSC on x86, CNTPCT on ARM).
+	uint64_t startTicks;
+	char name[24];
+};
+
 struct EirInfo {
 	uint64_t signature;
 	EirPtr commandLine;
@@ -52,4 +65,7 @@ struct EirInfo {
 	EirFramebuffer frameBuffer;
 
 	uint64_t acpiRsdp;
+
+	EirSize numBootStages;
+	EirPtr bootStageInfo;
 };
@@ -350,13 +350,9 @@ static uintptr_t cpuInterfaceSize;
 
 bool initGicV2() {
 	DeviceTreeNode *gicNode = nullptr;
-	getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-		if (node->isCompatible(dtGicV2Compatible)) {
-			gicNode = node;
-			return true;
-		}
-
-		return false;
+	forEachCompatibleDeviceTreeNode(dtGicV2Compatible, [&](DeviceTreeNode *node) -> bool {
+		gicNode = node;
+		return true;
 	});
 
 	if (!gicNode)
@@ -242,13 +242,9 @@ void GicPinV3::setPriority_(uint8_t priority) {
 
 bool initGicV3() {
 	DeviceTreeNode *gicNode = nullptr;
-	getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-		if(node->isCompatible(dtGicV3Compatible)) {
-			gicNode = node;
-			return true;
-		}
-
-		return false;
+	forEachCompatibleDeviceTreeNode(dtGicV3Compatible, [&](DeviceTreeNode *node) -> bool {
+		gicNode = node;
+		return true;
 	});
 
 	if(!gicNode)
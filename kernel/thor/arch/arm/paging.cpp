@@ -6,10 +6,75 @@
 
 namespace thor {
 
+namespace {
+	// Set if the CPU implements FEAT_TLBIRANGE (TLBI by range of VAs).
+	bool haveTlbiRange = false;
+
+	// Without range TLBIs, invalidating large ranges page by page is slower
+	// than dropping all entries of the ASID and refilling the TLB on demand.
+	constexpr size_t maxPagewiseInvalidation = 512;
+
+	// Range TLBIs cover (NUM + 1) << (5 * SCALE + 1) pages; since we issue at most
+	// one TLBI per SCALE, this is an exclusive upper bound on the range.
+	constexpr size_t maxRangeInvalidation = size_t{32} << 16;
+}
+
 static inline constexpr uint64_t tlbiValue(uint16_t asid, uint64_t va = 0) {
 	return (uint64_t(asid) << 48) | (va >> 12);
 }
 
+static inline constexpr uint64_t tlbiRangeValue(uint16_t asid, uint64_t va, int scale, int num) {
+	// TG = 0b01 selects the 4 KiB granule; TTL = 0 since entries can be at any level.
+	return (uint64_t(asid) << 48) | (uint64_t(1) << 46) | (uint64_t(scale) << 44)
+			| (uint64_t(num) << 39) | ((va >> 12) & ((uint64_t(1) << 37) - 1));
+}
+
+// Invalidates the local TLB entries of [address, address + size).
+// For kernel ranges, the (global) last level entries are invalidated.
+static void doInvalidateRange(bool kernel, int asid, VirtualAddr address, size_t size) {
+	auto pages = size >> kPageShift;
+	if(pages >= (haveTlbiRange ? maxRangeInvalidation : maxPagewiseInvalidation)) {
+		if(kernel) {
+			asm volatile ("dsb st; tlbi vmalle1; dsb sy; isb" ::: "memory");
+		}else{
+			invalidateAsid(asid);
+		}
+		return;
+	}
+
+	asm volatile ("dsb st" ::: "memory");
+	int scale = 0;
+	while(pages) {
+		// Range TLBIs only cover even numbers of pages.
+		if(!haveTlbiRange || (pages & 1)) {
+			if(kernel) {
+				asm volatile ("tlbi vale1, %0" :: "r"(tlbiValue(0, address)) : "memory");
+			}else{
+				asm volatile ("tlbi vae1, %0" :: "r"(tlbiValue(asid, address)) : "memory");
+			}
+			address += kPageSize;
+			pages--;
+			continue;
+		}
+
+		auto num = static_cast<int>((pages >> (5 * scale + 1)) & 0x1F) - 1;
+		if(num >= 0) {
+			auto value = tlbiRangeValue(kernel ? 0 : asid, address, scale, num);
+			// Encodings of TLBI RVALE1 and TLBI RVAE1 (older assemblers reject the mnemonics).
+			if(kernel) {
+				asm volatile ("sys #0, c8, c6, #5, %0" :: "r"(value) : "memory");
+			}else{
+				asm volatile ("sys #0, c8, c6, #1, %0" :: "r"(value) : "memory");
+			}
+			auto covered = size_t(num + 1) << (5 * scale + 1);
+			address += covered << kPageShift;
+			pages -= covered;
+		}
+		scale++;
+	}
+	asm volatile ("dsb sy; isb" ::: "memory");
+}
+
 void invalidatePage(const void *address) {
 	asm volatile ("dsb st;\n\t\
 			tlbi vale1, %0;\n\t\
@@ -37,6 +102,14 @@ void invalidatePage(int asid, const void *address) {
 			: "memory");
 }
 
+void invalidateRange(int asid, VirtualAddr address, size_t size) {
+	doInvalidateRange(false, asid, address, size);
+}
+
+void invalidateKernelRange(VirtualAddr address, size_t size) {
+	doInvalidateRange(true, 0, address, size);
+}
+
 // TODO: TLBI ALLE1 is invalid in EL1...
 void invalidateFullTlb() {
 	asm volatile ("dsb st;\n\t\
@@ -67,11 +140,8 @@ void PageBinding::rebind() {
 	assert(_boundSpace);
 	auto context = &getCpuData()->pageContext;
 
-	// Invalidate old TLB contents for this TTBR0's ASID
-	uint64_t old_ttbr0;
-	asm volatile ("mrs %0, ttbr0_el1" : "=r" (old_ttbr0) :: "memory");
-	invalidateAsid((old_ttbr0 >> 48) & 0xFFFF);
-
+	// The TLB entries that are tagged with our ASID still belong to the bound space
+	// (shootdowns are also applied to bindings that are not primary), so keep them.
 	auto ttbr0 = (uint64_t(_asid) << 48) | _boundSpace->rootTable();
 	asm volatile ("dsb st; msr ttbr0_el1, %0; dsb sy; isb" :: "r" (ttbr0) : "memory");
 
@@ -99,13 +169,11 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 	_boundSpace = space;
 	_alreadyShotSequence = target_seq;
 
-	// Invalidate old TLB contents for this TTBR0's ASID
-	uint64_t old_ttbr0;
-	asm volatile ("mrs %0, ttbr0_el1" : "=r" (old_ttbr0) :: "memory");
-	invalidateAsid((old_ttbr0 >> 48) & 0xFFFF);
-
+	// Switch TTBR0 and drop the entries of the previously bound space.
+	// These can be refilled until the write to TTBR0 takes effect, hence flush afterwards.
 	auto ttbr0 = (uint64_t(_asid) << 48) | _boundSpace->rootTable();
-	asm volatile ("msr ttbr0_el1, %0; isb; dsb sy; isb" :: "r" (ttbr0) : "memory");
+	asm volatile ("dsb st; msr ttbr0_el1, %0; isb" :: "r" (ttbr0) : "memory");
+	invalidateAsid(_asid);
 
 	_primaryStamp = context->_nextStamp++;
 	context->_primaryBinding = this;
@@ -249,8 +317,7 @@ void PageBinding::shootdown() {
 
 				if(current->_initiatorCpu != getCpuData()) {
 					// Perform the actual shootdown.
-					for(size_t pg = 0; pg < current->size; pg += kPageSize)
-						invalidatePage(_asid, reinterpret_cast<void *>(current->address + pg));
+					invalidateRange(_asid, current->address, current->size);
 
 					// Signal completion of the shootdown.
 					if(current->_bindingsToShoot.fetch_sub(1, std::memory_order_acq_rel) == 1) {
@@ -320,8 +387,7 @@ void GlobalPageBinding::shootdown() {
 
 				if(current->_initiatorCpu != getCpuData()) {
 					// Perform the actual shootdown.
-					for(size_t pg = 0; pg < current->size; pg += kPageSize)
-						invalidatePage(reinterpret_cast<void *>(current->address + pg));
+					invalidateKernelRange(current->address, current->size);
 
 					// Signal completion of the shootdown.
 					if(current->_bindingsToShoot.fetch_sub(1, std::memory_order_acq_rel) == 1) {
@@ -411,9 +477,7 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 				continue;
 			assert(unshot_bindings);
 
-			for(size_t pg = 0; pg < node->size; pg += kPageSize)
-				invalidatePage(bindings[i].getAsid(),
-						reinterpret_cast<void *>(node->address + pg));
+			invalidateRange(bindings[i].getAsid(), node->address, node->size);
 			unshot_bindings--;
 		}
 
@@ -436,6 +500,11 @@ void KernelPageSpace::initialize() {
 	PhysicalAddr ttbr1_ptr;
 	asm volatile ("mrs %0, ttbr1_el1" : "=r" (ttbr1_ptr));
 
+	// ID_AA64ISAR0_EL1.TLB is 0b0010 if range (and outer shareable) TLBIs are available.
+	uint64_t isar0;
+	asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+	haveTlbiRange = ((isar0 >> 56) & 0xF) == 2;
+
 	kernelSpaceSingleton.initialize(ttbr1_ptr);
 }
 
@@ -458,8 +527,7 @@ bool KernelPageSpace::submitShootdown(ShootNode *node) {
 
 		// Perform synchronous shootdown.
 		assert(unshotBindings);
-		for(size_t pg = 0; pg < node->size; pg += kPageSize)
-			invalidatePage(reinterpret_cast<void *>(node->address + pg));
+		invalidateKernelRange(node->address, node->size);
 		unshotBindings--;
 
 		if(!unshotBindings)
@@ -475,25 +543,6 @@ bool KernelPageSpace::submitShootdown(ShootNode *node) {
 	return false;
 }
 
-static inline constexpr uint64_t kPageValid = 1;
-static inline constexpr uint64_t kPageTable = (1 << 1);
-static inline constexpr uint64_t kPageL3Page = (1 << 1);
-static inline constexpr uint64_t kPageXN = (uint64_t(1) << 54);
-static inline constexpr uint64_t kPagePXN = (uint64_t(1) << 53);
-static inline constexpr uint64_t kPageShouldBeWritable = (uint64_t(1) << 55);
-static inline constexpr uint64_t kPageNotGlobal = (1 << 11);
-static inline constexpr uint64_t kPageAccess = (1 << 10);
-static inline constexpr uint64_t kPageRO = (1 << 7);
-static inline constexpr uint64_t kPageUser = (1 << 6);
-static inline constexpr uint64_t kPageInnerSh = (3 << 8);
-static inline constexpr uint64_t kPageOuterSh = (2 << 8);
-static inline constexpr uint64_t kPageWb = (0 << 2);
-static inline constexpr uint64_t kPageGRE = (1 << 2);
-static inline constexpr uint64_t kPagenGnRnE = (2 << 2);
-static inline constexpr uint64_t kPagenGnRE = (3 << 2);
-static inline constexpr uint64_t kPageUc = (4 << 2);
-static inline constexpr uint64_t kPageAddress = 0xFFFFFFFFF000;
-
 void KernelPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 		uint32_t flags, CachingMode caching_mode) {
 	assert((pointer % 0x1000) == 0);
@@ -654,7 +703,8 @@ ClientPageSpace::~ClientPageSpace() {
 		PageAccessor accessor{ps};
 		auto tbl = reinterpret_cast<uint64_t *>(accessor.get());
 		for(int i = 0; i < 512; i++) {
-			if(tbl[i] & kPageValid)
+			// Blocks are owned by their memory objects, not by the page space.
+			if((tbl[i] & kPageValid) && (tbl[i] & kPageTable))
 				physicalAllocator->free(tbl[i] & kPageAddress, kPageSize);
 		}
 	};
@@ -735,6 +785,7 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical, bo
 	tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
 
 	if (tbl2[index2].load() & kPageValid) {
+		assert(tbl2[index2].load() & kPageTable);
 		accessor3 = PageAccessor{tbl2[index2].load() & kPageAddress};
 	} else {
 		auto tbl_address = physicalAllocator->allocate(kPageSize);
@@ -926,6 +977,8 @@ bool ClientPageSpace::isMapped(VirtualAddr pointer) {
 	}
 
 	if (tbl2[index2].load() & kPageValid) {
+		if (!(tbl2[index2].load() & kPageTable))
+			return true;
 		accessor3 = PageAccessor{tbl2[index2].load() & kPageAddress};
 		tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
 	} else {
@@ -973,14 +1026,19 @@ bool ClientPageSpace::updatePageAccess(VirtualAddr pointer) {
 		return false;
 	}
 
+	// For blocks, the whole block becomes writable (and dirty).
+	auto entry = &tbl2[index2];
 	if (tbl2[index2].load() & kPageValid) {
-		accessor3 = PageAccessor{tbl2[index2].load() & kPageAddress};
-		tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+		if (tbl2[index2].load() & kPageTable) {
+			accessor3 = PageAccessor{tbl2[index2].load() & kPageAddress};
+			tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+			entry = &tbl3[index3];
+		}
 	} else {
 		return false;
 	}
 
-	auto bits = tbl3[index3].load();
+	auto bits = entry->load();
 	if (!(bits & kPageValid))
 		return false;
 
@@ -988,7 +1046,7 @@ bool ClientPageSpace::updatePageAccess(VirtualAddr pointer) {
 		return false;
 
 	bits &= ~kPageRO;
-	tbl3[index3].store(bits);
+	entry->store(bits);
 
 	// TODO: perform proper shootdown to update mapping
 	invalidatePage(reinterpret_cast<void *>(pointer));
@@ -996,4 +1054,73 @@ bool ClientPageSpace::updatePageAccess(VirtualAddr pointer) {
 	return true;
 }
 
+namespace {
+	// Makes sure that the table at level S below the given entry exists and returns an accessor to it.
+	// Blocks that are found at level 2 are split into equivalent level 3 tables.
+	template<int S>
+	void realizeSubPt(uintptr_t va, PageAccessor &subPt, PageAccessor &pt) {
+		auto ptPtr = reinterpret_cast<uint64_t *>(pt.get())
+				+ ((va >> S) & 0x1FF);
+		auto ptEnt = __atomic_load_n(ptPtr, __ATOMIC_RELAXED);
+		if((ptEnt & kPageValid) && (ptEnt & kPageTable)) {
+			subPt = PageAccessor{ptEnt & kPageAddress};
+			return;
+		}
+		assert(!(ptEnt & kPageValid) || S == 21);
+
+		PhysicalAddr subPtPage = physicalAllocator->allocate(kPageSize);
+		assert(subPtPage != static_cast<PhysicalAddr>(-1) && "OOM");
+
+		subPt = PageAccessor{subPtPage};
+		if(ptEnt & kPageValid) {
+			// Replicate the block: the attributes of level 3 pages are at the same positions.
+			auto flags = ptEnt & ~kPageBlockAddress;
+			for(int i = 0; i < 512; i++) {
+				auto subPtPtr = reinterpret_cast<uint64_t *>(subPt.get()) + i;
+				*subPtPtr = ((ptEnt & kPageBlockAddress) + i * kPageSize) | flags | kPageL3Page;
+			}
+
+			// Replacing a block by a table requires break-before-make: remove the block
+			// and invalidate it on all CPUs (for all ASIDs) before installing the table.
+			__atomic_store_n(ptPtr, 0, __ATOMIC_RELAXED);
+			asm volatile ("dsb ishst; tlbi vaae1is, %0; dsb ish; isb"
+					:: "r"((va & ~(kHugePageSize - 1)) >> 12) : "memory");
+		}else{
+			for(int i = 0; i < 512; i++) {
+				auto subPtPtr = reinterpret_cast<uint64_t *>(subPt.get()) + i;
+				*subPtPtr = 0;
+			}
+		}
+
+		ptEnt = subPtPage | kPageValid | kPageTable;
+		__atomic_store_n(ptPtr, ptEnt, __ATOMIC_RELEASE);
+	}
+} // anonymous namespace
+
+void ClientPageSpace::Cursor::realizePts() {
+	assert(!_accessor1);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&space_->_mutex);
+	{
+		if(!_accessor3)
+			realizeSubPt<39>(va_, _accessor3, _accessor4);
+		if(!_accessor2)
+			realizeSubPt<30>(va_, _accessor2, _accessor3);
+		realizeSubPt<21>(va_, _accessor1, _accessor2);
+	}
+}
+
+void ClientPageSpace::Cursor::realizePds() {
+	assert(!_accessor2);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&space_->_mutex);
+	{
+		if(!_accessor3)
+			realizeSubPt<39>(va_, _accessor3, _accessor4);
+		realizeSubPt<30>(va_, _accessor2, _accessor3);
+	}
+}
+
 }
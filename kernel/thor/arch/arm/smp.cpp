@@ -223,20 +223,15 @@ bool bootSecondary(DeviceTreeNode *node) {
 static initgraph::Task initAPs{&globalInitEngine, "arm.init-aps",
 	initgraph::Requires{getDeviceTreeParsedStage(), getTaskingAvailableStage()},
 	[] {
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			if (node->isCompatible<2>({"arm,psci", "arm,psci-1.0"})) {
-				psci_.initialize(node);
-				return true;
-			}
-
-			return false;
+		forEachCompatibleDeviceTreeNode<2>({"arm,psci", "arm,psci-1.0"},
+				[&](DeviceTreeNode *node) -> bool {
+			psci_.initialize(node);
+			return true;
 		});
 
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			if (node->isCompatible<4>({"arm,cortex-a72", "arm,cortex-a53", "arm,arm-v8", "arm,armv8"})) {
-				bootSecondary(node);
-			}
-
+		forEachCompatibleDeviceTreeNode<4>({"arm,cortex-a72", "arm,cortex-a53", "arm,arm-v8", "arm,armv8"},
+				[&](DeviceTreeNode *node) -> bool {
+			bootSecondary(node);
 			return false;
 		});
 	}
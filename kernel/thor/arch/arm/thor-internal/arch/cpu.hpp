@@ -2,6 +2,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <utility>
 
 #include <frg/tuple.hpp>
@@ -365,8 +366,6 @@ void doRunOnStack(void (*function) (void *, void *), void *sp, void *argument);
 
 void initializeThisProcessor();
 
-void bootSecondary(unsigned int apic_id);
-
 extern "C" void saveFpSimdRegisters(FpRegisters *frame);
 
 template<typename F>
@@ -388,6 +387,14 @@ void armPreemption(uint64_t nanos);
 void disarmPreemption();
 uint64_t getRawTimestampCounter();
 
+inline void zeroPage(void *page) {
+	memset(page, 0, kPageSize);
+}
+
+inline void copyPage(void *dest, const void *src) {
+	memcpy(dest, src, kPageSize);
+}
+
 void setupBootCpuContext();
 
 void setupCpuContext(AssemblyCpuData *context);
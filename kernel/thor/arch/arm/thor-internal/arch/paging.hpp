@@ -16,6 +16,9 @@ enum {
 	kPageShift = 12
 };
 
+// Size of the block mappings at level 2.
+constexpr size_t kHugePageSize = 0x200000;
+
 constexpr Word kPfAccess = 1;
 constexpr Word kPfWrite = 2;
 constexpr Word kPfUser = 4;
@@ -34,6 +37,9 @@ inline PhysicalAddr reverseDirectPhysical(void *pointer) {
 void invalidatePage(const void *address);
 void invalidateAsid(int asid);
 void invalidatePage(int pcid, const void *address);
+// Invalidate [address, address + size) on the current CPU, using range TLBIs if available.
+void invalidateRange(int asid, VirtualAddr address, size_t size);
+void invalidateKernelRange(VirtualAddr address, size_t size);
 
 struct PageAccessor {
 	friend void swap(PageAccessor &a, PageAccessor &b) {
@@ -258,6 +264,8 @@ namespace page_access {
 	static constexpr uint32_t write = 1;
 	static constexpr uint32_t execute = 2;
 	static constexpr uint32_t read = 4;
+	// Hint: map physically contiguous ranges using large pages.
+	static constexpr uint32_t preferHuge = 8;
 }
 
 using PageStatus = uint32_t;
@@ -265,6 +273,8 @@ using PageStatus = uint32_t;
 namespace page_status {
 	static constexpr PageStatus present = 1;
 	static constexpr PageStatus dirty = 2;
+	// Not reported on ARM since we always set the AF bit.
+	static constexpr PageStatus accessed = 4;
 };
 
 enum class CachingMode {
@@ -379,6 +389,27 @@ private:
 	> _shootQueue;
 };
 
+static inline constexpr uint64_t kPageValid = 1;
+static inline constexpr uint64_t kPageTable = (1 << 1);
+static inline constexpr uint64_t kPageL3Page = (1 << 1);
+static inline constexpr uint64_t kPageXN = (uint64_t(1) << 54);
+static inline constexpr uint64_t kPagePXN = (uint64_t(1) << 53);
+static inline constexpr uint64_t kPageShouldBeWritable = (uint64_t(1) << 55);
+static inline constexpr uint64_t kPageNotGlobal = (1 << 11);
+static inline constexpr uint64_t kPageAccess = (1 << 10);
+static inline constexpr uint64_t kPageRO = (1 << 7);
+static inline constexpr uint64_t kPageUser = (1 << 6);
+static inline constexpr uint64_t kPageInnerSh = (3 << 8);
+static inline constexpr uint64_t kPageOuterSh = (2 << 8);
+static inline constexpr uint64_t kPageWb = (0 << 2);
+static inline constexpr uint64_t kPageGRE = (1 << 2);
+static inline constexpr uint64_t kPagenGnRnE = (2 << 2);
+static inline constexpr uint64_t kPagenGnRE = (3 << 2);
+static inline constexpr uint64_t kPageUc = (4 << 2);
+static inline constexpr uint64_t kPageAddress = 0xFFFFFFFFF000;
+// Only valid in level 2 block descriptors.
+static inline constexpr uint64_t kPageBlockAddress = 0xFFFFFFE00000;
+
 struct ClientPageSpace : PageSpace {
 public:
 	struct Walk {
@@ -409,6 +440,277 @@ public:
 		PageAccessor _accessor1; // Finest level (page table).
 	};
 
+	// Write permissions are tracked in software: writable pages are mapped read-only
+	// (with kPageShouldBeWritable set) until they are written to, at which point
+	// updatePageAccess() clears kPageRO. Hence, clean pages are those with kPageRO set.
+	struct Cursor {
+		Cursor(ClientPageSpace *space, uintptr_t va)
+		: space_{space}, va_{0} {
+			_accessor4 = PageAccessor{space->rootTable()};
+			moveTo(va);
+		}
+
+		uintptr_t virtualAddress() {
+			return va_;
+		}
+
+		void moveTo(uintptr_t va) {
+			if((va_ ^ va) & (uintptr_t{0x1FF} << 39)) {
+				_accessor3 = {};
+				_accessor2 = {};
+				_accessor1 = {};
+			}else if((va_ ^ va) & (uintptr_t{0x1FF} << 30)) {
+				_accessor2 = {};
+				_accessor1 = {};
+			}else if((va_ ^ va) & (uintptr_t{0x1FF} << 21)) {
+				_accessor1 = {};
+			}
+			va_ = va;
+			accessPts();
+		}
+
+		void advance4k() {
+			moveTo(va_ + kPageSize);
+		}
+
+		void advance2m() {
+			moveTo((va_ & ~(kHugePageSize - 1)) + kHugePageSize);
+		}
+
+		// Whether the current address is covered by a block mapping.
+		bool isHuge2m() {
+			auto pdPtr = pdEntryPtr();
+			if(!pdPtr)
+				return false;
+			auto pdEnt = __atomic_load_n(pdPtr, __ATOMIC_RELAXED);
+			return (pdEnt & kPageValid) && !(pdEnt & kPageTable);
+		}
+
+		// Whether the 2 MiB range around the current address can be mapped by a block,
+		// i.e., whether no level 3 table is installed for this range.
+		bool canMap2m() {
+			auto pdPtr = pdEntryPtr();
+			if(!pdPtr)
+				return true;
+			auto pdEnt = __atomic_load_n(pdPtr, __ATOMIC_RELAXED);
+			return !(pdEnt & kPageValid) || !(pdEnt & kPageTable);
+		}
+
+		// Whether a page or a block is mapped at the current address.
+		bool isPresent() {
+			if(!_accessor1)
+				return isHuge2m();
+			auto ptPtr = reinterpret_cast<uint64_t *>(_accessor1.get())
+					+ ((va_ >> 12) & 0x1FF);
+			return __atomic_load_n(ptPtr, __ATOMIC_RELAXED) & kPageValid;
+		}
+
+		bool findPresent(uintptr_t limit) {
+			while(va_ < limit) {
+				if(!_accessor1) {
+					if(isHuge2m())
+						return true;
+					advance4k();
+					continue;
+				}
+				auto ptPtr = reinterpret_cast<uint64_t *>(_accessor1.get())
+						+ ((va_ >> 12) & 0x1FF);
+				auto ptEnt = __atomic_load_n(ptPtr, __ATOMIC_RELAXED);
+				if(ptEnt & kPageValid)
+					return true;
+				advance4k();
+			}
+			return false;
+		}
+
+		bool findDirty(uintptr_t limit) {
+			while(va_ < limit) {
+				if(!_accessor1) {
+					if(isHuge2m()) {
+						auto pdEnt = __atomic_load_n(pdEntryPtr(), __ATOMIC_RELAXED);
+						if(isDirty(pdEnt))
+							return true;
+						advance2m();
+						continue;
+					}
+					advance4k();
+					continue;
+				}
+				auto ptPtr = reinterpret_cast<uint64_t *>(_accessor1.get())
+						+ ((va_ >> 12) & 0x1FF);
+				auto ptEnt = __atomic_load_n(ptPtr, __ATOMIC_RELAXED);
+				if((ptEnt & kPageValid) && isDirty(ptEnt))
+					return true;
+				advance4k();
+			}
+			return false;
+		}
+
+		void map4k(PhysicalAddr pa, PageFlags flags, CachingMode cachingMode) {
+			if(!_accessor1)
+				realizePts();
+
+			auto ptPtr = reinterpret_cast<uint64_t *>(_accessor1.get())
+					+ ((va_ >> 12) & 0x1FF);
+			auto ptEnt = __atomic_load_n(ptPtr, __ATOMIC_RELAXED);
+			assert(!(ptEnt & kPageValid));
+
+			ptEnt = pa | kPageValid | kPageL3Page | leafAttributes(flags, cachingMode);
+			__atomic_store_n(ptPtr, ptEnt, __ATOMIC_RELAXED);
+		}
+
+		PageStatus remap4k(PhysicalAddr pa, PageFlags flags, CachingMode cachingMode) {
+			if(!_accessor1)
+				realizePts();
+
+			auto ptPtr = reinterpret_cast<uint64_t *>(_accessor1.get())
+					+ ((va_ >> 12) & 0x1FF);
+			auto ptEnt = pa | kPageValid | kPageL3Page | leafAttributes(flags, cachingMode);
+			ptEnt = __atomic_exchange_n(ptPtr, ptEnt, __ATOMIC_RELAXED);
+			return statusOf(ptEnt);
+		}
+
+		PageStatus clean4k() {
+			// realizePts() splits blocks.
+			if(!_accessor1 && isHuge2m())
+				realizePts();
+			if(!_accessor1)
+				return 0;
+
+			auto ptPtr = reinterpret_cast<uint64_t *>(_accessor1.get())
+					+ ((va_ >> 12) & 0x1FF);
+			auto ptEnt = __atomic_fetch_or(ptPtr, kPageRO, __ATOMIC_RELAXED);
+			return statusOf(ptEnt);
+		}
+
+		PageStatus unmap4k() {
+			if(!_accessor1 && isHuge2m())
+				realizePts();
+			if(!_accessor1)
+				return 0;
+
+			auto ptPtr = reinterpret_cast<uint64_t *>(_accessor1.get())
+					+ ((va_ >> 12) & 0x1FF);
+			auto ptEnt = __atomic_exchange_n(ptPtr, 0, __ATOMIC_RELAXED);
+			return statusOf(ptEnt);
+		}
+
+		// Maps a block at the current (2 MiB aligned) address.
+		// The caller must ensure that canMap2m() returns true.
+		PageStatus remap2m(PhysicalAddr pa, PageFlags flags, CachingMode cachingMode) {
+			assert(!(va_ & (kHugePageSize - 1)));
+			assert(!(pa & (kHugePageSize - 1)));
+			if(!_accessor2)
+				realizePds();
+
+			auto pdPtr = pdEntryPtr();
+			auto pdEnt = pa | kPageValid | leafAttributes(flags, cachingMode);
+			pdEnt = __atomic_exchange_n(pdPtr, pdEnt, __ATOMIC_RELAXED);
+			assert(!(pdEnt & kPageValid) || !(pdEnt & kPageTable));
+			return statusOf(pdEnt);
+		}
+
+		PageStatus unmap2m() {
+			assert(!(va_ & (kHugePageSize - 1)));
+			assert(isHuge2m());
+
+			auto pdEnt = __atomic_exchange_n(pdEntryPtr(), 0, __ATOMIC_RELAXED);
+			return statusOf(pdEnt);
+		}
+
+	private:
+		static bool isDirty(uint64_t ent) {
+			return (ent & kPageShouldBeWritable) && !(ent & kPageRO);
+		}
+
+		// The AF is always set, hence page_status::accessed is never reported.
+		static PageStatus statusOf(uint64_t ent) {
+			if(!(ent & kPageValid))
+				return 0;
+			PageStatus status = page_status::present;
+			if(isDirty(ent))
+				status |= page_status::dirty;
+			return status;
+		}
+
+		// Attributes that are shared by level 3 page and level 2 block descriptors.
+		static uint64_t leafAttributes(PageFlags flags, CachingMode cachingMode) {
+			uint64_t attributes = kPageAccess | kPageRO | kPageNotGlobal | kPageUser;
+			if(flags & page_access::write)
+				attributes |= kPageShouldBeWritable;
+			if(!(flags & page_access::execute))
+				attributes |= kPageXN | kPagePXN;
+			if(cachingMode == CachingMode::writeCombine) {
+				attributes |= kPageUc | kPageOuterSh;
+			}else if(cachingMode == CachingMode::uncached) {
+				attributes |= kPagenGnRnE | kPageOuterSh;
+			}else if(cachingMode == CachingMode::mmio) {
+				attributes |= kPagenGnRE | kPageOuterSh;
+			}else if(cachingMode == CachingMode::mmioNonPosted) {
+				attributes |= kPagenGnRnE | kPageOuterSh;
+			}else{
+				assert(cachingMode == CachingMode::null || cachingMode == CachingMode::writeBack);
+				attributes |= kPageWb | kPageInnerSh;
+			}
+			return attributes;
+		}
+
+		uint64_t *pdEntryPtr() {
+			if(!_accessor2)
+				return nullptr;
+			return reinterpret_cast<uint64_t *>(_accessor2.get())
+					+ ((va_ >> 21) & 0x1FF);
+		}
+
+		void accessPts() {
+			auto doReload = [&] <int S> (PageAccessor &subPt, PageAccessor &pt,
+					std::integral_constant<int, S>) -> bool {
+				auto ptPtr = reinterpret_cast<uint64_t *>(pt.get())
+						+ ((va_ >> S) & 0x1FF);
+				auto ptEnt = __atomic_load_n(ptPtr, __ATOMIC_ACQUIRE);
+				if(!(ptEnt & kPageValid))
+					return false;
+				// Blocks do not reference a lower level table.
+				if(S == 21 && !(ptEnt & kPageTable))
+					return false;
+				subPt = PageAccessor{ptEnt & kPageAddress};
+				return true;
+			};
+
+			auto reload3 = [&] {
+				if(_accessor3) /*[[likely]]*/
+					return true;
+				return doReload(_accessor3, _accessor4, std::integral_constant<int, 39>{});
+			};
+			auto reload2 = [&] {
+				if(_accessor2) /*[[likely]]*/
+					return true;
+				if(!reload3())
+					return false;
+				return doReload(_accessor2, _accessor3, std::integral_constant<int, 30>{});
+			};
+
+			if(_accessor1) /*[[likely]]*/
+				return;
+			if(!reload2())
+				return;
+			doReload(_accessor1, _accessor2, std::integral_constant<int, 21>{});
+		}
+
+		void realizePts();
+		void realizePds();
+
+		ClientPageSpace *space_;
+
+		uintptr_t va_ = 0;
+
+		// Accessors for all levels of PTs.
+		PageAccessor _accessor4; // Coarsest level (level 0).
+		PageAccessor _accessor3;
+		PageAccessor _accessor2;
+		PageAccessor _accessor1; // Finest level (level 3).
+	};
+
 	ClientPageSpace();
 
 	ClientPageSpace(const ClientPageSpace &) = delete;
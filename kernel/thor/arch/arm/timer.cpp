@@ -126,13 +126,9 @@ static initgraph::Task initTimerIrq{&globalInitEngine, "arm.init-timer-irq",
 		globalTimerEngine = frg::construct<PrecisionTimerEngine>(*kernelAlloc,
 			globalClockSource, globalVGTInstance.get());
 
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			if (node->isCompatible<1>({"arm,armv8-timer"})) {
-				timerNode = node;
-				return true;
-			}
-
-			return false;
+		forEachCompatibleDeviceTreeNode<1>({"arm,armv8-timer"}, [&](DeviceTreeNode *node) -> bool {
+			timerNode = node;
+			return true;
 		});
 
 		assert(timerNode && "Failed to find timer");
@@ -1,3 +1,4 @@
+#include <eir/interface.hpp>
 #include <thor-internal/arch/hpet.hpp>
 #include <thor-internal/arch/vmx.hpp>
 #include <thor-internal/arch/svm.hpp>
@@ -6,6 +7,7 @@
 #include <thor-internal/kasan.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/physical.hpp>
+#include <thor-internal/profile.hpp>
 
 namespace thor {
 
@@ -47,6 +49,8 @@ static constexpr uint16_t fcwInitializer =
 
 static constexpr uint32_t mxcsrInitializer = 0b1111110000000;
 
+constinit std::atomic<uint64_t> nextSimdId{1};
+
 
 size_t Executor::determineSimdSize() {
 	assert(cpuFeaturesKnown);
@@ -84,6 +88,7 @@ Executor::Executor(UserContext *context, AbiParameters abi) {
 
 	_tss = &context->tss;
 	_syscallStack = context->kernelStack.basePtr();
+	_simdId = nextSimdId.fetch_add(1, std::memory_order_relaxed);
 }
 
 Executor::Executor(FiberContext *context, AbiParameters abi)
@@ -104,12 +109,85 @@ Executor::Executor(FiberContext *context, AbiParameters abi)
 	general()->rdi = abi.argument;
 	general()->cs = kSelSystemFiberCode;
 	general()->ss = kSelExecutorKernelData;
+	_kernelOnly = true;
 }
 
 Executor::~Executor() {
 	kernelAlloc->free(_pointer);
 }
 
+void Executor::_saveSimd() {
+	if(_kernelOnly)
+		return;
+
+	// XSAVEOPT skips components that are in their initial configuration or
+	// that were not modified since the last XRSTOR from the same area.
+	if(getGlobalCpuFeatures()->haveXsaveopt) {
+		common::x86::xsaveopt((uint8_t*)_fxState(), ~0);
+	}else if(getGlobalCpuFeatures()->haveXsave) {
+		common::x86::xsave((uint8_t*)_fxState(), ~0);
+	}else{
+		asm volatile ("fxsaveq %0" : : "m" (*_fxState()));
+	}
+}
+
+void Executor::_restoreSimd() {
+	if(_kernelOnly)
+		return;
+
+	// Since the kernel itself does not use the SIMD registers, they still contain
+	// our state if we were the last executor to load them on this CPU (e.g., when
+	// returning to the same thread after running kernel fibers).
+	auto cpuData = getPlatformCpuData();
+	if(_simdCpu == cpuData && cpuData->simdOwner == _simdId)
+		return;
+
+	if(getGlobalCpuFeatures()->haveXsave){
+		common::x86::xrstor((uint8_t*)_fxState(), ~0);
+	}else{
+		asm volatile ("fxrstorq %0" : : "m" (*_fxState()));
+	}
+	_simdCpu = cpuData;
+	cpuData->simdOwner = _simdId;
+}
+
+void Executor::_expandSimd() {
+	if(!getGlobalCpuFeatures()->haveXsaveopt)
+		return;
+
+	auto area = reinterpret_cast<uint8_t *>(_fxState());
+	uint64_t xstateBv;
+	memcpy(&xstateBv, area + sizeof(FxState), sizeof(uint64_t));
+
+	auto missing = getGlobalCpuFeatures()->xsaveMask & ~xstateBv;
+	if(!missing)
+		return;
+
+	if(missing & 1) {
+		// Initial configuration as set by FNINIT; MXCSR is always saved.
+		auto fx = _fxState();
+		fx->fcw = 0x37F;
+		fx->fsw = 0;
+		fx->ftw = 0;
+		fx->fop = 0;
+		fx->fpuIp = 0;
+		fx->fpuDp = 0;
+		for(int i = 0; i < 8; ++i)
+			memset(area + 32 + 16 * i, 0, 10);
+	}
+	if(missing & 2)
+		memset(_fxState()->xmm0, 0, 16 * 16);
+	for(int i = 2; i < 64; ++i) {
+		if(!(missing & (uint64_t(1) << i)))
+			continue;
+		auto leaf = common::x86::cpuid(0xD, i);
+		memset(area + leaf[1], 0, leaf[0]);
+	}
+
+	xstateBv |= missing;
+	memcpy(area + sizeof(FxState), &xstateBv, sizeof(uint64_t));
+}
+
 void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
 	executor->general()->rax = accessor._frame()->rax;
 	executor->general()->rbx = accessor._frame()->rbx;
@@ -136,11 +214,7 @@ void saveExecutor(Executor *executor, FaultImageAccessor accessor) {
 	executor->general()->clientFs = common::x86::rdmsr(common::x86::kMsrIndexFsBase);
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	} else {
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	executor->_saveSimd();
 }
 
 void saveExecutor(Executor *executor, IrqImageAccessor accessor) {
@@ -169,12 +243,7 @@ void saveExecutor(Executor *executor, IrqImageAccessor accessor) {
 	executor->general()->clientFs = common::x86::rdmsr(common::x86::kMsrIndexFsBase);
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
-
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	}else{
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	executor->_saveSimd();
 }
 
 void saveExecutor(Executor *executor, SyscallImageAccessor accessor) {
@@ -203,11 +272,7 @@ void saveExecutor(Executor *executor, SyscallImageAccessor accessor) {
 	executor->general()->clientFs = common::x86::rdmsr(common::x86::kMsrIndexFsBase);
 	executor->general()->clientGs = common::x86::rdmsr(common::x86::kMsrIndexKernelGsBase);
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	}else{
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	executor->_saveSimd();
 }
 
 void switchExecutor(smarter::borrowed_ptr<Thread> thread) {
@@ -255,11 +320,7 @@ extern "C" [[ noreturn ]] void _restoreExecutorRegisters(void *pointer);
 	common::x86::wrmsr(common::x86::kMsrIndexFsBase, executor->general()->clientFs);
 	common::x86::wrmsr(common::x86::kMsrIndexKernelGsBase, executor->general()->clientGs);
 
-	if(getGlobalCpuFeatures()->haveXsave){
-		common::x86::xrstor((uint8_t*)executor->_fxState(), ~0);
-	}else{
-		asm volatile ("fxrstorq %0" : : "m" (*executor->_fxState()));
-	}
+	executor->_restoreSimd();
 
 	uint16_t cs = executor->general()->cs;
 	assert(cs == kSelExecutorFaultCode || cs == kSelExecutorSyscallCode
@@ -393,6 +454,22 @@ bool handleUserAccessFault(uintptr_t address, bool write, FaultImageAccessor acc
 	return true;
 }
 
+void zeroPage(void *page) {
+	auto p = reinterpret_cast<uint64_t *>(page);
+	for(size_t i = 0; i < kPageSize / sizeof(uint64_t); i++)
+		asm volatile ("movnti %1, %0" : "=m"(p[i]) : "r"(uint64_t{0}));
+	// Non-temporal stores are weakly ordered.
+	asm volatile ("sfence" : : : "memory");
+}
+
+void copyPage(void *dest, const void *src) {
+	auto d = reinterpret_cast<uint64_t *>(dest);
+	auto s = reinterpret_cast<const uint64_t *>(src);
+	for(size_t i = 0; i < kPageSize / sizeof(uint64_t); i++)
+		asm volatile ("movnti %1, %0" : "=m"(d[i]) : "r"(s[i]));
+	asm volatile ("sfence" : : : "memory");
+}
+
 // --------------------------------------------------------
 // Namespace scope functions
 // --------------------------------------------------------
@@ -415,6 +492,11 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 
 			auto xsaveCpuid = common::x86::cpuid(0xD);
 			globalCpuFeatures.xsaveRegionSize = xsaveCpuid[2];
+
+			if(common::x86::cpuid(0xD, 1)[0] & 1) {
+				debugLogger() << "thor: CPUs support XSAVEOPT" << frg::endlog;
+				globalCpuFeatures.haveXsaveopt = true;
+			}
 		}else{
 			debugLogger() << "thor: CPUs do not support XSAVE!" << frg::endlog;
 		}
@@ -433,6 +515,20 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 			}else{
 				debugLogger() << "thor: CPUs do not support AVX-512!" << frg::endlog;
 			}
+
+			uint64_t xcr0 = 0;
+			xcr0 |= (uint64_t(1) << 0); // Enable saving of x87 feature set
+			xcr0 |= (uint64_t(1) << 1); // Enable saving of SSE feature set
+
+			if(globalCpuFeatures.haveAvx)
+				xcr0 |= (uint64_t(1) << 2); // Enable saving of AVX feature set and enable it
+
+			if(globalCpuFeatures.haveZmm) {
+				xcr0 |= (uint64_t(1) << 5); // Enable AVX-512
+				xcr0 |= (uint64_t(1) << 6); // Enable management of ZMM{0 -> 15}
+				xcr0 |= (uint64_t(1) << 7); // Enable management of ZMM{16 -> 31}
+			}
+			globalCpuFeatures.xsaveMask = xcr0;
 		}
 
 		if(common::x86::cpuid(0x80000007)[3] & (1 << 8)) {
@@ -452,6 +548,37 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 					<< frg::endlog;
 		}
 
+		if(common::x86::cpuid(0x80000001)[3] & (1 << 27)) {
+			debugLogger() << "thor: CPUs support rdtscp" << frg::endlog;
+			globalCpuFeatures.haveRdtscp = true;
+		}else{
+			debugLogger() << "thor: CPUs do not support rdtscp!" << frg::endlog;
+		}
+
+		auto extendedFeatures = common::x86::cpuid(0x07);
+		if(extendedFeatures[1] & (uint32_t(1) << 9)) {
+			debugLogger() << "thor: CPUs support enhanced rep movsb/stosb" << frg::endlog;
+			globalCpuFeatures.haveErms = true;
+			common::x86::haveErms = true;
+		}
+		if(extendedFeatures[3] & (uint32_t(1) << 4)) {
+			debugLogger() << "thor: CPUs support fast short rep movsb" << frg::endlog;
+			globalCpuFeatures.haveFsrm = true;
+			common::x86::haveFsrm = true;
+		}
+
+		auto mwaitLeaf = common::x86::cpuid(0x05);
+		if((common::x86::cpuid(0x01)[2] & (1 << 3))
+				&& (mwaitLeaf[2] & 1) && (mwaitLeaf[2] & 2)) {
+			debugLogger() << "thor: CPUs support MONITOR/MWAIT" << frg::endlog;
+			globalCpuFeatures.haveMwait = true;
+			globalCpuFeatures.mwaitSubstates = mwaitLeaf[3];
+		}
+		if(common::x86::cpuid(0x06)[0] & (1 << 2)) {
+			debugLogger() << "thor: CPUs support always running APIC timer" << frg::endlog;
+			globalCpuFeatures.haveArat = true;
+		}
+
 		auto intelPmLeaf = common::x86::cpuid(0xA)[0];
 		if(intelPmLeaf & 0xFF) {
 			debugLogger() << "thor: CPUs support Intel performance counters"
@@ -529,6 +656,7 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 
 namespace {
 	frg::manual_box<frg::vector<CpuData *, KernelAlloc>> allCpuContexts;
+	frg::ticket_spinlock allCpuContextsMutex;
 }
 
 CpuData *getCpuData(size_t k) {
@@ -590,12 +718,86 @@ static initgraph::Task initBootProcessorTask{&globalInitEngine, "x86.init-boot-p
 	}
 };
 
+namespace {
+	int ceilLog2(uint32_t n) {
+		int shift = 0;
+		while((uint32_t{1} << shift) < n)
+			shift++;
+		return shift;
+	}
+
+	// Determines the topology from the APIC ID of the current CPU.
+	// The SMT, core and package fields of the APIC ID are described by CPUID leaf 0xB;
+	// CPUs that share a cache differ only in the lower bits of their APIC IDs (leaf 4 on Intel,
+	// 0x8000'001D on AMD).
+	void detectTopology(CpuData *cpuData) {
+		auto vendor = common::x86::cpuid(0);
+		auto maxLeaf = vendor[0];
+		bool isAmd = vendor[1] == 0x6874'7541; // "Auth".
+
+		auto basicLeaf = common::x86::cpuid(1);
+		uint32_t apicId = basicLeaf[1] >> 24;
+		int smtShift = 0;
+		int packageShift = 0;
+		if(basicLeaf[3] & (1 << 28)) // HTT: more than one logical CPU per package.
+			packageShift = ceilLog2((basicLeaf[1] >> 16) & 0xFF);
+
+		if(maxLeaf >= 0xB && common::x86::cpuid(0xB, 0)[1]) {
+			apicId = common::x86::cpuid(0xB, 0)[3];
+			for(uint32_t subleaf = 0; subleaf < 8; subleaf++) {
+				auto topoLeaf = common::x86::cpuid(0xB, subleaf);
+				auto type = (topoLeaf[2] >> 8) & 0xFF;
+				if(!type)
+					break;
+				if(type == 1) // SMT level.
+					smtShift = topoLeaf[0] & 0x1F;
+				// The shift of the last level yields the package.
+				packageShift = topoLeaf[0] & 0x1F;
+			}
+		}
+
+		uint32_t cacheLeaf = 0;
+		if(isAmd && (common::x86::cpuid(0x8000'0001)[2] & (1 << 22))) { // TOPOEXT.
+			cacheLeaf = 0x8000'001D;
+		}else if(!isAmd && maxLeaf >= 4) {
+			cacheLeaf = 4;
+		}
+
+		// Without cache information, assume that the LLC is shared by the package.
+		int llcShift = packageShift;
+		if(cacheLeaf) {
+			uint32_t llcLevel = 0;
+			for(uint32_t subleaf = 0; subleaf < 16; subleaf++) {
+				auto cache = common::x86::cpuid(cacheLeaf, subleaf);
+				auto type = cache[0] & 0x1F;
+				if(!type)
+					break;
+				auto level = (cache[0] >> 5) & 7;
+				if(type == 2 || level < llcLevel) // Ignore instruction caches.
+					continue;
+				llcLevel = level;
+				llcShift = ceilLog2(((cache[0] >> 14) & 0xFFF) + 1);
+			}
+		}
+
+		cpuData->topology.package = apicId >> packageShift;
+		cpuData->topology.core = apicId >> smtShift;
+		cpuData->topology.llc = apicId >> llcShift;
+		debugLogger() << "thor: CPU #" << cpuData->cpuIndex << " is core " << cpuData->topology.core
+				<< " in package " << cpuData->topology.package
+				<< ", LLC " << cpuData->topology.llc << frg::endlog;
+	}
+}
+
 void initializeThisProcessor() {
 	auto cpuData = getCpuData();
 
-	// TODO: If we want to make bootSecondary() parallel, we have to lock here.
-	cpuData->cpuIndex = allCpuContexts->size();
-	allCpuContexts->push(cpuData);
+	// APs boot in parallel (see bootSecondaries()).
+	{
+		auto lock = frg::guard(&allCpuContextsMutex);
+		cpuData->cpuIndex = allCpuContexts->size();
+		allCpuContexts->push(cpuData);
+	}
 
 	// Allocate per-CPU areas.
 	cpuData->irqStack = UniqueKernelStack::make();
@@ -668,20 +870,7 @@ void initializeThisProcessor() {
 		cr4 |= uint32_t(1) << 18; // Enable XSAVE and x{get, set}bv
 		asm volatile ("mov %0, %%cr4" : : "r" (cr4));
 
-		uint64_t xcr0 = 0;
-		xcr0 |= (uint64_t(1) << 0); // Enable saving of x87 feature set
-		xcr0 |= (uint64_t(1) << 1); // Enable saving of SSE feature set
-
-		if(getGlobalCpuFeatures()->haveAvx)
-			xcr0 |= (uint64_t(1) << 2); // Enable saving of AVX feature set and enable it
-
-		if(getGlobalCpuFeatures()->haveZmm) {
-			xcr0 |= (uint64_t(1) << 5); // Enable AVX-512
-			xcr0 |= (uint64_t(1) << 6); // Enable management of ZMM{0 -> 15}
-			xcr0 |= (uint64_t(1) << 7); // Enable management of ZMM{16 -> 31}
-		}
-
-		common::x86::wrxcr(0, xcr0);
+		common::x86::wrxcr(0, getGlobalCpuFeatures()->xsaveMask);
 	}
 
 	// Enable the SMAP extension.
@@ -774,6 +963,8 @@ void initializeThisProcessor() {
 	cpuData->generalWorkQueue = cpuData->wqFiber->associatedWorkQueue()->selfPtr.lock();
 	assert(cpuData->generalWorkQueue);
 
+	detectTopology(cpuData);
+
 	initLocalApicPerCpu();
 }
 
@@ -781,27 +972,46 @@ void initializeThisProcessor() {
 extern "C" uint8_t _binary_kernel_thor_arch_x86_trampoline_bin_start[];
 extern "C" uint8_t _binary_kernel_thor_arch_x86_trampoline_bin_end[];
 
-struct StatusBlock {
-	StatusBlock *self; // Pointer to this struct in the higher half.
+// All APs run the same trampoline. Each AP locates its ApSlot by its initial APIC ID.
+// Keep this in sync with trampoline.S.
+struct ApSlot {
+	ApSlot *self; // Pointer to this struct in the higher half.
+	uintptr_t stack;
+	CpuData *cpuContext;
 	unsigned int targetStage;
+	unsigned int padding;
+};
+
+static_assert(sizeof(ApSlot) == 32, "Bad sizeof(ApSlot)");
+
+// Shared by all APs. Resides at the end of the trampoline page.
+struct StatusBlock {
 	unsigned int initiatorStage;
 	unsigned int pml4;
-	uintptr_t stack;
-	void (*main)(StatusBlock *);
-	CpuData *cpuContext;
+	void (*main)(ApSlot *);
 };
 
-static_assert(sizeof(StatusBlock) == 48, "Bad sizeof(StatusBlock)");
+static_assert(sizeof(StatusBlock) == 16, "Bad sizeof(StatusBlock)");
+
+// The slots occupy the pages after the trampoline page.
+// MADT local APIC entries have 8-bit APIC IDs.
+constexpr size_t numApSlots = 256;
+constexpr size_t apSlotPages = numApSlots * sizeof(ApSlot) / kPageSize;
+
+static_assert((1 + apSlotPages) * kPageSize <= eirSmpTrampolineSize,
+		"Trampoline and AP slots do not fit into the range reserved by eir");
 
-void secondaryMain(StatusBlock *statusBlock) {
-	auto cpuContext = statusBlock->cpuContext;
+void secondaryMain(ApSlot *slot) {
+	auto cpuContext = slot->cpuContext;
 
 	setupCpuContext(cpuContext);
 	initializeThisProcessor();
-	__atomic_store_n(&statusBlock->targetStage, 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&slot->targetStage, 2, __ATOMIC_RELEASE);
 
 	debugLogger() << "Hello world from CPU #" << getLocalApicId() << frg::endlog;
 
+	initializeProfileOnThisCpu();
+
 	Scheduler::resume(cpuContext->wqFiber);
 
 	auto scheduler = localScheduler();
@@ -810,77 +1020,89 @@ void secondaryMain(StatusBlock *statusBlock) {
 	scheduler->commitReschedule();
 }
 
-void bootSecondary(unsigned int apic_id) {
-	if(disableSmp)
+void bootSecondaries(frg::span<const unsigned int> apicIds) {
+	if(disableSmp || !apicIds.size())
 		return;
 
-	// TODO: Allocate a page in low physical memory instead of hard-coding it.
-	uintptr_t pma = 0x10000;
+	// eir keeps this range out of the physical allocator.
+	uintptr_t pma = eirSmpTrampolineBase;
 
 	// Copy the trampoline code into low physical memory.
 	auto image_size = (uintptr_t)_binary_kernel_thor_arch_x86_trampoline_bin_end
 			- (uintptr_t)_binary_kernel_thor_arch_x86_trampoline_bin_start;
-	assert(image_size <= kPageSize);
+	assert(image_size <= kPageSize - sizeof(StatusBlock));
 	PageAccessor accessor{pma};
 	memcpy(accessor.get(), _binary_kernel_thor_arch_x86_trampoline_bin_start, image_size);
 
-	// Allocate a stack for the initialization code.
-	constexpr size_t stack_size = 0x10000;
-	void *stack_ptr = kernelAlloc->allocate(stack_size);
-
-	auto context = frg::construct<CpuData>(*kernelAlloc);
-	context->localApicId = apic_id;
-
-	// Participate in global TLB invalidation *before* paging is used by the target CPU.
-	{
-		auto irqLock = frg::guard(&irqMutex());
-
-		context->globalBinding.bind();
-	}
+	// The physical window maps the slot pages contiguously after the trampoline page.
+	auto slots = reinterpret_cast<ApSlot *>(reinterpret_cast<char *>(accessor.get()) + kPageSize);
+	memset(slots, 0, apSlotPages * kPageSize);
 
-	// Setup a status block to communicate information to the AP.
+	// Setup a status block to communicate information to the APs.
 	auto statusBlock = reinterpret_cast<StatusBlock *>(reinterpret_cast<char *>(accessor.get())
 			+ (kPageSize - sizeof(StatusBlock)));
 	debugLogger() << "status block accessed via: " << statusBlock << frg::endlog;
 
-	statusBlock->self = statusBlock;
-	statusBlock->targetStage = 0;
 	statusBlock->initiatorStage = 0;
 	statusBlock->pml4 = KernelPageSpace::global().rootTable();
-	statusBlock->stack = (uintptr_t)stack_ptr + stack_size;
 	statusBlock->main = &secondaryMain;
-	statusBlock->cpuContext = context;
 
-	// Send the IPI sequence that starts up the AP.
+	for(auto apicId : apicIds) {
+		assert(apicId < numApSlots);
+		auto slot = &slots[apicId];
+
+		// Allocate a stack for the initialization code.
+		constexpr size_t stack_size = 0x10000;
+		void *stack_ptr = kernelAlloc->allocate(stack_size);
+
+		auto context = frg::construct<CpuData>(*kernelAlloc);
+		context->localApicId = apicId;
+
+		// Participate in global TLB invalidation *before* paging is used by the target CPU.
+		{
+			auto irqLock = frg::guard(&irqMutex());
+
+			context->globalBinding.bind();
+		}
+
+		slot->self = slot;
+		slot->stack = (uintptr_t)stack_ptr + stack_size;
+		slot->cpuContext = context;
+	}
+
+	// Send the IPI sequence that starts up the APs. All APs go through the sequence
+	// at the same time, hence the delays are only incurred once.
 	// On modern processors INIT lets the processor enter the wait-for-SIPI state.
 	// The BIOS is not involved in this process at all.
-	infoLogger() << "thor: Booting AP " << apic_id << "." << frg::endlog;
-	raiseInitAssertIpi(apic_id);
+	infoLogger() << "thor: Booting " << apicIds.size() << " APs." << frg::endlog;
+	for(auto apicId : apicIds)
+		raiseInitAssertIpi(apicId);
 	KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(10'000'000)); // Wait for 10ms.
 
 	// SIPI causes the processor to resume execution and resets CS:IP.
 	// Intel suggets to send two SIPIs (probably for redundancy reasons).
-	raiseStartupIpi(apic_id, pma);
+	for(auto apicId : apicIds)
+		raiseStartupIpi(apicId, pma);
 	KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(200'000)); // Wait for 200us.
-	raiseStartupIpi(apic_id, pma);
+	for(auto apicId : apicIds)
+		raiseStartupIpi(apicId, pma);
 	KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(200'000)); // Wait for 200us.
 
-	// Wait until the AP wakes up.
-	while(__atomic_load_n(&statusBlock->targetStage, __ATOMIC_ACQUIRE) < 1) {
-		pause();
-	}
-	debugLogger() << "thor: AP did wake up." << frg::endlog;
-
-	// We only let the AP proceed after all IPIs have been sent.
-	// This ensures that the AP does not execute boot code twice (e.g. in case
+	// We only let the APs proceed after all IPIs have been sent.
+	// This ensures that no AP executes boot code twice (e.g. in case
 	// it already wakes up after a single SIPI).
 	__atomic_store_n(&statusBlock->initiatorStage, 1, __ATOMIC_RELEASE);
 
-	// Wait until the AP exits the boot code.
-	while(__atomic_load_n(&statusBlock->targetStage, __ATOMIC_ACQUIRE) < 2) {
-		pause();
+	// Wait until all APs exit the boot code. The trampoline page and the stacks
+	// can only be reused afterwards.
+	for(auto apicId : apicIds) {
+		auto slot = &slots[apicId];
+		while(__atomic_load_n(&slot->targetStage, __ATOMIC_ACQUIRE) < 1)
+			pause();
+		while(__atomic_load_n(&slot->targetStage, __ATOMIC_ACQUIRE) < 2)
+			pause();
+		debugLogger() << "thor: AP " << apicId << " finished booting." << frg::endlog;
 	}
-	debugLogger() << "thor: AP finished booting." << frg::endlog;
 }
 
 Error getEntropyFromCpu(void *buffer, size_t size) {
@@ -4,192 +4,155 @@
 
 namespace thor::vmx {
 
-Error EptSpace::map(uint64_t guestAddress, uint64_t hostAddress, int flags) {
-	auto irq_lock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&_mutex);
-	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
-	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
-	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
-	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
+namespace {
 
-	PageAccessor spaceAccessor{spaceRoot};
-	auto pml4e = reinterpret_cast<size_t*>(spaceAccessor.get());
+constexpr uint64_t eptPresent = (1 << EPT_READ);
+constexpr uint64_t eptLarge = (1 << 7);
+constexpr uint64_t eptDirty = (1 << 9);
+constexpr uint64_t eptAddress = 0x000F'FFFF'FFFF'F000;
+constexpr uint64_t eptLargeAddress = 0x000F'FFFF'FFE0'0000;
 
-	size_t pageFlags = 0;
+// Permissions of intermediate entries are ANDed with the permissions of the leaf entries.
+// Hence, intermediate entries grant all permissions.
+constexpr uint64_t eptTableFlags = (1 << EPT_READ) | (1 << EPT_WRITE) | (1 << EPT_EXEC);
 
-	pageFlags |= (1 << EPT_READ);
-	if(flags & 1) {
+uint64_t eptLeafFlags(int flags) {
+	uint64_t pageFlags = (1 << EPT_READ) | (6 << EPT_MEMORY_TYPE) | (1 << EPT_IGNORE_PAT);
+	if(flags & page_access::write)
 		pageFlags |= (1 << EPT_WRITE);
-	}
-	if(flags & 2) {
+	if(flags & page_access::execute)
 		pageFlags |= (1 << EPT_EXEC);
-	}
+	return pageFlags;
+}
 
-	size_t* pdpte;
-	if(!(pml4e[pml4eIdx] & (1 << EPT_READ))) {
-		auto pdpte_ptr = physicalAllocator->allocate(kPageSize);
-		if(reinterpret_cast<PhysicalAddr>(pdpte_ptr) == static_cast<PhysicalAddr>(-1)) {
-			return Error::noMemory;
-		}
-		size_t entry = ((pdpte_ptr >> 12) << EPT_PHYSADDR) | pageFlags;
-		pml4e[pml4eIdx] = entry;
-		PageAccessor pdpteAccessor{pdpte_ptr};
-		memset(pdpteAccessor.get(), 0, kPageSize);
-		pdpte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	} else {
-		PageAccessor pdpteAccessor{(pml4e[pml4eIdx] >> EPT_PHYSADDR) << 12};
-		pdpte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
+// Returns the table that the entry points to. If allocate is true, missing tables are allocated.
+uint64_t *eptWalk(uint64_t *table, int idx, bool allocate) {
+	if(!(table[idx] & eptPresent)) {
+		if(!allocate)
+			return nullptr;
+		auto next = physicalAllocator->allocate(kPageSize);
+		if(next == static_cast<PhysicalAddr>(-1))
+			return nullptr;
+		PageAccessor nextAccessor{next};
+		memset(nextAccessor.get(), 0, kPageSize);
+		table[idx] = (next & eptAddress) | eptTableFlags;
+	}
+	assert(!(table[idx] & eptLarge));
+	PageAccessor accessor{table[idx] & eptAddress};
+	return reinterpret_cast<uint64_t *>(accessor.get());
+}
 
+} // anonymous namespace
 
-	size_t* pde;
-	if(!(pdpte[pdpteIdx] & (1 << EPT_READ))) {
-		auto pdpte_ptr = physicalAllocator->allocate(kPageSize);
-		if(reinterpret_cast<PhysicalAddr>(pdpte_ptr) == static_cast<PhysicalAddr>(-1)) {
-			return Error::noMemory;
-		}
-		size_t entry = ((pdpte_ptr >> 12) << EPT_PHYSADDR) | pageFlags;
-		pdpte[pdpteIdx] = entry;
-		PageAccessor pdpteAccessor{pdpte_ptr};
-		memset(pdpteAccessor.get(), 0, kPageSize);
-		pde = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	} else {
-		PageAccessor pdpteAccessor{(pdpte[pdpteIdx] >> EPT_PHYSADDR) << 12};
-		pde = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
+uint64_t *EptSpace::walkToPd(uint64_t guestAddress, bool allocate) {
+	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
+	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
 
+	PageAccessor spaceAccessor{spaceRoot};
+	auto pml4e = reinterpret_cast<uint64_t *>(spaceAccessor.get());
 
-	size_t* pte;
-	if(!(pde[pdeIdx] & (1 << EPT_READ))) {
-		auto pt_ptr = physicalAllocator->allocate(kPageSize);
-		if(reinterpret_cast<PhysicalAddr>(pt_ptr) == static_cast<PhysicalAddr>(-1)) {
-			return Error::noMemory;
-		}
-		size_t entry = ((pt_ptr >> 12) << EPT_PHYSADDR) | pageFlags;
-		pde[pdeIdx] = entry;
-		PageAccessor pdpteAccessor{pt_ptr};
-		memset(pdpteAccessor.get(), 0, kPageSize);
-		pte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	} else {
-		PageAccessor pdpteAccessor{(pde[pdeIdx] >> EPT_PHYSADDR) << 12};
-		pte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
+	auto pdpte = eptWalk(pml4e, pml4eIdx, allocate);
+	if(!pdpte)
+		return nullptr;
+	return eptWalk(pdpte, pdpteIdx, allocate);
+}
 
-	auto alloc = hostAddress >> 12;
-	size_t entry = (alloc << EPT_PHYSADDR) | pageFlags | (6 << EPT_MEMORY_TYPE) | (1 << EPT_IGNORE_PAT);
-	pte[pteIdx] = entry | flags;
+Error EptSpace::map(uint64_t guestAddress, uint64_t hostAddress, int flags) {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
+	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
+
+	auto pde = walkToPd(guestAddress, true);
+	if(!pde)
+		return Error::noMemory;
+	if(pde[pdeIdx] & eptLarge)
+		return Error::alreadyExists;
+	auto pte = eptWalk(pde, pdeIdx, true);
+	if(!pte)
+		return Error::noMemory;
 
+	pte[pteIdx] = (hostAddress & eptAddress) | eptLeafFlags(flags);
 	return Error::success;
 }
 
-bool EptSpace::isMapped(VirtualAddr guestAddress) {
-	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
-	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
+Error EptSpace::map2m(uint64_t guestAddress, uint64_t hostAddress, int flags) {
+	assert(!(guestAddress & (kHugePageSize - 1)));
+	assert(!(hostAddress & (kHugePageSize - 1)));
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
 	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
-	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
 
-	PageAccessor spaceAccessor{spaceRoot};
-	size_t* pml4e = reinterpret_cast<size_t*>(spaceAccessor.get());
+	auto pde = walkToPd(guestAddress, true);
+	if(!pde)
+		return Error::noMemory;
+	// Do not bother to merge existing page tables; the caller falls back to 4 KiB pages.
+	if(pde[pdeIdx] & eptPresent)
+		return Error::alreadyExists;
 
-	size_t* pdpte;
-	if(!(pml4e[pml4eIdx] & (1 << EPT_READ))) {
-		return false;
-	} else {
-		PageAccessor pdpteAccessor{(pml4e[pml4eIdx] >> EPT_PHYSADDR) << 12};
-		pdpte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
+	pde[pdeIdx] = (hostAddress & eptLargeAddress) | eptLeafFlags(flags) | eptLarge;
+	return Error::success;
+}
 
-	size_t* pde;
-	if(!(pdpte[pdpteIdx] & (1 << EPT_READ))) {
-		return false;
-	} else {
-		PageAccessor pdpteAccessor{(pdpte[pdpteIdx] >> EPT_PHYSADDR) << 12};
-		pde = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
+bool EptSpace::isMapped(VirtualAddr guestAddress) {
+	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
+	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
 
-	size_t* pte;
-	if(!(pde[pdeIdx] & (1 << EPT_READ))) {
+	auto pde = walkToPd(guestAddress, false);
+	if(!pde || !(pde[pdeIdx] & eptPresent))
 		return false;
-	} else {
-		PageAccessor pdpteAccessor{(pde[pdeIdx] >> EPT_PHYSADDR) << 12};
-		pte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
-
-	return ((pte[pteIdx] & EPT_READ));
+	if(pde[pdeIdx] & eptLarge)
+		return true;
+	auto pte = eptWalk(pde, pdeIdx, false);
+	return pte[pteIdx] & eptPresent;
 }
 
 uintptr_t EptSpace::translate(uintptr_t guestAddress) {
-	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
-	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
 	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
 	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
 	int offset = (size_t)guestAddress & (0x1000 - 1);
 
-	PageAccessor spaceAccessor{spaceRoot};
-	size_t* pml4e = reinterpret_cast<size_t*>(spaceAccessor.get());
-
-	size_t* pdpte;
-	if(!(pml4e[pml4eIdx] & (1 << EPT_READ))) {
-		return -1;
-	} else {
-		PageAccessor pdpteAccessor{(pml4e[pml4eIdx] >> EPT_PHYSADDR) << 12};
-		pdpte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
-
-	size_t* pde;
-	if(!(pdpte[pdpteIdx] & (1 << EPT_READ))) {
+	auto pde = walkToPd(guestAddress, false);
+	if(!pde || !(pde[pdeIdx] & eptPresent))
 		return -1;
-	} else {
-		PageAccessor pdpteAccessor{(pdpte[pdpteIdx] >> EPT_PHYSADDR) << 12};
-		pde = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
-
-	size_t* pte;
-	if(!(pde[pdeIdx] & (1 << EPT_READ))) {
+	if(pde[pdeIdx] & eptLarge)
+		return (pde[pdeIdx] & eptLargeAddress) + (guestAddress & (kHugePageSize - 1));
+	auto pte = eptWalk(pde, pdeIdx, false);
+	if(!(pte[pteIdx] & eptPresent))
 		return -1;
-	} else {
-		PageAccessor pdpteAccessor{(pde[pdeIdx] >> EPT_PHYSADDR) << 12};
-		pte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
-
-	return ((pte[pteIdx] >> EPT_PHYSADDR) << 12) + offset;
+	return (pte[pteIdx] & eptAddress) + offset;
 }
 
 PageStatus EptSpace::unmap(uint64_t guestAddress) {
-	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
-	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
 	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
 	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
 
-	PageAccessor spaceAccessor{spaceRoot};
-	size_t* pml4e = reinterpret_cast<size_t*>(spaceAccessor.get());
-
-	size_t* pdpte;
-	if(!(pml4e[pml4eIdx] & (1 << EPT_READ))) {
-		return 0;
-	} else {
-		PageAccessor pdpteAccessor{(pml4e[pml4eIdx] >> EPT_PHYSADDR) << 12};
-		pdpte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
-
-	size_t* pde;
-	if(!(pdpte[pdpteIdx] & (1 << EPT_READ))) {
+	auto pde = walkToPd(guestAddress, false);
+	if(!pde || !(pde[pdeIdx] & eptPresent))
 		return 0;
-	} else {
-		PageAccessor pdpteAccessor{(pdpte[pdpteIdx] >> EPT_PHYSADDR) << 12};
-		pde = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
 
-	size_t* pte;
-	if(!(pde[pdeIdx] & (1 << EPT_READ))) {
+	// Split large pages such that only a single 4 KiB page is unmapped.
+	if(pde[pdeIdx] & eptLarge) {
+		auto pt = physicalAllocator->allocate(kPageSize);
+		if(pt == static_cast<PhysicalAddr>(-1))
+			panicLogger() << "thor: Out of memory while splitting EPT large page" << frg::endlog;
+		PageAccessor ptAccessor{pt};
+		auto entries = reinterpret_cast<uint64_t *>(ptAccessor.get());
+		auto large = pde[pdeIdx];
+		for(int i = 0; i < 512; i++)
+			entries[i] = ((large & eptLargeAddress) + i * kPageSize)
+					| (large & ~(eptLargeAddress | eptLarge));
+		pde[pdeIdx] = (pt & eptAddress) | eptTableFlags;
+	}
+
+	auto pte = eptWalk(pde, pdeIdx, false);
+	if(!(pte[pteIdx] & eptPresent))
 		return 0;
-	} else {
-		PageAccessor pdpteAccessor{(pde[pdeIdx] >> EPT_PHYSADDR) << 12};
-		pte = reinterpret_cast<size_t*>(pdpteAccessor.get());
-	}
 
 	PageStatus status = page_status::present;
-	if(pte[pteIdx] & (1 << 9)) {
+	if(pte[pteIdx] & eptDirty) {
 		status |= page_status::dirty;
 	}
 	pte[pteIdx] = 0;
@@ -270,7 +233,8 @@ EptSpace::~EptSpace() {
 					PageAccessor pdeAccessor{(pdpte[j] >> EPT_PHYSADDR) << 12};
 					auto pde = reinterpret_cast<size_t*>(pdeAccessor.get());
 					for(int k = 0; k < 512; k++) {
-						if(pde[k] & (1 << EPT_READ)) {
+						// Large pages point to guest memory, not to page tables.
+						if((pde[k] & (1 << EPT_READ)) && !(pde[k] & eptLarge)) {
 							physicalAllocator->free((size_t)(pde[k] >> EPT_PHYSADDR) << 12, kPageSize);
 						}
 					}
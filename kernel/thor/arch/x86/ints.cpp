@@ -1,10 +1,13 @@
 
 #include <thor-internal/cpu-data.hpp>
+#include <thor-internal/fiber.hpp>
 #include <thor-internal/profile.hpp>
 #include <thor-internal/thread.hpp>
+#include <thor-internal/timer.hpp>
 #include <thor-internal/arch/cpu.hpp>
 #include <thor-internal/arch/pmc-amd.hpp>
 #include <thor-internal/arch/pmc-intel.hpp>
+#include <thor-internal/arch/stack.hpp>
 
 extern char stubsPtr[], stubsLimit[];
 
@@ -499,6 +502,55 @@ extern "C" void onPlatformWork() {
 	disableInts();
 }
 
+namespace {
+	// Finds the kernel stack of this CPU that contains sp.
+	// Returns nullptr if sp does not belong to any of the stacks that we know about.
+	UniqueKernelStack *findKernelStack(CpuData *cpuData, uintptr_t sp) {
+		auto contains = [&] (UniqueKernelStack &stack) {
+			return stack.basePtr() && sp >= stack.lowerBound() && sp < stack.upperBound();
+		};
+
+		if(contains(cpuData->irqStack))
+			return &cpuData->irqStack;
+		if(contains(cpuData->detachedStack))
+			return &cpuData->detachedStack;
+		if(contains(cpuData->idleStack))
+			return &cpuData->idleStack;
+		if(auto fiber = cpuData->activeFiber; fiber) {
+			if(contains(fiber->kernelStack()))
+				return &fiber->kernelStack();
+		}else if(auto thread = cpuData->activeExecutor.get(); thread) {
+			if(contains(thread->getContext().kernelStack))
+				return &thread->getContext().kernelStack;
+		}
+		return nullptr;
+	}
+
+	void sampleProfile(NmiImageAccessor image, CpuData *cpuData) {
+		uintptr_t record[maxProfileRecordWords];
+		size_t n = 1;
+		record[n++] = *image.ip();
+#ifdef THOR_HAS_FRAME_POINTERS
+		// We cannot take page faults in NMI context; hence, we only follow frame pointers
+		// that stay within the kernel stack that we interrupted.
+		// User stacks are not walked for the same reason.
+		if(!(*image.cs() & 3)) {
+			auto sp = *image.sp();
+			if(auto stack = findKernelStack(cpuData, sp); stack) {
+				walkStackWithin(*image.bp(), sp, stack->upperBound(), [&] (uintptr_t ip) {
+					if(n == maxProfileRecordWords)
+						return false;
+					record[n++] = ip;
+					return true;
+				});
+			}
+		}
+#endif
+		record[0] = n - 1;
+		cpuData->localProfileRing->enqueue(record, n * sizeof(uintptr_t));
+	}
+} // anonymous namespace
+
 extern "C" void onPlatformNmi(NmiImageAccessor image) {
 	// If we interrupted user space or a kernel stub, we might need to update GS.
 	auto gs = common::x86::rdmsr(common::x86::kMsrIndexGsBase);
@@ -510,13 +562,11 @@ extern "C" void onPlatformNmi(NmiImageAccessor image) {
 	bool explained = false;
 	auto pmcMechanism = cpuData->profileMechanism.load(std::memory_order_acquire);
 	if(pmcMechanism == ProfileMechanism::intelPmc && checkIntelPmcOverflow()) {
-		uintptr_t ip = *image.ip();
-		cpuData->localProfileRing->enqueue(&ip, sizeof(uintptr_t));
+		sampleProfile(image, cpuData);
 		setIntelPmc();
 		explained = true;
 	}else if(pmcMechanism == ProfileMechanism::amdPmc && checkAmdPmcOverflow()) {
-		uintptr_t ip = *image.ip();
-		cpuData->localProfileRing->enqueue(&ip, sizeof(uintptr_t));
+		sampleProfile(image, cpuData);
 		setAmdPmc();
 		explained = true;
 	}
@@ -541,9 +591,73 @@ extern "C" void onPlatformNmi(NmiImageAccessor image) {
 }
 
 extern "C" void enableIntsAndHaltForever();
+extern "C" [[noreturn]] void enterIdleContext(void (*function)());
+
+namespace {
+	// Expected idle durations (in ns) above which deeper C-states are requested.
+	constexpr uint64_t mwaitC2Threshold = 100'000;
+	constexpr uint64_t mwaitC3Threshold = 1'000'000;
+
+	// Returns the MWAIT hint for the deepest C-state that is worth entering.
+	uint32_t chooseMwaitHint() {
+		auto features = getGlobalCpuFeatures();
+		// Without ARAT, the local APIC timer may stop in C-states deeper than C1.
+		if(!features->haveArat)
+			return 0;
+
+		uint64_t expected = ~uint64_t{0};
+		if(auto deadline = LocalApicContext::nextDeadline(); deadline) {
+			auto now = systemClockSource()->currentNanos();
+			expected = (deadline > now) ? deadline - now : 0;
+		}
+
+		auto hintFor = [&] (int cstate) -> int {
+			// Nibble n of EDX is the number of sub-states of C<n>.
+			if(!((features->mwaitSubstates >> (cstate * 4)) & 0xF))
+				return -1;
+			return (cstate - 1) << 4;
+		};
+
+		if(expected >= mwaitC3Threshold)
+			if(auto hint = hintFor(3); hint >= 0)
+				return hint;
+		if(expected >= mwaitC2Threshold)
+			if(auto hint = hintFor(2); hint >= 0)
+				return hint;
+		return 0;
+	}
+
+	[[noreturn]] void mwaitIdleLoop() {
+		auto cpuData = getCpuData();
+		while(true) {
+			assert(!intsAreEnabled());
+
+			// Remote CPUs that observe idleMonitorWaiting do not send a ping IPI.
+			// Instead, their write to idleMonitor terminates MWAIT.
+			cpuData->idleMonitor.store(idleMonitorWaiting, std::memory_order_seq_cst);
+			asm volatile ("monitor" : : "a"(&cpuData->idleMonitor), "c"(0), "d"(0) : "memory");
+			if(cpuData->idleMonitor.load(std::memory_order_seq_cst) == idleMonitorWaiting) {
+				// ECX bit 0: interrupts are break events even if they are masked.
+				asm volatile ("mwait" : : "a"(chooseMwaitHint()), "c"(1) : "memory");
+			}
+			cpuData->idleMonitor.store(idleMonitorRunning, std::memory_order_seq_cst);
+
+			// Handle the interrupts that terminated MWAIT (if any).
+			// Since idleMonitor is already reset, they may reschedule.
+			asm volatile ("sti\n\tnop\n\tcli" : : : "memory");
+
+			localScheduler()->update();
+			if(localScheduler()->maybeReschedule())
+				localScheduler()->commitReschedule();
+			localScheduler()->renewSchedule();
+		}
+	}
+}
 
 void suspendSelf() {
 	assert(!intsAreEnabled());
+	if(getGlobalCpuFeatures()->haveMwait)
+		enterIdleContext(&mwaitIdleLoop);
 	enableIntsAndHaltForever();
 }
 
@@ -13,173 +13,145 @@ enum {
 	kPageAddress = uint64_t{0x000FFFFFFFFFF000}
 };
 
-Error thor::svm::NptSpace::map(uint64_t guestAddress, uint64_t hostAddress, int flags) {
-	auto irq_lock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&_mutex);
-	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
-	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
-	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
-	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
+namespace {
 
-	PageAccessor spaceAccessor{spaceRoot};
-	auto pml4e = reinterpret_cast<size_t *>(spaceAccessor.get());
+constexpr uint64_t kPageLarge = (1 << 7);
+constexpr uint64_t kPageLargeAddress = uint64_t{0x000FFFFFFFE00000};
 
-	size_t pageFlags = kPagePresent | kPageUser;
+uint64_t nptLeafFlags(int flags) {
+	uint64_t pageFlags = kPagePresent | kPageUser;
 	if(flags & page_access::write)
 		pageFlags |= kPageWrite;
 	if(!(flags & page_access::execute))
 		pageFlags |= kPageXd;
+	return pageFlags;
+}
 
-	size_t *pdpte;
-	if(!(pml4e[pml4eIdx] & kPagePresent)) {
-		auto pdpte_ptr = physicalAllocator->allocate(kPageSize);
-		if(reinterpret_cast<PhysicalAddr>(pdpte_ptr) == static_cast<PhysicalAddr>(-1))
-			return Error::noMemory;
-
-		pml4e[pml4eIdx] = (pdpte_ptr & kPageAddress) | kPagePresent | kPageUser | kPageWrite;
-		PageAccessor pdpteAccessor{pdpte_ptr};
-		memset(pdpteAccessor.get(), 0, kPageSize);
-	}
-	PageAccessor pdpteAccessor{pml4e[pml4eIdx] & kPageAddress};
-	pdpte = reinterpret_cast<size_t *>(pdpteAccessor.get());
-
-	size_t *pde;
-	if(!(pdpte[pdpteIdx] & kPagePresent)) {
-		auto pdpte_ptr = physicalAllocator->allocate(kPageSize);
-		if(reinterpret_cast<PhysicalAddr>(pdpte_ptr) == static_cast<PhysicalAddr>(-1))
-			return Error::noMemory;
-		
-		pdpte[pdpteIdx] = (pdpte_ptr & kPageAddress) | kPagePresent | kPageUser | kPageWrite;
-		PageAccessor pdpteAccessor{pdpte_ptr};
-		memset(pdpteAccessor.get(), 0, kPageSize);
-	}
-	PageAccessor pdeAccessor{pdpte[pdpteIdx] & kPageAddress};
-	pde = reinterpret_cast<size_t *>(pdeAccessor.get());
-
-	size_t *pte;
-	if(!(pde[pdeIdx] & kPagePresent)) {
-		auto pt_ptr = physicalAllocator->allocate(kPageSize);
-		if(reinterpret_cast<PhysicalAddr>(pt_ptr) == static_cast<PhysicalAddr>(-1))
-			return Error::noMemory;
-
-		pde[pdeIdx] = (pt_ptr & kPageAddress) | kPagePresent | kPageUser | kPageWrite;
-		PageAccessor pdpteAccessor{pt_ptr};
-		memset(pdpteAccessor.get(), 0, kPageSize);
+// Returns the table that the entry points to. If allocate is true, missing tables are allocated.
+uint64_t *nptWalk(uint64_t *table, int idx, bool allocate) {
+	if(!(table[idx] & kPagePresent)) {
+		if(!allocate)
+			return nullptr;
+		auto next = physicalAllocator->allocate(kPageSize);
+		if(next == static_cast<PhysicalAddr>(-1))
+			return nullptr;
+		PageAccessor nextAccessor{next};
+		memset(nextAccessor.get(), 0, kPageSize);
+		table[idx] = (next & kPageAddress) | kPagePresent | kPageUser | kPageWrite;
 	}
-	PageAccessor pteAccessor{pde[pdeIdx] & kPageAddress};
-	pte = reinterpret_cast<size_t *>(pteAccessor.get());
-
-	size_t entry = (hostAddress & kPageAddress) | pageFlags;
-	pte[pteIdx] = entry;
-
-	return Error::success;
+	assert(!(table[idx] & kPageLarge));
+	PageAccessor accessor{table[idx] & kPageAddress};
+	return reinterpret_cast<uint64_t *>(accessor.get());
 }
 
-bool thor::svm::NptSpace::isMapped(VirtualAddr guestAddress) {
+} // anonymous namespace
+
+uint64_t *thor::svm::NptSpace::walkToPd(uint64_t guestAddress, bool allocate) {
 	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
 	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
+
+	PageAccessor spaceAccessor{spaceRoot};
+	auto pml4e = reinterpret_cast<uint64_t *>(spaceAccessor.get());
+
+	auto pdpte = nptWalk(pml4e, pml4eIdx, allocate);
+	if(!pdpte)
+		return nullptr;
+	return nptWalk(pdpte, pdpteIdx, allocate);
+}
+
+Error thor::svm::NptSpace::map(uint64_t guestAddress, uint64_t hostAddress, int flags) {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
 	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
 	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
 
-	PageAccessor spaceAccessor{spaceRoot};
-	size_t *pml4e = reinterpret_cast<size_t *>(spaceAccessor.get());
+	auto pde = walkToPd(guestAddress, true);
+	if(!pde)
+		return Error::noMemory;
+	if(pde[pdeIdx] & kPageLarge)
+		return Error::alreadyExists;
+	auto pte = nptWalk(pde, pdeIdx, true);
+	if(!pte)
+		return Error::noMemory;
 
-	size_t *pdpte;
-	if(!(pml4e[pml4eIdx] & kPagePresent)) {
-		return false;
-	} else {
-		PageAccessor pdpteAccessor{pml4e[pml4eIdx] & kPageAddress};
-		pdpte = reinterpret_cast<size_t *>(pdpteAccessor.get());
-	}
+	pte[pteIdx] = (hostAddress & kPageAddress) | nptLeafFlags(flags);
+	return Error::success;
+}
 
-	size_t *pde;
-	if(!(pdpte[pdpteIdx] & kPagePresent)) {
-		return false;
-	} else {
-		PageAccessor pdeAccessor{pdpte[pdpteIdx] & kPageAddress};
-		pde = reinterpret_cast<size_t *>(pdeAccessor.get());
-	}
+Error thor::svm::NptSpace::map2m(uint64_t guestAddress, uint64_t hostAddress, int flags) {
+	assert(!(guestAddress & (kHugePageSize - 1)));
+	assert(!(hostAddress & (kHugePageSize - 1)));
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
 
-	size_t *pte;
-	if(!(pde[pdeIdx] & kPagePresent)) {
-		return false;
-	} else {
-		PageAccessor pteAccessor{pde[pdeIdx] & kPageAddress};
-		pte = reinterpret_cast<size_t *>(pteAccessor.get());
-	}
+	auto pde = walkToPd(guestAddress, true);
+	if(!pde)
+		return Error::noMemory;
+	// Do not bother to merge existing page tables; the caller falls back to 4 KiB pages.
+	if(pde[pdeIdx] & kPagePresent)
+		return Error::alreadyExists;
 
-	return ((pte[pteIdx] & kPagePresent));
+	pde[pdeIdx] = (hostAddress & kPageLargeAddress) | nptLeafFlags(flags) | kPageLarge;
+	return Error::success;
 }
 
-uintptr_t thor::svm::NptSpace::translate(uintptr_t guestAddress) {
-	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
-	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
+bool thor::svm::NptSpace::isMapped(VirtualAddr guestAddress) {
 	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
 	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
-	size_t offset = (size_t)guestAddress & 0xFFF;
 
-	PageAccessor spaceAccessor{spaceRoot};
-	size_t *pml4e = reinterpret_cast<size_t *>(spaceAccessor.get());
+	auto pde = walkToPd(guestAddress, false);
+	if(!pde || !(pde[pdeIdx] & kPagePresent))
+		return false;
+	if(pde[pdeIdx] & kPageLarge)
+		return true;
+	auto pte = nptWalk(pde, pdeIdx, false);
+	return pte[pteIdx] & kPagePresent;
+}
 
-	size_t *pdpte;
-	if(!(pml4e[pml4eIdx] & kPagePresent)) {
-		return -1;
-	} else {
-		PageAccessor pdpteAccessor{pml4e[pml4eIdx] & kPageAddress};
-		pdpte = reinterpret_cast<size_t *>(pdpteAccessor.get());
-	}
+uintptr_t thor::svm::NptSpace::translate(uintptr_t guestAddress) {
+	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
+	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
+	size_t offset = (size_t)guestAddress & 0xFFF;
 
-	size_t *pde;
-	if(!(pdpte[pdpteIdx] & kPagePresent)) {
+	auto pde = walkToPd(guestAddress, false);
+	if(!pde || !(pde[pdeIdx] & kPagePresent))
 		return -1;
-	} else {
-		PageAccessor pdeAccessor{pdpte[pdpteIdx] & kPageAddress};
-		pde = reinterpret_cast<size_t *>(pdeAccessor.get());
-	}
-
-	size_t *pte;
-	if(!(pde[pdeIdx] & kPagePresent)) {
+	if(pde[pdeIdx] & kPageLarge)
+		return (pde[pdeIdx] & kPageLargeAddress) + (guestAddress & (kHugePageSize - 1));
+	auto pte = nptWalk(pde, pdeIdx, false);
+	if(!(pte[pteIdx] & kPagePresent))
 		return -1;
-	} else {
-		PageAccessor pteAccessor{pde[pdeIdx] & kPageAddress};
-		pte = reinterpret_cast<size_t *>(pteAccessor.get());
-	}
-
 	return (pte[pteIdx] & kPageAddress) + offset;
 }
 
 PageStatus thor::svm::NptSpace::unmap(uint64_t guestAddress) {
-	int pml4eIdx = (((guestAddress) >> 39) & 0x1ff);
-	int pdpteIdx = (((guestAddress) >> 30) & 0x1ff);
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
 	int pdeIdx   = (((guestAddress) >> 21) & 0x1ff);
 	int pteIdx   = (((guestAddress) >> 12) & 0x1ff);
 
-	PageAccessor spaceAccessor{spaceRoot};
-	size_t *pml4e = reinterpret_cast<size_t *>(spaceAccessor.get());
-
-	size_t *pdpte;
-	if(!(pml4e[pml4eIdx] & kPagePresent)) {
+	auto pde = walkToPd(guestAddress, false);
+	if(!pde || !(pde[pdeIdx] & kPagePresent))
 		return 0;
-	} else {
-		PageAccessor pdpteAccessor{pml4e[pml4eIdx] & kPageAddress};
-		pdpte = reinterpret_cast<size_t *>(pdpteAccessor.get());
-	}
 
-	size_t *pde;
-	if(!(pdpte[pdpteIdx] & kPagePresent)) {
-		return 0;
-	} else {
-		PageAccessor pdeAccessor{pdpte[pdpteIdx] & kPageAddress};
-		pde = reinterpret_cast<size_t *>(pdeAccessor.get());
+	// Split large pages such that only a single 4 KiB page is unmapped.
+	if(pde[pdeIdx] & kPageLarge) {
+		auto pt = physicalAllocator->allocate(kPageSize);
+		if(pt == static_cast<PhysicalAddr>(-1))
+			panicLogger() << "thor: Out of memory while splitting NPT large page" << frg::endlog;
+		PageAccessor ptAccessor{pt};
+		auto entries = reinterpret_cast<uint64_t *>(ptAccessor.get());
+		auto large = pde[pdeIdx];
+		for(int i = 0; i < 512; i++)
+			entries[i] = ((large & kPageLargeAddress) + i * kPageSize)
+					| (large & ~(kPageLargeAddress | kPageLarge));
+		pde[pdeIdx] = (pt & kPageAddress) | kPagePresent | kPageUser | kPageWrite;
 	}
 
-	size_t *pte;
-	if(!(pde[pdeIdx] & kPagePresent)) {
+	auto pte = nptWalk(pde, pdeIdx, false);
+	if(!(pte[pteIdx] & kPagePresent))
 		return 0;
-	} else {
-		PageAccessor pteAccessor{pde[pdeIdx] & kPageAddress};
-		pte = reinterpret_cast<size_t *>(pteAccessor.get());
-	}
 
 	PageStatus status = page_status::present;
 	if(pte[pteIdx] & kPageDirty)
@@ -257,7 +229,8 @@ thor::svm::NptSpace::~NptSpace() {
 					PageAccessor pdeAccessor{pdpte[j] & kPageAddress};
 					auto pde = reinterpret_cast<size_t *>(pdeAccessor.get());
 					for(int k = 0; k < 512; k++) {
-						if(pde[k] & kPagePresent) {
+						// Large pages point to guest memory, not to page tables.
+						if((pde[k] & kPagePresent) && !(pde[k] & kPageLarge)) {
 							physicalAllocator->free((size_t)(pde[k] & kPageAddress), kPageSize);
 						}
 					}
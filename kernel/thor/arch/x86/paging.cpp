@@ -72,6 +72,7 @@ enum {
 	kPageUser = 0x4,
 	kPagePwt = 0x8,
 	kPagePcd = 0x10,
+	kPageAccessed = 0x20,
 	kPageDirty = 0x40,
 	kPagePat = 0x80,
 	kPageGlobal = 0x100,
@@ -88,7 +89,8 @@ PageContext::PageContext()
 
 PageBinding::PageBinding()
 : _pcid{0}, _boundSpace{nullptr},
-		_primaryStamp{0}, _alreadyShotSequence{0} { }
+		_primaryStamp{0}, _alreadyShotSequence{0},
+		_isActive{false}, _isStale{false} { }
 
 bool PageBinding::isPrimary() {
 	assert(!intsAreEnabled());
@@ -104,13 +106,20 @@ void PageBinding::rebind() {
 	assert(_boundSpace);
 	auto context = &getCpuData()->pageContext;
 
+	auto previousBinding = context->_primaryBinding;
+	bool needsInvalidation = _activate();
+
 	auto cr3 = _boundSpace->rootTable() | _pcid;
-	if(getCpuData()->havePcids)
+	if(getCpuData()->havePcids && !needsInvalidation)
 		cr3 |= PhysicalAddr(1) << 63; // Do not invalidate the PCID.
 	asm volatile ("mov %0, %%cr3" : : "r"(cr3) : "memory");
 
 	_primaryStamp = context->_nextStamp++;
 	context->_primaryBinding = this;
+
+	// The previous binding is no longer loaded into CR3; it does not need IPIs anymore.
+	if(previousBinding && previousBinding != this && previousBinding->_isActive)
+		previousBinding->_deactivate();
 }
 
 void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
@@ -118,9 +127,12 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 	assert(getCpuData()->havePcids || !_pcid);
 	assert(!_boundSpace || _boundSpace.get() != space.get()); // This would be unnecessary work.
 	auto context = &getCpuData()->pageContext;
+	auto cpuIndex = getCpuData()->cpuIndex;
 
+	auto previousBinding = context->_primaryBinding;
 	auto unbound_space = _boundSpace;
 	auto unbound_sequence = _alreadyShotSequence;
+	auto unbound_active = _isActive;
 
 	// Bind the new space.
 	uint64_t target_seq;
@@ -129,10 +141,18 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 
 		target_seq = space->_shootSequence;
 		space->_numBindings++;
+		space->_numActiveBindings++;
+		if(cpuIndex < 64) {
+			space->_activeCpuMask |= uint64_t(1) << cpuIndex;
+		}else{
+			space->_numActiveHighCpus++;
+		}
 	}
 
 	_boundSpace = space;
 	_alreadyShotSequence = target_seq;
+	_isActive = true;
+	_isStale = false;
 
 	// Switch CR3 and invalidate the PCID.
 	auto cr3 = space->rootTable() | _pcid;
@@ -141,6 +161,9 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 	_primaryStamp = context->_nextStamp++;
 	context->_primaryBinding = this;
 
+	if(previousBinding && previousBinding != this && previousBinding->_isActive)
+		previousBinding->_deactivate();
+
 	// Mark every shootdown request in the unbound space as shot-down.
 	frg::intrusive_list<
 		ShootNode,
@@ -154,7 +177,8 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 	if(unbound_space) {
 		auto lock = frg::guard(&unbound_space->_mutex);
 
-		if(!unbound_space->_shootQueue.empty()) {
+		// Inactive bindings are not counted in _bindingsToShoot.
+		if(unbound_active && !unbound_space->_shootQueue.empty()) {
 			auto current = unbound_space->_shootQueue.back();
 			while(current->_sequence > unbound_sequence) {
 				auto predecessor = current->_queueNode.previous;
@@ -174,6 +198,15 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 			}
 		}
 
+		if(unbound_active) {
+			unbound_space->_numActiveBindings--;
+			if(cpuIndex < 64) {
+				unbound_space->_activeCpuMask &= ~(uint64_t(1) << cpuIndex);
+			}else{
+				unbound_space->_numActiveHighCpus--;
+			}
+		}
+
 		unbound_space->_numBindings--;
 		if(!unbound_space->_numBindings && unbound_space->_retireNode) {
 			unbound_space->_retireNode->complete();
@@ -204,39 +237,13 @@ void PageBinding::unbind() {
 		invalidatePcid(_pcid);
 	}
 
-	frg::intrusive_list<
-		ShootNode,
-		frg::locate_member<
-			ShootNode,
-			frg::default_list_hook<ShootNode>,
-			&ShootNode::_queueNode
-		>
-	> complete;
+	// This acknowledges all outstanding shootdowns; the actual shootdown was done above.
+	if(_isActive)
+		_deactivate();
 
 	{
 		auto lock = frg::guard(&_boundSpace->_mutex);
 
-		if(!_boundSpace->_shootQueue.empty()) {
-			auto current = _boundSpace->_shootQueue.back();
-			while(current->_sequence > _alreadyShotSequence) {
-				auto predecessor = current->_queueNode.previous;
-
-				// The actual shootdown was done above.
-				// Signal completion of the shootdown.
-				if(current->_initiatorCpu != getCpuData()) {
-					if(current->_bindingsToShoot.fetch_sub(1, std::memory_order_acq_rel) == 1) {
-						auto it = _boundSpace->_shootQueue.iterator_to(current);
-						_boundSpace->_shootQueue.erase(it);
-						complete.push_front(current);
-					}
-				}
-
-				if(!predecessor)
-					break;
-				current = predecessor;
-			}
-		}
-
 		_boundSpace->_numBindings--;
 		if(!_boundSpace->_numBindings && _boundSpace->_retireNode) {
 			_boundSpace->_retireNode->complete();
@@ -246,11 +253,7 @@ void PageBinding::unbind() {
 
 	_boundSpace = nullptr;
 	_alreadyShotSequence = 0;
-
-	while(!complete.empty()) {
-		auto current = complete.pop_front();
-		current->complete();
-	}
+	_isStale = false;
 }
 
 void PageBinding::shootdown() {
@@ -265,6 +268,10 @@ void PageBinding::shootdown() {
 		return;
 	}
 
+	// Inactive bindings are flushed lazily by _activate().
+	if(!_isActive)
+		return;
+
 	frg::intrusive_list<
 		ShootNode,
 		frg::locate_member<
@@ -327,6 +334,91 @@ void PageBinding::shootdown() {
 	}
 }
 
+bool PageBinding::_activate() {
+	assert(!intsAreEnabled());
+	assert(_boundSpace);
+	assert(!_isActive);
+	auto cpuIndex = getCpuData()->cpuIndex;
+
+	bool needsInvalidation;
+	{
+		auto lock = frg::guard(&_boundSpace->_mutex);
+
+		// All shootdowns since _alreadyShotSequence were requested while we were inactive.
+		needsInvalidation = _isStale || _boundSpace->_shootSequence > _alreadyShotSequence;
+		_alreadyShotSequence = _boundSpace->_shootSequence;
+
+		_boundSpace->_numActiveBindings++;
+		if(cpuIndex < 64) {
+			_boundSpace->_activeCpuMask |= uint64_t(1) << cpuIndex;
+		}else{
+			_boundSpace->_numActiveHighCpus++;
+		}
+	}
+
+	_isActive = true;
+	_isStale = false;
+	return needsInvalidation;
+}
+
+void PageBinding::_deactivate() {
+	assert(!intsAreEnabled());
+	assert(_boundSpace);
+	assert(_isActive);
+	auto cpuIndex = getCpuData()->cpuIndex;
+
+	frg::intrusive_list<
+		ShootNode,
+		frg::locate_member<
+			ShootNode,
+			frg::default_list_hook<ShootNode>,
+			&ShootNode::_queueNode
+		>
+	> complete;
+
+	{
+		auto lock = frg::guard(&_boundSpace->_mutex);
+
+		// Acknowledge all outstanding shootdowns without performing them.
+		// Since the PCID is not loaded into CR3, its TLB entries cannot be used until _activate().
+		if(!_boundSpace->_shootQueue.empty()) {
+			auto current = _boundSpace->_shootQueue.back();
+			while(current->_sequence > _alreadyShotSequence) {
+				auto predecessor = current->_queueNode.previous;
+
+				if(current->_initiatorCpu != getCpuData()) {
+					_isStale = true;
+
+					if(current->_bindingsToShoot.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+						auto it = _boundSpace->_shootQueue.iterator_to(current);
+						_boundSpace->_shootQueue.erase(it);
+						complete.push_front(current);
+					}
+				}
+
+				if(!predecessor)
+					break;
+				current = predecessor;
+			}
+		}
+		_alreadyShotSequence = _boundSpace->_shootSequence;
+
+		_boundSpace->_numActiveBindings--;
+		if(cpuIndex < 64) {
+			_boundSpace->_activeCpuMask &= ~(uint64_t(1) << cpuIndex);
+		}else{
+			_boundSpace->_numActiveHighCpus--;
+		}
+	}
+
+	_isActive = false;
+
+	while(!complete.empty()) {
+		auto current = complete.pop_front();
+		current->complete();
+	}
+}
+
 // --------------------------------------------------------
 
 GlobalPageBinding::GlobalPageBinding()
@@ -431,10 +523,13 @@ void PageSpace::activate(smarter::shared_ptr<PageSpace> space) {
 
 
 PageSpace::PageSpace(PhysicalAddr root_table)
-: _rootTable{root_table}, _numBindings{0}, _shootSequence{0} { }
+: _rootTable{root_table}, _numBindings{0},
+		_numActiveBindings{0}, _activeCpuMask{0}, _numActiveHighCpus{0},
+		_shootSequence{0} { }
 
 PageSpace::~PageSpace() {
 	assert(!_numBindings);
+	assert(!_numActiveBindings);
 }
 
 void PageSpace::retire(RetireNode *node) {
@@ -460,32 +555,30 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 	assert(!(node->address & (kPageSize - 1)));
 	assert(!(node->size & (kPageSize - 1)));
 
+	uint64_t cpuMask;
+	bool broadcast;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_mutex);
 
-		auto unshot_bindings = _numBindings;
+		// Inactive bindings (on this or other CPUs) are flushed lazily when they are activated.
+		auto unshot_bindings = _numActiveBindings;
 
 		// Perform synchronous shootdown.
 		auto bindings = getCpuData()->pcidBindings;
-		if(!getCpuData()->havePcids) {
-			if(bindings[0].boundSpace().get() == this) {
-				assert(unshot_bindings);
+		for(int i = 0; i < maxPcidCount; i++) {
+			if(bindings[i].boundSpace().get() != this || !bindings[i].isActive())
+				continue;
+			assert(unshot_bindings);
 
+			if(!getCpuData()->havePcids) {
 				if((node->size >> kPageShift) >= 64) {
 					invalidateFullTlb();
 				}else{
 					for(size_t pg = 0; pg < node->size; pg += kPageSize)
 						invalidatePage(reinterpret_cast<void *>(node->address + pg));
 				}
-				unshot_bindings--;
-			}
-		}else{
-			for(int i = 0; i < maxPcidCount; i++) {
-				if(bindings[i].boundSpace().get() != this)
-					continue;
-				assert(unshot_bindings);
-
+			}else{
 				if((node->size >> kPageShift) >= 64) {
 					invalidatePcid(bindings[i].getPcid());
 				}else{
@@ -493,20 +586,37 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 						invalidatePage(bindings[i].getPcid(),
 								reinterpret_cast<void *>(node->address + pg));
 				}
-				unshot_bindings--;
 			}
+			unshot_bindings--;
 		}
 
+		// Even if no binding needs to be shot down, we advance the sequence
+		// such that inactive bindings notice that they are stale.
+		node->_sequence = ++_shootSequence;
 		if(!unshot_bindings)
 			return true;
 
 		node->_initiatorCpu = getCpuData();
-		node->_sequence = ++_shootSequence;
 		node->_bindingsToShoot = unshot_bindings;
 		_shootQueue.push_back(node);
+
+		auto cpuIndex = getCpuData()->cpuIndex;
+		cpuMask = _activeCpuMask;
+		if(cpuIndex < 64)
+			cpuMask &= ~(uint64_t(1) << cpuIndex);
+		broadcast = _numActiveHighCpus;
 	}
 
-	sendShootdownIpi();
+	// Only interrupt CPUs that have the space loaded into CR3.
+	if(broadcast) {
+		sendShootdownIpi();
+	}else{
+		while(cpuMask) {
+			auto cpu = __builtin_ctzll(cpuMask);
+			sendShootdownIpi(cpu);
+			cpuMask &= cpuMask - 1;
+		}
+	}
 	return false;
 }
 
@@ -718,7 +828,8 @@ ClientPageSpace::~ClientPageSpace() {
 		PageAccessor accessor{ps};
 		auto tbl = reinterpret_cast<uint64_t *>(accessor.get());
 		for(int i = 0; i < 512; i++) {
-			if(tbl[i] & kPagePresent)
+			// Large pages are owned by their memory objects, not by the page space.
+			if((tbl[i] & kPagePresent) && !(tbl[i] & pteHuge))
 				physicalAllocator->free(tbl[i] & kPageAddress, kPageSize);
 		}
 	};
@@ -898,6 +1009,8 @@ PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	PageStatus status = page_status::present;
 	if(bits & kPageDirty)
 		status |= page_status::dirty;
+	if(bits & kPageAccessed)
+		status |= page_status::accessed;
 	return status;
 }
 
@@ -993,6 +1106,8 @@ bool ClientPageSpace::isMapped(VirtualAddr pointer) {
 	// Find the PT.
 	if(!(tbl2[index2].load() & kPagePresent))
 		return false;
+	if(tbl2[index2].load() & pteHuge)
+		return true;
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -1072,18 +1187,20 @@ void ClientPageSpace::Walk::_update() {
 
 	// Make sure there is a PT.
 	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor2.get());
-	if(!(tbl2[index2].load() & kPagePresent))
+	if(!(tbl2[index2].load() & kPagePresent) || (tbl2[index2].load() & pteHuge))
 		return;
 	_accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 }
 
-void ClientPageSpace::Cursor::realizePts() {
-	auto doRealize = [&] <int S> (PageAccessor &subPt, PageAccessor &pt,
-			std::integral_constant<int, S>) {
+namespace {
+	// Makes sure that the PT at level S below the given entry exists and returns an accessor to it.
+	// Large pages that are found in PDEs are split into equivalent PTs.
+	template<int S>
+	void realizeSubPt(uintptr_t va, PageAccessor &subPt, PageAccessor &pt) {
 		auto ptPtr = reinterpret_cast<uint64_t *>(pt.get())
-				+ ((va_ >> S) & 0x1FF);
+				+ ((va >> S) & 0x1FF);
 		auto ptEnt = __atomic_load_n(ptPtr, __ATOMIC_RELAXED);
-		if(ptEnt & ptePresent) {
+		if((ptEnt & ptePresent) && !(S == 21 && (ptEnt & pteHuge))) {
 			subPt = PageAccessor{ptEnt & pteAddress};
 			return;
 		}
@@ -1092,35 +1209,51 @@ void ClientPageSpace::Cursor::realizePts() {
 		assert(subPtPage != static_cast<PhysicalAddr>(-1) && "OOM");
 
 		subPt = PageAccessor{subPtPage};
-		for(int i = 0; i < 512; i++) {
-			auto subPtPtr = reinterpret_cast<uint64_t *>(subPt.get()) + i;
-			*subPtPtr = 0;
+		if(ptEnt & ptePresent) {
+			// Replicate the large page: keep all flags but move the PAT bit into its 4 KiB position.
+			auto flags = ptEnt & ~(pteHugeAddress | pteHuge | pteHugePat);
+			if(ptEnt & pteHugePat)
+				flags |= ptePat;
+			for(int i = 0; i < 512; i++) {
+				auto subPtPtr = reinterpret_cast<uint64_t *>(subPt.get()) + i;
+				*subPtPtr = ((ptEnt & pteHugeAddress) + i * kPageSize) | flags;
+			}
+		}else{
+			for(int i = 0; i < 512; i++) {
+				auto subPtPtr = reinterpret_cast<uint64_t *>(subPt.get()) + i;
+				*subPtPtr = 0;
+			}
 		}
 
 		ptEnt = subPtPage | ptePresent | pteWrite | pteUser;
 		__atomic_store_n(ptPtr, ptEnt, __ATOMIC_RELEASE);
-	};
-
-	auto realize3 = [&] {
-		if(_accessor3) /* [[likely]] */
-			return;
-		doRealize(_accessor3, _accessor4, std::integral_constant<int, 39>{});
-	};
-	auto realize2 = [&] {
-		if(_accessor2) /* [[likely]] */
-			return;
-		realize3();
-		doRealize(_accessor2, _accessor3, std::integral_constant<int, 30>{});
-	};
+	}
+} // anonymous namespace
 
+void ClientPageSpace::Cursor::realizePts() {
 	// This function is called after cachePts() if not all PTs are present.
 	assert(!_accessor1);
 
 	auto irqLock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&space_->_mutex);
 	{
-		realize2();
-		doRealize(_accessor1, _accessor2, std::integral_constant<int, 21>{});
+		if(!_accessor3)
+			realizeSubPt<39>(va_, _accessor3, _accessor4);
+		if(!_accessor2)
+			realizeSubPt<30>(va_, _accessor2, _accessor3);
+		realizeSubPt<21>(va_, _accessor1, _accessor2);
+	}
+}
+
+void ClientPageSpace::Cursor::realizePds() {
+	assert(!_accessor2);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&space_->_mutex);
+	{
+		if(!_accessor3)
+			realizeSubPt<39>(va_, _accessor3, _accessor4);
+		realizeSubPt<30>(va_, _accessor2, _accessor3);
 	}
 }
 
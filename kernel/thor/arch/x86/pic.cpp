@@ -8,6 +8,7 @@
 #include <initgraph.hpp>
 #include <thor-internal/irq.hpp>
 #include <thor-internal/main.hpp>
+#include <hel.h>
 
 namespace thor {
 
@@ -122,12 +123,13 @@ void GlobalApicContext::GlobalAlarmSlot::arm(uint64_t nanos) {
 		auto irq_lock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&globalApicContext()->_mutex);
 		globalApicContext()->_globalDeadline = nanos;
+		globalApicContext()->_globalOwner = localApicContext();
 	}
 	LocalApicContext::_updateLocalTimer();
 }
 
 LocalApicContext::LocalApicContext()
-: _preemptionDeadline{0}, _globalDeadline{0} { }
+: _preemptionDeadline{0}, _globalDeadline{0}, _programmedDeadline{0} { }
 
 void LocalApicContext::setPreemption(uint64_t nanos) {
 	assert(localApicContext()->timersAreCalibrated);
@@ -149,6 +151,9 @@ void LocalApicContext::handleTimerIrq() {
 	auto self = localApicContext();
 	auto now = systemClockSource()->currentNanos();
 
+	// The timer is one-shot; it is stopped after it fired.
+	self->_programmedDeadline = 0;
+
 	if(self->_preemptionDeadline && now > self->_preemptionDeadline)
 		self->_preemptionDeadline = 0;
 
@@ -160,13 +165,18 @@ void LocalApicContext::handleTimerIrq() {
 		{
 			auto irq_lock = frg::guard(&irqMutex());
 			auto lock = frg::guard(&globalApicContext()->_mutex);
-			localApicContext()->_globalDeadline = globalApicContext()->_globalDeadline;
+			if(globalApicContext()->_globalOwner == self)
+				self->_globalDeadline = globalApicContext()->_globalDeadline;
 		}
 	}
 
 	localApicContext()->_updateLocalTimer();
 }
 
+uint64_t LocalApicContext::nextDeadline() {
+	return localApicContext()->_programmedDeadline;
+}
+
 void LocalApicContext::_updateLocalTimer() {
 	uint64_t deadline = 0;
 	auto consider = [&] (uint64_t dc) {
@@ -180,22 +190,31 @@ void LocalApicContext::_updateLocalTimer() {
 	{
 		auto irq_lock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&globalApicContext()->_mutex);
-		localApicContext()->_globalDeadline = globalApicContext()->_globalDeadline;
+		if(globalApicContext()->_globalOwner == localApicContext()) {
+			localApicContext()->_globalDeadline = globalApicContext()->_globalDeadline;
+		}else{
+			localApicContext()->_globalDeadline = 0;
+		}
 	}
 
 	consider(localApicContext()->_preemptionDeadline);
 	consider(localApicContext()->_globalDeadline);
 
+	// Avoid reprogramming the timer if nothing changed (e.g., when the tick stays stopped).
+	if(deadline == localApicContext()->_programmedDeadline)
+		return;
+	localApicContext()->_programmedDeadline = deadline;
+
 	if(localApicContext()->useTscMode) {
 		if(!deadline) {
 			common::x86::wrmsr(common::x86::kMsrIa32TscDeadline, 0);
 			return;
 		}
 
-		uint64_t ticks;
-		auto of = __builtin_mul_overflow(deadline, localApicContext()->tscTicksPerMilli, &ticks);
-		assert(!of);
-		ticks /= 1'000'000;
+		// The factor and the result are rounded up such that the timer never fires early.
+		auto product = static_cast<unsigned __int128>(deadline)
+				* localApicContext()->nanosToTscFactor;
+		auto ticks = static_cast<uint64_t>(product >> 40) + 1;
 		common::x86::wrmsr(common::x86::kMsrIa32TscDeadline, ticks);
 		if(debugTimer)
 			infoLogger() << "thor [CPU " << getLocalApicId() << "]: Setting TSC deadline to "
@@ -340,7 +359,12 @@ uint64_t localTicks() {
 namespace {
 	struct TscClockSource final : ClockSource {
 		uint64_t currentNanos() override {
-			auto r = getRawTimestampCounter() * 1'000'000 / localApicContext()->tscTicksPerMilli;
+			// Split the computation to avoid overflowing the multiplication.
+			// User space performs the same computation (see HelClockPage).
+			auto tsc = getRawTimestampCounter();
+			auto ticksPerMilli = localApicContext()->tscTicksPerMilli;
+			auto r = (tsc / ticksPerMilli) * 1'000'000
+					+ (tsc % ticksPerMilli) * 1'000'000 / ticksPerMilli;
 	//		infoLogger() << r << frg::endlog;
 			return r;
 		}
@@ -377,9 +401,17 @@ void calibrateApicTimer() {
 	auto tsc_elapsed = getRawTimestampCounter() - tsc_start;
 
 	localApicContext()->tscTicksPerMilli = tsc_elapsed / millis;
+	assert(localApicContext()->tscTicksPerMilli < (uint64_t{1} << 24));
+	localApicContext()->nanosToTscFactor
+			= ((localApicContext()->tscTicksPerMilli << 40) + 999'999) / 1'000'000;
 	infoLogger() << "thor: TSC ticks/ms: " << localApicContext()->tscTicksPerMilli
 				<< " on CPU #" << getCpuData()->cpuIndex << frg::endlog;
 
+	// Allow user space to determine the current CPU (and its calibration) via rdtscp.
+	if(getGlobalCpuFeatures()->haveRdtscp)
+		common::x86::wrmsr(common::x86::kMsrIa32TscAux, getCpuData()->cpuIndex);
+	publishCpuClock(getCpuData()->cpuIndex, localApicContext()->tscTicksPerMilli);
+
 	localApicContext()->timersAreCalibrated = true;
 }
 
@@ -390,6 +422,10 @@ static initgraph::Task assessTimersTask{&globalInitEngine, "x86.assess-timers",
 		if(getGlobalCpuFeatures()->haveInvariantTsc) {
 			globalTscClockSource.initialize();
 			globalClockSource = globalTscClockSource.get();
+
+			// The TSC can only be used from user space if the current CPU can be determined.
+			if(getGlobalCpuFeatures()->haveRdtscp)
+				publishClockMode(kHelClockModeTsc, kHelClockTscAuxIsCpu);
 		}else{
 			infoLogger() << "thor: No invariant TSC; using HPET as system clock source"
 					<< frg::endlog;
@@ -468,8 +504,30 @@ void sendShootdownIpi() {
 	}
 }
 
-void sendPingIpi(int id) {
+void sendShootdownIpi(int id) {
 	auto apic = getCpuData(id)->localApicId;
+	if(picBase.isUsingX2apic()) {
+		picBase.store(lX2ApicIcr, x2apicIcrLowVector(0xF0) | x2apicIcrLowDelivMode(0)
+				| x2apicIcrLowLevel(true) | x2apicIcrLowShorthand(0) | x2apicIcrHighDestField(apic));
+	} else {
+		picBase.store(lApicIcrHigh, apicIcrHighDestField(apic));
+		picBase.store(lApicIcrLow, apicIcrLowVector(0xF0) | apicIcrLowDelivMode(0)
+				| apicIcrLowLevel(true) | apicIcrLowShorthand(0));
+		while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
+			// Wait for IPI delivery.
+		}
+	}
+}
+
+void sendPingIpi(int id) {
+	// If the CPU is waiting in MWAIT, writing to the monitored line is enough to wake it up.
+	// The exchange orders this against prior writes (e.g., to the scheduler's pending list).
+	auto cpuData = getCpuData(id);
+	if(cpuData->idleMonitor.exchange(idleMonitorWakeup, std::memory_order_seq_cst)
+			== idleMonitorWaiting)
+		return;
+
+	auto apic = cpuData->localApicId;
 //	infoLogger() << "thor [CPU" << getLocalApicId() << "]: Sending ping" << frg::endlog;
 	if(picBase.isUsingX2apic()) {
 		picBase.store(lX2ApicIcr, x2apicIcrLowVector(0xF1) | x2apicIcrLowDelivMode(0)
@@ -540,15 +598,27 @@ namespace {
 		}
 
 		uint64_t getMessageAddress() override {
-			return 0xFEE00000;
+			return 0xFEE00000 | (uint64_t{destination_} << 12);
 		}
 
 		uint32_t getMessageData() override {
 			return vector_;
 		}
 
+		bool setAffinity(size_t cpu) override {
+			if(cpu >= getCpuCount())
+				return false;
+			// Without interrupt remapping, the destination field only has 8 bits.
+			auto apic = getCpuData(cpu)->localApicId;
+			if(apic > 0xFF)
+				return false;
+			destination_ = apic;
+			return true;
+		}
+
 	private:
 		unsigned int vector_;
+		uint8_t destination_ = 0;
 	};
 }
 
@@ -40,4 +40,54 @@ bool checkAmdPmcOverflow() {
 	return !(value & (UINT64_C(1) << 47));
 }
 
+// --------------------------------------------------------------------------------------
+// Per-thread counters.
+// --------------------------------------------------------------------------------------
+
+// Kernel profiling uses counter 0. Event i (see Thread::numPmcEvents)
+// is always assigned to counter i + 1.
+namespace {
+	// AMD has no architectural cache miss event; only cycles and instructions are supported.
+	constexpr unsigned int amdThreadEvents[] = {
+		counters::clockCycles,
+		counters::instructionsRetired,
+	};
+	constexpr int numAmdThreadEvents = sizeof(amdThreadEvents) / sizeof(unsigned int);
+
+	uint32_t amdControlMsr(int i) {
+		return 0xC001'0200 + 2 * (i + 1);
+	}
+
+	uint32_t amdCounterMsr(int i) {
+		return 0xC001'0201 + 2 * (i + 1);
+	}
+}
+
+bool amdThreadPmcSupports(uint32_t events) {
+	return !(events >> numAmdThreadEvents);
+}
+
+void startAmdThreadPmc(uint32_t events) {
+	for(int i = 0; i < numAmdThreadEvents; i++) {
+		if(!(events & (UINT32_C(1) << i)))
+			continue;
+		common::x86::wrmsr(amdControlMsr(i), 0);
+		common::x86::wrmsr(amdCounterMsr(i), 0);
+		common::x86::wrmsr(amdControlMsr(i),
+				static_cast<uint64_t>(amdThreadEvents[i] & 0xFF)
+				| (UINT64_C(1) << 16) // Count in user mode only.
+				| (UINT64_C(1) << 22) // Enable performance counter
+		);
+	}
+}
+
+void stopAmdThreadPmc(uint32_t events, uint64_t *values) {
+	for(int i = 0; i < numAmdThreadEvents; i++) {
+		if(!(events & (UINT32_C(1) << i)))
+			continue;
+		common::x86::wrmsr(amdControlMsr(i), 0);
+		values[i] = common::x86::rdmsr(amdCounterMsr(i)) & ((UINT64_C(1) << 48) - 1);
+	}
+}
+
 } // namespace thor
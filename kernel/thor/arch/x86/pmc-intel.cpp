@@ -76,4 +76,73 @@ bool checkIntelPmcOverflow() {
 	}
 }
 
+// --------------------------------------------------------------------------------------
+// Per-thread counters.
+// --------------------------------------------------------------------------------------
+
+// We use the general purpose counters for per-thread counting such that they do not
+// interfere with the fixed counters that are used by kernel profiling.
+// Event i (see Thread::numPmcEvents) is always assigned to general purpose counter i.
+namespace {
+	struct IntelArchEvent {
+		uint8_t event;
+		uint8_t umask;
+		int unavailableBit; // Bit in CPUID.0AH:EBX that indicates that the event is unavailable.
+	};
+
+	constexpr IntelArchEvent intelArchEvents[] = {
+		{0x3C, 0x00, 0}, // Unhalted core cycles.
+		{0xC0, 0x00, 1}, // Instructions retired.
+		{0x2E, 0x41, 4}, // LLC misses.
+	};
+	constexpr int numIntelArchEvents = sizeof(intelArchEvents) / sizeof(IntelArchEvent);
+}
+
+bool intelThreadPmcSupports(uint32_t events) {
+	if(events >> numIntelArchEvents)
+		return false;
+
+	auto leaf = common::x86::cpuid(0xA);
+	auto numCounters = (leaf[0] >> 8) & 0xFF;
+	auto vectorLength = (leaf[0] >> 24) & 0xFF;
+	for(int i = 0; i < numIntelArchEvents; i++) {
+		if(!(events & (UINT32_C(1) << i)))
+			continue;
+		if(static_cast<unsigned int>(i) >= numCounters)
+			return false;
+		auto bit = intelArchEvents[i].unavailableBit;
+		if(static_cast<unsigned int>(bit) >= vectorLength || (leaf[1] & (UINT32_C(1) << bit)))
+			return false;
+	}
+	return true;
+}
+
+void startIntelThreadPmc(uint32_t events) {
+	uint64_t globalBits = 0;
+	for(int i = 0; i < numIntelArchEvents; i++) {
+		if(!(events & (UINT32_C(1) << i)))
+			continue;
+		common::x86::wrmsr(0xC1 + i, 0); // IA32_PMCi
+		common::x86::wrmsr(0x186 + i, // IA32_PERFEVTSELi
+				static_cast<uint64_t>(intelArchEvents[i].event)
+				| (static_cast<uint64_t>(intelArchEvents[i].umask) << 8)
+				| (UINT64_C(1) << 16) // Count in user mode only.
+				| (UINT64_C(1) << 22) // Enable the counter.
+		);
+		globalBits |= UINT64_C(1) << i;
+	}
+
+	common::x86::wrmsr(0x38F, // PERF_GLOBAL_CTRL
+			common::x86::rdmsr(0x38F) | globalBits);
+}
+
+void stopIntelThreadPmc(uint32_t events, uint64_t *values) {
+	for(int i = 0; i < numIntelArchEvents; i++) {
+		if(!(events & (UINT32_C(1) << i)))
+			continue;
+		common::x86::wrmsr(0x186 + i, 0); // IA32_PERFEVTSELi
+		values[i] = common::x86::rdmsr(0xC1 + i) & ((UINT64_C(1) << 48) - 1); // IA32_PMCi
+	}
+}
+
 } // namespace thor
@@ -117,6 +117,14 @@ namespace thor::svm {
 		while(true) {
 			asm("clgi");
 
+			// Inject the pending in-kernel interrupt if the guest can take it.
+			// Otherwise, we retry on the next exit.
+			if(auto vector = inKernelExits.pendingInterrupt(); vector >= 0
+					&& (vmcb->rflags & (1 << 9)) && !vmcb->irqShadow) {
+				vmcb->eventInject = vector | (1u << 31);
+				inKernelExits.acknowledgeInterrupt();
+			}
+
 			auto pat = common::x86::rdmsr(common::x86::kMsrPAT);
 			asm volatile("vmsave %%rax" : : "a"(host_additional_save_region) : "memory"); // Use vmsave / vmload to save additional state that would otherwise have to be wrmsr'ed
 
@@ -143,18 +151,69 @@ namespace thor::svm {
 
 			asm("stgi");
 
+			// Resumes the guest after the instruction that caused the exit.
+			// nextRip is only provided if the CPU supports NRIPS.
+			auto skipInstruction = [&] (uint64_t length) {
+				if(vmcb->nextRip) {
+					vmcb->rip = vmcb->nextRip;
+				}else{
+					vmcb->rip = vmcb->rip + length;
+				}
+				vmcb->irqShadow = 0;
+			};
+
 			auto code = vmcb->exitcode;
-			switch(code) {
-			default:
+			auto unknownExit = [&] {
 				infoLogger() << "svm: Unknown exitcode: " << code << frg::endlog;
 				reason.exitReason = kHelVmexitUnknownPlatformSpecificExitCode;
 				reason.code = code;
 				return reason;
+			};
+
+			switch(code) {
+			default:
+				return unknownExit();
 
 			case kSvmExitHlt:
+				if(inKernelExits.handles(kHelVmexitHandleHlt)
+						&& (vmcb->rflags & (1 << 9))
+						&& inKernelExits.pendingInterrupt() >= 0) {
+					// The interrupt is injected on the next entry.
+					skipInstruction(1);
+					break;
+				}
 				reason.exitReason = kHelVmexitHlt;
 				return reason;
 
+			case kSvmExitCpuid: {
+				if(!inKernelExits.handles(kHelVmexitHandleCpuid))
+					return unknownExit();
+				auto out = inKernelExits.cpuid(vmcb->rax, gprState.rcx, vmcb->cr4);
+				vmcb->rax = out[0];
+				gprState.rbx = out[1];
+				gprState.rcx = out[2];
+				gprState.rdx = out[3];
+				skipInstruction(2);
+				break;
+			}
+
+			case kSvmExitMsr: {
+				uint32_t index = gprState.rcx;
+				if(vmcb->exitinfo1) {
+					if(!inKernelExits.writeMsr(index,
+							(vmcb->rax & 0xFFFF'FFFF) | (gprState.rdx << 32)))
+						return unknownExit();
+				}else{
+					uint64_t value;
+					if(!inKernelExits.readMsr(index, value))
+						return unknownExit();
+					vmcb->rax = value & 0xFFFF'FFFF;
+					gprState.rdx = value >> 32;
+				}
+				skipInstruction(2);
+				break;
+			}
+
 			case kSvmExitNPTFault: {
 				size_t address = vmcb->exitinfo2;
 				size_t exitFlags = vmcb->exitinfo1;
@@ -238,6 +297,14 @@ namespace thor::svm {
 		SET_SEGMENT(tr);
 	}
 
+	void Vcpu::storeControl(const HelX86VirtualizationControl *control) {
+		inKernelExits.handled = control->handledExits;
+	}
+
+	void Vcpu::loadControl(HelX86VirtualizationControl *control) {
+		control->handledExits = inKernelExits.handled;
+	}
+
 	void Vcpu::loadRegs(HelX86VirtualizationRegs *regs) {
 		regs->rax = vmcb->rax;
 		regs->rbx = gprState.rbx;
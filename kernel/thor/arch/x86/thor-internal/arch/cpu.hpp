@@ -1,9 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <stddef.h>
 #include <stdint.h>
 #include <utility>
 
+#include <frg/span.hpp>
 #include <frg/tuple.hpp>
 #include <x86/gdt.hpp>
 #include <x86/idt.hpp>
@@ -245,6 +247,11 @@ struct SyscallImageAccessor {
 	Word *out0() { return &_frame()->rsi; }
 	Word *out1() { return &_frame()->rdx; }
 
+	// Used to redirect the thread on return to user space (e.g., for signal delivery).
+	Word *ip() { return &_frame()->rip; }
+	Word *sp() { return &_frame()->rsp; }
+	Word *rflags() { return &_frame()->rflags; }
+
 	void *frameBase() { return _pointer + sizeof(Frame); }
 
 private:
@@ -283,6 +290,8 @@ struct NmiImageAccessor {
 	Word *ip() { return &_frame()->rip; }
 	Word *cs() { return &_frame()->cs; }
 	Word *rflags() { return &_frame()->rflags; }
+	Word *sp() { return &_frame()->rsp; }
+	Word *bp() { return &_frame()->rbp; }
 
 private:
 	// note: this struct is accessed from assembly.
@@ -361,6 +370,7 @@ struct FiberContext {
 };
 
 struct Executor;
+struct PlatformCpuData;
 
 // Restores the current executor from its saved image.
 // This is functions does the heavy lifting during task switch.
@@ -493,10 +503,33 @@ public:
 		return reinterpret_cast<FxState *>(_pointer + sizeof(General) + 0x10);
 	}
 
+	// Saves the SIMD registers to _fxState().
+	// This is a no-op for kernel fibers since the kernel never touches the SIMD registers.
+	void _saveSimd();
+
+	// Loads the SIMD registers from _fxState() unless they still hold this executor's state.
+	void _restoreSimd();
+
+	// Must be called after software modified _fxState().
+	void _invalidateSimd() {
+		_simdCpu = nullptr;
+	}
+
+	// XSAVEOPT does not write out components that are in their initial configuration.
+	// This writes those components such that _fxState() can be inspected as a whole.
+	void _expandSimd();
+
 private:
 	char *_pointer;
 	void *_syscallStack;
 	common::x86::Tss64 *_tss;
+
+	// True for kernel fibers; they do not have SIMD state.
+	bool _kernelOnly = false;
+	// Unique ID (i.e., never reused) to identify the owner of the SIMD registers.
+	uint64_t _simdId = 0;
+	// CPU whose SIMD registers were last loaded from this executor.
+	PlatformCpuData *_simdCpu = nullptr;
 };
 
 void saveExecutor(Executor *executor, FaultImageAccessor accessor);
@@ -518,14 +551,26 @@ struct CpuFeatures {
 	static constexpr uint32_t profileAmdSupported = 2;
 
 	bool haveXsave;
+	bool haveXsaveopt;
 	bool haveAvx;
 	bool haveZmm;
 	bool haveInvariantTsc;
 	bool haveTscDeadline;
+	bool haveRdtscp;
+	bool haveErms;
+	bool haveFsrm;
+	// MONITOR/MWAIT with interrupts as break events (even if they are masked).
+	bool haveMwait;
+	// Whether the local APIC timer keeps running in deep C-states.
+	bool haveArat;
+	// Number of MWAIT sub-states per C-state (4 bits each), i.e., EDX of CPUID leaf 5.
+	uint32_t mwaitSubstates;
 	bool haveVmx;
 	bool haveSvm;
 	uint32_t profileFlags;
 	size_t xsaveRegionSize;
+	// Value of XCR0, i.e., the state components that are managed by XSAVE.
+	uint64_t xsaveMask;
 };
 
 extern bool cpuFeaturesKnown;
@@ -591,8 +636,14 @@ struct PlatformCpuData : public AssemblyCpuData {
 
 	LocalApicContext apicContext;
 
+	// Monitored by the idle loop if MWAIT is used; see sendPingIpi().
+	std::atomic<uint32_t> idleMonitor{0};
+
 	// TODO: This is not really arch-specific!
 	smarter::borrowed_ptr<Thread> activeExecutor;
+
+	// Executor::_simdId of the executor whose state is loaded into the SIMD registers.
+	uint64_t simdOwner = 0;
 };
 
 inline PlatformCpuData *getPlatformCpuData() {
@@ -633,7 +684,8 @@ void doRunOnStack(void (*function) (void *, void *), void *sp, void *argument);
 void setupBootCpuContext();
 void initializeThisProcessor();
 
-void bootSecondary(unsigned int apic_id);
+// Boots the APs with the given APIC IDs in parallel and waits until all of them are up.
+void bootSecondaries(frg::span<const unsigned int> apicIds);
 
 template<typename F>
 void forkExecutor(F functor, Executor *executor) {
@@ -642,11 +694,7 @@ void forkExecutor(F functor, Executor *executor) {
 		(*fp)();
 	};
 
-	if(getGlobalCpuFeatures()->haveXsave) {
-		common::x86::xsave((uint8_t*)executor->_fxState(), ~0);
-	} else {
-		asm volatile ("fxsaveq %0" : : "m" (*executor->_fxState()));
-	}
+	executor->_saveSimd();
 
 	doForkExecutor(executor, delegate, &functor);
 }
@@ -663,6 +711,15 @@ bool preemptionIsArmed();
 
 uint64_t getRawTimestampCounter();
 
+// --------------------------------------------------------
+// Page-sized memory operations.
+// --------------------------------------------------------
+
+// These use non-temporal stores. They are intended for pages that are not
+// accessed by the kernel right afterwards (e.g., pages that are handed to user space).
+void zeroPage(void *page);
+void copyPage(void *dest, const void *src);
+
 inline void pause() {
 	asm volatile ("pause");
 }
@@ -34,6 +34,11 @@ inline void halt() {
 
 void suspendSelf();
 
+// States of PlatformCpuData::idleMonitor.
+constexpr uint32_t idleMonitorRunning = 0;
+constexpr uint32_t idleMonitorWaiting = 1;
+constexpr uint32_t idleMonitorWakeup = 2;
+
 void sendPingIpi(int id);
 
 } // namespace thor
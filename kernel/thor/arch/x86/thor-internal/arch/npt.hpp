@@ -27,10 +27,13 @@ namespace thor::svm {
 		Error load(uintptr_t guestAddress, size_t len, void *buffer);
 
 		Error map(uint64_t guestAddress, uint64_t hostAddress, int flags);
+		Error map2m(uint64_t guestAddress, uint64_t hostAddress, int flags);
 		PageStatus unmap(uint64_t guestAddress);
 		bool isMapped(VirtualAddr pointer);
 
 	private:
+		// Returns the page directory that covers guestAddress.
+		uint64_t *walkToPd(uint64_t guestAddress, bool allocate);
 		uintptr_t translate(uintptr_t guestAddress);
 		PhysicalAddr spaceRoot;
 		frg::ticket_spinlock _mutex;
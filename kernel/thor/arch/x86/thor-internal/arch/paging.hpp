@@ -16,6 +16,9 @@ enum {
 	kPageShift = 12
 };
 
+// Size of the large pages that can be installed at the PD level.
+constexpr size_t kHugePageSize = 0x200000;
+
 constexpr Word kPfAccess = 1;
 constexpr Word kPfWrite = 2;
 constexpr Word kPfUser = 4;
@@ -164,6 +167,10 @@ struct PageBinding {
 
 	bool isPrimary();
 
+	bool isActive() {
+		return _isActive;
+	}
+
 	void rebind();
 
 	void rebind(smarter::shared_ptr<PageSpace> space);
@@ -183,6 +190,19 @@ private:
 	uint64_t _primaryStamp;
 
 	uint64_t _alreadyShotSequence;
+
+	// Active bindings are currently loaded into CR3 and take part in shootdown IPIs.
+	// Inactive (lazy) bindings do not; instead, they flush their PCID before becoming active
+	// if a shootdown was requested in the meantime.
+	bool _isActive;
+
+	// Shootdowns were acknowledged without actually invalidating the PCID.
+	bool _isStale;
+
+	// Both functions need to be called with the bound space's _mutex unlocked.
+	// _activate() returns true if the PCID needs to be invalidated.
+	bool _activate();
+	void _deactivate();
 };
 
 struct GlobalPageBinding {
@@ -228,6 +248,13 @@ private:
 
 	unsigned int _numBindings;
 
+	// Number of active bindings and the CPUs that they belong to.
+	// Only these CPUs are sent shootdown IPIs. CPUs with index >= 64 are only counted;
+	// if there are any, we fall back to broadcasting the IPI.
+	unsigned int _numActiveBindings;
+	uint64_t _activeCpuMask;
+	unsigned int _numActiveHighCpus;
+
 	uint64_t _shootSequence;
 
 	frg::intrusive_list<
@@ -256,6 +283,8 @@ namespace page_access {
 	static constexpr uint32_t write = 1;
 	static constexpr uint32_t execute = 2;
 	static constexpr uint32_t read = 4;
+	// Hint: map physically contiguous ranges using large pages.
+	static constexpr uint32_t preferHuge = 8;
 }
 
 using PageStatus = uint32_t;
@@ -263,6 +292,7 @@ using PageStatus = uint32_t;
 namespace page_status {
 	static constexpr PageStatus present = 1;
 	static constexpr PageStatus dirty = 2;
+	static constexpr PageStatus accessed = 4;
 };
 
 enum class CachingMode {
@@ -325,11 +355,16 @@ constexpr uint64_t pteWrite = 0x2;
 constexpr uint64_t pteUser = 0x4;
 constexpr uint64_t ptePwt = 0x8;
 constexpr uint64_t ptePcd = 0x10;
+constexpr uint64_t pteAccessed = 0x20;
 constexpr uint64_t pteDirty = 0x40;
 constexpr uint64_t ptePat = 0x80;
 constexpr uint64_t pteGlobal = 0x100;
 constexpr uint64_t pteXd = 0x8000000000000000;
 constexpr uint64_t pteAddress = 0x000FFFFFFFFFF00;
+// Only valid in PDEs.
+constexpr uint64_t pteHuge = 0x80;
+constexpr uint64_t pteHugePat = 0x1000;
+constexpr uint64_t pteHugeAddress = 0x000FFFFFFFE00000;
 
 struct ClientPageSpace : PageSpace {
 public:
@@ -391,9 +426,43 @@ public:
 			moveTo(va_ + kPageSize);
 		}
 
+		void advance2m() {
+			moveTo((va_ & ~(kHugePageSize - 1)) + kHugePageSize);
+		}
+
+		// Whether the current address is covered by a large page.
+		bool isHuge2m() {
+			auto pdPtr = pdEntryPtr();
+			if(!pdPtr)
+				return false;
+			auto pdEnt = __atomic_load_n(pdPtr, __ATOMIC_RELAXED);
+			return (pdEnt & ptePresent) && (pdEnt & pteHuge);
+		}
+
+		// Whether the 2 MiB range around the current address can be mapped by a large page,
+		// i.e., whether no page table is installed for this range.
+		bool canMap2m() {
+			auto pdPtr = pdEntryPtr();
+			if(!pdPtr)
+				return true;
+			auto pdEnt = __atomic_load_n(pdPtr, __ATOMIC_RELAXED);
+			return !(pdEnt & ptePresent) || (pdEnt & pteHuge);
+		}
+
+		// Whether a (small or large) page is mapped at the current address.
+		bool isPresent() {
+			if(!_accessor1)
+				return isHuge2m();
+			auto ptPtr = reinterpret_cast<uint64_t *>(_accessor1.get())
+					+ ((va_ >> 12) & 0x1FF);
+			return __atomic_load_n(ptPtr, __ATOMIC_RELAXED) & ptePresent;
+		}
+
 		bool findPresent(uintptr_t limit) {
 			while(va_ < limit) {
 				if(!_accessor1) {
+					if(isHuge2m())
+						return true;
 					advance4k();
 					continue;
 				}
@@ -410,6 +479,13 @@ public:
 		bool findDirty(uintptr_t limit) {
 			while(va_ < limit) {
 				if(!_accessor1) {
+					if(isHuge2m()) {
+						auto pdEnt = __atomic_load_n(pdEntryPtr(), __ATOMIC_RELAXED);
+						if(pdEnt & pteDirty)
+							return true;
+						advance2m();
+						continue;
+					}
 					advance4k();
 					continue;
 				}
@@ -475,10 +551,15 @@ public:
 			PageStatus status = page_status::present;
 			if(ptEnt & pteDirty)
 				status |= page_status::dirty;
+			if(ptEnt & pteAccessed)
+				status |= page_status::accessed;
 			return status;
 		}
 
 		PageStatus clean4k() {
+			// realizePts() splits large pages.
+			if(!_accessor1 && isHuge2m())
+				realizePts();
 			if(!_accessor1)
 				return 0;
 
@@ -490,10 +571,14 @@ public:
 			PageStatus status = page_status::present;
 			if(ptEnt & pteDirty)
 				status |= page_status::dirty;
+			if(ptEnt & pteAccessed)
+				status |= page_status::accessed;
 			return status;
 		}
 
 		PageStatus unmap4k() {
+			if(!_accessor1 && isHuge2m())
+				realizePts();
 			if(!_accessor1)
 				return 0;
 
@@ -505,10 +590,67 @@ public:
 			PageStatus status = page_status::present;
 			if(ptEnt & pteDirty)
 				status |= page_status::dirty;
+			if(ptEnt & pteAccessed)
+				status |= page_status::accessed;
+			return status;
+		}
+
+		// Maps a large page at the current (2 MiB aligned) address.
+		// The caller must ensure that canMap2m() returns true.
+		PageStatus remap2m(PhysicalAddr pa, PageFlags flags, CachingMode cachingMode) {
+			assert(!(va_ & (kHugePageSize - 1)));
+			assert(!(pa & (kHugePageSize - 1)));
+			if(!_accessor2)
+				realizePds();
+
+			auto pdPtr = pdEntryPtr();
+			auto pdEnt = pa | ptePresent | pteUser | pteHuge;
+			if(flags & page_access::write)
+				pdEnt |= pteWrite;
+			if(!(flags & page_access::execute))
+				pdEnt |= pteXd;
+			if(cachingMode == CachingMode::writeThrough) {
+				pdEnt |= ptePwt;
+			}else if(cachingMode == CachingMode::writeCombine) {
+				pdEnt |= pteHugePat | ptePwt;
+			}else if(cachingMode == CachingMode::uncached) {
+				pdEnt |= ptePcd;
+			}else{
+				assert(cachingMode == CachingMode::null || cachingMode == CachingMode::writeBack);
+			}
+			pdEnt = __atomic_exchange_n(pdPtr, pdEnt, __ATOMIC_RELAXED);
+			assert(!(pdEnt & ptePresent) || (pdEnt & pteHuge));
+			if(!(pdEnt & ptePresent))
+				return 0;
+			PageStatus status = page_status::present;
+			if(pdEnt & pteDirty)
+				status |= page_status::dirty;
+			if(pdEnt & pteAccessed)
+				status |= page_status::accessed;
+			return status;
+		}
+
+		PageStatus unmap2m() {
+			assert(!(va_ & (kHugePageSize - 1)));
+			assert(isHuge2m());
+
+			auto pdEnt = __atomic_exchange_n(pdEntryPtr(), 0, __ATOMIC_RELAXED);
+			PageStatus status = page_status::present;
+			if(pdEnt & pteDirty)
+				status |= page_status::dirty;
+			if(pdEnt & pteAccessed)
+				status |= page_status::accessed;
 			return status;
 		}
 
 	private:
+		uint64_t *pdEntryPtr() {
+			if(!_accessor2)
+				return nullptr;
+			return reinterpret_cast<uint64_t *>(_accessor2.get())
+					+ ((va_ >> 21) & 0x1FF);
+		}
+
 		void accessPts() {
 			auto doReload = [&] <int S> (PageAccessor &subPt, PageAccessor &pt,
 					std::integral_constant<int, S>) -> bool {
@@ -517,6 +659,9 @@ public:
 				auto ptEnt = __atomic_load_n(ptPtr, __ATOMIC_ACQUIRE);
 				if(!(ptEnt & ptePresent))
 					return false;
+				// Large pages do not reference a lower level PT.
+				if(S == 21 && (ptEnt & pteHuge))
+					return false;
 				subPt = PageAccessor{ptEnt & pteAddress};
 				return true;
 			};
@@ -542,6 +687,7 @@ public:
 		}
 
 		void realizePts();
+		void realizePds();
 
 		ClientPageSpace *space_;
 
@@ -74,6 +74,9 @@ private:
 	frg::ticket_spinlock _mutex;
 
 	uint64_t _globalDeadline;
+	// Only this CPU programs its local timer for the global deadline (i.e., the CPU that
+	// armed the global alarm most recently). Other CPUs do not take timer IRQs for it.
+	LocalApicContext *_globalOwner = nullptr;
 };
 
 struct LocalApicContext {
@@ -86,10 +89,15 @@ struct LocalApicContext {
 
 	static void handleTimerIrq();
 
+	// Returns the deadline that the local timer is programmed for (zero if it is stopped).
+	static uint64_t nextDeadline();
+
 	bool useTscMode = false;
 	bool timersAreCalibrated = false;
 	uint32_t localTicksPerMilli = 0;
 	uint64_t tscTicksPerMilli = 0;
+	// Fixed-point factor (40 fractional bits) that converts nanoseconds to TSC ticks.
+	uint64_t nanosToTscFactor = 0;
 
 private:
 	static void _updateLocalTimer();
@@ -97,6 +105,8 @@ private:
 private:
 	uint64_t _preemptionDeadline;
 	uint64_t _globalDeadline;
+	// Deadline that is currently programmed into the timer (zero if the timer is stopped).
+	uint64_t _programmedDeadline;
 };
 
 GlobalApicContext *globalApicContext();
@@ -120,6 +130,7 @@ void raiseInitDeassertIpi(uint32_t dest_apic_id);
 void raiseStartupIpi(uint32_t dest_apic_id, uint32_t page);
 
 void sendShootdownIpi();
+void sendShootdownIpi(int id);
 void sendGlobalNmi();
 
 // --------------------------------------------------------
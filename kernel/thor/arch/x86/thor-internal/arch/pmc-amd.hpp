@@ -1,8 +1,14 @@
 #pragma once
 
+#include <stdint.h>
+
 namespace thor {
 
 void setAmdPmc();
 bool checkAmdPmcOverflow();
 
+bool amdThreadPmcSupports(uint32_t events);
+void startAmdThreadPmc(uint32_t events);
+void stopAmdThreadPmc(uint32_t events, uint64_t *values);
+
 } // namespace thor
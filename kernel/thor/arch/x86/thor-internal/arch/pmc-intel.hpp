@@ -1,9 +1,15 @@
 #pragma once
 
+#include <stdint.h>
+
 namespace thor {
 
 void initializeIntelPmc();
 void setIntelPmc();
 bool checkIntelPmcOverflow();
 
+bool intelThreadPmcSupports(uint32_t events);
+void startIntelThreadPmc(uint32_t events);
+void stopIntelThreadPmc(uint32_t events, uint64_t *values);
+
 } // namespace thor
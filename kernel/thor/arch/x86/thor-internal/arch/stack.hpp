@@ -16,4 +16,23 @@ inline void walkThisStack(F functor) {
 	}
 }
 
+// Walks a frame pointer chain that does not belong to the current context.
+// Only frames within [low, high) are visited; this prevents us from following
+// garbage pointers (e.g., in contexts that cannot tolerate page faults).
+// The functor returns false to stop the walk.
+template <typename F>
+inline void walkStackWithin(uintptr_t bp, uintptr_t low, uintptr_t high, F functor) {
+	if(low < 0xffff800000000000)
+		return;
+	while(bp >= low && bp < high - 2 * sizeof(uintptr_t) && !(bp & (sizeof(uintptr_t) - 1))) {
+		auto frame = reinterpret_cast<uintptr_t *>(bp);
+		if(!functor(frame[1]))
+			return;
+		// Frames must grow towards the top of the stack.
+		if(frame[0] <= bp)
+			return;
+		bp = frame[0];
+	}
+}
+
 } // namespace thor
@@ -2,6 +2,7 @@
 
 #include "../../../hel/include/hel.h"
 #include <thor-internal/arch/npt.hpp>
+#include <thor-internal/arch/vm-exits.hpp>
 #include <thor-internal/virtualization.hpp>
 
 namespace thor::svm {
@@ -195,7 +196,9 @@ namespace thor::svm {
 	};
 
 	enum {
+		kSvmExitCpuid = 0x72,
 		kSvmExitHlt = 0x78,
+		kSvmExitMsr = 0x7C,
 		kSvmExitNPTFault = 0x400,
 	};
 
@@ -209,6 +212,8 @@ namespace thor::svm {
 		HelVmexitReason run();
 		void storeRegs(const HelX86VirtualizationRegs *regs);
 		void loadRegs(HelX86VirtualizationRegs *res);
+		void storeControl(const HelX86VirtualizationControl *control);
+		void loadControl(HelX86VirtualizationControl *control);
 
 		PhysicalAddr vmcb_region, host_additional_save_region, iopm_bitmap, msrpm_bitmap;
 		volatile Vmcb *vmcb;
@@ -217,5 +222,7 @@ namespace thor::svm {
 		uint8_t *host_fpu_state, *guest_fpu_state;
 
 		smarter::shared_ptr<NptSpace> space;
+
+		InKernelExits inKernelExits;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <frg/array.hpp>
+#include <hel.h>
+
+namespace thor {
+
+// Emulation of VM exits that are cheap enough to handle without returning to the VMM.
+// This is shared between VMX and SVM; the vendor code only decodes the exit
+// and applies the results to the guest state.
+struct InKernelExits {
+	// Mask of kHelVmexitHandle* flags.
+	uint32_t handled = 0;
+
+	bool handles(uint32_t flag) const {
+		return handled & flag;
+	}
+
+	// Returns the CPUID leaf as seen by the guest.
+	frg::array<uint32_t, 4> cpuid(uint32_t leaf, uint32_t subleaf, uint64_t guestCr4);
+
+	// Both functions return false if the MSR is not handled in the kernel.
+	bool readMsr(uint32_t index, uint64_t &value);
+	bool writeMsr(uint32_t index, uint64_t value);
+
+	// Returns the vector of the pending APIC timer interrupt or -1 if there is none.
+	int pendingInterrupt();
+	// Must be called after the pending interrupt was injected into the guest.
+	void acknowledgeInterrupt();
+
+private:
+	void armTimer_(uint64_t count);
+
+	uint64_t apicBase_ = 0xFEE0'0000 | (1 << 11) | (1 << 8); // Enabled, BSP.
+	uint64_t miscEnable_ = 1; // Fast strings.
+	uint64_t mtrrDefType_ = 0;
+
+	// x2APIC timer state. Deadlines are in TSC ticks; zero means disarmed.
+	uint32_t lvtTimer_ = 1 << 16; // Masked.
+	uint32_t divideConfig_ = 0;
+	uint32_t initialCount_ = 0;
+	uint64_t deadline_ = 0;
+	uint64_t period_ = 0;
+};
+
+} // namespace thor
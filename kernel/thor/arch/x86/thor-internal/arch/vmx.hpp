@@ -2,6 +2,7 @@
 
 #include <hel.h>
 #include <thor-internal/arch/ept.hpp>
+#include <thor-internal/arch/vm-exits.hpp>
 #include <thor-internal/virtualization.hpp>
 
 namespace thor::vmx {
@@ -114,6 +115,8 @@ namespace thor::vmx {
 	constexpr uint64_t GUEST_INTR_STATUS                 = 0x00000810;
 	constexpr uint64_t GUEST_PML_INDEX                   = 0x00000812;
 	constexpr uint64_t VM_EXIT_REASON                    = 0x00004402;
+	constexpr uint64_t VM_EXIT_INSTRUCTION_LENGTH        = 0x0000440C;
+	constexpr uint64_t VM_ENTRY_INTERRUPTION_INFO        = 0x00004016;
 	constexpr uint64_t VM_INSTRUCTION_ERROR              = 0x00004400;
 	constexpr uint64_t EPT_VIOLATION_ADDRESS             = 0x00002400;
 	constexpr uint64_t EPT_VIOLATION_FLAGS               = 0x00006400;
@@ -124,7 +127,10 @@ namespace thor::vmx {
 	constexpr uint64_t TR_ACCESS_RIGHT   = (0x3 | 1 << 7);
 
 	constexpr uint64_t VMEXIT_EXTERNAL_INTERRUPT           = 1;
+	constexpr uint64_t VMEXIT_CPUID                        = 10;
 	constexpr uint64_t VMEXIT_HLT                          = 12;
+	constexpr uint64_t VMEXIT_RDMSR                        = 31;
+	constexpr uint64_t VMEXIT_WRMSR                        = 32;
 	constexpr uint64_t VMEXIT_EPT_VIOLATION                = 48;
 
 	constexpr uint64_t VMEXIT_CONTROLS_LONG_MODE      = 1 << 9;
@@ -149,6 +155,8 @@ namespace thor::vmx {
 		HelVmexitReason run();
 		void storeRegs(const HelX86VirtualizationRegs *regs);
 		void loadRegs(HelX86VirtualizationRegs *res);
+		void storeControl(const HelX86VirtualizationControl *control);
+		void loadControl(HelX86VirtualizationControl *control);
 		
 		void *region;
 		uint8_t* hostFstate;
@@ -158,5 +166,7 @@ namespace thor::vmx {
 
 		GuestState state;
 		uint64_t saved_host_rsp;
+
+		InKernelExits inKernelExits;
 	};
 }
@@ -0,0 +1,216 @@
+#include <string.h>
+
+#include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/arch/vm-exits.hpp>
+#include <x86/machine.hpp>
+
+namespace thor {
+
+namespace {
+	constexpr uint32_t kMsrTsc = 0x10;
+	constexpr uint32_t kMsrBiosSignId = 0x8B;
+	constexpr uint32_t kMsrMtrrCap = 0xFE;
+	constexpr uint32_t kMsrMiscEnable = 0x1A0;
+	constexpr uint32_t kMsrMtrrDefType = 0x2FF;
+
+	constexpr uint32_t kMsrX2ApicEoi = 0x80B;
+	constexpr uint32_t kMsrX2ApicLvtTimer = 0x832;
+	constexpr uint32_t kMsrX2ApicInitialCount = 0x838;
+	constexpr uint32_t kMsrX2ApicCurrentCount = 0x839;
+	constexpr uint32_t kMsrX2ApicDivideConfig = 0x83E;
+
+	constexpr uint32_t kLvtMasked = 1 << 16;
+	constexpr uint32_t kTimerPeriodic = 1;
+	constexpr uint32_t kTimerTscDeadline = 2;
+
+	constexpr uint32_t timerMode(uint32_t lvt) {
+		return (lvt >> 17) & 3;
+	}
+
+	constexpr uint64_t timerDivisor(uint32_t config) {
+		auto value = ((config & 8) >> 1) | (config & 3);
+		if(value == 7)
+			return 1;
+		return uint64_t{2} << value;
+	}
+}
+
+frg::array<uint32_t, 4> InKernelExits::cpuid(uint32_t leaf, uint32_t subleaf,
+		uint64_t guestCr4) {
+	if(leaf >= 0x4000'0000 && leaf < 0x5000'0000) {
+		if(leaf != 0x4000'0000)
+			return {0, 0, 0, 0};
+		frg::array<uint32_t, 4> out{0x4000'0000, 0, 0, 0};
+		memcpy(&out[1], "ManagarmThor", 12);
+		return out;
+	}
+
+	auto out = common::x86::cpuid(leaf, subleaf);
+	switch(leaf) {
+	case 1:
+		out[1] &= 0x00FF'FFFF; // APIC ID 0.
+		out[2] &= ~(uint32_t{1} << 3); // MONITOR/MWAIT.
+		out[2] &= ~(uint32_t{1} << 5); // VMX.
+		if(handles(kHelVmexitHandleApicTimer))
+			out[2] |= uint32_t{1} << 21; // x2APIC.
+		if(guestCr4 & (1 << 18)) {
+			out[2] |= uint32_t{1} << 27; // OSXSAVE.
+		}else{
+			out[2] &= ~(uint32_t{1} << 27);
+		}
+		out[2] |= uint32_t{1} << 31; // Running under a hypervisor.
+		break;
+	case 0xA: // Performance monitoring is not virtualized.
+		out = {0, 0, 0, 0};
+		break;
+	case 0xB:
+	case 0x1F:
+		out[3] = 0; // x2APIC ID 0.
+		break;
+	case 0x8000'0001:
+		out[2] &= ~(uint32_t{1} << 2); // SVM.
+		break;
+	}
+	return out;
+}
+
+bool InKernelExits::readMsr(uint32_t index, uint64_t &value) {
+	if(handles(kHelVmexitHandleMsr)) {
+		switch(index) {
+		case kMsrTsc:
+			value = getRawTimestampCounter();
+			return true;
+		case common::x86::kMsrLocalApicBase:
+			value = apicBase_;
+			return true;
+		case kMsrBiosSignId:
+		case kMsrMtrrCap: // No MTRRs.
+			value = 0;
+			return true;
+		case kMsrMiscEnable:
+			value = miscEnable_;
+			return true;
+		case kMsrMtrrDefType:
+			value = mtrrDefType_;
+			return true;
+		}
+	}
+
+	if(handles(kHelVmexitHandleApicTimer)) {
+		switch(index) {
+		case kMsrX2ApicLvtTimer:
+			value = lvtTimer_;
+			return true;
+		case kMsrX2ApicInitialCount:
+			value = initialCount_;
+			return true;
+		case kMsrX2ApicCurrentCount: {
+			value = 0;
+			auto now = getRawTimestampCounter();
+			if(timerMode(lvtTimer_) != kTimerTscDeadline && deadline_ > now)
+				value = (deadline_ - now) / timerDivisor(divideConfig_);
+			return true;
+		}
+		case kMsrX2ApicDivideConfig:
+			value = divideConfig_;
+			return true;
+		case common::x86::kMsrIa32TscDeadline:
+			value = 0;
+			if(timerMode(lvtTimer_) == kTimerTscDeadline)
+				value = deadline_;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool InKernelExits::writeMsr(uint32_t index, uint64_t value) {
+	if(handles(kHelVmexitHandleMsr)) {
+		switch(index) {
+		case common::x86::kMsrLocalApicBase:
+			apicBase_ = value;
+			return true;
+		case kMsrBiosSignId:
+			return true;
+		case kMsrMiscEnable:
+			miscEnable_ = value;
+			return true;
+		case kMsrMtrrDefType:
+			mtrrDefType_ = value;
+			return true;
+		}
+	}
+
+	if(handles(kHelVmexitHandleApicTimer)) {
+		switch(index) {
+		case kMsrX2ApicEoi:
+			// The timer is the only in-kernel interrupt source; there is no ISR to track.
+			return true;
+		case kMsrX2ApicLvtTimer:
+			// Like on real hardware, switching the mode disarms the timer.
+			if(timerMode(value) != timerMode(lvtTimer_)) {
+				initialCount_ = 0;
+				deadline_ = 0;
+				period_ = 0;
+			}
+			lvtTimer_ = value & (0xFF | kLvtMasked | (3 << 17));
+			return true;
+		case kMsrX2ApicInitialCount:
+			if(timerMode(lvtTimer_) != kTimerTscDeadline)
+				armTimer_(static_cast<uint32_t>(value));
+			return true;
+		case kMsrX2ApicDivideConfig:
+			divideConfig_ = value & 0xB;
+			return true;
+		case common::x86::kMsrIa32TscDeadline:
+			if(timerMode(lvtTimer_) == kTimerTscDeadline) {
+				deadline_ = value;
+				period_ = 0;
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+int InKernelExits::pendingInterrupt() {
+	if(!handles(kHelVmexitHandleApicTimer) || !deadline_)
+		return -1;
+	if(getRawTimestampCounter() < deadline_)
+		return -1;
+
+	// Masked interrupts are discarded but the timer keeps running.
+	if((lvtTimer_ & kLvtMasked) || (lvtTimer_ & 0xFF) < 16) {
+		acknowledgeInterrupt();
+		return -1;
+	}
+	return lvtTimer_ & 0xFF;
+}
+
+void InKernelExits::acknowledgeInterrupt() {
+	if(timerMode(lvtTimer_) != kTimerPeriodic || !period_) {
+		deadline_ = 0;
+		return;
+	}
+
+	// Do not try to catch up on missed periods; this would only cause interrupt storms.
+	auto now = getRawTimestampCounter();
+	deadline_ += period_;
+	if(deadline_ <= now)
+		deadline_ = now + period_;
+}
+
+void InKernelExits::armTimer_(uint64_t count) {
+	initialCount_ = count;
+	if(!count) {
+		deadline_ = 0;
+		period_ = 0;
+		return;
+	}
+	period_ = count * timerDivisor(divideConfig_);
+	deadline_ = getRawTimestampCounter() + period_;
+}
+
+} // namespace thor
@@ -314,6 +314,7 @@ namespace thor::vmx {
 		vmclear((PhysicalAddr)region);
 
 		HelVmexitReason exitInfo{};
+		uint64_t msrValue;
 
 		bool launched = false;
 		while(1) {
@@ -326,6 +327,16 @@ namespace thor::vmx {
 			 */
 			asm volatile("cli");
 			vmptrld((PhysicalAddr)region);
+
+			// Inject the pending in-kernel interrupt if the guest can take it.
+			// Otherwise, we retry on the next exit.
+			if(auto vector = inKernelExits.pendingInterrupt(); vector >= 0
+					&& (vmread(GUEST_RFLAG) & (1 << 9))
+					&& !(vmread(GUEST_INTERRUPTIBILITY_STATE) & 3)) {
+				vmwrite(VM_ENTRY_INTERRUPTION_INFO, vector | (1u << 31));
+				inKernelExits.acknowledgeInterrupt();
+			}
+
 			if(getGlobalCpuFeatures()->haveXsave){
 				common::x86::xsave((uint8_t*)hostFstate, ~0);
 				common::x86::xrstor((uint8_t*)guestFstate, ~0);
@@ -359,8 +370,36 @@ namespace thor::vmx {
 				return exitInfo;
 			}
 
+			// Resumes the guest after the instruction that caused the exit.
+			auto skipInstruction = [] {
+				vmwrite(GUEST_RIP, vmread(GUEST_RIP) + vmread(VM_EXIT_INSTRUCTION_LENGTH));
+				vmwrite(GUEST_INTERRUPTIBILITY_STATE, vmread(GUEST_INTERRUPTIBILITY_STATE) & ~3);
+			};
+
 			auto reason = vmread(VM_EXIT_REASON);
-			if(reason == VMEXIT_HLT) {
+			if(reason == VMEXIT_HLT
+					&& inKernelExits.handles(kHelVmexitHandleHlt)
+					&& (vmread(GUEST_RFLAG) & (1 << 9))
+					&& inKernelExits.pendingInterrupt() >= 0) {
+				// The interrupt is injected on the next entry.
+				skipInstruction();
+			} else if(reason == VMEXIT_CPUID && inKernelExits.handles(kHelVmexitHandleCpuid)) {
+				auto out = inKernelExits.cpuid(state.rax, state.rcx, vmread(GUEST_CR4));
+				state.rax = out[0];
+				state.rbx = out[1];
+				state.rcx = out[2];
+				state.rdx = out[3];
+				skipInstruction();
+			} else if(reason == VMEXIT_RDMSR
+					&& inKernelExits.readMsr(state.rcx, msrValue)) {
+				state.rax = msrValue & 0xFFFF'FFFF;
+				state.rdx = msrValue >> 32;
+				skipInstruction();
+			} else if(reason == VMEXIT_WRMSR
+					&& inKernelExits.writeMsr(state.rcx,
+							(state.rax & 0xFFFF'FFFF) | (state.rdx << 32))) {
+				skipInstruction();
+			} else if(reason == VMEXIT_HLT) {
 				infoLogger() << "vmx: hlt" << frg::endlog;
 				exitInfo.exitReason = kHelVmexitHlt;
 				return exitInfo;
@@ -479,6 +518,14 @@ namespace thor::vmx {
 		regs->efer = vmread(VMCS_FIELD_GUEST_EFER_FULL);
 	}
 
+	void Vmcs::storeControl(const HelX86VirtualizationControl *control) {
+		inKernelExits.handled = control->handledExits;
+	}
+
+	void Vmcs::loadControl(HelX86VirtualizationControl *control) {
+		control->handledExits = inKernelExits.handled;
+	}
+
 	Vmcs::~Vmcs() {
 		physicalAllocator->free((size_t)region, kPageSize);
 	}
@@ -0,0 +1,688 @@
+#include <string.h>
+
+#include <arch/mem_space.hpp>
+#include <arch/register.hpp>
+#include <frg/vector.hpp>
+#include <uacpi/acpi.h>
+#include <uacpi/tables.h>
+#include <thor-internal/acpi/acpi.hpp>
+#include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/arch/paging.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/dma-space.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/pci/pci.hpp>
+#include <thor-internal/physical.hpp>
+
+// Driver for Intel VT-d DMA remapping units.
+// By default, all devices are put into pass-through mode, i.e., their DMA accesses
+// are not translated. Devices are only moved into a translated domain once their
+// driver requests a DMA space.
+
+namespace thor {
+
+namespace {
+
+// --------------------------------------------------------
+// DMAR table.
+// --------------------------------------------------------
+
+// Note: like the MADT, the DMAR is not guaranteed to be aligned.
+
+struct [[gnu::packed]] DmarHeader {
+	uint8_t hostAddressWidth;
+	uint8_t flags;
+	uint8_t reserved[10];
+};
+
+struct [[gnu::packed]] DmarGenericEntry {
+	uint16_t type;
+	uint16_t length;
+};
+
+struct [[gnu::packed]] DmarDrhdEntry {
+	DmarGenericEntry generic;
+	uint8_t flags;
+	uint8_t size;
+	uint16_t segment;
+	uint64_t registerBase;
+};
+
+struct [[gnu::packed]] DmarRmrrEntry {
+	DmarGenericEntry generic;
+	uint16_t reserved;
+	uint16_t segment;
+	uint64_t baseAddress;
+	uint64_t limitAddress;
+};
+
+struct [[gnu::packed]] DmarDeviceScope {
+	uint8_t type;
+	uint8_t length;
+	uint16_t reserved;
+	uint8_t enumerationId;
+	uint8_t startBus;
+	// Followed by (device, function) pairs.
+};
+
+namespace drhd_flags {
+	static constexpr uint8_t includePciAll = 1;
+};
+
+namespace scope_types {
+	static constexpr uint8_t endpoint = 1;
+	static constexpr uint8_t subHierarchy = 2;
+};
+
+// Decoded device scope. The path is resolved on each use since bus numbers
+// of bridges are only known after PCI enumeration.
+struct DeviceScope {
+	static constexpr int maxPath = 8;
+
+	uint8_t type;
+	uint8_t startBus;
+	int pathLength;
+	uint8_t path[maxPath][2];
+};
+
+// Region that firmware expects to stay accessible by DMA (e.g., for USB legacy emulation).
+struct ReservedRegion {
+	PhysicalAddr base;
+	PhysicalAddr limit;
+	DeviceScope scope;
+};
+
+// Resolves a scope to the bus, slot and function of the device it refers to.
+void resolveScope(uint32_t seg, const DeviceScope &scope,
+		uint32_t &bus, uint32_t &slot, uint32_t &function) {
+	bus = scope.startBus;
+	for(int i = 0; i < scope.pathLength; i++) {
+		slot = scope.path[i][0];
+		function = scope.path[i][1];
+		if(i + 1 < scope.pathLength)
+			bus = pci::readConfigByte(seg, bus, slot, function, pci::kPciBridgeSecondary);
+	}
+}
+
+bool scopeContains(uint32_t seg, const DeviceScope &scope,
+		uint32_t bus, uint32_t slot, uint32_t function) {
+	if(!scope.pathLength)
+		return false;
+
+	uint32_t scopeBus, scopeSlot, scopeFunction;
+	resolveScope(seg, scope, scopeBus, scopeSlot, scopeFunction);
+	if(scopeBus == bus && scopeSlot == slot && scopeFunction == function)
+		return true;
+	if(scope.type != scope_types::subHierarchy)
+		return false;
+
+	auto secondary = pci::readConfigByte(seg, scopeBus, scopeSlot, scopeFunction,
+			pci::kPciBridgeSecondary);
+	auto subordinate = pci::readConfigByte(seg, scopeBus, scopeSlot, scopeFunction,
+			pci::kPciBridgeSubordinate);
+	return bus >= secondary && bus <= subordinate;
+}
+
+// Returns the offset of the next scope or 0 if the scope is malformed.
+size_t parseScope(const DmarDeviceScope *raw, size_t available, DeviceScope &scope) {
+	if(available < sizeof(DmarDeviceScope) || raw->length < sizeof(DmarDeviceScope)
+			|| raw->length > available)
+		return 0;
+
+	scope.type = raw->type;
+	scope.startBus = raw->startBus;
+	scope.pathLength = frg::min<int>((raw->length - sizeof(DmarDeviceScope)) / 2,
+			DeviceScope::maxPath);
+	auto path = reinterpret_cast<const uint8_t *>(raw) + sizeof(DmarDeviceScope);
+	for(int i = 0; i < scope.pathLength; i++) {
+		scope.path[i][0] = path[2 * i];
+		scope.path[i][1] = path[2 * i + 1];
+	}
+	return raw->length;
+}
+
+// --------------------------------------------------------
+// Registers.
+// --------------------------------------------------------
+
+inline constexpr arch::bit_register<uint64_t> capRegister{0x08};
+inline constexpr arch::bit_register<uint64_t> ecapRegister{0x10};
+inline constexpr arch::scalar_register<uint32_t> gcmdRegister{0x18};
+inline constexpr arch::scalar_register<uint32_t> gstsRegister{0x1C};
+inline constexpr arch::scalar_register<uint64_t> rtaddrRegister{0x20};
+inline constexpr arch::scalar_register<uint32_t> fstsRegister{0x34};
+inline constexpr arch::scalar_register<uint64_t> iqtRegister{0x88};
+inline constexpr arch::scalar_register<uint64_t> iqaRegister{0x90};
+
+namespace cap_bits {
+	inline constexpr arch::field<uint64_t, unsigned int> numDomains{0, 3};
+	inline constexpr arch::field<uint64_t, bool> writeBufferFlush{4, 1};
+	inline constexpr arch::field<uint64_t, bool> cachingMode{7, 1};
+	inline constexpr arch::field<uint64_t, unsigned int> sagaw{8, 5};
+};
+
+namespace ecap_bits {
+	inline constexpr arch::field<uint64_t, bool> coherent{0, 1};
+	inline constexpr arch::field<uint64_t, bool> queuedInvalidation{1, 1};
+	inline constexpr arch::field<uint64_t, bool> passThrough{6, 1};
+};
+
+// Bits of the GCMD and GSTS registers.
+constexpr uint32_t globalTranslation = uint32_t{1} << 31;
+constexpr uint32_t globalRootTable = uint32_t{1} << 30;
+constexpr uint32_t globalWriteBufferFlush = uint32_t{1} << 27;
+constexpr uint32_t globalQueuedInvalidation = uint32_t{1} << 26;
+// GSTS bits that correspond to persistent settings (i.e., not to one-shot commands).
+constexpr uint32_t globalPersistentMask = 0x96FF'FFFF;
+
+constexpr uint32_t faultQueueError = uint32_t{1} << 4;
+
+// Root, context and second-level page table entries.
+constexpr uint64_t entryPresent = 1;
+constexpr uint64_t entryAddress = 0x000F'FFFF'FFFF'F000;
+constexpr uint64_t contextPassThrough = uint64_t{2} << 2;
+constexpr uint64_t slRead = 1;
+constexpr uint64_t slWrite = 2;
+
+// Invalidation descriptors.
+constexpr uint64_t invContextGlobal = 0x1 | (uint64_t{1} << 4);
+constexpr uint64_t invIotlbGlobal = 0x2 | (uint64_t{1} << 4) | (uint64_t{3} << 6);
+constexpr uint64_t invIotlbDomain = 0x2 | (uint64_t{2} << 4) | (uint64_t{3} << 6);
+constexpr uint64_t invWait = 0x5 | (uint64_t{1} << 5);
+
+// Domain ID that is used for all devices in pass-through mode.
+constexpr uint16_t passThroughDomain = 1;
+
+struct VtdUnit;
+
+struct VtdDomain final : IommuDomain {
+	VtdDomain(VtdUnit *unit, uint16_t id, int levels, PhysicalAddr root)
+	: unit_{unit}, id_{id}, levels_{levels}, root_{root} { }
+
+	uint16_t id() {
+		return id_;
+	}
+
+	PhysicalAddr root() {
+		return root_;
+	}
+
+	bool isMapped(uintptr_t ioAddress) override;
+	void mapPage(uintptr_t ioAddress, PhysicalAddr physical, DmaFlags flags) override;
+	void unmapPage(uintptr_t ioAddress) override;
+	void flush() override;
+
+	uintptr_t ioAddressLimit() override {
+		return uintptr_t{1} << (12 + 9 * levels_);
+	}
+
+private:
+	// Returns the last-level table that translates ioAddress.
+	PhysicalAddr leafTable_(uintptr_t ioAddress, bool allocate);
+
+	VtdUnit *unit_;
+	uint16_t id_;
+	int levels_;
+	PhysicalAddr root_;
+
+	bool pendingMaps_ = false;
+	bool pendingUnmaps_ = false;
+};
+
+struct VtdUnit final : Iommu {
+	VtdUnit(uint16_t segment, PhysicalAddr base, int addressBits, bool includeAll)
+	: segment_{segment}, base_{base}, addressBits_{addressBits}, includeAll_{includeAll} { }
+
+	bool initialize();
+
+	bool translatesPciDevice(uint32_t seg, uint32_t bus, uint32_t slot,
+			uint32_t function) override;
+
+	smarter::shared_ptr<IommuDomain> createPciDomain(uint32_t seg, uint32_t bus,
+			uint32_t slot, uint32_t function) override;
+
+	PhysicalAddr allocateTable();
+	void flushCacheLines(const void *pointer, size_t size);
+
+	void flushWriteBuffer();
+	void invalidateDomain(uint16_t id);
+
+	uint16_t segment() {
+		return segment_;
+	}
+
+	bool cachingMode() {
+		return cachingMode_;
+	}
+
+	frg::vector<DeviceScope, KernelAlloc> scopes{*kernelAlloc};
+	frg::vector<ReservedRegion, KernelAlloc> reservedRegions{*kernelAlloc};
+
+private:
+	void command_(uint32_t bit, bool enable);
+
+	// Appends a descriptor to the invalidation queue.
+	void queueDescriptor_(uint64_t low, uint64_t high);
+	// Submits all queued descriptors and waits until they are completed.
+	void submitAndWait_();
+
+	frg::ticket_spinlock mutex_;
+
+	uint16_t segment_;
+	PhysicalAddr base_;
+	int addressBits_;
+	bool includeAll_;
+
+	arch::mem_space space_;
+	bool coherent_ = false;
+	bool cachingMode_ = false;
+	bool writeBufferFlush_ = false;
+	int levels_ = 0;
+	uint64_t addressWidth_ = 0;
+	unsigned int maxDomains_ = 0;
+	uint16_t nextDomain_ = passThroughDomain + 1;
+
+	PhysicalAddr rootTable_ = PhysicalAddr(-1);
+	PhysicalAddr passThroughContext_ = PhysicalAddr(-1);
+	// Context table of each bus. Initially, all buses share passThroughContext_.
+	PhysicalAddr contextTables_[256];
+
+	static constexpr unsigned int queueSize = kPageSize / 16;
+	PhysicalAddr queue_ = PhysicalAddr(-1);
+	unsigned int queueTail_ = 0;
+	PhysicalAddr statusPage_ = PhysicalAddr(-1);
+	uint32_t statusSequence_ = 0;
+};
+
+// --------------------------------------------------------
+// VtdDomain.
+// --------------------------------------------------------
+
+PhysicalAddr VtdDomain::leafTable_(uintptr_t ioAddress, bool allocate) {
+	auto table = root_;
+	for(int level = levels_ - 1; level > 0; level--) {
+		PageAccessor accessor{table};
+		auto entries = reinterpret_cast<uint64_t *>(accessor.get());
+		auto index = (ioAddress >> (12 + 9 * level)) & 0x1FF;
+		if(!(entries[index] & (slRead | slWrite))) {
+			if(!allocate)
+				return PhysicalAddr(-1);
+			entries[index] = unit_->allocateTable() | slRead | slWrite;
+			unit_->flushCacheLines(&entries[index], sizeof(uint64_t));
+		}
+		table = entries[index] & entryAddress;
+	}
+	return table;
+}
+
+bool VtdDomain::isMapped(uintptr_t ioAddress) {
+	auto table = leafTable_(ioAddress, false);
+	if(table == PhysicalAddr(-1))
+		return false;
+	PageAccessor accessor{table};
+	auto entries = reinterpret_cast<uint64_t *>(accessor.get());
+	return entries[(ioAddress >> 12) & 0x1FF] & (slRead | slWrite);
+}
+
+void VtdDomain::mapPage(uintptr_t ioAddress, PhysicalAddr physical, DmaFlags flags) {
+	PageAccessor accessor{leafTable_(ioAddress, true)};
+	auto entries = reinterpret_cast<uint64_t *>(accessor.get());
+	auto entry = &entries[(ioAddress >> 12) & 0x1FF];
+	assert(!(*entry & (slRead | slWrite)));
+
+	uint64_t bits = physical & entryAddress;
+	if(flags & dmaRead)
+		bits |= slRead;
+	if(flags & dmaWrite)
+		bits |= slWrite;
+	__atomic_store_n(entry, bits, __ATOMIC_RELAXED);
+	unit_->flushCacheLines(entry, sizeof(uint64_t));
+	pendingMaps_ = true;
+}
+
+void VtdDomain::unmapPage(uintptr_t ioAddress) {
+	auto table = leafTable_(ioAddress, false);
+	assert(table != PhysicalAddr(-1));
+	PageAccessor accessor{table};
+	auto entries = reinterpret_cast<uint64_t *>(accessor.get());
+	auto entry = &entries[(ioAddress >> 12) & 0x1FF];
+	__atomic_store_n(entry, 0, __ATOMIC_RELAXED);
+	unit_->flushCacheLines(entry, sizeof(uint64_t));
+	pendingUnmaps_ = true;
+}
+
+void VtdDomain::flush() {
+	// Without caching mode, not-present entries are never cached;
+	// hence, new mappings do not require IOTLB invalidation.
+	if(pendingUnmaps_ || (pendingMaps_ && unit_->cachingMode())) {
+		unit_->invalidateDomain(id_);
+	}else if(pendingMaps_) {
+		unit_->flushWriteBuffer();
+	}
+	pendingMaps_ = false;
+	pendingUnmaps_ = false;
+}
+
+// --------------------------------------------------------
+// VtdUnit.
+// --------------------------------------------------------
+
+PhysicalAddr VtdUnit::allocateTable() {
+	auto physical = physicalAllocator->allocate(kPageSize, addressBits_);
+	assert(physical != PhysicalAddr(-1) && "OOM in VT-d driver");
+	PageAccessor accessor{physical};
+	memset(accessor.get(), 0, kPageSize);
+	flushCacheLines(accessor.get(), kPageSize);
+	return physical;
+}
+
+void VtdUnit::flushCacheLines(const void *pointer, size_t size) {
+	// If the unit does not snoop caches, it might not see our writes otherwise.
+	if(coherent_)
+		return;
+	auto begin = reinterpret_cast<uintptr_t>(pointer) & ~uintptr_t{63};
+	auto end = reinterpret_cast<uintptr_t>(pointer) + size;
+	for(auto p = begin; p < end; p += 64)
+		asm volatile ("clflush (%0)" : : "r"(p) : "memory");
+	asm volatile ("mfence" : : : "memory");
+}
+
+void VtdUnit::command_(uint32_t bit, bool enable) {
+	auto status = space_.load(gstsRegister) & globalPersistentMask;
+	space_.store(gcmdRegister, enable ? (status | bit) : (status & ~bit));
+	while(static_cast<bool>(space_.load(gstsRegister) & bit) != enable)
+		pause();
+}
+
+void VtdUnit::flushWriteBuffer() {
+	if(!writeBufferFlush_)
+		return;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&mutex_);
+
+	auto status = space_.load(gstsRegister) & globalPersistentMask;
+	space_.store(gcmdRegister, status | globalWriteBufferFlush);
+	while(space_.load(gstsRegister) & globalWriteBufferFlush)
+		pause();
+}
+
+void VtdUnit::invalidateDomain(uint16_t id) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&mutex_);
+
+	queueDescriptor_(invIotlbDomain | (uint64_t{id} << 16), 0);
+	submitAndWait_();
+}
+
+void VtdUnit::queueDescriptor_(uint64_t low, uint64_t high) {
+	PageAccessor accessor{queue_};
+	auto descriptors = reinterpret_cast<uint64_t *>(accessor.get());
+	descriptors[2 * queueTail_] = low;
+	descriptors[2 * queueTail_ + 1] = high;
+	flushCacheLines(&descriptors[2 * queueTail_], 16);
+	queueTail_ = (queueTail_ + 1) % queueSize;
+}
+
+void VtdUnit::submitAndWait_() {
+	auto sequence = ++statusSequence_;
+	queueDescriptor_(invWait | (uint64_t{sequence} << 32), statusPage_);
+	space_.store(iqtRegister, uint64_t{queueTail_} << 4);
+
+	PageAccessor accessor{statusPage_};
+	auto status = reinterpret_cast<uint32_t *>(accessor.get());
+	while(__atomic_load_n(status, __ATOMIC_ACQUIRE) != sequence) {
+		if(space_.load(fstsRegister) & faultQueueError)
+			panicLogger() << "thor: VT-d invalidation queue error" << frg::endlog;
+		pause();
+	}
+}
+
+bool VtdUnit::initialize() {
+	auto registerPtr = KernelVirtualMemory::global().allocate(kPageSize);
+	KernelPageSpace::global().mapSingle4k(VirtualAddr(registerPtr), base_,
+			page_access::write, CachingMode::null);
+	space_ = arch::mem_space(registerPtr);
+
+	auto cap = space_.load(capRegister);
+	auto ecap = space_.load(ecapRegister);
+	coherent_ = ecap & ecap_bits::coherent;
+	cachingMode_ = cap & cap_bits::cachingMode;
+	writeBufferFlush_ = cap & cap_bits::writeBufferFlush;
+	maxDomains_ = 1 << (4 + 2 * (cap & cap_bits::numDomains));
+
+	infoLogger() << "thor: VT-d unit at 0x" << frg::hex_fmt(base_)
+			<< ", segment " << segment_ << frg::endlog;
+
+	// Devices without a driver keep using physical addresses. Since we do not
+	// build identity mappings of all RAM, we rely on pass-through support for that.
+	if(!(ecap & ecap_bits::passThrough) || !(ecap & ecap_bits::queuedInvalidation)) {
+		infoLogger() << "thor: VT-d unit lacks pass-through or queued invalidation,"
+				" not using it" << frg::endlog;
+		return false;
+	}
+
+	auto sagaw = cap & cap_bits::sagaw;
+	if(sagaw & 4) {
+		levels_ = 4;
+		addressWidth_ = 2;
+	}else if(sagaw & 2) {
+		levels_ = 3;
+		addressWidth_ = 1;
+	}else{
+		infoLogger() << "thor: VT-d unit supports neither 3- nor 4-level tables,"
+				" not using it" << frg::endlog;
+		return false;
+	}
+
+	// Firmware can leave translation enabled (e.g., for pre-boot DMA protection).
+	if(space_.load(gstsRegister) & globalTranslation)
+		command_(globalTranslation, false);
+	if(space_.load(gstsRegister) & globalQueuedInvalidation)
+		command_(globalQueuedInvalidation, false);
+
+	rootTable_ = allocateTable();
+	passThroughContext_ = allocateTable();
+	{
+		PageAccessor accessor{passThroughContext_};
+		auto entries = reinterpret_cast<uint64_t *>(accessor.get());
+		for(int i = 0; i < 256; i++) {
+			entries[2 * i] = contextPassThrough | entryPresent;
+			entries[2 * i + 1] = addressWidth_ | (uint64_t{passThroughDomain} << 8);
+		}
+		flushCacheLines(entries, kPageSize);
+	}
+	{
+		PageAccessor accessor{rootTable_};
+		auto entries = reinterpret_cast<uint64_t *>(accessor.get());
+		for(int i = 0; i < 256; i++) {
+			entries[2 * i] = passThroughContext_ | entryPresent;
+			contextTables_[i] = passThroughContext_;
+		}
+		flushCacheLines(entries, kPageSize);
+	}
+
+	queue_ = allocateTable();
+	statusPage_ = allocateTable();
+
+	space_.store(rtaddrRegister, rootTable_);
+	command_(globalRootTable, true);
+
+	space_.store(iqtRegister, 0);
+	space_.store(iqaRegister, queue_); // 128-bit descriptors, one page.
+	command_(globalQueuedInvalidation, true);
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		queueDescriptor_(invContextGlobal, 0);
+		queueDescriptor_(invIotlbGlobal, 0);
+		submitAndWait_();
+	}
+
+	command_(globalTranslation, true);
+	return true;
+}
+
+bool VtdUnit::translatesPciDevice(uint32_t seg, uint32_t bus, uint32_t slot,
+		uint32_t function) {
+	if(seg != segment_)
+		return false;
+	if(includeAll_)
+		return true;
+	for(auto &scope : scopes) {
+		if(scopeContains(seg, scope, bus, slot, function))
+			return true;
+	}
+	return false;
+}
+
+smarter::shared_ptr<IommuDomain> VtdUnit::createPciDomain(uint32_t seg, uint32_t bus,
+		uint32_t slot, uint32_t function) {
+	assert(seg == segment_);
+	assert(bus < 256 && slot < 32 && function < 8);
+
+	// TODO: Devices behind PCIe-to-PCI bridges issue DMA with the requester ID
+	//       of the bridge. We should attach the bridge instead.
+	smarter::shared_ptr<VtdDomain> domain;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		if(nextDomain_ >= maxDomains_) {
+			infoLogger() << "thor: VT-d unit ran out of domain IDs" << frg::endlog;
+			return nullptr;
+		}
+		domain = smarter::allocate_shared<VtdDomain>(*kernelAlloc,
+				this, nextDomain_++, levels_, allocateTable());
+	}
+
+	// Keep the regions that firmware relies on accessible.
+	for(auto &region : reservedRegions) {
+		if(!scopeContains(seg, region.scope, bus, slot, function))
+			continue;
+		auto base = region.base & ~(kPageSize - 1);
+		for(auto page = base; page <= region.limit; page += kPageSize)
+			if(!domain->isMapped(page))
+				domain->mapPage(page, page, dmaRead | dmaWrite);
+	}
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&mutex_);
+
+	// Give the bus a private context table such that other buses stay in pass-through mode.
+	if(contextTables_[bus] == passThroughContext_) {
+		auto table = allocateTable();
+		{
+			PageAccessor sharedAccessor{passThroughContext_};
+			PageAccessor privateAccessor{table};
+			memcpy(privateAccessor.get(), sharedAccessor.get(), kPageSize);
+			flushCacheLines(privateAccessor.get(), kPageSize);
+		}
+		contextTables_[bus] = table;
+
+		PageAccessor rootAccessor{rootTable_};
+		auto entries = reinterpret_cast<uint64_t *>(rootAccessor.get());
+		__atomic_store_n(&entries[2 * bus], table | entryPresent, __ATOMIC_RELAXED);
+		flushCacheLines(&entries[2 * bus], sizeof(uint64_t));
+	}
+
+	// Since the entry is 128 bits wide, we first clear it and invalidate cached copies,
+	// such that the hardware never observes a torn entry.
+	PageAccessor contextAccessor{contextTables_[bus]};
+	auto entries = reinterpret_cast<uint64_t *>(contextAccessor.get());
+	auto entry = &entries[2 * ((slot << 3) | function)];
+	__atomic_store_n(&entry[0], 0, __ATOMIC_RELAXED);
+	flushCacheLines(entry, 16);
+	queueDescriptor_(invContextGlobal, 0);
+	queueDescriptor_(invIotlbDomain | (uint64_t{passThroughDomain} << 16), 0);
+	submitAndWait_();
+
+	entry[1] = addressWidth_ | (uint64_t{domain->id()} << 8);
+	__atomic_store_n(&entry[0], domain->root() | entryPresent, __ATOMIC_RELEASE);
+	flushCacheLines(entry, 16);
+	queueDescriptor_(invContextGlobal, 0);
+	queueDescriptor_(invIotlbDomain | (uint64_t{domain->id()} << 16), 0);
+	submitAndWait_();
+
+	infoLogger() << "thor: Attached PCI device " << seg << ":" << bus << ":"
+			<< slot << "." << function << " to VT-d domain " << domain->id() << frg::endlog;
+	return domain;
+}
+
+} // anonymous namespace
+
+static initgraph::Task initVtdTask{&globalInitEngine, "x86.init-vtd",
+	initgraph::Requires{acpi::getTablesDiscoveredStage(),
+		pci::getDevicesEnumeratedStage()},
+	[] {
+		uacpi_table dmarTbl;
+		if(uacpi_table_find_by_signature("DMAR", &dmarTbl) != UACPI_STATUS_OK)
+			return;
+		auto *dmar = dmarTbl.hdr;
+		if(dmar->length < sizeof(acpi_sdt_hdr) + sizeof(DmarHeader))
+			return;
+		auto header = (DmarHeader *)(dmarTbl.virt_addr + sizeof(acpi_sdt_hdr));
+		int addressBits = header->hostAddressWidth + 1;
+
+		frg::vector<VtdUnit *, KernelAlloc> units{*kernelAlloc};
+
+		size_t offset = sizeof(acpi_sdt_hdr) + sizeof(DmarHeader);
+		while(offset + sizeof(DmarGenericEntry) <= dmar->length) {
+			auto generic = (DmarGenericEntry *)(dmarTbl.virt_addr + offset);
+			if(generic->length < sizeof(DmarGenericEntry)
+					|| offset + generic->length > dmar->length)
+				break;
+
+			if(generic->type == 0 && generic->length >= sizeof(DmarDrhdEntry)) {
+				auto entry = (DmarDrhdEntry *)generic;
+				auto unit = frg::construct<VtdUnit>(*kernelAlloc, entry->segment,
+						entry->registerBase, addressBits,
+						entry->flags & drhd_flags::includePciAll);
+
+				size_t scopeOffset = sizeof(DmarDrhdEntry);
+				while(scopeOffset < generic->length) {
+					DeviceScope scope;
+					auto n = parseScope((DmarDeviceScope *)((uint8_t *)generic + scopeOffset),
+							generic->length - scopeOffset, scope);
+					if(!n)
+						break;
+					if(scope.type == scope_types::endpoint
+							|| scope.type == scope_types::subHierarchy)
+						unit->scopes.push_back(scope);
+					scopeOffset += n;
+				}
+				units.push_back(unit);
+			}else if(generic->type == 1 && generic->length >= sizeof(DmarRmrrEntry)) {
+				auto entry = (DmarRmrrEntry *)generic;
+
+				size_t scopeOffset = sizeof(DmarRmrrEntry);
+				while(scopeOffset < generic->length) {
+					ReservedRegion region{entry->baseAddress, entry->limitAddress, {}};
+					auto n = parseScope((DmarDeviceScope *)((uint8_t *)generic + scopeOffset),
+							generic->length - scopeOffset, region.scope);
+					if(!n)
+						break;
+					// RMRRs are listed after all DRHDs. Whether the region applies to
+					// a given device is only checked once the device is attached.
+					for(auto unit : units)
+						if(unit->segment() == entry->segment)
+							unit->reservedRegions.push_back(region);
+					scopeOffset += n;
+				}
+			}
+			offset += generic->length;
+		}
+
+		for(auto unit : units) {
+			if(!unit->initialize()) {
+				frg::destruct(*kernelAlloc, unit);
+				continue;
+			}
+			registerIommu(unit);
+		}
+	}
+};
+
+} // namespace thor
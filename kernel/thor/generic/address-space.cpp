@@ -15,6 +15,10 @@ namespace {
 	constexpr bool logCleanup = false;
 	constexpr bool logUsage = false;
 
+	// On page faults, also map resident pages within a window of this size
+	// around the faulting address (if they are part of the same mapping).
+	constexpr size_t faultAroundWindow = 16 * kPageSize;
+
 	[[maybe_unused]]
 	void logRss(VirtualSpace *space) {
 		if(!logUsage)
@@ -84,6 +88,8 @@ frg::expected<Error> VirtualOperations::remapPresentPages(VirtualAddr va, Memory
 		if(status & page_status::present) {
 			if(status & page_status::dirty)
 				view->markDirty(offset + progress, kPageSize);
+			if(status & page_status::accessed)
+				view->markAccessed(offset + progress, kPageSize);
 		}
 	}
 	return {};
@@ -107,6 +113,27 @@ frg::expected<Error> VirtualOperations::faultPage(VirtualAddr va, MemoryView *vi
 	return {};
 }
 
+frg::expected<Error> VirtualOperations::mapAbsentPages(VirtualAddr va, MemoryView *view,
+		uintptr_t offset, size_t size, PageFlags flags) {
+	assert(!(va & (kPageSize - 1)));
+	assert(!(offset & (kPageSize - 1)));
+	assert(!(size & (kPageSize - 1)));
+
+	for(size_t progress = 0; progress < size; progress += kPageSize) {
+		if(isMapped(va + progress))
+			continue;
+
+		auto physicalRange = view->peekRange(offset + progress);
+		if(physicalRange.get<0>() == PhysicalAddr(-1))
+			continue;
+		assert(!(physicalRange.get<0>() & (kPageSize - 1)));
+
+		mapSingle4k(va + progress, physicalRange.get<0>(),
+				flags, physicalRange.get<1>());
+	}
+	return {};
+}
+
 frg::expected<Error> VirtualOperations::cleanPages(VirtualAddr va, MemoryView *view,
 		uintptr_t offset, size_t size) {
 	assert(!(va & (kPageSize - 1)));
@@ -137,6 +164,8 @@ frg::expected<Error> VirtualOperations::unmapPages(VirtualAddr va,
 
 		if(status & page_status::dirty)
 			view->markDirty(offset + progress, kPageSize);
+		if(status & page_status::accessed)
+			view->markAccessed(offset + progress, kPageSize);
 	}
 	return {};
 }
@@ -243,6 +272,8 @@ uint32_t Mapping::compilePageFlags() {
 		pageFlags |= page_access::write;
 	if(flags & MappingFlags::protExecute)
 		pageFlags |= page_access::execute;
+	if(flags & MappingFlags::preferHugePages)
+		pageFlags |= page_access::preferHuge;
 	return pageFlags;
 }
 
@@ -322,12 +353,17 @@ coroutine<void> Mapping::runEvictionLoop() {
 
 CowChain::CowChain(smarter::shared_ptr<CowChain> chain)
 : _superChain{std::move(chain)}, _pages{*kernelAlloc} {
+	if(_superChain)
+		_superChain->_numUsers.fetch_add(1, std::memory_order_relaxed);
 }
 
 CowChain::~CowChain() {
 	if(logCleanup)
 		infoLogger() << "thor: Releasing CowChain" << frg::endlog;
 
+	if(_superChain)
+		_superChain->_numUsers.fetch_sub(1, std::memory_order_release);
+
 	for(auto it = _pages.begin(); it != _pages.end(); ++it) {
 		auto physical = it->load(std::memory_order_relaxed);
 		assert(physical != PhysicalAddr(-1));
@@ -412,19 +448,19 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 	if(offset + length > slice->length())
 		co_return Error::bufferTooSmall;
 
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	frg::optional<RangeLock> rangeLock;
 	bool needsShootdown = false;
 
 	if (flags & kMapFixed) {
-		auto [start, end] = co_await _splitMappings(address, length);
-		assert(start || (!start && !end));
-		needsShootdown = co_await _unmapMappings(address, length, start, end);
+		co_await _lockForSplit(rangeLock, address, length);
+		auto mappings = co_await _splitMappings(address, length);
+		needsShootdown = co_await _unmapMappings(address, length, std::move(mappings));
+	}else if(flags & kMapFixedNoReplace) {
+		rangeLock.emplace(&_rangeMutex, address, length, true);
+		co_await rangeLock->lock();
 	}
 
-	// The shared_ptr to the new Mapping needs to survive until the locks are released.
 	VirtualAddr actualAddress;
-	smarter::shared_ptr<Mapping> mapping;
 	{
 		auto irqLock = frg::guard(&irqMutex());
 		auto spaceLock = frg::guard(&_snapshotMutex);
@@ -448,6 +484,21 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 				actualAddress = FRG_CO_TRY(_allocate(length, flags));
 			}
 		}
+	}
+
+	// The range was removed from _holes above, so no other map() can allocate it.
+	// We still need to lock it since a concurrent unmap() of the same range might
+	// not have completed its TLB shootdown yet.
+	if(!rangeLock) {
+		rangeLock.emplace(&_rangeMutex, actualAddress, length, true);
+		co_await rangeLock->lock();
+	}
+
+	// The shared_ptr to the new Mapping needs to survive until the locks are released.
+	smarter::shared_ptr<Mapping> mapping;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceLock = frg::guard(&_snapshotMutex);
 
 	//	infoLogger() << "Creating new mapping at " << (void *)actualAddress
 	//			<< ", length: " << (void *)length << frg::endlog;
@@ -479,14 +530,14 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 
 		if(flags & kMapDontRequireBacking)
 			mappingFlags |= MappingFlags::dontRequireBacking;
+		if(flags & kMapPreferHugePages)
+			mappingFlags |= MappingFlags::preferHugePages;
 
 		mapping = smarter::allocate_shared<Mapping>(Allocator{},
 				length, static_cast<MappingFlags>(mappingFlags),
 				slice.lock(), slice->offset() + offset);
 		mapping->selfPtr = mapping;
 
-		assert(!(flags & kMapPopulate));
-
 		// Install the new mapping object.
 		mapping->tie(selfPtr.lock(), actualAddress);
 		_mappings.insert(mapping.get());
@@ -505,6 +556,8 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 			pageFlags |= page_access::execute;
 		if((mappingFlags & MappingFlags::permissionMask) & MappingFlags::protRead)
 			pageFlags |= page_access::read;
+		if(mappingFlags & MappingFlags::preferHugePages)
+			pageFlags |= page_access::preferHuge;
 
 		auto mapOutcome = _ops->mapPresentPages(mapping->address, mapping->view.get(),
 				mapping->viewOffset, mapping->length, pageFlags);
@@ -549,15 +602,11 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 		assert(!(flags & mask));
 	}
 
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
-
-	auto [start, end] = co_await _splitMappings(address, length);
-	assert(start || (!start && !end));
-	for (auto it = start; it != end;) {
-		auto mapping = it->selfPtr.lock();
-		it = MappingTree::successor(it);
+	frg::optional<RangeLock> rangeLock;
+	co_await _lockForSplit(rangeLock, address, length);
 
+	auto mappings = co_await _splitMappings(address, length);
+	for (auto &mapping : mappings) {
 		mapping->protect(static_cast<MappingFlags>(mappingFlags));
 
 		assert(mapping->state == MappingState::active);
@@ -569,6 +618,8 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 			pageFlags |= page_access::execute;
 		if((mapping->flags & MappingFlags::permissionMask) & MappingFlags::protRead)
 			pageFlags |= page_access::read;
+		if(mapping->flags & MappingFlags::preferHugePages)
+			pageFlags |= page_access::preferHuge;
 
 		co_await mapping->evictionMutex.async_lock();
 		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
@@ -583,12 +634,11 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 }
 
 coroutine<frg::expected<Error>> VirtualSpace::unmap(VirtualAddr address, size_t length) {
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	frg::optional<RangeLock> rangeLock;
+	co_await _lockForSplit(rangeLock, address, length);
 
-	auto [start, end] = co_await _splitMappings(address, length);
-	assert(start || (!start && !end));
-	auto needsShootdown = co_await _unmapMappings(address, length, start, end);
+	auto mappings = co_await _splitMappings(address, length);
+	auto needsShootdown = co_await _unmapMappings(address, length, std::move(mappings));
 
 	if (needsShootdown)
 		co_await _ops->shootdown(address, length);
@@ -598,13 +648,13 @@ coroutine<frg::expected<Error>> VirtualSpace::unmap(VirtualAddr address, size_t
 
 coroutine<frg::expected<Error>>
 VirtualSpace::synchronize(VirtualAddr address, size_t size) {
-	co_await _consistencyMutex.async_lock_shared();
-	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
-
 	auto misalign = address & (kPageSize - 1);
 	auto alignedAddress = address & ~(kPageSize - 1);
 	auto alignedSize = (size + misalign + kPageSize - 1) & ~(kPageSize - 1);
 
+	RangeLock rangeLock{&_rangeMutex, alignedAddress, alignedSize, false};
+	co_await rangeLock.lock();
+
 	size_t overallProgress = 0;
 	while(overallProgress < alignedSize) {
 		smarter::shared_ptr<Mapping> mapping;
@@ -636,8 +686,10 @@ VirtualSpace::synchronize(VirtualAddr address, size_t size) {
 coroutine<frg::expected<Error>>
 VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		smarter::shared_ptr<WorkQueue> wq) {
-	co_await _consistencyMutex.async_lock_shared();
-	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	// Operations that change a mapping lock its entire range. Hence, locking the faulting
+	// page is enough to keep the mapping that contains it (and its neighbours) stable.
+	RangeLock rangeLock{&_rangeMutex, address & ~(kPageSize - 1), kPageSize, false};
+	co_await rangeLock.lock();
 
 	smarter::shared_ptr<Mapping> mapping;
 	{
@@ -660,6 +712,23 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 	// TODO: Aligning should not be necessary here.
 	auto offset = (address - mapping->address) & ~(kPageSize - 1);
 
+	// Resolve read faults on untouched (or merged) memory by mapping a shared page
+	// read-only. The first write faults again and allocates memory of its own.
+	if(!(faultFlags & VirtualSpace::kFaultWrite)
+			&& !(mapping->flags & MappingFlags::preferHugePages)) {
+		co_await mapping->evictionMutex.async_lock();
+		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
+
+		auto shared = mapping->view->peekSharedPage(mapping->viewOffset + offset);
+		if(shared != PhysicalAddr(-1)) {
+			auto pageAddress = address & ~(kPageSize - 1);
+			if(!_ops->isMapped(pageAddress))
+				_ops->mapSingle4k(pageAddress, shared,
+						mapping->compilePageFlags() & ~page_access::write, CachingMode::null);
+			co_return {};
+		}
+	}
+
 	while(true) {
 		FetchFlags fetchFlags = 0;
 		if(mapping->flags & MappingFlags::dontRequireBacking)
@@ -671,9 +740,17 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		co_await mapping->evictionMutex.async_lock();
 		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
 
+		// Large pages may only be used if the mapping covers the surrounding 2 MiB window.
+		auto pageFlags = mapping->compilePageFlags();
+		if(pageFlags & page_access::preferHuge) {
+			auto window = address & ~(kHugePageSize - 1);
+			if(window < mapping->address
+					|| window + kHugePageSize > mapping->address + mapping->length)
+				pageFlags &= ~page_access::preferHuge;
+		}
+
 		auto remapOutcome = _ops->faultPage(address & ~(kPageSize - 1),
-				mapping->view.get(), mapping->viewOffset + offset,
-				mapping->compilePageFlags());
+				mapping->view.get(), mapping->viewOffset + offset, pageFlags);
 		if(!remapOutcome) {
 			if(remapOutcome.error() == Error::spuriousOperation) {
 				// Spurious page faults are the result of race conditions.
@@ -687,13 +764,66 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 			}
 		}
 
+		// Map neighbouring pages that are already resident to avoid further faults.
+		// This is done while holding the evictionMutex, such that no page can be evicted
+		// between the peekRange() in mapAbsentPages() and installing the mapping.
+		if(!(pageFlags & page_access::preferHuge)) {
+			auto windowBegin = frg::max(address & ~(faultAroundWindow - 1), mapping->address);
+			auto windowEnd = frg::min((address & ~(faultAroundWindow - 1)) + faultAroundWindow,
+					mapping->address + mapping->length);
+			auto aroundOutcome = _ops->mapAbsentPages(windowBegin, mapping->view.get(),
+					mapping->viewOffset + (windowBegin - mapping->address),
+					windowEnd - windowBegin, pageFlags);
+			assert(aroundOutcome);
+		}
+
 		co_return {};
 	}
 }
 
+coroutine<frg::expected<Error>>
+VirtualSpace::populate(VirtualAddr address, size_t length, smarter::shared_ptr<WorkQueue> wq) {
+	assert(!(address & (kPageSize - 1)));
+	assert(!(length & (kPageSize - 1)));
+
+	RangeLock rangeLock{&_rangeMutex, address, length, false};
+	co_await rangeLock.lock();
+
+	smarter::shared_ptr<Mapping> mapping;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto space_guard = frg::guard(&_snapshotMutex);
+
+		mapping = _findMapping(address);
+	}
+	if(!mapping)
+		co_return Error::fault;
+	if(address + length > mapping->address + mapping->length)
+		co_return Error::fault;
+
+	auto offset = address - mapping->address;
+
+	FetchFlags fetchFlags = 0;
+	if(mapping->flags & MappingFlags::dontRequireBacking)
+		fetchFlags |= fetchDisallowBacking;
+
+	FRG_CO_TRY(co_await mapping->view->touchRange(mapping->viewOffset + offset,
+			length, fetchFlags, wq));
+
+	co_await mapping->evictionMutex.async_lock();
+	frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
+
+	// Pages that were evicted after touchRange() are skipped; they are faulted in on access.
+	auto mapOutcome = _ops->mapAbsentPages(address, mapping->view.get(),
+			mapping->viewOffset + offset, length, mapping->compilePageFlags());
+	assert(mapOutcome);
+
+	co_return {};
+}
+
 coroutine<frg::expected<Error, PhysicalAddr>>
 VirtualSpace::retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	// We do not take _rangeMutex here since we are only interested in a snapshot.
 
 	smarter::shared_ptr<Mapping> mapping;
 	{
@@ -726,6 +856,54 @@ VirtualSpace::retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueu
 	}
 }
 
+VirtualSpace::Usage VirtualSpace::queryUsage(VirtualAddr address, size_t length) {
+	// Like retrievePhysical(), we do not take _rangeMutex since a snapshot is enough.
+	auto end = address + length;
+	if(end < address)
+		end = ~VirtualAddr{0};
+
+	frg::vector<smarter::shared_ptr<Mapping>, KernelAlloc> mappings{*kernelAlloc};
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceGuard = frg::guard(&_snapshotMutex);
+
+		for(auto it = _findMappingAfter(address); it && it->address < end;
+				it = MappingTree::successor(it)) {
+			if(auto mapping = it->selfPtr.lock(); mapping)
+				mappings.push_back(std::move(mapping));
+		}
+	}
+
+	Usage usage;
+	for(auto &mapping : mappings) {
+		if(mapping->state != MappingState::active)
+			continue;
+
+		auto begin = frg::max(address, mapping->address) & ~(kPageSize - 1);
+		auto limit = frg::min(end, mapping->address + mapping->length);
+		for(auto va = begin; va < limit; va += kPageSize) {
+			auto page = mapping->view->queryPageUsage(mapping->viewOffset
+					+ (va - mapping->address));
+			if(page & pageUsageEvicted) {
+				usage.evicted += kPageSize;
+				if(page & pageUsageAnonymous)
+					usage.swapped += kPageSize;
+			}
+			// Pages are only resident in this space if they are also mapped.
+			// This excludes the global zero page, which does not belong to the view.
+			if(!(page & pageUsagePresent) || !_ops->isMapped(va))
+				continue;
+			usage.resident += kPageSize;
+			if(page & pageUsageAnonymous)
+				usage.anonymous += kPageSize;
+			if(!(page & pageUsagePrivate))
+				usage.shared += kPageSize;
+		}
+	}
+
+	return usage;
+}
+
 smarter::shared_ptr<Mapping> VirtualSpace::_findMapping(VirtualAddr address) {
 	auto current = _mappings.get_root();
 	while(current) {
@@ -770,7 +948,19 @@ frg::expected<Error, VirtualAddr> VirtualSpace::_allocate(size_t length, MapFlag
 //	infoLogger() << "Allocate virtual memory area"
 //			<< ", size: 0x" << frg::hex_fmt(length) << frg::endlog;
 
-	if(_holes.get_root()->largestHole < length)
+	// Large pages can only be used if the mapping is aligned to them.
+	// We search for a hole that is large enough to align the mapping, but we fall back
+	// to unaligned mappings if there is no such hole.
+	size_t alignment = kPageSize;
+	if((flags & kMapPreferHugePages) && length >= kHugePageSize)
+		alignment = kHugePageSize;
+	size_t searchLength = length + alignment - kPageSize;
+	if(_holes.get_root()->largestHole < searchLength) {
+		alignment = kPageSize;
+		searchLength = length;
+	}
+
+	if(_holes.get_root()->largestHole < searchLength)
 		return Error::noMemory;
 
 	auto current = _holes.get_root();
@@ -778,41 +968,41 @@ frg::expected<Error, VirtualAddr> VirtualSpace::_allocate(size_t length, MapFlag
 		if(flags & kMapPreferBottom) {
 			// Try to allocate memory at the bottom of the range.
 			if(HoleTree::get_left(current)
-					&& HoleTree::get_left(current)->largestHole >= length) {
+					&& HoleTree::get_left(current)->largestHole >= searchLength) {
 				current = HoleTree::get_left(current);
 				continue;
 			}
 
-			if(current->length() >= length) {
+			if(current->length() >= searchLength) {
 				// Note that _splitHole can deallocate the hole!
-				auto address = current->address();
-				_splitHole(current, 0, length);
+				auto address = (current->address() + alignment - 1) & ~(alignment - 1);
+				_splitHole(current, address - current->address(), length);
 				return address;
 			}
 
 			assert(HoleTree::get_right(current));
-			assert(HoleTree::get_right(current)->largestHole >= length);
+			assert(HoleTree::get_right(current)->largestHole >= searchLength);
 			current = HoleTree::get_right(current);
 		}else{
 			// Try to allocate memory at the top of the range.
 			assert(flags & kMapPreferTop);
 
 			if(HoleTree::get_right(current)
-					&& HoleTree::get_right(current)->largestHole >= length) {
+					&& HoleTree::get_right(current)->largestHole >= searchLength) {
 				current = HoleTree::get_right(current);
 				continue;
 			}
 
-			if(current->length() >= length) {
+			if(current->length() >= searchLength) {
 				// Note that _splitHole can deallocate the hole!
-				auto offset = current->length() - length;
-				auto address = current->address() + offset;
-				_splitHole(current, offset, length);
+				auto address = (current->address() + current->length() - length)
+						& ~(alignment - 1);
+				_splitHole(current, address - current->address(), length);
 				return address;
 			}
 
 			assert(HoleTree::get_left(current));
-			assert(HoleTree::get_left(current)->largestHole >= length);
+			assert(HoleTree::get_left(current)->largestHole >= searchLength);
 			current = HoleTree::get_left(current);
 		}
 	}
@@ -866,140 +1056,163 @@ void VirtualSpace::_splitHole(Hole *hole, VirtualAddr offset, size_t length) {
 	frg::destruct(*kernelAlloc, hole);
 }
 
-coroutine<frg::tuple<Mapping *, Mapping *>> VirtualSpace::_splitMappings(uintptr_t address, size_t size) {
-	// _consistencyMutex is held here by the caller
+frg::tuple<VirtualAddr, size_t> VirtualSpace::_boundingRange(VirtualAddr address, size_t length) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto spaceGuard = frg::guard(&_snapshotMutex);
 
-	auto left = _mappings.get_root();
-	while (left) {
-		if (auto next = MappingTree::get_left(left))
-			left = next;
-		else
-			break;
-	}
+	auto begin = address;
+	auto end = address + length;
+	if(auto first = _findMappingAfter(address); first && first->address < begin)
+		begin = first->address;
+	if(auto last = _findMappingAfter(end - 1); last && last->address < end)
+		end = frg::max(end, last->address + last->length);
+	return frg::make_tuple(begin, end - begin);
+}
 
-	Mapping *start = nullptr, *end = nullptr;
-	for (auto it = left; it;) {
-		if ((it->address + it->length) <= address) {
-			it = MappingTree::successor(it);
-			start = it;
-			continue;
-		}
+coroutine<void> VirtualSpace::_lockForSplit(frg::optional<RangeLock> &rangeLock,
+		VirtualAddr address, size_t length) {
+	assert(!rangeLock);
 
-		if (it->address >= (address + size)) {
-			// If no mapping fell into the range, don't set the end iterator
-			if (start)
-				end = it;
+	auto [lockAddress, lockLength] = _boundingRange(address, length);
+	while(true) {
+		rangeLock.emplace(&_rangeMutex, lockAddress, lockLength, true);
+		co_await rangeLock->lock();
 
+		// The mappings at the boundaries might have changed while we were waiting.
+		auto [boundAddress, boundLength] = _boundingRange(address, length);
+		if(boundAddress >= lockAddress
+				&& boundAddress + boundLength <= lockAddress + lockLength)
 			break;
-		}
-
-		if (!start)
-			start = it;
 
-		auto mapping = it->selfPtr.lock();
-		auto at = address;
+		rangeLock = frg::null_opt;
+		lockAddress = boundAddress;
+		lockLength = boundLength;
+	}
+}
 
-		// Starting split not within mapping, consider end split
-		if (at <= mapping->address)
-			at = address + size;
+Mapping *VirtualSpace::_findMappingAfter(VirtualAddr address) {
+	Mapping *result = nullptr;
+	auto current = _mappings.get_root();
+	while(current) {
+		if(current->address + current->length > address) {
+			result = current;
+			current = MappingTree::get_left(current);
+		}else{
+			current = MappingTree::get_right(current);
+		}
+	}
+	return result;
+}
 
-		if (at > mapping->address && at < (mapping->address + mapping->length)) {
-			// Split mapping into left and right part
-			smarter::shared_ptr<Mapping> leftMapping = nullptr;
-			smarter::shared_ptr<Mapping> rightMapping = nullptr;
+coroutine<void> VirtualSpace::_splitMappingAt(VirtualAddr at) {
+	smarter::shared_ptr<Mapping> mapping;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceGuard = frg::guard(&_snapshotMutex);
 
-			assert(mapping->state == MappingState::active);
-			mapping->state = MappingState::zombie;
+		mapping = _findMapping(at);
+	}
+	if(!mapping || mapping->address == at)
+		co_return;
 
-			{
-				auto leftSize = at - mapping->address;
-				leftMapping = smarter::allocate_shared<Mapping>(Allocator{},
-						leftSize, mapping->flags, mapping->slice,
-						mapping->viewOffset);
-				leftMapping->selfPtr = leftMapping;
+	// Split mapping into left and right part
+	smarter::shared_ptr<Mapping> leftMapping = nullptr;
+	smarter::shared_ptr<Mapping> rightMapping = nullptr;
 
-				leftMapping->tie(selfPtr.lock(), mapping->address);
-			}
+	assert(mapping->state == MappingState::active);
+	mapping->state = MappingState::zombie;
 
-			{
-				auto rightOffset = at - mapping->address;
-				rightMapping = smarter::allocate_shared<Mapping>(Allocator{},
-						mapping->length - rightOffset, mapping->flags, mapping->slice,
-						mapping->viewOffset + rightOffset);
-				rightMapping->selfPtr = rightMapping;
+	{
+		auto leftSize = at - mapping->address;
+		leftMapping = smarter::allocate_shared<Mapping>(Allocator{},
+				leftSize, mapping->flags, mapping->slice,
+				mapping->viewOffset);
+		leftMapping->selfPtr = leftMapping;
 
-				rightMapping->tie(selfPtr.lock(), at);
-			}
+		leftMapping->tie(selfPtr.lock(), mapping->address);
+	}
 
-			assert(leftMapping && rightMapping);
+	{
+		auto rightOffset = at - mapping->address;
+		rightMapping = smarter::allocate_shared<Mapping>(Allocator{},
+				mapping->length - rightOffset, mapping->flags, mapping->slice,
+				mapping->viewOffset + rightOffset);
+		rightMapping->selfPtr = rightMapping;
 
-			// Now remove the mapping and insert the new mappings.
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_snapshotMutex);
+		rightMapping->tie(selfPtr.lock(), at);
+	}
 
-				_mappings.remove(mapping.get());
+	assert(leftMapping && rightMapping);
 
-				_mappings.insert(leftMapping.get());
-				assert(leftMapping->state == MappingState::null);
-				leftMapping->state = MappingState::active;
+	// Now remove the mapping and insert the new mappings.
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_snapshotMutex);
 
-				_mappings.insert(rightMapping.get());
-				assert(rightMapping->state == MappingState::null);
-				rightMapping->state = MappingState::active;
-			}
+		_mappings.remove(mapping.get());
 
-			// Retire the old mapping and start using the new ones.
-			// We keep one reference until the detach the observer.
-			leftMapping.ctr()->increment();
-			leftMapping->view->addObserver(&leftMapping->observer);
-			if (leftMapping->view->canEvictMemory())
-				async::detach_with_allocator(*kernelAlloc, leftMapping->runEvictionLoop());
+		_mappings.insert(leftMapping.get());
+		assert(leftMapping->state == MappingState::null);
+		leftMapping->state = MappingState::active;
 
-			// We keep one reference until the detach the observer.
-			rightMapping.ctr()->increment();
-			rightMapping->view->addObserver(&rightMapping->observer);
-			if (rightMapping->view->canEvictMemory())
-				async::detach_with_allocator(*kernelAlloc, rightMapping->runEvictionLoop());
+		_mappings.insert(rightMapping.get());
+		assert(rightMapping->state == MappingState::null);
+		rightMapping->state = MappingState::active;
+	}
 
-			assert(mapping->state == MappingState::zombie);
-			mapping->state = MappingState::retired;
+	// Retire the old mapping and start using the new ones.
+	// We keep one reference until the detach the observer.
+	leftMapping.ctr()->increment();
+	leftMapping->view->addObserver(&leftMapping->observer);
+	if (leftMapping->view->canEvictMemory())
+		async::detach_with_allocator(*kernelAlloc, leftMapping->runEvictionLoop());
+
+	// We keep one reference until the detach the observer.
+	rightMapping.ctr()->increment();
+	rightMapping->view->addObserver(&rightMapping->observer);
+	if (rightMapping->view->canEvictMemory())
+		async::detach_with_allocator(*kernelAlloc, rightMapping->runEvictionLoop());
+
+	assert(mapping->state == MappingState::zombie);
+	mapping->state = MappingState::retired;
+
+	if (mapping->view->canEvictMemory()) {
+		mapping->cancelEviction.cancel();
+		co_await mapping->evictionDoneEvent.wait();
+	}
+	mapping->view->removeObserver(&mapping->observer);
+	mapping->selfPtr.ctr()->decrement();
+}
 
-			if (mapping->view->canEvictMemory()) {
-				mapping->cancelEviction.cancel();
-				co_await mapping->evictionDoneEvent.wait();
-			}
-			mapping->view->removeObserver(&mapping->observer);
-			mapping->selfPtr.ctr()->decrement();
+coroutine<frg::vector<smarter::shared_ptr<Mapping>, KernelAlloc>>
+VirtualSpace::_splitMappings(uintptr_t address, size_t size) {
+	// The caller holds the range of all affected mappings (see _lockForSplit()).
+	// Thus, the mappings in that range cannot change concurrently; however,
+	// we still need _snapshotMutex to access the tree since other parts of it
+	// can be modified concurrently.
+	co_await _splitMappingAt(address);
+	co_await _splitMappingAt(address + size);
 
-			// If start pointed to the freshly-removed mapping,
-			// determine the correct mapping to use as our new start.
-			// Generally, this will be the left mapping, however, if we split the mapping 3 ways
-			// so as to choose the center one, this will be the right mapping.
-			if (start == it) {
-				if(address < at) {
-					start = leftMapping.get();
-				} else {
-					start = rightMapping.get();
-				}
-			}
+	frg::vector<smarter::shared_ptr<Mapping>, KernelAlloc> mappings{*kernelAlloc};
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceGuard = frg::guard(&_snapshotMutex);
 
-			it = rightMapping.get();
-		} else {
-			it = MappingTree::successor(it);
+		for(auto it = _findMappingAfter(address); it && it->address < address + size;
+				it = MappingTree::successor(it)) {
+			assert(it->address >= address && it->address + it->length <= address + size);
+			mappings.push_back(it->selfPtr.lock());
 		}
 	}
 
-	co_return frg::make_tuple(start, end);
+	co_return std::move(mappings);
 }
 
-coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length, Mapping *start, Mapping *end) {
+coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
+		frg::vector<smarter::shared_ptr<Mapping>, KernelAlloc> mappings) {
 	bool needsShootdown = false;
 
-	for (auto it = start; it != end;) {
-		auto mapping = it->selfPtr.lock();
-		it = MappingTree::successor(it);
-
+	for (auto &mapping : mappings) {
 		if (mapping->address >= address && (mapping->address + mapping->length) <= (address + length)) {
 			needsShootdown = true;
 
@@ -1011,7 +1224,12 @@ coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
 						mapping->viewOffset, mapping->length);
 			assert(unmapOutcome);
 
-			_mappings.remove(mapping.get());
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto spaceGuard = frg::guard(&_snapshotMutex);
+
+				_mappings.remove(mapping.get());
+			}
 
 			assert(mapping->state == MappingState::zombie);
 			mapping->state = MappingState::retired;
@@ -1024,6 +1242,8 @@ coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
 			mapping->selfPtr.ctr()->decrement();
 
 			// Finally, coalesce the hole in the hole tree.
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
 
 			// Find the holes that preceede/succeede mapping.
 			Hole *pre;
@@ -1091,7 +1311,7 @@ coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length,
 
 coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 		void *buffer, size_t size, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	// We do not take _rangeMutex here since we are only interested in a snapshot.
 
 	size_t progress = 0;
 	while(progress < size) {
@@ -1163,9 +1383,98 @@ coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 	co_return progress;
 }
 
+coroutine<frg::expected<Error, size_t>> VirtualSpace::readPartialSpaceToView(uintptr_t address,
+		MemoryView *dest, uintptr_t destOffset, size_t size,
+		smarter::shared_ptr<WorkQueue> wq) {
+	// We do not take _rangeMutex here since we are only interested in a snapshot.
+
+	size_t progress = 0;
+	while(progress < size) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceGuard = frg::guard(&_snapshotMutex);
+
+			mapping = _findMapping(address + progress);
+		}
+		if(!mapping)
+			co_return progress;
+
+		auto startInMapping = address + progress - mapping->address;
+		auto limitInMapping = frg::min(size - progress, mapping->length - startInMapping);
+		// Otherwise, _findMapping() would have returned garbage.
+		assert(limitInMapping);
+
+		auto lockOutcome = co_await mapping->lockVirtualRange(startInMapping, limitInMapping, wq);
+		if(!lockOutcome)
+			co_return progress;
+
+		FetchFlags fetchFlags = 0;
+		if(mapping->flags & MappingFlags::dontRequireBacking)
+			fetchFlags |= fetchDisallowBacking;
+
+		// This loop iterates until we hit the end of the mapping.
+		bool success = true;
+		frg::expected<Error> copyOutcome;
+		while(progress < size) {
+			auto offsetInMapping = address + progress - mapping->address;
+			if(offsetInMapping == mapping->length)
+				break;
+			assert(offsetInMapping < mapping->length);
+
+			auto touchOutcome = co_await mapping->view->fetchRange(
+					(mapping->viewOffset + offsetInMapping) & ~(kPageSize - 1), fetchFlags, wq);
+			if(!touchOutcome) {
+				success = false;
+				break;
+			}
+
+			auto [physical, cacheMode] = mapping->resolveRange(
+					offsetInMapping & ~(kPageSize - 1));
+			// Since we have locked the MemoryView, the physical address remains valid here.
+			assert(physical != PhysicalAddr(-1));
+
+			PageAccessor accessor{physical};
+			auto misalign = offsetInMapping & (kPageSize - 1);
+			auto chunk = frg::min(size - progress, kPageSize - misalign);
+			assert(chunk); // Otherwise, we would have finished already.
+			copyOutcome = co_await dest->copyTo(destOffset + progress,
+					reinterpret_cast<const std::byte *>(accessor.get()) + misalign,
+					chunk, wq);
+			if(!copyOutcome) {
+				success = false;
+				break;
+			}
+			progress += chunk;
+		}
+
+		mapping->unlockVirtualRange(startInMapping, limitInMapping);
+
+		if(!copyOutcome)
+			co_return copyOutcome.error();
+		if(!success)
+			co_return progress;
+	}
+
+	co_return progress;
+}
+
 coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 		const void *buffer, size_t size, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	auto outcome = co_await writePartialSpaceWith(address, buffer, size,
+			[] (void *dest, const void *src, size_t n) -> bool {
+				memcpy(dest, src, n);
+				return true;
+			}, std::move(wq));
+	assert(outcome);
+	co_return outcome.value();
+}
+
+coroutine<frg::expected<Error, size_t>> VirtualSpace::writePartialSpaceWith(uintptr_t address,
+		const void *source, size_t size,
+		bool (*copyIn)(void *dest, const void *src, size_t size),
+		smarter::shared_ptr<WorkQueue> wq) {
+	// We do not take _rangeMutex here since we are only interested in a snapshot.
 
 	size_t progress = 0;
 	while(progress < size) {
@@ -1174,7 +1483,7 @@ coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 			auto irqLock = frg::guard(&irqMutex());
 			auto spaceGuard = frg::guard(&_snapshotMutex);
 
-			mapping = _findMapping(address);
+			mapping = _findMapping(address + progress);
 		}
 		if(!mapping)
 			co_return progress;
@@ -1222,9 +1531,12 @@ coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 			auto misalign = offsetInMapping & (kPageSize - 1);
 			auto chunk = frg::min(size - progress, kPageSize - misalign);
 			assert(chunk); // Otherwise, we would have finished already.
-			memcpy(reinterpret_cast<std::byte *>(accessor.get()) + misalign,
-					reinterpret_cast<const std::byte *>(buffer) + progress,
-					chunk);
+			if(!copyIn(reinterpret_cast<std::byte *>(accessor.get()) + misalign,
+					reinterpret_cast<const std::byte *>(source) + progress,
+					chunk)) {
+				mapping->unlockVirtualRange(startInMapping, limitInMapping);
+				co_return Error::fault;
+			}
 			progress += chunk;
 		}
 
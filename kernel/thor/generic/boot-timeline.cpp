@@ -0,0 +1,137 @@
+#include <eir/interface.hpp>
+#include <thor-internal/boot-timeline.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/lockstat.hpp>
+#include <thor-internal/ostrace.hpp>
+#include <thor-internal/timer.hpp>
+
+extern "C" EirInfo *thorBootInfoPtr;
+
+namespace thor {
+
+namespace {
+
+constexpr size_t maxBootTasks = 512;
+
+struct BootTask {
+	initgraph::Node *node;
+	uint64_t startTicks;
+	uint64_t endTicks;
+};
+
+// Only accessed by the fiber that runs the initgraph engine; hence, we do not need a lock.
+constinit BootTask bootTasks[maxBootTasks] = {};
+constinit size_t numBootTasks = 0;
+constinit bool bootTimelineDone = false;
+
+constinit uint64_t thorEntryTicks = 0;
+
+// Reference points to convert ticks to nanoseconds.
+constinit uint64_t referenceTicks = 0;
+constinit uint64_t referenceNanos = 0;
+
+struct TicksConverter {
+	uint64_t operator() (uint64_t ticks) {
+		auto delta = static_cast<__int128>(ticks) - static_cast<__int128>(referenceTicks);
+		auto nanos = static_cast<__int128>(referenceNanos)
+				+ delta * nanosDelta / ticksDelta;
+		if(nanos < 0)
+			return 0;
+		return static_cast<uint64_t>(nanos);
+	}
+
+	__int128 ticksDelta;
+	__int128 nanosDelta;
+};
+
+void emitPhase(frg::string_view prefix, frg::string_view name,
+		OsTraceItemId timeItem, uint64_t start, uint64_t end) {
+	frg::string<KernelAlloc> eventName{*kernelAlloc, prefix};
+	eventName += name;
+	auto eventId = announceOsTraceEvent(eventName);
+
+	// Events are timestamped at the end of the phase.
+	managarm::ostrace::EventRecord<KernelAlloc> record{*kernelAlloc};
+	record.set_id(static_cast<uint64_t>(eventId));
+	managarm::ostrace::CounterItem item;
+	item.set_id(static_cast<uint64_t>(timeItem));
+	item.set_value(static_cast<int64_t>(end - start));
+	record.add_ctrs(std::move(item));
+	emitOsTrace(std::move(record), end);
+}
+
+} // anonymous namespace
+
+void startBootTimeline() {
+	thorEntryTicks = getRawTimestampCounter();
+}
+
+void recordBootTaskStart(initgraph::Node *node) {
+	if(bootTimelineDone)
+		return;
+	if(numBootTasks == maxBootTasks) {
+		infoLogger() << "thor: Boot timeline is full" << frg::endlog;
+		bootTimelineDone = true;
+		return;
+	}
+	bootTasks[numBootTasks++] = {node, getRawTimestampCounter(), 0};
+}
+
+void recordBootTaskEnd(initgraph::Node *node) {
+	if(bootTimelineDone)
+		return;
+	auto ticks = getRawTimestampCounter();
+	// Tasks usually complete in the order in which they are started.
+	for(size_t i = numBootTasks; i > 0; i--) {
+		auto task = &bootTasks[i - 1];
+		if(task->node != node || task->endTicks)
+			continue;
+		task->endTicks = ticks;
+		return;
+	}
+}
+
+void calibrateBootTimeline() {
+	referenceTicks = getRawTimestampCounter();
+	referenceNanos = systemClockSource()->currentNanos();
+}
+
+void emitBootTimeline() {
+	bootTimelineDone = true;
+
+	auto ticks = getRawTimestampCounter();
+	auto nanos = systemClockSource()->currentNanos();
+	if(!osTraceInUse.load(std::memory_order_relaxed))
+		return;
+	if(ticks <= referenceTicks || nanos <= referenceNanos) {
+		infoLogger() << "thor: Unable to calibrate boot timeline" << frg::endlog;
+		return;
+	}
+	TicksConverter toNanos{ticks - referenceTicks, nanos - referenceNanos};
+
+	auto timeItem = announceOsTraceItem("time");
+
+	auto stages = reinterpret_cast<EirBootStage *>(thorBootInfoPtr->bootStageInfo);
+	for(size_t i = 0; i < thorBootInfoPtr->numBootStages; i++) {
+		auto startTicks = stages[i].startTicks;
+		auto endTicks = thorEntryTicks;
+		if(i + 1 < thorBootInfoPtr->numBootStages)
+			endTicks = stages[i + 1].startTicks;
+		if(endTicks < startTicks)
+			continue;
+
+		// Eir always terminates the name.
+		emitPhase("boot.eir: ", stages[i].name, timeItem,
+				toNanos(startTicks), toNanos(endTicks));
+	}
+
+	for(size_t i = 0; i < numBootTasks; i++) {
+		auto task = &bootTasks[i];
+		if(!task->endTicks)
+			continue;
+		emitPhase("boot.thor: ", task->node->displayName(), timeItem,
+				toNanos(task->startTicks), toNanos(task->endTicks));
+	}
+}
+
+} // namespace thor
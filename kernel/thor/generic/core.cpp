@@ -1,8 +1,11 @@
+#include <string.h>
+
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/kasan.hpp>
 #include <thor-internal/kernel-io.hpp>
+#include <thor-internal/kfence.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/ring-buffer.hpp>
@@ -311,15 +314,221 @@ constinit frg::manual_box<PhysicalChunkAllocator> physicalAllocator = {};
 
 constinit frg::manual_box<KernelVirtualAlloc> kernelVirtualAlloc = {};
 
-constinit frg::manual_box<
-	frg::slab_pool<
-		KernelVirtualAlloc,
-		IrqSpinlock
-	>
-> kernelHeap = {};
+constinit frg::manual_box<KernelSlabPool> kernelHeap = {};
 
 constinit frg::manual_box<KernelAlloc> kernelAlloc = {};
 
+// --------------------------------------------------------
+// Per-CPU heap magazines
+// --------------------------------------------------------
+
+struct HeapMagazine {
+	static constexpr int capacity = 30;
+
+	HeapMagazine *next = nullptr;
+	int rounds = 0;
+	void *objects[capacity];
+};
+
+namespace {
+
+// Bypass the magazines if allocations are instrumented; otherwise, freed objects
+// would neither be poisoned nor traced until they are drained back to the heap.
+#if defined(THOR_KASAN) || defined(KERNEL_LOG_ALLOCATIONS)
+constexpr bool heapCacheEnabled = false;
+#else
+constexpr bool heapCacheEnabled = true;
+#endif
+
+// Upper bound on the number of full magazines per size class that the depot retains.
+constexpr int heapDepotMaxFull = 16;
+
+struct HeapDepot {
+	IrqSpinlock lock;
+	HeapMagazine *full = nullptr;
+	HeapMagazine *empty = nullptr;
+	int numFull = 0;
+};
+
+constinit HeapDepot heapDepots[HeapCpuCache::numClasses];
+
+// Returns the size class of an allocation or -1 if it is not cached.
+int heapCacheClass(size_t size) {
+	if(!heapCacheEnabled)
+		return -1;
+	int shift = HeapCpuCache::minShift;
+	while((size_t(1) << shift) < size)
+		shift++;
+	if(shift - HeapCpuCache::minShift >= HeapCpuCache::numClasses)
+		return -1;
+	return shift - HeapCpuCache::minShift;
+}
+
+size_t heapClassSize(int cls) {
+	return size_t(1) << (cls + HeapCpuCache::minShift);
+}
+
+} // anonymous namespace
+
+// Note that we always request the full size class from the slab pool (even if the magazines
+// are empty or if we run on a CPU without cache): this guarantees that every object
+// returned by deallocate() can later satisfy any request of the same class.
+
+void *KernelAlloc::allocate(size_t size) {
+#ifdef THOR_KFENCE
+	if(auto p = kfenceSampleAllocate(size); p)
+		return p;
+#endif
+
+	auto cls = heapCacheClass(size);
+	if(cls < 0)
+		return pool_->allocate(size);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto slot = &getCpuData()->heapCache.slots[cls];
+
+	auto tryPop = [&] () -> void * {
+		auto mag = slot->loaded;
+		if(mag && mag->rounds)
+			return mag->objects[--mag->rounds];
+		if(slot->previous && slot->previous->rounds) {
+			std::swap(slot->loaded, slot->previous);
+			mag = slot->loaded;
+			return mag->objects[--mag->rounds];
+		}
+		return nullptr;
+	};
+
+	if(auto p = tryPop(); p)
+		return p;
+
+	// Both magazines are empty. Exchange them for a full one from the depot.
+	auto depot = &heapDepots[cls];
+	{
+		auto lock = frg::guard(&depot->lock);
+		if(depot->full) {
+			auto full = depot->full;
+			depot->full = full->next;
+			depot->numFull--;
+
+			if(slot->previous) {
+				slot->previous->next = depot->empty;
+				depot->empty = slot->previous;
+			}
+			slot->previous = slot->loaded;
+			slot->loaded = full;
+		}
+	}
+
+	if(auto p = tryPop(); p)
+		return p;
+	return pool_->allocate(heapClassSize(cls));
+}
+
+void KernelAlloc::deallocate(void *pointer, size_t size) {
+#ifdef THOR_KFENCE
+	if(isKfenceObject(pointer)) {
+		kfenceFree(pointer);
+		return;
+	}
+#endif
+
+	auto cls = heapCacheClass(size);
+	if(cls < 0 || !pointer) {
+		pool_->deallocate(pointer, size);
+		return;
+	}
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto slot = &getCpuData()->heapCache.slots[cls];
+
+	auto tryPush = [&] () -> bool {
+		auto mag = slot->loaded;
+		if(mag && mag->rounds < HeapMagazine::capacity) {
+			mag->objects[mag->rounds++] = pointer;
+			return true;
+		}
+		if(slot->previous && slot->previous->rounds < HeapMagazine::capacity) {
+			std::swap(slot->loaded, slot->previous);
+			mag = slot->loaded;
+			mag->objects[mag->rounds++] = pointer;
+			return true;
+		}
+		return false;
+	};
+
+	if(tryPush())
+		return;
+
+	// Both magazines (if present) are full. Hand the previous one to the depot
+	// and continue with an empty magazine.
+	auto depot = &heapDepots[cls];
+	HeapMagazine *empty = nullptr;
+	{
+		auto lock = frg::guard(&depot->lock);
+		if(slot->previous && depot->numFull < heapDepotMaxFull) {
+			slot->previous->next = depot->full;
+			depot->full = slot->previous;
+			depot->numFull++;
+			slot->previous = nullptr;
+		}
+		if(!slot->previous && depot->empty) {
+			empty = depot->empty;
+			depot->empty = empty->next;
+		}
+	}
+
+	if(slot->previous) {
+		// The depot is saturated; drain the magazine back to the slab pool.
+		empty = slot->previous;
+		for(int i = 0; i < empty->rounds; i++)
+			pool_->deallocate(empty->objects[i], heapClassSize(cls));
+		empty->rounds = 0;
+	}else if(!empty) {
+		auto storage = pool_->allocate(sizeof(HeapMagazine));
+		if(!storage) {
+			pool_->deallocate(pointer, heapClassSize(cls));
+			return;
+		}
+		empty = new (storage) HeapMagazine{};
+	}
+
+	empty->next = nullptr;
+	slot->previous = slot->loaded;
+	slot->loaded = empty;
+	empty->objects[empty->rounds++] = pointer;
+}
+
+void *KernelAlloc::reallocate(void *pointer, size_t size) {
+#ifdef THOR_KFENCE
+	if(isKfenceObject(pointer)) {
+		auto p = allocate(size);
+		if(!p)
+			return nullptr;
+		memcpy(p, pointer, frg::min(size, kfenceObjectSize(pointer)));
+		kfenceFree(pointer);
+		return p;
+	}
+#endif
+
+	auto cls = heapCacheClass(size);
+	if(cls < 0)
+		return pool_->realloc(pointer, size);
+	return pool_->realloc(pointer, heapClassSize(cls));
+}
+
+void KernelAlloc::free(void *pointer) {
+#ifdef THOR_KFENCE
+	if(isKfenceObject(pointer)) {
+		kfenceFree(pointer);
+		return;
+	}
+#endif
+
+	// Without the size, we cannot determine the size class; return the object to the pool.
+	pool_->free(pointer);
+}
+
 // --------------------------------------------------------
 // CpuData
 // --------------------------------------------------------
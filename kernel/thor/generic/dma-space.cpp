@@ -0,0 +1,160 @@
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/dma-space.hpp>
+#include <thor-internal/memory-view.hpp>
+
+namespace thor {
+
+namespace {
+	frg::ticket_spinlock iommuMutex;
+	frg::intrusive_list<
+		Iommu,
+		frg::locate_member<
+			Iommu,
+			frg::default_list_hook<Iommu>,
+			&Iommu::hook
+		>
+	> iommuList;
+}
+
+void registerIommu(Iommu *iommu) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&iommuMutex);
+
+	iommuList.push_back(iommu);
+}
+
+Iommu *getIommuForPciDevice(uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&iommuMutex);
+
+	// IOMMUs that cover all remaining devices of a segment are registered last.
+	for(auto iommu : iommuList) {
+		if(iommu->translatesPciDevice(seg, bus, slot, function))
+			return iommu;
+	}
+	return nullptr;
+}
+
+// --------------------------------------------------------
+// DmaSpace
+// --------------------------------------------------------
+
+DmaSpace::DmaSpace(smarter::shared_ptr<IommuDomain> domain)
+: domain_{std::move(domain)}, mappings_{frg::hash<uintptr_t>{}, *kernelAlloc} { }
+
+DmaSpace::~DmaSpace() {
+	while(!activeMappings_.empty()) {
+		auto mapping = activeMappings_.pop_front();
+		for(size_t progress = 0; progress < mapping->length; progress += kPageSize)
+			domain_->unmapPage(mapping->ioAddress + progress);
+		pendingUnmaps_.push_back(mapping);
+	}
+	flush();
+}
+
+coroutine<Error> DmaSpace::map(smarter::shared_ptr<MemoryView> view, uintptr_t offset,
+		uintptr_t ioAddress, size_t length, DmaFlags flags,
+		smarter::shared_ptr<WorkQueue> wq) {
+	if(!length || ((offset | ioAddress | length) & (kPageSize - 1)))
+		co_return Error::illegalArgs;
+	if(!(flags & (dmaRead | dmaWrite)) || (flags & ~(dmaRead | dmaWrite)))
+		co_return Error::illegalArgs;
+	if(ioAddress + length < ioAddress || ioAddress + length > domain_->ioAddressLimit())
+		co_return Error::outOfBounds;
+	if(offset + length < offset || offset + length > view->getLength())
+		co_return Error::outOfBounds;
+
+	// Device accesses bypass the page tables of the CPU. Hence, we cannot rely on
+	// page faults and the memory needs to stay resident while the mapping exists.
+	MemoryViewLockHandle lock{view, offset, length};
+	co_await lock.acquire(wq);
+	if(!lock)
+		co_return Error::fault;
+
+	auto touchOutcome = co_await view->touchRange(offset, length, 0, wq);
+	if(!touchOutcome)
+		co_return touchOutcome.error();
+
+	frg::vector<PhysicalAddr, KernelAlloc> pages{*kernelAlloc};
+	pages.resize(length / kPageSize);
+	for(size_t i = 0; i < pages.size(); i++) {
+		auto physical = view->peekRange(offset + i * kPageSize).get<0>();
+		if(physical == PhysicalAddr(-1))
+			co_return Error::fault;
+		pages[i] = physical;
+	}
+
+	auto mapping = frg::construct<Mapping>(*kernelAlloc);
+	mapping->lock = std::move(lock);
+	mapping->view = std::move(view);
+	mapping->offset = offset;
+	mapping->ioAddress = ioAddress;
+	mapping->length = length;
+	mapping->flags = flags;
+
+	bool overlaps = false;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto spaceLock = frg::guard(&mutex_);
+
+		for(size_t i = 0; i < pages.size(); i++) {
+			if(domain_->isMapped(ioAddress + i * kPageSize)) {
+				overlaps = true;
+				break;
+			}
+		}
+
+		if(!overlaps) {
+			for(size_t i = 0; i < pages.size(); i++)
+				domain_->mapPage(ioAddress + i * kPageSize, pages[i], flags);
+			mappings_.insert(ioAddress, mapping);
+			activeMappings_.push_back(mapping);
+		}
+	}
+
+	if(overlaps) {
+		frg::destruct(*kernelAlloc, mapping);
+		co_return Error::alreadyExists;
+	}
+	co_return Error::success;
+}
+
+Error DmaSpace::unmap(uintptr_t ioAddress) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&mutex_);
+
+	auto mapping = mappings_.remove(ioAddress);
+	if(!mapping)
+		return Error::illegalArgs;
+
+	for(size_t progress = 0; progress < (*mapping)->length; progress += kPageSize)
+		domain_->unmapPage(ioAddress + progress);
+
+	// The device might still access the memory until the IOTLB is invalidated.
+	activeMappings_.erase(activeMappings_.iterator_to(*mapping));
+	pendingUnmaps_.push_back(*mapping);
+	return Error::success;
+}
+
+void DmaSpace::flush() {
+	MappingList unmapped;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		domain_->flush();
+		while(!pendingUnmaps_.empty())
+			unmapped.push_back(pendingUnmaps_.pop_front());
+	}
+
+	// Unlocking the memory can free it; thus we do it outside of the lock.
+	while(!unmapped.empty()) {
+		auto mapping = unmapped.pop_front();
+		if(mapping->flags & dmaWrite)
+			mapping->view->markDirty(mapping->offset, mapping->length);
+		frg::destruct(*kernelAlloc, mapping);
+	}
+}
+
+} // namespace thor
@@ -0,0 +1,312 @@
+#include <frg/hash_map.hpp>
+#include <frg/manual_box.hpp>
+#include <frg/small_vector.hpp>
+#include <thor-internal/futex-pi.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/lockstat.hpp>
+
+#include <hel.h>
+
+namespace thor {
+
+namespace {
+	// Maximal length of chains of PI futexes that boosts are propagated along.
+	constexpr int maxChainDepth = 64;
+
+	// PI futexes are only involved on contention. Hence, a single lock protects
+	// all PI state: all PiFutexStates, their waiters and the fields of all PiFutexTasks.
+	// Lock order: this lock is taken before the scheduler's locks.
+	using PiMutex = StatSpinlock<"futex-pi">;
+
+	struct PiFutexGlobals {
+		PiFutexGlobals()
+		: tasks{frg::hash<uint32_t>{}, *kernelAlloc},
+				states{FutexIdentity::Hash{}, *kernelAlloc} { }
+
+		PiMutex mutex;
+
+		uint32_t nextTid = 1;
+
+		frg::hash_map<
+			uint32_t,
+			PiFutexTask *,
+			frg::hash<uint32_t>,
+			KernelAlloc
+		> tasks;
+
+		frg::hash_map<
+			FutexIdentity,
+			PiFutexState *,
+			FutexIdentity::Hash,
+			KernelAlloc
+		> states;
+	};
+
+	frg::eternal<PiFutexGlobals> piGlobals;
+	frg::eternal<PiFutexRealm> globalPiFutexRealm;
+
+	PiFutexGlobals &globals() {
+		return piGlobals.get();
+	}
+
+	bool sameBoost(const frg::optional<SchedulingParameters> &a,
+			const frg::optional<SchedulingParameters> &b) {
+		if(!a || !b)
+			return !a && !b;
+		return *a == *b;
+	}
+
+	// Wakes waiters after piMutex is released.
+	using GrantList = frg::small_vector<FutexIdentity, 4, KernelAlloc>;
+
+	void wakeGranted(GrantList &granted) {
+		for(auto id : granted)
+			getGlobalFutexRealm()->wake(id);
+	}
+}
+
+// The following functions require piMutex.
+struct PiFutexOps {
+	static void insertWaiter(PiFutexState *state, PiFutexWaiter *waiter) {
+		auto it = state->waiters.begin();
+		while(it != state->waiters.end()
+				&& !Scheduler::schedulingPrecedes(waiter->parameters_, (*it)->parameters_))
+			++it;
+		state->waiters.insert(it, waiter);
+	}
+
+	static void setOwner(PiFutexState *state, PiFutexTask *owner) {
+		state->owner = owner;
+		owner->held_.push_back(state);
+	}
+
+	static void destroyState(PiFutexState *state) {
+		assert(state->waiters.empty());
+		if(state->owner)
+			state->owner->held_.erase(state->owner->held_.iterator_to(state));
+		globals().states.remove(state->id);
+		state->futex.retire();
+		frg::destruct(*kernelAlloc, state);
+	}
+
+	// Recomputes the boost of the task and propagates it along the chain of futexes
+	// that the task (transitively) waits for.
+	static void propagate(PiFutexTask *task) {
+		for(int depth = 0; task && depth < maxChainDepth; depth++) {
+			frg::optional<SchedulingParameters> boost;
+			for(auto state : task->held_) {
+				if(state->waiters.empty())
+					continue;
+				auto &parameters = state->waiters.front()->parameters_;
+				if(!boost || Scheduler::schedulingPrecedes(parameters, *boost))
+					boost = parameters;
+			}
+			if(sameBoost(boost, task->boost_))
+				return;
+			task->boost_ = boost;
+			Scheduler::setInheritedScheduling(task->entity_, boost);
+
+			// Re-sort the task in the futex that it waits for.
+			auto waiter = task->blockedOn_;
+			if(!waiter)
+				return;
+			auto state = waiter->state_;
+			state->waiters.erase(state->waiters.iterator_to(waiter));
+			waiter->parameters_ = task->entity_->effectiveParameters();
+			insertWaiter(state, waiter);
+			task = state->owner;
+		}
+	}
+
+	// Hands the futex over to its highest priority waiter.
+	static void handOver(PiFutexState *state, unsigned int extraBits, GrantList &granted) {
+		auto previous = state->owner;
+		auto waiter = state->waiters.pop_front();
+		auto next = waiter->task_;
+
+		unsigned int desired = next->tid_ | extraBits;
+		if(!state->waiters.empty())
+			desired |= kHelFutexPiWaiters;
+		auto word = state->futex.read();
+		while(!state->futex.compareExchange(word, desired))
+			;
+
+		previous->held_.erase(previous->held_.iterator_to(state));
+		state->owner = nullptr;
+		next->blockedOn_ = nullptr;
+		__atomic_store_n(&waiter->granted_, 1, __ATOMIC_RELEASE);
+		granted.push_back(waiter->grantFutex().getIdentity());
+
+		if(state->waiters.empty()) {
+			destroyState(state);
+		}else{
+			setOwner(state, next);
+		}
+		propagate(previous);
+		propagate(next);
+	}
+};
+
+PiFutexTask::PiFutexTask(ScheduleEntity *entity)
+: entity_{entity} {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&globals().mutex);
+
+	// Skip TIDs that are still in use after the counter wraps around.
+	do {
+		tid_ = globals().nextTid;
+		globals().nextTid = (globals().nextTid + 1) & kHelFutexPiTidMask;
+		if(!globals().nextTid)
+			globals().nextTid = 1;
+	} while(globals().tasks.get(tid_));
+	globals().tasks.insert(tid_, this);
+}
+
+PiFutexTask::~PiFutexTask() {
+	GrantList granted{*kernelAlloc};
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&globals().mutex);
+
+		// Threads can only be destructed after they left all syscalls.
+		assert(!blockedOn_);
+
+		while(!held_.empty())
+			PiFutexOps::handOver(held_.front(), kHelFutexPiOwnerDied, granted);
+		globals().tasks.remove(tid_);
+	}
+	wakeGranted(granted);
+}
+
+frg::expected<Error, bool> PiFutexRealm::lock(GlobalFutex futex, PiFutexTask *task,
+		PiFutexWaiter *waiter) {
+	auto id = futex.getIdentity();
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&globals().mutex);
+
+	auto word = futex.read();
+	while(true) {
+		auto ownerTid = word & kHelFutexPiTidMask;
+		if(!ownerTid) {
+			// The futex is free. Keep the remaining flags (e.g., kHelFutexPiOwnerDied).
+			if(!futex.compareExchange(word, word | task->tid_))
+				continue;
+			futex.retire();
+			return false;
+		}
+		if(ownerTid == task->tid_) {
+			futex.retire();
+			return Error::illegalState;
+		}
+		if(!globals().states.get(id) && !globals().tasks.get(ownerTid)) {
+			// The owner terminated without unlocking the futex from user space
+			// (the kernel only knows about contended futexes). Take the futex over.
+			if(!futex.compareExchange(word, task->tid_ | kHelFutexPiOwnerDied))
+				continue;
+			futex.retire();
+			return false;
+		}
+		if(!(word & kHelFutexPiWaiters)
+				&& !futex.compareExchange(word, word | kHelFutexPiWaiters))
+			continue;
+		break;
+	}
+	auto ownerTid = word & kHelFutexPiTidMask;
+
+	PiFutexState *state;
+	if(auto it = globals().states.get(id); it) {
+		state = *it;
+		futex.retire();
+		// User space might have overwritten the futex word.
+		if(state->owner == task || state->owner->tid_ != ownerTid)
+			return Error::illegalState;
+	}else{
+		auto owner = globals().tasks.get(ownerTid);
+		assert(owner);
+		state = frg::construct<PiFutexState>(*kernelAlloc, id, std::move(futex));
+		globals().states.insert(id, state);
+		PiFutexOps::setOwner(state, *owner);
+	}
+
+	// Refuse to wait if the owner (transitively) waits for us.
+	auto blocker = state->owner;
+	for(int depth = 0; blocker->blockedOn_; depth++) {
+		blocker = blocker->blockedOn_->state_->owner;
+		if(blocker == task || depth >= maxChainDepth) {
+			if(state->waiters.empty())
+				PiFutexOps::destroyState(state);
+			return Error::illegalState;
+		}
+	}
+
+	waiter->task_ = task;
+	waiter->state_ = state;
+	waiter->parameters_ = task->entity_->effectiveParameters();
+	PiFutexOps::insertWaiter(state, waiter);
+	task->blockedOn_ = waiter;
+
+	PiFutexOps::propagate(state->owner);
+	return true;
+}
+
+Error PiFutexRealm::finishWait(PiFutexWaiter *waiter) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&globals().mutex);
+
+	if(waiter->granted())
+		return Error::success;
+
+	auto task = waiter->task_;
+	auto state = waiter->state_;
+	auto owner = state->owner;
+	state->waiters.erase(state->waiters.iterator_to(waiter));
+	task->blockedOn_ = nullptr;
+
+	if(state->waiters.empty()) {
+		// Let the owner unlock from userspace again.
+		auto word = state->futex.read();
+		while(!state->futex.compareExchange(word, word & ~kHelFutexPiWaiters))
+			;
+		PiFutexOps::destroyState(state);
+	}
+	PiFutexOps::propagate(owner);
+	return Error::cancelled;
+}
+
+Error PiFutexRealm::unlock(GlobalFutex futex, PiFutexTask *task) {
+	auto id = futex.getIdentity();
+
+	GrantList granted{*kernelAlloc};
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&globals().mutex);
+
+		auto word = futex.read();
+		if((word & kHelFutexPiTidMask) != task->tid_) {
+			futex.retire();
+			return Error::illegalState;
+		}
+
+		if(auto it = globals().states.get(id); it) {
+			// User space might have written our TID into a futex that another task owns.
+			if((*it)->owner != task) {
+				futex.retire();
+				return Error::illegalState;
+			}
+			PiFutexOps::handOver(*it, 0, granted);
+		}else{
+			while(!futex.compareExchange(word, 0))
+				;
+		}
+		futex.retire();
+	}
+	wakeGranted(granted);
+	return Error::success;
+}
+
+PiFutexRealm *getPiFutexRealm() {
+	return &globalPiFutexRealm.get();
+}
+
+} // namespace thor
@@ -9,6 +9,8 @@
 #include <frg/small_vector.hpp>
 #include <thor-internal/event.hpp>
 #include <thor-internal/coroutine.hpp>
+#include <thor-internal/dma-space.hpp>
+#include <thor-internal/futex-pi.hpp>
 #include <thor-internal/io.hpp>
 #include <thor-internal/ipc-queue.hpp>
 #include <thor-internal/irq.hpp>
@@ -16,6 +18,7 @@
 #include <thor-internal/physical.hpp>
 #include <thor-internal/random.hpp>
 #include <thor-internal/stream.hpp>
+#include <thor-internal/swap.hpp>
 #include <thor-internal/thread.hpp>
 #include <thor-internal/timer.hpp>
 #ifdef __x86_64__
@@ -111,6 +114,7 @@ HelError translateError(Error error) {
 	case Error::bufferTooSmall: return kHelErrBufferTooSmall;
 	case Error::fault: return kHelErrFault;
 	case Error::remoteFault: return kHelErrRemoteFault;
+	case Error::illegalArgs: return kHelErrIllegalArgs;
 	default:
 		assert(!"Unexpected error");
 		__builtin_unreachable();
@@ -207,10 +211,7 @@ HelError helSubmitAsyncNop(HelHandle queueHandle, uintptr_t context) {
 
 	smarter::shared_ptr<IpcQueue> queue;
 	{
-		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeGuard(thisUniverse->lock);
-
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -308,23 +309,18 @@ HelError helGetCredentials(HelHandle handle, uint32_t flags, char *credentials)
 	assert(!flags);
 
 	std::array<char, 16> creds;
-	{
-		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(thisUniverse->lock);
-
-		if(handle == kHelThisThread) {
-			creds = thisThread->credentials();
-		}else{
-			auto wrapper = thisUniverse->getDescriptor(universe_guard, handle);
-			if(!wrapper)
-				return kHelErrNoDescriptor;
-			if(wrapper->is<ThreadDescriptor>())
-				creds = wrapper->get<ThreadDescriptor>().thread->credentials();
-			else if(wrapper->is<LaneDescriptor>())
-				creds = wrapper->get<LaneDescriptor>().handle.getStream()->credentials().credentials();
-			else
-				return kHelErrBadDescriptor;
-		}
+	if(handle == kHelThisThread) {
+		creds = thisThread->credentials();
+	}else{
+		auto wrapper = thisUniverse->getDescriptor(handle);
+		if(!wrapper)
+			return kHelErrNoDescriptor;
+		if(wrapper->is<ThreadDescriptor>())
+			creds = wrapper->get<ThreadDescriptor>().thread->credentials();
+		else if(wrapper->is<LaneDescriptor>())
+			creds = wrapper->get<LaneDescriptor>().handle.getStream()->credentials().credentials();
+		else
+			return kHelErrBadDescriptor;
 	}
 
 	if(!writeUserMemory(credentials, creds.data(), creds.size()))
@@ -398,10 +394,7 @@ HelError helCancelAsync(HelHandle handle, uint64_t async_id) {
 
 	smarter::shared_ptr<IpcQueue> queue;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto queue_wrapper = this_universe->getDescriptor(handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -429,21 +422,36 @@ HelError helAllocateMemory(size_t size, uint32_t flags,
 //			<< ", sum of allocated memory: " << (void *)pressure << frg::endlog;
 
 	HelAllocRestrictions effective{
-		.addressBits = 64
+		.addressBits = 64,
+		.numaNode = -1
 	};
 	if(restrictions)
 		if(!readUserMemory(&effective, restrictions, sizeof(HelAllocRestrictions)))
 			return kHelErrFault;
 
+	int numaNode = -1;
+	if(flags & kHelAllocNumaNode) {
+		if(effective.numaNode < 0 || effective.numaNode >= PhysicalChunkAllocator::maxNodes)
+			return kHelErrIllegalArgs;
+		numaNode = effective.numaNode;
+	}
+
+	bool swappable = (flags & kHelAllocSwappable) && effective.addressBits == 64;
+
 	smarter::shared_ptr<AllocatedMemory> memory;
 	if(flags & kHelAllocContinuous) {
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
-				size, kPageSize);
+				size, kPageSize, numaNode);
+	}else if((flags & kHelAllocHugePages) && !(size & (kHugePageSize - 1))) {
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kHugePageSize, kHugePageSize, numaNode);
 	}else if(flags & kHelAllocOnDemand) {
-		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kPageSize, kPageSize, numaNode, swappable);
 	}else{
 		// TODO:
-		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kPageSize, kPageSize, numaNode, swappable);
 	}
 	memory->selfPtr = memory;
 
@@ -464,10 +472,7 @@ HelError helResizeMemory(HelHandle handle, size_t newSize) {
 
 	smarter::shared_ptr<MemoryView> memory;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
@@ -526,18 +531,13 @@ HelError helCopyOnWrite(HelHandle memoryHandle,
 		view = getSpecialMemoryView(memoryHandle);
 	}
 
-	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		if(memoryHandle >= 0) {
-			auto wrapper = this_universe->getDescriptor(universe_guard, memoryHandle);
-			if(!wrapper)
-				return kHelErrNoDescriptor;
-			if(!wrapper->is<MemoryViewDescriptor>())
-				return kHelErrBadDescriptor;
-			view = wrapper->get<MemoryViewDescriptor>().memory;
-		}
+	if(memoryHandle >= 0) {
+		auto wrapper = this_universe->getDescriptor(memoryHandle);
+		if(!wrapper)
+			return kHelErrNoDescriptor;
+		if(!wrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		view = wrapper->get<MemoryViewDescriptor>().memory;
 	}
 
 	auto slice = smarter::allocate_shared<CopyOnWriteMemory>(*kernelAlloc, std::move(view),
@@ -643,10 +643,7 @@ HelError helCreateSliceView(HelHandle memoryHandle,
 
 	smarter::shared_ptr<MemoryView> view;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, memoryHandle);
+		auto wrapper = this_universe->getDescriptor(memoryHandle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
@@ -673,10 +670,7 @@ HelError helForkMemory(HelHandle handle, HelHandle *forkedHandle) {
 
 	smarter::shared_ptr<MemoryView> view;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto viewWrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto viewWrapper = this_universe->getDescriptor(handle);
 		if(!viewWrapper)
 			return kHelErrNoDescriptor;
 		if(!viewWrapper->is<MemoryViewDescriptor>())
@@ -807,13 +801,23 @@ HelError helRunVirtualizedCpu(HelHandle handle, HelVmexitReason *exitInfo) {
 
 HelError helGetRandomBytes(void *buffer, size_t wantedSize, size_t *actualSize) {
 	char bounceBuffer[128];
-	size_t generatedSize = generateRandomBytes(bounceBuffer,
-			frg::min(wantedSize, size_t{128}));
 
-	if(!writeUserMemory(buffer, bounceBuffer, generatedSize))
-		return kHelErrFault;
+	// Generating bytes is cheap with the per-CPU pools; limit the size per call
+	// such that we do not stall for too long.
+	auto limit = frg::min(wantedSize, size_t{4096});
+	size_t progress = 0;
+	while(progress < limit) {
+		size_t generatedSize = generateRandomBytes(bounceBuffer,
+				frg::min(limit - progress, sizeof(bounceBuffer)));
+
+		if(!writeUserMemory(reinterpret_cast<char *>(buffer) + progress,
+				bounceBuffer, generatedSize))
+			return kHelErrFault;
+		progress += generatedSize;
+	}
+	memset(bounceBuffer, 0, sizeof(bounceBuffer));
 
-	*actualSize = generatedSize;
+	*actualSize = progress;
 	return kHelErrNone;
 }
 
@@ -849,6 +853,10 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 
 	if(flags & kHelMapDontRequireBacking)
 		map_flags |= AddressSpace::kMapDontRequireBacking;
+	if(flags & kHelMapPreferHugePages)
+		map_flags |= AddressSpace::kMapPreferHugePages;
+	if(flags & kHelMapPopulate)
+		map_flags |= AddressSpace::kMapPopulate;
 
 	smarter::shared_ptr<MemorySlice> slice;
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
@@ -919,10 +927,50 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 			return kHelErrAlreadyExists;
 	}
 
+	// Populating is best-effort; errors are reported once the memory is accessed.
+	if(map_flags & AddressSpace::kMapPopulate) {
+		if(!isVspace) {
+			Thread::asyncBlockCurrent(space->populate(mapResult.value(), length,
+					this_thread->mainWorkQueue()->take()));
+		}else{
+			Thread::asyncBlockCurrent(vspace->populate(mapResult.value(), length,
+					this_thread->mainWorkQueue()->take()));
+		}
+	}
+
 	*actualPointer = (void *)mapResult.value();
 	return kHelErrNone;
 }
 
+HelError helForkSpace(HelHandle space_handle, HelForkArea *user_areas, size_t num_areas) {
+	for(size_t i = 0; i < num_areas; i++) {
+		HelForkArea area;
+		if(!readUserObject(user_areas + i, area))
+			return kHelErrFault;
+
+		area.forkedMemory = kHelNullHandle;
+		area.error = kHelErrNone;
+
+		auto memory_handle = area.memory;
+		if(area.forkFlags & kHelForkAreaCopyOnWrite) {
+			area.error = helForkMemory(area.memory, &area.forkedMemory);
+			memory_handle = area.forkedMemory;
+		}
+
+		if(area.error == kHelErrNone) {
+			void *pointer;
+			area.error = helMapMemory(memory_handle, space_handle,
+					reinterpret_cast<void *>(area.address), area.offset, area.size,
+					area.mapFlags, &pointer);
+		}
+
+		if(!writeUserObject(user_areas + i, area))
+			return kHelErrFault;
+	}
+
+	return kHelErrNone;
+}
+
 HelError helSubmitProtectMemory(HelHandle space_handle,
 		void *pointer, size_t length, uint32_t flags,
 		HelHandle queue_handle, uintptr_t context) {
@@ -1078,126 +1126,71 @@ HelError helPointerPhysical(const void *pointer, uintptr_t *physical) {
 	return kHelErrNone;
 }
 
-HelError helSubmitReadMemory(HelHandle handle, uintptr_t address,
-		size_t length, void *buffer,
-		HelHandle queueHandle, uintptr_t context) {
+HelError helQueryMappingUsage(HelHandle spaceHandle, void *pointer, size_t size,
+		HelMappingUsage *userUsage) {
 	auto thisThread = getCurrentThread();
 	auto thisUniverse = thisThread->getUniverse();
 
-	AnyDescriptor descriptor;
-	smarter::shared_ptr<IpcQueue> queue;
+	if(reinterpret_cast<uintptr_t>(pointer) & (kPageSize - 1))
+		return kHelErrIllegalArgs;
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
+		auto irqLock = frg::guard(&irqMutex());
 		Universe::Guard universeGuard(thisUniverse->lock);
 
-		auto wrapper = thisUniverse->getDescriptor(universeGuard, handle);
-		if(!wrapper)
-			return kHelErrNoDescriptor;
-		descriptor = *wrapper;
-
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
-		if(!queueWrapper)
-			return kHelErrNoDescriptor;
-		if(!queueWrapper->is<QueueDescriptor>())
-			return kHelErrBadDescriptor;
-		queue = queueWrapper->get<QueueDescriptor>().queue;
-	}
-
-	auto readMemoryView = [] (smarter::shared_ptr<Thread> submitThread,
-			smarter::shared_ptr<MemoryView> view,
-			uintptr_t address, size_t length, void *buffer,
-			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
-			enable_detached_coroutine = {}) -> void {
-		// Make sure that the pointer arithmetic below does not overflow.
-		uintptr_t limit;
-		if(__builtin_add_overflow(reinterpret_cast<uintptr_t>(buffer), length, &limit)) {
-			HelSimpleResult helResult{.error = kHelErrIllegalArgs, .reserved = {}};
-			QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-			co_await queue->submit(&ipcSource, context);
-			co_return;
+		if(spaceHandle == kHelNullHandle) {
+			space = thisThread->getAddressSpace().lock();
+		}else{
+			auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+			if(!spaceWrapper)
+				return kHelErrNoDescriptor;
+			if(!spaceWrapper->is<AddressSpaceDescriptor>())
+				return kHelErrBadDescriptor;
+			space = spaceWrapper->get<AddressSpaceDescriptor>().space;
 		}
-		(void)limit;
-
-		Error error = Error::success;
-		{
-			char temp[128];
-			size_t progress = 0;
-			while(progress < length) {
-				auto chunk = frg::min(length - progress, size_t{128});
-				auto copyOutcome = co_await view->copyFrom(address + progress, temp, chunk,
-						submitThread->mainWorkQueue()->take());
-				if(!copyOutcome) {
-					error = copyOutcome.error();
-					break;
-				}
-
-				// Enter the submitter's work-queue so that we can access memory directly.
-				co_await submitThread->mainWorkQueue()->schedule();
+	}
 
-				if(!writeUserMemory(reinterpret_cast<char *>(buffer) + progress, temp, chunk)) {
-					error = Error::fault;
-					break;
-				}
-				progress += chunk;
-			}
-		}
+	auto usage = space->queryUsage(reinterpret_cast<VirtualAddr>(pointer), size);
 
-		assert(error == Error::success);
-		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
-		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-		co_await queue->submit(&ipcSource, context);
-	};
+	HelMappingUsage result;
+	memset(&result, 0, sizeof(HelMappingUsage));
+	result.resident = usage.resident;
+	result.anonymous = usage.anonymous;
+	result.shared = usage.shared;
+	result.evicted = usage.evicted;
+	result.swapped = usage.swapped;
 
-	auto readAddressSpace = [] (smarter::shared_ptr<Thread> submitThread,
-			smarter::shared_ptr<AddressSpace, BindableHandle> space,
-			uintptr_t address, size_t length, void *buffer,
-			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
-			enable_detached_coroutine = {}) -> void {
-		// Make sure that the pointer arithmetic below does not overflow.
-		uintptr_t limit;
-		if(__builtin_add_overflow(reinterpret_cast<uintptr_t>(buffer), length, &limit)) {
-			HelSimpleResult helResult{.error = kHelErrIllegalArgs, .reserved = {}};
-			QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-			co_await queue->submit(&ipcSource, context);
-			co_return;
-		}
-		(void)limit;
+	if(!writeUserObject(userUsage, result))
+		return kHelErrFault;
 
-		Error error = Error::success;
-		{
-			char temp[128];
-			size_t progress = 0;
-			while(progress < length) {
-				auto chunk = frg::min(length - progress, size_t{128});
+	return kHelErrNone;
+}
 
-				auto outcome = co_await space->readSpace(address + progress, temp, chunk,
-						submitThread->mainWorkQueue()->take());
-				if(!outcome) {
-					error = Error::fault;
-					break;
-				}
+namespace {
 
-				// Enter the submitter's work-queue so that we can access memory directly.
-				co_await submitThread->mainWorkQueue()->schedule();
+// Returns true if helSubmit{Read,Write}Memory{,Vector}() can access the descriptor.
+// Windows can only be read.
+bool isAccessibleMemory(const AnyDescriptor &descriptor, bool write) {
+	if(descriptor.is<SpaceWindowDescriptor>())
+		return !write;
+	return descriptor.is<MemoryViewDescriptor>()
+			|| descriptor.is<AddressSpaceDescriptor>()
+			|| descriptor.is<ThreadDescriptor>()
+			|| descriptor.is<VirtualizedSpaceDescriptor>();
+}
 
-				if(!writeUserMemory(reinterpret_cast<char *>(buffer) + progress, temp, chunk)) {
-					error = Error::fault;
-					break;
-				}
-				progress += chunk;
-			}
-		}
+// Copies [address, address + length) of the descriptor to the submitter's buffer.
+coroutine<Error> readFromDescriptor(smarter::shared_ptr<Thread> submitThread,
+		const AnyDescriptor &descriptor, uintptr_t address, size_t length, void *buffer) {
+	// Make sure that the pointer arithmetic below does not overflow.
+	uintptr_t limit;
+	if(__builtin_add_overflow(reinterpret_cast<uintptr_t>(buffer), length, &limit))
+		co_return Error::illegalArgs;
 
-		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
-		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-		co_await queue->submit(&ipcSource, context);
-	};
+	if(descriptor.is<VirtualizedSpaceDescriptor>()) {
+		auto space = descriptor.get<VirtualizedSpaceDescriptor>().space;
 
-	auto readVirtualizedSpace = [] (smarter::shared_ptr<Thread> submitThread,
-			smarter::shared_ptr<VirtualizedPageSpace> space,
-			uintptr_t address, size_t length, void *buffer,
-			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
-			enable_detached_coroutine = {}) -> void {
 		// Enter the submitter's work-queue so that we can access memory directly.
 		co_await submitThread->mainWorkQueue()->schedule();
 
@@ -1205,157 +1198,67 @@ HelError helSubmitReadMemory(HelHandle handle, uintptr_t address,
 		auto error = space->load(address, length, buffer);
 		disableUserAccess();
 		assert(error == Error::success || error == Error::fault);
+		co_return error;
+	}
 
-		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
-		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-		co_await queue->submit(&ipcSource, context);
-	};
-
+	smarter::shared_ptr<MemoryView> view;
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	smarter::shared_ptr<SpaceWindow> window;
 	if(descriptor.is<MemoryViewDescriptor>()) {
-		auto view = descriptor.get<MemoryViewDescriptor>().memory;
-		readMemoryView(thisThread.lock(),
-				std::move(view), address, length, buffer, std::move(queue), context);
+		view = descriptor.get<MemoryViewDescriptor>().memory;
 	}else if(descriptor.is<AddressSpaceDescriptor>()) {
-		auto space = descriptor.get<AddressSpaceDescriptor>().space;
-		readAddressSpace(thisThread.lock(),
-				std::move(space), address, length, buffer, std::move(queue), context);
-	}else if(descriptor.is<ThreadDescriptor>()) {
-		auto thread = descriptor.get<ThreadDescriptor>().thread;
-		auto space = thread->getAddressSpace().lock();
-		readAddressSpace(thisThread.lock(),
-				std::move(space), address, length, buffer, std::move(queue), context);
-	}else if(descriptor.is<VirtualizedSpaceDescriptor>()) {
-		auto space = descriptor.get<VirtualizedSpaceDescriptor>().space;
-		readVirtualizedSpace(thisThread.lock(),
-				std::move(space), address, length, buffer, std::move(queue), context);
+		space = descriptor.get<AddressSpaceDescriptor>().space;
+	}else if(descriptor.is<SpaceWindowDescriptor>()) {
+		// Addresses are relative to the start of the window.
+		window = descriptor.get<SpaceWindowDescriptor>().window;
+		if(auto outcome = window->checkAccess(address, length); !outcome)
+			co_return outcome.error();
+		space = window->space;
+		address += window->address;
 	}else{
-		return kHelErrBadDescriptor;
-	}
-
-	return kHelErrNone;
-}
-
-HelError helSubmitWriteMemory(HelHandle handle, uintptr_t address,
-		size_t length, const void *buffer,
-		HelHandle queueHandle, uintptr_t context) {
-	auto thisThread = getCurrentThread();
-	auto thisUniverse = thisThread->getUniverse();
-
-	AnyDescriptor descriptor;
-	smarter::shared_ptr<IpcQueue> queue;
-	{
-		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeGuard(thisUniverse->lock);
-
-		auto wrapper = thisUniverse->getDescriptor(universeGuard, handle);
-		if(!wrapper)
-			return kHelErrNoDescriptor;
-		descriptor = *wrapper;
-
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
-		if(!queueWrapper)
-			return kHelErrNoDescriptor;
-		if(!queueWrapper->is<QueueDescriptor>())
-			return kHelErrBadDescriptor;
-		queue = queueWrapper->get<QueueDescriptor>().queue;
+		auto thread = descriptor.get<ThreadDescriptor>().thread;
+		space = thread->getAddressSpace().lock();
 	}
 
-	auto writeMemoryView = [] (smarter::shared_ptr<Thread> submitThread,
-			smarter::shared_ptr<MemoryView> view,
-			uintptr_t address, size_t length, const void *buffer,
-			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
-			enable_detached_coroutine = {}) -> void {
-		// Make sure that the pointer arithmetic below does not overflow.
-		uintptr_t limit;
-		if(__builtin_add_overflow(reinterpret_cast<uintptr_t>(buffer), length, &limit)) {
-			HelSimpleResult helResult{.error = kHelErrIllegalArgs, .reserved = {}};
-			QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-			co_await queue->submit(&ipcSource, context);
-			co_return;
-		}
-		(void)limit;
-
-		Error error = Error::success;
-		{
-			char temp[128];
-			size_t progress = 0;
-			while(progress < length) {
-				auto chunk = frg::min(length - progress, size_t{128});
-
-				// Enter the submitter's work-queue so that we can access memory directly.
-				co_await submitThread->mainWorkQueue()->schedule();
-
-				if(!readUserMemory(temp,
-						reinterpret_cast<const char *>(buffer) + progress, chunk)) {
-					error = Error::fault;
-					break;
-				}
-
-				auto copyOutcome = co_await view->copyTo(address + progress, temp, chunk,
-						submitThread->mainWorkQueue()->take());
-				if(!copyOutcome) {
-					error = copyOutcome.error();
-					break;
-				}
-				progress += chunk;
-			}
+	char temp[128];
+	size_t progress = 0;
+	while(progress < length) {
+		auto chunk = frg::min(length - progress, size_t{128});
+		if(window && window->revoked.load(std::memory_order_acquire))
+			co_return Error::fault;
+		if(view) {
+			auto copyOutcome = co_await view->copyFrom(address + progress, temp, chunk,
+					submitThread->mainWorkQueue()->take());
+			if(!copyOutcome)
+				co_return copyOutcome.error();
+		}else{
+			auto outcome = co_await space->readSpace(address + progress, temp, chunk,
+					submitThread->mainWorkQueue()->take());
+			if(!outcome)
+				co_return Error::fault;
 		}
 
-		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
-		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-		co_await queue->submit(&ipcSource, context);
-	};
-
-	auto writeAddressSpace = [] (smarter::shared_ptr<Thread> submitThread,
-			smarter::shared_ptr<AddressSpace, BindableHandle> space,
-			uintptr_t address, size_t length, const void *buffer,
-			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
-			enable_detached_coroutine = {}) -> void {
-		// Make sure that the pointer arithmetic below does not overflow.
-		uintptr_t limit;
-		if(__builtin_add_overflow(reinterpret_cast<uintptr_t>(buffer), length, &limit)) {
-			HelSimpleResult helResult{.error = kHelErrIllegalArgs, .reserved = {}};
-			QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-			co_await queue->submit(&ipcSource, context);
-			co_return;
-		}
-		(void)limit;
+		// Enter the submitter's work-queue so that we can access memory directly.
+		co_await submitThread->mainWorkQueue()->schedule();
 
-		Error error = Error::success;
-		{
-			char temp[128];
-			size_t progress = 0;
-			while(progress < length) {
-				auto chunk = frg::min(length - progress, size_t{128});
-
-				// Enter the submitter's work-queue so that we can access memory directly.
-				co_await submitThread->mainWorkQueue()->schedule();
-				if(!readUserMemory(temp,
-						reinterpret_cast<const char *>(buffer) + progress, chunk)) {
-					error = Error::fault;
-					break;
-				}
+		if(!writeUserMemory(reinterpret_cast<char *>(buffer) + progress, temp, chunk))
+			co_return Error::fault;
+		progress += chunk;
+	}
+	co_return Error::success;
+}
 
-				auto outcome = co_await space->writeSpace(address + progress, temp, chunk,
-						submitThread->mainWorkQueue()->take());
-				if(!outcome) {
-					error = Error::fault;
-					break;
-				}
-				progress += chunk;
-			}
-		}
+// Copies the submitter's buffer to [address, address + length) of the descriptor.
+coroutine<Error> writeToDescriptor(smarter::shared_ptr<Thread> submitThread,
+		const AnyDescriptor &descriptor, uintptr_t address, size_t length, const void *buffer) {
+	// Make sure that the pointer arithmetic below does not overflow.
+	uintptr_t limit;
+	if(__builtin_add_overflow(reinterpret_cast<uintptr_t>(buffer), length, &limit))
+		co_return Error::illegalArgs;
 
-		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
-		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-		co_await queue->submit(&ipcSource, context);
-	};
+	if(descriptor.is<VirtualizedSpaceDescriptor>()) {
+		auto space = descriptor.get<VirtualizedSpaceDescriptor>().space;
 
-	auto writeVirtualizedSpace = [] (smarter::shared_ptr<Thread> submitThread,
-			smarter::shared_ptr<VirtualizedPageSpace> space,
-			uintptr_t address, size_t length, const void *buffer,
-			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
-			enable_detached_coroutine = {}) -> void {
 		// Enter the submitter's work-queue so that we can access memory directly.
 		co_await submitThread->mainWorkQueue()->schedule();
 
@@ -1363,47 +1266,324 @@ HelError helSubmitWriteMemory(HelHandle handle, uintptr_t address,
 		auto error = space->store(address, length, buffer);
 		disableUserAccess();
 		assert(error == Error::success || error == Error::fault);
+		co_return error;
+	}
 
-		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
-		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
-		co_await queue->submit(&ipcSource, context);
-	};
-
+	smarter::shared_ptr<MemoryView> view;
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	if(descriptor.is<MemoryViewDescriptor>()) {
-		auto view = descriptor.get<MemoryViewDescriptor>().memory;
-		writeMemoryView(thisThread.lock(),
-				std::move(view), address, length, buffer, std::move(queue), context);
+		view = descriptor.get<MemoryViewDescriptor>().memory;
 	}else if(descriptor.is<AddressSpaceDescriptor>()) {
-		auto space = descriptor.get<AddressSpaceDescriptor>().space;
-		writeAddressSpace(thisThread.lock(),
-				std::move(space), address, length, buffer, std::move(queue), context);
-	}else if(descriptor.is<ThreadDescriptor>()) {
-		auto thread = descriptor.get<ThreadDescriptor>().thread;
-		auto space = thread->getAddressSpace().lock();
-		writeAddressSpace(thisThread.lock(),
-				std::move(space), address, length, buffer, std::move(queue), context);
-	}else if(descriptor.is<VirtualizedSpaceDescriptor>()) {
-		auto space = descriptor.get<VirtualizedSpaceDescriptor>().space;
-		writeVirtualizedSpace(thisThread.lock(),
-				std::move(space), address, length, buffer, std::move(queue), context);
+		space = descriptor.get<AddressSpaceDescriptor>().space;
 	}else{
-		return kHelErrBadDescriptor;
+		auto thread = descriptor.get<ThreadDescriptor>().thread;
+		space = thread->getAddressSpace().lock();
 	}
 
-	return kHelErrNone;
-}
+	char temp[128];
+	size_t progress = 0;
+	while(progress < length) {
+		auto chunk = frg::min(length - progress, size_t{128});
 
-HelError helMemoryInfo(HelHandle handle, size_t *size) {
-	auto this_thread = getCurrentThread();
-	auto this_universe = this_thread->getUniverse();
+		// Enter the submitter's work-queue so that we can access memory directly.
+		co_await submitThread->mainWorkQueue()->schedule();
 
-	smarter::shared_ptr<MemoryView> memory;
-	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		if(!readUserMemory(temp, reinterpret_cast<const char *>(buffer) + progress, chunk))
+			co_return Error::fault;
 
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
-		if(!wrapper)
+		if(view) {
+			auto copyOutcome = co_await view->copyTo(address + progress, temp, chunk,
+					submitThread->mainWorkQueue()->take());
+			if(!copyOutcome)
+				co_return copyOutcome.error();
+		}else{
+			auto outcome = co_await space->writeSpace(address + progress, temp, chunk,
+					submitThread->mainWorkQueue()->take());
+			if(!outcome)
+				co_return Error::fault;
+		}
+		progress += chunk;
+	}
+	co_return Error::success;
+}
+
+// Looks up the descriptor and queue arguments of helSubmit{Read,Write}Memory{,Vector}().
+HelError getMemoryAccessArgs(HelHandle handle, HelHandle queueHandle, bool write,
+		AnyDescriptor &descriptor, smarter::shared_ptr<IpcQueue> &queue) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	auto wrapper = thisUniverse->getDescriptor(handle);
+	if(!wrapper)
+		return kHelErrNoDescriptor;
+	if(!isAccessibleMemory(*wrapper, write))
+		return kHelErrBadDescriptor;
+	descriptor = *wrapper;
+
+	auto queueWrapper = thisUniverse->getDescriptor(queueHandle);
+	if(!queueWrapper)
+		return kHelErrNoDescriptor;
+	if(!queueWrapper->is<QueueDescriptor>())
+		return kHelErrBadDescriptor;
+	queue = queueWrapper->get<QueueDescriptor>().queue;
+	return kHelErrNone;
+}
+
+// Copies the HelMemoryVector array of helSubmit{Read,Write}MemoryVector() to the kernel.
+HelError readMemoryVectors(const HelMemoryVector *userVectors, size_t count,
+		frg::vector<HelMemoryVector, KernelAlloc> &vectors) {
+	if(count > kHelMaxMemoryVectors)
+		return kHelErrIllegalArgs;
+
+	vectors.resize(count);
+	if(!readUserArray(userVectors, vectors.data(), count))
+		return kHelErrFault;
+	return kHelErrNone;
+}
+
+} // anonymous namespace
+
+HelError helSubmitReadMemory(HelHandle handle, uintptr_t address,
+		size_t length, void *buffer,
+		HelHandle queueHandle, uintptr_t context) {
+	auto thisThread = getCurrentThread();
+
+	AnyDescriptor descriptor;
+	smarter::shared_ptr<IpcQueue> queue;
+	if(auto error = getMemoryAccessArgs(handle, queueHandle, false, descriptor, queue); error)
+		return error;
+
+	[] (smarter::shared_ptr<Thread> submitThread, AnyDescriptor descriptor,
+			uintptr_t address, size_t length, void *buffer,
+			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
+			enable_detached_coroutine = {}) -> void {
+		auto error = co_await readFromDescriptor(std::move(submitThread), descriptor,
+				address, length, buffer);
+
+		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
+		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
+		co_await queue->submit(&ipcSource, context);
+	}(thisThread.lock(), std::move(descriptor), address, length, buffer,
+			std::move(queue), context);
+
+	return kHelErrNone;
+}
+
+HelError helSubmitWriteMemory(HelHandle handle, uintptr_t address,
+		size_t length, const void *buffer,
+		HelHandle queueHandle, uintptr_t context) {
+	auto thisThread = getCurrentThread();
+
+	AnyDescriptor descriptor;
+	smarter::shared_ptr<IpcQueue> queue;
+	if(auto error = getMemoryAccessArgs(handle, queueHandle, true, descriptor, queue); error)
+		return error;
+
+	[] (smarter::shared_ptr<Thread> submitThread, AnyDescriptor descriptor,
+			uintptr_t address, size_t length, const void *buffer,
+			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
+			enable_detached_coroutine = {}) -> void {
+		auto error = co_await writeToDescriptor(std::move(submitThread), descriptor,
+				address, length, buffer);
+
+		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
+		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
+		co_await queue->submit(&ipcSource, context);
+	}(thisThread.lock(), std::move(descriptor), address, length, buffer,
+			std::move(queue), context);
+
+	return kHelErrNone;
+}
+
+HelError helSubmitReadMemoryVector(HelHandle handle,
+		const HelMemoryVector *userVectors, size_t count,
+		HelHandle queueHandle, uintptr_t context) {
+	auto thisThread = getCurrentThread();
+
+	AnyDescriptor descriptor;
+	smarter::shared_ptr<IpcQueue> queue;
+	if(auto error = getMemoryAccessArgs(handle, queueHandle, false, descriptor, queue); error)
+		return error;
+
+	frg::vector<HelMemoryVector, KernelAlloc> vectors{*kernelAlloc};
+	if(auto error = readMemoryVectors(userVectors, count, vectors); error)
+		return error;
+
+	[] (smarter::shared_ptr<Thread> submitThread, AnyDescriptor descriptor,
+			frg::vector<HelMemoryVector, KernelAlloc> vectors,
+			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
+			enable_detached_coroutine = {}) -> void {
+		Error error = Error::success;
+		for(auto &vector : vectors) {
+			error = co_await readFromDescriptor(submitThread, descriptor,
+					vector.address, vector.length, vector.buffer);
+			if(error != Error::success)
+				break;
+		}
+
+		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
+		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
+		co_await queue->submit(&ipcSource, context);
+	}(thisThread.lock(), std::move(descriptor), std::move(vectors),
+			std::move(queue), context);
+
+	return kHelErrNone;
+}
+
+HelError helSubmitWriteMemoryVector(HelHandle handle,
+		const HelMemoryVector *userVectors, size_t count,
+		HelHandle queueHandle, uintptr_t context) {
+	auto thisThread = getCurrentThread();
+
+	AnyDescriptor descriptor;
+	smarter::shared_ptr<IpcQueue> queue;
+	if(auto error = getMemoryAccessArgs(handle, queueHandle, true, descriptor, queue); error)
+		return error;
+
+	frg::vector<HelMemoryVector, KernelAlloc> vectors{*kernelAlloc};
+	if(auto error = readMemoryVectors(userVectors, count, vectors); error)
+		return error;
+
+	[] (smarter::shared_ptr<Thread> submitThread, AnyDescriptor descriptor,
+			frg::vector<HelMemoryVector, KernelAlloc> vectors,
+			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
+			enable_detached_coroutine = {}) -> void {
+		Error error = Error::success;
+		for(auto &vector : vectors) {
+			error = co_await writeToDescriptor(submitThread, descriptor,
+					vector.address, vector.length, vector.buffer);
+			if(error != Error::success)
+				break;
+		}
+
+		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
+		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
+		co_await queue->submit(&ipcSource, context);
+	}(thisThread.lock(), std::move(descriptor), std::move(vectors),
+			std::move(queue), context);
+
+	return kHelErrNone;
+}
+
+HelError helCreateSpaceWindow(HelHandle spaceHandle, void *pointer, size_t length,
+		HelHandle *handle) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	uintptr_t limit;
+	if(__builtin_add_overflow(reinterpret_cast<uintptr_t>(pointer), length, &limit))
+		return kHelErrIllegalArgs;
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	if(spaceHandle == kHelNullHandle) {
+		space = thisThread->getAddressSpace().lock();
+	}else{
+		auto spaceWrapper = thisUniverse->getDescriptor(spaceHandle);
+		if(!spaceWrapper)
+			return kHelErrNoDescriptor;
+		if(!spaceWrapper->is<AddressSpaceDescriptor>())
+			return kHelErrBadDescriptor;
+		space = spaceWrapper->get<AddressSpaceDescriptor>().space;
+	}
+
+	auto window = smarter::allocate_shared<SpaceWindow>(*kernelAlloc,
+			std::move(space), reinterpret_cast<VirtualAddr>(pointer), length);
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		Universe::Guard universeGuard(thisUniverse->lock);
+
+		*handle = thisUniverse->attachDescriptor(universeGuard,
+				SpaceWindowDescriptor(std::move(window)));
+	}
+
+	return kHelErrNone;
+}
+
+HelError helRevokeSpaceWindow(HelHandle handle) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	auto wrapper = thisUniverse->getDescriptor(handle);
+	if(!wrapper)
+		return kHelErrNoDescriptor;
+	if(!wrapper->is<SpaceWindowDescriptor>())
+		return kHelErrBadDescriptor;
+	wrapper->get<SpaceWindowDescriptor>().window->revoked.store(true,
+			std::memory_order_release);
+
+	return kHelErrNone;
+}
+
+HelError helSubmitCopyFromWindow(HelHandle windowHandle, HelHandle memoryHandle,
+		uintptr_t offset, size_t length, HelHandle queueHandle, uintptr_t context) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<SpaceWindow> window;
+	smarter::shared_ptr<MemoryView> view;
+	smarter::shared_ptr<IpcQueue> queue;
+	{
+		auto windowWrapper = thisUniverse->getDescriptor(windowHandle);
+		if(!windowWrapper)
+			return kHelErrNoDescriptor;
+		if(!windowWrapper->is<SpaceWindowDescriptor>())
+			return kHelErrBadDescriptor;
+		window = windowWrapper->get<SpaceWindowDescriptor>().window;
+
+		auto memoryWrapper = thisUniverse->getDescriptor(memoryHandle);
+		if(!memoryWrapper)
+			return kHelErrNoDescriptor;
+		if(!memoryWrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		view = memoryWrapper->get<MemoryViewDescriptor>().memory;
+
+		auto queueWrapper = thisUniverse->getDescriptor(queueHandle);
+		if(!queueWrapper)
+			return kHelErrNoDescriptor;
+		if(!queueWrapper->is<QueueDescriptor>())
+			return kHelErrBadDescriptor;
+		queue = queueWrapper->get<QueueDescriptor>().queue;
+	}
+
+	if(length > window->length)
+		return kHelErrIllegalArgs;
+	uintptr_t limit;
+	if(__builtin_add_overflow(offset, length, &limit))
+		return kHelErrIllegalArgs;
+
+	[] (smarter::shared_ptr<Thread> submitThread, smarter::shared_ptr<SpaceWindow> window,
+			smarter::shared_ptr<MemoryView> view, uintptr_t offset, size_t length,
+			smarter::shared_ptr<IpcQueue> queue, uintptr_t context,
+			enable_detached_coroutine = {}) -> void {
+		Error error = Error::success;
+		if(auto outcome = window->checkAccess(0, length); !outcome) {
+			error = outcome.error();
+		}else{
+			auto copyOutcome = co_await window->space->readPartialSpaceToView(window->address,
+					view.get(), offset, length, submitThread->mainWorkQueue()->take());
+			if(!copyOutcome)
+				error = copyOutcome.error();
+			else if(copyOutcome.value() != length)
+				error = Error::fault;
+		}
+
+		HelSimpleResult helResult{.error = translateError(error), .reserved = {}};
+		QueueSource ipcSource{&helResult, sizeof(HelSimpleResult), nullptr};
+		co_await queue->submit(&ipcSource, context);
+	}(thisThread.lock(), std::move(window), std::move(view), offset, length,
+			std::move(queue), context);
+
+	return kHelErrNone;
+}
+
+HelError helMemoryInfo(HelHandle handle, size_t *size) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<MemoryView> memory;
+	{
+		auto wrapper = this_universe->getDescriptor(handle);
+		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
@@ -1421,17 +1601,14 @@ HelError helSubmitManageMemory(HelHandle handle, HelHandle queue_handle, uintptr
 	smarter::shared_ptr<MemoryView> memory;
 	smarter::shared_ptr<IpcQueue> queue;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1475,10 +1652,7 @@ HelError helUpdateMemory(HelHandle handle, int type,
 
 	smarter::shared_ptr<MemoryView> memory;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
@@ -1507,6 +1681,69 @@ HelError helUpdateMemory(HelHandle handle, int type,
 	return kHelErrNone;
 }
 
+HelError helEnableSwap(HelHandle handle, size_t numPages) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<MemoryView> memory;
+	{
+		auto memoryWrapper = thisUniverse->getDescriptor(handle);
+		if(!memoryWrapper)
+			return kHelErrNoDescriptor;
+		if(!memoryWrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		memory = memoryWrapper->get<MemoryViewDescriptor>().memory;
+	}
+
+	if(numPages < 2 || numPages > (memory->getLength() >> kPageShift))
+		return kHelErrIllegalArgs;
+
+	auto error = enableSwap(std::move(memory), numPages);
+	if(error == Error::illegalState)
+		return kHelErrIllegalState;
+
+	assert(error == Error::success);
+	return kHelErrNone;
+}
+
+HelError helAdviseMemory(HelHandle handle, uintptr_t offset, size_t length, int advice) {
+	if(offset % kPageSize || length % kPageSize)
+		return kHelErrIllegalArgs;
+
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<MemoryView> memory;
+	{
+		auto memoryWrapper = thisUniverse->getDescriptor(handle);
+		if(!memoryWrapper)
+			return kHelErrNoDescriptor;
+		if(!memoryWrapper->is<MemoryViewDescriptor>())
+			return kHelErrBadDescriptor;
+		memory = memoryWrapper->get<MemoryViewDescriptor>().memory;
+	}
+
+	Error error;
+	switch(advice) {
+	case kHelAdviseMergeable:
+		error = memory->adviseRange(MemoryAdvice::mergeable, offset, length);
+		break;
+	case kHelAdviseUnmergeable:
+		error = memory->adviseRange(MemoryAdvice::unmergeable, offset, length);
+		break;
+	default:
+		return kHelErrIllegalArgs;
+	}
+
+	if(error == Error::illegalObject)
+		return kHelErrUnsupportedOperation;
+	else if(error == Error::illegalArgs || error == Error::bufferTooSmall)
+		return kHelErrIllegalArgs;
+
+	assert(error == Error::success);
+	return kHelErrNone;
+}
+
 HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offset, size_t size,
 		HelHandle queue_handle, uintptr_t context) {
 	auto this_thread = getCurrentThread();
@@ -1515,17 +1752,14 @@ HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offset, size_t size
 	smarter::shared_ptr<MemoryView> memory;
 	smarter::shared_ptr<IpcQueue> queue;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1591,10 +1825,7 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 
 	smarter::shared_ptr<MemoryView> memory;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
@@ -1612,8 +1843,6 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 	return kHelErrNone;
 }
 
-std::atomic<unsigned int> globalNextCpu = 0;
-
 HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 		int abi, void *ip, void *sp, uint32_t flags, HelHandle *handle) {
 	(void)abi;
@@ -1659,10 +1888,7 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 	auto new_thread = Thread::create(std::move(universe), std::move(space), params);
 	new_thread->self = remove_tag_cast(new_thread);
 
-	// Adding a large prime (coprime to getCpuCount()) should yield a good distribution.
-	auto cpu = globalNextCpu.fetch_add(4099, std::memory_order_relaxed) % getCpuCount();
-//	infoLogger() << "thor: New thread on CPU #" << cpu << frg::endlog;
-	Scheduler::associate(new_thread.get(), &getCpuData(cpu)->scheduler);
+	Scheduler::associate(new_thread.get(), Scheduler::choosePlacement(getCpuData()));
 //	Scheduler::associate(new_thread.get(), localScheduler());
 	if(!(flags & kHelThreadStopped))
 		Thread::resumeOther(remove_tag_cast(new_thread));
@@ -1686,10 +1912,7 @@ HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 	if(handle == kHelThisThread) {
 		thread = this_thread.lock();
 	}else{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1707,7 +1930,7 @@ HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 	return kHelErrNone;
 }
 
-HelError helSetPriority(HelHandle handle, int priority) {
+HelError helSetThreadPmc(HelHandle handle, uint32_t events) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
@@ -1715,10 +1938,7 @@ HelError helSetPriority(HelHandle handle, int priority) {
 	if(handle == kHelThisThread) {
 		thread = this_thread.lock();
 	}else{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1726,36 +1946,141 @@ HelError helSetPriority(HelHandle handle, int priority) {
 		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
 	}
 
-	Scheduler::setPriority(thread.get(), priority);
-
-	return kHelErrNone;
-}
+	if(events & ~uint32_t{kHelPmcCycles | kHelPmcInstructions | kHelPmcCacheMisses})
+		return kHelErrIllegalArgs;
+	if(!Thread::pmcEventsSupported(events))
+		return kHelErrNoHardwareSupport;
 
-HelError helYield() {
-	Thread::deferCurrent();
+	thread->setPmcEvents(events);
 
 	return kHelErrNone;
 }
 
-HelError helSubmitObserve(HelHandle handle, uint64_t inSeq,
-		HelHandle queueHandle, uintptr_t context) {
+HelError helQueryThreadPmc(HelHandle handle, HelPmcValues *user_values) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.lock();
+	}else{
+		auto thread_wrapper = this_universe->getDescriptor(handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	static_assert(Thread::numPmcEvents == 3);
+	HelPmcValues values;
+	memset(&values, 0, sizeof(HelPmcValues));
+	values.cycles = thread->pmcValue(0);
+	values.instructions = thread->pmcValue(1);
+	values.cacheMisses = thread->pmcValue(2);
+
+	if(!writeUserObject(user_values, values))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
+HelError helSetPriority(HelHandle handle, int priority) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.lock();
+	}else{
+		auto thread_wrapper = this_universe->getDescriptor(handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	Scheduler::setPriority(thread.get(), priority);
+
+	return kHelErrNone;
+}
+
+HelError helSetScheduling(HelHandle handle, const HelSchedulingParameters *userParameters) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	HelSchedulingParameters in;
+	if(!readUserObject(userParameters, in))
+		return kHelErrFault;
+
+	SchedulingParameters parameters;
+	parameters.priority = in.priority;
+	switch(in.policy) {
+	case kHelSchedFair:
+		parameters.policy = SchedulePolicy::fair;
+		break;
+	case kHelSchedFifo:
+	case kHelSchedRoundRobin:
+		if(in.priority < kHelSchedMinRealtimePriority
+				|| in.priority > kHelSchedMaxRealtimePriority)
+			return kHelErrIllegalArgs;
+		parameters.policy = (in.policy == kHelSchedFifo)
+				? SchedulePolicy::fifo : SchedulePolicy::roundRobin;
+		break;
+	case kHelSchedDeadline:
+		// Require a non-trivial budget such that the budget timer does not flood the CPU.
+		if(in.runtime < 10'000 || in.runtime > in.deadline || in.deadline > in.period)
+			return kHelErrIllegalArgs;
+		parameters.policy = SchedulePolicy::deadline;
+		parameters.priority = 0;
+		parameters.runtime = in.runtime;
+		parameters.deadline = in.deadline;
+		parameters.period = in.period;
+		break;
+	default:
+		return kHelErrIllegalArgs;
+	}
+
+	smarter::shared_ptr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.lock();
+	}else{
+		auto thread_wrapper = this_universe->getDescriptor(handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	Scheduler::setScheduling(thread.get(), parameters);
+
+	return kHelErrNone;
+}
+
+HelError helYield() {
+	Thread::deferCurrent();
+
+	return kHelErrNone;
+}
+
+HelError helSubmitObserve(HelHandle handle, uint64_t inSeq,
+		HelHandle queueHandle, uintptr_t context) {
 	auto thisThread = getCurrentThread();
 	auto thisUniverse = thisThread->getUniverse();
 
 	smarter::shared_ptr<Thread> thread;
 	smarter::shared_ptr<IpcQueue> queue;
 	{
-		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeGuard(thisUniverse->lock);
-
-		auto threadWrapper = thisUniverse->getDescriptor(universeGuard, handle);
+		auto threadWrapper = thisUniverse->getDescriptor(handle);
 		if(!threadWrapper)
 			return kHelErrNoDescriptor;
 		if(!threadWrapper->is<ThreadDescriptor>())
 			return kHelErrBadDescriptor;
 		thread = remove_tag_cast(threadWrapper->get<ThreadDescriptor>().thread);
 
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -1806,10 +2131,7 @@ HelError helKillThread(HelHandle handle) {
 
 	smarter::shared_ptr<Thread> thread;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1828,10 +2150,7 @@ HelError helInterruptThread(HelHandle handle) {
 
 	smarter::shared_ptr<Thread> thread;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1844,16 +2163,95 @@ HelError helInterruptThread(HelHandle handle) {
 	return kHelErrNone;
 }
 
-HelError helResume(HelHandle handle) {
+HelError helQueueSignal(HelHandle handle, const HelSignalDelivery *deliveryPtr) {
+#if defined(__x86_64__)
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
+	// Size of the kHelRegsSignal image.
+	constexpr size_t signalRegistersSize = 19 * sizeof(uintptr_t);
+
+	HelSignalDelivery delivery;
+	if(!readUserObject(deliveryPtr, delivery))
+		return kHelErrFault;
+
+	if(inHigherHalf(delivery.ip))
+		return kHelErrIllegalArgs;
+	if(delivery.payloadSize > kHelSignalMaxPayload)
+		return kHelErrIllegalArgs;
+	if(delivery.registersOffset > delivery.payloadSize
+			|| delivery.payloadSize - delivery.registersOffset < signalRegistersSize)
+		return kHelErrIllegalArgs;
+	if(delivery.simdPointerOffset != ~size_t(0)
+			&& (delivery.simdPointerOffset > delivery.payloadSize
+				|| delivery.payloadSize - delivery.simdPointerOffset < sizeof(uintptr_t)))
+		return kHelErrIllegalArgs;
+
 	smarter::shared_ptr<Thread> thread;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	Thread::SignalDelivery kernelDelivery;
+	kernelDelivery.ip = delivery.ip;
+	kernelDelivery.altStackBase = delivery.altStackBase;
+	kernelDelivery.altStackSize = delivery.altStackSize;
+	kernelDelivery.redZone = delivery.redZone;
+	kernelDelivery.flagAddress = delivery.flagAddress;
+	kernelDelivery.registersOffset = delivery.registersOffset;
+	kernelDelivery.simdPointerOffset = delivery.simdPointerOffset;
+	kernelDelivery.argument = delivery.argument;
+	kernelDelivery.argumentOffsets[0] = delivery.argumentOffsets[0];
+	kernelDelivery.argumentOffsets[1] = delivery.argumentOffsets[1];
+	kernelDelivery.payload.resize(delivery.payloadSize);
+	if(!readUserMemory(kernelDelivery.payload.data(), delivery.payload, delivery.payloadSize))
+		return kHelErrFault;
+
+	auto error = thread->queueSignal(std::move(kernelDelivery));
+	if(error == Error::illegalState)
+		return kHelErrIllegalState;
+	if(error == Error::noHardwareSupport)
+		return kHelErrNoHardwareSupport;
+	assert(error == Error::success);
+	return kHelErrNone;
+#else
+	// Kernel-side signal frames are not implemented on this architecture.
+	(void)handle;
+	(void)deliveryPtr;
+	return kHelErrNoHardwareSupport;
+#endif
+}
+
+HelError helDequeueSignal(HelHandle handle, int *dequeued) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
 
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+	smarter::shared_ptr<Thread> thread;
+	{
+		auto thread_wrapper = this_universe->getDescriptor(handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	*dequeued = thread->dequeueSignal();
+	return kHelErrNone;
+}
+
+HelError helResume(HelHandle handle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<Thread> thread;
+	{
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1878,10 +2276,7 @@ HelError helLoadRegisters(HelHandle handle, int set, void *image) {
 	smarter::shared_ptr<Thread> thread;
 	VirtualizedCpuDescriptor vcpu;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(thread_wrapper->is<ThreadDescriptor>()) {
@@ -1966,9 +2361,22 @@ HelError helLoadRegisters(HelHandle handle, int set, void *image) {
 			return kHelErrFault;
 #else
 		return kHelErrNoHardwareSupport;
+#endif
+	}else if(set == kHelRegsVirtualizationControl) {
+		if(!vcpu.vcpu) {
+			return kHelErrIllegalArgs;
+		}
+#ifdef __x86_64__
+		HelX86VirtualizationControl control{};
+		vcpu.vcpu->loadControl(&control);
+		if(!writeUserObject(reinterpret_cast<HelX86VirtualizationControl *>(image), control))
+			return kHelErrFault;
+#else
+		return kHelErrNoHardwareSupport;
 #endif
 	}else if(set == kHelRegsSimd) {
 #if defined(__x86_64__)
+		thread->_executor._expandSimd();
 		if(!writeUserMemory(image, thread->_executor._fxState(), Executor::determineSimdSize()))
 			return kHelErrFault;
 #elif defined(__aarch64__)
@@ -2032,10 +2440,7 @@ HelError helStoreRegisters(HelHandle handle, int set, const void *image) {
 		// FIXME: Properly handle this below.
 		thread = this_thread.lock();
 	}else{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(thread_wrapper->is<ThreadDescriptor>()) {
@@ -2127,11 +2532,24 @@ HelError helStoreRegisters(HelHandle handle, int set, const void *image) {
 		vcpu.vcpu->storeRegs(&regs);
 #else
 		return kHelErrNoHardwareSupport;
+#endif
+	}else if(set == kHelRegsVirtualizationControl) {
+#ifdef __x86_64__
+		if(!vcpu.vcpu) {
+			return kHelErrIllegalArgs;
+		}
+		HelX86VirtualizationControl control;
+		if(!readUserObject(reinterpret_cast<const HelX86VirtualizationControl *>(image), control))
+			return kHelErrFault;
+		vcpu.vcpu->storeControl(&control);
+#else
+		return kHelErrNoHardwareSupport;
 #endif
 	}else if(set == kHelRegsSimd) {
 #if defined(__x86_64__)
 		if(!readUserMemory(thread->_executor._fxState(), image, Executor::determineSimdSize()))
 			return kHelErrFault;
+		thread->_executor._invalidateSimd();
 #elif defined(__aarch64__)
 		if(!readUserMemory(&thread->_executor.general()->fp, image, sizeof(FpRegisters)))
 			return kHelErrFault;
@@ -2234,12 +2652,34 @@ HelError helGetClock(uint64_t *counter) {
 	return kHelErrNone;
 }
 
+HelError helAccessClockPage(HelHandle *handle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	auto memory = smarter::allocate_shared<HardwareMemory>(*kernelAlloc,
+			clockPagePhysical(), kPageSize, CachingMode::null);
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		*handle = this_universe->attachDescriptor(universe_guard,
+				MemoryViewDescriptor(std::move(memory)));
+	}
+
+	return kHelErrNone;
+}
+
 HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t context,
 		uint64_t *async_id) {
+	return helSubmitAwaitClockWithSlack(counter, 0, queue_handle, context, async_id);
+}
+
+HelError helSubmitAwaitClockWithSlack(uint64_t counter, uint64_t slack,
+		HelHandle queue_handle, uintptr_t context, uint64_t *async_id) {
 	struct Closure final : CancelNode, PrecisionTimerNode, IpcNode {
-		static void issue(uint64_t nanos, smarter::shared_ptr<IpcQueue> queue,
+		static void issue(uint64_t nanos, uint64_t slack, smarter::shared_ptr<IpcQueue> queue,
 				uintptr_t context, uint64_t *async_id) {
-			auto closure = frg::construct<Closure>(*kernelAlloc, nanos,
+			auto closure = frg::construct<Closure>(*kernelAlloc, nanos, slack,
 					std::move(queue), context);
 			closure->queue->registerNode(closure);
 			*async_id = closure->asyncId();
@@ -2254,7 +2694,7 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 			closure->queue->submit(closure);
 		}
 
-		explicit Closure(uint64_t nanos, smarter::shared_ptr<IpcQueue> the_queue,
+		explicit Closure(uint64_t nanos, uint64_t slack, smarter::shared_ptr<IpcQueue> the_queue,
 				uintptr_t context)
 		: queue{std::move(the_queue)},
 				source{&result, sizeof(HelSimpleResult), nullptr},
@@ -2264,6 +2704,7 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 
 			worklet.setup(&Closure::elapsed, getCurrentThread()->mainWorkQueue());
 			PrecisionTimerNode::setup(nanos, cancelEvent, &worklet);
+			PrecisionTimerNode::setSlack(slack);
 		}
 
 		void handleCancellation() override {
@@ -2286,10 +2727,7 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 
 	smarter::shared_ptr<IpcQueue> queue;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -2300,7 +2738,7 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
 		return kHelErrQueueTooSmall;
 
-	Closure::issue(counter, std::move(queue), context, async_id);
+	Closure::issue(counter, slack, std::move(queue), context, async_id);
 
 	return kHelErrNone;
 }
@@ -2336,10 +2774,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 	LaneHandle lane;
 	smarter::shared_ptr<IpcQueue> queue;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(thisUniverse->lock);
-
-		auto wrapper = thisUniverse->getDescriptor(universe_guard, handle);
+		auto wrapper = thisUniverse->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(wrapper->is<LaneDescriptor>()) {
@@ -2348,7 +2783,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 			return kHelErrBadDescriptor;
 		}
 
-		auto queueWrapper = thisUniverse->getDescriptor(universe_guard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -2371,7 +2806,182 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		};
 	};
 
-	frg::dyn_array<Item, KernelAlloc> items{count, *kernelAlloc};
+	struct Closure final : StreamPacket, IpcNode {
+		static void transmitted(Closure *closure) {
+			QueueSource *tail = nullptr;
+			auto link = [&] (QueueSource *source) {
+				if(tail)
+					tail->link = source;
+				tail = source;
+			};
+
+			for(size_t i = 0; i < closure->count; i++) {
+				auto item = &closure->items[i];
+				HelAction *recipe = &item->recipe;
+				auto node = &item->transmit;
+
+				if(recipe->type == kHelActionDismiss) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionOffer) {
+					HelHandle handle = kHelNullHandle;
+
+					if(node->error() == Error::success
+							&& (recipe->flags & kHelItemWantLane)) {
+						auto universe = closure->weakUniverse.lock();
+						if (!universe) {
+							item->helHandleResult = {kHelErrBadDescriptor, 0, handle};
+							item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
+							link(&item->mainSource);
+							continue;
+						}
+						assert(universe);
+
+						auto irq_lock = frg::guard(&irqMutex());
+						Universe::Guard lock(universe->lock);
+
+						handle = universe->attachDescriptor(lock,
+								LaneDescriptor{node->lane()});
+					}
+
+					item->helHandleResult = {translateError(node->error()), 0, handle};
+					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionAccept) {
+					// TODO: This condition should be replaced. Just test if lane is valid.
+					HelHandle handle = kHelNullHandle;
+					if(node->error() == Error::success) {
+						auto universe = closure->weakUniverse.lock();
+						assert(universe);
+
+						auto irq_lock = frg::guard(&irqMutex());
+						Universe::Guard lock(universe->lock);
+
+						handle = universe->attachDescriptor(lock,
+								LaneDescriptor{node->lane()});
+					}
+
+					item->helHandleResult = {translateError(node->error()), 0, handle};
+					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionImbueCredentials) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionExtractCredentials) {
+					item->helCredentialsResult = {.error = translateError(node->error()), .reserved = {}, .credentials = {}};
+					memcpy(item->helCredentialsResult.credentials,
+							node->credentials().data(), 16);
+					item->mainSource.setup(&item->helCredentialsResult,
+							sizeof(HelCredentialsResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionSendFromBuffer
+						|| recipe->type == kHelActionSendFromBufferSg) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionRecvInline) {
+					item->helInlineResult = {translateError(node->error()),
+							0, node->_transmitBuffer.size()};
+					item->mainSource.setup(&item->helInlineResult, sizeof(HelInlineResultNoFlex));
+					item->dataSource.setup(node->_transmitBuffer.data(),
+							node->_transmitBuffer.size());
+					link(&item->mainSource);
+					link(&item->dataSource);
+				}else if(recipe->type == kHelActionRecvToBuffer) {
+					item->helLengthResult = {translateError(node->error()),
+							0, node->actualLength()};
+					item->mainSource.setup(&item->helLengthResult, sizeof(HelLengthResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionPushDescriptor) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionPullDescriptor) {
+					// TODO: This condition should be replaced. Just test if lane is valid.
+					HelHandle handle = kHelNullHandle;
+					if(node->error() == Error::success) {
+						auto universe = closure->weakUniverse.lock();
+						assert(universe);
+
+						auto irq_lock = frg::guard(&irqMutex());
+						Universe::Guard lock(universe->lock);
+
+						handle = universe->attachDescriptor(lock, node->descriptor());
+					}
+
+					item->helHandleResult = {translateError(node->error()), 0, handle};
+					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
+					link(&item->mainSource);
+				}else{
+					// This cannot happen since we validate recipes at submit time.
+					__builtin_trap();
+				}
+			}
+
+			closure->setupSource(&closure->items[0].mainSource);
+			closure->ipcQueue->submit(closure);
+		}
+
+		// The items are stored in the same allocation as the closure (directly behind it),
+		// such that each submission only requires a single allocation.
+		static size_t itemsOffset() {
+			return (sizeof(Closure) + alignof(Item) - 1) & ~(alignof(Item) - 1);
+		}
+
+		static size_t allocationSize(size_t count) {
+			return itemsOffset() + count * sizeof(Item);
+		}
+
+		static Closure *create(size_t count) {
+			auto memory = static_cast<char *>(kernelAlloc->allocate(allocationSize(count)));
+			return new (memory) Closure{count, reinterpret_cast<Item *>(memory + itemsOffset())};
+		}
+
+		static void destroy(Closure *closure) {
+			auto size = allocationSize(closure->count);
+			closure->~Closure();
+			kernelAlloc->deallocate(closure, size);
+		}
+
+		Closure(size_t count_, Item *items_)
+		: count{count_}, items{items_} {
+			for(size_t i = 0; i < count; i++)
+				new (&items[i]) Item{};
+		}
+
+		~Closure() {
+			for(size_t i = 0; i < count; i++)
+				items[i].~Item();
+		}
+
+		void completePacket() override {
+			transmitted(this);
+		}
+
+		void complete() override {
+			destroy(this);
+		}
+
+		size_t count;
+		smarter::weak_ptr<Universe> weakUniverse;
+		smarter::shared_ptr<IpcQueue> ipcQueue;
+		Item *items;
+	};
+
+	auto closure = Closure::create(count);
+	auto items = closure->items;
+
+	// Free the closure if we fail before submitting it.
+	struct ClosureGuard {
+		~ClosureGuard() {
+			if(closure)
+				Closure::destroy(closure);
+		}
+
+		Closure *closure;
+	} closureGuard{closure};
 
 	// Identifies the root chain on the stack below.
 	constexpr size_t noIndex = static_cast<size_t>(-1);
@@ -2408,10 +3018,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				if(recipe->handle == kHelThisThread) {
 					creds = thisThread->credentials();
 				} else {
-					auto irq_lock = frg::guard(&irqMutex());
-					Universe::Guard universe_guard(thisUniverse->lock);
-
-					auto wrapper = thisUniverse->getDescriptor(universe_guard, recipe->handle);
+					auto wrapper = thisUniverse->getDescriptor(recipe->handle);
 					if(!wrapper) {
 						return kHelErrNoDescriptor;
 					}
@@ -2491,10 +3098,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 			case kHelActionPushDescriptor: {
 				AnyDescriptor operand;
 				{
-					auto irq_lock = frg::guard(&irqMutex());
-					Universe::Guard universe_guard(thisUniverse->lock);
-
-					auto wrapper = thisUniverse->getDescriptor(universe_guard, recipe->handle);
+					auto wrapper = thisUniverse->getDescriptor(recipe->handle);
 					if(!wrapper)
 						return kHelErrNoDescriptor;
 					operand = *wrapper;
@@ -2522,155 +3126,20 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		if(!(recipe->flags & kHelItemChain))
 			linkStack.pop_back();
 		if(recipe->flags & kHelItemAncillary)
-			linkStack.push_back(i);
-	}
-
-	// All chains must terminate properly.
-	if(!linkStack.empty())
-		return kHelErrIllegalArgs;
-
-	if(!queue->validSize(ipcSize))
-		return kHelErrQueueTooSmall;
-
-	// From this point on, the function must not fail, since we now link our items
-	// into intrusive linked lists.
-
-	struct Closure final : StreamPacket, IpcNode {
-		static void transmitted(Closure *closure) {
-			QueueSource *tail = nullptr;
-			auto link = [&] (QueueSource *source) {
-				if(tail)
-					tail->link = source;
-				tail = source;
-			};
-
-			for(size_t i = 0; i < closure->count; i++) {
-				auto item = &closure->items[i];
-				HelAction *recipe = &item->recipe;
-				auto node = &item->transmit;
-
-				if(recipe->type == kHelActionDismiss) {
-					item->helSimpleResult = {translateError(node->error()), 0};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionOffer) {
-					HelHandle handle = kHelNullHandle;
-
-					if(node->error() == Error::success
-							&& (recipe->flags & kHelItemWantLane)) {
-						auto universe = closure->weakUniverse.lock();
-						if (!universe) {
-							item->helHandleResult = {kHelErrBadDescriptor, 0, handle};
-							item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
-							link(&item->mainSource);
-							continue;
-						}
-						assert(universe);
-
-						auto irq_lock = frg::guard(&irqMutex());
-						Universe::Guard lock(universe->lock);
-
-						handle = universe->attachDescriptor(lock,
-								LaneDescriptor{node->lane()});
-					}
-
-					item->helHandleResult = {translateError(node->error()), 0, handle};
-					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionAccept) {
-					// TODO: This condition should be replaced. Just test if lane is valid.
-					HelHandle handle = kHelNullHandle;
-					if(node->error() == Error::success) {
-						auto universe = closure->weakUniverse.lock();
-						assert(universe);
-
-						auto irq_lock = frg::guard(&irqMutex());
-						Universe::Guard lock(universe->lock);
-
-						handle = universe->attachDescriptor(lock,
-								LaneDescriptor{node->lane()});
-					}
-
-					item->helHandleResult = {translateError(node->error()), 0, handle};
-					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionImbueCredentials) {
-					item->helSimpleResult = {translateError(node->error()), 0};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionExtractCredentials) {
-					item->helCredentialsResult = {.error = translateError(node->error()), .reserved = {}, .credentials = {}};
-					memcpy(item->helCredentialsResult.credentials,
-							node->credentials().data(), 16);
-					item->mainSource.setup(&item->helCredentialsResult,
-							sizeof(HelCredentialsResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionSendFromBuffer
-						|| recipe->type == kHelActionSendFromBufferSg) {
-					item->helSimpleResult = {translateError(node->error()), 0};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionRecvInline) {
-					item->helInlineResult = {translateError(node->error()),
-							0, node->_transmitBuffer.size()};
-					item->mainSource.setup(&item->helInlineResult, sizeof(HelInlineResultNoFlex));
-					item->dataSource.setup(node->_transmitBuffer.data(),
-							node->_transmitBuffer.size());
-					link(&item->mainSource);
-					link(&item->dataSource);
-				}else if(recipe->type == kHelActionRecvToBuffer) {
-					item->helLengthResult = {translateError(node->error()),
-							0, node->actualLength()};
-					item->mainSource.setup(&item->helLengthResult, sizeof(HelLengthResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionPushDescriptor) {
-					item->helSimpleResult = {translateError(node->error()), 0};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionPullDescriptor) {
-					// TODO: This condition should be replaced. Just test if lane is valid.
-					HelHandle handle = kHelNullHandle;
-					if(node->error() == Error::success) {
-						auto universe = closure->weakUniverse.lock();
-						assert(universe);
-
-						auto irq_lock = frg::guard(&irqMutex());
-						Universe::Guard lock(universe->lock);
-
-						handle = universe->attachDescriptor(lock, node->descriptor());
-					}
-
-					item->helHandleResult = {translateError(node->error()), 0, handle};
-					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
-					link(&item->mainSource);
-				}else{
-					// This cannot happen since we validate recipes at submit time.
-					__builtin_trap();
-				}
-			}
-
-			closure->setupSource(&closure->items[0].mainSource);
-			closure->ipcQueue->submit(closure);
-		}
-
-		Closure(frg::dyn_array<Item, KernelAlloc> items_)
-		: items{std::move(items_)} { }
+			linkStack.push_back(i);
+	}
 
-		void completePacket() override {
-			transmitted(this);
-		}
+	// All chains must terminate properly.
+	if(!linkStack.empty())
+		return kHelErrIllegalArgs;
 
-		void complete() override {
-			frg::destruct(*kernelAlloc, this);
-		}
+	if(!queue->validSize(ipcSize))
+		return kHelErrQueueTooSmall;
 
-		size_t count;
-		smarter::weak_ptr<Universe> weakUniverse;
-		smarter::shared_ptr<IpcQueue> ipcQueue;
-		frg::dyn_array<Item, KernelAlloc> items;
-	} *closure = frg::construct<Closure>(*kernelAlloc, std::move(items));
+	// From this point on, the function must not fail, since we now link our items
+	// into intrusive linked lists.
+	closureGuard.closure = nullptr;
 
-	closure->count = count;
 	closure->weakUniverse = thisUniverse.lock();
 	closure->ipcQueue = std::move(queue);
 
@@ -2701,9 +3170,6 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		// Below, we need to ensure that we always complete our own nodes
 		// before completing peer nodes.
 
-		// The size of this array must be a power of two.
-		frg::array<frg::unique_memory<KernelAlloc>, 2> xferBuffers;
-
 		size_t i = 0;
 		size_t seenFlows = 0; // Iterates through flows.
 		while(seenFlows < numFlows) {
@@ -2752,92 +3218,29 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				// Empty packets are handled by the generic stream code.
 				assert(recipe->length);
 
-				size_t progress = 0;
-				size_t numSent = 0;
-				size_t numAcked = 0;
-				bool lastTransferSent = false;
-				// Each iteration of this loop sends one transfer packet (or terminates).
-				while(true) {
-					bool anyRemoteFault = false;
-					while(numSent != numAcked) {
-						// If there is anything more to send, we only need to wait until
-						// at least one buffer is not in-flight (otherwise, we wait for all).
-						if(!lastTransferSent && numSent - numAcked < xferBuffers.size())
-							break;
-						auto ackPacket = co_await node->flowQueue.async_get();
-						assert(ackPacket);
-						if(ackPacket->fault)
-							anyRemoteFault = true;
-						++numAcked;
-					}
-
-					if(lastTransferSent) {
-						if(anyRemoteFault) {
-							node->_error = Error::remoteFault;
-						}else{
-							node->_error = Error::success;
-						}
-						break;
-					}
-
-					// If we encounter remote faults, we terminate.
-					if(anyRemoteFault) {
-						// Send the packet (may deallocate the peer!).
-						peer->flowQueue.put({ .terminate = true });
-						++numSent;
-
-						// Retrieve but ignore all acks.
-						assert(numSent > numAcked);
-						while(numSent != numAcked) {
-							auto ackPacket = co_await node->flowQueue.async_get();
-							assert(ackPacket);
-							++numAcked;
-						}
-
-						node->_error = Error::remoteFault;
-						break;
-					}
-
-					// Prepare a buffer an send it.
-					assert(numSent - numAcked < xferBuffers.size());
-					auto &xb = xferBuffers[numSent & (xferBuffers.size() - 1)];
-					if(!xb.size())
-						xb = frg::unique_memory<KernelAlloc>{*kernelAlloc, 4096};
-
-					auto chunkSize = frg::min(recipe->length - progress, xb.size());
-					assert(chunkSize);
-
-					co_await thread->mainWorkQueue()->enter();
-					auto outcome = readUserMemory(xb.data(),
-							reinterpret_cast<std::byte *>(recipe->buffer) + progress, chunkSize);
-					if(!outcome) {
-						// Send the packet (may deallocate the peer!).
-						peer->flowQueue.put({ .terminate = true, .fault = true });
-						++numSent;
-
-						// Retrieve but ignore all acks.
-						assert(numSent > numAcked);
-						while(numSent != numAcked) {
-							auto ackPacket = co_await node->flowQueue.async_get();
-							assert(ackPacket);
-							++numAcked;
-						}
+				// The receiver offers its buffer; we copy into it directly from user memory.
+				auto offerPacket = co_await node->flowQueue.async_get();
+				assert(offerPacket);
+				assert(offerPacket->targetSpace);
 
-						node->_error = Error::fault;
-						break;
-					}
+				auto outcome = co_await offerPacket->targetSpace->writePartialSpaceWith(
+						offerPacket->targetAddress, recipe->buffer, recipe->length,
+						&readUserMemory, thread->mainWorkQueue()->take());
 
-					lastTransferSent = (progress + chunkSize == recipe->length);
-					// Send the packet (may deallocate the peer!).
-					peer->flowQueue.put({
-						.data = xb.data(),
-						.size = chunkSize,
-						.terminate = lastTransferSent
-					});
-					++numSent;
-					progress += chunkSize;
+				FlowPacket resultPacket{.terminate = true};
+				if(!outcome) {
+					resultPacket.fault = true;
+					node->_error = Error::fault;
+				}else if(outcome.value() != recipe->length) {
+					resultPacket.targetFault = true;
+					node->_error = Error::remoteFault;
+				}else{
+					resultPacket.size = outcome.value();
+					node->_error = Error::success;
 				}
 
+				// Send the packet (may deallocate the peer!).
+				peer->flowQueue.put(std::move(resultPacket));
 				node->complete();
 			}else if(recipe->type == kHelActionRecvToBuffer
 					&& peer->tag() == kTagSendKernelBuffer) {
@@ -2862,57 +3265,22 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				assert(recipe->type == kHelActionRecvToBuffer
 						&& peer->tag() == kTagSendFlow);
 
-				size_t progress = 0;
-				bool didFault = false;
-				// Each iteration of this loop sends one ack packet.
-				while(true) {
-					auto xferPacket = co_await node->flowQueue.async_get();
-					assert(xferPacket);
-
-					if(xferPacket->data && !didFault) {
-						// Otherwise, there would have been a transmission error.
-						assert(progress + xferPacket->size <= recipe->length);
-
-						co_await thread->mainWorkQueue()->enter();
-						auto outcome = writeUserMemory(
-								reinterpret_cast<std::byte *>(recipe->buffer) + progress,
-								xferPacket->data, xferPacket->size);
-						if(outcome) {
-							progress += xferPacket->size;
-						}else{
-							didFault = true;
-						}
-					}
-
-					if(xferPacket->terminate) {
-						if(didFault) {
-							// Ack the packet (may deallocate the peer!).
-							peer->flowQueue.put({ .terminate = true, .fault = true, });
-							node->_error = Error::fault;
-						}else{
-							// Ack the packet (may deallocate the peer!).
-							peer->flowQueue.put({ .terminate = true });
-							if(xferPacket->fault) {
-								node->_error = Error::remoteFault;
-							}else{
-								node->_actualLength = progress;
-							}
-						}
-
-						// This node is finished.
-						break;
-					}
+				// Offer our buffer to the sender (may deallocate the peer!).
+				peer->flowQueue.put({
+					.targetSpace = thread->getAddressSpace().lock(),
+					.targetAddress = reinterpret_cast<uintptr_t>(recipe->buffer)
+				});
 
-					// This is the only non-terminating case.
-					// Senders should always terminate if they fault.
-					assert(!xferPacket->fault);
+				auto resultPacket = co_await node->flowQueue.async_get();
+				assert(resultPacket);
+				assert(resultPacket->terminate);
 
-					// Ack the packet (may deallocate the peer!).
-					if(didFault) {
-						peer->flowQueue.put({ .fault = true });
-					}else{
-						peer->flowQueue.put({});
-					}
+				if(resultPacket->targetFault) {
+					node->_error = Error::fault;
+				}else if(resultPacket->fault) {
+					node->_error = Error::remoteFault;
+				}else{
+					node->_actualLength = resultPacket->size;
 				}
 
 				node->complete();
@@ -2928,16 +3296,55 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 	return kHelErrNone;
 }
 
+HelError helSubmitAsyncRing(HelSubmissionRing *ring, unsigned int ringShift,
+		size_t *numSubmitted) {
+	// Bound the amount of work that a single syscall can do.
+	if(ringShift > 16)
+		return kHelErrIllegalArgs;
+	uint32_t ringMask = (uint32_t{1} << ringShift) - 1;
+
+	uint32_t head;
+	uint32_t tail;
+	if(!readUserObject(&ring->head, head))
+		return kHelErrFault;
+	if(!readUserObject(&ring->tail, tail))
+		return kHelErrFault;
+	if(tail - head > ringMask + 1)
+		return kHelErrIllegalArgs;
+
+	size_t n = 0;
+	HelError result = kHelErrNone;
+	for(; head != tail; ++head, ++n) {
+		auto entryPtr = &ring->entries[head & ringMask];
+
+		HelRingSubmission entry;
+		if(!readUserObject(entryPtr, entry)) {
+			result = kHelErrFault;
+			break;
+		}
+
+		auto error = helSubmitAsync(entry.handle, entry.actions, entry.count,
+				entry.queue, entry.context, entry.flags);
+		if(!writeUserObject(&entryPtr->error, error)) {
+			result = kHelErrFault;
+			break;
+		}
+	}
+
+	// Publish the new head even on failure; the consumed entries have been submitted.
+	if(!writeUserObject(&ring->head, head))
+		return kHelErrFault;
+	*numSubmitted = n;
+	return result;
+}
+
 HelError helShutdownLane(HelHandle handle) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
 
 	LaneHandle lane;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<LaneDescriptor>())
@@ -2997,6 +3404,182 @@ HelError helFutexWake(int *pointer) {
 	return kHelErrNone;
 }
 
+HelError helFutexRequeue(int *pointer, int *target, int expected,
+		size_t wakeCount, size_t requeueCount, size_t *count) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take()));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	auto targetOrError = space->resolveGlobalFutex(reinterpret_cast<uintptr_t>(target));
+	if(!targetOrError) {
+		futex.retire();
+		return kHelErrFault;
+	}
+
+	auto numOrError = getGlobalFutexRealm()->requeue(std::move(futex), expected,
+			targetOrError.value(), wakeCount, requeueCount);
+	if(!numOrError) {
+		assert(numOrError.error() == Error::futexRace);
+		return kHelErrIllegalState;
+	}
+
+	*count = numOrError.value();
+	return kHelErrNone;
+}
+
+HelError helSubmitAwaitFutex(int *pointer, int expected,
+		HelHandle queueHandle, uintptr_t context, uint64_t *asyncId) {
+	struct Closure final : CancelNode, IpcNode {
+		explicit Closure(smarter::shared_ptr<IpcQueue> theQueue, uintptr_t context)
+		: queue{std::move(theQueue)},
+				source{&result, sizeof(HelSimpleResult), nullptr},
+				result{translateError(Error::success), 0} {
+			setupContext(context);
+			setupSource(&source);
+		}
+
+		void handleCancellation() override {
+			cancelEvent.cancel();
+		}
+
+		void complete() override {
+			frg::destruct(*kernelAlloc, this);
+		}
+
+		async::cancellation_event cancelEvent;
+		smarter::shared_ptr<IpcQueue> queue;
+		QueueSource source;
+		HelSimpleResult result;
+	};
+
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<IpcQueue> queue;
+	{
+		auto queueWrapper = thisUniverse->getDescriptor(queueHandle);
+		if(!queueWrapper)
+			return kHelErrNoDescriptor;
+		if(!queueWrapper->is<QueueDescriptor>())
+			return kHelErrBadDescriptor;
+		queue = queueWrapper->get<QueueDescriptor>().queue;
+	}
+
+	if(!queue->validSize(ipcSourceSize(sizeof(HelSimpleResult))))
+		return kHelErrQueueTooSmall;
+
+	auto closure = frg::construct<Closure>(*kernelAlloc, std::move(queue), context);
+	closure->queue->registerNode(closure);
+	*asyncId = closure->asyncId();
+
+	[] (Closure *closure, smarter::shared_ptr<AddressSpace, BindableHandle> space,
+			uintptr_t address, int expected, smarter::shared_ptr<WorkQueue> wq,
+			enable_detached_coroutine = {}) -> void {
+		auto futexOrError = co_await space->grabGlobalFutex(address, wq);
+		if(futexOrError) {
+			// Unlike helFutexWait(), a mismatch of the futex value is not an error.
+			co_await getGlobalFutexRealm()->wait(std::move(futexOrError.value()), expected,
+					closure->cancelEvent);
+		}else{
+			closure->result.error = kHelErrFault;
+		}
+
+		closure->queue->unregisterNode(closure);
+		closure->queue->submit(closure);
+	}(closure, thisThread->getAddressSpace().lock(), reinterpret_cast<uintptr_t>(pointer),
+			expected, thisThread->mainWorkQueue()->take());
+
+	return kHelErrNone;
+}
+
+HelError helGetFutexTid(uint32_t *tid) {
+	auto thisThread = getCurrentThread();
+
+	*tid = thisThread->piFutexTask.tid();
+	return kHelErrNone;
+}
+
+HelError helFutexLockPi(int *pointer, int64_t deadline) {
+	if(deadline < 0 && deadline != -1)
+		return kHelErrIllegalArgs;
+
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take()));
+	if(!futexOrError)
+		return kHelErrFault;
+
+	PiFutexWaiter waiter;
+	auto waitOrError = getPiFutexRealm()->lock(std::move(futexOrError.value()),
+			&thisThread->piFutexTask, &waiter);
+	if(!waitOrError) {
+		if(waitOrError.error() == Error::illegalState)
+			return kHelErrIllegalState;
+		return translateError(waitOrError.error());
+	}
+	if(!waitOrError.value())
+		return kHelErrNone;
+
+	// The grant futex is not backed by user memory; its identity can be reused by
+	// later waiters. Hence, we can see spurious wakeups here.
+	while(!waiter.granted()) {
+		if(deadline < 0) {
+			Thread::asyncBlockCurrent(
+				getGlobalFutexRealm()->wait(waiter.grantFutex(), 0)
+			);
+		}else{
+			if(systemClockSource()->currentNanos() >= static_cast<uint64_t>(deadline))
+				break;
+			Thread::asyncBlockCurrent(
+				async::race_and_cancel(
+					[&] (async::cancellation_token cancellation) {
+						return getGlobalFutexRealm()->wait(waiter.grantFutex(), 0,
+								cancellation);
+					},
+					[&] (async::cancellation_token cancellation) {
+						return generalTimerEngine()->sleep(deadline, cancellation);
+					}
+				)
+			);
+		}
+	}
+
+	auto error = getPiFutexRealm()->finishWait(&waiter);
+	if(error == Error::cancelled)
+		return kHelErrCancelled;
+	assert(error == Error::success);
+
+	return kHelErrNone;
+}
+
+HelError helFutexUnlockPi(int *pointer) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take()));
+	if(!futexOrError)
+		return kHelErrFault;
+
+	auto error = getPiFutexRealm()->unlock(std::move(futexOrError.value()),
+			&thisThread->piFutexTask);
+	if(error == Error::illegalState)
+		return kHelErrIllegalState;
+	assert(error == Error::success);
+
+	return kHelErrNone;
+}
+
 HelError helCreateOneshotEvent(HelHandle *handle) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -3037,10 +3620,7 @@ HelError helRaiseEvent(HelHandle handle) {
 
 	AnyDescriptor descriptor;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		descriptor = *wrapper;
@@ -3092,10 +3672,7 @@ HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence)
 
 	smarter::shared_ptr<IrqObject> irq;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto irq_wrapper = this_universe->getDescriptor(handle);
 		if(!irq_wrapper)
 			return kHelErrNoDescriptor;
 		if(!irq_wrapper->is<IrqDescriptor>())
@@ -3214,15 +3791,12 @@ HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 	AnyDescriptor descriptor;
 	smarter::shared_ptr<IpcQueue> queue;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		descriptor = *wrapper;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -3261,17 +3835,14 @@ HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet_hand
 	smarter::shared_ptr<IrqObject> irq;
 	smarter::shared_ptr<BoundKernlet> kernlet;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto irq_wrapper = this_universe->getDescriptor(handle);
 		if(!irq_wrapper)
 			return kHelErrNoDescriptor;
 		if(!irq_wrapper->is<IrqDescriptor>())
 			return kHelErrBadDescriptor;
 		irq = irq_wrapper->get<IrqDescriptor>().irq;
 
-		auto kernlet_wrapper = this_universe->getDescriptor(universe_guard, kernlet_handle);
+		auto kernlet_wrapper = this_universe->getDescriptor(kernlet_handle);
 		if(!kernlet_wrapper)
 			return kHelErrNoDescriptor;
 		if(!kernlet_wrapper->is<BoundKernletDescriptor>())
@@ -3315,10 +3886,7 @@ HelError helEnableIo(HelHandle handle) {
 
 	smarter::shared_ptr<IoSpace> io_space;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<IoDescriptor>())
@@ -3347,6 +3915,112 @@ HelError helEnableFullIo() {
 #endif
 }
 
+namespace {
+
+HelError translateDmaError(Error error) {
+	switch(error) {
+	case Error::illegalArgs: return kHelErrIllegalArgs;
+	case Error::outOfBounds: return kHelErrOutOfBounds;
+	case Error::alreadyExists: return kHelErrAlreadyExists;
+	default: return translateError(error);
+	}
+}
+
+} // anonymous namespace
+
+HelError helMapDma(HelHandle handle, const HelDmaMapping *mappings, size_t count) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<DmaSpace> space;
+	{
+		auto wrapper = thisUniverse->getDescriptor(handle);
+		if(!wrapper)
+			return kHelErrNoDescriptor;
+		if(!wrapper->is<DmaSpaceDescriptor>())
+			return kHelErrBadDescriptor;
+		space = wrapper->get<DmaSpaceDescriptor>().dmaSpace;
+	}
+
+	HelError result = kHelErrNone;
+	for(size_t i = 0; i < count; i++) {
+		HelDmaMapping mapping;
+		if(!readUserObject(mappings + i, mapping)) {
+			result = kHelErrFault;
+			break;
+		}
+
+		if(mapping.flags & ~uint32_t{kHelDmaRead | kHelDmaWrite}) {
+			result = kHelErrIllegalArgs;
+			break;
+		}
+		DmaFlags flags = 0;
+		if(mapping.flags & kHelDmaRead)
+			flags |= dmaRead;
+		if(mapping.flags & kHelDmaWrite)
+			flags |= dmaWrite;
+
+		smarter::shared_ptr<MemoryView> view;
+		{
+			auto wrapper = thisUniverse->getDescriptor(mapping.memory);
+			if(!wrapper) {
+				result = kHelErrNoDescriptor;
+				break;
+			}
+			if(!wrapper->is<MemoryViewDescriptor>()) {
+				result = kHelErrBadDescriptor;
+				break;
+			}
+			view = wrapper->get<MemoryViewDescriptor>().memory;
+		}
+
+		auto error = Thread::asyncBlockCurrent(space->map(std::move(view), mapping.offset,
+				mapping.ioAddress, mapping.length, flags, thisThread->mainWorkQueue()->take()));
+		if(error != Error::success) {
+			result = translateDmaError(error);
+			break;
+		}
+	}
+
+	// Even on error, make the successful mappings visible.
+	space->flush();
+	return result;
+}
+
+HelError helUnmapDma(HelHandle handle, const uintptr_t *ioAddresses, size_t count) {
+	auto thisThread = getCurrentThread();
+	auto thisUniverse = thisThread->getUniverse();
+
+	smarter::shared_ptr<DmaSpace> space;
+	{
+		auto wrapper = thisUniverse->getDescriptor(handle);
+		if(!wrapper)
+			return kHelErrNoDescriptor;
+		if(!wrapper->is<DmaSpaceDescriptor>())
+			return kHelErrBadDescriptor;
+		space = wrapper->get<DmaSpaceDescriptor>().dmaSpace;
+	}
+
+	HelError result = kHelErrNone;
+	for(size_t i = 0; i < count; i++) {
+		uintptr_t ioAddress;
+		if(!readUserObject(ioAddresses + i, ioAddress)) {
+			result = kHelErrFault;
+			break;
+		}
+
+		auto error = space->unmap(ioAddress);
+		if(error != Error::success) {
+			result = translateDmaError(error);
+			break;
+		}
+	}
+
+	// All unmaps are covered by a single IOTLB invalidation.
+	space->flush();
+	return result;
+}
+
 HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num_data,
 		HelHandle *bound_handle) {
 	auto this_thread = getCurrentThread();
@@ -3354,10 +4028,7 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 
 	smarter::shared_ptr<KernletObject> kernlet;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto kernlet_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto kernlet_wrapper = this_universe->getDescriptor(handle);
 		if(!kernlet_wrapper)
 			return kHelErrNoDescriptor;
 		if(!kernlet_wrapper->is<KernletObjectDescriptor>())
@@ -3382,10 +4053,7 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 		}else if(defn.type == KernletParameterType::memoryView) {
 			smarter::shared_ptr<MemoryView> memory;
 			{
-				auto irq_lock = frg::guard(&irqMutex());
-				Universe::Guard universe_guard(this_universe->lock);
-
-				auto wrapper = this_universe->getDescriptor(universe_guard, d.handle);
+				auto wrapper = this_universe->getDescriptor(d.handle);
 				if(!wrapper)
 					return kHelErrNoDescriptor;
 				if(!wrapper->is<MemoryViewDescriptor>())
@@ -3393,6 +4061,10 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 				memory = wrapper->get<MemoryViewDescriptor>().memory;
 			}
 
+			// The window is never unmapped; keep the pages resident (i.e., not swapped out).
+			if(memory->lockRange(0, memory->getLength()) != Error::success)
+				return kHelErrFault;
+
 			auto window = reinterpret_cast<char *>(KernelVirtualMemory::global().allocate(0x10000));
 			assert(memory->getLength() <= 0x10000);
 
@@ -3409,10 +4081,7 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 
 			smarter::shared_ptr<BitsetEvent> event;
 			{
-				auto irq_lock = frg::guard(&irqMutex());
-				Universe::Guard universe_guard(this_universe->lock);
-
-				auto wrapper = this_universe->getDescriptor(universe_guard, d.handle);
+				auto wrapper = this_universe->getDescriptor(d.handle);
 				if(!wrapper)
 					return kHelErrNoDescriptor;
 				if(!wrapper->is<BitsetEventDescriptor>())
@@ -3441,10 +4110,7 @@ HelError helGetAffinity(HelHandle handle, uint8_t *mask, size_t size, size_t *ac
 
 	smarter::borrowed_ptr<Thread> thread;
 	{
-		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
-
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -3494,10 +4160,7 @@ HelError helSetAffinity(HelHandle handle, uint8_t *mask, size_t size) {
 	} else {
 		smarter::borrowed_ptr<Thread> thread;
 		{
-			auto irq_lock = frg::guard(&irqMutex());
-			Universe::Guard universe_guard(this_universe->lock);
-
-			auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+			auto thread_wrapper = this_universe->getDescriptor(handle);
 			if(!thread_wrapper)
 				return kHelErrNoDescriptor;
 			if(!thread_wrapper->is<ThreadDescriptor>())
@@ -3544,6 +4207,10 @@ HelError helQueryRegisterInfo(int set, HelRegisterInfo *info) {
 		case kHelRegsVirtualization:
 			outInfo.setSize = sizeof(HelX86VirtualizationRegs);
 			break;
+
+		case kHelRegsVirtualizationControl:
+			outInfo.setSize = sizeof(HelX86VirtualizationControl);
+			break;
 #endif
 
 		case kHelRegsSimd:
@@ -8,6 +8,20 @@ namespace thor {
 
 namespace {
 	constexpr bool logService = false;
+
+	// Level-triggered IRQs that are raised more often than this are masked for a while.
+	constexpr uint64_t stormWindowNanos = 100'000'000;
+	constexpr unsigned int stormThreshold = 10'000;
+
+	frg::ticket_spinlock allPinsMutex;
+	frg::intrusive_list<
+		IrqPin,
+		frg::locate_member<
+			IrqPin,
+			frg::default_list_hook<IrqPin>,
+			&IrqPin::allPinsHook
+		>
+	> allPinsList;
 }
 
 // --------------------------------------------------------
@@ -123,13 +137,19 @@ IrqPin::IrqPin(frg::string<KernelAlloc> name)
 : _name{std::move(name)}, _strategy{IrqStrategy::null},
 		_inService{false}, _dueSinks{0},
 		_maskState{0} {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&allPinsMutex);
+		allPinsList.push_back(this);
+	}
+
 	[] (IrqPin *self, enable_detached_coroutine = {}) -> void {
 		while(true) {
 			co_await self->_unstallEvent.async_wait_if([&] () -> bool {
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&self->_mutex);
 
-				return !(self->_maskState & maskedForNack);
+				return !(self->_maskState & (maskedForNack | maskedForStorm));
 			});
 
 			// Enter the WQ to avoid doing work in IRQ context,
@@ -141,7 +161,7 @@ IrqPin::IrqPin(frg::string<KernelAlloc> name)
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&self->_mutex);
 
-				if(!(self->_maskState & maskedForNack))
+				if(!(self->_maskState & (maskedForNack | maskedForStorm)))
 					continue;
 			}
 
@@ -154,6 +174,14 @@ IrqPin::IrqPin(frg::string<KernelAlloc> name)
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&self->_mutex);
 
+				if(self->_maskState & maskedForStorm) {
+					debugLogger() << "thor: Unthrottling IRQ " << self->name()
+							<< " after " << ms << " ms" << frg::endlog;
+					self->_maskState &= ~maskedForStorm;
+					self->_stormWindowRaises = 0;
+					self->_updateMask();
+				}
+
 				if(!(self->_maskState & maskedForNack))
 					continue;
 				debugLogger() << "thor: Unstalling IRQ " << self->name()
@@ -185,10 +213,29 @@ void IrqPin::configure(IrqConfiguration desired) {
 	}
 }
 
+frg::vector<IrqPin *, KernelAlloc> IrqPin::allPins() {
+	frg::vector<IrqPin *, KernelAlloc> pins{*kernelAlloc};
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&allPinsMutex);
+	for(auto pin : allPinsList)
+		pins.push_back(pin);
+	return pins;
+}
+
+IrqPin::Statistics IrqPin::getStatistics() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+	return _stats;
+}
+
 void IrqPin::raise() {
 	assert(!intsAreEnabled());
 	auto lock = frg::guard(&_mutex);
 
+	++_stats.raises;
+	getCpuData()->irqCount.fetch_add(1, std::memory_order_relaxed);
+
 	if(_strategy == IrqStrategy::null) {
 		debugLogger() << "thor: Unconfigured IRQ was raised" << frg::endlog;
 		dumpHardwareState();
@@ -199,6 +246,7 @@ void IrqPin::raise() {
 
 	// If the IRQ is already masked, we're encountering a hardware race.
 	if(_maskState) {
+		++_stats.maskedRaises;
 		++_maskedRaiseCtr;
 		// At least on x86, the IRQ controller may buffer up to one edge-triggered IRQ.
 		// If an IRQ is already buffered while we mask it, it will inevitably be raised again.
@@ -242,15 +290,51 @@ void IrqPin::raise() {
 		return;
 	}
 
+	// A level-triggered IRQ that keeps firing (e.g., because nobody clears the
+	// device's IRQ condition) would otherwise eat the CPU. Edge-triggered IRQs
+	// are not throttled since masking them can lose edges.
+	// Only raises that follow a service that no sink acked are counted;
+	// busy devices that keep acknowledging their IRQs are never throttled.
+	if(_strategy == IrqStrategy::maskThenEoi && !_lastServiceAcked) {
+		auto now = systemClockSource()->currentNanos();
+		if(now - _stormWindowStart > stormWindowNanos) {
+			_stormWindowStart = now;
+			_stormWindowRaises = 0;
+		}
+
+		if(++_stormWindowRaises > stormThreshold) {
+			++_stats.storms;
+			urgentLogger() << "thor: IRQ " << _name << " is storming ("
+					<< _stormWindowRaises << " raises in "
+					<< (now - _stormWindowStart) / 1'000'000 << " ms), throttling it"
+					<< frg::endlog;
+			_maskState |= maskedForStorm;
+			_unstallEvent.raise();
+
+			_updateMask();
+			sendEoi();
+			return;
+		}
+	}
+
 	_doService();
 
 	_updateMask();
 	sendEoi();
 }
 
+void IrqPin::_countAck() {
+	auto latency = systemClockSource()->currentNanos() - _raiseClock;
+	++_stats.acks;
+	_stats.totalAckLatency += latency;
+	if(latency > _stats.maxAckLatency)
+		_stats.maxAckLatency = latency;
+}
+
 void IrqPin::_acknowledge() {
 	assert(_inService);
 	assert(_dueSinks);
+	_countAck();
 	_dispatchAcks = true;
 	_dueSinks--;
 
@@ -261,6 +345,7 @@ void IrqPin::_acknowledge() {
 void IrqPin::_nack() {
 	assert(_inService);
 	assert(_dueSinks);
+	++_stats.nacks;
 	_dueSinks--;
 
 	if(!_dueSinks)
@@ -271,6 +356,7 @@ void IrqPin::_kick(bool doClear) {
 	if(doClear) {
 		assert(_inService);
 		assert(_dueSinks);
+		_countAck();
 		_dueSinks--;
 	}else{
 		if(!_inService)
@@ -293,6 +379,7 @@ void IrqPin::_dispatch() {
 		if(_unstallExponent > 0)
 			--_unstallExponent;
 	}
+	_lastServiceAcked = _dispatchAcks;
 
 	if(_dispatchKicks)
 		_maskState &= ~maskedForNack;
@@ -406,10 +493,13 @@ void IrqPin::_doService() {
 
 			if(_unstallExponent > 0)
 				--_unstallExponent;
+			_lastServiceAcked = true;
 
 			_inService = false;
 			_maskState &= ~maskedForService;
 		}else{
+			++_stats.nacks;
+			_lastServiceAcked = false;
 			urgentLogger() << "thor: IRQ " << _name << " was nacked (synchronously)!" << frg::endlog;
 			for(auto it = _sinkList.begin(); it != _sinkList.end(); ++it) {
 				auto lock = frg::guard(&(*it)->_mutex);
@@ -3,9 +3,12 @@
 #include <thor-internal/universe.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/fiber.hpp>
+#include <thor-internal/irq.hpp>
 #include <thor-internal/kerncfg.hpp>
 #include <thor-internal/ostrace.hpp>
 #include <thor-internal/kernel-log.hpp>
+#include <thor-internal/lockstat.hpp>
+#include <thor-internal/memory-view.hpp>
 #include <thor-internal/profile.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/timer.hpp>
@@ -84,6 +87,8 @@ private:
 			resp.set_total_usable_memory(physicalAllocator->numTotalPages());
 			resp.set_available_memory(physicalAllocator->numFreePages());
 			resp.set_memory_unit(kPageSize);
+			resp.set_dirty_memory(numDirtyPages());
+			resp.set_writeback_memory(numWritebackPages());
 
 			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
 			bragi::write_head_only(resp, respBuffer);
@@ -107,6 +112,77 @@ private:
 			if(respError != Error::success) {
 				co_return respError;
 			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetIrqStatisticsRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::GetIrqStatisticsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req)
+				co_return Error::protocolViolation;
+
+			managarm::kerncfg::GetIrqStatisticsResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::kerncfg::Error::SUCCESS);
+
+			for(auto pin : IrqPin::allPins()) {
+				auto stats = pin->getStatistics();
+
+				managarm::kerncfg::IrqPinStatistics<KernelAlloc> entry(*kernelAlloc);
+				entry.set_name(frg::string<KernelAlloc>{*kernelAlloc, pin->name()});
+				entry.set_raises(stats.raises);
+				entry.set_masked_raises(stats.maskedRaises);
+				entry.set_acks(stats.acks);
+				entry.set_nacks(stats.nacks);
+				entry.set_storms(stats.storms);
+				entry.set_total_ack_latency(stats.totalAckLatency);
+				entry.set_max_ack_latency(stats.maxAckLatency);
+				resp.add_pins(std::move(entry));
+			}
+
+			for(size_t i = 0; i < getCpuCount(); i++)
+				resp.add_cpu_irqs(getCpuData(i)->irqCount.load(std::memory_order_relaxed));
+
+			frg::unique_memory<KernelAlloc> respHeadBuffer{*kernelAlloc, resp.size_of_head()};
+			frg::unique_memory<KernelAlloc> respTailBuffer{*kernelAlloc, resp.size_of_tail()};
+			bragi::write_head_tail(resp, respHeadBuffer, respTailBuffer);
+			auto respHeadError = co_await SendBufferSender{lane, std::move(respHeadBuffer)};
+			if(respHeadError != Error::success)
+				co_return respHeadError;
+			auto respTailError = co_await SendBufferSender{lane, std::move(respTailBuffer)};
+			if(respTailError != Error::success)
+				co_return respTailError;
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetLockStatisticsRequest>) {
+			auto req = bragi::parse_head_only<managarm::kerncfg::GetLockStatisticsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!req)
+				co_return Error::protocolViolation;
+
+			managarm::kerncfg::GetLockStatisticsResponse<KernelAlloc> resp(*kernelAlloc);
+#ifdef THOR_LOCKSTAT
+			resp.set_error(managarm::kerncfg::Error::SUCCESS);
+
+			for(auto cls = LockClass::firstClass(); cls; cls = cls->nextClass()) {
+				managarm::kerncfg::LockClassStatistics<KernelAlloc> entry(*kernelAlloc);
+				entry.set_name(frg::string<KernelAlloc>{*kernelAlloc, cls->name});
+				entry.set_acquisitions(cls->acquisitions.load(std::memory_order_relaxed));
+				entry.set_contended_acquisitions(
+						cls->contendedAcquisitions.load(std::memory_order_relaxed));
+				entry.set_total_spin_time(cls->totalSpinTime.load(std::memory_order_relaxed));
+				entry.set_max_spin_time(cls->maxSpinTime.load(std::memory_order_relaxed));
+				entry.set_total_hold_time(cls->totalHoldTime.load(std::memory_order_relaxed));
+				entry.set_max_hold_time(cls->maxHoldTime.load(std::memory_order_relaxed));
+				resp.add_classes(std::move(entry));
+			}
+#else
+			resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
+#endif
+
+			frg::unique_memory<KernelAlloc> respHeadBuffer{*kernelAlloc, resp.size_of_head()};
+			frg::unique_memory<KernelAlloc> respTailBuffer{*kernelAlloc, resp.size_of_tail()};
+			bragi::write_head_tail(resp, respHeadBuffer, respTailBuffer);
+			auto respHeadError = co_await SendBufferSender{lane, std::move(respHeadBuffer)};
+			if(respHeadError != Error::success)
+				co_return respHeadError;
+			auto respTailError = co_await SendBufferSender{lane, std::move(respTailBuffer)};
+			if(respTailError != Error::success)
+				co_return respTailError;
 		}else{
 			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
 			resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
@@ -123,8 +199,9 @@ private:
 };
 
 struct ByteRingBusObject : private KernelBusObject {
-	ByteRingBusObject(LogRingBuffer *buffer, frg::string_view purpose)
-	: buffer_{buffer}, purpose_{purpose} { }
+	ByteRingBusObject(LogRingBuffer *buffer, frg::string_view purpose,
+			smarter::shared_ptr<MemoryView> memory = {})
+	: buffer_{buffer}, purpose_{purpose}, memory_{std::move(memory)} { }
 
 	coroutine<void> run() {
 		Properties properties;
@@ -138,6 +215,8 @@ struct ByteRingBusObject : private KernelBusObject {
 private:
 	LogRingBuffer *buffer_;
 	frg::string_view purpose_;
+	// Memory that user space can map to read the ring directly; can be null.
+	smarter::shared_ptr<MemoryView> memory_;
 
 	coroutine<frg::expected<Error>> handleRequest(LaneHandle boundLane) override {
 		auto [acceptError, lane] = co_await AcceptSender{boundLane};
@@ -228,6 +307,39 @@ private:
 
 			if(dataError != Error::success)
 				co_return dataError;
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::GetRingMemoryRequest>) {
+			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(memory_ ? managarm::kerncfg::Error::SUCCESS
+					: managarm::kerncfg::Error::ILLEGAL_REQUEST);
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success)
+				co_return respError;
+
+			if(memory_) {
+				auto memoryError = co_await PushDescriptorSender{lane, MemoryViewDescriptor{memory_}};
+				if(memoryError != Error::success)
+					co_return memoryError;
+			}
+		}else if(preamble.id() == bragi::message_id<managarm::kerncfg::WaitForRecordsRequest>) {
+			auto maybeReq = bragi::parse_head_only<managarm::kerncfg::WaitForRecordsRequest>(reqBuffer, *kernelAlloc);
+
+			if (!maybeReq)
+				co_return Error::protocolViolation;
+
+			co_await buffer_->wait(maybeReq->dequeue());
+
+			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::kerncfg::Error::SUCCESS);
+			resp.set_new_dequeue(buffer_->headPtr());
+
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, resp.size_of_head()};
+			bragi::write_head_only(resp, respBuffer);
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+			if(respError != Error::success)
+				co_return respError;
 		}else{
 			managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
 			resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
@@ -252,7 +364,8 @@ void initializeKerncfg() {
 		async::detach_with_allocator(*kernelAlloc, kerncfg->run());
 
 		{
-			auto ring = frg::construct<ByteRingBusObject>(*kernelAlloc, getGlobalLogRing(), "kernel-log");
+			auto ring = frg::construct<ByteRingBusObject>(*kernelAlloc, getGlobalLogRing(), "kernel-log",
+					getGlobalLogRingMemory());
 			async::detach_with_allocator(*kernelAlloc, ring->run());
 		}
 
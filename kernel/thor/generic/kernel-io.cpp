@@ -35,21 +35,29 @@ smarter::shared_ptr<KernelIoChannel> solicitIoChannel(frg::string_view tag) {
 coroutine<void> dumpRingToChannel(LogRingBuffer *ringBuffer,
 		smarter::shared_ptr<KernelIoChannel> channel, size_t packetSize) {
 	uint64_t currentPtr = 0;
+	// True if output was produced since the last call to issueIo().
+	bool unflushed = false;
 	while(true) {
 		auto span = channel->writableSpan();
 		if(span.size() < packetSize) {
 			auto ioOutcome = co_await channel->issueIo(KernelIoChannel::ioProgressOutput);
 			assert(ioOutcome);
+			unflushed = false;
 			continue;
 		}
 
+		// Fill as much of the span as possible such that a single I/O operation
+		// transfers many records.
 		size_t progress = 0;
+		bool drained = false;
 		while(progress < span.size()) {
 			auto [success, recordPtr, nextPtr, actualSize] = ringBuffer->dequeueAt(
 					currentPtr, span.data() + progress, span.size() - progress);
 			if(!success) {
-				if(progress)
+				if(progress || unflushed) {
+					drained = true;
 					break;
+				}
 				co_await ringBuffer->wait(nextPtr);
 				continue;
 			}
@@ -69,7 +77,18 @@ coroutine<void> dumpRingToChannel(LogRingBuffer *ringBuffer,
 			progress += actualSize;
 		}
 
-		channel->produceOutput(progress);
+		if(progress) {
+			channel->produceOutput(progress);
+			unflushed = true;
+		}
+
+		// Flush before we wait for more records; otherwise, the output would only be
+		// transferred once the channel's buffer fills up.
+		if(drained) {
+			auto ioOutcome = co_await channel->issueIo(KernelIoChannel::ioProgressOutput);
+			assert(ioOutcome);
+			unflushed = false;
+		}
 	}
 }
 
@@ -3,6 +3,8 @@
 #include <thor-internal/kernel-io.hpp>
 #include <thor-internal/kernel-log.hpp>
 #include <thor-internal/main.hpp>
+#include <thor-internal/memory-view.hpp>
+#include <thor-internal/physical.hpp>
 #include <thor-internal/timer.hpp>
 #include <frg/string.hpp>
 
@@ -86,7 +88,56 @@ namespace {
 		}
 	};
 
+	constexpr size_t logRingSize = 1 << 20;
+
+	// View of the log ring for user space: the HelLogRingHeader, followed by the storage
+	// of the ring. Like HardwareMemory, the pages are never evicted.
+	// Since we cannot enforce read-only mappings, LogRingBuffer tolerates corrupted headers.
+	struct LogRingMemory final : MemoryView {
+		LogRingMemory(PhysicalAddr header, PhysicalAddr storage)
+		: header_{header}, storage_{storage} { }
+
+		size_t getLength() override {
+			return kPageSize + logRingSize;
+		}
+
+		frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
+		resolveGlobalFutex(uintptr_t) override {
+			return Error::illegalObject;
+		}
+
+		Error lockRange(uintptr_t, size_t) override {
+			return Error::success;
+		}
+
+		void unlockRange(uintptr_t, size_t) override { }
+
+		frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override {
+			assert(offset % kPageSize == 0);
+			if(offset < kPageSize)
+				return frg::tuple<PhysicalAddr, CachingMode>{header_, CachingMode::null};
+			return frg::tuple<PhysicalAddr, CachingMode>{storage_ + (offset - kPageSize),
+					CachingMode::null};
+		}
+
+		coroutine<frg::expected<Error, PhysicalRange>>
+		fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue>) override {
+			assert(offset % kPageSize == 0);
+			if(offset < kPageSize)
+				co_return PhysicalRange{header_, kPageSize, CachingMode::null};
+			co_return PhysicalRange{storage_ + (offset - kPageSize),
+					logRingSize - (offset - kPageSize), CachingMode::null};
+		}
+
+		void markDirty(uintptr_t, size_t) override { }
+
+	private:
+		PhysicalAddr header_;
+		PhysicalAddr storage_;
+	};
+
 	frg::manual_box<LogRingBuffer> globalLogRing;
+	smarter::shared_ptr<MemoryView> globalLogRingMemory;
 
 	initgraph::Task initLogSinks{&globalInitEngine, "generic.init-kernel-log",
 		initgraph::Requires{getFibersAvailableStage(),
@@ -108,8 +159,22 @@ frg::manual_box<KmsgLogHandlerContext> kmsgLogHandlerContext;
 frg::manual_box<KmsgLogHandler> kmsgLogHandler;
 
 void initializeLog() {
-	void *logMemory = kernelAlloc->allocate(1 << 20);
-	globalLogRing.initialize(reinterpret_cast<uintptr_t>(logMemory), 1 << 20);
+	// The ring is allocated from physical memory such that it can be mapped into user space.
+	auto headerPhysical = physicalAllocator->allocate(kPageSize);
+	auto storagePhysical = physicalAllocator->allocate(logRingSize);
+	assert(headerPhysical != PhysicalAddr(-1) && "OOM when allocating the kernel log");
+	assert(storagePhysical != PhysicalAddr(-1) && "OOM when allocating the kernel log");
+
+	auto header = reinterpret_cast<HelLogRingHeader *>(mapDirectPhysical(headerPhysical));
+	auto storage = mapDirectPhysical(storagePhysical);
+	memset(header, 0, kPageSize);
+	memset(storage, 0, logRingSize);
+	header->dataOffset = kPageSize;
+
+	globalLogRing.initialize(reinterpret_cast<uintptr_t>(storage), logRingSize);
+	globalLogRing->shareHeader(header);
+	globalLogRingMemory = smarter::allocate_shared<LogRingMemory>(*kernelAlloc,
+			headerPhysical, storagePhysical);
 	kmsgLogHandlerContext.initialize();
 	kmsgLogHandler.initialize(kmsgLogHandlerContext.get());
 	enableLogHandler(kmsgLogHandler.get());
@@ -119,4 +184,8 @@ LogRingBuffer *getGlobalLogRing() {
 	return globalLogRing.get();
 }
 
+smarter::shared_ptr<MemoryView> getGlobalLogRingMemory() {
+	return globalLogRingMemory;
+}
+
 } // namespace thor
@@ -1,4 +1,5 @@
 #include <thor-internal/arch/paging.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/kernel-stack.hpp>
@@ -7,6 +8,13 @@
 namespace thor {
 
 UniqueKernelStack UniqueKernelStack::make() {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto cache = &getCpuData()->stackCache;
+		if(cache->numStacks)
+			return UniqueKernelStack(cache->stacks[--cache->numStacks]);
+	}
+
 	size_t guardedSize = kSize + kPageSize;
 	auto pointer = KernelVirtualMemory::global().allocate(guardedSize);
 
@@ -24,9 +32,20 @@ UniqueKernelStack UniqueKernelStack::make() {
 UniqueKernelStack::~UniqueKernelStack() {
 	if(!_base)
 		return;
+	auto top = _top();
+
+	// Keep the stack mapped if there is space in the cache.
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto cache = &getCpuData()->stackCache;
+		if(cache->numStacks < KernelStackCpuCache::capacity) {
+			cache->stacks[cache->numStacks++] = top;
+			return;
+		}
+	}
 
 	size_t guardedSize = kSize + kPageSize;
-	auto address = reinterpret_cast<uintptr_t>(_base - guardedSize);
+	auto address = reinterpret_cast<uintptr_t>(top - guardedSize);
 	for(size_t offset = 0; offset < kSize; offset += kPageSize) {
 		PhysicalAddr physical = KernelPageSpace::global().unmapSingle4k(
 				address + guardedSize - kSize + offset);
@@ -59,4 +78,10 @@ UniqueKernelStack::~UniqueKernelStack() {
 		p->complete();
 }
 
+char *UniqueKernelStack::_top() {
+	// The top of the stack is page-aligned; embedded objects are smaller than a page.
+	auto top = (reinterpret_cast<uintptr_t>(_base) + kPageSize - 1) & ~uintptr_t(kPageSize - 1);
+	return reinterpret_cast<char *>(top);
+}
+
 } //namespace thor
@@ -0,0 +1,311 @@
+#include <atomic>
+#include <new>
+
+#include <frg/manual_box.hpp>
+#include <thor-internal/arch/paging.hpp>
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/kfence.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/physical.hpp>
+
+namespace thor {
+
+constinit uintptr_t kfencePoolBase = 0;
+constinit uintptr_t kfencePoolLimit = 0;
+
+namespace {
+
+// Number of guarded objects. Each object occupies one data page and one guard page.
+constexpr size_t kfenceNumSlots = 255;
+
+// Every kfenceSampleInterval-th allocation on each CPU is sampled.
+constexpr unsigned int kfenceSampleInterval = 1024;
+
+constexpr size_t kfenceStackDepth = 16;
+
+// Alignment of sampled objects. Objects are aligned to this but otherwise placed
+// as close as possible to the end of their page.
+constexpr size_t kfenceAlignment = 16;
+
+enum class KfenceState {
+	unused,
+	allocated,
+	freed
+};
+
+struct KfenceSlot {
+	// Puts the slot back onto the free list once its page is unmapped on all CPUs.
+	struct Shootdown final : ShootNode {
+		void complete() override;
+
+		KfenceSlot *slot;
+	};
+
+	struct Stack {
+		void record() {
+			depth = 0;
+#ifdef THOR_HAS_FRAME_POINTERS
+			walkThisStack([&] (uintptr_t ip) {
+				if(depth < kfenceStackDepth)
+					ips[depth++] = ip;
+			});
+#endif
+		}
+
+		size_t depth = 0;
+		uintptr_t ips[kfenceStackDepth];
+	};
+
+	uintptr_t page() {
+		return kfencePoolBase + (2 * index + 1) * kPageSize;
+	}
+
+	size_t index;
+	PhysicalAddr physical;
+	KfenceState state = KfenceState::unused;
+	uintptr_t object = 0;
+	size_t size = 0;
+	Stack allocStack;
+	Stack freeStack;
+	Shootdown shootdown;
+	KfenceSlot *next = nullptr;
+};
+
+// Protects the free list and the state of all slots.
+constinit IrqSpinlock kfenceLock;
+
+constinit KfenceSlot *kfenceSlots = nullptr;
+
+// Slots are reused in FIFO order; this delays reuse of freed pages as long as possible
+// and thus maximizes the chance of catching use-after-free.
+constinit KfenceSlot *kfenceFreeHead = nullptr;
+constinit KfenceSlot *kfenceFreeTail = nullptr;
+
+constinit std::atomic<bool> kfenceReady{false};
+
+uint8_t canaryByte(uintptr_t address) {
+	return 0xAA ^ static_cast<uint8_t>(address & 7);
+}
+
+// Returns the first corrupted canary byte or zero if all canaries are intact.
+uintptr_t checkCanaries(KfenceSlot *slot) {
+	for(uintptr_t p = slot->page(); p < slot->object; p++)
+		if(*reinterpret_cast<uint8_t *>(p) != canaryByte(p))
+			return p;
+	for(uintptr_t p = slot->object + slot->size; p < slot->page() + kPageSize; p++)
+		if(*reinterpret_cast<uint8_t *>(p) != canaryByte(p))
+			return p;
+	return 0;
+}
+
+void pushFreeSlot(KfenceSlot *slot) {
+	slot->next = nullptr;
+	if(kfenceFreeTail) {
+		kfenceFreeTail->next = slot;
+	}else{
+		kfenceFreeHead = slot;
+	}
+	kfenceFreeTail = slot;
+}
+
+KfenceSlot *popFreeSlot() {
+	auto slot = kfenceFreeHead;
+	if(!slot)
+		return nullptr;
+	kfenceFreeHead = slot->next;
+	if(!kfenceFreeHead)
+		kfenceFreeTail = nullptr;
+	return slot;
+}
+
+void KfenceSlot::Shootdown::complete() {
+	auto lock = frg::guard(&kfenceLock);
+	pushFreeSlot(slot);
+}
+
+void printStack(const char *what, KfenceSlot::Stack &stack) {
+	urgentLogger() << "thor: KFENCE: " << what << ":" << frg::endlog;
+	for(size_t i = 0; i < stack.depth; i++)
+		urgentLogger() << "\t<" << (void *)stack.ips[i] << ">" << frg::endlog;
+}
+
+void printObject(KfenceSlot *slot) {
+	urgentLogger() << "thor: KFENCE: Object " << (void *)slot->object
+			<< " of size " << slot->size << frg::endlog;
+	if(slot->state != KfenceState::unused)
+		printStack("Allocated by", slot->allocStack);
+	if(slot->state == KfenceState::freed)
+		printStack("Freed by", slot->freeStack);
+}
+
+void *kfenceAllocate(size_t size) {
+	KfenceSlot *slot;
+	{
+		auto lock = frg::guard(&kfenceLock);
+		slot = popFreeSlot();
+		if(!slot)
+			return nullptr;
+		slot->state = KfenceState::allocated;
+		slot->object = slot->page() + kPageSize
+				- ((size + kfenceAlignment - 1) & ~(kfenceAlignment - 1));
+		slot->size = size;
+		slot->allocStack.record();
+	}
+
+	KernelPageSpace::global().mapSingle4k(slot->page(), slot->physical,
+			page_access::write, CachingMode::null);
+	for(uintptr_t p = slot->page(); p < slot->page() + kPageSize; p++)
+		*reinterpret_cast<uint8_t *>(p) = canaryByte(p);
+	return reinterpret_cast<void *>(slot->object);
+}
+
+KfenceSlot *slotOf(uintptr_t address) {
+	auto pageIndex = (address - kfencePoolBase) / kPageSize;
+	if(!(pageIndex & 1))
+		return nullptr;
+	return &kfenceSlots[pageIndex / 2];
+}
+
+} // anonymous namespace
+
+void *kfenceSampleAllocate(size_t size) {
+	if(!kfenceReady.load(std::memory_order_acquire))
+		return nullptr;
+	if(!size || size > kPageSize)
+		return nullptr;
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto cache = &getCpuData()->heapCache;
+		if(cache->kfenceCountdown) {
+			cache->kfenceCountdown--;
+			return nullptr;
+		}
+		cache->kfenceCountdown = kfenceSampleInterval - 1;
+	}
+
+	return kfenceAllocate(size);
+}
+
+void kfenceFree(void *pointer) {
+	auto address = reinterpret_cast<uintptr_t>(pointer);
+	auto slot = slotOf(address);
+
+	{
+		auto lock = frg::guard(&kfenceLock);
+		if(!slot || slot->state != KfenceState::allocated || slot->object != address) {
+			urgentLogger() << "thor: KFENCE: Invalid free of " << pointer << frg::endlog;
+			if(slot)
+				printObject(slot);
+			panicLogger() << "thor: KFENCE: Memory error detected" << frg::endlog;
+		}
+
+		if(auto corrupted = checkCanaries(slot); corrupted) {
+			urgentLogger() << "thor: KFENCE: Out-of-bounds write at " << (void *)corrupted
+					<< " detected on free" << frg::endlog;
+			printObject(slot);
+			panicLogger() << "thor: KFENCE: Memory error detected" << frg::endlog;
+		}
+
+		slot->state = KfenceState::freed;
+		slot->freeStack.record();
+	}
+
+	KernelPageSpace::global().unmapSingle4k(slot->page());
+	slot->shootdown.address = slot->page();
+	slot->shootdown.size = kPageSize;
+	if(KernelPageSpace::global().submitShootdown(&slot->shootdown))
+		slot->shootdown.complete();
+}
+
+size_t kfenceObjectSize(void *pointer) {
+	auto slot = slotOf(reinterpret_cast<uintptr_t>(pointer));
+	assert(slot);
+	return slot->size;
+}
+
+void handleKfenceFault(uintptr_t address, bool write, uintptr_t ip) {
+	if(!isKfenceObject(reinterpret_cast<void *>(address)))
+		return;
+
+	auto lock = frg::guard(&kfenceLock);
+	const char *access = write ? "write" : "read";
+
+	if(auto slot = slotOf(address); slot) {
+		if(slot->state == KfenceState::freed) {
+			urgentLogger() << "thor: KFENCE: Use-after-free " << access
+					<< " at " << (void *)address << ", faulting ip: " << (void *)ip << frg::endlog;
+		}else{
+			urgentLogger() << "thor: KFENCE: Invalid " << access
+					<< " at " << (void *)address << ", faulting ip: " << (void *)ip << frg::endlog;
+		}
+		printObject(slot);
+		panicLogger() << "thor: KFENCE: Memory error detected" << frg::endlog;
+	}
+
+	// The fault hit a guard page. Blame the closest object on either side.
+	auto guardIndex = (address - kfencePoolBase) / kPageSize / 2;
+	KfenceSlot *left = guardIndex > 0 ? &kfenceSlots[guardIndex - 1] : nullptr;
+	KfenceSlot *right = guardIndex < kfenceNumSlots ? &kfenceSlots[guardIndex] : nullptr;
+	if(left && left->state == KfenceState::unused)
+		left = nullptr;
+	if(right && right->state == KfenceState::unused)
+		right = nullptr;
+
+	KfenceSlot *slot;
+	if(left && right) {
+		auto leftDistance = address - (left->object + left->size);
+		auto rightDistance = right->object - address;
+		slot = leftDistance <= rightDistance ? left : right;
+	}else{
+		slot = left ? left : right;
+	}
+
+	urgentLogger() << "thor: KFENCE: Out-of-bounds " << access
+			<< " at " << (void *)address << ", faulting ip: " << (void *)ip << frg::endlog;
+	if(slot) {
+		if(slot == left) {
+			urgentLogger() << "thor: KFENCE: Access is " << (address - slot->object - slot->size)
+					<< " bytes to the right of the object" << frg::endlog;
+		}else{
+			urgentLogger() << "thor: KFENCE: Access is " << (slot->object - address)
+					<< " bytes to the left of the object" << frg::endlog;
+		}
+		printObject(slot);
+	}
+	panicLogger() << "thor: KFENCE: Memory error detected" << frg::endlog;
+}
+
+namespace {
+	initgraph::Task initKfence{&globalInitEngine, "generic.init-kfence",
+		initgraph::Requires{getFibersAvailableStage()},
+		[] {
+			// Data pages are interleaved with guard pages; the pool starts and ends with a guard page.
+			size_t poolSize = (2 * kfenceNumSlots + 1) * kPageSize;
+			auto pool = KernelVirtualMemory::global().allocate(poolSize);
+			kfencePoolBase = reinterpret_cast<uintptr_t>(pool);
+			kfencePoolLimit = kfencePoolBase + poolSize;
+
+			auto storage = kernelAlloc->allocate(sizeof(KfenceSlot) * kfenceNumSlots);
+			assert(storage);
+			kfenceSlots = static_cast<KfenceSlot *>(storage);
+			for(size_t i = 0; i < kfenceNumSlots; i++) {
+				auto slot = new (&kfenceSlots[i]) KfenceSlot{};
+				slot->index = i;
+				slot->physical = physicalAllocator->allocate(kPageSize);
+				assert(slot->physical != static_cast<PhysicalAddr>(-1) && "OOM");
+				slot->shootdown.slot = slot;
+				pushFreeSlot(slot);
+			}
+
+			infoLogger() << "thor: KFENCE pool with " << kfenceNumSlots << " objects at "
+					<< pool << frg::endlog;
+			kfenceReady.store(true, std::memory_order_release);
+		}
+	};
+}
+
+} // namespace thor
@@ -4,6 +4,7 @@
 #include <elf.h>
 #include <hel.h>
 #include <thor-internal/arch/system.hpp>
+#include <thor-internal/boot-timeline.hpp>
 #include <thor-internal/debug.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/framebuffer/fb.hpp>
@@ -11,6 +12,7 @@
 #include <thor-internal/irq.hpp>
 #include <thor-internal/kerncfg.hpp>
 #include <thor-internal/kernlet.hpp>
+#include <thor-internal/kfence.hpp>
 #include <thor-internal/kernel-log.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/module.hpp>
@@ -135,12 +137,16 @@ void GlobalInitEngine::onRealizeEdge(initgraph::Edge *edge) {
 }
 
 void GlobalInitEngine::preActivate(initgraph::Node *node) {
-	if(node->type() == initgraph::NodeType::task)
+	if(node->type() == initgraph::NodeType::task) {
 		infoLogger() << "thor: Running task " << node->displayName()
 				<< frg::endlog;
+		recordBootTaskStart(node);
+	}
 }
 
 void GlobalInitEngine::postActivate(initgraph::Node *node) {
+	if(node->type() == initgraph::NodeType::task)
+		recordBootTaskEnd(node);
 	if(node->type() == initgraph::NodeType::stage)
 		infoLogger() << "thor: Reached stage " << node->displayName()
 				<< frg::endlog;
@@ -157,6 +163,53 @@ void GlobalInitEngine::onUnreached() {
 			" that could not be reached (circular dependencies?)" << frg::endlog;
 }
 
+bool GlobalInitEngine::dispatchActivation(initgraph::Node *node) {
+	if(!parallel_ || !node->concurrent())
+		return false;
+	if(getCpuCount() < 2 || numDispatched_ == maxDispatched)
+		return false;
+
+	// Spread the tasks round-robin; the boot CPU only blocks in waitForActivation().
+	auto cpuData = getCpuData(nextCpu_++ % getCpuCount());
+	++numDispatched_;
+
+	KernelFiber::run([this, node] {
+		activateNode(node);
+
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&mutex_);
+
+			assert(numCompleted_ < maxDispatched);
+			completed_[numCompleted_++] = node;
+		}
+
+		completionEvent_.raise();
+	}, &cpuData->scheduler);
+	return true;
+}
+
+initgraph::Node *GlobalInitEngine::waitForActivation() {
+	auto haveCompletion = [this] () -> bool {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		return numCompleted_;
+	};
+
+	KernelFiber::asyncBlockCurrent(completionEvent_.async_wait_if([&] () -> bool {
+		return !haveCompletion();
+	}));
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&mutex_);
+
+	assert(numCompleted_);
+	assert(numDispatched_);
+	--numDispatched_;
+	return completed_[--numCompleted_];
+}
+
 constinit GlobalInitEngine globalInitEngine;
 
 initgraph::Stage *getTaskingAvailableStage() {
@@ -171,6 +224,8 @@ initgraph::Edge fibersTaskingEdge{
 };
 
 extern "C" void thorMain() {
+	startBootTimeline();
+
 	kernelCommandLine.initialize(*kernelAlloc,
 			reinterpret_cast<const char *>(thorBootInfoPtr->commandLine));
 
@@ -179,6 +234,7 @@ extern "C" void thorMain() {
 
 	// Run the initgraph tasks that we need for tasking.
 	globalInitEngine.run(getTaskingAvailableStage());
+	calibrateBootTimeline();
 
 	initializeRandom();
 
@@ -196,7 +252,10 @@ extern "C" void thorMain() {
 		initializeMbusStream();
 
 		// Run all other initgraph tasks.
+		// Concurrent tasks are spread across all CPUs that are up at that point.
+		globalInitEngine.enableParallelActivation();
 		globalInitEngine.run();
+		emitBootTimeline();
 
 		transitionBootFb();
 
@@ -433,6 +492,10 @@ void handlePageFault(FaultImageAccessor image, uintptr_t address, Word errorCode
 				logFault();
 			panicLogger() << "thor: SMAP fault." << frg::endlog;
 		}
+
+#ifdef THOR_KFENCE
+		handleKfenceFault(address, errorCode & kPfWrite, *image.ip());
+#endif
 	}else{
 		assert(errorCode & kPfUser);
 	}
@@ -663,6 +726,9 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helForkMemory((HelHandle)arg0, &forkedHandle);
 		*image.out0() = forkedHandle;
 	} break;
+	case kHelCallForkSpace: {
+		*image.error() = helForkSpace((HelHandle)arg0, (HelForkArea *)arg1, (size_t)arg2);
+	} break;
 	case kHelCallCreateSpace: {
 		HelHandle handle;
 		*image.error() = helCreateSpace(&handle);
@@ -690,6 +756,10 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helPointerPhysical((void *)arg0, &physical);
 		*image.out0() = physical;
 	} break;
+	case kHelCallQueryMappingUsage: {
+		*image.error() = helQueryMappingUsage((HelHandle)arg0, (void *)arg1,
+				(size_t)arg2, (HelMappingUsage *)arg3);
+	} break;
 	case kHelCallSubmitReadMemory: {
 		*image.error() = helSubmitReadMemory((HelHandle)arg0, (uintptr_t)arg1,
 				(size_t)arg2, (void *)arg3,
@@ -700,6 +770,30 @@ void handleSyscall(SyscallImageAccessor image) {
 				(size_t)arg2, (const void *)arg3,
 				(HelHandle)arg4, (uintptr_t)arg5);
 	} break;
+	case kHelCallSubmitReadMemoryVector: {
+		*image.error() = helSubmitReadMemoryVector((HelHandle)arg0,
+				(const HelMemoryVector *)arg1, (size_t)arg2,
+				(HelHandle)arg3, (uintptr_t)arg4);
+	} break;
+	case kHelCallSubmitWriteMemoryVector: {
+		*image.error() = helSubmitWriteMemoryVector((HelHandle)arg0,
+				(const HelMemoryVector *)arg1, (size_t)arg2,
+				(HelHandle)arg3, (uintptr_t)arg4);
+	} break;
+	case kHelCallCreateSpaceWindow: {
+		HelHandle handle;
+		*image.error() = helCreateSpaceWindow((HelHandle)arg0, (void *)arg1,
+				(size_t)arg2, &handle);
+		*image.out0() = handle;
+	} break;
+	case kHelCallRevokeSpaceWindow: {
+		*image.error() = helRevokeSpaceWindow((HelHandle)arg0);
+	} break;
+	case kHelCallSubmitCopyFromWindow: {
+		*image.error() = helSubmitCopyFromWindow((HelHandle)arg0, (HelHandle)arg1,
+				(uintptr_t)arg2, (size_t)arg3,
+				(HelHandle)arg4, (uintptr_t)arg5);
+	} break;
 	case kHelCallMemoryInfo: {
 		size_t size;
 		*image.error() = helMemoryInfo((HelHandle)arg0, &size);
@@ -713,6 +807,13 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helUpdateMemory((HelHandle)arg0, (int)arg1,
 				(uintptr_t)arg2, (size_t)arg3);
 	} break;
+	case kHelCallEnableSwap: {
+		*image.error() = helEnableSwap((HelHandle)arg0, (size_t)arg1);
+	} break;
+	case kHelCallAdviseMemory: {
+		*image.error() = helAdviseMemory((HelHandle)arg0, (uintptr_t)arg1,
+				(size_t)arg2, (int)arg3);
+	} break;
 	case kHelCallSubmitLockMemoryView: {
 		*image.error() = helSubmitLockMemoryView((HelHandle)arg0, (uintptr_t)arg1, (size_t)arg2,
 				(HelHandle)arg3, (uintptr_t)arg4);
@@ -749,9 +850,19 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallQueryThreadStats: {
 		*image.error() = helQueryThreadStats((HelHandle)arg0, (HelThreadStats *)arg1);
 	} break;
+	case kHelCallSetThreadPmc: {
+		*image.error() = helSetThreadPmc((HelHandle)arg0, (uint32_t)arg1);
+	} break;
+	case kHelCallQueryThreadPmc: {
+		*image.error() = helQueryThreadPmc((HelHandle)arg0, (HelPmcValues *)arg1);
+	} break;
 	case kHelCallSetPriority: {
 		*image.error() = helSetPriority((HelHandle)arg0, (int)arg1);
 	} break;
+	case kHelCallSetScheduling: {
+		*image.error() = helSetScheduling((HelHandle)arg0,
+				(const HelSchedulingParameters *)arg1);
+	} break;
 	case kHelCallYield: {
 		*image.error() = helYield();
 	} break;
@@ -765,6 +876,15 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallInterruptThread: {
 		*image.error() = helInterruptThread((HelHandle)arg0);
 	} break;
+	case kHelCallQueueSignal: {
+		*image.error() = helQueueSignal((HelHandle)arg0,
+				(const HelSignalDelivery *)arg1);
+	} break;
+	case kHelCallDequeueSignal: {
+		int dequeued;
+		*image.error() = helDequeueSignal((HelHandle)arg0, &dequeued);
+		*image.out0() = dequeued;
+	} break;
 	case kHelCallResume: {
 		*image.error() = helResume((HelHandle)arg0);
 	} break;
@@ -795,12 +915,23 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helGetClock(&counter);
 		*image.out0() = counter;
 	} break;
+	case kHelCallAccessClockPage: {
+		HelHandle handle;
+		*image.error() = helAccessClockPage(&handle);
+		*image.out0() = handle;
+	} break;
 	case kHelCallSubmitAwaitClock: {
 		uint64_t async_id;
 		*image.error() = helSubmitAwaitClock((uint64_t)arg0,
 				(HelHandle)arg1, (uintptr_t)arg2, &async_id);
 		*image.out0() = async_id;
 	} break;
+	case kHelCallSubmitAwaitClockWithSlack: {
+		uint64_t async_id;
+		*image.error() = helSubmitAwaitClockWithSlack((uint64_t)arg0, (uint64_t)arg1,
+				(HelHandle)arg2, (uintptr_t)arg3, &async_id);
+		*image.out0() = async_id;
+	} break;
 
 	case kHelCallCreateStream: {
 		HelHandle lane1;
@@ -813,6 +944,12 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helSubmitAsync((HelHandle)arg0, (HelAction *)arg1,
 				(size_t)arg2, (HelHandle)arg3, (uintptr_t)arg4, (uint32_t)arg5);
 	} break;
+	case kHelCallSubmitAsyncRing: {
+		size_t count;
+		*image.error() = helSubmitAsyncRing((HelSubmissionRing *)arg0,
+				(unsigned int)arg1, &count);
+		*image.out0() = count;
+	} break;
 	case kHelCallShutdownLane: {
 		*image.error() = helShutdownLane((HelHandle)arg0);
 	} break;
@@ -823,6 +960,29 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallFutexWake: {
 		*image.error() = helFutexWake((int *)arg0);
 	} break;
+	case kHelCallFutexRequeue: {
+		size_t count;
+		*image.error() = helFutexRequeue((int *)arg0, (int *)arg1, (int)arg2,
+				(size_t)arg3, (size_t)arg4, &count);
+		*image.out0() = count;
+	} break;
+	case kHelCallSubmitAwaitFutex: {
+		uint64_t asyncId;
+		*image.error() = helSubmitAwaitFutex((int *)arg0, (int)arg1,
+				(HelHandle)arg2, (uintptr_t)arg3, &asyncId);
+		*image.out0() = asyncId;
+	} break;
+	case kHelCallGetFutexTid: {
+		uint32_t tid;
+		*image.error() = helGetFutexTid(&tid);
+		*image.out0() = tid;
+	} break;
+	case kHelCallFutexLockPi: {
+		*image.error() = helFutexLockPi((int *)arg0, (int64_t)arg1);
+	} break;
+	case kHelCallFutexUnlockPi: {
+		*image.error() = helFutexUnlockPi((int *)arg0);
+	} break;
 
 	case kHelCallCreateOneshotEvent: {
 		HelHandle handle;
@@ -864,6 +1024,14 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallEnableFullIo: {
 		*image.error() = helEnableFullIo();
 	} break;
+	case kHelCallMapDma: {
+		*image.error() = helMapDma((HelHandle)arg0,
+				(const HelDmaMapping *)arg1, (size_t)arg2);
+	} break;
+	case kHelCallUnmapDma: {
+		*image.error() = helUnmapDma((HelHandle)arg0,
+				(const uintptr_t *)arg1, (size_t)arg2);
+	} break;
 
 	case kHelCallBindKernlet: {
 		HelHandle bound_handle;
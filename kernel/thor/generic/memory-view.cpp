@@ -1,9 +1,12 @@
+#include <frg/container_of.hpp>
 #include <thor-internal/coroutine.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/main.hpp>
 #include <thor-internal/memory-view.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/timer.hpp>
+#include <thor-internal/zswap.hpp>
 
 namespace thor {
 
@@ -14,47 +17,80 @@ namespace {
 	// The following flags are debugging options to debug the correctness of various components.
 	constexpr bool tortureUncaching = false;
 	constexpr bool disableUncaching = false;
+
+	// Dirty pages are only written back once they are older than this.
+	// This gives writers the chance to dirty adjacent pages, such that they can be
+	// written back by a single request.
+	constexpr uint64_t dirtyExpireNanos = 5'000'000'000;
+	// Maximal number of pages per writeback request.
+	constexpr size_t maxWritebackPages = 256;
+	// If a single ManagedSpace has more dirty pages than this, writeback starts immediately.
+	constexpr size_t maxDirtyPagesPerSpace = 4096;
+
+	std::atomic<size_t> globalDirtyPages{0};
+	std::atomic<size_t> globalWritebackPages{0};
+}
+
+size_t numDirtyPages() {
+	return globalDirtyPages.load(std::memory_order_relaxed);
+}
+
+size_t numWritebackPages() {
+	return globalWritebackPages.load(std::memory_order_relaxed);
 }
 
 // --------------------------------------------------------
 // Reclaim implementation.
 // --------------------------------------------------------
 
+// Pages are organized into a small number of LRU generations.
+// New pages enter the youngest generation while pages are evicted from the oldest one.
+// Accessing a page only sets a flag in the CachePage; referenced pages are moved to
+// the youngest generation when the reclaimer encounters them.
+// To avoid contention on the global lock, new pages are first queued in per-CPU batches.
 struct MemoryReclaimer {
+	static constexpr uint64_t numGenerations = 4;
+	// Maximal number of referenced pages that are aged before the lock is dropped.
+	static constexpr int maxAgingScan = 64;
+
 	void addPage(CachePage *page) {
 		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&_mutex);
+		auto batch = &getCpuData()->reclaimBatch;
+		auto batchLock = frg::guard(&batch->mutex);
 
 		assert(!(page->flags & CachePage::reclaimRegistered));
+		assert(!page->batch.load(std::memory_order_relaxed));
 
-		_lruList.push_back(page);
 		page->flags |= CachePage::reclaimRegistered;
-		_cachedSize += kPageSize;
+		page->referenced.store(false, std::memory_order_relaxed);
+		page->batchIndex = batch->numPages;
+		page->batch.store(batch, std::memory_order_relaxed);
+		batch->pages[batch->numPages++] = page;
+
+		if(batch->numPages == ReclaimCpuBatch::capacity)
+			_flushBatch(batch);
 	}
 
 	void removePage(CachePage *page) {
 		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&_mutex);
 
-		assert(page->flags & CachePage::reclaimRegistered);
+		// Fast path: the page did not enter the LRU yet.
+		if(auto batch = page->batch.load(std::memory_order_acquire); batch) {
+			auto batchLock = frg::guard(&batch->mutex);
 
-		if(page->flags & CachePage::reclaimPosted) {
-			if(!(page->flags & CachePage::reclaimInflight)) {
-				auto it = page->bundle->_reclaimList.iterator_to(page);
-				page->bundle->_reclaimList.erase(it);
-			}
+			// Re-check since the batch may have been flushed concurrently.
+			if(page->batch.load(std::memory_order_relaxed) == batch) {
+				assert(page->flags & CachePage::reclaimRegistered);
 
-			page->flags &= ~(CachePage::reclaimPosted | CachePage::reclaimInflight);
-		}else{
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
-			_cachedSize -= kPageSize;
+				auto last = batch->pages[--batch->numPages];
+				batch->pages[page->batchIndex] = last;
+				last->batchIndex = page->batchIndex;
+				page->batch.store(nullptr, std::memory_order_relaxed);
+				page->flags &= ~CachePage::reclaimRegistered;
+				return;
+			}
 		}
-		page->flags &= ~CachePage::reclaimRegistered;
-	}
 
-	void bumpPage(CachePage *page) {
-		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_mutex);
 
 		assert(page->flags & CachePage::reclaimRegistered);
@@ -66,13 +102,18 @@ struct MemoryReclaimer {
 			}
 
 			page->flags &= ~(CachePage::reclaimPosted | CachePage::reclaimInflight);
-			_cachedSize += kPageSize;
 		}else{
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
+			auto &list = _generations[page->generation];
+			auto it = list.iterator_to(page);
+			list.erase(it);
+			_cachedSize -= kPageSize;
 		}
+		page->flags &= ~CachePage::reclaimRegistered;
+	}
 
-		_lruList.push_back(page);
+	// This is called on every access to a cached page. Hence, it does not take any locks.
+	void bumpPage(CachePage *page) {
+		page->referenced.store(true, std::memory_order_relaxed);
 	}
 
 	auto awaitReclaim(CacheBundle *bundle, async::cancellation_token ct = {}) {
@@ -87,21 +128,38 @@ struct MemoryReclaimer {
 	}
 
 	CachePage *reclaimPage(CacheBundle *bundle) {
+		return reclaimPage(bundle, [] (CachePage *) { return true; });
+	}
+
+	// Variant of reclaimPage() for bundles that are shared by multiple owners.
+	// pin() is called with the reclaimer's lock held; it has to keep the owner of the page
+	// alive. Pages that cannot be pinned (since their owner is being destructed) are skipped.
+	template<typename F>
+	CachePage *reclaimPage(CacheBundle *bundle, F pin) {
 		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_mutex);
 
-		if(bundle->_reclaimList.empty())
-			return nullptr;
+		while(!bundle->_reclaimList.empty()) {
+			auto page = bundle->_reclaimList.pop_front();
 
-		auto page = bundle->_reclaimList.pop_front();
+			assert(page->flags & CachePage::reclaimRegistered);
+			assert(page->flags & CachePage::reclaimPosted);
+			assert(!(page->flags & CachePage::reclaimInflight));
 
-		assert(page->flags & CachePage::reclaimRegistered);
-		assert(page->flags & CachePage::reclaimPosted);
-		assert(!(page->flags & CachePage::reclaimInflight));
+			// If the page was accessed after it was posted, keep it.
+			if(page->referenced.exchange(false, std::memory_order_relaxed)) {
+				page->flags &= ~CachePage::reclaimPosted;
+				_pushYoungest(page);
+				continue;
+			}
 
-		page->flags |= CachePage::reclaimInflight;
+			page->flags |= CachePage::reclaimInflight;
+			if(!pin(page))
+				continue;
+			return page;
+		}
 
-		return page;
+		return nullptr;
 	}
 
 	void runReclaimFiber() {
@@ -112,7 +170,7 @@ struct MemoryReclaimer {
 			auto irqLock = frg::guard(&irqMutex());
 			auto lock = frg::guard(&_mutex);
 
-			if(_lruList.empty())
+			if(!_cachedSize)
 				return false;
 
 			if(!tortureUncaching) {
@@ -128,14 +186,25 @@ struct MemoryReclaimer {
 				}
 			}
 
-			auto page = _lruList.pop_front();
+			CachePage *page;
+			for(int i = 0; ; ++i) {
+				page = _popOldest();
+				if(!page)
+					return false;
+				if(!page->referenced.exchange(false, std::memory_order_relaxed))
+					break;
+
+				// Give the page another chance; retry later if we aged too many pages.
+				_pushYoungest(page);
+				if(i == maxAgingScan)
+					return true;
+			}
 
 			assert(page->flags & CachePage::reclaimRegistered);
 			assert(!(page->flags & CachePage::reclaimPosted));
 			assert(!(page->flags & CachePage::reclaimInflight));
 
 			page->flags |= CachePage::reclaimPosted;
-			_cachedSize -= kPageSize;
 
 			page->bundle->_reclaimList.push_back(page);
 			page->bundle->_reclaimEvent.raise();
@@ -145,11 +214,15 @@ struct MemoryReclaimer {
 
 		KernelFiber::run([=, this] {
 			while(true) {
+				_flushAllBatches();
+				_advanceGeneration();
+
 				if(logUncaching) {
 					auto irqLock = frg::guard(&irqMutex());
 					auto lock = frg::guard(&_mutex);
 					infoLogger() << "thor: " << (_cachedSize / 1024)
-							<< " KiB of cached pages" << frg::endlog;
+							<< " KiB of cached pages in " << (_youngestGen - _oldestGen + 1)
+							<< " generations" << frg::endlog;
 				}
 
 				while(checkReclaim())
@@ -164,8 +237,64 @@ struct MemoryReclaimer {
 	}
 
 private:
+	// Moves all pages of a batch into the LRU. The batch mutex must be held.
+	void _flushBatch(ReclaimCpuBatch *batch) {
+		auto lock = frg::guard(&_mutex);
+
+		for(int i = 0; i < batch->numPages; ++i) {
+			auto page = batch->pages[i];
+			page->batch.store(nullptr, std::memory_order_relaxed);
+			_pushYoungest(page);
+		}
+		batch->numPages = 0;
+	}
+
+	void _flushAllBatches() {
+		for(size_t k = 0; k < getCpuCount(); ++k) {
+			auto batch = &getCpuData(k)->reclaimBatch;
+
+			auto irqLock = frg::guard(&irqMutex());
+			auto batchLock = frg::guard(&batch->mutex);
+			_flushBatch(batch);
+		}
+	}
+
+	// Starts a new generation (if the youngest one is non-empty and there is a free slot).
+	// Pages that are not referenced before they reach the oldest generation are evicted.
+	void _advanceGeneration() {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(_youngestGen - _oldestGen + 1 == numGenerations)
+			return;
+		if(_generations[_youngestGen % numGenerations].empty())
+			return;
+		_youngestGen++;
+	}
+
+	void _pushYoungest(CachePage *page) {
+		page->generation = _youngestGen % numGenerations;
+		_generations[page->generation].push_back(page);
+		_cachedSize += kPageSize;
+	}
+
+	CachePage *_popOldest() {
+		while(true) {
+			auto &list = _generations[_oldestGen % numGenerations];
+			if(!list.empty()) {
+				_cachedSize -= kPageSize;
+				return list.pop_front();
+			}
+			if(_oldestGen == _youngestGen)
+				return nullptr;
+			_oldestGen++;
+		}
+	}
+
 	frg::ticket_spinlock _mutex;
 
+	// Lists of pages in generations [_oldestGen, _youngestGen] (both modulo numGenerations).
+	// All other lists are empty.
 	frg::intrusive_list<
 		CachePage,
 		frg::locate_member<
@@ -173,18 +302,25 @@ private:
 			frg::default_list_hook<CachePage>,
 			&CachePage::listHook
 		>
-	> _lruList;
+	> _generations[numGenerations];
+
+	uint64_t _oldestGen = 0;
+	uint64_t _youngestGen = 0;
 
+	// Size of all pages in the LRU (i.e., excluding batched and posted pages).
 	size_t _cachedSize = 0;
 };
 
 static frg::manual_box<MemoryReclaimer> globalReclaimer;
 
+static void runAnonymousSwapper();
+
 static initgraph::Task initReclaim{&globalInitEngine, "generic.init-reclaim",
 	initgraph::Requires{getFibersAvailableStage()},
 	[] {
 		globalReclaimer.initialize();
 		globalReclaimer->runReclaimFiber();
+		runAnonymousSwapper();
 	}
 };
 
@@ -345,6 +481,26 @@ Error MemoryView::updateRange(ManageRequest, size_t, size_t) {
 	return Error::illegalObject;
 }
 
+Error MemoryView::adviseRange(MemoryAdvice, uintptr_t, size_t) {
+	return Error::illegalObject;
+}
+
+void MemoryView::markAccessed(uintptr_t, size_t) {
+	// Do nothing by default.
+}
+
+PhysicalAddr MemoryView::peekSharedPage(uintptr_t) {
+	return PhysicalAddr(-1);
+}
+
+PageUsage MemoryView::queryPageUsage(uintptr_t) {
+	return 0;
+}
+
+bool MemoryView::donatePage(uintptr_t, PhysicalAddr) {
+	return false;
+}
+
 void MemoryView::submitManage(ManageNode *) {
 	panicLogger() << "MemoryView does not support management!" << frg::endlog;
 }
@@ -435,6 +591,17 @@ smarter::shared_ptr<MemoryView> getZeroMemory() {
 	return singleton.get();
 }
 
+PhysicalAddr getZeroPage() {
+	static PhysicalAddr physical = [] {
+		auto physical = physicalAllocator->allocate(kPageSize);
+		assert(physical != PhysicalAddr(-1) && "OOM");
+		PageAccessor accessor{physical};
+		zeroPage(accessor.get());
+		return physical;
+	}();
+	return physical;
+}
+
 // --------------------------------------------------------
 // ImmediateMemory
 // --------------------------------------------------------
@@ -444,12 +611,9 @@ ImmediateMemory::ImmediateMemory(size_t length)
 	auto numPages = (length + kPageSize - 1) >> kPageShift;
 	_physicalPages.resize(numPages);
 	for(size_t i = 0; i < numPages; ++i) {
-		auto physical = physicalAllocator->allocate(kPageSize, 64);
+		auto physical = physicalAllocator->allocateZeroed();
 		assert(physical != PhysicalAddr(-1) && "OOM when allocating ImmediateMemory");
 
-		PageAccessor accessor{physical};
-		memset(accessor.get(), 0, kPageSize);
-
 		_physicalPages[i] = physical;
 	}
 }
@@ -469,12 +633,9 @@ void ImmediateMemory::resize(size_t newSize, async::any_receiver<void> receiver)
 		assert(newNumPages >= currentNumPages);
 		_physicalPages.resize(newNumPages);
 		for(size_t i = currentNumPages; i < newNumPages; ++i) {
-			auto physical = physicalAllocator->allocate(kPageSize, 64);
+			auto physical = physicalAllocator->allocateZeroed();
 			assert(physical != PhysicalAddr(-1) && "OOM when allocating ImmediateMemory");
 
-			PageAccessor accessor{physical};
-			memset(accessor.get(), 0, kPageSize);
-
 			_physicalPages[i] = physical;
 		}
 	}
@@ -593,10 +754,224 @@ size_t HardwareMemory::getLength() {
 // AllocatedMemory
 // --------------------------------------------------------
 
+// All pages of swappable AllocatedMemory objects share a single CacheBundle.
+// The swapper compresses the pages that the reclaimer posts to this bundle into the zswap pool
+// or writes them to the swap device (if one is enabled).
+struct AnonymousSwapper {
+	void run() {
+		[] (AnonymousSwapper *self, enable_detached_coroutine = {}) -> void {
+			while(true) {
+				co_await globalReclaimer->awaitReclaim(&self->bundle);
+
+				smarter::shared_ptr<AllocatedMemory> memory;
+				auto page = globalReclaimer->reclaimPage(&self->bundle, [&] (CachePage *page) {
+					auto anon = frg::container_of(page, &AllocatedMemory::AnonPage::cachePage);
+					memory = anon->memory->selfPtr.lock();
+					return static_cast<bool>(memory);
+				});
+				if(!page)
+					continue;
+
+				co_await swapOut(std::move(memory), page->identity);
+			}
+		}(this);
+	}
+
+	// Maximal number of pages that are swapped out together.
+	static constexpr size_t maxSwapCluster = 8;
+
+	// Swaps out the page at index together with up to maxSwapCluster - 1 cold pages
+	// that follow it. Pages are compressed into zswap; pages that zswap rejects are
+	// written to consecutive swap slots, such that the swap device can write them
+	// (and later read them ahead) in a single request.
+	static coroutine<void> swapOut(smarter::shared_ptr<AllocatedMemory> memory, size_t index) {
+		size_t count = 0;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			auto anon = memory->_anonPages.find(index);
+			assert(anon);
+			// The page may have been locked (and unlocked again) since it was posted.
+			if(!(anon->cachePage.flags & CachePage::reclaimInflight))
+				co_return;
+			assert(!anon->lockCount);
+			assert(memory->_physicalChunks[index] != PhysicalAddr(-1));
+
+			globalReclaimer->removePage(&anon->cachePage);
+			bool haveSwap = swapAvailable();
+			if(!zswapHasSpace() && !haveSwap) {
+				globalReclaimer->addPage(&anon->cachePage);
+				co_return;
+			}
+			anon->swappingOut = true;
+			count = 1;
+
+			while(haveSwap && count < maxSwapCluster
+					&& index + count < memory->_physicalChunks.size()) {
+				auto next = memory->_anonPages.find(index + count);
+				if(!next || next->lockCount || next->swappingOut
+						|| memory->_physicalChunks[index + count] == PhysicalAddr(-1)
+						|| !(next->cachePage.flags & CachePage::reclaimRegistered)
+						|| next->cachePage.referenced.load(std::memory_order_relaxed))
+					break;
+				globalReclaimer->removePage(&next->cachePage);
+				next->swappingOut = true;
+				count++;
+			}
+		}
+
+		co_await memory->_evictQueue.evictRange(index << kPageShift, count << kPageShift);
+
+		// Since the pages are now unmapped and swappingOut is set, all accesses to the
+		// pages cancel the swap-out. Hence, we can compress without holding the lock.
+		PhysicalAddr physicals[maxSwapCluster];
+		bool cancelled[maxSwapCluster];
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			for(size_t i = 0; i < count; i++) {
+				auto anon = memory->_anonPages.find(index + i);
+				assert(anon);
+				cancelled[i] = !anon->swappingOut;
+				physicals[i] = memory->_physicalChunks[index + i];
+				assert(physicals[i] != PhysicalAddr(-1));
+			}
+		}
+
+		ZswapEntry *entries[maxSwapCluster];
+		uint64_t slots[maxSwapCluster];
+		for(size_t i = 0; i < count; i++) {
+			entries[i] = nullptr;
+			slots[i] = noSwapSlot;
+			if(!cancelled[i])
+				entries[i] = zswapStore(physicals[i]);
+		}
+
+		// Assign consecutive slots to runs of pages that need to go to the device.
+		for(size_t i = 0; i < count; ) {
+			if(cancelled[i] || entries[i]) {
+				i++;
+				continue;
+			}
+			size_t n = 1;
+			while(i + n < count && !cancelled[i + n] && !entries[i + n])
+				n++;
+			auto base = allocateSwapSlots(n);
+			if(base == noSwapSlot)
+				break;
+			for(size_t j = 0; j < n; j++)
+				slots[i + j] = base + j;
+			i += n;
+		}
+
+		// Pages that were donated to the swap cache are no longer owned by us;
+		// pages in needCopy have to be copied into the swap cache.
+		bool needCopy[maxSwapCluster];
+		bool freePhysical[maxSwapCluster];
+		bool anyCopies = false;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			for(size_t i = 0; i < count; i++) {
+				needCopy[i] = false;
+				freePhysical[i] = false;
+
+				auto anon = memory->_anonPages.find(index + i);
+				assert(anon);
+				if(!anon->swappingOut) {
+					if(entries[i])
+						zswapDrop(entries[i]);
+					if(slots[i] != noSwapSlot)
+						freeSwapSlot(slots[i]);
+					continue;
+				}
+
+				if(entries[i]) {
+					anon->swappingOut = false;
+					anon->swapped = entries[i];
+					memory->_physicalChunks[index + i] = PhysicalAddr(-1);
+					freePhysical[i] = true;
+				}else if(slots[i] != noSwapSlot) {
+					if(donateToSwap(slots[i], physicals[i])) {
+						anon->swappingOut = false;
+						anon->swapSlot = slots[i];
+						memory->_physicalChunks[index + i] = PhysicalAddr(-1);
+					}else{
+						needCopy[i] = true;
+						anyCopies = true;
+					}
+				}else{
+					// The page does not compress well (or we are out of space); keep it.
+					anon->swappingOut = false;
+					globalReclaimer->addPage(&anon->cachePage);
+				}
+			}
+		}
+
+		if(anyCopies) {
+			bool written[maxSwapCluster];
+			for(size_t i = 0; i < count; i++) {
+				written[i] = false;
+				if(!needCopy[i])
+					continue;
+				auto outcome = co_await writeSwapSlot(slots[i], physicals[i]);
+				written[i] = static_cast<bool>(outcome);
+			}
+
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			for(size_t i = 0; i < count; i++) {
+				if(!needCopy[i])
+					continue;
+
+				auto anon = memory->_anonPages.find(index + i);
+				assert(anon);
+				if(!anon->swappingOut) {
+					freeSwapSlot(slots[i]);
+					continue;
+				}
+				anon->swappingOut = false;
+
+				if(!written[i]) {
+					freeSwapSlot(slots[i]);
+					globalReclaimer->addPage(&anon->cachePage);
+					continue;
+				}
+				anon->swapSlot = slots[i];
+				memory->_physicalChunks[index + i] = PhysicalAddr(-1);
+				freePhysical[i] = true;
+			}
+		}
+
+		for(size_t i = 0; i < count; i++) {
+			if(!freePhysical[i])
+				continue;
+			if(logUncaching)
+				warningLogger() << "Swapping out anonymous page" << frg::endlog;
+			physicalAllocator->free(physicals[i], kPageSize);
+		}
+	}
+
+	CacheBundle bundle;
+};
+
+static frg::manual_box<AnonymousSwapper> anonymousSwapper;
+
+static void runAnonymousSwapper() {
+	anonymousSwapper.initialize();
+	anonymousSwapper->run();
+}
+
 AllocatedMemory::AllocatedMemory(size_t desiredLngth,
-		int addressBits, size_t desiredChunkSize, size_t chunkAlign)
-: _physicalChunks{*kernelAlloc},
-		_addressBits{addressBits}, _chunkAlign{chunkAlign} {
+		int addressBits, size_t desiredChunkSize, size_t chunkAlign, int numaNode,
+		bool swappable)
+: MemoryView{swappable ? &_evictQueue : nullptr}, _physicalChunks{*kernelAlloc},
+		_addressBits{addressBits}, _chunkAlign{chunkAlign}, _numaNode{numaNode},
+		_swappable{swappable}, _anonPages{*kernelAlloc} {
 	static_assert(sizeof(unsigned long) == sizeof(uint64_t), "Fix use of __builtin_clzl");
 	_chunkSize = size_t(1) << (64 - __builtin_clzl(desiredChunkSize - 1));
 	if(_chunkSize != desiredChunkSize)
@@ -612,6 +987,7 @@ AllocatedMemory::AllocatedMemory(size_t desiredLngth,
 	assert(_chunkSize % kPageSize == 0);
 	assert(_chunkAlign % kPageSize == 0);
 	assert(_chunkSize % _chunkAlign == 0);
+	assert(!_swappable || (_chunkSize == kPageSize && _addressBits == 64));
 	_physicalChunks.resize(length / _chunkSize, PhysicalAddr(-1));
 }
 
@@ -621,6 +997,20 @@ AllocatedMemory::~AllocatedMemory() {
 	if(logUsage)
 		infoLogger() << "thor: Releasing AllocatedMemory ("
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB in use)" << frg::endlog;
+	if(_swappable) {
+		// The swapper keeps a reference while it swaps out a page (and so do callers of
+		// fetchRange() while a page is swapped in); hence, no swapping can be in progress here.
+		for(auto it = _anonPages.begin(); it != _anonPages.end(); ++it) {
+			assert(!it->swappingOut);
+			assert(!it->swappingIn);
+			if(it->cachePage.flags & CachePage::reclaimRegistered)
+				globalReclaimer->removePage(&it->cachePage);
+			if(it->swapped)
+				zswapDrop(it->swapped);
+			if(it->swapSlot != noSwapSlot)
+				freeSwapSlot(it->swapSlot);
+		}
+	}
 	for(size_t i = 0; i < _physicalChunks.size(); ++i) {
 		if(_physicalChunks[i] != PhysicalAddr(-1))
 			physicalAllocator->free(_physicalChunks[i], _chunkSize);
@@ -649,13 +1039,54 @@ AllocatedMemory::resolveGlobalFutex(uintptr_t offset) {
 	return frg::make_tuple(std::move(futexSpace), offset);
 }
 
-Error AllocatedMemory::lockRange(uintptr_t, size_t) {
-	// For now, we do not evict "anonymous" memory. TODO: Implement eviction here.
+// Note: Neither offset nor size are necessarily multiples of the page size.
+Error AllocatedMemory::lockRange(uintptr_t offset, size_t size) {
+	// Only swappable memory is ever evicted.
+	if(!_swappable || !size)
+		return Error::success;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto first = offset >> kPageShift;
+	auto last = (offset + size - 1) >> kPageShift;
+	if(last >= _physicalChunks.size())
+		return Error::bufferTooSmall;
+
+	for(auto index = first; index <= last; ++index) {
+		auto anon = _findOrInsertAnonPage(index);
+		if(anon->lockCount++)
+			continue;
+		if(anon->swappingOut) {
+			anon->swappingOut = false;
+		}else if(anon->cachePage.flags & CachePage::reclaimRegistered) {
+			globalReclaimer->removePage(&anon->cachePage);
+		}
+	}
 	return Error::success;
 }
 
-void AllocatedMemory::unlockRange(uintptr_t, size_t) {
-	// For now, we do not evict "anonymous" memory. TODO: Implement eviction here.
+// Note: Neither offset nor size are necessarily multiples of the page size.
+void AllocatedMemory::unlockRange(uintptr_t offset, size_t size) {
+	if(!_swappable || !size)
+		return;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto first = offset >> kPageShift;
+	auto last = (offset + size - 1) >> kPageShift;
+	assert(last < _physicalChunks.size());
+
+	for(auto index = first; index <= last; ++index) {
+		auto anon = _anonPages.find(index);
+		assert(anon);
+		assert(anon->lockCount);
+		if(--anon->lockCount)
+			continue;
+		if(_physicalChunks[index] != PhysicalAddr(-1))
+			globalReclaimer->addPage(&anon->cachePage);
+	}
 }
 
 frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offset) {
@@ -670,12 +1101,26 @@ frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offse
 
 	if(_physicalChunks[index] == PhysicalAddr(-1))
 		return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
+
+	if(_swappable) {
+		auto anon = _anonPages.find(index);
+		assert(anon);
+		if(anon->swappingOut) {
+			// Cancel the swap-out -- the page is still needed.
+			anon->swappingOut = false;
+			globalReclaimer->addPage(&anon->cachePage);
+		}
+	}
+
 	return frg::tuple<PhysicalAddr, CachingMode>{_physicalChunks[index] + disp,
 			CachingMode::null};
 }
 
 coroutine<frg::expected<Error, PhysicalRange>>
-AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue>) {
+AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue> wq) {
+	if(_swappable)
+		co_return co_await _fetchAnonPage(offset, std::move(wq));
+
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
 
@@ -684,13 +1129,19 @@ AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<Wo
 	assert(index < _physicalChunks.size());
 
 	if(_physicalChunks[index] == PhysicalAddr(-1)) {
-		auto physical = physicalAllocator->allocate(_chunkSize, _addressBits);
-		assert(physical != PhysicalAddr(-1) && "OOM");
-		assert(!(physical & (_chunkAlign - 1)));
+		PhysicalAddr physical;
+		if(_chunkSize == kPageSize && _chunkAlign <= kPageSize && _addressBits == 64) {
+			physical = physicalAllocator->allocateZeroed(_numaNode);
+			assert(physical != PhysicalAddr(-1) && "OOM");
+		}else{
+			physical = physicalAllocator->allocate(_chunkSize, _addressBits, _numaNode);
+			assert(physical != PhysicalAddr(-1) && "OOM");
+			assert(!(physical & (_chunkAlign - 1)));
 
-		for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
-			PageAccessor accessor{physical + pg_progress};
-			memset(accessor.get(), 0, kPageSize);
+			for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
+				PageAccessor accessor{physical + pg_progress};
+				zeroPage(accessor.get());
+			}
 		}
 		_physicalChunks[index] = physical;
 	}
@@ -703,6 +1154,24 @@ void AllocatedMemory::markDirty(uintptr_t, size_t) {
 	// Do nothing for now.
 }
 
+PageUsage AllocatedMemory::queryPageUsage(uintptr_t offset) {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto index = offset / _chunkSize;
+	if(index >= _physicalChunks.size())
+		return 0;
+	if(_physicalChunks[index] == PhysicalAddr(-1)) {
+		if(_swappable)
+			if(auto anon = _anonPages.find(index);
+					anon && (anon->swapped || anon->swapSlot != noSwapSlot))
+				return pageUsageEvicted | pageUsageAnonymous;
+		return 0;
+	}
+	// AllocatedMemory can be mapped by multiple spaces; hence, it is not private.
+	return pageUsagePresent | pageUsageAnonymous;
+}
+
 size_t AllocatedMemory::getLength() {
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
@@ -712,13 +1181,130 @@ size_t AllocatedMemory::getLength() {
 
 coroutine<frg::expected<Error, PhysicalAddr>> AllocatedMemory::takeGlobalFutex(uintptr_t offset,
 		smarter::shared_ptr<WorkQueue> wq) {
+	// Keep the page from being swapped out while the futex is in use.
+	auto lockError = lockRange(offset & ~(kPageSize - 1), kPageSize);
+	if(lockError != Error::success)
+		co_return Error::fault;
 	// TODO: This could be optimized further (by avoiding the coroutine call).
 	auto range = FRG_CO_TRY(co_await fetchRange(offset & ~(kPageSize - 1), 0, wq));
 	assert(range.get<0>() != PhysicalAddr(-1));
 	co_return range.get<0>();
 }
 
-void AllocatedMemory::retireGlobalFutex(uintptr_t) {
+void AllocatedMemory::retireGlobalFutex(uintptr_t offset) {
+	unlockRange(offset & ~(kPageSize - 1), kPageSize);
+}
+
+coroutine<frg::expected<Error, PhysicalRange>>
+AllocatedMemory::_fetchAnonPage(uintptr_t offset, smarter::shared_ptr<WorkQueue> wq) {
+	auto index = offset >> kPageShift;
+	auto disp = offset & (kPageSize - 1);
+
+	while(true) {
+		uint64_t slot;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			assert(index < _physicalChunks.size());
+			auto anon = _findOrInsertAnonPage(index);
+			if(_physicalChunks[index] != PhysicalAddr(-1)) {
+				if(anon->swappingOut) {
+					// Cancel the swap-out -- the page is still needed.
+					anon->swappingOut = false;
+					globalReclaimer->addPage(&anon->cachePage);
+				}else if(!anon->lockCount) {
+					globalReclaimer->bumpPage(&anon->cachePage);
+				}
+				co_return PhysicalRange{_physicalChunks[index] + disp, kPageSize - disp,
+						CachingMode::null};
+			}
+
+			if(!anon->swappingIn && anon->swapSlot == noSwapSlot) {
+				PhysicalAddr physical;
+				if(anon->swapped) {
+					physical = physicalAllocator->allocate(kPageSize, 64, _numaNode);
+					assert(physical != PhysicalAddr(-1) && "OOM");
+					zswapLoad(anon->swapped, physical);
+					anon->swapped = nullptr;
+				}else{
+					physical = physicalAllocator->allocateZeroed(_numaNode);
+					assert(physical != PhysicalAddr(-1) && "OOM");
+				}
+				_physicalChunks[index] = physical;
+
+				if(!anon->lockCount)
+					globalReclaimer->addPage(&anon->cachePage);
+				co_return PhysicalRange{physical + disp, kPageSize - disp, CachingMode::null};
+			}
+
+			slot = anon->swapSlot;
+			if(!anon->swappingIn)
+				anon->swappingIn = true;
+			else
+				slot = noSwapSlot;
+		}
+
+		if(slot == noSwapSlot) {
+			// Another fetch is reading the page from the swap device; wait for it.
+			bool stillWaiting;
+			do {
+				stillWaiting = co_await _swapInEvent.async_wait_if([&] () -> bool {
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&_mutex);
+
+					auto anon = _anonPages.find(index);
+					assert(anon);
+					return anon->swappingIn;
+				});
+				co_await wq->schedule();
+			} while(stillWaiting);
+			continue;
+		}
+
+		// The swap device reads ahead adjacent slots. Since swap-out assigns consecutive
+		// slots to adjacent pages, this usually prefetches the following pages.
+		auto physical = physicalAllocator->allocate(kPageSize, 64, _numaNode);
+		assert(physical != PhysicalAddr(-1) && "OOM");
+		auto outcome = co_await readSwapSlot(slot, physical);
+
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			auto anon = _anonPages.find(index);
+			assert(anon);
+			assert(anon->swappingIn);
+			assert(anon->swapSlot == slot);
+			assert(_physicalChunks[index] == PhysicalAddr(-1));
+			anon->swappingIn = false;
+
+			if(outcome) {
+				anon->swapSlot = noSwapSlot;
+				_physicalChunks[index] = physical;
+				if(!anon->lockCount)
+					globalReclaimer->addPage(&anon->cachePage);
+			}
+		}
+		_swapInEvent.raise();
+
+		if(!outcome) {
+			urgentLogger() << "thor: Failed to read swap slot " << slot << frg::endlog;
+			physicalAllocator->free(physical, kPageSize);
+			co_return outcome.error();
+		}
+		if(logUncaching)
+			warningLogger() << "Swapped in anonymous page" << frg::endlog;
+		freeSwapSlot(slot);
+		co_return PhysicalRange{physical + disp, kPageSize - disp, CachingMode::null};
+	}
+}
+
+AllocatedMemory::AnonPage *AllocatedMemory::_findOrInsertAnonPage(size_t index) {
+	auto [anon, wasInserted] = _anonPages.find_or_insert(index, this,
+			&anonymousSwapper->bundle, index);
+	assert(anon);
+	return anon;
 }
 
 // --------------------------------------------------------
@@ -768,6 +1354,7 @@ ManagedSpace::ManagedSpace(size_t length, bool readahead)
 
 				pit->loadState = kStateMissing;
 				pit->physical = PhysicalAddr(-1);
+				pit->wasEvicted = true;
 			}
 
 			if(logUncaching)
@@ -775,6 +1362,34 @@ ManagedSpace::ManagedSpace(size_t length, bool readahead)
 			physicalAllocator->free(physical, kPageSize);
 		}
 	}(this);
+
+	// Timer that starts the writeback of dirty pages once they expire.
+	[] (ManagedSpace *self, enable_detached_coroutine = {}) -> void {
+		while(true) {
+			uint64_t deadline;
+			co_await self->_writebackEvent.async_wait_if([&] () -> bool {
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&self->mutex);
+
+				deadline = self->_writebackDeadline;
+				return !deadline;
+			});
+
+			// _writebackEvent is raised with the mutex held; leave that context first.
+			co_await WorkQueue::generalQueue()->schedule();
+			co_await generalTimerEngine()->sleep(deadline);
+
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&self->mutex);
+
+				if(self->_writebackDeadline == deadline)
+					self->_writebackDeadline = 0;
+			}
+
+			self->_deferredManagement.invoke();
+		}
+	}(this);
 }
 
 ManagedSpace::~ManagedSpace() {
@@ -868,29 +1483,67 @@ void ManagedSpace::submitMonitor(MonitorNode *node) {
 
 }
 
+// Puts a page into kStateWantWriteback. The page must already be counted as dirty.
+void ManagedSpace::_queueWriteback(ManagedPage *pit, uint64_t now) {
+	pit->loadState = kStateWantWriteback;
+	pit->dirtyTime = now;
+	_writebackList.push_back(&pit->cachePage);
+}
+
+// Returns true if dirty pages should be written back without waiting for them to expire.
+bool ManagedSpace::_isWritebackUrgent() {
+	if(_numDirty > maxDirtyPagesPerSpace)
+		return true;
+	// Dirty pages cannot be reclaimed; write them back before they fill up memory.
+	if(numDirtyPages() > physicalAllocator->numTotalPages() / 8)
+		return true;
+	return false;
+}
+
 void ManagedSpace::_progressManagement(ManageList &pending) {
 	// For now, we prefer writeback to initialization.
 	// "Proper" priorization should probably be done in the userspace driver
 	// (we do not want to store per-page priorities here).
 
+	// Moves a page from kStateWantWriteback to kStateWriteback (if it is in that state).
+	auto takeWriteback = [this] (size_t index) -> bool {
+		auto pit = pages.find(index);
+		if(!pit || pit->loadState != kStateWantWriteback)
+			return false;
+		pit->loadState = kStateWriteback;
+		_writebackList.erase(_writebackList.iterator_to(&pit->cachePage));
+		return true;
+	};
+
+	uint64_t now = 0;
 	while(!_writebackList.empty() && !_managementQueue.empty()) {
-		auto page = _writebackList.front();
-		auto index = page->identity;
+		// _writebackList is ordered by dirtyTime, hence the front page expires first.
+		auto head = frg::container_of(_writebackList.front(), &ManagedPage::cachePage);
+		if(!now)
+			now = systemClockSource()->currentNanos();
+		if(now < head->dirtyTime + dirtyExpireNanos && !_isWritebackUrgent()) {
+			auto deadline = head->dirtyTime + dirtyExpireNanos;
+			if(_writebackDeadline != deadline) {
+				_writebackDeadline = deadline;
+				_writebackEvent.raise();
+			}
+			break;
+		}
 
-		// Fuse the request with adjacent pages in the list.
-		ptrdiff_t count = 0;
-		while(!_writebackList.empty()) {
-			auto fuse_cache_page = _writebackList.front();
-			auto fuse_index = fuse_cache_page->identity;
-			auto fuse_managed_page = frg::container_of(fuse_cache_page, &ManagedPage::cachePage);
-			if(fuse_index != index + count)
-				break;
-			assert(fuse_managed_page->loadState == kStateWantWriteback);
-			fuse_managed_page->loadState = kStateWriteback;
+		// Fuse the request with adjacent dirty pages, regardless of their position in the list.
+		size_t index = head->cachePage.identity;
+		size_t count = 1;
+		takeWriteback(index);
+		while(count < maxWritebackPages && index && takeWriteback(index - 1)) {
+			index--;
 			count++;
-			_writebackList.pop_front();
 		}
-		assert(count);
+		while(count < maxWritebackPages && index + count < numPages
+				&& takeWriteback(index + count))
+			count++;
+
+		_numWriteback += count;
+		globalWritebackPages.fetch_add(count, std::memory_order_relaxed);
 
 		auto node = _managementQueue.pop_front();
 		node->setup(Error::success, ManageRequest::writeback,
@@ -1029,11 +1682,8 @@ BackingMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<Work
 	assert(pit);
 
 	if(pit->physical == PhysicalAddr(-1)) {
-		PhysicalAddr physical = physicalAllocator->allocate(kPageSize);
+		PhysicalAddr physical = physicalAllocator->allocateZeroed();
 		assert(physical != PhysicalAddr(-1) && "OOM");
-
-		PageAccessor accessor{physical};
-		memset(accessor.get(), 0, kPageSize);
 		pit->physical = physical;
 	}
 
@@ -1058,6 +1708,7 @@ Error BackingMemory::updateRange(ManageRequest type, size_t offset, size_t lengt
 	assert((length % kPageSize) == 0);
 
 	MonitorList pending;
+	ManageList pendingManagement;
 	{
 		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_managed->mutex);
@@ -1094,6 +1745,8 @@ Error BackingMemory::updateRange(ManageRequest type, size_t offset, size_t lengt
 					globalReclaimer->addPage(&pit->cachePage);
 			}
 		}else{
+			auto now = systemClockSource()->currentNanos();
+			size_t numCleaned = 0;
 			for(size_t pg = 0; pg < length; pg += kPageSize) {
 				size_t index = (offset + pg) / kPageSize;
 				auto pit = _managed->pages.find(index);
@@ -1103,12 +1756,21 @@ Error BackingMemory::updateRange(ManageRequest type, size_t offset, size_t lengt
 					pit->loadState = ManagedSpace::kStatePresent;
 					if(!pit->lockCount)
 						globalReclaimer->addPage(&pit->cachePage);
+					numCleaned++;
 				}else{
 					assert(pit->loadState == ManagedSpace::kStateAnotherWriteback);
-					pit->loadState = ManagedSpace::kStateWantWriteback;
-					_managed->_writebackList.push_back(&pit->cachePage);
+					_managed->_queueWriteback(pit, now);
 				}
 			}
+
+			assert(_managed->_numWriteback >= length / kPageSize);
+			_managed->_numWriteback -= length / kPageSize;
+			globalWritebackPages.fetch_sub(length / kPageSize, std::memory_order_relaxed);
+			_managed->_numDirty -= numCleaned;
+			globalDirtyPages.fetch_sub(numCleaned, std::memory_order_relaxed);
+
+			// Pages that were dirtied again might need to be written back now.
+			_managed->_progressManagement(pendingManagement);
 		}
 
 		_managed->_progressMonitors(pending);
@@ -1119,6 +1781,11 @@ Error BackingMemory::updateRange(ManageRequest type, size_t offset, size_t lengt
 		node->event.raise();
 	}
 
+	while(!pendingManagement.empty()) {
+		auto node = pendingManagement.pop_front();
+		node->complete();
+	}
+
 	return Error::success;
 }
 
@@ -1280,24 +1947,26 @@ void FrontalMemory::markDirty(uintptr_t offset, size_t size) {
 	assert(!(offset % kPageSize));
 	assert(!(size % kPageSize));
 
+	auto now = systemClockSource()->currentNanos();
 	{
 		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_managed->mutex);
 
 		// Put the pages into the dirty state.
+		size_t numDirtied = 0;
 		for(size_t pg = 0; pg < size; pg += kPageSize) {
 			auto index = (offset + pg) >> kPageShift;
 			auto pit = _managed->pages.find(index);
 			assert(pit);
 			if(pit->loadState == ManagedSpace::kStatePresent) {
-				pit->loadState = ManagedSpace::kStateWantWriteback;
 				if(!pit->lockCount)
 					globalReclaimer->removePage(&pit->cachePage);
-				_managed->_writebackList.push_back(&pit->cachePage);
+				_managed->_queueWriteback(pit, now);
+				numDirtied++;
 			}else if(pit->loadState == ManagedSpace::kStateEvicting) {
-				pit->loadState = ManagedSpace::kStateWantWriteback;
 				assert(!pit->lockCount);
-				_managed->_writebackList.push_back(&pit->cachePage);
+				_managed->_queueWriteback(pit, now);
+				numDirtied++;
 			}else if(pit->loadState == ManagedSpace::kStateWriteback) {
 				pit->loadState = ManagedSpace::kStateAnotherWriteback;
 			}else{
@@ -1305,6 +1974,9 @@ void FrontalMemory::markDirty(uintptr_t offset, size_t size) {
 						|| pit->loadState == ManagedSpace::kStateAnotherWriteback);
 			}
 		}
+
+		_managed->_numDirty += numDirtied;
+		globalDirtyPages.fetch_add(numDirtied, std::memory_order_relaxed);
 	}
 
 	// We cannot call management callbacks with locks held, but markDirty() may be called
@@ -1312,6 +1984,82 @@ void FrontalMemory::markDirty(uintptr_t offset, size_t size) {
 	_managed->_deferredManagement.invoke();
 }
 
+void FrontalMemory::markAccessed(uintptr_t offset, size_t size) {
+	assert(!(offset % kPageSize));
+	assert(!(size % kPageSize));
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_managed->mutex);
+
+	for(size_t pg = 0; pg < size; pg += kPageSize) {
+		auto index = (offset + pg) >> kPageShift;
+		auto pit = _managed->pages.find(index);
+		assert(pit);
+		if(pit->loadState == ManagedSpace::kStatePresent) {
+			if(!pit->lockCount)
+				globalReclaimer->bumpPage(&pit->cachePage);
+		}else if(pit->loadState == ManagedSpace::kStateEvicting) {
+			// Cancel evication -- the page is still in use.
+			pit->loadState = ManagedSpace::kStatePresent;
+			globalReclaimer->addPage(&pit->cachePage);
+		}
+	}
+}
+
+PageUsage FrontalMemory::queryPageUsage(uintptr_t offset) {
+	assert(!(offset % kPageSize));
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_managed->mutex);
+
+	auto index = offset >> kPageShift;
+	if(index >= _managed->numPages)
+		return 0;
+	auto pit = _managed->pages.find(index);
+	if(!pit)
+		return 0;
+
+	// Pages of the page cache are shared with all other users of the file.
+	// Unlike peekRange(), we do not cancel eviction of kStateEvicting pages.
+	if(pit->physical != PhysicalAddr(-1))
+		return pageUsagePresent;
+	if(pit->loadState == ManagedSpace::kStateMissing && pit->wasEvicted)
+		return pageUsageEvicted;
+	return 0;
+}
+
+bool FrontalMemory::donatePage(uintptr_t offset, PhysicalAddr physical) {
+	assert(!(offset % kPageSize));
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_managed->mutex);
+
+		auto index = offset >> kPageShift;
+		assert(index < _managed->numPages);
+		auto [pit, wasInserted] = _managed->pages.find_or_insert(index, _managed.get(), index);
+		assert(pit);
+		if(pit->loadState != ManagedSpace::kStateMissing)
+			return false;
+		assert(pit->physical == PhysicalAddr(-1));
+
+		pit->physical = physical;
+		pit->wasEvicted = false;
+		// Donated pages are usually written back under memory pressure; do not wait for
+		// them to expire. Since their dirtyTime is zero, pushing them to the front keeps
+		// _writebackList ordered.
+		pit->loadState = ManagedSpace::kStateWantWriteback;
+		pit->dirtyTime = 0;
+		_managed->_writebackList.push_front(&pit->cachePage);
+
+		_managed->_numDirty++;
+		globalDirtyPages.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	_managed->_deferredManagement.invoke();
+	return true;
+}
+
 size_t FrontalMemory::getLength() {
 	// Size is constant so we do not need to lock.
 	return _managed->numPages << kPageShift;
@@ -1413,6 +2161,18 @@ IndirectMemory::fetchRange(uintptr_t offset, FetchFlags flags, smarter::shared_p
 			+ inSlotOffset, flags, std::move(wq));
 }
 
+PageUsage IndirectMemory::queryPageUsage(uintptr_t offset) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&mutex_);
+
+	auto slot = offset >> 32;
+	auto inSlotOffset = offset & ((uintptr_t(1) << 32) - 1);
+	if(slot >= indirections_.size() || !indirections_[slot])
+		return 0;
+	return indirections_[slot]->memory->queryPageUsage(indirections_[slot]->offset
+			+ inSlotOffset);
+}
+
 void IndirectMemory::markDirty(uintptr_t offset, size_t size) {
 	auto irqLock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&mutex_);
@@ -1454,18 +2214,33 @@ CopyOnWriteMemory::CopyOnWriteMemory(smarter::shared_ptr<MemoryView> view,
 		smarter::shared_ptr<CowChain> chain)
 : MemoryView{&_evictQueue}, _view{std::move(view)},
 		_viewOffset{offset}, _length{length}, _copyChain{std::move(chain)},
-		_ownedPages{*kernelAlloc} {
+		_ownedPages{*kernelAlloc}, _mergedPages{*kernelAlloc}, _mergeableBits{*kernelAlloc} {
 	assert(length);
 	assert(!(offset & (kPageSize - 1)));
 	assert(!(length & (kPageSize - 1)));
+
+	_viewIsZero = _view.get() == getZeroMemory().get();
+	if(_copyChain)
+		_copyChain->_numUsers.fetch_add(1, std::memory_order_relaxed);
 }
 
 CopyOnWriteMemory::~CopyOnWriteMemory() {
+	// The PageMerger keeps a reference while it merges pages; hence, no merge can be
+	// in progress here.
+	if(!_mergeableBits.empty())
+		unregisterMergeableMemory(this);
+
 	for(auto it = _ownedPages.begin(); it != _ownedPages.end(); ++it) {
 		assert(it->state == CowState::hasCopy);
 		assert(it->physical != PhysicalAddr(-1));
+		assert(!it->merging);
 		physicalAllocator->free(it->physical, kPageSize);
 	}
+	for(auto it = _mergedPages.begin(); it != _mergedPages.end(); ++it)
+		unrefStablePage(it->stable);
+
+	if(_copyChain)
+		_copyChain->_numUsers.fetch_sub(1, std::memory_order_release);
 }
 
 size_t CopyOnWriteMemory::getLength() {
@@ -1500,7 +2275,7 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 				// As the page is locked anyway, we can just copy it synchronously.
 				PageAccessor lockedAccessor{page->physical};
 				PageAccessor copyAccessor{copyPhysical};
-				memcpy(copyAccessor.get(), lockedAccessor.get(), kPageSize);
+				copyPage(copyAccessor.get(), lockedAccessor.get());
 
 				// Update the chains.
 				auto fsIt = forked->_ownedPages.insert(pg >> kPageShift);
@@ -1523,25 +2298,44 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 			auto irqLock = frg::guard(&irqMutex());
 			auto lock = frg::guard(&self->_mutex);
 
+			// Keep the chains short: forking repeatedly would otherwise grow them without bound.
+			self->_collapseChain();
+
 			// Create a new CowChain for both the original and the forked mapping.
 			// To correct handle locks pages, we move only non-locked pages from
 			// the original mapping to the new chain.
 			newChain = smarter::allocate_shared<CowChain>(*kernelAlloc, self->_copyChain);
 
 			// Update the original mapping
+			if(self->_copyChain)
+				self->_copyChain->_numUsers.fetch_sub(1, std::memory_order_release);
 			self->_copyChain = newChain;
+			newChain->_numUsers.fetch_add(1, std::memory_order_relaxed);
 
 			// Create a new mapping in the forked space.
 			forked = smarter::allocate_shared<CopyOnWriteMemory>(*kernelAlloc,
 							self->_view, self->_viewOffset, self->_length, newChain);
 			forked->selfPtr = forked;
 
+			// The forked memory inherits the merging advice.
+			if(!self->_mergeableBits.empty()) {
+				forked->_mergeableBits.resize(self->_mergeableBits.size(), 0);
+				for(size_t i = 0; i < self->_mergeableBits.size(); i++)
+					forked->_mergeableBits[i] = self->_mergeableBits[i];
+			}
+
 			// Inspect all copied pages owned by the original mapping.
 			for(size_t pg = 0; pg < self->_length; pg += kPageSize) {
 				auto osIt = self->_ownedPages.find(pg >> kPageShift);
 
-				if(!osIt)
+				if(!osIt) {
+					// Merged pages are never written to; hence, both mappings can share them.
+					if(auto merged = self->_mergedPages.find(pg >> kPageShift); merged) {
+						refStablePage(merged->stable);
+						forked->_mergedPages.insert(pg >> kPageShift, merged->stable);
+					}
 					continue;
+				}
 				if(osIt->state == CowState::inProgress) {
 					// We wait for the in progress pages later, as we
 					// need to drop the locks we're holding before
@@ -1556,6 +2350,9 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 			}
 		}
 
+		if(!forked->_mergeableBits.empty())
+			registerMergeableMemory(forked.get());
+
 		// Wait for the in progress pages to complete copying.
 		bool stillWaiting = inProgressPages.size() > 0;
 		while (stillWaiting) {
@@ -1608,6 +2405,7 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 			smarter::shared_ptr<CowChain> chain;
 			smarter::shared_ptr<MemoryView> view;
 			uintptr_t viewOffset;
+			StablePage *stable = nullptr;
 			CowPage *cowIt;
 			bool waitForCopy = false;
 			{
@@ -1620,6 +2418,7 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 					if(cowIt->state == CowState::hasCopy) {
 						assert(cowIt->physical != PhysicalAddr(-1));
 
+						cowIt->merging = false;
 						cowIt->lockCount++;
 						progress += kPageSize;
 						continue;
@@ -1628,13 +2427,21 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 						waitForCopy = true;
 					}
 				}else{
+					self->_collapseChain();
 					chain = self->_copyChain;
 					view = self->_view;
 					viewOffset = self->_viewOffset;
 
+					// Merged pages are copied from their stable page.
+					if(auto merged = self->_mergedPages.find(offset >> kPageShift); merged) {
+						stable = merged->stable;
+						self->_mergedPages.erase(offset >> kPageShift);
+					}
+
 					// Otherwise we need to copy from the chain or from the root view.
 					cowIt = self->_ownedPages.insert(offset >> kPageShift);
 					cowIt->state = CowState::inProgress;
+					self->_numCopiesInProgress++;
 				}
 			}
 
@@ -1669,30 +2476,36 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 			assert(physical != PhysicalAddr(-1) && "OOM");
 			PageAccessor accessor{physical};
 
-			// Try to copy from a descendant CoW chain.
 			auto pageOffset = viewOffset + offset;
-			while(chain) {
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&chain->_mutex);
-
-				if(auto it = chain->_pages.find(pageOffset >> kPageShift); it) {
-					// We can just copy synchronously here -- the descendant is not evicted.
-					auto srcPhysical = it->load(std::memory_order_relaxed);
-					assert(srcPhysical != PhysicalAddr(-1));
-					auto srcAccessor = PageAccessor{srcPhysical};
-					memcpy(accessor.get(), srcAccessor.get(), kPageSize);
-					break;
-				}
+			if(stable) {
+				// Stable pages are never written to; we can copy synchronously.
+				auto srcAccessor = PageAccessor{stable->physical};
+				copyPage(accessor.get(), srcAccessor.get());
+			}else{
+				// Try to copy from a descendant CoW chain.
+				while(chain) {
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&chain->_mutex);
+
+					if(auto it = chain->_pages.find(pageOffset >> kPageShift); it) {
+						// We can just copy synchronously here -- the descendant is not evicted.
+						auto srcPhysical = it->load(std::memory_order_relaxed);
+						assert(srcPhysical != PhysicalAddr(-1));
+						auto srcAccessor = PageAccessor{srcPhysical};
+						copyPage(accessor.get(), srcAccessor.get());
+						break;
+					}
 
-				chain = chain->_superChain;
-			}
+					chain = chain->_superChain;
+				}
 
-			// Copy from the root view.
-			if(!chain) {
-				// TODO: Handle errors here -- we need to drop the lock again.
-				auto copyOutcome = co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
-						accessor.get(), kPageSize, wq);
-				assert(copyOutcome);
+				// Copy from the root view.
+				if(!chain) {
+					// TODO: Handle errors here -- we need to drop the lock again.
+					auto copyOutcome = co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
+							accessor.get(), kPageSize, wq);
+					assert(copyOutcome);
+				}
 			}
 
 			// To make CoW unobservable, we first need to evict the page here.
@@ -1707,8 +2520,12 @@ bool CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 				cowIt->state = CowState::hasCopy;
 				cowIt->physical = physical;
 				cowIt->lockCount++;
+				self->_numCopiesInProgress--;
 			}
 			self->_copyEvent.raise();
+			// The stable page can only be freed after it is unmapped from our mappings.
+			if(stable)
+				unrefStablePage(stable);
 			progress += kPageSize;
 		}
 
@@ -1737,6 +2554,7 @@ frg::tuple<PhysicalAddr, CachingMode> CopyOnWriteMemory::peekRange(uintptr_t off
 
 	if(auto it = _ownedPages.find(offset >> kPageShift); it) {
 		assert(it->state == CowState::hasCopy);
+		it->merging = false;
 		return frg::tuple<PhysicalAddr, CachingMode>{it->physical, CachingMode::null};
 	}
 
@@ -1748,6 +2566,7 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 	smarter::shared_ptr<CowChain> chain;
 	smarter::shared_ptr<MemoryView> view;
 	uintptr_t viewOffset;
+	StablePage *stable = nullptr;
 	CowPage *cowIt;
 	bool waitForCopy = false;
 	{
@@ -1760,19 +2579,29 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 			if(cowIt->state == CowState::hasCopy) {
 				assert(cowIt->physical != PhysicalAddr(-1));
 
+				// Cancel merging -- the page is still needed.
+				cowIt->merging = false;
 				co_return PhysicalRange{cowIt->physical, kPageSize, CachingMode::null};
 			}else{
 				assert(cowIt->state == CowState::inProgress);
 				waitForCopy = true;
 			}
 		}else{
+			_collapseChain();
 			chain = _copyChain;
 			view = _view;
 			viewOffset = _viewOffset;
 
+			// Merged pages are copied from their stable page.
+			if(auto merged = _mergedPages.find(offset >> kPageShift); merged) {
+				stable = merged->stable;
+				_mergedPages.erase(offset >> kPageShift);
+			}
+
 			// Otherwise we need to copy from the chain or from the root view.
 			cowIt = _ownedPages.insert(offset >> kPageShift);
 			cowIt->state = CowState::inProgress;
+			_numCopiesInProgress++;
 		}
 	}
 
@@ -1799,28 +2628,34 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 	assert(physical != PhysicalAddr(-1) && "OOM");
 	PageAccessor accessor{physical};
 
-	// Try to copy from a descendant CoW chain.
 	auto pageOffset = viewOffset + offset;
-	while(chain) {
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&chain->_mutex);
-
-		if(auto it = chain->_pages.find(pageOffset >> kPageShift); it) {
-			// We can just copy synchronously here -- the descendant is not evicted.
-			auto srcPhysical = it->load(std::memory_order_relaxed);
-			assert(srcPhysical != PhysicalAddr(-1));
-			auto srcAccessor = PageAccessor{srcPhysical};
-			memcpy(accessor.get(), srcAccessor.get(), kPageSize);
-			break;
-		}
+	if(stable) {
+		// Stable pages are never written to; we can copy synchronously.
+		auto srcAccessor = PageAccessor{stable->physical};
+		copyPage(accessor.get(), srcAccessor.get());
+	}else{
+		// Try to copy from a descendant CoW chain.
+		while(chain) {
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&chain->_mutex);
+
+			if(auto it = chain->_pages.find(pageOffset >> kPageShift); it) {
+				// We can just copy synchronously here -- the descendant is not evicted.
+				auto srcPhysical = it->load(std::memory_order_relaxed);
+				assert(srcPhysical != PhysicalAddr(-1));
+				auto srcAccessor = PageAccessor{srcPhysical};
+				copyPage(accessor.get(), srcAccessor.get());
+				break;
+			}
 
-		chain = chain->_superChain;
-	}
+			chain = chain->_superChain;
+		}
 
-	// Copy from the root view.
-	if(!chain) {
-		FRG_CO_TRY(co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
-				accessor.get(), kPageSize, wq));
+		// Copy from the root view.
+		if(!chain) {
+			FRG_CO_TRY(co_await view->copyFrom(pageOffset & ~(kPageSize - 1),
+					accessor.get(), kPageSize, wq));
+		}
 	}
 
 	// To make CoW unobservable, we first need to evict the page here.
@@ -1834,8 +2669,12 @@ CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<
 		assert(cowIt->state == CowState::inProgress);
 		cowIt->state = CowState::hasCopy;
 		cowIt->physical = physical;
+		_numCopiesInProgress--;
 	}
 	_copyEvent.raise();
+	// The stable page can only be freed after it is unmapped from our mappings.
+	if(stable)
+		unrefStablePage(stable);
 	co_return PhysicalRange{cowIt->physical, kPageSize, CachingMode::null};
 }
 
@@ -1843,6 +2682,119 @@ void CopyOnWriteMemory::markDirty(uintptr_t, size_t) {
 	// We do not need to track dirty pages.
 }
 
+PageUsage CopyOnWriteMemory::queryPageUsage(uintptr_t offset) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	// Only pages that we copied can be mapped (apart from the global zero page).
+	// Pages that are still in the chain are shared with our CoW relatives but
+	// they are not mapped into this view's mappings.
+	if(auto it = _ownedPages.find(offset >> kPageShift); it && it->state == CowState::hasCopy)
+		return pageUsagePresent | pageUsageAnonymous | pageUsagePrivate;
+	// Merged pages are mapped but they are shared with other memory objects.
+	if(_mergedPages.find(offset >> kPageShift))
+		return pageUsagePresent | pageUsageAnonymous;
+	return 0;
+}
+
+PhysicalAddr CopyOnWriteMemory::peekSharedPage(uintptr_t offset) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	// Note that pages that are currently being copied are also found here.
+	if(_ownedPages.find(offset >> kPageShift))
+		return PhysicalAddr(-1);
+
+	if(auto merged = _mergedPages.find(offset >> kPageShift); merged)
+		return merged->stable->physical;
+
+	if(!_viewIsZero)
+		return PhysicalAddr(-1);
+
+	// Only pages that were never written to in any CoW ancestor are zero.
+	auto pageOffset = _viewOffset + offset;
+	for(auto chain = _copyChain.get(); chain; chain = chain->_superChain.get()) {
+		auto chainLock = frg::guard(&chain->_mutex);
+		if(chain->_pages.find(pageOffset >> kPageShift))
+			return PhysicalAddr(-1);
+	}
+	return getZeroPage();
+}
+
+Error CopyOnWriteMemory::adviseRange(MemoryAdvice advice, uintptr_t offset, size_t size) {
+	if(offset + size < offset || offset + size > _length)
+		return Error::bufferTooSmall;
+	if(advice != MemoryAdvice::mergeable && advice != MemoryAdvice::unmergeable)
+		return Error::illegalArgs;
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(_mergeableBits.empty()) {
+			if(advice == MemoryAdvice::unmergeable)
+				return Error::success;
+			_mergeableBits.resize(((_length >> kPageShift) + 63) / 64, 0);
+		}
+
+		// Pages that are already merged stay merged until they are written to.
+		auto first = offset >> kPageShift;
+		auto last = (offset + size + kPageSize - 1) >> kPageShift;
+		for(size_t i = first; i < last; i++) {
+			if(advice == MemoryAdvice::mergeable) {
+				_mergeableBits[i / 64] |= uint64_t{1} << (i % 64);
+			}else{
+				_mergeableBits[i / 64] &= ~(uint64_t{1} << (i % 64));
+			}
+		}
+	}
+
+	if(advice == MemoryAdvice::mergeable)
+		registerMergeableMemory(this);
+	return Error::success;
+}
+
+void CopyOnWriteMemory::_collapseChain() {
+	// Copies in progress may still read from the chain without holding _mutex.
+	if(_numCopiesInProgress)
+		return;
+
+	// If we are the only user of the chain, no other CopyOnWriteMemory can observe it.
+	// All of its pages can then be taken over (or freed if we already own a copy).
+	// Since new users can only be added by fork() under our _mutex, this check is stable.
+	while(_copyChain && _copyChain->_numUsers.load(std::memory_order_acquire) == 1) {
+		auto chain = std::move(_copyChain);
+		{
+			auto chainLock = frg::guard(&chain->_mutex);
+
+			for(size_t pg = 0; pg < _length; pg += kPageSize) {
+				auto pageIndex = (_viewOffset + pg) >> kPageShift;
+				auto it = chain->_pages.find(pageIndex);
+				if(!it)
+					continue;
+				auto physical = it->load(std::memory_order_relaxed);
+				assert(physical != PhysicalAddr(-1));
+				chain->_pages.erase(pageIndex);
+
+				if(_ownedPages.find(pg >> kPageShift) || _mergedPages.find(pg >> kPageShift)) {
+					physicalAllocator->free(physical, kPageSize);
+				}else{
+					auto ownIt = _ownedPages.insert(pg >> kPageShift);
+					ownIt->state = CowState::hasCopy;
+					ownIt->physical = physical;
+				}
+			}
+		}
+
+		_copyChain = chain->_superChain;
+		if(_copyChain)
+			_copyChain->_numUsers.fetch_add(1, std::memory_order_relaxed);
+		// Drops our reference to the (now empty) chain.
+		chain->_numUsers.fetch_sub(1, std::memory_order_relaxed);
+		chain = nullptr;
+	}
+}
+
 coroutine<frg::expected<Error, PhysicalAddr>> CopyOnWriteMemory::takeGlobalFutex(uintptr_t offset,
 		smarter::shared_ptr<WorkQueue> wq) {
 	// For now, we pick the trival implementation here.
@@ -2,9 +2,13 @@
 #include <bragi/helpers-frigg.hpp>
 #include <frg/small_vector.hpp>
 #include <frg/span.hpp>
+#include <frg/vector.hpp>
+#include <protocols/ostrace/ring.hpp>
+#include <thor-internal/address-space.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/kernel-io.hpp>
 #include <thor-internal/main.hpp>
+#include <thor-internal/memory-view.hpp>
 #include <thor-internal/ostrace.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/timer.hpp>
@@ -43,22 +47,321 @@ initgraph::Task initOsTraceCore{&globalInitEngine, "generic.init-ostrace-core",
 	}
 };
 
+// Records in the per-CPU rings are prefixed by their timestamp.
+// This allows the drain fiber to merge the per-CPU rings in timestamp order.
+constexpr size_t tsPrefixSize = sizeof(uint64_t);
+
 template<typename R>
-void commitOsTrace(R record) {
+void commitOsTrace(R record, uint64_t ts) {
 	if(!osTraceInUse.load(std::memory_order_relaxed))
 		return;
 
-	auto ts = record.size_of_tail();
+	auto tailSize = record.size_of_tail();
 	frg::small_vector<char, 64, KernelAlloc> ser(*kernelAlloc);
-	ser.resize(8 + ts);
+	ser.resize(tsPrefixSize + 8 + tailSize);
+	memcpy(ser.data(), &ts, tsPrefixSize);
 	bool encodeSuccess = bragi::write_head_tail(record,
-			frg::span<char>(ser.data(), 8),
-			frg::span<char>(ser.data() + 8, ts));
+			frg::span<char>(ser.data() + tsPrefixSize, 8),
+			frg::span<char>(ser.data() + tsPrefixSize + 8, tailSize));
 	assert(encodeSuccess);
 
-	// We want to be able to call this function from any context, but we cannot wake the waiters
-	// in all contexts. For now, only wake waiters if IRQs are enabled.
-	globalOsTraceRing->enqueue(ser.data(), ser.size(), !intsAreEnabled());
+	// Only the local CPU writes to its ring; disabling IRQs is enough to serialize writers.
+	auto irqLock = frg::guard(&irqMutex());
+
+	auto cpuData = getCpuData();
+	auto ring = cpuData->localOsTraceRing.load(std::memory_order_relaxed);
+	if(!ring) {
+		ring = frg::construct<SingleContextRecordRing>(*kernelAlloc);
+		cpuData->localOsTraceRing.store(ring, std::memory_order_release);
+	}
+	ring->enqueue(ser.data(), ser.size());
+}
+
+template<typename R>
+void commitOsTrace(R record) {
+	commitOsTrace(std::move(record), systemClockSource()->currentNanos());
+}
+
+struct OsTraceCursor {
+	uint64_t deqPtr = 0;
+	bool valid = false;
+	uint64_t ts;
+	size_t size;
+	char buffer[512];
+};
+
+// Ring that a process writes EventRecords to (see protocols/ostrace/ring.hpp).
+// Its memory is locked while the ring is registered, such that the drain fiber can read
+// it through the physical pages. We never trust the contents of the ring.
+struct UserOsTraceRing {
+	UserOsTraceRing(smarter::shared_ptr<MemoryView> view)
+	: view_{std::move(view)}, pages_{*kernelAlloc} { }
+
+	UserOsTraceRing(const UserOsTraceRing &) = delete;
+
+	UserOsTraceRing &operator= (const UserOsTraceRing &) = delete;
+
+	coroutine<Error> setup() {
+		using protocols::ostrace::ringDataOffset;
+		size_t length = frg::min(view_->getLength(),
+				ringDataOffset + (size_t{1} << protocols::ostrace::maxRingShift));
+		if(length < ringDataOffset + (size_t{1} << protocols::ostrace::minRingShift))
+			co_return Error::illegalArgs;
+
+		lock_ = MemoryViewLockHandle{view_, 0, length};
+		co_await lock_.acquire(WorkQueue::generalQueue()->take());
+		if(!lock_)
+			co_return Error::fault;
+
+		auto touchOutcome = co_await view_->touchRange(0, length, 0,
+				WorkQueue::generalQueue()->take());
+		if(!touchOutcome)
+			co_return touchOutcome.error();
+
+		pages_.resize(length / kPageSize);
+		for(size_t i = 0; i < pages_.size(); i++) {
+			auto physical = view_->peekRange(i * kPageSize).get<0>();
+			if(physical == PhysicalAddr(-1))
+				co_return Error::fault;
+			pages_[i] = physical;
+		}
+
+		uint32_t shift;
+		copyOut_(offsetof(protocols::ostrace::UserRingHeader, shift), &shift, sizeof(uint32_t));
+		if(shift < protocols::ostrace::minRingShift || shift > protocols::ostrace::maxRingShift
+				|| ringDataOffset + (size_t{1} << shift) > length)
+			co_return Error::illegalArgs;
+		ringSize_ = size_t{1} << shift;
+		co_return Error::success;
+	}
+
+	// Same interface as SingleContextRecordRing::dequeueAt().
+	frg::tuple<bool, uint64_t, uint64_t, size_t>
+	dequeueAt(uint64_t deqPtr, void *data, size_t maxSize) {
+		// Do not let the process stall the drain fiber by moving the tail all the time.
+		for(int attempt = 0; attempt < 4; attempt++) {
+			auto beforePtr = load_(offsetof(protocols::ostrace::UserRingHeader, tailPtr));
+			if(deqPtr < beforePtr)
+				deqPtr = beforePtr;
+
+			auto validPtr = load_(offsetof(protocols::ostrace::UserRingHeader, headPtr));
+			if(deqPtr >= validPtr)
+				return {false, deqPtr, deqPtr, 0};
+
+			auto recordOffset = deqPtr & (ringSize_ - 1);
+			if((recordOffset & (sizeof(size_t) - 1)))
+				return {false, validPtr, validPtr, 0};
+
+			size_t recordSize;
+			copyRing_(recordOffset, &recordSize, sizeof(size_t));
+			if(recordSize > ringSize_ - sizeof(size_t))
+				return {false, validPtr, validPtr, 0};
+			auto chunkSize = frg::min(recordSize, maxSize);
+			copyRing_((recordOffset + sizeof(size_t)) & (ringSize_ - 1), data, chunkSize);
+
+			// Validate the data *after* copying.
+			auto afterPtr = load_(offsetof(protocols::ostrace::UserRingHeader, tailPtr));
+			if(deqPtr < afterPtr)
+				continue;
+
+			auto effectiveSize = (sizeof(size_t) + recordSize + sizeof(size_t) - 1)
+					& ~(sizeof(size_t) - 1);
+			return {true, deqPtr, deqPtr + effectiveSize, chunkSize};
+		}
+		return {false, deqPtr, deqPtr, 0};
+	}
+
+	// Set once the process closes the conversation that registered the ring.
+	std::atomic<bool> closed{false};
+	OsTraceCursor cursor;
+	frg::default_list_hook<UserOsTraceRing> hook;
+
+private:
+	uint64_t load_(size_t offset) {
+		PageAccessor accessor{pages_[offset / kPageSize]};
+		auto word = reinterpret_cast<uint64_t *>(
+				reinterpret_cast<char *>(accessor.get()) + (offset & (kPageSize - 1)));
+		return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+	}
+
+	void copyOut_(size_t offset, void *buffer, size_t size) {
+		auto p = reinterpret_cast<char *>(buffer);
+		while(size) {
+			auto misalign = offset & (kPageSize - 1);
+			auto chunk = frg::min(kPageSize - misalign, size);
+			PageAccessor accessor{pages_[offset / kPageSize]};
+			memcpy(p, reinterpret_cast<char *>(accessor.get()) + misalign, chunk);
+			p += chunk;
+			offset += chunk;
+			size -= chunk;
+		}
+	}
+
+	void copyRing_(size_t ringOffset, void *buffer, size_t size) {
+		auto p = reinterpret_cast<char *>(buffer);
+		auto preWrapSize = frg::min(ringSize_ - ringOffset, size);
+		copyOut_(protocols::ostrace::ringDataOffset + ringOffset, p, preWrapSize);
+		copyOut_(protocols::ostrace::ringDataOffset, p + preWrapSize, size - preWrapSize);
+	}
+
+	smarter::shared_ptr<MemoryView> view_;
+	MemoryViewLockHandle lock_;
+	frg::vector<PhysicalAddr, KernelAlloc> pages_;
+	size_t ringSize_ = 0;
+};
+
+frg::ticket_spinlock userRingsMutex;
+frg::intrusive_list<
+	UserOsTraceRing,
+	frg::locate_member<
+		UserOsTraceRing,
+		frg::default_list_hook<UserOsTraceRing>,
+		&UserOsTraceRing::hook
+	>
+> userRings;
+
+// Processes can write arbitrary data to their rings; only forward well-formed EventRecords.
+bool isValidUserRecord(OsTraceCursor *cursor) {
+	frg::span<const char> record{cursor->buffer + tsPrefixSize, cursor->size - tsPrefixSize};
+	auto preamble = bragi::read_preamble(record);
+	if(preamble.error() || preamble.id() != bragi::message_id<managarm::ostrace::EventRecord>)
+		return false;
+	if(8 + preamble.tail_size() != record.size())
+		return false;
+	return static_cast<bool>(bragi::parse_head_tail<managarm::ostrace::EventRecord>(
+			record.subspan(0, 8), record.subspan(8, preamble.tail_size()), *kernelAlloc));
+}
+
+// The drain fiber polls the rings: kernel records are committed with IRQs disabled
+// (where we cannot wake up fibers) and processes write their rings without entering
+// the kernel at all. To avoid waking up periodically on an idle system, the polling
+// interval backs off while the rings stay empty. The maximum interval bounds the
+// amount of records that a ring needs to buffer after a period of inactivity.
+constexpr uint64_t minDrainInterval = 1'000'000;
+constexpr uint64_t maxDrainInterval = 16'000'000;
+
+// Moves records from the per-CPU rings to the global ring, ordered by timestamp.
+void drainOsTraceRings() {
+	frg::vector<OsTraceCursor, KernelAlloc> cursors{*kernelAlloc};
+	frg::vector<UserOsTraceRing *, KernelAlloc> activeRings{*kernelAlloc};
+	uint64_t drainInterval = minDrainInterval;
+
+	while(true) {
+		bool forwarded = false;
+
+		// Records are timestamped before they are committed. Hence, once we start
+		// scanning the rings, no record with a timestamp <= watermark can appear anymore
+		// unless it is already visible to us. In particular, this ensures that announce
+		// records are always forwarded before the events that refer to them.
+		auto watermark = systemClockSource()->currentNanos();
+
+		while(cursors.size() < getCpuCount())
+			cursors.emplace_back();
+
+		// Only this fiber removes rings; hence, the pointers stay valid during this round.
+		activeRings.resize(0);
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&userRingsMutex);
+
+			for(auto ring : userRings)
+				activeRings.push_back(ring);
+		}
+
+		// Fills the cursor with the next record of the ring. Returns false if there is none.
+		auto refill = [] (OsTraceCursor *cursor, auto *ring) -> bool {
+			if(cursor->valid)
+				return true;
+			auto deqPtr = cursor->deqPtr;
+			auto [success, recordPtr, nextPtr, size] = ring->dequeueAt(
+					deqPtr, cursor->buffer, sizeof(cursor->buffer));
+			cursor->deqPtr = nextPtr;
+			if(!success)
+				return false;
+			if(recordPtr != deqPtr)
+				infoLogger() << "thor: ostrace records lost" << frg::endlog;
+			if(size == sizeof(cursor->buffer) || size <= tsPrefixSize) {
+				infoLogger() << "thor: Dropping oversized ostrace record" << frg::endlog;
+				return false;
+			}
+			memcpy(&cursor->ts, cursor->buffer, tsPrefixSize);
+			cursor->size = size;
+			cursor->valid = true;
+			return true;
+		};
+
+		while(true) {
+			OsTraceCursor *next = nullptr;
+			auto consider = [&] (OsTraceCursor *cursor) {
+				if(cursor->ts > watermark)
+					return;
+				if(!next || cursor->ts < next->ts)
+					next = cursor;
+			};
+
+			for(size_t k = 0; k < cursors.size(); ++k) {
+				auto ring = getCpuData(k)->localOsTraceRing.load(std::memory_order_acquire);
+				if(ring && refill(&cursors[k], ring))
+					consider(&cursors[k]);
+			}
+
+			// Processes can be preempted between taking the timestamp and committing
+			// a record. Hence, their records can be forwarded slightly out of order.
+			for(auto ring : activeRings) {
+				auto cursor = &ring->cursor;
+				bool wasValid = cursor->valid;
+				if(!refill(cursor, ring))
+					continue;
+				if(!wasValid && !isValidUserRecord(cursor)) {
+					infoLogger() << "thor: Dropping malformed ostrace record"
+							" from user space" << frg::endlog;
+					cursor->valid = false;
+					continue;
+				}
+				consider(cursor);
+			}
+
+			if(!next)
+				break;
+
+			globalOsTraceRing->enqueue(next->buffer + tsPrefixSize, next->size - tsPrefixSize);
+			next->valid = false;
+			forwarded = true;
+		}
+
+		// Records that are still in the rings of closed processes are lost.
+		frg::intrusive_list<
+			UserOsTraceRing,
+			frg::locate_member<
+				UserOsTraceRing,
+				frg::default_list_hook<UserOsTraceRing>,
+				&UserOsTraceRing::hook
+			>
+		> closedRings;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&userRingsMutex);
+
+			for(auto it = userRings.begin(); it != userRings.end(); ) {
+				auto ring = *it;
+				++it;
+				if(!ring->closed.load(std::memory_order_acquire))
+					continue;
+				userRings.erase(userRings.iterator_to(ring));
+				closedRings.push_back(ring);
+			}
+		}
+		// Unlocking the memory can free it; thus we do it outside of the lock.
+		while(!closedRings.empty())
+			frg::destruct(*kernelAlloc, closedRings.pop_front());
+
+		if(forwarded) {
+			drainInterval = minDrainInterval;
+		} else {
+			drainInterval = frg::min(drainInterval * 2, maxDrainInterval);
+		}
+		KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(drainInterval));
+	}
 }
 
 } // anonymous namespace
@@ -74,10 +377,25 @@ OsTraceEventId announceOsTraceEvent(frg::string_view name) {
 	return static_cast<OsTraceEventId>(id);
 }
 
-void emitOsTrace(managarm::ostrace::EventRecord<KernelAlloc> record) {
-	record.set_ts(systemClockSource()->currentNanos());
+OsTraceItemId announceOsTraceItem(frg::string_view name) {
+	auto id = nextId.fetch_add(1, std::memory_order_relaxed);
 
+	managarm::ostrace::AnnounceItemRecord<KernelAlloc> record{*kernelAlloc};
+	record.set_id(id);
+	record.set_name(frg::string<KernelAlloc>{*kernelAlloc, name});
 	commitOsTrace(std::move(record));
+
+	return static_cast<OsTraceItemId>(id);
+}
+
+void emitOsTrace(managarm::ostrace::EventRecord<KernelAlloc> record) {
+	emitOsTrace(std::move(record), systemClockSource()->currentNanos());
+}
+
+void emitOsTrace(managarm::ostrace::EventRecord<KernelAlloc> record, uint64_t ts) {
+	record.set_ts(ts);
+
+	commitOsTrace(std::move(record), ts);
 }
 
 LogRingBuffer *getGlobalOsTraceRing() {
@@ -231,6 +549,61 @@ private:
 				co_return Error::protocolViolation;
 			}
 		} break;
+		case bragi::message_id<managarm::ostrace::RegisterRingReq>: {
+			auto maybeReq = bragi::parse_head_tail<managarm::ostrace::RegisterRingReq>(
+					headSpan, tailSpan, *kernelAlloc);
+			if(!maybeReq)
+				co_return Error::protocolViolation;
+
+			auto [pullError, descriptor] = co_await PullDescriptorSender{lane};
+			if(pullError != Error::success) {
+				assert(isRemoteIpcError(pullError));
+				co_return Error::protocolViolation;
+			}
+
+			UserOsTraceRing *ring = nullptr;
+			managarm::ostrace::Response<KernelAlloc> resp(*kernelAlloc);
+			if(!wantOsTrace) {
+				resp.set_error(managarm::ostrace::Error::OSTRACE_GLOBALLY_DISABLED);
+			}else if(!descriptor.is<MemoryViewDescriptor>()) {
+				resp.set_error(managarm::ostrace::Error::ILLEGAL_REQUEST);
+			}else{
+				ring = frg::construct<UserOsTraceRing>(*kernelAlloc,
+						descriptor.get<MemoryViewDescriptor>().memory);
+				if(auto setupError = co_await ring->setup(); setupError != Error::success) {
+					frg::destruct(*kernelAlloc, ring);
+					ring = nullptr;
+					resp.set_error(managarm::ostrace::Error::ILLEGAL_REQUEST);
+				}else{
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&userRingsMutex);
+
+					userRings.push_back(ring);
+					resp.set_error(managarm::ostrace::Error::SUCCESS);
+				}
+			}
+
+			frg::string<KernelAlloc> ser(*kernelAlloc);
+			resp.SerializeToString(&ser);
+			frg::unique_memory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+			memcpy(respBuffer.data(), ser.data(), ser.size());
+			auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+
+			// The process keeps the conversation open while it uses the ring.
+			// The ring is removed by the drain fiber once this fails.
+			if(ring) {
+				async::detach_with_allocator(*kernelAlloc, [] (LaneHandle lane,
+						UserOsTraceRing *ring) -> coroutine<void> {
+					co_await RecvBufferSender{lane};
+					ring->closed.store(true, std::memory_order_release);
+				}(lane, ring));
+			}
+
+			if(respError != Error::success) {
+				assert(isRemoteIpcError(respError));
+				co_return Error::protocolViolation;
+			}
+		} break;
 		default:
 			managarm::ostrace::Response<KernelAlloc> resp(*kernelAlloc);
 			resp.set_error(managarm::ostrace::Error::ILLEGAL_REQUEST);
@@ -264,6 +637,8 @@ initgraph::Task initOsTraceMbus{&globalInitEngine, "generic.init-ostrace-sinks",
 			// Only dump to an I/O channel if ostrace is supported (otherwise, the ring buffer
 			// does not even exist).
 			if(wantOsTrace) {
+				KernelFiber::run(drainOsTraceRings);
+
 				auto channel = solicitIoChannel("ostrace");
 				if(channel) {
 					infoLogger() << "thor: Connecting ostrace to I/O channel" << frg::endlog;
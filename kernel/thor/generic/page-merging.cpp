@@ -0,0 +1,464 @@
+#include <string.h>
+
+#include <frg/hash_map.hpp>
+#include <frg/list.hpp>
+#include <frg/manual_box.hpp>
+#include <thor-internal/arch/paging.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/memory-view.hpp>
+#include <thor-internal/page-merging.hpp>
+#include <thor-internal/physical.hpp>
+#include <thor-internal/timer.hpp>
+#include <thor-internal/work-queue.hpp>
+
+namespace thor {
+
+namespace {
+
+constexpr bool logMerging = false;
+
+// The scanner wakes up at this interval and scans up to pagesPerScan mergeable pages.
+constexpr uint64_t scanIntervalNanos = 20'000'000;
+constexpr size_t pagesPerScan = 256;
+
+bool samePage(PhysicalAddr a, PhysicalAddr b) {
+	PageAccessor accessorA{a};
+	PageAccessor accessorB{b};
+	return !memcmp(accessorA.get(), accessorB.get(), kPageSize);
+}
+
+} // anonymous namespace
+
+// The scanner works in passes over all registered memory objects.
+// Candidates are first looked up in the table of stable pages. If no stable page matches,
+// the candidate is looked up in the unstable table, which contains the candidates that
+// were already seen in the current pass. If it matches, both pages are merged into a
+// new stable page; otherwise, the candidate is added to the unstable table.
+//
+// Pages are unmapped (i.e., isolated) before they are merged. Since accessing an isolated
+// page cancels the merge, the page contents are stable once the merge is committed.
+// Lock order: CopyOnWriteMemory::_mutex is taken before PageMerger::mutex.
+struct PageMerger {
+	struct UnstableEntry {
+		smarter::weak_ptr<CopyOnWriteMemory> memory;
+		size_t index;
+	};
+
+	using UnstableTable = frg::hash_map<
+		uint64_t,
+		UnstableEntry,
+		frg::hash<uint64_t>,
+		KernelAlloc
+	>;
+
+	PageMerger()
+	: stableTable{frg::hash<uint64_t>{}, *kernelAlloc} {
+		unstableTable.initialize(frg::hash<uint64_t>{}, *kernelAlloc);
+	}
+
+	void run() {
+		[] (PageMerger *self, enable_detached_coroutine = {}) -> void {
+			while(true) {
+				bool stillWaiting;
+				do {
+					stillWaiting = co_await self->registerEvent.async_wait_if([&] () -> bool {
+						auto irqLock = frg::guard(&irqMutex());
+						auto lock = frg::guard(&self->mutex);
+
+						return self->memories.empty();
+					});
+				} while(stillWaiting);
+
+				co_await generalTimerEngine()->sleepFor(scanIntervalNanos);
+				co_await WorkQueue::generalQueue()->schedule();
+
+				size_t budget = pagesPerScan;
+				while(budget) {
+					auto memory = self->currentMemory();
+					if(!memory) {
+						self->endPass();
+						break;
+					}
+					if(co_await self->scanMemory(memory, budget))
+						self->advanceCursor(memory.get());
+				}
+			}
+		}(this);
+	}
+
+	void registerMemory(CopyOnWriteMemory *memory) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&mutex);
+
+			if(memory->_mergeRegistered)
+				return;
+			memory->_mergeRegistered = true;
+			memories.push_back(memory);
+		}
+		registerEvent.raise();
+	}
+
+	void unregisterMemory(CopyOnWriteMemory *memory) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex);
+
+		if(!memory->_mergeRegistered)
+			return;
+		if(cursor == memory)
+			cursor = nextOf(memory);
+		memories.erase(memories.iterator_to(memory));
+		memory->_mergeRegistered = false;
+	}
+
+	void refStable(StablePage *page) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex);
+
+		assert(page->refCount);
+		page->refCount++;
+	}
+
+	void unrefStable(StablePage *page) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&mutex);
+
+			assert(page->refCount);
+			if(--page->refCount)
+				return;
+			if(auto it = stableTable.get(page->hash); it && *it == page)
+				stableTable.remove(page->hash);
+		}
+
+		if(logMerging)
+			infoLogger() << "thor: Freeing stable page " << (void *)page->physical << frg::endlog;
+		physicalAllocator->free(page->physical, kPageSize);
+		frg::destruct(*kernelAlloc, page);
+	}
+
+private:
+	// Called with mutex held.
+	CopyOnWriteMemory *nextOf(CopyOnWriteMemory *memory) {
+		auto it = memories.iterator_to(memory);
+		++it;
+		if(it == memories.end())
+			return nullptr;
+		return *it;
+	}
+
+	// Returns the memory at the cursor or null at the end of the pass.
+	smarter::shared_ptr<CopyOnWriteMemory> currentMemory() {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex);
+
+		while(cursor) {
+			// Memory objects that are being destructed are skipped.
+			if(auto memory = cursor->selfPtr.lock(); memory)
+				return memory;
+			cursor = nextOf(cursor);
+		}
+		return nullptr;
+	}
+
+	void advanceCursor(CopyOnWriteMemory *memory) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex);
+
+		// The cursor may have been moved by unregisterMemory().
+		if(cursor == memory)
+			cursor = nextOf(memory);
+	}
+
+	void endPass() {
+		// Pages in the unstable table may have changed in the meantime.
+		unstableTable.destruct();
+		unstableTable.initialize(frg::hash<uint64_t>{}, *kernelAlloc);
+
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&mutex);
+
+		cursor = memories.empty() ? nullptr : memories.front();
+	}
+
+	// Scans the memory starting at its _mergeCursor.
+	// Returns true if the end of the memory is reached.
+	coroutine<bool> scanMemory(smarter::shared_ptr<CopyOnWriteMemory> memory, size_t &budget) {
+		auto numPages = memory->_length >> kPageShift;
+		while(true) {
+			size_t index;
+			PhysicalAddr physical;
+			uint64_t hash;
+			bool candidate = false;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&memory->_mutex);
+
+				while(budget && memory->_mergeCursor < numPages) {
+					auto i = memory->_mergeCursor;
+					// Skip ranges without mergeable pages quickly.
+					if(!memory->_mergeableBits[i / 64]) {
+						memory->_mergeCursor = (i / 64 + 1) * 64;
+						continue;
+					}
+					memory->_mergeCursor++;
+					if(!memory->_isMergeable(i))
+						continue;
+					budget--;
+
+					auto page = memory->_ownedPages.find(i);
+					if(!page || page->state != CopyOnWriteMemory::CowState::hasCopy
+							|| page->lockCount || page->merging)
+						continue;
+
+					// Only pages that did not change since the last scan are candidates.
+					auto pageHash = hashMergeablePage(page->physical);
+					if(pageHash != page->lastHash) {
+						page->lastHash = pageHash;
+						continue;
+					}
+
+					index = i;
+					physical = page->physical;
+					hash = pageHash;
+					candidate = true;
+					break;
+				}
+
+				if(!candidate) {
+					if(memory->_mergeCursor < numPages)
+						co_return false;
+					memory->_mergeCursor = 0;
+					co_return true;
+				}
+			}
+
+			co_await tryMerge(memory, index, physical, hash);
+		}
+	}
+
+	coroutine<void> tryMerge(smarter::shared_ptr<CopyOnWriteMemory> memory, size_t index,
+			PhysicalAddr physical, uint64_t hash) {
+		StablePage *stable = nullptr;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&mutex);
+
+			if(auto it = stableTable.get(hash); it) {
+				stable = *it;
+				stable->refCount++;
+			}
+		}
+
+		if(stable) {
+			// Comparing without locks is only a prefilter; commitMerge() verifies the contents.
+			if(samePage(stable->physical, physical)
+					&& co_await isolatePage(memory.get(), index, physical)
+					&& commitMerge(memory.get(), index, physical, stable))
+				co_return;
+			unrefStable(stable);
+			co_return;
+		}
+
+		auto entry = unstableTable->get(hash);
+		if(!entry) {
+			unstableTable->insert(hash, UnstableEntry{memory, index});
+			co_return;
+		}
+
+		auto other = entry->memory.lock();
+		if(!other || (other == memory && entry->index == index)) {
+			*entry = UnstableEntry{memory, index};
+			co_return;
+		}
+		auto otherIndex = entry->index;
+
+		// Check that the other page is still a candidate.
+		PhysicalAddr otherPhysical;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&other->_mutex);
+
+			auto page = other->_ownedPages.find(otherIndex);
+			if(!page || page->state != CopyOnWriteMemory::CowState::hasCopy
+					|| page->lockCount || page->merging
+					|| hashMergeablePage(page->physical) != hash) {
+				*entry = UnstableEntry{memory, index};
+				co_return;
+			}
+			otherPhysical = page->physical;
+		}
+
+		if(!samePage(otherPhysical, physical))
+			co_return;
+
+		// The other page becomes the stable page; we take one reference for this page.
+		unstableTable->remove(hash);
+		if(!(co_await isolatePage(other.get(), otherIndex, otherPhysical)))
+			co_return;
+		stable = commitStable(other.get(), otherIndex, otherPhysical, hash);
+		if(!stable)
+			co_return;
+
+		if(co_await isolatePage(memory.get(), index, physical)
+				&& commitMerge(memory.get(), index, physical, stable))
+			co_return;
+		unrefStable(stable);
+	}
+
+	// Unmaps the page such that its contents cannot change until the merge is committed.
+	// Each successful call must be followed by a commit, which clears the merging flag.
+	coroutine<bool> isolatePage(CopyOnWriteMemory *memory, size_t index, PhysicalAddr physical) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			auto page = memory->_ownedPages.find(index);
+			if(!page || page->state != CopyOnWriteMemory::CowState::hasCopy
+					|| page->physical != physical || page->lockCount || page->merging)
+				co_return false;
+			page->merging = true;
+		}
+
+		co_await memory->_evictQueue.evictRange(index << kPageShift, kPageSize);
+		co_return true;
+	}
+
+	// Checks that the merge was not canceled and clears the merging flag.
+	// Called with the memory's _mutex held.
+	CopyOnWriteMemory::CowPage *takeIsolated(CopyOnWriteMemory *memory, size_t index,
+			PhysicalAddr physical) {
+		auto page = memory->_ownedPages.find(index);
+		if(!page || page->physical != physical || !page->merging)
+			return nullptr;
+		page->merging = false;
+		assert(page->state == CopyOnWriteMemory::CowState::hasCopy);
+		assert(!page->lockCount);
+		return page;
+	}
+
+	// Turns the isolated page into a stable page that is referenced twice:
+	// by the memory and by the caller.
+	StablePage *commitStable(CopyOnWriteMemory *memory, size_t index,
+			PhysicalAddr physical, uint64_t hash) {
+		auto stable = frg::construct<StablePage>(*kernelAlloc,
+				StablePage{physical, hash, 2});
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			if(!takeIsolated(memory, index, physical)
+					|| hashMergeablePage(physical) != hash) {
+				frg::destruct(*kernelAlloc, stable);
+				return nullptr;
+			}
+			memory->_ownedPages.erase(index);
+			memory->_mergedPages.insert(index, stable);
+
+			auto mergerLock = frg::guard(&mutex);
+			if(!stableTable.get(hash))
+				stableTable.insert(hash, stable);
+		}
+
+		if(logMerging)
+			infoLogger() << "thor: New stable page " << (void *)physical << frg::endlog;
+		return stable;
+	}
+
+	// Replaces the isolated page by the stable page. Consumes a reference on success.
+	bool commitMerge(CopyOnWriteMemory *memory, size_t index,
+			PhysicalAddr physical, StablePage *stable) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&memory->_mutex);
+
+			if(!takeIsolated(memory, index, physical)
+					|| !samePage(physical, stable->physical))
+				return false;
+			memory->_ownedPages.erase(index);
+			memory->_mergedPages.insert(index, stable);
+		}
+
+		if(logMerging)
+			infoLogger() << "thor: Merged page " << (void *)physical
+					<< " into " << (void *)stable->physical << frg::endlog;
+		physicalAllocator->free(physical, kPageSize);
+		return true;
+	}
+
+	// Protects the following fields and the reference counts of all StablePages.
+	frg::ticket_spinlock mutex;
+
+	frg::intrusive_list<
+		CopyOnWriteMemory,
+		frg::locate_member<
+			CopyOnWriteMemory,
+			frg::default_list_hook<CopyOnWriteMemory>,
+			&CopyOnWriteMemory::_mergeHook
+		>
+	> memories;
+
+	// Next memory that is scanned. Null at the end of a pass.
+	CopyOnWriteMemory *cursor = nullptr;
+
+	frg::hash_map<
+		uint64_t,
+		StablePage *,
+		frg::hash<uint64_t>,
+		KernelAlloc
+	> stableTable;
+
+	// Raised when memories becomes non-empty.
+	async::recurring_event registerEvent;
+
+	// Only accessed by the scanner (hence, not protected by mutex).
+	frg::manual_box<UnstableTable> unstableTable;
+};
+
+namespace {
+
+frg::manual_box<PageMerger> pageMerger;
+
+initgraph::Task initPageMerging{&globalInitEngine, "generic.init-page-merging",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		pageMerger.initialize();
+		pageMerger->run();
+	}
+};
+
+} // anonymous namespace
+
+void refStablePage(StablePage *page) {
+	pageMerger->refStable(page);
+}
+
+void unrefStablePage(StablePage *page) {
+	pageMerger->unrefStable(page);
+}
+
+uint64_t hashMergeablePage(PhysicalAddr physical) {
+	PageAccessor accessor{physical};
+	auto words = reinterpret_cast<const uint64_t *>(accessor.get());
+
+	// FNV-1a over 64-bit words; this is faster than hashing individual bytes.
+	uint64_t hash = 0xcbf29ce484222325;
+	for(size_t i = 0; i < kPageSize / sizeof(uint64_t); i++) {
+		hash ^= words[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+void registerMergeableMemory(CopyOnWriteMemory *memory) {
+	pageMerger->registerMemory(memory);
+}
+
+void unregisterMergeableMemory(CopyOnWriteMemory *memory) {
+	pageMerger->unregisterMemory(memory);
+}
+
+} // namespace thor
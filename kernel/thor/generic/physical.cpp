@@ -1,13 +1,46 @@
 #include <assert.h>
+#include <string.h>
 #include <thor-internal/arch/paging.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/main.hpp>
 #include <thor-internal/physical.hpp>
+#include <thor-internal/timer.hpp>
 
 namespace thor {
 
 static bool logPhysicalAllocs = false;
 
+namespace {
+	// The pre-zeroed pools are not refilled if fewer pages are free (64 MiB).
+	constexpr size_t minFreePagesForZeroing = 16384;
+
+	// Number of pages that the zeroing fiber produces before it blocks.
+	// Fibers are not preempted; this bounds the latency that zeroing adds.
+	constexpr int zeroingBatch = 16;
+
+	initgraph::Task initZeroingFiber{&globalInitEngine, "generic.init-zeroing-fiber",
+		initgraph::Requires{getFibersAvailableStage()},
+		[] {
+			KernelFiber::run([] {
+				// Only zero pages if the CPU would otherwise be idle.
+				Scheduler::setPriority(thisFiber(), -1);
+
+				while(true) {
+					int n = 0;
+					while(n < zeroingBatch && physicalAllocator->produceZeroedPage())
+						n++;
+
+					// Back off for longer if the pool is full.
+					uint64_t nanos = (n == zeroingBatch) ? 1'000'000 : 100'000'000;
+					KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(nanos));
+				}
+			});
+		}
+	};
+}
+
 // --------------------------------------------------------
 // SkeletalRegion
 // --------------------------------------------------------
@@ -32,6 +65,10 @@ void *SkeletalRegion::access(PhysicalAddr physical) {
 // --------------------------------------------------------
 
 PhysicalChunkAllocator::PhysicalChunkAllocator() {
+	// Defaults from the ACPI specification for systems without a SLIT.
+	for(int i = 0; i < maxNodes; i++)
+		for(int j = 0; j < maxNodes; j++)
+			_nodeDistances[i][j] = (i == j) ? 10 : 20;
 }
 
 void PhysicalChunkAllocator::bootstrapRegion(PhysicalAddr address,
@@ -54,15 +91,90 @@ void PhysicalChunkAllocator::bootstrapRegion(PhysicalAddr address,
 	_freePages.store(currentFree + (numRoots << order), std::memory_order_relaxed);
 }
 
-PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
+void PhysicalChunkAllocator::setRegionNode(PhysicalAddr address, size_t length, int node) {
+	assert(node >= 0 && node < maxNodes);
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
 
-	auto currentFree = _freePages.load(std::memory_order_relaxed);
-	auto currentUsed = _usedPages.load(std::memory_order_relaxed);
-	assert(currentFree > size / kPageSize);
-	_freePages.store(currentFree - size / kPageSize, std::memory_order_relaxed);
-	_usedPages.store(currentUsed + size / kPageSize, std::memory_order_relaxed);
+	// Buddy regions cannot be split. Regions that straddle a node boundary
+	// go to the node that owns most of their memory.
+	for(int i = 0; i < _numRegions; i++) {
+		auto region = &_allRegions[i];
+		auto begin = frg::max(region->physicalBase, address);
+		auto end = frg::min(region->physicalBase + region->regionSize, address + length);
+		if(begin >= end)
+			continue;
+		region->nodeCoverage[node] += end - begin;
+
+		for(int j = 0; j < maxNodes; j++) {
+			if(region->nodeCoverage[j] > region->nodeCoverage[region->node])
+				region->node = j;
+		}
+		if(region->nodeCoverage[node] != region->regionSize)
+			infoLogger() << "thor: Memory region at 0x" << frg::hex_fmt(region->physicalBase)
+					<< " is only partially covered by NUMA node " << node
+					<< ", assigning it to node " << region->node << frg::endlog;
+	}
+}
+
+void PhysicalChunkAllocator::setNodeDistance(int from, int to, int distance) {
+	assert(from >= 0 && from < maxNodes);
+	assert(to >= 0 && to < maxNodes);
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_nodeDistances[from][to] = distance;
+}
+
+PhysicalAddr PhysicalChunkAllocator::_allocateFromRegions(int target, int addressBits, int node) {
+	// Try the regions of the preferred node first, then fall back to the other nodes
+	// in the order of increasing distance.
+	bool tried[maxNodes] = {};
+	int current = node;
+	while(current >= 0) {
+		tried[current] = true;
+		for(int i = 0; i < _numRegions; i++) {
+			if(_allRegions[i].node != current)
+				continue;
+			if(target > _allRegions[i].buddyAccessor.tableOrder())
+				continue;
+
+			auto physical = _allRegions[i].buddyAccessor.allocate(target, addressBits);
+			if(physical == BuddyAccessor::illegalAddress)
+				continue;
+			assert(!(physical % (size_t(kPageSize) << target)));
+			return physical;
+		}
+
+		current = -1;
+		for(int i = 0; i < maxNodes; i++) {
+			if(tried[i])
+				continue;
+			if(current < 0 || _nodeDistances[node][i] < _nodeDistances[node][current])
+				current = i;
+		}
+	}
+
+	return static_cast<PhysicalAddr>(-1);
+}
+
+auto PhysicalChunkAllocator::_findRegion(PhysicalAddr address, size_t size) -> Region * {
+	for(int i = 0; i < _numRegions; i++) {
+		if(address < _allRegions[i].physicalBase)
+			continue;
+		if(address + size - _allRegions[i].physicalBase > _allRegions[i].regionSize)
+			continue;
+		return &_allRegions[i];
+	}
+	return nullptr;
+}
+
+PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits, int node) {
+	assert(node >= -1 && node < maxNodes);
+	auto irq_lock = frg::guard(&irqMutex());
+	auto cpuData = getCpuData();
+	if(node < 0)
+		node = cpuData->numaNode;
 
 	// TODO: This could be solved better.
 	int target = 0;
@@ -73,45 +185,163 @@ PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
 	if(logPhysicalAllocs)
 		infoLogger() << "thor: Allocating physical memory of order "
 					<< (target + kPageShift) << frg::endlog;
-	for(int i = 0; i < _numRegions; i++) {
-		if(target > _allRegions[i].buddyAccessor.tableOrder())
-			continue;
 
-		auto physical = _allRegions[i].buddyAccessor.allocate(target, addressBits);
-		if(physical == BuddyAccessor::illegalAddress)
-			continue;
+	// Serve single pages from the per-CPU cache. Since cached pages can reside anywhere,
+	// allocations with address restrictions always go to the buddy allocator.
+	// The same applies to allocations that prefer a remote node.
+	PhysicalAddr physical;
+	auto cache = &cpuData->pageCache;
+	if(!target && addressBits == 64 && node == cpuData->numaNode) {
+		if(!cache->numPages) {
+			auto lock = frg::guard(&_mutex);
+			while(cache->numPages < PhysicalCpuCache::batch) {
+				auto page = _allocateFromRegions(0, 64, node);
+				if(page == static_cast<PhysicalAddr>(-1))
+					break;
+				cache->pages[cache->numPages++] = page;
+			}
+		}
+
+		if(!cache->numPages) {
+			// As a last resort, take back pages from the pre-zeroed pools.
+			// These pages are already accounted as used.
+			auto lock = frg::guard(&_mutex);
+			return _takeZeroedPage(node);
+		}
+		physical = cache->pages[--cache->numPages];
+	}else{
+		auto lock = frg::guard(&_mutex);
+		physical = _allocateFromRegions(target, addressBits, node);
+		if(physical == static_cast<PhysicalAddr>(-1))
+			return physical;
+	}
 	//	infoLogger() << "Allocate " << (void *)physical << frg::endlog;
-		assert(!(physical % (size_t(kPageSize) << target)));
+
+	[[maybe_unused]] auto previousFree = _freePages.fetch_sub(size / kPageSize,
+			std::memory_order_relaxed);
+	assert(previousFree >= size / kPageSize);
+	_usedPages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+	return physical;
+}
+
+PhysicalAddr PhysicalChunkAllocator::_takeZeroedPage(int node) {
+	auto pool = &_zeroedPools[node];
+	if(!pool->numPages) {
+		pool = nullptr;
+		for(int i = 0; i < maxNodes; i++) {
+			if(_zeroedPools[i].numPages) {
+				pool = &_zeroedPools[i];
+				break;
+			}
+		}
+		if(!pool)
+			return static_cast<PhysicalAddr>(-1);
+	}
+
+	auto physical = pool->head;
+	PageAccessor accessor{physical};
+	auto link = reinterpret_cast<PhysicalAddr *>(accessor.get());
+	pool->head = *link;
+	pool->numPages--;
+	*link = 0;
+	return physical;
+}
+
+PhysicalAddr PhysicalChunkAllocator::allocateZeroed(int node) {
+	assert(node >= -1 && node < maxNodes);
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		auto physical = _takeZeroedPage(node < 0 ? getCpuData()->numaNode : node);
+		if(physical != static_cast<PhysicalAddr>(-1))
+			return physical;
+	}
+
+	auto physical = allocate(kPageSize, 64, node);
+	if(physical == static_cast<PhysicalAddr>(-1))
 		return physical;
+	PageAccessor accessor{physical};
+	zeroPage(accessor.get());
+	return physical;
+}
+
+bool PhysicalChunkAllocator::produceZeroedPage() {
+	if(numFreePages() < minFreePagesForZeroing)
+		return false;
+
+	int node;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		node = getCpuData()->numaNode;
+		if(_zeroedPools[node].numPages >= maxZeroedPages)
+			return false;
 	}
 
-	return static_cast<PhysicalAddr>(-1);
+	auto physical = allocate(kPageSize);
+	if(physical == static_cast<PhysicalAddr>(-1))
+		return false;
+	PageAccessor accessor{physical};
+	zeroPage(accessor.get());
+
+	// The page may belong to a remote node if the local node ran out of memory.
+	auto region = _findRegion(physical, kPageSize);
+	assert(region);
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto pool = &_zeroedPools[region->node];
+	*reinterpret_cast<PhysicalAddr *>(accessor.get()) = pool->head;
+	pool->head = physical;
+	pool->numPages++;
+	return true;
 }
 
 void PhysicalChunkAllocator::free(PhysicalAddr address, size_t size) {
 	auto irq_lock = frg::guard(&irqMutex());
-	auto lock = frg::guard(&_mutex);
+	auto cpuData = getCpuData();
 	
 	int target = 0;
 	while(size > (size_t(kPageSize) << target))
 		target++;
 
-	for(int i = 0; i < _numRegions; i++) {
-		if(address < _allRegions[i].physicalBase)
-			continue;
-		if(address + size - _allRegions[i].physicalBase > _allRegions[i].regionSize)
-			continue;
+	// Regions are never added or removed after boot, hence we can look them up without locking.
+	auto region = _findRegion(address, size);
+	if(!region) {
+		assert(!"Physical page is not part of any region");
+		return;
+	}
 
-		_allRegions[i].buddyAccessor.free(address, target);
-		auto currentFree = _freePages.load(std::memory_order_relaxed);
-		auto currentUsed = _usedPages.load(std::memory_order_relaxed);
-		assert(currentUsed > size / kPageSize);
-		_freePages.store(currentFree + size / kPageSize, std::memory_order_relaxed);
-		_usedPages.store(currentUsed - size / kPageSize, std::memory_order_relaxed);
+	[[maybe_unused]] auto previousUsed = _usedPages.fetch_sub(size / kPageSize,
+			std::memory_order_relaxed);
+	assert(previousUsed >= size / kPageSize);
+	_freePages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+
+	// Only cache pages of the local node; remote pages are returned to their region.
+	auto cache = &cpuData->pageCache;
+	if(!target && region->node == cpuData->numaNode) {
+		if(cache->numPages == PhysicalCpuCache::capacity) {
+			// Drain the oldest pages (i.e., the least recently freed ones) in one batch.
+			auto lock = frg::guard(&_mutex);
+			for(int i = 0; i < PhysicalCpuCache::batch; i++) {
+				auto page = cache->pages[i];
+				auto pageRegion = _findRegion(page, kPageSize);
+				assert(pageRegion);
+				pageRegion->buddyAccessor.free(page, 0);
+			}
+			memmove(cache->pages, cache->pages + PhysicalCpuCache::batch,
+					(cache->numPages - PhysicalCpuCache::batch) * sizeof(PhysicalAddr));
+			cache->numPages -= PhysicalCpuCache::batch;
+		}
+		cache->pages[cache->numPages++] = address;
 		return;
 	}
 
-	assert(!"Physical page is not part of any region");
+	auto lock = frg::guard(&_mutex);
+	region->buddyAccessor.free(address, target);
 }
 
 } // namespace thor
@@ -14,6 +14,10 @@ bool wantKernelProfile = false;
 
 namespace {
 	frg::manual_box<LogRingBuffer> globalProfileRing;
+#ifdef __x86_64__
+	// Set once the global ring exists and the hardware supports profiling.
+	bool profileActive = false;
+#endif
 
 	initgraph::Task initProfilingSinks{&globalInitEngine, "generic.init-profiling-sinks",
 		initgraph::Requires{getFibersAvailableStage(),
@@ -46,36 +50,48 @@ void initializeProfile() {
 
 	void *profileMemory = kernelAlloc->allocate(1 << 20);
 	globalProfileRing.initialize(reinterpret_cast<uintptr_t>(profileMemory), 1 << 20);
+	profileActive = true;
+
+	initializeProfileOnThisCpu();
+#endif
+}
+
+void initializeProfileOnThisCpu() {
+#ifdef __x86_64__
+	if(!profileActive)
+		return;
 
 	// Dump the per-CPU profiling data to the global ring buffer.
-	// TODO: Start one such fiber per CPU.
+	// Note that this fiber is not necessarily pinned to its CPU; it only
+	// needs to run there to program the PMC.
 	KernelFiber::run([=] {
-		getCpuData()->localProfileRing = frg::construct<SingleContextRecordRing>(*kernelAlloc);
+		auto cpuData = getCpuData();
+		cpuData->localProfileRing = frg::construct<SingleContextRecordRing>(*kernelAlloc);
 
 		if(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileIntelSupported) {
 			initializeIntelPmc();
-			getCpuData()->profileMechanism.store(ProfileMechanism::intelPmc,
+			cpuData->profileMechanism.store(ProfileMechanism::intelPmc,
 					std::memory_order_release);
 			setIntelPmc();
 		}else{
 			assert(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileAmdSupported);
-			getCpuData()->profileMechanism.store(ProfileMechanism::amdPmc,
+			cpuData->profileMechanism.store(ProfileMechanism::amdPmc,
 					std::memory_order_release);
 			setAmdPmc();
 		}
 
 		uint64_t deqPtr = 0;
 		while(true) {
-			char buffer[128];
-			auto [success, recordPtr, newPtr, size] = getCpuData()->localProfileRing->dequeueAt(
-					deqPtr, buffer, 128);
+			uintptr_t buffer[maxProfileRecordWords];
+			auto [success, recordPtr, newPtr, size] = cpuData->localProfileRing->dequeueAt(
+					deqPtr, buffer, sizeof(buffer));
 			deqPtr = newPtr;
 			if(!success) {
 				KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(1'000'000));
 				continue;
 			}
 			assert(size);
-			assert(size < 128);
+			assert(size <= sizeof(buffer));
 
 			globalProfileRing->enqueue(buffer, size);
 		}
@@ -4,6 +4,7 @@
 #include <cralgo/aes.hpp>
 #include <cralgo/sha2_32.hpp>
 #include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/random.hpp>
 #include <thor-internal/debug.hpp>
@@ -189,6 +190,112 @@ private:
 
 frg::manual_box<Fortuna> csprng;
 
+// Whether getEntropyFromCpu() works. Determined once since checking for support
+// can be expensive (e.g., CPUID traps in VMs).
+bool haveCpuEntropy = false;
+
+// Per-CPU pools are rekeyed from the global CSPRNG after this many bytes.
+constexpr size_t cpuPoolReseedInterval = size_t{1} << 20;
+
+uint32_t rotl32(uint32_t v, int n) {
+	return (v << n) | (v >> (32 - n));
+}
+
+void chachaQuarterRound(uint32_t *x, int a, int b, int c, int d) {
+	x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 16);
+	x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 12);
+	x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 8);
+	x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 7);
+}
+
+// Computes a single ChaCha20 block (RFC 8439, with a 64-bit counter and zero nonce).
+void chachaBlock(const uint32_t *key, uint64_t counter, uint8_t *out) {
+	uint32_t input[16] = {
+		0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+		key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+		static_cast<uint32_t>(counter), static_cast<uint32_t>(counter >> 32), 0, 0
+	};
+
+	uint32_t x[16];
+	memcpy(x, input, sizeof(x));
+	for(int i = 0; i < 10; ++i) {
+		chachaQuarterRound(x, 0, 4, 8, 12);
+		chachaQuarterRound(x, 1, 5, 9, 13);
+		chachaQuarterRound(x, 2, 6, 10, 14);
+		chachaQuarterRound(x, 3, 7, 11, 15);
+		chachaQuarterRound(x, 0, 5, 10, 15);
+		chachaQuarterRound(x, 1, 6, 11, 12);
+		chachaQuarterRound(x, 2, 7, 8, 13);
+		chachaQuarterRound(x, 3, 4, 9, 14);
+	}
+
+	for(int i = 0; i < 16; ++i) {
+		uint32_t word = x[i] + input[i];
+		out[4 * i + 0] = word;
+		out[4 * i + 1] = word >> 8;
+		out[4 * i + 2] = word >> 16;
+		out[4 * i + 3] = word >> 24;
+	}
+}
+
+void reseedCpuPool(RandomCpuPool *pool) {
+	uint8_t seed[32];
+	size_t progress = 0;
+	while(progress < sizeof(seed))
+		progress += csprng->generate(seed + progress, sizeof(seed) - progress);
+
+	// Mix in fresh hardware entropy so that a compromise of the global generator's
+	// state does not directly reveal the per-CPU keys.
+	if(haveCpuEntropy) {
+		uint8_t hw[32];
+		if(getEntropyFromCpu(hw, sizeof(hw)) == Error::success) {
+			for(size_t i = 0; i < sizeof(seed); ++i)
+				seed[i] ^= hw[i];
+		}
+	}
+
+	memcpy(pool->key, seed, sizeof(pool->key));
+	pool->counter = 0;
+	pool->available = 0;
+	pool->sinceReseed = 0;
+	pool->seeded = true;
+}
+
+size_t generateFromCpuPool(RandomCpuPool *pool, void *buffer, size_t size) {
+	if(!pool->seeded || pool->sinceReseed >= cpuPoolReseedInterval)
+		reseedCpuPool(pool);
+
+	// Same limit as Fortuna::generate(); callers loop anyway.
+	size = std::min(size, size_t{1} << 20);
+
+	auto p = reinterpret_cast<uint8_t *>(buffer);
+	size_t progress = 0;
+	while(progress < size) {
+		if(!pool->available) {
+			chachaBlock(pool->key, pool->counter++, pool->block);
+			pool->available = sizeof(pool->block);
+		}
+		size_t chunk = std::min(size - progress, pool->available);
+		auto offset = sizeof(pool->block) - pool->available;
+		memcpy(p + progress, pool->block + offset, chunk);
+		// Erase consumed output such that it cannot be recovered later.
+		memset(pool->block + offset, 0, chunk);
+		pool->available -= chunk;
+		progress += chunk;
+	}
+
+	// Fast key erasure: replace the key by fresh output such that
+	// previously returned bytes cannot be reconstructed from the pool state.
+	uint8_t next[64];
+	chachaBlock(pool->key, pool->counter++, next);
+	memcpy(pool->key, next, sizeof(pool->key));
+	memset(next, 0, sizeof(next));
+	pool->counter = 0;
+
+	pool->sinceReseed += progress;
+	return progress;
+}
+
 } // anonymous namespace
 
 void initializeRandom() {
@@ -196,6 +303,7 @@ void initializeRandom() {
 
 	uint8_t seed[32]; // 256 bits of entropy should be enough.
 	if(auto e = getEntropyFromCpu(seed, 32); e == Error::success) {
+		haveCpuEntropy = true;
 		csprng->forceReseed(seed, 32);
 		return;
 	}else if(e == Error::noHardwareSupport) {
@@ -217,7 +325,8 @@ void injectEntropy(unsigned int entropySource, unsigned int seqNum, void *buffer
 }
 
 size_t generateRandomBytes(void *buffer, size_t size) {
-	return csprng->generate(buffer, size);
+	StatelessIrqLock irqLock;
+	return generateFromCpuPool(&getCpuData()->randomPool, buffer, size);
 }
 
 } // namespace thor
@@ -4,6 +4,7 @@
 #include <thor-internal/arch/cpu.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/ostrace.hpp>
 #include <thor-internal/schedule.hpp>
 #include <thor-internal/timer.hpp>
 
@@ -15,11 +16,39 @@ namespace {
 	constexpr bool logUpdates = false;
 	constexpr bool logIdle = false;
 
+	constexpr bool logBalancing = false;
+
 	constexpr bool disablePreemption = false;
+	constexpr bool disableBalancing = false;
 
 	// Minimum length of a preemption time slice in ns.
 	constexpr int64_t sliceGranularity = 10'000'000;
 
+	// Minimum time between two runs of the balancer on a busy CPU (unless requested by an
+	// idle CPU).
+	constexpr uint64_t balanceInterval = sliceGranularity;
+
+	// Maximal number of waiting entities that the balancer inspects to find
+	// an entity that can be migrated.
+	constexpr int balanceScanDepth = 4;
+
+	OsTraceEventId osTraceMigrateEvent;
+	OsTraceItemId osTraceFromCpuItem;
+	OsTraceItemId osTraceToCpuItem;
+	bool osTraceAnnounced = false;
+
+	initgraph::Task initSchedulerOsTrace{&globalInitEngine, "generic.init-scheduler-ostrace",
+		initgraph::Requires{getOsTraceAvailableStage()},
+		[] {
+			if(!wantOsTrace)
+				return;
+			osTraceMigrateEvent = announceOsTraceEvent("thor.sched-migrate");
+			osTraceFromCpuItem = announceOsTraceItem("from-cpu");
+			osTraceToCpuItem = announceOsTraceItem("to-cpu");
+			osTraceAnnounced = true;
+		}
+	};
+
 	struct IdleTask final : ScheduleEntity {
 		IdleTask()
 		: ScheduleEntity{ScheduleType::idle} { }
@@ -50,33 +79,127 @@ namespace {
 	frg::eternal<IdleTask> globalIdleTask;
 }
 
+namespace {
+	int policyRank(SchedulePolicy policy) {
+		switch(policy) {
+		case SchedulePolicy::fair:
+			return 0;
+		case SchedulePolicy::fifo:
+		case SchedulePolicy::roundRobin:
+			return 1;
+		case SchedulePolicy::deadline:
+			return 2;
+		}
+		__builtin_unreachable();
+	}
+}
+
 int ScheduleEntity::orderPriority(const ScheduleEntity *a, const ScheduleEntity *b) {
 	assert(a->type() == ScheduleType::regular);
 	assert(b->type() == ScheduleType::regular);
+	if(auto ra = policyRank(a->_policy), rb = policyRank(b->_policy); ra != rb)
+		return rb - ra; // Prefer higher scheduling classes.
+
+	if(a->_policy == SchedulePolicy::deadline) {
+		// Prefer earlier deadlines.
+		if(a->_dlAbsoluteDeadline < b->_dlAbsoluteDeadline)
+			return -1;
+		if(a->_dlAbsoluteDeadline > b->_dlAbsoluteDeadline)
+			return 1;
+		return 0;
+	}
 	return b->priority - a->priority; // Prefer larger priority.
 }
 
 bool ScheduleEntity::scheduleBefore(const ScheduleEntity *a, const ScheduleEntity *b) {
 	assert(a->type() == ScheduleType::regular);
 	assert(b->type() == ScheduleType::regular);
+	// Real-time entities with the same priority (or deadline) run in FIFO order.
+	if(a->_policy != SchedulePolicy::fair)
+		return a->_queueSequence < b->_queueSequence;
 	return a->baseUnfairness - a->refProgress
 			> b->baseUnfairness - b->refProgress; // Prefer greater unfairness.
 }
 
 ScheduleEntity::ScheduleEntity(ScheduleType type)
-: type_{type}, state{ScheduleState::null}, priority{0}, _refClock{0}, _runTime{0},
-		refProgress{0}, baseUnfairness{0} { }
+: type_{type}, state{ScheduleState::null}, _policy{SchedulePolicy::fair}, priority{0},
+		_dlRuntime{0}, _dlDeadline{0}, _dlPeriod{0}, _dlAbsoluteDeadline{0}, _dlBudget{0},
+		_queueSequence{0}, _parametersChanged{false},
+		_refClock{0}, _runTime{0}, refProgress{0}, baseUnfairness{0} { }
 
 ScheduleEntity::~ScheduleEntity() {
 	assert(state == ScheduleState::null);
 }
 
+bool ScheduleEntity::isMigratableTo(CpuData *) {
+	return false;
+}
+
+SchedulingParameters ScheduleEntity::effectiveParameters() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_associationMutex);
+
+	if(_inheritedParameters
+			&& Scheduler::schedulingPrecedes(*_inheritedParameters, _requestedParameters))
+		return *_inheritedParameters;
+	return _requestedParameters;
+}
+
+Scheduler *Scheduler::choosePlacement(CpuData *creator) {
+	// Rotate the start of the search to distribute entities among equally good CPUs.
+	// Adding a large prime (coprime to getCpuCount()) should yield a good distribution.
+	static std::atomic<unsigned int> rotation{0};
+
+	auto n = getCpuCount();
+	auto start = rotation.fetch_add(4099, std::memory_order_relaxed) % n;
+
+	auto loadOf = [] (CpuData *cpu) -> size_t {
+		auto other = &cpu->scheduler;
+		auto load = other->_publishedLoad.load(std::memory_order_relaxed);
+		if(!other->_isIdle.load(std::memory_order_relaxed))
+			load++;
+		return load;
+	};
+
+	Scheduler *best = nullptr;
+	size_t bestScore = 0;
+	for(size_t i = 0; i < n; i++) {
+		auto cpu = getCpuData((start + i) % n);
+		auto score = loadOf(cpu) * 4;
+		if(!sharesLlc(cpu->topology, creator->topology))
+			score += 1;
+		if(best && score >= bestScore)
+			continue;
+
+		for(size_t j = 0; j < n; j++) {
+			auto sibling = getCpuData(j);
+			if(sibling == cpu || !sharesCore(sibling->topology, cpu->topology))
+				continue;
+			if(loadOf(sibling)) {
+				score += 2;
+				break;
+			}
+		}
+		if(best && score >= bestScore)
+			continue;
+
+		best = &cpu->scheduler;
+		bestScore = score;
+	}
+	assert(best);
+	return best;
+}
+
 void Scheduler::associate(ScheduleEntity *entity, Scheduler *scheduler) {
 	assert(entity->type() == ScheduleType::regular);
 
 //	infoLogger() << "associate " << entity << frg::endlog;
 	assert(entity->state == ScheduleState::null);
-	entity->_scheduler = scheduler;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&entity->_associationMutex);
+		entity->_scheduler = scheduler;
+	}
 	entity->state = ScheduleState::attached;
 }
 
@@ -91,7 +214,14 @@ void Scheduler::unassociate(ScheduleEntity *entity) {
 
 	assert(entity->state == ScheduleState::attached);
 	assert(entity != self->_current);
-	entity->_scheduler = nullptr;
+	{
+		auto lock = frg::guard(&entity->_associationMutex);
+		entity->_scheduler = nullptr;
+
+		auto boostLock = frg::guard(&self->_mutex);
+		if(entity->boostHook.in_list)
+			self->_boostList.erase(self->_boostList.iterator_to(entity));
+	}
 	entity->state = ScheduleState::null;
 }
 
@@ -106,7 +236,68 @@ void Scheduler::setPriority(ScheduleEntity *entity, int priority) {
 	// Otherwise, we would have to remove-reinsert into the queue.
 	assert(entity == self->_current);
 
-	entity->priority = priority;
+	auto lock = frg::guard(&entity->_associationMutex);
+	entity->_requestedParameters.priority = priority;
+	if(!entity->_inheritedParameters
+			|| !schedulingPrecedes(*entity->_inheritedParameters, entity->_requestedParameters))
+		entity->priority = priority;
+}
+
+void Scheduler::setScheduling(ScheduleEntity *entity, const SchedulingParameters &parameters) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto irqLock = frg::guard(&irqMutex());
+
+	auto self = localScheduler();
+	{
+		auto lock = frg::guard(&entity->_associationMutex);
+		entity->_requestedParameters = parameters;
+		entity->_parametersChanged.store(true, std::memory_order_release);
+	}
+
+	if(entity->_scheduler == self && entity == self->_current) {
+		self->_updateEntityStats(entity);
+		self->_applyRequestedParameters(entity);
+		// Re-evaluate preemption with the new parameters.
+		sendPingIpi(self->_cpuContext->cpuIndex);
+	}
+}
+
+void Scheduler::setInheritedScheduling(ScheduleEntity *entity,
+		frg::optional<SchedulingParameters> parameters) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto irqLock = frg::guard(&irqMutex());
+
+	auto self = localScheduler();
+	auto lock = frg::guard(&entity->_associationMutex);
+	entity->_inheritedParameters = parameters;
+	entity->_parametersChanged.store(true, std::memory_order_release);
+
+	auto scheduler = entity->_scheduler;
+	if(!scheduler)
+		return;
+
+	if(scheduler == self && entity == self->_current) {
+		lock.unlock();
+		self->_updateEntityStats(entity);
+		self->_applyRequestedParameters(entity);
+	}else{
+		// Let the owning CPU re-sort the entity in its wait queue.
+		auto boostLock = frg::guard(&scheduler->_mutex);
+		if(!entity->boostHook.in_list)
+			scheduler->_boostList.push_back(entity);
+	}
+	sendPingIpi(scheduler->_cpuContext->cpuIndex);
+}
+
+bool Scheduler::schedulingPrecedes(const SchedulingParameters &a,
+		const SchedulingParameters &b) {
+	if(auto ra = policyRank(a.policy), rb = policyRank(b.policy); ra != rb)
+		return ra > rb;
+	if(a.policy == SchedulePolicy::deadline)
+		return a.deadline < b.deadline;
+	return a.priority > b.priority;
 }
 
 void Scheduler::resume(ScheduleEntity *entity) {
@@ -127,6 +318,10 @@ void Scheduler::resume(ScheduleEntity *entity) {
 
 		wasEmpty = self->_pendingList.empty();
 		self->_pendingList.push_back(entity);
+
+		if(self == localScheduler() && self->_handoffArmed
+				&& self->_current == self->_handoffDonor && !self->_handoffTarget)
+			self->_handoffTarget = entity;
 	}
 
 	if(wasEmpty) {
@@ -151,9 +346,39 @@ void Scheduler::suspendCurrent() {
 	self->_updateEntityStats(entity);
 	entity->state = ScheduleState::attached;
 
+	// Only keep the handoff target if the donor blocks; _schedule() picks it up.
+	if(self->_handoffDonor != entity)
+		self->_handoffTarget = nullptr;
+	self->_handoffArmed = false;
+	self->_handoffDonor = nullptr;
+
 	self->_current = nullptr;
 }
 
+void Scheduler::armHandoff() {
+	auto irqLock = frg::guard(&irqMutex());
+
+	auto self = localScheduler();
+	if(self->_current->type() != ScheduleType::regular)
+		return;
+	self->_handoffArmed = true;
+	self->_handoffDonor = self->_current;
+	self->_handoffTarget = nullptr;
+}
+
+void Scheduler::disarmHandoff() {
+	auto irqLock = frg::guard(&irqMutex());
+
+	// The donor may have been migrated in the meantime; in this case,
+	// the handoff state was already reset by _unschedule().
+	// Otherwise, drop the target as well: a donor that blocks later (e.g., after
+	// returning to user space) must not boost an entity that it resumed long ago.
+	auto self = localScheduler();
+	self->_handoffArmed = false;
+	self->_handoffDonor = nullptr;
+	self->_handoffTarget = nullptr;
+}
+
 Scheduler::Scheduler(CpuData *cpuContext)
 : _cpuContext{cpuContext}, _current{&globalIdleTask.get()} { }
 
@@ -212,11 +437,33 @@ void Scheduler::update() {
 			&ScheduleEntity::listHook
 		>
 	> pendingSnapshot;
+	frg::intrusive_list<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::default_list_hook<ScheduleEntity>,
+			&ScheduleEntity::boostHook
+		>
+	> boostSnapshot;
 	{
 		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&_mutex);
 
 		pendingSnapshot.splice(pendingSnapshot.end(), _pendingList);
+		boostSnapshot.splice(boostSnapshot.end(), _boostList);
+	}
+	while(!boostSnapshot.empty()) {
+		auto entity = boostSnapshot.pop_front();
+
+		// Entities that are not waiting pick up their parameters when they are enqueued.
+		if(entity == _current) {
+			_updateEntityStats(entity);
+			_applyRequestedParameters(entity);
+		}else if(entity->state == ScheduleState::active) {
+			_waitQueue.remove(entity);
+			_applyRequestedParameters(entity);
+			_waitQueue.push(entity);
+		}
 	}
 	while(!pendingSnapshot.empty()) {
 		auto entity = pendingSnapshot.pop_front();
@@ -227,9 +474,23 @@ void Scheduler::update() {
 		entity->_refClock = _refClock;
 		entity->state = ScheduleState::active;
 
+		_applyRequestedParameters(entity);
+		if(entity->_policy == SchedulePolicy::deadline)
+			_replenishOnWakeup(entity);
+
+		entity->_queueSequence = _nextQueueSequence++;
 		_waitQueue.push(entity);
 		_numWaiting++;
 	}
+	_publishedLoad.store(_numWaiting, std::memory_order_relaxed);
+
+	if(!disableBalancing && _numWaiting) {
+		bool requested = _balanceRequested.exchange(false, std::memory_order_relaxed);
+		if(requested || _refClock - _balanceClock >= balanceInterval) {
+			_balanceClock = _refClock;
+			_balance();
+		}
+	}
 }
 
 bool Scheduler::maybeReschedule() {
@@ -254,6 +515,18 @@ bool Scheduler::maybeReschedule() {
 			return false;
 		}
 
+		// Real-time entities are only preempted by entities of the same priority
+		// at the end of a round-robin time slice.
+		switch(_current->_policy) {
+		case SchedulePolicy::fifo:
+		case SchedulePolicy::deadline:
+			return false;
+		case SchedulePolicy::roundRobin:
+			return _refClock - _sliceClock >= static_cast<uint64_t>(sliceGranularity);
+		case SchedulePolicy::fair:
+			break;
+		}
+
 		// Switch based on unfairness.
 		auto diff = _liveUnfairness(_current) + sliceGranularity * 256
 				- _liveUnfairness(_waitQueue.top());
@@ -284,14 +557,18 @@ void Scheduler::forceReschedule() {
 	_scheduled = nullptr;
 	_sliceClock = _refClock;
 
-	if(!preemptionIsArmed())
+	// Keep a running time slice but stop the tick once there is nothing left to preempt to.
+	// Deadline entities always need a timer for the end of their budget.
+	if(!preemptionIsArmed() || _waitQueue.empty()
+			|| (_current->type() == ScheduleType::regular
+				&& _current->_policy == SchedulePolicy::deadline))
 		_updatePreemption();
 
 	currentRunnable()->invoke();
 }
 
 void Scheduler::renewSchedule() {
-	if(!preemptionIsArmed())
+	if(!preemptionIsArmed() || _waitQueue.empty())
 		_updatePreemption();
 }
 
@@ -306,8 +583,17 @@ void Scheduler::_unschedule() {
 	// Decrease the unfairness at the end of the time slice.
 	_updateEntityStats(_current);
 
+	// Handoff only applies if the donor blocks, not if it is preempted.
+	_handoffArmed = false;
+	_handoffDonor = nullptr;
+	_handoffTarget = nullptr;
+
 	if(_current->type() == ScheduleType::regular
 			|| _current->state == ScheduleState::active) {
+		_applyRequestedParameters(_current);
+		// Preempted FIFO entities stay at the head of their priority.
+		if(_current->_policy != SchedulePolicy::fifo)
+			_current->_queueSequence = _nextQueueSequence++;
 		_waitQueue.push(_current);
 		_numWaiting++;
 	}
@@ -323,12 +609,29 @@ void Scheduler::_schedule() {
 		if(logScheduling)
 			infoLogger() << "No entities to schedule" << frg::endlog;
 		_scheduled = &globalIdleTask.get();
+		_publishedLoad.store(0, std::memory_order_relaxed);
+		if(!_isIdle.exchange(true, std::memory_order_relaxed))
+			_requestBalance();
 		return;
 	}
 
-	auto entity = _waitQueue.top();
-	_waitQueue.pop();
+	// Prefer the handoff target, unless an entity with higher priority is waiting.
+	ScheduleEntity *entity = nullptr;
+	if(auto target = _handoffTarget; target) {
+		_handoffTarget = nullptr;
+		if(target->_scheduler == this && target->state == ScheduleState::active
+				&& ScheduleEntity::orderPriority(target, _waitQueue.top()) <= 0) {
+			_waitQueue.remove(target);
+			entity = target;
+		}
+	}
+	if(!entity) {
+		entity = _waitQueue.top();
+		_waitQueue.pop();
+	}
 	_numWaiting--;
+	_publishedLoad.store(_numWaiting, std::memory_order_relaxed);
+	_isIdle.store(false, std::memory_order_relaxed);
 
 	// Increase the unfairness at the start of the time slice.
 	assert(entity->state == ScheduleState::active);
@@ -352,28 +655,154 @@ void Scheduler::_schedule() {
 	_scheduled = entity;
 }
 
-// Returns true if preemption should be done immediately.
+void Scheduler::_balance() {
+	assert(!intsAreEnabled());
+
+	// Find an idle CPU. Start the search at our successor to spread the load.
+	// Prefer CPUs that share our LLC such that the migrated entity keeps its cache footprint.
+	Scheduler *target = nullptr;
+	auto n = getCpuCount();
+	for(int pass = 0; pass < 2 && !target; pass++) {
+		for(size_t i = 1; i < n; i++) {
+			auto cpu = getCpuData((_cpuContext->cpuIndex + i) % n);
+			if(!pass && !sharesLlc(cpu->topology, _cpuContext->topology))
+				continue;
+			auto other = &cpu->scheduler;
+			if(!other->_isIdle.load(std::memory_order_relaxed))
+				continue;
+			// Claim the CPU such that no other CPU pushes to it concurrently.
+			bool expected = true;
+			if(!other->_isIdle.compare_exchange_strong(expected, false,
+					std::memory_order_relaxed))
+				continue;
+			target = other;
+			break;
+		}
+	}
+	if(!target)
+		return;
+
+	// Find a waiting entity that can run on the target.
+	ScheduleEntity *skipped[balanceScanDepth];
+	int numSkipped = 0;
+	ScheduleEntity *entity = nullptr;
+	while(!_waitQueue.empty() && numSkipped < balanceScanDepth) {
+		auto candidate = _waitQueue.top();
+		_waitQueue.pop();
+		if(candidate->isMigratableTo(target->_cpuContext)) {
+			_numWaiting--;
+			entity = candidate;
+			break;
+		}
+		skipped[numSkipped++] = candidate;
+	}
+	for(int i = 0; i < numSkipped; i++)
+		_waitQueue.push(skipped[i]);
+	_publishedLoad.store(_numWaiting, std::memory_order_relaxed);
+
+	if(!entity) {
+		// Give up our claim. This is racy if the target became busy in the meantime,
+		// but at worst, another CPU pushes an entity to a busy CPU.
+		bool expected = false;
+		target->_isIdle.compare_exchange_strong(expected, true, std::memory_order_relaxed);
+		return;
+	}
+
+	if(entity == _handoffTarget)
+		_handoffTarget = nullptr;
+
+	// Fold our progress into the entity's unfairness. The target's update() rebases
+	// the entity on its own progress, similar to resume().
+	assert(entity->state == ScheduleState::active);
+	_updateWaitingEntity(entity);
+	_updateEntityStats(entity);
+	entity->state = ScheduleState::attached;
+	{
+		auto lock = frg::guard(&entity->_associationMutex);
+		entity->_scheduler = target;
+
+		// The target applies pending boosts when it enqueues the entity.
+		auto boostLock = frg::guard(&_mutex);
+		if(entity->boostHook.in_list)
+			_boostList.erase(_boostList.iterator_to(entity));
+	}
+
+	_numMigratedOut.fetch_add(1, std::memory_order_relaxed);
+	target->_numMigratedIn.fetch_add(1, std::memory_order_relaxed);
+	if(logBalancing)
+		infoLogger() << "thor: Migrating entity from CPU " << _cpuContext->cpuIndex
+				<< " to CPU " << target->_cpuContext->cpuIndex << frg::endlog;
+	if(osTraceAnnounced) {
+		OsTraceEvent event{osTraceMigrateEvent};
+		event.withCounter(osTraceFromCpuItem, _cpuContext->cpuIndex);
+		event.withCounter(osTraceToCpuItem, target->_cpuContext->cpuIndex);
+		event.emit();
+	}
+
+	resume(entity);
+}
+
+void Scheduler::_requestBalance() {
+	if(disableBalancing)
+		return;
+
+	Scheduler *busiest = nullptr;
+	size_t maxLoad = 0;
+	for(size_t i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this)
+			continue;
+		auto load = other->_publishedLoad.load(std::memory_order_relaxed);
+		if(load > maxLoad) {
+			busiest = other;
+			maxLoad = load;
+		}
+	}
+	if(!busiest)
+		return;
+
+	if(!busiest->_balanceRequested.exchange(true, std::memory_order_relaxed))
+		sendPingIpi(busiest->_cpuContext->cpuIndex);
+}
+
+// Arms the preemption timer if the current entity can be preempted.
+// Otherwise, the timer is disarmed such that the CPU only wakes up for real timers.
 void Scheduler::_updatePreemption() {
+	auto stopTick = [] {
+		if(preemptionIsArmed())
+			disarmPreemption();
+	};
+
 	if(disablePreemption)
-		return;
+		return stopTick();
 
 	// Disable preemption if there are no other threads.
 	if(_waitQueue.empty())
-		return;
+		return stopTick();
 
 	// If there was no current entity, we would have rescheduled.
 	assert(_current);
 	assert(_current->type() == ScheduleType::regular);
 	assert(_current->state == ScheduleState::active);
 
+	// Deadlines are postponed once the budget is exhausted; this may change the order.
+	if(_current->_policy == SchedulePolicy::deadline
+			&& _waitQueue.top()->_policy == SchedulePolicy::deadline) {
+		armPreemption(_current->_dlBudget);
+		return;
+	}
+
 	if(auto po = ScheduleEntity::orderPriority(_current, _waitQueue.top()); po < 0) {
 		// Disable preemption if we have higher priority.
-		return;
+		return stopTick();
 	}else{
 		// If there was an entity with higher priority, we would have rescheduled.
 		assert(!po);
 	}
 
+	if(_current->_policy == SchedulePolicy::fifo)
+		return stopTick();
+
 	armPreemption(sliceGranularity);
 }
 
@@ -390,6 +819,10 @@ void Scheduler::_updateCurrentEntity() {
 				<< " us (" << _numWaiting << " waiting threads)" << frg::endlog;
 	_current->baseUnfairness -= _numWaiting * delta_progress;
 	_current->refProgress = _systemProgress;
+
+	// Account the budget such that postponed deadlines are taken into account.
+	if(_current->_policy == SchedulePolicy::deadline)
+		_updateEntityStats(_current);
 }
 
 void Scheduler::_updateWaitingEntity(ScheduleEntity *entity) {
@@ -412,11 +845,80 @@ void Scheduler::_updateEntityStats(ScheduleEntity *entity) {
 	assert(entity->state == ScheduleState::active
 			|| entity == _current);
 
-	if(entity == _current)
-		entity->_runTime += _refClock - entity->_refClock;
+	if(entity == _current) {
+		auto delta = _refClock - entity->_refClock;
+		entity->_runTime += delta;
+		if(entity->_policy == SchedulePolicy::deadline)
+			_chargeBudget(entity, delta);
+	}
 	entity->_refClock = _refClock;
 }
 
+void Scheduler::_applyParameters(ScheduleEntity *entity, const SchedulingParameters &parameters) {
+	// Keep the current server period if the deadline parameters did not change
+	// (e.g., if only inherited parameters were added or removed).
+	bool keepServer = entity->_policy == SchedulePolicy::deadline
+			&& parameters.policy == SchedulePolicy::deadline
+			&& entity->_dlRuntime == parameters.runtime
+			&& entity->_dlDeadline == parameters.deadline
+			&& entity->_dlPeriod == parameters.period;
+
+	entity->_policy = parameters.policy;
+	entity->priority = parameters.priority;
+	if(parameters.policy == SchedulePolicy::deadline && !keepServer) {
+		entity->_dlRuntime = parameters.runtime;
+		entity->_dlDeadline = parameters.deadline;
+		entity->_dlPeriod = parameters.period;
+		entity->_dlAbsoluteDeadline = _refClock + parameters.deadline;
+		entity->_dlBudget = parameters.runtime;
+	}
+}
+
+void Scheduler::_applyRequestedParameters(ScheduleEntity *entity) {
+	if(!entity->_parametersChanged.load(std::memory_order_acquire))
+		return;
+
+	SchedulingParameters parameters;
+	{
+		auto lock = frg::guard(&entity->_associationMutex);
+		parameters = entity->_requestedParameters;
+		if(entity->_inheritedParameters
+				&& schedulingPrecedes(*entity->_inheritedParameters, parameters))
+			parameters = *entity->_inheritedParameters;
+		entity->_parametersChanged.store(false, std::memory_order_relaxed);
+	}
+	_applyParameters(entity, parameters);
+}
+
+void Scheduler::_replenishOnWakeup(ScheduleEntity *entity) {
+	assert(entity->_policy == SchedulePolicy::deadline);
+
+	// Keep the current server period unless the remaining budget would exceed the
+	// reserved bandwidth until the deadline, i.e., unless budget / (deadline - now)
+	// is greater than runtime / period.
+	if(entity->_dlAbsoluteDeadline > _refClock) {
+		auto slack = entity->_dlAbsoluteDeadline - _refClock;
+		if(static_cast<unsigned __int128>(entity->_dlBudget) * entity->_dlPeriod
+				<= static_cast<unsigned __int128>(slack) * entity->_dlRuntime)
+			return;
+	}
+	entity->_dlAbsoluteDeadline = _refClock + entity->_dlDeadline;
+	entity->_dlBudget = entity->_dlRuntime;
+}
+
+void Scheduler::_chargeBudget(ScheduleEntity *entity, uint64_t delta) {
+	assert(entity->_policy == SchedulePolicy::deadline);
+
+	entity->_dlBudget -= delta;
+	if(entity->_dlBudget > 0)
+		return;
+
+	// Postpone the deadline by as many periods as needed to recharge the budget.
+	auto periods = (-entity->_dlBudget) / entity->_dlRuntime + 1;
+	entity->_dlBudget += periods * entity->_dlRuntime;
+	entity->_dlAbsoluteDeadline += periods * entity->_dlPeriod;
+}
+
 Scheduler *localScheduler() {
 	return &getCpuData()->scheduler;
 }
@@ -82,6 +82,10 @@ void Stream::Submitter::enqueue(const LaneHandle &lane, StreamList &chain) {
 }
 
 void Stream::Submitter::run() {
+	// If we complete an operation of a peer that blocks on the stream, run the peer next
+	// if we block before the handoff is disarmed below.
+	Scheduler::armHandoff();
+
 	while(!_pending.empty()) {
 		StreamNode *u = _pending.pop_front();
 		StreamNode *v = nullptr;
@@ -239,6 +243,8 @@ void Stream::Submitter::run() {
 			}
 		}
 	}
+
+	Scheduler::disarmHandoff();
 }
 
 void Stream::incrementPeers(Stream *stream, int lane) {
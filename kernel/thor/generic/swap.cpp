@@ -0,0 +1,154 @@
+#include <atomic>
+
+#include <frg/manual_box.hpp>
+#include <frg/vector.hpp>
+#include <thor-internal/arch/paging.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/memory-view.hpp>
+#include <thor-internal/swap.hpp>
+#include <thor-internal/work-queue.hpp>
+
+namespace thor {
+
+namespace {
+
+constexpr bool logSwap = false;
+
+struct SwapArea {
+	SwapArea(smarter::shared_ptr<MemoryView> view, size_t numSlots)
+	: view{std::move(view)}, numSlots{numSlots}, bitmap{*kernelAlloc} {
+		bitmap.resize((numSlots + 63) / 64, 0);
+		// Slot 0 contains the swap header.
+		bitmap[0] |= 1;
+		numFree = numSlots - 1;
+	}
+
+	bool isUsed(size_t slot) {
+		return bitmap[slot / 64] & (uint64_t{1} << (slot % 64));
+	}
+
+	smarter::shared_ptr<MemoryView> view;
+	size_t numSlots;
+
+	// Protects the following fields.
+	frg::ticket_spinlock mutex;
+	// Bit i is set if slot i is in use.
+	frg::vector<uint64_t, KernelAlloc> bitmap;
+	size_t numFree;
+	// Allocation continues after the last allocated slot. This keeps slots that are
+	// allocated around the same time adjacent on the device.
+	size_t cursor = 1;
+};
+
+constinit frg::manual_box<SwapArea> swapAreaBox = {};
+// Set once swapAreaBox is initialized.
+constinit std::atomic<SwapArea *> activeArea{nullptr};
+frg::ticket_spinlock enableMutex;
+
+} // anonymous namespace
+
+Error enableSwap(smarter::shared_ptr<MemoryView> view, size_t numSlots) {
+	assert(numSlots >= 2);
+	assert(numSlots <= (view->getLength() >> kPageShift));
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&enableMutex);
+
+		if(activeArea.load(std::memory_order_relaxed))
+			return Error::illegalState;
+		swapAreaBox.initialize(std::move(view), numSlots);
+		activeArea.store(swapAreaBox.get(), std::memory_order_release);
+	}
+
+	infoLogger() << "thor: Enabled swap space of " << ((numSlots - 1) * (kPageSize >> 10))
+			<< " KiB" << frg::endlog;
+	return Error::success;
+}
+
+bool swapAvailable() {
+	auto area = activeArea.load(std::memory_order_acquire);
+	if(!area)
+		return false;
+	// Racy read; this is only a hint.
+	return __atomic_load_n(&area->numFree, __ATOMIC_RELAXED);
+}
+
+uint64_t allocateSwapSlots(size_t &count) {
+	assert(count);
+	auto area = activeArea.load(std::memory_order_acquire);
+	if(!area) {
+		count = 0;
+		return noSwapSlot;
+	}
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&area->mutex);
+
+	if(!area->numFree) {
+		count = 0;
+		return noSwapSlot;
+	}
+
+	// Find the next free slot (there is at least one).
+	auto base = area->cursor;
+	while(area->isUsed(base)) {
+		base++;
+		if(base == area->numSlots)
+			base = 1;
+	}
+
+	size_t n = 1;
+	while(n < count && base + n < area->numSlots && !area->isUsed(base + n))
+		n++;
+
+	for(size_t i = 0; i < n; i++)
+		area->bitmap[(base + i) / 64] |= uint64_t{1} << ((base + i) % 64);
+	__atomic_store_n(&area->numFree, area->numFree - n, __ATOMIC_RELAXED);
+	area->cursor = base + n;
+	if(area->cursor == area->numSlots)
+		area->cursor = 1;
+
+	if(logSwap)
+		infoLogger() << "thor: Allocated " << n << " swap slots at " << base << frg::endlog;
+	count = n;
+	return base;
+}
+
+void freeSwapSlot(uint64_t slot) {
+	auto area = activeArea.load(std::memory_order_acquire);
+	assert(area);
+	assert(slot && slot < area->numSlots);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&area->mutex);
+
+	assert(area->isUsed(slot));
+	area->bitmap[slot / 64] &= ~(uint64_t{1} << (slot % 64));
+	__atomic_store_n(&area->numFree, area->numFree + 1, __ATOMIC_RELAXED);
+}
+
+bool donateToSwap(uint64_t slot, PhysicalAddr physical) {
+	auto area = activeArea.load(std::memory_order_acquire);
+	assert(area);
+	return area->view->donatePage(slot << kPageShift, physical);
+}
+
+coroutine<frg::expected<Error>> writeSwapSlot(uint64_t slot, PhysicalAddr physical) {
+	auto area = activeArea.load(std::memory_order_acquire);
+	assert(area);
+	PageAccessor accessor{physical};
+	co_return co_await area->view->copyTo(slot << kPageShift, accessor.get(), kPageSize,
+			WorkQueue::generalQueue()->take());
+}
+
+coroutine<frg::expected<Error>> readSwapSlot(uint64_t slot, PhysicalAddr physical) {
+	auto area = activeArea.load(std::memory_order_acquire);
+	assert(area);
+	PageAccessor accessor{physical};
+	co_return co_await area->view->copyFrom(slot << kPageShift, accessor.get(), kPageSize,
+			WorkQueue::generalQueue()->take());
+}
+
+} // namespace thor
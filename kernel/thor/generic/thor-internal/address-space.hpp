@@ -1,17 +1,56 @@
 #pragma once
 
+#include <atomic>
+
 #include <async/basic.hpp>
 #include <async/mutex.hpp>
 #include <async/oneshot-event.hpp>
 #include <frg/container_of.hpp>
 #include <frg/expected.hpp>
+#include <frg/optional.hpp>
+#include <frg/vector.hpp>
 #include <thor-internal/coroutine.hpp>
+#include <thor-internal/lockstat.hpp>
 #include <thor-internal/memory-view.hpp>
+#include <thor-internal/range-mutex.hpp>
 
 namespace thor {
 
 struct VirtualSpace;
 
+// Tries to install a single large page at the (2 MiB aligned) position of the cursor.
+// This only succeeds if the caller asked for large pages and if the view is backed
+// by a suitably aligned, physically contiguous range with uniform caching mode.
+// Otherwise, the caller needs to fall back to 4 KiB pages.
+template<typename Cursor>
+bool mapHugeByCursor(Cursor &c, MemoryView *view, uintptr_t offset, size_t remaining,
+		PageFlags flags, PageStatus &status) {
+	if constexpr (requires { c.remap2m(PhysicalAddr{}, flags, CachingMode::null); }) {
+		if(!(flags & page_access::preferHuge))
+			return false;
+		if((c.virtualAddress() & (kHugePageSize - 1)) || (offset & (kHugePageSize - 1)))
+			return false;
+		if(remaining < kHugePageSize || !c.canMap2m())
+			return false;
+
+		auto firstRange = view->peekRange(offset);
+		auto physical = firstRange.template get<0>();
+		if(physical == PhysicalAddr(-1) || (physical & (kHugePageSize - 1)))
+			return false;
+		for(size_t progress = kPageSize; progress < kHugePageSize; progress += kPageSize) {
+			auto physicalRange = view->peekRange(offset + progress);
+			if(physicalRange.template get<0>() != physical + progress
+					|| physicalRange.template get<1>() != firstRange.template get<1>())
+				return false;
+		}
+
+		status = c.remap2m(physical, flags, firstRange.template get<1>());
+		return true;
+	}else{
+		return false;
+	}
+}
+
 template<typename Cursor, typename PageSpace>
 frg::expected<Error> mapPresentPagesByCursor(PageSpace *ps, VirtualAddr va,
 		MemoryView *view, uintptr_t offset, size_t size, PageFlags flags) {
@@ -22,6 +61,14 @@ frg::expected<Error> mapPresentPagesByCursor(PageSpace *ps, VirtualAddr va,
 	Cursor c{ps, va};
 	while(c.virtualAddress() < va + size) {
 		auto progress = c.virtualAddress() - va;
+
+		PageStatus status;
+		if(mapHugeByCursor(c, view, offset + progress, size - progress, flags, status)) {
+			assert(!(status & page_status::present));
+			c.advance2m();
+			continue;
+		}
+
 		auto physicalRange = view->peekRange(offset + progress);
 		if(physicalRange.template get<0>() == PhysicalAddr(-1)) {
 			c.advance4k();
@@ -46,9 +93,30 @@ frg::expected<Error> remapPresentPagesByCursor(PageSpace *ps, VirtualAddr va,
 	while(c.virtualAddress() < va + size) {
 		auto progress = c.virtualAddress() - va;
 
+		if constexpr (requires { c.unmap2m(); }) {
+			if(!(c.virtualAddress() & (kHugePageSize - 1))
+					&& size - progress >= kHugePageSize && c.isHuge2m()) {
+				auto status = c.unmap2m();
+				if(status & page_status::dirty)
+					view->markDirty(offset + progress, kHugePageSize);
+				if(status & page_status::accessed)
+					view->markAccessed(offset + progress, kHugePageSize);
+			}
+
+			PageStatus status;
+			if(mapHugeByCursor(c, view, offset + progress, size - progress, flags, status)) {
+				assert(!(status & page_status::present));
+				c.advance2m();
+				continue;
+			}
+		}
+
 		auto status = c.unmap4k();
-		if((status & page_status::present) && (status & page_status::dirty)) {
-			view->markDirty(offset + progress, kPageSize);
+		if(status & page_status::present) {
+			if(status & page_status::dirty)
+				view->markDirty(offset + progress, kPageSize);
+			if(status & page_status::accessed)
+				view->markAccessed(offset + progress, kPageSize);
 		}
 
 		auto physicalRange = view->peekRange(offset + progress);
@@ -70,6 +138,22 @@ frg::expected<Error> faultPageByCursor(PageSpace *ps, VirtualAddr va,
 	assert(!(va & (kPageSize - 1)));
 	assert(!(offset & (kPageSize - 1)));
 
+	if constexpr (requires { Cursor{ps, va}.remap2m(PhysicalAddr{}, flags, CachingMode::null); }) {
+		// If the caller allows it, try to resolve the fault for the entire surrounding 2 MiB window.
+		if(flags & page_access::preferHuge) {
+			auto hugeVa = va & ~(kHugePageSize - 1);
+			auto hugeOffset = offset - (va - hugeVa);
+
+			Cursor c{ps, hugeVa};
+			PageStatus status;
+			if(mapHugeByCursor(c, view, hugeOffset, kHugePageSize, flags, status)) {
+				if((status & page_status::present) && (status & page_status::dirty))
+					view->markDirty(hugeOffset, kHugePageSize);
+				return {};
+			}
+		}
+	}
+
 	Cursor c{ps, va};
 
 	auto physicalRange = view->peekRange(offset);
@@ -85,6 +169,37 @@ frg::expected<Error> faultPageByCursor(PageSpace *ps, VirtualAddr va,
 	return {};
 }
 
+// Maps all pages that are resident in the view but not mapped yet.
+// In contrast to remapPresentPagesByCursor(), this never touches existing mappings.
+template<typename Cursor, typename PageSpace>
+frg::expected<Error> mapAbsentPagesByCursor(PageSpace *ps, VirtualAddr va,
+		MemoryView *view, uintptr_t offset, size_t size, PageFlags flags) {
+	assert(!(va & (kPageSize - 1)));
+	assert(!(offset & (kPageSize - 1)));
+	assert(!(size & (kPageSize - 1)));
+
+	Cursor c{ps, va};
+	while(c.virtualAddress() < va + size) {
+		auto progress = c.virtualAddress() - va;
+
+		if(c.isPresent()) {
+			c.advance4k();
+			continue;
+		}
+
+		auto physicalRange = view->peekRange(offset + progress);
+		if(physicalRange.template get<0>() == PhysicalAddr(-1)) {
+			c.advance4k();
+			continue;
+		}
+		assert(!(physicalRange.template get<0>() & (kPageSize - 1)));
+
+		c.map4k(physicalRange.template get<0>(), flags, physicalRange.template get<1>());
+		c.advance4k();
+	}
+	return {};
+}
+
 template<typename Cursor, typename PageSpace>
 frg::expected<Error> cleanPagesByCursor(PageSpace *ps, VirtualAddr va,
 		MemoryView *view, uintptr_t offset, size_t size) {
@@ -117,10 +232,25 @@ frg::expected<Error> unmapPagesByCursor(PageSpace *ps, VirtualAddr va,
 	while(c.findPresent(va + size)) {
 		auto progress = c.virtualAddress() - va;
 
+		if constexpr (requires { c.unmap2m(); }) {
+			if(!(c.virtualAddress() & (kHugePageSize - 1))
+					&& size - progress >= kHugePageSize && c.isHuge2m()) {
+				auto status = c.unmap2m();
+				if(status & page_status::dirty)
+					view->markDirty(offset + progress, kHugePageSize);
+				if(status & page_status::accessed)
+					view->markAccessed(offset + progress, kHugePageSize);
+				c.advance2m();
+				continue;
+			}
+		}
+
 		auto status = c.unmap4k();
 		assert(status & page_status::present);
 		if(status & page_status::dirty)
 			view->markDirty(offset + progress, kPageSize);
+		if(status & page_status::accessed)
+			view->markAccessed(offset + progress, kPageSize);
 
 		c.advance4k();
 	}
@@ -152,6 +282,10 @@ struct VirtualOperations {
 	virtual frg::expected<Error> faultPage(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, PageFlags flags);
 
+	// Maps pages that are resident in the view but not mapped yet (e.g., for fault-around).
+	virtual frg::expected<Error> mapAbsentPages(VirtualAddr va, MemoryView *view,
+			uintptr_t offset, size_t size, PageFlags flags);
+
 	virtual frg::expected<Error> cleanPages(VirtualAddr va, MemoryView *view,
 			uintptr_t offset, size_t size);
 
@@ -294,7 +428,8 @@ enum MappingFlags : uint32_t {
 	protWrite = 0x20,
 	protExecute = 0x40,
 
-	dontRequireBacking = 0x100
+	dontRequireBacking = 0x100,
+	preferHugePages = 0x200
 };
 
 struct TouchVirtualResult {
@@ -477,7 +612,8 @@ public:
 		kMapProtExecute = 0x20,
 		kMapPopulate = 0x200,
 		kMapDontRequireBacking = 0x400,
-		kMapFixedNoReplace = 0x800
+		kMapFixedNoReplace = 0x800,
+		kMapPreferHugePages = 0x1000
 	};
 
 	enum FaultFlags : uint32_t {
@@ -509,6 +645,11 @@ public:
 	coroutine<frg::expected<Error>>
 	handleFault(VirtualAddr address, uint32_t flags, smarter::shared_ptr<WorkQueue> wq);
 
+	// Makes all pages of a range resident and maps them.
+	// The range must be contained in a single mapping.
+	coroutine<frg::expected<Error>>
+	populate(VirtualAddr address, size_t length, smarter::shared_ptr<WorkQueue> wq);
+
 	coroutine<frg::expected<Error, PhysicalAddr>>
 	retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueue> wq);
 
@@ -516,6 +657,24 @@ public:
 		return _ops->getRss();
 	}
 
+	// Per-mapping memory accounting; all sizes are in bytes.
+	struct Usage {
+		// Pages that are mapped and backed by memory of the mapped view.
+		size_t resident = 0;
+		// Resident pages that are not backed by a file.
+		size_t anonymous = 0;
+		// Resident pages that can also be mapped by other views (or spaces).
+		size_t shared = 0;
+		// Pages that are no longer resident since they were evicted.
+		size_t evicted = 0;
+		// Part of evicted that is anonymous memory (i.e., compressed or swapped out).
+		size_t swapped = 0;
+	};
+
+	// Accounts all pages of mappings inside [address, address + length).
+	// This only takes a snapshot; it does not prevent concurrent (un)mapping or eviction.
+	Usage queryUsage(VirtualAddr address, size_t length);
+
 	// ----------------------------------------------------------------------------------
 	// Read/write support.
 	// ----------------------------------------------------------------------------------
@@ -527,6 +686,22 @@ public:
 	coroutine<size_t> writePartialSpace(uintptr_t address, const void *buffer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq);
 
+	// Like writePartialSpace() but the source is read by copyIn() (which runs on wq).
+	// This allows to copy directly from user memory (e.g., of the thread that owns wq).
+	// Returns Error::fault if copyIn() fails; otherwise, returns the number of bytes written.
+	coroutine<frg::expected<Error, size_t>> writePartialSpaceWith(uintptr_t address,
+			const void *source, size_t size,
+			bool (*copyIn)(void *dest, const void *src, size_t size),
+			smarter::shared_ptr<WorkQueue> wq);
+
+	// Like readPartialSpace() but copies directly into a MemoryView
+	// (at offset destOffset) instead of a kernel buffer.
+	// Returns an error if copying to the view fails; otherwise,
+	// returns the number of bytes that were copied.
+	coroutine<frg::expected<Error, size_t>> readPartialSpaceToView(uintptr_t address,
+			MemoryView *dest, uintptr_t destOffset, size_t size,
+			smarter::shared_ptr<WorkQueue> wq);
+
 	auto readSpace(uintptr_t address, void *buffer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq) {
 		return async::transform(
@@ -556,7 +731,7 @@ public:
 	// ----------------------------------------------------------------------------------
 
 	frg::expected<Error, FutexIdentity> resolveGlobalFutex(uintptr_t address) {
-		// We do not take _consistencyMutex here since we are only interested in a snapshot.
+		// We do not take _rangeMutex here since we are only interested in a snapshot.
 
 		smarter::shared_ptr<Mapping> mapping;
 		{
@@ -576,7 +751,7 @@ public:
 
 	coroutine<frg::expected<Error, GlobalFutex>> grabGlobalFutex(uintptr_t address,
 			smarter::shared_ptr<WorkQueue> wq) {
-		// We do not take _consistencyMutex here since we are only interested in a snapshot.
+		// We do not take _rangeMutex here since we are only interested in a snapshot.
 
 		smarter::shared_ptr<Mapping> mapping;
 		{
@@ -608,32 +783,51 @@ private:
 
 	smarter::shared_ptr<Mapping> _findMapping(VirtualAddr address);
 
+	// Returns the lowest mapping that ends after address.
+	Mapping *_findMappingAfter(VirtualAddr address);
+
 	bool _areMappingsInRange(VirtualAddr address, VirtualAddr length);
 
 	// Splits some memory range from a hole mapping.
 	void _splitHole(Hole *hole, VirtualAddr offset, VirtualAddr length);
 
+	// Extends the range such that it covers all mappings that overlap its boundaries.
+	frg::tuple<VirtualAddr, size_t> _boundingRange(VirtualAddr address, size_t length);
+
+	// Exclusively locks a range and all mappings that overlap it.
+	// This is required before calling _splitMappings().
+	coroutine<void> _lockForSplit(frg::optional<RangeLock> &rangeLock,
+			VirtualAddr address, size_t length);
+
+	// Splits the mapping that contains (at) into two parts at (at), if any.
+	coroutine<void> _splitMappingAt(VirtualAddr at);
+
 	// Potentially splits mappings into two parts at (address) and (address + size).
-	// Returns the start and end mappings that are within the specified range.
-	coroutine<frg::tuple<Mapping *, Mapping *>> _splitMappings(uintptr_t address, size_t size);
+	// Returns the mappings that are within the specified range.
+	coroutine<frg::vector<smarter::shared_ptr<Mapping>, KernelAlloc>>
+	_splitMappings(uintptr_t address, size_t size);
 
 	// Used in conjunction with _splitMappings.
-	// Unmaps and removes all mappings between start and end that fall within the specified range.
+	// Unmaps and removes all mappings that fall within the specified range.
 	// Returns whether shootdown needs to be performed (any of the mappings got unmapped).
-	coroutine<bool> _unmapMappings(VirtualAddr address, size_t length, Mapping *start, Mapping *end);
+	coroutine<bool> _unmapMappings(VirtualAddr address, size_t length,
+			frg::vector<smarter::shared_ptr<Mapping>, KernelAlloc> mappings);
 
 	VirtualOperations *_ops;
 
 	// Since changing memory mappings requires TLB shootdown, most mapping-related operations
-	// of VirtualSpace are async. Thus, we use an async mutex to serialize these operations.
-	async::shared_mutex _consistencyMutex;
+	// of VirtualSpace are async. Thus, we use an async lock to serialize these operations.
+	// The lock is taken per address range such that operations on disjoint ranges
+	// (e.g., map() and unmap() from different threads, or page faults) run concurrently.
+	// Operations that modify a mapping always lock the entire range of the mapping.
+	RangeMutex _rangeMutex;
 
-	// To avoid taking _consistencyMutex for operations that only need to look at the current
+	// To avoid taking _rangeMutex for operations that only need to look at the current
 	// state of the VirtualSpace (and that can run concurrently with mapping-related that
 	// perform TLB shootdown), we have another mutex that only protects _holes and _mappings.
 	// We make sure that we "commit" changes to _holes and _mappings before changing page
 	// tables and/or doing TLB shootdown.
-	frg::ticket_spinlock _snapshotMutex;
+	StatSpinlock<"address-space-snapshot"> _snapshotMutex;
 
 	HoleTree _holes;
 	MappingTree _mappings;
@@ -674,7 +868,7 @@ struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, Bi
 			return space_->pageSpace_.isMapped(pointer);
 		}
 
-#ifdef __x86_64__
+#if defined(__x86_64__) || defined(__aarch64__)
 		frg::expected<Error> mapPresentPages(VirtualAddr va, MemoryView *view,
 				uintptr_t offset, size_t size, PageFlags flags) override {
 			return mapPresentPagesByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
@@ -693,6 +887,12 @@ struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, Bi
 					va, view, offset, flags);
 		}
 
+		frg::expected<Error> mapAbsentPages(VirtualAddr va, MemoryView *view,
+				uintptr_t offset, size_t size, PageFlags flags) override {
+			return mapAbsentPagesByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
+					va, view, offset, size, flags);
+		}
+
 		frg::expected<Error> cleanPages(VirtualAddr va, MemoryView *view,
 				uintptr_t offset, size_t size) override {
 			return cleanPagesByCursor<ClientPageSpace::Cursor>(&space_->pageSpace_,
@@ -745,6 +945,29 @@ private:
 	ClientPageSpace pageSpace_;
 };
 
+// Read-only view of a range of an AddressSpace (see helCreateSpaceWindow()).
+// Windows allow other processes to read a buffer without access to the entire space.
+struct SpaceWindow {
+	SpaceWindow(smarter::shared_ptr<AddressSpace, BindableHandle> space,
+			VirtualAddr address, size_t length)
+	: space{std::move(space)}, address{address}, length{length} { }
+
+	// Fails with Error::fault if the window was revoked or if the range
+	// is not contained in the window.
+	frg::expected<Error> checkAccess(uintptr_t offset, size_t size) {
+		if(revoked.load(std::memory_order_acquire))
+			return Error::fault;
+		if(offset > length || size > length - offset)
+			return Error::fault;
+		return {};
+	}
+
+	smarter::shared_ptr<AddressSpace, BindableHandle> space;
+	VirtualAddr address;
+	size_t length;
+	std::atomic<bool> revoked{false};
+};
+
 struct MemoryViewLockHandle {
 	friend void swap(MemoryViewLockHandle &a, MemoryViewLockHandle &b) {
 		using std::swap;
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <initgraph.hpp>
+
+namespace thor {
+
+// Boot timeline, i.e., the durations of eir's boot stages and of thor's initgraph tasks.
+//
+// Phases are timed using the raw timestamp counter since the system clock is not
+// available early during boot. Once it is, emitBootTimeline() converts the timestamps
+// and emits one ostrace event per phase (named "boot.eir: <stage>" and
+// "boot.thor: <task>"); the duration of each phase is passed as "time" item.
+
+// Must be called on entry to thor; this ends the last stage of eir.
+void startBootTimeline();
+
+// Called by GlobalInitEngine for each task.
+void recordBootTaskStart(initgraph::Node *node);
+void recordBootTaskEnd(initgraph::Node *node);
+
+// Takes a reference point to convert timestamps. Must be called once the system clock
+// is available but (ideally) a long time before emitBootTimeline().
+void calibrateBootTimeline();
+
+// Emits the boot timeline (if ostrace is enabled) and stops recording.
+void emitBootTimeline();
+
+} // namespace thor
@@ -2,12 +2,16 @@
 
 #include <thor-internal/arch/cpu.hpp>
 #include <thor-internal/executor-context.hpp>
+#include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/physical.hpp>
+#include <thor-internal/random.hpp>
 #include <thor-internal/schedule.hpp>
 
 namespace thor {
 
 // Forward defined for pointers that are part of CpuData.
+struct CachePage;
 struct KernelFiber;
 struct SingleContextRecordRing;
 struct WorkQueue;
@@ -18,6 +22,36 @@ enum class ProfileMechanism {
 	amdPmc
 };
 
+// Per-CPU batch of CachePages that still need to be inserted into the LRU of the
+// MemoryReclaimer. Mostly accessed by the owning CPU; the mutex is only contended
+// if a page is removed from a foreign CPU's batch or if the batch is flushed remotely.
+struct ReclaimCpuBatch {
+	static constexpr int capacity = 32;
+
+	frg::ticket_spinlock mutex;
+	int numPages = 0;
+	CachePage *pages[capacity];
+};
+
+// Identifiers of the topology units that contain a CPU.
+// CPUs with equal identifiers share the respective unit.
+struct CpuTopology {
+	int package = 0;
+	// Physical core, i.e., the SMT siblings of a CPU have the same identifier.
+	// Negative if the core is not known (CPUs are then assumed to be separate cores).
+	int core = -1;
+	// Last level cache.
+	int llc = 0;
+};
+
+inline bool sharesCore(const CpuTopology &a, const CpuTopology &b) {
+	return a.core >= 0 && a.core == b.core;
+}
+
+inline bool sharesLlc(const CpuTopology &a, const CpuTopology &b) {
+	return a.package == b.package && a.llc == b.llc;
+}
+
 struct CpuData : public PlatformCpuData {
 	CpuData();
 
@@ -38,11 +72,24 @@ struct CpuData : public PlatformCpuData {
 	KernelFiber *wqFiber = nullptr;
 	smarter::shared_ptr<WorkQueue> generalWorkQueue;
 	std::atomic<uint64_t> heartbeat;
+	// Number of IRQ pin raises handled by this CPU.
+	std::atomic<uint64_t> irqCount{0};
+
+	HeapCpuCache heapCache;
+	PhysicalCpuCache pageCache;
+	KernelStackCpuCache stackCache;
+	ReclaimCpuBatch reclaimBatch;
+	// NUMA node of this CPU; indexes the nodes of the PhysicalChunkAllocator.
+	int numaNode = 0;
+	CpuTopology topology;
 
 	unsigned int irqEntropySeq = 0;
+	RandomCpuPool randomPool;
 	std::atomic<ProfileMechanism> profileMechanism{};
 	// TODO: This should be a unique_ptr instead.
 	SingleContextRecordRing *localProfileRing = nullptr;
+	// Allocated on first use by the ostrace code; drained into the global ostrace ring.
+	std::atomic<SingleContextRecordRing *> localOsTraceRing{nullptr};
 };
 
 CpuData *getCpuData(size_t k);
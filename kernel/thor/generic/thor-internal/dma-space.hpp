@@ -0,0 +1,121 @@
+#pragma once
+
+#include <frg/hash_map.hpp>
+#include <frg/list.hpp>
+#include <frg/spinlock.hpp>
+#include <smarter.hpp>
+#include <thor-internal/address-space.hpp>
+#include <thor-internal/coroutine.hpp>
+#include <thor-internal/error.hpp>
+
+namespace thor {
+
+using DmaFlags = uint32_t;
+inline constexpr DmaFlags dmaRead = 1;
+inline constexpr DmaFlags dmaWrite = 2;
+
+// One set of I/O page tables of an IOMMU. Each domain translates the DMA accesses
+// of the devices that are attached to it.
+// Implementations do not need to synchronize calls; this is done by DmaSpace.
+struct IommuDomain {
+protected:
+	~IommuDomain() = default;
+
+public:
+	// Returns true if the page at ioAddress is mapped.
+	virtual bool isMapped(uintptr_t ioAddress) = 0;
+
+	// Maps a single page. The page must not be mapped yet.
+	virtual void mapPage(uintptr_t ioAddress, PhysicalAddr physical, DmaFlags flags) = 0;
+	virtual void unmapPage(uintptr_t ioAddress) = 0;
+
+	// Makes all previous mapPage() and unmapPage() calls visible to devices.
+	// Returns only after stale translations have been evicted from the IOTLB.
+	virtual void flush() = 0;
+
+	// Size of the I/O address space in bytes.
+	virtual uintptr_t ioAddressLimit() = 0;
+};
+
+// Hardware unit that translates the DMA accesses of PCI devices.
+struct Iommu {
+	frg::default_list_hook<Iommu> hook;
+
+	// Returns true if this unit translates DMA accesses of the given device.
+	virtual bool translatesPciDevice(uint32_t seg, uint32_t bus, uint32_t slot,
+			uint32_t function) = 0;
+
+	// Creates a new domain and attaches the device to it.
+	// Until this is called, DMA accesses of the device are not translated.
+	virtual smarter::shared_ptr<IommuDomain> createPciDomain(uint32_t seg, uint32_t bus,
+			uint32_t slot, uint32_t function) = 0;
+
+protected:
+	~Iommu() = default;
+};
+
+// IOMMUs must be registered before PCI drivers can obtain DMA spaces.
+void registerIommu(Iommu *iommu);
+
+// Returns the IOMMU that translates the DMA accesses of a PCI device (or nullptr).
+Iommu *getIommuForPciDevice(uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function);
+
+// I/O address space of a device, as seen by user space drivers.
+// Mappings point into memory views; they keep the memory locked until they are removed.
+struct DmaSpace {
+	DmaSpace(smarter::shared_ptr<IommuDomain> domain);
+
+	DmaSpace(const DmaSpace &) = delete;
+
+	~DmaSpace();
+
+	DmaSpace &operator= (const DmaSpace &) = delete;
+
+	// Maps [offset, offset + length) of the view to [ioAddress, ioAddress + length).
+	// The mapping is only visible to the device after the next call to flush().
+	coroutine<Error> map(smarter::shared_ptr<MemoryView> view, uintptr_t offset,
+			uintptr_t ioAddress, size_t length, DmaFlags flags,
+			smarter::shared_ptr<WorkQueue> wq);
+
+	// Removes the mapping that starts at ioAddress.
+	// The memory is only unlocked by the next call to flush().
+	Error unmap(uintptr_t ioAddress);
+
+	// Commits all previous map() and unmap() calls to the hardware.
+	// Batching multiple calls results in a single IOTLB invalidation.
+	void flush();
+
+private:
+	struct Mapping {
+		MemoryViewLockHandle lock;
+		smarter::shared_ptr<MemoryView> view;
+		uintptr_t offset;
+		uintptr_t ioAddress;
+		size_t length;
+		DmaFlags flags;
+		frg::default_list_hook<Mapping> hook;
+	};
+
+	using MappingList = frg::intrusive_list<
+		Mapping,
+		frg::locate_member<
+			Mapping,
+			frg::default_list_hook<Mapping>,
+			&Mapping::hook
+		>
+	>;
+
+	frg::ticket_spinlock mutex_;
+
+	smarter::shared_ptr<IommuDomain> domain_;
+
+	// Maps the start address of each mapping to the mapping.
+	frg::hash_map<uintptr_t, Mapping *, frg::hash<uintptr_t>, KernelAlloc> mappings_;
+
+	MappingList activeMappings_;
+
+	// Mappings that were removed but are still visible to the device.
+	MappingList pendingUnmaps_;
+};
+
+} // namespace thor
@@ -137,6 +137,10 @@ public:
 		return _associatedWorkQueue.get();
 	}
 
+	UniqueKernelStack &kernelStack() {
+		return _fiberContext.stack;
+	}
+
 private:
 	frg::ticket_spinlock _mutex;
 	bool _blocked;
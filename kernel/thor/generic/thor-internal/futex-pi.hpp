@@ -0,0 +1,142 @@
+#pragma once
+
+#include <frg/expected.hpp>
+#include <frg/list.hpp>
+#include <frg/optional.hpp>
+
+#include <thor-internal/error.hpp>
+#include <thor-internal/futex.hpp>
+#include <thor-internal/memory-view.hpp>
+#include <thor-internal/schedule.hpp>
+
+namespace thor {
+
+// Priority inheritance (PI) futexes.
+//
+// The futex word contains the TID (see PiFutexTask) of the owner or zero if the
+// futex is unlocked. Userspace locks and unlocks uncontended futexes by atomic
+// compare-exchange; on contention, it calls into the kernel which sets
+// kHelFutexPiWaiters and boosts the owner to the scheduling parameters of its
+// highest priority waiter. Boosts are propagated along chains of PI futexes.
+
+struct PiFutexTask;
+struct PiFutexState;
+struct PiFutexOps;
+
+struct PiFutexWaiter {
+	friend struct PiFutexRealm;
+	friend struct PiFutexOps;
+
+	// The waiting thread blocks on this futex (via the global FutexRealm) until the PI futex
+	// is handed over to it. It is not backed by user memory.
+	struct GrantFutex {
+		FutexIdentity getIdentity() {
+			return {reinterpret_cast<uintptr_t>(&self->granted_), 0};
+		}
+
+		unsigned int read() {
+			return __atomic_load_n(&self->granted_, __ATOMIC_ACQUIRE);
+		}
+
+		void retire() { }
+
+		PiFutexWaiter *self;
+	};
+
+	GrantFutex grantFutex() {
+		return {this};
+	}
+
+	bool granted() {
+		return __atomic_load_n(&granted_, __ATOMIC_ACQUIRE);
+	}
+
+private:
+	PiFutexTask *task_ = nullptr;
+	PiFutexState *state_ = nullptr;
+	// Parameters that this waiter donates to the owner.
+	SchedulingParameters parameters_;
+	unsigned int granted_ = 0;
+	frg::default_list_hook<PiFutexWaiter> hook_;
+};
+
+// Kernel state of a PI futex. This only exists while the futex has waiters.
+struct PiFutexState {
+	PiFutexState(FutexIdentity id, GlobalFutex futex)
+	: id{id}, futex{std::move(futex)} { }
+
+	FutexIdentity id;
+	// Keeps the futex word pinned while the state exists.
+	GlobalFutex futex;
+	PiFutexTask *owner = nullptr;
+
+	// Ordered by scheduling parameters; waiters with equal parameters are in FIFO order.
+	frg::intrusive_list<
+		PiFutexWaiter,
+		frg::locate_member<
+			PiFutexWaiter,
+			frg::default_list_hook<PiFutexWaiter>,
+			&PiFutexWaiter::hook_
+		>
+	> waiters;
+
+	frg::default_list_hook<PiFutexState> ownerHook;
+};
+
+// Per-thread state of PI futexes.
+struct PiFutexTask {
+	friend struct PiFutexRealm;
+	friend struct PiFutexOps;
+
+	PiFutexTask(ScheduleEntity *entity);
+
+	PiFutexTask(const PiFutexTask &) = delete;
+
+	PiFutexTask &operator= (const PiFutexTask &) = delete;
+
+	// Hands over all PI futexes that are still owned to their waiters
+	// (with kHelFutexPiOwnerDied set).
+	~PiFutexTask();
+
+	uint32_t tid() {
+		return tid_;
+	}
+
+private:
+	ScheduleEntity *entity_;
+	uint32_t tid_;
+	PiFutexWaiter *blockedOn_ = nullptr;
+	// Parameters that are currently inherited from the waiters of held futexes.
+	frg::optional<SchedulingParameters> boost_;
+
+	// Futexes that this task owns and that have waiters.
+	frg::intrusive_list<
+		PiFutexState,
+		frg::locate_member<
+			PiFutexState,
+			frg::default_list_hook<PiFutexState>,
+			&PiFutexState::ownerHook
+		>
+	> held_;
+};
+
+struct PiFutexRealm {
+	// Acquires the futex or enqueues the waiter. Returns true if the caller needs to wait
+	// until waiter->granted() (through waiter->grantFutex()) and call finishWait() afterwards.
+	// Fails with Error::illegalState if the futex is already owned by the task or
+	// if waiting would deadlock and with Error::illegalArgs if the owner does not exist.
+	frg::expected<Error, bool> lock(GlobalFutex futex, PiFutexTask *task,
+			PiFutexWaiter *waiter);
+
+	// Dequeues the waiter unless the futex was handed over to it.
+	// Fails with Error::cancelled if the waiter did not acquire the futex.
+	Error finishWait(PiFutexWaiter *waiter);
+
+	// Releases the futex and hands it over to the highest priority waiter.
+	// Fails with Error::illegalState if the futex is not owned by the task.
+	Error unlock(GlobalFutex futex, PiFutexTask *task);
+};
+
+PiFutexRealm *getPiFutexRealm();
+
+} // namespace thor
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
+
 #include <async/cancellation.hpp>
+#include <frg/expected.hpp>
 #include <frg/functional.hpp>
 #include <frg/hash_map.hpp>
 #include <frg/list.hpp>
@@ -11,6 +14,7 @@
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/error.hpp>
 #include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/lockstat.hpp>
 #include <thor-internal/work-queue.hpp>
 
 #include <thor-internal/debug.hpp>
@@ -57,11 +61,13 @@ concept Futex = requires(F f) {
 struct FutexRealm {
 private:
 	// Represents a single waiter.
+	struct Bucket;
+
 	struct Node {
 		friend struct FutexRealm;
 
 		Node(FutexRealm *realm, FutexIdentity id)
-		: realm_{realm}, id_{id}, cobs_{this} { }
+		: realm_{realm}, id_{id}, bucket_{realm->_bucketOf(id)}, cobs_{this} { }
 
 	protected:
 		virtual void complete() = 0;
@@ -72,11 +78,23 @@ private:
 		void cancel_() {
 			{
 				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&realm_->_mutex);
+
+				// requeue() can move the node to another bucket; it changes bucket_ and id_
+				// while holding the locks of both buckets.
+				auto bucket = bucket_.load(std::memory_order_relaxed);
+				bucket->mutex.lock();
+				while(true) {
+					auto current = bucket_.load(std::memory_order_relaxed);
+					if(current == bucket)
+						break;
+					bucket->mutex.unlock();
+					bucket = current;
+					bucket->mutex.lock();
+				}
 
 				if(!result_) {
-					auto sit = realm_->_slots.get(id_);
-					assert(sit);			
+					auto sit = bucket->slots.get(id_);
+					assert(sit);
 
 					// Invariant: If the slot exists then its queue is not empty.
 					assert(!sit->queue.empty());
@@ -86,10 +104,12 @@ private:
 					result_ = Error::cancelled;
 
 					if(sit->queue.empty())
-						realm_->_slots.remove(id_);
+						bucket->slots.remove(id_);
 				}else{
 					assert(!queueHook_.in_list);
 				}
+
+				bucket->mutex.unlock();
 			}
 
 			complete();
@@ -97,6 +117,7 @@ private:
 
 		FutexRealm *realm_;
 		FutexIdentity id_;
+		std::atomic<Bucket *> bucket_;
 		frg::optional<Error> result_; // Set after completion.
 		async::cancellation_observer<frg::bound_mem_fn<&Node::cancel_>> cobs_;
 		frg::default_list_hook<Node> queueHook_;
@@ -113,12 +134,51 @@ private:
 		> queue;
 	};
 
-public:
-	FutexRealm()
-	: _slots{FutexIdentity::Hash{}, *kernelAlloc} { }
+	using Mutex = StatSpinlock<"futex">;
 
+	using NodeList = frg::intrusive_list<
+		Node,
+		frg::locate_member<
+			Node,
+			frg::default_list_hook<Node>,
+			&Node::queueHook_
+		>
+	>;
+
+	// Futexes are distributed over a fixed number of buckets, each with its own lock.
+	// Unrelated futexes thus only contend if they hash to the same bucket.
+	struct Bucket {
+		Bucket()
+		: slots{FutexIdentity::Hash{}, *kernelAlloc} { }
+
+		Mutex mutex;
+
+		frg::hash_map<
+			FutexIdentity,
+			Slot,
+			FutexIdentity::Hash,
+			KernelAlloc
+		> slots;
+	};
+
+	static constexpr size_t numBuckets = 64;
+
+	Bucket *_bucketOf(FutexIdentity id) {
+		// Use the high bits of the hash; the hash maps inside the buckets use the low bits.
+		auto h = FutexIdentity::Hash{}(id);
+		return &_buckets[(h >> 32) % numBuckets];
+	}
+
+public:
 	bool empty() {
-		return _slots.empty();
+		for(size_t i = 0; i < numBuckets; i++) {
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_buckets[i].mutex);
+
+			if(!_buckets[i].slots.empty())
+				return false;
+		}
+		return true;
 	}
 
 	// ----------------------------------------------------------------------------------
@@ -143,8 +203,11 @@ public:
 			F f = std::move(f_);
 
 			auto fastPath = [&] {
+				// No concurrent requeue() can happen before the node is inserted.
+				auto bucket = bucket_.load(std::memory_order_relaxed);
+
 				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&realm_->_mutex);
+				auto lock = frg::guard(&bucket->mutex);
 
 				if(f.read() != expected_) {
 					result_ = Error::futexRace;
@@ -156,10 +219,10 @@ public:
 					return true;
 				}
 
-				auto sit = realm_->_slots.get(id_);
+				auto sit = bucket->slots.get(id_);
 				if(!sit) {
-					realm_->_slots.insert(id_, Slot());
-					sit = realm_->_slots.get(id_);
+					bucket->slots.insert(id_, Slot());
+					sit = bucket->slots.get(id_);
 				}
 
 				assert(!queueHook_.in_list);
@@ -214,60 +277,129 @@ public:
 
 	// ----------------------------------------------------------------------------------
 
-	void wake(FutexIdentity id) {
-		frg::intrusive_list<
-			Node,
-			frg::locate_member<
-				Node,
-				frg::default_list_hook<Node>,
-				&Node::queueHook_
-			>
-		> pending;
+	// Wakes up to count waiters of the futex. Returns the number of woken waiters.
+	size_t wake(FutexIdentity id, size_t count = static_cast<size_t>(-1)) {
+		NodeList pending;
+		size_t numWoken = 0;
+		{
+			auto bucket = _bucketOf(id);
+
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&bucket->mutex);
+
+			numWoken = _wakeLocked(bucket, id, count, pending);
+		}
+
+		while(!pending.empty()) {
+			auto node = pending.pop_front();
+			node->complete();
+		}
+		return numWoken;
+	}
+
+	// Wakes up to wakeCount waiters of the futex and moves up to requeueCount of the
+	// remaining waiters to the target futex, without waking them.
+	// Returns the number of woken and moved waiters.
+	// Fails with Error::futexRace if the futex does not match the expected value.
+	// This allows condition variables to avoid thundering herds on broadcasts.
+	template<Futex F>
+	frg::expected<Error, size_t> requeue(F f, unsigned int expected, FutexIdentity target,
+			size_t wakeCount, size_t requeueCount) {
+		auto id = f.getIdentity();
+		auto bucket = _bucketOf(id);
+		auto targetBucket = _bucketOf(target);
+
+		NodeList pending;
+		Error error = Error::success;
+		size_t numAffected = 0;
 		{
 			auto irqLock = frg::guard(&irqMutex());
-			auto lock = frg::guard(&_mutex);
-
-			auto sit = _slots.get(id);
-			if(!sit)
-				return;
-			// Invariant: If the slot exists then its queue is not empty.
-			assert(!sit->queue.empty());
-
-			// TODO: Enable users to only wake a certain number of waiters.
-			while(!sit->queue.empty()) {
-				auto node = sit->queue.front();
-				assert(!node->result_);
-				sit->queue.pop_front();
-
-				node->result_ = Error::success;
-				if(node->cobs_.try_reset()) {
-					pending.push_back(node);
+
+			// Take both locks in a consistent order to avoid deadlocks.
+			if(bucket == targetBucket) {
+				bucket->mutex.lock();
+			}else if(bucket < targetBucket) {
+				bucket->mutex.lock();
+				targetBucket->mutex.lock();
+			}else{
+				targetBucket->mutex.lock();
+				bucket->mutex.lock();
+			}
+
+			if(f.read() != expected) {
+				error = Error::futexRace;
+			}else{
+				numAffected = _wakeLocked(bucket, id, wakeCount, pending);
+
+				auto sit = bucket->slots.get(id);
+				if(sit && requeueCount && target != id) {
+					auto tit = targetBucket->slots.get(target);
+					if(!tit) {
+						targetBucket->slots.insert(target, Slot());
+						tit = targetBucket->slots.get(target);
+						// Insertion may invalidate pointers into the same hash map.
+						sit = bucket->slots.get(id);
+					}
+
+					size_t numRequeued = 0;
+					while(!sit->queue.empty() && numRequeued < requeueCount) {
+						auto node = sit->queue.pop_front();
+						assert(!node->result_);
+						node->id_ = target;
+						node->bucket_.store(targetBucket, std::memory_order_relaxed);
+						tit->queue.push_back(node);
+						numRequeued++;
+					}
+					numAffected += numRequeued;
+
+					if(sit->queue.empty())
+						bucket->slots.remove(id);
 				}
 			}
 
-			if(sit->queue.empty())
-				_slots.remove(id);
+			if(bucket != targetBucket)
+				targetBucket->mutex.unlock();
+			bucket->mutex.unlock();
 		}
 
+		f.retire();
+
 		while(!pending.empty()) {
 			auto node = pending.pop_front();
 			node->complete();
 		}
+		if(error != Error::success)
+			return error;
+		return numAffected;
 	}
 
 private:
-	using Mutex = frg::ticket_spinlock;
-
-	// TODO: use a scalable hash table with fine-grained locks to
-	// improve the scalability of the futex algorithm.
-	Mutex _mutex;
-
-	frg::hash_map<
-		FutexIdentity,
-		Slot,
-		FutexIdentity::Hash,
-		KernelAlloc
-	> _slots;
+	size_t _wakeLocked(Bucket *bucket, FutexIdentity id, size_t count, NodeList &pending) {
+		auto sit = bucket->slots.get(id);
+		if(!sit)
+			return 0;
+		// Invariant: If the slot exists then its queue is not empty.
+		assert(!sit->queue.empty());
+
+		size_t numWoken = 0;
+		while(!sit->queue.empty() && numWoken < count) {
+			auto node = sit->queue.front();
+			assert(!node->result_);
+			sit->queue.pop_front();
+
+			node->result_ = Error::success;
+			if(node->cobs_.try_reset()) {
+				pending.push_back(node);
+			}
+			numWoken++;
+		}
+
+		if(sit->queue.empty())
+			bucket->slots.remove(id);
+		return numWoken;
+	}
+
+	Bucket _buckets[numBuckets];
 };
 
 } // namespace thor
@@ -4,6 +4,7 @@
 #include <frg/expected.hpp>
 #include <frg/list.hpp>
 #include <frg/string.hpp>
+#include <frg/vector.hpp>
 #include <thor-internal/error.hpp>
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/kernlet.hpp>
@@ -153,6 +154,7 @@ private:
 	static constexpr int maskedForService = 1;
 	static constexpr int maskedWhileBuffered = 2;
 	static constexpr int maskedForNack = 4;
+	static constexpr int maskedForStorm = 8;
 
 public:
 	static void attachSink(IrqPin *pin, IrqSink *sink);
@@ -160,6 +162,21 @@ public:
 	static Error nackSink(IrqSink *sink, uint64_t sequence);
 	static Error kickSink(IrqSink *sink, bool wantClear);
 
+	// Counters since the pin was created. Latencies are in nanoseconds and measured
+	// from the start of service until an asynchronous (i.e., user space) ACK.
+	struct Statistics {
+		uint64_t raises = 0;
+		uint64_t maskedRaises = 0;
+		uint64_t acks = 0;
+		uint64_t nacks = 0;
+		uint64_t storms = 0;
+		uint64_t totalAckLatency = 0;
+		uint64_t maxAckLatency = 0;
+	};
+
+	// Returns all pins. IrqPins are never destroyed, so the pointers stay valid.
+	static frg::vector<IrqPin *, KernelAlloc> allPins();
+
 public:
 	IrqPin(frg::string<KernelAlloc> name);
 
@@ -181,10 +198,15 @@ private:
 	void _nack();
 	void _kick(bool doClear);
 	void _dispatch();
+	void _countAck();
 
 public:
 	void warnIfPending();
 
+	Statistics getStatistics();
+
+	frg::default_list_hook<IrqPin> allPinsHook;
+
 	virtual void dumpHardwareState();
 
 protected:
@@ -229,9 +251,19 @@ private:
 	bool _warnedAfterPending;
 
 	// Unstall logic to unmask an IRQ periodically after NACK.
+	// The same logic unmasks level-triggered IRQs that were throttled as storms.
 	int _unstallExponent = 0;
 	async::recurring_event _unstallEvent;
 
+	// Unacked raises in the current storm detection window.
+	uint64_t _stormWindowStart = 0;
+	unsigned int _stormWindowRaises = 0;
+
+	// Whether a sink acked the most recent service (as opposed to kicking or nacking it).
+	bool _lastServiceAcked = true;
+
+	Statistics _stats;
+
 	// TODO: This list should change rarely. Use a RCU list.
 	frg::intrusive_list<
 		IrqSink,
@@ -250,6 +282,10 @@ struct MsiPin : IrqPin {
 	virtual uint64_t getMessageAddress() = 0;
 	virtual uint32_t getMessageData() = 0;
 
+	// Routes the MSI to the given CPU; the device has to be reprogrammed afterwards.
+	// Returns false (and keeps the old target) if the CPU cannot be targeted.
+	virtual bool setAffinity(size_t cpu) { (void)cpu; return false; }
+
 protected:
 	~MsiPin() = default;
 };
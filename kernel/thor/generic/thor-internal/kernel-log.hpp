@@ -1,11 +1,17 @@
 #pragma once
 
+#include <smarter.hpp>
 #include <thor-internal/ring-buffer.hpp>
 
 namespace thor {
 
+struct MemoryView;
+
 void initializeLog();
 
 LogRingBuffer *getGlobalLogRing();
 
+// Memory that contains the HelLogRingHeader and the storage of the global log ring.
+smarter::shared_ptr<MemoryView> getGlobalLogRingMemory();
+
 } // namespace thor
@@ -44,6 +44,14 @@ struct UniqueKernelStack {
 		return _base;
 	}
 
+	// Bounds [lowerBound(), upperBound()) of the memory that backs the stack.
+	uintptr_t lowerBound() {
+		return upperBound() - kSize;
+	}
+	uintptr_t upperBound() {
+		return reinterpret_cast<uintptr_t>(_top());
+	}
+
 	template<typename T, typename... Args>
 	T *embed(Args &&... args) {
 		// TODO: Do not use a magic number as stack alignment here.
@@ -60,7 +68,19 @@ private:
 	explicit UniqueKernelStack(char *base)
 	: _base(base) { }
 
+	// Returns the top of the stack, i.e., _base before any embed() calls.
+	char *_top();
+
 	char *_base;
 };
 
+// Per-CPU cache of kernel stacks that are still mapped (including their guard page).
+// Only accessed by the owning CPU with IRQs disabled.
+struct KernelStackCpuCache {
+	static constexpr int capacity = 8;
+
+	int numStacks = 0;
+	char *stacks[capacity];
+};
+
 } // namespace thor
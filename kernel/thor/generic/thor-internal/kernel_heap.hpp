@@ -6,6 +6,7 @@
 #include <frg/manual_box.hpp>
 #include <physical-buddy.hpp>
 #include <thor-internal/arch/stack.hpp>
+#include <thor-internal/lockstat.hpp>
 
 namespace thor {
 
@@ -16,11 +17,11 @@ struct IrqSpinlock {
 	void unlock();
 
 private:
-	frg::ticket_spinlock _spinlock;
+	StatSpinlock<"kernel-heap"> _spinlock;
 };
 
 struct KernelVirtualMemory {
-	using Mutex = frg::ticket_spinlock;
+	using Mutex = StatSpinlock<"kernel-virtual-memory">;
 public:
 	static KernelVirtualMemory &global();
 
@@ -65,16 +66,55 @@ public:
 	void output_trace(void *buffer, size_t size);
 };
 
-using KernelAlloc = frg::slab_allocator<KernelVirtualAlloc, IrqSpinlock>;
+using KernelSlabPool = frg::slab_pool<KernelVirtualAlloc, IrqSpinlock>;
+
+struct HeapMagazine;
+
+// Per-CPU state of the magazine layer in front of the kernel heap.
+// Each small size class has a loaded and a previous magazine (following Bonwick's design);
+// both are only accessed by the owning CPU with IRQs disabled.
+struct HeapCpuCache {
+	// Size classes are powers of two from 16 to 512 bytes.
+	static constexpr int minShift = 4;
+	static constexpr int numClasses = 6;
+
+	struct Slot {
+		HeapMagazine *loaded = nullptr;
+		HeapMagazine *previous = nullptr;
+	};
+
+	Slot slots[numClasses];
+
+	// Number of allocations until KFENCE samples the next one.
+	unsigned int kfenceCountdown = 0;
+};
+
+// Allocator front-end for kernelHeap.
+// Small allocations are served from per-CPU magazines without taking the heap lock;
+// full and empty magazines are exchanged with a global per-class depot.
+class KernelAlloc {
+public:
+	constexpr KernelAlloc(KernelSlabPool *pool)
+	: pool_{pool} { }
+
+	void *allocate(size_t size);
+	void deallocate(void *pointer, size_t size);
+	void *reallocate(void *pointer, size_t size);
+	void free(void *pointer);
+
+	KernelSlabPool *get_pool() const {
+		return pool_;
+	}
+
+	bool operator== (const KernelAlloc &other) const = default;
+
+private:
+	KernelSlabPool *pool_;
+};
 
 extern constinit frg::manual_box<KernelVirtualAlloc> kernelVirtualAlloc;
 
-extern constinit frg::manual_box<
-	frg::slab_pool<
-		KernelVirtualAlloc,
-		IrqSpinlock
-	>
-> kernelHeap;
+extern constinit frg::manual_box<KernelSlabPool> kernelHeap;
 
 extern constinit frg::manual_box<KernelAlloc> kernelAlloc;
 
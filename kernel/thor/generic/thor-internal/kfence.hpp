@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace thor {
+
+// Sampling detector for heap memory errors (modeled after Linux' KFENCE).
+//
+// Unlike KASAN, this is cheap enough to be enabled in production builds:
+// only every kfenceSampleInterval-th allocation (per CPU) is redirected to a small pool
+// of pages that are separated by unmapped guard pages. Sampled objects are placed at
+// the end of their page such that overflows fault on the next guard page; the remaining
+// bytes of the page are filled with canaries that are validated on free.
+// Freed pages are unmapped, thus use-after-free also faults.
+// Detected errors are reported together with the allocation and free stacks; then we panic.
+
+#ifdef THOR_KFENCE
+
+extern constinit uintptr_t kfencePoolBase;
+extern constinit uintptr_t kfencePoolLimit;
+
+inline bool isKfenceObject(const void *pointer) {
+	auto address = reinterpret_cast<uintptr_t>(pointer);
+	return address >= kfencePoolBase && address < kfencePoolLimit;
+}
+
+// Returns a guarded object if this allocation is sampled and nullptr otherwise.
+void *kfenceSampleAllocate(size_t size);
+
+void kfenceFree(void *pointer);
+
+size_t kfenceObjectSize(void *pointer);
+
+// Called on page faults in kernel mode. Reports the error and panics
+// if the fault occurred within the KFENCE pool; otherwise, this returns.
+void handleKfenceFault(uintptr_t address, bool write, uintptr_t ip);
+
+#endif // THOR_KFENCE
+
+} // namespace thor
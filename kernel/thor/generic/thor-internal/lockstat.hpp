@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <frg/spinlock.hpp>
+
+namespace thor {
+
+uint64_t getRawTimestampCounter();
+
+// Name of a lock class. This is a structural type such that it can be a template argument.
+template<size_t N>
+struct LockClassName {
+	constexpr LockClassName(const char (&s)[N]) {
+		for(size_t i = 0; i < N; i++)
+			str[i] = s[i];
+	}
+
+	char str[N];
+};
+
+// Statistics of all locks of a class. Times are in ticks of getRawTimestampCounter().
+struct LockClass {
+	constexpr LockClass(const char *name)
+	: name{name} { }
+
+	LockClass(const LockClass &) = delete;
+
+	LockClass &operator= (const LockClass &) = delete;
+
+	// Adds the class to the list returned by allLockClasses() on its first use.
+	void ensureRegistered() {
+		if(registered_.load(std::memory_order_acquire))
+			return;
+		if(registered_.exchange(true, std::memory_order_acq_rel))
+			return;
+		next_ = head_().load(std::memory_order_relaxed);
+		while(!head_().compare_exchange_weak(next_, this,
+				std::memory_order_release, std::memory_order_relaxed))
+			;
+	}
+
+	void recordAcquisition(bool contended, uint64_t spin) {
+		ensureRegistered();
+		acquisitions.fetch_add(1, std::memory_order_relaxed);
+		if(!contended)
+			return;
+		contendedAcquisitions.fetch_add(1, std::memory_order_relaxed);
+		totalSpinTime.fetch_add(spin, std::memory_order_relaxed);
+		updateMax_(maxSpinTime, spin);
+	}
+
+	void recordRelease(uint64_t hold) {
+		totalHoldTime.fetch_add(hold, std::memory_order_relaxed);
+		updateMax_(maxHoldTime, hold);
+	}
+
+	LockClass *nextClass() {
+		return next_;
+	}
+
+	static LockClass *firstClass() {
+		return head_().load(std::memory_order_acquire);
+	}
+
+	const char *name;
+	std::atomic<uint64_t> acquisitions{0};
+	std::atomic<uint64_t> contendedAcquisitions{0};
+	std::atomic<uint64_t> totalSpinTime{0};
+	std::atomic<uint64_t> maxSpinTime{0};
+	std::atomic<uint64_t> totalHoldTime{0};
+	std::atomic<uint64_t> maxHoldTime{0};
+
+private:
+	static std::atomic<LockClass *> &head_() {
+		static constinit std::atomic<LockClass *> head{nullptr};
+		return head;
+	}
+
+	static void updateMax_(std::atomic<uint64_t> &max, uint64_t value) {
+		auto current = max.load(std::memory_order_relaxed);
+		while(current < value && !max.compare_exchange_weak(current, value,
+				std::memory_order_relaxed, std::memory_order_relaxed))
+			;
+	}
+
+	std::atomic<bool> registered_{false};
+	LockClass *next_{nullptr};
+};
+
+#ifdef THOR_LOCKSTAT
+
+// Ticket spinlock that accounts its acquisitions to a LockClass.
+// Like frg::ticket_spinlock, this does not disable IRQs.
+template<LockClassName Name>
+struct StatSpinlock {
+	constexpr StatSpinlock() = default;
+
+	StatSpinlock(const StatSpinlock &) = delete;
+
+	StatSpinlock &operator= (const StatSpinlock &) = delete;
+
+	void lock() {
+		auto ticket = nextTicket_.fetch_add(1, std::memory_order_relaxed);
+		bool contended = false;
+		uint64_t spin = 0;
+		if(servingTicket_.load(std::memory_order_acquire) != ticket) {
+			contended = true;
+			auto start = getRawTimestampCounter();
+			while(servingTicket_.load(std::memory_order_acquire) != ticket)
+				relax_();
+			spin = getRawTimestampCounter() - start;
+		}
+		acquiredAt_ = getRawTimestampCounter();
+		lockClass.recordAcquisition(contended, spin);
+	}
+
+	void unlock() {
+		lockClass.recordRelease(getRawTimestampCounter() - acquiredAt_);
+		auto ticket = servingTicket_.load(std::memory_order_relaxed);
+		servingTicket_.store(ticket + 1, std::memory_order_release);
+	}
+
+	static inline constinit LockClass lockClass{Name.str};
+
+private:
+	static void relax_() {
+#if defined(__x86_64__)
+		asm volatile ("pause");
+#elif defined(__aarch64__)
+		asm volatile ("yield");
+#endif
+	}
+
+	std::atomic<uint32_t> nextTicket_{0};
+	std::atomic<uint32_t> servingTicket_{0};
+	uint64_t acquiredAt_{0};
+};
+
+#else // THOR_LOCKSTAT
+
+// Without lockstat, lock classes have no overhead.
+template<LockClassName Name>
+using StatSpinlock = frg::ticket_spinlock;
+
+#endif // THOR_LOCKSTAT
+
+} // namespace thor
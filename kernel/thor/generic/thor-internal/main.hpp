@@ -1,11 +1,20 @@
 #pragma once
 
+#include <async/recurring-event.hpp>
 #include <initgraph.hpp>
+#include <thor-internal/kernel-locks.hpp>
 
 namespace thor {
 
 struct GlobalInitEngine : public initgraph::Engine {
 	virtual ~GlobalInitEngine() = default;
+
+	// Lets run() activate concurrent tasks on fibers spread across all CPUs.
+	// Must only be called once run() itself is called from a fiber.
+	void enableParallelActivation() {
+		parallel_ = true;
+	}
+
 protected:
 	void onRealizeNode(initgraph::Node *node) override;
 	void onRealizeEdge(initgraph::Edge *node) override;
@@ -13,6 +22,21 @@ protected:
 	void postActivate(initgraph::Node *node) override;
 	void reportUnreached(initgraph::Node *node) override;
 	void onUnreached() override;
+	bool dispatchActivation(initgraph::Node *node) override;
+	initgraph::Node *waitForActivation() override;
+
+private:
+	static constexpr size_t maxDispatched = 32;
+
+	bool parallel_ = false;
+	size_t nextCpu_ = 0;
+	size_t numDispatched_ = 0;
+
+	// Protects completed_ and numCompleted_.
+	frg::ticket_spinlock mutex_;
+	initgraph::Node *completed_[maxDispatched] = {};
+	size_t numCompleted_ = 0;
+	async::recurring_event completionEvent_;
 };
 
 extern GlobalInitEngine globalInitEngine;
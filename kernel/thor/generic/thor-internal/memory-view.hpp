@@ -14,6 +14,8 @@
 #include <thor-internal/futex.hpp>
 #include <thor-internal/types.hpp>
 #include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/page-merging.hpp>
+#include <thor-internal/swap.hpp>
 
 namespace thor {
 
@@ -23,6 +25,13 @@ enum class ManageRequest {
 	writeback
 };
 
+enum class MemoryAdvice {
+	null,
+	// Pages of the range may be merged with identical pages (see page-merging.hpp).
+	mergeable,
+	unmergeable
+};
+
 struct Mapping;
 struct AddressSpace;
 struct AddressSpaceLockHandle;
@@ -30,6 +39,7 @@ struct FaultNode;
 struct MemoryReclaimer;
 
 struct CacheBundle;
+struct ReclaimCpuBatch;
 
 struct CachePage {
 	// Page is registered with the reclaim mechanism.
@@ -50,6 +60,18 @@ struct CachePage {
 	frg::default_list_hook<CachePage> listHook;
 
 	uint32_t flags = 0;
+
+	// Index of the LRU generation that this page is part of.
+	uint32_t generation = 0;
+
+	// Per-CPU batch that this page is queued in before it enters the LRU.
+	// Protected by the mutex of the batch; may be read without holding the mutex.
+	std::atomic<ReclaimCpuBatch *> batch{nullptr};
+	int batchIndex = 0;
+
+	// Set when the page is accessed. The reclaimer does not evict referenced pages;
+	// instead, it clears this flag and moves the page to the youngest generation.
+	std::atomic<bool> referenced{false};
 };
 
 // This is the "backend" part of a memory object.
@@ -171,6 +193,17 @@ public:
 using FetchFlags = uint32_t;
 inline constexpr FetchFlags fetchDisallowBacking = 1;
 
+// Result of MemoryView::queryPageUsage(). Only used for memory accounting.
+using PageUsage = uint32_t;
+// The page is backed by physical memory of the view.
+inline constexpr PageUsage pageUsagePresent = 1;
+// The page is not backed by a file (i.e., it is not part of the page cache).
+inline constexpr PageUsage pageUsageAnonymous = 2;
+// The page belongs to a single view (e.g., it is a private copy).
+inline constexpr PageUsage pageUsagePrivate = 4;
+// The page was loaded before but it has been evicted since.
+inline constexpr PageUsage pageUsageEvicted = 8;
+
 struct RangeToEvict {
 	uintptr_t offset;
 	size_t size;
@@ -316,11 +349,36 @@ public:
 	// Marks a range of pages as dirty.
 	virtual void markDirty(uintptr_t offset, size_t size) = 0;
 
+	// Marks a range of pages as recently accessed (e.g., by the accessed bits of page tables).
+	// This is only a hint for the reclaim mechanism.
+	virtual void markAccessed(uintptr_t offset, size_t size);
+
+	// Returns a page that read faults may map (read-only) at the given offset instead of
+	// fetching the page, e.g., the global zero page for untouched memory; otherwise,
+	// returns PhysicalAddr(-1). The first write then faults again and fetches the page.
+	// Only valid while the caller prevents eviction (e.g., by holding the evictionMutex).
+	virtual PhysicalAddr peekSharedPage(uintptr_t offset);
+
+	// Classifies the page at the given offset for memory accounting.
+	// In contrast to peekRange(), this does not affect eviction.
+	// The default implementation reports all pages as not present.
+	virtual PageUsage queryPageUsage(uintptr_t offset);
+
+	// Makes the physical page the backing page at the given offset (which takes ownership
+	// of the page) and marks it as dirty. This avoids a copy when the contents of a page
+	// are moved into this view. Fails (i.e., returns false) if the page at the offset is
+	// already backed. The default implementation always fails.
+	// May be called with locks held.
+	virtual bool donatePage(uintptr_t offset, PhysicalAddr physical);
+
 	virtual void submitManage(ManageNode *handle);
 
 	// Called (e.g. by user space) to update a range after loading or writeback.
 	virtual Error updateRange(ManageRequest type, size_t offset, size_t length);
 
+	// Called by user space to hint at how a range is used.
+	virtual Error adviseRange(MemoryAdvice advice, uintptr_t offset, size_t size);
+
 	virtual Error setIndirection(size_t slot, smarter::shared_ptr<MemoryView> view,
 			uintptr_t offset, size_t size);
 
@@ -694,6 +752,15 @@ private:
 
 smarter::shared_ptr<MemoryView> getZeroMemory();
 
+// Returns a global page of zeros. This page must only ever be mapped read-only.
+PhysicalAddr getZeroPage();
+
+// Number of dirty pages of all managed memory objects (including pages under writeback).
+size_t numDirtyPages();
+
+// Number of pages of all managed memory objects that are currently being written back.
+size_t numWritebackPages();
+
 // Memory that is allocated by the kernel and never swapped out.
 // In contrast to most other memory objects, it can be accessed synchronously.
 struct ImmediateMemory final : MemoryView, GlobalFutexSpace {
@@ -790,9 +857,18 @@ private:
 	CachingMode _cacheMode;
 };
 
+struct ZswapEntry;
+
 struct AllocatedMemory final : MemoryView, GlobalFutexSpace {
+	friend struct AnonymousSwapper;
+
+	// numaNode is the preferred NUMA node of the memory; -1 selects the node of
+	// the CPU that first touches each chunk.
+	// If swappable is set, cold pages are compressed into the zswap pool (or written to
+	// the swap device) under memory pressure. This is only supported for memory that consists of unrestricted 4 KiB chunks.
 	AllocatedMemory(size_t length, int addressBits = 64,
-			size_t chunkSize = kPageSize, size_t chunkAlign = kPageSize);
+			size_t chunkSize = kPageSize, size_t chunkAlign = kPageSize, int numaNode = -1,
+			bool swappable = false);
 	AllocatedMemory(const AllocatedMemory &) = delete;
 	~AllocatedMemory();
 
@@ -809,6 +885,7 @@ struct AllocatedMemory final : MemoryView, GlobalFutexSpace {
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	PageUsage queryPageUsage(uintptr_t offset) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
@@ -818,11 +895,50 @@ public:
 	// Contract: set by the code that constructs this object.
 	smarter::borrowed_ptr<AllocatedMemory> selfPtr;
 private:
+	// Reclaim state of a page of swappable memory.
+	struct AnonPage {
+		AnonPage(AllocatedMemory *memory, CacheBundle *bundle, uint64_t index)
+		: memory{memory} {
+			cachePage.bundle = bundle;
+			cachePage.identity = index;
+		}
+
+		AnonPage(const AnonPage &) = delete;
+
+		AnonPage &operator= (const AnonPage &) = delete;
+
+		AllocatedMemory *memory;
+		unsigned int lockCount = 0;
+		// Set while the page is unmapped for swap-out. Accessing the page clears this flag,
+		// which cancels the swap-out.
+		bool swappingOut = false;
+		// Set while the page is read back from the swap device.
+		bool swappingIn = false;
+		// Compressed contents of the page while it is swapped out to zswap.
+		ZswapEntry *swapped = nullptr;
+		// Swap slot that holds the page while it is swapped out to the swap device.
+		uint64_t swapSlot = noSwapSlot;
+		CachePage cachePage;
+	};
+
+	AnonPage *_findOrInsertAnonPage(size_t index);
+
+	coroutine<frg::expected<Error, PhysicalRange>>
+			_fetchAnonPage(uintptr_t offset, smarter::shared_ptr<WorkQueue> wq);
+
 	frg::ticket_spinlock _mutex;
 
 	frg::vector<PhysicalAddr, KernelAlloc> _physicalChunks;
 	int _addressBits;
 	size_t _chunkSize, _chunkAlign;
+	int _numaNode;
+
+	bool _swappable;
+	// Only populated for swappable memory.
+	frg::rcu_radixtree<AnonPage, KernelAlloc> _anonPages;
+	EvictionQueue _evictQueue;
+	// Raised when a page is swapped in from the swap device.
+	async::recurring_event _swapInEvent;
 };
 
 struct ManagedSpace : CacheBundle {
@@ -850,6 +966,10 @@ struct ManagedSpace : CacheBundle {
 		PhysicalAddr physical = PhysicalAddr(-1);
 		LoadState loadState = kStateMissing;
 		unsigned int lockCount = 0;
+		// Time (in nanoseconds) at which the page entered kStateWantWriteback.
+		uint64_t dirtyTime = 0;
+		// Set once the page has been evicted (for memory accounting).
+		bool wasEvicted = false;
 		CachePage cachePage;
 	};
 
@@ -887,6 +1007,8 @@ struct ManagedSpace : CacheBundle {
 
 	void submitManagement(ManageNode *node);
 	void submitMonitor(MonitorNode *node);
+	void _queueWriteback(ManagedPage *pit, uint64_t now);
+	bool _isWritebackUrgent();
 	void _progressManagement(ManageList &pending);
 	void _progressMonitors(MonitorList &pending);
 
@@ -922,6 +1044,16 @@ struct ManagedSpace : CacheBundle {
 	ManageList _managementQueue;
 	MonitorList _monitorQueue;
 
+	// Number of pages in one of the writeback states.
+	size_t _numDirty = 0;
+	// Number of pages in kStateWriteback or kStateAnotherWriteback.
+	size_t _numWriteback = 0;
+
+	// Time at which the oldest dirty page expires (or zero if no expiration is pending).
+	// Raising _writebackEvent notifies the expiration timer.
+	uint64_t _writebackDeadline = 0;
+	async::recurring_event _writebackEvent;
+
 	DeferredWork<DeferredManagement> _deferredManagement{{this}};
 };
 
@@ -971,6 +1103,9 @@ public:
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	void markAccessed(uintptr_t offset, size_t size) override;
+	PageUsage queryPageUsage(uintptr_t offset) override;
+	bool donatePage(uintptr_t offset, PhysicalAddr physical) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
@@ -1000,6 +1135,7 @@ struct IndirectMemory final : MemoryView {
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	PageUsage queryPageUsage(uintptr_t offset) override;
 
 	Error setIndirection(size_t slot, smarter::shared_ptr<MemoryView> memory,
 			uintptr_t offset, size_t size) override;
@@ -1032,11 +1168,17 @@ struct CowChain {
 // TODO: Either this private again or make this class POD-like.
 	frg::ticket_spinlock _mutex;
 
+	// Number of CopyOnWriteMemory objects and CowChains that directly refer to this chain.
+	// If only a single CopyOnWriteMemory remains, it can absorb the chain.
+	std::atomic<unsigned int> _numUsers{0};
+
 	smarter::shared_ptr<CowChain> _superChain;
 	frg::rcu_radixtree<std::atomic<PhysicalAddr>, KernelAlloc> _pages;
 };
 
 struct CopyOnWriteMemory final : MemoryView, GlobalFutexSpace /*, MemoryObserver */ {
+	friend struct PageMerger;
+
 public:
 	CopyOnWriteMemory(smarter::shared_ptr<MemoryView> view,
 			uintptr_t offset, size_t length,
@@ -1060,6 +1202,9 @@ public:
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	PhysicalAddr peekSharedPage(uintptr_t offset) override;
+	PageUsage queryPageUsage(uintptr_t offset) override;
+	Error adviseRange(MemoryAdvice advice, uintptr_t offset, size_t size) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
@@ -1079,17 +1224,52 @@ private:
 		PhysicalAddr physical = -1;
 		CowState state = CowState::null;
 		unsigned int lockCount = 0;
+		// Set while the page is unmapped for merging. Accessing the page clears this flag,
+		// which cancels the merge.
+		bool merging = false;
+		// Hash of the page contents as of the last scan (see PageMerger).
+		uint64_t lastHash = 0;
+	};
+
+	// Page that was merged into a stable page. Merged pages are not in _ownedPages.
+	struct MergedPage {
+		MergedPage(StablePage *stable)
+		: stable{stable} { }
+
+		StablePage *stable;
 	};
 
+	// Moves the pages of CowChains that are only used by this object into _ownedPages.
+	// Called with _mutex held.
+	void _collapseChain();
+
+	bool _isMergeable(size_t index) {
+		return index / 64 < _mergeableBits.size()
+				&& (_mergeableBits[index / 64] & (uint64_t{1} << (index % 64)));
+	}
+
 	frg::ticket_spinlock _mutex;
 
 	smarter::shared_ptr<MemoryView> _view;
 	uintptr_t _viewOffset;
 	size_t _length;
+	bool _viewIsZero;
 	smarter::shared_ptr<CowChain> _copyChain;
 	frg::rcu_radixtree<CowPage, KernelAlloc> _ownedPages;
+	// Number of pages in _ownedPages that are in CowState::inProgress.
+	// While copies are in progress, the chain must not be collapsed.
+	unsigned int _numCopiesInProgress = 0;
 	async::recurring_event _copyEvent;
 	EvictionQueue _evictQueue;
+
+	frg::rcu_radixtree<MergedPage, KernelAlloc> _mergedPages;
+	// Bit i is set if page i may be merged. Empty unless the memory was advised.
+	frg::vector<uint64_t, KernelAlloc> _mergeableBits;
+	// Protected by the PageMerger's lock.
+	bool _mergeRegistered = false;
+	frg::default_list_hook<CopyOnWriteMemory> _mergeHook;
+	// Next page that the PageMerger scans. Only accessed by the PageMerger.
+	size_t _mergeCursor = 0;
 };
 
 // --------------------------------------------------------------------------------------
@@ -1140,6 +1320,17 @@ struct GlobalFutex {
 		return __atomic_load_n(accessPtr, __ATOMIC_RELAXED);
 	}
 
+	// Used by PI futexes which are also modified by the kernel.
+	// On failure, expected is updated to the current value.
+	bool compareExchange(unsigned int &expected, unsigned int desired) {
+		PageAccessor accessor{physical_};
+		auto offsetOfWord = offset_ & (kPageSize - 1);
+		auto accessPtr = reinterpret_cast<unsigned int *>(
+				reinterpret_cast<std::byte *>(accessor.get()) + offsetOfWord);
+		return __atomic_compare_exchange_n(accessPtr, &expected, desired, false,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+	}
+
 	void retire() {
 		space_->retireGlobalFutex(offset_);
 		space_ = nullptr;
@@ -12,11 +12,15 @@ extern bool wantOsTrace;
 extern std::atomic<bool> osTraceInUse;
 
 enum class OsTraceEventId : uint64_t { };
+enum class OsTraceItemId : uint64_t { };
 
 LogRingBuffer *getGlobalOsTraceRing();
 
 OsTraceEventId announceOsTraceEvent(frg::string_view name);
+OsTraceItemId announceOsTraceItem(frg::string_view name);
 void emitOsTrace(managarm::ostrace::EventRecord<KernelAlloc> record);
+// Emits an event that happened in the past; ts must not be in the future.
+void emitOsTrace(managarm::ostrace::EventRecord<KernelAlloc> record, uint64_t ts);
 
 initgraph::Stage *getOsTraceAvailableStage();
 
@@ -27,6 +31,15 @@ struct OsTraceEvent {
 			rec_.set_id(static_cast<uint64_t>(id));
 	}
 
+	void withCounter(OsTraceItemId id, int64_t value) {
+		if(!live_)
+			return;
+		managarm::ostrace::CounterItem item;
+		item.set_id(static_cast<uint64_t>(id));
+		item.set_value(value);
+		rec_.add_ctrs(std::move(item));
+	}
+
 	void emit() {
 		if(!live_)
 			return;
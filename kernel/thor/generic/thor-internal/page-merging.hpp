@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <thor-internal/types.hpp>
+
+namespace thor {
+
+// Same-page merging of anonymous memory (modeled after Linux' KSM).
+//
+// A background scanner hashes the pages of CopyOnWriteMemory objects that user space
+// marked as mergeable (see helAdviseMemory()). Pages whose hash did not change since the
+// previous scan are candidates; identical candidates are merged into a single stable page
+// that is shared by all of them. Read faults map stable pages read-only; writes break
+// the sharing by copying the page, just like writes to the zero page.
+
+struct CopyOnWriteMemory;
+
+// A page that is shared by multiple CopyOnWriteMemory objects.
+// Stable pages are never written to once they are created.
+struct StablePage {
+	PhysicalAddr physical;
+	uint64_t hash;
+	// Protected by the global merging lock.
+	size_t refCount;
+};
+
+void refStablePage(StablePage *page);
+
+// Frees the page once the last reference is dropped.
+void unrefStablePage(StablePage *page);
+
+// Hash of the page contents that the scanner uses to find candidates.
+uint64_t hashMergeablePage(PhysicalAddr physical);
+
+// Makes the memory known to the scanner. Called when a range of the memory is first
+// marked as mergeable.
+void registerMergeableMemory(CopyOnWriteMemory *memory);
+
+// Must be called before the memory is destructed (if it was registered).
+void unregisterMergeableMemory(CopyOnWriteMemory *memory);
+
+} // namespace thor
@@ -5,6 +5,7 @@
 #include <frg/spinlock.hpp>
 #include <frg/manual_box.hpp>
 #include <physical-buddy.hpp>
+#include <thor-internal/lockstat.hpp>
 #include <thor-internal/types.hpp>
 
 namespace thor {
@@ -25,17 +26,47 @@ public:
 	void *access(PhysicalAddr physical);
 };
 
+// Per-CPU cache of free order-0 pages in front of the PhysicalChunkAllocator.
+// Only accessed by the owning CPU with IRQs disabled.
+struct PhysicalCpuCache {
+	static constexpr int capacity = 64;
+	// Number of pages that are moved from/to the buddy allocator at a time.
+	static constexpr int batch = 32;
+
+	int numPages = 0;
+	PhysicalAddr pages[capacity];
+};
+
 class PhysicalChunkAllocator {
-	typedef frg::ticket_spinlock Mutex;
+	typedef StatSpinlock<"physical"> Mutex;
 public:
+	static constexpr int maxNodes = 8;
+
 	PhysicalChunkAllocator();
 	
 	void bootstrapRegion(PhysicalAddr address,
 			int order, size_t numRoots, int8_t *buddyTree);
 
-	PhysicalAddr allocate(size_t size, int addressBits = 64);
+	// Records that [address, address + length) belongs to a NUMA node.
+	// Each region is assigned to the node that covers the largest part of it.
+	void setRegionNode(PhysicalAddr address, size_t length, int node);
+
+	// Sets the relative distance between two nodes (in SLIT units, i.e., 10 means local).
+	// Allocations that cannot be served by the preferred node fall back to the nearest nodes.
+	void setNodeDistance(int from, int to, int distance);
+
+	// Allocations prefer memory of the given NUMA node; -1 selects the node of the current CPU.
+	PhysicalAddr allocate(size_t size, int addressBits = 64, int node = -1);
 	void free(PhysicalAddr address, size_t size);
 
+	// Allocates a single page that is filled with zeros. Prefers pages from the pool
+	// that is filled in the background; otherwise, the page is zeroed synchronously.
+	PhysicalAddr allocateZeroed(int node = -1);
+
+	// Zeroes a free page and adds it to the pool of pre-zeroed pages.
+	// Returns false if the pool is full or if free memory is scarce.
+	bool produceZeroedPage();
+
 	size_t numTotalPages() {
 		return _totalPages.load(std::memory_order_relaxed);
 	}
@@ -47,17 +78,45 @@ public:
 	}
 
 private:
-	Mutex _mutex;
-
 	struct Region {
 		PhysicalAddr physicalBase;
 		PhysicalAddr regionSize;
 		BuddyAccessor buddyAccessor;
+		int node = 0;
+		// Number of bytes of the region that each node covers.
+		size_t nodeCoverage[maxNodes] = {};
 	};
 
+	// Allocates from the buddy allocators. Prefers regions of the given node.
+	// The caller must hold _mutex.
+	PhysicalAddr _allocateFromRegions(int target, int addressBits, int node);
+
+	// Returns the region that contains [address, address + size) or nullptr.
+	Region *_findRegion(PhysicalAddr address, size_t size);
+
+	// Takes a page from the pre-zeroed pools. Prefers the pool of the given node.
+	// The caller must hold _mutex.
+	PhysicalAddr _takeZeroedPage(int node);
+
+	Mutex _mutex;
+
 	Region _allRegions[8];
 	int _numRegions = 0;
 
+	// Upper bound on the number of pre-zeroed pages per node (8 MiB).
+	static constexpr size_t maxZeroedPages = 2048;
+
+	// Singly linked list of pre-zeroed pages. The link is stored in the first word
+	// of each page; it is cleared again when the page is taken from the list.
+	struct ZeroedPool {
+		PhysicalAddr head = static_cast<PhysicalAddr>(-1);
+		size_t numPages = 0;
+	};
+
+	ZeroedPool _zeroedPools[maxNodes];
+
+	uint8_t _nodeDistances[maxNodes][maxNodes];
+
 	std::atomic<size_t> _totalPages{0};
 	std::atomic<size_t> _usedPages{0};
 	std::atomic<size_t> _freePages{0};
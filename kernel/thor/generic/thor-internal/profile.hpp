@@ -6,7 +6,14 @@ namespace thor {
 
 extern bool wantKernelProfile;
 
+// Each profile record consists of a word that counts the IPs in the record,
+// followed by the sampled IP and the return addresses of the kernel call stack.
+constexpr size_t maxProfileRecordWords = 32;
+
 void initializeProfile();
+// Starts sampling on the current CPU (if profiling is enabled).
+// initializeProfile() does this for the BSP; APs call this after they are initialized.
+void initializeProfileOnThisCpu();
 LogRingBuffer *getGlobalProfileRing();
 
 } // namespace thor
@@ -1,11 +1,25 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 
 namespace thor {
 
 inline constexpr unsigned int entropySrcIrqs = 1;
 
+// Per-CPU ChaCha20 generator that is periodically rekeyed from the global CSPRNG.
+// Only accessed by the owning CPU with IRQs disabled.
+struct RandomCpuPool {
+	uint32_t key[8];
+	uint64_t counter = 0;
+	// Unused output of the last ChaCha20 block; the first 64 - available bytes are consumed.
+	uint8_t block[64];
+	size_t available = 0;
+	// Number of bytes that were generated since the last reseed.
+	size_t sinceReseed = 0;
+	bool seeded = false;
+};
+
 void initializeRandom();
 
 void injectEntropy(unsigned int entropySource, unsigned int seqNum, void *buffer, size_t size);
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <async/oneshot-event.hpp>
+#include <frg/list.hpp>
+#include <frg/spinlock.hpp>
+
+#include <thor-internal/coroutine.hpp>
+#include <thor-internal/kernel-locks.hpp>
+
+namespace thor {
+
+// Async reader/writer lock that protects ranges of addresses instead of a whole object.
+// Requests for disjoint ranges (or shared requests) are granted concurrently.
+// A request waits if it conflicts with a request that is held or that is queued before it;
+// hence, conflicting requests are granted in FIFO order.
+struct RangeMutex {
+	struct Node {
+		friend struct RangeMutex;
+
+		Node(uintptr_t address, size_t length, bool exclusive)
+		: address_{address}, length_{length}, exclusive_{exclusive} { }
+
+		Node(const Node &) = delete;
+
+		Node &operator= (const Node &) = delete;
+
+		uintptr_t address() const {
+			return address_;
+		}
+
+		size_t length() const {
+			return length_;
+		}
+
+	private:
+		bool conflictsWith(const Node *other) const {
+			if(!exclusive_ && !other->exclusive_)
+				return false;
+			return address_ < other->address_ + other->length_
+					&& other->address_ < address_ + length_;
+		}
+
+		uintptr_t address_;
+		size_t length_;
+		bool exclusive_;
+
+		async::oneshot_event grantedEvent_;
+		frg::default_list_hook<Node> hook_;
+		frg::default_list_hook<Node> grantHook_;
+	};
+
+	coroutine<void> lock(Node *node) {
+		bool mustWait = false;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&mutex_);
+
+			for(auto other : held_) {
+				if(node->conflictsWith(other)) {
+					mustWait = true;
+					break;
+				}
+			}
+			for(auto other : waiting_) {
+				if(mustWait)
+					break;
+				if(node->conflictsWith(other))
+					mustWait = true;
+			}
+
+			if(mustWait) {
+				waiting_.push_back(node);
+			}else{
+				held_.push_back(node);
+			}
+		}
+
+		if(mustWait)
+			co_await node->grantedEvent_.wait();
+	}
+
+	void unlock(Node *node) {
+		GrantList granted;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&mutex_);
+
+			held_.erase(held_.iterator_to(node));
+
+			auto it = waiting_.begin();
+			while(it != waiting_.end()) {
+				auto current = it++;
+				auto candidate = *current;
+
+				bool blocked = false;
+				for(auto other : held_) {
+					if(candidate->conflictsWith(other)) {
+						blocked = true;
+						break;
+					}
+				}
+				for(auto other : waiting_) {
+					if(blocked || other == candidate)
+						break;
+					if(candidate->conflictsWith(other))
+						blocked = true;
+				}
+
+				if(blocked)
+					continue;
+
+				waiting_.erase(current);
+				held_.push_back(candidate);
+				granted.push_back(candidate);
+			}
+		}
+
+		// Raise the events outside of the lock since waiters may resume synchronously.
+		while(!granted.empty()) {
+			auto candidate = granted.pop_front();
+			candidate->grantedEvent_.raise();
+		}
+	}
+
+private:
+	using NodeList = frg::intrusive_list<
+		Node,
+		frg::locate_member<
+			Node,
+			frg::default_list_hook<Node>,
+			&Node::hook_
+		>
+	>;
+
+	using GrantList = frg::intrusive_list<
+		Node,
+		frg::locate_member<
+			Node,
+			frg::default_list_hook<Node>,
+			&Node::grantHook_
+		>
+	>;
+
+	frg::ticket_spinlock mutex_;
+
+	NodeList held_;
+	NodeList waiting_;
+};
+
+// RAII wrapper around RangeMutex::Node; the range is released on destruction.
+struct RangeLock {
+	RangeLock(RangeMutex *mutex, uintptr_t address, size_t length, bool exclusive)
+	: mutex_{mutex}, node_{address, length, exclusive} { }
+
+	RangeLock(const RangeLock &) = delete;
+
+	~RangeLock() {
+		if(locked_)
+			mutex_->unlock(&node_);
+	}
+
+	RangeLock &operator= (const RangeLock &) = delete;
+
+	coroutine<void> lock() {
+		assert(!locked_);
+		co_await mutex_->lock(&node_);
+		locked_ = true;
+	}
+
+	void unlock() {
+		assert(locked_);
+		mutex_->unlock(&node_);
+		locked_ = false;
+	}
+
+private:
+	RangeMutex *mutex_;
+	RangeMutex::Node node_;
+	bool locked_ = false;
+};
+
+} // namespace thor
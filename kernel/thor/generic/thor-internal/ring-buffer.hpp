@@ -6,6 +6,7 @@
 #include <async/recurring-event.hpp>
 #include <frg/tuple.hpp>
 #include <frg/utility.hpp>
+#include <hel.h>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/kernel-locks.hpp>
 
@@ -43,14 +44,20 @@ struct LogRingBuffer {
 
 				size_t tailSize;
 				memcpy(&tailSize, buffer_ + tailOffset, sizeof(size_t));
-				assert(tailSize <= ringSize_);
+				// If the ring is shared, user space can corrupt the headers; drop everything then.
+				if(tailSize > ringSize_ - headerSize) {
+					invalPtr = enqPtr;
+					break;
+				}
 
-				invalPtr += effectiveSize(tailSize);
+				invalPtr = frg::min(invalPtr + effectiveSize(tailSize), enqPtr);
 			}
 
 			// Invalidate the ring *before* writing to it.
 			assert(!(invalPtr & (recordAlign - 1)));
 			tailPtr_.store(invalPtr, std::memory_order_release);
+			if(shared_)
+				__atomic_store_n(&shared_->tailPtr, invalPtr, __ATOMIC_RELEASE);
 
 			// Copy to the ring.
 			auto recordOffset = enqPtr & (ringSize_ - 1);
@@ -65,12 +72,30 @@ struct LogRingBuffer {
 			// Commit the operation *after* writing to the ring.
 			auto commitPtr = enqPtr + effectiveSize(recordSize);
 			headPtr_.store(commitPtr, std::memory_order_release);
+			if(shared_)
+				__atomic_store_n(&shared_->headPtr, commitPtr, __ATOMIC_RELEASE);
 		}
 
 		if(!suppressWakeup)
 			event_.raise();
 	}
 
+	// Mirrors the head and tail pointers to a header that is shared with user space.
+	// The storage itself must then be shared, too (see HelLogRingHeader).
+	void shareHeader(HelLogRingHeader *header) {
+		auto irqLock = frg::guard(&thor::irqMutex());
+		auto lock = frg::guard(&mutex_);
+
+		header->tailPtr = tailPtr_.load(std::memory_order_relaxed);
+		header->headPtr = headPtr_.load(std::memory_order_relaxed);
+		header->ringSize = ringSize_;
+		shared_ = header;
+	}
+
+	uint64_t headPtr() {
+		return headPtr_.load(std::memory_order_acquire);
+	}
+
 	void enqueue(char c) {
 		enqueue(&c, 1);
 	}
@@ -98,8 +123,12 @@ struct LogRingBuffer {
 		size_t recordSize;
 		memcpy(&recordSize, buffer_ + recordOffset, sizeof(size_t));
 		// Alignment guarantees that the header fits contiguously.
-		if(recordSize > ringSize_ - headerSize)
-			goto tryAgain;
+		if(recordSize > ringSize_ - headerSize) {
+			if(deqPtr < tailPtr_.load(std::memory_order_acquire))
+				goto tryAgain;
+			// The header is corrupted (this can only happen if the ring is shared).
+			return {false, validPtr, validPtr, 0};
+		}
 		auto chunkSize = frg::min(recordSize, maxSize);
 		auto preWrapSize = frg::min(ringSize_ - (recordOffset + headerSize), chunkSize);
 		memcpy(p, buffer_ + recordOffset + sizeof(size_t), preWrapSize);
@@ -131,6 +160,7 @@ private:
 	char *buffer_;
 	std::atomic<uint64_t> tailPtr_{0};
 	std::atomic<uint64_t> headPtr_{0};
+	HelLogRingHeader *shared_{nullptr};
 };
 
 struct SingleContextRecordRing {
@@ -2,8 +2,10 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <atomic>
 
 #include <frg/list.hpp>
+#include <frg/optional.hpp>
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
 
@@ -18,6 +20,31 @@ enum class ScheduleType {
 	regular
 };
 
+// Scheduling class of a regular entity. Classes are strictly ordered:
+// deadline entities always run before FIFO/RR entities which run before fair entities.
+enum class SchedulePolicy {
+	// Fair-share scheduling according to priority and unfairness.
+	fair,
+	// Fixed priority real-time scheduling; FIFO entities are never preempted by
+	// entities of the same priority, RR entities are preempted after a time slice.
+	fifo,
+	roundRobin,
+	// Earliest deadline first with a constant bandwidth server: the entity may run for
+	// runtime ns every period ns; once the budget is exhausted, its deadline is postponed.
+	deadline
+};
+
+struct SchedulingParameters {
+	SchedulePolicy policy = SchedulePolicy::fair;
+	int priority = 0;
+	// Only used for SchedulePolicy::deadline. All values are in ns.
+	uint64_t runtime = 0;
+	uint64_t deadline = 0;
+	uint64_t period = 0;
+
+	bool operator== (const SchedulingParameters &) const = default;
+};
+
 enum class ScheduleState {
 	null,
 	attached,
@@ -53,10 +80,22 @@ public:
 
 	virtual void handlePreemption(IrqImageAccessor image) = 0;
 
+	// Whether the load balancer is allowed to move this entity to another CPU.
+	// This is called by the CPU that currently owns the entity (with IRQs disabled).
+	virtual bool isMigratableTo(CpuData *cpu);
+
 	uint64_t runTime() {
 		return _runTime;
 	}
 
+	SchedulePolicy policy() const {
+		return _policy;
+	}
+
+	// Returns the parameters that the entity should run with, i.e., its own parameters
+	// or its inherited parameters (whichever take precedence).
+	SchedulingParameters effectiveParameters();
+
 private:
 	const ScheduleType type_;
 
@@ -64,8 +103,31 @@ private:
 	Scheduler *_scheduler;
 
 	ScheduleState state;
+	SchedulePolicy _policy;
 	int priority;
 
+	// Parameters of SchedulePolicy::deadline.
+	uint64_t _dlRuntime;
+	uint64_t _dlDeadline;
+	uint64_t _dlPeriod;
+	// Absolute deadline and remaining budget of the current server period.
+	uint64_t _dlAbsoluteDeadline;
+	int64_t _dlBudget;
+
+	// Order in which entities were enqueued; breaks ties between real-time entities.
+	uint64_t _queueSequence;
+
+	// The entity's own scheduling parameters and the parameters that it inherits
+	// (e.g., from waiters of priority inheritance futexes).
+	// Protected by _associationMutex; changes to entities that are not running on the
+	// calling CPU are applied the next time that the entity is enqueued or re-sorted.
+	SchedulingParameters _requestedParameters;
+	frg::optional<SchedulingParameters> _inheritedParameters;
+	std::atomic<bool> _parametersChanged;
+
+	// Links the entity into Scheduler::_boostList.
+	frg::default_list_hook<ScheduleEntity> boostHook;
+
 	frg::default_list_hook<ScheduleEntity> listHook;
 	frg::pairing_heap_hook<ScheduleEntity> heapHook;
 
@@ -93,14 +155,43 @@ struct Scheduler {
 	// may be called from any CPU, *however*, calling them on the same ScheduleEntity is
 	// *not* thread-safe without additional synchronization!
 
+	// Chooses the scheduler for a new entity that is created on the given CPU.
+	// This prefers lightly loaded CPUs, then CPUs whose SMT siblings are idle
+	// (i.e., entities are spread across cores first) and then CPUs that share the LLC
+	// of the creator (since new entities often communicate with their creator).
+	static Scheduler *choosePlacement(CpuData *creator);
+
 	static void associate(ScheduleEntity *entity, Scheduler *scheduler);
 	static void unassociate(ScheduleEntity *entity);
 
 	static void setPriority(ScheduleEntity *entity, int priority);
 
+	// Changes the scheduling class of an entity. If the entity is not the current entity of
+	// the calling CPU, the change takes effect the next time that the entity is enqueued
+	// (i.e., when it is woken up or preempted).
+	static void setScheduling(ScheduleEntity *entity, const SchedulingParameters &parameters);
+
+	// Lets the entity inherit the given parameters (for priority inheritance); the entity
+	// runs with whichever of its own and the inherited parameters take precedence.
+	// Passing frg::null_opt removes the inherited parameters. Unlike setScheduling(),
+	// this also re-sorts waiting entities such that a boost takes effect immediately.
+	static void setInheritedScheduling(ScheduleEntity *entity,
+			frg::optional<SchedulingParameters> parameters);
+
+	// Returns true if entities with parameters a run before entities with parameters b.
+	static bool schedulingPrecedes(const SchedulingParameters &a, const SchedulingParameters &b);
+
 	static void resume(ScheduleEntity *entity);
 	static void suspendCurrent();
 
+	// Direct handoff (e.g., for synchronous IPC): while handoff is armed, the first entity
+	// that the current entity resumes on the same CPU becomes its handoff target.
+	// If the current entity blocks before handoff is disarmed (and before it is
+	// preempted), the target runs next, regardless of its unfairness.
+	// disarmHandoff() drops the target.
+	static void armHandoff();
+	static void disarmHandoff();
+
 	Scheduler(CpuData *cpu_context);
 
 	Scheduler(const Scheduler &) = delete;
@@ -122,10 +213,22 @@ public:
 
 	ScheduleEntity *currentRunnable();
 
+	uint64_t numMigratedIn() {
+		return _numMigratedIn.load(std::memory_order_relaxed);
+	}
+	uint64_t numMigratedOut() {
+		return _numMigratedOut.load(std::memory_order_relaxed);
+	}
+
 private:
 	void _unschedule();
 	void _schedule();
 
+	// Moves a waiting entity to an idle CPU (if there is one).
+	void _balance();
+	// Asks the most loaded CPU to push work to us.
+	void _requestBalance();
+
 private:
 	void _updatePreemption();
 
@@ -134,6 +237,13 @@ private:
 
 	void _updateEntityStats(ScheduleEntity *entity);
 
+	void _applyParameters(ScheduleEntity *entity, const SchedulingParameters &parameters);
+	void _applyRequestedParameters(ScheduleEntity *entity);
+	// Implements the wakeup rule of the constant bandwidth server.
+	void _replenishOnWakeup(ScheduleEntity *entity);
+	// Charges the run time of the current entity against its budget.
+	void _chargeBudget(ScheduleEntity *entity, uint64_t delta);
+
 	CpuData *_cpuContext;
 
 	ScheduleEntity *_current;
@@ -151,6 +261,8 @@ private:
 
 	size_t _numWaiting = 0;
 
+	uint64_t _nextQueueSequence = 0;
+
 	// The last tick at which the scheduler's state (i.e. progress) was updated.
 	// In our model this is the time point at which slice T started.
 	uint64_t _refClock = 0;
@@ -162,6 +274,35 @@ private:
 	// This allows us to easily track u_p(T) for all waiting processes.
 	Progress _systemProgress = 0;
 
+	// ----------------------------------------------------------------------------------
+	// Load balancing.
+	// These variables are read by other CPUs.
+	// ----------------------------------------------------------------------------------
+
+	// Number of entities that wait on this CPU (i.e., _numWaiting).
+	std::atomic<size_t> _publishedLoad{0};
+
+	// Whether this CPU runs its idle task and can accept entities from other CPUs.
+	std::atomic<bool> _isIdle{false};
+
+	// Set by idle CPUs to make this CPU run the balancer at its next update().
+	std::atomic<bool> _balanceRequested{false};
+
+	std::atomic<uint64_t> _numMigratedIn{0};
+	std::atomic<uint64_t> _numMigratedOut{0};
+
+	// Clock at which the balancer was run for the last time.
+	uint64_t _balanceClock = 0;
+
+	// ----------------------------------------------------------------------------------
+	// Direct handoff.
+	// Only accessed by the CPU that owns the scheduler (with IRQs disabled).
+	// ----------------------------------------------------------------------------------
+
+	bool _handoffArmed = false;
+	ScheduleEntity *_handoffDonor = nullptr;
+	ScheduleEntity *_handoffTarget = nullptr;
+
 	// ----------------------------------------------------------------------------------
 	// Management of pending entities.
 	// ----------------------------------------------------------------------------------
@@ -177,6 +318,17 @@ private:
 			&ScheduleEntity::listHook
 		>
 	> _pendingList;
+
+	// Entities whose inherited parameters changed; update() re-sorts them.
+	// Also protected by _mutex.
+	frg::intrusive_list<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::default_list_hook<ScheduleEntity>,
+			&ScheduleEntity::boostHook
+		>
+	> _boostList;
 };
 
 Scheduler *localScheduler();
@@ -75,10 +75,16 @@ inline bool usesFlowProtocol(int tag) {
 }
 
 struct FlowPacket {
-	void *data = nullptr;
 	size_t size = 0;
 	bool terminate = false;
 	bool fault = false;
+
+	// For direct transfers, receivers offer their buffer to the sender,
+	// which then copies into it without going through a kernel buffer.
+	smarter::shared_ptr<AddressSpace, BindableHandle> targetSpace;
+	uintptr_t targetAddress = 0;
+	// Set by the sender if writing to the target buffer faulted.
+	bool targetFault = false;
 };
 
 struct StreamNode {
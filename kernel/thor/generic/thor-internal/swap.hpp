@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <frg/expected.hpp>
+#include <smarter.hpp>
+#include <thor-internal/coroutine.hpp>
+#include <thor-internal/error.hpp>
+#include <thor-internal/types.hpp>
+
+namespace thor {
+
+struct MemoryView;
+
+// Block-device-backed swap space for anonymous memory.
+//
+// User space (i.e., libblockfs) hands us the frontal view of a managed memory object
+// that is backed by a swap partition (see helEnableSwap()). That view serves as swap cache:
+// pages are swapped out by handing them over to the view and marking them dirty, such that
+// the view's writeback (which fuses adjacent dirty pages into a single request) writes
+// them to the device. Swap-in reads through the view, which also performs readahead.
+// The swap area is divided into page-sized slots; slot 0 holds the swap header.
+
+constexpr uint64_t noSwapSlot = static_cast<uint64_t>(-1);
+
+// Uses the first numSlots pages of the view as swap area (numSlots must be at least two).
+// Only a single swap area is supported. Fails with Error::illegalState if swap is
+// already enabled.
+Error enableSwap(smarter::shared_ptr<MemoryView> view, size_t numSlots);
+
+// Returns true if swap is enabled and not all slots are in use.
+bool swapAvailable();
+
+// Allocates up to count consecutive slots; on return, count is the number of slots
+// that were actually allocated. Returns noSwapSlot (and sets count to zero) on failure.
+uint64_t allocateSwapSlots(size_t &count);
+
+void freeSwapSlot(uint64_t slot);
+
+// Transfers ownership of the page to the swap cache without copying if the slot is not
+// cached already. Returns false (and leaves the page alone) otherwise.
+// May be called with locks held.
+bool donateToSwap(uint64_t slot, PhysicalAddr physical);
+
+// Copies the page into the slot. The page is still owned by the caller.
+coroutine<frg::expected<Error>> writeSwapSlot(uint64_t slot, PhysicalAddr physical);
+
+// Copies the contents of the slot into the page.
+coroutine<frg::expected<Error>> readSwapSlot(uint64_t slot, PhysicalAddr physical);
+
+} // namespace thor
@@ -7,6 +7,7 @@
 #include <thor-internal/credentials.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/error.hpp>
+#include <thor-internal/futex-pi.hpp>
 #include <thor-internal/schedule.hpp>
 #include <thor-internal/universe.hpp>
 #include <thor-internal/work-queue.hpp>
@@ -271,9 +272,54 @@ public:
 
 	void handlePreemption(IrqImageAccessor accessor) override;
 
+	bool isMigratableTo(CpuData *cpu) override;
+
 private:
 	void _uninvoke();
 	void _kill();
+	void _startPmc();
+	void _stopPmc();
+
+public:
+	// Bit i of a PMC event mask corresponds to PMC value i (cycles, instructions, cache misses).
+	static constexpr int numPmcEvents = 3;
+
+	static bool pmcEventsSupported(uint32_t events);
+
+	// Changing the events resets all values. If this thread is running on another CPU,
+	// counts from before the change are accounted when the thread is descheduled.
+	void setPmcEvents(uint32_t events);
+
+	uint64_t pmcValue(int i) {
+		return _pmcValues[i].load(std::memory_order_relaxed);
+	}
+
+public:
+	// Signal frame that the kernel builds on return from a syscall (see helQueueSignal()).
+	struct SignalDelivery {
+		uintptr_t ip;
+		uintptr_t altStackBase;
+		size_t altStackSize;
+		size_t redZone;
+		uintptr_t flagAddress;
+		size_t registersOffset;
+		size_t simdPointerOffset;
+		uintptr_t argument;
+		size_t argumentOffsets[2];
+		frg::vector<uint8_t, KernelAlloc> payload{*kernelAlloc};
+	};
+
+	// Fails with Error::illegalState if a delivery is already queued.
+	Error queueSignal(SignalDelivery delivery);
+
+	// Returns true if a queued delivery was removed before it took place.
+	bool dequeueSignal();
+
+private:
+	// Builds the frame of a queued delivery (if any) and redirects the syscall image.
+	void _deliverQueuedSignal(SyscallImageAccessor image);
+
+	frg::optional<SignalDelivery> _queuedSignal;
 
 public:
 	frg::vector<uint8_t, KernelAlloc> getAffinityMask() {
@@ -284,6 +330,12 @@ public:
 	void setAffinityMask(frg::vector<uint8_t, KernelAlloc> &&mask) {
 		auto lock = frg::guard(&_mutex);
 		_affinityMask = std::move(mask);
+
+		uint64_t bits = 0;
+		for(size_t i = 0; i < _affinityMask.size() && i < 8; i++)
+			bits |= uint64_t(_affinityMask[i]) << (i * 8);
+		_affinityBits.store(_affinityMask.empty() ? ~uint64_t(0) : bits,
+				std::memory_order_relaxed);
 	}
 
 	// TODO: Tidy this up.
@@ -291,6 +343,9 @@ public:
 
 	uint32_t flags;
 
+	// Priority inheritance futexes that this thread owns or waits for.
+	PiFutexTask piFutexTask;
+
 private:
 	typedef frg::ticket_spinlock Mutex;
 
@@ -365,6 +420,14 @@ private:
 
 	ObserveQueue _observeQueue;
 	frg::vector<uint8_t, KernelAlloc> _affinityMask;
+	// Summary of _affinityMask for the first 64 CPUs that can be read without taking _mutex.
+	// Threads without affinity mask can run on all CPUs.
+	std::atomic<uint64_t> _affinityBits{~uint64_t(0)};
+
+	std::atomic<uint32_t> _pmcEvents{0};
+	// Events that were started by invoke(); only accessed by the CPU that runs the thread.
+	uint32_t _activePmcEvents = 0;
+	std::atomic<uint64_t> _pmcValues[numPmcEvents]{};
 };
 
 } // namespace thor
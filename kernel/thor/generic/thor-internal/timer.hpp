@@ -9,6 +9,7 @@
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
 #include <thor-internal/cancel.hpp>
+#include <thor-internal/types.hpp>
 #include <thor-internal/work-queue.hpp>
 
 namespace thor {
@@ -24,6 +25,14 @@ protected:
 
 ClockSource *systemClockSource();
 
+// The clock page (see helAccessClockPage()) allows user space to compute
+// the value of systemClockSource() without entering the kernel.
+PhysicalAddr clockPagePhysical();
+// Sets the HelClockModes and HelClockPageFlags of the clock page.
+void publishClockMode(uint32_t mode, uint32_t flags);
+// Publishes the TSC calibration of a CPU.
+void publishCpuClock(int cpuIndex, uint64_t tscTicksPerMilli);
+
 struct AlarmSink {
 	virtual void firedAlarm() = 0;
 
@@ -90,6 +99,12 @@ struct PrecisionTimerNode {
 		_elapsed = elapsed;
 	}
 
+	// Allows the engine to fire the timer up to slack nanoseconds after its deadline.
+	// This lets the engine coalesce nearby deadlines into a single interrupt.
+	void setSlack(uint64_t slack) {
+		_slack = slack;
+	}
+
 	bool wasCancelled() {
 		return _wasCancelled;
 	}
@@ -98,6 +113,7 @@ struct PrecisionTimerNode {
 
 private:
 	uint64_t _deadline;
+	uint64_t _slack = 0;
 	async::cancellation_token _cancelToken;
 	Worklet *_elapsed;
 
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
+
+#include <frg/manual_box.hpp>
+#include <frg/optional.hpp>
 #include <frg/variant.hpp>
 #include <assert.h>
 #include <smarter.hpp>
+#include <thor-internal/lockstat.hpp>
 #include <thor-internal/mm-rc.hpp>
 #include <thor-internal/virtualization.hpp>
 
@@ -13,6 +18,7 @@ typedef int64_t Handle;
 struct MemoryView;
 struct AddressSpace;
 struct IoSpace;
+struct DmaSpace;
 struct Thread;
 struct Universe;
 struct IpcQueue;
@@ -62,6 +68,13 @@ struct AddressSpaceDescriptor {
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 };
 
+struct SpaceWindowDescriptor {
+	SpaceWindowDescriptor(smarter::shared_ptr<SpaceWindow> window)
+	: window(std::move(window)) { }
+
+	smarter::shared_ptr<SpaceWindow> window;
+};
+
 struct MemoryViewLockDescriptor {
 	MemoryViewLockDescriptor(smarter::shared_ptr<NamedMemoryViewLock> lock)
 	: lock(std::move(lock)) { }
@@ -200,6 +213,13 @@ struct IoDescriptor {
 	smarter::shared_ptr<IoSpace> ioSpace;
 };
 
+struct DmaSpaceDescriptor {
+	DmaSpaceDescriptor(smarter::shared_ptr<DmaSpace> dma_space)
+	: dmaSpace(std::move(dma_space)) { }
+
+	smarter::shared_ptr<DmaSpace> dmaSpace;
+};
+
 // --------------------------------------------------------
 // Kernlet related descriptors.
 // --------------------------------------------------------
@@ -239,6 +259,7 @@ typedef frg::variant<
 	MemoryViewDescriptor,
 	MemorySliceDescriptor,
 	AddressSpaceDescriptor,
+	SpaceWindowDescriptor,
 	VirtualizedSpaceDescriptor,
 	VirtualizedCpuDescriptor,
 	MemoryViewLockDescriptor,
@@ -248,6 +269,7 @@ typedef frg::variant<
 	OneshotEventDescriptor,
 	BitsetEventDescriptor,
 	IoDescriptor,
+	DmaSpaceDescriptor,
 	KernletObjectDescriptor,
 	BoundKernletDescriptor,
 	TokenDescriptor
@@ -257,10 +279,14 @@ typedef frg::variant<
 // Universe.
 // --------------------------------------------------------
 
+// Handles are indices into a two-level table of slots. Lookups through
+// getDescriptor(Handle) do not take the universe lock; they only take the
+// lock of the affected slot. Freed slots are reused. To detect stale handles,
+// the upper bits of a handle contain the generation of the slot.
 struct Universe {
 public:
-	typedef frg::ticket_spinlock Lock;
-	typedef frg::unique_lock<frg::ticket_spinlock> Guard;
+	typedef StatSpinlock<"universe"> Lock;
+	typedef frg::unique_lock<Lock> Guard;
 
 	Universe();
 	~Universe();
@@ -269,19 +295,50 @@ public:
 
 	AnyDescriptor *getDescriptor(Guard &guard, Handle handle);
 
+	// Returns a copy of the descriptor without taking the universe lock.
+	// Must be called without holding any locks since the copy may hold the last
+	// reference to the descriptor once it is released.
+	frg::optional<AnyDescriptor> getDescriptor(Handle handle);
+
 	frg::optional<AnyDescriptor> detachDescriptor(Guard &guard, Handle handle);
 
 	Lock lock;
 
 private:
-	frg::hash_map<
-		Handle,
-		AnyDescriptor,
-		frg::hash<Handle>,
-		KernelAlloc
-	> _descriptorMap;
-
-	Handle _nextHandle;
+	static constexpr int indexBits = 20;
+	static constexpr int generationBits = 11;
+	static constexpr size_t slotsPerChunk = 1024;
+	static constexpr size_t numChunks = (size_t{1} << indexBits) / slotsPerChunk;
+	// Only reuse slots once there are enough free slots.
+	// This makes it less likely that stale handles refer to new descriptors.
+	static constexpr size_t minFreeSlots = 64;
+
+	struct Slot {
+		// Protects the descriptor; writers also hold the universe lock.
+		frg::ticket_spinlock mutex;
+		uint32_t generation = 0;
+		bool present = false;
+		frg::manual_box<AnyDescriptor> descriptor;
+		// Next slot in the free list. Protected by the universe lock.
+		uint32_t nextFree = 0;
+	};
+
+	struct Chunk {
+		Slot slots[slotsPerChunk];
+	};
+
+	Slot *_slotAt(uint32_t index);
+	Slot *_findSlot(Handle handle);
+	bool _matches(Slot *slot, Handle handle);
+
+	std::atomic<Chunk *> _chunks[numChunks];
+
+	// The following fields are protected by the universe lock.
+	// Index 0 is never used, such that no handle is zero.
+	uint32_t _nextIndex = 1;
+	uint32_t _freeHead = 0;
+	uint32_t _freeTail = 0;
+	size_t _numFree = 0;
 };
 
 } // namespace thor
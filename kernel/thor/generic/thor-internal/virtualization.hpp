@@ -28,6 +28,8 @@ namespace thor {
 			virtual HelVmexitReason run() = 0;
 			virtual void storeRegs(const HelX86VirtualizationRegs *regs) = 0;
 			virtual void loadRegs(HelX86VirtualizationRegs *res) = 0;
+			virtual void storeControl(const HelX86VirtualizationControl *control) = 0;
+			virtual void loadControl(HelX86VirtualizationControl *control) = 0;
 
 	protected:
 		~VirtualizedCpu() = default;
@@ -41,6 +43,8 @@ namespace thor {
 		virtual void retire(RetireNode *node) = 0;
 
 		virtual Error map(uint64_t guestAddress, uint64_t hostAddress, int flags) = 0;
+		// Maps a 2 MiB large page. Fails if a page table already covers guestAddress.
+		virtual Error map2m(uint64_t guestAddress, uint64_t hostAddress, int flags) = 0;
 		virtual PageStatus unmap(uint64_t guestAddress) = 0;
 		VirtualizedPageSpace() : VirtualSpace{&ops_}, ops_{this} {}
 
@@ -74,7 +78,50 @@ namespace thor {
 			bool isMapped(VirtualAddr pointer) override {
 				return space_->isMapped(pointer);
 			}
+
+			// Uses large pages for 2 MiB chunks that are physically contiguous (if requested).
+			// This avoids both EPT/NPT violations and TLB pressure for guest memory.
+			frg::expected<Error> mapPresentPages(VirtualAddr va, MemoryView *view,
+					uintptr_t offset, size_t size, PageFlags flags) override {
+				if(!(flags & page_access::preferHuge))
+					return VirtualOperations::mapPresentPages(va, view, offset, size, flags);
+
+				size_t progress = 0;
+				while(progress < size) {
+					if(!((va + progress) & (kHugePageSize - 1))
+							&& !((offset + progress) & (kHugePageSize - 1))
+							&& size - progress >= kHugePageSize) {
+						auto physical = contiguousHugePage_(view, offset + progress);
+						if(physical != PhysicalAddr(-1)
+								&& space_->map2m(va + progress, physical, flags)
+										== Error::success) {
+							progress += kHugePageSize;
+							continue;
+						}
+					}
+
+					auto result = VirtualOperations::mapPresentPages(va + progress, view,
+							offset + progress, kPageSize, flags);
+					if(!result)
+						return result;
+					progress += kPageSize;
+				}
+				return {};
+			}
 			private:
+				// Returns the physical address of the 2 MiB chunk at offset
+				// if it is present, aligned and contiguous; otherwise returns -1.
+				static PhysicalAddr contiguousHugePage_(MemoryView *view, uintptr_t offset) {
+					auto base = view->peekRange(offset).get<0>();
+					if(base == PhysicalAddr(-1) || (base & (kHugePageSize - 1)))
+						return PhysicalAddr(-1);
+					for(size_t i = kPageSize; i < kHugePageSize; i += kPageSize) {
+						if(view->peekRange(offset + i).get<0>() != base + i)
+							return PhysicalAddr(-1);
+					}
+					return base;
+				}
+
 				VirtualizedPageSpace *space_;
 		};
 	protected:
@@ -5,7 +5,6 @@
 #include <async/basic.hpp>
 #include <frg/container_of.hpp>
 #include <frg/list.hpp>
-#include <frg/spinlock.hpp>
 #include <smarter.hpp>
 
 #include <thor-internal/executor-context.hpp>
@@ -23,6 +22,8 @@ private:
 	smarter::shared_ptr<WorkQueue> _workQueue;
 	void (*_run)(Worklet *);
 	frg::default_list_hook<Worklet> _hook;
+	// Link in WorkQueue::_remoteHead.
+	Worklet *_remoteNext = nullptr;
 };
 
 struct WorkQueue {
@@ -32,7 +33,7 @@ struct WorkQueue {
 	static bool enter(Worklet *worklet);
 
 	WorkQueue(ExecutorContext *executorContext = illegalExecutorContext())
-	: _executorContext{executorContext}, _localPosted{false}, _lockedPosted{false} { }
+	: _executorContext{executorContext}, _localPosted{false} { }
 
 	bool check();
 
@@ -140,6 +141,10 @@ protected:
 	~WorkQueue() = default;
 
 private:
+	// Pushes a worklet that is posted from another executor.
+	// Returns true if the WQ needs to be woken up.
+	bool _pushRemote(Worklet *worklet);
+
 	ExecutorContext *_executorContext;
 
 	frg::intrusive_list<
@@ -155,23 +160,13 @@ private:
 
 	std::atomic<bool> _inRun{false};
 
-	frg::ticket_spinlock _mutex;
-
-	// Writes to this flag are totally ordered since they only happen within _mutex.
-	// Each 0-1 transition of this flag causes wakeup() to be called.
+	// Lock-free LIFO of worklets that are posted from other executors.
+	// run() takes all of them with a single exchange and restores the posting order.
+	// Each transition from nullptr to non-nullptr causes wakeup() to be called.
 	// wakeup() is responsible to ensure that (i) check() (and eventually run()) will be called,
-	// and (ii) that the call to check() synchronizes with the 0-1 transition of _lockedPosted.
+	// and (ii) that the call to check() synchronizes with the transition of _remoteHead.
 	// (In the case of threads, this is guaranteed by the blocking mechanics.)
-	std::atomic<bool> _lockedPosted;
-
-	frg::intrusive_list<
-		Worklet,
-		frg::locate_member<
-			Worklet,
-			frg::default_list_hook<Worklet>,
-			&Worklet::_hook
-		>
-	> _lockedQueue;
+	std::atomic<Worklet *> _remoteHead{nullptr};
 };
 
 inline void Worklet::setup(void (*run)(Worklet *), WorkQueue *wq) {
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <thor-internal/types.hpp>
+
+namespace thor {
+
+// Compressed in-memory pool for pages of anonymous memory.
+//
+// Under memory pressure, cold pages of swappable AllocatedMemory objects are LZ4-compressed
+// into this pool and decompressed again on fault. The size of the pool is limited by the
+// command line option thor.zswap=<percent of RAM> (default: 20, 0 disables the pool).
+
+struct ZswapEntry;
+
+// Returns false if the pool is disabled or full. This is a cheap check that allows callers
+// to avoid evicting pages that cannot be stored anyway.
+bool zswapHasSpace();
+
+// Compresses the page into the pool. Returns nullptr if the pool is full
+// or if the page does not compress well enough.
+ZswapEntry *zswapStore(PhysicalAddr physical);
+
+// Decompresses the entry into the page and releases the entry.
+void zswapLoad(ZswapEntry *entry, PhysicalAddr physical);
+
+// Releases the entry without decompressing it.
+void zswapDrop(ZswapEntry *entry);
+
+} // namespace thor
@@ -7,6 +7,14 @@
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/thread.hpp>
+#ifdef __x86_64__
+#include <thor-internal/arch/pmc-amd.hpp>
+#include <thor-internal/arch/pmc-intel.hpp>
+#endif
+
+// Defined in hel.cpp.
+bool readUserMemory(void *kernelPtr, const void *userPtr, size_t size);
+bool writeUserMemory(void *userPtr, const void *kernelPtr, size_t size);
 
 namespace thor {
 
@@ -37,8 +45,8 @@ void Thread::migrateCurrent() {
 	size_t n = -1;
 	for (size_t i = 0; i < getCpuCount(); i++) {
 		bool bit = 0;
-		if ((i + 7) / 8 < this_thread->_affinityMask.size())
-			bit = this_thread->_affinityMask[(i + 7) / 8] & (1 << (i % 8));
+		if (i / 8 < this_thread->_affinityMask.size())
+			bit = this_thread->_affinityMask[i / 8] & (1 << (i % 8));
 
 		if (bit) {
 			n = i;
@@ -245,6 +253,8 @@ void Thread::interruptCurrent(Interrupt interrupt, SyscallImageAccessor image) {
 
 void Thread::raiseSignals(SyscallImageAccessor image) {
 	auto this_thread = getCurrentThread();
+	this_thread->_deliverQueuedSignal(image);
+
 	StatelessIrqLock irq_lock;
 	auto lock = frg::guard(&this_thread->_mutex);
 
@@ -318,6 +328,131 @@ void Thread::raiseSignals(SyscallImageAccessor image) {
 	}
 }
 
+Error Thread::queueSignal(SignalDelivery delivery) {
+#if defined(__x86_64__)
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	if(_queuedSignal)
+		return Error::illegalState;
+	_queuedSignal = std::move(delivery);
+	return Error::success;
+#else
+	(void)delivery;
+	return Error::noHardwareSupport;
+#endif
+}
+
+bool Thread::dequeueSignal() {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	if(!_queuedSignal)
+		return false;
+	_queuedSignal = frg::null_opt;
+	return true;
+}
+
+void Thread::_deliverQueuedSignal(SyscallImageAccessor image) {
+#if defined(__x86_64__)
+	uintptr_t flagAddress;
+	{
+		StatelessIrqLock irq_lock;
+		auto lock = frg::guard(&_mutex);
+
+		if(!_queuedSignal || _pendingKill)
+			return;
+		flagAddress = _queuedSignal->flagAddress;
+	}
+
+	// User space defers signals while it is in a critical section.
+	// Since this thread does not run user code right now, there is no race here.
+	if(flagAddress) {
+		auto flagPtr = reinterpret_cast<unsigned int *>(flagAddress);
+		unsigned int flag;
+		if(!readUserMemory(&flag, flagPtr, sizeof(unsigned int))) {
+			interruptCurrent(kIntrPageFault, image);
+			return;
+		}
+		if(flag) {
+			if(flag == 1) {
+				unsigned int request = 2;
+				if(!writeUserMemory(flagPtr, &request, sizeof(unsigned int)))
+					interruptCurrent(kIntrPageFault, image);
+			}
+			return;
+		}
+	}
+
+	frg::optional<SignalDelivery> delivery;
+	{
+		StatelessIrqLock irq_lock;
+		auto lock = frg::guard(&_mutex);
+
+		// The delivery might have been dequeued in the meantime.
+		if(!_queuedSignal)
+			return;
+		delivery = std::move(_queuedSignal);
+		_queuedSignal = frg::null_opt;
+	}
+
+	// This also saves the SIMD state to the executor.
+	saveExecutor(&_executor, image);
+	_executor._expandSimd();
+	auto simdSize = Executor::determineSimdSize();
+
+	uintptr_t sp = *_executor.sp();
+	if(delivery->altStackBase && !(sp >= delivery->altStackBase
+			&& sp <= delivery->altStackBase + delivery->altStackSize))
+		sp = delivery->altStackBase + delivery->altStackSize;
+
+	// Align the frame as the SysV ABI expects it at function entry (i.e., after a call).
+	size_t frameSize = delivery->payload.size() + simdSize;
+	if(sp < delivery->redZone + frameSize + 24) {
+		interruptCurrent(kIntrPageFault, image);
+		return;
+	}
+	uintptr_t frame = ((sp - delivery->redZone - frameSize) & ~uintptr_t(15)) - 8;
+
+	auto general = _executor.general();
+	uintptr_t regs[19] = {
+		general->r8, general->r9, general->r10, general->r11,
+		general->r12, general->r13, general->r14, general->r15,
+		general->rdi, general->rsi, general->rbp, general->rbx,
+		general->rdx, general->rax, general->rcx, general->rsp,
+		general->rip, general->rflags, general->cs
+	};
+	memcpy(delivery->payload.data() + delivery->registersOffset, regs, sizeof(regs));
+	if(delivery->simdPointerOffset != ~size_t(0)) {
+		uintptr_t simdPointer = frame + delivery->payload.size();
+		memcpy(delivery->payload.data() + delivery->simdPointerOffset,
+				&simdPointer, sizeof(uintptr_t));
+	}
+
+	if(!writeUserMemory(reinterpret_cast<void *>(frame),
+			delivery->payload.data(), delivery->payload.size())
+			|| !writeUserMemory(reinterpret_cast<void *>(frame + delivery->payload.size()),
+			_executor._fxState(), simdSize)) {
+		interruptCurrent(kIntrPageFault, image);
+		return;
+	}
+
+	if(logTransitions)
+		infoLogger() << "thor: Delivering signal frame at " << (void *)frame
+				<< " in " << (void *)this << frg::endlog;
+
+	*image.ip() = delivery->ip;
+	*image.sp() = frame;
+	*image.rflags() &= ~uintptr_t(0x500); // Clear TF and DF.
+	*image.number() = delivery->argument; // rdi.
+	*image.in0() = frame + delivery->argumentOffsets[0]; // rsi.
+	*image.in1() = frame + delivery->argumentOffsets[1]; // rdx.
+	*image.in2() = 0; // rax, i.e., the number of vector arguments.
+#else
+	(void)image;
+#endif
+}
+
 void Thread::unblockOther(smarter::borrowed_ptr<Thread> thread) {
 	// Release semantics ensure that we synchronize with the thread when it flips the flag
 	// back to false. Acquire semantics are needed to synchronize with other threads
@@ -374,7 +509,7 @@ Error Thread::resumeOther(smarter::borrowed_ptr<Thread> thread) {
 
 Thread::Thread(smarter::shared_ptr<Universe> universe,
 		smarter::shared_ptr<AddressSpace, BindableHandle> address_space, AbiParameters abi)
-: flags{0}, _mainWorkQueue{this}, _pagingWorkQueue{this},
+: flags{0}, piFutexTask{this}, _mainWorkQueue{this}, _pagingWorkQueue{this},
 		_runState{kRunInterrupted}, _lastInterrupt{kIntrNull}, _stateSeq{1},
 		_pendingKill{false}, _pendingSignal{kSigNone}, _runCount{1},
 		_executor{&_userContext, abi},
@@ -467,6 +602,7 @@ void Thread::invoke() {
 
 	_userContext.migrate(getCpuData());
 	AddressSpace::activate(_addressSpace);
+	_startPmc();
 	getCpuData()->executorContext = &_executorContext;
 	switchExecutor(self);
 	restoreExecutor(&_executor);
@@ -502,10 +638,87 @@ void Thread::handlePreemption(IrqImageAccessor image) {
 	}
 }
 
+bool Thread::isMigratableTo(CpuData *cpu) {
+	auto bits = _affinityBits.load(std::memory_order_relaxed);
+	if(cpu->cpuIndex >= 64)
+		return bits == ~uint64_t(0);
+	return bits & (uint64_t(1) << cpu->cpuIndex);
+}
+
 void Thread::_uninvoke() {
+	_stopPmc();
 	UserContext::deactivate();
 }
 
+bool Thread::pmcEventsSupported(uint32_t events) {
+#ifdef __x86_64__
+	if(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileIntelSupported)
+		return intelThreadPmcSupports(events);
+	if(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileAmdSupported)
+		return amdThreadPmcSupports(events);
+#endif
+	return !events;
+}
+
+void Thread::setPmcEvents(uint32_t events) {
+	assert(pmcEventsSupported(events));
+
+	auto irqLock = frg::guard(&irqMutex());
+
+	bool isCurrent = getCurrentThread().get() == this;
+	if(isCurrent)
+		_stopPmc();
+
+	_pmcEvents.store(events, std::memory_order_relaxed);
+	for(int i = 0; i < numPmcEvents; i++)
+		_pmcValues[i].store(0, std::memory_order_relaxed);
+
+	if(isCurrent)
+		_startPmc();
+}
+
+void Thread::_startPmc() {
+	assert(!intsAreEnabled());
+	assert(!_activePmcEvents);
+
+	auto events = _pmcEvents.load(std::memory_order_relaxed);
+	if(!events)
+		return;
+
+#ifdef __x86_64__
+	if(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileIntelSupported) {
+		startIntelThreadPmc(events);
+	}else{
+		assert(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileAmdSupported);
+		startAmdThreadPmc(events);
+	}
+#endif
+	_activePmcEvents = events;
+}
+
+void Thread::_stopPmc() {
+	assert(!intsAreEnabled());
+
+	auto events = _activePmcEvents;
+	if(!events)
+		return;
+
+	uint64_t values[numPmcEvents]{};
+#ifdef __x86_64__
+	if(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileIntelSupported) {
+		stopIntelThreadPmc(events, values);
+	}else{
+		assert(getGlobalCpuFeatures()->profileFlags & CpuFeatures::profileAmdSupported);
+		stopAmdThreadPmc(events, values);
+	}
+#endif
+	for(int i = 0; i < numPmcEvents; i++) {
+		if(events & (UINT32_C(1) << i))
+			_pmcValues[i].fetch_add(values[i], std::memory_order_relaxed);
+	}
+	_activePmcEvents = 0;
+}
+
 void Thread::_kill() {
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
@@ -1,15 +1,95 @@
+#include <string.h>
+#include <thor-internal/arch/paging.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/debug.hpp>
+#include <thor-internal/physical.hpp>
 #include <thor-internal/timer.hpp>
+#include <hel.h>
 
 namespace thor {
 
 static constexpr bool logTimers = false;
 static constexpr bool logProgress = false;
 
+namespace {
+	// Rounds the deadline up to a multiple of the largest power of two that does not exceed
+	// the slack. Timers with similar deadlines and slack thus end up with identical deadlines
+	// and are processed by the same alarm, similar to the slots of a timer wheel.
+	uint64_t coalesceDeadline(uint64_t deadline, uint64_t slack) {
+		if(!slack)
+			return deadline;
+		auto granularity = uint64_t(1) << (63 - __builtin_clzll(slack));
+		auto rounded = (deadline + (granularity - 1)) & ~(granularity - 1);
+		if(rounded < deadline) // Overflow.
+			return deadline;
+		return rounded;
+	}
+}
+
 ClockSource *globalClockSource;
 PrecisionTimerEngine *globalTimerEngine;
 
+static_assert(sizeof(HelClockPage) <= kPageSize);
+
+namespace {
+	frg::ticket_spinlock clockPageMutex;
+	PhysicalAddr globalClockPagePhysical = PhysicalAddr(-1);
+
+	// Must be called with clockPageMutex held.
+	HelClockPage *accessClockPage() {
+		if(globalClockPagePhysical == PhysicalAddr(-1)) {
+			globalClockPagePhysical = physicalAllocator->allocate(kPageSize);
+			assert(globalClockPagePhysical != PhysicalAddr(-1) && "OOM");
+			PageAccessor accessor{globalClockPagePhysical};
+			memset(accessor.get(), 0, kPageSize);
+		}
+		PageAccessor accessor{globalClockPagePhysical};
+		return reinterpret_cast<HelClockPage *>(accessor.get());
+	}
+
+	template<typename F>
+	void updateClockPage(F fn) {
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&clockPageMutex);
+
+		auto page = accessClockPage();
+		auto seq = __atomic_load_n(&page->seqlock, __ATOMIC_RELAXED);
+		__atomic_store_n(&page->seqlock, seq + 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		fn(page);
+		__atomic_store_n(&page->seqlock, seq + 2, __ATOMIC_RELEASE);
+	}
+}
+
+PhysicalAddr clockPagePhysical() {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&clockPageMutex);
+
+	accessClockPage();
+	return globalClockPagePhysical;
+}
+
+void publishClockMode(uint32_t mode, uint32_t flags) {
+	updateClockPage([&] (HelClockPage *page) {
+		__atomic_store_n(&page->mode, mode, __ATOMIC_RELAXED);
+		__atomic_store_n(&page->flags, flags, __ATOMIC_RELAXED);
+	});
+}
+
+void publishCpuClock(int cpuIndex, uint64_t tscTicksPerMilli) {
+	if(cpuIndex >= kHelClockPageMaxCpus) {
+		infoLogger() << "thor: CPU #" << cpuIndex
+				<< " does not fit into the clock page" << frg::endlog;
+		return;
+	}
+	updateClockPage([&] (HelClockPage *page) {
+		__atomic_store_n(&page->cpus[cpuIndex].tscTicksPerMilli, tscTicksPerMilli,
+				__ATOMIC_RELAXED);
+		if(page->numCpus < static_cast<uint32_t>(cpuIndex) + 1)
+			__atomic_store_n(&page->numCpus, cpuIndex + 1, __ATOMIC_RELAXED);
+	});
+}
+
 PrecisionTimerEngine::PrecisionTimerEngine(ClockSource *clock, AlarmTracker *alarm)
 : _clock{clock}, _alarm{alarm} {
 	_alarm->setSink(this);
@@ -23,6 +103,8 @@ void PrecisionTimerEngine::installTimer(PrecisionTimerNode *timer) {
 	auto lock = frg::guard(&_mutex);
 	assert(timer->_state == TimerState::none);
 
+	timer->_deadline = coalesceDeadline(timer->_deadline, timer->_slack);
+
 	if(logTimers) {
 		auto current = _clock->currentNanos();
 		infoLogger() << "thor: Setting timer at " << timer->_deadline
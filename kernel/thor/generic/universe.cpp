@@ -1,3 +1,4 @@
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/universe.hpp>
 
 namespace thor {
@@ -6,32 +7,137 @@ namespace {
 	constexpr bool logCleanup = false;
 }
 
-Universe::Universe()
-: _descriptorMap{frg::hash<Handle>{}, *kernelAlloc}, _nextHandle{1} { }
+Universe::Universe() {
+	for(auto &chunk : _chunks)
+		chunk.store(nullptr, std::memory_order_relaxed);
+}
 
 Universe::~Universe() {
 	if(logCleanup)
 		debugLogger() << "thor: Universe is deallocated" << frg::endlog;
+
+	for(auto &chunkPtr : _chunks) {
+		auto chunk = chunkPtr.load(std::memory_order_relaxed);
+		if(!chunk)
+			continue;
+		for(auto &slot : chunk->slots)
+			if(slot.present)
+				slot.descriptor.destruct();
+		frg::destruct(*kernelAlloc, chunk);
+	}
+}
+
+Universe::Slot *Universe::_slotAt(uint32_t index) {
+	auto chunk = _chunks[index / slotsPerChunk].load(std::memory_order_acquire);
+	if(!chunk)
+		return nullptr;
+	return &chunk->slots[index % slotsPerChunk];
+}
+
+Universe::Slot *Universe::_findSlot(Handle handle) {
+	if(handle <= 0 || (handle >> (indexBits + generationBits)))
+		return nullptr;
+	return _slotAt(handle & ((Handle{1} << indexBits) - 1));
+}
+
+// Checks whether the slot currently holds the descriptor that the handle refers to.
+bool Universe::_matches(Slot *slot, Handle handle) {
+	if(!slot->present)
+		return false;
+	auto generationMask = (uint32_t{1} << generationBits) - 1;
+	return (slot->generation & generationMask) == static_cast<uint32_t>(handle >> indexBits);
 }
 
 Handle Universe::attachDescriptor(Guard &guard, AnyDescriptor descriptor) {
 	assert(guard.protects(&lock));
 
-	Handle handle = _nextHandle++;
-	_descriptorMap.insert(handle, std::move(descriptor));
-	return handle;
+	uint32_t index;
+	Slot *slot;
+	if(_numFree > minFreeSlots) {
+		index = _freeHead;
+		slot = _slotAt(index);
+		_freeHead = slot->nextFree;
+		_numFree--;
+	}else{
+		index = _nextIndex++;
+		if(index == (uint32_t{1} << indexBits))
+			panicLogger() << "thor: Universe ran out of handles" << frg::endlog;
+
+		auto &chunkPtr = _chunks[index / slotsPerChunk];
+		auto chunk = chunkPtr.load(std::memory_order_relaxed);
+		if(!chunk) {
+			chunk = frg::construct<Chunk>(*kernelAlloc);
+			chunkPtr.store(chunk, std::memory_order_release);
+		}
+		slot = &chunk->slots[index % slotsPerChunk];
+	}
+
+	uint32_t generation;
+	{
+		auto slotLock = frg::guard(&slot->mutex);
+		assert(!slot->present);
+		slot->descriptor.initialize(std::move(descriptor));
+		slot->present = true;
+		generation = slot->generation;
+	}
+
+	auto generationMask = (uint32_t{1} << generationBits) - 1;
+	return (Handle(generation & generationMask) << indexBits) | index;
 }
 
 AnyDescriptor *Universe::getDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.get(handle);
+	// Since all writers hold the universe lock, we do not need to lock the slot.
+	auto slot = _findSlot(handle);
+	if(!slot || !_matches(slot, handle))
+		return nullptr;
+	return &slot->descriptor.get();
+}
+
+frg::optional<AnyDescriptor> Universe::getDescriptor(Handle handle) {
+	auto slot = _findSlot(handle);
+	if(!slot)
+		return frg::null_opt;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto slotLock = frg::guard(&slot->mutex);
+	if(!_matches(slot, handle))
+		return frg::null_opt;
+	return slot->descriptor.get();
 }
 
 frg::optional<AnyDescriptor> Universe::detachDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.remove(handle);
+	auto slot = _findSlot(handle);
+	if(!slot)
+		return frg::null_opt;
+
+	frg::optional<AnyDescriptor> descriptor;
+	{
+		auto slotLock = frg::guard(&slot->mutex);
+		if(!_matches(slot, handle))
+			return frg::null_opt;
+
+		descriptor = std::move(slot->descriptor.get());
+		slot->descriptor.destruct();
+		slot->present = false;
+		slot->generation++;
+	}
+
+	// Append the slot to the free list.
+	auto index = static_cast<uint32_t>(handle & ((Handle{1} << indexBits) - 1));
+	slot->nextFree = 0;
+	if(_numFree) {
+		_slotAt(_freeTail)->nextFree = index;
+	}else{
+		_freeHead = index;
+	}
+	_freeTail = index;
+	_numFree++;
+
+	return descriptor;
 }
 
 } // namespace thor
@@ -20,12 +20,7 @@ void WorkQueue::post(Worklet *worklet) {
 		wq->_localQueue.push_back(worklet);
 		wq->_localPosted.store(true, std::memory_order_relaxed);
 	}else{
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&wq->_mutex);
-
-		invokeWakeup = wq->_lockedQueue.empty();
-		wq->_lockedQueue.push_back(worklet);
-		wq->_lockedPosted.store(true, std::memory_order_relaxed);
+		invokeWakeup = wq->_pushRemote(worklet);
 	}
 
 	if(invokeWakeup)
@@ -50,13 +45,7 @@ bool WorkQueue::enter(Worklet *worklet) {
 		wq->_localQueue.push_back(worklet);
 		wq->_localPosted.store(true, std::memory_order_relaxed);
 	}else{
-		// Same logic as in post().
-		auto irqLock = frg::guard(&irqMutex());
-		auto lock = frg::guard(&wq->_mutex);
-
-		invokeWakeup = wq->_lockedQueue.empty();
-		wq->_lockedQueue.push_back(worklet);
-		wq->_lockedPosted.store(true, std::memory_order_relaxed);
+		invokeWakeup = wq->_pushRemote(worklet);
 	}
 
 	if(invokeWakeup)
@@ -66,9 +55,19 @@ bool WorkQueue::enter(Worklet *worklet) {
 
 bool WorkQueue::check() {
 	// _localPosted is only accessed from the thread/fiber that runs the WQ.
-	// For _lockedPosted, see the comment in the header file.
+	// For _remoteHead, see the comment in the header file.
 	return _localPosted.load(std::memory_order_relaxed)
-			|| _lockedPosted.load(std::memory_order_relaxed);
+			|| _remoteHead.load(std::memory_order_relaxed);
+}
+
+bool WorkQueue::_pushRemote(Worklet *worklet) {
+	// The release ordering publishes the worklet to run(); returns true on empty -> non-empty.
+	auto head = _remoteHead.load(std::memory_order_relaxed);
+	do {
+		worklet->_remoteNext = head;
+	} while(!_remoteHead.compare_exchange_weak(head, worklet,
+			std::memory_order_release, std::memory_order_relaxed));
+	return !head;
 }
 
 void WorkQueue::run() {
@@ -91,12 +90,22 @@ void WorkQueue::run() {
 
 		pending.splice(pending.end(), _localQueue);
 		_localPosted.store(false, std::memory_order_relaxed);
+	}
 
-		if(_lockedPosted.load(std::memory_order_relaxed)) {
-			auto lock = frg::guard(&_mutex);
-
-			pending.splice(pending.end(), _lockedQueue);
-			_lockedPosted.store(false, std::memory_order_relaxed);
+	// Drain the whole remote batch at once. The LIFO is reversed to preserve FIFO order.
+	if(_remoteHead.load(std::memory_order_relaxed)) {
+		auto worklet = _remoteHead.exchange(nullptr, std::memory_order_acquire);
+		Worklet *reversed = nullptr;
+		while(worklet) {
+			auto next = worklet->_remoteNext;
+			worklet->_remoteNext = reversed;
+			reversed = worklet;
+			worklet = next;
+		}
+		while(reversed) {
+			auto next = reversed->_remoteNext;
+			pending.push_back(reversed);
+			reversed = next;
 		}
 	}
 
@@ -0,0 +1,281 @@
+#include <atomic>
+#include <new>
+#include <string.h>
+
+#include <frg/array.hpp>
+#include <frg/cmdline.hpp>
+#include <frg/string.hpp>
+#include <thor-internal/arch/paging.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/physical.hpp>
+#include <thor-internal/zswap.hpp>
+
+namespace thor {
+
+extern frg::manual_box<frg::string<KernelAlloc>> kernelCommandLine;
+
+struct ZswapEntry {
+	// Size of the compressed data that follows this struct.
+	size_t size;
+};
+
+namespace {
+
+constexpr bool logZswap = false;
+
+// Pages that do not shrink below this size are not stored.
+constexpr size_t maxCompressedSize = kPageSize * 3 / 4;
+
+// Zero-filled pages are common; they do not consume any memory in the pool.
+constinit ZswapEntry zeroEntry{0};
+
+constinit size_t maxPoolBytes = 0;
+std::atomic<size_t> poolBytes{0};
+
+uint32_t load32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(uint32_t));
+	return v;
+}
+
+// Compresses in into the LZ4 block format.
+// Returns the compressed size or zero if the output does not fit into out.
+size_t lz4Compress(const uint8_t *in, size_t size, uint8_t *out, size_t capacity) {
+	// See https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md for these constants.
+	constexpr size_t minMatch = 4;
+	constexpr size_t lastLiterals = 5;
+	constexpr size_t matchLimit = 12;
+	constexpr int hashBits = 10;
+
+	// Positions are only used as hints; candidates are always verified.
+	uint16_t table[1 << hashBits] = {};
+	auto hash = [] (uint32_t seq) {
+		return (seq * 2654435761u) >> (32 - hashBits);
+	};
+
+	size_t op = 0;
+	auto writeLength = [&] (size_t n) -> bool {
+		while(n >= 255) {
+			if(op == capacity)
+				return false;
+			out[op++] = 255;
+			n -= 255;
+		}
+		if(op == capacity)
+			return false;
+		out[op++] = n;
+		return true;
+	};
+
+	// Emits literals [anchor, anchor + literals) followed by a match (unless matchLength is 0).
+	auto emit = [&] (size_t anchor, size_t literals, size_t offset, size_t matchLength) -> bool {
+		if(op == capacity)
+			return false;
+		auto token = &out[op++];
+		*token = frg::min(literals, size_t{15}) << 4;
+		if(literals >= 15 && !writeLength(literals - 15))
+			return false;
+		if(literals > capacity - op)
+			return false;
+		memcpy(out + op, in + anchor, literals);
+		op += literals;
+
+		if(!matchLength)
+			return true;
+		if(capacity - op < 2)
+			return false;
+		out[op++] = offset & 0xFF;
+		out[op++] = offset >> 8;
+		*token |= frg::min(matchLength - minMatch, size_t{15});
+		if(matchLength - minMatch >= 15 && !writeLength(matchLength - minMatch - 15))
+			return false;
+		return true;
+	};
+
+	size_t ip = 0;
+	size_t anchor = 0;
+	while(ip + matchLimit <= size) {
+		auto seq = load32(in + ip);
+		auto h = hash(seq);
+		size_t ref = table[h];
+		table[h] = ip;
+
+		if(ref >= ip || ip - ref > 0xFFFF || load32(in + ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		// The last literals of the block must not be covered by a match.
+		size_t length = minMatch;
+		while(ip + length < size - lastLiterals && in[ref + length] == in[ip + length])
+			length++;
+
+		if(!emit(anchor, ip - anchor, ip - ref, length))
+			return 0;
+		ip += length;
+		anchor = ip;
+	}
+
+	if(!emit(anchor, size - anchor, 0, 0))
+		return 0;
+	return op;
+}
+
+// Decompresses an LZ4 block that must expand to exactly size bytes.
+bool lz4Decompress(const uint8_t *in, size_t length, uint8_t *out, size_t size) {
+	auto end = in + length;
+	size_t progress = 0;
+
+	auto extendLength = [&] (size_t &n) -> bool {
+		while(true) {
+			if(in == end)
+				return false;
+			auto b = *in++;
+			n += b;
+			if(b != 255)
+				return true;
+		}
+	};
+
+	while(in < end) {
+		auto token = *in++;
+
+		size_t literals = token >> 4;
+		if(literals == 15 && !extendLength(literals))
+			return false;
+		if(literals > size_t(end - in) || literals > size - progress)
+			return false;
+		memcpy(out + progress, in, literals);
+		in += literals;
+		progress += literals;
+
+		// The last sequence only consists of literals.
+		if(in == end)
+			break;
+
+		if(end - in < 2)
+			return false;
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		if(!offset || offset > progress)
+			return false;
+
+		size_t matchLength = token & 0xF;
+		if(matchLength == 15 && !extendLength(matchLength))
+			return false;
+		matchLength += 4;
+		if(matchLength > size - progress)
+			return false;
+
+		// Matches may overlap their own output; copy byte by byte.
+		for(size_t i = 0; i < matchLength; i++)
+			out[progress + i] = out[progress - offset + i];
+		progress += matchLength;
+	}
+
+	return progress == size;
+}
+
+uint8_t *entryData(ZswapEntry *entry) {
+	return reinterpret_cast<uint8_t *>(entry + 1);
+}
+
+bool isZeroPage(const uint8_t *p) {
+	for(size_t i = 0; i < kPageSize; i += sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, p + i, sizeof(uint64_t));
+		if(word)
+			return false;
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+bool zswapHasSpace() {
+	return poolBytes.load(std::memory_order_relaxed) < maxPoolBytes;
+}
+
+ZswapEntry *zswapStore(PhysicalAddr physical) {
+	if(!zswapHasSpace())
+		return nullptr;
+
+	PageAccessor accessor{physical};
+	auto page = reinterpret_cast<const uint8_t *>(accessor.get());
+	if(isZeroPage(page))
+		return &zeroEntry;
+
+	auto buffer = kernelAlloc->allocate(sizeof(ZswapEntry) + maxCompressedSize);
+	if(!buffer)
+		return nullptr;
+	auto entry = new (buffer) ZswapEntry{0};
+	entry->size = lz4Compress(page, kPageSize, entryData(entry), maxCompressedSize);
+	if(!entry->size) {
+		kernelAlloc->free(entry);
+		return nullptr;
+	}
+
+	// Return the unused part of the buffer to the heap.
+	auto shrunken = kernelAlloc->reallocate(entry, sizeof(ZswapEntry) + entry->size);
+	if(shrunken)
+		entry = static_cast<ZswapEntry *>(shrunken);
+
+	poolBytes.fetch_add(sizeof(ZswapEntry) + entry->size, std::memory_order_relaxed);
+	return entry;
+}
+
+void zswapLoad(ZswapEntry *entry, PhysicalAddr physical) {
+	PageAccessor accessor{physical};
+	auto page = reinterpret_cast<uint8_t *>(accessor.get());
+	if(entry == &zeroEntry) {
+		zeroPage(page);
+	}else if(!lz4Decompress(entryData(entry), entry->size, page, kPageSize)) {
+		panicLogger() << "thor: Corrupted zswap entry " << entry << frg::endlog;
+	}
+	zswapDrop(entry);
+}
+
+void zswapDrop(ZswapEntry *entry) {
+	if(entry == &zeroEntry)
+		return;
+	poolBytes.fetch_sub(sizeof(ZswapEntry) + entry->size, std::memory_order_relaxed);
+	kernelAlloc->free(entry);
+}
+
+namespace {
+	initgraph::Task initZswap{&globalInitEngine, "generic.init-zswap",
+		initgraph::Requires{getFibersAvailableStage()},
+		[] {
+			frg::string_view percentString;
+			frg::array args = {
+				frg::option{"thor.zswap", frg::as_string_view(percentString)},
+			};
+			frg::parse_arguments(kernelCommandLine->data(), args);
+
+			size_t percent = 20;
+			if(percentString.size()) {
+				percent = 0;
+				for(size_t i = 0; i < percentString.size(); i++) {
+					auto c = percentString[i];
+					if(c < '0' || c > '9') {
+						urgentLogger() << "thor: Ignoring invalid thor.zswap option" << frg::endlog;
+						percent = 20;
+						break;
+					}
+					percent = percent * 10 + (c - '0');
+				}
+				percent = frg::min(percent, size_t{100});
+			}
+
+			maxPoolBytes = physicalAllocator->numTotalPages() * kPageSize / 100 * percent;
+			if(logZswap)
+				infoLogger() << "thor: zswap pool is limited to "
+						<< (maxPoolBytes >> 10) << " KiB" << frg::endlog;
+		}
+	};
+}
+
+} // namespace thor
@@ -4,6 +4,7 @@
 #include <frg/vector.hpp>
 #include <eir/interface.hpp>
 #include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/cpu-data.hpp>
 #include <thor-internal/fiber.hpp>
 #include <thor-internal/kernel_heap.hpp>
 #include <thor-internal/main.hpp>
@@ -127,7 +128,7 @@ void bootOtherProcessors() {
 	assert(ret == UACPI_STATUS_OK);
 	auto *madt = madtTbl.hdr;
 
-	infoLogger() << "thor: Booting APs." << frg::endlog;
+	frg::vector<unsigned int, KernelAlloc> apicIds{*kernelAlloc};
 
 	size_t offset = sizeof(acpi_sdt_hdr) + sizeof(MadtHeader);
 	while(offset < madt->length) {
@@ -137,10 +138,20 @@ void bootOtherProcessors() {
 			// TODO: Support BSPs with APIC ID != 0.
 			if((entry->flags & local_flags::enabled)
 					&& entry->localApicId) // We ignore the BSP here.
-				bootSecondary(entry->localApicId);
+				apicIds.push_back(entry->localApicId);
 		}
 		offset += generic->length;
 	}
+
+	bootSecondaries({apicIds.data(), apicIds.size()});
+
+#ifdef __x86_64__
+	// Now that all CPUs are known, assign them to their NUMA nodes.
+	for(size_t i = 0; i < getCpuCount(); i++) {
+		auto cpuData = getCpuData(i);
+		cpuData->numaNode = numaNodeOfApic(cpuData->localApicId);
+	}
+#endif
 }
 
 // --------------------------------------------------------
@@ -0,0 +1,192 @@
+#include <thor-internal/acpi/acpi.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/physical.hpp>
+
+#include <uacpi/acpi.h>
+#include <uacpi/tables.h>
+
+namespace thor::acpi {
+
+// Note: like the MADT, the SRAT is not guaranteed to be aligned.
+
+struct [[gnu::packed]] SratHeader {
+	uint32_t reserved1;
+	uint64_t reserved2;
+};
+
+struct [[gnu::packed]] SratGenericEntry {
+	uint8_t type;
+	uint8_t length;
+};
+
+struct [[gnu::packed]] SratLocalApicEntry {
+	SratGenericEntry generic;
+	uint8_t proximityDomainLow;
+	uint8_t localApicId;
+	uint32_t flags;
+	uint8_t localSapicEid;
+	uint8_t proximityDomainHigh[3];
+	uint32_t clockDomain;
+};
+
+struct [[gnu::packed]] SratMemoryEntry {
+	SratGenericEntry generic;
+	uint32_t proximityDomain;
+	uint16_t reserved1;
+	uint64_t baseAddress;
+	uint64_t length;
+	uint32_t reserved2;
+	uint32_t flags;
+	uint64_t reserved3;
+};
+
+struct [[gnu::packed]] SratX2ApicEntry {
+	SratGenericEntry generic;
+	uint16_t reserved1;
+	uint32_t proximityDomain;
+	uint32_t x2apicId;
+	uint32_t flags;
+	uint32_t clockDomain;
+	uint32_t reserved2;
+};
+
+struct [[gnu::packed]] SlitHeader {
+	uint64_t numLocalities;
+};
+
+namespace srat_flags {
+	static constexpr uint32_t enabled = 1;
+};
+
+namespace {
+
+// Maps ACPI proximity domains to dense node numbers.
+uint32_t nodeDomains[PhysicalChunkAllocator::maxNodes];
+int numNodes = 0;
+
+struct ApicAffinity {
+	uint32_t apicId;
+	int node;
+};
+
+constexpr int maxApicAffinities = 256;
+ApicAffinity apicAffinities[maxApicAffinities];
+int numApicAffinities = 0;
+
+int nodeOfDomain(uint32_t domain) {
+	for(int i = 0; i < numNodes; i++)
+		if(nodeDomains[i] == domain)
+			return i;
+	if(numNodes == PhysicalChunkAllocator::maxNodes) {
+		infoLogger() << "thor: Too many NUMA nodes, merging proximity domain "
+				<< domain << " into node 0" << frg::endlog;
+		return 0;
+	}
+	nodeDomains[numNodes] = domain;
+	return numNodes++;
+}
+
+// Unlike nodeOfDomain(), this does not allocate new nodes.
+int knownNodeOfDomain(uint32_t domain) {
+	for(int i = 0; i < numNodes; i++)
+		if(nodeDomains[i] == domain)
+			return i;
+	return -1;
+}
+
+void addApicAffinity(uint32_t apicId, uint32_t domain) {
+	if(numApicAffinities == maxApicAffinities)
+		return;
+	apicAffinities[numApicAffinities++] = {apicId, nodeOfDomain(domain)};
+}
+
+} // anonymous namespace
+
+int numaNodeOfApic(uint32_t apicId) {
+	for(int i = 0; i < numApicAffinities; i++)
+		if(apicAffinities[i].apicId == apicId)
+			return apicAffinities[i].node;
+	return 0;
+}
+
+static initgraph::Task parseSratTask{&globalInitEngine, "acpi.parse-srat",
+	initgraph::Requires{getTablesDiscoveredStage()},
+	initgraph::Entails{getTaskingAvailableStage()},
+	[] {
+		uacpi_table sratTbl;
+		if(uacpi_table_find_by_signature("SRAT", &sratTbl) != UACPI_STATUS_OK) {
+			infoLogger() << "thor: No SRAT present, assuming a single NUMA node"
+					<< frg::endlog;
+			return;
+		}
+		auto *srat = sratTbl.hdr;
+
+		size_t offset = sizeof(acpi_sdt_hdr) + sizeof(SratHeader);
+		while(offset + sizeof(SratGenericEntry) <= srat->length) {
+			auto generic = (SratGenericEntry *)(sratTbl.virt_addr + offset);
+			if(!generic->length)
+				break;
+
+			if(generic->type == 0) { // Local APIC affinity.
+				auto entry = (SratLocalApicEntry *)generic;
+				if(entry->flags & srat_flags::enabled) {
+					uint32_t domain = entry->proximityDomainLow
+							| (uint32_t(entry->proximityDomainHigh[0]) << 8)
+							| (uint32_t(entry->proximityDomainHigh[1]) << 16)
+							| (uint32_t(entry->proximityDomainHigh[2]) << 24);
+					addApicAffinity(entry->localApicId, domain);
+				}
+			}else if(generic->type == 1) { // Memory affinity.
+				auto entry = (SratMemoryEntry *)generic;
+				if(entry->baseAddress + entry->length < entry->baseAddress) {
+					infoLogger() << "thor: Ignoring SRAT memory entry at 0x"
+							<< frg::hex_fmt(entry->baseAddress) << " that wraps around"
+							<< frg::endlog;
+				}else if(entry->length && (entry->flags & srat_flags::enabled)) {
+					auto node = nodeOfDomain(entry->proximityDomain);
+					infoLogger() << "thor: Memory at 0x" << frg::hex_fmt(entry->baseAddress)
+							<< " (0x" << frg::hex_fmt(entry->length) << " bytes)"
+							<< " belongs to NUMA node " << node << frg::endlog;
+					physicalAllocator->setRegionNode(entry->baseAddress, entry->length, node);
+				}
+			}else if(generic->type == 2) { // x2APIC affinity.
+				auto entry = (SratX2ApicEntry *)generic;
+				if(entry->flags & srat_flags::enabled)
+					addApicAffinity(entry->x2apicId, entry->proximityDomain);
+			}
+			offset += generic->length;
+		}
+
+		infoLogger() << "thor: SRAT describes " << numNodes << " NUMA node(s)" << frg::endlog;
+
+		// The SLIT provides the relative distances between proximity domains.
+		// Without it, the allocator assumes that all remote nodes are equally far away.
+		uacpi_table slitTbl;
+		if(uacpi_table_find_by_signature("SLIT", &slitTbl) != UACPI_STATUS_OK)
+			return;
+		auto *slit = slitTbl.hdr;
+
+		auto header = (SlitHeader *)(slitTbl.virt_addr + sizeof(acpi_sdt_hdr));
+		uint64_t n = header->numLocalities;
+		if(sizeof(acpi_sdt_hdr) + sizeof(SlitHeader) + n * n > slit->length) {
+			infoLogger() << "thor: SLIT is truncated, ignoring it" << frg::endlog;
+			return;
+		}
+		auto matrix = (uint8_t *)(slitTbl.virt_addr + sizeof(acpi_sdt_hdr) + sizeof(SlitHeader));
+
+		for(uint64_t i = 0; i < n; i++) {
+			auto from = knownNodeOfDomain(i);
+			if(from < 0)
+				continue;
+			for(uint64_t j = 0; j < n; j++) {
+				auto to = knownNodeOfDomain(j);
+				if(to < 0)
+					continue;
+				physicalAllocator->setNodeDistance(from, to, matrix[i * n + j]);
+			}
+		}
+	}
+};
+
+} // namespace thor::acpi
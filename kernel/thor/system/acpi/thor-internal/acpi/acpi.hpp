@@ -111,6 +111,9 @@ initgraph::Stage *getAcpiWorkqueueAvailableStage();
 
 void initGlue();
 void initEc();
+
+// Returns the NUMA node of the CPU with the given (x2)APIC ID as reported by the SRAT.
+int numaNodeOfApic(uint32_t apicId);
 void initEvents();
 
 struct AcpiObject final : public KernelBusObject {
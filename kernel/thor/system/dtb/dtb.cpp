@@ -30,6 +30,20 @@ namespace {
 		>
 	> phandles;
 
+	using NodeList = frg::vector<DeviceTreeNode *, KernelAlloc>;
+
+	// Maps compatible strings to the nodes (in tree order) that list them.
+	frg::manual_box<
+		frg::hash_map<
+			frg::string_view,
+			NodeList *,
+			frg::hash<frg::string_view>,
+			KernelAlloc
+		>
+	> compatibles;
+
+	size_t nextTreeIndex = 0;
+
 	DeviceTreeNode *treeRoot;
 
 	auto parseStringList(const ::DeviceTreeProperty &prop) {
@@ -48,6 +62,7 @@ namespace {
 
 void DeviceTreeNode::initializeWith(::DeviceTreeNode dtNode) {
 	name_ = dtNode.name();
+	treeIndex_ = nextTreeIndex++;
 	generatePath_();
 
 	if (auto p = dtNode.findProperty("phandle"); p) {
@@ -149,6 +164,19 @@ void DeviceTreeNode::initializeWith(::DeviceTreeNode dtNode) {
 		}
 	}
 
+	for (auto c : compatible_) {
+		auto it = compatibles->find(c);
+		if (it == compatibles->end()) {
+			compatibles->insert(c, frg::construct<NodeList>(*kernelAlloc, *kernelAlloc));
+			it = compatibles->find(c);
+		}
+
+		// Nodes may list the same string multiple times.
+		auto nodes = it->get<1>();
+		if (nodes->empty() || nodes->back() != this)
+			nodes->push_back(this);
+	}
+
 	// Iterate again to parse things that depend on previously parsed properties
 	for (auto prop : dtNode.properties()) {
 		frg::string_view pn{prop.name()};
@@ -492,6 +520,14 @@ DeviceTreeNode *getDeviceTreeRoot() {
 	return treeRoot;
 }
 
+const frg::vector<DeviceTreeNode *, KernelAlloc> *getDeviceTreeNodesByCompatible(
+		frg::string_view compatible) {
+	auto it = compatibles->find(compatible);
+	if (it == compatibles->end())
+		return nullptr;
+	return it->get<1>();
+}
+
 static initgraph::Task initTablesTask{&globalInitEngine, "dtb.parse-dtb",
 	initgraph::Entails{getDeviceTreeParsedStage()},
 	[] {
@@ -514,6 +550,7 @@ static initgraph::Task initTablesTask{&globalInitEngine, "dtb.parse-dtb",
 
 		dt.initialize(ptr);
 		phandles.initialize(frg::hash<uint32_t>{}, *kernelAlloc);
+		compatibles.initialize(frg::hash<frg::string_view>{}, *kernelAlloc);
 
 		treeRoot = frg::construct<DeviceTreeNode>(*kernelAlloc, nullptr);
 		treeRoot->initializeWith(dt->rootNode());
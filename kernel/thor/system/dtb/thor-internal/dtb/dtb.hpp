@@ -50,6 +50,11 @@ struct DeviceTreeNode {
 		return model_;
 	}
 
+	// Position of the node in a pre-order traversal of the tree.
+	size_t treeIndex() const {
+		return treeIndex_;
+	}
+
 	template <size_t N>
 	bool isCompatible(frg::array<frg::string_view, N> with) const {
 		for (const auto &c : compatible_) {
@@ -194,6 +199,7 @@ private:
 	> children_;
 
 	frg::string_view name_;
+	size_t treeIndex_ = 0;
 	frg::string<KernelAlloc> path_;
 	frg::string_view model_;
 	uint32_t phandle_;
@@ -232,6 +238,45 @@ private:
 DeviceTreeNode *getDeviceTreeNodeByPath(frg::string_view path);
 DeviceTreeNode *getDeviceTreeRoot();
 
+// Returns all nodes (in tree order) that list the given compatible string, or nullptr.
+const frg::vector<DeviceTreeNode *, KernelAlloc> *getDeviceTreeNodesByCompatible(
+		frg::string_view compatible);
+
+// Calls func on all nodes (in tree order) that are compatible with any of the given strings;
+// stops once func returns true. In contrast to forEach(), this does not traverse the tree
+// but uses the index of compatible strings that is built while parsing the DTB.
+template <size_t N, typename F>
+bool forEachCompatibleDeviceTreeNode(frg::array<frg::string_view, N> with, F &&func) {
+	const frg::vector<DeviceTreeNode *, KernelAlloc> *lists[N];
+	size_t positions[N];
+	for (size_t i = 0; i < N; i++) {
+		lists[i] = getDeviceTreeNodesByCompatible(with[i]);
+		positions[i] = 0;
+	}
+
+	// Merge the lists; nodes that match multiple strings are only visited once.
+	while (true) {
+		DeviceTreeNode *next = nullptr;
+		for (size_t i = 0; i < N; i++) {
+			if (!lists[i] || positions[i] == lists[i]->size())
+				continue;
+			auto candidate = (*lists[i])[positions[i]];
+			if (!next || candidate->treeIndex() < next->treeIndex())
+				next = candidate;
+		}
+		if (!next)
+			return false;
+
+		for (size_t i = 0; i < N; i++) {
+			if (lists[i] && positions[i] < lists[i]->size() && (*lists[i])[positions[i]] == next)
+				positions[i]++;
+		}
+
+		if (func(next))
+			return true;
+	}
+}
+
 initgraph::Stage *getDeviceTreeParsedStage();
 
 static inline frg::array<frg::string_view, 12> dtGicV2Compatible = {
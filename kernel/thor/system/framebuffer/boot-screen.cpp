@@ -101,8 +101,11 @@ void BootScreen::printChar(char) {
 	};
 
 	if(auto cs = currentLogSequence(); _bottomSequence < cs) {
-		// Fully redraw the first _height - 1 lines.
-		for(size_t i = 1; i < _height; i++) {
+		// Scroll the lines that stay visible and only draw the new ones.
+		// Line _height - 1 - i shows message cs - i.
+		auto fresh = frg::min<uint64_t>(cs - _bottomSequence, _height - 1);
+		_display->scrollUp(fresh);
+		for(size_t i = 1; i <= fresh; i++) {
 			if(cs < i)
 				break;
 			displayLine(cs - i, _height - 1 - i);
@@ -1,4 +1,5 @@
 
+#include <string.h>
 #include <render-text.hpp>
 #include <thor-internal/arch/cpu.hpp>
 #include <thor-internal/fiber.hpp>
@@ -20,6 +21,9 @@ namespace thor {
 constexpr size_t fontHeight = 16;
 constexpr size_t fontWidth = 8;
 
+// Rows beyond this limit are not tracked and always treated as fully drawn.
+constexpr size_t maxTrackedRows = 512;
+
 struct FbDisplay final : TextDisplay {
 	FbDisplay(void *ptr, unsigned int width, unsigned int height, size_t pitch)
 	: _width{width}, _height{height}, _pitch{pitch / sizeof(uint32_t)} {
@@ -38,14 +42,30 @@ struct FbDisplay final : TextDisplay {
 	void setChars(unsigned int x, unsigned int y,
 			const char *c, int count, int fg, int bg) override;
 	void setBlanks(unsigned int x, unsigned int y, int count, int bg) override;
+	void scrollUp(unsigned int lines) override;
 
 private:
 	void _clearScreen(uint32_t rgb_color);
 
+	// Number of columns of row y that may contain something other than defaultBg.
+	unsigned int _extent(unsigned int y) {
+		if(y >= maxTrackedRows)
+			return getWidth();
+		return _rowExtent[y];
+	}
+
+	void _setExtent(unsigned int y, unsigned int extent) {
+		if(y < maxTrackedRows)
+			_rowExtent[y] = extent;
+	}
+
 	volatile uint32_t *_window;
 	unsigned int _width;
 	unsigned int _height;
 	size_t _pitch;
+
+	GlyphRowCache<fontWidth> _glyphCache;
+	uint16_t _rowExtent[maxTrackedRows] = {};
 };
 
 size_t FbDisplay::getWidth() {
@@ -58,14 +78,29 @@ size_t FbDisplay::getHeight() {
 
 void FbDisplay::setChars(unsigned int x, unsigned int y,
 		const char *c, int count, int fg, int bg) {
-	renderChars((void *)_window, _pitch, x, y, c, count, fg, bg,
+	renderChars(_glyphCache, (void *)_window, _pitch, x, y, c, count, fg, bg,
 			std::integral_constant<int, fontWidth>{},
 			std::integral_constant<int, fontHeight>{});
+	if(x + count > _extent(y))
+		_setExtent(y, x + count);
 }
 
 void FbDisplay::setBlanks(unsigned int x, unsigned int y, int count, int bg) {
 	auto bg_rgb = (bg < 0) ? defaultBg : rgbColor[bg];
 
+	// Cells past the extent of the row are already blank.
+	if(bg < 0) {
+		auto extent = _extent(y);
+		if(x >= extent)
+			return;
+		if(x + count >= extent) {
+			count = extent - x;
+			_setExtent(y, x);
+		}
+	}else if(x + count > _extent(y)) {
+		_setExtent(y, x + count);
+	}
+
 	auto dest_line = _window + y * fontHeight * _pitch + x * fontWidth;
 	for(size_t i = 0; i < fontHeight; i++) {
 		auto dest = dest_line;
@@ -77,6 +112,26 @@ void FbDisplay::setBlanks(unsigned int x, unsigned int y, int count, int bg) {
 	}
 }
 
+void FbDisplay::scrollUp(unsigned int lines) {
+	auto rows = getHeight();
+	if(lines >= rows) {
+		_clearScreen(defaultBg);
+		memset(_rowExtent, 0, sizeof(_rowExtent));
+		return;
+	}
+
+	// The pitch is constant, hence the text rows that stay visible are a single
+	// contiguous block of memory.
+	auto shift = lines * fontHeight * _pitch;
+	memmove(const_cast<uint32_t *>(_window), const_cast<uint32_t *>(_window) + shift,
+			((rows - lines) * fontHeight * _pitch) * sizeof(uint32_t));
+
+	for(unsigned int y = 0; y < rows; y++)
+		_setExtent(y, (y + lines < rows) ? _extent(y + lines) : getWidth());
+	for(unsigned int y = rows - lines; y < rows; y++)
+		setBlanks(0, y, getWidth(), -1);
+}
+
 void FbDisplay::_clearScreen(uint32_t rgb_color) {
 	auto dest_line = _window;
 	for(size_t i = 0; i < _height; i++) {
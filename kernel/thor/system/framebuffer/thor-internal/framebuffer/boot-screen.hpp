@@ -11,6 +11,8 @@ struct TextDisplay {
 	virtual void setChars(unsigned int x, unsigned int y,
 			const char *c, int count, int fg, int bg) = 0;
 	virtual void setBlanks(unsigned int x, unsigned int y, int count, int bg) = 0;
+	// Moves the screen contents up and blanks the bottom lines.
+	virtual void scrollUp(unsigned int lines) = 0;
 
 protected:
 	~TextDisplay() = default;
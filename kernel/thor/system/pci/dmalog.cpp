@@ -31,7 +31,9 @@ constexpr arch::field<uint32_t, bool> isrOutStatus{0, 1};
 constexpr arch::field<uint32_t, bool> isrInStatus{1, 1};
 
 struct DmalogDevice final : IrqSink, KernelIoChannel {
-	static constexpr size_t ringSize = kPageSize;
+	// Each transfer costs a round trip to the device; large rings allow high-rate
+	// producers (e.g., profiling) to batch many records into a single transfer.
+	static constexpr size_t ringSize = 16 * kPageSize;
 
 	DmalogDevice(frg::string<KernelAlloc> tag, frg::string<KernelAlloc> descriptiveTag, void *mmioPtr)
 	: IrqSink{frg::string<KernelAlloc>{*kernelAlloc, "dmalog-"}
@@ -40,8 +42,8 @@ struct DmalogDevice final : IrqSink, KernelIoChannel {
 			KernelIoChannel{std::move(tag), std::move(descriptiveTag)},
 			mmioSpace_{mmioPtr} {
 		ctrlPhysical_ = physicalAllocator->allocate(kPageSize);
-		outPhysical_ = physicalAllocator->allocate(kPageSize);
-		inPhysical_ = physicalAllocator->allocate(kPageSize);
+		outPhysical_ = physicalAllocator->allocate(ringSize);
+		inPhysical_ = physicalAllocator->allocate(ringSize);
 		assert(ctrlPhysical_ != PhysicalAddr(-1) && "OOM in dmalog");
 		assert(outPhysical_ != PhysicalAddr(-1) && "OOM in dmalog");
 		assert(inPhysical_ != PhysicalAddr(-1) && "OOM in dmalog");
@@ -53,17 +55,19 @@ struct DmalogDevice final : IrqSink, KernelIoChannel {
 		inView_ = reinterpret_cast<std::byte *>(
 				KernelVirtualMemory::global().allocate(2 * ringSize));
 
-		// TODO: We need to map more memory if we want to support rings > kPageSize.
-		KernelPageSpace::global().mapSingle4k(reinterpret_cast<uintptr_t>(outView_),
-				outPhysical_, page_access::write, CachingMode::writeBack);
-		KernelPageSpace::global().mapSingle4k(reinterpret_cast<uintptr_t>(outView_) + kPageSize,
-				outPhysical_, page_access::write, CachingMode::writeBack);
-
-		// TODO: We need to map more memory if we want to support rings > kPageSize.
-		KernelPageSpace::global().mapSingle4k(reinterpret_cast<uintptr_t>(inView_),
-				inPhysical_, page_access::write, CachingMode::writeBack);
-		KernelPageSpace::global().mapSingle4k(reinterpret_cast<uintptr_t>(inView_) + kPageSize,
-				inPhysical_, page_access::write, CachingMode::writeBack);
+		for(size_t pg = 0; pg < ringSize; pg += kPageSize) {
+			KernelPageSpace::global().mapSingle4k(reinterpret_cast<uintptr_t>(outView_) + pg,
+					outPhysical_ + pg, page_access::write, CachingMode::writeBack);
+			KernelPageSpace::global().mapSingle4k(
+					reinterpret_cast<uintptr_t>(outView_) + ringSize + pg,
+					outPhysical_ + pg, page_access::write, CachingMode::writeBack);
+
+			KernelPageSpace::global().mapSingle4k(reinterpret_cast<uintptr_t>(inView_) + pg,
+					inPhysical_ + pg, page_access::write, CachingMode::writeBack);
+			KernelPageSpace::global().mapSingle4k(
+					reinterpret_cast<uintptr_t>(inView_) + ringSize + pg,
+					inPhysical_ + pg, page_access::write, CachingMode::writeBack);
+		}
 
 		PageAccessor ctrlAccessor{ctrlPhysical_};
 		auto ctrlPtr = reinterpret_cast<std::byte *>(ctrlAccessor.get());
@@ -109,15 +113,16 @@ struct DmalogDevice final : IrqSink, KernelIoChannel {
 
 			auto offset = outTail_ & (ringSize - 1);
 
+			// The ring is physically contiguous, hence we only need to split at the wrap-around.
 			size_t progress = 0;
 			size_t k = 0;
 			while(progress < size) {
 				assert(k < 2);
-				auto misalign = (offset + progress) & (kPageSize - 1);
-				auto chunk = frg::min(size - progress, kPageSize - misalign);
+				auto ringOffset = (offset + progress) & (ringSize - 1);
+				auto chunk = frg::min(size - progress, ringSize - ringOffset);
 
 				outDesc_->buffers[k] = {
-					.ptr = outPhysical_ + misalign,
+					.ptr = outPhysical_ + ringOffset,
 					.length = chunk
 				};
 				progress += chunk;
@@ -140,15 +145,16 @@ struct DmalogDevice final : IrqSink, KernelIoChannel {
 
 			auto offset = inHead_ & (ringSize - 1);
 
+			// The ring is physically contiguous, hence we only need to split at the wrap-around.
 			size_t progress = 0;
 			size_t k = 0;
 			while(progress < size) {
 				assert(k < 2);
-				auto misalign = (offset + progress) & (kPageSize - 1);
-				auto chunk = frg::min(size - progress, kPageSize - misalign);
+				auto ringOffset = (offset + progress) & (ringSize - 1);
+				auto chunk = frg::min(size - progress, ringSize - ringOffset);
 
 				inDesc_->buffers[k] = {
-					.ptr = inPhysical_ + misalign,
+					.ptr = inPhysical_ + ringOffset,
 					.length = chunk
 				};
 				progress += chunk;
@@ -237,6 +237,7 @@ static initgraph::Task discoverConfigIoSpaces{&globalInitEngine, "pci.discover-a
 };
 
 static initgraph::Task discoverAcpiRootBuses{&globalInitEngine, "pci.discover-acpi-root-buses",
+	initgraph::Concurrent{},
 	initgraph::Requires{getTaskingAvailableStage(), acpi::getNsAvailableStage()},
 	initgraph::Entails{getDevicesEnumeratedStage()},
 	[] {
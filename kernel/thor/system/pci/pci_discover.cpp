@@ -261,6 +261,9 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 			resp.add_bars(std::move(msg));
 		}
 
+		// Drivers query the info before touching the ROM, so this is the first use.
+		probeExpansionRom();
+
 		managarm::hw::PciExpansionRom<KernelAlloc> msg(*kernelAlloc);
 		msg.set_address(expansionRom.address);
 		msg.set_length(expansionRom.length);
@@ -308,6 +311,7 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 			co_return Error::protocolViolation;
 		}
 
+		probeExpansionRom();
 		assert(expansionRom.address);
 		AnyDescriptor descriptor = MemoryViewDescriptor{expansionRom.memory};
 
@@ -318,6 +322,42 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 
 		auto descError = co_await PushDescriptorSender{conversation, std::move(descriptor)};
 
+		if (descError != Error::success)
+			co_return descError;
+	}else if(preamble.id() == bragi::message_id<managarm::hw::AccessDmaSpaceRequest>) {
+		auto req = bragi::parse_head_only<managarm::hw::AccessDmaSpaceRequest>(
+				reqBuffer, *kernelAlloc);
+
+		if(!req) {
+			infoLogger() << "thor: Closing lane due to illegal HW request." << frg::endlog;
+			co_return Error::protocolViolation;
+		}
+
+		if(!dmaSpace) {
+			if(auto iommu = getIommuForPciDevice(seg, bus, slot, function); iommu) {
+				auto domain = iommu->createPciDomain(seg, bus, slot, function);
+				if(domain)
+					dmaSpace = smarter::allocate_shared<DmaSpace>(*kernelAlloc,
+							std::move(domain));
+			}
+		}
+
+		if(!dmaSpace) {
+			managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
+			resp.set_error(managarm::hw::Errors::DEVICE_ERROR);
+
+			FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
+			co_return frg::success;
+		}
+
+		managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
+		resp.set_error(managarm::hw::Errors::SUCCESS);
+
+		FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
+
+		auto descError = co_await PushDescriptorSender{conversation,
+				DmaSpaceDescriptor{dmaSpace}};
+
 		if (descError != Error::success)
 			co_return descError;
 	}else if(preamble.id() == bragi::message_id<managarm::hw::AccessIrqRequest>) {
@@ -406,7 +446,15 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 				+ frg::to_allocated_string(*kernelAlloc, req->index()));
 		IrqPin::attachSink(interrupt, object.get());
 
-		static_cast<PciDevice *>(this)->setupMsi(interrupt, req->index());
+		if(req->cpu() >= 0 && !interrupt->setAffinity(req->cpu()))
+			infoLogger() << "thor: Cannot route " << interrupt->name()
+					<< " to CPU " << req->cpu() << frg::endlog;
+
+		auto device = static_cast<PciDevice *>(this);
+		if(device->msiPins.size() < numMsis)
+			device->msiPins.resize(numMsis, nullptr);
+		device->msiPins[req->index()] = interrupt;
+		device->setupMsi(interrupt, req->index());
 
 		managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
 		resp.set_error(managarm::hw::Errors::SUCCESS);
@@ -417,6 +465,34 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 
 		if (descError != Error::success)
 			co_return descError;
+	}else if(preamble.id() == bragi::message_id<managarm::hw::SetMsiAffinityRequest>) {
+		auto req = bragi::parse_head_only<managarm::hw::SetMsiAffinityRequest>(
+				reqBuffer, *kernelAlloc);
+
+		if (!req) {
+			infoLogger() << "thor: Closing lane due to illegal HW request." << frg::endlog;
+			co_return Error::protocolViolation;
+		}
+
+		if(type() != PciEntityType::Device) {
+			infoLogger() << "thor: Unsupported operation on PCI entity." << frg::endlog;
+			co_return Error::protocolViolation;
+		}
+
+		auto device = static_cast<PciDevice *>(this);
+
+		managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
+		if(req->index() >= device->msiPins.size() || !device->msiPins[req->index()]
+				|| req->cpu() < 0) {
+			resp.set_error(managarm::hw::Errors::ILLEGAL_ARGUMENTS);
+		}else if(!device->msiPins[req->index()]->setAffinity(req->cpu())) {
+			resp.set_error(managarm::hw::Errors::OUT_OF_BOUNDS);
+		}else{
+			device->setupMsi(device->msiPins[req->index()], req->index());
+			resp.set_error(managarm::hw::Errors::SUCCESS);
+		}
+
+		FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
 	}else if(preamble.id() == bragi::message_id<managarm::hw::ClaimDeviceRequest>) {
 		auto req = bragi::parse_head_only<managarm::hw::ClaimDeviceRequest>(reqBuffer, *kernelAlloc);
 
@@ -551,6 +627,43 @@ coroutine<frg::expected<Error>> PciEntity::handleRequest(LaneHandle lane) {
 		}
 
 		FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
+	}else if(preamble.id() == bragi::message_id<managarm::hw::LoadPciSpaceRangeRequest>) {
+		auto req = bragi::parse_head_only<managarm::hw::LoadPciSpaceRangeRequest>(
+				reqBuffer, *kernelAlloc);
+
+		if (!req) {
+			infoLogger() << "thor: Closing lane due to illegal HW request." << frg::endlog;
+			co_return Error::protocolViolation;
+		}
+
+		managarm::hw::SvrResponse<KernelAlloc> resp{*kernelAlloc};
+
+		auto io = parentBus->io;
+
+		size_t offset = req->offset();
+		size_t size = req->size();
+		if(!size || (offset & 3) || (size & 3) || offset + size > io->spaceSize()) {
+			resp.set_error(managarm::hw::Errors::ILLEGAL_ARGUMENTS);
+
+			FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
+			co_return frg::success;
+		}
+
+		// The range is sent as a separate buffer after the response.
+		frg::unique_memory<KernelAlloc> rangeBuffer{*kernelAlloc, size};
+		for(size_t i = 0; i < size; i += 4) {
+			auto word = io->readConfigWord(parentBus, slot, function, offset + i);
+			memcpy(reinterpret_cast<char *>(rangeBuffer.data()) + i, &word, 4);
+		}
+
+		resp.set_error(managarm::hw::Errors::SUCCESS);
+
+		FRG_CO_TRY(co_await sendResponse(conversation, std::move(resp)));
+
+		auto rangeError = co_await SendBufferSender{conversation, std::move(rangeBuffer)};
+
+		if (rangeError != Error::success)
+			co_return rangeError;
 	}else if(preamble.id() == bragi::message_id<managarm::hw::StorePciSpaceRequest>) {
 		auto req = bragi::parse_head_only<managarm::hw::StorePciSpaceRequest>(reqBuffer, *kernelAlloc);
 
@@ -748,8 +861,11 @@ void PciDevice::setupMsi(MsiPin *msi, size_t index) {
 	auto io = parentBus->io;
 
 	if (msixIndex >= 0) {
-		// Setup the MSI-X table.
+		// Setup the MSI-X table. The entry may be live (when it is retargeted),
+		// so keep it masked while the address and data are inconsistent.
 		auto space = arch::mem_space{msixMapping}.subspace(index * 16);
+		space.store(msixVectorControl,
+				space.load(msixVectorControl) | 1);
 		space.store(msixMessageAddress, msi->getMessageAddress());
 		space.store(msixMessageData, msi->getMessageData());
 		space.store(msixVectorControl,
@@ -1101,37 +1217,46 @@ void findPciCaps(PciEntity *entity) {
 	}
 }
 
+void PciEntity::probeExpansionRom() {
+	if(expansionRomProbed)
+		return;
+	expansionRomProbed = true;
+
+	auto io = parentBus->io;
+	auto offset = (type() == PciEntityType::Bridge)
+			? kPciBridgeExpansionRomBaseAddress
+			: kPciRegularExpansionRomBaseAddress;
+
+	uint32_t expansion_rom_addr = io->readConfigWord(parentBus, slot, function, offset);
+	// write all 1s to the expansion rom addr and read it back to determine this its length.
+	io->writeConfigWord(parentBus, slot, function, offset, 0xFFFFFFFF);
+
+	uint32_t expansion_rom_mask = io->readConfigWord(parentBus, slot, function, offset) & 0xFFFFFFFC;
+	io->writeConfigWord(parentBus, slot, function, offset, expansion_rom_addr);
+
+	if(expansion_rom_mask) {
+		auto expansion_rom_length = computeBarLength(expansion_rom_mask);
+		// Enable it
+		io->writeConfigWord(parentBus, slot, function, offset, expansion_rom_addr | 1);
+		// Map it
+		auto pageOffset = expansion_rom_addr & (kPageSize - 1);
+		expansionRom.memory = smarter::allocate_shared<HardwareMemory>(*kernelAlloc,
+					expansion_rom_addr & ~(kPageSize - 1),
+					(expansion_rom_length + pageOffset + (kPageSize - 1)) & ~(kPageSize - 1),
+					CachingMode::uncached); // Some cards have problems with caching the PCI Expansion Rom
+		expansionRom.offset = pageOffset;
+		expansionRom.address = expansion_rom_addr;
+		expansionRom.length = expansion_rom_length;
+	} else {
+		expansionRom.address = 0;
+	}
+}
+
 template <typename EnumFunc>
 void checkPciFunction(PciBus *bus, uint32_t slot, uint32_t function,
 		EnumFunc &&enumerateDownstream) {
 	auto io = bus->io;
 
-	auto parseExpansionRom = [&io, bus, slot, function](PciEntity *device, uint32_t offset) {
-		uint32_t expansion_rom_addr = io->readConfigWord(bus, slot, function, offset);
-		// write all 1s to the expansion rom addr and read it back to determine this its length.
-		io->writeConfigWord(bus, slot, function, offset, 0xFFFFFFFF);
-
-		uint32_t expansion_rom_mask = io->readConfigWord(bus, slot, function, offset) & 0xFFFFFFFC;
-		io->writeConfigWord(bus, slot, function, offset, expansion_rom_addr);
-
-		if(expansion_rom_mask) {
-			auto expansion_rom_length = computeBarLength(expansion_rom_mask);
-			// Enable it
-			io->writeConfigWord(bus, slot, function, offset, expansion_rom_addr | 1);
-			// Map it
-			auto offset = expansion_rom_addr & (kPageSize - 1);
-			device->expansionRom.memory = smarter::allocate_shared<HardwareMemory>(*kernelAlloc,
-						expansion_rom_addr & ~(kPageSize - 1),
-						(expansion_rom_length + offset + (kPageSize - 1)) & ~(kPageSize - 1),
-						CachingMode::uncached); // Some cards have problems with caching the PCI Expansion Rom
-			device->expansionRom.offset = offset;
-			device->expansionRom.address = expansion_rom_addr;
-			device->expansionRom.length = expansion_rom_length;
-		} else {
-			device->expansionRom.address = 0;
-		}
-	};
-
 	uint16_t vendor = io->readConfigHalf(bus, slot, function, kPciVendor);
 	if(vendor == 0xFFFF)
 		return;
@@ -1204,7 +1329,6 @@ void checkPciFunction(PciBus *bus, uint32_t slot, uint32_t function,
 		}
 
 		readEntityBars(device.get(), 6);
-		parseExpansionRom(device.get(), kPciRegularExpansionRomBaseAddress);
 
 		auto irq_index = static_cast<IrqIndex>(io->readConfigByte(bus, slot, function,
 				kPciRegularInterruptPin));
@@ -1281,7 +1405,6 @@ void checkPciFunction(PciBus *bus, uint32_t slot, uint32_t function,
 		findPciCaps(bridge);
 
 		readEntityBars(bridge, 2);
-		parseExpansionRom(bridge, kPciBridgeExpansionRomBaseAddress);
 
 		uint8_t downstreamId = io->readConfigByte(bus, slot, function, kPciBridgeSecondary);
 
@@ -168,12 +168,9 @@ static initgraph::Task discoverDtbNodes{&globalInitEngine, "pci.discover-dtb-nod
 	[] {
 		size_t i = 0;
 
-		getDeviceTreeRoot()->forEach([&](DeviceTreeNode *node) -> bool {
-			if (node->isCompatible(dtPciCompatible)) {
-				initPciNode(node);
-				i++;
-			}
-
+		forEachCompatibleDeviceTreeNode(dtPciCompatible, [&](DeviceTreeNode *node) -> bool {
+			initPciNode(node);
+			i++;
 			return false;
 		});
 
@@ -9,75 +9,71 @@ EcamPcieConfigIo::EcamPcieConfigIo(uintptr_t mmioBase, uint16_t seg,
 : mmioBase_{mmioBase}, busMappings_{frg::hash<uint32_t>{}, *kernelAlloc},
 		seg_{seg}, busStart_{busStart}, busEnd_{busEnd} { }
 
-arch::mem_space EcamPcieConfigIo::spaceForBus_(uint32_t bus) {
+arch::mem_space EcamPcieConfigIo::spaceForFunction_(uint32_t bus, uint32_t slot,
+		uint32_t function) {
 	assert(bus >= busStart_ && bus <= busEnd_);
+	assert(slot < 32 && function < 8);
 
-	if (auto mapping = busMappings_.get(bus); mapping) {
-		return arch::mem_space{*mapping};
+	auto mapping = busMappings_.get(bus);
+	if (!mapping) {
+		constexpr uintptr_t size = 1 << 20;
+		busMappings_.insert(bus, BusMapping{KernelVirtualMemory::global().allocate(size), {}});
+		mapping = busMappings_.get(bus);
 	}
 
-	constexpr uintptr_t size = 1 << 20;
-	uintptr_t offset = uintptr_t(bus - busStart_) << 20;
+	auto page = (slot << 3) | function;
+	auto window = reinterpret_cast<VirtualAddr>(mapping->window) + (page << 12);
 
-	auto ptr = KernelVirtualMemory::global().allocate(size);
-
-	for (size_t i = 0; i < size; i += 0x1000) {
-		KernelPageSpace::global().mapSingle4k(
-				VirtualAddr(ptr) + i, mmioBase_ + i + offset,
+	if (!(mapping->mappedPages[page / 64] & (uint64_t{1} << (page % 64)))) {
+		uintptr_t offset = (uintptr_t(bus - busStart_) << 20) | (page << 12);
+		KernelPageSpace::global().mapSingle4k(window, mmioBase_ + offset,
 				page_access::write, CachingMode::mmio);
+		mapping->mappedPages[page / 64] |= uint64_t{1} << (page % 64);
 	}
 
-	busMappings_.insert(bus, ptr);
-
-	return arch::mem_space{ptr};
-}
-
-uintptr_t EcamPcieConfigIo::calculateOffset_(uint32_t slot, uint32_t function,
-		uint16_t offset) {
-	assert(offset < 0x1000);
-	return (slot << 15) | (function << 12) | offset;
+	return arch::mem_space{reinterpret_cast<void *>(window)};
 }
 
 uint8_t EcamPcieConfigIo::readConfigByte(uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function, uint16_t offset) {
 	assert(seg == seg_);
-	auto space = spaceForBus_(bus);
-	auto spaceOffset = calculateOffset_(slot, function, offset);
-	return arch::scalar_load<uint8_t>(space, spaceOffset);
+	assert(offset < 0x1000);
+	auto space = spaceForFunction_(bus, slot, function);
+	return arch::scalar_load<uint8_t>(space, offset);
 }
 
 uint16_t EcamPcieConfigIo::readConfigHalf(uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function, uint16_t offset) {
 	assert(seg == seg_);
-	auto space = spaceForBus_(bus);
-	auto spaceOffset = calculateOffset_(slot, function, offset);
-	return arch::scalar_load<uint16_t>(space, spaceOffset);
+	assert(offset < 0x1000);
+	auto space = spaceForFunction_(bus, slot, function);
+	return arch::scalar_load<uint16_t>(space, offset);
 }
 
 uint32_t EcamPcieConfigIo::readConfigWord(uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function, uint16_t offset) {
 	assert(seg == seg_);
-	auto space = spaceForBus_(bus);
-	auto spaceOffset = calculateOffset_(slot, function, offset);
-	return arch::scalar_load<uint32_t>(space, spaceOffset);
+	assert(offset < 0x1000);
+	auto space = spaceForFunction_(bus, slot, function);
+	return arch::scalar_load<uint32_t>(space, offset);
 }
 
 void EcamPcieConfigIo::writeConfigByte(uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function, uint16_t offset, uint8_t value) {
 	assert(seg == seg_);
-	auto space = spaceForBus_(bus);
-	auto spaceOffset = calculateOffset_(slot, function, offset);
-	arch::scalar_store<uint8_t>(space, spaceOffset, value);
+	assert(offset < 0x1000);
+	auto space = spaceForFunction_(bus, slot, function);
+	arch::scalar_store<uint8_t>(space, offset, value);
 }
 
 void EcamPcieConfigIo::writeConfigHalf(uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function, uint16_t offset, uint16_t value) {
 	assert(seg == seg_);
-	auto space = spaceForBus_(bus);
-	auto spaceOffset = calculateOffset_(slot, function, offset);
-	arch::scalar_store<uint16_t>(space, spaceOffset, value);
+	assert(offset < 0x1000);
+	auto space = spaceForFunction_(bus, slot, function);
+	arch::scalar_store<uint16_t>(space, offset, value);
 }
 
 void EcamPcieConfigIo::writeConfigWord(uint32_t seg, uint32_t bus, uint32_t slot, uint32_t function, uint16_t offset, uint32_t value) {
 	assert(seg == seg_);
-	auto space = spaceForBus_(bus);
-	auto spaceOffset = calculateOffset_(slot, function, offset);
-	arch::scalar_store<uint32_t>(space, spaceOffset, value);
+	assert(offset < 0x1000);
+	auto space = spaceForFunction_(bus, slot, function);
+	arch::scalar_store<uint32_t>(space, offset, value);
 }
 
 } // namespace thor::pci
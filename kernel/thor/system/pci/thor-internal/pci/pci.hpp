@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <thor-internal/dma-space.hpp>
 #include <thor-internal/mbus.hpp>
 
 #include <frg/vector.hpp>
@@ -297,7 +298,11 @@ struct PciEntity : protected KernelBusObject {
 
 	frg::vector<Capability, KernelAlloc> caps{*kernelAlloc};
 
+	// Sized and mapped on first use by probeExpansionRom(), not during enumeration.
 	PciExpansionRom expansionRom;
+	bool expansionRomProbed = false;
+
+	void probeExpansionRom();
 
 	// MSI / MSI-X support.
 	unsigned int numMsis = 0;
@@ -307,6 +312,9 @@ struct PciEntity : protected KernelBusObject {
 	bool msiEnabled = false;
 	bool msiInstalled = false;
 
+	// Created on first use; all drivers of the device share the same DMA space.
+	smarter::shared_ptr<DmaSpace> dmaSpace;
+
 private:
 	coroutine<frg::expected<Error>> handleRequest(LaneHandle lane) override;
 
@@ -369,6 +377,9 @@ struct PciDevice final : PciEntity {
 
 	IrqPin *interrupt;
 
+	// MSI pins installed by installMsi requests, indexed by MSI(-X) vector.
+	frg::vector<MsiPin *, KernelAlloc> msiPins{*kernelAlloc};
+
 	// device configuration
 	PciBar bars[6];
 
@@ -487,6 +498,11 @@ struct PciConfigIo {
 	virtual void writeConfigWord(uint32_t seg, uint32_t bus, uint32_t slot,
 			uint32_t function, uint16_t offset, uint32_t value) = 0;
 
+	// Size of the config space of each function (4 KiB if extended config space is supported).
+	virtual size_t spaceSize() {
+		return 0x100;
+	}
+
 protected:
 	~PciConfigIo() = default;
 };
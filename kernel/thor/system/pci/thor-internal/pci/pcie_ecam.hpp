@@ -23,16 +23,26 @@ struct EcamPcieConfigIo final : PciConfigIo {
 	void writeConfigWord(uint32_t seg, uint32_t bus, uint32_t slot,
 			uint32_t function, uint16_t offset, uint32_t value) override;
 
+	size_t spaceSize() override {
+		return 0x1000;
+	}
+
 private:
-	arch::mem_space spaceForBus_(uint32_t bus);
-	uintptr_t calculateOffset_(uint32_t slot, uint32_t function,
-			uint16_t offset);
+	// The 4 KiB of config space of a single function.
+	arch::mem_space spaceForFunction_(uint32_t bus, uint32_t slot, uint32_t function);
+
+	// Each bus gets a 1 MiB window of virtual memory, but pages are only mapped
+	// once a function is accessed: enumeration only touches a fraction of them.
+	struct BusMapping {
+		void *window;
+		uint64_t mappedPages[256 / 64];
+	};
 
 	uintptr_t mmioBase_;
 
 	frg::hash_map<
 		uint32_t,
-		void *,
+		BusMapping,
 		frg::hash<uint32_t>,
 		KernelAlloc
 	> busMappings_;
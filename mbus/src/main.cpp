@@ -11,12 +11,14 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <queue>
+#include <set>
 #include <variant>
 #include <vector>
 
 #include <frg/rbtree.hpp>
 
 #include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
 #include <async/sequenced-event.hpp>
 #include <async/result.hpp>
 #include <async/queue.hpp>
@@ -59,7 +61,7 @@ struct Entity {
 	}
 
 	void updateProperty(std::string key, mbus_ng::AnyItem value) {
-		_properties.emplace(key, value);
+		_properties.insert_or_assign(std::move(key), std::move(value));
 	}
 
 	async::result<void> submitRemoteLane(helix::UniqueLane &&lane) {
@@ -204,6 +206,88 @@ using EntitySeqTree = frg::rbtree<
 >;
 EntitySeqTree entitySeqTree;
 
+// Inverted index from (property, value) to the entities that currently carry that value.
+// Only string items are indexed since matchesFilter() cannot match anything else.
+// Buckets are created on demand and never destroyed, so pointers to them stay valid.
+struct EntityPtrSeqLess {
+	using is_transparent = void;
+
+	bool operator()(const Entity *a, const Entity *b) const {
+		return a->seq() < b->seq();
+	}
+	bool operator()(const Entity *a, uint64_t seq) const {
+		return a->seq() < seq;
+	}
+	bool operator()(uint64_t seq, const Entity *b) const {
+		return seq < b->seq();
+	}
+};
+
+struct IndexBucket {
+	// Ordered by seq so that enumeration can start at the requested seq.
+	// Entities must be removed before their seq changes.
+	std::set<Entity *, EntityPtrSeqLess> entities;
+	// Raised whenever an entity is (re-)inserted into this bucket.
+	// Observers whose filter contains this equality wait here instead of on globalSeq.
+	async::recurring_event changed;
+};
+
+std::unordered_map<std::string, std::unordered_map<std::string, IndexBucket>> propertyIndex;
+
+IndexBucket *getBucket(const std::string &property, const std::string &value) {
+	return &propertyIndex[property][value];
+}
+
+void indexEntity(Entity *entity) {
+	for(auto &[key, item] : entity->getProperties()) {
+		if(auto str = std::get_if<mbus_ng::StringItem>(&item); str)
+			getBucket(key, str->value)->entities.insert(entity);
+	}
+}
+
+void unindexEntity(Entity *entity) {
+	for(auto &[key, item] : entity->getProperties()) {
+		if(auto str = std::get_if<mbus_ng::StringItem>(&item); str)
+			getBucket(key, str->value)->entities.erase(entity);
+	}
+}
+
+// Wakes up everyone that might be interested in a new or changed entity.
+void notifyObservers(Entity *entity) {
+	// Collect the buckets first: waiters may resume inline and touch the index.
+	std::vector<IndexBucket *> buckets;
+	for(auto &[key, item] : entity->getProperties()) {
+		if(auto str = std::get_if<mbus_ng::StringItem>(&item); str)
+			buckets.push_back(getBucket(key, str->value));
+	}
+
+	globalSeq.raise();
+	for(auto bucket : buckets)
+		bucket->changed.raise();
+}
+
+// Returns the smallest bucket that contains all entities matching the filter,
+// or nullptr if the filter has no equality that every match must satisfy.
+IndexBucket *selectBucket(const AnyFilter &filter) {
+	if(auto real = std::get_if<EqualsFilter>(&filter); real) {
+		auto value = real->getValue();
+		if(auto str = std::get_if<mbus_ng::StringItem>(&value); str)
+			return getBucket(real->getProperty(), str->value);
+		return nullptr;
+	}else if(auto real = std::get_if<Conjunction>(&filter); real) {
+		IndexBucket *best = nullptr;
+		for(auto &operand : real->getOperands()) {
+			auto bucket = selectBucket(operand);
+			if(bucket && (!best || bucket->entities.size() < best->entities.size()))
+				best = bucket;
+		}
+		return best;
+	}
+
+	// Matches of a disjunction can come from any operand.
+	return nullptr;
+}
+
 std::shared_ptr<Entity> getEntityById(int64_t id) {
 	auto it = allEntities.find(id);
 	if(it == allEntities.end())
@@ -241,6 +325,47 @@ tryEnumerate(managarm::mbus::EnumerateResponse &resp, uint64_t inSeq, const AnyF
 	auto actualSeq = co_await globalSeq.async_wait(inSeq);
 	auto outSeq = actualSeq;
 
+	constexpr size_t maxEntitiesPerMessage = 16;
+
+	// Returns true once the response is full.
+	auto addEntity = [&] (Entity *entity) -> bool {
+		managarm::mbus::Entity protoEntity;
+		protoEntity.set_id(entity->id());
+		protoEntity.set_name(entity->name());
+		for(auto kv : entity->getProperties()) {
+			managarm::mbus::Property prop;
+			prop.set_name(kv.first);
+			prop.set_item(mbus_ng::encodeItem(kv.second));
+			protoEntity.add_properties(prop);
+		}
+
+		resp.add_entities(protoEntity);
+
+		// Limit the amount of entities we send at once.
+		// Send back the seq number of the successor of the last entity
+		// to the client, so it can pick back up where we left off.
+		// This is correct since in the non-paginated case, the returned
+		// seq number is the seq of the first new entity.
+		if (resp.entities().size() >= maxEntitiesPerMessage) {
+			outSeq = entity->seq() + 1;
+			return true;
+		}
+		return false;
+	};
+
+	// If the filter pins down a property value, only look at entities that carry it.
+	if (auto bucket = selectBucket(filter); bucket) {
+		auto &entities = bucket->entities;
+		for (auto it = entities.lower_bound(inSeq); it != entities.end(); ++it) {
+			if (!matchesFilter(*it, filter))
+				continue;
+			if (addEntity(*it))
+				break;
+		}
+
+		co_return {outSeq, actualSeq};
+	}
+
 	// Find the first entity with an interesting seq number.
 	auto cur = entitySeqTree.get_root();
 	while (cur) {
@@ -255,35 +380,14 @@ tryEnumerate(managarm::mbus::EnumerateResponse &resp, uint64_t inSeq, const AnyF
 		}
 	}
 
-	constexpr size_t maxEntitiesPerMessage = 16;
-
 	// At this point, cur and all successors should have ->seq() >= inSeq
 	for (; cur; cur = EntitySeqTree::successor(cur)) {
 		assert(cur->seq() >= inSeq);
 		// The client doesn't want to see this.
 		if (!matchesFilter(cur, filter)) continue;
 
-		managarm::mbus::Entity protoEntity;
-		protoEntity.set_id(cur->id());
-		protoEntity.set_name(cur->name());
-		for(auto kv : cur->getProperties()) {
-			managarm::mbus::Property prop;
-			prop.set_name(kv.first);
-			prop.set_item(mbus_ng::encodeItem(kv.second));
-			protoEntity.add_properties(prop);
-		}
-
-		resp.add_entities(protoEntity);
-
-		// Limit the amount of entities we send at once.
-		// Send back the seq number of the successor of the last entity
-		// to the client, so it can pick back up where we left off.
-		// This is correct since in the non-paginated case, the returned
-		// seq number is the seq of the first new entity.
-		if (resp.entities().size() >= maxEntitiesPerMessage) {
-			outSeq = cur->seq() + 1;
+		if (addEntity(cur))
 			break;
-		}
 	}
 
 	co_return {outSeq, actualSeq};
@@ -307,6 +411,14 @@ async::detached doEnumerate(helix::UniqueLane conversation, uint64_t inSeq, AnyF
 			// Something changed, but nothing of interest was inserted
 			assert(outSeq == actualSeq);
 			curSeq = actualSeq;
+
+			// Only changes to the indexed bucket can produce a match,
+			// so there is no need to rescan on every globalSeq bump.
+			if(auto bucket = selectBucket(filter); bucket) {
+				co_await bucket->changed.async_wait_if([&] () -> bool {
+					return bucket->entities.lower_bound(curSeq) == bucket->entities.end();
+				});
+			}
 		}
 	}
 
@@ -482,9 +594,10 @@ async::detached serve(helix::UniqueLane lane) {
 
 			allEntities.insert({ child->id(), child });
 			entitySeqTree.insert(child.get());
+			indexEntity(child.get());
 
 			// Wake up all pending enumeration operations.
-			globalSeq.raise();
+			notifyObservers(child.get());
 
 			// Set up the management lane
 			auto [localLane, remoteLane] = helix::createStream();
@@ -518,6 +631,8 @@ async::detached serve(helix::UniqueLane lane) {
 			if(!entity) {
 				resp.set_error(managarm::mbus::Error::NO_SUCH_ENTITY);
 			} else {
+				// The index is ordered by seq, so drop the entity before touching it.
+				unindexEntity(entity.get());
 				for(auto p : req->properties()) {
 					entity->updateProperty(p.name(), mbus_ng::decodeItem(p.item()));
 				}
@@ -528,7 +643,8 @@ async::detached serve(helix::UniqueLane lane) {
 				auto seq = globalSeq.next_sequence() - 1;
 				entity->updateSeq(seq);
 				entitySeqTree.insert(entity.get());
-				globalSeq.raise();
+				indexEntity(entity.get());
+				notifyObservers(entity.get());
 			}
 
 			auto [sendResp] =
@@ -58,28 +58,30 @@ int main() {
 	}
 
 	// Start some drivers that are not integrated into udev rules yet.
-#if defined (__x86_64__)
-	auto input_ps2 = fork();
-	if(!input_ps2) {
+	// runsvr starts them concurrently (unless they depend on each other).
+	auto input_drivers = fork();
+	if(!input_drivers) {
 		execl("/usr/bin/runsvr", "/usr/bin/runsvr", "run",
-				"/usr/lib/managarm/server/input-atkbd.bin", nullptr);
-	}else assert(input_ps2 != -1);
+#if defined (__x86_64__)
+				"/usr/lib/managarm/server/input-atkbd.bin",
 #endif
-
-	auto input_hid = fork();
-	if(!input_hid) {
-		execl("/usr/bin/runsvr", "/usr/bin/runsvr", "run",
 				"/usr/lib/managarm/server/input-usbhid.bin", nullptr);
-	}else assert(input_hid != -1);
-
-	// Now run 'udevadm trigger' to make sure that udev initializes every device.
-	std::cout << "init: Running udev-trigger" << std::endl;
-	auto udev_trigger_devs = fork();
-	if(!udev_trigger_devs) {
-		execl("/usr/bin/udevadm", "udevadm", "trigger", "--action=add", nullptr);
-	}else assert(udev_trigger_devs != -1);
-
-	waitpid(udev_trigger_devs, nullptr, 0);
+	}else assert(input_drivers != -1);
+
+	// Now make sure that udev initializes every device. posix can emit add events for all
+	// devices at once; this is much faster than writing to each device's uevent file.
+	// Fall back to 'udevadm trigger' otherwise.
+	if(std::ofstream coldplug{"/sys/devices/coldplug"}; coldplug && (coldplug << "add").flush()) {
+		std::cout << "init: Requested coldplug uevents" << std::endl;
+	}else{
+		std::cout << "init: Running udev-trigger" << std::endl;
+		auto udev_trigger_devs = fork();
+		if(!udev_trigger_devs) {
+			execl("/usr/bin/udevadm", "udevadm", "trigger", "--action=add", nullptr);
+		}else assert(udev_trigger_devs != -1);
+
+		waitpid(udev_trigger_devs, nullptr, 0);
+	}
 
 	std::cout << "init: Running udev-settle" << std::endl;
 	auto udev_settle = fork();
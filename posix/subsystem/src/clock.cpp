@@ -15,6 +15,7 @@ namespace {
 helix::UniqueLane trackerLane;
 helix::UniqueDescriptor globalTrackerPageMemory;
 helix::Mapping trackerPageMapping;
+helix::UniqueDescriptor globalClockPageMemory;
 
 async::result<void> fetchTrackerPage() {
 	managarm::clock::AccessPageRequest req;
@@ -22,7 +23,7 @@ async::result<void> fetchTrackerPage() {
 	auto [offer, sendReq, recvResp, pullMemory] = co_await helix_ng::exchangeMsgs(
 		trackerLane,
 		helix_ng::offer(
-			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::sendBragiHeadOnly(req),
 			helix_ng::recvInline(),
 			helix_ng::pullDescriptor()
 		)
@@ -48,6 +49,15 @@ helix::BorrowedDescriptor trackerPageMemory() {
 	return globalTrackerPageMemory;
 }
 
+helix::BorrowedDescriptor clockPageMemory() {
+	if(!globalClockPageMemory) {
+		HelHandle handle;
+		HEL_CHECK(helAccessClockPage(&handle));
+		globalClockPageMemory = helix::UniqueDescriptor{handle};
+	}
+	return globalClockPageMemory;
+}
+
 async::result<void> enumerateTracker() {
 	auto filter = mbus_ng::Conjunction{{
 		mbus_ng::EqualsFilter{"class", "clocktracker"}
@@ -7,6 +7,9 @@ namespace clk {
 
 helix::BorrowedDescriptor trackerPageMemory();
 
+// The kernel's clock page (see helAccessClockPage()).
+helix::BorrowedDescriptor clockPageMemory();
+
 async::result<void> enumerateTracker();
 
 struct timespec getRealtime();
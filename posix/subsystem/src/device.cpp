@@ -348,6 +348,35 @@ async::result<void> serveServerLane(helix::UniqueDescriptor lane) {
 					helix::action(&send_resp, ser.data(), ser.size()));
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
+		}else if(req.request_type() == managarm::posix::CntReqType::FD_ACCESS_MEMORY) {
+			managarm::posix::SvrResponse resp;
+
+			const auto creds = req.passthrough_credentials();
+			auto file = findFileWithPassthroughCredentials((const char *) creds.data());
+
+			if(!file) {
+				resp.set_error(managarm::posix::Errors::NO_SUCH_FD);
+
+				auto ser = resp.SerializeAsString();
+				auto [send_resp] = co_await helix_ng::exchangeMsgs(
+					conversation,
+					helix_ng::sendBuffer(ser.data(), ser.size())
+				);
+				HEL_CHECK(send_resp.error());
+				continue;
+			}
+
+			auto memory = co_await file->accessMemory();
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp, push_memory] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::pushDescriptor(memory)
+			);
+			HEL_CHECK(send_resp.error());
+			HEL_CHECK(push_memory.error());
 		}
 	}
 }
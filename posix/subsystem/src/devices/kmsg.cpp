@@ -1,58 +1,106 @@
+#include <algorithm>
 #include <arch/dma_pool.hpp>
+#include <async/recurring-event.hpp>
 #include <bitset>
 #include <bragi/helpers-std.hpp>
 #include <kerncfg.bragi.hpp>
+#include <helix/memory.hpp>
 #include <protocols/mbus/client.hpp>
 #include <string.h>
+#include <sys/epoll.h>
 
 #include "../common.hpp"
 #include "kmsg.hpp"
 
 namespace {
 
-struct KmsgFile final : File {
-private:
-	async::result<frg::expected<Error, size_t>>
-	readSome(Process *, void *data, size_t length) override {
-		std::vector<char> buffer(2048);
-
-		uint32_t flags = managarm::kerncfg::GetBufferContentsFlags::ONE_RECORD;
+// Read-only mapping of the kernel log ring (see HelLogRingHeader), shared by all open files.
+// Records are read directly from the mapping; kerncfg is only involved to wait for records.
+struct KmsgRing {
+	KmsgRing(helix::UniqueDescriptor memory)
+	: memory{std::move(memory)} {
+		helix::Mapping headerMapping{this->memory, 0, 0x1000, kHelMapProtRead};
+		auto header = reinterpret_cast<HelLogRingHeader *>(headerMapping.get());
+		ringSize = header->ringSize;
+		dataOffset = header->dataOffset;
+		assert(ringSize && !(ringSize & (ringSize - 1)));
+
+		mapping = helix::Mapping{this->memory, 0, dataOffset + ringSize, kHelMapProtRead};
+	}
 
-		if(nonBlock_)
-			flags |= managarm::kerncfg::GetBufferContentsFlags::NO_WAIT;
+	HelLogRingHeader *header() {
+		return reinterpret_cast<HelLogRingHeader *>(mapping.get());
+	}
 
-		managarm::kerncfg::GetBufferContentsRequest req;
-		req.set_size(buffer.size());
-		req.set_dequeue(offset_);
-		req.set_flags(flags);
+	uint64_t headPtr() {
+		return __atomic_load_n(&header()->headPtr, __ATOMIC_ACQUIRE);
+	}
 
-		auto [offer, sendReq, recvResp, recvBuffer] =
-			co_await helix_ng::exchangeMsgs(lane_,
-				helix_ng::offer(
-					helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
-					helix_ng::recvInline(),
-					helix_ng::recvBuffer(buffer.data(), buffer.size())
-				)
-			);
-		HEL_CHECK(offer.error());
-		HEL_CHECK(sendReq.error());
-		HEL_CHECK(recvResp.error());
-		HEL_CHECK(recvBuffer.error());
+	// Copies the record at ptr (or the oldest record that is still valid) and advances ptr.
+	// Returns the number of bytes that were copied, or zero if there is no record.
+	size_t dequeue(uint64_t &ptr, char *buffer, size_t maxSize) {
+		auto data = reinterpret_cast<const char *>(mapping.get()) + dataOffset;
+		while(true) {
+			auto tailPtr = __atomic_load_n(&header()->tailPtr, __ATOMIC_ACQUIRE);
+			if(ptr < tailPtr)
+				ptr = tailPtr;
+			auto headPtr = this->headPtr();
+			if(ptr >= headPtr)
+				return 0;
+
+			// Alignment guarantees that the header fits contiguously.
+			auto recordOffset = ptr & (ringSize - 1);
+			size_t recordSize;
+			memcpy(&recordSize, data + recordOffset, sizeof(size_t));
+			auto chunkSize = std::min(recordSize, maxSize);
+			bool valid = recordSize <= ringSize - sizeof(size_t);
+			if(valid) {
+				auto preWrapSize = std::min(ringSize - (recordOffset + sizeof(size_t)), chunkSize);
+				memcpy(buffer, data + recordOffset + sizeof(size_t), preWrapSize);
+				memcpy(buffer + preWrapSize, data, chunkSize - preWrapSize);
+			}
 
-		auto resp = *bragi::parse_head_only<managarm::kerncfg::SvrResponse>(recvResp);
+			// Validate the data *after* copying; the kernel might have overwritten the record.
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if(ptr < __atomic_load_n(&header()->tailPtr, __ATOMIC_ACQUIRE))
+				continue;
+			if(!valid) {
+				std::cout << "posix: Skipping corrupted records in the kernel log" << std::endl;
+				ptr = headPtr;
+				return 0;
+			}
 
-		if(resp.error() == managarm::kerncfg::Error::WOULD_BLOCK)
-			co_return Error::wouldBlock;
+			ptr += (sizeof(size_t) + recordSize + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+			return chunkSize;
+		}
+	}
 
-		assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+	helix::UniqueDescriptor memory;
+	helix::Mapping mapping;
+	uint64_t ringSize;
+	uint64_t dataOffset;
+};
 
-		int ret_len = snprintf(reinterpret_cast<char *>(data), length,
-			"%s", reinterpret_cast<char *>(buffer.data()));
+struct KmsgFile final : File {
+private:
+	async::result<frg::expected<Error, size_t>>
+	readSome(Process *, void *data, size_t length) override {
+		std::vector<char> buffer(2048);
 
-		assert(offset_ == resp.effective_dequeue());
-		offset_ = resp.new_dequeue();
+		while(true) {
+			if(auto size = ring_->dequeue(offset_, buffer.data(), buffer.size()); size) {
+				// Records are NUL-terminated strings.
+				auto chunk = std::min(strnlen(buffer.data(), size), length);
+				memcpy(data, buffer.data(), chunk);
+				co_return chunk;
+			}
 
-		co_return ret_len;
+			if(nonBlock_)
+				co_return Error::wouldBlock;
+			co_await waitForRecords_(offset_);
+			if(!isOpen())
+				co_return 0;
+		}
 	}
 
 	async::result<frg::expected<Error, size_t>> writeAll(Process *, const void *data, size_t length) override {
@@ -117,19 +165,90 @@ private:
 		co_return offset_;
 	}
 
+	// The head pointer of the ring serves as sequence number; hence, we only wake up
+	// if new records arrive.
+	async::result<frg::expected<Error, PollWaitResult>>
+	pollWait(Process *, uint64_t sequence, int mask,
+			async::cancellation_token cancellation) override {
+		(void)mask; // TODO: utilize mask.
+
+		if(ring_->headPtr() == sequence)
+			co_await waitForRecords_(sequence, cancellation);
+
+		auto headPtr = ring_->headPtr();
+		co_return PollWaitResult(headPtr, headPtr != sequence ? EPOLLIN : 0);
+	}
+
+	async::result<frg::expected<Error, PollStatusResult>>
+	pollStatus(Process *) override {
+		auto headPtr = ring_->headPtr();
+		co_return PollStatusResult(headPtr, offset_ < headPtr ? EPOLLIN : 0);
+	}
+
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return ring_->memory.dup();
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return passthrough_;
 	}
 
 	void handleClose() override {
+		waiterBell_.raise();
+		recordBell_.raise();
+	}
+
+	async::result<void> waitForRecords_(uint64_t ptr, async::cancellation_token cancellation = {}) {
+		if(!numWaiters_++)
+			waiterBell_.raise();
+		while(ring_->headPtr() == ptr && isOpen() && !cancellation.is_cancellation_requested())
+			co_await recordBell_.async_wait(cancellation);
+		numWaiters_--;
+	}
+
+	// Asks kerncfg to wait for new records while there are waiters.
+	// The coroutine keeps the file alive until it is closed; since a pending request
+	// cannot be cancelled, this can take until the next record arrives.
+	async::detached watchRing_(smarter::shared_ptr<KmsgFile> self) {
+		(void)self;
+		while(isOpen()) {
+			if(!numWaiters_) {
+				co_await waiterBell_.async_wait();
+				continue;
+			}
+
+			managarm::kerncfg::WaitForRecordsRequest req;
+			req.set_dequeue(ring_->headPtr());
+
+			auto [offer, sendReq, recvResp] =
+				co_await helix_ng::exchangeMsgs(lane_,
+					helix_ng::offer(
+						helix_ng::sendBragiHeadOnly(req),
+						helix_ng::recvInline()
+					)
+				);
+			HEL_CHECK(offer.error());
+			HEL_CHECK(sendReq.error());
+			HEL_CHECK(recvResp.error());
+
+			auto resp = *bragi::parse_head_only<managarm::kerncfg::SvrResponse>(recvResp);
+			assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+			recordBell_.raise();
+		}
 		lane_ = helix::UniqueLane{};
 	}
 
 	helix::UniqueLane passthrough_;
 	async::cancellation_event cancelServe_;
 	helix::UniqueLane lane_;
+	std::shared_ptr<KmsgRing> ring_;
+
+	async::recurring_event recordBell_;
+	async::recurring_event waiterBell_;
+	// Number of coroutines in waitForRecords_().
+	unsigned int numWaiters_ = 0;
 
-	size_t offset_ = 0;
+	uint64_t offset_ = 0;
 	bool nonBlock_;
 
 public:
@@ -138,11 +257,13 @@ public:
 		std::tie(lane, file->passthrough_) = helix::createStream();
 		async::detach(protocols::fs::servePassthrough(std::move(lane),
 				file, &fileOperations, file->cancelServe_));
+		file->watchRing_(file);
 	}
 
-	KmsgFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link, helix::UniqueLane lane, bool nonblock)
+	KmsgFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link, helix::UniqueLane lane,
+			std::shared_ptr<KmsgRing> ring, bool nonblock)
 	: File{StructName::get("kmsg-file"), std::move(mount), std::move(link)},
-		lane_{std::move(lane)}, nonBlock_{nonblock} {}
+		lane_{std::move(lane)}, ring_{std::move(ring)}, nonBlock_{nonblock} {}
 };
 
 struct KmsgDevice final : UnixDevice {
@@ -178,13 +299,38 @@ struct KmsgDevice final : UnixDevice {
 		assert(events.size() == 1);
 
 		auto entity = co_await mbus_ng::Instance::global().getEntity(events[0].id);
+		auto lane = (co_await entity.getRemoteLane()).unwrap();
+
+		if(!ring_) {
+			managarm::kerncfg::GetRingMemoryRequest req;
+
+			auto [offer, sendReq, recvResp, pullMemory] =
+				co_await helix_ng::exchangeMsgs(lane,
+					helix_ng::offer(
+						helix_ng::sendBragiHeadOnly(req),
+						helix_ng::recvInline(),
+						helix_ng::pullDescriptor()
+					)
+				);
+			HEL_CHECK(offer.error());
+			HEL_CHECK(sendReq.error());
+			HEL_CHECK(recvResp.error());
+			HEL_CHECK(pullMemory.error());
+
+			auto resp = *bragi::parse_head_only<managarm::kerncfg::SvrResponse>(recvResp);
+			assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+			ring_ = std::make_shared<KmsgRing>(pullMemory.descriptor());
+		}
 
 		auto file = smarter::make_shared<KmsgFile>(std::move(mount), std::move(link),
-			(co_await entity.getRemoteLane()).unwrap(), nonblock);
+			std::move(lane), ring_, nonblock);
 		file->setupWeakFile(file);
 		KmsgFile::serve(file);
 		co_return File::constructHandle(std::move(file));
 	}
+
+private:
+	std::shared_ptr<KmsgRing> ring_;
 };
 
 } // anonymous namespace
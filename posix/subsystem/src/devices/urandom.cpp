@@ -2,6 +2,7 @@
 #include <sys/random.h>
 
 #include "../common.hpp"
+#include "../process.hpp"
 #include "urandom.hpp"
 
 #include <bitset>
@@ -12,7 +13,12 @@ namespace {
 struct UrandomFile final : File {
 private:
 	async::result<frg::expected<Error, size_t>>
-	readSome(Process *, void *data, size_t length) override {
+	readSome(Process *process, void *data, size_t length) override {
+		if(process) {
+			process->readRandom(data, length);
+			co_return length;
+		}
+
 		auto p = reinterpret_cast<char *>(data);
 		size_t n = 0;
 		while(n < length) {
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <linux/netlink.h>
 #include <sstream>
 
@@ -43,27 +44,38 @@ public:
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override {
 		auto device = static_cast<Device *>(object);
 
-		UeventProperties ue;
-		device->composeStandardUevent(ue);
-		device->composeUevent(ue);
-
-		std::stringstream ss;
-		for(const auto &[name, value] : ue)
-			ss << name << '=' << value << '\n';
-
-		co_return ss.str();
+		auto str = device->ueventEnvironment();
+		std::replace(str.begin(), str.end(), '\0', '\n');
+		co_return str;
 	}
 
 	async::result<Error> store(sysfs::Object *object, std::string data) override {
 		(void) data;
 
 		auto device = static_cast<Device *>(object);
+		udev::emitAddEvent(device);
+		co_return Error::success;
+	}
+};
 
-		UeventProperties ue;
-		device->composeStandardUevent(ue);
-		device->composeUevent(ue);
+// Writing to /sys/devices/coldplug emits add events for all devices at once.
+struct ColdplugAttribute : sysfs::Attribute {
+	static auto singleton() {
+		static ColdplugAttribute attr;
+		return &attr;
+	}
+
+private:
+	ColdplugAttribute()
+	: sysfs::Attribute("coldplug", true) { }
 
-		udev::emitAddEvent(device->getSysfsPath(), ue);
+public:
+	async::result<frg::expected<Error, std::string>> show(sysfs::Object *) override {
+		co_return std::string{};
+	}
+
+	async::result<Error> store(sysfs::Object *, std::string) override {
+		udev::emitColdplugSnapshot();
 		co_return Error::success;
 	}
 };
@@ -101,6 +113,24 @@ void Device::composeStandardUevent(UeventProperties &ue) {
 	}
 }
 
+const std::string &Device::ueventEnvironment() {
+	if(!_ueventEnvironment) {
+		UeventProperties ue;
+		composeStandardUevent(ue);
+		composeUevent(ue);
+
+		std::string env;
+		for(const auto &[name, value] : ue) {
+			env += name;
+			env += '=';
+			env += value;
+			env += '\0';
+		}
+		_ueventEnvironment = std::move(env);
+	}
+	return *_ueventEnvironment;
+}
+
 void Device::linkToSubsystem() {
 	// Nothing to do for devices outside of a subsystem.
 }
@@ -193,12 +223,16 @@ void initialize() {
 	dev_object->addObject();
 	globalCharObject->addObject(); // TODO: Do this before dev_object is visible.
 	globalBlockDevObject->addObject();
+	globalDevicesObject->realizeAttribute(ColdplugAttribute::singleton());
 }
 
 namespace {
 
 std::map<mbus_ng::EntityId, std::shared_ptr<Device>> mbusMap;
 
+// All devices passed to installDevice(), in installation order.
+std::vector<std::weak_ptr<Device>> installedDevices;
+
 } // namespace
 
 // TODO(no92): also attach type info (USB, PCI, etc.) about the device here?
@@ -235,11 +269,8 @@ void installDevice(std::shared_ptr<Device> device) {
 			assert(!"Unsupported unix device trying to be added!");
 	}
 
-	UeventProperties ue;
-	device->composeStandardUevent(ue);
-	device->composeUevent(ue);
-
-	udev::emitAddEvent(device->getSysfsPath(), ue);
+	installedDevices.push_back(device);
+	udev::emitAddEvent(device.get());
 }
 
 namespace udev {
@@ -253,12 +284,71 @@ uint32_t allocateNextSeq() {
 	return seqnum++;
 }
 
+int batchDepth = 0;
+std::vector<std::string> batchedEvents;
+
 void emitEvent(std::string buffer) {
+	if(batchDepth) {
+		batchedEvents.push_back(std::move(buffer));
+		return;
+	}
 	netlink::nl_socket::broadcast(NETLINK_KOBJECT_UEVENT, 1, std::move(buffer));
 }
 
+std::string composeEvent(const char *action, const std::string &devpath,
+		const std::string &env) {
+	std::string buffer;
+	auto seqnum = std::to_string(allocateNextSeq());
+	buffer.reserve(2 * devpath.size() + env.size() + 64);
+	buffer += action;
+	buffer += "@/";
+	buffer += devpath;
+	buffer += '\0';
+	buffer += "ACTION=";
+	buffer += action;
+	buffer += '\0';
+	buffer += "DEVPATH=/";
+	buffer += devpath;
+	buffer += '\0';
+	buffer += "SEQNUM=";
+	buffer += seqnum;
+	buffer += '\0';
+	buffer += env;
+	return buffer;
+}
+
 } // namespace
 
+Batch::Batch() {
+	batchDepth++;
+}
+
+Batch::~Batch() {
+	assert(batchDepth > 0);
+	if(--batchDepth)
+		return;
+	if(batchedEvents.empty())
+		return;
+	netlink::nl_socket::broadcastBatch(NETLINK_KOBJECT_UEVENT, 1, std::move(batchedEvents));
+	batchedEvents.clear();
+}
+
+void emitAddEvent(Device *device) {
+	udev::emitEvent(composeEvent("add", device->getSysfsPath(), device->ueventEnvironment()));
+}
+
+void emitChangeEvent(Device *device) {
+	udev::emitEvent(composeEvent("change", device->getSysfsPath(), device->ueventEnvironment()));
+}
+
+void emitColdplugSnapshot() {
+	Batch batch;
+	for(auto &weak : installedDevices) {
+		if(auto device = weak.lock(); device)
+			emitAddEvent(device.get());
+	}
+}
+
 void emitAddEvent(std::string devpath, UeventProperties &ue) {
 	std::stringstream ss;
 	ss << "add@/" << devpath << '\0';
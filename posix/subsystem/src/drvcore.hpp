@@ -1,7 +1,9 @@
 #pragma once
 
+#include <optional>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <protocols/mbus/client.hpp>
 
 #include "device.hpp"
@@ -62,11 +64,23 @@ public:
 
 	void composeStandardUevent(UeventProperties &);
 
+	// Returns the uevent environment (i.e., "NAME=value" strings, each terminated by '\0').
+	// The environment is composed on first use and cached afterwards.
+	const std::string &ueventEnvironment();
+
+	// Devices whose uevent properties change must call this before emitting
+	// the next uevent.
+	void invalidateUevent() {
+		_ueventEnvironment.reset();
+	}
+
 	virtual void linkToSubsystem();
 
 	virtual void composeUevent(UeventProperties &) = 0;
 
 private:
+	std::optional<std::string> _ueventEnvironment;
+
 	std::weak_ptr<Device> _devicePtr;
 	UnixDevice *_unixDevice;
 	std::shared_ptr<Device> _parentDevice;
@@ -157,6 +171,26 @@ namespace udev {
 void emitAddEvent(std::string devpath, UeventProperties &ue);
 void emitChangeEvent(std::string devpath, UeventProperties &ue);
 
+// Variants that use the cached environment of the device.
+void emitAddEvent(Device *device);
+void emitChangeEvent(Device *device);
+
+// While a Batch exists, uevents are queued and then multicast together
+// when the last Batch is destroyed. Batches can be nested.
+struct Batch {
+	Batch();
+
+	Batch(const Batch &) = delete;
+
+	~Batch();
+
+	Batch &operator= (const Batch &) = delete;
+};
+
+// Emits add events for all installed devices (in installation order) as a single batch.
+// This replaces triggering each device through its uevent attribute during coldplug.
+void emitColdplugSnapshot();
+
 } // namespace udev
 
 } // namespace drvcore
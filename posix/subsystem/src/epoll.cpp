@@ -1,6 +1,7 @@
 
 #include <string.h>
 #include <iostream>
+#include <vector>
 
 #include <async/recurring-event.hpp>
 #include <boost/intrusive/list.hpp>
@@ -28,6 +29,9 @@ private:
 	static constexpr State statePolling = 2;
 	static constexpr State statePending = 4;
 
+	// Flags of the event mask that do not correspond to poll() events.
+	static constexpr int modeFlags = EPOLLET | EPOLLONESHOT | EPOLLEXCLUSIVE | EPOLLWAKEUP;
+
 	struct Item;
 
 	struct Receiver {
@@ -69,9 +73,38 @@ private:
 
 		std::optional<frg::expected<Error, PollWaitResult>> pollOutcome;
 
+		// Edges reported by the pollWait() that made this item pending.
+		// Edge-triggered items are reported from these values without pollStatus().
+		bool edgeValid = false;
+		uint64_t edgeSeq = 0;
+		int edgeEvents = 0;
+
 		smarter::borrowed_ptr<Item> self;
 	};
 
+	// Events that we watch for on the item's file.
+	static int _watchMask(Item *item) {
+		return (item->eventMask & ~modeFlags) | EPOLLERR | EPOLLHUP;
+	}
+
+	// Starts a pollWait() on an item that is currently not being watched.
+	static void _armItem(smarter::shared_ptr<Item> item, uint64_t seq) {
+		if(!(item->state & stateActive) || (item->state & statePolling))
+			return;
+		item->state |= statePolling;
+
+		item->cancelPoll.reset();
+		item->pollOperation.construct_with([&] {
+			return async::execution::connect(
+				item->file->pollWait(item->process, seq,
+						_watchMask(item.get()), item->cancelPoll),
+				Receiver{item}
+			);
+		});
+		if(async::execution::start_inline(*item->pollOperation))
+			_awaitPoll(item.get());
+	}
+
 	static void _awaitPoll(Item *item) {
 	reRunImmediately:
 		// First, destruct the operation so that we can re-use it later.
@@ -100,15 +133,19 @@ private:
 		// This is the correct behavior for edge-triggered items.
 		// Level-triggered items stay pending until the event disappears.
 		auto result = resultOrError.value();
-		if(std::get<1>(result) & (item->eventMask | EPOLLERR | EPOLLHUP)) {
+		if(std::get<1>(result) & _watchMask(item)) {
 			if(logEpoll)
 				std::cout << "posix.epoll \e[1;34m" << item->epoll->structName() << "\e[0m"
 						<< ": Item \e[1;34m" << item->file->structName()
 						<< "\e[0m becomes pending" << std::endl;
 
 			// Note that we stop watching once an item becomes pending.
-			// We do this as we have to pollStatus() again anyway before we report the item.
+			// We do this as we have to pollStatus() level-triggered items again anyway
+			// before we report them; edge-triggered items are re-armed once reported.
 			item->state &= ~statePolling;
+			item->edgeValid = true;
+			item->edgeSeq = std::get<0>(result);
+			item->edgeEvents = std::get<1>(result);
 			if(!(item->state & statePending)) {
 				item->state |= statePending;
 
@@ -130,7 +167,7 @@ private:
 			item->pollOperation.construct_with([&] {
 				return async::execution::connect(
 					item->file->pollWait(item->process, std::get<0>(result),
-							item->eventMask | EPOLLERR | EPOLLHUP, item->cancelPoll),
+							_watchMask(item), item->cancelPoll),
 					Receiver{item->self.lock()}
 				);
 			});
@@ -182,8 +219,13 @@ public:
 		auto item = it->second;
 		assert(item->state & stateActive);
 
+		// Like Linux, we do not allow EPOLLEXCLUSIVE to be changed after EPOLL_CTL_ADD.
+		if((item->eventMask | mask) & EPOLLEXCLUSIVE)
+			return Error::illegalArguments;
+
 		item->eventMask = mask;
 		item->cookie = cookie;
+		item->edgeValid = false;
 		item->cancelPoll.cancel();
 
 		// Mark the item as pending.
@@ -229,6 +271,10 @@ public:
 
 		size_t k = 0;
 		boost::intrusive::list<Item> repoll_queue;
+		bool repollWakes = false;
+		// Items that need a new pollWait(). We collect them and only start the
+		// operations once we are done with the pending queue.
+		std::vector<std::pair<smarter::shared_ptr<Item>, uint64_t>> rearm_queue;
 		while(true) {
 			// TODO: Stop waiting in this case.
 			assert(isOpen());
@@ -249,67 +295,82 @@ public:
 					continue;
 				}
 
-				if(logEpoll)
-					std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Checking item "
-							<< "\e[1;34m" << item->file->structName() << "\e[0m" << std::endl;
-				auto result_or_error = co_await item->file->pollStatus(item->process);
-
-				// Discard closed items.
-				if(!result_or_error) {
-					assert(result_or_error.error() == Error::fileClosed);
+				uint64_t seq;
+				int edges;
+				if((item->eventMask & EPOLLET) && item->edgeValid) {
+					// Edge-triggered items that became pending through pollWait() are
+					// reported with the edges that pollWait() returned.
+					// Users of EPOLLET have to tolerate spurious events anyway,
+					// hence we can avoid asking the file for its status again.
+					seq = item->edgeSeq;
+					edges = item->edgeEvents;
+					item->edgeValid = false;
+				}else{
 					if(logEpoll)
-						std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Discarding"
-								" closed item \e[1;34m" << item->file->structName() << "\e[0m"
-								<< std::endl;
-					item->state &= ~statePending;
-					continue;
+						std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Checking item "
+								<< "\e[1;34m" << item->file->structName() << "\e[0m" << std::endl;
+					auto result_or_error = co_await item->file->pollStatus(item->process);
+
+					// Discard closed items.
+					if(!result_or_error) {
+						assert(result_or_error.error() == Error::fileClosed);
+						if(logEpoll)
+							std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m: Discarding"
+									" closed item \e[1;34m" << item->file->structName() << "\e[0m"
+									<< std::endl;
+						item->state &= ~statePending;
+						continue;
+					}
+
+					seq = std::get<0>(result_or_error.value());
+					edges = std::get<1>(result_or_error.value());
+					item->edgeValid = false;
 				}
 
-				auto result = result_or_error.value();
 				if(logEpoll)
 					std::cout << "posix.epoll \e[1;34m" << structName() << "\e[0m:"
 							" Item \e[1;34m" << item->file->structName() << "\e[0m"
-							" mask is " << item->eventMask << ", while " << std::get<1>(result)
+							" mask is " << item->eventMask << ", while " << edges
 							<< " is active" << std::endl;
 
 				// Abort early (i.e before requeuing) if the item is not pending.
-				auto status = std::get<1>(result) & (item->eventMask | EPOLLERR | EPOLLHUP);
+				// Once an item is not pending anymore, we continue watching it.
+				auto status = edges & _watchMask(item.get());
 				if(!status) {
 					item->state &= ~statePending;
-					if(!(item->state & statePolling)) {
-						item->state |= statePolling;
-
-						// Once an item is not pending anymore, we continue watching it.
-						item->cancelPoll.reset();
-						item->pollOperation.construct_with([&] {
-							return async::execution::connect(
-								item->file->pollWait(item->process, std::get<0>(result),
-										item->eventMask | EPOLLERR | EPOLLHUP, item->cancelPoll),
-								Receiver{item}
-							);
-						});
-						if(async::execution::start_inline(*item->pollOperation))
-							_awaitPoll(item.get());
-					}
+					rearm_queue.push_back({std::move(item), seq});
 					continue;
 				}
 
-				// We have to increment the sequence again as concurrent waiters
-				// might have seen an empty _pendingQueue.
-				// TODO: Edge-triggered watches should not be requeued here.
-				item.ctr()->increment();
-				repoll_queue.push_back(*item);
-
 				assert(k < max_events);
 				memset(events + k, 0, sizeof(struct epoll_event));
 				events[k].events = status;
 				events[k].data.u64 = item->cookie;
 
+				if(item->eventMask & EPOLLET) {
+					// Edge-triggered items are not requeued; they only become
+					// pending again once pollWait() reports a new edge.
+					item->state &= ~statePending;
+					rearm_queue.push_back({std::move(item), seq});
+				}else{
+					// Level-triggered items are requeued below. Concurrent waiters are
+					// woken up to re-check them, except for EPOLLEXCLUSIVE items
+					// where waking a single waiter (i.e., us) is sufficient.
+					if(!(item->eventMask & EPOLLEXCLUSIVE))
+						repollWakes = true;
+					item.ctr()->increment();
+					repoll_queue.push_back(*item);
+				}
+
 				k++;
 				if(k == max_events)
 					break;
 			}
 
+			for(auto &[item, seq] : rearm_queue)
+				_armItem(std::move(item), seq);
+			rearm_queue.clear();
+
 			if(k)
 				break;
 
@@ -320,10 +381,13 @@ public:
 		}
 
 		// Before returning, we have to reinsert the level-triggered events that we report.
+		// We have to increment the sequence again as concurrent waiters
+		// might have seen an empty _pendingQueue.
 		if(!repoll_queue.empty()) {
 			_pendingQueue.splice(_pendingQueue.end(), repoll_queue);
 			_currentSeq++;
-			_statusBell.raise();
+			if(repollWakes)
+				_statusBell.raise();
 		}
 
 		if(logEpoll)
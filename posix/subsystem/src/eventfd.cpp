@@ -1,9 +1,10 @@
-
 #include <string.h>
 #include <sys/epoll.h>
 
 #include <async/recurring-event.hpp>
 #include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <protocols/posix/eventfd.hpp>
 #include "eventfd.hpp"
 #include "process.hpp"
 
@@ -11,10 +12,24 @@ namespace eventfd {
 
 namespace {
 
+constexpr uint64_t maxCounter = 0xFFFFFFFFFFFFFFFE;
+
+// The counter lives in a page that is shared with processes (see protocols/posix/eventfd.hpp).
+// Processes update it without involving posix; we only watch the page (using a futex)
+// while somebody waits for a change.
 struct OpenFile : File {
 	OpenFile(unsigned int initval, bool nonBlock, bool semaphore)
 	: File{StructName::get("eventfd")}, _currentSeq{1}, _readableSeq{0},
-		_writeableSeq{0}, _counter{initval}, _nonBlock{nonBlock}, _semaphore{semaphore} { }
+		_writeableSeq{0}, _nonBlock{nonBlock} {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &handle));
+		_memory = helix::UniqueDescriptor{handle};
+		_mapping = helix::Mapping{_memory, 0, 0x1000};
+
+		auto page = _page();
+		page->counter = initval;
+		page->flags = semaphore ? posix::eventfdSemaphore : 0;
+	}
 
 	~OpenFile() {
 	}
@@ -24,6 +39,14 @@ struct OpenFile : File {
 		std::tie(lane, file->_passthrough) = helix::createStream();
 		async::detach(protocols::fs::servePassthrough(std::move(lane),
 				smarter::shared_ptr<File>{file}, &File::fileOperations));
+		file->_watchPage(file);
+	}
+
+	void handleClose() override {
+		if(_futexAsyncId)
+			HEL_CHECK(helCancelAsync(helix::Dispatcher::global().acquire(), _futexAsyncId));
+		_waiterBell.raise();
+		_doorbell.raise();
 	}
 
 	async::result<frg::expected<Error, size_t>>
@@ -32,47 +55,39 @@ struct OpenFile : File {
 			co_return Error::illegalArguments;
 
 		while (1) {
-			if (_counter) {
-				if(_semaphore) {
-					auto ptr = reinterpret_cast<uint64_t *>(data);
-					*ptr = 1;
-					_counter--;
-				} else {
-					memcpy(data, &_counter, 8);
-					_counter = 0;
-				}
-				_writeableSeq = ++_currentSeq;
-				_doorbell.raise();
+			uint64_t value;
+			if (_tryRead(value)) {
+				memcpy(data, &value, 8);
+				_synchronize();
 				co_return 8;
 			}
 
 			if (_nonBlock)
 				co_return Error::wouldBlock;
 			else
-				co_await _doorbell.async_wait();
+				co_await _waitForChange();
 		}
 	}
 
 	async::result<frg::expected<Error, size_t>>
 	writeAll(Process *, const void *data, size_t length) override {
-		assert(length >= 8); // TODO: return Error::illegalArguments to user instead
+		if (length < 8)
+			co_return Error::illegalArguments;
 
 		uint64_t num;
 		memcpy(&num, data, 8);
 
-		assert(num != 0xFFFFFFFFFFFFFFFF); // TODO: return Error::wouldBlock to user instead
+		if (num > maxCounter)
+			co_return Error::illegalArguments;
 
-		if (num && num + _counter <= _counter) {
+		while (!_tryWrite(num)) {
 			if (_nonBlock)
-				assert(!"return Error::wouldBlock from eventfd::OpenFile::writeAll");
+				co_return Error::wouldBlock;
 			else
-				co_await _doorbell.async_wait(); // wait for read
+				co_await _waitForChange(); // wait for read
 		}
 
-		_counter += num;
-
-		_readableSeq = ++_currentSeq;
-		_doorbell.raise();
+		_synchronize();
 		co_return length;
 	}
 
@@ -81,10 +96,10 @@ struct OpenFile : File {
 			async::cancellation_token cancellation) override {
 		(void)mask; // TODO: utilize mask.
 
+		_synchronize();
 		assert(sequence <= _currentSeq);
-		while (_currentSeq == sequence &&
-				!cancellation.is_cancellation_requested())
-			co_await _doorbell.async_wait(cancellation);
+		if (_currentSeq == sequence)
+			co_await _waitForChange(cancellation);
 
 		int edges = 0;
 		if (_readableSeq > sequence)
@@ -97,30 +112,133 @@ struct OpenFile : File {
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
+		_synchronize();
+
+		auto counter = __atomic_load_n(&_page()->counter, __ATOMIC_SEQ_CST);
 		int events = 0;
-		if (_counter > 0)
+		if (counter > 0)
 			events |= EPOLLIN;
-		if (_counter < 0xFFFFFFFFFFFFFFFF)
+		if (counter < maxCounter)
 			events |= EPOLLOUT;
 
 		co_return PollStatusResult(_currentSeq, events);
 	}
 
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _memory.dup();
+	}
+
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _passthrough;
 	}
 
 private:
+	posix::EventfdPage *_page() {
+		return reinterpret_cast<posix::EventfdPage *>(_mapping.get());
+	}
+
+	bool _tryRead(uint64_t &value) {
+		auto page = _page();
+		auto counter = __atomic_load_n(&page->counter, __ATOMIC_SEQ_CST);
+		while (true) {
+			if (!counter)
+				return false;
+			value = (page->flags & posix::eventfdSemaphore) ? 1 : counter;
+			if (__atomic_compare_exchange_n(&page->counter, &counter, counter - value,
+					false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+				break;
+		}
+		__atomic_add_fetch(&page->seq, 1, __ATOMIC_SEQ_CST);
+		return true;
+	}
+
+	bool _tryWrite(uint64_t num) {
+		auto page = _page();
+		auto counter = __atomic_load_n(&page->counter, __ATOMIC_SEQ_CST);
+		while (true) {
+			if (num > maxCounter - counter)
+				return false;
+			if (__atomic_compare_exchange_n(&page->counter, &counter, counter + num,
+					false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+				break;
+		}
+		__atomic_add_fetch(&page->seq, 1, __ATOMIC_SEQ_CST);
+		return true;
+	}
+
+	// Turns changes of the shared page into edges for pollWait().
+	void _synchronize() {
+		auto page = _page();
+		auto seq = __atomic_load_n(&page->seq, __ATOMIC_SEQ_CST);
+		if (seq == _observedSeq)
+			return;
+		_observedSeq = seq;
+
+		// We cannot tell reads and writes of processes apart; derive the edges from the state.
+		auto counter = __atomic_load_n(&page->counter, __ATOMIC_SEQ_CST);
+		++_currentSeq;
+		if (counter > 0)
+			_readableSeq = _currentSeq;
+		if (counter < maxCounter)
+			_writeableSeq = _currentSeq;
+		_doorbell.raise();
+	}
+
+	async::result<void> _waitForChange(async::cancellation_token cancellation = {}) {
+		auto sequence = _currentSeq;
+		if (!_numWaiters++)
+			_waiterBell.raise();
+		while (_currentSeq == sequence && isOpen()
+				&& !cancellation.is_cancellation_requested())
+			co_await _doorbell.async_wait(cancellation);
+		_numWaiters--;
+	}
+
+	// Waits on the futex of the shared page while there are waiters.
+	// The coroutine keeps the file alive until it is closed.
+	async::detached _watchPage(smarter::shared_ptr<OpenFile> self) {
+		(void)self;
+		auto page = _page();
+		while (isOpen()) {
+			if (!_numWaiters) {
+				__atomic_store_n(&page->watched, 0, __ATOMIC_SEQ_CST);
+				co_await _waiterBell.async_wait();
+				continue;
+			}
+
+			// Processes check watched after changing seq; hence, this cannot miss a change.
+			__atomic_store_n(&page->watched, 1, __ATOMIC_SEQ_CST);
+			auto seq = __atomic_load_n(&page->seq, __ATOMIC_SEQ_CST);
+			_synchronize();
+
+			helix::AwaitFutex await;
+			auto &&submit = helix::submitAwaitFutex(&await, &page->seq, seq,
+					helix::Dispatcher::global());
+			_futexAsyncId = await.asyncId();
+			co_await submit.async_wait();
+			_futexAsyncId = 0;
+			assert(!await.error() || await.error() == kHelErrCancelled);
+			_synchronize();
+		}
+	}
+
 	helix::UniqueLane _passthrough;
+	helix::UniqueDescriptor _memory;
+	helix::Mapping _mapping;
 	async::recurring_event _doorbell;
+	async::recurring_event _waiterBell;
 
 	uint64_t _currentSeq;
 	uint64_t _readableSeq;
 	uint64_t _writeableSeq;
 
-	uint64_t _counter;
+	// Value of EventfdPage::seq when we last looked at the page.
+	int32_t _observedSeq = 0;
+	// Number of coroutines in _waitForChange().
+	unsigned int _numWaiters = 0;
+	uint64_t _futexAsyncId = 0;
+
 	bool _nonBlock;
-	bool _semaphore;
 };
 
 }
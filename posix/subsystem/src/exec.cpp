@@ -3,7 +3,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/auxv.h>
+#include <algorithm>
 #include <iostream>
+#include <map>
+#include <optional>
 
 #include "vfs.hpp"
 #include "exec.hpp"
@@ -28,67 +31,96 @@ struct ImageInfo {
 	size_t phdrCount;
 };
 
-async::result<frg::expected<Error, ImagePreamble>>
-parseElfPreamble(SharedFilePtr file) {
-	ImagePreamble preamble;
-
-	// Read the elf file header and verify the signature.
+// Parsed headers of an ELF file, independent of the base address.
+// Images are cached such that repeated exec() of the same file does not
+// need to re-read the headers or the contents of writable segments.
+struct ElfImage {
 	Elf64_Ehdr ehdr;
-	FRG_CO_TRY(co_await file->seek(0, VfsSeek::absolute));
-	FRG_CO_TRY(co_await file->readExactly(nullptr, &ehdr, sizeof(Elf64_Ehdr)));
+	std::vector<char> phdrBuffer;
 
-	if(!(ehdr.e_ident[0] == 0x7F
-			&& ehdr.e_ident[1] == 'E'
-			&& ehdr.e_ident[2] == 'L'
-			&& ehdr.e_ident[3] == 'F'))
-		co_return Error::badExecutable;
-	if(ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN)
-		co_return Error::badExecutable;
+	// Memory of the file itself. Read-only segments map this memory directly.
+	helix::UniqueDescriptor fileMemory;
 
-	// Right now we treat every ET_DYN object as PIE and unconditionally apply
-	// a non-zero base address.
-	if(ehdr.e_type == ET_DYN)
-		preamble.isPie = true;
+	// Initial contents of the writable segments, indexed like the PHDRs.
+	// These are only ever mapped copy-on-write, hence they are never modified.
+	std::vector<helix::UniqueDescriptor> segmentMemory;
 
-	co_return preamble;
-}
+	// Used to evict the least recently used image.
+	uint64_t lastUse = 0;
 
-async::result<frg::expected<Error, ImageInfo>>
-loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
-	assert(!(base & (kPageSize - 1))); // Callers need to ensure this.
-	ImageInfo info;
+	Elf64_Phdr *phdr(int i) {
+		return reinterpret_cast<Elf64_Phdr *>(phdrBuffer.data() + i * ehdr.e_phentsize);
+	}
+};
 
-	// Get a handle to the file's memory.
-	auto fileMemory = co_await file->accessMemory();
+namespace {
 
-	// Read the elf file header and verify the signature.
-	Elf64_Ehdr ehdr;
-	FRG_CO_TRY(co_await file->seek(0, VfsSeek::absolute));
-	FRG_CO_TRY(co_await file->readExactly(nullptr, &ehdr, sizeof(Elf64_Ehdr)));
+constexpr bool logImageCache = false;
+
+constexpr size_t maxCachedImages = 64;
+
+// Identifies a specific version of a file.
+struct ImageKey {
+	FsSuperblock *superblock;
+	uint64_t inodeNumber;
+	uint64_t fileSize;
+	uint64_t mtimeSecs;
+	uint64_t mtimeNanos;
+
+	auto operator<=> (const ImageKey &) const = default;
+};
+
+std::map<ImageKey, std::shared_ptr<ElfImage>> imageCache;
+uint64_t imageCacheClock = 0;
+
+async::result<std::optional<ImageKey>> getImageKey(SharedFilePtr file) {
+	auto link = file->associatedLink();
+	if(!link)
+		co_return std::nullopt;
+	auto node = link->getTarget();
+	if(!node || node->getType() != VfsType::regular)
+		co_return std::nullopt;
+	auto stats = co_await node->getStats();
+	if(!stats)
+		co_return std::nullopt;
+	co_return ImageKey{node->superblock(), stats.value().inodeNumber, stats.value().fileSize,
+			stats.value().mtimeSecs, stats.value().mtimeNanos};
+}
 
-	// Verify the ELF file again, since loadElfPreamble() is not necessarily called
-	// on every object that we load.
+bool verifyElfHeader(const Elf64_Ehdr &ehdr) {
 	if(!(ehdr.e_ident[0] == 0x7F
 			&& ehdr.e_ident[1] == 'E'
 			&& ehdr.e_ident[2] == 'L'
 			&& ehdr.e_ident[3] == 'F'))
-		co_return Error::badExecutable;
+		return false;
 	if(ehdr.e_type != ET_EXEC && ehdr.e_type != ET_DYN)
+		return false;
+	return true;
+}
+
+async::result<frg::expected<Error, std::shared_ptr<ElfImage>>>
+readElfImage(SharedFilePtr file) {
+	auto image = std::make_shared<ElfImage>();
+
+	// Read the elf file header and verify the signature.
+	FRG_CO_TRY(co_await file->seek(0, VfsSeek::absolute));
+	FRG_CO_TRY(co_await file->readExactly(nullptr, &image->ehdr, sizeof(Elf64_Ehdr)));
+	if(!verifyElfHeader(image->ehdr))
 		co_return Error::badExecutable;
+	auto &ehdr = image->ehdr;
 
-	info.entryIp = (char *)base + ehdr.e_entry;
-	info.phdrEntrySize = ehdr.e_phentsize;
-	info.phdrCount = ehdr.e_phnum;
+	// Get a handle to the file's memory.
+	image->fileMemory = co_await file->accessMemory();
 
-	// Read the elf program headers and load them into the address space.
-	std::vector<char> phdrBuffer;
-	phdrBuffer.resize(ehdr.e_phnum * ehdr.e_phentsize);
+	// Read the elf program headers.
+	image->phdrBuffer.resize(ehdr.e_phnum * ehdr.e_phentsize);
 	FRG_CO_TRY(co_await file->seek(ehdr.e_phoff, VfsSeek::absolute));
 	FRG_CO_TRY(co_await file->readExactly(nullptr,
-			phdrBuffer.data(), ehdr.e_phnum * size_t(ehdr.e_phentsize)));
+			image->phdrBuffer.data(), ehdr.e_phnum * size_t(ehdr.e_phentsize)));
 
+	image->segmentMemory.resize(ehdr.e_phnum);
 	for(int i = 0; i < ehdr.e_phnum; i++) {
-		auto phdr = (Elf64_Phdr *)(phdrBuffer.data() + i * ehdr.e_phentsize);
+		auto phdr = image->phdr(i);
 
 		if(phdr->p_type == PT_LOAD) {
 			if(!phdr->p_memsz) // Skip empty segments.
@@ -97,7 +129,6 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 			bool properlyAligned = phdr->p_offset % phdr->p_align == phdr->p_vaddr % phdr->p_align;
 
 			size_t misalign = phdr->p_vaddr & (kPageSize - 1);
-			uintptr_t mapAddress = base + phdr->p_vaddr - misalign;
 			uintptr_t fileOffset = phdr->p_offset - misalign;
 			size_t mapLength = (phdr->p_memsz + misalign + kPageSize - 1) & ~(kPageSize - 1);
 
@@ -107,59 +138,34 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 				co_return Error::badExecutable;
 			}
 
-			// Check if we can share the segment.
-			if(!(phdr->p_flags & PF_W)) {
-				// Map the segment with correct permissions into the process.
-				if((phdr->p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_X)) {
-					HEL_CHECK(helLoadahead(fileMemory.getHandle(), fileOffset, mapLength));
-
-					FRG_CO_TRY(co_await vmContext->mapFile(mapAddress,
-							fileMemory.dup(), file,
-							fileOffset, mapLength, true,
-							kHelMapProtRead | kHelMapProtExecute));
-				// Allow read only mappings too, ICU loves those.
-				}else if((phdr->p_flags & (PF_R | PF_W | PF_X)) == (PF_R)) {
-					HEL_CHECK(helLoadahead(fileMemory.getHandle(), fileOffset, mapLength));
-
-					FRG_CO_TRY(co_await vmContext->mapFile(mapAddress,
-							fileMemory.dup(), file,
-							fileOffset, mapLength, true,
-							kHelMapProtRead));
-				}else{
-					std::cout << "posix: Illegal combination of segment permissions" << std::endl;
-					co_return Error::badExecutable;
-				}
-			}else{
-				// Map the segment with write permission into this address space.
+			auto permissions = phdr->p_flags & (PF_R | PF_W | PF_X);
+			if(permissions == (PF_R | PF_X) || permissions == PF_R) {
+				// Read-only segments are shared with the file.
+				HEL_CHECK(helLoadahead(image->fileMemory.getHandle(), fileOffset, mapLength));
+			}else if(permissions == (PF_R | PF_W)) {
 				HelHandle segmentHandle;
-				HEL_CHECK(helAllocateMemory(mapLength, 0, nullptr, &segmentHandle));
+				HEL_CHECK(helAllocateMemory(mapLength, kHelAllocSwappable, nullptr, &segmentHandle));
+				image->segmentMemory[i] = helix::UniqueDescriptor{segmentHandle};
 
 				void *window;
 				HEL_CHECK(helMapMemory(segmentHandle, kHelNullHandle, nullptr,
 						0, mapLength, kHelMapProtRead | kHelMapProtWrite, &window));
 
-				// Map the segment with correct permissions into the process.
-				if((phdr->p_flags & (PF_R | PF_W | PF_X)) == (PF_R | PF_W)) {
-					FRG_CO_TRY(co_await vmContext->mapFile(mapAddress,
-							helix::UniqueDescriptor{segmentHandle}, file,
-							0, mapLength, true,
-							kHelMapProtRead | kHelMapProtWrite));
-				}else{
-					std::cout << "posix: Illegal combination of segment permissions" << std::endl;
-					co_return Error::badExecutable;
-				}
-
 				// Read the segment contents from the file.
 				memset(window, 0, mapLength);
-				FRG_CO_TRY(co_await file->seek(phdr->p_offset, VfsSeek::absolute));
-				FRG_CO_TRY(co_await file->readExactly(nullptr,
-						(char *)window + misalign, phdr->p_filesz));
+				auto seekOutcome = co_await file->seek(phdr->p_offset, VfsSeek::absolute);
+				auto readOutcome = seekOutcome
+						? co_await file->readExactly(nullptr, (char *)window + misalign, phdr->p_filesz)
+						: frg::expected<Error>{seekOutcome.error()};
 				HEL_CHECK(helUnmapMemory(kHelNullHandle, window, mapLength));
+				if(!readOutcome)
+					co_return readOutcome.error();
+			}else{
+				std::cout << "posix: Illegal combination of segment permissions" << std::endl;
+				co_return Error::badExecutable;
 			}
-		}else if(phdr->p_type == PT_PHDR) {
-			info.phdrPtr = (char *)base + phdr->p_vaddr;
-		}else if(phdr->p_type == PT_DYNAMIC || phdr->p_type == PT_INTERP
-				|| phdr->p_type == PT_TLS
+		}else if(phdr->p_type == PT_PHDR || phdr->p_type == PT_DYNAMIC
+				|| phdr->p_type == PT_INTERP || phdr->p_type == PT_TLS
 				|| phdr->p_type == PT_GNU_EH_FRAME || phdr->p_type == PT_GNU_STACK
 				|| phdr->p_type == PT_GNU_RELRO || phdr->p_type == PT_NOTE) {
 			// Ignore this PHDR here.
@@ -169,6 +175,95 @@ loadElfImage(SharedFilePtr file, VmContext *vmContext, uintptr_t base) {
 		}
 	}
 
+	co_return image;
+}
+
+} // anonymous namespace
+
+// Returns the (possibly cached) image of an ELF file.
+async::result<frg::expected<Error, std::shared_ptr<ElfImage>>>
+getElfImage(SharedFilePtr file) {
+	auto key = co_await getImageKey(file);
+	if(key) {
+		auto it = imageCache.find(*key);
+		if(it != imageCache.end()) {
+			if(logImageCache)
+				std::cout << "posix: Using cached ELF image of inode "
+						<< key->inodeNumber << std::endl;
+			it->second->lastUse = ++imageCacheClock;
+			co_return it->second;
+		}
+	}
+
+	auto image = FRG_CO_TRY(co_await readElfImage(file));
+	if(!key)
+		co_return image;
+
+	if(imageCache.size() >= maxCachedImages) {
+		auto victim = std::min_element(imageCache.begin(), imageCache.end(),
+				[] (const auto &a, const auto &b) {
+					return a.second->lastUse < b.second->lastUse;
+				});
+		imageCache.erase(victim);
+	}
+	image->lastUse = ++imageCacheClock;
+	imageCache.insert_or_assign(*key, image);
+	co_return image;
+}
+
+ImagePreamble parseElfPreamble(ElfImage *image) {
+	ImagePreamble preamble;
+
+	// Right now we treat every ET_DYN object as PIE and unconditionally apply
+	// a non-zero base address.
+	if(image->ehdr.e_type == ET_DYN)
+		preamble.isPie = true;
+
+	return preamble;
+}
+
+async::result<frg::expected<Error, ImageInfo>>
+loadElfImage(SharedFilePtr file, ElfImage *image, VmContext *vmContext, uintptr_t base) {
+	assert(!(base & (kPageSize - 1))); // Callers need to ensure this.
+	ImageInfo info;
+
+	auto &ehdr = image->ehdr;
+	info.entryIp = (char *)base + ehdr.e_entry;
+	info.phdrEntrySize = ehdr.e_phentsize;
+	info.phdrCount = ehdr.e_phnum;
+
+	// Load the segments into the address space. readElfImage() already validated the PHDRs.
+	for(int i = 0; i < ehdr.e_phnum; i++) {
+		auto phdr = image->phdr(i);
+
+		if(phdr->p_type == PT_LOAD) {
+			if(!phdr->p_memsz) // Skip empty segments.
+				continue;
+
+			size_t misalign = phdr->p_vaddr & (kPageSize - 1);
+			uintptr_t mapAddress = base + phdr->p_vaddr - misalign;
+			uintptr_t fileOffset = phdr->p_offset - misalign;
+			size_t mapLength = (phdr->p_memsz + misalign + kPageSize - 1) & ~(kPageSize - 1);
+
+			// Map the segment with correct permissions into the process.
+			if(!(phdr->p_flags & PF_W)) {
+				uint32_t nativeFlags = kHelMapProtRead;
+				if(phdr->p_flags & PF_X)
+					nativeFlags |= kHelMapProtExecute;
+				FRG_CO_TRY(co_await vmContext->mapFile(mapAddress,
+						image->fileMemory.dup(), file,
+						fileOffset, mapLength, true, nativeFlags));
+			}else{
+				FRG_CO_TRY(co_await vmContext->mapFile(mapAddress,
+						image->segmentMemory[i].dup(), file,
+						0, mapLength, true,
+						kHelMapProtRead | kHelMapProtWrite));
+			}
+		}else if(phdr->p_type == PT_PHDR) {
+			info.phdrPtr = (char *)base + phdr->p_vaddr;
+		}
+	}
+
 	co_return info;
 }
 
@@ -255,25 +350,31 @@ execute(ViewPath root, ViewPath workdir,
 		nRecursions++;
 	}
 
-	auto execPreamble = FRG_CO_TRY(co_await parseElfPreamble(execFile));
+	auto execImage = FRG_CO_TRY(co_await getElfImage(execFile));
+	auto execPreamble = parseElfPreamble(execImage.get());
 	ImageInfo execInfo;
 	if(execPreamble.isPie) {
 		// Unconditionally apply a non-zero base address to PIE objects.
-		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, vmContext.get(), 0x200000));
+		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, execImage.get(),
+				vmContext.get(), 0x200000));
 	}else{
-		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, vmContext.get(), 0));
+		execInfo = FRG_CO_TRY(co_await loadElfImage(execFile, execImage.get(),
+				vmContext.get(), 0));
 	}
 
 	// TODO: Should we really look up the dynamic linker in the current working dir?
 	auto ldsoFile = FRG_CO_TRY(co_await open(root, workdir, "/lib/ld-init.so", self));
 	assert(ldsoFile); // If open() succeeds, it must return a non-null file.
-	auto ldsoInfo = FRG_CO_TRY(co_await loadElfImage(ldsoFile, vmContext.get(), 0x40000000));
+	auto ldsoImage = FRG_CO_TRY(co_await getElfImage(ldsoFile));
+	auto ldsoInfo = FRG_CO_TRY(co_await loadElfImage(ldsoFile, ldsoImage.get(),
+			vmContext.get(), 0x40000000));
 
 	constexpr size_t stackSize = 0x200000;
 
 	// Allocate memory for the stack.
 	HelHandle stackHandle;
-	HEL_CHECK(helAllocateMemory(stackSize, kHelAllocOnDemand, nullptr, &stackHandle));
+	HEL_CHECK(helAllocateMemory(stackSize, kHelAllocOnDemand | kHelAllocSwappable,
+			nullptr, &stackHandle));
 
 	void *window;
 	HEL_CHECK(helMapMemory(stackHandle, kHelNullHandle, nullptr,
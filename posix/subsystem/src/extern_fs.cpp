@@ -1,7 +1,11 @@
 #include <sys/epoll.h>
+#include <algorithm>
+#include <list>
 #include <map>
+#include <optional>
 
 #include <frg/std_compat.hpp>
+#include <helix/memory.hpp>
 #include <protocols/fs/client.hpp>
 #include "common.hpp"
 #include "extern_fs.hpp"
@@ -33,11 +37,43 @@ struct Superblock final : FsSuperblock {
 	std::shared_ptr<FsLink> internalizePeripheralLink(Node *parent, std::string name,
 			std::shared_ptr<Node> target);
 
+	// Dentry cache. Maps (directory inode, name) to the link; a null link is a negative entry.
+	// Posix is the only client that modifies the file system, hence it is enough to
+	// invalidate entries after the server has modified a directory.
+	// Lookups that race with a modification must not cache their (possibly stale) result:
+	// they pass the generation from before their request to cacheDentry(), which ignores
+	// the entry if anything was invalidated in the meantime.
+	std::optional<std::shared_ptr<FsLink>> lookupDentry(uint64_t directory, const std::string &name);
+	uint64_t dentryGeneration() {
+		return _dentryGeneration;
+	}
+	void cacheDentry(uint64_t directory, const std::string &name, std::shared_ptr<FsLink> link,
+			uint64_t generation);
+	void invalidateDentry(uint64_t directory, const std::string &name);
+	// Returns the inode of the directory that name refers to (if it is a directory).
+	async::result<std::optional<uint64_t>> findDirectory(FsNode *parent, const std::string &name);
+	// Drops all entries of a directory. Must be called before a lookup can observe
+	// that the server reused the inode for a different directory.
+	void invalidateDirectory(uint64_t inode);
+
 private:
+	using DentryKey = std::pair<uint64_t, std::string>;
+
+	struct DentryEntry {
+		std::shared_ptr<FsLink> link;
+		std::list<DentryKey>::iterator lruIt;
+	};
+
+	// Cached links keep their targets alive; bound the number of entries.
+	static constexpr size_t dentryCacheCapacity = 4096;
+
 	helix::UniqueLane _lane;
 	std::map<uint64_t, std::weak_ptr<DirectoryNode>> _activeStructural;
 	std::map<uint64_t, std::weak_ptr<Node>> _activePeripheralNodes;
 	std::map<std::tuple<uint64_t, std::string, uint64_t>, std::weak_ptr<FsLink>> _activePeripheralLinks;
+	std::map<DentryKey, DentryEntry> _dentries;
+	std::list<DentryKey> _dentryLru; // Most recently used entries are at the front.
+	uint64_t _dentryGeneration = 0;
 };
 
 struct Node : FsNode {
@@ -100,6 +136,8 @@ struct Node : FsNode {
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		if(resp.error() == managarm::fs::Errors::READ_ONLY_FILE_SYSTEM)
+			co_return Error::readOnlyFileSystem;
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
 		co_return Error::success;
@@ -128,6 +166,8 @@ struct Node : FsNode {
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		if(resp.error() == managarm::fs::Errors::READ_ONLY_FILE_SYSTEM)
+			co_return Error::readOnlyFileSystem;
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
 		co_return Error::success;
@@ -179,6 +219,29 @@ private:
 		co_return length;
 	}
 
+	async::result<frg::expected<Error, size_t>>
+	pread(Process *, int64_t offset, void *data, size_t length) override {
+		if(offset < 0)
+			co_return Error::illegalArguments;
+		if(!length)
+			co_return size_t{0};
+
+		auto cached = co_await _readCached(offset, data, length);
+		if(cached)
+			co_return cached;
+
+		auto result = co_await _file.pread(offset, data, length);
+		if(!result) {
+			if(result.error() == protocols::fs::Error::wouldBlock)
+				co_return Error::wouldBlock;
+			if(result.error() == protocols::fs::Error::illegalArguments)
+				co_return Error::illegalArguments;
+			assert(result.error() == protocols::fs::Error::illegalOperationTarget);
+			co_return Error::illegalOperationTarget;
+		}
+		co_return result.value();
+	}
+
 	async::result<frg::expected<Error, PollWaitResult>>
 	pollWait(Process *, uint64_t sequence, int mask,
 			async::cancellation_token cancellation) override {
@@ -241,14 +304,70 @@ public:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		if(resp.error() == managarm::fs::Errors::READ_ONLY_FILE_SYSTEM)
+			co_return protocols::fs::Error::readOnlyFileSystem;
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 		co_return {};
 	}
 
 private:
+	// Copies from the server's page cache (i.e., the memory returned by accessMemory()),
+	// provided that the range starts within the part of the file that is known to exist.
+	// Returns the number of bytes that were copied; zero means that IPC is required.
+	async::result<size_t> _readCached(uint64_t offset, void *data, size_t length) {
+		constexpr size_t pageSize = 0x1000;
+
+		if(!_cacheProbed) {
+			_cacheProbed = true;
+			auto link = associatedLink();
+			if(link && link->getTarget()->getType() == VfsType::regular)
+				_cacheMemory = co_await _file.accessMemory();
+		}
+		if(!_cacheMemory)
+			co_return 0;
+
+		// Servers keep the size of the memory at the file size rounded up to pages.
+		// Hence, all pages except for the last one are within the file;
+		// the last page is read via IPC to determine the exact end of the file.
+		size_t viewSize;
+		HEL_CHECK(helMemoryInfo(_cacheMemory.getHandle(), &viewSize));
+		size_t safeEnd = std::min(viewSize > pageSize ? viewSize - pageSize : 0,
+				maxCacheMapping);
+		if(offset >= safeEnd)
+			co_return 0;
+		auto chunk = std::min(length, safeEnd - offset);
+
+		// Re-map if the file grew since we mapped it.
+		if(_cacheMapping.size() < safeEnd)
+			_cacheMapping = helix::Mapping{_cacheMemory, 0, safeEnd,
+					kHelMapProtRead | kHelMapDontRequireBacking};
+
+		// Locking makes sure that the pages are present. If they are not,
+		// the kernel asks the server to load them; posix is not blocked meanwhile.
+		auto lockOffset = offset & ~(pageSize - 1);
+		auto lockSize = ((offset + chunk + pageSize - 1) & ~(pageSize - 1)) - lockOffset;
+		helix::LockMemoryView lockMemory;
+		auto &&submit = helix::submitLockMemoryView(_cacheMemory,
+				&lockMemory, lockOffset, lockSize, helix::Dispatcher::global());
+		co_await submit.async_wait();
+		if(lockMemory.error())
+			co_return 0;
+		auto lock = lockMemory.descriptor();
+
+		memcpy(data, reinterpret_cast<char *>(_cacheMapping.get()) + offset, chunk);
+		co_return chunk;
+	}
+
+	// Larger files are only cached up to this offset.
+	static constexpr size_t maxCacheMapping = size_t(64) << 20;
+
 	helix::UniqueLane _control;
 	protocols::fs::File _file;
 	bool _append;
+
+	bool _cacheProbed = false;
+	helix::UniqueDescriptor _cacheMemory;
+	helix::Mapping _cacheMapping;
 };
 
 struct RegularNode final : Node {
@@ -383,9 +502,15 @@ public:
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
+		_obstructed = true;
 		co_return frg::success_tag{};
 	}
 
+	// The server stops traversing paths at obstructed links (i.e., at mount points).
+	bool isObstructed() {
+		return _obstructed;
+	}
+
 private:
 	std::string getName() override {
 		assert(_owner);
@@ -406,6 +531,7 @@ protected:
 private:
 	std::shared_ptr<FsNode> _owner;
 	std::string _name;
+	bool _obstructed = false;
 };
 
 // This class maintains a strong reference to the target.
@@ -462,6 +588,41 @@ private:
 
 	async::result<frg::expected<Error, std::pair<std::shared_ptr<FsLink>, size_t>>>
 	traverseLinks(std::deque<std::string> path) override {
+		// Resolve as many components as possible from the dentry cache.
+		// If we make progress, the PathResolver calls us again for the remaining components.
+		{
+			std::shared_ptr<FsLink> link;
+			std::shared_ptr<FsNode> directory;
+			Node *directoryNode = this;
+			size_t n = 0;
+			while(n < path.size()) {
+				if(path[n] == "." || path[n] == "..")
+					break;
+				auto cached = _sb->lookupDentry(directoryNode->getInode(), path[n]);
+				if(!cached)
+					break;
+				if(!*cached)
+					co_return Error::noSuchFile;
+				link = std::move(*cached);
+				n++;
+
+				if(n == path.size())
+					break;
+				auto target = link->getTarget();
+				if(static_cast<Link *>(link.get())->isObstructed()
+						|| target->getType() == VfsType::symlink)
+					break;
+				if(target->getType() != VfsType::directory)
+					co_return Error::notDirectory;
+				directory = std::move(target);
+				directoryNode = static_cast<Node *>(directory.get());
+			}
+			if(n)
+				co_return std::make_pair(link, n);
+		}
+
+		auto generation = _sb->dentryGeneration();
+
 		managarm::fs::NodeTraverseLinksRequest req;
 		for (auto &i : path)
 			req.add_path_segments(i);
@@ -487,6 +648,9 @@ private:
 		recv_resp.reset();
 
 		if (resp.error() == managarm::fs::Errors::FILE_NOT_FOUND) {
+			// We only know which component is missing if there is a single one.
+			if (path.size() == 1 && path[0] != "." && path[0] != "..")
+				_sb->cacheDentry(getInode(), path[0], nullptr, generation);
 			co_return Error::noSuchFile;
 		} else if (resp.error() == managarm::fs::Errors::NOT_DIRECTORY) {
 			co_return Error::notDirectory;
@@ -501,18 +665,32 @@ private:
 		assert(resp.links_traversed() <= path.size());
 
 		std::shared_ptr<Node> parentNode{weakNode()};
-		for (size_t i = 0; i < resp.ids().size(); i++) {
-			auto [pull_node] = co_await helix_ng::exchangeMsgs(
-				pull_lane,
-				helix_ng::pullDescriptor()
-			);
+		// The server resolves ".." itself; we cannot map IDs to names after that.
+		bool cacheable = true;
+		// Pull the nodes in batches instead of doing one round trip per node.
+		std::vector<helix_ng::PullDescriptorResult> pull_nodes;
+		for (size_t i = 0; i < resp.ids().size(); i += protocols::fs::maxDescriptorBatch) {
+			auto n = std::min(resp.ids().size() - i, protocols::fs::maxDescriptorBatch);
+			auto batch = co_await helix_ng::exchangeMsgsVector(pull_lane,
+					std::vector<helix_ng::PullDescriptor>(n));
+			for (auto &pull_node : batch)
+				pull_nodes.push_back(std::move(pull_node));
+		}
 
+		for (size_t i = 0; i < resp.ids().size(); i++) {
+			auto &pull_node = pull_nodes[i];
 			HEL_CHECK(pull_node.error());
 
+			if (path[i] == "." || path[i] == "..")
+				cacheable = false;
+
 			if (i != resp.ids().size() - 1
 					|| resp.file_type() == managarm::fs::FileType::DIRECTORY) {
 				auto child = _sb->internalizeStructural(parentNode.get(), path[i],
 						resp.ids()[i], pull_node.descriptor());
+				if (cacheable)
+					_sb->cacheDentry(parentNode->getInode(), path[i], child->treeLink(),
+							generation);
 				if (i != resp.ids().size() - 1)
 					parentNode = child;
 				else
@@ -521,6 +699,8 @@ private:
 				auto child = _sb->internalizePeripheralNode(resp.file_type(), resp.ids()[i],
 						pull_node.descriptor());
 				link = _sb->internalizePeripheralLink(parentNode.get(), path[i], std::move(child));
+				if (cacheable)
+					_sb->cacheDentry(parentNode->getInode(), path[i], link, generation);
 			}
 		}
 
@@ -549,6 +729,7 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recvResp.data(), recvResp.length());
 		recvResp.reset();
+		_sb->invalidateDentry(getInode(), name);
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pullNode.error());
 
@@ -587,6 +768,7 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recvResp.data(), recvResp.length());
 		recvResp.reset();
+		_sb->invalidateDentry(getInode(), name);
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pullNode.error());
 
@@ -608,6 +790,10 @@ private:
 
 	async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 			getLink(std::string name) override {
+		if(auto cached = _sb->lookupDentry(getInode(), name); cached)
+			co_return std::move(*cached);
+		auto generation = _sb->dentryGeneration();
+
 		helix::Offer offer;
 		helix::SendBuffer send_req;
 		helix::RecvInline recv_resp;
@@ -633,16 +819,20 @@ private:
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pull_node.error());
 
+			std::shared_ptr<FsLink> link;
 			if(resp.file_type() == managarm::fs::FileType::DIRECTORY) {
 				auto child = _sb->internalizeStructural(this, name,
 						resp.id(), pull_node.descriptor());
-				co_return child->treeLink();
+				link = child->treeLink();
 			}else{
 				auto child = _sb->internalizePeripheralNode(resp.file_type(), resp.id(),
 						pull_node.descriptor());
-				co_return _sb->internalizePeripheralLink(this, name, std::move(child));
+				link = _sb->internalizePeripheralLink(this, name, std::move(child));
 			}
+			_sb->cacheDentry(getInode(), name, link, generation);
+			co_return link;
 		}else if(resp.error() == managarm::fs::Errors::FILE_NOT_FOUND) {
+			_sb->cacheDentry(getInode(), name, nullptr, generation);
 			co_return nullptr;
 		}else{
 			assert(resp.error() == managarm::fs::Errors::NOT_DIRECTORY);
@@ -675,6 +865,7 @@ private:
 
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		_sb->invalidateDentry(getInode(), name);
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pull_node.error());
 
@@ -713,15 +904,20 @@ private:
 
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		_sb->invalidateDentry(getInode(), name);
 		if(resp.error() == managarm::fs::Errors::FILE_NOT_FOUND)
 			co_return Error::noSuchFile;
 		else if(resp.error() == managarm::fs::Errors::DIRECTORY_NOT_EMPTY)
 			co_return Error::directoryNotEmpty;
+		else if(resp.error() == managarm::fs::Errors::READ_ONLY_FILE_SYSTEM)
+			co_return Error::readOnlyFileSystem;
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 		co_return {};
 	}
 
 	async::result<frg::expected<Error>> rmdir(std::string name) override {
+		auto directoryInode = co_await _sb->findDirectory(this, name);
+
 		managarm::fs::CntRequest req;
 		req.set_req_type(managarm::fs::CntReqType::NODE_RMDIR);
 		req.set_path(name);
@@ -741,9 +937,14 @@ private:
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 		recv_resp.reset();
+		if(directoryInode)
+			_sb->invalidateDirectory(*directoryInode);
+		_sb->invalidateDentry(getInode(), name);
 
 		if(resp.error() == managarm::fs::Errors::DIRECTORY_NOT_EMPTY) {
 			co_return Error::directoryNotEmpty;
+		}else if(resp.error() == managarm::fs::Errors::READ_ONLY_FILE_SYSTEM) {
+			co_return Error::readOnlyFileSystem;
 		}
 
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
@@ -876,6 +1077,9 @@ async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 	req.set_old_name(source->getName());
 	req.set_new_name(name);
 
+	// The rename might replace an (empty) directory.
+	auto directoryInode = co_await findDirectory(target_node, name);
+
 	auto [offer, send_head, send_tail, recv_resp] = co_await helix_ng::exchangeMsgs(
 		_lane,
 		helix_ng::offer(
@@ -892,6 +1096,10 @@ async::result<frg::expected<Error, std::shared_ptr<FsLink>>>
 	managarm::fs::SvrResponse resp;
 	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
 	recv_resp.reset();
+	if(directoryInode)
+		invalidateDirectory(*directoryInode);
+	invalidateDentry(source_node->getInode(), source->getName());
+	invalidateDentry(target_node->getInode(), name);
 	if(resp.error() == managarm::fs::Errors::SUCCESS) {
 		co_return internalizePeripheralLink(target_node, name, shared_node);
 	}else{
@@ -962,6 +1170,66 @@ std::shared_ptr<FsLink> Superblock::internalizePeripheralLink(Node *parent, std:
 	return link;
 }
 
+std::optional<std::shared_ptr<FsLink>>
+Superblock::lookupDentry(uint64_t directory, const std::string &name) {
+	auto it = _dentries.find({directory, name});
+	if(it == _dentries.end())
+		return std::nullopt;
+	_dentryLru.splice(_dentryLru.begin(), _dentryLru, it->second.lruIt);
+	return it->second.link;
+}
+
+void Superblock::cacheDentry(uint64_t directory, const std::string &name,
+		std::shared_ptr<FsLink> link, uint64_t generation) {
+	if(generation != _dentryGeneration)
+		return;
+
+	auto [it, inserted] = _dentries.insert({{directory, name}, DentryEntry{}});
+	if(inserted) {
+		_dentryLru.push_front(it->first);
+		it->second.lruIt = _dentryLru.begin();
+	}else{
+		_dentryLru.splice(_dentryLru.begin(), _dentryLru, it->second.lruIt);
+	}
+	it->second.link = std::move(link);
+
+	while(_dentries.size() > dentryCacheCapacity) {
+		_dentries.erase(_dentryLru.back());
+		_dentryLru.pop_back();
+	}
+}
+
+void Superblock::invalidateDentry(uint64_t directory, const std::string &name) {
+	_dentryGeneration++;
+
+	auto it = _dentries.find({directory, name});
+	if(it == _dentries.end())
+		return;
+	_dentryLru.erase(it->second.lruIt);
+	_dentries.erase(it);
+}
+
+async::result<std::optional<uint64_t>>
+Superblock::findDirectory(FsNode *parent, const std::string &name) {
+	auto linkResult = co_await parent->getLink(name);
+	if(!linkResult || !linkResult.value())
+		co_return std::nullopt;
+	auto target = linkResult.value()->getTarget();
+	if(target->getType() != VfsType::directory)
+		co_return std::nullopt;
+	co_return static_cast<Node *>(target.get())->getInode();
+}
+
+void Superblock::invalidateDirectory(uint64_t inode) {
+	_dentryGeneration++;
+
+	auto it = _dentries.lower_bound({inode, std::string{}});
+	while(it != _dentries.end() && it->first.first == inode) {
+		_dentryLru.erase(it->second.lruIt);
+		it = _dentries.erase(it);
+	}
+}
+
 } // anonymous namespace
 
 std::shared_ptr<FsLink> createRoot(helix::UniqueLane sb_lane, helix::UniqueLane lane) {
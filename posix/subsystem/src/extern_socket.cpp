@@ -1,37 +1,207 @@
+#include <sys/epoll.h>
+
+#include <iostream>
+
+#include <async/recurring-event.hpp>
+#include <helix/memory.hpp>
+#include <protocols/fs/defs.hpp>
+
 #include "extern_socket.hpp"
 
 #include "fs.bragi.hpp"
 #include "protocols/fs/client.hpp"
 
 namespace {
+
+constexpr bool logStatusSeqlock = false;
+
+// Consistent copy of the fields of the status page that are protected by the seqlock.
+struct StatusSnapshot {
+	uint64_t sequence;
+	int status;
+	uint64_t inSequence;
+	uint64_t outSequence;
+	uint64_t hupSequence;
+};
+
 struct Socket : File {
-	Socket(helix::UniqueLane sockLane)
+	Socket(helix::UniqueLane sockLane, helix::Mapping statusMapping)
 	: File{StructName::get("extern-socket")},
-		_file{std::move(sockLane)} { }
+		_file{std::move(sockLane)}, _statusMapping{std::move(statusMapping)} { }
+
+	// If the server provides a status page, we watch the page (using a futex) instead
+	// of issuing poll requests to the server.
+	// The coroutine keeps the file alive until it is closed.
+	static void serve(smarter::shared_ptr<Socket> file) {
+		if(file->_hasEdges())
+			file->_watchPage(file);
+	}
+
+	void handleClose() override {
+		if(_futexAsyncId)
+			HEL_CHECK(helCancelAsync(helix::Dispatcher::global().acquire(), _futexAsyncId));
+		_waiterBell.raise();
+		_doorbell.raise();
+	}
 
 	async::result<frg::expected<Error, PollWaitResult>>
 	pollWait(Process *, uint64_t sequence, int mask,
 			async::cancellation_token cancellation) override {
-		auto resultOrError = co_await _file.pollWait(sequence, mask, cancellation);
-		assert(resultOrError);
-		co_return resultOrError.value();
+		(void)mask; // TODO: utilize mask.
+
+		auto pollOverIpc = [&] () -> async::result<frg::expected<Error, PollWaitResult>> {
+			auto resultOrError = co_await _file.pollWait(sequence, mask, cancellation);
+			assert(resultOrError);
+			co_return resultOrError.value();
+		};
+
+		if(!_hasEdges())
+			co_return co_await pollOverIpc();
+
+		auto page = _page();
+		while(true) {
+			// Read the futex before the snapshot, such that we notice all later updates.
+			auto futex = __atomic_load_n(&page->futex, __ATOMIC_SEQ_CST);
+			StatusSnapshot snapshot;
+			if(!_readStatus(snapshot))
+				co_return co_await pollOverIpc();
+
+			if(snapshot.sequence != sequence || cancellation.is_cancellation_requested()
+					|| !isOpen()) {
+				int edges = 0;
+				if(snapshot.inSequence > sequence)
+					edges |= EPOLLIN;
+				if(snapshot.outSequence > sequence)
+					edges |= EPOLLOUT;
+				if(snapshot.hupSequence > sequence)
+					edges |= EPOLLHUP;
+				co_return PollWaitResult{snapshot.sequence, edges};
+			}
+
+			co_await _waitForChange(futex, cancellation);
+		}
 	}
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
+		if(_statusMapping) {
+			StatusSnapshot snapshot;
+			if(_readStatus(snapshot))
+				co_return PollStatusResult{snapshot.sequence, snapshot.status};
+		}
+
 		auto resultOrError = co_await _file.pollStatus();
 		assert(resultOrError);
 		co_return resultOrError.value();
 	}
+	// Only used for transfers that posix performs on behalf of the user (e.g., sendfile()).
+	// Regular reads and writes go through the passthrough lane.
+	async::result<frg::expected<Error, size_t>>
+	writeAll(Process *, const void *data, size_t length) override {
+		size_t progress = 0;
+		while(progress < length) {
+			size_t chunk = co_await _file.writeSome(
+					reinterpret_cast<const char *>(data) + progress,
+					length - progress);
+			progress += chunk;
+		}
+		co_return length;
+	}
 
 	helix::BorrowedDescriptor getPassthroughLane() override {
 		return _file.getLane();
 	}
 
 private:
+	protocols::fs::StatusPage *_page() {
+		return reinterpret_cast<protocols::fs::StatusPage *>(_statusMapping.get());
+	}
+
+	bool _hasEdges() {
+		return _statusMapping
+				&& (__atomic_load_n(&_page()->flags, __ATOMIC_ACQUIRE)
+					& protocols::fs::statusPageHasEdges);
+	}
+
+	// Returns false if the page is being updated concurrently.
+	bool _readStatus(StatusSnapshot &snapshot) {
+		auto page = _page();
+
+		// Start the seqlock read.
+		auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seqlock & 1) {
+			if(logStatusSeqlock)
+				std::cout << "posix: Socket status page update in progess;"
+						" falling back to IPC request." << std::endl;
+			return false;
+		}
+
+		// Perform the actual loads.
+		snapshot.sequence = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+		snapshot.status = __atomic_load_n(&page->status, __ATOMIC_RELAXED);
+		snapshot.inSequence = __atomic_load_n(&page->inSequence, __ATOMIC_RELAXED);
+		snapshot.outSequence = __atomic_load_n(&page->outSequence, __ATOMIC_RELAXED);
+		snapshot.hupSequence = __atomic_load_n(&page->hupSequence, __ATOMIC_RELAXED);
+
+		// Finish the seqlock read.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) != seqlock) {
+			if(logStatusSeqlock)
+				std::cout << "posix: Stale data from socket status page;"
+						" falling back to IPC request." << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	// Waits until the futex of the status page differs from the given value.
+	async::result<void> _waitForChange(int32_t futex, async::cancellation_token cancellation) {
+		auto page = _page();
+		if(!_numWaiters++)
+			_waiterBell.raise();
+		while(__atomic_load_n(&page->futex, __ATOMIC_SEQ_CST) == futex && isOpen()
+				&& !cancellation.is_cancellation_requested())
+			co_await _doorbell.async_wait(cancellation);
+		_numWaiters--;
+	}
+
+	// Waits on the futex of the status page while there are waiters.
+	async::detached _watchPage(smarter::shared_ptr<Socket> self) {
+		(void)self;
+		auto page = _page();
+		while(isOpen()) {
+			if(!_numWaiters) {
+				__atomic_store_n(&page->watched, 0, __ATOMIC_SEQ_CST);
+				co_await _waiterBell.async_wait();
+				continue;
+			}
+
+			// The server checks watched after changing futex; hence, this cannot miss a change.
+			__atomic_store_n(&page->watched, 1, __ATOMIC_SEQ_CST);
+			auto futex = __atomic_load_n(&page->futex, __ATOMIC_SEQ_CST);
+			_doorbell.raise();
+
+			helix::AwaitFutex await;
+			auto &&submit = helix::submitAwaitFutex(&await, &page->futex, futex,
+					helix::Dispatcher::global());
+			_futexAsyncId = await.asyncId();
+			co_await submit.async_wait();
+			_futexAsyncId = 0;
+			assert(!await.error() || await.error() == kHelErrCancelled);
+		}
+	}
+
 	protocols::fs::File _file;
+	helix::Mapping _statusMapping;
+
+	async::recurring_event _doorbell;
+	async::recurring_event _waiterBell;
+	// Number of coroutines in _waitForChange().
+	unsigned int _numWaiters = 0;
+	uint64_t _futexAsyncId = 0;
 };
-}
+
+} // anonymous namespace
 
 namespace extern_socket {
 
@@ -47,11 +217,12 @@ async::result<smarter::shared_ptr<File, FileHandle>> createSocket(helix::Borrowe
 	auto req_data = req.SerializeAsString();
 	char buffer[128];
 
-	auto [offer, send_req, recv_resp, recv_lane] = co_await helix_ng::exchangeMsgs(
+	auto [offer, send_req, recv_resp, recv_lane, recv_page] = co_await helix_ng::exchangeMsgs(
 		lane,
 		helix_ng::offer(
 			helix_ng::sendBuffer(req_data.data(), req_data.size()),
 			helix_ng::recvBuffer(buffer, sizeof(buffer)),
+			helix_ng::pullDescriptor(),
 			helix_ng::pullDescriptor()
 		)
 	);
@@ -64,8 +235,15 @@ async::result<smarter::shared_ptr<File, FileHandle>> createSocket(helix::Borrowe
 	resp.ParseFromArray(buffer, recv_resp.actualLength());
 	assert(resp.error() == managarm::fs::Errors::SUCCESS);
 
-	auto file = smarter::make_shared<Socket>(recv_lane.descriptor());
+	helix::Mapping statusMapping;
+	if(resp.caps() & managarm::fs::FileCaps::FC_STATUS_PAGE) {
+		assert(!recv_page.error());
+		statusMapping = helix::Mapping{recv_page.descriptor(), 0, 0x1000};
+	}
+
+	auto file = smarter::make_shared<Socket>(recv_lane.descriptor(), std::move(statusMapping));
 	file->setupWeakFile(file);
+	Socket::serve(file);
 	co_return File::constructHandle(file);
 }
 
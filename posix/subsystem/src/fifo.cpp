@@ -1,10 +1,10 @@
 
+#include <limits.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <iostream>
-#include <deque>
 #include <map>
-#include <numeric>
+#include <memory>
 
 #include <async/recurring-event.hpp>
 #include <bragi/helpers-std.hpp>
@@ -20,32 +20,62 @@ namespace {
 
 constexpr bool logFifos = false;
 
-struct Packet {
-	// The actual octet data that the packet consists of.
-	std::vector<char> buffer;
-
-	size_t offset = 0;
-};
+// Capacity of each pipe. This matches the Linux default of 16 pages.
+constexpr size_t ringSize = 16 * 4096;
 
 struct Channel {
 	Channel()
 	: writerCount{0}, readerCount{0} { }
 
+	size_t bytesQueued() {
+		return writePtr - readPtr;
+	}
+
+	size_t bytesFree() {
+		return ringSize - bytesQueued();
+	}
+
+	// Copies data into the ring. The caller has to ensure that there is enough space.
+	void copyIn(const void *data, size_t length) {
+		assert(length <= bytesFree());
+		if(!ring)
+			ring = std::make_unique<char[]>(ringSize);
+		auto offset = writePtr % ringSize;
+		auto chunk = std::min(length, ringSize - offset);
+		memcpy(ring.get() + offset, data, chunk);
+		memcpy(ring.get(), reinterpret_cast<const char *>(data) + chunk, length - chunk);
+		writePtr += length;
+	}
+
+	// Copies data out of the ring. The caller has to ensure that enough data is queued.
+	void copyOut(void *data, size_t length) {
+		assert(length <= bytesQueued());
+		auto offset = readPtr % ringSize;
+		auto chunk = std::min(length, ringSize - offset);
+		memcpy(data, ring.get() + offset, chunk);
+		memcpy(reinterpret_cast<char *>(data) + chunk, ring.get(), length - chunk);
+		readPtr += length;
+	}
+
 	// Status management for poll().
 	async::recurring_event statusBell;
-	// Start at currentSeq = 1 since the pipe is always writable.
+	// Start at currentSeq = 1 since the pipe is initially writable.
 	uint64_t currentSeq = 1;
 	uint64_t noWriterSeq = 0;
 	uint64_t noReaderSeq = 0;
 	uint64_t inSeq = 0;
+	uint64_t outSeq = 1;
 	int writerCount;
 	int readerCount;
 
 	async::recurring_event readerPresent;
 	async::recurring_event writerPresent;
 
-	// The actual queue of this pipe.
-	std::deque<Packet> packetQueue;
+	// The actual ring buffer of this pipe. It is allocated on first write.
+	// readPtr and writePtr only ever increase; they are taken modulo ringSize.
+	std::unique_ptr<char[]> ring;
+	size_t readPtr = 0;
+	size_t writePtr = 0;
 };
 
 struct ReaderFile : File {
@@ -83,7 +113,7 @@ public:
 		if(!maxLength)
 			co_return 0;
 
-		while(_channel->packetQueue.empty() && _channel->writerCount) {
+		while(!_channel->bytesQueued() && _channel->writerCount) {
 			if(nonBlock_) {
 				if(logFifos)
 					std::cout << "posix: FIFO pipe would block" << std::endl;
@@ -92,19 +122,16 @@ public:
 			co_await _channel->statusBell.async_wait();
 		}
 
-		if(_channel->packetQueue.empty()) {
+		if(!_channel->bytesQueued()) {
 			assert(!_channel->writerCount);
 			co_return 0;
 		}
 
-		// TODO: Truncate packets (for SOCK_DGRAM) here.
-		auto packet = &_channel->packetQueue.front();
-		size_t chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
+		size_t chunk = std::min(_channel->bytesQueued(), maxLength);
 		assert(chunk); // Otherwise we return above since !maxLength.
-		memcpy(data, packet->buffer.data() + packet->offset, chunk);
-		packet->offset += chunk;
-		if(packet->offset == packet->buffer.size())
-			_channel->packetQueue.pop_front();
+		_channel->copyOut(data, chunk);
+		_channel->outSeq = ++_channel->currentSeq;
+		_channel->statusBell.raise();
 		co_return chunk;
 	}
 
@@ -139,7 +166,7 @@ public:
 		int events = 0;
 		if(!_channel->writerCount)
 			events |= EPOLLHUP;
-		if(!_channel->packetQueue.empty())
+		if(_channel->bytesQueued())
 			events |= EPOLLIN;
 
 		co_return PollStatusResult(_channel->currentSeq, events);
@@ -179,11 +206,7 @@ public:
 
 			switch(req->command()) {
 				case FIONREAD: {
-					size_t count = std::accumulate(_channel->packetQueue.cbegin(), _channel->packetQueue.cend(), 0, [](size_t sum, const Packet &p) {
-						return sum + (p.buffer.size() - p.offset);
-					});
-
-					resp.set_fionread_count(count);
+					resp.set_fionread_count(_channel->bytesQueued());
 					resp.set_error(managarm::fs::Errors::SUCCESS);
 
 					break;
@@ -231,8 +254,8 @@ public:
 				smarter::shared_ptr<File>{file}, &File::fileOperations));
 	}
 
-	WriterFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link)
-	: File{StructName::get("fifo.write"), mount, link, File::defaultPipeLikeSeek} { }
+	WriterFile(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link, bool nonBlock = false)
+	: File{StructName::get("fifo.write"), mount, link, File::defaultPipeLikeSeek}, nonBlock_{nonBlock} { }
 
 	void connectChannel(std::shared_ptr<Channel> channel) {
 		assert(!_channel);
@@ -252,15 +275,33 @@ public:
 
 	async::result<frg::expected<Error, size_t>>
 	writeAll(Process *, const void *data, size_t maxLength) override {
-		Packet packet;
-		packet.buffer.resize(maxLength);
-		memcpy(packet.buffer.data(), data, maxLength);
-		packet.offset = 0;
+		size_t progress = 0;
+		while(progress < maxLength) {
+			// Writes of at most PIPE_BUF bytes must not be interleaved with other writes.
+			size_t required = (maxLength <= PIPE_BUF) ? maxLength : 1;
+			while(_channel->bytesFree() < required && _channel->readerCount) {
+				if(nonBlock_) {
+					if(progress)
+						co_return progress;
+					co_return Error::wouldBlock;
+				}
+				co_await _channel->statusBell.async_wait();
+			}
 
-		_channel->packetQueue.push_back(std::move(packet));
-		_channel->inSeq = ++_channel->currentSeq;
-		_channel->statusBell.raise();
-		co_return maxLength;
+			if(!_channel->readerCount) {
+				if(progress)
+					co_return progress;
+				co_return Error::brokenPipe;
+			}
+
+			size_t chunk = std::min(_channel->bytesFree(), maxLength - progress);
+			_channel->copyIn(reinterpret_cast<const char *>(data) + progress, chunk);
+			progress += chunk;
+
+			_channel->inSeq = ++_channel->currentSeq;
+			_channel->statusBell.raise();
+		}
+		co_return progress;
 	}
 
 	async::result<frg::expected<Error, PollWaitResult>>
@@ -280,7 +321,9 @@ public:
 		if(cancellation.is_cancellation_requested())
 			std::cout << "\e[33mposix: fifo::poll() cancellation is untested\e[39m" << std::endl;
 
-		int edges = EPOLLOUT;
+		int edges = 0;
+		if(_channel->outSeq > pastSeq)
+			edges |= EPOLLOUT;
 		if(_channel->noReaderSeq > pastSeq)
 			edges |= EPOLLERR;
 
@@ -289,7 +332,9 @@ public:
 
 	async::result<frg::expected<Error, PollStatusResult>>
 	pollStatus(Process *) override {
-		int events = EPOLLOUT;
+		int events = 0;
+		if(_channel->bytesFree() >= PIPE_BUF)
+			events |= EPOLLOUT;
 		if(!_channel->readerCount)
 			events |= EPOLLERR;
 
@@ -300,15 +345,28 @@ public:
 		return _passthrough;
 	}
 
+	async::result<void> setFileFlags(int flags) override {
+		if(flags & ~O_NONBLOCK) {
+			std::cout << "posix: setFileFlags on fifo \e[1;34m" << structName() << "\e[0m called with unknown flags" << std::endl;
+			co_return;
+		}
+		nonBlock_ = flags & O_NONBLOCK;
+		co_return;
+	}
+
 	async::result<int> getFileFlags() override {
-		// TODO: Check if we need to OR any other bits in
-		co_return O_WRONLY;
+		int flags = O_WRONLY;
+		if(nonBlock_)
+			flags |= O_NONBLOCK;
+		co_return flags;
 	}
 
 private:
 	helix::UniqueLane _passthrough;
 
 	std::shared_ptr<Channel> _channel;
+
+	bool nonBlock_;
 };
 
 } // anonymous namespace
@@ -336,7 +394,7 @@ openNamedChannel(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 	if (flags & semanticRead) {
 		assert(!(flags & semanticWrite));
 
-		auto r_file = smarter::make_shared<ReaderFile>(mount, link);
+		auto r_file = smarter::make_shared<ReaderFile>(mount, link, flags & semanticNonBlock);
 		r_file->setupWeakFile(r_file);
 		r_file->connectChannel(channel);
 
@@ -351,7 +409,7 @@ openNamedChannel(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 		assert(flags & semanticWrite);
 		assert(!(flags & semanticRead));
 
-		auto w_file = smarter::make_shared<WriterFile>(mount, link);
+		auto w_file = smarter::make_shared<WriterFile>(mount, link, flags & semanticNonBlock);
 		w_file->setupWeakFile(w_file);
 		w_file->connectChannel(channel);
 
@@ -369,7 +427,7 @@ std::array<smarter::shared_ptr<File, FileHandle>, 2> createPair(bool nonBlock) {
 	auto link = SpecialLink::makeSpecialLink(VfsType::fifo, 0777);
 	auto channel = std::make_shared<Channel>();
 	auto r_file = smarter::make_shared<ReaderFile>(nullptr, link, nonBlock);
-	auto w_file = smarter::make_shared<WriterFile>(nullptr, link);
+	auto w_file = smarter::make_shared<WriterFile>(nullptr, link, nonBlock);
 	r_file->setupWeakFile(r_file);
 	w_file->setupWeakFile(w_file);
 	r_file->connectChannel(channel);
@@ -118,6 +118,10 @@ async::result<frg::expected<protocols::fs::Error, size_t>> File::ptWrite(void *o
 			co_return protocols::fs::Error::notConnected;
 		case Error::illegalOperationTarget:
 			co_return protocols::fs::Error::illegalOperationTarget;
+		case Error::brokenPipe:
+			co_return protocols::fs::Error::brokenPipe;
+		case Error::wouldBlock:
+			co_return protocols::fs::Error::wouldBlock;
 		default:
 			assert(!"Unexpected error from writeAll()");
 			__builtin_unreachable();
@@ -353,7 +357,9 @@ async::result<ReadEntriesResult> File::readEntries() {
 async::result<protocols::fs::RecvResult>
 File::recvMsg(Process *, uint32_t, void *, size_t,
 		void *, size_t, size_t) {
-	throw std::runtime_error("posix: Object has no File::recvMsg()");
+	std::cout << "posix \e[1;34m" << structName()
+			<< "\e[0m: Object does not implement recvMsg()" << std::endl;
+	co_return protocols::fs::Error::illegalOperationTarget;
 }
 
 async::result<frg::expected<protocols::fs::Error, size_t>>
@@ -363,7 +369,7 @@ File::sendMsg(Process *, uint32_t,
 		std::vector<smarter::shared_ptr<File, FileHandle>>, struct ucred) {
 	std::cout << "posix \e[1;34m" << structName()
 			<< "\e[0m: Object does not implement sendMsg()" << std::endl;
-	throw std::runtime_error("posix: Object has no File::sendMsg()");
+	co_return protocols::fs::Error::illegalOperationTarget;
 }
 
 async::result<frg::expected<protocols::fs::Error>> File::truncate(size_t) {
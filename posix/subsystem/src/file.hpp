@@ -69,7 +69,10 @@ enum class Error {
 	directoryNotEmpty,
 
 	// Failure of the underlying device, corresponds to EIO
-	ioError
+	ioError,
+
+	// Corresponds with EROFS
+	readOnlyFileSystem
 };
 
 std::ostream& operator<<(std::ostream& os, const Error& err);
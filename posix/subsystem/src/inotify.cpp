@@ -1,3 +1,4 @@
+#include <fcntl.h>
 #include <string.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
@@ -15,6 +16,9 @@ namespace inotify {
 
 namespace {
 
+// Matches the default of /proc/sys/fs/inotify/max_queued_events on Linux.
+constexpr size_t maxQueuedEvents = 16384;
+
 struct OpenFile : File {
 public:
 	struct Packet {
@@ -37,9 +41,7 @@ public:
 				inotifyEvents |= IN_CREATE;
 			if(!(inotifyEvents & mask))
 				return;
-			file->_queue.push_back(Packet{descriptor, inotifyEvents & mask, name, cookie});
-			file->_inSeq = ++file->_currentSeq;
-			file->_statusBell.raise();
+			file->_postEvent(Packet{descriptor, inotifyEvents & mask, name, cookie});
 		}
 
 		OpenFile *file;
@@ -54,8 +56,9 @@ public:
 				smarter::shared_ptr<File>{file}, &File::fileOperations));
 	}
 
-	OpenFile()
-	: File{StructName::get("inotify"), nullptr, SpecialLink::makeSpecialLink(VfsType::regular, 0777)} { }
+	OpenFile(bool nonBlock)
+	: File{StructName::get("inotify"), nullptr, SpecialLink::makeSpecialLink(VfsType::regular, 0777)},
+			_nonBlock{nonBlock} { }
 
 	~OpenFile() {
 		// TODO: Properly keep track of watches.
@@ -64,24 +67,40 @@ public:
 
 	async::result<frg::expected<Error, size_t>>
 	readSome(Process *, void *data, size_t maxLength) override {
-		// TODO: As an optimization, we could return multiple events at the same time.
-		Packet packet = std::move(_queue.front());
-		_queue.pop_front();
+		while(_queue.empty()) {
+			if(_nonBlock)
+				co_return Error::wouldBlock;
+			co_await _statusBell.async_wait();
+		}
 
-		if(maxLength < sizeof(inotify_event) + packet.name.size() + 1)
-			co_return Error::illegalArguments;
+		// Return as many events as fit into the buffer.
+		size_t offset = 0;
+		while(!_queue.empty()) {
+			auto &packet = _queue.front();
+			auto size = _eventSize(packet);
+			if(offset + size > maxLength)
+				break;
+
+			inotify_event e;
+			memset(&e, 0, sizeof(inotify_event));
+			e.wd = packet.descriptor;
+			e.mask = packet.events;
+			e.cookie = packet.cookie;
+			e.len = size - sizeof(inotify_event);
+
+			auto p = reinterpret_cast<char *>(data) + offset;
+			memcpy(p, &e, sizeof(inotify_event));
+			memset(p + sizeof(inotify_event), 0, e.len);
+			memcpy(p + sizeof(inotify_event), packet.name.data(), packet.name.size());
+
+			offset += size;
+			_queuedBytes -= size;
+			_queue.pop_front();
+		}
 
-		inotify_event e;
-		memset(&e, 0, sizeof(inotify_event));
-		e.wd = packet.descriptor;
-		e.mask = packet.events;
-		e.cookie = packet.cookie;
-		e.len = packet.name.size();
-
-		memcpy(data, &e, sizeof(inotify_event));
-		memcpy(reinterpret_cast<char *>(data) + sizeof(inotify_event),
-				packet.name.c_str(), packet.name.size() + 1);
-		co_return sizeof(inotify_event) + packet.name.size() + 1;
+		if(!offset)
+			co_return Error::illegalArguments;
+		co_return offset;
 	}
 
 	async::result<frg::expected<Error, PollWaitResult>>
@@ -115,6 +134,21 @@ public:
 		return _passthrough;
 	}
 
+	async::result<void> setFileFlags(int flags) override {
+		if(flags & ~O_NONBLOCK)
+			std::cout << "posix: setFileFlags on inotify \e[1;34m" << structName()
+					<< "\e[0m called with unknown flags" << std::endl;
+		_nonBlock = flags & O_NONBLOCK;
+		co_return;
+	}
+
+	async::result<int> getFileFlags() override {
+		int flags = O_RDONLY;
+		if(_nonBlock)
+			flags |= O_NONBLOCK;
+		co_return flags;
+	}
+
 	int addWatch(std::shared_ptr<FsNode> node, uint32_t mask) {
 		// TODO: Coalesce watch descriptors for the same inode.
 		if(mask & ~(IN_DELETE | IN_CREATE))
@@ -136,14 +170,7 @@ public:
 			switch(req->command()) {
 				case FIONREAD: {
 					resp.set_error(managarm::fs::Errors::SUCCESS);
-
-					if(_queue.empty()) {
-						resp.set_fionread_count(0);
-					} else {
-						auto packet = &_queue.front();
-						auto size = sizeof(Packet) + packet->name.size() + 1;
-						resp.set_fionread_count(size);
-					}
+					resp.set_fionread_count(_queuedBytes);
 					break;
 				}
 				default: {
@@ -164,8 +191,50 @@ public:
 	}
 
 private:
+	// Size of the inotify_event that readSome() produces for a packet.
+	// Like Linux, we pad names with null bytes to keep subsequent events aligned.
+	static size_t _eventSize(const Packet &packet) {
+		if(packet.name.empty())
+			return sizeof(inotify_event);
+		auto nameSize = (packet.name.size() + 1 + sizeof(inotify_event) - 1)
+				& ~(sizeof(inotify_event) - 1);
+		return sizeof(inotify_event) + nameSize;
+	}
+
+	void _postEvent(Packet packet) {
+		// Like Linux, merge identical events that have not been read yet.
+		if(!_queue.empty()) {
+			auto &last = _queue.back();
+			if(last.descriptor == packet.descriptor && last.events == packet.events
+					&& last.cookie == packet.cookie && last.name == packet.name)
+				return;
+		}
+
+		// Once the queue is full, further events are replaced by a single IN_Q_OVERFLOW.
+		if(_queue.size() >= maxQueuedEvents) {
+			if(_queue.back().events == IN_Q_OVERFLOW)
+				return;
+			packet = Packet{-1, IN_Q_OVERFLOW, {}, 0};
+		}
+
+		bool wasEmpty = _queue.empty();
+		_queuedBytes += _eventSize(packet);
+		_queue.push_back(std::move(packet));
+
+		// Readers drain the entire queue (up to their buffer size) on each read.
+		// Hence, we only need to wake them up when the first event arrives;
+		// as usual for edge-triggered polling, readers have to read until EAGAIN.
+		if(wasEmpty) {
+			_inSeq = ++_currentSeq;
+			_statusBell.raise();
+		}
+	}
+
 	helix::UniqueLane _passthrough;
 	std::deque<Packet> _queue;
+	// Total size of all events in _queue, as reported by FIONREAD.
+	size_t _queuedBytes = 0;
+	bool _nonBlock;
 
 	// TODO: Use a proper ID allocator to allocate watch descriptor IDs.
 	int _nextDescriptor = 1;
@@ -177,8 +246,8 @@ private:
 
 } // anonymous namespace
 
-smarter::shared_ptr<File, FileHandle> createFile() {
-	auto file = smarter::make_shared<OpenFile>();
+smarter::shared_ptr<File, FileHandle> createFile(bool nonBlock) {
+	auto file = smarter::make_shared<OpenFile>(nonBlock);
 	file->setupWeakFile(file);
 	OpenFile::serve(file);
 	return File::constructHandle(std::move(file));
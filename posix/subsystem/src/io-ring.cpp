@@ -0,0 +1,442 @@
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+#include <async/recurring-event.hpp>
+#include <helix/ipc.hpp>
+#include <helix/memory.hpp>
+#include <protocols/posix/io-ring.hpp>
+#include "io-ring.hpp"
+#include "process.hpp"
+
+namespace io_ring {
+
+namespace {
+
+constexpr bool logIoRing = false;
+
+// Upper bound on the number of submission queue entries.
+constexpr unsigned int maxEntries = 4096;
+
+// Reads and writes transfer at most this many bytes; larger requests complete short.
+constexpr size_t maxTransferSize = 1 << 20;
+
+int64_t errorToResult(Error error) {
+	switch(error) {
+	case Error::wouldBlock: return -EAGAIN;
+	case Error::brokenPipe: return -EPIPE;
+	case Error::seekOnPipe: return -ESPIPE;
+	case Error::illegalArguments: return -EINVAL;
+	case Error::illegalOperationTarget: return -EINVAL;
+	case Error::notConnected: return -ENOTCONN;
+	case Error::noSpaceLeft: return -ENOSPC;
+	case Error::isDirectory: return -EISDIR;
+	case Error::insufficientPermissions: return -EPERM;
+	case Error::accessDenied: return -EACCES;
+	case Error::noMemory: return -ENOMEM;
+	case Error::readOnlyFileSystem: return -EROFS;
+	default: return -EIO;
+	}
+}
+
+int64_t sendRecvErrorToResult(protocols::fs::Error error) {
+	switch(error) {
+	case protocols::fs::Error::wouldBlock: return -EAGAIN;
+	case protocols::fs::Error::brokenPipe: return -EPIPE;
+	case protocols::fs::Error::illegalArguments: return -EINVAL;
+	case protocols::fs::Error::illegalOperationTarget: return -EOPNOTSUPP;
+	case protocols::fs::Error::notConnected: return -ENOTCONN;
+	case protocols::fs::Error::destAddrRequired: return -EDESTADDRREQ;
+	case protocols::fs::Error::messageSize: return -EMSGSIZE;
+	case protocols::fs::Error::connectionRefused: return -ECONNREFUSED;
+	default: return -EIO;
+	}
+}
+
+// Copies the iovec array of a readv/writev SQE from the process.
+// Returns a negated errno value on failure.
+async::result<frg::expected<int64_t, std::vector<struct iovec>>>
+loadIovecs(Process *process, const posix::IoRingSqe &sqe) {
+	if(sqe.length > IOV_MAX)
+		co_return -EINVAL;
+
+	std::vector<struct iovec> iovs(sqe.length);
+	if(!iovs.empty()) {
+		auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+				sqe.addr, iovs.size() * sizeof(struct iovec), iovs.data());
+		if(load.error())
+			co_return -EFAULT;
+	}
+	co_return iovs;
+}
+
+// Total size of the transfer of a readv/writev SQE (including the maxTransferSize limit).
+size_t transferSize(const std::vector<struct iovec> &iovs) {
+	size_t size = 0;
+	for(auto &iov : iovs)
+		size += std::min(iov.iov_len, maxTransferSize - size);
+	return size;
+}
+
+struct OpenFile : File {
+	OpenFile(unsigned int entries)
+	: File{StructName::get("io-ring")}, _sqEntries{entries}, _cqEntries{2 * entries} {
+		_sqOffset = (sizeof(posix::IoRingHeader) + 63) & ~size_t(63);
+		_cqOffset = _sqOffset + _sqEntries * sizeof(posix::IoRingSqe);
+		_size = (_cqOffset + _cqEntries * sizeof(posix::IoRingCqe) + 0xFFF) & ~size_t(0xFFF);
+
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(_size, 0, nullptr, &handle));
+		_memory = helix::UniqueDescriptor{handle};
+		_mapping = helix::Mapping{_memory, 0, _size};
+
+		auto header = _header();
+		header->sqEntries = _sqEntries;
+		header->cqEntries = _cqEntries;
+		header->sqOffset = _sqOffset;
+		header->cqOffset = _cqOffset;
+	}
+
+	static void serve(smarter::shared_ptr<OpenFile> file) {
+		helix::UniqueLane lane;
+		std::tie(lane, file->_passthrough) = helix::createStream();
+		async::detach(protocols::fs::servePassthrough(std::move(lane),
+				smarter::shared_ptr<File>{file}, &File::fileOperations, file->_cancelServe));
+	}
+
+	async::result<frg::expected<Error, size_t>>
+	enter(std::shared_ptr<Process> process, unsigned int toSubmit, unsigned int minComplete) {
+		auto self = smarter::static_pointer_cast<OpenFile>(weakFile().lock());
+		auto header = _header();
+
+		size_t submitted = 0;
+		bool cancelChain = false;
+		while(submitted < toSubmit) {
+			// We own sqHead, hence there is no need for an atomic load.
+			auto head = header->sqHead;
+			auto tail = __atomic_load_n(&header->sqTail, __ATOMIC_ACQUIRE);
+			if(head == tail)
+				break;
+
+			// Copy the SQE such that the process can reuse the slot immediately.
+			posix::IoRingSqe sqe;
+			memcpy(&sqe, _sqes() + (head % _sqEntries), sizeof(posix::IoRingSqe));
+			__atomic_store_n(&header->sqHead, head + 1, __ATOMIC_RELEASE);
+
+			if(logIoRing)
+				std::cout << "posix: io-ring \e[1;34m" << structName() << "\e[0m: Starting opcode "
+						<< (int)sqe.opcode << " on fd " << sqe.fd << std::endl;
+			// Instead of running the SQEs of a chain independently, fail the entire chain.
+			// A chain ends at the first SQE without a link flag (or at the end of the batch).
+			constexpr uint8_t linkFlags = posix::ioRingSqeLink | posix::ioRingSqeHardLink;
+			if(cancelChain) {
+				cancelChain = sqe.flags & linkFlags;
+				_complete(sqe.userData, -ECANCELED);
+			}else if(sqe.flags & linkFlags) {
+				cancelChain = true;
+				_complete(sqe.userData, -EINVAL);
+			}else{
+				async::detach(_runOperation(self, process, sqe));
+			}
+			submitted++;
+		}
+
+		// Operations that completed while the CQ was full might fit now.
+		_flushOverflow();
+
+		while(_numCompletions() < minComplete && isOpen())
+			co_await _completionBell.async_wait();
+
+		co_return submitted;
+	}
+
+	// ------------------------------------------------------------------------
+	// File implementation.
+	// ------------------------------------------------------------------------
+
+	void handleClose() override {
+		_completionBell.raise();
+		_cancelServe.cancel();
+	}
+
+	async::result<frg::expected<Error, PollWaitResult>>
+	pollWait(Process *, uint64_t pastSeq, int mask,
+			async::cancellation_token cancellation) override {
+		assert(pastSeq <= _currentSeq);
+		// Completions are the only edges. If the caller is not interested in them,
+		// we only return once the file is closed or the wait is cancelled.
+		while(isOpen() && !cancellation.is_cancellation_requested()) {
+			if(_completionSeq > pastSeq && (mask & EPOLLIN))
+				break;
+			co_await _completionBell.async_wait(cancellation);
+		}
+
+		if(!isOpen())
+			co_return Error::fileClosed;
+
+		int edges = 0;
+		if(_completionSeq > pastSeq)
+			edges |= EPOLLIN;
+		co_return PollWaitResult{_currentSeq, edges & mask};
+	}
+
+	async::result<frg::expected<Error, PollStatusResult>>
+	pollStatus(Process *) override {
+		int events = 0;
+		if(_numCompletions())
+			events |= EPOLLIN;
+		co_return PollStatusResult{_currentSeq, events};
+	}
+
+	FutureMaybe<helix::UniqueDescriptor> accessMemory() override {
+		co_return _memory.dup();
+	}
+
+	helix::BorrowedDescriptor getPassthroughLane() override {
+		return _passthrough;
+	}
+
+private:
+	posix::IoRingHeader *_header() {
+		return reinterpret_cast<posix::IoRingHeader *>(_mapping.get());
+	}
+
+	posix::IoRingSqe *_sqes() {
+		return reinterpret_cast<posix::IoRingSqe *>(
+				reinterpret_cast<char *>(_mapping.get()) + _sqOffset);
+	}
+
+	posix::IoRingCqe *_cqes() {
+		return reinterpret_cast<posix::IoRingCqe *>(
+				reinterpret_cast<char *>(_mapping.get()) + _cqOffset);
+	}
+
+	// Number of completions that the process has not consumed yet (including overflowed ones).
+	size_t _numCompletions() {
+		auto header = _header();
+		auto head = __atomic_load_n(&header->cqHead, __ATOMIC_ACQUIRE);
+		return static_cast<uint32_t>(header->cqTail - head) + _overflow.size();
+	}
+
+	void _flushOverflow() {
+		auto header = _header();
+		while(!_overflow.empty()) {
+			auto head = __atomic_load_n(&header->cqHead, __ATOMIC_ACQUIRE);
+			// We own cqTail, hence there is no need for an atomic load.
+			auto tail = header->cqTail;
+			if(static_cast<uint32_t>(tail - head) == _cqEntries)
+				break;
+
+			memcpy(_cqes() + (tail % _cqEntries), &_overflow.front(), sizeof(posix::IoRingCqe));
+			_overflow.pop_front();
+			__atomic_store_n(&header->cqTail, tail + 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	void _complete(uint64_t userData, int64_t result) {
+		_overflow.push_back(posix::IoRingCqe{userData, result});
+		_flushOverflow();
+
+		_completionSeq = ++_currentSeq;
+		_completionBell.raise();
+	}
+
+	static async::result<void> _runOperation(smarter::shared_ptr<OpenFile> self,
+			std::shared_ptr<Process> process, posix::IoRingSqe sqe) {
+		auto result = co_await _performOperation(process.get(), sqe);
+		self->_complete(sqe.userData, result);
+	}
+
+	static async::result<int64_t> _performOperation(Process *process, posix::IoRingSqe sqe) {
+		// No other flags are supported either; linked SQEs never get here.
+		if(sqe.flags)
+			co_return -EINVAL;
+
+		if(sqe.opcode == posix::ioRingNop)
+			co_return 0;
+
+		auto file = process->fileContext()->getFile(sqe.fd);
+		if(!file)
+			co_return -EBADF;
+
+		if(sqe.opcode == posix::ioRingRead) {
+			std::vector<char> buffer(std::min(size_t{sqe.length}, maxTransferSize));
+			auto result = (sqe.offset >= 0)
+					? co_await file->pread(process, sqe.offset, buffer.data(), buffer.size())
+					: co_await file->readSome(process, buffer.data(), buffer.size());
+			if(!result)
+				co_return errorToResult(result.error());
+
+			if(result.value()) {
+				auto store = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+						sqe.addr, result.value(), buffer.data());
+				if(store.error())
+					co_return -EFAULT;
+			}
+			co_return result.value();
+		}else if(sqe.opcode == posix::ioRingWrite) {
+			std::vector<char> buffer(std::min(size_t{sqe.length}, maxTransferSize));
+			if(!buffer.empty()) {
+				auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+						sqe.addr, buffer.size(), buffer.data());
+				if(load.error())
+					co_return -EFAULT;
+			}
+
+			auto result = (sqe.offset >= 0)
+					? co_await file->pwrite(process, sqe.offset, buffer.data(), buffer.size())
+					: co_await file->writeAll(process, buffer.data(), buffer.size());
+			if(!result)
+				co_return errorToResult(result.error());
+			co_return result.value();
+		}else if(sqe.opcode == posix::ioRingAccept) {
+			auto result = co_await file->accept(process);
+			if(!result)
+				co_return errorToResult(result.error());
+			co_return process->fileContext()->attachFile(std::move(result.value()));
+		}else if(sqe.opcode == posix::ioRingReadv) {
+			auto iovs = co_await loadIovecs(process, sqe);
+			if(!iovs)
+				co_return iovs.error();
+
+			std::vector<char> buffer(transferSize(iovs.value()));
+			auto result = (sqe.offset >= 0)
+					? co_await file->pread(process, sqe.offset, buffer.data(), buffer.size())
+					: co_await file->readSome(process, buffer.data(), buffer.size());
+			if(!result)
+				co_return errorToResult(result.error());
+
+			// Scatter the data over the iovecs.
+			size_t progress = 0;
+			for(auto &iov : iovs.value()) {
+				if(progress == result.value())
+					break;
+				auto chunk = std::min(iov.iov_len, result.value() - progress);
+				if(!chunk)
+					continue;
+				auto store = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+						reinterpret_cast<uintptr_t>(iov.iov_base), chunk,
+						buffer.data() + progress);
+				if(store.error())
+					co_return -EFAULT;
+				progress += chunk;
+			}
+			co_return result.value();
+		}else if(sqe.opcode == posix::ioRingWritev) {
+			auto iovs = co_await loadIovecs(process, sqe);
+			if(!iovs)
+				co_return iovs.error();
+
+			// Gather the data from the iovecs.
+			std::vector<char> buffer(transferSize(iovs.value()));
+			size_t progress = 0;
+			for(auto &iov : iovs.value()) {
+				auto chunk = std::min(iov.iov_len, buffer.size() - progress);
+				if(!chunk)
+					continue;
+				auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+						reinterpret_cast<uintptr_t>(iov.iov_base), chunk,
+						buffer.data() + progress);
+				if(load.error())
+					co_return -EFAULT;
+				progress += chunk;
+			}
+
+			auto result = (sqe.offset >= 0)
+					? co_await file->pwrite(process, sqe.offset, buffer.data(), buffer.size())
+					: co_await file->writeAll(process, buffer.data(), buffer.size());
+			if(!result)
+				co_return errorToResult(result.error());
+			co_return result.value();
+		}else if(sqe.opcode == posix::ioRingSend) {
+			if(sqe.msgFlags & ~MSG_DONTWAIT)
+				co_return -EINVAL;
+
+			std::vector<char> buffer(std::min(size_t{sqe.length}, maxTransferSize));
+			if(!buffer.empty()) {
+				auto load = co_await helix_ng::readMemory(process->vmContext()->getSpace(),
+						sqe.addr, buffer.size(), buffer.data());
+				if(load.error())
+					co_return -EFAULT;
+			}
+
+			struct ucred creds{};
+			creds.pid = process->pid();
+			creds.uid = process->uid();
+			creds.gid = process->gid();
+			auto result = co_await file->sendMsg(process, sqe.msgFlags,
+					buffer.data(), buffer.size(), nullptr, 0, {}, creds);
+			if(!result)
+				co_return sendRecvErrorToResult(result.error());
+			co_return result.value();
+		}else if(sqe.opcode == posix::ioRingRecv) {
+			if(sqe.msgFlags & ~MSG_DONTWAIT)
+				co_return -EINVAL;
+
+			std::vector<char> buffer(std::min(size_t{sqe.length}, maxTransferSize));
+			auto result = co_await file->recvMsg(process, sqe.msgFlags,
+					buffer.data(), buffer.size(), nullptr, 0, 0);
+			if(auto error = std::get_if<protocols::fs::Error>(&result); error)
+				co_return sendRecvErrorToResult(*error);
+			auto length = std::get<protocols::fs::RecvData>(result).dataLength;
+
+			if(length) {
+				auto store = co_await helix_ng::writeMemory(process->vmContext()->getSpace(),
+						sqe.addr, length, buffer.data());
+				if(store.error())
+					co_return -EFAULT;
+			}
+			co_return length;
+		}
+
+		co_return -EINVAL;
+	}
+
+	helix::UniqueLane _passthrough;
+	async::cancellation_event _cancelServe;
+
+	helix::UniqueDescriptor _memory;
+	helix::Mapping _mapping;
+	size_t _size;
+	uint32_t _sqEntries;
+	uint32_t _cqEntries;
+	uint32_t _sqOffset;
+	uint32_t _cqOffset;
+
+	// Completions that did not fit into the CQ yet.
+	std::deque<posix::IoRingCqe> _overflow;
+
+	async::recurring_event _completionBell;
+	uint64_t _currentSeq = 1;
+	uint64_t _completionSeq = 0;
+};
+
+} // anonymous namespace
+
+smarter::shared_ptr<File, FileHandle> createFile(unsigned int entries) {
+	assert(entries);
+	// Round up to a power of two such that indices wrap around consistently.
+	unsigned int effective = 1;
+	while(effective < std::min(entries, maxEntries))
+		effective *= 2;
+
+	auto file = smarter::make_shared<OpenFile>(effective);
+	file->setupWeakFile(file);
+	OpenFile::serve(file);
+	return File::constructHandle(std::move(file));
+}
+
+async::result<frg::expected<Error, size_t>> enter(File *ringFile, std::shared_ptr<Process> process,
+		unsigned int toSubmit, unsigned int minComplete) {
+	auto ring = static_cast<OpenFile *>(ringFile);
+	return ring->enter(std::move(process), toSubmit, minComplete);
+}
+
+} // namespace io_ring
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "file.hpp"
+
+namespace io_ring {
+
+smarter::shared_ptr<File, FileHandle> createFile(unsigned int entries);
+
+// Starts the operations of up to toSubmit submission queue entries and waits until
+// at least minComplete completion queue entries are available.
+// Returns the number of submission queue entries that were consumed.
+async::result<frg::expected<Error, size_t>> enter(File *ringFile, std::shared_ptr<Process> process,
+		unsigned int toSubmit, unsigned int minComplete);
+
+} // namespace io_ring
@@ -1,3 +1,4 @@
+#include <format>
 #include <memory>
 
 #include <protocols/mbus/client.hpp>
@@ -43,6 +44,27 @@ std::shared_ptr<Process> findProcessWithCredentials(const char *credentials) {
 	return globalCredentialsMap.at(creds);
 }
 
+smarter::shared_ptr<File, FileHandle> findFileWithPassthroughCredentials(const char *credentials) {
+	// There is no index of passthrough lanes; this is only used to import PRIME buffers,
+	// which servers cache by credentials anyway.
+	for(auto &[threadCreds, process] : globalCredentialsMap) {
+		auto context = process->fileContext();
+		if(!context)
+			continue;
+		for(auto &[fd, desc] : context->fileTable()) {
+			auto lane = desc.file->getPassthroughLane();
+			if(lane.getHandle() == kHelNullHandle)
+				continue;
+			char laneCreds[16];
+			if(helGetCredentials(lane.getHandle(), 0, laneCreds) != kHelErrNone)
+				continue;
+			if(!memcmp(laneCreds, credentials, 16))
+				return desc.file;
+		}
+	}
+	return {};
+}
+
 async::result<void> serveSignals(std::shared_ptr<Process> self,
 		std::shared_ptr<Generation> generation) {
 	auto thread = self->threadDescriptor();
@@ -56,6 +78,12 @@ async::result<void> serveSignals(std::shared_ptr<Process> self,
 		auto result = co_await self->signalContext()->pollSignal(sequence,
 				UINT64_C(-1), cancellation);
 		sequence = std::get<0>(result);
+		if(cancellation.is_cancellation_requested())
+			break;
+
+		// Prefer letting the kernel build the signal frame; this does not stop the thread.
+		if(self->signalContext()->raiseDirect(self.get()))
+			continue;
 		//std::cout << "Calling helInterruptThread on " << self->pid() << std::endl;
 		HEL_CHECK(helInterruptThread(thread.getHandle()));
 	}
@@ -104,7 +132,7 @@ struct CmdlineNode final : public procfs::RegularNode {
 			co_await helix_ng::exchangeMsgs(
 				kerncfgLane,
 				helix_ng::offer(
-					helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+					helix_ng::sendBragiHeadOnly(req),
 					helix_ng::recvInline(),
 					helix_ng::recvInline() // What about a cmdline larger than 128 bytes?
 				)
@@ -120,9 +148,117 @@ struct CmdlineNode final : public procfs::RegularNode {
 
 		co_return std::string{(const char *)recvCmdline.data(), recvCmdline.length()} + '\n';
 	}
+};
+
+struct InterruptsNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		managarm::kerncfg::GetIrqStatisticsRequest req;
+
+		auto [offer, sendReq, recvResp] =
+			co_await helix_ng::exchangeMsgs(
+				kerncfgLane,
+				helix_ng::offer(
+					helix_ng::want_lane,
+					helix_ng::sendBragiHeadOnly(req),
+					helix_ng::recvInline()
+				)
+			);
+
+		HEL_CHECK(offer.error());
+		HEL_CHECK(sendReq.error());
+		HEL_CHECK(recvResp.error());
+
+		auto preamble = bragi::read_preamble(recvResp);
+		assert(!preamble.error());
+
+		std::vector<std::byte> tail(preamble.tail_size());
+		auto [recvTail] =
+			co_await helix_ng::exchangeMsgs(
+				offer.descriptor(),
+				helix_ng::recvBuffer(tail.data(), tail.size())
+			);
+		HEL_CHECK(recvTail.error());
 
-	async::result<void> store(std::string) override {
-		throw std::runtime_error("Cannot store to /proc/cmdline");
+		auto resp = *bragi::parse_head_tail<managarm::kerncfg::GetIrqStatisticsResponse>(
+				recvResp, tail);
+		assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+
+		// The kernel does not count IRQs per pin and CPU, hence we print the
+		// per-CPU totals in a separate line, followed by one line per pin.
+		std::string out = std::format("{:>12}", "");
+		for(size_t i = 0; i < resp.cpu_irqs().size(); i++)
+			out += std::format(" {:>10}", std::format("CPU{}", i));
+		out += "\n";
+		out += std::format("{:>12}", "ALL:");
+		for(auto count : resp.cpu_irqs())
+			out += std::format(" {:>10}", count);
+		out += "\n\n";
+
+		out += std::format("{:>12} {:>10} {:>10} {:>10} {:>10} {:>6} {:>12} {:>12}\n",
+				"PIN:", "RAISES", "MASKED", "ACKS", "NACKS", "STORMS", "AVG_ACK_NS", "MAX_ACK_NS");
+		for(auto &pin : resp.pins()) {
+			out += std::format("{:>12} {:>10} {:>10} {:>10} {:>10} {:>6} {:>12} {:>12}\n",
+					pin.name() + ":", pin.raises(), pin.masked_raises(),
+					pin.acks(), pin.nacks(), pin.storms(),
+					pin.acks() ? pin.total_ack_latency() / pin.acks() : 0,
+					pin.max_ack_latency());
+		}
+
+		co_return out;
+	}
+};
+
+// Only available if the kernel is built with lockstat.
+struct LockStatNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		managarm::kerncfg::GetLockStatisticsRequest req;
+
+		auto [offer, sendReq, recvResp] =
+			co_await helix_ng::exchangeMsgs(
+				kerncfgLane,
+				helix_ng::offer(
+					helix_ng::want_lane,
+					helix_ng::sendBragiHeadOnly(req),
+					helix_ng::recvInline()
+				)
+			);
+
+		HEL_CHECK(offer.error());
+		HEL_CHECK(sendReq.error());
+		HEL_CHECK(recvResp.error());
+
+		auto preamble = bragi::read_preamble(recvResp);
+		assert(!preamble.error());
+
+		std::vector<std::byte> tail(preamble.tail_size());
+		auto [recvTail] =
+			co_await helix_ng::exchangeMsgs(
+				offer.descriptor(),
+				helix_ng::recvBuffer(tail.data(), tail.size())
+			);
+		HEL_CHECK(recvTail.error());
+
+		auto resp = *bragi::parse_head_tail<managarm::kerncfg::GetLockStatisticsResponse>(
+				recvResp, tail);
+		if(resp.error() == managarm::kerncfg::Error::ILLEGAL_REQUEST)
+			co_return "lockstat is not enabled in the kernel\n";
+		assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+
+		// Times are in ticks of the kernel's raw timestamp counter.
+		std::string out = std::format("{:>24} {:>12} {:>12} {:>14} {:>14} {:>14} {:>14}\n",
+				"CLASS:", "ACQUIRED", "CONTENDED", "AVG_SPIN", "MAX_SPIN",
+				"AVG_HOLD", "MAX_HOLD");
+		for(auto &cls : resp.classes()) {
+			out += std::format("{:>24} {:>12} {:>12} {:>14} {:>14} {:>14} {:>14}\n",
+					cls.name() + ":", cls.acquisitions(), cls.contended_acquisitions(),
+					cls.contended_acquisitions()
+						? cls.total_spin_time() / cls.contended_acquisitions() : 0,
+					cls.max_spin_time(),
+					cls.acquisitions() ? cls.total_hold_time() / cls.acquisitions() : 0,
+					cls.max_hold_time());
+		}
+
+		co_return out;
 	}
 };
 
@@ -140,6 +276,8 @@ async::result<void> enumerateKerncfg() {
 
 	auto procfsRoot = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
 	procfsRoot->directMkregular("cmdline", std::make_shared<CmdlineNode>());
+	procfsRoot->directMkregular("interrupts", std::make_shared<InterruptsNode>());
+	procfsRoot->directMkregular("lock_stat", std::make_shared<LockStatNode>());
 }
 
 async::result<void> enumeratePm() {
@@ -173,6 +311,10 @@ int main() {
 
 //	HEL_CHECK(helSetPriority(kHelThisThread, 1));
 
+	// POSIX serves requests from all processes through a single dispatcher.
+	// Allow the queue to grow beyond the default size under load.
+	helix::Dispatcher::global().configure(128);
+
 	drvcore::initialize();
 
 	charRegistry.install(createHeloutDevice());
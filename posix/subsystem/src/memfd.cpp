@@ -54,7 +54,7 @@ void MemoryFile::_resizeFile(size_t new_size) {
 		HEL_CHECK(helResizeMemory(_memory.getHandle(), aligned_size));
 	}else{
 		HelHandle handle;
-		HEL_CHECK(helAllocateMemory(aligned_size, 0, nullptr, &handle));
+		HEL_CHECK(helAllocateMemory(aligned_size, kHelAllocSwappable, nullptr, &handle));
 		_memory = helix::UniqueDescriptor{handle};
 	}
 
@@ -43,20 +43,39 @@ OpenFile::OpenFile(int protocol, bool nonBlock)
 		_inSeq{0}, _socketPort{0}, _passCreds{false}, nonBlock_{nonBlock} { }
 
 void OpenFile::deliver(core::netlink::Packet packet) {
+	if(!_enqueue(std::move(packet)))
+		return;
+
+	_inSeq = ++_currentSeq;
+	_statusBell.raise();
+}
+
+void OpenFile::deliverBatch(const std::vector<core::netlink::Packet> &packets) {
+	bool enqueued = false;
+	for(auto &packet : packets) {
+		if(_enqueue(packet))
+			enqueued = true;
+	}
+	if(!enqueued)
+		return;
+
+	_inSeq = ++_currentSeq;
+	_statusBell.raise();
+}
+
+bool OpenFile::_enqueue(core::netlink::Packet packet) {
 	if(filter_) {
-		Bpf bpf{filter_.value()};
-		size_t accept_bytes = bpf.run(arch::dma_buffer_view{nullptr, packet.buffer.data(), packet.buffer.size()});
+		size_t accept_bytes = filter_->run(arch::dma_buffer_view{nullptr, packet.buffer.data(), packet.buffer.size()});
 
 		if(!accept_bytes)
-			return;
+			return false;
 
 		if(accept_bytes < packet.buffer.size())
 			packet.buffer.resize(accept_bytes);
 	}
 
 	_recvQueue.push_back(std::move(packet));
-	_inSeq = ++_currentSeq;
-	_statusBell.raise();
+	return true;
 }
 
 async::result<frg::expected<Error, size_t>>
@@ -176,7 +195,8 @@ OpenFile::sendMsg(Process *process, uint32_t flags, const void *data, size_t max
 		std::vector<smarter::shared_ptr<File, FileHandle>> files, struct ucred) {
 	if(logSockets)
 		std::cout << "posix: Send to socket \e[1;34m" << structName() << "\e[0m" << std::endl;
-	assert(!flags);
+	// Sending never blocks, hence we can ignore MSG_DONTWAIT.
+	assert(!(flags & ~MSG_DONTWAIT));
 	assert(files.empty());
 
 	struct sockaddr_nl sa;
@@ -305,7 +325,7 @@ async::result<frg::expected<protocols::fs::Error>> OpenFile::setSocketOption(int
 		if(!bpf.validate())
 			co_return protocols::fs::Error::illegalArguments;
 
-		filter_ = optbuf;
+		filter_ = std::move(bpf);
 	} else if(layer == SOL_NETLINK && number == NETLINK_ADD_MEMBERSHIP) {
 		auto val = *reinterpret_cast<int *>(optbuf.data());
 		std::cout << "posix: Join netlink group "
@@ -381,6 +401,23 @@ void broadcast(int proto_idx, uint32_t grp_idx, std::string buffer) {
 	group->carbonCopy(packet);
 }
 
+void broadcastBatch(int proto_idx, uint32_t grp_idx, std::vector<std::string> buffers) {
+	std::vector<core::netlink::Packet> packets;
+	packets.reserve(buffers.size());
+	for(auto &buffer : buffers) {
+		core::netlink::Packet packet{
+			.group = grp_idx,
+		};
+		packet.buffer.assign(buffer.begin(), buffer.end());
+		packets.push_back(std::move(packet));
+	}
+
+	auto it = globalGroupMap.find({proto_idx, grp_idx});
+	assert(it != globalGroupMap.end());
+	auto group = it->second.get();
+	group->carbonCopyBatch(packets);
+}
+
 bool protocol_supported(int protocol) {
 	return globalProtocolOpsMap.contains(protocol);
 }
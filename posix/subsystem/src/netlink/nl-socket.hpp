@@ -1,6 +1,7 @@
 #pragma once
 
 #include <async/recurring-event.hpp>
+#include <core/bpf.hpp>
 #include <linux/netlink.h>
 #include <map>
 
@@ -35,6 +36,7 @@ public:
 	OpenFile(int protocol, bool nonBlock = false);
 
 	void deliver(core::netlink::Packet packet) override;
+	void deliverBatch(const std::vector<core::netlink::Packet> &packets) override;
 
 	void handleClose() override {
 		_isClosed = true;
@@ -96,6 +98,10 @@ public:
 private:
 	void _associatePort();
 
+	// Applies the BPF filter and appends the packet to the receive queue.
+	// Returns false if the filter dropped the packet.
+	bool _enqueue(core::netlink::Packet packet);
+
 	int _protocol;
 	const ops *ops_;
 	helix::UniqueLane _passthrough;
@@ -117,7 +123,7 @@ private:
 	bool nonBlock_;
 
 	// BPF filter
-	std::optional<std::vector<char>> filter_ = std::nullopt;
+	std::optional<Bpf> filter_ = std::nullopt;
 };
 
 // Configures the given netlink protocol.
@@ -127,6 +133,9 @@ void configure(int proto_idx, size_t num_groups, const ops *ops);
 // Broadcasts a kernel message to the given netlink multicast group.
 void broadcast(int proto_idx, uint32_t grp_idx, std::string buffer);
 
+// Broadcasts multiple kernel messages at once; subscribers are only woken up once.
+void broadcastBatch(int proto_idx, uint32_t grp_idx, std::vector<std::string> buffers);
+
 bool protocol_supported(int protocol);
 
 smarter::shared_ptr<File, FileHandle> createSocketFile(int proto_idx, bool nonBlock);
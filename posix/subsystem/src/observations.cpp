@@ -118,6 +118,10 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 		HEL_CHECK(observe.error());
 		sequence = observe.sequence();
 
+		// The thread is stopped now. Take back signals that the kernel did not
+		// deliver yet, such that the code below sees a consistent signal state.
+		self->signalContext()->reclaimDirect(self.get());
+
 		if(observe.observation() == kHelObserveSuperCall + posix::superAnonAllocate) {
 			uintptr_t gprs[kHelNumGprs];
 			HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsGeneral, &gprs));
@@ -147,7 +151,8 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 				self->fileContext()->clientMbusLane(),
 				self->clientThreadPage(),
 				static_cast<HelHandle *>(self->clientFileTable()),
-				self->clientClkTrackerPage()
+				self->clientClkTrackerPage(),
+				self->clientClockPage()
 			};
 
 			if(logRequests)
@@ -185,6 +190,32 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 
 			HEL_CHECK(helResume(thread.getHandle()));
 			HEL_CHECK(helResume(new_thread));
+		}else if(observe.observation() == kHelObserveSuperCall + posix::superVfork) {
+			if(logRequests)
+				std::cout << "posix: vfork supercall" << std::endl;
+			auto child = Process::vfork(self);
+
+			// Copy registers from the current thread to the new one.
+			auto new_thread = child->threadDescriptor().getHandle();
+			uintptr_t pcrs[2], gprs[kHelNumGprs], thrs[2];
+			HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsProgram, &pcrs));
+			HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsGeneral, &gprs));
+			HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsThread, &thrs));
+
+			HEL_CHECK(helStoreRegisters(new_thread, kHelRegsProgram, &pcrs));
+			HEL_CHECK(helStoreRegisters(new_thread, kHelRegsThread, &thrs));
+
+			gprs[kHelRegError] = kHelErrNone;
+			gprs[kHelRegOut0] = child->pid();
+			HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsGeneral, &gprs));
+
+			gprs[kHelRegOut0] = 0;
+			HEL_CHECK(helStoreRegisters(new_thread, kHelRegsGeneral, &gprs));
+
+			// The child runs on our stack; only resume once it has left our address space.
+			HEL_CHECK(helResume(new_thread));
+			co_await child->waitForVfork();
+			HEL_CHECK(helResume(thread.getHandle()));
 		}else if(observe.observation() == kHelObserveSuperCall + posix::superClone) {
 			if(logRequests)
 				std::cout << "posix: clone supercall" << std::endl;
@@ -212,21 +243,19 @@ async::result<void> observeThread(std::shared_ptr<Process> self,
 
 			std::string path;
 			path.resize(gprs[kHelRegArg1]);
-			auto loadPath = co_await helix_ng::readMemory(self->vmContext()->getSpace(),
-					gprs[kHelRegArg0], gprs[kHelRegArg1], path.data());
-			HEL_CHECK(loadPath.error());
-
 			std::string args_area;
 			args_area.resize(gprs[kHelRegArg3]);
-			auto loadArgs = co_await helix_ng::readMemory(self->vmContext()->getSpace(),
-					gprs[kHelRegArg2], gprs[kHelRegArg3], args_area.data());
-			HEL_CHECK(loadArgs.error());
-
 			std::string env_area;
 			env_area.resize(gprs[kHelRegArg5]);
-			auto loadEnv = co_await helix_ng::readMemory(self->vmContext()->getSpace(),
-					gprs[kHelRegArg4], gprs[kHelRegArg5], env_area.data());
-			HEL_CHECK(loadEnv.error());
+
+			HelMemoryVector loadVectors[] = {
+				{gprs[kHelRegArg0], gprs[kHelRegArg1], path.data()},
+				{gprs[kHelRegArg2], gprs[kHelRegArg3], args_area.data()},
+				{gprs[kHelRegArg4], gprs[kHelRegArg5], env_area.data()}
+			};
+			auto load = co_await helix_ng::readMemoryVector(self->vmContext()->getSpace(),
+					loadVectors, 3);
+			HEL_CHECK(load.error());
 
 			if(logRequests || logPaths)
 				std::cout << "posix: execve path: " << path << std::endl;
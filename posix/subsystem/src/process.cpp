@@ -21,6 +21,11 @@ async::result<void> serve(std::shared_ptr<Process> self, std::shared_ptr<Generat
 // VmContext.
 // ----------------------------------------------------------------------------
 
+uint64_t freshGeneration() {
+	static uint64_t counter = 0;
+	return ++counter;
+}
+
 std::shared_ptr<VmContext> VmContext::create() {
 	auto context = std::make_shared<VmContext>();
 
@@ -38,27 +43,60 @@ std::shared_ptr<VmContext> VmContext::clone(std::shared_ptr<VmContext> original)
 	HEL_CHECK(helCreateSpace(&space));
 	context->_space = helix::UniqueDescriptor(space);
 
+	// Fork and map all areas in a single system call.
+	std::vector<HelForkArea> forkAreas;
+	std::vector<helix::UniqueDescriptor> hugeCopies;
+	forkAreas.reserve(original->_areaTree.size());
+	hugeCopies.resize(original->_areaTree.size());
+	for(const auto &entry : original->_areaTree) {
+		const auto &[address, area] = entry;
+
+		HelForkArea forkArea{};
+		forkArea.address = address;
+		forkArea.size = area.areaSize;
+		forkArea.mapFlags = area.nativeFlags;
+		if(area.hugePages) {
+			// Copy the memory now; this also populates the pages that were not touched yet.
+			HelHandle handle;
+			HEL_CHECK(helAllocateMemory(area.areaSize, kHelAllocHugePages, nullptr, &handle));
+			helix::UniqueDescriptor hugeCopy{handle};
+			{
+				helix::Mapping source{area.copyView, area.offset, area.areaSize,
+						kHelMapProtRead};
+				helix::Mapping dest{hugeCopy, 0, area.areaSize};
+				memcpy(dest.get(), source.get(), area.areaSize);
+			}
+
+			forkArea.memory = hugeCopy.getHandle();
+			hugeCopies[forkAreas.size()] = std::move(hugeCopy);
+		}else if(area.copyOnWrite) {
+			forkArea.memory = area.copyView.getHandle();
+			forkArea.forkFlags = kHelForkAreaCopyOnWrite;
+		}else{
+			forkArea.memory = area.fileView.getHandle();
+			forkArea.offset = area.offset;
+		}
+		forkAreas.push_back(forkArea);
+	}
+	HEL_CHECK(helForkSpace(context->_space.getHandle(), forkAreas.data(), forkAreas.size()));
+
+	size_t i = 0;
 	for(const auto &entry : original->_areaTree) {
 		const auto &[address, area] = entry;
+		const auto &forkArea = forkAreas[i++];
 
 		helix::UniqueDescriptor copyView;
-		if(area.copyOnWrite) {
-			HelHandle copyHandle;
-			HEL_CHECK(helForkMemory(area.copyView.getHandle(), &copyHandle));
-			copyView = helix::UniqueDescriptor{copyHandle};
-
-			void *pointer;
-			HelError error = helMapMemory(copyView.getHandle(), context->_space.getHandle(),
-					reinterpret_cast<void *>(address),
-					0, area.areaSize, area.nativeFlags, &pointer);
-			if(error != kHelErrNone && error != kHelErrAlreadyExists) {
-				HEL_CHECK(error);
+		if(area.hugePages) {
+			HEL_CHECK(forkArea.error);
+			copyView = std::move(hugeCopies[i - 1]);
+		}else if(area.copyOnWrite) {
+			if(forkArea.forkedMemory != kHelNullHandle)
+				copyView = helix::UniqueDescriptor{forkArea.forkedMemory};
+			if(forkArea.error != kHelErrNone && forkArea.error != kHelErrAlreadyExists) {
+				HEL_CHECK(forkArea.error);
 			}
 		}else{
-			void *pointer;
-			HEL_CHECK(helMapMemory(area.fileView.getHandle(), context->_space.getHandle(),
-					reinterpret_cast<void *>(address),
-					area.offset, area.areaSize, area.nativeFlags, &pointer));
+			HEL_CHECK(forkArea.error);
 		}
 
 		Area copy;
@@ -68,7 +106,8 @@ std::shared_ptr<VmContext> VmContext::clone(std::shared_ptr<VmContext> original)
 		copy.fileView = area.fileView.dup();
 		copy.copyView = std::move(copyView);
 		copy.file = area.file;
-		copy.offset = area.offset;
+		copy.offset = area.hugePages ? 0 : area.offset;
+		copy.hugePages = area.hugePages;
 		context->_areaTree.emplace(address, std::move(copy));
 	}
 
@@ -105,6 +144,7 @@ auto VmContext::splitAreaOn_(uintptr_t addr, size_t size) ->
 			right.copyView = area.copyView.dup();
 			right.file = area.file;
 			right.offset = area.offset + (addr - base);
+			right.hugePages = area.hugePages;
 
 			_areaTree.emplace(addr, std::move(right));
 
@@ -126,6 +166,10 @@ VmContext::mapFile(uintptr_t hint, helix::UniqueDescriptor memory,
 		intptr_t offset, size_t size, bool copyOnWrite, uint32_t nativeFlags) {
 	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
 
+	bool hugePages = copyOnWrite && !memory && (nativeFlags & kHelMapPreferHugePages);
+	if(hugePages)
+		alignedSize = (size + hugePageSize - 1) & ~(hugePageSize - 1);
+
 	// Perform the actual mapping.
 	// POSIX specifies that non-page-size mappings are rounded up and filled with zeros.
 	helix::UniqueDescriptor copyView;
@@ -135,6 +179,8 @@ VmContext::mapFile(uintptr_t hint, helix::UniqueDescriptor memory,
 		HelHandle handle;
 		if(memory) {
 			HEL_CHECK(helCopyOnWrite(memory.getHandle(), offset, alignedSize, &handle));
+		}else if(hugePages) {
+			HEL_CHECK(helAllocateMemory(alignedSize, kHelAllocHugePages, nullptr, &handle));
 		}else{
 			HEL_CHECK(helCopyOnWrite(kHelZeroMemory, offset, alignedSize, &handle));
 		}
@@ -179,7 +225,9 @@ VmContext::mapFile(uintptr_t hint, helix::UniqueDescriptor memory,
 	area.copyView = std::move(copyView);
 	area.file = std::move(file);
 	area.offset = offset;
+	area.hugePages = hugePages;
 	_areaTree.emplace(address, std::move(area));
+	_generation = freshGeneration();
 
 	co_return pointer;
 }
@@ -229,6 +277,7 @@ async::result<void *> VmContext::remapFile(void *oldPointer,
 	}
 
 	_areaTree.insert({address, std::move(area)});
+	_generation = freshGeneration();
 
 	co_return pointer;
 }
@@ -252,6 +301,35 @@ async::result<void> VmContext::protectFile(void *pointer, size_t size, uint32_t
 			area.nativeFlags |= protectionFlags;
 		}
 	}
+	_generation = freshGeneration();
+}
+
+void VmContext::adviseMemory(void *pointer, size_t size, int advice) {
+	size_t alignedSize = (size + 0xFFF) & ~size_t(0xFFF);
+	auto address = reinterpret_cast<uintptr_t>(pointer);
+
+	auto it = _areaTree.upper_bound(address);
+	if(it != _areaTree.begin())
+		it = std::prev(it);
+
+	for(; it != _areaTree.end() && it->first < address + alignedSize; ++it) {
+		auto &[addr, area] = *it;
+		auto begin = std::max(addr, address);
+		auto end = std::min(addr + area.areaSize, address + alignedSize);
+		if(begin >= end)
+			continue;
+
+		// For anonymous areas, the offset of the area is also its offset into copyView
+		// (see splitAreaOn_()). Huge page memory is never merged.
+		if(!area.copyOnWrite || area.fileView || area.hugePages || !area.copyView)
+			continue;
+
+		auto error = helAdviseMemory(area.copyView.getHandle(),
+				area.offset + (begin - addr), end - begin, advice);
+		if(error == kHelErrUnsupportedOperation)
+			continue;
+		HEL_CHECK(error);
+	}
 }
 
 void VmContext::unmapFile(void *pointer, size_t size) {
@@ -270,6 +348,7 @@ void VmContext::unmapFile(void *pointer, size_t size) {
 			++it;
 		}
 	}
+	_generation = freshGeneration();
 }
 
 // ----------------------------------------------------------------------------
@@ -331,9 +410,9 @@ std::shared_ptr<FileContext> FileContext::create() {
 
 	HelHandle memory;
 	void *window;
-	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &memory));
+	HEL_CHECK(helAllocateMemory(fileTableSize, 0, nullptr, &memory));
 	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
-			0, 0x1000, kHelMapProtRead | kHelMapProtWrite, &window));
+			0, fileTableSize, kHelMapProtRead | kHelMapProtWrite, &window));
 	context->_fileTableMemory = helix::UniqueDescriptor(memory);
 	context->_fileTableWindow = reinterpret_cast<HelHandle *>(window);
 
@@ -352,15 +431,22 @@ std::shared_ptr<FileContext> FileContext::clone(std::shared_ptr<FileContext> ori
 
 	HelHandle memory;
 	void *window;
-	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &memory));
+	HEL_CHECK(helAllocateMemory(fileTableSize, 0, nullptr, &memory));
 	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
-			0, 0x1000, kHelMapProtRead | kHelMapProtWrite, &window));
+			0, fileTableSize, kHelMapProtRead | kHelMapProtWrite, &window));
 	context->_fileTableMemory = helix::UniqueDescriptor(memory);
 	context->_fileTableWindow = reinterpret_cast<HelHandle *>(window);
 
-	for(auto entry : original->_fileTable) {
-		//std::cout << "Clone FD " << entry.first << std::endl;
-		context->attachFile(entry.first, entry.second.file, entry.second.closeOnExec);
+	// Copy the table and the bitmaps as a whole; only the handles need to be transferred.
+	context->_fileTable = original->_fileTable;
+	context->_usedMap = original->_usedMap;
+	context->_fullMap = original->_fullMap;
+	for(size_t fd = 0; fd < context->_fileTable.size(); fd++) {
+		auto &file = context->_fileTable[fd].file;
+		if(!file)
+			continue;
+		HEL_CHECK(helTransferDescriptor(file->getPassthroughLane().getHandle(),
+				context->_universe.getHandle(), &context->_fileTableWindow[fd]));
 	}
 
 	HEL_CHECK(helTransferDescriptor(posixMbusClient,
@@ -374,27 +460,62 @@ FileContext::~FileContext() {
 		std::cout << "\e[33mposix: FileContext is destructed\e[39m" << std::endl;
 }
 
+void FileContext::_markUsed(int fd) {
+	size_t word = fd / 64;
+	if(word >= _usedMap.size())
+		_usedMap.resize(word + 1);
+	_usedMap[word] |= uint64_t(1) << (fd % 64);
+	if(_usedMap[word] == ~uint64_t(0))
+		_fullMap[word / 64] |= uint64_t(1) << (word % 64);
+}
+
+void FileContext::_markFree(int fd) {
+	size_t word = fd / 64;
+	assert(word < _usedMap.size());
+	_usedMap[word] &= ~(uint64_t(1) << (fd % 64));
+	_fullMap[word / 64] &= ~(uint64_t(1) << (word % 64));
+}
+
+int FileContext::_findFreeFd() {
+	for(size_t v = 0; v < _fullMap.size(); v++) {
+		if(_fullMap[v] == ~uint64_t(0))
+			continue;
+		size_t word = v * 64 + __builtin_ctzll(~_fullMap[v]);
+		// Words beyond the end of _usedMap are completely free.
+		int fd = word * 64;
+		if(word < _usedMap.size())
+			fd += __builtin_ctzll(~_usedMap[word]);
+		if(fd >= maxFileDescriptors)
+			return -1;
+		return fd;
+	}
+	return -1;
+}
+
 int FileContext::attachFile(smarter::shared_ptr<File, FileHandle> file,
 		bool close_on_exec) {
+	int fd = _findFreeFd();
+	if(fd < 0)
+		return -1;
+
 	HelHandle handle;
 	HEL_CHECK(helTransferDescriptor(file->getPassthroughLane().getHandle(),
 			_universe.getHandle(), &handle));
 
-	for(int fd = 0; ; fd++) {
-		if(_fileTable.find(fd) != _fileTable.end())
-			continue;
-
-		if(logFileAttach)
-			std::cout << "posix: Attaching FD " << fd << std::endl;
+	if(logFileAttach)
+		std::cout << "posix: Attaching FD " << fd << std::endl;
 
-		_fileTable.insert({fd, {std::move(file), close_on_exec}});
-		_fileTableWindow[fd] = handle;
-		return fd;
-	}
+	if(static_cast<size_t>(fd) >= _fileTable.size())
+		_fileTable.resize(fd + 1);
+	_fileTable[fd] = {std::move(file), close_on_exec};
+	_markUsed(fd);
+	_fileTableWindow[fd] = handle;
+	return fd;
 }
 
 void FileContext::attachFile(int fd, smarter::shared_ptr<File, FileHandle> file,
 		bool close_on_exec) {
+	assert(fd >= 0 && fd < maxFileDescriptors);
 	HelHandle handle;
 	HEL_CHECK(helTransferDescriptor(file->getPassthroughLane().getHandle(),
 			_universe.getHandle(), &handle));
@@ -402,65 +523,65 @@ void FileContext::attachFile(int fd, smarter::shared_ptr<File, FileHandle> file,
 	if(logFileAttach)
 		std::cout << "posix: Attaching fixed FD " << fd << std::endl;
 
-	auto it = _fileTable.find(fd);
-	if(it != _fileTable.end()) {
-		it->second = {std::move(file), close_on_exec};
-	}else{
-		_fileTable.insert({fd, {std::move(file), close_on_exec}});
-	}
+	if(static_cast<size_t>(fd) >= _fileTable.size())
+		_fileTable.resize(fd + 1);
+	_fileTable[fd] = {std::move(file), close_on_exec};
+	_markUsed(fd);
 	_fileTableWindow[fd] = handle;
 }
 
 std::optional<FileDescriptor> FileContext::getDescriptor(int fd) {
-	auto file = _fileTable.find(fd);
-	if(file == _fileTable.end())
+	if(fd < 0 || static_cast<size_t>(fd) >= _fileTable.size() || !_fileTable[fd].file)
 		return std::nullopt;
-	return file->second;
+	return _fileTable[fd];
 }
 
 Error FileContext::setDescriptor(int fd, bool close_on_exec) {
-	auto it = _fileTable.find(fd);
-	if(it == _fileTable.end()) {
+	if(fd < 0 || static_cast<size_t>(fd) >= _fileTable.size() || !_fileTable[fd].file)
 		return Error::noSuchFile;
-	}
-	it->second.closeOnExec = close_on_exec;
+	_fileTable[fd].closeOnExec = close_on_exec;
 	return Error::success;
 }
 
 smarter::shared_ptr<File, FileHandle> FileContext::getFile(int fd) {
-	auto file = _fileTable.find(fd);
-	if(file == _fileTable.end())
+	if(fd < 0 || static_cast<size_t>(fd) >= _fileTable.size())
 		return smarter::shared_ptr<File, FileHandle>{};
-	return file->second.file;
+	return _fileTable[fd].file;
 }
 
 Error FileContext::closeFile(int fd) {
 	if(logFileAttach)
 		std::cout << "posix: Closing FD " << fd << std::endl;
-	auto it = _fileTable.find(fd);
-	if(it == _fileTable.end()) {
+	if(fd < 0 || static_cast<size_t>(fd) >= _fileTable.size() || !_fileTable[fd].file)
 		return Error::noSuchFile;
-	}
 
 	HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[fd]));
 
 	_fileTableWindow[fd] = 0;
-	_fileTable.erase(it);
+	_fileTable[fd] = {};
+	_markFree(fd);
 	return Error::success;
 }
 
 void FileContext::closeOnExec() {
-	auto it = _fileTable.begin();
-	while(it != _fileTable.end()) {
-		if(it->second.closeOnExec) {
-			HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[it->first]));
+	for(size_t fd = 0; fd < _fileTable.size(); fd++) {
+		if(!_fileTable[fd].file || !_fileTable[fd].closeOnExec)
+			continue;
+		HEL_CHECK(helCloseDescriptor(_universe.getHandle(), _fileTableWindow[fd]));
 
-			_fileTableWindow[it->first] = 0;
-			it = _fileTable.erase(it);
-		}else{
-			it++;
-		}
+		_fileTableWindow[fd] = 0;
+		_fileTable[fd] = {};
+		_markFree(fd);
+	}
+}
+
+std::unordered_map<int, FileDescriptor> FileContext::fileTable() {
+	std::unordered_map<int, FileDescriptor> snapshot;
+	for(size_t fd = 0; fd < _fileTable.size(); fd++) {
+		if(_fileTable[fd].file)
+			snapshot.insert({static_cast<int>(fd), _fileTable[fd]});
 	}
+	return snapshot;
 }
 
 // ----------------------------------------------------------------------------
@@ -559,26 +680,34 @@ CheckSignalResult SignalContext::checkSignal() {
 async::result<SignalItem *> SignalContext::fetchSignal(uint64_t mask, bool nonBlock) {
 	int sn;
 	while(true) {
-		for(sn = 1; sn <= 64; sn++) {
-			if(!(mask & (UINT64_C(1) << (sn - 1))))
-				continue;
-			if(!_slots[sn - 1].asyncQueue.empty())
-				break;
-		}
-		if(sn - 1 != 64)
+		sn = _findPending(mask);
+		if(sn)
 			break;
 		if(nonBlock)
 			co_return nullptr;
 		co_await _signalBell.async_wait();
 	}
 
+	co_return _popPending(sn);
+}
+
+int SignalContext::_findPending(uint64_t mask) {
+	for(int sn = 1; sn <= 64; sn++) {
+		if(!(mask & (UINT64_C(1) << (sn - 1))))
+			continue;
+		if(!_slots[sn - 1].asyncQueue.empty())
+			return sn;
+	}
+	return 0;
+}
+
+SignalItem *SignalContext::_popPending(int sn) {
 	assert(!_slots[sn - 1].asyncQueue.empty());
 	auto item = &_slots[sn - 1].asyncQueue.front();
 	_slots[sn - 1].asyncQueue.pop_front();
 	if(_slots[sn - 1].asyncQueue.empty())
 		_activeSet &= ~(UINT64_C(1) << (sn - 1));
-
-	co_return item;
+	return item;
 }
 
 // We follow a similar model as Linux. The linux layout is a follows:
@@ -723,12 +852,12 @@ async::result<void> SignalContext::raiseContext(SignalItem *item, Process *proce
 #endif
 	// TODO: aarch64
 
-	auto storeFrame = co_await helix_ng::writeMemory(thread, frame,
-			sizeof(SignalFrame), &sf);
-	auto storeSimd = co_await helix_ng::writeMemory(thread, frame + sizeof(SignalFrame),
-			simdStateSize, simdState.data());
-	HEL_CHECK(storeFrame.error());
-	HEL_CHECK(storeSimd.error());
+	HelMemoryVector storeVectors[] = {
+		{frame, sizeof(SignalFrame), &sf},
+		{frame + sizeof(SignalFrame), simdStateSize, simdState.data()}
+	};
+	auto store = co_await helix_ng::writeMemoryVector(thread, storeVectors, 2);
+	HEL_CHECK(store.error());
 
 	if(logSignals) {
 		std::cout << "posix: Saving pre-signal stack to " << (void *)frame << std::endl;
@@ -764,6 +893,96 @@ async::result<void> SignalContext::raiseContext(SignalItem *item, Process *proce
 	delete item;
 }
 
+bool SignalContext::raiseDirect(Process *process) {
+	static bool directUnsupported = false;
+	if(directUnsupported)
+		return false;
+
+	// The kernel only holds a single delivery per thread.
+	reclaimDirect(process);
+
+	auto sn = _findPending(~process->signalMask());
+	if(!sn)
+		return false;
+
+	// Default dispositions and SA_RESETHAND are handled by raiseContext();
+	// the latter because the handler must not be reset again if we reclaim the signal.
+	SignalHandler handler = _handlers[sn - 1];
+	if(handler.disposition != SignalDisposition::handle || (handler.flags & signalOnce))
+		return false;
+
+	auto item = _popPending(sn);
+
+	SignalFrame sf;
+	memset(&sf, 0, sizeof(SignalFrame));
+#if defined(__x86_64__)
+	sf.returnAddress = handler.restorerIp;
+#endif
+	memcpy(&sf.ucontext.uc_sigmask, &handler.mask, sizeof(handler.mask));
+	if(handler.flags & signalInfo) {
+		sf.info.si_signo = item->signalNumber;
+		std::visit(CompileSignalInfo{&sf.info}, item->info);
+	}
+
+	HelSignalDelivery delivery{};
+	delivery.ip = handler.handlerIp;
+	if(handler.flags & signalOnStack && process->isAltStackEnabled()) {
+		delivery.altStackBase = process->altStackSp();
+		delivery.altStackSize = process->altStackSize();
+	}
+	delivery.redZone = redZoneSize;
+	// The global signal flag is the first word of the thread page (see checkSignalRaise()).
+	delivery.flagAddress = reinterpret_cast<uintptr_t>(process->clientThreadPage());
+	delivery.payload = &sf;
+	delivery.payloadSize = sizeof(SignalFrame);
+#if defined(__x86_64__)
+	delivery.registersOffset = offsetof(SignalFrame, ucontext.uc_mcontext.gregs);
+	delivery.simdPointerOffset = offsetof(SignalFrame, ucontext.uc_mcontext.fpregs);
+#endif
+	delivery.argument = item->signalNumber;
+	delivery.argumentOffsets[0] = offsetof(SignalFrame, info);
+	delivery.argumentOffsets[1] = offsetof(SignalFrame, ucontext);
+
+	auto error = helQueueSignal(process->threadDescriptor().getHandle(), &delivery);
+	if(error) {
+		if(error == kHelErrNoHardwareSupport)
+			directUnsupported = true;
+		else
+			HEL_CHECK(error);
+		_slots[sn - 1].asyncQueue.push_front(*item);
+		_activeSet |= UINT64_C(1) << (sn - 1);
+		return false;
+	}
+
+	if(logSignals)
+		std::cout << "posix: Queued signal " << sn << " for direct delivery to handler at "
+				<< (void *)handler.handlerIp << std::endl;
+	process->exchangeDirectSignal(item);
+	return true;
+}
+
+void SignalContext::reclaimDirect(Process *process) {
+	auto item = process->exchangeDirectSignal(nullptr);
+	if(!item)
+		return;
+
+	int dequeued;
+	HEL_CHECK(helDequeueSignal(process->threadDescriptor().getHandle(), &dequeued));
+	if(!dequeued) {
+		// The kernel already built the frame.
+		process->enterSignal();
+		delete item;
+		return;
+	}
+
+	// Re-queue the signal in front to retain the order of signals.
+	auto sn = item->signalNumber;
+	_slots[sn - 1].raiseSeq = ++_currentSeq;
+	_slots[sn - 1].asyncQueue.push_front(*item);
+	_activeSet |= UINT64_C(1) << (sn - 1);
+	_signalBell.raise();
+}
+
 async::result<void> SignalContext::restoreContext(helix::BorrowedDescriptor thread) {
 	uintptr_t pcrs[2];
 	HEL_CHECK(helLoadRegisters(thread.getHandle(), kHelRegsProgram, &pcrs));
@@ -775,12 +994,12 @@ async::result<void> SignalContext::restoreContext(helix::BorrowedDescriptor thre
 	std::vector<std::byte> simdState(simdStateSize);
 
 	SignalFrame sf;
-	auto loadFrame = co_await helix_ng::readMemory(thread, frame,
-			sizeof(SignalFrame), &sf);
-	auto loadSimd = co_await helix_ng::readMemory(thread, frame + sizeof(SignalFrame),
-			simdStateSize, simdState.data());
-	HEL_CHECK(loadFrame.error());
-	HEL_CHECK(loadSimd.error());
+	HelMemoryVector loadVectors[] = {
+		{frame, sizeof(SignalFrame), &sf},
+		{frame + sizeof(SignalFrame), simdStateSize, simdState.data()}
+	};
+	auto load = co_await helix_ng::readMemoryVector(thread, loadVectors, 2);
+	HEL_CHECK(load.error());
 
 #if defined(__x86_64__)
 	HEL_CHECK(helStoreRegisters(thread.getHandle(), kHelRegsSignal, &sf.ucontext.uc_mcontext.gregs));
@@ -856,6 +1075,16 @@ std::shared_ptr<Process> Process::findProcess(ProcessId pid) {
 	return it->second->getProcess();
 }
 
+std::vector<std::shared_ptr<Process>> Process::listProcesses() {
+	std::vector<std::shared_ptr<Process>> processes;
+	for(auto &[pid, hull] : globalPidMap) {
+		auto process = hull->getProcess();
+		if(process)
+			processes.push_back(std::move(process));
+	}
+	return processes;
+}
+
 Process::Process(std::shared_ptr<PidHull> hull, Process *parent)
 : _parent{parent}, _hull{std::move(hull)},
 		_clientPosixLane{kHelNullHandle}, _clientFileTable{nullptr},
@@ -866,6 +1095,39 @@ Process::~Process() {
 	_pgPointer->dropProcess(this);
 }
 
+void Process::readRandom(void *data, size_t length) {
+	auto p = reinterpret_cast<char *>(data);
+
+	auto fill = [] (char *dest, size_t size) {
+		size_t n = 0;
+		while(n < size) {
+			size_t chunk;
+			HEL_CHECK(helGetRandomBytes(dest + n, size - n, &chunk));
+			n += chunk;
+		}
+	};
+
+	// Large reads would only drain the buffer; serve them directly.
+	if(length > 256) {
+		fill(p, length);
+		return;
+	}
+
+	if(!_randomBuffer)
+		_randomBuffer = std::make_unique<std::array<char, 4096>>();
+
+	if(_randomAvailable < length) {
+		fill(_randomBuffer->data(), _randomBuffer->size());
+		_randomAvailable = _randomBuffer->size();
+	}
+
+	// Erase handed out bytes such that they cannot be returned twice.
+	auto src = _randomBuffer->data() + _randomAvailable - length;
+	memcpy(p, src, length);
+	memset(src, 0, length);
+	_randomAvailable -= length;
+}
+
 bool Process::checkSignalRaise() {
 	auto p = reinterpret_cast<unsigned int *>(accessThreadPage());
 	unsigned int gsf = __atomic_load_n(p, __ATOMIC_RELAXED);
@@ -921,12 +1183,16 @@ async::result<std::shared_ptr<Process>> Process::init(std::string path) {
 			&process->_clientThreadPage));
 	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
-			nullptr, 0, 0x1000, kHelMapProtRead,
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
 			&process->_clientFileTable));
 	HEL_CHECK(helMapMemory(clk::trackerPageMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
 			&process->_clientClkTrackerPage));
+	HEL_CHECK(helMapMemory(clk::clockPageMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientClockPage));
 
 	process->_uid = 0;
 	process->_euid = 0;
@@ -993,12 +1259,16 @@ std::shared_ptr<Process> Process::fork(std::shared_ptr<Process> original) {
 			&process->_clientThreadPage));
 	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
-			nullptr, 0, 0x1000, kHelMapProtRead,
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
 			&process->_clientFileTable));
 	HEL_CHECK(helMapMemory(clk::trackerPageMemory().getHandle(),
 			process->_vmContext->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
 			&process->_clientClkTrackerPage));
+	HEL_CHECK(helMapMemory(clk::clockPageMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientClockPage));
 
 	process->_clientAuxBegin = original->_clientAuxBegin;
 	process->_clientAuxEnd = original->_clientAuxEnd;
@@ -1060,6 +1330,7 @@ std::shared_ptr<Process> Process::clone(std::shared_ptr<Process> original, void
 
 	process->_clientFileTable = original->_clientFileTable;
 	process->_clientClkTrackerPage = original->_clientClkTrackerPage;
+	process->_clientClockPage = original->_clientClockPage;
 
 	process->_clientAuxBegin = original->_clientAuxBegin;
 	process->_clientAuxEnd = original->_clientAuxEnd;
@@ -1088,6 +1359,167 @@ std::shared_ptr<Process> Process::clone(std::shared_ptr<Process> original, void
 	return process;
 }
 
+std::shared_ptr<Process> Process::vfork(std::shared_ptr<Process> original) {
+	auto hull = std::make_shared<PidHull>(nextPid++);
+	auto process = std::make_shared<Process>(std::move(hull), original.get());
+	process->_path = original->path();
+	process->_name = original->name();
+	process->_vmContext = original->_vmContext;
+	process->_fsContext = FsContext::clone(original->_fsContext);
+	process->_fileContext = FileContext::clone(original->_fileContext);
+	process->_signalContext = SignalContext::clone(original->_signalContext);
+	process->_inVfork = true;
+
+	original->_pgPointer->reassociateProcess(process.get());
+
+	HelHandle thread_memory;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &thread_memory));
+	process->_threadPageMemory = helix::UniqueDescriptor{thread_memory};
+	process->_threadPageMapping = helix::Mapping{process->_threadPageMemory, 0, 0x1000};
+
+	// Signal masks are copied on vfork().
+	process->_signalMask = original->_signalMask;
+
+	auto [server_lane, client_lane] = helix::createStream();
+	HEL_CHECK(helTransferDescriptor(client_lane.getHandle(),
+			process->_fileContext->getUniverse().getHandle(), &process->_clientPosixLane));
+	client_lane.release();
+
+	// These mappings live in the parent's address space; _finishVfork() removes them again.
+	HEL_CHECK(helMapMemory(process->_threadPageMemory.getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead | kHelMapProtWrite,
+			&process->_clientThreadPage));
+	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
+			&process->_clientFileTable));
+	process->_clientClkTrackerPage = original->_clientClkTrackerPage;
+	process->_clientClockPage = original->_clientClockPage;
+
+	process->_clientAuxBegin = original->_clientAuxBegin;
+	process->_clientAuxEnd = original->_clientAuxEnd;
+	process->_uid = original->_uid;
+	process->_euid = original->_euid;
+	process->_gid = original->_gid;
+	process->_egid = original->_egid;
+	original->_children.push_back(process);
+	process->_hull->initializeProcess(process.get());
+	process->_didExecute = false;
+
+	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
+	process->_procfs_dir = procfs_root->createProcDirectory(std::to_string(process->_hull->getPid()), process.get());
+
+	HelHandle new_thread;
+	HEL_CHECK(helCreateThread(process->fileContext()->getUniverse().getHandle(),
+			process->vmContext()->getSpace().getHandle(), kHelAbiSystemV,
+			nullptr, nullptr, kHelThreadStopped, &new_thread));
+	process->_threadDescriptor = helix::UniqueDescriptor{new_thread};
+	process->_posixLane = std::move(server_lane);
+
+	auto generation = std::make_shared<Generation>();
+	process->_currentGeneration = generation;
+	async::detach(serve(process, std::move(generation)));
+
+	return process;
+}
+
+async::result<frg::expected<Error, std::shared_ptr<Process>>>
+Process::spawn(std::shared_ptr<Process> original, std::shared_ptr<FileContext> fileContext,
+		std::string path, std::vector<std::string> args, std::vector<std::string> env) {
+	auto fsContext = FsContext::clone(original->_fsContext);
+	auto vmContext = VmContext::create();
+
+	// Execute the program before creating the process such that errors
+	// can be reported to the caller. Note that this never copies the caller's memory.
+	auto execResult = FRG_CO_TRY(co_await execute(fsContext->getRoot(),
+			fsContext->getWorkingDirectory(),
+			path, std::move(args), std::move(env), vmContext,
+			fileContext->getUniverse(),
+			fileContext->clientMbusLane(), original.get()));
+
+	auto hull = std::make_shared<PidHull>(nextPid++);
+	auto process = std::make_shared<Process>(std::move(hull), original.get());
+	size_t pos = path.rfind('/');
+	assert(pos != std::string::npos);
+	process->_name = path.substr(pos + 1);
+	process->_path = std::move(path);
+	process->_vmContext = std::move(vmContext);
+	process->_fsContext = std::move(fsContext);
+	process->_fileContext = std::move(fileContext);
+	process->_signalContext = SignalContext::clone(original->_signalContext);
+	process->_signalContext->resetHandlers();
+
+	original->_pgPointer->reassociateProcess(process.get());
+
+	process->_fileContext->closeOnExec();
+
+	HelHandle thread_memory;
+	HEL_CHECK(helAllocateMemory(0x1000, 0, nullptr, &thread_memory));
+	process->_threadPageMemory = helix::UniqueDescriptor{thread_memory};
+	process->_threadPageMapping = helix::Mapping{process->_threadPageMemory, 0, 0x1000};
+
+	// Signal masks are inherited by spawned processes.
+	process->_signalMask = original->_signalMask;
+
+	auto [server_lane, client_lane] = helix::createStream();
+	HEL_CHECK(helTransferDescriptor(client_lane.getHandle(),
+			process->_fileContext->getUniverse().getHandle(), &process->_clientPosixLane));
+	client_lane.release();
+
+	HEL_CHECK(helMapMemory(process->_threadPageMemory.getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead | kHelMapProtWrite,
+			&process->_clientThreadPage));
+	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
+			&process->_clientFileTable));
+	HEL_CHECK(helMapMemory(clk::trackerPageMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientClkTrackerPage));
+	HEL_CHECK(helMapMemory(clk::clockPageMemory().getHandle(),
+			process->_vmContext->getSpace().getHandle(),
+			nullptr, 0, 0x1000, kHelMapProtRead,
+			&process->_clientClockPage));
+
+	process->_clientAuxBegin = execResult.auxBegin;
+	process->_clientAuxEnd = execResult.auxEnd;
+	process->_uid = original->_uid;
+	process->_euid = original->_euid;
+	process->_gid = original->_gid;
+	process->_egid = original->_egid;
+	original->_children.push_back(process);
+	process->_hull->initializeProcess(process.get());
+	process->_didExecute = true;
+
+	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
+	process->_procfs_dir = procfs_root->createProcDirectory(std::to_string(process->_hull->getPid()), process.get());
+
+	process->_threadDescriptor = std::move(execResult.thread);
+	process->_posixLane = std::move(server_lane);
+
+	auto generation = std::make_shared<Generation>();
+	process->_currentGeneration = generation;
+	helResume(process->_threadDescriptor.getHandle());
+	async::detach(serve(process, std::move(generation)));
+
+	co_return process;
+}
+
+void Process::_finishVfork() {
+	if(!_inVfork)
+		return;
+	_inVfork = false;
+
+	HEL_CHECK(helUnmapMemory(_vmContext->getSpace().getHandle(),
+			_clientThreadPage, 0x1000));
+	HEL_CHECK(helUnmapMemory(_vmContext->getSpace().getHandle(),
+			_clientFileTable, FileContext::fileTableSize));
+	_vforkDone.raise();
+}
+
 async::result<Error> Process::exec(std::shared_ptr<Process> process,
 		std::string path, std::vector<std::string> args, std::vector<std::string> env) {
 	auto exec_vm_context = VmContext::create();
@@ -1109,6 +1541,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 
 	void *exec_thread_page;
 	void *exec_clk_tracker_page;
+	void *exec_clock_page;
 	void *exec_client_table;
 	HEL_CHECK(helMapMemory(process->_threadPageMemory.getHandle(),
 			exec_vm_context->getSpace().getHandle(),
@@ -1118,9 +1551,13 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 			exec_vm_context->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
 			&exec_clk_tracker_page));
-	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
+	HEL_CHECK(helMapMemory(clk::clockPageMemory().getHandle(),
 			exec_vm_context->getSpace().getHandle(),
 			nullptr, 0, 0x1000, kHelMapProtRead,
+			&exec_clock_page));
+	HEL_CHECK(helMapMemory(process->_fileContext->fileTableMemory().getHandle(),
+			exec_vm_context->getSpace().getHandle(),
+			nullptr, 0, FileContext::fileTableSize, kHelMapProtRead,
 			&exec_client_table));
 
 	// Kill the old thread.
@@ -1132,6 +1569,9 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 	co_await previousGeneration->signalsDone.wait();
 	co_await previousGeneration->requestsDone.wait();
 
+	// A vfork() child stops using the parent's address space now.
+	process->_finishVfork();
+
 	// Perform pre-exec() work.
 	// From here on, we can now release resources of the old process image.
 	process->_fileContext->closeOnExec();
@@ -1149,9 +1589,11 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 	process->_clientPosixLane = exec_posix_lane;
 	process->_clientFileTable = exec_client_table;
 	process->_clientClkTrackerPage = exec_clk_tracker_page;
+	process->_clientClockPage = exec_clock_page;
 	process->_clientAuxBegin = execResult.auxBegin;
 	process->_clientAuxEnd = execResult.auxEnd;
 	process->_didExecute = true;
+	process->_generation = freshGeneration();
 
 	auto generation = std::make_shared<Generation>();
 	process->_currentGeneration = generation;
@@ -1164,6 +1606,7 @@ async::result<Error> Process::exec(std::shared_ptr<Process> process,
 void Process::retire(Process *process) {
 	assert(process->_parent);
 	process->_parent->_childrenUsage.userTime += process->_generationUsage.userTime;
+	process->_parent->_generation = freshGeneration();
 }
 
 async::result<void> Process::terminate(TerminationState state) {
@@ -1177,12 +1620,17 @@ async::result<void> Process::terminate(TerminationState state) {
 	co_await _currentGeneration->signalsDone.wait();
 	co_await _currentGeneration->requestsDone.wait();
 
+	// A signal that was queued in the kernel dies with the thread.
+	delete std::exchange(_directSignal, nullptr);
+
 	// TODO: Also do this before switching to a new Generation in execve().
 	// TODO: Do the accumulation + _currentGeneration reset after the thread has really terminated?
 	HelThreadStats stats;
 	HEL_CHECK(helQueryThreadStats(_threadDescriptor.getHandle(), &stats));
 	_generationUsage.userTime += stats.userTime;
 
+	_finishVfork();
+
 	_posixLane = {};
 	_threadDescriptor = {};
 	_vmContext = nullptr;
@@ -1263,6 +1711,7 @@ void ProcessGroup::reassociateProcess(Process *process) {
 	}
 	process->_pgPointer = shared_from_this();
 	members_.push_back(*process);
+	process->_generation = freshGeneration();
 }
 
 void ProcessGroup::dropProcess(Process *process) {
@@ -1,8 +1,10 @@
 #pragma once
 
+#include <array>
 #include <map>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include <async/result.hpp>
 #include <async/oneshot-event.hpp>
@@ -21,9 +23,16 @@ struct ControllingTerminalState;
 
 typedef int ProcessId;
 
+// Returns a fresh value for generation counters. Values are unique across all objects,
+// hence consumers can detect changes even if the object itself is replaced.
+uint64_t freshGeneration();
+
 // TODO: This struct should store the process' VMAs once we implement them.
 // TODO: We need a clarification here: Does mmap() keep file descriptions open (e.g. for flock())?
 struct VmContext {
+	// Granularity of mappings that pass kHelMapPreferHugePages.
+	static constexpr size_t hugePageSize = 0x200000;
+
 	static std::shared_ptr<VmContext> create();
 	static std::shared_ptr<VmContext> clone(std::shared_ptr<VmContext> original);
 
@@ -42,8 +51,17 @@ struct VmContext {
 
 	async::result<void> protectFile(void *pointer, size_t size, uint32_t protectionFlags);
 
+	// Passes advice (one of the kHelAdvise* values) to the memory of private
+	// anonymous areas that overlap the given range. Other areas are skipped.
+	void adviseMemory(void *pointer, size_t size, int advice);
+
 	void unmapFile(void *pointer, size_t size);
 
+	// Changes whenever the set of areas or their attributes change.
+	uint64_t generation() {
+		return _generation;
+	}
+
 private:
 	struct Area {
 		bool copyOnWrite;
@@ -53,6 +71,10 @@ private:
 		helix::UniqueDescriptor copyView;
 		smarter::shared_ptr<File, FileHandle> file;
 		intptr_t offset;
+		// Private anonymous huge page mappings are not backed by CoW memory
+		// since CoW memory is always copied page by page. Instead, copyView is memory
+		// of 2 MiB chunks (starting at offset) that is copied eagerly on fork().
+		bool hugePages = false;
 	};
 
 	std::pair<
@@ -64,6 +86,8 @@ private:
 
 	std::map<uintptr_t, Area> _areaTree;
 
+	uint64_t _generation = freshGeneration();
+
 public:
 	struct AreaAccessor {
 		AreaAccessor(std::map<uintptr_t, Area>::iterator iter)
@@ -156,6 +180,13 @@ struct FileDescriptor {
 
 struct FileContext {
 public:
+	// Size of the memory that holds the passthrough handles of all file descriptors.
+	// The memory is mapped into the client and only populated on demand.
+	static constexpr size_t fileTableSize = 0x100000;
+
+	// Upper bound on the number of file descriptors of a process.
+	static constexpr int maxFileDescriptors = fileTableSize / sizeof(HelHandle);
+
 	static std::shared_ptr<FileContext> create();
 	static std::shared_ptr<FileContext> clone(std::shared_ptr<FileContext> original);
 
@@ -169,6 +200,7 @@ public:
 		return _fileTableMemory;
 	}
 
+	// Attaches the file to the lowest free file descriptor. Returns -1 if there is none.
 	int attachFile(smarter::shared_ptr<File, FileHandle> file, bool close_on_exec = false);
 
 	void attachFile(int fd, smarter::shared_ptr<File, FileHandle> file, bool close_on_exec = false);
@@ -187,15 +219,24 @@ public:
 		return _clientMbusLane;
 	}
 
-	const std::unordered_map<int, FileDescriptor> &fileTable() {
-		return _fileTable;
-	}
+	// Returns a snapshot of all open file descriptors.
+	std::unordered_map<int, FileDescriptor> fileTable();
 
 private:
+	void _markUsed(int fd);
+	void _markFree(int fd);
+	int _findFreeFd();
+
 	helix::UniqueDescriptor _universe;
 
-	// TODO: replace this by a tree that remembers gaps between keys.
-	std::unordered_map<int, FileDescriptor> _fileTable;
+	// Dense table indexed by file descriptor; unused slots have a null file.
+	std::vector<FileDescriptor> _fileTable;
+
+	// Two-level bitmap of used file descriptors. Bit i of _usedMap[w] is set if
+	// fd 64 * w + i is in use. Bit j of _fullMap[v] is set if _usedMap[64 * v + j]
+	// is completely in use. This makes finding the lowest free fd constant-time.
+	std::vector<uint64_t> _usedMap;
+	std::array<uint64_t, (maxFileDescriptors + 64 * 64 - 1) / (64 * 64)> _fullMap{};
 
 	helix::UniqueDescriptor _fileTableMemory;
 
@@ -288,7 +329,21 @@ public:
 
 	async::result<void> restoreContext(helix::BorrowedDescriptor thread);
 
+	// Delivers a pending signal by letting the kernel build the signal frame on the
+	// thread's next return from a syscall (see helQueueSignal()). Unlike raiseContext(),
+	// this does not require the thread to be interrupted.
+	// Returns false if the signal needs to be delivered by raiseContext() instead.
+	bool raiseDirect(Process *process);
+
+	// Takes back a signal from raiseDirect() that the kernel did not deliver yet.
+	// Must be called while the thread is stopped, before its signal state is inspected.
+	void reclaimDirect(Process *process);
+
 private:
+	// Returns the lowest pending signal number in mask, or zero.
+	int _findPending(uint64_t mask);
+	SignalItem *_popPending(int sn);
+
 	SignalHandler _handlers[64];
 	SignalSlot _slots[64];
 
@@ -377,11 +432,24 @@ struct Process : std::enable_shared_from_this<Process> {
 
 	static std::shared_ptr<Process> findProcess(ProcessId pid);
 
+	// Returns all processes that currently have a PID, ordered by PID.
+	static std::vector<std::shared_ptr<Process>> listProcesses();
+
 	static async::result<std::shared_ptr<Process>> init(std::string path);
 
 	static std::shared_ptr<Process> fork(std::shared_ptr<Process> parent);
 	static std::shared_ptr<Process> clone(std::shared_ptr<Process> parent, void *ip, void *sp);
 
+	// Like fork() but the child shares the VmContext of the parent.
+	// The parent must not run until waitForVfork() completes.
+	static std::shared_ptr<Process> vfork(std::shared_ptr<Process> parent);
+
+	// Creates a child that executes path in a fresh address space. The child uses
+	// the given FileContext, which is usually a clone of the parent's FileContext.
+	static async::result<frg::expected<Error, std::shared_ptr<Process>>> spawn(
+			std::shared_ptr<Process> parent, std::shared_ptr<FileContext> fileContext,
+			std::string path, std::vector<std::string> args, std::vector<std::string> env);
+
 	static async::result<Error> exec(std::shared_ptr<Process> process,
 			std::string path, std::vector<std::string> args, std::vector<std::string> env);
 
@@ -412,6 +480,7 @@ public:
 	}
 
 	Error setUid(int uid) {
+		_generation = freshGeneration();
 		if(uid < 0) {
 			return Error::illegalArguments;
 		}
@@ -431,6 +500,7 @@ public:
 	}
 
 	Error setEuid(int euid) {
+		_generation = freshGeneration();
 		if(euid < 0) {
 			return Error::illegalArguments;
 		}
@@ -446,6 +516,7 @@ public:
 	}
 
 	Error setGid(int gid) {
+		_generation = freshGeneration();
 		if(gid < 0) {
 			return Error::illegalArguments;
 		}
@@ -465,6 +536,7 @@ public:
 	}
 
 	Error setEgid(int egid) {
+		_generation = freshGeneration();
 		if(egid < 0) {
 			return Error::illegalArguments;
 		}
@@ -493,6 +565,12 @@ public:
 
 	void setName(std::string name) {
 		_name = name;
+		_generation = freshGeneration();
+	}
+
+	// Changes whenever the data shown in /proc/[pid]/stat and similar files changes.
+	uint64_t generation() {
+		return _generation;
 	}
 
 	helix::BorrowedLane posixLane() {
@@ -523,6 +601,7 @@ public:
 	void *clientThreadPage() { return _clientThreadPage; }
 	void *clientFileTable() { return _clientFileTable; }
 	void *clientClkTrackerPage() { return _clientClkTrackerPage; }
+	void *clientClockPage() { return _clientClockPage; }
 	void *clientAuxBegin() { return _clientAuxBegin; }
 	void *clientAuxEnd() { return _clientAuxEnd; }
 
@@ -540,6 +619,11 @@ public:
 
 	async::result<void> terminate(TerminationState state);
 
+	// Completes once a child created by vfork() no longer uses the parent's address space.
+	async::result<void> waitForVfork() {
+		co_await _vforkDone.wait();
+	}
+
 	async::result<int> wait(int pid, bool nonBlocking, TerminationState *state, ResourceUsage *stats = nullptr);
 
 	ResourceUsage accumulatedUsage() {
@@ -579,7 +663,18 @@ public:
 		_enteredSignalSeq++;
 	}
 
+	SignalItem *exchangeDirectSignal(SignalItem *item) {
+		return std::exchange(_directSignal, item);
+	}
+
+	// Fills the buffer with random bytes. Small reads are served from a per-process
+	// buffer such that they do not need to enter the kernel each time.
+	void readRandom(void *data, size_t length);
+
 private:
+	// Removes the mappings of a vfork() child from the shared address space.
+	void _finishVfork();
+
 	Process *_parent;
 
 	std::shared_ptr<PidHull> _hull;
@@ -609,6 +704,7 @@ private:
 	void *_clientThreadPage;
 	void *_clientFileTable;
 	void *_clientClkTrackerPage;
+	void *_clientClockPage;
 	// Pointers to the aux vector in the client.
 	void *_clientAuxBegin = nullptr;
 	void *_clientAuxEnd = nullptr;
@@ -616,6 +712,17 @@ private:
 	uint64_t _signalMask;
 	std::vector<std::shared_ptr<Process>> _children;
 
+	// Random bytes that have not been handed out yet; they are consumed from the end.
+	// Allocated on first use. This is never inherited by children.
+	std::unique_ptr<std::array<char, 4096>> _randomBuffer;
+	size_t _randomAvailable = 0;
+
+	uint64_t _generation = freshGeneration();
+
+	// True while a vfork() child still shares the address space of its parent.
+	bool _inVfork = false;
+	async::oneshot_event _vforkDone;
+
 	// The following intrusive queue stores notifications for wait().
 	NotifyType _notifyType;
 	TerminationState _state;
@@ -645,9 +752,13 @@ private:
 	// Used for tracking signals that happened between sigprocmask and
 	// a call that resumes on a signal.
 	uint64_t _enteredSignalSeq = 0;
+
+	// Signal that was handed to the kernel by SignalContext::raiseDirect().
+	SignalItem *_directSignal = nullptr;
 };
 
 std::shared_ptr<Process> findProcessWithCredentials(const char *credentials);
+smarter::shared_ptr<File, FileHandle> findFileWithPassthroughCredentials(const char *credentials);
 
 // --------------------------------------------------------------------------------------
 // Process groups and sessions.
@@ -1,11 +1,16 @@
 #include <string.h>
+#include <charconv>
 #include <sstream>
 #include <iomanip>
+#include <algorithm>
+
+#include <protocols/posix/taskstats.hpp>
 
 #include "clock.hpp"
 #include "common.hpp"
 #include "procfs.hpp"
 #include "process.hpp"
+#include "requests.hpp"
 
 #include <bitset>
 
@@ -68,7 +73,7 @@ RegularFile::readSome(Process *, void *data, size_t max_length) {
 	if(!_cached) {
 		assert(!_offset);
 		auto node = static_cast<RegularNode *>(associatedLink()->getTarget().get());
-		_buffer = co_await node->show();
+		_buffer = co_await node->_cachedShow();
 		_cached = true;
 	}
 
@@ -84,7 +89,9 @@ RegularFile::writeAll(Process *, const void *data, size_t length) {
 	assert(length > 0);
 
 	auto node = static_cast<RegularNode *>(associatedLink()->getTarget().get());
-	co_await node->store(std::string{reinterpret_cast<const char *>(data), length});
+	auto err = co_await node->store(std::string{reinterpret_cast<const char *>(data), length});
+	if(err != Error::success)
+		co_return err;
 	co_return length;
 }
 
@@ -203,6 +210,25 @@ RegularNode::open(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link
 	co_return File::constructHandle(std::move(file));
 }
 
+async::result<Error> RegularNode::store(std::string) {
+	co_return Error::illegalOperationTarget;
+}
+
+async::result<std::string> RegularNode::_cachedShow() {
+	auto current = generation();
+	if(current && _cachedGeneration == current)
+		co_return _cachedOutput;
+
+	// Note that show() may suspend. We read the generation before calling show(),
+	// such that concurrent changes invalidate the cached output.
+	auto output = co_await show();
+	if(current) {
+		_cachedGeneration = current;
+		_cachedOutput = output;
+	}
+	co_return output;
+}
+
 FutureMaybe<std::shared_ptr<FsNode>> SuperBlock::createRegular(Process *) {
 	co_return nullptr;
 }
@@ -233,6 +259,9 @@ std::shared_ptr<Link> DirectoryNode::createRootDirectory() {
 	the_node->_entries.insert(std::move(self_thread_link));
 
 	the_node->directMkregular("uptime", std::make_shared<UptimeNode>());
+	the_node->directMkregular("posix-requests", std::make_shared<PosixRequestsNode>());
+	the_node->directMkregular("posix-request-load", std::make_shared<PosixRequestLoadNode>());
+	the_node->directMkregular("taskstats", std::make_shared<TaskStatsNode>());
 
 	auto sysLink = the_node->directMkdir("sys");
 	auto sys = std::static_pointer_cast<DirectoryNode>(sysLink->getTarget());
@@ -284,6 +313,7 @@ std::shared_ptr<Link> DirectoryNode::createProcDirectory(std::string name,
 	proc_dir->directMknode("cwd", std::make_shared<CwdLink>(process));
 	proc_dir->directMknode("fd", std::make_shared<FdDirectoryNode>(process));
 	proc_dir->directMkregular("maps", std::make_shared<MapNode>(process));
+	proc_dir->directMkregular("smaps", std::make_shared<SmapsNode>(process));
 	proc_dir->directMkregular("comm", std::make_shared<CommNode>(process));
 	proc_dir->directMkregular("stat", std::make_shared<StatNode>(process));
 	proc_dir->directMkregular("statm", std::make_shared<StatmNode>(process));
@@ -361,10 +391,37 @@ async::result<std::string> UptimeNode::show() {
 	co_return stream.str();
 }
 
-async::result<void> UptimeNode::store(std::string) {
-	// TODO: proper error reporting.
-	std::cout << "posix: Can't store to a /proc/uptime file" << std::endl;
-	co_return;
+async::result<std::string> TaskStatsNode::show() {
+	auto processes = Process::listProcesses();
+	std::string buffer(processes.size() * sizeof(posix::TaskStats), '\0');
+	for(size_t i = 0; i < processes.size(); i++) {
+		auto &process = processes[i];
+
+		posix::TaskStats record{};
+		record.recordSize = sizeof(posix::TaskStats);
+		record.pid = process->pid();
+		if(process->getParent())
+			record.ppid = process->getParent()->pid();
+		record.pgrp = process->pgPointer()->getHull()->getPid();
+		record.sid = process->pgPointer()->getSession()->getSessionId();
+		record.uid = process->uid();
+		record.gid = process->gid();
+		record.childrenUserTime = process->accumulatedUsage().userTime;
+		record.generation = process->generation();
+		auto name = process->name();
+		memcpy(record.comm, name.data(), std::min(name.size(), sizeof(record.comm) - 1));
+
+		memcpy(buffer.data() + i * sizeof(posix::TaskStats), &record, sizeof(posix::TaskStats));
+	}
+	co_return buffer;
+}
+
+async::result<std::string> PosixRequestsNode::show() {
+	co_return formatRequestStats();
+}
+
+async::result<std::string> PosixRequestLoadNode::show() {
+	co_return formatRequestLoad();
 }
 
 async::result<std::string> OstypeNode::show() {
@@ -375,12 +432,6 @@ async::result<std::string> OstypeNode::show() {
 	co_return stream.str();
 }
 
-async::result<void> OstypeNode::store(std::string) {
-	// TODO: proper error reporting.
-	std::cout << "posix: Can't store to a /proc/sys/kernel/ostype file" << std::endl;
-	co_return;
-}
-
 async::result<std::string> OsreleaseNode::show() {
 	// See man 5 proc for more details.
 	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
@@ -390,12 +441,6 @@ async::result<std::string> OsreleaseNode::show() {
 	co_return stream.str();
 }
 
-async::result<void> OsreleaseNode::store(std::string) {
-	// TODO: proper error reporting.
-	std::cout << "posix: Can't store to a /proc/sys/kernel/osrelease file" << std::endl;
-	co_return;
-}
-
 async::result<std::string> ArchNode::show() {
 	// See man 5 proc for more details.
 	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
@@ -412,12 +457,6 @@ async::result<std::string> ArchNode::show() {
 	co_return stream.str();
 }
 
-async::result<void> ArchNode::store(std::string) {
-	// TODO: proper error reporting.
-	std::cout << "posix: Can't store to a /proc/sys/kernel/arch file" << std::endl;
-	co_return;
-}
-
 VfsType SelfLink::getType() {
 	return VfsType::symlink;
 }
@@ -457,49 +496,144 @@ async::result<frg::expected<Error, FileStats>> ExeLink::getStats() {
 	co_return FileStats{};
 }
 
+namespace {
+
+// Prints the line that describes an area in /proc/[pid]/maps (without the newline).
+async::result<void> showMapsLine(Process *process, VmContext::AreaAccessor area,
+		std::stringstream &stream) {
+	stream << std::hex << area.baseAddress();
+	stream << "-";
+	stream << std::hex << area.baseAddress() + area.size();
+	stream << " ";
+	stream << (area.isReadable() ? "r" : "-");
+	stream << (area.isWritable() ? "w" : "-");
+	stream << (area.isExecutable() ? "x" : "-");
+	stream << (area.isPrivate() ? "p" : "-");
+	stream << " ";
+	auto backingFile = area.backingFile();
+	if(backingFile && backingFile->associatedLink() && backingFile->associatedMount()) {
+		stream << std::setfill('0') << std::setw(8) << area.backingFileOffset();
+		stream << " ";
+		auto fsNode = backingFile->associatedLink()->getTarget();
+		ViewPath viewPath = {backingFile->associatedMount(), backingFile->associatedLink()};
+		auto fileStats = co_await fsNode->getStats();
+		DeviceId deviceId{};
+		if (fsNode->getType() == VfsType::charDevice || fsNode->getType() == VfsType::blockDevice)
+			deviceId = fsNode->readDevice();
+		assert(fileStats);
+
+		stream << std::dec << std::setfill('0') << std::setw(2) << deviceId.first << ":" << deviceId.second;
+		stream << " ";
+		stream << std::setw(0) << fileStats.value().inodeNumber;
+		stream << "    ";
+		stream << viewPath.getPath(process->fsContext()->getRoot());
+	} else {
+		// TODO: In the case of memfd files, show the name here.
+		stream << "00000000 00:00 0";
+	}
+	stream << std::dec << std::setfill(' ');
+}
+
+HelMappingUsage queryAreaUsage(VmContext *vmContext, VmContext::AreaAccessor area) {
+	HelMappingUsage usage;
+	HEL_CHECK(helQueryMappingUsage(vmContext->getSpace().getHandle(),
+			reinterpret_cast<void *>(area.baseAddress()), area.size(), &usage));
+	return usage;
+}
+
+// Totals of all areas of a VmContext, used by statm and status.
+struct VmTotals {
+	size_t size = 0;
+	size_t text = 0;
+	size_t data = 0;
+	size_t resident = 0;
+	size_t anonymous = 0;
+	size_t file = 0;
+	size_t shmem = 0;
+	size_t swapped = 0;
+};
+
+VmTotals queryVmTotals(VmContext *vmContext) {
+	VmTotals totals;
+	for (auto area : *vmContext) {
+		auto usage = queryAreaUsage(vmContext, area);
+		totals.size += area.size();
+		if(area.isExecutable()) {
+			totals.text += area.size();
+		}else if(area.isWritable() && area.isPrivate()) {
+			totals.data += area.size();
+		}
+		totals.resident += usage.resident;
+		// Pages that are not anonymous belong to the page cache (and they are always shared).
+		// Shared anonymous pages belong to shared memory objects.
+		auto file = usage.resident - usage.anonymous;
+		auto shmem = usage.shared - std::min(usage.shared, file);
+		totals.file += file;
+		totals.shmem += shmem;
+		totals.anonymous += usage.anonymous - shmem;
+		totals.swapped += usage.swapped;
+	}
+	return totals;
+}
+
+} // anonymous namespace
+
 async::result<std::string> MapNode::show() {
 	auto vmContext = _process->vmContext();
 	std::stringstream stream;
 	for (auto area : *vmContext) {
-		stream << std::hex << area.baseAddress();
-		stream << "-";
-		stream << std::hex << area.baseAddress() + area.size();
-		stream << " ";
-		stream << (area.isReadable() ? "r" : "-");
-		stream << (area.isWritable() ? "w" : "-");
-		stream << (area.isExecutable() ? "x" : "-");
-		stream << (area.isPrivate() ? "p" : "-");
-		stream << " ";
-		auto backingFile = area.backingFile();
-		if(backingFile && backingFile->associatedLink() && backingFile->associatedMount()) {
-			stream << std::setfill('0') << std::setw(8) << area.backingFileOffset();
-			stream << " ";
-			auto fsNode = backingFile->associatedLink()->getTarget();
-			ViewPath viewPath = {backingFile->associatedMount(), backingFile->associatedLink()};
-			auto fileStats = co_await fsNode->getStats();
-			DeviceId deviceId{};
-			if (fsNode->getType() == VfsType::charDevice || fsNode->getType() == VfsType::blockDevice)
-				deviceId = fsNode->readDevice();
-			assert(fileStats);
-
-			stream << std::dec << std::setfill('0') << std::setw(2) << deviceId.first << ":" << deviceId.second;
-			stream << " ";
-			stream << std::setw(0) << fileStats.value().inodeNumber;
-			stream << "    ";
-			stream << viewPath.getPath(_process->fsContext()->getRoot());
-		} else {
-			// TODO: In the case of memfd files, show the name here.
-			stream << "00000000 00:00 0";
-		}
+		co_await showMapsLine(_process, area, stream);
 		stream << "\n";
 	}
 	co_return stream.str();
 }
 
-async::result<void> MapNode::store(std::string) {
-	// TODO: proper error reporting.
-	std::cout << "posix: Can't store to a /proc/maps file" << std::endl;
-	co_return;
+std::optional<uint64_t> MapNode::generation() {
+	// Generations are globally unique and increasing, hence the maximum
+	// also changes if the VmContext is replaced by exec().
+	return std::max(_process->vmContext()->generation(), _process->generation());
+}
+
+async::result<std::string> SmapsNode::show() {
+	// See man 5 proc for more details.
+	// We do not track how many processes map each page, nor whether pages are dirty;
+	// hence, Pss equals Rss and all pages are reported as clean.
+	auto vmContext = _process->vmContext();
+	std::stringstream stream;
+	for (auto area : *vmContext) {
+		co_await showMapsLine(_process, area, stream);
+		stream << "\n";
+
+		auto usage = queryAreaUsage(vmContext, area);
+		auto kb = [&] (const char *name, size_t bytes) {
+			stream << std::left << std::setw(16) << name << std::right << std::setw(8)
+					<< (bytes / 1024) << " kB\n";
+		};
+		kb("Size:", area.size());
+		kb("KernelPageSize:", 0x1000);
+		kb("MMUPageSize:", 0x1000);
+		kb("Rss:", usage.resident);
+		kb("Pss:", usage.resident);
+		kb("Shared_Clean:", usage.shared);
+		kb("Shared_Dirty:", 0);
+		kb("Private_Clean:", usage.resident - usage.shared);
+		kb("Private_Dirty:", 0);
+		kb("Anonymous:", usage.anonymous);
+		kb("Swap:", usage.swapped);
+		// Not part of Linux' smaps: memory of the area that was evicted from the page cache.
+		kb("Evicted:", usage.evicted - usage.swapped);
+		stream << "VmFlags:";
+		if(area.isReadable())
+			stream << " rd";
+		if(area.isWritable())
+			stream << " wr";
+		if(area.isExecutable())
+			stream << " ex";
+		if(!area.isPrivate())
+			stream << " sh";
+		stream << "\n";
+	}
+	co_return stream.str();
 }
 
 async::result<std::string> CommNode::show() {
@@ -510,10 +644,14 @@ async::result<std::string> CommNode::show() {
 	co_return stream.str();
 }
 
-async::result<void> CommNode::store(std::string name) {
+std::optional<uint64_t> CommNode::generation() {
+	return _process->generation();
+}
+
+async::result<Error> CommNode::store(std::string name) {
 	// silently truncate to TASK_COMM_LEN (16), including the null terminator
 	_process->setName(name.substr(0, 15));
-	co_return;
+	co_return Error::success;
 }
 
 VfsType RootLink::getType() {
@@ -594,32 +732,26 @@ async::result<std::string> StatNode::show() {
 	co_return stream.str();
 }
 
-async::result<void> StatNode::store(std::string) {
-	// TODO: proper error reporting.
-	throw std::runtime_error("Can't store to a /proc/stat file!");
+std::optional<uint64_t> StatNode::generation() {
+	return _process->generation();
 }
 
 async::result<std::string> StatmNode::show() {
-	(void)_process;
-	// All hardcoded to 0.
+	// All values are in pages.
 	// See man 5 proc for more details.
 	// Based on the man page from Linux man-pages 6.01, updated on 2022-10-09.
+	auto totals = queryVmTotals(_process->vmContext());
 	std::stringstream stream;
-	stream << "0 "; // size
-	stream << "0 "; // resident
-	stream << "0 "; // shared
-	stream << "0 "; // text
-	stream << "0 "; // lib
-	stream << "0 "; // data
-	stream << "0\n"; // dt
+	stream << (totals.size >> 12) << " "; // size
+	stream << (totals.resident >> 12) << " "; // resident
+	stream << ((totals.file + totals.shmem) >> 12) << " "; // shared
+	stream << (totals.text >> 12) << " "; // text
+	stream << "0 "; // lib, unused since Linux 2.6.
+	stream << (totals.data >> 12) << " "; // data
+	stream << "0\n"; // dt, unused since Linux 2.6.
 	co_return stream.str();
 }
 
-async::result<void> StatmNode::store(std::string) {
-	// TODO: proper error reporting.
-	throw std::runtime_error("Can't store to a /proc/statm file!");
-}
-
 async::result<std::string> StatusNode::show() {
 	// Everything that has a value of N/A is not implemented yet.
 	// See man 5 proc for more details.
@@ -648,22 +780,23 @@ async::result<std::string> StatusNode::show() {
 	stream << "NSpgid: N/A\n";
 	stream << "NSsid: N/A\n";
 	// End namespace information.
-	// VM information, not exposed yet.
+	// VM information, only partially exposed yet.
+	auto totals = queryVmTotals(_process->vmContext());
 	stream << "VmPeak: N/A kB\n";
-	stream << "VmSize: N/A kB\n";
+	stream << "VmSize: " << (totals.size / 1024) << " kB\n";
 	stream << "VmLck: 0 kB\n"; // We don't lock memory.
 	stream << "VmPin: 0 kB\n"; // We don't pin memory.
 	stream << "VmHWM: N/A kB\n";
-	stream << "VmRSS: N/A kB\n";
-	stream << "RssAnon: N/A kB\n";
-	stream << "RssFile: N/A kB\n";
-	stream << "RssShmem: N/A kB\n";
-	stream << "VmData: N/A kB\n";
+	stream << "VmRSS: " << (totals.resident / 1024) << " kB\n";
+	stream << "RssAnon: " << (totals.anonymous / 1024) << " kB\n";
+	stream << "RssFile: " << (totals.file / 1024) << " kB\n";
+	stream << "RssShmem: " << (totals.shmem / 1024) << " kB\n";
+	stream << "VmData: " << (totals.data / 1024) << " kB\n";
 	stream << "VmStk: N/A kB\n";
-	stream << "VmExe: N/A kB\n";
+	stream << "VmExe: " << (totals.text / 1024) << " kB\n";
 	stream << "VmLib: N/A kB\n";
 	stream << "VmPTE: N/A kB\n";
-	stream << "VmSwap: 0 kB\n"; // We don't have swap yet.
+	stream << "VmSwap: " << (totals.swapped / 1024) << " kB\n";
 	stream << "HugetlbPages: N/A kB\n";
 	// End of VM information.
 	stream << "CoreDumping: 0\n"; // We don't implement coredumps, so 0 is correct here.
@@ -701,11 +834,6 @@ async::result<std::string> StatusNode::show() {
 	co_return stream.str();
 }
 
-async::result<void> StatusNode::store(std::string) {
-	// TODO: proper error reporting.
-	throw std::runtime_error("Can't store to a /proc/status file!");
-}
-
 VfsType CwdLink::getType() {
 	return VfsType::symlink;
 }
@@ -776,12 +904,15 @@ FdDirectoryNode::open(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink>
 }
 
 async::result<frg::expected<Error, std::shared_ptr<FsLink>>> FdDirectoryNode::getLink(std::string name) {
-	for(const auto &[fdnum, fd] : _process->fileContext()->fileTable()) {
-		if(name != std::to_string(fdnum))
-			continue;
-		co_return std::make_shared<Link>(shared_from_this(), std::move(name), fd.file->associatedLink()->getTarget());
-	}
-	co_return Error::noSuchFile;
+	int fdnum;
+	auto [ptr, ec] = std::from_chars(name.data(), name.data() + name.size(), fdnum);
+	if(ec != std::errc{} || ptr != name.data() + name.size() || name != std::to_string(fdnum))
+		co_return Error::noSuchFile;
+
+	auto fd = _process->fileContext()->getDescriptor(fdnum);
+	if(!fd)
+		co_return Error::noSuchFile;
+	co_return std::make_shared<Link>(shared_from_this(), std::move(name), fd->file->associatedLink()->getTarget());
 }
 
 } // namespace procfs
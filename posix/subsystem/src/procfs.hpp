@@ -1,5 +1,7 @@
 #pragma once
 
+#include <optional>
+
 #include <protocols/fs/server.hpp>
 
 #include "vfs.hpp"
@@ -104,7 +106,21 @@ struct RegularNode : FsNode, std::enable_shared_from_this<RegularNode> {
 
 protected:
 	virtual async::result<std::string> show() = 0;
-	virtual async::result<void> store(std::string buffer) = 0;
+	// Nodes are read-only unless they override store().
+	virtual async::result<Error> store(std::string buffer);
+
+	// Nodes whose output only depends on state that is tracked by generation counters
+	// return the current generation here; their output is then only regenerated
+	// if the generation changed since the last show().
+	virtual std::optional<uint64_t> generation() {
+		return std::nullopt;
+	}
+
+private:
+	async::result<std::string> _cachedShow();
+
+	std::optional<uint64_t> _cachedGeneration;
+	std::string _cachedOutput;
 };
 
 struct SuperBlock final : FsSuperblock {
@@ -208,7 +224,19 @@ struct MapNode final : RegularNode {
 	{ }
 
 	async::result<std::string> show() override;
-	async::result<void> store(std::string) override;
+	std::optional<uint64_t> generation() override;
+private:
+	Process *_process;
+};
+
+// Like MapNode but also shows the memory usage of each area.
+// Since the usage changes all the time, the output is never cached.
+struct SmapsNode final : RegularNode {
+	SmapsNode(Process *process)
+	: _process(process)
+	{ }
+
+	async::result<std::string> show() override;
 private:
 	Process *_process;
 };
@@ -217,28 +245,45 @@ struct UptimeNode final : RegularNode {
 	UptimeNode() {}
 
 	async::result<std::string> show() override;
-	async::result<void> store(std::string) override;
+};
+
+// Binary records of all processes (see protocols/posix/taskstats.hpp).
+struct TaskStatsNode final : RegularNode {
+	TaskStatsNode() {}
+
+	async::result<std::string> show() override;
+};
+
+// Per-request statistics of the POSIX server (see formatRequestStats()).
+struct PosixRequestsNode final : RegularNode {
+	PosixRequestsNode() {}
+
+	async::result<std::string> show() override;
+};
+
+// Load of the POSIX server's request loops (see formatRequestLoad()).
+struct PosixRequestLoadNode final : RegularNode {
+	PosixRequestLoadNode() {}
+
+	async::result<std::string> show() override;
 };
 
 struct OstypeNode final : RegularNode {
 	OstypeNode() {}
 
 	async::result<std::string> show() override;
-	async::result<void> store(std::string) override;
 };
 
 struct OsreleaseNode final : RegularNode {
 	OsreleaseNode() {}
 
 	async::result<std::string> show() override;
-	async::result<void> store(std::string) override;
 };
 
 struct ArchNode final : RegularNode {
 	ArchNode() {}
 
 	async::result<std::string> show() override;
-	async::result<void> store(std::string) override;
 };
 
 struct CommNode final : RegularNode {
@@ -247,7 +292,8 @@ struct CommNode final : RegularNode {
 	{ }
 
 	async::result<std::string> show() override;
-	async::result<void> store(std::string) override;
+	async::result<Error> store(std::string) override;
+	std::optional<uint64_t> generation() override;
 private:
 	Process *_process;
 };
@@ -258,7 +304,7 @@ struct StatNode final : RegularNode {
 	{ }
 
 	async::result<std::string> show() override;
-	async::result<void> store(std::string) override;
+	std::optional<uint64_t> generation() override;
 private:
 	Process *_process;
 };
@@ -269,7 +315,6 @@ struct StatmNode final : RegularNode {
         { }
 
         async::result<std::string> show() override;
-        async::result<void> store(std::string) override;
 private:
         Process *_process;
 };
@@ -280,7 +325,6 @@ struct StatusNode final : RegularNode {
 	{ }
 
 	async::result<std::string> show() override;
-	async::result<void> store(std::string) override;
 private:
 	Process *_process;
 };
@@ -93,38 +93,93 @@ struct Channel {
 
 namespace {
 
-void processOut(const char c, Packet &packet, std::shared_ptr<Channel> channel) {
-	if(!(channel->activeSettings.c_oflag & OPOST)) {
-		packet.buffer.push_back(c);
+// Packets are only merged up to this size.
+constexpr size_t maxMergedPacket = 64 * 1024;
+
+// Appends a packet to a queue. If merge is true, the data is appended to the last packet
+// instead; this is only done if readers do not depend on packet boundaries.
+// Empty packets signal EOF to the reader and are never merged.
+void enqueueData(std::deque<Packet> &queue, Packet packet, bool merge) {
+	if(merge && !packet.buffer.empty() && !queue.empty()) {
+		auto &back = queue.back();
+		if(!back.buffer.empty()
+				&& back.buffer.size() + packet.buffer.size() <= maxMergedPacket) {
+			back.buffer.insert(back.buffer.end(), packet.buffer.begin(), packet.buffer.end());
+			return;
+		}
+	}
+
+	queue.push_back(std::move(packet));
+}
+
+// Copies data from the front of a queue. If merge is true, the data of multiple
+// packets is returned at once; otherwise, at most a single packet is consumed.
+size_t dequeueData(std::deque<Packet> &queue, void *data, size_t maxLength, bool merge) {
+	size_t progress = 0;
+	while(!queue.empty() && progress < maxLength) {
+		auto packet = &queue.front();
+		auto chunk = std::min(packet->buffer.size() - packet->offset, maxLength - progress);
+		if(!chunk) {
+			// Empty packets are returned as a read of size zero.
+			if(!progress)
+				queue.pop_front();
+			break;
+		}
+
+		memcpy(reinterpret_cast<char *>(data) + progress,
+				packet->buffer.data() + packet->offset, chunk);
+		packet->offset += chunk;
+		progress += chunk;
+		if(packet->offset == packet->buffer.size())
+			queue.pop_front();
+		if(!merge)
+			break;
+	}
+	return progress;
+}
+
+// Performs output processing. Runs of characters that do not need to be translated
+// are copied in bulk.
+void processOut(const char *s, size_t length, Packet &packet, Channel *channel) {
+	auto end = s + length;
+	if(!(channel->activeSettings.c_oflag & OPOST)
+			|| !(channel->activeSettings.c_oflag & ONLCR)) {
+		packet.buffer.insert(packet.buffer.end(), s, end);
 		return;
 	}
 
-	if((channel->activeSettings.c_oflag & ONLCR) && c == '\n') {
+	while(s != end) {
+		auto nl = static_cast<const char *>(memchr(s, '\n', end - s));
+		if(!nl) {
+			packet.buffer.insert(packet.buffer.end(), s, end);
+			return;
+		}
+		packet.buffer.insert(packet.buffer.end(), s, nl);
 		packet.buffer.push_back('\r');
 		packet.buffer.push_back('\n');
-		return;
+		s = nl + 1;
 	}
+}
 
-	packet.buffer.push_back(c);
-
-	return;
+// Determines whether processIn() would pass all characters to the slave unchanged.
+bool isRawInput(const struct termios &settings) {
+	return !(settings.c_lflag & (ICANON | ECHO | ISIG))
+			&& !(settings.c_iflag & (ISTRIP | IGNCR | ICRNL | INLCR | IUCLC));
 }
 
-void processIn(const char character, Packet &packet, std::shared_ptr<Channel> channel) {
+void processIn(const char character, Packet &packet, const std::shared_ptr<Channel> &channel) {
 	auto enqueuePacket = [&channel](Packet packet) {
-		channel->slaveQueue.push_back(std::move(packet));
+		enqueueData(channel->slaveQueue, std::move(packet),
+				!(channel->activeSettings.c_lflag & ICANON));
 		channel->slaveInSeq = ++channel->currentSeq;
 		channel->statusBell.raise();
 	};
 
 	auto enqueueOut = [&channel](Packet packet) {
 		Packet parsed{};
+		processOut(packet.buffer.data(), packet.buffer.size(), parsed, channel.get());
 
-		for(auto c : packet.buffer) {
-			processOut(c, parsed, channel);
-		}
-
-		channel->masterQueue.push_back(std::move(parsed));
+		enqueueData(channel->masterQueue, std::move(parsed), true);
 		channel->masterInSeq = ++channel->currentSeq;
 		channel->statusBell.raise();
 	};
@@ -715,14 +770,8 @@ MasterFile::readSome(Process *, void *data, size_t maxLength) {
 	while(_channel->masterQueue.empty())
 		co_await _channel->statusBell.async_wait();
 
-	auto packet = &_channel->masterQueue.front();
-	size_t chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
-	assert(chunk); // Otherwise, we return above due to !maxLength.
-	memcpy(data, packet->buffer.data() + packet->offset, chunk);
-	packet->offset += chunk;
-	if(packet->offset == packet->buffer.size())
-		_channel->masterQueue.pop_front();
-	co_return chunk;
+	// The master side does not care about packet boundaries.
+	co_return dequeueData(_channel->masterQueue, data, maxLength, true);
 }
 
 async::result<frg::expected<Error, size_t>>
@@ -731,14 +780,18 @@ MasterFile::writeAll(Process *, const void *data, size_t length) {
 		std::cout << std::format("posix: Write to tty {} of size {}\n", structName(), length);
 
 	auto enqueuePacket = [this](Packet packet) {
-		_channel->slaveQueue.push_back(std::move(packet));
+		enqueueData(_channel->slaveQueue, std::move(packet),
+				!(_channel->activeSettings.c_lflag & ICANON));
 		_channel->slaveInSeq = ++_channel->currentSeq;
 		_channel->statusBell.raise();
 	};
 
 	auto s = reinterpret_cast<const char *>(data);
-	for(size_t i = 0; i < length; i++) {
-		processIn(s[i], _packet, _channel);
+	if(isRawInput(_channel->activeSettings)) {
+		_packet.buffer.insert(_packet.buffer.end(), s, s + length);
+	}else{
+		for(size_t i = 0; i < length; i++)
+			processIn(s[i], _packet, _channel);
 	}
 
 	// Check whether all data was discarded above.
@@ -906,14 +959,9 @@ SlaveFile::readSome(Process *, void *data, size_t maxLength) {
 		co_await _channel->statusBell.async_wait();
 	}
 
-	auto packet = &_channel->slaveQueue.front();
-	auto chunk = std::min(packet->buffer.size() - packet->offset, maxLength);
-	if(chunk)
-		memcpy(data, packet->buffer.data() + packet->offset, chunk);
-	packet->offset += chunk;
-	if(packet->offset == packet->buffer.size())
-		_channel->slaveQueue.pop_front();
-	co_return chunk;
+	// In canonical mode, each read returns at most one line.
+	co_return dequeueData(_channel->slaveQueue, data, maxLength,
+			!(_channel->activeSettings.c_lflag & ICANON));
 }
 
 
@@ -925,14 +973,9 @@ SlaveFile::writeAll(Process *, const void *data, size_t length) {
 	if(!length)
 		co_return {};
 
-	// Perform output processing.
-	for(size_t i = 0; i < length; i++) {
-		char c;
-		memcpy(&c, reinterpret_cast<const char *>(data) + i, 1);
-		processOut(c, _packet, _channel);
-	}
+	processOut(reinterpret_cast<const char *>(data), length, _packet, _channel.get());
 
-	_channel->masterQueue.push_back(std::move(_packet));
+	enqueueData(_channel->masterQueue, std::move(_packet), true);
 	_channel->masterInSeq = ++_channel->currentSeq;
 	_channel->statusBell.raise();
 	_packet = Packet{};
@@ -1,4 +1,7 @@
 #include <format>
+#include <map>
+#include <sstream>
+#include <vector>
 #include <linux/netlink.h>
 #include <sys/mman.h>
 #include <sys/poll.h>
@@ -18,6 +21,7 @@
 #include "extern_socket.hpp"
 #include "fifo.hpp"
 #include "inotify.hpp"
+#include "io-ring.hpp"
 #include "memfd.hpp"
 #include "pts.hpp"
 #include "requests.hpp"
@@ -35,6 +39,143 @@
 
 #include "debug-options.hpp"
 
+namespace {
+
+struct RequestStats {
+	uint64_t count = 0;
+	uint64_t totalNanos = 0;
+	uint64_t maxNanos = 0;
+};
+
+// Requests are keyed by their bragi message ID.
+// CntRequests are distinguished by their request type instead.
+constexpr uint64_t cntRequestKeyBit = uint64_t(1) << 32;
+
+std::map<uint64_t, RequestStats> globalRequestStats;
+
+// Load of the request loops. Since each loop handles one request at a time,
+// the number of requests in flight is the number of processes that are
+// waiting for a reply (from posix itself or from other servers).
+struct RequestLoadStats {
+	uint64_t inFlight = 0;
+	uint64_t peakInFlight = 0;
+	uint64_t busyNanos = 0;
+	uint64_t busySince = 0;
+};
+
+RequestLoadStats globalRequestLoad;
+
+// Accounts the time until the current request is fully handled (including the time that
+// is spent waiting for other servers). This is an RAII object since the handlers
+// leave the dispatch loop through continue and break.
+struct RequestStatsScope {
+	RequestStatsScope(uint64_t key)
+	: stats_{&globalRequestStats[key]} {
+		HEL_CHECK(helGetClock(&start_));
+
+		auto &load = globalRequestLoad;
+		if(!load.inFlight++)
+			load.busySince = start_;
+		load.peakInFlight = std::max(load.peakInFlight, load.inFlight);
+	}
+
+	RequestStatsScope(const RequestStatsScope &) = delete;
+
+	~RequestStatsScope() {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		auto elapsed = now - start_;
+		stats_->count++;
+		stats_->totalNanos += elapsed;
+		stats_->maxNanos = std::max(stats_->maxNanos, elapsed);
+
+		auto &load = globalRequestLoad;
+		assert(load.inFlight);
+		if(!--load.inFlight)
+			load.busyNanos += now - load.busySince;
+	}
+
+	RequestStatsScope &operator= (const RequestStatsScope &) = delete;
+
+private:
+	RequestStats *stats_;
+	uint64_t start_;
+};
+
+// Size of the bounce buffer that posix uses for sendfile() and copy_file_range().
+constexpr size_t copyChunkSize = 64 * 1024;
+
+// Copies data between two files without involving the caller's address space.
+// Negative offsets denote the current file position.
+async::result<frg::expected<Error, size_t>> copyFileData(Process *process,
+		File *in, int64_t inOffset, File *out, int64_t outOffset, size_t size) {
+	std::vector<char> buffer(std::min(size, copyChunkSize));
+	size_t progress = 0;
+	while(progress < size) {
+		auto chunk = std::min(size - progress, buffer.size());
+
+		auto readResult = (inOffset >= 0)
+				? co_await in->pread(process, inOffset + progress, buffer.data(), chunk)
+				: co_await in->readSome(process, buffer.data(), chunk);
+		if(!readResult) {
+			if(progress)
+				break;
+			co_return readResult.error();
+		}
+		if(!readResult.value())
+			break;
+
+		auto writeResult = (outOffset >= 0)
+				? co_await out->pwrite(process, outOffset + progress,
+						buffer.data(), readResult.value())
+				: co_await out->writeAll(process, buffer.data(), readResult.value());
+		if(!writeResult) {
+			if(progress)
+				break;
+			co_return writeResult.error();
+		}
+		progress += writeResult.value();
+
+		if(writeResult.value() < readResult.value())
+			break;
+	}
+	co_return progress;
+}
+
+} // anonymous namespace
+
+std::string formatRequestLoad() {
+	std::stringstream stream;
+
+	// busy_ns is the time during which at least one request was in flight.
+	auto &load = globalRequestLoad;
+	auto busyNanos = load.busyNanos;
+	if(load.inFlight) {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		busyNanos += now - load.busySince;
+	}
+	stream << "in_flight peak_in_flight busy_ns\n";
+	stream << load.inFlight << " " << load.peakInFlight << " " << busyNanos << "\n";
+	return stream.str();
+}
+
+std::string formatRequestStats() {
+	std::stringstream stream;
+	stream << "request count total_ns avg_ns max_ns\n";
+	for(auto &[key, stats] : globalRequestStats) {
+		if(key & cntRequestKeyBit) {
+			stream << "cnt-" << (key & ~cntRequestKeyBit);
+		}else{
+			stream << "msg-" << key;
+		}
+		stream << " " << stats.count << " " << stats.totalNanos
+				<< " " << (stats.count ? stats.totalNanos / stats.count : 0)
+				<< " " << stats.maxNanos << "\n";
+	}
+	return stream.str();
+}
+
 async::result<void> serveRequests(std::shared_ptr<Process> self,
 		std::shared_ptr<Generation> generation) {
 	async::cancellation_token cancellation = generation->cancelServe;
@@ -69,7 +210,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -90,6 +231,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			req = *o;
 		}
 
+		RequestStatsScope statsScope{preamble.id() == managarm::posix::CntRequest::message_id
+				? cntRequestKeyBit | static_cast<uint64_t>(req.request_type())
+				: static_cast<uint64_t>(preamble.id())};
+
 		if(preamble.id() == bragi::message_id<managarm::posix::GetPidRequest>) {
 			auto req = bragi::parse_head_only<managarm::posix::GetPidRequest>(recv_head);
 			if (!req) {
@@ -105,7 +250,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				helix_ng::sendBragiHeadOnly(resp)
 			);
 			HEL_CHECK(sendResp.error());
 		}else if(preamble.id() == managarm::posix::GetPpidRequest::message_id) {
@@ -125,7 +270,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -146,7 +291,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -186,7 +331,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -226,7 +371,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -247,7 +392,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -348,7 +493,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				helix_ng::sendBragiHeadOnly(resp)
 			);
 			HEL_CHECK(sendResp.error());
 		}else if(req.request_type() == managarm::posix::CntReqType::WAIT) {
@@ -414,7 +559,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto [offer, hwSendResp, hwResp] = co_await helix_ng::exchangeMsgs(
 				getPmLane(),
 				helix_ng::offer(
-					helix_ng::sendBragiHeadOnly(hwRequest, frg::stl_allocator{}),
+					helix_ng::sendBragiHeadOnly(hwRequest),
 					helix_ng::recvInline()
 				)
 			);
@@ -513,17 +658,26 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(req->flags() & MAP_ANONYMOUS) {
 				assert(!req->rel_offset());
 
+				// Huge page mappings are backed by memory that is allocated in 2 MiB chunks.
+				size_t size = req->size();
+				uint32_t allocFlags = kHelAllocSwappable;
+				if(req->flags() & MAP_HUGETLB) {
+					size = (size + VmContext::hugePageSize - 1) & ~(VmContext::hugePageSize - 1);
+					allocFlags |= kHelAllocHugePages;
+					nativeFlags |= kHelMapPreferHugePages;
+				}
+
 				if(copyOnWrite) {
 					result = co_await self->vmContext()->mapFile(hint,
 							{}, nullptr,
-							0, req->size(), true, nativeFlags);
+							0, size, true, nativeFlags);
 				}else{
 					HelHandle handle;
-					HEL_CHECK(helAllocateMemory(req->size(), 0, nullptr, &handle));
+					HEL_CHECK(helAllocateMemory(size, allocFlags, nullptr, &handle));
 
 					result = co_await self->vmContext()->mapFile(hint,
 							helix::UniqueDescriptor{handle}, nullptr,
-							0, req->size(), false, nativeFlags);
+							0, size, false, nativeFlags);
 				}
 			}else{
 				auto file = self->fileContext()->getFile(req->fd());
@@ -552,7 +706,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				helix_ng::sendBragiHeadOnly(resp)
 			);
 			HEL_CHECK(sendResp.error());
 		}else if(req.request_type() == managarm::posix::CntReqType::VM_REMAP) {
@@ -700,7 +854,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 						conversation,
-						helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+						helix_ng::sendBragiHeadOnly(resp)
 					);
 
 			HEL_CHECK(send_resp.error());
@@ -1184,7 +1338,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				helix_ng::sendBragiHeadOnly(resp)
 			);
 			HEL_CHECK(sendResp.error());
 		}else if(preamble.id() == managarm::posix::RenameAtRequest::message_id) {
@@ -1415,7 +1569,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -1486,7 +1640,11 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				target_link = resolver.currentLink();
 			}
 
-			co_await target_link->getTarget()->chmod(req->mode());
+			auto result = co_await target_link->getTarget()->chmod(req->mode());
+			if(result == Error::readOnlyFileSystem) {
+				co_await sendErrorResponse(managarm::posix::Errors::READ_ONLY_FILE_SYSTEM);
+				continue;
+			}
 
 			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
 		}else if(preamble.id() == managarm::posix::UtimensAtRequest::message_id) {
@@ -1555,7 +1713,12 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				target = resolver.currentLink()->getTarget();
 			}
 
-			co_await target->utimensat(req->atimeSec(), req->atimeNsec(), req->mtimeSec(), req->mtimeNsec());
+			auto result = co_await target->utimensat(req->atimeSec(), req->atimeNsec(),
+					req->mtimeSec(), req->mtimeNsec());
+			if(result == Error::readOnlyFileSystem) {
+				co_await sendErrorResponse(managarm::posix::Errors::READ_ONLY_FILE_SYSTEM);
+				continue;
+			}
 
 			co_await sendErrorResponse(managarm::posix::Errors::SUCCESS);
 		}else if(preamble.id() == bragi::message_id<managarm::posix::ReadlinkAtRequest>) {
@@ -1849,6 +2012,10 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			if(req->flags() & managarm::posix::OpenFlags::OF_TRUNC) {
 				auto result = co_await file->truncate(0);
+				if(!result && result.error() == protocols::fs::Error::readOnlyFileSystem) {
+					co_await sendErrorResponse(managarm::posix::Errors::READ_ONLY_FILE_SYSTEM);
+					continue;
+				}
 				assert(result || result.error() == protocols::fs::Error::illegalOperationTarget);
 			}
 			int fd = self->fileContext()->attachFile(file,
@@ -1860,7 +2027,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 			HEL_CHECK(sendResp.error());
 		}else if(preamble.id() == bragi::message_id<managarm::posix::CloseRequest>) {
@@ -1889,7 +2056,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 			HEL_CHECK(sendResp.error());
 		}else if(req.request_type() == managarm::posix::CntReqType::DUP) {
@@ -2009,7 +2176,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 			HEL_CHECK(sendResp.error());
 		}else if(req.request_type() == managarm::posix::CntReqType::TTY_NAME) {
@@ -2145,6 +2312,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				}else if(result.error() == Error::directoryNotEmpty) {
 					co_await sendErrorResponse(managarm::posix::Errors::DIRECTORY_NOT_EMPTY);
 					continue;
+				}else if(result.error() == Error::readOnlyFileSystem) {
+					co_await sendErrorResponse(managarm::posix::Errors::READ_ONLY_FILE_SYSTEM);
+					continue;
 				}else{
 					std::cout << "posix: Unexpected failure from unlink()" << std::endl;
 					co_return;
@@ -2198,6 +2368,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				if(result.error() == Error::directoryNotEmpty) {
 					co_await sendErrorResponse(managarm::posix::Errors::DIRECTORY_NOT_EMPTY);
 					continue;
+				}else if(result.error() == Error::readOnlyFileSystem) {
+					co_await sendErrorResponse(managarm::posix::Errors::READ_ONLY_FILE_SYSTEM);
+					continue;
 				}
 
 				std::cout << "posix: Unexpected failure from rmdir()" << std::endl;
@@ -2446,7 +2619,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 				auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 				HEL_CHECK(send_resp.error());
@@ -2532,7 +2705,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -2586,7 +2759,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -2622,7 +2795,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -2693,7 +2866,8 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}else{
 				assert(req.timeout() > 0);
 				async::cancellation_event cancel_wait;
-				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
+				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait,
+						helix::defaultTimerSlack};
 				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
 				co_await timer.retire();
 			}
@@ -2795,6 +2969,9 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			if(ret == Error::noSuchFile) {
 				co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
 				continue;
+			}else if(ret == Error::illegalArguments) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
 			}
 			assert(ret == Error::success);
 
@@ -2866,7 +3043,8 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}else{
 				assert(req.timeout() > 0);
 				async::cancellation_event cancel_wait;
-				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait};
+				helix::TimeoutCancellation timer{static_cast<uint64_t>(req.timeout()), cancel_wait,
+						helix::defaultTimerSlack};
 				k = co_await epoll::wait(epfile.get(), events, 16, cancel_wait);
 				co_await timer.retire();
 			}
@@ -2962,11 +3140,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			assert(!(req->flags() & ~(managarm::posix::OpenFlags::OF_CLOEXEC | managarm::posix::OpenFlags::OF_NONBLOCK)));
 
-			// TODO: Implement blocking reads
-			if(!(req->flags() & managarm::posix::OpenFlags::OF_NONBLOCK))
-				std::cout << "posix: INOTIFY_CREATE doesn't do blocking reads" << std::endl;
-
-			auto file = inotify::createFile();
+			auto file = inotify::createFile(req->flags() & managarm::posix::OpenFlags::OF_NONBLOCK);
 			auto fd = self->fileContext()->attachFile(file,
 					req->flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
 
@@ -2976,7 +3150,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -3031,7 +3205,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -3067,7 +3241,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -3206,7 +3380,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -3238,7 +3412,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -3309,7 +3483,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -3340,7 +3514,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 
 			HEL_CHECK(send_resp.error());
@@ -3386,7 +3560,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 			HEL_CHECK(sendResp.error());
 		}else if(preamble.id() == managarm::posix::SetAffinityRequest::message_id) {
@@ -3435,7 +3609,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				helix_ng::sendBragiHeadOnly(resp)
 			);
 			HEL_CHECK(sendResp.error());
 		}else if(preamble.id() == managarm::posix::GetAffinityRequest::message_id) {
@@ -3486,10 +3660,134 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp, sendData] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+				helix_ng::sendBragiHeadOnly(resp),
 				helix_ng::sendBuffer(affinity.data(), affinity.size())
 			);
 			HEL_CHECK(sendResp.error());
+		}else if(preamble.id() == managarm::posix::SetSchedulerRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::SetSchedulerRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			if(logRequests)
+				std::cout << "posix: SET_SCHEDULER" << std::endl;
+
+			HelSchedulingParameters parameters{};
+			switch(req->policy()) {
+			case managarm::posix::SchedPolicy::OTHER:
+			case managarm::posix::SchedPolicy::BATCH:
+				parameters.policy = kHelSchedFair;
+				break;
+			case managarm::posix::SchedPolicy::IDLE:
+				parameters.policy = kHelSchedFair;
+				parameters.priority = -1;
+				break;
+			case managarm::posix::SchedPolicy::FIFO:
+				parameters.policy = kHelSchedFifo;
+				parameters.priority = req->priority();
+				break;
+			case managarm::posix::SchedPolicy::RR:
+				parameters.policy = kHelSchedRoundRobin;
+				parameters.priority = req->priority();
+				break;
+			case managarm::posix::SchedPolicy::DEADLINE:
+				parameters.policy = kHelSchedDeadline;
+				parameters.runtime = req->runtime();
+				parameters.deadline = req->deadline();
+				parameters.period = req->period();
+				break;
+			default:
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			// We do not support capabilities or RLIMIT_RTPRIO. Hence, only root may
+			// use real-time policies (which can starve the rest of the system)
+			// or change the policy of other processes.
+			bool privileged = self->euid() == 0;
+			if(parameters.policy != kHelSchedFair && !privileged) {
+				co_await sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
+				continue;
+			}
+
+			auto handle = self->threadDescriptor().getHandle();
+
+			if(req->pid() && self->pid() != req->pid()) {
+				if(!privileged) {
+					co_await sendErrorResponse(managarm::posix::Errors::INSUFFICIENT_PERMISSION);
+					continue;
+				}
+				auto target_process = self->findProcess(req->pid());
+				if(target_process == nullptr) {
+					co_await sendErrorResponse(managarm::posix::Errors::NO_SUCH_RESOURCE);
+					continue;
+				}
+				handle = target_process->threadDescriptor().getHandle();
+			}
+
+			HelError e = helSetScheduling(handle, &parameters);
+
+			if(e == kHelErrIllegalArgs) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			} else if(e != kHelErrNone) {
+				std::cout << "posix: SET_SCHEDULER hel call returned unexpected error: " << e << std::endl;
+				co_await sendErrorResponse(managarm::posix::Errors::INTERNAL_ERROR);
+				continue;
+			}
+
+			managarm::posix::SvrResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp)
+			);
+			HEL_CHECK(sendResp.error());
+		}else if(preamble.id() == managarm::posix::VmAdviseRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::VmAdviseRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			if(logRequests)
+				std::cout << "posix: VM_ADVISE address: " << (void *)req->address()
+						<< ", size: " << (void *)(size_t)req->size() << std::endl;
+
+			if(req->address() & 0xFFF) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			int advice;
+			switch(req->advice()) {
+			case managarm::posix::MemoryAdvice::MERGEABLE:
+				advice = kHelAdviseMergeable;
+				break;
+			case managarm::posix::MemoryAdvice::UNMERGEABLE:
+				advice = kHelAdviseUnmergeable;
+				break;
+			default:
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			self->vmContext()->adviseMemory(reinterpret_cast<void *>(req->address()),
+					req->size(), advice);
+
+			managarm::posix::SvrResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp)
+			);
+			HEL_CHECK(sendResp.error());
 		}else if(preamble.id() == managarm::posix::GetMemoryInformationRequest::message_id) {
 			auto req = bragi::parse_head_only<managarm::posix::GetMemoryInformationRequest>(recv_head);
 
@@ -3505,7 +3803,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			auto [offer, kerncfgSendResp, kerncfgResp] = co_await helix_ng::exchangeMsgs(
 				getKerncfgLane(),
 				helix_ng::offer(
-					helix_ng::sendBragiHeadOnly(kerncfgRequest, frg::stl_allocator{}),
+					helix_ng::sendBragiHeadOnly(kerncfgRequest),
 					helix_ng::recvInline()
 				)
 			);
@@ -3522,7 +3820,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 			auto [sendResp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				helix_ng::sendBragiHeadOnly(resp)
 			);
 			HEL_CHECK(sendResp.error());
 		}else if(preamble.id() == managarm::posix::SysconfRequest::message_id) {
@@ -3544,7 +3842,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 				auto [offer, kerncfgSendResp, kerncfgResp] = co_await helix_ng::exchangeMsgs(
 				getKerncfgLane(),
 				helix_ng::offer(
-						helix_ng::sendBragiHeadOnly(kerncfgRequest, frg::stl_allocator{}),
+						helix_ng::sendBragiHeadOnly(kerncfgRequest),
 						helix_ng::recvInline()
 					)
 				);
@@ -3562,10 +3860,191 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 			}
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				helix_ng::sendBragiHeadOnly(resp)
 			);
 
 			HEL_CHECK(send_resp.error());
+		}else if(preamble.id() == managarm::posix::CopyFileRangeRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::CopyFileRangeRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			if(logRequests)
+				std::cout << "posix: COPY_FILE_RANGE" << std::endl;
+
+			managarm::posix::CopyFileRangeResponse resp;
+
+			auto inFile = self->fileContext()->getFile(req->fd_in());
+			auto outFile = self->fileContext()->getFile(req->fd_out());
+			if(!inFile || !outFile) {
+				resp.set_error(managarm::posix::Errors::BAD_FD);
+			}else if(req->flags()) {
+				resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+			}else{
+				auto result = co_await copyFileData(self.get(), inFile.get(), req->offset_in(),
+						outFile.get(), req->offset_out(), req->size());
+				if(result) {
+					resp.set_error(managarm::posix::Errors::SUCCESS);
+					resp.set_size(result.value());
+				}else if(result.error() == Error::wouldBlock) {
+					resp.set_error(managarm::posix::Errors::WOULD_BLOCK);
+				}else if(result.error() == Error::brokenPipe) {
+					resp.set_error(managarm::posix::Errors::BROKEN_PIPE);
+				}else if(result.error() == Error::seekOnPipe) {
+					resp.set_error(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				}else{
+					resp.set_error(managarm::posix::Errors::ILLEGAL_OPERATION_TARGET);
+				}
+			}
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp)
+			);
+			HEL_CHECK(sendResp.error());
+		}else if(preamble.id() == managarm::posix::IoRingSetupRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::IoRingSetupRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			if(logRequests)
+				std::cout << "posix: IO_RING_SETUP " << req->entries() << std::endl;
+
+			if(!req->entries() || (req->flags() & ~managarm::posix::OpenFlags::OF_CLOEXEC)) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			auto file = io_ring::createFile(req->entries());
+			auto fd = self->fileContext()->attachFile(std::move(file),
+					req->flags() & managarm::posix::OpenFlags::OF_CLOEXEC);
+
+			managarm::posix::SvrResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_fd(fd);
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp)
+			);
+			HEL_CHECK(sendResp.error());
+		}else if(preamble.id() == managarm::posix::IoRingEnterRequest::message_id) {
+			auto req = bragi::parse_head_only<managarm::posix::IoRingEnterRequest>(recv_head);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			if(logRequests)
+				std::cout << "posix: IO_RING_ENTER" << std::endl;
+
+			auto file = self->fileContext()->getFile(req->fd());
+			if(!file) {
+				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
+				continue;
+			}
+
+			auto result = co_await io_ring::enter(file.get(), self,
+					req->to_submit(), req->min_complete());
+			assert(result);
+
+			managarm::posix::SvrResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_size(result.value());
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp)
+			);
+			HEL_CHECK(sendResp.error());
+		}else if(preamble.id() == managarm::posix::SpawnRequest::message_id) {
+			std::vector<std::byte> tail(preamble.tail_size());
+			auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+					conversation,
+					helix_ng::recvBuffer(tail.data(), tail.size())
+				);
+			HEL_CHECK(recv_tail.error());
+
+			auto req = bragi::parse_head_tail<managarm::posix::SpawnRequest>(recv_head, tail);
+
+			if (!req) {
+				std::cout << "posix: Rejecting request due to decoding failure" << std::endl;
+				break;
+			}
+
+			if(logRequests || logPaths)
+				std::cout << "posix: SPAWN " << req->path() << std::endl;
+
+			if(req->path().empty() || req->action_fds().size() != req->action_target_fds().size()) {
+				co_await sendErrorResponse(managarm::posix::Errors::ILLEGAL_ARGUMENTS);
+				continue;
+			}
+
+			// Apply the file actions to the child's FileContext only.
+			auto fileContext = FileContext::clone(self->fileContext());
+			bool actionsFailed = false;
+			for(size_t i = 0; i < req->action_fds().size(); i++) {
+				auto fd = req->action_fds()[i];
+				auto targetFd = req->action_target_fds()[i];
+				if(targetFd < 0 || targetFd >= FileContext::maxFileDescriptors) {
+					actionsFailed = true;
+					break;
+				}
+
+				if(fd < 0) {
+					if(fileContext->closeFile(targetFd) != Error::success) {
+						actionsFailed = true;
+						break;
+					}
+				}else{
+					auto file = fileContext->getFile(fd);
+					if(!file) {
+						actionsFailed = true;
+						break;
+					}
+					fileContext->attachFile(targetFd, std::move(file));
+				}
+			}
+			if(actionsFailed) {
+				co_await sendErrorResponse(managarm::posix::Errors::BAD_FD);
+				continue;
+			}
+
+			auto child = co_await Process::spawn(self, std::move(fileContext),
+					req->path(), req->args(), req->env());
+			if(!child) {
+				if(child.error() == Error::noSuchFile) {
+					co_await sendErrorResponse(managarm::posix::Errors::FILE_NOT_FOUND);
+				}else if(child.error() == Error::notDirectory) {
+					co_await sendErrorResponse(managarm::posix::Errors::NOT_A_DIRECTORY);
+				}else if(child.error() == Error::accessDenied) {
+					co_await sendErrorResponse(managarm::posix::Errors::ACCESS_DENIED);
+				}else if(child.error() == Error::badExecutable || child.error() == Error::eof) {
+					co_await sendErrorResponse(managarm::posix::Errors::BAD_EXECUTABLE);
+				}else{
+					std::cout << "posix: Unhandled error from Process::spawn: "
+							<< (int)child.error() << std::endl;
+					co_await sendErrorResponse(managarm::posix::Errors::INTERNAL_ERROR);
+				}
+				continue;
+			}
+
+			managarm::posix::SvrResponse resp;
+			resp.set_error(managarm::posix::Errors::SUCCESS);
+			resp.set_pid(child.value()->pid());
+
+			auto [sendResp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp)
+			);
+			HEL_CHECK(sendResp.error());
 		}else{
 			std::cout << "posix: Illegal request" << std::endl;
 			helix::SendBuffer send_resp;
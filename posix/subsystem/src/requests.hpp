@@ -5,5 +5,12 @@
 async::result<void> serveRequests(std::shared_ptr<Process> self,
 		std::shared_ptr<Generation> generation);
 
+// Returns per-request counters and latencies in a human readable form.
+std::string formatRequestStats();
+
+// Returns the number of requests in flight and the time during which
+// requests were in flight in a human readable form.
+std::string formatRequestLoad();
+
 helix::UniqueLane &getKerncfgLane();
 helix::UniqueLane &getPmLane();
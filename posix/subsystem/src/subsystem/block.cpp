@@ -4,6 +4,7 @@
 #include <string_view>
 #include <linux/fs.h>
 
+#include <bragi/helpers-std.hpp>
 #include <core/id-allocator.hpp>
 #include <protocols/mbus/client.hpp>
 
@@ -38,6 +39,10 @@ struct Device final : UnixDevice, drvcore::BlockDevice {
 		return _size;
 	}
 
+	helix::BorrowedLane lane() {
+		return _lane;
+	}
+
 	async::result<frg::expected<Error, smarter::shared_ptr<File, FileHandle>>>
 	open(std::shared_ptr<MountView> mount, std::shared_ptr<FsLink> link,
 			SemanticFlags semantic_flags) override {
@@ -85,6 +90,13 @@ struct SizeAttribute : sysfs::Attribute {
 	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
 };
 
+struct StatAttribute : sysfs::Attribute {
+	StatAttribute(std::string name)
+	: sysfs::Attribute{std::move(name), false} { }
+
+	async::result<frg::expected<Error, std::string>> show(sysfs::Object *object) override;
+};
+
 struct ManagarmRootAttribute : sysfs::Attribute {
 	ManagarmRootAttribute(std::string name)
 	: sysfs::Attribute{std::move(name), false} { }
@@ -95,6 +107,7 @@ struct ManagarmRootAttribute : sysfs::Attribute {
 ReadOnlyAttribute roAttr{"ro"};
 DevAttribute devAttr{"dev"};
 SizeAttribute sizeAttr{"size"};
+StatAttribute statAttr{"stat"};
 ManagarmRootAttribute managarmRootAttr{"managarm-root"};
 
 async::result<frg::expected<Error, std::string>> ReadOnlyAttribute::show(sysfs::Object *object) {
@@ -116,6 +129,42 @@ async::result<frg::expected<Error, std::string>> SizeAttribute::show(sysfs::Obje
 	co_return std::to_string(device->size() / 512) + "\n";
 }
 
+async::result<frg::expected<Error, std::string>> StatAttribute::show(sysfs::Object *object) {
+	auto device = static_cast<Device *>(object);
+
+	managarm::fs::GetIoStatsRequest req;
+
+	std::vector<std::byte> tail(256);
+	auto [offer, send_req, recv_resp, recv_tail] = co_await helix_ng::exchangeMsgs(
+		device->lane(),
+		helix_ng::offer(
+			helix_ng::sendBragiHeadOnly(req),
+			helix_ng::recvInline(),
+			helix_ng::recvBuffer(tail.data(), tail.size())
+		)
+	);
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+	HEL_CHECK(recv_tail.error());
+
+	tail.resize(recv_tail.actualLength());
+	auto resp = bragi::parse_head_tail<managarm::fs::GetIoStatsReply>(recv_resp, tail);
+	assert(resp);
+	if(resp->error() != managarm::fs::Errors::SUCCESS)
+		co_return Error::ioError;
+
+	// Like Linux, right-align the fields in columns.
+	std::string str;
+	for(auto value : resp->values()) {
+		auto field = std::to_string(value);
+		if(field.size() < 8)
+			str.append(8 - field.size(), ' ');
+		str += " " + field;
+	}
+	co_return str.substr(1) + "\n";
+}
+
 async::result<frg::expected<Error, std::string>> ManagarmRootAttribute::show(sysfs::Object *) {
 	co_return "1\n";
 }
@@ -190,6 +239,7 @@ async::detached observePartitions() {
 			device->realizeAttribute(&roAttr);
 			device->realizeAttribute(&devAttr);
 			device->realizeAttribute(&sizeAttr);
+			device->realizeAttribute(&statAttr);
 			if (std::get<mbus_ng::StringItem>(properties.at("unix.is-managarm-root")).value == "1")
 				device->realizeAttribute(&managarmRootAttr);
 		}
@@ -92,7 +92,7 @@ async::result<frg::expected<Error, std::string>> CapabilityAttribute::show(sysfs
 	auto [offer, send_ioctl_req, send_req, recv_resp, recv_data]
 			= co_await helix_ng::exchangeMsgs(lane,
 		helix_ng::offer(
-			helix_ng::sendBragiHeadOnly(ioctl_req, frg::stl_allocator{}),
+			helix_ng::sendBragiHeadOnly(ioctl_req),
 			helix_ng::sendBuffer(ser.data(), ser.size()),
 			helix_ng::recvInline(),
 			helix_ng::recvBuffer(buffer.data(), buffer.size() * sizeof(uint64_t))
@@ -97,11 +97,9 @@ struct Device final : drvcore::ClassDevice {
 		while(true) {
 			co_await _hwDevice.getBatteryState(_state, true);
 
-			drvcore::UeventProperties ue;
-			composeStandardUevent(ue);
-			composeUevent(ue);
-
-			drvcore::udev::emitChangeEvent(getSysfsPath(), ue);
+			// The uevent properties reflect the battery state.
+			invalidateUevent();
+			drvcore::udev::emitChangeEvent(this);
 		}
 	}
 
@@ -251,37 +251,42 @@ async::result<void> bindDevice(mbus_ng::Entity entity, mbus_ng::Properties prope
 		}
 	});
 
-	drvcore::registerMbusDevice(entity.id(), device);
-	drvcore::installDevice(device);
-	sysfsSubsystem->devicesObject()->createSymlink(sysfs_name, device);
+	{
+		// Multicast the uevents of the device and all of its interfaces together.
+		drvcore::udev::Batch ueventBatch;
 
-	for(auto interface : device->interfaces) {
-		if(interface->alternateSetting != 0) {
-			// TODO(no92): currently we don't support anything but bAlternateSetting 0
-			continue;
-		}
+		drvcore::registerMbusDevice(entity.id(), device);
+		drvcore::installDevice(device);
+		sysfsSubsystem->devicesObject()->createSymlink(sysfs_name, device);
 
-		drvcore::installDevice(interface);
-		sysfsSubsystem->devicesObject()->createSymlink(interface->sysfs_name, interface);
-
-		interface->realizeAttribute(&interfaceClassAttr);
-		interface->realizeAttribute(&interfaceSubClassAttr);
-		interface->realizeAttribute(&interfaceProtocolAttr);
-		interface->realizeAttribute(&alternateSettingAttr);
-		interface->realizeAttribute(&interfaceNumAttr);
-		interface->realizeAttribute(&numEndpointsAttr);
-		interface->createSymlink("subsystem", sysfsSubsystem->object());
-
-		for(auto ep : interface->endpoints) {
-			ep->addObject();
-
-			ep->realizeAttribute(&endpointAddressAttr);
-			ep->realizeAttribute(&prettyIntervalAttr);
-			ep->realizeAttribute(&intervalAttr);
-			ep->realizeAttribute(&lengthAttr);
-			ep->realizeAttribute(&epAttributesAttr);
-			ep->realizeAttribute(&epMaxPacketSizeAttr);
-			ep->realizeAttribute(&epTypeAttr);
+		for(auto interface : device->interfaces) {
+			if(interface->alternateSetting != 0) {
+				// TODO(no92): currently we don't support anything but bAlternateSetting 0
+				continue;
+			}
+
+			drvcore::installDevice(interface);
+			sysfsSubsystem->devicesObject()->createSymlink(interface->sysfs_name, interface);
+
+			interface->realizeAttribute(&interfaceClassAttr);
+			interface->realizeAttribute(&interfaceSubClassAttr);
+			interface->realizeAttribute(&interfaceProtocolAttr);
+			interface->realizeAttribute(&alternateSettingAttr);
+			interface->realizeAttribute(&interfaceNumAttr);
+			interface->realizeAttribute(&numEndpointsAttr);
+			interface->createSymlink("subsystem", sysfsSubsystem->object());
+
+			for(auto ep : interface->endpoints) {
+				ep->addObject();
+
+				ep->realizeAttribute(&endpointAddressAttr);
+				ep->realizeAttribute(&prettyIntervalAttr);
+				ep->realizeAttribute(&intervalAttr);
+				ep->realizeAttribute(&lengthAttr);
+				ep->realizeAttribute(&epAttributesAttr);
+				ep->realizeAttribute(&epMaxPacketSizeAttr);
+				ep->realizeAttribute(&epTypeAttr);
+			}
 		}
 	}
 
@@ -65,8 +65,18 @@ private:
 			assert(!await_interval.error() || await_interval.error() == kHelErrCancelled);
 			tick += timer->interval;
 
+			// If we woke up late, account for all intervals that elapsed in the meantime
+			// at once instead of waking up for each of them.
+			uint64_t now;
+			HEL_CHECK(helGetClock(&now));
+			uint64_t missed = 0;
+			if(now >= tick) {
+				missed = (now - tick) / timer->interval + 1;
+				tick += missed * timer->interval;
+			}
+
 			if(_activeTimer == timer) {
-				_expirations++;
+				_expirations += 1 + missed;
 				_theSeq++;
 				_seqBell.raise();
 			}else{
@@ -88,9 +98,7 @@ public:
 
 	OpenFile(bool non_block)
 	: File{StructName::get("timerfd"), nullptr, SpecialLink::makeSpecialLink(VfsType::regular, 0777)}, _nonBlock{non_block},
-			_activeTimer{nullptr}, _expirations{0}, _theSeq{0} {
-		(void)_nonBlock;
-	}
+			_activeTimer{nullptr}, _expirations{0}, _theSeq{0} { }
 
 	~OpenFile() {
 		// Nothing to do here.
@@ -103,8 +111,16 @@ public:
 
 	async::result<frg::expected<Error, size_t>>
 	readSome(Process *, void *data, size_t max_length) override {
-		assert(max_length == sizeof(uint64_t));
-		assert(_expirations);
+		if(max_length < sizeof(uint64_t))
+			co_return Error::illegalArguments;
+
+		while(!_expirations) {
+			if(_nonBlock)
+				co_return Error::wouldBlock;
+			if(!isOpen())
+				co_return Error::fileClosed;
+			co_await _seqBell.async_wait();
+		}
 
 		memcpy(data, &_expirations, sizeof(uint64_t));
 		_expirations = 0;
@@ -1,6 +1,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <set>
+#include <vector>
 
 #include <helix/memory.hpp>
 #include <helix/passthrough-fd.hpp>
@@ -480,10 +481,87 @@ struct MemoryNode final : Node {
 	}
 
 private:
+	static constexpr size_t pageSize = 0x1000;
+	static constexpr size_t hugePageSize = 0x200000;
+
+	bool _isPopulated(size_t page) {
+		if(_exposed)
+			return true;
+		if(page / 64 >= _populated.size())
+			return false;
+		return _populated[page / 64] & (uint64_t(1) << (page % 64));
+	}
+
+	void _markPopulated(size_t page) {
+		if(page / 64 >= _populated.size())
+			_populated.resize(page / 64 + 1);
+		_populated[page / 64] |= uint64_t(1) << (page % 64);
+	}
+
+	void _markUnpopulated(size_t page) {
+		if(page / 64 >= _populated.size())
+			return;
+		_populated[page / 64] &= ~(uint64_t(1) << (page % 64));
+	}
+
+	// Reads from pages that were never written (i.e., holes) return zeros
+	// without touching (and thus allocating) the underlying memory.
+	void _readData(size_t offset, void *buffer, size_t length) {
+		auto base = reinterpret_cast<char *>(_mapping.get());
+		auto dest = reinterpret_cast<char *>(buffer);
+		size_t progress = 0;
+		while(progress < length) {
+			auto page = (offset + progress) / pageSize;
+			auto misalign = (offset + progress) % pageSize;
+			auto chunk = std::min(length - progress, pageSize - misalign);
+			if(_isPopulated(page)) {
+				memcpy(dest + progress, base + offset + progress, chunk);
+			}else{
+				memset(dest + progress, 0, chunk);
+			}
+			progress += chunk;
+		}
+	}
+
+	void _writeData(size_t offset, const void *buffer, size_t length) {
+		auto base = reinterpret_cast<char *>(_mapping.get());
+		auto src = reinterpret_cast<const char *>(buffer);
+		size_t progress = 0;
+		while(progress < length) {
+			auto page = (offset + progress) / pageSize;
+			auto misalign = (offset + progress) % pageSize;
+			auto chunk = std::min(length - progress, pageSize - misalign);
+			if(!_isPopulated(page)) {
+				// The page might contain stale data from before a truncate().
+				if(chunk < pageSize)
+					memset(base + page * pageSize, 0, pageSize);
+				_markPopulated(page);
+			}
+			memcpy(base + offset + progress, src + progress, chunk);
+			progress += chunk;
+		}
+	}
+
 	void _resizeFile(size_t new_size) {
+		if(new_size < _fileSize) {
+			// Make sure that the truncated part reads as zeros if the file grows again.
+			if(_exposed) {
+				memset(reinterpret_cast<char *>(_mapping.get()) + new_size, 0,
+						_fileSize - new_size);
+			}else{
+				auto first = (new_size + pageSize - 1) / pageSize;
+				auto last = (_fileSize + pageSize - 1) / pageSize;
+				for(size_t page = first; page < last; ++page)
+					_markUnpopulated(page);
+				if((new_size % pageSize) && _isPopulated(new_size / pageSize))
+					memset(reinterpret_cast<char *>(_mapping.get()) + new_size, 0,
+							pageSize - new_size % pageSize);
+			}
+		}
 		_fileSize = new_size;
 
-		size_t aligned_size = (new_size + 0xFFF) & ~size_t(0xFFF);
+		size_t granularity = _hugePages ? hugePageSize : pageSize;
+		size_t aligned_size = (new_size + granularity - 1) & ~(granularity - 1);
 		if(aligned_size <= _areaSize)
 			return;
 
@@ -491,7 +569,8 @@ private:
 			HEL_CHECK(helResizeMemory(_memory.getHandle(), aligned_size));
 		}else{
 			HelHandle handle;
-			HEL_CHECK(helAllocateMemory(aligned_size, 0, nullptr, &handle));
+			HEL_CHECK(helAllocateMemory(aligned_size,
+					_hugePages ? kHelAllocHugePages : kHelAllocSwappable, nullptr, &handle));
 			_memory = helix::UniqueDescriptor{handle};
 		}
 
@@ -503,6 +582,15 @@ private:
 	helix::Mapping _mapping;
 	size_t _areaSize;
 	size_t _fileSize;
+
+	// Bitmap of pages that have been written through posix.
+	// Once the memory object is handed out via accessMemory(), we cannot observe
+	// writes anymore; from then on, all pages are considered to be populated.
+	std::vector<uint64_t> _populated;
+	bool _exposed = false;
+
+	// Back the file by 2 MiB chunks. This is decided when the memory object is created.
+	bool _hugePages = false;
 };
 
 struct Superblock final : FsSuperblock {
@@ -579,7 +667,7 @@ MemoryFile::readSome(Process *, void *buffer, size_t max_length) {
 		co_return 0;
 	auto chunk = std::min(node->_fileSize - _offset, max_length);
 
-	memcpy(buffer, reinterpret_cast<char *>(node->_mapping.get()) + _offset, chunk);
+	node->_readData(_offset, buffer, chunk);
 	_offset += chunk;
 
 	co_return chunk;
@@ -592,7 +680,7 @@ MemoryFile::writeAll(Process *, const void *buffer, size_t length) {
 	if(_offset + length > node->_fileSize)
 		node->_resizeFile(_offset + length);
 
-	memcpy(reinterpret_cast<char *>(node->_mapping.get()) + _offset, buffer, length);
+	node->_writeData(_offset, buffer, length);
 	_offset += length;
 	co_return length;
 }
@@ -605,7 +693,7 @@ MemoryFile::pread(Process *, int64_t offset, void *buffer, size_t length) {
 		co_return 0;
 	auto chunk = std::min(node->_fileSize - offset, length);
 
-	memcpy(buffer, reinterpret_cast<char *>(node->_mapping.get()) + offset, chunk);
+	node->_readData(offset, buffer, chunk);
 
 	co_return chunk;
 }
@@ -617,7 +705,7 @@ MemoryFile::pwrite(Process *, int64_t offset, const void *buffer, size_t length)
 	if(offset + length > node->_fileSize)
 		node->_resizeFile(offset + length);
 
-	memcpy(reinterpret_cast<char *>(node->_mapping.get()) + offset, buffer, length);
+	node->_writeData(offset, buffer, length);
 	co_return length;
 }
 
@@ -638,6 +726,9 @@ MemoryFile::allocate(int64_t offset, size_t size) {
 	// TODO: Careful about overflow.
 	if(offset + size <= node->_fileSize)
 		co_return {};
+	// Large preallocations are likely to be used densely; back them by huge pages.
+	if(!node->_memory && offset + size >= MemoryNode::hugePageSize)
+		node->_hugePages = true;
 	node->_resizeFile(offset + size);
 	co_return {};
 }
@@ -645,6 +736,7 @@ MemoryFile::allocate(int64_t offset, size_t size) {
 FutureMaybe<helix::UniqueDescriptor>
 MemoryFile::accessMemory() {
 	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
+	node->_exposed = true;
 	co_return node->_memory.dup();
 }
 
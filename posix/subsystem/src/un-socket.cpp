@@ -21,6 +21,9 @@ namespace un_socket {
 
 static constexpr bool logSockets = false;
 
+// Stream data is coalesced into the last queued packet up to this size.
+static constexpr size_t maxCoalescedPacketSize = 64 * 1024;
+
 struct OpenFile;
 
 // This map associates bound sockets with FS nodes.
@@ -128,14 +131,25 @@ public:
 
 		auto packet = &_recvQueue.front();
 		if(socktype_ == SOCK_STREAM) {
-			assert(packet->files.empty());
-
-			auto chunk = std::min(packet->buffer.size() - packet->offset, max_length);
-			memcpy(data, packet->buffer.data() + packet->offset, chunk);
-			packet->offset += chunk;
-			if(packet->offset == packet->buffer.size())
-				_recvQueue.pop_front();
-			co_return chunk;
+			// Drain as many packets as fit into the buffer to save round trips.
+			size_t progress = 0;
+			while(progress < max_length && !_recvQueue.empty()) {
+				packet = &_recvQueue.front();
+				// Files are only delivered through recvMsg().
+				if(progress && !packet->files.empty())
+					break;
+				assert(packet->files.empty());
+
+				auto chunk = std::min(packet->buffer.size() - packet->offset,
+						max_length - progress);
+				memcpy(reinterpret_cast<char *>(data) + progress,
+						packet->buffer.data() + packet->offset, chunk);
+				packet->offset += chunk;
+				progress += chunk;
+				if(packet->offset == packet->buffer.size())
+					_recvQueue.pop_front();
+			}
+			co_return progress;
 		} else {
 			assert(!packet->offset);
 			assert(packet->files.empty());
@@ -155,15 +169,7 @@ public:
 		if(logSockets)
 			std::cout << "posix: Write to socket \e[1;34m" << structName() << "\e[0m" << std::endl;
 
-		Packet packet;
-		packet.senderPid = process->pid();
-		packet.buffer.resize(length);
-		memcpy(packet.buffer.data(), data, length);
-		packet.offset = 0;
-
-		_remote->_recvQueue.push_back(std::move(packet));
-		_remote->_inSeq = ++_remote->_currentSeq;
-		_remote->_statusBell.raise();
+		_deliver(data, length, process->pid(), process->uid(), process->gid(), {});
 		co_return length;
 	}
 
@@ -246,22 +252,47 @@ public:
 		// We ignore MSG_DONTWAIT here as we never block anyway.
 
 		// TODO: Add permission checking for ucred related items
-		Packet packet;
-		packet.senderPid = ucreds.pid;
-		packet.senderUid = ucreds.uid;
-		packet.senderGid = ucreds.gid;
-		packet.buffer.resize(max_length);
-		memcpy(packet.buffer.data(), data, max_length);
-		packet.files = std::move(files);
-		packet.offset = 0;
-
-		_remote->_recvQueue.push_back(std::move(packet));
+		_deliver(data, max_length, ucreds.pid, ucreds.uid, ucreds.gid, std::move(files));
+		co_return max_length;
+	}
+
+private:
+	// Queues data on the remote's receive queue.
+	// For stream sockets, data without attached files is appended to the last packet
+	// if that packet comes from the same sender and carries no files either.
+	// This avoids one allocation per write for bulk transfers.
+	void _deliver(const void *data, size_t length, int pid, unsigned int uid, unsigned int gid,
+			std::vector<smarter::shared_ptr<File, FileHandle>> files) {
+		auto bytes = reinterpret_cast<const char *>(data);
+		auto &queue = _remote->_recvQueue;
+
+		bool coalesce = false;
+		if(socktype_ == SOCK_STREAM && files.empty() && !queue.empty()) {
+			auto &tail = queue.back();
+			coalesce = tail.files.empty()
+					&& tail.senderPid == pid && tail.senderUid == uid && tail.senderGid == gid
+					&& tail.buffer.size() + length <= maxCoalescedPacketSize;
+		}
+
+		if(coalesce) {
+			auto &tail = queue.back();
+			tail.buffer.insert(tail.buffer.end(), bytes, bytes + length);
+		}else{
+			Packet packet;
+			packet.senderPid = pid;
+			packet.senderUid = uid;
+			packet.senderGid = gid;
+			packet.buffer.assign(bytes, bytes + length);
+			packet.files = std::move(files);
+			packet.offset = 0;
+			queue.push_back(std::move(packet));
+		}
+
 		_remote->_inSeq = ++_remote->_currentSeq;
 		_remote->_statusBell.raise();
-
-		co_return max_length;
 	}
 
+public:
 	async::result<int> getOption(int option) override {
 		assert(option == SO_PEERCRED);
 		if (_currentState != State::connected)
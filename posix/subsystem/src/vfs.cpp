@@ -261,14 +261,25 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 		}else{
 			if (_currentPath.second->getTarget()->hasTraverseLinks()) {
 				_components.push_front(name);
-				std::string end;
 
-				if (flags & resolvePrefix) {
-					end = _components.back();
-					_components.pop_back();
+				// Hand all components up to the next "." or ".." to the file system in a
+				// single request. Those components are handled by the VFS since ".." can
+				// cross mount points (and the server cannot map them to inodes for us).
+				// Mount points and symlinks within the batch are handled by the server,
+				// which stops at obstructed links and symlinks.
+				size_t batchEnd = _components.size();
+				if (flags & resolvePrefix)
+					batchEnd--;
+				std::deque<std::string> batch;
+				for (size_t i = 0; i < batchEnd; i++) {
+					if (_components[i] == "." || _components[i] == "..")
+						break;
+					batch.push_back(_components[i]);
 				}
+				assert(!batch.empty());
 
-				auto result = co_await _currentPath.second->getTarget()->traverseLinks(_components);
+				auto result = co_await _currentPath.second->getTarget()->traverseLinks(
+						std::move(batch));
 
 				if (!result) {
 					assert(result.error() == Error::illegalOperationTarget
@@ -287,10 +298,6 @@ async::result<frg::expected<protocols::fs::Error, void>> PathResolver::resolve(R
 
 				auto [child, nLinks] = result.value();
 
-				if (flags & resolvePrefix) {
-					_components.push_back(end);
-				}
-
 				assert(nLinks <= _components.size());
 
 				while (nLinks--)
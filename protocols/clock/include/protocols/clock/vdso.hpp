@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+#include <protocols/clock/defs.hpp>
+
+// Helpers to read clocks without IPC or system calls. Both pages are provided
+// to processes by posix (see ManagarmProcessData); they are mapped read-only.
+
+namespace protocols::clock {
+
+// Reads the TSC and the index of the current CPU (as set up by the kernel).
+// Returns false if the clock page does not allow this.
+inline bool readTscAndCpu(const HelClockPage *page, uint64_t *tsc, unsigned int *cpu) {
+#if defined(__x86_64__)
+	if(!page || !(__atomic_load_n(&page->flags, __ATOMIC_RELAXED) & kHelClockTscAuxIsCpu))
+		return false;
+	uint32_t lsw, msw, aux;
+	asm volatile ("rdtscp" : "=a"(lsw), "=d"(msw), "=c"(aux));
+	*tsc = (static_cast<uint64_t>(msw) << 32) | lsw;
+	*cpu = aux;
+	return true;
+#else
+	(void)page;
+	(void)tsc;
+	(void)cpu;
+	return false;
+#endif
+}
+
+// Computes the value of helGetClock() without a system call if possible.
+inline uint64_t getSystemClock(const HelClockPage *page) {
+	while(page) {
+		auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_ACQUIRE);
+		if(seqlock & 1)
+			continue;
+		if(__atomic_load_n(&page->mode, __ATOMIC_RELAXED) != kHelClockModeTsc)
+			break;
+
+		uint64_t tsc;
+		unsigned int cpu;
+		if(!readTscAndCpu(page, &tsc, &cpu) || cpu >= kHelClockPageMaxCpus)
+			break;
+		auto ticksPerMilli = __atomic_load_n(&page->cpus[cpu].tscTicksPerMilli, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&page->seqlock, __ATOMIC_RELAXED) != seqlock)
+			continue;
+		if(!ticksPerMilli)
+			break;
+
+		// This must match the computation of the kernel's clock source.
+		return (tsc / ticksPerMilli) * 1'000'000
+				+ (tsc % ticksPerMilli) * 1'000'000 / ticksPerMilli;
+	}
+
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+// Like getcpu(). Falls back to a system call if the CPU cannot be determined otherwise.
+inline unsigned int getCpu(const HelClockPage *page) {
+	uint64_t tsc;
+	unsigned int cpu;
+	if(readTscAndCpu(page, &tsc, &cpu))
+		return cpu;
+
+	int current;
+	HEL_CHECK(helGetCurrentCpu(&current));
+	return current;
+}
+
+// Like clock_gettime(). Returns false if the clock is not supported.
+inline bool getTime(const HelClockPage *clockPage, const TrackerPage *trackerPage,
+		clockid_t clock, struct timespec *ts) {
+	int64_t nanos;
+	if(clock == CLOCK_MONOTONIC || clock == CLOCK_MONOTONIC_RAW
+			|| clock == CLOCK_MONOTONIC_COARSE || clock == CLOCK_BOOTTIME) {
+		// We do not support suspend or clock slewing, hence these clocks coincide.
+		nanos = getSystemClock(clockPage);
+	}else if(clock == CLOCK_REALTIME || clock == CLOCK_REALTIME_COARSE) {
+		if(!trackerPage)
+			return false;
+		while(true) {
+			auto seqlock = __atomic_load_n(&trackerPage->seqlock, __ATOMIC_ACQUIRE);
+			if(seqlock & 1)
+				continue;
+
+			auto ref = __atomic_load_n(&trackerPage->refClock, __ATOMIC_RELAXED);
+			auto base = __atomic_load_n(&trackerPage->baseRealtime, __ATOMIC_RELAXED);
+
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if(__atomic_load_n(&trackerPage->seqlock, __ATOMIC_RELAXED) != seqlock)
+				continue;
+
+			nanos = base + (static_cast<int64_t>(getSystemClock(clockPage)) - ref);
+			break;
+		}
+	}else{
+		return false;
+	}
+
+	ts->tv_sec = nanos / 1'000'000'000;
+	ts->tv_nsec = nanos % 1'000'000'000;
+	return true;
+}
+
+} // namespace protocols::clock
@@ -3,6 +3,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <unordered_map>
 
 #include <async/result.hpp>
@@ -29,8 +30,19 @@ struct File {
 	async::result<void> seekAbsolute(int64_t offset);
 
 	async::result<size_t> readSome(void *data, size_t max_length);
+
+	// Reads at the given offset without changing the file offset.
+	async::result<frg::expected<Error, size_t>> pread(int64_t offset, void *data, size_t length);
 	async::result<size_t> writeSome(const void *data, size_t max_length);
 
+	// Vectored variants of readSome() and writeSome(). Each of these issues a single request.
+	async::result<size_t> readSomeVectored(const struct iovec *iov, size_t iovCount);
+	async::result<size_t> writeSomeVectored(const struct iovec *iov, size_t iovCount);
+
+	// Reads directory entries in the format of DirentBuilder; returns zero at the end of
+	// the directory and Error::illegalOperationTarget if the server lacks PT_READ_DIRENTS.
+	async::result<frg::expected<Error, size_t>> readDirents(void *data, size_t length);
+
 	async::result<frg::expected<Error, PollWaitResult>>
 	pollWait(uint64_t sequence, int mask, async::cancellation_token cancellation = {});
 
@@ -40,6 +52,9 @@ struct File {
 	async::result<helix::UniqueDescriptor> accessMemory();
 
 private:
+	// Used by writeSome() for writes of at least windowedWriteThreshold bytes.
+	async::result<size_t> _writeSomeWindowed(const void *data, size_t max_length);
+
 	helix::UniqueDescriptor _lane;
 };
 
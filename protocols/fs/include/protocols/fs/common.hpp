@@ -1,8 +1,11 @@
 #pragma once
 
 #include <optional>
+#include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <string>
+#include <string_view>
 #include <sys/socket.h>
 #include <variant>
 #include <vector>
@@ -12,6 +15,15 @@
 namespace protocols {
 namespace fs {
 
+// Maximal number of descriptors that are transferred by a single submission
+// when a request returns a variable number of nodes (e.g., NodeTraverseLinksRequest).
+inline constexpr size_t maxDescriptorBatch = 64;
+
+// Writes of at least this many bytes pass the payload as a window of the client's
+// buffer (see CntRequest::windowed). This allows servers to copy the payload
+// directly to its destination (e.g., the page cache) instead of receiving it first.
+inline constexpr size_t windowedWriteThreshold = 64 * 1024;
+
 enum class Error {
 	none = 0,
 	fileNotFound = 1,
@@ -40,6 +52,8 @@ enum class Error {
 	invalidProtocolOption = 25,
 	directoryNotEmpty = 26,
 	connectionRefused = 27,
+	deadlock = 28,
+	readOnlyFileSystem = 29,
 };
 
 inline managarm::fs::Errors mapFsError(Error e) {
@@ -70,6 +84,8 @@ inline managarm::fs::Errors mapFsError(Error e) {
 		case Error::invalidProtocolOption: return managarm::fs::Errors::INVALID_PROTOCOL_OPTION;
 		case Error::directoryNotEmpty: return managarm::fs::Errors::DIRECTORY_NOT_EMPTY;
 		case Error::connectionRefused: return managarm::fs::Errors::CONNECTION_REFUSED;
+		case Error::deadlock: return managarm::fs::Errors::DEADLOCK;
+		case Error::readOnlyFileSystem: return managarm::fs::Errors::READ_ONLY_FILE_SYSTEM;
 	}
 }
 
@@ -81,6 +97,25 @@ using PollResult = std::tuple<uint64_t, int, int>;
 using PollWaitResult = std::tuple<uint64_t, int>;
 using PollStatusResult = std::tuple<uint64_t, int>;
 
+enum class RangeLockType {
+	read,
+	write,
+	unlock
+};
+
+// A byte-range lock request (or a lock that conflicts with one).
+// end is exclusive; UINT64_MAX extends the range to the end of the file.
+struct RangeLockRequest {
+	RangeLockType type;
+	uint64_t start;
+	uint64_t end;
+	// Open file description locks are owned by the file instead of the process.
+	bool ofd = false;
+	// Owner of POSIX locks. For OFD locks, this is only reported back (as -1).
+	int64_t pid = -1;
+	bool wait = false;
+};
+
 struct RecvData {
 	std::vector<char> ctrl;
 	size_t dataLength;
@@ -130,4 +165,46 @@ private:
 	size_t _offset;
 };
 
+// Builds the response of PT_READ_DIRENTS. Records have the layout of struct linux_dirent64
+// (such that clients can copy them into the buffer of getdents64() as-is):
+// uint64_t inode, int64_t next offset, uint16_t record length, uint8_t DT_* type
+// and a NUL-terminated name, padded to a multiple of 8 bytes.
+struct DirentBuilder {
+	static constexpr size_t headerSize = 19;
+
+	DirentBuilder(void *buffer, size_t max_size)
+	: _buffer{static_cast<char *>(buffer)}, _maxSize{max_size}, _offset{0} { }
+
+	static size_t recordLength(size_t name_length) {
+		return (headerSize + name_length + 1 + 7) & ~size_t(7);
+	}
+
+	// Returns false (and does not write anything) if the entry does not fit.
+	bool append(uint64_t inode, int64_t next_offset, uint8_t type, std::string_view name) {
+		auto length = recordLength(name.size());
+		if(_offset + length > _maxSize)
+			return false;
+
+		auto record = _buffer + _offset;
+		auto reclen = static_cast<uint16_t>(length);
+		memcpy(record, &inode, sizeof(uint64_t));
+		memcpy(record + 8, &next_offset, sizeof(int64_t));
+		memcpy(record + 16, &reclen, sizeof(uint16_t));
+		memcpy(record + 18, &type, sizeof(uint8_t));
+		memcpy(record + headerSize, name.data(), name.size());
+		memset(record + headerSize + name.size(), 0, length - headerSize - name.size());
+		_offset += length;
+		return true;
+	}
+
+	size_t size() const {
+		return _offset;
+	}
+
+private:
+	char *_buffer;
+	size_t _maxSize;
+	size_t _offset;
+};
+
 } } // namespace protocols::fs
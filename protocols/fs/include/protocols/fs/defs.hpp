@@ -4,11 +4,29 @@
 
 namespace protocols::fs {
 
+enum StatusPageFlags : int {
+	// The page contains the edge sequences and the futex below; otherwise, only
+	// sequence and status are valid.
+	statusPageHasEdges = 1
+};
+
+// Page that servers share with posix (see FC_STATUS_PAGE), such that posix can
+// answer poll requests without a round-trip to the server.
+// All fields except futex and watched are protected by seqlock.
 struct StatusPage {
 	uint64_t seqlock;
 	uint64_t sequence;
 	int flags;
 	int status;
+	// Sequences of the last EPOLLIN, EPOLLOUT and EPOLLHUP edges (if statusPageHasEdges).
+	uint64_t inSequence;
+	uint64_t outSequence;
+	uint64_t hupSequence;
+	// Incremented after each update. If watched is non-zero, the server calls
+	// helFutexWake() on futex. Both accesses are sequentially consistent; the reader
+	// sets watched before it inspects futex, such that wakeups are never lost.
+	int32_t futex;
+	int32_t watched;
 };
 
 } // namespace protocols::fs
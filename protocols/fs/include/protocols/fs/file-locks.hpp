@@ -1,8 +1,12 @@
 #pragma once
 
+#include <optional>
+#include <vector>
 #include <protocols/fs/server.hpp>
 #include <boost/intrusive/list.hpp>
+#include <async/oneshot-event.hpp>
 #include <async/recurring-event.hpp>
+#include <frg/rbtree.hpp>
 
 namespace protocols::fs {
 
@@ -35,4 +39,134 @@ private:
 		static bool validateFlockFlags(int flags);
 	};
 
+	struct RangeLockManager;
+
+	// Locks are owned by processes (POSIX locks) or by open file descriptions (OFD locks).
+	struct RangeLockOwner {
+		uintptr_t id;
+		bool ofd;
+
+		bool operator== (const RangeLockOwner &) const = default;
+	};
+
+	// Per-open-file state of byte-range locks. When the file is closed, this releases
+	// its OFD locks and the POSIX locks of all processes that locked through it.
+	struct RangeLockFile {
+		friend struct RangeLockManager;
+
+		RangeLockFile() = default;
+
+		RangeLockFile(const RangeLockFile &) = delete;
+
+		RangeLockFile &operator= (const RangeLockFile &) = delete;
+
+		~RangeLockFile();
+
+	private:
+		RangeLockManager *_manager = nullptr;
+		// Processes that acquired POSIX locks through this file.
+		std::vector<int64_t> _pids;
+	};
+
+	struct RangeLock {
+		RangeLockOwner owner;
+		RangeLockType type;
+		uint64_t start;
+		uint64_t end;
+		int64_t pid;
+
+		frg::rbtree_hook treeNode;
+		// Maximal end of all locks in the subtree.
+		uint64_t maxEnd = 0;
+	};
+
+	struct RangeLockLess {
+		bool operator() (const RangeLock &a, const RangeLock &b) {
+			return a.start < b.start;
+		}
+	};
+
+	struct RangeLockAggregator;
+
+	using RangeLockTree = frg::rbtree<
+		RangeLock,
+		&RangeLock::treeNode,
+		RangeLockLess,
+		RangeLockAggregator
+	>;
+
+	struct RangeLockAggregator {
+		static bool aggregate(RangeLock *node);
+		static bool check_invariant(RangeLockTree &, RangeLock *) {
+			return true;
+		}
+	};
+
+	// fcntl() byte-range locks of a single file. The locks are kept in an interval tree
+	// (ordered by start and augmented by the maximal end of each subtree).
+	// Waiters only wake up when a range that overlaps their request is unlocked.
+	struct RangeLockManager {
+		struct Waiter {
+			RangeLockManager *manager;
+			RangeLockOwner owner;
+			RangeLockType type;
+			uint64_t start;
+			uint64_t end;
+			async::oneshot_event event;
+			boost::intrusive::list_member_hook<> hook;
+		};
+
+		RangeLockManager() = default;
+
+		RangeLockManager(const RangeLockManager &) = delete;
+
+		RangeLockManager &operator= (const RangeLockManager &) = delete;
+
+		~RangeLockManager();
+
+		// Acquires, converts or releases (parts of) locks. Existing locks of the same owner
+		// are split and merged as necessary. Fails with Error::deadlock if waiting for the
+		// lock would close a cycle of waiting processes.
+		async::result<Error> lock(RangeLockFile *file, RangeLockRequest request);
+
+		// Returns the first lock that conflicts with the request (F_GETLK).
+		std::optional<RangeLockRequest> test(RangeLockFile *file, RangeLockRequest request);
+
+		// Releases all locks of the owner.
+		void release(RangeLockOwner owner);
+
+	private:
+		static RangeLockOwner _ownerOf(RangeLockFile *file, const RangeLockRequest &request);
+
+		// Returns all locks that overlap [start, end).
+		std::vector<RangeLock *> _overlapping(uint64_t start, uint64_t end);
+
+		// Returns the locks that conflict with a request of the given owner.
+		std::vector<RangeLock *> _conflicting(RangeLockOwner owner, RangeLockType type,
+				uint64_t start, uint64_t end);
+
+		// Removes the locks of the owner from [start, end).
+		void _unlockRange(RangeLockOwner owner, uint64_t start, uint64_t end);
+
+		void _insert(RangeLock *lock);
+		void _remove(RangeLock *lock);
+
+		// Wakes the waiters whose requests overlap [start, end).
+		void _wake(uint64_t start, uint64_t end);
+
+		// Returns true if the owner (transitively) waits for target.
+		static bool _waitsFor(RangeLockOwner owner, RangeLockOwner target,
+				std::vector<RangeLockOwner> &visited);
+
+		RangeLockTree _tree;
+		boost::intrusive::list<
+			Waiter,
+			boost::intrusive::member_hook<
+				Waiter,
+				boost::intrusive::list_member_hook<>,
+				&Waiter::hook
+			>
+		> _waiters;
+	};
+
 }
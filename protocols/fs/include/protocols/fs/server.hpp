@@ -82,10 +82,25 @@ struct FileOperations {
 		pwrite = f;
 		return *this;
 	}
+	constexpr FileOperations &withWriteFromWindow(async::result<frg::expected<protocols::fs::Error, size_t>> (*f)(void *object,
+			const char *, helix::BorrowedDescriptor window, size_t length)) {
+		writeFromWindow = f;
+		return *this;
+	}
+	constexpr FileOperations &withPwriteFromWindow(async::result<frg::expected<protocols::fs::Error, size_t>> (*f)(void *object,
+			int64_t offset, const char *, helix::BorrowedDescriptor window, size_t length)) {
+		pwriteFromWindow = f;
+		return *this;
+	}
 	constexpr FileOperations &withReadEntries(async::result<ReadEntriesResult> (*f)(void *object)) {
 		readEntries = f;
 		return *this;
 	}
+	constexpr FileOperations &withReadDirents(async::result<ReadResult> (*f)(void *object,
+			void *buffer, size_t length)) {
+		readDirents = f;
+		return *this;
+	}
 	constexpr FileOperations &withAccessMemory(async::result<helix::BorrowedDescriptor>(*f)(void *object)) {
 		accessMemory = f;
 		return *this;
@@ -110,6 +125,17 @@ struct FileOperations {
 		flock = f;
 		return *this;
 	}
+	constexpr FileOperations &withRangeLock(async::result<protocols::fs::Error> (*f)(void *object,
+			RangeLockRequest request)) {
+		rangeLock = f;
+		return *this;
+	}
+	constexpr FileOperations &withTestRangeLock(
+			async::result<std::optional<RangeLockRequest>> (*f)(void *object,
+			RangeLockRequest request)) {
+		testRangeLock = f;
+		return *this;
+	}
 	constexpr FileOperations &withGetOption(async::result<int> (*f)(void *object,
 			int option)) {
 		getOption = f;
@@ -157,13 +183,27 @@ struct FileOperations {
 			const void *buffer, size_t length) = nullptr;
 	async::result<frg::expected<protocols::fs::Error, size_t>> (*pwrite)(void *object, int64_t offset, const char *credentials,
 			const void *buffer, size_t length) = nullptr;
+	// Like write() and pwrite() but the payload is read from a window of the client's buffer
+	// (e.g., via helix_ng::copyFromWindow()). Optional; if these are not set,
+	// windowed payloads are copied to a buffer and passed to write() and pwrite().
+	async::result<frg::expected<protocols::fs::Error, size_t>> (*writeFromWindow)(void *object, const char *credentials,
+			helix::BorrowedDescriptor window, size_t length) = nullptr;
+	async::result<frg::expected<protocols::fs::Error, size_t>> (*pwriteFromWindow)(void *object, int64_t offset,
+			const char *credentials, helix::BorrowedDescriptor window, size_t length) = nullptr;
 	async::result<ReadEntriesResult> (*readEntries)(void *object) = nullptr;
+	// Fills the buffer with DirentBuilder records; returns zero at the end of the directory.
+	async::result<ReadResult> (*readDirents)(void *object, void *buffer, size_t length) = nullptr;
 	async::result<helix::BorrowedDescriptor>(*accessMemory)(void *object) = nullptr;
 	async::result<frg::expected<protocols::fs::Error>> (*truncate)(void *object, size_t size) = nullptr;
 	async::result<frg::expected<protocols::fs::Error>> (*fallocate)(void *object, int64_t offset, size_t size) = nullptr;
 	async::result<void> (*ioctl)(void *object, uint32_t id, helix_ng::RecvInlineResult req,
 			helix::UniqueLane conversation) = nullptr;
 	async::result<protocols::fs::Error> (*flock)(void *object, int flags) = nullptr;
+	async::result<protocols::fs::Error> (*rangeLock)(void *object,
+			RangeLockRequest request) = nullptr;
+	// Returns the first lock that conflicts with the request (if any).
+	async::result<std::optional<RangeLockRequest>> (*testRangeLock)(void *object,
+			RangeLockRequest request) = nullptr;
 	async::result<int> (*getOption)(void *object, int option) = nullptr;
 	async::result<void> (*setOption)(void *object, int option, int value) = nullptr;
 	async::result<frg::expected<Error, PollWaitResult>>
@@ -203,7 +243,13 @@ struct StatusPageProvider {
 
 	void update(uint64_t sequence, int status);
 
+	// Also publishes the sequences of the last edges (e.g., for sockets).
+	void update(uint64_t sequence, int status,
+			uint64_t inSequence, uint64_t outSequence, uint64_t hupSequence);
+
 private:
+	void _wake();
+
 	helix::UniqueDescriptor _memory;
 	helix::Mapping _mapping;
 };
@@ -70,7 +70,89 @@ async::result<size_t> File::readSome(void *data, size_t max_length) {
 	co_return recv_data.actualLength();
 }
 
+async::result<frg::expected<Error, size_t>>
+File::pread(int64_t offset, void *data, size_t length) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::PT_PREAD);
+	req.set_offset(offset);
+	req.set_size(length);
+
+	auto ser = req.SerializeAsString();
+	uint8_t buffer[128];
+
+	auto [offer, send_req, imbue_creds, recv_resp, recv_data] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::imbueCredentials(),
+				helix_ng::recvBuffer(buffer, 128),
+				helix_ng::recvBuffer(data, length)
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(imbue_creds.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(buffer, recv_resp.actualLength());
+	// On errors, the server does not send any data.
+	if(resp.error() == managarm::fs::Errors::END_OF_FILE)
+		co_return 0;
+	if(resp.error() == managarm::fs::Errors::WOULD_BLOCK)
+		co_return Error::wouldBlock;
+	if(resp.error() == managarm::fs::Errors::ILLEGAL_ARGUMENT)
+		co_return Error::illegalArguments;
+	if(resp.error() == managarm::fs::Errors::ILLEGAL_OPERATION_TARGET)
+		co_return Error::illegalOperationTarget;
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+	HEL_CHECK(recv_data.error());
+	co_return recv_data.actualLength();
+}
+
+async::result<frg::expected<Error, size_t>>
+File::readDirents(void *data, size_t length) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::PT_READ_DIRENTS);
+	req.set_size(length);
+
+	auto ser = req.SerializeAsString();
+	uint8_t buffer[128];
+
+	auto [offer, send_req, recv_resp, recv_data] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::recvBuffer(buffer, 128),
+				helix_ng::recvBuffer(data, length)
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(buffer, recv_resp.actualLength());
+	// On errors, the server does not send any data.
+	if(resp.error() == managarm::fs::Errors::END_OF_FILE)
+		co_return 0;
+	if(resp.error() == managarm::fs::Errors::ILLEGAL_ARGUMENT)
+		co_return Error::illegalArguments;
+	if(resp.error() == managarm::fs::Errors::ILLEGAL_OPERATION_TARGET)
+		co_return Error::illegalOperationTarget;
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+	HEL_CHECK(recv_data.error());
+	co_return recv_data.actualLength();
+}
+
 async::result<size_t> File::writeSome(const void *data, size_t maxLength) {
+	if(maxLength >= windowedWriteThreshold)
+		co_return co_await _writeSomeWindowed(data, maxLength);
+
 	managarm::fs::CntRequest req;
 	req.set_req_type(managarm::fs::CntReqType::WRITE);
 	req.set_size(maxLength);
@@ -103,6 +185,137 @@ async::result<size_t> File::writeSome(const void *data, size_t maxLength) {
 	co_return resp.size();
 }
 
+// Instead of sending the data, this passes a window of our buffer to the server.
+// The server can then copy the data directly to its destination.
+async::result<size_t> File::_writeSomeWindowed(const void *data, size_t maxLength) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::WRITE);
+	req.set_size(maxLength);
+	req.set_windowed(true);
+
+	auto ser = req.SerializeAsString();
+
+	HelHandle handle;
+	HEL_CHECK(helCreateSpaceWindow(kHelNullHandle, const_cast<void *>(data), maxLength, &handle));
+	helix::UniqueDescriptor window{handle};
+
+	auto [offer, sendReq, imbueCreds, pushWindow, recvResp] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::imbueCredentials(),
+				helix_ng::pushDescriptor(window),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(imbueCreds.error());
+	HEL_CHECK(pushWindow.error());
+	HEL_CHECK(recvResp.error());
+
+	// The server may still hold a handle to the window; make sure that it cannot
+	// access the buffer once we return.
+	HEL_CHECK(helRevokeSpaceWindow(window.getHandle()));
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recvResp.data(), recvResp.length());
+	recvResp.reset();
+	if(resp.error() == managarm::fs::Errors::END_OF_FILE)
+		co_return 0;
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+	co_return resp.size();
+}
+
+async::result<size_t> File::readSomeVectored(const struct iovec *iov, size_t iovCount) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::READ);
+
+	size_t total = 0;
+	for(size_t i = 0; i < iovCount; i++) {
+		req.add_iov_lengths(iov[i].iov_len);
+		total += iov[i].iov_len;
+	}
+
+	auto ser = req.SerializeAsString();
+	uint8_t buffer[128];
+	std::vector<char> data(total);
+
+	auto [offer, send_req, imbue_creds, recv_resp, recv_data] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::imbueCredentials(),
+				helix_ng::recvBuffer(buffer, 128),
+				helix_ng::recvBuffer(data.data(), data.size())
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(imbue_creds.error());
+	HEL_CHECK(recv_resp.error());
+	HEL_CHECK(recv_data.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(buffer, recv_resp.actualLength());
+	if(resp.error() == managarm::fs::Errors::END_OF_FILE)
+		co_return 0;
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+
+	// Scatter the data into the segments.
+	size_t progress = 0;
+	for(size_t i = 0; i < iovCount && progress < recv_data.actualLength(); i++) {
+		auto chunk = std::min(iov[i].iov_len, recv_data.actualLength() - progress);
+		memcpy(iov[i].iov_base, data.data() + progress, chunk);
+		progress += chunk;
+	}
+	co_return recv_data.actualLength();
+}
+
+async::result<size_t> File::writeSomeVectored(const struct iovec *iov, size_t iovCount) {
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::WRITE);
+
+	// Gather the segments into a single buffer.
+	std::vector<char> data;
+	for(size_t i = 0; i < iovCount; i++) {
+		req.add_iov_lengths(iov[i].iov_len);
+		auto base = reinterpret_cast<const char *>(iov[i].iov_base);
+		data.insert(data.end(), base, base + iov[i].iov_len);
+	}
+
+	auto ser = req.SerializeAsString();
+
+	auto [offer, sendReq, imbueCreds, sendData, recvResp] =
+		co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::imbueCredentials(),
+				helix_ng::sendBuffer(data.data(), data.size()),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(imbueCreds.error());
+	HEL_CHECK(sendData.error());
+	HEL_CHECK(recvResp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(recvResp.data(), recvResp.length());
+	recvResp.reset();
+	if(resp.error() == managarm::fs::Errors::END_OF_FILE)
+		co_return 0;
+	assert(resp.error() == managarm::fs::Errors::SUCCESS);
+	co_return resp.size();
+}
+
 async::result<frg::expected<Error, PollWaitResult>> File::pollWait(uint64_t sequence, int mask,
 		async::cancellation_token cancellation) {
 	HelHandle cancel_handle;
@@ -1,6 +1,9 @@
 #include <protocols/fs/file-locks.hpp>
 #include <protocols/fs/server.hpp>
+#include <algorithm>
+#include <cassert>
 #include <iostream>
+#include <unordered_map>
 #include <fs.bragi.hpp>
 
 namespace protocols::fs {
@@ -83,3 +86,269 @@ namespace protocols::fs {
 		return true;
 	}
 }
+
+namespace protocols::fs {
+	namespace {
+		// POSIX owners that currently wait for a lock, used for deadlock detection.
+		// A process can wait for multiple locks (from different threads).
+		std::unordered_multimap<uintptr_t, RangeLockManager::Waiter *> globalRangeLockWaiters;
+
+		bool rangeLocksConflict(RangeLockType a, RangeLockType b) {
+			return a == RangeLockType::write || b == RangeLockType::write;
+		}
+	}
+
+	RangeLockFile::~RangeLockFile() {
+		if(!_manager)
+			return;
+		_manager->release({reinterpret_cast<uintptr_t>(this), true});
+		for(auto pid : _pids)
+			_manager->release({static_cast<uintptr_t>(pid), false});
+	}
+
+	bool RangeLockAggregator::aggregate(RangeLock *node) {
+		uint64_t end = node->end;
+		if(auto left = RangeLockTree::get_left(node); left && left->maxEnd > end)
+			end = left->maxEnd;
+		if(auto right = RangeLockTree::get_right(node); right && right->maxEnd > end)
+			end = right->maxEnd;
+
+		if(node->maxEnd == end)
+			return false;
+		node->maxEnd = end;
+		return true;
+	}
+
+	RangeLockManager::~RangeLockManager() {
+		for(auto lock : _overlapping(0, UINT64_MAX)) {
+			_tree.remove(lock);
+			delete lock;
+		}
+	}
+
+	async::result<Error> RangeLockManager::lock(RangeLockFile *file, RangeLockRequest request) {
+		if(!request.ofd && request.pid < 0)
+			co_return Error::illegalArguments;
+		assert(request.start < request.end);
+		assert(!file->_manager || file->_manager == this);
+		file->_manager = this;
+
+		auto owner = _ownerOf(file, request);
+		if(request.type == RangeLockType::unlock) {
+			if(_unlockRange(owner, request.start, request.end))
+				_wake(request.start, request.end);
+			co_return Error::none;
+		}
+
+		while(true) {
+			auto conflicts = _conflicting(owner, request.type, request.start, request.end);
+			if(conflicts.empty())
+				break;
+			if(!request.wait)
+				co_return Error::wouldBlock;
+
+			// Like Linux, we only detect deadlocks between POSIX owners.
+			if(!owner.ofd) {
+				for(auto conflict : conflicts) {
+					if(conflict->owner.ofd)
+						continue;
+					std::vector<RangeLockOwner> visited;
+					if(_waitsFor(conflict->owner, owner, visited))
+						co_return Error::deadlock;
+				}
+			}
+
+			Waiter waiter{
+				.manager = this,
+				.owner = owner,
+				.type = request.type,
+				.start = request.start,
+				.end = request.end
+			};
+			_waiters.push_back(waiter);
+			std::unordered_multimap<uintptr_t, Waiter *>::iterator waiterIt;
+			if(!owner.ofd)
+				waiterIt = globalRangeLockWaiters.insert({owner.id, &waiter});
+
+			co_await waiter.event.wait();
+
+			if(!owner.ofd)
+				globalRangeLockWaiters.erase(waiterIt);
+			_waiters.erase(_waiters.iterator_to(waiter));
+		}
+
+		if(!owner.ofd
+				&& std::find(file->_pids.begin(), file->_pids.end(), request.pid) == file->_pids.end())
+			file->_pids.push_back(request.pid);
+
+		// Replace the owner's existing locks in the range; this might downgrade a write lock.
+		bool changed = _unlockRange(owner, request.start, request.end);
+
+		auto lock = new RangeLock{
+			.owner = owner,
+			.type = request.type,
+			.start = request.start,
+			.end = request.end,
+			.pid = request.pid
+		};
+
+		// Merge adjacent locks of the same owner and type.
+		uint64_t lower = lock->start ? lock->start - 1 : 0;
+		uint64_t upper = lock->end == UINT64_MAX ? UINT64_MAX : lock->end + 1;
+		for(auto other : _overlapping(lower, upper)) {
+			if(other->owner != owner || other->type != lock->type)
+				continue;
+			if(other->end == lock->start) {
+				lock->start = other->start;
+			}else if(other->start == lock->end) {
+				lock->end = other->end;
+			}else{
+				continue;
+			}
+			_remove(other);
+			delete other;
+		}
+
+		_insert(lock);
+		if(changed)
+			_wake(request.start, request.end);
+		co_return Error::none;
+	}
+
+	std::optional<RangeLockRequest> RangeLockManager::test(RangeLockFile *file,
+			RangeLockRequest request) {
+		auto conflicts = _conflicting(_ownerOf(file, request), request.type,
+				request.start, request.end);
+		if(conflicts.empty())
+			return std::nullopt;
+
+		// _conflicting() returns the locks in order of their start.
+		auto conflict = conflicts.front();
+		return RangeLockRequest{
+			.type = conflict->type,
+			.start = conflict->start,
+			.end = conflict->end,
+			.ofd = conflict->owner.ofd,
+			.pid = conflict->owner.ofd ? -1 : conflict->pid
+		};
+	}
+
+	void RangeLockManager::release(RangeLockOwner owner) {
+		uint64_t start = UINT64_MAX;
+		uint64_t end = 0;
+		for(auto lock : _overlapping(0, UINT64_MAX)) {
+			if(lock->owner != owner)
+				continue;
+			start = std::min(start, lock->start);
+			end = std::max(end, lock->end);
+			_remove(lock);
+			delete lock;
+		}
+		if(start < end)
+			_wake(start, end);
+	}
+
+	RangeLockOwner RangeLockManager::_ownerOf(RangeLockFile *file,
+			const RangeLockRequest &request) {
+		if(request.ofd)
+			return {reinterpret_cast<uintptr_t>(file), true};
+		return {static_cast<uintptr_t>(request.pid), false};
+	}
+
+	std::vector<RangeLock *> RangeLockManager::_overlapping(uint64_t start, uint64_t end) {
+		std::vector<RangeLock *> result;
+
+		// In-order traversal that skips subtrees which cannot contain overlapping locks:
+		// subtrees whose maxEnd is <= start and right subtrees of locks that start at >= end.
+		auto visit = [&] (auto &self, RangeLock *node) -> void {
+			if(!node || node->maxEnd <= start)
+				return;
+			self(self, RangeLockTree::get_left(node));
+			if(node->start >= end)
+				return;
+			if(node->end > start)
+				result.push_back(node);
+			self(self, RangeLockTree::get_right(node));
+		};
+		visit(visit, _tree.get_root());
+
+		return result;
+	}
+
+	std::vector<RangeLock *> RangeLockManager::_conflicting(RangeLockOwner owner,
+			RangeLockType type, uint64_t start, uint64_t end) {
+		auto result = _overlapping(start, end);
+		std::erase_if(result, [&] (RangeLock *lock) {
+			return lock->owner == owner || !rangeLocksConflict(lock->type, type);
+		});
+		return result;
+	}
+
+	bool RangeLockManager::_unlockRange(RangeLockOwner owner, uint64_t start, uint64_t end) {
+		bool changed = false;
+		for(auto lock : _overlapping(start, end)) {
+			if(lock->owner != owner)
+				continue;
+			changed = true;
+			_remove(lock);
+
+			// Keep the parts of the lock that are outside of the range.
+			if(lock->start < start && lock->end > end) {
+				_insert(new RangeLock{
+					.owner = lock->owner,
+					.type = lock->type,
+					.start = end,
+					.end = lock->end,
+					.pid = lock->pid
+				});
+				lock->end = start;
+				_insert(lock);
+			}else if(lock->start < start) {
+				lock->end = start;
+				_insert(lock);
+			}else if(lock->end > end) {
+				lock->start = end;
+				_insert(lock);
+			}else{
+				delete lock;
+			}
+		}
+		return changed;
+	}
+
+	void RangeLockManager::_insert(RangeLock *lock) {
+		lock->maxEnd = lock->end;
+		_tree.insert(lock);
+	}
+
+	void RangeLockManager::_remove(RangeLock *lock) {
+		_tree.remove(lock);
+	}
+
+	void RangeLockManager::_wake(uint64_t start, uint64_t end) {
+		for(auto &waiter : _waiters) {
+			if(waiter.start < end && start < waiter.end)
+				waiter.event.raise();
+		}
+	}
+
+	bool RangeLockManager::_waitsFor(RangeLockOwner owner, RangeLockOwner target,
+			std::vector<RangeLockOwner> &visited) {
+		if(std::find(visited.begin(), visited.end(), owner) != visited.end())
+			return false;
+		visited.push_back(owner);
+
+		auto [begin, end] = globalRangeLockWaiters.equal_range(owner.id);
+		for(auto it = begin; it != end; ++it) {
+			auto waiter = it->second;
+			for(auto blocker : waiter->manager->_conflicting(waiter->owner, waiter->type,
+					waiter->start, waiter->end)) {
+				if(blocker->owner == target)
+					return true;
+				if(!blocker->owner.ofd && _waitsFor(blocker->owner, target, visited))
+					return true;
+			}
+		}
+		return false;
+	}
+}
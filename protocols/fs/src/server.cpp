@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -17,6 +18,70 @@ namespace fs {
 
 namespace {
 
+// Vectored requests carry the lengths of all of their segments. Since the data of
+// all segments is transferred in one buffer, a vectored operation costs a single
+// round trip, independently of the number of segments.
+size_t transferSize(managarm::fs::CntRequest &req) {
+	if(req.iov_lengths().empty())
+		return req.size();
+	size_t total = 0;
+	for(auto length : req.iov_lengths())
+		total += length;
+	return total;
+}
+
+// Payload of WRITE and PT_PWRITE.
+struct WritePayload {
+	char credentials[16];
+	// Only valid if the payload was passed as a window and readsWindow was true.
+	helix::UniqueDescriptor window;
+	std::vector<uint8_t> buffer;
+	size_t length = 0;
+};
+
+// Receives the payload of WRITE and PT_PWRITE. Windowed payloads (see CntRequest::windowed)
+// are copied to the buffer, unless the server reads the window itself (readsWindow).
+// Fails with Error::illegalArguments if the window cannot be read.
+async::result<frg::expected<Error, WritePayload>> recvWritePayload(
+		helix::UniqueLane &conversation, managarm::fs::CntRequest &req, bool readsWindow) {
+	WritePayload payload;
+	if(!req.windowed()) {
+		payload.buffer.resize(transferSize(req));
+
+		auto [extract_creds, recv_buffer] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::extractCredentials(),
+			helix_ng::recvBuffer(payload.buffer.data(), payload.buffer.size())
+		);
+		HEL_CHECK(extract_creds.error());
+		HEL_CHECK(recv_buffer.error());
+		memcpy(payload.credentials, extract_creds.credentials(), 16);
+		payload.length = recv_buffer.actualLength();
+		co_return std::move(payload);
+	}
+
+	auto [extract_creds, pull_window] = co_await helix_ng::exchangeMsgs(
+		conversation,
+		helix_ng::extractCredentials(),
+		helix_ng::pullDescriptor()
+	);
+	HEL_CHECK(extract_creds.error());
+	HEL_CHECK(pull_window.error());
+	memcpy(payload.credentials, extract_creds.credentials(), 16);
+	payload.window = pull_window.descriptor();
+	payload.length = transferSize(req);
+
+	if(!readsWindow) {
+		payload.buffer.resize(payload.length);
+		auto read_memory = co_await helix_ng::readMemory(payload.window, 0,
+				payload.length, payload.buffer.data());
+		if(read_memory.error())
+			co_return Error::illegalArguments;
+		payload.window = {};
+	}
+	co_return std::move(payload);
+}
+
 async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		const FileOperations *file_ops,
 		managarm::fs::CntRequest req, helix::UniqueLane conversation) {
@@ -144,9 +209,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		}
 
 		std::string data;
-		data.resize(req.size());
+		data.resize(transferSize(req));
 		auto res = co_await file_ops->read(file.get(), extract_creds.credentials(),
-				data.data(), req.size());
+				data.data(), data.size());
 
 		managarm::fs::SvrResponse resp;
 		auto error = std::get_if<Error>(&res);
@@ -205,9 +270,9 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		}
 
 		std::string data;
-		data.resize(req.size());
+		data.resize(transferSize(req));
 		auto res = co_await file_ops->pread(file.get(), req.offset(), extract_creds.credentials(),
-				data.data(), req.size());
+				data.data(), data.size());
 
 		managarm::fs::SvrResponse resp;
 		auto error = std::get_if<Error>(&res);
@@ -243,18 +308,22 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			HEL_CHECK(send_data.error());
 		}
 	}else if(req.req_type() == managarm::fs::CntReqType::WRITE) {
-		std::vector<uint8_t> buffer;
-		buffer.resize(req.size());
+		bool readsWindow = file_ops->writeFromWindow;
+		auto payload = co_await recvWritePayload(conversation, req, readsWindow);
+		if(!payload) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
 
-		auto [extract_creds, recv_buffer] = co_await helix_ng::exchangeMsgs(
-			conversation,
-			helix_ng::extractCredentials(),
-			helix_ng::recvBuffer(buffer.data(), buffer.size())
-		);
-		HEL_CHECK(extract_creds.error());
-		HEL_CHECK(recv_buffer.error());
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
 
-		if(!file_ops->write) {
+		if(!payload->window && !file_ops->write) {
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
@@ -267,8 +336,11 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			co_return;
 		}
 
-		auto res = co_await file_ops->write(file.get(), extract_creds.credentials(),
-				buffer.data(), recv_buffer.actualLength());
+		auto res = payload->window
+				? co_await file_ops->writeFromWindow(file.get(), payload->credentials,
+						payload->window, payload->length)
+				: co_await file_ops->write(file.get(), payload->credentials,
+						payload->buffer.data(), payload->length);
 
 		managarm::fs::SvrResponse resp;
 		if(!res) {
@@ -282,6 +354,10 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 				resp.set_error(managarm::fs::Errors::NOT_CONNECTED);
 			} else if(res.error() == Error::illegalOperationTarget) {
 				resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+			} else if(res.error() == Error::illegalArguments) {
+				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			} else if(res.error() == Error::readOnlyFileSystem) {
+				resp.set_error(managarm::fs::Errors::READ_ONLY_FILE_SYSTEM);
 			} else {
 				std::cout << "Unknown error from write()" << std::endl;
 				co_return;
@@ -304,18 +380,22 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			HEL_CHECK(send_resp.error());
 		}
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_PWRITE) {
-		std::vector<uint8_t> buffer;
-		buffer.resize(req.size());
+		bool readsWindow = file_ops->pwriteFromWindow;
+		auto payload = co_await recvWritePayload(conversation, req, readsWindow);
+		if(!payload) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
 
-		auto [extract_creds, recv_buffer] = co_await helix_ng::exchangeMsgs(
-			conversation,
-			helix_ng::extractCredentials(),
-			helix_ng::recvBuffer(buffer.data(), buffer.size())
-		);
-		HEL_CHECK(extract_creds.error());
-		HEL_CHECK(recv_buffer.error());
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
 
-		if(!file_ops->pwrite) {
+		if(!payload->window && !file_ops->pwrite) {
 			managarm::fs::SvrResponse resp;
 			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
 
@@ -328,8 +408,11 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			co_return;
 		}
 
-		auto res = co_await file_ops->pwrite(file.get(), req.offset(), extract_creds.credentials(),
-				buffer.data(), recv_buffer.actualLength());
+		auto res = payload->window
+				? co_await file_ops->pwriteFromWindow(file.get(), req.offset(),
+						payload->credentials, payload->window, payload->length)
+				: co_await file_ops->pwrite(file.get(), req.offset(), payload->credentials,
+						payload->buffer.data(), payload->length);
 
 		managarm::fs::SvrResponse resp;
 		if(!res) {
@@ -337,6 +420,10 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 				resp.set_error(managarm::fs::Errors::NO_SPACE_LEFT);
 			} else if(res.error() == Error::wouldBlock) {
 				resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
+			} else if(res.error() == Error::illegalArguments) {
+				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			} else if(res.error() == Error::readOnlyFileSystem) {
+				resp.set_error(managarm::fs::Errors::READ_ONLY_FILE_SYSTEM);
 			} else {
 				std::cout << "Unknown error from pwrite()" << std::endl;
 				co_return;
@@ -382,6 +469,55 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			resp.set_error(managarm::fs::Errors::SUCCESS);
 		}
 
+		auto ser = resp.SerializeAsString();
+		auto [send_resp] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(ser.data(), ser.size())
+		);
+		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_RANGE_LOCK
+			|| req.req_type() == managarm::fs::CntReqType::PT_RANGE_LOCK_TEST) {
+		bool test = req.req_type() == managarm::fs::CntReqType::PT_RANGE_LOCK_TEST;
+		managarm::fs::SvrResponse resp;
+
+		RangeLockRequest request;
+		if(req.lock_type() == managarm::fs::RangeLockType::RL_READ) {
+			request.type = RangeLockType::read;
+		}else if(req.lock_type() == managarm::fs::RangeLockType::RL_WRITE) {
+			request.type = RangeLockType::write;
+		}else{
+			request.type = RangeLockType::unlock;
+		}
+		request.start = req.lock_start();
+		request.end = req.lock_length() ? req.lock_start() + req.lock_length() : UINT64_MAX;
+		request.ofd = req.lock_flags() & managarm::fs::RangeLockFlags::RLF_OFD;
+		request.pid = req.lock_pid();
+		request.wait = req.lock_flags() & managarm::fs::RangeLockFlags::RLF_WAIT;
+
+		if(test ? !file_ops->testRangeLock : !file_ops->rangeLock) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+		}else if(request.end <= request.start
+				|| (test && request.type == RangeLockType::unlock)) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		}else if(test) {
+			auto conflict = co_await file_ops->testRangeLock(file.get(), request);
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			if(conflict) {
+				resp.set_lock_type(conflict->type == RangeLockType::read
+						? managarm::fs::RangeLockType::RL_READ
+						: managarm::fs::RangeLockType::RL_WRITE);
+				resp.set_lock_start(conflict->start);
+				resp.set_lock_length(conflict->end == UINT64_MAX
+						? 0 : conflict->end - conflict->start);
+				resp.set_lock_pid(conflict->ofd ? -1 : conflict->pid);
+			}else{
+				resp.set_lock_type(managarm::fs::RangeLockType::RL_UNLOCK);
+			}
+		}else{
+			auto result = co_await file_ops->rangeLock(file.get(), request);
+			resp.set_error(mapFsError(result));
+		}
+
 		auto ser = resp.SerializeAsString();
 		auto [send_resp] = co_await helix_ng::exchangeMsgs(
 			conversation,
@@ -416,6 +552,56 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			conversation,
 			helix_ng::sendBuffer(ser.data(), ser.size()));
 		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_READ_DIRENTS) {
+		if(!file_ops->readDirents) {
+			// Clients fall back to PT_READ_ENTRIES.
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_OPERATION_TARGET);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+			co_return;
+		}
+
+		std::vector<char> data;
+		data.resize(req.size());
+		auto res = co_await file_ops->readDirents(file.get(), data.data(), data.size());
+
+		managarm::fs::SvrResponse resp;
+		if(auto error = std::get_if<Error>(&res)) {
+			resp.set_error(mapFsError(*error));
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+		}else if(!std::get<size_t>(res)) {
+			resp.set_error(managarm::fs::Errors::END_OF_FILE);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size())
+			);
+			HEL_CHECK(send_resp.error());
+		}else{
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+
+			auto ser = resp.SerializeAsString();
+			auto [send_resp, send_data] = co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBuffer(ser.data(), ser.size()),
+				helix_ng::sendBuffer(data.data(), std::get<size_t>(res))
+			);
+			HEL_CHECK(send_resp.error());
+			HEL_CHECK(send_data.error());
+		}
 	}else if(req.req_type() == managarm::fs::CntReqType::MMAP) {
 		if(!file_ops->accessMemory) {
 			managarm::fs::SvrResponse resp;
@@ -1059,7 +1245,7 @@ async::result<void> servePassthrough(helix::UniqueLane lane,
 				conversation,
 				helix_ng::sendBuffer(ser.data(), ser.size()),
 				helix_ng::sendBuffer(addr.data(), std::min(addr.size(), data.addressLength)),
-				helix_ng::sendBuffer(buffer.data(), buffer.size()),
+				helix_ng::sendBuffer(buffer.data(), std::min(buffer.size(), data.dataLength)),
 				helix_ng::sendBuffer(data.ctrl.data(), data.ctrl.size())
 			);
 			HEL_CHECK(send_resp.error());
@@ -1197,7 +1383,7 @@ async::result<void> servePassthrough(helix::UniqueLane lane,
 
 				auto [send_resp] = co_await helix_ng::exchangeMsgs(
 					conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 				HEL_CHECK(send_resp.error());
 				continue;
@@ -1213,7 +1399,7 @@ async::result<void> servePassthrough(helix::UniqueLane lane,
 
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
 				conversation,
-				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+				helix_ng::sendBragiHeadOnly(resp)
 			);
 			HEL_CHECK(send_resp.error());
 		} else {
@@ -1247,6 +1433,39 @@ void StatusPageProvider::update(uint64_t sequence, int status) {
 
 	// Complete the seqlock write.
 	__atomic_store_n(&page->seqlock, seqlock + 2, __ATOMIC_RELEASE);
+
+	_wake();
+}
+
+void StatusPageProvider::update(uint64_t sequence, int status,
+		uint64_t inSequence, uint64_t outSequence, uint64_t hupSequence) {
+	auto page = reinterpret_cast<protocols::fs::StatusPage *>(_mapping.get());
+
+	auto seqlock = __atomic_load_n(&page->seqlock, __ATOMIC_RELAXED);
+	assert(!(seqlock & 1));
+	__atomic_store_n(&page->seqlock, seqlock + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&page->sequence, sequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->flags, page->flags | protocols::fs::statusPageHasEdges,
+			__ATOMIC_RELAXED);
+	__atomic_store_n(&page->status, status, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->inSequence, inSequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->outSequence, outSequence, __ATOMIC_RELAXED);
+	__atomic_store_n(&page->hupSequence, hupSequence, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&page->seqlock, seqlock + 2, __ATOMIC_RELEASE);
+
+	_wake();
+}
+
+void StatusPageProvider::_wake() {
+	auto page = reinterpret_cast<protocols::fs::StatusPage *>(_mapping.get());
+
+	// Only enter the kernel if the reader waits for changes.
+	__atomic_add_fetch(&page->futex, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&page->watched, __ATOMIC_SEQ_CST))
+		HEL_CHECK(helFutexWake(&page->futex));
 }
 
 async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
@@ -1436,17 +1655,25 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(push_desc.error());
 
+			// Push the nodes in batches instead of waiting for one round trip per node.
+			std::vector<helix::UniqueLane> remote_lanes;
 			for (auto &[node, _] : nodes) {
 				helix::UniqueLane local_lane, remote_lane;
 				std::tie(local_lane, remote_lane) = helix::createStream();
 				serveNode(std::move(local_lane), std::move(node), node_ops);
+				remote_lanes.push_back(std::move(remote_lane));
+			}
 
-				auto [push_node] = co_await helix_ng::exchangeMsgs(
-					local_push,
-					helix_ng::pushDescriptor(remote_lane)
-				);
+			for (size_t i = 0; i < remote_lanes.size(); i += maxDescriptorBatch) {
+				auto n = std::min(remote_lanes.size() - i, maxDescriptorBatch);
+				std::vector<helix_ng::PushDescriptor> pushes;
+				for (size_t j = 0; j < n; j++)
+					pushes.push_back(helix_ng::pushDescriptor(remote_lanes[i + j]));
 
-				HEL_CHECK(push_node.error());
+				auto push_nodes = co_await helix_ng::exchangeMsgsVector(local_push,
+						std::move(pushes));
+				for (auto &push_node : push_nodes)
+					HEL_CHECK(push_node.error());
 			}
 		}else if(req.req_type() == managarm::fs::CntReqType::NODE_MKDIR) {
 			auto result = co_await node_ops->mkdir(node, req.path());
@@ -1650,10 +1877,10 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(send_link.error());
 		}else if(req.req_type() == managarm::fs::CntReqType::NODE_CHMOD) {
-			co_await node_ops->chmod(node, req.mode());
+			auto result = co_await node_ops->chmod(node, req.mode());
 
 			managarm::fs::SvrResponse resp;
-			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_error(mapFsError(result));
 
 			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
@@ -1662,10 +1889,10 @@ async::detached serveNode(helix::UniqueLane lane, std::shared_ptr<void> node,
 			);
 			HEL_CHECK(send_resp.error());
 		}else if(req.req_type() == managarm::fs::CntReqType::NODE_UTIMENSAT) {
-			co_await node_ops->utimensat(node, req.atime_sec(), req.atime_nsec(), req.mtime_sec(), req.mtime_nsec());
+			auto result = co_await node_ops->utimensat(node, req.atime_sec(), req.atime_nsec(), req.mtime_sec(), req.mtime_nsec());
 
 			managarm::fs::SvrResponse resp;
-			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_error(mapFsError(result));
 
 			auto ser = resp.SerializeAsString();
 			auto [send_resp] = co_await helix_ng::exchangeMsgs(
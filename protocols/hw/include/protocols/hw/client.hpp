@@ -29,6 +29,8 @@ struct ExpansionRomInfo {
 
 struct Capability {
 	unsigned int type;
+	// Offset of the capability in config space.
+	size_t offset;
 };
 
 struct PciInfo {
@@ -69,8 +71,13 @@ struct Device {
 	async::result<PciInfo> getPciInfo();
 	async::result<helix::UniqueDescriptor> accessBar(int index);
 	async::result<helix::UniqueDescriptor> accessExpansionRom();
+	// Returns an empty descriptor if the device is not behind an IOMMU.
+	async::result<helix::UniqueDescriptor> accessDmaSpace();
 	async::result<helix::UniqueDescriptor> accessIrq(size_t index = 0);
-	async::result<helix::UniqueDescriptor> installMsi(int index);
+	// cpu selects the CPU that the MSI is delivered to (-1 lets the kernel choose).
+	async::result<helix::UniqueDescriptor> installMsi(int index, int cpu = -1);
+	// Retargets an installed MSI. Returns false if the CPU cannot be targeted.
+	async::result<bool> setMsiAffinity(int index, int cpu);
 
 	async::result<void> claimDevice();
 	async::result<void> enableBusIrq();
@@ -78,6 +85,9 @@ struct Device {
 	async::result<void> enableBusmaster();
 
 	async::result<uint32_t> loadPciSpace(size_t offset, unsigned int size);
+	// Reads size bytes of config space at once (offset and size must be multiples of 4).
+	// Returns an empty vector if the range is not within the device's config space.
+	async::result<std::vector<uint8_t>> loadPciSpaceRange(size_t offset, size_t size);
 	async::result<void> storePciSpace(size_t offset, unsigned int size, uint32_t word);
 	async::result<uint32_t> loadPciCapability(unsigned int index, size_t offset, unsigned int size);
 
@@ -49,7 +49,7 @@ async::result<PciInfo> Device::getPciInfo() {
 	info.numMsis = resp.num_msis();
 
 	for(size_t i = 0; i < resp.capabilities_size(); i++)
-		info.caps.push_back({resp.capabilities(i).type()});
+		info.caps.push_back({resp.capabilities(i).type(), resp.capabilities(i).offset()});
 
 	for(size_t i = 0; i < 6; i++) {
 		if(i >= resp.bars_size()) {
@@ -168,6 +168,50 @@ async::result<helix::UniqueDescriptor> Device::accessExpansionRom() {
 	co_return std::move(expansion_rom);
 }
 
+async::result<helix::UniqueDescriptor> Device::accessDmaSpace() {
+	managarm::hw::AccessDmaSpaceRequest req;
+
+	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
+		_lane,
+		helix_ng::offer(
+			helix_ng::want_lane,
+			helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+			helix_ng::recvInline()
+		)
+	);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_head.error());
+
+	auto preamble = bragi::read_preamble(recv_head);
+	assert(!preamble.error());
+	recv_head.reset();
+
+	std::vector<std::byte> tailBuffer(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::recvBuffer(tailBuffer.data(), tailBuffer.size())
+		);
+
+	HEL_CHECK(recv_tail.error());
+
+	auto resp = *bragi::parse_head_tail<managarm::hw::SvrResponse>(recv_head, tailBuffer);
+
+	if(resp.error() == managarm::hw::Errors::DEVICE_ERROR)
+		co_return helix::UniqueDescriptor{};
+	assert(resp.error() == managarm::hw::Errors::SUCCESS);
+
+	auto [pull_space] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::pullDescriptor()
+		);
+
+	HEL_CHECK(pull_space.error());
+
+	co_return pull_space.descriptor();
+}
+
 async::result<helix::UniqueDescriptor> Device::accessIrq(size_t index) {
 	managarm::hw::AccessIrqRequest req;
 	req.set_index(index);
@@ -206,9 +250,10 @@ async::result<helix::UniqueDescriptor> Device::accessIrq(size_t index) {
 	co_return pull_irq.descriptor();
 }
 
-async::result<helix::UniqueDescriptor> Device::installMsi(int index) {
+async::result<helix::UniqueDescriptor> Device::installMsi(int index, int cpu) {
 	managarm::hw::InstallMsiRequest req;
 	req.set_index(index);
+	req.set_cpu(cpu);
 
 	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
 			_lane,
@@ -244,6 +289,43 @@ async::result<helix::UniqueDescriptor> Device::installMsi(int index) {
 	co_return pull_msi.descriptor();
 }
 
+async::result<bool> Device::setMsiAffinity(int index, int cpu) {
+	managarm::hw::SetMsiAffinityRequest req;
+	req.set_index(index);
+	req.set_cpu(cpu);
+
+	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_head.error());
+
+	auto preamble = bragi::read_preamble(recv_head);
+	assert(!preamble.error());
+	recv_head.reset();
+
+	std::vector<std::byte> tailBuffer(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::recvBuffer(tailBuffer.data(), tailBuffer.size())
+		);
+
+	HEL_CHECK(recv_tail.error());
+
+	auto resp = *bragi::parse_head_tail<managarm::hw::SvrResponse>(recv_head, tailBuffer);
+
+	assert(resp.error() == managarm::hw::Errors::SUCCESS
+			|| resp.error() == managarm::hw::Errors::OUT_OF_BOUNDS);
+	co_return resp.error() == managarm::hw::Errors::SUCCESS;
+}
+
 async::result<void> Device::claimDevice() {
 	managarm::hw::ClaimDeviceRequest req;
 
@@ -413,6 +495,53 @@ async::result<uint32_t> Device::loadPciSpace(size_t offset, unsigned int size) {
 	co_return resp.word();
 }
 
+async::result<std::vector<uint8_t>> Device::loadPciSpaceRange(size_t offset, size_t size) {
+	managarm::hw::LoadPciSpaceRangeRequest req;
+	req.set_offset(offset);
+	req.set_size(size);
+
+	auto [offer, send_req, recv_head] = co_await helix_ng::exchangeMsgs(
+			_lane,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_head.error());
+
+	auto preamble = bragi::read_preamble(recv_head);
+	assert(!preamble.error());
+	recv_head.reset();
+
+	std::vector<std::byte> tailBuffer(preamble.tail_size());
+	auto [recv_tail] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::recvBuffer(tailBuffer.data(), tailBuffer.size())
+		);
+
+	HEL_CHECK(recv_tail.error());
+
+	auto resp = *bragi::parse_head_tail<managarm::hw::SvrResponse>(recv_head, tailBuffer);
+
+	if(resp.error() == managarm::hw::Errors::ILLEGAL_ARGUMENTS)
+		co_return std::vector<uint8_t>{};
+	assert(resp.error() == managarm::hw::Errors::SUCCESS);
+
+	std::vector<uint8_t> range(size);
+	auto [recv_range] = co_await helix_ng::exchangeMsgs(
+			offer.descriptor(),
+			helix_ng::recvBuffer(range.data(), range.size())
+		);
+
+	HEL_CHECK(recv_range.error());
+
+	co_return range;
+}
+
 async::result<void> Device::storePciSpace(size_t offset, unsigned int size, uint32_t word) {
 	managarm::hw::StorePciSpaceRequest req;
 	req.set_offset(offset);
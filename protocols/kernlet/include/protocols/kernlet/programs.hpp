@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <async/result.hpp>
+#include <helix/ipc.hpp>
+
+// Describes a kernlet that handles the IRQs of a device with a memory-mapped
+// interrupt status register. In IRQ context, the kernlet reads the register,
+// optionally clears it and passes the status bits to user space through a
+// bitset event. The IRQ is ACKed iff one of the status bits is set; otherwise
+// it is NACKed (e.g., because it belongs to another device on a shared line).
+struct StatusIrqKernlet {
+	enum class WriteBack {
+		// The register is not written (e.g., because it is read-to-clear).
+		none,
+		// The status bits are written back (for write-1-to-clear registers).
+		bits,
+		// The value that was read is written back. This is required if the register
+		// mixes write-1-to-clear status bits and read/write control bits.
+		value
+	};
+
+	// Offset of the status register, relative to the MMIO offset passed to automateStatusIrq().
+	uint32_t offset;
+	// Status bits that indicate an IRQ.
+	uint32_t mask;
+	// Width of the status register in bits (8, 16 or 32).
+	unsigned int width = 32;
+	WriteBack writeBack = WriteBack::none;
+};
+
+// Compiles the kernlet described by desc.
+// Its bindings are (memory view, offset, bitset event).
+async::result<helix::UniqueDescriptor> compileStatusIrqKernlet(StatusIrqKernlet desc);
+
+// Compiles the kernlet described by desc, binds it to the given MMIO region and
+// automates the IRQ with it. Returns the bitset event that the kernlet triggers.
+// This works for both line-based IRQs and MSIs.
+// Afterwards, the caller should kick the IRQ with kHelAckKick | kHelAckClear
+// to handle IRQs that were pending before the kernlet was attached.
+async::result<helix::UniqueDescriptor> automateStatusIrq(helix::BorrowedDescriptor irq,
+		helix::BorrowedDescriptor mmio, ptrdiff_t mmioOffset, StatusIrqKernlet desc);
@@ -0,0 +1,101 @@
+#include <assert.h>
+
+#include <fafnir/dsl.hpp>
+#include <protocols/kernlet/compiler.hpp>
+#include <protocols/kernlet/programs.hpp>
+
+namespace {
+
+const char *mmioRead(unsigned int width) {
+	switch(width) {
+	case 8: return "__mmio_read8";
+	case 16: return "__mmio_read16";
+	case 32: return "__mmio_read32";
+	default:
+		assert(!"Unexpected width of status register");
+		__builtin_unreachable();
+	}
+}
+
+const char *mmioWrite(unsigned int width) {
+	switch(width) {
+	case 8: return "__mmio_write8";
+	case 16: return "__mmio_write16";
+	case 32: return "__mmio_write32";
+	default:
+		assert(!"Unexpected width of status register");
+		__builtin_unreachable();
+	}
+}
+
+} // anonymous namespace
+
+async::result<helix::UniqueDescriptor> compileStatusIrqKernlet(StatusIrqKernlet desc) {
+	co_await connectKernletCompiler();
+
+	std::vector<uint8_t> kernlet_program;
+	fnr::emit_to(std::back_inserter(kernlet_program),
+		// Load the status register.
+		fnr::scope_push{} (
+			fnr::intrin{mmioRead(desc.width), 2, 1} (
+				fnr::binding{0}, // MMIO region (bound to slot 0).
+				fnr::binding{1} // MMIO offset (bound to slot 1).
+					+ fnr::literal{desc.offset}
+			)
+		),
+		fnr::scope_push{} (
+			fnr::scope_get{0} & fnr::literal{desc.mask}
+		),
+		// Ack the IRQ iff one of the bits was set.
+		fnr::check_if{},
+			fnr::scope_get{1},
+		fnr::then{}
+	);
+
+	if(desc.writeBack != StatusIrqKernlet::WriteBack::none) {
+		// Write back to the status register to deassert the IRQ.
+		fnr::emit_to(std::back_inserter(kernlet_program),
+			fnr::intrin{mmioWrite(desc.width), 3, 0} (
+				fnr::binding{0}, // MMIO region (bound to slot 0).
+				fnr::binding{1} // MMIO offset (bound to slot 1).
+					+ fnr::literal{desc.offset},
+				fnr::scope_get{desc.writeBack == StatusIrqKernlet::WriteBack::bits ? 1u : 0u}
+			)
+		);
+	}
+
+	fnr::emit_to(std::back_inserter(kernlet_program),
+			// Trigger the bitset event (bound to slot 2).
+			fnr::intrin{"__trigger_bitset", 2, 0} (
+				fnr::binding{2},
+				fnr::scope_get{1}
+			),
+			fnr::scope_push{} ( fnr::literal{1} ),
+		fnr::else_then{},
+			fnr::scope_push{} ( fnr::literal{2} ),
+		fnr::end{}
+	);
+
+	co_return co_await compile(kernlet_program.data(),
+			kernlet_program.size(), {BindType::memoryView, BindType::offset,
+			BindType::bitsetEvent});
+}
+
+async::result<helix::UniqueDescriptor> automateStatusIrq(helix::BorrowedDescriptor irq,
+		helix::BorrowedDescriptor mmio, ptrdiff_t mmioOffset, StatusIrqKernlet desc) {
+	auto kernlet_object = co_await compileStatusIrqKernlet(desc);
+
+	HelHandle event_handle;
+	HEL_CHECK(helCreateBitsetEvent(&event_handle));
+	helix::UniqueDescriptor event{event_handle};
+
+	HelKernletData data[3];
+	data[0].handle = mmio.getHandle();
+	data[1].handle = mmioOffset;
+	data[2].handle = event.getHandle();
+	HelHandle bound_handle;
+	HEL_CHECK(helBindKernlet(kernlet_object.getHandle(), data, 3, &bound_handle));
+	HEL_CHECK(helAutomateIrq(irq.getHandle(), 0, bound_handle));
+
+	co_return event;
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 
 #include <async/result.hpp>
@@ -24,12 +25,26 @@ struct Context {
 		return enabled_;
 	}
 
+	// Whether events are written to a shared-memory ring instead of being sent via IPC.
+	inline bool hasRing() {
+		return static_cast<bool>(ring_);
+	}
+
 	async::result<EventId> announceEvent(std::string_view name);
 	async::result<ItemId> announceItem(std::string_view name);
 
+	// Registers a shared-memory ring with the kernel. If this fails, events are sent via IPC.
+	async::result<void> setupRing();
+
+	// Timestamps and writes a record to the ring. Can be called from any thread.
+	void commitToRing(managarm::ostrace::EventRecord &record);
+
 private:
+	struct Ring;
+
 	helix::UniqueLane lane_;
 	bool enabled_;
+	std::shared_ptr<Ring> ring_;
 };
 
 struct Event {
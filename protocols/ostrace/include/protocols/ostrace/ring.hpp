@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Layout of the shared-memory rings that processes register with the kernel (see
+// RegisterRingReq). This header is also used by thor.
+
+namespace protocols::ostrace {
+
+// The ring memory starts with a UserRingHeader; the records follow at ringDataOffset.
+// A record consists of a size_t length, followed by a uint64_t timestamp and the
+// serialized EventRecord; records are aligned to sizeof(size_t) and may wrap around.
+// Like the kernel's record rings, the process (the only producer) moves tailPtr forward
+// *before* overwriting records and moves headPtr forward *after* writing a record.
+struct UserRingHeader {
+	uint64_t tailPtr;
+	uint64_t headPtr;
+	// The size of the record area is (1 << shift).
+	uint32_t shift;
+	uint32_t reserved;
+};
+
+inline constexpr size_t ringDataOffset = 0x1000;
+inline constexpr uint32_t minRingShift = 12;
+inline constexpr uint32_t maxRingShift = 20;
+
+} // namespace protocols::ostrace
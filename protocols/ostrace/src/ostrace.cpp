@@ -1,12 +1,82 @@
+#include <string.h>
+#include <mutex>
+#include <vector>
+
 #include <async/oneshot-event.hpp>
+#include <bragi/helpers-all.hpp>
 #include <bragi/helpers-std.hpp>
+#include <frg/span.hpp>
 #include <frg/std_compat.hpp>
+#include <helix/memory.hpp>
+#include <protocols/clock/vdso.hpp>
 #include <protocols/mbus/client.hpp>
 #include <protocols/ostrace/ostrace.hpp>
+#include <protocols/ostrace/ring.hpp>
 #include <ostrace.bragi.hpp>
 
 namespace protocols::ostrace {
 
+namespace {
+
+constexpr uint32_t ringShift = 16;
+constexpr size_t recordAlign = sizeof(size_t);
+// Size of the kernel's buffers for records (including the timestamp).
+constexpr size_t maxRecordSize = 512;
+
+} // anonymous namespace
+
+struct Context::Ring {
+	UserRingHeader *header() {
+		return reinterpret_cast<UserRingHeader *>(mapping.get());
+	}
+
+	char *data() {
+		return reinterpret_cast<char *>(mapping.get()) + ringDataOffset;
+	}
+
+	// Same protocol as the kernel's SingleContextRecordRing.
+	void enqueue(const void *record, size_t recordSize) {
+		auto ringSize = size_t{1} << ringShift;
+		auto effectiveSize = [] (size_t size) {
+			return (sizeof(size_t) + size + recordAlign - 1) & ~(recordAlign - 1);
+		};
+		auto p = reinterpret_cast<const char *>(record);
+		assert(effectiveSize(recordSize) <= ringSize);
+
+		auto enqPtr = __atomic_load_n(&header()->headPtr, __ATOMIC_RELAXED);
+
+		// Compute the invalidated part of the ring buffer.
+		auto invalPtr = __atomic_load_n(&header()->tailPtr, __ATOMIC_RELAXED);
+		while(invalPtr + ringSize < enqPtr + sizeof(size_t) + recordSize) {
+			assert(invalPtr < enqPtr);
+			size_t tailSize;
+			memcpy(&tailSize, data() + (invalPtr & (ringSize - 1)), sizeof(size_t));
+			invalPtr += effectiveSize(tailSize);
+		}
+
+		// Invalidate the ring *before* writing to it.
+		__atomic_store_n(&header()->tailPtr, invalPtr, __ATOMIC_RELEASE);
+
+		// Copy to the ring. Alignment guarantees that the header fits contiguously.
+		auto recordOffset = enqPtr & (ringSize - 1);
+		memcpy(data() + recordOffset, &recordSize, sizeof(size_t));
+		auto preWrapSize = std::min(ringSize - (recordOffset + sizeof(size_t)), recordSize);
+		memcpy(data() + recordOffset + sizeof(size_t), p, preWrapSize);
+		memcpy(data(), p + preWrapSize, recordSize - preWrapSize);
+
+		// Commit the operation *after* writing to the ring.
+		__atomic_store_n(&header()->headPtr, enqPtr + effectiveSize(recordSize), __ATOMIC_RELEASE);
+	}
+
+	helix::UniqueDescriptor memory;
+	helix::Mapping mapping;
+	// The kernel unregisters the ring once this is closed.
+	helix::UniqueLane conversation;
+	helix::UniqueDescriptor clockMemory;
+	helix::Mapping clockMapping;
+	std::mutex mutex;
+};
+
 Context::Context()
 : enabled_{false} { }
 
@@ -65,6 +135,76 @@ async::result<ItemId> Context::announceItem(std::string_view name) {
 	co_return ItemId{resp.id()};
 }
 
+async::result<void> Context::setupRing() {
+	if(!enabled_ || ring_)
+		co_return;
+
+	auto ring = std::make_shared<Ring>();
+
+	HelHandle handle;
+	HEL_CHECK(helAllocateMemory(ringDataOffset + (size_t{1} << ringShift), 0, nullptr, &handle));
+	ring->memory = helix::UniqueDescriptor{handle};
+	ring->mapping = helix::Mapping{ring->memory, 0, ringDataOffset + (size_t{1} << ringShift)};
+	ring->header()->shift = ringShift;
+
+	HEL_CHECK(helAccessClockPage(&handle));
+	ring->clockMemory = helix::UniqueDescriptor{handle};
+	ring->clockMapping = helix::Mapping{ring->clockMemory, 0, 0x1000, kHelMapProtRead};
+
+	managarm::ostrace::RegisterRingReq req;
+
+	auto [offer, sendReq, pushMemory, recvResp] =
+		co_await helix_ng::exchangeMsgs(
+			lane_,
+			helix_ng::offer(
+				helix_ng::want_lane,
+				helix_ng::sendBragiHeadOnly(req, frg::stl_allocator{}),
+				helix_ng::pushDescriptor(ring->memory),
+				helix_ng::recvInline()
+			)
+		);
+
+	HEL_CHECK(offer.error());
+	HEL_CHECK(sendReq.error());
+	HEL_CHECK(pushMemory.error());
+	HEL_CHECK(recvResp.error());
+
+	auto maybeResp = bragi::parse_head_only<managarm::ostrace::Response>(recvResp);
+	recvResp.reset();
+	assert(maybeResp);
+	auto &resp = maybeResp.value();
+	if(resp.error() != managarm::ostrace::Error::SUCCESS) {
+		std::cout << "ostrace: Failed to register ring, falling back to IPC" << std::endl;
+		co_return;
+	}
+
+	ring->conversation = offer.descriptor();
+	ring_ = std::move(ring);
+}
+
+void Context::commitToRing(managarm::ostrace::EventRecord &record) {
+	assert(ring_);
+	auto ts = protocols::clock::getSystemClock(
+			reinterpret_cast<const HelClockPage *>(ring_->clockMapping.get()));
+	record.set_ts(ts);
+
+	// Records are prefixed by their timestamp, like in the kernel's per-CPU rings.
+	auto tailSize = record.size_of_tail();
+	std::vector<char> ser(sizeof(uint64_t) + 8 + tailSize);
+	memcpy(ser.data(), &ts, sizeof(uint64_t));
+	bool encodeSuccess = bragi::write_head_tail(record,
+			frg::span<char>(ser.data() + sizeof(uint64_t), 8),
+			frg::span<char>(ser.data() + sizeof(uint64_t) + 8, tailSize));
+	assert(encodeSuccess);
+
+	// Records that do not fit into the kernel's buffers would be dropped anyway.
+	if(ser.size() >= maxRecordSize)
+		return;
+
+	std::lock_guard lock{ring_->mutex};
+	ring_->enqueue(ser.data(), ser.size());
+}
+
 Event::Event(Context *ctx, EventId id)
 : ctx_{ctx} {
 	live_ = ctx->isActive();
@@ -85,6 +225,15 @@ async::result<void> Event::emit() {
 	if(!live_)
 		co_return;
 
+	if(ctx_->hasRing()) {
+		managarm::ostrace::EventRecord record;
+		record.set_id(req_.id());
+		for(size_t i = 0; i < req_.ctrs_size(); ++i)
+			record.add_ctrs(req_.ctrs(i));
+		ctx_->commitToRing(record);
+		co_return;
+	}
+
 	auto [offer, sendReq, recvResp] =
 		co_await helix_ng::exchangeMsgs(
 			ctx_->getLane(),
@@ -121,7 +270,7 @@ async::result<Context> createContext() {
 
 	// Perform the negotiation request.
 
-	managarm::ostrace::AnnounceItemReq req;
+	managarm::ostrace::NegotiateReq req;
 
 	auto [offer, sendReq, recvResp] =
 		co_await helix_ng::exchangeMsgs(
@@ -145,7 +294,9 @@ async::result<Context> createContext() {
 		co_return Context{std::move(lane), false};
 
 	assert(resp.error() == managarm::ostrace::Error::SUCCESS);
-	co_return Context{std::move(lane), true};
+	Context ctx{std::move(lane), true};
+	co_await ctx.setupRing();
+	co_return ctx;
 }
 
 } // namespace protocols::ostrace
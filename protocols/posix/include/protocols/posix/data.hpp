@@ -10,6 +10,8 @@ struct ManagarmProcessData {
 	void *threadPage;
 	HelHandle *fileTable;
 	void *clockTrackerPage;
+	// Kernel page of type HelClockPage (see protocols/clock/vdso.hpp).
+	void *clockPage;
 };
 
 struct ManagarmServerData {
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace posix {
+
+// Layout of the page that backs an eventfd; processes obtain it by mmap()ing the eventfd.
+// This allows processes to read and write the counter without a round-trip to posix:
+//
+// * To write, a process adds to counter using a CAS loop. If the addition would
+//   overflow, it falls back to write() on the eventfd.
+//   After a successful CAS, it increments seq and, if watched is non-zero,
+//   calls helFutexWake() on seq to notify posix.
+// * To read, a process takes the counter (or decrements it for eventfdSemaphore)
+//   using a CAS loop. If the counter is zero, it falls back to read() on the eventfd.
+//   It increments seq and wakes posix as above.
+//
+// All accesses must be atomic and sequentially consistent; posix sets watched
+// before it inspects seq, such that wakeups are never lost.
+enum EventfdFlags : uint32_t {
+	eventfdSemaphore = 1
+};
+
+struct EventfdPage {
+	uint64_t counter;
+	// Futex that is incremented after each change of counter.
+	int32_t seq;
+	// Non-zero if posix waits for changes of seq.
+	int32_t watched;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+} // namespace posix
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace posix {
+
+// Layout of the memory that is shared between posix and a process that uses an I/O ring.
+// The memory starts with an IoRingHeader, followed by the submission queue (an array of
+// IoRingSqe) at sqOffset and the completion queue (an array of IoRingCqe) at cqOffset.
+// Head and tail indices increase monotonically and wrap around at 2^32;
+// they are taken modulo the number of entries of the respective queue.
+// The process produces SQEs (i.e., it owns sqTail) and consumes CQEs (i.e., it owns cqHead).
+
+enum IoRingOpcode : uint8_t {
+	ioRingNop = 0,
+	// Reads into addr (from the current file position if offset is negative).
+	ioRingRead = 1,
+	// Writes from addr (to the current file position if offset is negative).
+	ioRingWrite = 2,
+	// Accepts a connection; the result is the new file descriptor.
+	ioRingAccept = 3,
+	// Like ioRingRead and ioRingWrite but addr points to an array of length struct iovecs.
+	ioRingReadv = 4,
+	ioRingWritev = 5,
+	// Sends from or receives into addr on a connected socket, with the flags in msgFlags.
+	// Only sockets that posix implements itself (e.g., AF_UNIX) are supported;
+	// other files complete with -EOPNOTSUPP. MSG_DONTWAIT is the only supported flag.
+	ioRingSend = 6,
+	ioRingRecv = 7,
+};
+
+// Values of IoRingSqe::flags. The bits match the IOSQE_* flags of Linux.
+enum IoRingSqeFlags : uint8_t {
+	// Links the SQE to the next one (IOSQE_IO_LINK and IOSQE_IO_HARDLINK).
+	// Linked SQEs are not supported: the SQE completes with -EINVAL and
+	// the remaining SQEs of its chain complete with -ECANCELED.
+	ioRingSqeLink = 1 << 2,
+	ioRingSqeHardLink = 1 << 3,
+};
+
+struct IoRingSqe {
+	uint8_t opcode;
+	uint8_t flags;
+	uint16_t reserved0;
+	int32_t fd;
+	int64_t offset;
+	uint64_t addr;
+	uint32_t length;
+	uint32_t msgFlags;
+	uint64_t userData;
+};
+
+struct IoRingCqe {
+	uint64_t userData;
+	// Non-negative on success, otherwise a negated errno value.
+	int64_t result;
+};
+
+struct IoRingHeader {
+	uint32_t sqHead;
+	uint32_t sqTail;
+	uint32_t cqHead;
+	uint32_t cqTail;
+	uint32_t sqEntries;
+	uint32_t cqEntries;
+	uint32_t sqOffset;
+	uint32_t cqOffset;
+};
+
+} // namespace posix
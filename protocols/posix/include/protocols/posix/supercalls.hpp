@@ -19,6 +19,9 @@ inline constexpr uint32_t superSigAltStack = 12;
 inline constexpr uint32_t superSigSuspend = 13;
 inline constexpr uint32_t superGetTid = 14;
 inline constexpr uint32_t superSigGetPending = 15;
+// Like superFork, but the child shares the address space of the parent.
+// The parent is suspended until the child calls execve() or exits.
+inline constexpr uint32_t superVfork = 16;
 inline constexpr uint32_t superGetServerData = 64;
 
 } // namespace posix
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace posix {
+
+// Layout of the records returned by reads of /proc/taskstats.
+// The file consists of one TaskStats record per process, ordered by PID.
+// New fields are only ever appended; readers must advance by recordSize bytes
+// (and must not access fields beyond recordSize) to stay compatible.
+
+struct TaskStats {
+	uint32_t recordSize;
+	int32_t pid;
+	int32_t ppid;
+	int32_t pgrp;
+	int32_t sid;
+	int32_t uid;
+	int32_t gid;
+	int32_t reserved;
+	// User time of all terminated children, in nanoseconds.
+	uint64_t childrenUserTime;
+	// Changes whenever any of the fields of this record (except for the time) changes.
+	// Readers can use this to avoid re-parsing /proc/[pid] files.
+	uint64_t generation;
+	// Null-terminated, like /proc/[pid]/comm.
+	char comm[16];
+};
+
+} // namespace posix
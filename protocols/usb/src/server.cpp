@@ -52,6 +52,56 @@ auto handleXferReq(auto req, auto &endpoint, auto &&...xferArgs) {
 	return endpoint.transfer(xfer);
 };
 
+// Passes the transfer to the endpoint right away (i.e., before the first suspension point),
+// such that it reaches the HCD in the order in which the requests were received.
+async::detached handleTransfer(managarm::usb::TransferRequest req, Endpoint endpoint,
+		helix::UniqueDescriptor conversation, arch::dma_buffer buffer) {
+	frg::expected<UsbError, uint64_t> outcome;
+
+	switch (req.type()) {
+		using enum managarm::usb::XferType;
+		case INTERRUPT:
+			outcome = co_await handleXferReq<InterruptTransfer>(&req, endpoint, buffer);
+			break;
+		case BULK:
+			outcome = co_await handleXferReq<BulkTransfer>(&req, endpoint, buffer);
+			break;
+		default:
+			assert(!"Unexpected transfer type");
+			co_return;
+	}
+
+	if (!outcome) {
+		co_await respondWithError(conversation, outcome.error());
+		co_return;
+	}
+
+	auto length = outcome.value();
+
+	managarm::usb::SvrResponse resp;
+	resp.set_error(managarm::usb::Errors::SUCCESS);
+
+	if (req.dir() == managarm::usb::XferDirection::TO_HOST) {
+		auto [sendResp, sendData] =
+			co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
+				helix_ng::sendBuffer(buffer.data(), length)
+			);
+
+		HEL_CHECK(sendResp.error());
+		HEL_CHECK(sendData.error());
+	} else {
+		auto [sendResp] =
+			co_await helix_ng::exchangeMsgs(
+				conversation,
+				helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+			);
+
+		HEL_CHECK(sendResp.error());
+	}
+}
+
 } // namespace anonymous
 
 async::detached serveEndpoint(Endpoint endpoint, helix::UniqueLane lane) {
@@ -94,54 +144,16 @@ async::detached serveEndpoint(Endpoint endpoint, helix::UniqueLane lane) {
 				HEL_CHECK(recvBuffer.error());
 			}
 
-			frg::expected<UsbError, uint64_t> outcome;
-
-			switch (req->type()) {
-				using enum managarm::usb::XferType;
-				case INTERRUPT:
-					outcome = co_await handleXferReq<InterruptTransfer>(req, endpoint, buffer);
-					break;
-				case BULK:
-					outcome = co_await handleXferReq<BulkTransfer>(req, endpoint, buffer);
-					break;
-					// TODO(qookie): Support control EPs
-					//case CONTROL:
-					//	outcome = co_await handleXferReq<ControlTransfer>(req, endpoint, buffer);
-					//	break;
-				default:
-					std::cout << "Unexpected endpoint type\n";
-					co_return;
-			}
-
-			if (!outcome) {
-				co_await respondWithError(conversation, outcome.error());
-				continue;
+			if (req->type() != managarm::usb::XferType::INTERRUPT
+					&& req->type() != managarm::usb::XferType::BULK) {
+				// TODO(qookie): Support control EPs
+				std::cout << "Unexpected endpoint type\n";
+				co_return;
 			}
 
-			auto length = outcome.value();
-
-			managarm::usb::SvrResponse resp;
-			resp.set_error(managarm::usb::Errors::SUCCESS);
-
-			if (req->dir() == managarm::usb::XferDirection::TO_HOST) {
-				auto [sendResp, sendData] =
-					co_await helix_ng::exchangeMsgs(
-						conversation,
-						helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{}),
-						helix_ng::sendBuffer(buffer.data(), length)
-					);
-
-				HEL_CHECK(sendResp.error());
-				HEL_CHECK(sendData.error());
-			} else {
-				auto [sendResp] =
-					co_await helix_ng::exchangeMsgs(
-						conversation,
-						helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
-					);
-
-				HEL_CHECK(sendResp.error());
-			}
+			// Do not wait for the transfer to complete before accepting the next
+			// request; this allows clients to queue multiple transfers.
+			handleTransfer(std::move(*req), endpoint, std::move(conversation), std::move(buffer));
 		}else{
 			managarm::usb::SvrResponse resp;
 			resp.set_error(managarm::usb::Errors::ILLEGAL_REQUEST);
@@ -10,6 +10,7 @@
 #include <optional>
 #include <ostream>
 #include <protocols/mbus/client.hpp>
+#include <span>
 #include <unordered_map>
 
 namespace nic {
@@ -49,8 +50,54 @@ enum EtherType : uint16_t {
 	ETHER_TYPE_ARP = 0x0806,
 };
 
-// TODO(arsen): Expose interface for csum offloading, constructing frames, and
-// other features of NICs
+// Offloads that a Link implements in hardware, see Link::offloads().
+enum Offload : uint32_t {
+	// The L4 checksum of outgoing frames can be completed by the NIC.
+	OFFLOAD_TX_CSUM = 1 << 0,
+	// The NIC reports whether the L4 checksum of incoming frames is valid.
+	OFFLOAD_RX_CSUM = 1 << 1,
+	// The NIC can segment outgoing TCP/IPv4 frames (TSO).
+	OFFLOAD_TSO4 = 1 << 2,
+};
+
+// Per-frame information for Link::sendOffloaded(). All offsets are in bytes from the
+// start of the frame. The layout matches struct virtio_net_hdr, such that drivers can
+// translate it directly.
+struct TxMetadata {
+	// If set, the L4 checksum at csumStart + csumOffset is computed over all bytes
+	// starting at csumStart. The checksum field must contain the (non-complemented)
+	// sum of the pseudo header; for TSO, the pseudo header's length is taken as zero.
+	bool needsChecksum = false;
+	uint16_t csumStart = 0;
+	uint16_t csumOffset = 0;
+
+	// If non-zero, the frame is a TCP/IPv4 super-segment: its payload is split into
+	// segments of gsoSize bytes that each carry a copy of the first headerLength bytes
+	// (with fixed up IPv4 length, IPv4 identification and TCP sequence number).
+	uint16_t gsoSize = 0;
+	uint16_t headerLength = 0;
+	// Offset of the IPv4 header.
+	uint16_t networkOffset = 0;
+};
+
+// Per-frame information returned by Link::receiveBatch().
+struct RxMetadata {
+	// The NIC verified the L4 checksum (or the frame was never checksummed since
+	// it comes from a peer that offloads the checksum, e.g., in virtio).
+	bool checksumValid = false;
+};
+
+// A frame returned by Link::receiveBatch().
+struct RxFrame {
+	// Buffer that holds the frame, allocated by the Link.
+	arch::dma_buffer buffer;
+	// Offset of the frame within buffer.
+	size_t offset = 0;
+	size_t length = 0;
+	RxMetadata meta;
+};
+
+// TODO(arsen): Expose interface for constructing frames, and other features of NICs
 struct Link {
 	struct AllocatedBuffer {
 		arch::dma_buffer frame;
@@ -63,6 +110,23 @@ struct Link {
 	virtual async::result<size_t> receive(arch::dma_buffer_view) = 0;
 	//! Sends an entire ethernet frame
 	virtual async::result<void> send(const arch::dma_buffer_view) = 0;
+	//! Receives at least one and at most frames.size() frames, returns the number of frames.
+	//! Only waits for the first frame; the remaining frames are those that are already
+	//! available. Links override this to drain their rings in bursts (and to report
+	//! offload results); by default, it forwards to receive().
+	virtual async::result<size_t> receiveBatch(std::span<RxFrame> frames);
+	//! Sends multiple entire frames. Links override this to notify the NIC only once
+	//! per batch; by default, it forwards to send().
+	virtual async::result<void> sendBatch(std::span<const arch::dma_buffer_view> frames);
+	//! Sends a frame that may need a checksum or segmentation according to the metadata.
+	//! Links override this for the offloads that they advertise; by default, the
+	//! work is done in software and the resulting frames are passed to send().
+	virtual async::result<void> sendOffloaded(const arch::dma_buffer_view, const TxMetadata &);
+
+	uint32_t offloads() {
+		return offloads_;
+	}
+
 	arch::dma_pool *dmaPool();
 	AllocatedBuffer allocateFrame(size_t payloadSize);
 	AllocatedBuffer allocateFrame(MacAddress to, EtherType type,
@@ -106,6 +170,9 @@ protected:
 	bool l1_up_ = false;
 
 	bool raw_ip_ = false;
+
+	// Bitmask of Offload, set by the driver.
+	uint32_t offloads_ = 0;
 };
 
 async::detached runDevice(std::shared_ptr<Link> dev);
@@ -132,39 +132,51 @@ void Neighbours::feedArp(nic::MacAddress, arch::dma_buffer_view view, std::weak_
 	async::detach(sendArp(2, targetProto, senderHw, senderProto));
 }
 
+namespace {
+void updateStale(Neighbours::Entry &entry, uint64_t time) {
+	if (entry.state == Neighbours::State::reachable
+			&& entry.mtime_ns + Neighbours::staleTimeMs * 1'000'000 <= time) {
+		entry.state = Neighbours::State::stale;
+	}
+}
+} // namespace
+
 Neighbours::Entry &Neighbours::getEntry(uint32_t ip) {
 	uint64_t time;
 	HEL_CHECK(helGetClock(&time));
 	if (auto f = table_.find(ip); f != table_.end()) {
-		if (time + staleTimeMs * 1'000'000 <= f->second.mtime_ns) {
-			f->second.state = State::stale;
-		}
+		updateStale(f->second, time);
 		return f->second;
 	}
 	auto &entry = table_.emplace(std::piecewise_construct,
 		std::make_tuple(ip), std::make_tuple()).first->second;
+	entry.ip = ip;
 	entry.mtime_ns = time;
 	return entry;
 }
 
 void Neighbours::updateTable(uint32_t ip, nic::MacAddress mac, std::weak_ptr<nic::Link> link) {
 	auto &entry = getEntry(ip);
+	HEL_CHECK(helGetClock(&entry.mtime_ns));
 	entry.mac = mac;
+	entry.hasMac = true;
 	entry.state = State::reachable;
 	entry.link = std::move(link);
 
 	entry.change.raise();
 }
 
-std::map<uint32_t, Neighbours::Entry> &Neighbours::getTable() {
+std::unordered_map<uint32_t, Neighbours::Entry> &Neighbours::getTable() {
 	return table_;
 }
 
 namespace {
-async::detached entryProber(uint32_t ip, Neighbours::Entry &e, uint32_t sender) {
+async::detached entryProber(Neighbours::Entry &e, uint32_t sender) {
 	e.state = Neighbours::State::probe;
 	for (int i = 0; i < 3; i++) {
-		co_await sendArp(1, sender, {}, ip);
+		// Re-validate stale entries by unicast (as in RFC 4861, section 7.3.3);
+		// sendArp() broadcasts if we do not know the address yet.
+		co_await sendArp(1, sender, e.hasMac ? e.mac : nic::MacAddress{}, e.ip);
 		std::cout << "netserver: sent arp req" << std::endl;
 
 		async::cancellation_event ev;
@@ -177,18 +189,36 @@ async::detached entryProber(uint32_t ip, Neighbours::Entry &e, uint32_t sender)
 		}
 	}
 	e.state = Neighbours::State::failed;
+	e.hasMac = false;
 	e.change.raise();
 }
 } // namespace
 
 async::result<std::optional<nic::MacAddress>> Neighbours::tryResolve(uint32_t ip,
 		uint32_t sender) {
-	auto &entry = getEntry(ip);
+	return tryResolve(getEntry(ip), sender);
+}
+
+async::result<std::optional<nic::MacAddress>> Neighbours::tryResolve(Entry &entry,
+		uint32_t sender) {
+	uint64_t time;
+	HEL_CHECK(helGetClock(&time));
+	updateStale(entry, time);
+
 	if (entry.state == State::reachable) {
 		co_return entry.mac;
 	}
+	// Keep sending to the old address while it is re-validated in the background.
+	if (entry.state == State::stale) {
+		entryProber(entry, sender);
+		co_return entry.mac;
+	}
+	if (entry.state == State::probe && entry.hasMac) {
+		co_return entry.mac;
+	}
+
 	if (entry.state != State::probe) {
-		entryProber(ip, entry, sender);
+		entryProber(entry, sender);
 	}
 	co_await entry.change.async_wait();
 	if (entry.state != State::reachable) {
@@ -3,8 +3,8 @@
 #include <async/recurring-event.hpp>
 #include <memory>
 #include <netserver/nic.hpp>
-#include <map>
 #include <optional>
+#include <unordered_map>
 
 struct Neighbours {
 	static constexpr uint64_t staleTimeMs = 30'000;
@@ -15,21 +15,31 @@ struct Neighbours {
 		reachable,
 		stale
 	};
+	// Entries are never removed from the table, hence references to them stay valid
+	// (e.g., in Ip4TargetInfo).
 	struct Entry {
+		uint32_t ip;
+		// Time of the last confirmation of mac.
 		uint64_t mtime_ns;
 		nic::MacAddress mac;
+		// Set once mac was learned; stale entries and entries that are being
+		// re-validated keep using the old mac.
+		bool hasMac = false;
 		async::recurring_event change;
 		State state = State::none;
 		std::weak_ptr<nic::Link> link;
 	};
 	async::result<std::optional<nic::MacAddress>> tryResolve(uint32_t addr,
 		uint32_t sender);
+	async::result<std::optional<nic::MacAddress>> tryResolve(Entry &entry,
+		uint32_t sender);
 	void feedArp(nic::MacAddress destination, arch::dma_buffer_view arpData, std::weak_ptr<nic::Link> link);
 	void updateTable(uint32_t proto, nic::MacAddress hardware, std::weak_ptr<nic::Link> link);
-	std::map<uint32_t, Neighbours::Entry> &getTable();
-private:
+	std::unordered_map<uint32_t, Neighbours::Entry> &getTable();
+	// Creates the entry if it does not exist yet.
 	Entry &getEntry(uint32_t addr);
-	std::map<uint32_t, Entry> table_;
+private:
+	std::unordered_map<uint32_t, Entry> table_;
 };
 
 Neighbours &neigh4();
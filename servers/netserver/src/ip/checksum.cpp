@@ -1,6 +1,140 @@
 #include "checksum.hpp"
 
 #include <arch/bit.hpp>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// The one's complement sum does not depend on the byte order (RFC1071, section 2(B)),
+// hence the functions below sum words in native byte order; the folded result
+// is swapped to network byte order at the end.
+
+uint64_t addWithCarry(uint64_t sum, uint64_t value) {
+	sum += value;
+	return sum + (sum < value);
+}
+
+uint64_t loadWord(const unsigned char *data) {
+	uint64_t word;
+	memcpy(&word, data, sizeof(uint64_t));
+	return word;
+}
+
+// Sums the trailing size < 8 bytes.
+uint64_t sumTail(uint64_t sum, const unsigned char *data, size_t size) {
+	uint64_t word = 0;
+	memcpy(&word, data, size);
+	return addWithCarry(sum, word);
+}
+
+uint64_t sumGeneric(const unsigned char *data, size_t size) {
+	uint64_t sum = 0;
+	// Four independent chains keep multiple adders busy.
+	uint64_t sums[4] = {};
+	while(size >= 32) {
+		for(int i = 0; i < 4; i++)
+			sums[i] = addWithCarry(sums[i], loadWord(data + 8 * i));
+		data += 32;
+		size -= 32;
+	}
+	for(int i = 0; i < 4; i++)
+		sum = addWithCarry(sum, sums[i]);
+
+	while(size >= 8) {
+		sum = addWithCarry(sum, loadWord(data));
+		data += 8;
+		size -= 8;
+	}
+	return sumTail(sum, data, size);
+}
+
+#if defined(__x86_64__)
+
+[[gnu::target("avx2")]]
+uint64_t sumAvx2(const unsigned char *data, size_t size) {
+	// Zero-extend 32-bit words into 64-bit lanes such that the additions cannot overflow.
+	auto zero = _mm256_setzero_si256();
+	auto lo = _mm256_setzero_si256();
+	auto hi = _mm256_setzero_si256();
+	while(size >= 32) {
+		auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data));
+		lo = _mm256_add_epi64(lo, _mm256_unpacklo_epi32(v, zero));
+		hi = _mm256_add_epi64(hi, _mm256_unpackhi_epi32(v, zero));
+		data += 32;
+		size -= 32;
+	}
+
+	alignas(32) uint64_t lanes[4];
+	_mm256_store_si256(reinterpret_cast<__m256i *>(lanes), _mm256_add_epi64(lo, hi));
+
+	uint64_t sum = 0;
+	for(auto lane : lanes)
+		sum = addWithCarry(sum, lane);
+	while(size >= 8) {
+		sum = addWithCarry(sum, loadWord(data));
+		data += 8;
+		size -= 8;
+	}
+	return sumTail(sum, data, size);
+}
+
+#elif defined(__aarch64__)
+
+uint64_t sumNeon(const unsigned char *data, size_t size) {
+	// vpadalq_u32() adds pairs of 32-bit words into 64-bit lanes, which cannot overflow.
+	auto acc = vdupq_n_u64(0);
+	while(size >= 16) {
+		acc = vpadalq_u32(acc, vreinterpretq_u32_u8(vld1q_u8(data)));
+		data += 16;
+		size -= 16;
+	}
+
+	auto sum = addWithCarry(vgetq_lane_u64(acc, 0), vgetq_lane_u64(acc, 1));
+	while(size >= 8) {
+		sum = addWithCarry(sum, loadWord(data));
+		data += 8;
+		size -= 8;
+	}
+	return sumTail(sum, data, size);
+}
+
+#endif
+
+// Vector registers only pay off for larger buffers (e.g., payloads but not headers).
+constexpr size_t vectorThreshold = 256;
+
+using SumFunction = uint64_t (*)(const unsigned char *, size_t);
+
+SumFunction selectLargeSum() {
+#if defined(__x86_64__)
+	// We run during static initialization, possibly before libgcc initialized its CPU model.
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		return &sumAvx2;
+#elif defined(__aarch64__)
+	// NEON is mandatory on AArch64.
+	return &sumNeon;
+#endif
+	return &sumGeneric;
+}
+
+const SumFunction largeSum = selectLargeSum();
+
+uint16_t fold(uint64_t sum) {
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 32) + (sum & 0xffffffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum = (sum >> 16) + (sum & 0xffff);
+	return sum;
+}
+
+} // anonymous namespace
 
 void Checksum::update(uint16_t word)  {
 	state_ += word;
@@ -11,15 +145,17 @@ void Checksum::update(uint16_t word)  {
 
 void Checksum::update(const void *data, size_t size) {
 	using namespace arch;
-	auto iter = static_cast<const unsigned char*>(data);
-	if (size % 2 != 0) {
-		size--;
-		update(iter[size] << 8);
-	}
-	auto end = iter + size;
-	for (; iter < end; iter += 2) {
-		update(iter[0] << 8 | iter[1]);
+	auto bytes = static_cast<const unsigned char *>(data);
+
+	// An odd trailing byte is padded with zero (i.e., it is the high byte of the last word).
+	uint64_t sum;
+	if(size >= vectorThreshold) {
+		sum = largeSum(bytes, size);
+	}else{
+		sum = sumGeneric(bytes, size);
 	}
+
+	update(convert_endian<endian::big, endian::native>(fold(sum)));
 }
 
 void Checksum::update(arch::dma_buffer_view view) {
@@ -30,3 +166,16 @@ uint16_t Checksum::finalize() {
 	auto state_ = this->state_;
 	return ~state_;
 }
+
+uint16_t Checksum::sum() const {
+	return state_;
+}
+
+uint16_t Checksum::adjust(uint16_t checksum, uint16_t old_word, uint16_t new_word) {
+	// HC' = ~(~HC + ~m + m'), see RFC1624, section 3.
+	Checksum csum;
+	csum.update(static_cast<uint16_t>(~checksum));
+	csum.update(static_cast<uint16_t>(~old_word));
+	csum.update(new_word);
+	return csum.finalize();
+}
@@ -8,6 +8,13 @@ struct Checksum {
 	void update(const void *mem, size_t size);
 	void update(arch::dma_buffer_view area);
 	uint16_t finalize();
+	// Returns the folded sum without complementing it, e.g., to seed a checksum
+	// that is completed by the NIC.
+	uint16_t sum() const;
+
+	// Returns the checksum after a 16-bit word that it covers changed from old_word to new_word
+	// (e.g., for header rewrites), without summing the data again.
+	static uint16_t adjust(uint16_t checksum, uint16_t old_word, uint16_t new_word);
 
 private:
 	uint32_t state_ = 0;
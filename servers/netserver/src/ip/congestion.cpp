@@ -0,0 +1,372 @@
+#include "congestion.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+void TcpCongestionControl::onFastRetransmit(uint32_t inFlight, uint64_t) {
+	ssthresh_ = lossThreshold_(inFlight);
+	cwnd_ = ssthresh_ + 3 * mss_;
+}
+
+void TcpCongestionControl::onDuplicateAck() {
+	// Each duplicate ACK indicates that a segment left the network.
+	cwnd_ += mss_;
+}
+
+void TcpCongestionControl::onPartialAck(const TcpAckSample &sample) {
+	// Deflate the window by the amount of new data (RFC 6582, section 3.2).
+	cwnd_ = (cwnd_ > sample.ackedBytes ? cwnd_ - sample.ackedBytes : 0) + mss_;
+}
+
+void TcpCongestionControl::onRecoveryExit(uint32_t inFlight) {
+	cwnd_ = std::min(ssthresh_, inFlight + mss_);
+}
+
+void TcpCongestionControl::onRetransmissionTimeout(uint32_t inFlight, uint64_t) {
+	ssthresh_ = lossThreshold_(inFlight);
+	cwnd_ = mss_;
+}
+
+uint32_t TcpCongestionControl::lossThreshold_(uint32_t inFlight) {
+	// See RFC 5681, section 3.1.
+	return std::max(inFlight / 2, 2 * mss_);
+}
+
+namespace {
+
+// Upper bound of the congestion window, such that the arithmetic below does not overflow.
+constexpr uint32_t maxCwnd = uint32_t{1} << 30;
+
+// Slow start with appropriate byte counting (RFC 3465) and L = 2 * MSS.
+uint32_t slowStart(uint32_t cwnd, uint32_t mss, const TcpAckSample &sample) {
+	return std::min(cwnd + std::min(sample.ackedBytes, 2 * mss), maxCwnd);
+}
+
+struct RenoCongestionControl final : TcpCongestionControl {
+	using TcpCongestionControl::TcpCongestionControl;
+
+	std::string_view name() const override {
+		return "reno";
+	}
+
+	void onAck(const TcpAckSample &sample) override {
+		// Do not grow the window if it is not used (RFC 7661).
+		if(sample.appLimited)
+			return;
+
+		if(cwnd_ < ssthresh_) {
+			cwnd_ = slowStart(cwnd_, mss_, sample);
+			return;
+		}
+
+		// Congestion avoidance: grow by one MSS per window of acknowledged data.
+		ackedInWindow_ += sample.ackedBytes;
+		if(ackedInWindow_ >= cwnd_) {
+			ackedInWindow_ -= cwnd_;
+			cwnd_ = std::min(cwnd_ + mss_, maxCwnd);
+		}
+	}
+
+private:
+	uint32_t ackedInWindow_ = 0;
+};
+
+// CUBIC as specified by RFC 9438. Windows are computed in units of segments.
+struct CubicCongestionControl final : TcpCongestionControl {
+	static constexpr double c = 0.4;
+	static constexpr double beta = 0.7;
+
+	using TcpCongestionControl::TcpCongestionControl;
+
+	std::string_view name() const override {
+		return "cubic";
+	}
+
+	void onAck(const TcpAckSample &sample) override {
+		if(sample.rtt && (!minRtt_ || sample.rtt < minRtt_))
+			minRtt_ = sample.rtt;
+
+		if(sample.appLimited)
+			return;
+
+		if(cwnd_ < ssthresh_) {
+			cwnd_ = slowStart(cwnd_, mss_, sample);
+			return;
+		}
+
+		double segments = cwnd_ / double(mss_);
+		double acked = sample.ackedBytes / double(mss_);
+
+		// Start a new congestion avoidance epoch (section 4.2).
+		if(!epochStart_) {
+			epochStart_ = sample.now;
+			if(segments < wMax_) {
+				k_ = std::cbrt((wMax_ - segments) / c);
+				origin_ = wMax_;
+			}else{
+				k_ = 0;
+				origin_ = segments;
+			}
+			wEst_ = segments;
+		}
+
+		auto cubic = [&] (uint64_t time) {
+			double t = (time - epochStart_) / 1e9 - k_;
+			return origin_ + c * t * t * t;
+		};
+
+		// Reno-friendly region (section 4.3).
+		constexpr double alpha = 3 * (1 - beta) / (1 + beta);
+		wEst_ += alpha * acked / segments;
+
+		double next;
+		if(cubic(sample.now) < wEst_) {
+			next = wEst_;
+		}else{
+			// Concave and convex regions (sections 4.4 and 4.5).
+			double target = std::clamp(cubic(sample.now + minRtt_), segments, 1.5 * segments);
+			next = segments + (target - segments) / segments * acked;
+		}
+		cwnd_ = std::min(static_cast<uint32_t>(next * mss_), maxCwnd);
+	}
+
+protected:
+	uint32_t lossThreshold_(uint32_t) override {
+		double segments = cwnd_ / double(mss_);
+
+		// Fast convergence (section 4.7).
+		if(segments < wMax_) {
+			wMax_ = segments * (1 + beta) / 2;
+		}else{
+			wMax_ = segments;
+		}
+		epochStart_ = 0;
+
+		// Multiplicative decrease (section 4.6).
+		return std::max(static_cast<uint32_t>(cwnd_ * beta), 2 * mss_);
+	}
+
+private:
+	// Window before the last reduction.
+	double wMax_ = 0;
+	// Start of the current congestion avoidance epoch (zero if there is none).
+	uint64_t epochStart_ = 0;
+	double k_ = 0;
+	double origin_ = 0;
+	// Window that Reno would have in the current epoch.
+	double wEst_ = 0;
+	uint64_t minRtt_ = 0;
+};
+
+// BBR (version 1), see draft-cardwell-iccrg-bbr-congestion-control-00.
+// The delivery rate is sampled once per round trip.
+struct BbrCongestionControl final : TcpCongestionControl {
+	static constexpr double highGain = 2.885; // 2 / ln(2).
+	static constexpr double drainGain = 1 / highGain;
+	static constexpr double cwndGain = 2;
+	static constexpr std::array<double, 8> probeBwGains{1.25, 0.75, 1, 1, 1, 1, 1, 1};
+	static constexpr size_t btlBwFilterRounds = 10;
+	static constexpr uint64_t rtPropFilterLength = 10'000'000'000;
+	static constexpr uint64_t probeRttDuration = 200'000'000;
+
+	enum class Mode {
+		startup,
+		drain,
+		probeBw,
+		probeRtt
+	};
+
+	BbrCongestionControl(uint32_t mss, uint32_t cwnd)
+	: TcpCongestionControl{mss, cwnd}, initialCwnd_{cwnd} { }
+
+	std::string_view name() const override {
+		return "bbr";
+	}
+
+	void onAck(const TcpAckSample &sample) override {
+		updateModel_(sample);
+
+		uint32_t minCwnd = 4 * mss_;
+		if(mode_ == Mode::probeRtt) {
+			cwnd_ = minCwnd;
+			return;
+		}
+
+		double bdp = btlBw_() * rtProp_ / 1e9;
+		if(!bdp) {
+			cwnd_ = std::min(cwnd_ + sample.ackedBytes, maxCwnd);
+			return;
+		}
+
+		auto gain = mode_ == Mode::startup ? highGain : cwndGain;
+		auto target = std::max(static_cast<uint32_t>(std::min(gain * bdp, double{maxCwnd})), minCwnd);
+		if(filledPipe_) {
+			cwnd_ = std::min(cwnd_ + sample.ackedBytes, target);
+		}else if(cwnd_ < target || sample.delivered < initialCwnd_) {
+			cwnd_ = std::min(cwnd_ + sample.ackedBytes, maxCwnd);
+		}
+		cwnd_ = std::max(cwnd_, minCwnd);
+	}
+
+	// BBR does not treat losses as a congestion signal. During recovery,
+	// it only sends as much data as leaves the network (packet conservation).
+
+	void onFastRetransmit(uint32_t inFlight, uint64_t) override {
+		priorCwnd_ = cwnd_;
+		cwnd_ = inFlight + mss_;
+	}
+
+	void onPartialAck(const TcpAckSample &sample) override {
+		updateModel_(sample);
+		cwnd_ = std::max(cwnd_, sample.inFlight + mss_);
+	}
+
+	void onRecoveryExit(uint32_t) override {
+		cwnd_ = std::max(cwnd_, priorCwnd_);
+	}
+
+	void onRetransmissionTimeout(uint32_t, uint64_t) override {
+		priorCwnd_ = cwnd_;
+		cwnd_ = mss_;
+	}
+
+private:
+	double btlBw_() {
+		return *std::max_element(btlBwSamples_.begin(), btlBwSamples_.end());
+	}
+
+	void updateModel_(const TcpAckSample &sample) {
+		bool rtPropExpired = rtPropStamp_ && sample.now - rtPropStamp_ > rtPropFilterLength;
+		if(sample.rtt && (!rtProp_ || sample.rtt <= rtProp_ || rtPropExpired)) {
+			rtProp_ = sample.rtt;
+			rtPropStamp_ = sample.now;
+		}
+
+		// A round trip ends once the data that was in flight at its start is delivered.
+		if(sample.delivered >= nextRoundDelivered_) {
+			if(roundStart_ && sample.now > roundStart_) {
+				double rate = (sample.delivered - roundStartDelivered_) * 1e9
+						/ (sample.now - roundStart_);
+				// App-limited samples only count if they exceed the estimate.
+				auto &slot = btlBwSamples_[rounds_ % btlBwFilterRounds];
+				slot = (!sample.appLimited || rate > btlBw_()) ? rate : btlBw_();
+				++rounds_;
+
+				if(!filledPipe_ && !sample.appLimited)
+					checkFullPipe_();
+			}
+			roundStart_ = sample.now;
+			roundStartDelivered_ = sample.delivered;
+			nextRoundDelivered_ = sample.delivered + sample.inFlight;
+		}
+
+		double bdp = btlBw_() * rtProp_ / 1e9;
+		switch(mode_) {
+		case Mode::startup:
+			if(filledPipe_)
+				mode_ = Mode::drain;
+			break;
+		case Mode::drain:
+			if(sample.inFlight <= bdp)
+				enterProbeBw_(sample.now);
+			break;
+		case Mode::probeBw:
+			if(sample.now - cycleStamp_ > rtProp_) {
+				cycleIndex_ = (cycleIndex_ + 1) % probeBwGains.size();
+				cycleStamp_ = sample.now;
+			}
+			break;
+		case Mode::probeRtt:
+			if(!probeRttDone_ && sample.inFlight <= 4 * mss_) {
+				probeRttDone_ = sample.now + probeRttDuration;
+			}else if(probeRttDone_ && sample.now >= probeRttDone_) {
+				rtPropStamp_ = sample.now;
+				cwnd_ = std::max(cwnd_, priorCwnd_);
+				if(filledPipe_) {
+					enterProbeBw_(sample.now);
+				}else{
+					mode_ = Mode::startup;
+				}
+			}
+			break;
+		}
+
+		if(mode_ != Mode::probeRtt && rtPropExpired && rtProp_) {
+			mode_ = Mode::probeRtt;
+			probeRttDone_ = 0;
+			priorCwnd_ = cwnd_;
+		}
+
+		updatePacingRate_();
+	}
+
+	void checkFullPipe_() {
+		// The pipe is full if the bandwidth did not grow by 25% in three rounds.
+		if(btlBw_() >= fullBw_ * 1.25) {
+			fullBw_ = btlBw_();
+			fullBwRounds_ = 0;
+			return;
+		}
+		if(++fullBwRounds_ >= 3)
+			filledPipe_ = true;
+	}
+
+	void enterProbeBw_(uint64_t now) {
+		mode_ = Mode::probeBw;
+		// Do not start with the draining phase.
+		cycleIndex_ = 2;
+		cycleStamp_ = now;
+	}
+
+	void updatePacingRate_() {
+		double gain = 1;
+		switch(mode_) {
+		case Mode::startup: gain = highGain; break;
+		case Mode::drain: gain = drainGain; break;
+		case Mode::probeBw: gain = probeBwGains[cycleIndex_]; break;
+		case Mode::probeRtt: gain = 1; break;
+		}
+
+		double rate = btlBw_();
+		if(!rate && rtProp_)
+			rate = cwnd_ * 1e9 / rtProp_;
+		pacingRate_ = gain * rate;
+	}
+
+	uint32_t initialCwnd_;
+	Mode mode_ = Mode::startup;
+
+	// Windowed maximum of the delivery rate (in bytes per second) over the last rounds.
+	std::array<double, btlBwFilterRounds> btlBwSamples_{};
+	uint64_t rounds_ = 0;
+	uint64_t roundStart_ = 0;
+	uint64_t roundStartDelivered_ = 0;
+	uint64_t nextRoundDelivered_ = 0;
+
+	// Windowed minimum of the RTT and the time at which it was measured.
+	uint64_t rtProp_ = 0;
+	uint64_t rtPropStamp_ = 0;
+
+	bool filledPipe_ = false;
+	double fullBw_ = 0;
+	int fullBwRounds_ = 0;
+
+	size_t cycleIndex_ = 0;
+	uint64_t cycleStamp_ = 0;
+	uint64_t probeRttDone_ = 0;
+	uint32_t priorCwnd_ = 0;
+};
+
+} // anonymous namespace
+
+std::unique_ptr<TcpCongestionControl> makeTcpCongestionControl(std::string_view name,
+		uint32_t mss, uint32_t cwnd) {
+	if(name == "reno")
+		return std::make_unique<RenoCongestionControl>(mss, cwnd);
+	if(name == "cubic")
+		return std::make_unique<CubicCongestionControl>(mss, cwnd);
+	if(name == "bbr")
+		return std::make_unique<BbrCongestionControl>(mss, cwnd);
+	return nullptr;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string_view>
+
+// Information about an ACK that acknowledged new data.
+struct TcpAckSample {
+	uint64_t now;
+	// Number of bytes that the ACK acknowledged.
+	uint32_t ackedBytes;
+	// Number of bytes that are still in flight.
+	uint32_t inFlight;
+	// RTT sample in nanoseconds, or zero if the ACK did not yield one.
+	uint64_t rtt;
+	// Total number of bytes that were acknowledged so far (including this ACK).
+	uint64_t delivered;
+	// Set if the sender did not have enough data to fill the congestion window.
+	bool appLimited;
+};
+
+// Congestion control of a TCP sender. The socket performs loss recovery (i.e., it decides
+// what to retransmit), while the algorithm decides how much data may be in flight and
+// how fast it is sent.
+//
+// The default implementations of the loss hooks follow NewReno (RFC 5681 and RFC 6582).
+struct TcpCongestionControl {
+	TcpCongestionControl(uint32_t mss, uint32_t cwnd)
+	: mss_{mss}, cwnd_{cwnd} { }
+
+	virtual ~TcpCongestionControl() = default;
+
+	virtual std::string_view name() const = 0;
+
+	// Called for ACKs that acknowledge new data outside of fast recovery.
+	virtual void onAck(const TcpAckSample &sample) = 0;
+
+	// Called when fast recovery starts after three duplicate ACKs.
+	virtual void onFastRetransmit(uint32_t inFlight, uint64_t now);
+	// Called for each duplicate ACK during fast recovery.
+	virtual void onDuplicateAck();
+	// Called for ACKs that acknowledge new data during fast recovery,
+	// but not all data that was outstanding when fast recovery started.
+	virtual void onPartialAck(const TcpAckSample &sample);
+	// Called when the end of fast recovery is acknowledged.
+	virtual void onRecoveryExit(uint32_t inFlight);
+	virtual void onRetransmissionTimeout(uint32_t inFlight, uint64_t now);
+
+	// Congestion window in bytes.
+	uint32_t cwnd() const {
+		return cwnd_;
+	}
+
+	uint32_t ssthresh() const {
+		return ssthresh_;
+	}
+
+	// Pacing rate in bytes per second. Zero if the sender is not paced.
+	uint64_t pacingRate() const {
+		return pacingRate_;
+	}
+
+protected:
+	// Returns the slow start threshold after a loss.
+	virtual uint32_t lossThreshold_(uint32_t inFlight);
+
+	uint32_t mss_;
+	uint32_t cwnd_;
+	uint32_t ssthresh_ = std::numeric_limits<uint32_t>::max();
+	uint64_t pacingRate_ = 0;
+};
+
+// Algorithm that connections use unless TCP_CONGESTION is set.
+constexpr std::string_view defaultTcpCongestionControl = "cubic";
+
+// Returns nullptr if there is no algorithm called name ("reno", "cubic" or "bbr").
+std::unique_ptr<TcpCongestionControl> makeTcpCongestionControl(std::string_view name,
+		uint32_t mss, uint32_t cwnd);
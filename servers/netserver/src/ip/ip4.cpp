@@ -6,6 +6,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <algorithm>
+#include <cassert>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
@@ -26,29 +27,39 @@ Ip4 &ip4() {
 	return inst;
 }
 
-bool Ip4Router::addRoute(Route r) {
-	return routes.emplace(std::move(r)).second;
-}
+namespace {
 
-std::optional<Route> Ip4Router::resolveRoute(uint32_t ip, std::shared_ptr<nic::Link> link) {
-	for (auto i = routes.begin(); i != routes.end(); i++) {
-		const auto &r = *i;
-		if (r.network.sameNet(ip)) {
-			if(link && r.link.lock()->index() != link->index())
-				continue;
+arch::contiguous_pool loopbackPool;
 
-			if (r.link.expired()) {
-				i = routes.erase(i);
-				continue;
-			}
-			return { r };
-		}
+// MTU of local delivery; as on Linux, it is limited only by the IP total length.
+constexpr unsigned int loopbackMtu = 65535;
+// Locally delivered packets that may be queued before new ones are dropped.
+constexpr size_t maxLocalBacklog = 1000;
+
+// Stands in for the device of locally delivered packets (e.g., in Ip4TargetInfo and
+// Ip4Packet::link). It is not registered as a link; Ip4::sendFrame() passes such
+// packets to Ip4::feedPacket() without ever calling into it.
+struct LoopbackLink final : nic::Link {
+	LoopbackLink()
+	: nic::Link{loopbackMtu, &loopbackPool} {
+		raw_ip_ = true;
 	}
-	return {};
-}
 
-bool operator<(const CidrAddress &lhs, const CidrAddress &) {
-	return std::tie(lhs.prefix, lhs.ip) < std::tie(lhs.prefix, lhs.ip);
+	async::result<size_t> receive(arch::dma_buffer_view) override {
+		assert(!"loopback packets are never received from a device");
+		co_return 0;
+	}
+
+	async::result<void> send(const arch::dma_buffer_view) override {
+		assert(!"loopback packets are delivered by Ip4::sendFrame()");
+		co_return;
+	}
+};
+
+} // anonymous namespace
+
+bool operator<(const CidrAddress &lhs, const CidrAddress &rhs) {
+	return std::tie(lhs.prefix, lhs.ip) < std::tie(rhs.prefix, rhs.ip);
 }
 
 auto operator<=>(const Route &lhs, const Route &rhs) {
@@ -71,6 +82,135 @@ bool operator==(const Route &lhs, const Route &rhs) {
 	return operator<=>(lhs, rhs) == 0;
 }
 
+namespace {
+
+uint32_t prefixMask(uint8_t length) {
+	return length ? ~uint32_t{0} << (32 - length) : 0;
+}
+
+// Returns the bit at the given index, counted from the most significant bit.
+int prefixBit(uint32_t ip, uint8_t index) {
+	return (ip >> (31 - index)) & 1;
+}
+
+uint8_t commonPrefixLength(uint32_t a, uint32_t b, uint8_t limit) {
+	auto diff = a ^ b;
+	uint8_t length = diff ? __builtin_clz(diff) : 32;
+	return std::min(length, limit);
+}
+
+} // anonymous namespace
+
+bool Ip4Router::addRoute(Route r) {
+	auto [it, inserted] = routes.emplace(std::move(r));
+	if (!inserted)
+		return false;
+
+	auto &network = it->network;
+	auto &node = trie_[trieNode_(network.ip & network.mask(), network.prefix)];
+	auto pos = std::upper_bound(node.routes.begin(), node.routes.end(), &*it,
+		[] (const Route *a, const Route *b) { return *a < *b; });
+	node.routes.insert(pos, &*it);
+	generation_++;
+	return true;
+}
+
+std::optional<Route> Ip4Router::resolveRoute(uint32_t ip, std::shared_ptr<nic::Link> link) {
+	// Collect the nodes along the path that have routes; the longest prefix comes last.
+	std::array<int, 33> matches;
+	size_t numMatches = 0;
+	for (int current = trieRoot_; current >= 0;) {
+		auto &node = trie_[current];
+		if ((ip ^ node.prefix) & prefixMask(node.length))
+			break;
+		if (!node.routes.empty())
+			matches[numMatches++] = current;
+		if (node.length == 32)
+			break;
+		current = node.children[prefixBit(ip, node.length)];
+	}
+
+	std::optional<Route> result;
+	bool sawExpired = false;
+	for (size_t i = numMatches; i-- > 0 && !result;) {
+		for (auto route : trie_[matches[i]].routes) {
+			auto routeLink = route->link.lock();
+			if (!routeLink) {
+				sawExpired = true;
+				continue;
+			}
+			if (link && routeLink->index() != link->index())
+				continue;
+			result = *route;
+			break;
+		}
+	}
+
+	if (sawExpired)
+		removeExpiredRoutes_();
+	return result;
+}
+
+int Ip4Router::trieNode_(uint32_t prefix, uint8_t length) {
+	auto makeNode = [&] (uint32_t nodePrefix, uint8_t nodeLength) {
+		trie_.push_back({nodePrefix, nodeLength});
+		return static_cast<int>(trie_.size() - 1);
+	};
+
+	// The edge that we follow is the child of parent at index bit (or the root if parent < 0).
+	int parent = -1;
+	int bit = 0;
+	auto edge = [&] () -> int & {
+		return parent < 0 ? trieRoot_ : trie_[parent].children[bit];
+	};
+
+	while (true) {
+		int current = edge();
+		if (current < 0) {
+			int leaf = makeNode(prefix, length);
+			edge() = leaf;
+			return leaf;
+		}
+
+		auto nodePrefix = trie_[current].prefix;
+		auto nodeLength = trie_[current].length;
+		auto common = commonPrefixLength(prefix, nodePrefix, std::min(length, nodeLength));
+		if (common == nodeLength) {
+			if (common == length)
+				return current;
+			parent = current;
+			bit = prefixBit(prefix, nodeLength);
+			continue;
+		}
+
+		// Split the edge at the common prefix.
+		int split = makeNode(prefix & prefixMask(common), common);
+		trie_[split].children[prefixBit(nodePrefix, common)] = current;
+		edge() = split;
+		if (common == length)
+			return split;
+
+		int leaf = makeNode(prefix, length);
+		trie_[split].children[prefixBit(prefix, common)] = leaf;
+		return leaf;
+	}
+}
+
+void Ip4Router::removeExpiredRoutes_() {
+	for (auto it = routes.begin(); it != routes.end();) {
+		if (!it->link.expired()) {
+			++it;
+			continue;
+		}
+
+		auto &network = it->network;
+		auto &node = trie_[trieNode_(network.ip & network.mask(), network.prefix)];
+		std::erase(node.routes, &*it);
+		it = routes.erase(it);
+		generation_++;
+	}
+}
+
 bool Ip4Packet::parse(arch::dma_buffer owner, arch::dma_buffer_view frame) {
 	buffer_ = std::move(owner);
 	data = frame;
@@ -234,6 +374,15 @@ async::result<frg::expected<protocols::fs::Error, size_t>> Ip4Socket::sendmsg(vo
 
 async::result<std::optional<Ip4TargetInfo>>
 Ip4::targetByRemote(uint32_t remote, std::shared_ptr<nic::Link> link) {
+	// Local traffic does not need a route, neighbour or device.
+	if (!link && isLocal(remote)) {
+		if (!loopback_)
+			loopback_ = std::make_shared<LoopbackLink>();
+		auto source = (remote >> 24) == IN_LOOPBACKNET ? INADDR_LOOPBACK : remote;
+		Route route{CidrAddress{remote, 32}, loopback_};
+		co_return Ip4TargetInfo { remote, source, route, loopback_, nullptr, true };
+	}
+
 	auto oroute = ip4Router().resolveRoute(remote, link);
 	if (!oroute) {
 		std::cout << "netserver: net unreachable" << std::endl;
@@ -259,7 +408,38 @@ Ip4::targetByRemote(uint32_t remote, std::shared_ptr<nic::Link> link) {
 		co_return std::nullopt;
 	}
 
-	co_return Ip4TargetInfo { remote, source, *oroute, std::move(target) };
+	Neighbours::Entry *neighbour = nullptr;
+	if (!target->rawIp()) {
+		neighbour = &neigh4().getEntry(oroute->gateway ? oroute->gateway : remote);
+	}
+
+	co_return Ip4TargetInfo { remote, source, *oroute, std::move(target), neighbour };
+}
+
+async::result<std::optional<Ip4TargetInfo>>
+Ip4TargetCache::get(uint32_t remote, std::shared_ptr<nic::Link> link) {
+	auto generation = ip4Router().generation();
+	if (info_ && generation_ == generation && remote_ == remote
+			&& boundLink_.lock() == link) {
+		if (auto target = targetLink_.lock(); target) {
+			auto info = *info_;
+			info.link = std::move(target);
+			co_return info;
+		}
+	}
+
+	auto info = co_await ip4().targetByRemote(remote, link);
+	if (info) {
+		info_ = *info;
+		info_->link = nullptr;
+		targetLink_ = info->link;
+		remote_ = remote;
+		boundLink_ = link;
+		generation_ = generation;
+	} else {
+		info_.reset();
+	}
+	co_return info;
 }
 
 bool Ip4::hasIp(uint32_t addr) {
@@ -269,8 +449,12 @@ bool Ip4::hasIp(uint32_t addr) {
 		});
 }
 
+bool Ip4::isLocal(uint32_t addr) {
+	return (addr >> 24) == IN_LOOPBACKNET || hasIp(addr);
+}
+
 async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
-		void *data, size_t len, uint16_t proto) {
+		void *data, size_t len, uint16_t proto, std::optional<Ip4Offload> offload) {
 	using arch::convert_endian;
 	using arch::endian;
 
@@ -278,14 +462,21 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	// calculate header size
 	size_t header_size = sizeof(Ip4Packet::Header);
 	size_t packet_size = len + header_size;
+	// Super-segments only need to fit into the MTU after segmentation.
+	size_t wire_size = packet_size;
+	if (offload && offload->gsoSize) {
+		assert(packet_size <= 0xFFFF);
+		wire_size = std::min(packet_size,
+			header_size + offload->headerLength + offload->gsoSize);
+	}
 	// TODO(arsen): options
-	if (ti.route.mtu != 0 && ti.route.mtu < packet_size) {
+	if (ti.route.mtu != 0 && ti.route.mtu < wire_size) {
 		std::cout << "netserver: cant fragment 1" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
 
 	auto &target = ti.link;
-	if (target->mtu < packet_size) {
+	if (target->mtu < wire_size) {
 		std::cout << "netserver: cant fragment 2" << std::endl;
 		co_return protocols::fs::Error::messageSize;
 	}
@@ -311,15 +502,40 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	chk.update(reinterpret_cast<void *>(&hdr), sizeof(hdr));
 	hdr.checksum = convert_endian<endian::big>(chk.finalize());
 
+	// Local packets skip address resolution and the device. Since they cannot be
+	// corrupted on the way, the receiver does not verify L4 checksums and a super-segment
+	// is delivered as a whole. Delivery is deferred to deliverLocal_() so that the
+	// receiving socket does not run (and reply) while the sender is still in here.
+	if (ti.local) {
+		if (localQueue_.size() >= maxLocalBacklog)
+			co_return protocols::fs::Error::none;
+
+		arch::dma_buffer buffer{target->dmaPool(), packet_size};
+		std::memcpy(buffer.data(), &hdr, sizeof(hdr));
+		std::memcpy(reinterpret_cast<uint8_t *>(buffer.data()) + header_size, data, len);
+		localQueue_.push_back(std::move(buffer));
+		localEvent_.raise();
+
+		if (!localRunning_) {
+			localRunning_ = true;
+			deliverLocal_();
+		}
+		co_return protocols::fs::Error::none;
+	}
+
 	nic::Link::AllocatedBuffer fb;
 
 	if(!target->rawIp()) {
-		auto macTarget = ti.route.gateway;
-		if (macTarget == 0) {
-			macTarget = ti.remote;
+		std::optional<nic::MacAddress> mac;
+		if (ti.neighbour) {
+			mac = co_await neigh4().tryResolve(*ti.neighbour, ti.source);
+		} else {
+			auto macTarget = ti.route.gateway;
+			if (macTarget == 0) {
+				macTarget = ti.remote;
+			}
+			mac = co_await neigh4().tryResolve(macTarget, ti.source);
 		}
-
-		auto mac = co_await neigh4().tryResolve(macTarget, ti.source);
 		if (!mac) {
 			co_return protocols::fs::Error::hostUnreachable;
 		}
@@ -332,14 +548,33 @@ async::result<protocols::fs::Error> Ip4::sendFrame(Ip4TargetInfo ti,
 	std::memcpy(fb.payload.data(), &hdr, sizeof(hdr));
 	std::memcpy(fb.payload.subview(header_size).byte_data(), data, len);
 
-	co_await target->send(std::move(fb.frame));
+	if (offload) {
+		auto network_offset = reinterpret_cast<uint8_t *>(fb.payload.data())
+			- reinterpret_cast<uint8_t *>(fb.frame.data());
+		nic::TxMetadata meta{
+			.needsChecksum = true,
+			.csumStart = static_cast<uint16_t>(network_offset + header_size),
+			.csumOffset = offload->csumOffset,
+			.networkOffset = static_cast<uint16_t>(network_offset),
+		};
+		// Segmentation is not needed if the super-segment turned out to be small.
+		if (offload->gsoSize && len - offload->headerLength > offload->gsoSize) {
+			meta.gsoSize = offload->gsoSize;
+			meta.headerLength = meta.csumStart + offload->headerLength;
+		}
+		co_await target->sendOffloaded(std::move(fb.frame), meta);
+	} else {
+		co_await target->send(std::move(fb.frame));
+	}
 	co_return protocols::fs::Error::none;
 }
 
 void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
-		arch::dma_buffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link) {
+		arch::dma_buffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link,
+		bool l4ChecksumValid) {
 	Ip4Packet hdr{};
 	hdr.link = link;
+	hdr.l4ChecksumValid = l4ChecksumValid;
 
 	if (!hdr.parse(std::move(owner), frame)) {
 		std::cout << "netserver: runt, or otherwise invalid, ip4 frame received"
@@ -369,8 +604,22 @@ void Ip4::feedPacket(nic::MacAddress, nic::MacAddress,
 	}
 }
 
+async::detached Ip4::deliverLocal_() {
+	while (true) {
+		while (localQueue_.empty())
+			co_await localEvent_.async_wait();
+
+		auto buffer = std::move(localQueue_.front());
+		localQueue_.pop_front();
+		arch::dma_buffer_view view = buffer;
+		feedPacket({}, {}, std::move(buffer), view, loopback_, true);
+	}
+}
+
 void Ip4::setLink(CidrAddress addr, std::weak_ptr<nic::Link> l) {
 	ips.emplace(addr, std::move(l));
+	// Source addresses of cached targets may change.
+	ip4Router().invalidate();
 }
 
 std::shared_ptr<nic::Link> Ip4::getLink(uint32_t addr) {
@@ -404,6 +653,7 @@ std::optional<CidrAddress> Ip4::getCidrByIndex(int index) {
 }
 
 bool Ip4::deleteLink(CidrAddress addr) {
+	ip4Router().invalidate();
 	return ips.erase(addr) > 0;
 }
 
@@ -419,7 +669,8 @@ std::optional<uint32_t> Ip4::findLinkIp(uint32_t ipOnNet, nic::Link *link) {
 	return {};
 }
 
-managarm::fs::Errors Ip4::serveSocket(helix::UniqueLane lane, int type, int proto, int flags) {
+managarm::fs::Errors Ip4::serveSocket(helix::UniqueLane lane, int type, int proto, int flags,
+		helix::UniqueDescriptor &statusPage) {
 	using namespace protocols::fs;
 	switch (type) {
 	case SOCK_RAW: {
@@ -440,10 +691,10 @@ managarm::fs::Errors Ip4::serveSocket(helix::UniqueLane lane, int type, int prot
 		return managarm::fs::Errors::SUCCESS;
 	}
 	case SOCK_DGRAM:
-		udp.serveSocket(std::move(lane));
+		statusPage = udp.serveSocket(std::move(lane));
 		return managarm::fs::Errors::SUCCESS;
 	case SOCK_STREAM:
-		tcp.serveSocket(flags, std::move(lane));
+		statusPage = tcp.serveSocket(flags, std::move(lane));
 		return managarm::fs::Errors::SUCCESS;
 	default:
 		return managarm::fs::Errors::ILLEGAL_ARGUMENT;
@@ -2,16 +2,22 @@
 
 #include <arch/bit.hpp>
 #include <arch/dma_structs.hpp>
+#include <async/basic.hpp>
+#include <async/recurring-event.hpp>
 #include <helix/ipc.hpp>
+#include <array>
 #include <map>
 #include <smarter.hpp>
 #include <netserver/nic.hpp>
 #include <protocols/fs/common.hpp>
+#include <deque>
 #include <set>
 #include <cstdint>
 #include <memory>
 #include <optional>
+#include <vector>
 
+#include "arp.hpp"
 #include "udp4.hpp"
 #include "tcp4.hpp"
 
@@ -63,13 +69,40 @@ struct Ip4Router {
 
 	// false if insertion fails
 	bool addRoute(Route r);
+	// Returns the best route of the longest matching prefix (optionally restricted to a link).
 	std::optional<Route> resolveRoute(uint32_t ip, std::shared_ptr<nic::Link> link = {});
 
 	inline const std::set<Route> &getRoutes() const {
 		return routes;
 	}
+
+	// Changes whenever the result of a lookup may change, see Ip4TargetCache.
+	inline uint64_t generation() const {
+		return generation_;
+	}
+
+	inline void invalidate() {
+		generation_++;
+	}
+
 private:
+	// Node of a path-compressed binary trie over the prefixes of all routes.
+	struct TrieNode {
+		uint32_t prefix;
+		uint8_t length;
+		std::array<int, 2> children = {-1, -1};
+		// Routes with exactly this prefix, in the order of the set (i.e., best first).
+		std::vector<const Route *> routes = {};
+	};
+
+	// Returns the index of the node for the prefix, creating it if necessary.
+	int trieNode_(uint32_t prefix, uint8_t length);
+	void removeExpiredRoutes_();
+
 	std::set<Route> routes;
+	std::vector<TrieNode> trie_;
+	int trieRoot_ = -1;
+	uint64_t generation_ = 0;
 };
 
 class Ip4Packet {
@@ -107,6 +140,8 @@ public:
 	static_assert(sizeof(header) == 20, "bad header size");
 	arch::dma_buffer_view data;
 	std::weak_ptr<nic::Link> link;
+	// The NIC already verified the checksum of the L4 protocol.
+	bool l4ChecksumValid = false;
 
 	inline arch::dma_buffer_view payload() const {
 		return data.subview(header.ihl * 4);
@@ -125,16 +160,37 @@ struct Ip4TargetInfo {
 	uint32_t source;
 	Ip4Router::Route route;
 	std::shared_ptr<nic::Link> link;
+	// Neighbour entry of the next hop, unless the link does not use ARP.
+	Neighbours::Entry *neighbour = nullptr;
+	// Set if the remote is a local address; such packets bypass the NIC and are
+	// not checksummed, see Ip4::sendFrame().
+	bool local = false;
+};
+
+// Offloads that an L4 protocol requests from Ip4::sendFrame(), see nic::TxMetadata.
+struct Ip4Offload {
+	// Offset of the checksum field within the L4 data; the field must contain
+	// the (non-complemented) pseudo header sum.
+	uint16_t csumOffset;
+	// If non-zero, the L4 data is a TCP super-segment that is split into segments
+	// of gsoSize bytes after the L4 header of headerLength bytes.
+	uint16_t gsoSize = 0;
+	uint16_t headerLength = 0;
 };
 
 struct Ip4Socket;
 struct Ip4 {
-	managarm::fs::Errors serveSocket(helix::UniqueLane lane, int type, int proto, int flags);
+	// Sets statusPage if the socket provides a status page (see FC_STATUS_PAGE).
+	managarm::fs::Errors serveSocket(helix::UniqueLane lane, int type, int proto, int flags,
+			helix::UniqueDescriptor &statusPage);
 	// frame is a view into the owner buffer, stripping away eth bits
 	void feedPacket(nic::MacAddress dest, nic::MacAddress src,
-		arch::dma_buffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link);
+		arch::dma_buffer owner, arch::dma_buffer_view frame, std::weak_ptr<nic::Link> link,
+		bool l4ChecksumValid = false);
 
 	bool hasIp(uint32_t ip);
+	// True for 127.0.0.0/8 and for addresses of our own links.
+	bool isLocal(uint32_t ip);
 	std::shared_ptr<nic::Link> getLink(uint32_t ip);
 	std::optional<CidrAddress> getCidrByIndex(int index);
 	bool deleteLink(CidrAddress addr);
@@ -144,14 +200,37 @@ struct Ip4 {
 	async::result<std::optional<Ip4TargetInfo>> targetByRemote(uint32_t, std::shared_ptr<nic::Link> link = {});
 	async::result<protocols::fs::Error> sendFrame(Ip4TargetInfo,
 		void*, size_t,
-		uint16_t);
+		uint16_t, std::optional<Ip4Offload> offload = std::nullopt);
 private:
+	async::detached deliverLocal_();
+
 	std::multimap<int, smarter::shared_ptr<Ip4Socket>> sockets;
 	std::map<CidrAddress, std::weak_ptr<nic::Link>> ips;
 
+	// Link that locally delivered packets are attributed to; it is not a real device.
+	std::shared_ptr<nic::Link> loopback_;
+	std::deque<arch::dma_buffer> localQueue_;
+	async::recurring_event localEvent_;
+	bool localRunning_ = false;
+
 	Udp4 udp;
 	Tcp4 tcp;
 };
 
 Ip4 &ip4();
 Ip4Router &ip4Router();
+
+// Caches the result of Ip4::targetByRemote() (e.g., for a connected socket)
+// until routes or addresses change.
+struct Ip4TargetCache {
+	async::result<std::optional<Ip4TargetInfo>> get(uint32_t remote,
+			std::shared_ptr<nic::Link> link = {});
+
+private:
+	uint64_t generation_ = 0;
+	uint32_t remote_ = 0;
+	std::weak_ptr<nic::Link> boundLink_;
+	// Does not hold a reference to the link, which is stored in targetLink_.
+	std::optional<Ip4TargetInfo> info_;
+	std::weak_ptr<nic::Link> targetLink_;
+};
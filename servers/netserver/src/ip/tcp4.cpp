@@ -3,21 +3,33 @@
 #include <async/result.hpp>
 #include <arch/bit.hpp>
 #include <arch/variable.hpp>
+#include <helix/timer.hpp>
 #include <protocols/fs/server.hpp>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
 #include <cstring>
+#include <deque>
 #include <format>
+#include <initializer_list>
 #include <iomanip>
+#include <optional>
 #include <random>
+#include <hel.h>
+#include <hel-syscalls.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 
 #include <bragi/helpers-std.hpp>
 
 #include "checksum.hpp"
+#include "congestion.hpp"
 #include "ip4.hpp"
 #include "tcp4.hpp"
 
@@ -25,6 +37,111 @@ namespace {
 
 constexpr bool debugTcp = false;
 
+// Maximal number of segments that are passed to the IP layer at once,
+// such that the resulting packet still fits into the IPv4 length field.
+constexpr size_t maxSegmentsPerSend = 64;
+
+// Initial size of the send ring and the receive queue is 1 << ringShift bytes.
+constexpr int ringShift = 18;
+// Bounds of the buffer sizes, both for SO_SNDBUF / SO_RCVBUF and for autotuning.
+constexpr int minBufferShift = 12;
+constexpr int maxBufferShift = 22;
+// Window scale that we announce, such that the largest receive queue fits into the window.
+constexpr uint8_t localWindowShift = maxBufferShift - 16;
+// Limit of the memory of all socket buffers together; buffers do not grow beyond it.
+constexpr size_t maxBufferMemory = size_t{64} << 20;
+// Maximal window scale (RFC 7323, section 2.3).
+constexpr uint8_t maxWindowShift = 14;
+
+// MSS that is assumed if the remote does not announce one (RFC 9293, section 3.7.1).
+constexpr unsigned int defaultMss = 536;
+// Smaller MSS values would not leave room for payload next to the headers.
+constexpr unsigned int minMss = 64;
+
+// Bounds of the retransmission timeout (RFC 6298) in nanoseconds. Like other stacks,
+// we use a smaller minimum than the RFC's one second.
+constexpr uint64_t initialRto = 1'000'000'000;
+constexpr uint64_t minRto = 200'000'000;
+constexpr uint64_t maxRto = 60'000'000'000;
+
+// Number of SYN retransmissions before connect() fails.
+constexpr int maxSynRetries = 6;
+
+// Paced senders pass about this much time worth of data to the IP layer at once.
+constexpr uint64_t pacingQuantum = 1'000'000;
+
+// Maximal delay of ACKs for in-order data in nanoseconds (the minimum delay of Linux).
+constexpr uint64_t delayedAckTimeout = 40'000'000;
+// Partial segments that TCP_CORK or MSG_MORE hold back are sent after this time (as on Linux).
+constexpr uint64_t corkTimeout = 200'000'000;
+
+// TCP option kinds.
+constexpr uint8_t optionEnd = 0;
+constexpr uint8_t optionNop = 1;
+constexpr uint8_t optionMss = 2;
+constexpr uint8_t optionWindowScale = 3;
+constexpr uint8_t optionSackPermitted = 4;
+constexpr uint8_t optionSack = 5;
+constexpr uint8_t optionTimestamp = 8;
+
+// Options are limited by the data offset field of the TCP header.
+constexpr size_t maxOptionsSize = 40;
+
+// Comparison of sequence numbers modulo 2^32 (RFC 9293, section 3.4).
+bool seqLess(uint32_t a, uint32_t b) {
+	return static_cast<int32_t>(a - b) < 0;
+}
+
+uint32_t seqMax(uint32_t a, uint32_t b) {
+	return seqLess(a, b) ? b : a;
+}
+
+struct SeqLess {
+	bool operator() (uint32_t a, uint32_t b) const {
+		return seqLess(a, b);
+	}
+};
+
+uint16_t loadBig16(const uint8_t *p) {
+	return (uint16_t{p[0]} << 8) | p[1];
+}
+
+uint32_t loadBig32(const uint8_t *p) {
+	return (uint32_t{p[0]} << 24) | (uint32_t{p[1]} << 16) | (uint32_t{p[2]} << 8) | p[3];
+}
+
+void storeBig16(uint8_t *p, uint16_t v) {
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+void storeBig32(uint8_t *p, uint32_t v) {
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+uint64_t currentNanos() {
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	return now;
+}
+
+// Clock of the timestamp option (RFC 7323, section 5.4) with a resolution of 1 ms.
+uint32_t currentTimestamp() {
+	return currentNanos() / 1'000'000;
+}
+
+// Returns the MTU towards the remote.
+// TODO: Also take ICMP "fragmentation needed" messages into account (RFC 1191).
+unsigned int pathMtu(const Ip4TargetInfo &ti) {
+	auto mtu = ti.link->mtu;
+	if(ti.route.mtu)
+		mtu = std::min(mtu, ti.route.mtu);
+	return mtu;
+}
+
 struct stl_allocator {
 	void *allocate(size_t size) {
 		return operator new(size);
@@ -65,11 +182,11 @@ struct RingBuffer {
 		return enqPtr_ - deqPtr_;
 	}
 
-	void enqueue(void *data, size_t size) {
+	void enqueue(const void *data, size_t size) {
 		assert(size <= spaceForEnqueue());
 		size_t ringSize = size_t{1} << shift_;
 		auto wrappedPtr = enqPtr_ & (ringSize - 1);
-		auto p = reinterpret_cast<char *>(data);
+		auto p = reinterpret_cast<const char *>(data);
 		size_t bytesUntilEnd = std::min(size, ringSize - wrappedPtr);
 		memcpy(storage_ + wrappedPtr, p, bytesUntilEnd);
 		memcpy(storage_, p + bytesUntilEnd, size - bytesUntilEnd);
@@ -95,6 +212,28 @@ struct RingBuffer {
 		deqPtr_ += size;
 	}
 
+	size_t size() {
+		return size_t{1} << shift_;
+	}
+
+	// Changes the size of the ring to 1 << shift bytes. The data must fit into the new ring.
+	void resize(int shift) {
+		size_t ringSize = size_t{1} << shift;
+		size_t available = availableToDequeue();
+		assert(available <= ringSize);
+
+		// The pointers stay the same, hence the data moves to its new wrapped position.
+		auto storage = reinterpret_cast<char *>(operator new(ringSize));
+		auto wrappedPtr = deqPtr_ & (ringSize - 1);
+		size_t bytesUntilEnd = std::min(available, ringSize - wrappedPtr);
+		dequeueLookahead(0, storage + wrappedPtr, bytesUntilEnd);
+		dequeueLookahead(bytesUntilEnd, storage, available - bytesUntilEnd);
+
+		operator delete(storage_);
+		storage_ = storage;
+		shift_ = shift;
+	}
+
 private:
 	char *storage_;
 	int shift_;
@@ -102,6 +241,82 @@ private:
 	uint64_t deqPtr_ = 0;
 };
 
+// Queue of received data. Instead of copying the data, it keeps references to
+// the packets (and thus to the DMA buffers that the NIC received them into), such that
+// the data is only copied once into the reader's buffer.
+struct ReceiveQueue {
+	ReceiveQueue(int shift)
+	: capacity_{size_t{1} << shift} { }
+
+	// Data is accounted by its size, not by the size of the packets' buffers.
+	size_t spaceForEnqueue() {
+		return capacity_ - size_;
+	}
+
+	size_t availableToDequeue() {
+		return size_;
+	}
+
+	size_t capacity() {
+		return capacity_;
+	}
+
+	void setCapacity(size_t capacity) {
+		assert(capacity >= size_);
+		capacity_ = capacity;
+	}
+
+	void enqueue(smarter::shared_ptr<const Ip4Packet> packet, arch::dma_buffer_view view) {
+		assert(view.size() <= spaceForEnqueue());
+		if(!view.size())
+			return;
+		size_ += view.size();
+		chunks_.push_back({std::move(packet), view});
+	}
+
+	void dequeueLookahead(size_t offset, void *data, size_t size) {
+		assert(offset + size <= availableToDequeue());
+		auto p = reinterpret_cast<char *>(data);
+		for(auto &chunk : chunks_) {
+			if(!size)
+				break;
+			if(offset >= chunk.view.size()) {
+				offset -= chunk.view.size();
+				continue;
+			}
+			size_t n = std::min(size, chunk.view.size() - offset);
+			memcpy(p, reinterpret_cast<const char *>(chunk.view.data()) + offset, n);
+			p += n;
+			size -= n;
+			offset = 0;
+		}
+	}
+
+	void dequeueAdvance(size_t size) {
+		assert(size <= availableToDequeue());
+		size_ -= size;
+		while(size) {
+			auto &front = chunks_.front();
+			if(size < front.view.size()) {
+				front.view = front.view.subview(size);
+				break;
+			}
+			size -= front.view.size();
+			chunks_.pop_front();
+		}
+	}
+
+private:
+	struct Chunk {
+		smarter::shared_ptr<const Ip4Packet> packet;
+		arch::dma_buffer_view view;
+	};
+
+	size_t capacity_;
+	size_t size_ = 0;
+	std::deque<Chunk> chunks_;
+};
+
 // TODO: Use a CSPRNG, see also UDP.
 static std::mt19937 globalPrng;
 
@@ -125,8 +340,28 @@ struct TcpHeader {
 
 static_assert(sizeof(TcpHeader) == 20);
 
+struct TcpTimestamp {
+	uint32_t value;
+	uint32_t echo;
+};
+
+struct TcpSackBlock {
+	uint32_t left;
+	uint32_t right;
+};
+
+// Options that we understand (RFC 9293, RFC 7323 and RFC 2018).
+struct TcpOptions {
+	std::optional<uint16_t> mss;
+	std::optional<uint8_t> windowShift;
+	bool sackPermitted = false;
+	std::optional<TcpTimestamp> timestamp;
+	std::array<TcpSackBlock, 4> sackBlocks;
+	size_t numSackBlocks = 0;
+};
+
 struct TcpPacket {
-	arch::dma_buffer_view payload() {
+	arch::dma_buffer_view payload() const {
 		auto words = header.flags.load() & TcpHeader::headerWords;
 		return packet->payload().subview(words * 4);
 	}
@@ -143,7 +378,7 @@ struct TcpPacket {
 		if (ipPayload.size() < words * 4)
 			return false;
 
-		if (header.checksum.load()) {
+		if (header.checksum.load() && !packet->l4ChecksumValid) {
 			PseudoHeader pseudo {
 				.src = packet->header.source,
 				.dst = packet->header.destination,
@@ -158,11 +393,63 @@ struct TcpPacket {
 				return false;
 		}
 
+		auto optionBytes = reinterpret_cast<const uint8_t *>(ipPayload.data()) + sizeof(TcpHeader);
+		parseOptions_(optionBytes, words * 4 - sizeof(TcpHeader));
+
 		this->packet = std::move(packet);
 		return true;
 	}
 
 	TcpHeader header;
+	TcpOptions options;
+
+private:
+	void parseOptions_(const uint8_t *p, size_t size) {
+		size_t i = 0;
+		while (i < size) {
+			auto kind = p[i];
+			if (kind == optionEnd)
+				break;
+			if (kind == optionNop) {
+				i++;
+				continue;
+			}
+
+			// Ignore the remaining options if they are malformed.
+			if (i + 2 > size)
+				break;
+			size_t length = p[i + 1];
+			if (length < 2 || i + length > size)
+				break;
+
+			auto data = p + i + 2;
+			switch (kind) {
+			case optionMss:
+				if (length == 4)
+					options.mss = loadBig16(data);
+				break;
+			case optionWindowScale:
+				if (length == 3)
+					options.windowShift = std::min(data[0], maxWindowShift);
+				break;
+			case optionSackPermitted:
+				if (length == 2)
+					options.sackPermitted = true;
+				break;
+			case optionTimestamp:
+				if (length == 10)
+					options.timestamp = TcpTimestamp{loadBig32(data), loadBig32(data + 4)};
+				break;
+			case optionSack:
+				for (size_t j = 0; j + 8 <= length - 2
+						&& options.numSackBlocks < options.sackBlocks.size(); j += 8)
+					options.sackBlocks[options.numSackBlocks++] = {
+						loadBig32(data + j), loadBig32(data + j + 4)};
+				break;
+			}
+			i += length;
+		}
+	}
 	smarter::shared_ptr<const Ip4Packet> packet;
 };
 
@@ -186,15 +473,20 @@ protocols::fs::Error checkAddress(const void *addrPtr, size_t addrLength, TcpEnd
 
 struct Tcp4Socket {
 	Tcp4Socket(Tcp4 *parent, bool nonBlock)
-	: parent_(parent), nonBlock_{nonBlock}, recvRing_{14}, sendRing_{14} {}
+	: parent_(parent), nonBlock_{nonBlock}, recvQueue_{ringShift}, sendRing_{ringShift} {
+		parent_->chargeMemory(recvQueue_.capacity() + sendRing_.size());
+	}
 
 	~Tcp4Socket() {
+		setFlow_(std::nullopt);
 		parent_->unbind(localEp_);
+		parent_->unchargeMemory(recvQueue_.capacity() + sendRing_.size());
 	}
 
 	static auto makeSocket(Tcp4 *parent, bool nonBlock) {
 		auto s = smarter::make_shared<Tcp4Socket>(parent, nonBlock);
 		s->holder_ = s;
+		s->publishStatus_();
 		async::detach(s->flushOutPackets_());
 		return s;
 	}
@@ -219,7 +511,7 @@ struct Tcp4Socket {
 			co_return protocols::fs::Error::accessDenied;
 		}
 
-		if (bindEp.ipAddress != INADDR_ANY && !ip4().hasIp(bindEp.ipAddress)) {
+		if (bindEp.ipAddress != INADDR_ANY && !ip4().isLocal(bindEp.ipAddress)) {
 			std::cout << "netserver: IP address " << std::setw(8) << std::hex << bindEp.ipAddress << std::dec << " is not available" << std::endl;
 			co_return protocols::fs::Error::addressNotAvailable;
 		}
@@ -277,7 +569,7 @@ struct Tcp4Socket {
 					if(self->connectState_ != ConnectState::connected) {
 						resp.set_error(managarm::fs::Errors::NOT_CONNECTED);
 					}else {
-						resp.set_fionread_count(self->recvRing_.availableToDequeue());
+						resp.set_fionread_count(self->recvQueue_.availableToDequeue());
 					}
 					break;
 				}
@@ -331,6 +623,7 @@ struct Tcp4Socket {
 
 		// Connect to the remote.
 		self->connectState_ = ConnectState::sendSyn;
+		self->connectError_ = protocols::fs::Error::none;
 		self->remoteEp_ = connectEp;
 		self->flushEvent_.raise();
 
@@ -339,7 +632,7 @@ struct Tcp4Socket {
 				break;
 			co_await self->settleEvent_.async_wait();
 		}
-		co_return protocols::fs::Error::none;
+		co_return self->connectError_;
 	}
 
 	static async::result<protocols::fs::ReadResult> read(void *object, const char *creds,
@@ -371,7 +664,7 @@ struct Tcp4Socket {
 
 		size_t progress = 0;
 		while(progress < size) {
-			size_t available = self->recvRing_.availableToDequeue();
+			size_t available = self->recvQueue_.availableToDequeue();
 			if(!available) {
 				if(progress)
 					break;
@@ -381,13 +674,16 @@ struct Tcp4Socket {
 				continue;
 			}
 			size_t chunk = std::min(available, size - progress);
-			self->recvRing_.dequeueLookahead(0, p + progress, chunk);
+			self->recvQueue_.dequeueLookahead(0, p + progress, chunk);
 			progress += chunk;
 			if(flags & MSG_PEEK)
 				break;
-			self->recvRing_.dequeueAdvance(chunk);
+			self->recvQueue_.dequeueAdvance(chunk);
+			self->autotuneReceive_(chunk);
 			self->flushEvent_.raise();
 		}
+		if(progress && !(flags & MSG_PEEK))
+			self->publishStatus_();
 
 		struct sockaddr_in sa;
 		memset(&sa, 0, sizeof(struct sockaddr_in));
@@ -404,7 +700,6 @@ struct Tcp4Socket {
 			void *addrPtr, size_t addrSize,
 			std::vector<uint32_t> fds, struct ucred ucreds) {
 		(void) creds;
-		(void) flags;
 		(void) addrPtr;
 		(void) addrSize;
 		(void) fds;
@@ -412,6 +707,12 @@ struct Tcp4Socket {
 		auto self = static_cast<Tcp4Socket *>(object);
 		auto p = reinterpret_cast<char *>(data);
 
+		// Data of writes with MSG_MORE is only sent in full-sized segments,
+		// until a write without MSG_MORE follows.
+		self->more_ = flags & MSG_MORE;
+		if(!self->more_)
+			self->flushEvent_.raise();
+
 		size_t progress = 0;
 		while(progress < size) {
 			size_t space = self->sendRing_.spaceForEnqueue();
@@ -429,6 +730,8 @@ struct Tcp4Socket {
 			self->flushEvent_.raise();
 			progress += chunk;
 		}
+		if(progress)
+			self->publishStatus_();
 
 		co_return progress;
 	}
@@ -461,16 +764,11 @@ struct Tcp4Socket {
 	static async::result<frg::expected<protocols::fs::Error, protocols::fs::PollStatusResult>>
 	pollStatus(void *object) {
 		auto self = static_cast<Tcp4Socket *>(object);
+		co_return protocols::fs::PollStatusResult{self->currentSeq_, self->activeEvents_()};
+	}
 
-		int active = 0;
-		if(self->recvRing_.availableToDequeue())
-			active |= EPOLLIN;
-		if(self->sendRing_.spaceForEnqueue())
-			active |= EPOLLOUT;
-		if(self->remoteClosed_)
-			active |= EPOLLHUP;
-
-		co_return protocols::fs::PollStatusResult{self->currentSeq_, active};
+	helix::UniqueDescriptor statusPageMemory() {
+		return statusPage_.getMemory().dup();
 	}
 
 	static async::result<void> setFileFlags(void *object, int flags) {
@@ -512,6 +810,54 @@ struct Tcp4Socket {
 				self->boundInterface_ = nic;
 				co_return {};
 			}
+		}else if(layer == IPPROTO_TCP && number == TCP_CONGESTION) {
+			std::string_view name{optbuf.data(), strnlen(optbuf.data(), optbuf.size())};
+			uint32_t mss = self->sendMss_;
+			uint32_t cwnd = self->congestion_ ? self->congestion_->cwnd() : mss;
+			auto congestion = makeTcpCongestionControl(name, mss, cwnd);
+			if(!congestion)
+				co_return protocols::fs::Error::fileNotFound;
+
+			// Switching algorithms keeps the current window, but not the algorithm's state.
+			if(self->congestion_)
+				self->congestion_ = std::move(congestion);
+			self->congestionName_ = name;
+			co_return {};
+		}else if(layer == IPPROTO_TCP
+				&& (number == TCP_NODELAY || number == TCP_CORK || number == TCP_QUICKACK)) {
+			if(optbuf.size() < sizeof(int))
+				co_return protocols::fs::Error::illegalArguments;
+
+			int val;
+			memcpy(&val, optbuf.data(), sizeof(int));
+
+			if(number == TCP_NODELAY) {
+				self->noDelay_ = val;
+			}else if(number == TCP_CORK) {
+				self->cork_ = val;
+				self->corkDeadline_ = 0;
+			}else{
+				self->quickAck_ = val;
+			}
+			// Send data or ACKs that are no longer held back.
+			self->flushEvent_.raise();
+			co_return {};
+		}else if(layer == SOL_SOCKET && (number == SO_RCVBUF || number == SO_SNDBUF)) {
+			if(optbuf.size() < sizeof(int))
+				co_return protocols::fs::Error::illegalArguments;
+
+			int val;
+			memcpy(&val, optbuf.data(), sizeof(int));
+
+			// Like Linux, double the value to leave room for bookkeeping overhead.
+			size_t size = std::clamp(2 * size_t(std::max(val, 0)),
+					size_t{1} << minBufferShift, size_t{1} << maxBufferShift);
+			if(number == SO_RCVBUF) {
+				self->setReceiveBuffer_(size);
+			}else{
+				self->setSendBuffer_(size);
+			}
+			co_return {};
 		}
 
 		std::cout << std::format("netserver: unhandled TCP socket setsockopt layer {} number {}\n",
@@ -553,10 +899,85 @@ struct Tcp4Socket {
 	}
 
 private:
+	int activeEvents_() {
+		int active = 0;
+		if(recvQueue_.availableToDequeue())
+			active |= EPOLLIN;
+		if(sendRing_.spaceForEnqueue())
+			active |= EPOLLOUT;
+		if(remoteClosed_)
+			active |= EPOLLHUP;
+		return active;
+	}
+
+	// Must be called whenever the sequences or the active events change.
+	void publishStatus_() {
+		statusPage_.update(currentSeq_, activeEvents_(), inSeq_, outSeq_, hupSeq_);
+	}
+
+	// Updates our entry in Tcp4::connections.
+	void setFlow_(std::optional<TcpFlow> flow) {
+		if (flow_ == flow)
+			return;
+		if (flow_)
+			parent_->removeConnection(*flow_);
+		flow_ = flow;
+		if (flow_)
+			parent_->addConnection(*flow_, this);
+	}
+
 	async::result<void> flushOutPackets_();
 
+	// Waits until flushEvent_ is raised or the deadline (if non-zero) expires.
+	async::result<void> waitForFlush_(uint64_t deadline);
+
+	async::result<protocols::fs::Error> sendSyn_(Ip4TargetInfo targetInfo);
+
 	void handleInPacket_(TcpPacket packet);
 
+	// Passes in-order data (and FIN) to the receive ring.
+	// Returns true if the state of the socket changed.
+	bool acceptData_(smarter::shared_ptr<const Ip4Packet> packet,
+			arch::dma_buffer_view data, bool fin);
+	bool drainOutOfOrder_();
+
+	void handleAck_(const TcpPacket &packet, uint64_t now);
+	TcpAckSample makeAckSample_(uint32_t ackedBytes, uint64_t rtt, uint64_t now);
+	void handleRetransmissionTimeout_();
+	void updateRto_(uint64_t rtt);
+
+	// Manage the SACK scoreboard.
+	void addSacked_(uint32_t left, uint32_t right);
+	std::optional<uint32_t> nextHole_();
+	uint32_t holeEnd_(uint32_t sn);
+
+	// Whether segments that are not full-sized are held back (RFC 9293, section 3.7.4).
+	// Nagle's algorithm does so while data is unacknowledged, TCP_CORK and MSG_MORE
+	// do so until the cork timer expires.
+	bool holdPartial_(uint64_t now) {
+		if(cork_ || more_) {
+			if(!corkDeadline_)
+				corkDeadline_ = now + corkTimeout;
+			return now < corkDeadline_;
+		}
+		return !noDelay_ && localFlushedSn_ != localSettledSn_;
+	}
+
+	// Resize the buffers, either due to SO_RCVBUF / SO_SNDBUF or due to autotuning.
+	void setReceiveBuffer_(size_t size);
+	void setSendBuffer_(size_t size);
+	// Grows the receive queue to twice the amount of data that the reader consumes
+	// per RTT (i.e., about twice the bandwidth-delay product), similar to Linux.
+	void autotuneReceive_(size_t copied);
+
+	// Value of the window field of outgoing (non-SYN) segments.
+	uint16_t windowField_() {
+		return std::min(recvQueue_.spaceForEnqueue() >> recvWindowShift_, size_t{0xFFFF});
+	}
+
+	// Writes the options of outgoing (non-SYN) segments and returns their size.
+	size_t writeOptions_(uint8_t *p);
+
 private:
 	friend struct Tcp4;
 
@@ -567,19 +988,30 @@ private:
 		connected,
 	};
 
+	struct OutOfOrderSegment {
+		smarter::shared_ptr<const Ip4Packet> packet;
+		arch::dma_buffer_view data;
+		bool fin = false;
+	};
+
 	Tcp4 *parent_;
 	bool nonBlock_;
 	TcpEndpoint remoteEp_;
 	TcpEndpoint localEp_;
+	std::optional<TcpFlow> flow_;
 	smarter::weak_ptr<Tcp4Socket> holder_;
 
 	ConnectState connectState_ = ConnectState::none;
+	protocols::fs::Error connectError_ = protocols::fs::Error::none;
 	bool remoteClosed_ = false;
 
 	// Out-SN corresponding to the front of sendRing_.
 	uint32_t localSettledSn_ = 0;
 	// Out-SN that has already been flushed to the IP layer (>= localSettledSn_).
 	uint32_t localFlushedSn_ = 0;
+	// Highest Out-SN that was ever flushed (>= localFlushedSn_).
+	// Differs from localFlushedSn_ after a retransmission timeout.
+	uint32_t localMaxSn_ = 0;
 	// Out-SN of the end of the remote window (>= localSettledSn_).
 	uint32_t localWindowSn_ = 0;
 	// In-SN that we already acknowledged.
@@ -588,8 +1020,83 @@ private:
 	uint32_t remoteKnownSn_ = 0;
 	// Size of received window that we announced to the remote side.
 	uint32_t announcedWindow_ = 0;
-
-	RingBuffer recvRing_;
+	// Set if the next segment needs to be acknowledged immediately.
+	bool ackNow_ = false;
+	// Largest payload that we received in a segment; we acknowledge at least every
+	// second segment of this size.
+	size_t recvMss_ = defaultMss;
+	// Expiration time of the delayed ACK timer; zero if the timer is not armed.
+	uint64_t ackDeadline_ = 0;
+
+	// Socket options that control when segments are sent.
+	bool quickAck_ = false; // TCP_QUICKACK: do not delay ACKs.
+	bool noDelay_ = false; // TCP_NODELAY: disable Nagle's algorithm.
+	bool cork_ = false; // TCP_CORK: only send full-sized segments.
+	// Set if the most recent write passed MSG_MORE, which acts like a temporary TCP_CORK.
+	bool more_ = false;
+	// Expiration time of the cork timer; zero if no data is held back by corking.
+	uint64_t corkDeadline_ = 0;
+	// Payload size of full-sized outgoing segments, as of the most recent transmission.
+	size_t segmentSize_ = defaultMss;
+
+	// Set by SO_RCVBUF, which disables autotuning of the receive queue.
+	bool recvBufferLocked_ = false;
+	// Data that the reader consumed since recvSpaceSince_ (for autotuning).
+	size_t recvSpaceCopied_ = 0;
+	uint64_t recvSpaceSince_ = 0;
+
+	// Negotiated by the SYN segments.
+	unsigned int sendMss_ = defaultMss;
+	uint8_t sendWindowShift_ = 0;
+	uint8_t recvWindowShift_ = 0;
+	bool timestampsEnabled_ = false;
+	bool sackEnabled_ = false;
+	// Timestamp that we echo (TS.Recent in RFC 7323).
+	uint32_t recentTimestamp_ = 0;
+
+	// Segments that arrived beyond remoteKnownSn_, keyed by In-SN.
+	std::map<uint32_t, OutOfOrderSegment, SeqLess> outOfOrder_;
+	// In-SN of the most recent out-of-order segment (reported first in SACK blocks).
+	uint32_t lastOutOfOrderSn_ = 0;
+
+	// Disjoint ranges of Out-SNs above localSettledSn_ that the remote SACKed, sorted by SN.
+	std::vector<TcpSackBlock> sackedRanges_;
+
+	// RTT estimation (RFC 6298). Times are in nanoseconds.
+	bool rttValid_ = false;
+	uint64_t srtt_ = 0;
+	uint64_t rttVar_ = 0;
+	uint64_t rto_ = initialRto;
+	// Expiration time of the retransmission timer; zero if the timer is not armed.
+	uint64_t rtoDeadline_ = 0;
+	// Persist timer that probes zero windows; zero if the timer is not armed.
+	uint64_t persistDeadline_ = 0;
+	uint64_t persistInterval_ = 0;
+	// Without timestamps, a single segment is timed at a time.
+	bool timing_ = false;
+	uint32_t timedSn_ = 0;
+	uint64_t timedSince_ = 0;
+	int synRetries_ = 0;
+
+	// Congestion control; created once the connection is established.
+	std::string congestionName_{defaultTcpCongestionControl};
+	std::unique_ptr<TcpCongestionControl> congestion_;
+	// Total number of bytes that the remote acknowledged.
+	uint64_t delivered_ = 0;
+	// Earliest time at which paced data may be sent.
+	uint64_t nextSendTime_ = 0;
+
+	// Loss recovery (RFC 5681 and RFC 6582).
+	int dupAcks_ = 0;
+	bool inRecovery_ = false;
+	// Out-SN that ends fast recovery once it is acknowledged.
+	uint32_t recoverSn_ = 0;
+	// Out-SN that we retransmit next (regardless of the congestion window), if any.
+	std::optional<uint32_t> retransmitSn_;
+	// End of the most recent retransmission.
+	uint32_t highRetransmitSn_ = 0;
+
+	ReceiveQueue recvQueue_;
 	RingBuffer sendRing_;
 
 	async::recurring_event inEvent_;
@@ -603,10 +1110,82 @@ private:
 	uint64_t outSeq_ = 0;
 	uint64_t hupSeq_ = 1;
 	async::recurring_event pollEvent_;
+	// Allows posix to poll without a round-trip to us.
+	protocols::fs::StatusPageProvider statusPage_;
 
 	std::shared_ptr<nic::Link> boundInterface_ = {};
+	Ip4TargetCache targetCache_;
 };
 
+async::result<void> Tcp4Socket::waitForFlush_(uint64_t deadline) {
+	if(!deadline) {
+		co_await flushEvent_.async_wait();
+		co_return;
+	}
+
+	auto now = currentNanos();
+	if(now >= deadline)
+		co_return;
+
+	async::cancellation_event ev;
+	helix::TimeoutCancellation timer{deadline - now, ev};
+	co_await flushEvent_.async_wait(ev);
+	co_await timer.retire();
+}
+
+async::result<protocols::fs::Error> Tcp4Socket::sendSyn_(Ip4TargetInfo targetInfo) {
+	// Same layout as other stacks: MSS, SACK permitted, timestamp, NOP, window scale.
+	constexpr size_t optionsSize = 20;
+
+	std::vector<char> buf;
+	buf.resize(sizeof(TcpHeader) + optionsSize);
+
+	auto header = new (buf.data()) TcpHeader {
+		.srcPort = localEp_.port,
+		.destPort = remoteEp_.port,
+		.seqNumber = localSettledSn_,
+		.ackNumber = 0,
+		.flags = {},
+		// The window of SYN segments is never scaled.
+		.window = std::min(recvQueue_.spaceForEnqueue(), size_t{0xFFFF}),
+		.checksum = 0,
+		.urgentPointer = 0,
+	};
+	header->flags.store(TcpHeader::headerWords(buf.size() / 4)
+			| TcpHeader::synFlag(true));
+
+	auto p = reinterpret_cast<uint8_t *>(buf.data() + sizeof(TcpHeader));
+	p[0] = optionMss;
+	p[1] = 4;
+	storeBig16(p + 2, pathMtu(targetInfo) - sizeof(Ip4Packet::Header) - sizeof(TcpHeader));
+	p[4] = optionSackPermitted;
+	p[5] = 2;
+	p[6] = optionTimestamp;
+	p[7] = 10;
+	storeBig32(p + 8, currentTimestamp());
+	storeBig32(p + 12, 0);
+	p[16] = optionNop;
+	p[17] = optionWindowScale;
+	p[18] = 3;
+	p[19] = localWindowShift;
+
+	// Fill in the checksum.
+	PseudoHeader pseudo {
+		.src = targetInfo.source,
+		.dst = remoteEp_.ipAddress,
+		.len = buf.size()
+	};
+	Checksum csum;
+	csum.update(&pseudo, sizeof(PseudoHeader));
+	csum.update(buf.data(), buf.size());
+	header->checksum = csum.finalize();
+
+	if(debugTcp)
+		std::cout << "netserver: Sending TCP SYN" << std::endl;
+	co_return co_await ip4().sendFrame(std::move(targetInfo),
+		buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp));
+}
+
 async::result<void> Tcp4Socket::flushOutPackets_() {
 	while(true) {
 		if(connectState_ == ConnectState::none) {
@@ -614,58 +1193,61 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 			continue;
 		}
 
+		auto now = currentNanos();
+		bool timedOut = rtoDeadline_ && now >= rtoDeadline_;
+
 		if(connectState_ == ConnectState::sendSyn) {
-			if(localSettledSn_ != localFlushedSn_) {
-				co_await flushEvent_.async_wait();
+			if(localSettledSn_ != localFlushedSn_ && !timedOut) {
+				co_await waitForFlush_(rtoDeadline_);
 				continue;
 			}
 
-			// Obtain a new random sequence number.
-			auto randomSn = globalPrng();
-			localSettledSn_ = randomSn;
-			localFlushedSn_ = randomSn;
+			if(timedOut) {
+				// Retransmit the SYN with the same sequence number.
+				rtoDeadline_ = 0;
+				timing_ = false;
+				if(++synRetries_ > maxSynRetries) {
+					std::cout << "netserver: TCP connection timed out" << std::endl;
+					setFlow_(std::nullopt);
+					localFlushedSn_ = localSettledSn_;
+					connectState_ = ConnectState::none;
+					connectError_ = protocols::fs::Error::hostUnreachable;
+					settleEvent_.raise();
+					continue;
+				}
+				rto_ = std::min(2 * rto_, maxRto);
+			}else{
+				// Obtain a new random sequence number.
+				auto randomSn = globalPrng();
+				localSettledSn_ = randomSn;
+				localFlushedSn_ = randomSn;
+				synRetries_ = 0;
+				timing_ = true;
+				timedSn_ = randomSn + 1;
+				timedSince_ = now;
+			}
 
 			// Construct and transmit the initial SYN packet.
-			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress, boundInterface_);
+			auto targetInfo = co_await targetCache_.get(remoteEp_.ipAddress, boundInterface_);
 			if (!targetInfo) {
-				// TODO: Return an error to users.
 				std::cout << "netserver: Destination unreachable" << std::endl;
-				co_return;
+				setFlow_(std::nullopt);
+				localFlushedSn_ = localSettledSn_;
+				connectState_ = ConnectState::none;
+				connectError_ = protocols::fs::Error::netUnreachable;
+				settleEvent_.raise();
+				continue;
 			}
 
-			std::vector<char> buf;
-			buf.resize(sizeof(TcpHeader));
-
-			auto header = new (buf.data()) TcpHeader {
-				.srcPort = localEp_.port,
-				.destPort = remoteEp_.port,
-				.seqNumber = localFlushedSn_,
-				.ackNumber = 0,
-				.flags = {},
-				.window = 0,
-				.checksum = 0,
-				.urgentPointer = 0,
-			};
-			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
-					| TcpHeader::synFlag(true));
-
-			// Fill in the checksum.
-			PseudoHeader pseudo {
-				.src = targetInfo->source,
-				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
-			};
-			Checksum csum;
-			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
+			// The flow is only known once the route determined our source address.
+			setFlow_(TcpFlow{targetInfo->source, localEp_.port,
+					remoteEp_.ipAddress, remoteEp_.port});
 
-			++localFlushedSn_;
+			localFlushedSn_ = localSettledSn_ + 1; // SYN counts as one byte.
+			localMaxSn_ = localFlushedSn_;
+			rtoDeadline_ = now + rto_;
 
-			if(debugTcp)
-				std::cout << "netserver: Sending TCP SYN" << std::endl;
-			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
-				buf.data(), buf.size(), static_cast<uint16_t>(IpProto::tcp));
+			auto error = co_await sendSyn_(std::move(*targetInfo));
 			if (error != protocols::fs::Error::none) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
@@ -673,75 +1255,218 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 			}
 		}else{
 			assert(connectState_ == ConnectState::connected);
+			if(timedOut)
+				handleRetransmissionTimeout_();
+
 			size_t flushPointer = localFlushedSn_ - localSettledSn_;
 			size_t windowPointer = localWindowSn_ - localSettledSn_;
+			size_t limitPointer = std::min(windowPointer, size_t{congestion_->cwnd()});
 
 			size_t bytesAvailable = sendRing_.availableToDequeue();
 			assert(bytesAvailable >= flushPointer);
 
+			// Probe zero windows (RFC 9293, section 3.8.6.1). If no data is in flight,
+			// no ACK would tell us when the window opens again, as window updates
+			// are not transmitted reliably. The probe interval backs off exponentially.
+			bool wantProbe = false;
+			if(bytesAvailable && !flushPointer && !windowPointer) {
+				if(!persistDeadline_) {
+					persistInterval_ = rto_;
+					persistDeadline_ = now + persistInterval_;
+				}else if(now >= persistDeadline_) {
+					wantProbe = true;
+					persistInterval_ = std::min(2 * persistInterval_, maxRto);
+					persistDeadline_ = now + persistInterval_;
+				}
+			}else{
+				persistDeadline_ = 0;
+			}
+
 			// Check whether we need to send a packet.
-			// TODO: Add retransmission here.
-			bool wantData = (bytesAvailable > flushPointer && windowPointer > flushPointer);
-			bool wantAck = (remoteAckedSn_ != remoteKnownSn_);
-			bool wantWindowUpdate = (announcedWindow_ < recvRing_.spaceForEnqueue());
+			bool paced = congestion_->pacingRate() && now < nextSendTime_;
+			bool wantRetransmit = retransmitSn_.has_value();
+			bool wantData = (bytesAvailable > flushPointer && limitPointer > flushPointer);
+			if(wantData && bytesAvailable - flushPointer < segmentSize_ && holdPartial_(now))
+				wantData = false;
+
+			// Delay ACKs of in-order data, but acknowledge at least every second
+			// full-sized segment (RFC 9293, section 3.8.6.3).
+			bool pendingAck = (remoteAckedSn_ != remoteKnownSn_);
+			bool wantAck = ackNow_ || (pendingAck && (quickAck_
+					|| remoteKnownSn_ - remoteAckedSn_ >= 2 * recvMss_
+					|| (ackDeadline_ && now >= ackDeadline_)));
+			if(pendingAck && !wantAck && !ackDeadline_)
+				ackDeadline_ = now + delayedAckTimeout;
+
+			// Only announce windows that grew by at least a segment or by half of the
+			// receive queue, to avoid the silly window syndrome (RFC 9293, section 3.8.6.2.2).
+			size_t window = size_t{windowField_()} << recvWindowShift_;
+			bool wantWindowUpdate = window > announcedWindow_
+					&& window - announcedWindow_ >= std::min(recvMss_, recvQueue_.capacity() / 2);
+
+			// Wake up for whichever timer expires first.
+			auto deadline = [] (std::initializer_list<uint64_t> deadlines) {
+				uint64_t earliest = 0;
+				for(auto d : deadlines) {
+					if(d && (!earliest || d < earliest))
+						earliest = d;
+				}
+				return earliest;
+			};
+			uint64_t corkDeadline = (corkDeadline_ > now) ? corkDeadline_ : 0;
+
+			// Wait for the pacing deadline unless we need to send an ACK anyway.
+			if(paced && (wantRetransmit || wantData) && !wantAck && !wantWindowUpdate && !wantProbe) {
+				co_await waitForFlush_(deadline({rtoDeadline_, nextSendTime_, ackDeadline_,
+						corkDeadline, persistDeadline_}));
+				continue;
+			}
 
-			if(!wantData && !wantAck && !wantWindowUpdate) {
-				co_await flushEvent_.async_wait();
+			if(!wantRetransmit && !wantData && !wantAck && !wantWindowUpdate && !wantProbe) {
+				co_await waitForFlush_(deadline({rtoDeadline_, ackDeadline_, corkDeadline,
+						persistDeadline_}));
 				continue;
 			}
 
 			// Construct and transmit the TCP packet.
-			auto targetInfo = co_await ip4().targetByRemote(remoteEp_.ipAddress);
+			auto targetInfo = co_await targetCache_.get(remoteEp_.ipAddress);
 			if (!targetInfo) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Destination unreachable" << std::endl;
 				co_return;
 			}
 
-			auto chunk = std::min({
-				bytesAvailable - flushPointer,
-				windowPointer - flushPointer,
-				size_t{1000} // TODO: Perform path MTU discovery.
-			});
+			// The state may have changed while we were waiting for the route.
+			bytesAvailable = sendRing_.availableToDequeue();
+			flushPointer = localFlushedSn_ - localSettledSn_;
+			limitPointer = std::min(size_t{localWindowSn_ - localSettledSn_}, size_t{congestion_->cwnd()});
+
+			uint8_t options[maxOptionsSize];
+			size_t optionsSize = writeOptions_(options);
+			size_t headerSize = sizeof(TcpHeader) + optionsSize;
+
+			// The MSS does not include options (RFC 6691).
+			size_t segmentSize = std::min(size_t{sendMss_} + sizeof(TcpHeader),
+					pathMtu(*targetInfo) - sizeof(Ip4Packet::Header)) - headerSize;
+
+			// Send a super-segment that the NIC (or the IP layer in software)
+			// splits into segments of at most segmentSize bytes.
+			// If the congestion control paces us, only send pure ACKs ahead of time;
+			// otherwise, limit super-segments to a pacing quantum (but at least two segments).
+			size_t maxChunk = std::min(maxSegmentsPerSend * segmentSize,
+					0xFFFF - sizeof(Ip4Packet::Header) - headerSize);
+			if(auto rate = congestion_->pacingRate(); rate)
+				maxChunk = std::min(maxChunk,
+						std::max(size_t(rate * pacingQuantum / 1'000'000'000), 2 * segmentSize));
+
+			uint32_t sn = localFlushedSn_;
+			size_t chunk = 0;
+			bool retransmission = false;
+			if(retransmitSn_ && !paced) {
+				// Retransmit a single segment, but stop at the next SACKed range.
+				sn = seqMax(*retransmitSn_, localSettledSn_);
+				retransmitSn_.reset();
+				if(seqLess(sn, localMaxSn_)) {
+					size_t offset = sn - localSettledSn_;
+					chunk = std::min({
+						size_t{holeEnd_(sn) - sn},
+						bytesAvailable - offset,
+						segmentSize
+					});
+					retransmission = true;
+				}else{
+					sn = localFlushedSn_;
+				}
+			}
+			if(!retransmission && !paced
+					&& bytesAvailable > flushPointer && limitPointer > flushPointer) {
+				chunk = std::min({
+					bytesAvailable - flushPointer,
+					limitPointer - flushPointer,
+					maxChunk
+				});
+
+				// If the chunk ends with a partial segment that is held back, only send
+				// the full-sized segments in front of it.
+				segmentSize_ = segmentSize;
+				if(chunk == bytesAvailable - flushPointer && chunk % segmentSize && holdPartial_(now))
+					chunk -= chunk % segmentSize;
+				if(!chunk && !wantRetransmit && !wantAck && !wantWindowUpdate)
+					continue;
+			}
+			// Like other implementations, we probe with an old sequence number; the remote
+			// responds with an ACK that carries its current window.
+			if(wantProbe && !chunk)
+				sn = localSettledSn_ - 1;
 
 			std::vector<char> buf;
-			buf.resize(sizeof(TcpHeader) + chunk);
+			buf.resize(headerSize + chunk);
 
 			auto header = new (buf.data()) TcpHeader {
 				.srcPort = localEp_.port,
 				.destPort = remoteEp_.port,
-				.seqNumber = localFlushedSn_,
+				.seqNumber = sn,
 				.ackNumber = remoteKnownSn_,
 				.flags = {},
-				.window = std::min(recvRing_.spaceForEnqueue(), size_t{0xFFFF}),
+				.window = windowField_(),
 				.checksum = 0,
 				.urgentPointer = 0,
 			};
-			header->flags.store(TcpHeader::headerWords(sizeof(TcpHeader) / 4)
+			header->flags.store(TcpHeader::headerWords(headerSize / 4)
 					| TcpHeader::ackFlag(true));
 
-			sendRing_.dequeueLookahead(flushPointer, buf.data() + sizeof(TcpHeader), chunk);
+			memcpy(buf.data() + sizeof(TcpHeader), options, optionsSize);
+			if(chunk)
+				sendRing_.dequeueLookahead(sn - localSettledSn_, buf.data() + headerSize, chunk);
 
-			// Fill in the checksum.
+			// Seed the checksum with the pseudo header, the link completes it.
+			// For segmentation, the length is accounted for per segment.
+			bool segmented = chunk > segmentSize;
 			PseudoHeader pseudo {
 				.src = targetInfo->source,
 				.dst = remoteEp_.ipAddress,
-				.len = buf.size()
+				.len = segmented ? 0 : buf.size()
 			};
 			Checksum csum;
 			csum.update(&pseudo, sizeof(PseudoHeader));
-			csum.update(buf.data(), buf.size());
-			header->checksum = csum.finalize();
+			header->checksum = csum.sum();
 
-			localFlushedSn_ += chunk;
+			Ip4Offload offload{
+				.csumOffset = offsetof(TcpHeader, checksum),
+				.gsoSize = static_cast<uint16_t>(segmented ? segmentSize : 0),
+				.headerLength = static_cast<uint16_t>(headerSize),
+			};
+
+			if(retransmission) {
+				highRetransmitSn_ = sn + chunk;
+			}else if(chunk) {
+				// Only time segments that are not retransmitted (Karn's algorithm).
+				if(!timestampsEnabled_ && !timing_ && sn == localMaxSn_) {
+					timing_ = true;
+					timedSn_ = sn + chunk;
+					timedSince_ = now;
+				}
+				localFlushedSn_ += chunk;
+				localMaxSn_ = seqMax(localMaxSn_, localFlushedSn_);
+			}
+			if(chunk && !rtoDeadline_)
+				rtoDeadline_ = now + rto_;
+			if(auto rate = congestion_->pacingRate(); chunk && rate)
+				nextSendTime_ = std::max(now, nextSendTime_) + chunk * 1'000'000'000 / rate;
+			// Once the tail of the send ring is flushed, no data is held back any more.
+			if(localFlushedSn_ - localSettledSn_ == bytesAvailable)
+				corkDeadline_ = 0;
 			remoteAckedSn_ = remoteKnownSn_;
-			announcedWindow_ = recvRing_.spaceForEnqueue();
+			announcedWindow_ = uint32_t{windowField_()} << recvWindowShift_;
+			ackNow_ = false;
+			ackDeadline_ = 0;
 
 			if(debugTcp)
-				std::cout << "netserver: Sending TCP data (" << chunk << " bytes)" << std::endl;
+				std::cout << "netserver: Sending TCP data (" << chunk << " bytes"
+						<< (retransmission ? ", retransmission" : "") << ")" << std::endl;
 			auto error = co_await ip4().sendFrame(std::move(*targetInfo),
 				buf.data(), buf.size(),
-				static_cast<uint16_t>(IpProto::tcp));
+				static_cast<uint16_t>(IpProto::tcp), offload);
 			if (error != protocols::fs::Error::none) {
 				// TODO: Return an error to users.
 				std::cout << "netserver: Could not send TCP packet" << std::endl;
@@ -751,10 +1476,361 @@ async::result<void> Tcp4Socket::flushOutPackets_() {
 	}
 }
 
+size_t Tcp4Socket::writeOptions_(uint8_t *p) {
+	size_t n = 0;
+	if(timestampsEnabled_) {
+		p[n++] = optionNop;
+		p[n++] = optionNop;
+		p[n++] = optionTimestamp;
+		p[n++] = 10;
+		storeBig32(p + n, currentTimestamp());
+		storeBig32(p + n + 4, recentTimestamp_);
+		n += 8;
+	}
+
+	if(sackEnabled_ && !outOfOrder_.empty()) {
+		// Merge adjacent segments into blocks.
+		std::vector<TcpSackBlock> blocks;
+		for(auto &[sn, segment] : outOfOrder_) {
+			uint32_t end = sn + segment.data.size() + segment.fin;
+			if(!blocks.empty() && !seqLess(blocks.back().right, sn)) {
+				blocks.back().right = seqMax(blocks.back().right, end);
+			}else{
+				blocks.push_back({sn, end});
+			}
+		}
+
+		// The first block must contain the most recent segment (RFC 2018, section 4).
+		auto it = std::find_if(blocks.begin(), blocks.end(), [&] (const TcpSackBlock &block) {
+			return !seqLess(lastOutOfOrderSn_, block.left) && seqLess(lastOutOfOrderSn_, block.right);
+		});
+		if(it != blocks.end())
+			std::rotate(blocks.begin(), it, it + 1);
+
+		size_t numBlocks = std::min(blocks.size(), (maxOptionsSize - n - 4) / 8);
+		p[n++] = optionNop;
+		p[n++] = optionNop;
+		p[n++] = optionSack;
+		p[n++] = 2 + 8 * numBlocks;
+		for(size_t i = 0; i < numBlocks; i++) {
+			storeBig32(p + n, blocks[i].left);
+			storeBig32(p + n + 4, blocks[i].right);
+			n += 8;
+		}
+	}
+
+	assert(n <= maxOptionsSize && !(n % 4));
+	return n;
+}
+
+void Tcp4Socket::setReceiveBuffer_(size_t size) {
+	recvBufferLocked_ = true;
+
+	// Never take back window that we already announced (RFC 9293, section 3.8.6.2.2).
+	size = std::max(size, recvQueue_.availableToDequeue() + announcedWindow_);
+
+	size_t capacity = recvQueue_.capacity();
+	if(size > capacity) {
+		if(!parent_->tryChargeMemory(size - capacity))
+			return;
+	}else{
+		parent_->unchargeMemory(capacity - size);
+	}
+	recvQueue_.setCapacity(size);
+	flushEvent_.raise();
+}
+
+void Tcp4Socket::setSendBuffer_(size_t size) {
+	// The ring must be a power of two and hold the data that it already contains.
+	int shift = std::bit_width(size - 1);
+	while((size_t{1} << shift) < sendRing_.availableToDequeue())
+		shift++;
+
+	size_t ringSize = size_t{1} << shift;
+	if(ringSize > sendRing_.size()) {
+		if(!parent_->tryChargeMemory(ringSize - sendRing_.size()))
+			return;
+	}else{
+		parent_->unchargeMemory(sendRing_.size() - ringSize);
+	}
+	bool grew = ringSize > sendRing_.size();
+	sendRing_.resize(shift);
+
+	if(grew) {
+		outSeq_ = ++currentSeq_;
+		settleEvent_.raise();
+		pollEvent_.raise();
+	}
+	// Shrinking can also make the socket non-writable.
+	publishStatus_();
+}
+
+void Tcp4Socket::autotuneReceive_(size_t copied) {
+	if(recvBufferLocked_ || !rttValid_)
+		return;
+
+	auto now = currentNanos();
+	recvSpaceCopied_ += copied;
+	if(!recvSpaceSince_) {
+		recvSpaceSince_ = now;
+		return;
+	}
+	if(now - recvSpaceSince_ < srtt_)
+		return;
+
+	// Only grow the queue; shrinking it would take back announced window.
+	size_t target = std::min(2 * recvSpaceCopied_, size_t{1} << maxBufferShift);
+	size_t capacity = recvQueue_.capacity();
+	if(target > capacity && parent_->tryChargeMemory(target - capacity)) {
+		recvQueue_.setCapacity(target);
+		if(debugTcp)
+			std::cout << "netserver: Growing TCP receive queue to " << target << " bytes" << std::endl;
+		// Announce the larger window.
+		flushEvent_.raise();
+	}
+
+	recvSpaceCopied_ = 0;
+	recvSpaceSince_ = now;
+}
+
+void Tcp4Socket::handleRetransmissionTimeout_() {
+	rtoDeadline_ = 0;
+	if(localSettledSn_ == localMaxSn_)
+		return;
+
+	congestion_->onRetransmissionTimeout(localMaxSn_ - localSettledSn_, currentNanos());
+	dupAcks_ = 0;
+	inRecovery_ = false;
+	retransmitSn_.reset();
+	timing_ = false;
+
+	// The remote may discard SACKed data (RFC 2018, section 8).
+	sackedRanges_.clear();
+
+	// Go back to the first unacknowledged byte and back off the timer (RFC 6298, section 5).
+	localFlushedSn_ = localSettledSn_;
+	rto_ = std::min(2 * rto_, maxRto);
+}
+
+void Tcp4Socket::updateRto_(uint64_t rtt) {
+	// See RFC 6298, section 2.
+	if(!rttValid_) {
+		srtt_ = rtt;
+		rttVar_ = rtt / 2;
+		rttValid_ = true;
+	}else{
+		uint64_t delta = srtt_ > rtt ? srtt_ - rtt : rtt - srtt_;
+		rttVar_ = (3 * rttVar_ + delta) / 4;
+		srtt_ = (7 * srtt_ + rtt) / 8;
+	}
+	rto_ = std::clamp(srtt_ + 4 * rttVar_, minRto, maxRto);
+}
+
+void Tcp4Socket::addSacked_(uint32_t left, uint32_t right) {
+	// Ignore blocks that do not cover outstanding data.
+	left = seqMax(left, localSettledSn_);
+	if(!seqLess(left, right) || seqLess(localMaxSn_, right))
+		return;
+
+	auto it = std::find_if(sackedRanges_.begin(), sackedRanges_.end(),
+			[&] (const TcpSackBlock &range) {
+		return !seqLess(range.right, left);
+	});
+	while(it != sackedRanges_.end() && !seqLess(right, it->left)) {
+		left = seqLess(it->left, left) ? it->left : left;
+		right = seqMax(right, it->right);
+		it = sackedRanges_.erase(it);
+	}
+	sackedRanges_.insert(it, {left, right});
+}
+
+std::optional<uint32_t> Tcp4Socket::nextHole_() {
+	if(sackedRanges_.empty())
+		return std::nullopt;
+
+	auto sn = seqMax(highRetransmitSn_, localSettledSn_);
+	for(auto &range : sackedRanges_) {
+		if(seqLess(sn, range.left))
+			break;
+		sn = seqMax(sn, range.right);
+	}
+
+	// Data above the highest SACKed byte is not considered lost (RFC 6675, section 4).
+	if(!seqLess(sn, sackedRanges_.back().right))
+		return std::nullopt;
+	return sn;
+}
+
+uint32_t Tcp4Socket::holeEnd_(uint32_t sn) {
+	for(auto &range : sackedRanges_) {
+		if(seqLess(sn, range.left))
+			return range.left;
+	}
+	return localMaxSn_;
+}
+
+bool Tcp4Socket::acceptData_(smarter::shared_ptr<const Ip4Packet> packet,
+		arch::dma_buffer_view data, bool fin) {
+	bool gotUpdate = false;
+
+	size_t size = data.size();
+	size_t chunk = std::min(size, recvQueue_.spaceForEnqueue());
+	if(chunk) {
+		recvQueue_.enqueue(std::move(packet), data.subview(0, chunk));
+		remoteKnownSn_ += chunk;
+		if(announcedWindow_ < chunk) {
+			announcedWindow_ = 0;
+		}else{
+			announcedWindow_ -= chunk;
+		}
+
+		inSeq_ = ++currentSeq_;
+		gotUpdate = true;
+	}
+
+	if(fin && chunk == size && !remoteClosed_) {
+		++remoteKnownSn_; // FIN counts as one byte.
+		remoteClosed_ = true;
+
+		hupSeq_ = ++currentSeq_;
+		gotUpdate = true;
+	}
+
+	return gotUpdate;
+}
+
+bool Tcp4Socket::drainOutOfOrder_() {
+	bool gotUpdate = false;
+	while(!outOfOrder_.empty()) {
+		auto it = outOfOrder_.begin();
+		if(seqLess(remoteKnownSn_, it->first))
+			break;
+
+		// Segments may overlap data that we already received.
+		auto &segment = it->second;
+		size_t skip = remoteKnownSn_ - it->first;
+		if(skip <= segment.data.size())
+			gotUpdate |= acceptData_(std::move(segment.packet),
+					segment.data.subview(skip), segment.fin);
+		outOfOrder_.erase(it);
+	}
+	return gotUpdate;
+}
+
+TcpAckSample Tcp4Socket::makeAckSample_(uint32_t ackedBytes, uint64_t rtt, uint64_t now) {
+	return TcpAckSample{
+		.now = now,
+		.ackedBytes = ackedBytes,
+		.inFlight = localMaxSn_ - localSettledSn_,
+		.rtt = rtt,
+		.delivered = delivered_,
+		.appLimited = sendRing_.availableToDequeue() < congestion_->cwnd(),
+	};
+}
+
+void Tcp4Socket::handleAck_(const TcpPacket &packet, uint64_t now) {
+	auto ackSn = packet.header.ackNumber.load();
+	size_t validWindow = localMaxSn_ - localSettledSn_;
+	size_t ackPointer = ackSn - localSettledSn_;
+	if(ackPointer > validWindow) {
+		std::cout << "netserver: Rejecting ack-number outside of valid window"
+				<< std::endl;
+		return;
+	}
+
+	auto flags = packet.header.flags.load();
+	uint32_t window = uint32_t{packet.header.window.load()} << sendWindowShift_;
+
+	// See the definition of duplicate ACKs in RFC 5681, section 2.
+	bool duplicate = !ackPointer && validWindow
+			&& !packet.payload().size()
+			&& !(flags & TcpHeader::synFlag) && !(flags & TcpHeader::finFlag)
+			&& window == localWindowSn_ - localSettledSn_;
+
+	if(sackEnabled_) {
+		for(size_t i = 0; i < packet.options.numSackBlocks; i++)
+			addSacked_(packet.options.sackBlocks[i].left, packet.options.sackBlocks[i].right);
+	}
+
+	if(ackPointer) {
+		// Take an RTT sample, either from the timestamp or from the timed segment.
+		uint64_t rtt = 0;
+		if(timestampsEnabled_ && packet.options.timestamp && packet.options.timestamp->echo) {
+			uint32_t rttMs = currentTimestamp() - packet.options.timestamp->echo;
+			rtt = uint64_t{rttMs} * 1'000'000;
+		}else if(timing_ && !seqLess(ackSn, timedSn_)) {
+			rtt = now - timedSince_;
+		}
+		if(rtt)
+			updateRto_(rtt);
+		if(timing_ && !seqLess(ackSn, timedSn_))
+			timing_ = false;
+
+		localSettledSn_ = ackSn;
+		sendRing_.dequeueAdvance(ackPointer);
+		localFlushedSn_ = seqMax(localFlushedSn_, localSettledSn_);
+		delivered_ += ackPointer;
+		auto sample = makeAckSample_(ackPointer, rtt, now);
+
+		// Drop ranges of the scoreboard that are now acknowledged.
+		std::erase_if(sackedRanges_, [&] (const TcpSackBlock &range) {
+			return !seqLess(localSettledSn_, range.right);
+		});
+		if(!sackedRanges_.empty())
+			sackedRanges_.front().left = seqMax(sackedRanges_.front().left, localSettledSn_);
+
+		if(inRecovery_) {
+			if(!seqLess(ackSn, recoverSn_)) {
+				// Full acknowledgement: leave fast recovery (RFC 6582, section 3.2).
+				inRecovery_ = false;
+				congestion_->onRecoveryExit(sample.inFlight);
+			}else{
+				// Partial acknowledgement: retransmit the next hole.
+				retransmitSn_ = localSettledSn_;
+				congestion_->onPartialAck(sample);
+			}
+		}else{
+			congestion_->onAck(sample);
+		}
+		dupAcks_ = 0;
+
+		// Restart the retransmission timer (RFC 6298, section 5).
+		if(localSettledSn_ == localMaxSn_) {
+			rtoDeadline_ = 0;
+		}else{
+			rtoDeadline_ = now + rto_;
+		}
+
+		outSeq_ = ++currentSeq_;
+		settleEvent_.raise();
+		pollEvent_.raise();
+		publishStatus_();
+	}else if(duplicate) {
+		if(inRecovery_) {
+			congestion_->onDuplicateAck();
+			if(auto hole = nextHole_(); hole)
+				retransmitSn_ = *hole;
+		}else if(++dupAcks_ == 3) {
+			// Fast retransmit (RFC 5681, section 3.2).
+			congestion_->onFastRetransmit(localMaxSn_ - localSettledSn_, now);
+			inRecovery_ = true;
+			recoverSn_ = localMaxSn_;
+			retransmitSn_ = localSettledSn_;
+			highRetransmitSn_ = localSettledSn_;
+			timing_ = false;
+		}
+	}
+
+	localWindowSn_ = localSettledSn_ + window;
+	flushEvent_.raise();
+}
+
 void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 	if(boundInterface_ && boundInterface_->index() != packet.packet->link.lock()->index())
 		return;
 
+	auto now = currentNanos();
+
 	if(connectState_ == ConnectState::sendSyn) {
 		if(localSettledSn_ == localFlushedSn_) {
 			std::cout << "netserver: Rejecting packet before SYN is sent [sendSyn]"
@@ -778,62 +1854,97 @@ void Tcp4Socket::handleInPacket_(TcpPacket packet) {
 			return;
 		}
 
+		// Apply the options that the remote agreed to.
+		auto &options = packet.options;
+		sendMss_ = std::max(unsigned{options.mss.value_or(defaultMss)}, minMss);
+		if(options.windowShift) {
+			sendWindowShift_ = *options.windowShift;
+			recvWindowShift_ = localWindowShift;
+		}
+		sackEnabled_ = options.sackPermitted;
+		if(options.timestamp) {
+			timestampsEnabled_ = true;
+			recentTimestamp_ = options.timestamp->value;
+		}
+
+		if(timing_)
+			updateRto_(now - timedSince_);
+		timing_ = false;
+		rtoDeadline_ = 0;
+
+		// Initial window of RFC 5681, section 3.1.
+		congestion_ = makeTcpCongestionControl(congestionName_, sendMss_,
+				std::min(4 * sendMss_, std::max(2 * sendMss_, 4380u)));
+		assert(congestion_);
+
 		++localSettledSn_;
 		localWindowSn_ = localSettledSn_ + packet.header.window.load();
 		remoteAckedSn_ = packet.header.seqNumber.load();
 		remoteKnownSn_ = packet.header.seqNumber.load() + 1; // SYN counts as one byte.
+		ackNow_ = true;
 		connectState_ = ConnectState::connected;
 		flushEvent_.raise();
 		settleEvent_.raise();
 	}else if(connectState_ == ConnectState::connected) {
-		if(packet.header.seqNumber.load() == remoteKnownSn_) {
-			bool gotUpdate = false;
-
-			auto payload = packet.payload();
-			size_t chunk = std::min(payload.size(), recvRing_.spaceForEnqueue());
-			if(chunk) {
-				recvRing_.enqueue(payload.data(), chunk);
-				remoteKnownSn_ += chunk;
-				if(announcedWindow_ < chunk) {
-					announcedWindow_ = 0;
-				}else{
-					announcedWindow_ -= chunk;
+		auto flags = packet.header.flags.load();
+		auto seq = packet.header.seqNumber.load();
+		auto payload = packet.payload();
+		bool fin = flags & TcpHeader::finFlag;
+
+		// Update the timestamp that we echo (RFC 7323, section 4.3).
+		if(timestampsEnabled_ && packet.options.timestamp
+				&& !seqLess(packet.options.timestamp->value, recentTimestamp_)
+				&& !seqLess(remoteAckedSn_, seq))
+			recentTimestamp_ = packet.options.timestamp->value;
+
+		bool gotUpdate = false;
+		if(payload.size() || fin) {
+			recvMss_ = std::max(recvMss_, payload.size());
+
+			if(!seqLess(remoteKnownSn_, seq)) {
+				// Segments that fill a hole are acknowledged immediately (RFC 5681, section 4.2).
+				if(!outOfOrder_.empty())
+					ackNow_ = true;
+
+				// Skip data that we already received.
+				size_t skip = remoteKnownSn_ - seq;
+				if(skip <= payload.size())
+					gotUpdate = acceptData_(packet.packet, payload.subview(skip), fin);
+				if(gotUpdate)
+					gotUpdate |= drainOutOfOrder_();
+
+				// Acknowledge duplicates immediately, the remote may be retransmitting.
+				// Do not delay the ACK of a FIN either, the remote waits for it to close.
+				if(skip || fin)
+					ackNow_ = true;
+			}else{
+				// Queue segments that fit into our window, the hole is reported via SACK.
+				size_t offset = seq - remoteKnownSn_;
+				if(offset + payload.size() <= recvQueue_.spaceForEnqueue()) {
+					auto &segment = outOfOrder_[seq];
+					if(!segment.packet || payload.size() >= segment.data.size()) {
+						segment.packet = packet.packet;
+						segment.data = payload;
+						segment.fin = fin;
+					}
+					lastOutOfOrderSn_ = seq;
 				}
 
-				inSeq_ = ++currentSeq_;
-				gotUpdate = true;
-			}
-
-			if(packet.header.flags.load() & TcpHeader::finFlag) {
-				++remoteKnownSn_; // FIN counts as one byte.
-				remoteClosed_ = true;
-
-				hupSeq_ = ++currentSeq_;
-				gotUpdate = true;
-			}
-
-			if(gotUpdate) {
-				inEvent_.raise();
-				flushEvent_.raise();
-				pollEvent_.raise();
+				// Trigger duplicate ACKs for fast retransmit at the remote.
+				ackNow_ = true;
 			}
 		}
 
-		if(packet.header.flags.load() & TcpHeader::ackFlag) {
-			size_t validWindow = localFlushedSn_ - localSettledSn_;
-			size_t ackPointer = packet.header.ackNumber.load() - localSettledSn_;
-			if(ackPointer <= validWindow) {
-				localSettledSn_ += ackPointer;
-				localWindowSn_ = localSettledSn_ + packet.header.window.load();
-				sendRing_.dequeueAdvance(ackPointer);
-				outSeq_ = ++currentSeq_;
-				settleEvent_.raise();
-				pollEvent_.raise();
-			}else{
-				std::cout << "netserver: Rejecting ack-number outside of valid window"
-						<< std::endl;
-			}
+		if(gotUpdate) {
+			inEvent_.raise();
+			pollEvent_.raise();
+			publishStatus_();
 		}
+		if(gotUpdate || ackNow_)
+			flushEvent_.raise();
+
+		if(flags & TcpHeader::ackFlag)
+			handleAck_(packet, now);
 	}
 }
 
@@ -848,6 +1959,13 @@ void Tcp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet) {
 		std::cout << "netserver: Received TCP packet at port " << tcp.header.destPort.load()
 				<< " (" << tcp.payload().size() << " bytes)" << std::endl;
 
+	TcpFlow flow{tcp.packet->header.destination, tcp.header.destPort.load(),
+			tcp.packet->header.source, tcp.header.srcPort.load()};
+	if (auto conn = connections.find(flow); conn != connections.end()) {
+		conn->second->handleInPacket_(std::move(tcp));
+		return;
+	}
+
 	auto it = binds.lower_bound({ 0, tcp.header.destPort.load() });
 	for (; it != binds.end() && it->first.port == tcp.header.destPort.load(); it++) {
 		auto existingEp = it->first;
@@ -877,9 +1995,45 @@ bool Tcp4::unbind(TcpEndpoint e) {
 	return binds.erase(e) != 0;
 }
 
-void Tcp4::serveSocket(int flags, helix::UniqueLane lane) {
+void Tcp4::addConnection(TcpFlow flow, Tcp4Socket *socket) {
+	connections.insert_or_assign(flow, socket);
+}
+
+void Tcp4::removeConnection(TcpFlow flow) {
+	connections.erase(flow);
+}
+
+bool Tcp4::tryChargeMemory(size_t size) {
+	if(bufferMemory_ + size > maxBufferMemory)
+		return false;
+	bufferMemory_ += size;
+	return true;
+}
+
+void Tcp4::chargeMemory(size_t size) {
+	bufferMemory_ += size;
+}
+
+void Tcp4::unchargeMemory(size_t size) {
+	assert(size <= bufferMemory_);
+	bufferMemory_ -= size;
+}
+
+size_t TcpFlowHash::operator()(const TcpFlow &flow) const {
+	auto mix = [] (uint64_t x) {
+		x *= 0x9E3779B97F4A7C15;
+		return x ^ (x >> 32);
+	};
+	uint64_t addresses = (uint64_t{flow.localAddress} << 32) | flow.remoteAddress;
+	uint64_t ports = (uint64_t{flow.localPort} << 16) | flow.remotePort;
+	return mix(addresses ^ mix(ports));
+}
+
+helix::UniqueDescriptor Tcp4::serveSocket(int flags, helix::UniqueLane lane) {
 	using protocols::fs::servePassthrough;
 	auto sock = Tcp4Socket::makeSocket(this, flags & SOCK_NONBLOCK);
+	auto statusPage = sock->statusPageMemory();
 	async::detach(servePassthrough(std::move(lane), std::move(sock),
 			&Tcp4Socket::ops));
+	return statusPage;
 }
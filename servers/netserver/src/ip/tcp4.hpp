@@ -3,6 +3,7 @@
 #include <helix/ipc.hpp>
 #include <smarter.hpp>
 #include <map>
+#include <unordered_map>
 
 class Ip4Packet;
 
@@ -15,14 +16,41 @@ struct TcpEndpoint {
 	uint16_t port = 0;
 };
 
+// Identifies a connection. Addresses and ports are in native byte order.
+struct TcpFlow {
+	friend bool operator==(const TcpFlow &, const TcpFlow &) = default;
+
+	uint32_t localAddress = 0;
+	uint16_t localPort = 0;
+	uint32_t remoteAddress = 0;
+	uint16_t remotePort = 0;
+};
+
+struct TcpFlowHash {
+	size_t operator()(const TcpFlow &flow) const;
+};
+
 struct Tcp4Socket;
 
 struct Tcp4 {
 	void feedDatagram(smarter::shared_ptr<const Ip4Packet>);
 	bool tryBind(smarter::shared_ptr<Tcp4Socket> socket, TcpEndpoint ipAddress);
 	bool unbind(TcpEndpoint remote);
-	void serveSocket(int flags, helix::UniqueLane lane);
+	void addConnection(TcpFlow flow, Tcp4Socket *socket);
+	void removeConnection(TcpFlow flow);
+	// Returns the status page of the socket.
+	helix::UniqueDescriptor serveSocket(int flags, helix::UniqueLane lane);
+
+	// Accounts the memory of the send rings and receive queues of all sockets.
+	// Buffers can only grow while the total is below a global limit.
+	bool tryChargeMemory(size_t size);
+	void chargeMemory(size_t size);
+	void unchargeMemory(size_t size);
 
 private:
 	std::map<TcpEndpoint, smarter::shared_ptr<Tcp4Socket>> binds;
+	// Connected sockets, such that incoming segments are demultiplexed by a single
+	// hash lookup. Sockets remove themselves before they are destructed.
+	std::unordered_map<TcpFlow, Tcp4Socket *, TcpFlowHash> connections;
+	size_t bufferMemory_ = 0;
 };
@@ -9,13 +9,16 @@
 #include <async/queue.hpp>
 #include <arch/bit.hpp>
 #include <protocols/fs/server.hpp>
+#include <algorithm>
 #include <cstring>
 #include <iomanip>
+#include <optional>
 #include <random>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <linux/udp.h>
 
 namespace {
 struct stl_allocator {
@@ -70,6 +73,14 @@ struct Udp {
 		return packet->payload().subview(sizeof(header));
 	}
 
+	// Whether the datagram can be coalesced with other (for UDP_GRO).
+	bool sameFlow(const Udp &other) const {
+		return header.src == other.header.src
+			&& header.dst == other.header.dst
+			&& packet->header.source == other.packet->header.source
+			&& packet->header.destination == other.packet->header.destination;
+	}
+
 	bool parse(smarter::shared_ptr<const Ip4Packet> packet) {
 		Checksum chk;
 		auto payload = packet->payload();
@@ -81,7 +92,7 @@ struct Udp {
 		if (payload.size() < header.len) {
 			return false;
 		}
-		if (header.chk != 0) {
+		if (header.chk != 0 && !packet->l4ChecksumValid) {
 			PseudoHeader phdr;
 			phdr.src = packet->header.source;
 			phdr.dst = packet->header.destination;
@@ -137,6 +148,16 @@ auto checkAddress(const void *addr_ptr, size_t addr_len, Endpoint &e) {
 	e = addr;
 	return protocols::fs::Error::none;
 }
+
+// Maximal number of datagrams per UDP_SEGMENT send or UDP_GRO receive (as on Linux).
+constexpr size_t maxSegments = 64;
+
+// Distributes remote endpoints over the sockets of a SO_REUSEPORT group.
+uint64_t remoteHash(uint32_t addr, uint16_t port) {
+	uint64_t x = (uint64_t{addr} << 16) | port;
+	x *= 0x9E3779B97F4A7C15;
+	return x ^ (x >> 32);
+}
 } // namespace
 
 using namespace protocols::fs;
@@ -145,12 +166,13 @@ struct Udp4Socket {
 	Udp4Socket(Udp4 *parent) : parent_(parent) {}
 
 	~Udp4Socket() {
-		parent_->unbind(local_);
+		parent_->unbind(this);
 	}
 
 	static auto make_socket(Udp4 *parent) {
 		auto s = smarter::make_shared<Udp4Socket>(parent);
 		s->holder_ = s;
+		s->publishStatus_();
 		return s;
 	}
 
@@ -205,7 +227,7 @@ struct Udp4Socket {
 			co_return protocols::fs::Error::accessDenied;
 		}
 
-		if (local.addr != INADDR_ANY && !ip4().hasIp(local.addr)) {
+		if (local.addr != INADDR_ANY && !ip4().isLocal(local.addr)) {
 			std::cout << "netserver: not local ip" << std::endl;
 			co_return protocols::fs::Error::addressNotAvailable;
 		}
@@ -215,7 +237,7 @@ struct Udp4Socket {
 				co_return protocols::fs::Error::addressInUse;
 			}
 			std::cout << "netserver: no source port" << std::endl;
-		} else if (!self->parent_->tryBind(self->holder_.lock(), local)) {
+		} else if (!self->parent_->tryBind(self, local)) {
 			std::cout << "netserver: address in use" << std::endl;
 			co_return protocols::fs::Error::addressInUse;
 		}
@@ -235,16 +257,46 @@ struct Udp4Socket {
 
 		auto self = static_cast<Udp4Socket *>(obj);
 
-		auto element = co_await self->queue_.async_get();
-		auto packet = element->payload();
+		auto element = co_await self->nextDatagram_();
+		self->publishStatus_();
+		auto packet = element.payload();
 		auto copy_size = std::min(packet.size(), len);
 		std::memcpy(data, packet.data(), copy_size);
 
+		// Coalesce subsequent datagrams of the same flow and size, such that a single
+		// request returns a whole train of datagrams. As on Linux, a shorter datagram
+		// ends the train.
+		size_t segments = 1;
+		if (self->gro_ && copy_size == packet.size() && packet.size()) {
+			while (segments < maxSegments) {
+				if (!self->pending_) {
+					if (auto next = self->queue_.maybe_get(); next)
+						self->pending_ = std::move(*next);
+				}
+				if (!self->pending_ || !self->pending_->sameFlow(element))
+					break;
+
+				auto next = self->pending_->payload();
+				if (!next.size() || next.size() > packet.size()
+						|| copy_size + next.size() > len)
+					break;
+
+				std::memcpy(static_cast<char *>(data) + copy_size, next.data(), next.size());
+				copy_size += next.size();
+				segments++;
+				self->pending_.reset();
+
+				if (next.size() < packet.size())
+					break;
+			}
+			self->publishStatus_();
+		}
+
 		sockaddr_in addr {};
 		addr.sin_family = AF_INET;
-		addr.sin_port = convert_endian<endian::big>(element->header.src);
+		addr.sin_port = convert_endian<endian::big>(element.header.src);
 		addr.sin_addr = {
-			convert_endian<endian::big>(element->packet->header.source)
+			convert_endian<endian::big>(element.packet->header.source)
 		};
 
 		std::memset(addr_buf, 0, addr_size);
@@ -255,12 +307,17 @@ struct Udp4Socket {
 		if(self->ipPacketInfo_) {
 			ctrl.message(IPPROTO_IP, IP_PKTINFO, sizeof(struct in_pktinfo));
 			ctrl.write<struct in_pktinfo>({
-				.ipi_ifindex = unsigned(element->link.lock()->index()),
-				.ipi_spec_dst = { .s_addr = convert_endian<endian::big>(element->packet->header.destination) },
-				.ipi_addr = { .s_addr = convert_endian<endian::big>(element->packet->header.source) },
+				.ipi_ifindex = unsigned(element.link.lock()->index()),
+				.ipi_spec_dst = { .s_addr = convert_endian<endian::big>(element.packet->header.destination) },
+				.ipi_addr = { .s_addr = convert_endian<endian::big>(element.packet->header.source) },
 			});
 		}
 
+		if(segments > 1) {
+			ctrl.message(IPPROTO_UDP, UDP_GRO, sizeof(int));
+			ctrl.write<int>(packet.size());
+		}
+
 		co_return RecvData{ctrl.buffer(), copy_size, sizeof(addr), 0};
 	}
 
@@ -273,8 +330,6 @@ struct Udp4Socket {
 		(void) flags;
 		(void) fds;
 
-		using arch::convert_endian;
-		using arch::endian;
 		auto self = static_cast<Udp4Socket *>(obj);
 		Endpoint target;
 		auto source = self->local_;
@@ -305,60 +360,30 @@ struct Udp4Socket {
 			co_return protocols::fs::Error::accessDenied;
 		}
 
-		std::vector<char> buf;
-		buf.resize(sizeof(Udp::Header) + len);
-		Udp::Header header {
-			.src = source.port,
-			.dst = target.port,
-			.len = static_cast<uint16_t>(len + sizeof(Udp::Header)),
-			.chk = 0,
-		};
-		header.ensureEndian();
-
-		// native endian target IP
-		auto targetIpNe = target.addr;
-		source.ensureEndian();
-		target.ensureEndian();
-
-		auto ti = co_await ip4().targetByRemote(targetIpNe);
+		auto ti = co_await self->targetCache_.get(target.addr);
 		if (!ti) {
 			co_return protocols::fs::Error::netUnreachable;
 		}
 
-		Checksum chk;
-		PseudoHeader psh {
-			.src = convert_endian<endian::big>(ti->source),
-			.dst = target.addr,
-			.len = header.len
-		};
-		chk.update(&psh, sizeof(psh));
-		chk.update(&header, sizeof(header));
-		chk.update(data, len);
-		header.chk = convert_endian<endian::big>(chk.finalize());
-
-		std::cout << "netserver:" << std::endl << std::hex
-			<< std::setw(8) << psh.src << std::endl
-			<< std::setw(8) << psh.dst << std::endl
-			<< std::setw(8) << psh.len << std::endl
-
-			<< std::setw(8) << header.src << std::endl
-			<< std::setw(8) << header.dst << std::endl
-			<< std::setw(8) << header.len << std::endl
-			<< std::setw(8) << header.chk << std::endl << std::dec;
-
-		if (header.chk == 0) {
-			header.chk = ~header.chk;
+		// With UDP_SEGMENT, one request carries a train of datagrams.
+		size_t segmentSize = len;
+		if (self->segmentSize_ && len > self->segmentSize_) {
+			segmentSize = self->segmentSize_;
+			if ((len + segmentSize - 1) / segmentSize > maxSegments) {
+				co_return protocols::fs::Error::illegalArguments;
+			}
 		}
 
-		std::memcpy(buf.data(), &header, sizeof(header));
-		std::memcpy(buf.data() + sizeof(header), data, len);
-
-		auto error = co_await ip4().sendFrame(std::move(*ti),
-			buf.data(), buf.size(),
-			static_cast<uint16_t>(IpProto::udp));
-		if (error != protocols::fs::Error::none) {
-			co_return error;
-		}
+		size_t offset = 0;
+		do {
+			auto chunk = std::min(len - offset, segmentSize);
+			auto error = co_await sendDatagram_(*ti, source, target,
+				static_cast<char *>(data) + offset, chunk);
+			if (error != protocols::fs::Error::none) {
+				co_return error;
+			}
+			offset += chunk;
+		} while (offset < len);
 		co_return len;
 	}
 
@@ -382,11 +407,11 @@ struct Udp4Socket {
 	static async::result<frg::expected<protocols::fs::Error, protocols::fs::PollStatusResult>>
 	pollStatus(void *obj) {
 		auto self = static_cast<Udp4Socket *>(obj);
-		int events = EPOLLOUT;
-		if(!self->queue_.empty())
-			events |= EPOLLIN;
+		co_return protocols::fs::PollStatusResult(self->_currentSeq, self->activeEvents_());
+	}
 
-		co_return protocols::fs::PollStatusResult(self->_currentSeq, events);
+	helix::UniqueDescriptor statusPageMemory() {
+		return _statusPage.getMemory().dup();
 	}
 
 	static async::result<frg::expected<Error>> setSocketOption(void *obj,
@@ -400,6 +425,29 @@ struct Udp4Socket {
 			int val = *reinterpret_cast<int *>(optbuf.data());
 
 			self->ipPacketInfo_ = (val != 0);
+		} else if(layer == SOL_SOCKET && number == SO_REUSEPORT) {
+			if(optbuf.size() != sizeof(int))
+				co_return Error::illegalArguments;
+
+			int val = *reinterpret_cast<int *>(optbuf.data());
+
+			self->reusePort_ = (val != 0);
+		} else if(layer == IPPROTO_UDP && number == UDP_SEGMENT) {
+			if(optbuf.size() != sizeof(int))
+				co_return Error::illegalArguments;
+
+			int val = *reinterpret_cast<int *>(optbuf.data());
+			if(val < 0 || val > 0xFFFF - int(sizeof(Udp::Header)))
+				co_return Error::illegalArguments;
+
+			self->segmentSize_ = val;
+		} else if(layer == IPPROTO_UDP && number == UDP_GRO) {
+			if(optbuf.size() != sizeof(int))
+				co_return Error::illegalArguments;
+
+			int val = *reinterpret_cast<int *>(optbuf.data());
+
+			self->gro_ = (val != 0);
 		} else {
 			printf("netserver: unhandled setsockopt layer %d number %d\n", layer, number);
 			co_return protocols::fs::Error::invalidProtocolOption;
@@ -428,7 +476,6 @@ struct Udp4Socket {
 		// see also: RFC6056, Section 3.3.3
 		auto number = dist(rng);
 		auto range_size = dist.b() - dist.a();
-		auto shared_from_this = holder_.lock();
 		// TODO(arsen): optimize to not call lower_bound every time?
 		// I believe that such a thing is not needed right now: nearly
 		// (read: absolutely) every case is is an immediate miss: we are
@@ -436,7 +483,7 @@ struct Udp4Socket {
 		// that manner
 		for (int i = 0; i < range_size; i++) {
 			uint16_t port = dist.a() + ((number + i) % range_size);
-			if (parent_->tryBind(shared_from_this, { addr, port })) {
+			if (parent_->tryBind(this, { addr, port })) {
 				return true;
 			}
 		}
@@ -446,17 +493,105 @@ struct Udp4Socket {
 private:
 	friend struct Udp4;
 
+	int activeEvents_() {
+		int events = EPOLLOUT;
+		if(pending_ || !queue_.empty())
+			events |= EPOLLIN;
+		return events;
+	}
+
+	// Must be called whenever _currentSeq or the active events change.
+	void publishStatus_() {
+		// As in pollWait(), sockets are always writable.
+		_statusPage.update(_currentSeq, activeEvents_(), _inSeq, _currentSeq, 0);
+	}
+
+	async::result<Udp> nextDatagram_() {
+		if (pending_) {
+			auto element = std::move(*pending_);
+			pending_.reset();
+			co_return element;
+		}
+		co_return std::move(*co_await queue_.async_get());
+	}
+
+	// Sends a single datagram; source and target are in native byte order.
+	static async::result<protocols::fs::Error> sendDatagram_(Ip4TargetInfo ti,
+			Endpoint source, Endpoint target, const void *data, size_t len) {
+		using arch::convert_endian;
+		using arch::endian;
+
+		std::vector<char> buf;
+		buf.resize(sizeof(Udp::Header) + len);
+		Udp::Header header {
+			.src = source.port,
+			.dst = target.port,
+			.len = static_cast<uint16_t>(len + sizeof(Udp::Header)),
+			.chk = 0,
+		};
+		header.ensureEndian();
+
+		source.ensureEndian();
+		target.ensureEndian();
+
+		PseudoHeader psh {
+			.src = convert_endian<endian::big>(ti.source),
+			.dst = target.addr,
+			.len = header.len
+		};
+		// Locally delivered datagrams are not checksummed (a zero checksum means
+		// that there is none).
+		if (!ti.local) {
+			Checksum chk;
+			chk.update(&psh, sizeof(psh));
+			chk.update(&header, sizeof(header));
+			chk.update(data, len);
+			header.chk = convert_endian<endian::big>(chk.finalize());
+
+			if (header.chk == 0) {
+				header.chk = ~header.chk;
+			}
+		}
+
+		std::cout << "netserver:" << std::endl << std::hex
+			<< std::setw(8) << psh.src << std::endl
+			<< std::setw(8) << psh.dst << std::endl
+			<< std::setw(8) << psh.len << std::endl
+
+			<< std::setw(8) << header.src << std::endl
+			<< std::setw(8) << header.dst << std::endl
+			<< std::setw(8) << header.len << std::endl
+			<< std::setw(8) << header.chk << std::endl << std::dec;
+
+		std::memcpy(buf.data(), &header, sizeof(header));
+		std::memcpy(buf.data() + sizeof(header), data, len);
+
+		co_return co_await ip4().sendFrame(std::move(ti),
+			buf.data(), buf.size(),
+			static_cast<uint16_t>(IpProto::udp));
+	}
+
 	async::queue<Udp, stl_allocator> queue_;
+	// Datagram that was dequeued while coalescing but did not fit.
+	std::optional<Udp> pending_;
 	Endpoint remote_;
 	Endpoint local_;
 	Udp4 *parent_;
 	smarter::weak_ptr<Udp4Socket> holder_;
 
 	async::recurring_event _statusBell;
-	uint64_t _currentSeq;
-	uint64_t _inSeq;
+	uint64_t _currentSeq = 1;
+	uint64_t _inSeq = 0;
+	// Allows posix to poll without a round-trip to us.
+	protocols::fs::StatusPageProvider _statusPage;
 
 	bool ipPacketInfo_ = false;
+	bool reusePort_ = false;
+	// Payload size of the datagrams that UDP_SEGMENT splits sends into (or zero).
+	size_t segmentSize_ = 0;
+	bool gro_ = false;
+
+	Ip4TargetCache targetCache_;
 };
 
 void Udp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet, std::weak_ptr<nic::Link> link) {
@@ -468,40 +603,82 @@ void Udp4::feedDatagram(smarter::shared_ptr<const Ip4Packet> packet, std::weak_p
 
 	std::cout << "received udp datagram to port " << udp.header.dst << std::endl;
 
-	auto i = binds.lower_bound({ 0, udp.header.dst });
-	for (; i != binds.end() && i->first.port == udp.header.dst; i++) {
-		auto ep = i->first;
-		if (ep.addr == udp.packet->header.destination
-			|| ep.addr == INADDR_ANY) {
-			i->second->queue_.emplace(std::move(udp));
-			i->second->_inSeq = ++i->second->_currentSeq;
-			i->second->_statusBell.raise();
-			break;
+	auto bucket = binds.find(udp.header.dst);
+	if (bucket == binds.end()) {
+		return;
+	}
+	auto &sockets = bucket->second;
+
+	// Sockets that are bound to the destination address take precedence over
+	// wildcard binds. Within a SO_REUSEPORT group, pick a socket by the remote.
+	auto destination = udp.packet->header.destination;
+	auto boundTo = [&] (uint32_t addr) {
+		return std::count_if(sockets.begin(), sockets.end(),
+			[&] (Udp4Socket *s) { return s->local_.addr == addr; });
+	};
+
+	uint32_t addr = destination;
+	size_t n = boundTo(addr);
+	if (!n) {
+		addr = INADDR_ANY;
+		n = boundTo(addr);
+	}
+	if (!n) {
+		return;
+	}
+
+	size_t k = remoteHash(udp.packet->header.source, udp.header.src) % n;
+	for (auto socket : sockets) {
+		if (socket->local_.addr != addr || k--) {
+			continue;
 		}
+		socket->queue_.emplace(std::move(udp));
+		socket->_inSeq = ++socket->_currentSeq;
+		socket->_statusBell.raise();
+		socket->publishStatus_();
+		break;
 	}
 }
 
-bool Udp4::tryBind(smarter::shared_ptr<Udp4Socket> socket, Endpoint addr) {
-	auto i = binds.lower_bound(addr);
-	for (; i != binds.end() && i->first.port == addr.port; i++) {
-		auto ep = i->first;
+bool Udp4::tryBind(Udp4Socket *socket, Endpoint addr) {
+	auto &sockets = binds[addr.port];
+	for (auto existing : sockets) {
+		auto ep = existing->local_;
+		if (ep.addr == addr.addr && existing->reusePort_ && socket->reusePort_) {
+			continue;
+		}
 		if (ep.addr == INADDR_ANY || addr.addr == INADDR_ANY
 			|| ep.addr == addr.addr) {
 			return false;
 		}
 	}
 	socket->local_ = addr;
-	binds.emplace(addr, std::move(socket));
+	sockets.push_back(socket);
 	return true;
 }
 
-bool Udp4::unbind(Endpoint e) {
-	return binds.erase(e) != 0;
+bool Udp4::unbind(Udp4Socket *socket) {
+	auto bucket = binds.find(socket->local_.port);
+	if (bucket == binds.end()) {
+		return false;
+	}
+	auto &sockets = bucket->second;
+	auto it = std::find(sockets.begin(), sockets.end(), socket);
+	if (it == sockets.end()) {
+		return false;
+	}
+	sockets.erase(it);
+	if (sockets.empty()) {
+		binds.erase(bucket);
+	}
+	return true;
 }
 
-void Udp4::serveSocket(helix::UniqueLane lane) {
+helix::UniqueDescriptor Udp4::serveSocket(helix::UniqueLane lane) {
 	using protocols::fs::servePassthrough;
 	auto sock = Udp4Socket::make_socket(this);
+	auto statusPage = sock->statusPageMemory();
 	async::detach(servePassthrough(std::move(lane), std::move(sock),
 			&Udp4Socket::ops));
+	return statusPage;
 }
@@ -4,6 +4,8 @@
 #include <smarter.hpp>
 #include <map>
 #include <netserver/nic.hpp>
+#include <unordered_map>
+#include <vector>
 
 class Ip4Packet;
 
@@ -20,9 +22,12 @@ bool operator<(const Endpoint &l, const Endpoint &r);
 struct Udp4Socket;
 struct Udp4 {
 	void feedDatagram(smarter::shared_ptr<const Ip4Packet>, std::weak_ptr<nic::Link> link);
-	bool tryBind(smarter::shared_ptr<Udp4Socket> socket, Endpoint addr);
-	bool unbind(Endpoint remote);
-	void serveSocket(helix::UniqueLane lane);
+	bool tryBind(Udp4Socket *socket, Endpoint addr);
+	bool unbind(Udp4Socket *socket);
+	// Returns the status page of the socket.
+	helix::UniqueDescriptor serveSocket(helix::UniqueLane lane);
 private:
-	std::map<Endpoint, smarter::shared_ptr<Udp4Socket>> binds;
+	// Sockets bound to each port. Multiple sockets can share an endpoint if they
+	// all set SO_REUSEPORT. Sockets unbind themselves before they are destructed.
+	std::unordered_map<uint16_t, std::vector<Udp4Socket *>> binds;
 };
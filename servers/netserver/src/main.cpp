@@ -428,13 +428,14 @@ async::detached serve(helix::UniqueLane lane) {
 
 			if (req.req_type() == managarm::fs::CntReqType::CREATE_SOCKET) {
 				auto [local_lane, remote_lane] = helix::createStream();
+				helix::UniqueDescriptor statusPage;
 
 				managarm::fs::SvrResponse resp;
 				resp.set_error(managarm::fs::Errors::SUCCESS);
 
 				if(req.domain() == AF_INET) {
 					auto err = ip4().serveSocket(std::move(local_lane),
-							req.type(), req.protocol(), req.flags());
+							req.type(), req.protocol(), req.flags(), statusPage);
 					if(err != managarm::fs::Errors::SUCCESS) {
 						co_await sendError(err);
 						continue;
@@ -456,6 +457,24 @@ async::detached serve(helix::UniqueLane lane) {
 					continue;
 				}
 
+				if(statusPage) {
+					resp.set_caps(managarm::fs::FileCaps::FC_STATUS_PAGE);
+
+					auto ser = resp.SerializeAsString();
+					auto [send_resp, push_socket, push_page] =
+						co_await helix_ng::exchangeMsgs(
+							conversation,
+							helix_ng::sendBuffer(
+								ser.data(), ser.size()),
+							helix_ng::pushDescriptor(remote_lane),
+							helix_ng::pushDescriptor(statusPage)
+						);
+					HEL_CHECK(send_resp.error());
+					HEL_CHECK(push_socket.error());
+					HEL_CHECK(push_page.error());
+					continue;
+				}
+
 				auto ser = resp.SerializeAsString();
 				auto [send_resp, push_socket] =
 					co_await helix_ng::exchangeMsgs(
@@ -612,7 +631,7 @@ async::detached serve(helix::UniqueLane lane) {
 
 			auto [send] =
 				co_await helix_ng::exchangeMsgs(conversation,
-					helix_ng::sendBragiHeadOnly(resp, frg::stl_allocator{})
+					helix_ng::sendBragiHeadOnly(resp)
 				);
 			HEL_CHECK(send.error());
 		} else if(preamble.id() == managarm::fs::InitializePosixLane::message_id) {
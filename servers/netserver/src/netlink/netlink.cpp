@@ -1,5 +1,6 @@
 #include "netlink.hpp"
 
+#include <algorithm>
 #include <linux/rtnetlink.h>
 #include <memory>
 #include <sys/epoll.h>
@@ -14,6 +15,9 @@ namespace {
 constexpr bool logGroups = false;
 constexpr bool logSocket = false;
 
+// Upper bound of the size of dump chunks, as on Linux.
+constexpr size_t maxChunkSize = 32768;
+
 /* groupid -> std::unique_ptr<Group> */
 std::map<unsigned, std::unique_ptr<Group>> globalGroupMap;
 
@@ -50,6 +54,8 @@ async::result<protocols::fs::RecvResult> NetlinkSocket::recvMsg(void *obj,
 	if(logSocket)
 		std::cout << "netserver: Recv from netlink socket" << std::endl;
 
+	self->_chunkSize = std::clamp(len, self->_chunkSize, maxChunkSize);
+
 	if(self->_recvQueue.empty() && self->_nonBlock)
 		co_return protocols::fs::Error::wouldBlock;
 
@@ -83,7 +89,7 @@ async::result<protocols::fs::RecvResult> NetlinkSocket::recvMsg(void *obj,
 
 		auto [offer, send_req, recv_resp] = co_await helix_ng::exchangeMsgs(*posixLane,
 			helix_ng::offer(
-				helix_ng::sendBragiHeadOnly(creds_resolve_req, frg::stl_allocator{}),
+				helix_ng::sendBragiHeadOnly(creds_resolve_req),
 				helix_ng::recvInline()
 			)
 		);
@@ -96,9 +102,14 @@ async::result<protocols::fs::RecvResult> NetlinkSocket::recvMsg(void *obj,
 		ctrl.write<struct ucred>(ucreds);
 	}
 
-	if(!(flags & MSG_PEEK))
+	if(!(flags & MSG_PEEK)) {
 		self->_recvQueue.pop_front();
 
+		// The next chunk of a dump is built once the previous one has been read.
+		if(self->_recvQueue.empty() && self->_dump)
+			self->continueDump();
+	}
+
 	uint32_t reply_flags = 0;
 
 	if(!(flags & MSG_TRUNC) && truncated_size < size) {
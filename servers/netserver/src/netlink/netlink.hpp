@@ -12,6 +12,8 @@
 #include "ip/arp.hpp"
 
 #include <deque>
+#include <optional>
+#include <string>
 #include <vector>
 
 namespace nl {
@@ -66,7 +68,36 @@ public:
 	void deliver(core::netlink::Packet packet) override;
 
 private:
+	// State of a dump (i.e., a request with NLM_F_DUMP). Dumps are sent in chunks that
+	// contain multiple messages; the next chunk is only built once the previous one
+	// was read, so that large tables are not copied into the receive queue at once.
+	struct Dump {
+		struct nlmsghdr request;
+		// Filters of RTM_GETLINK and RTM_GETADDR.
+		int index = 0;
+		std::optional<std::string> name;
+		struct ifaddrmsg addrRequest{};
+		// Key of the last object that was considered: the last route, or the last
+		// interface index or neighbour address.
+		std::optional<Ip4Router::Route> lastRoute;
+		int64_t cursor = -1;
+		// If routes or addresses change during the dump, NLM_F_DUMP_INTR is set on
+		// NLMSG_DONE so that userspace knows to dump again.
+		uint64_t generation = 0;
+	};
+
 	void broadcast(core::netlink::Packet packet);
+	// Sends a reply to userspace, or appends it to the current chunk of a dump.
+	void reply(core::netlink::Packet packet);
+
+	void startDump(Dump dump);
+	void continueDump();
+	// Each of these fills the current chunk after the cursor. They return true if
+	// the dump is complete.
+	bool dumpLinks(Dump &dump);
+	bool dumpAddrs(Dump &dump);
+	bool dumpRoutes(Dump &dump);
+	bool dumpNeighbors(Dump &dump);
 
 	void getRoute(struct nlmsghdr *hdr);
 	void newRoute(struct nlmsghdr *hdr);
@@ -82,6 +113,8 @@ private:
 	void sendLinkPacket(std::shared_ptr<nic::Link> nic, void *h);
 	void sendAddrPacket(const struct nlmsghdr *hdr, const struct ifaddrmsg *msg, std::shared_ptr<nic::Link>);
 	void sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route &route);
+	static core::netlink::Packet routePacket(uint16_t type, uint16_t flags, uint32_t seq,
+			Ip4Router::Route &route);
 	void sendNeighPacket(const struct nlmsghdr *hdr, uint32_t addr, Neighbours::Entry &entry);
 
 	int flags;
@@ -95,6 +128,12 @@ private:
 	bool _nonBlock = false;
 
 	std::deque<core::netlink::Packet> _recvQueue;
+
+	std::optional<Dump> _dump;
+	std::optional<core::netlink::Packet> _chunk;
+	bool _chunkFull = false;
+	// Like Linux, size chunks according to the largest buffer passed to recvMsg().
+	size_t _chunkSize = 4096;
 };
 
 } // namespace nl
@@ -37,6 +37,21 @@ void NetlinkSocket::deliver(core::netlink::Packet packet) {
 	_statusBell.raise();
 }
 
+void NetlinkSocket::reply(core::netlink::Packet packet) {
+	if(!_chunk) {
+		deliver(std::move(packet));
+		return;
+	}
+
+	// A chunk always takes at least one message, even if it is larger than _chunkSize.
+	auto &buffer = _chunk->buffer;
+	if(!buffer.empty() && buffer.size() + packet.buffer.size() > _chunkSize) {
+		_chunkFull = true;
+		return;
+	}
+	buffer.insert(buffer.end(), packet.buffer.begin(), packet.buffer.end());
+}
+
 void NetlinkSocket::sendLinkPacket(std::shared_ptr<nic::Link> nic, void *h) {
 	struct nlmsghdr *hdr = reinterpret_cast<struct nlmsghdr *>(h);
 
@@ -68,7 +83,7 @@ void NetlinkSocket::sendLinkPacket(std::shared_ptr<nic::Link> nic, void *h) {
 	b.rtattr(IFLA_OPERSTATE, (uint8_t) IF_OPER_UP);
 	b.rtattr(IFLA_NUM_TX_QUEUES, 1);
 
-	deliver(b.packet());
+	reply(b.packet());
 }
 
 void NetlinkSocket::sendAddrPacket(const struct nlmsghdr *hdr, const struct ifaddrmsg *msg, std::shared_ptr<nic::Link> nic) {
@@ -93,13 +108,14 @@ void NetlinkSocket::sendAddrPacket(const struct nlmsghdr *hdr, const struct ifad
 	b.rtattr(IFA_LOCAL, htonl(addr.ip));
 	b.rtattr(IFA_LABEL, nic->name());
 
-	deliver(b.packet());
+	reply(b.packet());
 }
 
-void NetlinkSocket::sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route &route) {
+core::netlink::Packet NetlinkSocket::routePacket(uint16_t type, uint16_t flags, uint32_t seq,
+		Ip4Router::Route &route) {
 	NetlinkBuilder b;
 
-	b.header(RTM_NEWROUTE, NLM_F_MULTI, hdr->nlmsg_seq, 0);
+	b.header(type, flags, seq, 0);
 	b.message<struct rtmsg>({
 		.rtm_family = AF_INET,
 		.rtm_dst_len = route.network.prefix,
@@ -123,7 +139,11 @@ void NetlinkSocket::sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route
 		b.rtattr(RTA_PREFSRC, htonl(route.source));
 	b.rtattr(RTA_OIF, (route.link.expired()) ? 0 : route.link.lock()->index());
 
-	deliver(b.packet());
+	return b.packet();
+}
+
+void NetlinkSocket::sendRoutePacket(const struct nlmsghdr *hdr, Ip4Router::Route &route) {
+	reply(routePacket(RTM_NEWROUTE, NLM_F_MULTI, hdr->nlmsg_seq, route));
 }
 
 void NetlinkSocket::sendNeighPacket(const struct nlmsghdr *hdr, uint32_t addr, Neighbours::Entry &entry) {
@@ -148,7 +168,7 @@ void NetlinkSocket::sendNeighPacket(const struct nlmsghdr *hdr, uint32_t addr, N
 	b.rtattr(NDA_DST, htonl(addr));
 	b.rtattr<uint8_t[6]>(NDA_LLADDR, entry.mac.data());
 
-	deliver(b.packet());
+	reply(b.packet());
 }
 
 } // namespace nl
@@ -2,13 +2,143 @@
 #include "netlink.hpp"
 #include "src/ip/arp.hpp"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <linux/neighbour.h>
 
+namespace {
+
+// Returns the keys of the map that are greater than the cursor, in ascending order.
+template<typename Map>
+std::vector<int64_t> keysAfter(const Map &map, int64_t cursor) {
+	std::vector<int64_t> keys;
+	for(auto &[key, value] : map) {
+		if(static_cast<int64_t>(key) > cursor)
+			keys.push_back(key);
+	}
+	std::ranges::sort(keys);
+	return keys;
+}
+
+} // namespace
+
 namespace nl {
 
 using core::netlink::netlinkMessage;
 using core::netlink::netlinkAttr;
+using core::netlink::NetlinkBuilder;
+
+void NetlinkSocket::startDump(Dump dump) {
+	// Linux also allows only one dump per socket at a time.
+	if(_dump) {
+		sendError(this, &dump.request, EBUSY);
+		return;
+	}
+
+	dump.generation = ip4Router().generation();
+	_dump = std::move(dump);
+	continueDump();
+}
+
+void NetlinkSocket::continueDump() {
+	assert(_dump && !_chunk);
+	_chunk.emplace();
+	_chunkFull = false;
+
+	bool complete = false;
+	switch(_dump->request.nlmsg_type) {
+		case RTM_GETLINK: complete = dumpLinks(*_dump); break;
+		case RTM_GETADDR: complete = dumpAddrs(*_dump); break;
+		case RTM_GETROUTE: complete = dumpRoutes(*_dump); break;
+		case RTM_GETNEIGH: complete = dumpNeighbors(*_dump); break;
+		default:
+			assert(!"unexpected type of netlink dump");
+	}
+
+	auto chunk = std::move(*_chunk);
+	_chunk.reset();
+
+	if(complete) {
+		uint16_t flags = NLM_F_MULTI;
+		if(_dump->generation != ip4Router().generation())
+			flags |= NLM_F_DUMP_INTR;
+
+		NetlinkBuilder b;
+		b.header(NLMSG_DONE, flags, _dump->request.nlmsg_seq, 0);
+		b.message<uint32_t>(0);
+		auto done = b.packet();
+
+		// Otherwise, NLMSG_DONE is sent in a chunk of its own.
+		if(chunk.buffer.empty() || chunk.buffer.size() + done.buffer.size() <= _chunkSize) {
+			chunk.buffer.insert(chunk.buffer.end(), done.buffer.begin(), done.buffer.end());
+			_dump.reset();
+		}
+	}
+
+	deliver(std::move(chunk));
+}
+
+bool NetlinkSocket::dumpLinks(Dump &dump) {
+	auto &links = nic::Link::getLinks();
+
+	for(auto index : keysAfter(links, dump.cursor)) {
+		auto nic = links.at(index);
+		if((!dump.index || nic->index() == dump.index)
+				&& (!dump.name.has_value() || dump.name == nic->name())) {
+			sendLinkPacket(nic, &dump.request);
+			if(_chunkFull)
+				return false;
+		}
+		dump.cursor = index;
+	}
+
+	return true;
+}
+
+bool NetlinkSocket::dumpAddrs(Dump &dump) {
+	auto &links = nic::Link::getLinks();
+
+	for(auto index : keysAfter(links, dump.cursor)) {
+		auto nic = links.at(index);
+		if(!dump.index || nic->index() == dump.index) {
+			sendAddrPacket(&dump.request, &dump.addrRequest, nic);
+			if(_chunkFull)
+				return false;
+		}
+		dump.cursor = index;
+	}
+
+	return true;
+}
+
+bool NetlinkSocket::dumpRoutes(Dump &dump) {
+	// TODO: also return ipv6 routes.
+	auto &routes = ip4Router().getRoutes();
+
+	auto it = dump.lastRoute ? routes.upper_bound(*dump.lastRoute) : routes.begin();
+	for(; it != routes.end(); it++) {
+		auto route = *it;
+		sendRoutePacket(&dump.request, route);
+		if(_chunkFull)
+			return false;
+		dump.lastRoute = *it;
+	}
+
+	return true;
+}
+
+bool NetlinkSocket::dumpNeighbors(Dump &dump) {
+	auto &table = neigh4().getTable();
+
+	for(auto addr : keysAfter(table, dump.cursor)) {
+		sendNeighPacket(&dump.request, addr, table.at(addr));
+		if(_chunkFull)
+			return false;
+		dump.cursor = addr;
+	}
+
+	return true;
+}
 
 void NetlinkSocket::getLink(struct nlmsghdr *hdr) {
 	const struct ifinfomsg *msg;
@@ -62,29 +192,16 @@ void NetlinkSocket::getLink(struct nlmsghdr *hdr) {
 		}
 	}
 
-	if(!msg || msg->ifi_index == 0) {
-		auto links = nic::Link::getLinks();
-
-		for(auto m = links.begin(); m != links.end(); m++) {
-			if(!if_name.has_value() || if_name == m->second->name()) {
-				sendLinkPacket(m->second, hdr);
-			}
-		}
-	} else {
-		auto nic = nic::Link::byIndex(msg->ifi_index);
-
-		if(!nic) {
-			sendError(this, hdr, ENODEV);
-			return;
-		}
-
-		if(!if_name.has_value() || if_name == nic->name())
-			sendLinkPacket(nic, hdr);
+	if(msg && msg->ifi_index != 0 && !nic::Link::byIndex(msg->ifi_index)) {
+		sendError(this, hdr, ENODEV);
+		return;
 	}
 
-	sendDone(this, hdr);
-
-	return;
+	startDump({
+		.request = *hdr,
+		.index = msg ? msg->ifi_index : 0,
+		.name = if_name,
+	});
 }
 
 void NetlinkSocket::newRoute(struct nlmsghdr *hdr) {
@@ -165,8 +282,11 @@ void NetlinkSocket::newRoute(struct nlmsghdr *hdr) {
 	if(msg->rtm_family)
 		route.family = msg->rtm_family;
 
-	if(route_changed)
-		ip4Router().addRoute(std::move(route));
+	if(route_changed && ip4Router().addRoute(route)) {
+		auto packet = routePacket(RTM_NEWROUTE, 0, hdr->nlmsg_seq, route);
+		packet.group = RTNLGRP_IPV4_ROUTE;
+		broadcast(std::move(packet));
+	}
 
 	if(hdr->nlmsg_flags & NLM_F_ACK)
 		sendAck(this, hdr);
@@ -186,15 +306,7 @@ void NetlinkSocket::getRoute(struct nlmsghdr *hdr) {
 
 	assert(payload->rtgen_family == AF_UNSPEC || payload->rtgen_family == AF_INET);
 
-	// Loop over all ipv4 and ipv6 routes, and return them.
-	// TODO: also return ipv6 routes.
-	auto ipv4_router = ip4Router();
-
-	for(auto route : ipv4_router.getRoutes()) {
-		sendRoutePacket(hdr, route);
-	}
-
-	sendDone(this, hdr);
+	startDump({.request = *hdr});
 }
 
 void NetlinkSocket::newAddr(struct nlmsghdr *hdr) {
@@ -277,19 +389,11 @@ void NetlinkSocket::getAddr(struct nlmsghdr *hdr) {
 		}
 	}
 
-	auto links = nic::Link::getLinks();
-	for(auto m = links.begin(); m != links.end(); m++) {
-		if(!msg || msg->ifa_index == 0) {
-			sendAddrPacket(hdr, msg, m->second);
-		} else if(static_cast<uint32_t>(m->second->index()) == msg->ifa_index) {
-			sendAddrPacket(hdr, msg, m->second);
-			break;
-		}
-	}
-
-	sendDone(this, hdr);
-
-	return;
+	startDump({
+		.request = *hdr,
+		.index = static_cast<int>(msg->ifa_index),
+		.addrRequest = *msg,
+	});
 }
 
 void NetlinkSocket::deleteAddr(struct nlmsghdr *hdr) {
@@ -355,19 +459,23 @@ void NetlinkSocket::deleteAddr(struct nlmsghdr *hdr) {
 	if(hdr->nlmsg_flags & NLM_F_ACK)
 		sendAck(this, hdr);
 
+	NetlinkBuilder b;
+	b.group(RTNLGRP_IPV4_IFADDR);
+	b.header(RTM_DELADDR, 0, hdr->nlmsg_seq, 0);
+	b.message<struct ifaddrmsg>({
+		.ifa_family = AF_INET,
+		.ifa_prefixlen = cidr->prefix,
+		.ifa_index = msg->ifa_index,
+	});
+	b.nlattr(IFA_ADDRESS, htonl(cidr->ip));
+
+	broadcast(b.packet());
+
 	return;
 }
 
 void NetlinkSocket::getNeighbor(struct nlmsghdr *hdr) {
-	auto &table = neigh4().getTable();
-
-	for(auto it = table.begin(); it != table.end(); it++) {
-		sendNeighPacket(hdr, it->first, it->second);
-	}
-
-	sendDone(this, hdr);
-
-	return;
+	startDump({.request = *hdr});
 }
 
 } // namespace nl
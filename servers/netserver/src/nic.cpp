@@ -3,13 +3,16 @@
 #include <netserver/nic.hpp>
 
 #include <algorithm>
+#include <array>
 #include <cstring>
+#include <vector>
 #include <arch/bit.hpp>
 #include <frg/formatting.hpp>
 #include <frg/logging.hpp>
 #include <net/if.h>
 
 #include "ip/arp.hpp"
+#include "ip/checksum.hpp"
 #include "ip/ip4.hpp"
 #include "raw.hpp"
 
@@ -19,6 +22,35 @@ id_allocator<int> _allocator;
 
 std::unordered_map<std::string, id_allocator<int>> prefixedNames_;
 
+uint16_t loadBig16(const uint8_t *p) {
+	uint16_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return arch::convert_endian<arch::endian::big, arch::endian::native>(v);
+}
+
+uint32_t loadBig32(const uint8_t *p) {
+	uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return arch::convert_endian<arch::endian::big, arch::endian::native>(v);
+}
+
+void storeBig16(uint8_t *p, uint16_t v) {
+	v = arch::convert_endian<arch::endian::big>(v);
+	std::memcpy(p, &v, sizeof(v));
+}
+
+void storeBig32(uint8_t *p, uint32_t v) {
+	v = arch::convert_endian<arch::endian::big>(v);
+	std::memcpy(p, &v, sizeof(v));
+}
+
+// Completes a checksum whose field is seeded with the pseudo header sum.
+void completeChecksum(uint8_t *frame, size_t size, uint16_t csumStart, uint16_t csumOffset) {
+	Checksum csum;
+	csum.update(frame + csumStart, size - csumStart);
+	storeBig16(frame + csumStart + csumOffset, csum.finalize());
+}
+
 } /* namespace */
 
 namespace nic {
@@ -126,6 +158,80 @@ Link::AllocatedBuffer Link::allocateFrame(MacAddress to, EtherType type,
 	return buf;
 }
 
+async::result<size_t> Link::receiveBatch(std::span<RxFrame> frames) {
+	assert(!frames.empty());
+	frames[0].buffer = arch::dma_buffer{dmaPool(), 1514};
+	frames[0].offset = 0;
+	frames[0].length = co_await receive(frames[0].buffer);
+	frames[0].meta = {};
+	co_return 1;
+}
+
+async::result<void> Link::sendBatch(std::span<const arch::dma_buffer_view> frames) {
+	for(auto &frame : frames)
+		co_await send(frame);
+}
+
+async::result<void> Link::sendOffloaded(const arch::dma_buffer_view frame, const TxMetadata &meta) {
+	auto data = reinterpret_cast<uint8_t *>(frame.data());
+
+	if(!meta.gsoSize) {
+		if(meta.needsChecksum)
+			completeChecksum(data, frame.size(), meta.csumStart, meta.csumOffset);
+		co_await send(frame);
+		co_return;
+	}
+
+	// Software GSO: split the TCP payload into segments that fit into the MTU.
+	assert(meta.needsChecksum);
+	assert(frame.size() > meta.headerLength);
+	auto ipOffset = meta.networkOffset;
+	auto tcpOffset = meta.csumStart;
+	size_t headerLength = meta.headerLength;
+	size_t payloadSize = frame.size() - headerLength;
+	auto ident = loadBig16(data + ipOffset + 4);
+	auto seq = loadBig32(data + tcpOffset + 4);
+
+	std::vector<arch::dma_buffer> segmentBuffers;
+	std::vector<arch::dma_buffer_view> segments;
+	segmentBuffers.reserve((payloadSize + meta.gsoSize - 1) / meta.gsoSize);
+
+	uint16_t n = 0;
+	for(size_t offset = 0; offset < payloadSize; offset += meta.gsoSize, n++) {
+		auto chunk = std::min(size_t{meta.gsoSize}, payloadSize - offset);
+		auto &segmentBuffer = segmentBuffers.emplace_back(dmaPool(), headerLength + chunk);
+		auto segment = reinterpret_cast<uint8_t *>(segmentBuffer.data());
+		std::memcpy(segment, data, headerLength);
+		std::memcpy(segment + headerLength, data + headerLength + offset, chunk);
+
+		// Fix up the IPv4 header.
+		auto ip = segment + ipOffset;
+		size_t ihl = (ip[0] & 0x0f) * 4;
+		storeBig16(ip + 2, headerLength - ipOffset + chunk);
+		storeBig16(ip + 4, ident + n);
+		storeBig16(ip + 10, 0);
+		Checksum ipCsum;
+		ipCsum.update(ip, ihl);
+		storeBig16(ip + 10, ipCsum.finalize());
+
+		// Fix up the TCP header and compute its checksum (including the pseudo header).
+		auto tcp = segment + tcpOffset;
+		size_t tcpLength = headerLength - tcpOffset + chunk;
+		storeBig32(tcp + 4, seq + offset);
+		storeBig16(tcp + meta.csumOffset, 0);
+		Checksum tcpCsum;
+		tcpCsum.update(ip + 12, 8);
+		tcpCsum.update(uint16_t{ip[9]});
+		tcpCsum.update(static_cast<uint16_t>(tcpLength));
+		tcpCsum.update(tcp, tcpLength);
+		storeBig16(tcp + meta.csumOffset, tcpCsum.finalize());
+
+		segments.push_back(segmentBuffer);
+	}
+
+	co_await sendBatch(segments);
+}
+
 unsigned int Link::iff_flags() {
 	unsigned int flags = 0;
 
@@ -145,33 +251,45 @@ unsigned int Link::iff_flags() {
 
 async::detached runDevice(std::shared_ptr<nic::Link> dev) {
 	using namespace arch;
+	// Maximal number of frames that we take from the link at once.
+	constexpr size_t batchSize = 16;
+	std::array<RxFrame, batchSize> frames;
+
 	while(true) {
-		dma_buffer frameBuffer { dev->dmaPool(), 1514 };
-		auto len = co_await dev->receive(frameBuffer);
-
-		if(!dev->rawIp()) {
-			auto capsule = frameBuffer.subview(14, len - 14);
-			auto data = reinterpret_cast<uint8_t*>(frameBuffer.data());
-			uint16_t ethertype = data[12] << 8 | data[13];
-			nic::MacAddress dstsrc[2];
-			std::memcpy(dstsrc, data, sizeof(dstsrc));
-
-			raw().feedPacket(frameBuffer.subview(0, len));
-
-			switch (ethertype) {
-			case ETHER_TYPE_IP4:
-				ip4().feedPacket(dstsrc[0], dstsrc[1],
-					std::move(frameBuffer), capsule, dev);
-				break;
-			case ETHER_TYPE_ARP:
-				neigh4().feedArp(dstsrc[0], capsule, dev);
-				break;
-			default:
-				break;
+		auto count = co_await dev->receiveBatch(frames);
+		assert(count && count <= batchSize);
+
+		for(size_t i = 0; i < count; i++) {
+			auto frameBuffer = std::move(frames[i].buffer);
+			auto offset = frames[i].offset;
+			auto len = frames[i].length;
+			auto &meta = frames[i].meta;
+
+			if(!dev->rawIp()) {
+				auto capsule = frameBuffer.subview(offset + 14, len - 14);
+				auto data = reinterpret_cast<uint8_t*>(frameBuffer.data()) + offset;
+				uint16_t ethertype = data[12] << 8 | data[13];
+				nic::MacAddress dstsrc[2];
+				std::memcpy(dstsrc, data, sizeof(dstsrc));
+
+				raw().feedPacket(frameBuffer.subview(offset, len));
+
+				switch (ethertype) {
+				case ETHER_TYPE_IP4:
+					ip4().feedPacket(dstsrc[0], dstsrc[1],
+						std::move(frameBuffer), capsule, dev, meta.checksumValid);
+					break;
+				case ETHER_TYPE_ARP:
+					neigh4().feedArp(dstsrc[0], capsule, dev);
+					break;
+				default:
+					break;
+				}
+			} else {
+				dma_buffer_view capsule = frameBuffer.subview(offset, len);
+				ip4().feedPacket({}, {}, std::move(frameBuffer), capsule, dev,
+					meta.checksumValid);
 			}
-		} else {
-			dma_buffer_view capsule = frameBuffer;
-			ip4().feedPacket({}, {}, std::move(frameBuffer), capsule, dev);
 		}
 	}
 }
@@ -28,8 +28,7 @@ void Raw::feedPacket(arch::dma_buffer_view frame) {
 		size_t accept_bytes = SIZE_MAX;
 
 		if((*s)->filter_) {
-			Bpf bpf{(*s)->filter_.value()};
-			accept_bytes = bpf.run(frame);
+			accept_bytes = (*s)->filter_->run(frame);
 
 			if(!accept_bytes)
 				continue;
@@ -126,7 +125,7 @@ async::result<frg::expected<protocols::fs::Error>> RawSocket::setSocketOption(vo
 		if(!bpf.validate())
 			co_return protocols::fs::Error::illegalArguments;
 
-		self->filter_ = optbuf;
+		self->filter_ = std::move(bpf);
 	} else if(layer == SOL_SOCKET && number == SO_DETACH_FILTER) {
 		if(self->filterLocked_)
 			co_return protocols::fs::Error::insufficientPermissions;
@@ -3,6 +3,7 @@
 #include <arch/dma_pool.hpp>
 #include <async/recurring-event.hpp>
 #include <async/queue.hpp>
+#include <core/bpf.hpp>
 #include <helix/ipc.hpp>
 #include <netserver/nic.hpp>
 #include <protocols/fs/server.hpp>
@@ -60,7 +61,7 @@ private:
 	int proto;
 	bool filterLocked_ = false;
 	bool packetAuxData_ = false;
-	std::optional<std::vector<char>> filter_ = std::nullopt;
+	std::optional<Bpf> filter_ = std::nullopt;
 
 	std::shared_ptr<nic::Link> link = {};
 
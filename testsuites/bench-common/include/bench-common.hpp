@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Result collection and reporting shared by kernel-bench, storage-bench and net-bench.
+// All of them print human-readable results while running and (with --json) a machine
+// readable summary in the same format at the end.
+
+namespace bench {
+
+using clock = std::chrono::steady_clock;
+
+// Per-operation latencies (in nanoseconds) of a single worker (thread, queue slot, ...).
+// Note that each sample includes the overhead of reading the clock twice.
+struct LatencySamples {
+	// Upper bound on the number of samples that we keep in memory (per worker).
+	static constexpr size_t maxSamples = 1 << 20;
+
+	void record(std::chrono::time_point<clock> start, std::chrono::time_point<clock> end) {
+		numOps++;
+		if(samples.size() >= maxSamples)
+			return;
+		auto elapsed = duration_cast<std::chrono::nanoseconds>(end - start);
+		samples.push_back(elapsed.count());
+	}
+
+	uint64_t numOps = 0;
+	uint64_t numBytes = 0;
+	std::vector<uint64_t> samples;
+};
+
+struct LatencyStats {
+	uint64_t numSamples = 0;
+	uint64_t p50 = 0;
+	uint64_t p90 = 0;
+	uint64_t p99 = 0;
+	uint64_t p999 = 0;
+	uint64_t max = 0;
+};
+
+// Sorts the samples in place.
+inline LatencyStats computeLatencyStats(std::vector<uint64_t> &samples) {
+	LatencyStats stats;
+	stats.numSamples = samples.size();
+	if(samples.empty())
+		return stats;
+
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&] (double p) -> uint64_t {
+		return samples[static_cast<size_t>(p * (samples.size() - 1))];
+	};
+	stats.p50 = percentile(0.5);
+	stats.p90 = percentile(0.9);
+	stats.p99 = percentile(0.99);
+	stats.p999 = percentile(0.999);
+	stats.max = samples.back();
+	return stats;
+}
+
+// Merges the samples of all workers.
+inline LatencyStats computeLatencyStats(const std::vector<LatencySamples> &workers) {
+	std::vector<uint64_t> samples;
+	for(auto &worker : workers)
+		samples.insert(samples.end(), worker.samples.begin(), worker.samples.end());
+	return computeLatencyStats(samples);
+}
+
+inline void printLatency(const LatencyStats &stats) {
+	std::cout << "    latency: p50: " << stats.p50 << " ns"
+			<< ", p90: " << stats.p90 << " ns"
+			<< ", p99: " << stats.p99 << " ns"
+			<< ", p99.9: " << stats.p999 << " ns"
+			<< ", max: " << stats.max << " ns"
+			<< " (" << stats.numSamples << " samples)" << std::endl;
+}
+
+// Results of all benchmarks; printed as JSON at the end if requested.
+// Each benchmark fills in the groups of fields that it measures.
+struct BenchmarkResult {
+	std::string name;
+	// Repeated runs of a fixed-time loop.
+	bool haveIterations = false;
+	uint64_t avgIterations = 0;
+	uint64_t stdIterations = 0;
+	// Operations over the whole runtime of the benchmark.
+	bool haveRate = false;
+	uint64_t numOps = 0;
+	uint64_t bytesPerSecond = 0;
+	uint64_t opsPerSecond = 0;
+	bool haveLatency = false;
+	LatencyStats latency;
+};
+
+inline std::vector<BenchmarkResult> allResults;
+
+// Returns the result of the given benchmark, creating it if necessary.
+inline BenchmarkResult &resultFor(const std::string &name) {
+	for(auto &result : allResults)
+		if(result.name == name)
+			return result;
+	allResults.push_back(BenchmarkResult{.name = name});
+	return allResults.back();
+}
+
+inline void printJson() {
+	std::cout << "{\"benchmarks\": [";
+	for(size_t i = 0; i < allResults.size(); ++i) {
+		auto &result = allResults[i];
+		if(i)
+			std::cout << ",";
+		std::cout << "\n  {\"name\": \"" << result.name << "\"";
+		if(result.haveIterations)
+			std::cout << ", \"iterations_per_second\": {\"avg\": " << result.avgIterations
+					<< ", \"std\": " << result.stdIterations << "}";
+		if(result.haveRate)
+			std::cout << ", \"ops\": " << result.numOps
+					<< ", \"bytes_per_second\": " << result.bytesPerSecond
+					<< ", \"ops_per_second\": " << result.opsPerSecond;
+		if(result.haveLatency)
+			std::cout << ", \"latency_ns\": {\"samples\": " << result.latency.numSamples
+					<< ", \"p50\": " << result.latency.p50
+					<< ", \"p90\": " << result.latency.p90
+					<< ", \"p99\": " << result.latency.p99
+					<< ", \"p99.9\": " << result.latency.p999
+					<< ", \"max\": " << result.latency.max << "}";
+		std::cout << "}";
+	}
+	std::cout << "\n]}" << std::endl;
+}
+
+} // namespace bench
@@ -1,16 +1,55 @@
 #include <math.h>
+#include <string.h>
 
 #include <async/result.hpp>
 #include <async/algorithm.hpp>
+#include <bench-common.hpp>
 #include <helix/ipc.hpp>
 
+#include <cassert>
+#include <cstddef>
+#include <string>
+#include <thread>
 #include <vector>
 
 namespace {
 
+// Records per-operation latencies (in nanoseconds) and reports percentiles.
+struct LatencyHistogram {
+	using clock = bench::clock;
+
+	explicit LatencyHistogram(std::string name)
+	: name_{std::move(name)} { }
+
+	void record(std::chrono::time_point<clock> start, std::chrono::time_point<clock> end) {
+		samples_.record(start, end);
+	}
+
+	template<typename F>
+	void measure(F &&f) {
+		auto start = clock::now();
+		f();
+		record(start, clock::now());
+	}
+
+	void finalizeStatistics() {
+		auto &result = bench::resultFor(name_);
+		result.haveLatency = true;
+		result.latency = bench::computeLatencyStats(samples_.samples);
+		bench::printLatency(result.latency);
+	}
+
+private:
+	std::string name_;
+	bench::LatencySamples samples_;
+};
+
 struct IterationsPerSecondBenchmark {
 	using clock = std::chrono::high_resolution_clock;
 
+	explicit IterationsPerSecondBenchmark(std::string name)
+	: name_{std::move(name)} { }
+
 	void launchRepetition() {
 		ref_ = clock::now();
 	}
@@ -39,9 +78,15 @@ struct IterationsPerSecondBenchmark {
 
 		std::cout << "    avg: " << static_cast<uint64_t>(avg)
 				<< ", std: " << static_cast<uint64_t>(sqrt(var)) << std::endl;
+
+		auto &result = bench::resultFor(name_);
+		result.haveIterations = true;
+		result.avgIterations = static_cast<uint64_t>(avg);
+		result.stdIterations = static_cast<uint64_t>(sqrt(var));
 	}
 
 private:
+	std::string name_;
 	std::vector<double> results_;
 	std::chrono::time_point<clock> ref_;
 };
@@ -49,7 +94,7 @@ private:
 void doNopBenchmark() {
 	std::cout << "syscall ops" << std::endl;
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"syscall"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -62,12 +107,17 @@ void doNopBenchmark() {
 		bench.announceIterations(n);
 	}
 	bench.finalizeStatistics();
+
+	LatencyHistogram histogram{"syscall"};
+	for(int i = 0; i < 100'000; ++i)
+		histogram.measure([] { HEL_CHECK(helNop()); });
+	histogram.finalizeStatistics();
 }
 
 async::result<void> doAsyncNopBenchmark() {
 	std::cout << "ipc ops" << std::endl;
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"async-nop"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -81,12 +131,21 @@ async::result<void> doAsyncNopBenchmark() {
 		bench.announceIterations(n);
 	}
 	bench.finalizeStatistics();
+
+	LatencyHistogram histogram{"async-nop"};
+	for(int i = 0; i < 100'000; ++i) {
+		auto start = LatencyHistogram::clock::now();
+		auto result = co_await helix_ng::asyncNop();
+		HEL_CHECK(result.error());
+		histogram.record(start, LatencyHistogram::clock::now());
+	}
+	histogram.finalizeStatistics();
 }
 
 void doFutexBenchmark() {
 	std::cout << "futex waits" << std::endl;
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"futex-wait"};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -100,12 +159,19 @@ void doFutexBenchmark() {
 		bench.announceIterations(n);
 	}
 	bench.finalizeStatistics();
+
+	LatencyHistogram histogram{"futex-wait"};
+	for(int i = 0; i < 100'000; ++i) {
+		int futex = 1;
+		histogram.measure([&] { HEL_CHECK(helFutexWait(&futex, 0, -1)); });
+	}
+	histogram.finalizeStatistics();
 }
 
 void doAllocateBenchmark(size_t size) {
 	std::cout << "allocate memory, size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"allocate-memory-" + std::to_string(size)};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -123,7 +189,7 @@ void doAllocateBenchmark(size_t size) {
 void doMapBenchmark(size_t size) {
 	std::cout << "memory mapping, size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"map-memory-" + std::to_string(size)};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -158,7 +224,8 @@ void doMapPopulatedBenchmark(size_t size) {
 
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
 
-	IterationsPerSecondBenchmark bench;
+	auto name = "map-populated-" + std::to_string(size);
+	IterationsPerSecondBenchmark bench{name};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -173,13 +240,25 @@ void doMapPopulatedBenchmark(size_t size) {
 	}
 	bench.finalizeStatistics();
 
+	LatencyHistogram histogram{name};
+	for(int i = 0; i < 10'000; ++i) {
+		histogram.measure([&] {
+			void *window;
+			HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+					kHelMapProtRead | kHelMapProtWrite, &window));
+			HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+		});
+	}
+	histogram.finalizeStatistics();
+
 	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
 }
 
 void doPageFaultBenchmark(size_t size) {
 	std::cout << "page faults (mapping size = " << (size / (1024 * 1024)) << " MiB)" << std::endl;
 
-	IterationsPerSecondBenchmark bench;
+	auto name = "page-fault-" + std::to_string(size);
+	IterationsPerSecondBenchmark bench{name};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -203,6 +282,113 @@ void doPageFaultBenchmark(size_t size) {
 		bench.announceIterations(n);
 	}
 	bench.finalizeStatistics();
+
+	// Measure the cost of individual faults.
+	LatencyHistogram histogram{name};
+	for(int k = 0; k < 100; ++k) {
+		HelHandle handle;
+		HEL_CHECK(helAllocateMemory(size, 0, nullptr, &handle));
+		void *window;
+		HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, size,
+				kHelMapProtRead | kHelMapProtWrite, &window));
+
+		auto p = reinterpret_cast<volatile std::byte *>(window);
+		for(size_t progress = 0; progress < size; progress += 0x1000)
+			histogram.measure([&] { p[progress] = static_cast<std::byte>(0); });
+
+		HEL_CHECK(helUnmapMemory(kHelNullHandle, window, size));
+		HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+	}
+	histogram.finalizeStatistics();
+}
+
+void doThreadBenchmark() {
+	std::cout << "thread create/join" << std::endl;
+
+	IterationsPerSecondBenchmark bench{"thread-create-join"};
+	for(int k = 0; k < 5; ++k) {
+		uint64_t n = 0;
+		bench.launchRepetition();
+		while(!bench.isRepetitionDone()) {
+			std::thread thread{[] { }};
+			thread.join();
+			++n;
+		}
+		bench.announceIterations(n);
+	}
+	bench.finalizeStatistics();
+
+	LatencyHistogram histogram{"thread-create-join"};
+	for(int i = 0; i < 1'000; ++i) {
+		histogram.measure([] {
+			std::thread thread{[] { }};
+			thread.join();
+		});
+	}
+	histogram.finalizeStatistics();
+}
+
+void pinCurrentThread(unsigned int cpu) {
+	std::vector<uint8_t> mask(cpu / 8 + 1);
+	mask[cpu / 8] |= 1 << (cpu % 8);
+	HEL_CHECK(helSetAffinity(kHelThisThread, mask.data(), mask.size()));
+}
+
+async::result<void> servePingPong(helix::UniqueLane &lane, int rounds) {
+	for(int i = 0; i < rounds; ++i) {
+		auto [accept, recv] = co_await helix_ng::exchangeMsgs(
+			lane,
+			helix_ng::accept(
+				helix_ng::recvInline()
+			)
+		);
+		HEL_CHECK(accept.error());
+		HEL_CHECK(recv.error());
+
+		auto conversation = accept.descriptor();
+		auto [send] = co_await helix_ng::exchangeMsgs(
+			conversation,
+			helix_ng::sendBuffer(recv.data(), recv.length())
+		);
+		HEL_CHECK(send.error());
+	}
+}
+
+// Measures round trips of offer/accept conversations between two threads.
+// If there are at least two CPUs, the threads are pinned to different CPUs.
+async::result<void> doPingPongBenchmark(bool crossCpu) {
+	constexpr int rounds = 100'000;
+	auto name = std::string{crossCpu ? "ping-pong-cross-cpu" : "ping-pong-same-cpu"};
+	std::cout << (crossCpu ? "cross-CPU" : "same-CPU") << " ping-pong" << std::endl;
+
+	auto [lane1, lane2] = helix::createStream();
+
+	pinCurrentThread(0);
+	std::thread server{[&, lane = std::move(lane2)] () mutable {
+		pinCurrentThread(crossCpu ? 1 : 0);
+		async::run(servePingPong(lane, rounds), helix::currentDispatcher);
+	}};
+
+	LatencyHistogram histogram{name};
+	for(int i = 0; i < rounds; ++i) {
+		uint64_t ping = i;
+		auto start = LatencyHistogram::clock::now();
+		auto [offer, send, recv] = co_await helix_ng::exchangeMsgs(
+			lane1,
+			helix_ng::offer(
+				helix_ng::sendBuffer(&ping, sizeof(uint64_t)),
+				helix_ng::recvInline()
+			)
+		);
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send.error());
+		HEL_CHECK(recv.error());
+		histogram.record(start, LatencyHistogram::clock::now());
+		assert(recv.length() == sizeof(uint64_t));
+	}
+	histogram.finalizeStatistics();
+
+	server.join();
 }
 
 async::result<void> doSendRecvBufferBenchmark(size_t size) {
@@ -218,7 +404,7 @@ async::result<void> doSendRecvBufferBenchmark(size_t size) {
 		std::cout << "size = " << (size / (1024 * 1024)) << " MiB" << std::endl;
 	}
 
-	IterationsPerSecondBenchmark bench;
+	IterationsPerSecondBenchmark bench{"send-recv-buffer-" + std::to_string(size)};
 	for(int k = 0; k < 5; ++k) {
 		uint64_t n = 0;
 		bench.launchRepetition();
@@ -249,7 +435,17 @@ async::result<void> doSendRecvBufferBenchmark(size_t size) {
 
 } // anonymous namespace
 
-int main() {
+int main(int argc, char **argv) {
+	bool json = false;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "--json")) {
+			json = true;
+		}else{
+			std::cerr << "kernel-bench: Unknown argument " << argv[i] << std::endl;
+			return 1;
+		}
+	}
+
 	doNopBenchmark();
 	doFutexBenchmark();
 	async::run(doAsyncNopBenchmark(), helix::currentDispatcher);
@@ -264,4 +460,11 @@ int main() {
 	async::run(doSendRecvBufferBenchmark(16 * 1024), helix::currentDispatcher);
 	async::run(doSendRecvBufferBenchmark(64 * 1024), helix::currentDispatcher);
 	async::run(doSendRecvBufferBenchmark(1024 * 1024), helix::currentDispatcher);
+	doThreadBenchmark();
+	async::run(doPingPongBenchmark(false), helix::currentDispatcher);
+	if(std::thread::hardware_concurrency() >= 2)
+		async::run(doPingPongBenchmark(true), helix::currentDispatcher);
+
+	if(json)
+		bench::printJson();
 }
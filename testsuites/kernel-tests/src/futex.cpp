@@ -0,0 +1,125 @@
+#include <atomic>
+#include <cassert>
+#include <thread>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(futexRequeueMismatch, ([] {
+	int futex = 1;
+	int target = 0;
+	size_t count;
+	assert(helFutexRequeue(&futex, &target, 0, 1, 1, &count) == kHelErrIllegalState);
+	HEL_CHECK(helFutexRequeue(&futex, &target, 1, 1, 1, &count));
+	assert(!count);
+}))
+
+DEFINE_TEST(futexRequeueWake, ([] {
+	int futex = 0;
+	int target = 0;
+	std::atomic<bool> started{false};
+	std::atomic<bool> done{false};
+
+	std::thread waiter{[&] {
+		started.store(true);
+		while(!done.load())
+			HEL_CHECK(helFutexWait(&futex, 0, -1));
+	}};
+
+	// The waiter may not have blocked yet; retry until the requeue moves it.
+	while(!started.load())
+		std::this_thread::yield();
+	size_t count;
+	while(true) {
+		HEL_CHECK(helFutexRequeue(&futex, &target, 0, 0, 1, &count));
+		if(count)
+			break;
+		std::this_thread::yield();
+	}
+	assert(count == 1);
+
+	// The waiter is not on the original futex anymore.
+	HEL_CHECK(helFutexRequeue(&futex, &target, 0, 1, 0, &count));
+	assert(!count);
+
+	// Waking the target futex wakes the waiter; the join hangs otherwise.
+	done.store(true);
+	HEL_CHECK(helFutexWake(&target));
+	waiter.join();
+}))
+
+DEFINE_TEST(futexPiErrors, ([] {
+	uint32_t tid;
+	HEL_CHECK(helGetFutexTid(&tid));
+	assert(tid && !(tid & ~kHelFutexPiTidMask));
+
+	// Locking an unlocked futex in the kernel takes it.
+	int futex = 0;
+	HEL_CHECK(helFutexLockPi(&futex, -1));
+	assert(static_cast<uint32_t>(futex) == tid);
+
+	// We already own the futex.
+	assert(helFutexLockPi(&futex, -1) == kHelErrIllegalState);
+
+	HEL_CHECK(helFutexUnlockPi(&futex));
+	assert(!futex);
+
+	// We do not own the futex anymore.
+	assert(helFutexUnlockPi(&futex) == kHelErrIllegalState);
+}))
+
+DEFINE_TEST(futexPiHandover, ([] {
+	uint32_t tid;
+	HEL_CHECK(helGetFutexTid(&tid));
+
+	int futex = static_cast<int>(tid);
+	std::atomic<bool> acquired{false};
+
+	std::thread waiter{[&] {
+		uint32_t waiterTid;
+		HEL_CHECK(helGetFutexTid(&waiterTid));
+
+		int expected = 0;
+		if(!__atomic_compare_exchange_n(&futex, &expected, static_cast<int>(waiterTid),
+				false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			HEL_CHECK(helFutexLockPi(&futex, -1));
+		assert((static_cast<uint32_t>(futex) & kHelFutexPiTidMask) == waiterTid);
+		acquired.store(true);
+
+		expected = static_cast<int>(waiterTid);
+		if(!__atomic_compare_exchange_n(&futex, &expected, 0,
+				false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			HEL_CHECK(helFutexUnlockPi(&futex));
+	}};
+
+	// Wait until the waiter has blocked in the kernel.
+	while(!(__atomic_load_n(&futex, __ATOMIC_RELAXED) & kHelFutexPiWaiters))
+		;
+	assert(!acquired.load());
+	HEL_CHECK(helFutexUnlockPi(&futex));
+
+	waiter.join();
+	assert(acquired.load());
+	assert(!futex);
+}))
+
+DEFINE_TEST(futexPiTimeout, ([] {
+	uint32_t tid;
+	HEL_CHECK(helGetFutexTid(&tid));
+	int futex = static_cast<int>(tid);
+
+	std::thread waiter{[&] {
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		assert(helFutexLockPi(&futex, now + 1'000'000) == kHelErrCancelled);
+	}};
+	waiter.join();
+
+	// The waiters flag is cleared once the last waiter gives up.
+	assert(static_cast<uint32_t>(futex) == tid);
+	int expected = static_cast<int>(tid);
+	assert(__atomic_compare_exchange_n(&futex, &expected, 0,
+			false, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}))
@@ -0,0 +1,44 @@
+#include <cassert>
+#include <cstdlib>
+
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include "testsuite.hpp"
+
+DEFINE_TEST(submitAsyncRingErrors, ([] {
+	constexpr unsigned int ringShift = 2;
+	auto ring = static_cast<HelSubmissionRing *>(calloc(1,
+			sizeof(HelSubmissionRing) + (sizeof(HelRingSubmission) << ringShift)));
+	assert(ring);
+
+	HelAction action{};
+	action.type = kHelActionDismiss;
+
+	// Start close to the wrap-around point to test index masking.
+	ring->head = 3;
+	ring->tail = 3;
+	for(uint32_t i = 0; i < 3; ++i) {
+		auto entry = &ring->entries[ring->tail & ((1 << ringShift) - 1)];
+		entry->handle = kHelNullHandle;
+		entry->actions = &action;
+		entry->count = (i == 1) ? 0 : 1;
+		entry->queue = kHelNullHandle;
+		entry->error = kHelErrNone;
+		ring->tail++;
+	}
+
+	size_t numSubmitted;
+	HEL_CHECK(helSubmitAsyncRing(ring, ringShift, &numSubmitted));
+	assert(numSubmitted == 3);
+	assert(ring->head == ring->tail);
+	assert(ring->entries[3].error == kHelErrNoDescriptor);
+	assert(ring->entries[0].error == kHelErrIllegalArgs);
+	assert(ring->entries[1].error == kHelErrNoDescriptor);
+
+	// The ring cannot contain more entries than its size.
+	ring->tail = ring->head + (1 << ringShift) + 1;
+	assert(helSubmitAsyncRing(ring, ringShift, &numSubmitted) == kHelErrIllegalArgs);
+
+	free(ring);
+}))
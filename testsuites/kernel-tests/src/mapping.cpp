@@ -49,3 +49,42 @@ DEFINE_TEST(unmapPartialPreserve, ([] {
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, p, 0x1000));
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, p + 0x2000, 0x1000));
 }))
+
+DEFINE_TEST(copyOnWriteZeroPages, ([] {
+	HelHandle handle;
+	HEL_CHECK(helCopyOnWrite(kHelZeroMemory, 0, 0x2000, &handle));
+	void *window;
+	HEL_CHECK(helMapMemory(handle, kHelNullHandle, nullptr, 0, 0x2000,
+			kHelMapProtRead | kHelMapProtWrite, &window));
+
+	// Reading untouched pages yields zeros; writing afterwards must not affect other pages.
+	auto p = reinterpret_cast<volatile std::byte *>(window);
+	assert(p[0] == static_cast<std::byte>(0));
+	assert(p[0x1000] == static_cast<std::byte>(0));
+	p[0] = static_cast<std::byte>(42);
+	assert(p[0] == static_cast<std::byte>(42));
+	assert(p[0x1000] == static_cast<std::byte>(0));
+
+	// Forks must see the data, but not the writes of the original memory object.
+	HelHandle forkedHandle;
+	HEL_CHECK(helForkMemory(handle, &forkedHandle));
+	void *forkedWindow;
+	HEL_CHECK(helMapMemory(forkedHandle, kHelNullHandle, nullptr, 0, 0x2000,
+			kHelMapProtRead | kHelMapProtWrite, &forkedWindow));
+
+	auto q = reinterpret_cast<volatile std::byte *>(forkedWindow);
+	p[0] = static_cast<std::byte>(21);
+	assert(q[0] == static_cast<std::byte>(42));
+	assert(q[0x1000] == static_cast<std::byte>(0));
+
+	// Dropping the fork allows the original memory object to absorb the CoW chain.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, forkedWindow, 0x2000));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, forkedHandle));
+	p[0x1000] = static_cast<std::byte>(1);
+	assert(p[0] == static_cast<std::byte>(21));
+	assert(p[0x1000] == static_cast<std::byte>(1));
+
+	// Clean up.
+	HEL_CHECK(helUnmapMemory(kHelNullHandle, window, 0x2000));
+	HEL_CHECK(helCloseDescriptor(kHelThisUniverse, handle));
+}))
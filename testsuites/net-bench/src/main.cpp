@@ -0,0 +1,498 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <bench-common.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// net-bench: measures TCP and UDP performance of the network stack, similar to
+// iperf / netperf. The client runs the tests against a server, which is either
+// started in the same process on the loopback interface, or runs on another host
+// (net-bench --server). Each test uses one connection per parallel stream.
+//
+// Tests:
+//   stream   bulk TCP transfer from the client to the server (throughput)
+//   tcp_rr   request/response over a single TCP connection (latency)
+//   udp_rr   request/response over UDP (latency)
+//   tcp_crr  a new TCP connection per request/response (connection rate)
+
+namespace {
+
+using bench::clock;
+using bench::LatencySamples;
+
+enum class Test {
+	stream,
+	tcpRr,
+	udpRr,
+	tcpCrr
+};
+
+struct TestInfo {
+	const char *name;
+	Test test;
+};
+
+constexpr TestInfo allTests[] = {
+	{"stream", Test::stream},
+	{"tcp_rr", Test::tcpRr},
+	{"udp_rr", Test::udpRr},
+	{"tcp_crr", Test::tcpCrr},
+};
+
+struct Options {
+	// Empty for the loopback mode.
+	std::string host;
+	uint16_t port = 5201;
+	// Size of each write for stream, size of requests and responses otherwise.
+	size_t size = 0;
+	size_t parallel = 1;
+	bool noDelay = false;
+	std::chrono::nanoseconds runtime = std::chrono::seconds{5};
+	std::vector<const TestInfo *> tests;
+};
+
+// Sent by the client at the start of each TCP connection.
+struct Hello {
+	// 's' for stream, 'r' for request/response.
+	uint8_t mode;
+	uint8_t reserved[3];
+	// Size of requests and responses (in network byte order).
+	uint32_t size;
+};
+
+static_assert(sizeof(Hello) == 8);
+
+[[noreturn]] void fail(const char *what) {
+	std::cerr << "net-bench: " << what << " failed: " << strerror(errno) << std::endl;
+	abort();
+}
+
+sockaddr_in makeAddress(const Options &options) {
+	sockaddr_in sa{};
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(options.port);
+	auto host = options.host.empty() ? "127.0.0.1" : options.host.c_str();
+	if(inet_pton(AF_INET, host, &sa.sin_addr) != 1) {
+		std::cerr << "net-bench: Invalid address " << host << std::endl;
+		exit(1);
+	}
+	return sa;
+}
+
+void readAll(int fd, void *buffer, size_t size) {
+	auto p = reinterpret_cast<char *>(buffer);
+	while(size) {
+		auto n = read(fd, p, size);
+		if(n < 0)
+			fail("read()");
+		if(!n) {
+			std::cerr << "net-bench: Unexpected end of stream" << std::endl;
+			abort();
+		}
+		p += n;
+		size -= n;
+	}
+}
+
+void writeAll(int fd, const void *buffer, size_t size) {
+	auto p = reinterpret_cast<const char *>(buffer);
+	while(size) {
+		auto n = write(fd, p, size);
+		if(n < 0)
+			fail("write()");
+		p += n;
+		size -= n;
+	}
+}
+
+// Returns false if the peer closed the connection.
+bool tryReadAll(int fd, void *buffer, size_t size) {
+	auto p = reinterpret_cast<char *>(buffer);
+	while(size) {
+		auto n = read(fd, p, size);
+		if(n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+void setNoDelay(int fd) {
+	int one = 1;
+	if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+		fail("setsockopt(TCP_NODELAY)");
+}
+
+// ----------------------------------------------------------------------------
+// Server.
+// ----------------------------------------------------------------------------
+
+void serveConnection(int fd) {
+	Hello hello;
+	if(!tryReadAll(fd, &hello, sizeof(hello))) {
+		close(fd);
+		return;
+	}
+
+	std::vector<char> buffer(std::max<size_t>(ntohl(hello.size), 64 * 1024));
+	if(hello.mode == 's') {
+		// Discard everything until the client closes the connection.
+		while(read(fd, buffer.data(), buffer.size()) > 0)
+			;
+	}else if(hello.mode == 'r') {
+		setNoDelay(fd);
+		size_t size = ntohl(hello.size);
+		while(tryReadAll(fd, buffer.data(), size))
+			writeAll(fd, buffer.data(), size);
+	}else{
+		std::cerr << "net-bench: Unknown mode " << int(hello.mode) << std::endl;
+	}
+	close(fd);
+}
+
+void runTcpServer(int listenFd) {
+	while(true) {
+		int fd = accept(listenFd, nullptr, nullptr);
+		if(fd < 0)
+			fail("accept()");
+		std::thread{serveConnection, fd}.detach();
+	}
+}
+
+void runUdpServer(int fd) {
+	std::vector<char> buffer(65536);
+	while(true) {
+		sockaddr_in sa;
+		socklen_t length = sizeof(sa);
+		auto n = recvfrom(fd, buffer.data(), buffer.size(), 0,
+				reinterpret_cast<sockaddr *>(&sa), &length);
+		if(n < 0)
+			fail("recvfrom()");
+		if(sendto(fd, buffer.data(), n, 0, reinterpret_cast<sockaddr *>(&sa), length) != n)
+			fail("sendto()");
+	}
+}
+
+// Binds the TCP and UDP sockets of the server and starts serving them on
+// background threads.
+void startServer(const Options &options) {
+	sockaddr_in sa{};
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(options.port);
+	sa.sin_addr.s_addr = options.host.empty() ? htonl(INADDR_LOOPBACK) : htonl(INADDR_ANY);
+
+	int tcpFd = socket(AF_INET, SOCK_STREAM, 0);
+	if(tcpFd < 0)
+		fail("socket(SOCK_STREAM)");
+	int one = 1;
+	setsockopt(tcpFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if(bind(tcpFd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)))
+		fail("bind(SOCK_STREAM)");
+	if(listen(tcpFd, 128))
+		fail("listen()");
+
+	int udpFd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(udpFd < 0)
+		fail("socket(SOCK_DGRAM)");
+	if(bind(udpFd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)))
+		fail("bind(SOCK_DGRAM)");
+
+	std::thread{runTcpServer, tcpFd}.detach();
+	std::thread{runUdpServer, udpFd}.detach();
+}
+
+// ----------------------------------------------------------------------------
+// Client.
+// ----------------------------------------------------------------------------
+
+int connectTcp(const Options &options, uint8_t mode) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd < 0)
+		fail("socket(SOCK_STREAM)");
+	if(mode == 'r' || options.noDelay)
+		setNoDelay(fd);
+
+	auto sa = makeAddress(options);
+	if(connect(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)))
+		fail("connect()");
+
+	Hello hello{};
+	hello.mode = mode;
+	hello.size = htonl(options.size);
+	writeAll(fd, &hello, sizeof(hello));
+	return fd;
+}
+
+void runStream(const Options &options, std::chrono::time_point<clock> deadline,
+		LatencySamples &samples) {
+	int fd = connectTcp(options, 's');
+	std::vector<char> buffer(options.size, 0x5A);
+
+	auto now = clock::now();
+	while(now < deadline) {
+		writeAll(fd, buffer.data(), buffer.size());
+		auto end = clock::now();
+		samples.record(now, end);
+		samples.numBytes += buffer.size();
+		now = end;
+	}
+	close(fd);
+}
+
+void runTcpRr(const Options &options, std::chrono::time_point<clock> deadline,
+		LatencySamples &samples) {
+	int fd = connectTcp(options, 'r');
+	std::vector<char> buffer(options.size, 0x5A);
+
+	auto now = clock::now();
+	while(now < deadline) {
+		writeAll(fd, buffer.data(), buffer.size());
+		readAll(fd, buffer.data(), buffer.size());
+		auto end = clock::now();
+		samples.record(now, end);
+		samples.numBytes += 2 * buffer.size();
+		now = end;
+	}
+	close(fd);
+}
+
+void runUdpRr(const Options &options, std::chrono::time_point<clock> deadline,
+		LatencySamples &samples) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if(fd < 0)
+		fail("socket(SOCK_DGRAM)");
+	auto sa = makeAddress(options);
+	if(connect(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)))
+		fail("connect()");
+
+	// Lost datagrams would stall the test forever.
+	timeval timeout{.tv_sec = 1, .tv_usec = 0};
+	if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)))
+		fail("setsockopt(SO_RCVTIMEO)");
+
+	std::vector<char> buffer(options.size, 0x5A);
+	uint64_t numLost = 0;
+	auto now = clock::now();
+	while(now < deadline) {
+		if(send(fd, buffer.data(), buffer.size(), 0) != static_cast<ssize_t>(buffer.size()))
+			fail("send()");
+		auto n = recv(fd, buffer.data(), buffer.size(), 0);
+		auto end = clock::now();
+		if(n < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				fail("recv()");
+			numLost++;
+		}else{
+			samples.record(now, end);
+			samples.numBytes += 2 * buffer.size();
+		}
+		now = end;
+	}
+	if(numLost)
+		std::cout << "net-bench: " << numLost << " UDP requests timed out" << std::endl;
+	close(fd);
+}
+
+void runTcpCrr(const Options &options, std::chrono::time_point<clock> deadline,
+		LatencySamples &samples) {
+	std::vector<char> buffer(options.size, 0x5A);
+
+	auto now = clock::now();
+	while(now < deadline) {
+		int fd = connectTcp(options, 'r');
+		writeAll(fd, buffer.data(), buffer.size());
+		readAll(fd, buffer.data(), buffer.size());
+		close(fd);
+
+		auto end = clock::now();
+		samples.record(now, end);
+		samples.numBytes += 2 * buffer.size();
+		now = end;
+	}
+}
+
+void reportResult(const TestInfo &info, const Options &options,
+		std::vector<LatencySamples> &streams, std::chrono::nanoseconds elapsed) {
+	bench::BenchmarkResult result;
+	result.name = std::string{info.name} + "-" + (options.host.empty() ? "loopback" : "remote")
+			+ "-size" + std::to_string(options.size) + "-p" + std::to_string(options.parallel);
+
+	result.haveRate = true;
+	uint64_t numBytes = 0;
+	for(auto &stream : streams) {
+		result.numOps += stream.numOps;
+		numBytes += stream.numBytes;
+	}
+	result.haveLatency = true;
+	result.latency = bench::computeLatencyStats(streams);
+
+	auto ns = std::max<int64_t>(elapsed.count(), 1);
+	result.opsPerSecond = result.numOps * 1'000'000'000 / ns;
+	result.bytesPerSecond = numBytes * 1'000'000'000 / ns;
+
+	std::cout << result.name << std::endl;
+	if(info.test == Test::stream) {
+		std::cout << "    " << (result.bytesPerSecond * 8 / 1'000'000) << " Mbit/s"
+				<< " (" << (numBytes >> 10) << " KiB)" << std::endl;
+	}else{
+		std::cout << "    " << result.opsPerSecond
+				<< (info.test == Test::tcpCrr ? " connections/s" : " transactions/s")
+				<< " (" << result.numOps << " ops)" << std::endl;
+	}
+	// For stream, this is the time that each write() blocks.
+	bench::printLatency(result.latency);
+
+	bench::allResults.push_back(std::move(result));
+}
+
+void runTest(const TestInfo &info, Options options) {
+	if(!options.size)
+		options.size = (info.test == Test::stream) ? 128 * 1024 : 1;
+	if(info.test == Test::udpRr && options.size > 65507) {
+		std::cerr << "net-bench: Skipping udp_rr, the size does not fit into a datagram" << std::endl;
+		return;
+	}
+
+	std::vector<LatencySamples> streams(options.parallel);
+	std::vector<std::thread> threads;
+
+	auto start = clock::now();
+	auto deadline = start + options.runtime;
+	for(size_t k = 0; k < options.parallel; ++k) {
+		threads.emplace_back([&, k] {
+			switch(info.test) {
+				case Test::stream: runStream(options, deadline, streams[k]); break;
+				case Test::tcpRr: runTcpRr(options, deadline, streams[k]); break;
+				case Test::udpRr: runUdpRr(options, deadline, streams[k]); break;
+				case Test::tcpCrr: runTcpCrr(options, deadline, streams[k]); break;
+			}
+		});
+	}
+	for(auto &thread : threads)
+		thread.join();
+
+	reportResult(info, options, streams, clock::now() - start);
+}
+
+// ----------------------------------------------------------------------------
+// Setup.
+// ----------------------------------------------------------------------------
+
+uint64_t parseSize(const char *str) {
+	char *end;
+	uint64_t value = strtoull(str, &end, 10);
+	if(*end == 'k' || *end == 'K') {
+		value <<= 10;
+		end++;
+	}else if(*end == 'm' || *end == 'M') {
+		value <<= 20;
+		end++;
+	}
+	if(end == str || *end) {
+		std::cerr << "net-bench: Invalid size " << str << std::endl;
+		exit(1);
+	}
+	return value;
+}
+
+void usage() {
+	std::cerr << "usage: net-bench [options]\n"
+			<< "  --server                run the server for remote clients\n"
+			<< "  --host=ADDR             run against the server at ADDR (default: loopback)\n"
+			<< "  --port=PORT             TCP and UDP port of the server (default: 5201)\n"
+			<< "  --test=TEST             stream, tcp_rr, udp_rr or tcp_crr (default: all)\n"
+			<< "  --size=SIZE             write size for stream (default: 128k),\n"
+			<< "                          request/response size otherwise (default: 1)\n"
+			<< "  --parallel=N            number of concurrent streams (default: 1)\n"
+			<< "  --nodelay               set TCP_NODELAY for stream\n"
+			<< "  --runtime=SECONDS       duration of each test (default: 5)\n"
+			<< "  --json                  print the results as JSON" << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	Options options;
+	bool server = false;
+	bool json = false;
+	for(int i = 1; i < argc; ++i) {
+		auto arg = argv[i];
+		auto value = strchr(arg, '=');
+		if(value)
+			value++;
+
+		if(!strcmp(arg, "--json")) {
+			json = true;
+		}else if(!strcmp(arg, "--server")) {
+			server = true;
+		}else if(!strcmp(arg, "--nodelay")) {
+			options.noDelay = true;
+		}else if(!strncmp(arg, "--host=", 7)) {
+			options.host = value;
+		}else if(!strncmp(arg, "--port=", 7)) {
+			options.port = parseSize(value);
+		}else if(!strncmp(arg, "--test=", 7)) {
+			auto it = std::find_if(std::begin(allTests), std::end(allTests),
+					[&] (const TestInfo &info) { return !strcmp(info.name, value); });
+			if(it == std::end(allTests)) {
+				std::cerr << "net-bench: Unknown test " << value << std::endl;
+				return 1;
+			}
+			options.tests.push_back(it);
+		}else if(!strncmp(arg, "--size=", 7)) {
+			options.size = parseSize(value);
+		}else if(!strncmp(arg, "--parallel=", 11)) {
+			options.parallel = parseSize(value);
+		}else if(!strncmp(arg, "--runtime=", 10)) {
+			options.runtime = std::chrono::seconds{parseSize(value)};
+		}else{
+			std::cerr << "net-bench: Unknown argument " << arg << std::endl;
+			usage();
+			return 1;
+		}
+	}
+
+	if(!options.parallel) {
+		std::cerr << "net-bench: Parallelism must be non-zero" << std::endl;
+		return 1;
+	}
+
+	if(server) {
+		// Accept connections from other hosts.
+		options.host = "0.0.0.0";
+		startServer(options);
+		std::cout << "net-bench: Listening on port " << options.port << std::endl;
+		while(true)
+			pause();
+	}
+
+	if(options.host.empty())
+		startServer(options);
+	if(options.tests.empty())
+		for(auto &info : allTests)
+			options.tests.push_back(&info);
+
+	std::cout << "net-bench: " << (options.host.empty() ? "loopback" : options.host)
+			<< ", port " << options.port << std::endl;
+
+	for(auto info : options.tests)
+		runTest(*info, options);
+
+	if(json)
+		bench::printJson();
+}
@@ -43,10 +43,59 @@ DEFINE_TEST(inotify_unlink_child, ([] {
 	assert(evtHeader.wd == wd);
 	assert(evtHeader.mask & IN_DELETE);
 
-	std::string evtName{buffer + sizeof(inotify_event), evtHeader.len};
+	// The name is null-terminated and padded with null bytes.
+	assert(evtHeader.len >= strlen("foobar") + 1);
+	std::string evtName{buffer + sizeof(inotify_event)};
 	assert(evtName == "foobar");
 
 	close(ifd);
 	//e = rmdir(dirPath);
 	//assert(!e);
 }))
+
+DEFINE_TEST(inotify_batched_read, ([] {
+	int e;
+
+	char dirPath[64];
+	strcpy(dirPath, "/tmp/posix-tests.XXXXXX");
+	if(!mkdtemp(dirPath))
+		assert(!"mkdtemp() failed");
+
+	int ifd = inotify_init1(IN_NONBLOCK);
+	assert(ifd > 0);
+	int wd = inotify_add_watch(ifd, dirPath, IN_CREATE);
+	assert(wd >= 0);
+
+	const char *names[] = {"foo", "bar", "baz"};
+	for(auto name : names) {
+		char filePath[64];
+		sprintf(filePath, "%s/%s", dirPath, name);
+		int ffd = creat(filePath, 0644);
+		assert(ffd > 0);
+		close(ffd);
+	}
+
+	// All events are returned by a single read.
+	alignas(inotify_event) char buffer[4096];
+	auto chunk = read(ifd, buffer, sizeof(buffer));
+	assert(chunk > 0);
+
+	size_t offset = 0;
+	for(auto name : names) {
+		assert(offset + sizeof(inotify_event) <= size_t(chunk));
+		inotify_event evtHeader;
+		memcpy(&evtHeader, buffer + offset, sizeof(inotify_event));
+		assert(evtHeader.wd == wd);
+		assert(evtHeader.mask & IN_CREATE);
+
+		std::string evtName{buffer + offset + sizeof(inotify_event)};
+		assert(evtName == name);
+		offset += sizeof(inotify_event) + evtHeader.len;
+	}
+	assert(offset == size_t(chunk));
+
+	e = read(ifd, buffer, sizeof(buffer));
+	assert(e == -1 && errno == EAGAIN);
+
+	close(ifd);
+}))
@@ -1,4 +1,10 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #include "testsuite.hpp"
@@ -8,11 +14,96 @@ std::vector<abstract_test_case *> &test_case_ptrs() {
 	return singleton;
 }
 
+std::vector<abstract_benchmark *> &benchmark_ptrs() {
+	static std::vector<abstract_benchmark *> singleton;
+	return singleton;
+}
+
 void abstract_test_case::register_case(abstract_test_case *tcp) {
 	test_case_ptrs().push_back(tcp);
 }
 
-int main() {
+void abstract_benchmark::register_benchmark(abstract_benchmark *bp) {
+	benchmark_ptrs().push_back(bp);
+}
+
+namespace {
+
+// Duration of each measurement.
+constexpr auto measureTime = std::chrono::seconds(1);
+
+// Returns the total number of operations per second.
+double measure(abstract_benchmark *bp, int n) {
+	std::atomic<int> ready{0};
+	std::atomic<bool> go{false};
+	std::atomic<bool> stop{false};
+	std::vector<uint64_t> counts(n);
+
+	bp->setup(n);
+
+	std::vector<std::thread> threads;
+	for(int i = 0; i < n; i++) {
+		threads.emplace_back([&, i] {
+			ready.fetch_add(1);
+			while(!go.load(std::memory_order_acquire))
+				;
+
+			uint64_t count = 0;
+			while(!stop.load(std::memory_order_relaxed)) {
+				bp->run(i);
+				count++;
+			}
+			counts[i] = count;
+		});
+	}
+
+	while(ready.load() != n)
+		;
+	auto start = std::chrono::steady_clock::now();
+	go.store(true, std::memory_order_release);
+	std::this_thread::sleep_for(measureTime);
+	stop.store(true, std::memory_order_relaxed);
+	for(auto &thread : threads)
+		thread.join();
+	auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+	bp->teardown();
+
+	uint64_t total = 0;
+	for(auto count : counts)
+		total += count;
+	return total / elapsed.count();
+}
+
+void run_benchmarks(int maxThreads) {
+	// Sweep over powers of two and maxThreads itself.
+	std::vector<int> threadCounts;
+	for(int n = 1; n < maxThreads; n *= 2)
+		threadCounts.push_back(n);
+	threadCounts.push_back(maxThreads);
+
+	for(abstract_benchmark *bp : benchmark_ptrs()) {
+		for(int n : threadCounts) {
+			auto rate = measure(bp, n);
+			std::cout << "posix-torture: " << bp->name() << " with " << n << " threads: "
+					<< static_cast<uint64_t>(rate) << " ops/s ("
+					<< static_cast<uint64_t>(rate / n) << " ops/s per thread)" << std::endl;
+		}
+	}
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	if(argc > 1 && !strcmp(argv[1], "--scaling")) {
+		int maxThreads = argc > 2 ? atoi(argv[2])
+				: static_cast<int>(std::thread::hardware_concurrency());
+		if(maxThreads < 1)
+			maxThreads = 1;
+		run_benchmarks(maxThreads);
+		return 0;
+	}
+
 	for(int s = 10; s < 24; s++) {
 		int n = 1 << s;
 		for(abstract_test_case *tcp : test_case_ptrs()) {
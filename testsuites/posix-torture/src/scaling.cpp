@@ -0,0 +1,206 @@
+#include <cassert>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "testsuite.hpp"
+
+namespace {
+
+const char *scalingDir = "/tmp/posix-torture-scaling";
+
+std::string sharedFile(int thread) {
+	return std::string{scalingDir} + "/shared/file-" + std::to_string(thread);
+}
+
+std::string privateDir(int thread) {
+	return std::string{scalingDir} + "/private-" + std::to_string(thread);
+}
+
+void createFile(const std::string &path) {
+	int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	assert(fd >= 0);
+	close(fd);
+}
+
+// All threads open files in the same directory.
+struct OpenCloseShared : abstract_benchmark {
+	using abstract_benchmark::abstract_benchmark;
+
+	void setup(int n) override {
+		mkdir(scalingDir, 0755);
+		mkdir((std::string{scalingDir} + "/shared").c_str(), 0755);
+		for(int i = 0; i < n; i++) {
+			paths_.push_back(sharedFile(i));
+			createFile(paths_.back());
+		}
+	}
+
+	void teardown() override {
+		for(auto &path : paths_)
+			unlink(path.c_str());
+		rmdir((std::string{scalingDir} + "/shared").c_str());
+		paths_.clear();
+	}
+
+	void run(int thread) override {
+		int fd = open(paths_[thread].c_str(), O_RDONLY);
+		assert(fd >= 0);
+		close(fd);
+	}
+
+private:
+	std::vector<std::string> paths_;
+};
+
+OpenCloseShared bench_open_close_shared_dir{"open_close_shared_dir"};
+
+// Each thread opens files in its own directory.
+struct OpenClosePrivate : abstract_benchmark {
+	using abstract_benchmark::abstract_benchmark;
+
+	void setup(int n) override {
+		mkdir(scalingDir, 0755);
+		for(int i = 0; i < n; i++) {
+			mkdir(privateDir(i).c_str(), 0755);
+			paths_.push_back(privateDir(i) + "/file");
+			createFile(paths_.back());
+		}
+	}
+
+	void teardown() override {
+		for(size_t i = 0; i < paths_.size(); i++) {
+			unlink(paths_[i].c_str());
+			rmdir(privateDir(i).c_str());
+		}
+		paths_.clear();
+	}
+
+	void run(int thread) override {
+		int fd = open(paths_[thread].c_str(), O_RDONLY);
+		assert(fd >= 0);
+		close(fd);
+	}
+
+private:
+	std::vector<std::string> paths_;
+};
+
+OpenClosePrivate bench_open_close_private_dir{"open_close_private_dir"};
+
+// Each thread sends one byte back and forth to its own echo thread.
+// Fds are created by the given function; fds[0] is used by the benchmark thread
+// and fds[1] by the echo thread. Both ends must be bidirectional.
+template<typename MakePair>
+struct PingPong : abstract_benchmark {
+	PingPong(const char *name, MakePair makePair)
+	: abstract_benchmark{name}, makePair_{std::move(makePair)} { }
+
+	void setup(int n) override {
+		for(int i = 0; i < n; i++) {
+			Pair pair;
+			makePair_(pair.local, pair.remote);
+			pairs_.push_back(pair);
+		}
+		for(auto &pair : pairs_) {
+			int in = pair.remote[0];
+			int out = pair.remote[1];
+			echoThreads_.emplace_back([in, out] {
+				char c;
+				while(read(in, &c, 1) == 1) {
+					auto written = write(out, &c, 1);
+					assert(written == 1);
+				}
+			});
+		}
+	}
+
+	void teardown() override {
+		// Closing our ends makes the echo threads see EOF.
+		for(auto &pair : pairs_) {
+			close(pair.local[1]);
+			if(pair.local[0] != pair.local[1])
+				close(pair.local[0]);
+		}
+		for(auto &thread : echoThreads_)
+			thread.join();
+		for(auto &pair : pairs_) {
+			close(pair.remote[0]);
+			if(pair.remote[0] != pair.remote[1])
+				close(pair.remote[1]);
+		}
+		echoThreads_.clear();
+		pairs_.clear();
+	}
+
+	void run(int thread) override {
+		auto &pair = pairs_[thread];
+		char c = 42;
+		auto written = write(pair.local[1], &c, 1);
+		assert(written == 1);
+		auto count = read(pair.local[0], &c, 1);
+		assert(count == 1);
+	}
+
+private:
+	struct Pair {
+		// {read end, write end} of each side.
+		int local[2];
+		int remote[2];
+	};
+
+	MakePair makePair_;
+	std::vector<Pair> pairs_;
+	std::vector<std::thread> echoThreads_;
+};
+
+PingPong bench_pipe_ping_pong{"pipe_ping_pong", [] (int *local, int *remote) {
+	int forward[2];
+	int backward[2];
+	if(pipe(forward) || pipe(backward))
+		abort();
+	local[0] = backward[0];
+	local[1] = forward[1];
+	remote[0] = forward[0];
+	remote[1] = backward[1];
+}};
+
+PingPong bench_unix_ping_pong{"unix_ping_pong", [] (int *local, int *remote) {
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+		abort();
+	local[0] = local[1] = fds[0];
+	remote[0] = remote[1] = fds[1];
+}};
+
+} // anonymous namespace
+
+// All threads map and unmap in the same address space.
+DEFINE_BENCHMARK(map_unmap_parallel, ([] (int) {
+	void *window = mmap(nullptr, 0x1000, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(window != MAP_FAILED);
+	// Touch the page such that it is actually allocated.
+	*static_cast<volatile char *>(window) = 1;
+	munmap(window, 0x1000);
+}))
+
+DEFINE_BENCHMARK(fork_exec, ([] (int) {
+	int pid = fork();
+	assert(pid >= 0);
+	if(!pid) {
+		execl("/usr/bin/true", "true", nullptr);
+		_exit(127);
+	}else{
+		int status;
+		auto res = waitpid(pid, &status, 0);
+		assert(res > 0);
+	}
+}))
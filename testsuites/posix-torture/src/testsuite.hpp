@@ -5,6 +5,9 @@
 #define DEFINE_TEST(s, f) \
 	static test_case test_ ## s{#s, f};
 
+#define DEFINE_BENCHMARK(s, f) \
+	static benchmark bench_ ## s{#s, f};
+
 struct abstract_test_case {
 private:
 	static void register_case(abstract_test_case *tcp);
@@ -43,3 +46,49 @@ struct test_case : abstract_test_case {
 private:
 	F functor_;
 };
+
+// Scalability benchmarks are run with increasing numbers of threads
+// (see `posix-torture --scaling`).
+struct abstract_benchmark {
+private:
+	static void register_benchmark(abstract_benchmark *bp);
+
+public:
+	abstract_benchmark(const char *name)
+	: name_{name} {
+		register_benchmark(this);
+	}
+
+	abstract_benchmark(const abstract_benchmark &) = delete;
+
+	virtual ~abstract_benchmark() = default;
+
+	abstract_benchmark &operator= (const abstract_benchmark &) = delete;
+
+	const char *name() {
+		return name_;
+	}
+
+	// Called before and after measuring with the given number of threads.
+	virtual void setup(int) { }
+	virtual void teardown() { }
+
+	// Runs a single operation on the given thread (0 <= thread < number of threads).
+	virtual void run(int thread) = 0;
+
+private:
+	const char *name_;
+};
+
+template<typename F>
+struct benchmark : abstract_benchmark {
+	benchmark(const char *name, F functor)
+	: abstract_benchmark{name}, functor_{std::move(functor)} { }
+
+	void run(int thread) override {
+		functor_(thread);
+	}
+
+private:
+	F functor_;
+};
@@ -0,0 +1,399 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <async/oneshot-event.hpp>
+#include <async/result.hpp>
+#include <bench-common.hpp>
+#include <blockfs.hpp>
+#include <helix/ipc.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// storage-bench: measures throughput and latency of sequential and random reads and
+// writes on a file or block device. Requests are either issued through the POSIX
+// file API (from one thread per queue slot) or through a blockfs::BlockDevice
+// (with one coroutine per queue slot).
+
+namespace {
+
+using bench::clock;
+using bench::LatencySamples;
+
+enum class Engine {
+	posix,
+	blockfs
+};
+
+struct Workload {
+	const char *name;
+	bool write;
+	bool random;
+};
+
+constexpr Workload allWorkloads[] = {
+	{"read", false, false},
+	{"write", true, false},
+	{"randread", false, true},
+	{"randwrite", true, true},
+};
+
+struct Options {
+	std::string path;
+	Engine engine = Engine::posix;
+	size_t blockSize = 4096;
+	size_t queueDepth = 1;
+	// Size of the region of the file that is accessed. Zero means the size of the file.
+	uint64_t size = 0;
+	std::chrono::nanoseconds runtime = std::chrono::seconds{5};
+	std::vector<const Workload *> workloads;
+};
+
+// Generates the offsets that a single queue slot accesses.
+// Sequential slots interleave such that the device sees a single sequential stream.
+struct OffsetGenerator {
+	OffsetGenerator(const Workload &workload, const Options &options, size_t slot)
+	: random_{workload.random}, numBlocks_{options.size / options.blockSize},
+			blockSize_{options.blockSize}, stride_{options.queueDepth},
+			next_{slot}, engine_{slot + 1} { }
+
+	uint64_t next() {
+		if(random_) {
+			std::uniform_int_distribution<uint64_t> dist{0, numBlocks_ - 1};
+			return dist(engine_) * blockSize_;
+		}
+		auto block = next_ % numBlocks_;
+		next_ += stride_;
+		return block * blockSize_;
+	}
+
+private:
+	bool random_;
+	uint64_t numBlocks_;
+	size_t blockSize_;
+	size_t stride_;
+	uint64_t next_;
+	std::mt19937_64 engine_;
+};
+
+void reportResult(const Workload &workload, const Options &options,
+		std::vector<LatencySamples> &slots, std::chrono::nanoseconds elapsed) {
+	bench::BenchmarkResult result;
+	result.name = std::string{workload.name} + "-bs" + std::to_string(options.blockSize)
+			+ "-qd" + std::to_string(options.queueDepth);
+
+	result.haveRate = true;
+	for(auto &slot : slots)
+		result.numOps += slot.numOps;
+	result.opsPerSecond = result.numOps * 1'000'000'000 / std::max<int64_t>(elapsed.count(), 1);
+	result.bytesPerSecond = result.opsPerSecond * options.blockSize;
+	result.haveLatency = true;
+	result.latency = bench::computeLatencyStats(slots);
+
+	std::cout << result.name << std::endl;
+	std::cout << "    " << (result.bytesPerSecond / 1024) << " KiB/s"
+			<< ", " << result.opsPerSecond << " IOPS"
+			<< " (" << result.numOps << " ops)" << std::endl;
+	bench::printLatency(result.latency);
+
+	bench::allResults.push_back(std::move(result));
+}
+
+// ----------------------------------------------------------------------------
+// POSIX engine.
+// ----------------------------------------------------------------------------
+
+void runPosixWorkload(int fd, const Workload &workload, const Options &options) {
+	std::vector<LatencySamples> slots(options.queueDepth);
+	std::vector<std::thread> threads;
+
+	auto start = clock::now();
+	auto deadline = start + options.runtime;
+	for(size_t k = 0; k < options.queueDepth; ++k) {
+		threads.emplace_back([&, k] {
+			OffsetGenerator offsets{workload, options, k};
+			std::vector<std::byte> buffer(options.blockSize, std::byte{0x5A});
+
+			auto now = clock::now();
+			while(now < deadline) {
+				auto offset = offsets.next();
+				ssize_t n;
+				if(workload.write) {
+					n = pwrite(fd, buffer.data(), options.blockSize, offset);
+				}else{
+					n = pread(fd, buffer.data(), options.blockSize, offset);
+				}
+				if(n != static_cast<ssize_t>(options.blockSize)) {
+					std::cerr << "storage-bench: I/O at offset " << offset
+							<< " failed: " << strerror(errno) << std::endl;
+					abort();
+				}
+
+				auto end = clock::now();
+				slots[k].record(now, end);
+				now = end;
+			}
+		});
+	}
+	for(auto &thread : threads)
+		thread.join();
+
+	// Include the time that it takes to flush the written data.
+	if(workload.write)
+		fsync(fd);
+	reportResult(workload, options, slots, clock::now() - start);
+}
+
+// ----------------------------------------------------------------------------
+// blockfs engine.
+// ----------------------------------------------------------------------------
+
+// Exposes a file descriptor as a blockfs::BlockDevice.
+// Requests are performed synchronously, such that the measurements do not include
+// any IPC; they show the overhead of the BlockDevice request path on top of the file.
+struct FileDevice final : blockfs::BlockDevice {
+	FileDevice(int fd, uint64_t size)
+	: BlockDevice{512, -1}, fd_{fd} {
+		this->size = size;
+	}
+
+	async::result<void> readSectors(uint64_t sector, void *buffer,
+			size_t num_sectors) override {
+		auto n = pread(fd_, buffer, num_sectors * sectorSize, sector * sectorSize);
+		if(n != static_cast<ssize_t>(num_sectors * sectorSize))
+			throw std::runtime_error("storage-bench: pread() failed");
+		co_return;
+	}
+
+	async::result<void> writeSectors(uint64_t sector, const void *buffer,
+			size_t num_sectors) override {
+		auto n = pwrite(fd_, buffer, num_sectors * sectorSize, sector * sectorSize);
+		if(n != static_cast<ssize_t>(num_sectors * sectorSize))
+			throw std::runtime_error("storage-bench: pwrite() failed");
+		co_return;
+	}
+
+	async::result<size_t> getSize() override {
+		co_return size;
+	}
+
+private:
+	int fd_;
+};
+
+async::result<void> runDeviceSlot(blockfs::BlockDevice *device, const Workload &workload,
+		const Options &options, size_t slot, std::chrono::time_point<clock> deadline,
+		LatencySamples &samples) {
+	OffsetGenerator offsets{workload, options, slot};
+	std::vector<std::byte> buffer(options.blockSize, std::byte{0x5A});
+
+	auto now = clock::now();
+	while(now < deadline) {
+		blockfs::BlockRequest request;
+		request.op = workload.write ? blockfs::BlockOp::write : blockfs::BlockOp::read;
+		request.sector = offsets.next() / device->sectorSize;
+		request.segments.push_back({buffer.data(), options.blockSize / device->sectorSize});
+		co_await device->submit(request);
+
+		auto end = clock::now();
+		samples.record(now, end);
+		now = end;
+	}
+}
+
+async::result<void> runDeviceWorkload(blockfs::BlockDevice *device,
+		const Workload &workload, const Options &options) {
+	std::vector<LatencySamples> slots(options.queueDepth);
+
+	auto start = clock::now();
+	auto deadline = start + options.runtime;
+
+	size_t pending = options.queueDepth;
+	async::oneshot_event doneEvent;
+	for(size_t k = 0; k < options.queueDepth; ++k) {
+		async::detach([] (blockfs::BlockDevice *device, const Workload &workload,
+				const Options &options, size_t k, std::chrono::time_point<clock> deadline,
+				LatencySamples &samples, size_t &pending,
+				async::oneshot_event &doneEvent) -> async::result<void> {
+			co_await runDeviceSlot(device, workload, options, k, deadline, samples);
+			if(!--pending)
+				doneEvent.raise();
+		}(device, workload, options, k, deadline, slots[k], pending, doneEvent));
+	}
+	co_await doneEvent.wait();
+
+	if(workload.write) {
+		blockfs::BlockRequest flush;
+		flush.op = blockfs::BlockOp::flush;
+		co_await device->submit(flush);
+	}
+	reportResult(workload, options, slots, clock::now() - start);
+}
+
+async::result<void> runDeviceBenchmarks(int fd, const Options &options) {
+	FileDevice device{fd, options.size};
+	for(auto workload : options.workloads)
+		co_await runDeviceWorkload(&device, *workload, options);
+}
+
+// ----------------------------------------------------------------------------
+// Setup.
+// ----------------------------------------------------------------------------
+
+uint64_t parseSize(const char *str) {
+	char *end;
+	uint64_t value = strtoull(str, &end, 10);
+	if(*end == 'k' || *end == 'K') {
+		value <<= 10;
+		end++;
+	}else if(*end == 'm' || *end == 'M') {
+		value <<= 20;
+		end++;
+	}else if(*end == 'g' || *end == 'G') {
+		value <<= 30;
+		end++;
+	}
+	if(end == str || *end) {
+		std::cerr << "storage-bench: Invalid size " << str << std::endl;
+		exit(1);
+	}
+	return value;
+}
+
+// Extends the file such that reads do not hit holes or the end of the file.
+void prepareFile(int fd, uint64_t size) {
+	struct stat st;
+	if(fstat(fd, &st)) {
+		std::cerr << "storage-bench: fstat() failed: " << strerror(errno) << std::endl;
+		exit(1);
+	}
+	if(!S_ISREG(st.st_mode) || static_cast<uint64_t>(st.st_size) >= size)
+		return;
+
+	std::cout << "storage-bench: Filling " << (size >> 10) << " KiB" << std::endl;
+	std::vector<std::byte> buffer(1 << 20, std::byte{0xA5});
+	for(uint64_t offset = st.st_size; offset < size; offset += buffer.size()) {
+		auto chunk = std::min<uint64_t>(buffer.size(), size - offset);
+		if(pwrite(fd, buffer.data(), chunk, offset) != static_cast<ssize_t>(chunk)) {
+			std::cerr << "storage-bench: Could not fill file: " << strerror(errno) << std::endl;
+			exit(1);
+		}
+	}
+	fsync(fd);
+}
+
+void usage() {
+	std::cerr << "usage: storage-bench [options] PATH\n"
+			<< "  --engine=posix|blockfs  issue requests via pread()/pwrite() or a BlockDevice\n"
+			<< "  --rw=WORKLOAD           read, write, randread or randwrite (default: all)\n"
+			<< "  --bs=SIZE               request size (default: 4k)\n"
+			<< "  --qd=N                  number of requests in flight (default: 1)\n"
+			<< "  --size=SIZE             size of the accessed region (default: file size)\n"
+			<< "  --runtime=SECONDS       duration of each workload (default: 5)\n"
+			<< "  --json                  print the results as JSON" << std::endl;
+}
+
+} // anonymous namespace
+
+int main(int argc, char **argv) {
+	Options options;
+	bool json = false;
+	for(int i = 1; i < argc; ++i) {
+		auto arg = argv[i];
+		auto value = strchr(arg, '=');
+		if(value)
+			value++;
+
+		if(!strcmp(arg, "--json")) {
+			json = true;
+		}else if(!strcmp(arg, "--engine=posix")) {
+			options.engine = Engine::posix;
+		}else if(!strcmp(arg, "--engine=blockfs")) {
+			options.engine = Engine::blockfs;
+		}else if(!strncmp(arg, "--rw=", 5)) {
+			auto it = std::find_if(std::begin(allWorkloads), std::end(allWorkloads),
+					[&] (const Workload &workload) { return !strcmp(workload.name, value); });
+			if(it == std::end(allWorkloads)) {
+				std::cerr << "storage-bench: Unknown workload " << value << std::endl;
+				return 1;
+			}
+			options.workloads.push_back(it);
+		}else if(!strncmp(arg, "--bs=", 5)) {
+			options.blockSize = parseSize(value);
+		}else if(!strncmp(arg, "--qd=", 5)) {
+			options.queueDepth = parseSize(value);
+		}else if(!strncmp(arg, "--size=", 7)) {
+			options.size = parseSize(value);
+		}else if(!strncmp(arg, "--runtime=", 10)) {
+			options.runtime = std::chrono::seconds{parseSize(value)};
+		}else if(arg[0] != '-' && options.path.empty()) {
+			options.path = arg;
+		}else{
+			std::cerr << "storage-bench: Unknown argument " << arg << std::endl;
+			usage();
+			return 1;
+		}
+	}
+
+	if(options.path.empty()) {
+		usage();
+		return 1;
+	}
+	if(!options.blockSize || options.blockSize % 512 || !options.queueDepth) {
+		std::cerr << "storage-bench: Block size must be a multiple of 512"
+				" and queue depth must be non-zero" << std::endl;
+		return 1;
+	}
+	if(options.workloads.empty())
+		for(auto &workload : allWorkloads)
+			options.workloads.push_back(&workload);
+
+	int fd = open(options.path.c_str(), O_RDWR | O_CREAT, 0644);
+	if(fd < 0) {
+		std::cerr << "storage-bench: Could not open " << options.path
+				<< ": " << strerror(errno) << std::endl;
+		return 1;
+	}
+
+	if(!options.size) {
+		auto end = lseek(fd, 0, SEEK_END);
+		if(end <= 0) {
+			std::cerr << "storage-bench: " << options.path
+					<< " is empty; pass --size" << std::endl;
+			return 1;
+		}
+		options.size = end;
+	}
+	options.size -= options.size % options.blockSize;
+	if(!options.size) {
+		std::cerr << "storage-bench: Region is smaller than the block size" << std::endl;
+		return 1;
+	}
+	prepareFile(fd, options.size);
+
+	std::cout << "storage-bench: " << options.path << ", "
+			<< (options.size >> 10) << " KiB, engine: "
+			<< (options.engine == Engine::posix ? "posix" : "blockfs") << std::endl;
+
+	if(options.engine == Engine::posix) {
+		for(auto workload : options.workloads)
+			runPosixWorkload(fd, *workload, options);
+	}else{
+		async::run(runDeviceBenchmarks(fd, options), helix::currentDispatcher);
+	}
+
+	close(fd);
+	if(json)
+		bench::printJson();
+}
@@ -12,6 +12,8 @@ parser.add_argument('--aggregate-by',
 	help="aggregate samples by source line of code or by symbol inside the binary")
 parser.add_argument('--line', action='store_true')
 parser.add_argument('--isn', action='store_true')
+parser.add_argument('--folded', action='store_true',
+	help="emit folded call stacks (e.g., for flamegraph.pl) instead of a flat profile")
 
 args = parser.parse_args()
 
@@ -43,37 +45,60 @@ n_user = 0
 n_kernel = 0
 n_resolved = 0
 
+def resolve(ip):
+	if args.aggregate_by == 'symbol':
+		idx = bisect.bisect_left(sym_index, ip)
+		if idx == 0:
+			return None
+		start, symbol = sym_table[idx - 1];
+		assert ip >= start
+
+		return symbol, 0
+	else:
+		addr2line.stdin.write(hex(ip) + '\n')
+		addr2line.stdin.flush()
+		func = addr2line.stdout.readline().rstrip()
+		line = addr2line.stdout.readline().rstrip()
+		if args.line:
+			return (func, line)
+		elif args.isn:
+			return (func, line.split(':')[0] + ':' + hex(ip))
+		else:
+			return (func, line.split(':')[0])
+
+folded = dict()
+
+# Each record is a word that counts the IPs, followed by the IPs (innermost first).
 with open(args.profile_path, 'rb') as f:
 	while True:
 		rec = f.read(8)
 		if not rec:
 			break
-		ip = struct.unpack('Q', rec)[0]
+		n = struct.unpack('Q', rec)[0]
+		ips = struct.unpack('{}Q'.format(n), f.read(8 * n))
+		ip = ips[0]
 		if ip < (1 << 63):
 			n_user += 1
+			if args.folded:
+				folded['[user]'] = folded.get('[user]', 0) + 1
 			continue
 		else:
 			n_kernel += 1
 
-		if args.aggregate_by == 'symbol':
-			idx = bisect.bisect_left(sym_index, ip)
-			if idx == 0:
-				continue
-			start, symbol = sym_table[idx - 1];
-			assert ip >= start
+		loc = resolve(ip)
+		if loc is None:
+			continue
 
-			loc = symbol, 0
-		else:
-			addr2line.stdin.write(hex(ip) + '\n')
-			addr2line.stdin.flush()
-			func = addr2line.stdout.readline().rstrip()
-			line = addr2line.stdout.readline().rstrip()
-			if args.line:
-				loc = (func, line)
-			elif args.isn:
-				loc = (func, line.split(':')[0] + ':' + hex(ip))
-			else:
-				loc = (func, line.split(':')[0])
+		if args.folded:
+			frames = [loc[0]]
+			for ret in ips[1:]:
+				# Return addresses point after the call; resolve the call itself.
+				caller = resolve(ret - 1)
+				if caller is None:
+					break
+				frames.append(caller[0])
+			stack = ';'.join(reversed([frame.replace(';', ':') for frame in frames]))
+			folded[stack] = folded.get(stack, 0) + 1
 
 		if loc in profile:
 			profile[loc] += 1
@@ -81,6 +106,11 @@ with open(args.profile_path, 'rb') as f:
 			profile[loc] = 1
 		n_resolved += 1
 
+if args.folded:
+	for stack, count in folded.items():
+		print("{} {}".format(stack, count))
+	exit(0)
+
 n_all = n_user + n_kernel
 
 out = sorted(profile.keys(), key=lambda loc: profile[loc])
@@ -11,6 +11,9 @@ parser = argparse.ArgumentParser(description = 'Generate a managarm initrd')
 parser.add_argument('-t', '--triple', dest = 'arch',
 		choices = ['x86_64-managarm', 'aarch64-managarm'], default = 'x86_64-managarm',
 		help = 'Target system triple (default: x86_64-managarm)')
+parser.add_argument('--compress', dest = 'compress',
+		choices = ['none', 'lz4'], default = 'none',
+		help = 'Compress the initrd; eir decompresses it at boot (default: none)')
 
 args = parser.parse_args()
 
@@ -111,9 +114,11 @@ for rel_path in file_list:
 	else:
 		os.link(entry.source, dest_path)
 
+cpio_path = 'initrd.cpio' if args.compress == 'none' else 'initrd.cpio.uncompressed'
+
 proc = subprocess.Popen(['cpio', '--create', '--format=newc',
 			'-D', tree_path,
-			'--file', 'initrd.cpio',
+			'--file', cpio_path,
 			'--quiet'],
 		stdin=subprocess.PIPE,
 		encoding='ascii')
@@ -122,3 +127,9 @@ if proc.returncode != 0:
 	sys.exit(1)
 
 shutil.rmtree(tree_path)
+
+# Eir needs to know the uncompressed size in advance, hence we include it in the frame.
+# The file name stays the same since eir detects the compression by its magic.
+if args.compress == 'lz4':
+	subprocess.check_call(['lz4', '-9', '--content-size', '-f', '-q', cpio_path, 'initrd.cpio'])
+	os.unlink(cpio_path)
@@ -3,7 +3,13 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <optional>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
 
 #include <bragi/helpers-std.hpp>
 #include <CLI/App.hpp>
@@ -15,15 +21,63 @@
 enum class ExtractMode {
 	none,
 	eventOnly,
-	specificItem
+	specificItem,
+	chromeTrace,
+	bootChart
 };
 
 
 std::unordered_map<std::string, ExtractMode> stringToExtractMode{
 	{"event-only", ExtractMode::eventOnly},
 	{"specific-item", ExtractMode::specificItem},
+	{"chrome-trace", ExtractMode::chromeTrace},
+	{"boot-chart", ExtractMode::bootChart},
 };
 
+// Name of the item that carries the duration (in nanoseconds) of an event.
+// Events with such an item are exported as complete events that end at the record's timestamp.
+constexpr const char *durationItemName = "time";
+
+// Boot phases are named "boot.<component>: <phase>" (e.g., "boot.eir: load-kernel").
+// ExtractMode::bootChart exports only these events, grouped into one process per component.
+constexpr std::string_view bootPhasePrefix = "boot.";
+
+// Returns the component and the phase of a boot phase event (or nothing for other events).
+std::optional<std::pair<std::string, std::string>> parseBootPhase(const std::string &name) {
+	if(!name.starts_with(bootPhasePrefix))
+		return std::nullopt;
+	auto colon = name.find(": ", bootPhasePrefix.size());
+	if(colon == std::string::npos)
+		return std::nullopt;
+	return std::pair{name.substr(bootPhasePrefix.size(), colon - bootPhasePrefix.size()),
+			name.substr(colon + 2)};
+}
+
+std::string escapeJson(const std::string &in) {
+	std::string out;
+	for(char c : in) {
+		if(c == '"' || c == '\\') {
+			out += '\\';
+			out += c;
+		}else if(static_cast<unsigned char>(c) < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		}else{
+			out += c;
+		}
+	}
+	return out;
+}
+
+// Chrome's trace format expects timestamps in microseconds.
+std::string formatMicros(int64_t nanos) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%s%ld.%03ld", nanos < 0 ? "-" : "",
+			static_cast<long>(std::abs(nanos) / 1000), static_cast<long>(std::abs(nanos) % 1000));
+	return buf;
+}
+
 int main(int argc, char **argv) {
 	ExtractMode mode{};
 	std::string path{"virtio-trace.bin"};
@@ -67,6 +121,113 @@ int main(int argc, char **argv) {
 	std::vector<uint64_t> ts;
 	std::vector<uint64_t> value;
 
+	// State for ExtractMode::chromeTrace and ExtractMode::bootChart.
+	bool chromeTraceFormat = mode == ExtractMode::chromeTrace || mode == ExtractMode::bootChart;
+	std::unordered_map<uint64_t, std::string> eventNames;
+	std::unordered_map<uint64_t, std::string> itemNames;
+	std::vector<std::string> traceEvents;
+	// Maps components to pids (for ExtractMode::bootChart).
+	std::unordered_map<std::string, int> componentPids;
+	// Maps event IDs to pids.
+	std::unordered_map<uint64_t, int> eventPids;
+
+	// Returns false if the event is not exported.
+	auto announceChromeTraceEvent = [&] (managarm::ostrace::AnnounceEventRecord &record) -> bool {
+		if(mode == ExtractMode::chromeTrace) {
+			if(!eventName.empty() && record.name() != eventName)
+				return false;
+			eventPids[record.id()] = 0;
+			traceEvents.push_back("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0"
+					", \"tid\": " + std::to_string(record.id())
+					+ ", \"args\": {\"name\": \"" + escapeJson(record.name()) + "\"}}");
+			return true;
+		}
+
+		auto phase = parseBootPhase(record.name());
+		if(!phase)
+			return false;
+		auto &[component, phaseName] = *phase;
+
+		auto [pidIt, inserted] = componentPids.insert({component,
+				static_cast<int>(componentPids.size())});
+		auto pid = std::to_string(pidIt->second);
+		if(inserted) {
+			// Order the components by their first phase.
+			traceEvents.push_back("{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " + pid
+					+ ", \"args\": {\"name\": \"" + escapeJson(component) + "\"}}");
+			traceEvents.push_back("{\"name\": \"process_sort_index\", \"ph\": \"M\", \"pid\": "
+					+ pid + ", \"args\": {\"sort_index\": " + pid + "}}");
+		}
+		eventPids[record.id()] = pidIt->second;
+
+		// Each phase gets its own row, ordered by announcement.
+		traceEvents.push_back("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " + pid
+				+ ", \"tid\": " + std::to_string(record.id())
+				+ ", \"args\": {\"name\": \"" + escapeJson(phaseName) + "\"}}");
+		traceEvents.push_back("{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": " + pid
+				+ ", \"tid\": " + std::to_string(record.id())
+				+ ", \"args\": {\"sort_index\": " + std::to_string(record.id()) + "}}");
+		return true;
+	};
+
+	// Each event gets its own track. ostrace records do not identify threads.
+	auto emitChromeTraceEvent = [&] (managarm::ostrace::EventRecord &record) {
+		auto nameIt = eventNames.find(record.id());
+		if(nameIt == eventNames.end()) {
+			warnx("ignoring event with unknown ID %lu", static_cast<unsigned long>(record.id()));
+			return;
+		}
+		auto pidIt = eventPids.find(record.id());
+		if(pidIt == eventPids.end())
+			return;
+		auto name = escapeJson(nameIt->second);
+		auto pid = std::to_string(pidIt->second);
+
+		bool haveDuration = false;
+		int64_t duration = 0;
+		std::stringstream args;
+		std::stringstream counters;
+		bool haveCounters = false;
+		for(size_t i = 0; i < record.ctrs_size(); ++i) {
+			auto ctr = record.ctrs(i);
+			auto itemIt = itemNames.find(ctr.id());
+			std::string itemName = itemIt != itemNames.end() ? itemIt->second
+					: "item-" + std::to_string(ctr.id());
+			if(itemName == durationItemName) {
+				haveDuration = true;
+				duration = ctr.value();
+			}
+			args << (i ? ", " : "") << "\"" << escapeJson(itemName) << "\": " << ctr.value();
+			if(itemName != durationItemName) {
+				counters << (haveCounters ? ", " : "")
+						<< "\"" << escapeJson(itemName) << "\": " << ctr.value();
+				haveCounters = true;
+			}
+		}
+
+		std::stringstream ev;
+		ev << "{\"name\": \"" << name << "\", \"cat\": \"ostrace\", \"pid\": " << pid
+				<< ", \"tid\": " << record.id();
+		if(haveDuration) {
+			ev << ", \"ph\": \"X\", \"ts\": "
+					<< formatMicros(static_cast<int64_t>(record.ts()) - duration)
+					<< ", \"dur\": " << formatMicros(duration);
+		}else{
+			ev << ", \"ph\": \"i\", \"s\": \"t\", \"ts\": "
+					<< formatMicros(record.ts());
+		}
+		ev << ", \"args\": {" << args.str() << "}}";
+		traceEvents.push_back(ev.str());
+
+		if(haveCounters) {
+			std::stringstream cv;
+			cv << "{\"name\": \"" << name << "\", \"cat\": \"ostrace\", \"pid\": " << pid
+					<< ", \"ph\": \"C\", \"ts\": " << formatMicros(record.ts())
+					<< ", \"args\": {" << counters.str() << "}}";
+			traceEvents.push_back(cv.str());
+		}
+	};
+
 	auto extractRecord = [&] () -> bool {
 		auto preamble = bragi::read_preamble(buffer);
 		if(preamble.error()) {
@@ -88,7 +249,9 @@ int main(int argc, char **argv) {
 			}
 			auto &record = maybeRecord.value();
 
-			if(record.id() == filteredEventId) {
+			if(chromeTraceFormat) {
+				emitChromeTraceEvent(record);
+			}else if(record.id() == filteredEventId) {
 				if(mode == ExtractMode::eventOnly) {
 					ts.push_back(record.ts());
 				}else if(mode == ExtractMode::specificItem) {
@@ -109,6 +272,11 @@ int main(int argc, char **argv) {
 
 			if(record.name() == eventName)
 				filteredEventId = record.id();
+
+			if(chromeTraceFormat) {
+				eventNames[record.id()] = record.name();
+				announceChromeTraceEvent(record);
+			}
 		} break;
 		case bragi::message_id<managarm::ostrace::AnnounceItemRecord>: {
 			auto maybeRecord = bragi::parse_head_tail<managarm::ostrace::AnnounceItemRecord>(
@@ -118,6 +286,7 @@ int main(int argc, char **argv) {
 
 			if(record.name() == itemName)
 				desiredItemId = record.id();
+			itemNames[record.id()] = record.name();
 		} break;
 		default:
 			warnx("halting due to unexpected message ID %u", preamble.id());
@@ -135,6 +304,18 @@ int main(int argc, char **argv) {
 		++nRecords;
 	}
 
+	if(chromeTraceFormat) {
+		std::cout << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+		for(size_t i = 0; i < traceEvents.size(); ++i)
+			std::cout << (i ? ",\n" : "") << traceEvents[i];
+		std::cout << "\n]}" << std::endl;
+
+		std::cerr << "extracted " << nRecords << " records"
+				<< " (" << buffer.size() << " bytes remain)" << std::endl;
+		std::cerr << "exported " << traceEvents.size() << " trace events" << std::endl;
+		return 0;
+	}
+
 	std::cout << "{\n";
 	std::cout << "\"ts\": [";
 	for(size_t i = 0; i < ts.size(); ++i)
@@ -1,10 +1,15 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <optional>
 
 #include <async/oneshot-event.hpp>
 #include <helix/memory.hpp>
 #include <protocols/mbus/client.hpp>
+#include <protocols/ostrace/ostrace.hpp>
 #include <svrctl.bragi.hpp>
 
 #include <CLI/CLI.hpp>
@@ -64,12 +69,53 @@ static std::vector<std::byte> readEntireFile(const char *path) {
 	return buffer;
 }
 
+// ----------------------------------------------------------------------------
+// Boot timeline.
+// ----------------------------------------------------------------------------
+
+protocols::ostrace::Context ostContext;
+protocols::ostrace::ItemId ostTimeItem;
+
+async::result<void> initTracing() {
+	ostContext = co_await protocols::ostrace::createContext();
+	if(!ostContext.isActive())
+		co_return;
+	ostTimeItem = co_await ostContext.announceItem("time");
+}
+
+// Emits a "boot.<component>: <name>" event with the duration as "time" item
+// (like the kernel does for its boot stages).
+struct BootPhase {
+	static async::result<BootPhase> start(std::string component, const std::string &name) {
+		BootPhase phase;
+		if(ostContext.isActive())
+			phase.id_ = co_await ostContext.announceEvent("boot." + component + ": " + name);
+		// Take the timestamp after announcing such that the IPC is not accounted to the phase.
+		HEL_CHECK(helGetClock(&phase.start_));
+		co_return phase;
+	}
+
+	async::result<void> finish() {
+		if(!ostContext.isActive())
+			co_return;
+		uint64_t end;
+		HEL_CHECK(helGetClock(&end));
+
+		protocols::ostrace::Event oste{&ostContext, id_};
+		oste.withCounter(ostTimeItem, static_cast<int64_t>(end - start_));
+		co_await oste.emit();
+	}
+
+private:
+	protocols::ostrace::EventId id_{};
+	uint64_t start_ = 0;
+};
+
 // ----------------------------------------------------------------------------
 // svrctl handling.
 // ----------------------------------------------------------------------------
 
-helix::UniqueLane svrctlLane;
-async::oneshot_event foundSvrctl;
+std::optional<mbus_ng::Entity> svrctlEntity;
 
 async::result<void> enumerateSvrctl() {
 	auto filter = mbus_ng::Conjunction({
@@ -80,11 +126,16 @@ async::result<void> enumerateSvrctl() {
 	auto [_, events] = (co_await enumerator.nextEvents()).unwrap();
 	assert(events.size() == 1);
 
-	auto entity = co_await mbus_ng::Instance::global().getEntity(events[0].id);
-	svrctlLane = (co_await entity.getRemoteLane()).unwrap();
+	svrctlEntity = co_await mbus_ng::Instance::global().getEntity(events[0].id);
 }
 
-async::result<helix::UniqueLane> runServer(const char *name) {
+// The kernel handles the requests on each svrctl lane one after another.
+// Hence, servers that are started concurrently use separate lanes.
+async::result<helix::UniqueLane> connectSvrctl() {
+	co_return (co_await svrctlEntity->getRemoteLane()).unwrap();
+}
+
+async::result<helix::UniqueLane> runServer(helix::UniqueLane &svrctlLane, const char *name) {
 	managarm::svrctl::CntRequest req;
 	req.set_req_type(managarm::svrctl::CntReqType::SVR_RUN);
 	req.set_name(name);
@@ -109,7 +160,7 @@ async::result<helix::UniqueLane> runServer(const char *name) {
 	co_return pull_server.descriptor();
 }
 
-async::result<void> uploadFile(const char *name) {
+async::result<void> uploadFile(helix::UniqueLane &svrctlLane, const char *name) {
 	std::vector<std::byte> buffer;
 
 	auto optimisticUpload = [&] () -> async::result<bool> {
@@ -195,6 +246,106 @@ async::result<int> bindServer(helix::UniqueLane &lane, int mbusId) {
 	 	co_return 1;
 }
 
+// ----------------------------------------------------------------------------
+// Server descriptions and dependencies.
+// ----------------------------------------------------------------------------
+
+managarm::svrctl::Description readDescription(const std::string &path) {
+	auto buffer = readEntireFile(path.c_str());
+
+	managarm::svrctl::Description desc;
+	bragi::limited_reader rd{buffer.data(), buffer.size()};
+	auto deser = bragi::deserializer{};
+	desc.decode_body(rd, deser);
+	return desc;
+}
+
+struct Service {
+	std::string path;
+	managarm::svrctl::Description desc;
+	std::vector<std::shared_ptr<Service>> dependencies;
+
+	// State of resolveDependencies().
+	bool resolving = false;
+	bool resolved = false;
+
+	bool launched = false;
+	async::oneshot_event running;
+	helix::UniqueLane controlLane;
+};
+
+// All services that were loaded by this process, indexed by name.
+std::map<std::string, std::shared_ptr<Service>> allServices;
+
+std::shared_ptr<Service> loadService(const std::string &path) {
+	auto desc = readDescription(path);
+	if(auto it = allServices.find(desc.name()); it != allServices.end())
+		return it->second;
+
+	auto service = std::make_shared<Service>();
+	service->path = path;
+	service->desc = std::move(desc);
+	allServices.insert({service->desc.name(), service});
+	return service;
+}
+
+// Loads the descriptions of all (transitive) dependencies.
+// This is done before any server is started such that cycles cannot cause deadlocks.
+void resolveDependencies(std::shared_ptr<Service> service) {
+	if(service->resolved)
+		return;
+	if(service->resolving) {
+		err("runsvr: Dependency cycle involving %s\n", service->desc.name().c_str());
+		abort();
+	}
+	service->resolving = true;
+
+	// Descriptions of dependencies are found in the same directory.
+	std::string dir;
+	if(auto slash = service->path.rfind('/'); slash != std::string::npos)
+		dir = service->path.substr(0, slash + 1);
+
+	for(auto &name : service->desc.dependencies()) {
+		auto dependency = loadService(dir + name + ".bin");
+		resolveDependencies(dependency);
+		service->dependencies.push_back(std::move(dependency));
+	}
+
+	service->resolving = false;
+	service->resolved = true;
+}
+
+async::result<void> startService(std::shared_ptr<Service> service);
+
+// Starts a service once all of its dependencies are running.
+// Services that do not depend on each other are started concurrently.
+void launchService(std::shared_ptr<Service> service) {
+	assert(service->resolved);
+	if(service->launched)
+		return;
+	service->launched = true;
+
+	for(auto &dependency : service->dependencies)
+		launchService(dependency);
+	async::detach(startService(std::move(service)));
+}
+
+async::result<void> startService(std::shared_ptr<Service> service) {
+	for(auto &dependency : service->dependencies)
+		co_await dependency->running.wait();
+
+	log("runsvr: Running %s\n", service->desc.name().c_str());
+	auto phase = co_await BootPhase::start("runsvr", service->desc.name());
+
+	auto lane = co_await connectSvrctl();
+	for(auto &file : service->desc.files())
+		co_await uploadFile(lane, file.path().c_str());
+
+	service->controlLane = co_await runServer(lane, service->desc.exec().c_str());
+	co_await phase.finish();
+	service->running.raise();
+}
+
 // ----------------------------------------------------------------
 // Freestanding mbus functions.
 // ----------------------------------------------------------------
@@ -203,58 +354,57 @@ enum class action {
 	runsvr, run, bind, upload
 };
 
-async::result<int> asyncMain(action act, std::string path) {
+async::result<int> asyncMain(action act, std::vector<std::string> paths) {
 	co_await enumerateSvrctl();
+	co_await initTracing();
 
 	switch (act) {
 		case action::runsvr: {
-			log("runsvr: Running %s\n", path.c_str());
-			co_await runServer(path.c_str());
+			log("runsvr: Running %s\n", paths[0].c_str());
+			auto phase = co_await BootPhase::start("runsvr", paths[0]);
+			auto lane = co_await connectSvrctl();
+			co_await runServer(lane, paths[0].c_str());
+			co_await phase.finish();
 
 			break;
 		}
 
 		case action::run: {
-			auto buffer = readEntireFile(path.c_str());
-
-			managarm::svrctl::Description desc;
-			bragi::limited_reader rd{buffer.data(), buffer.size()};
-			auto deser = bragi::deserializer{};
-			desc.decode_body(rd, deser);
-
-			log("runsvr: Running %s\n", desc.name().c_str());
-
-			for(auto &file : desc.files())
-				co_await uploadFile(file.path().c_str());
-
-			co_await runServer(desc.exec().c_str());
+			std::vector<std::shared_ptr<Service>> services;
+			for(auto &path : paths) {
+				auto service = loadService(path);
+				resolveDependencies(service);
+				services.push_back(std::move(service));
+			}
+
+			for(auto &service : services)
+				launchService(service);
+			for(auto &service : services)
+				co_await service->running.wait();
 
 			break;
 		}
 
 		case action::bind: {
-			auto buffer = readEntireFile(path.c_str());
-
-			managarm::svrctl::Description desc;
-			bragi::limited_reader rd{buffer.data(), buffer.size()};
-			auto deser = bragi::deserializer{};
-			desc.decode_body(rd, deser);
+			auto service = loadService(paths[0]);
+			resolveDependencies(service);
 
 			auto id_str = getenv("MBUS_ID");
-			log("runsvr: Binding driver %s to mbus ID %s\n", desc.name().c_str(), id_str);
-
-			for(auto &file : desc.files())
-				co_await uploadFile(file.path().c_str());
+			log("runsvr: Binding driver %s to mbus ID %s\n", service->desc.name().c_str(), id_str);
 
-			auto lane = co_await runServer(desc.exec().c_str());
-			co_await bindServer(lane, std::stoi(id_str));
+			launchService(service);
+			co_await service->running.wait();
+			auto phase = co_await BootPhase::start("bind", service->desc.name());
+			co_await bindServer(service->controlLane, std::stoi(id_str));
+			co_await phase.finish();
 
 			break;
 		}
 
 		case action::upload: {
-			log("runsvr: Uploading %s\n", path.c_str());
-			co_await uploadFile(path.c_str());
+			log("runsvr: Uploading %s\n", paths[0].c_str());
+			auto lane = co_await connectSvrctl();
+			co_await uploadFile(lane, paths[0].c_str());
 
 			break;
 		}
@@ -272,23 +422,24 @@ int main(int argc, const char **argv) {
 	heloutFd = open("/dev/helout", O_RDWR);
 
 	bool do_fork = false;
-	std::string path;
+	std::vector<std::string> paths;
 	action act;
 
 	CLI::App app{"runsvr"};
 	app.add_flag("-f,--fork", do_fork, "Fork off before continuing");
 
 	CLI::App *sub_runsvr = app.add_subcommand("runsvr", "Run a server (deprecated)");
-	sub_runsvr->add_option("path", path, "Path to executable")->required();
+	sub_runsvr->add_option("path", paths, "Path to executable")->required()->expected(1);
 
-	CLI::App *sub_run = app.add_subcommand("run", "Run a server (used in conjunction with bind)");
-	sub_run->add_option("path", path, "Path to description")->required();
+	CLI::App *sub_run = app.add_subcommand("run",
+			"Run servers and their dependencies (independent servers are started concurrently)");
+	sub_run->add_option("paths", paths, "Paths to descriptions")->required();
 
 	CLI::App *sub_bind = app.add_subcommand("bind", "Bind an mbus ID to a server");
-	sub_bind->add_option("path", path, "Path to description")->required();
+	sub_bind->add_option("path", paths, "Path to description")->required()->expected(1);
 
 	CLI::App *sub_upload = app.add_subcommand("upload", "Upload a file");
-	sub_upload->add_option("path", path, "Path to file")->required();
+	sub_upload->add_option("path", paths, "Path to file")->required()->expected(1);
 
 	app.require_subcommand(1);
 
@@ -319,5 +470,5 @@ int main(int argc, const char **argv) {
 		mbus_ng::recreateInstance();
 	}
 
-	return async::run(asyncMain(act, std::move(path)), helix::currentDispatcher);
+	return async::run(asyncMain(act, std::move(paths)), helix::currentDispatcher);
 }